@@ -0,0 +1,733 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+/* Standalone microbenchmarks for the containers in 'src/lib/public' and for 
+ * the math routines in 'src/pf_math.c'. Build and run with 'make bench'. 
+ * 
+ * Every benchmark is run a number of times with the same pseudo-random 
+ * inputs and the per-operation time of each run is recorded. The results 
+ * are written out as JSON so that they can be diffed between builds:
+ *
+ *     pf_bench [-o <file>] [-r <reps>] [<name filter>]
+ */
+
+#include "../src/pf_math.h"
+#include "../src/lib/public/khash.h"
+#include "../src/lib/public/vec.h"
+#include "../src/lib/public/queue.h"
+#include "../src/lib/public/pqueue.h"
+#include "../src/lib/public/mpool.h"
+#include "../src/lib/public/lru_cache.h"
+#include "../src/lib/public/quadtree.h"
+
+#include <SDL_timer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+#define DEFAULT_REPS    (7)
+#define MAX_REPS        (64)
+#define MAP_DIM         (4096.0f)
+#define NQUERIES        (1024)
+#define QUERY_DIM       (64.0f)
+#define LRU_CAP         (4096)
+#define NMATH_OPS       (1 << 20)
+#define MAX_RESULTS     (4096)
+
+struct bench{
+    const char *name;
+    size_t      n;
+    void      (*setup)(size_t n);
+    /* Returns the number of operations performed */
+    uint64_t  (*run)(size_t n);
+    void      (*teardown)(void);
+};
+
+KHASH_MAP_INIT_INT64(bench, uint64_t)
+
+VEC_TYPE(bench, uint64_t)
+VEC_PROTOTYPES(static, bench, uint64_t)
+VEC_IMPL(static, bench, uint64_t)
+
+QUEUE_TYPE(bench, uint64_t)
+QUEUE_PROTOTYPES(static, bench, uint64_t)
+QUEUE_IMPL(static, bench, uint64_t)
+
+PQUEUE_TYPE(bench, uint32_t)
+PQUEUE_PROTOTYPES(static, bench, uint32_t)
+PQUEUE_IMPL(static, bench, uint32_t)
+
+MPOOL_TYPE(bench, uint64_t)
+MPOOL_PROTOTYPES(static, bench, uint64_t)
+MPOOL_IMPL(static, bench, uint64_t)
+
+LRU_CACHE_TYPE(lbench, uint64_t)
+LRU_CACHE_PROTOTYPES(static, lbench, uint64_t)
+LRU_CACHE_IMPL(static, lbench, uint64_t)
+
+QUADTREE_TYPE(qbench, uint32_t)
+QUADTREE_PROTOTYPES(static, qbench, uint32_t)
+QUADTREE_IMPL(static, qbench, uint32_t)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static uint64_t          s_rng_state;
+/* Results are folded into the sink so that the work can't be optimized away */
+static volatile uint64_t s_sink;
+
+static uint64_t         *s_keys;
+static uint64_t         *s_miss_keys;
+static vec2_t           *s_points;
+static vec2_t           *s_queries;
+static mp_ref_t         *s_refs;
+
+static khash_t(bench)   *s_hash;
+static vec(bench)        s_vec;
+static queue(bench)      s_queue;
+static pq(bench)         s_pqueue;
+static mp(bench)         s_mpool;
+static lru(lbench)       s_lru;
+static qt(qbench)        s_qt;
+
+static mat4x4_t         *s_mats;
+static quat_t           *s_quats;
+static vec3_t           *s_vecs;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void rng_seed(void)
+{
+    s_rng_state = 0x9E3779B97F4A7C15ull;
+}
+
+static uint64_t rng_next(void)
+{
+    /* xorshift64* */
+    s_rng_state ^= s_rng_state >> 12;
+    s_rng_state ^= s_rng_state << 25;
+    s_rng_state ^= s_rng_state >> 27;
+    return s_rng_state * 2685821657736338717ull;
+}
+
+static float rng_float(float max)
+{
+    return (rng_next() >> 40) / (float)(1 << 24) * max;
+}
+
+static void *xmalloc(size_t size)
+{
+    void *ret = malloc(size);
+    if(!ret) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return ret;
+}
+
+static void gen_keys(size_t n)
+{
+    s_keys = xmalloc(n * sizeof(uint64_t));
+    s_miss_keys = xmalloc(n * sizeof(uint64_t));
+    for(size_t i = 0; i < n; i++) {
+        /* The two key sets are disjoint by their lowest bit */
+        s_keys[i] = rng_next() & ~((uint64_t)1);
+        s_miss_keys[i] = rng_next() | 1;
+    }
+}
+
+static void free_keys(void)
+{
+    free(s_keys);
+    free(s_miss_keys);
+    s_keys = s_miss_keys = NULL;
+}
+
+static bool qt_uid_equal(const uint32_t *a, const uint32_t *b)
+{
+    return (*a == *b);
+}
+
+/*--------------------------------------------------------------------------*/
+/* khash                                                                    */
+/*--------------------------------------------------------------------------*/
+
+static void hash_setup(size_t n)
+{
+    gen_keys(n);
+    s_hash = kh_init(bench);
+}
+
+static void hash_filled_setup(size_t n)
+{
+    hash_setup(n);
+    kh_resize(bench, s_hash, n);
+    for(size_t i = 0; i < n; i++) {
+        int status;
+        khiter_t k = kh_put(bench, s_hash, s_keys[i], &status);
+        kh_value(s_hash, k) = i;
+    }
+}
+
+static void hash_teardown(void)
+{
+    kh_destroy(bench, s_hash);
+    free_keys();
+}
+
+static uint64_t hash_insert(size_t n)
+{
+    for(size_t i = 0; i < n; i++) {
+        int status;
+        khiter_t k = kh_put(bench, s_hash, s_keys[i], &status);
+        kh_value(s_hash, k) = i;
+    }
+    s_sink += kh_size(s_hash);
+    kh_clear(bench, s_hash);
+    return n;
+}
+
+static uint64_t hash_lookup_hit(size_t n)
+{
+    uint64_t sum = 0;
+    for(size_t i = 0; i < n; i++) {
+        khiter_t k = kh_get(bench, s_hash, s_keys[i]);
+        sum += kh_value(s_hash, k);
+    }
+    s_sink += sum;
+    return n;
+}
+
+static uint64_t hash_lookup_miss(size_t n)
+{
+    uint64_t nfound = 0;
+    for(size_t i = 0; i < n; i++) {
+        khiter_t k = kh_get(bench, s_hash, s_miss_keys[i]);
+        nfound += (k != kh_end(s_hash));
+    }
+    s_sink += nfound;
+    return n;
+}
+
+/*--------------------------------------------------------------------------*/
+/* vec                                                                      */
+/*--------------------------------------------------------------------------*/
+
+static void vec_setup(size_t n)
+{
+    vec_bench_init(&s_vec);
+}
+
+static void vec_teardown(void)
+{
+    vec_bench_destroy(&s_vec);
+}
+
+static uint64_t vec_push_iterate(size_t n)
+{
+    vec_bench_reset(&s_vec);
+    for(size_t i = 0; i < n; i++) {
+        vec_bench_push(&s_vec, i);
+    }
+    uint64_t sum = 0;
+    for(int i = 0; i < vec_size(&s_vec); i++) {
+        sum += vec_AT(&s_vec, i);
+    }
+    s_sink += sum;
+    return n;
+}
+
+/*--------------------------------------------------------------------------*/
+/* queue                                                                    */
+/*--------------------------------------------------------------------------*/
+
+static void queue_setup(size_t n)
+{
+    queue_bench_init(&s_queue, 64);
+}
+
+static void queue_teardown(void)
+{
+    queue_bench_destroy(&s_queue);
+}
+
+static uint64_t queue_push_pop(size_t n)
+{
+    /* Keep a steady backlog, as the scheduler and event queues do */
+    uint64_t sum = 0;
+    for(uint64_t i = 0; i < 64; i++) {
+        queue_bench_push(&s_queue, &i);
+    }
+    for(uint64_t i = 0; i < n; i++) {
+        uint64_t out = 0;
+        queue_bench_push(&s_queue, &i);
+        queue_bench_pop(&s_queue, &out);
+        sum += out;
+    }
+    queue_bench_clear(&s_queue);
+    s_sink += sum;
+    return n;
+}
+
+/*--------------------------------------------------------------------------*/
+/* pqueue                                                                   */
+/*--------------------------------------------------------------------------*/
+
+static void pqueue_setup(size_t n)
+{
+    gen_keys(n);
+    pq_bench_init(&s_pqueue);
+}
+
+static void pqueue_teardown(void)
+{
+    pq_bench_destroy(&s_pqueue);
+    free_keys();
+}
+
+static uint64_t pqueue_push_pop(size_t n)
+{
+    for(size_t i = 0; i < n; i++) {
+        pq_bench_push(&s_pqueue, (float)(s_keys[i] >> 40), (uint32_t)i);
+    }
+    uint64_t sum = 0;
+    uint32_t out;
+    while(pq_bench_pop(&s_pqueue, &out)) {
+        sum += out;
+    }
+    s_sink += sum;
+    return 2 * n;
+}
+
+/*--------------------------------------------------------------------------*/
+/* mpool                                                                    */
+/*--------------------------------------------------------------------------*/
+
+static void mpool_setup(size_t n)
+{
+    gen_keys(n);
+    s_refs = xmalloc(n * sizeof(mp_ref_t));
+    mp_bench_init(&s_mpool, true);
+    mp_bench_reserve(&s_mpool, n);
+}
+
+static void mpool_teardown(void)
+{
+    mp_bench_destroy(&s_mpool);
+    free(s_refs);
+    free_keys();
+}
+
+static uint64_t mpool_alloc_free(size_t n)
+{
+    for(size_t i = 0; i < n; i++) {
+        s_refs[i] = mp_bench_alloc(&s_mpool);
+        *mp_bench_entry(&s_mpool, s_refs[i]) = i;
+    }
+    /* Free in a shuffled order to scramble the free list */
+    for(size_t i = 0; i < n; i++) {
+        size_t j = s_keys[i] % n;
+        mp_ref_t tmp = s_refs[i];
+        s_refs[i] = s_refs[j];
+        s_refs[j] = tmp;
+    }
+    for(size_t i = 0; i < n; i++) {
+        mp_bench_free(&s_mpool, s_refs[i]);
+    }
+    s_sink += s_mpool.num_allocd;
+    return 2 * n;
+}
+
+/*--------------------------------------------------------------------------*/
+/* lru_cache                                                                */
+/*--------------------------------------------------------------------------*/
+
+static void lru_setup(size_t n, enum lru_policy policy)
+{
+    gen_keys(n);
+    lru_lbench_init(&s_lru, LRU_CAP, NULL);
+    lru_lbench_set_policy(&s_lru, policy);
+    for(size_t i = 0; i < LRU_CAP; i++) {
+        lru_lbench_put(&s_lru, s_keys[i % n], &(uint64_t){i});
+    }
+}
+
+static void lru_setup_lru(size_t n)
+{
+    lru_setup(n, LRU_POLICY_LRU);
+}
+
+static void lru_setup_clock(size_t n)
+{
+    lru_setup(n, LRU_POLICY_CLOCK);
+}
+
+static void lru_teardown(void)
+{
+    lru_lbench_destroy(&s_lru);
+    free_keys();
+}
+
+static uint64_t lru_get_hit(size_t n)
+{
+    uint64_t sum = 0;
+    for(size_t i = 0; i < n; i++) {
+        uint64_t out = 0;
+        lru_lbench_get(&s_lru, s_keys[s_miss_keys[i] % LRU_CAP], &out);
+        sum += out;
+    }
+    s_sink += sum;
+    return n;
+}
+
+static uint64_t lru_put_evict(size_t n)
+{
+    for(size_t i = 0; i < n; i++) {
+        lru_lbench_put(&s_lru, s_miss_keys[i], &(uint64_t){i});
+    }
+    s_sink += s_lru.used;
+    return n;
+}
+
+/*--------------------------------------------------------------------------*/
+/* quadtree                                                                 */
+/*--------------------------------------------------------------------------*/
+
+/* The quadtree partitions its' region around the origin, like the map */
+static void qt_setup(size_t n)
+{
+    const float half = MAP_DIM / 2.0f;
+    s_points = xmalloc(n * sizeof(vec2_t));
+    s_queries = xmalloc(NQUERIES * sizeof(vec2_t));
+    for(size_t i = 0; i < n; i++) {
+        s_points[i] = (vec2_t){rng_float(MAP_DIM) - half, rng_float(MAP_DIM) - half};
+    }
+    for(size_t i = 0; i < NQUERIES; i++) {
+        s_queries[i] = (vec2_t){rng_float(MAP_DIM - QUERY_DIM) - half, 
+                                rng_float(MAP_DIM - QUERY_DIM) - half};
+    }
+    qt_qbench_init(&s_qt, -half, half, -half, half, qt_uid_equal);
+}
+
+static void qt_filled_setup(size_t n)
+{
+    qt_setup(n);
+    for(size_t i = 0; i < n; i++) {
+        qt_qbench_insert(&s_qt, s_points[i].x, s_points[i].z, (uint32_t)i);
+    }
+}
+
+static void qt_teardown(void)
+{
+    qt_qbench_destroy(&s_qt);
+    free(s_points);
+    free(s_queries);
+    s_points = s_queries = NULL;
+}
+
+static uint64_t qt_insert(size_t n)
+{
+    for(size_t i = 0; i < n; i++) {
+        qt_qbench_insert(&s_qt, s_points[i].x, s_points[i].z, (uint32_t)i);
+    }
+    s_sink += s_qt.nrecs;
+    qt_qbench_clear(&s_qt);
+    return n;
+}
+
+static uint64_t qt_insert_delete(size_t n)
+{
+    for(size_t i = 0; i < n; i++) {
+        qt_qbench_insert(&s_qt, s_points[i].x, s_points[i].z, (uint32_t)i);
+    }
+    for(size_t i = 0; i < n; i++) {
+        qt_qbench_delete(&s_qt, s_points[i].x, s_points[i].z, (uint32_t)i);
+    }
+    s_sink += s_qt.nrecs;
+    return 2 * n;
+}
+
+static uint64_t qt_range_query(size_t n)
+{
+    static uint32_t results[MAX_RESULTS];
+    uint64_t nresults = 0;
+    for(size_t i = 0; i < NQUERIES; i++) {
+        const vec2_t *q = &s_queries[i];
+        nresults += qt_qbench_inrange_rect(&s_qt, q->x, q->x + QUERY_DIM, 
+            q->z, q->z + QUERY_DIM, results, ARR_SIZE(results));
+    }
+    s_sink += nresults;
+    return NQUERIES;
+}
+
+/*--------------------------------------------------------------------------*/
+/* pf_math                                                                  */
+/*--------------------------------------------------------------------------*/
+
+static void math_setup(size_t n)
+{
+    s_mats = xmalloc(n * sizeof(mat4x4_t));
+    s_quats = xmalloc(n * sizeof(quat_t));
+    s_vecs = xmalloc(n * sizeof(vec3_t));
+
+    for(size_t i = 0; i < n; i++) {
+        vec3_t trans = (vec3_t){rng_float(100.0f), rng_float(100.0f), rng_float(100.0f)};
+        vec3_t scale = (vec3_t){1.0f + rng_float(1.0f), 1.0f + rng_float(1.0f), 1.0f + rng_float(1.0f)};
+        quat_t rot = (quat_t){rng_float(1.0f), rng_float(1.0f), rng_float(1.0f), 1.0f};
+        PFM_Quat_Normal(&rot, &rot);
+        PFM_Mat4x4_MakeTRS(&trans, &rot, &scale, &s_mats[i]);
+        s_quats[i] = rot;
+        s_vecs[i] = trans;
+    }
+}
+
+static void math_teardown(void)
+{
+    free(s_mats);
+    free(s_quats);
+    free(s_vecs);
+}
+
+static uint64_t math_mat4_mult(size_t n)
+{
+    mat4x4_t acc;
+    PFM_Mat4x4_Identity(&acc);
+    for(size_t i = 0; i < NMATH_OPS; i++) {
+        mat4x4_t tmp;
+        PFM_Mat4x4_Mult4x4(&s_mats[i % n], &acc, &tmp);
+        /* Keep the accumulator bounded */
+        acc = (i % 8 == 7) ? s_mats[(i + 1) % n] : tmp;
+    }
+    s_sink += (uint64_t)acc.cols[3][0];
+    return NMATH_OPS;
+}
+
+static uint64_t math_mat4_mult_vec(size_t n)
+{
+    float sum = 0.0f;
+    for(size_t i = 0; i < NMATH_OPS; i++) {
+        vec4_t in = (vec4_t){s_vecs[i % n].x, s_vecs[i % n].y, s_vecs[i % n].z, 1.0f};
+        vec4_t out;
+        PFM_Mat4x4_Mult4x1(&s_mats[(i * 7) % n], &in, &out);
+        sum += out.x;
+    }
+    s_sink += (uint64_t)sum;
+    return NMATH_OPS;
+}
+
+static uint64_t math_mat4_inverse(size_t n)
+{
+    float sum = 0.0f;
+    for(size_t i = 0; i < NMATH_OPS; i++) {
+        mat4x4_t out;
+        PFM_Mat4x4_Inverse(&s_mats[i % n], &out);
+        sum += out.cols[3][0];
+    }
+    s_sink += (uint64_t)sum;
+    return NMATH_OPS;
+}
+
+static uint64_t math_quat_mult(size_t n)
+{
+    quat_t acc = s_quats[0];
+    for(size_t i = 0; i < NMATH_OPS; i++) {
+        quat_t tmp;
+        PFM_Quat_MultQuat(&acc, &s_quats[i % n], &tmp);
+        PFM_Quat_Normal(&tmp, &acc);
+    }
+    s_sink += (uint64_t)(acc.w * 1000.0f);
+    return NMATH_OPS;
+}
+
+static uint64_t math_quat_to_mat(size_t n)
+{
+    float sum = 0.0f;
+    for(size_t i = 0; i < NMATH_OPS; i++) {
+        mat4x4_t out;
+        PFM_Mat4x4_RotFromQuat(&s_quats[i % n], &out);
+        sum += out.cols[0][0];
+    }
+    s_sink += (uint64_t)sum;
+    return NMATH_OPS;
+}
+
+static uint64_t math_vec3_cross_normal(size_t n)
+{
+    float sum = 0.0f;
+    for(size_t i = 0; i < NMATH_OPS; i++) {
+        vec3_t cross, norm;
+        PFM_Vec3_Cross(&s_vecs[i % n], &s_vecs[(i + 1) % n], &cross);
+        PFM_Vec3_Normal(&cross, &norm);
+        sum += norm.x;
+    }
+    s_sink += (uint64_t)sum;
+    return NMATH_OPS;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static const struct bench s_benches[] = {
+    {"khash.insert",            1024,   hash_setup,         hash_insert,        hash_teardown},
+    {"khash.insert",            65536,  hash_setup,         hash_insert,        hash_teardown},
+    {"khash.lookup_hit",        1024,   hash_filled_setup,  hash_lookup_hit,    hash_teardown},
+    {"khash.lookup_hit",        65536,  hash_filled_setup,  hash_lookup_hit,    hash_teardown},
+    {"khash.lookup_miss",       1024,   hash_filled_setup,  hash_lookup_miss,   hash_teardown},
+    {"khash.lookup_miss",       65536,  hash_filled_setup,  hash_lookup_miss,   hash_teardown},
+    {"vec.push_iterate",        65536,  vec_setup,          vec_push_iterate,   vec_teardown},
+    {"queue.push_pop",          65536,  queue_setup,        queue_push_pop,     queue_teardown},
+    {"pqueue.push_pop",         1024,   pqueue_setup,       pqueue_push_pop,    pqueue_teardown},
+    {"pqueue.push_pop",         65536,  pqueue_setup,       pqueue_push_pop,    pqueue_teardown},
+    {"mpool.alloc_free",        65536,  mpool_setup,        mpool_alloc_free,   mpool_teardown},
+    {"lru.get_hit",             65536,  lru_setup_lru,      lru_get_hit,        lru_teardown},
+    {"lru.get_hit_clock",       65536,  lru_setup_clock,    lru_get_hit,        lru_teardown},
+    {"lru.put_evict",           65536,  lru_setup_lru,      lru_put_evict,      lru_teardown},
+    {"lru.put_evict_clock",     65536,  lru_setup_clock,    lru_put_evict,      lru_teardown},
+    {"quadtree.insert",         10000,  qt_setup,           qt_insert,          qt_teardown},
+    {"quadtree.insert",         100000, qt_setup,           qt_insert,          qt_teardown},
+    {"quadtree.insert_delete",  10000,  qt_setup,           qt_insert_delete,   qt_teardown},
+    {"quadtree.insert_delete",  100000, qt_setup,           qt_insert_delete,   qt_teardown},
+    {"quadtree.range_query",    10000,  qt_filled_setup,    qt_range_query,     qt_teardown},
+    {"quadtree.range_query",    100000, qt_filled_setup,    qt_range_query,     qt_teardown},
+    {"math.mat4_mult",          1024,   math_setup,         math_mat4_mult,     math_teardown},
+    {"math.mat4_mult_vec4",     1024,   math_setup,         math_mat4_mult_vec, math_teardown},
+    {"math.mat4_inverse",       1024,   math_setup,         math_mat4_inverse,  math_teardown},
+    {"math.quat_mult",          1024,   math_setup,         math_quat_mult,     math_teardown},
+    {"math.quat_to_mat4",       1024,   math_setup,         math_quat_to_mat,   math_teardown},
+    {"math.vec3_cross_normal",  1024,   math_setup,         math_vec3_cross_normal, math_teardown},
+};
+
+static int compare_double(const void *a, const void *b)
+{
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static void run_bench(const struct bench *b, int reps, FILE *out, bool first)
+{
+    double ns_per_op[MAX_REPS];
+    uint64_t nops = 0;
+    double hz = SDL_GetPerformanceFrequency();
+
+    rng_seed();
+    b->setup(b->n);
+
+    /* One untimed run to warm up the caches and the allocator */
+    b->run(b->n);
+
+    for(int i = 0; i < reps; i++) {
+        uint64_t begin = SDL_GetPerformanceCounter();
+        nops = b->run(b->n);
+        uint64_t end = SDL_GetPerformanceCounter();
+        ns_per_op[i] = (end - begin) * 1e9 / hz / nops;
+    }
+    b->teardown();
+
+    qsort(ns_per_op, reps, sizeof(double), compare_double);
+    double mean = 0.0;
+    for(int i = 0; i < reps; i++) {
+        mean += ns_per_op[i] / reps;
+    }
+
+    fprintf(out, "%s\n    {\"name\":\"%s\",\"n\":%zu,\"ops\":%llu,\"reps\":%d,"
+        "\"min_ns\":%.3f,\"median_ns\":%.3f,\"mean_ns\":%.3f,\"max_ns\":%.3f}",
+        first ? "" : ",", b->name, b->n, (unsigned long long)nops, reps,
+        ns_per_op[0], ns_per_op[reps / 2], mean, ns_per_op[reps - 1]);
+    fflush(out);
+
+    fprintf(stderr, "%-26s n=%-7zu median: %10.3f ns/op\n", b->name, b->n, ns_per_op[reps / 2]);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-o <file>] [-r <reps>] [<name filter>]\n", prog);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    const char *outpath = NULL;
+    const char *filter = NULL;
+    int reps = DEFAULT_REPS;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outpath = argv[++i];
+        }else if(!strcmp(argv[i], "-r") && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        }else if(argv[i][0] == '-') {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }else {
+            filter = argv[i];
+        }
+    }
+    if(reps < 1 || reps > MAX_REPS) {
+        fprintf(stderr, "The number of repetitions must be in the range [1, %d]\n", MAX_REPS);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = outpath ? fopen(outpath, "w") : stdout;
+    if(!out) {
+        fprintf(stderr, "Could not open '%s' for writing\n", outpath);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "{\"benchmarks\":[");
+    bool first = true;
+    for(int i = 0; i < ARR_SIZE(s_benches); i++) {
+        if(filter && !strstr(s_benches[i].name, filter))
+            continue;
+        run_bench(&s_benches[i], reps, out, first);
+        first = false;
+    }
+    fprintf(out, "\n]}\n");
+
+    if(outpath) {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
+
@@ -77,31 +77,111 @@ class PerfStatsWindow(pf.Window):
         self.layout_row_dynamic(20, 1)
         self.label_colored_wrap("Vendor: %s" % render_info["vendor"], (255, 255, 255))
 
+    def render_stats_tab(self):
+        render_stats = pf.get_render_stats()
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Commands]   Count: {cmds:05d}   Args: {kb} KB" \
+            .format(cmds=render_stats["commands"], kb=render_stats["arg_bytes"] // 1024), \
+            (0, 255, 0))
+
+        passes = [("total", render_stats["total"])] \
+               + [(name, render_stats["passes"][name]) for name in \
+                  ("main", "shadow", "refraction", "reflection", "minimap", "ui")]
+        for name, stats in passes:
+            self.layout_row_dynamic(20, 1)
+            self.label_colored_wrap("[{name}]   Draws: {draws:04d} (+{ind:04d} indirect)   Instances: {inst:05d}   Tris: {tris:07d}   Programs: {progs:03d}   Textures: {texs:04d}   Upload: {kb} KB" \
+                .format(name=name.capitalize(), draws=stats["draws"], ind=stats["indirect"], 
+                inst=stats["instances"], tris=stats["tris"], progs=stats["prog_binds"], 
+                texs=stats["tex_binds"], kb=stats["upload_bytes"] // 1024), \
+                (0, 255, 0))
+
     def nav_stats_tab(self):
         nav_stats = pf.get_nav_perfstats()
 
         self.layout_row_dynamic(20, 1)
-        self.label_colored_wrap("[LOS Field Cache]   Used: {used:04d}/{cap:04d}  Hit Rate: {hr:02.03f} Invalidated: {inv:04d}" \
+        self.label_colored_wrap("[LOS Field Cache]   Used: {used:04d}/{cap:04d}  Hit Rate: {hr:02.03f} Evicted: {ev:04d} Invalidated: {inv:04d}" \
             .format(used=nav_stats["los_used"], cap=nav_stats["los_max"], 
-            hr=nav_stats["los_hit_rate"], inv=nav_stats["los_invalidated"]), \
+            hr=nav_stats["los_hit_rate"], ev=nav_stats["los_evicted"], inv=nav_stats["los_invalidated"]), \
             (0, 255, 0))
 
         self.layout_row_dynamic(20, 1)
-        self.label_colored_wrap("[Flow Field Cache]   Used: {used:04d}/{cap:04d}   Hit Rate: {hr:02.03f} Invalidated: {inv:04d}" \
+        self.label_colored_wrap("[Flow Field Cache]   Used: {used:04d}/{cap:04d}   Hit Rate: {hr:02.03f} Evicted: {ev:04d} Invalidated: {inv:04d}" \
             .format(used=nav_stats["flow_used"], cap=nav_stats["flow_max"], 
-            hr=nav_stats["flow_hit_rate"], inv=nav_stats["flow_invalidated"]), \
+            hr=nav_stats["flow_hit_rate"], ev=nav_stats["flow_evicted"], inv=nav_stats["flow_invalidated"]), \
             (0, 255, 0))
 
         self.layout_row_dynamic(20, 1)
-        self.label_colored_wrap("[Dest:Field Mapping Cache] Used: {used:04d}/{cap:04d}   Hit Rate: {hr:02.03f}" \
-            .format(used=nav_stats["ffid_used"], cap=nav_stats["ffid_max"], hr=nav_stats["ffid_hit_rate"]), \
+        self.label_colored_wrap("[Dest:Field Mapping Cache] Used: {used:04d}/{cap:04d}   Hit Rate: {hr:02.03f} Evicted: {ev:04d}" \
+            .format(used=nav_stats["ffid_used"], cap=nav_stats["ffid_max"], hr=nav_stats["ffid_hit_rate"], 
+            ev=nav_stats["ffid_evicted"]), \
             (0, 255, 0))
 
         self.layout_row_dynamic(20, 1)
-        self.label_colored_wrap("[Grid Path Cache] Used: {used:04d}/{cap:04d}   Hit Rate: {hr:02.03f}" \
-            .format(used=nav_stats["grid_path_used"], cap=nav_stats["grid_path_max"], hr=nav_stats["grid_path_hit_rate"]), \
+        self.label_colored_wrap("[Grid Path Cache] Used: {used:04d}/{cap:04d} ({kb}/{maxkb} KB)   Hit Rate: {hr:02.03f} Evicted: {ev:04d}" \
+            .format(used=nav_stats["grid_path_used"], cap=nav_stats["grid_path_max"], 
+            kb=nav_stats["grid_path_bytes"] // 1024, maxkb=nav_stats["grid_path_max_bytes"] // 1024,
+            hr=nav_stats["grid_path_hit_rate"], ev=nav_stats["grid_path_evicted"]), \
             (0, 255, 0))
 
+    def percentiles_tab(self):
+        percentiles = pf.get_frame_percentiles()
+        for name, label in [("frame", "Frame"), ("sim", "Simulation"), ("render", "Render Thread")]:
+            pct = percentiles[name]
+            self.layout_row_dynamic(20, 1)
+            self.label_colored_wrap("[{label}]   p50: {p50:.2f} ms   p95: {p95:.2f} ms   p99: {p99:.2f} ms   Max: {max:.2f} ms" \
+                .format(label=label, p50=pct["p50_ms"], p95=pct["p95_ms"], p99=pct["p99_ms"], max=pct["max_ms"]), \
+                (0, 255, 0))
+
+        self.layout_row_dynamic(30, 1)
+        self.button_label("Reset", pf.reset_frame_percentiles)
+
+    def sched_stats_tab(self):
+        sched_stats = pf.get_sched_perfstats()
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Tasks]   Live: {live:04d}   Created: {created:04d}   Switches: {sw:05d}   Steals: {steals:04d}   Missed Deadlines: {missed:04d}" \
+            .format(live=sched_stats["ntasks_live"], created=sched_stats["ntasks_created"], 
+            sw=sched_stats["nswitches"], steals=sched_stats["nsteals"], missed=sched_stats["ndeadline_misses"]), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Ready Queue]   Max Depth: {depth:04d}   Wait: {wait:.3f} ms   Max Wait: {maxwait:.3f} ms" \
+            .format(depth=sched_stats["max_queue_depth"], wait=sched_stats["ready_wait_ms"], 
+            maxwait=sched_stats["ready_wait_max_ms"]), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Blocked]   Messages: {msg:.3f} ms   Events: {ev:.3f} ms" \
+            .format(msg=sched_stats["blocked_msg_ms"], ev=sched_stats["blocked_event_ms"]), \
+            (0, 255, 0))
+
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Stacks]   Live: {live:04d} (Max: {hwm:04d})   Big Live: {blive:02d} (Max: {bhwm:02d})" \
+            .format(live=sched_stats["stacks_live"], hwm=sched_stats["stacks_live_hwm"], 
+            blive=sched_stats["big_stacks_live"], bhwm=sched_stats["big_stacks_live_hwm"]), \
+            (0, 255, 0))
+
+        tick_ms = max(sched_stats["tick_ms"], 0.001)
+        self.layout_row_dynamic(20, 1)
+        self.label_colored_wrap("[Main Thread]   Busy: {busy:.3f} ms" \
+            .format(busy=sched_stats["main_busy_ms"]), (0, 255, 0))
+
+        for i, busy in enumerate(sched_stats["worker_busy_ms"]):
+            self.layout_row_dynamic(20, 1)
+            self.label_colored_wrap("[Worker {idx:02d}]   Busy: {busy:.3f} ms ({pct:.1f}%)" \
+                .format(idx=i, busy=busy, pct=100.0 * busy / tick_ms), (0, 255, 0))
+
+    def mem_stats_tab(self):
+        mem_stats = pf.get_mem_stats()
+        for name in sorted(mem_stats.keys()):
+            stats = mem_stats[name]
+            self.layout_row_dynamic(20, 1)
+            self.label_colored_wrap("[{name}]   Live: {live} KB   Peak: {peak} KB   Allocs: {allocs:07d}   Frees: {frees:07d}   Allocs/Tick: {tick:04d}" \
+                .format(name=name, live=stats["live_bytes"] // 1024, peak=stats["peak_bytes"] // 1024,
+                allocs=stats["nallocs"], frees=stats["nfrees"], tick=stats["tick_allocs"]), \
+                (0, 255, 0))
+
     def threads_tab(self):
         for name in self.frame_perfstats[self.tickindex]:
             t_frame_times = [0] * 100
@@ -173,5 +253,9 @@ class PerfStatsWindow(pf.Window):
         self.tree(pf.NK_TREE_TAB, "Frame Performance", pf.NK_MINIMIZED, self.frame_perf_tab)
         self.tree(pf.NK_TREE_TAB, "Threads", pf.NK_MINIMIZED, self.threads_tab)
         self.tree(pf.NK_TREE_TAB, "Renderer Info", pf.NK_MINIMIZED, self.render_info_tab)
+        self.tree(pf.NK_TREE_TAB, "Renderer Stats", pf.NK_MINIMIZED, self.render_stats_tab)
         self.tree(pf.NK_TREE_TAB, "Navigation Stats", pf.NK_MINIMIZED, self.nav_stats_tab)
+        self.tree(pf.NK_TREE_TAB, "Frame Time Percentiles", pf.NK_MINIMIZED, self.percentiles_tab)
+        self.tree(pf.NK_TREE_TAB, "Scheduler Stats", pf.NK_MINIMIZED, self.sched_stats_tab)
+        self.tree(pf.NK_TREE_TAB, "Memory Stats", pf.NK_MINIMIZED, self.mem_stats_tab)
 
@@ -192,6 +192,7 @@ class Map(object):
         if self.filename is not None:
             with open(self.filename, "w") as mapfile:
                 mapfile.write(self.pfmap_str())
+            pf.bake_map_nav_data(self.filename, absolute=True)
 
     def update_tile_mat(self, tile_coords, top_material, blend_mode, blend_normals):
 
@@ -243,8 +244,9 @@ class Map(object):
 
     @classmethod
     def from_filepath(cls, filepath):
-        with open(filepath, "r") as mapfile:
-            mapdata = mapfile.read()
+        with open(filepath, "rb") as mapfile:
+            # Skip over any precomputed navigation data following the tiles 
+            mapdata = mapfile.read().split(b"\nnavdata ")[0].decode("ascii")
             ret = Map.from_string(mapdata)
             ret.filename = filepath
             return ret
@@ -0,0 +1,119 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2023 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+# Headless pathfinding benchmark. Loads a map, times building its' navigation 
+# data and a batch of path, LOS and surround queries over it, and writes the 
+# results out as JSON. Run it with:
+#
+#     ./bin/pf ./ scripts/nav_bench.py --bench=1
+#
+# The run is configured through the following environment variables:
+#
+#     NAV_BENCH_MAP       map file in 'assets/maps' (default: demo.pfmap)
+#     NAV_BENCH_PATHS     number of random source/destination pairs (default: 1000)
+#     NAV_BENCH_SEED      seed for picking the pairs (default: 1)
+#     NAV_BENCH_PAIRS     JSON file with recorded [[[x, z], [x, z]], ...] pairs to replay instead
+#     NAV_BENCH_OUT       output path (default: nav_bench.json)
+
+import pf
+import os
+import sys
+import json
+import random
+
+MAP = os.environ.get("NAV_BENCH_MAP", "demo.pfmap")
+NPATHS = int(os.environ.get("NAV_BENCH_PATHS", "1000"))
+SEED = int(os.environ.get("NAV_BENCH_SEED", "1"))
+PAIRS = os.environ.get("NAV_BENCH_PAIRS")
+OUT = os.environ.get("NAV_BENCH_OUT", "nav_bench.json")
+
+NTARGETS = 16
+# The unit radii of the navigation layers that are benchmarked
+RADII = {"ground_1x1": 0.0, "ground_3x3": 3.0}
+
+def random_map_points(n):
+    # There is no query for the map dimensions, so sample within the 
+    # bounds of the largest maps and keep the points that land on it.
+    extent = 16 * pf.TILES_PER_CHUNK_WIDTH * pf.X_COORDS_PER_TILE
+    rng = random.Random(SEED)
+    ret = []
+    for i in range(n * 1000):
+        if len(ret) == n:
+            break
+        x = rng.uniform(-extent, extent)
+        z = rng.uniform(-extent, extent)
+        if pf.map_height_at_point(x, z) is None:
+            continue
+        xz = pf.map_nearest_pathable((x, z))
+        if xz is not None:
+            ret.append(xz)
+    return ret
+
+def spawn_targets():
+    targets = []
+    for xz in random_map_points(NTARGETS):
+        ent = pf.Entity("assets/models/barrel", "barrel.pfobj", "nav_bench_target")
+        ent.pos = (xz[0], pf.map_height_at_point(*xz), xz[1])
+        targets.append(ent)
+    return targets
+
+def load_pairs():
+    if PAIRS is None:
+        return None
+    with open(PAIRS, "r") as f:
+        return [(tuple(src), tuple(dest)) for src, dest in json.load(f)]
+
+def run():
+    pf.load_map("assets/maps", MAP)
+    targets = spawn_targets()
+    pairs = load_pairs()
+
+    results = {"map": MAP, "seed": SEED, "layers": {}}
+    for name, radius in sorted(RADII.items()):
+        results["layers"][name] = pf.nav_benchmark(npaths=NPATHS, seed=SEED, 
+            radius=radius, targets=targets, pairs=pairs)
+        path = results["layers"][name]["latency"]["path"]
+        print("{0}: {1} paths, p50 {2:.1f} us, p99 {3:.1f} us".format(
+            name, path["samples"], path["p50_us"], path["p99_us"]))
+
+    with open(OUT, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+    print("Wrote navigation benchmark results to: " + OUT)
+
+def on_tick(user, event):
+    pf.global_event(pf.SDL_QUIT, None)
+
+run()
+pf.register_event_handler(pf.EVENT_UPDATE_START, on_tick, None)
@@ -0,0 +1,199 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2023 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+# Session save/load benchmark. Loads a map, populates it with entities and a 
+# large script-defined state (using the kinds of objects exercised by 
+# 'test_pickle.py'), times pickling that state directly, then saves the 
+# session and loads it back. The per-section times and sizes reported by the 
+# engine are written out as JSON. Run it with:
+#
+#     ./bin/pf ./ scripts/save_bench.py
+#
+# The run is configured through the following environment variables:
+#
+#     SAVE_BENCH_MAP      map file in 'assets/maps' (default: demo.pfmap)
+#     SAVE_BENCH_ENTS     number of entities to spawn (default: 2000)
+#     SAVE_BENCH_OBJS     number of script objects in the world state (default: 20000)
+#     SAVE_BENCH_ITERS    number of times to pickle and unpickle the state (default: 5)
+#     SAVE_BENCH_SEED     seed for placing the entities (default: 1)
+#     SAVE_BENCH_FILE     session file to save to and load from (default: save_bench.pfsave)
+#     SAVE_BENCH_OUT      output path (default: save_bench.json)
+
+import pf
+import os
+import sys
+import json
+import time
+import random
+
+MAP = os.environ.get("SAVE_BENCH_MAP", "demo.pfmap")
+NENTS = int(os.environ.get("SAVE_BENCH_ENTS", "2000"))
+NOBJS = int(os.environ.get("SAVE_BENCH_OBJS", "20000"))
+NITERS = int(os.environ.get("SAVE_BENCH_ITERS", "5"))
+SEED = int(os.environ.get("SAVE_BENCH_SEED", "1"))
+SAVEFILE = os.environ.get("SAVE_BENCH_FILE", "save_bench.pfsave")
+OUT = os.environ.get("SAVE_BENCH_OUT", "save_bench.json")
+
+class Record(object):
+    def __init__(self, idx, rng):
+        self.idx = idx
+        self.name = "record_%d" % idx
+        self.value = rng.random()
+        self.tags = set(rng.sample(xrange(64), 4))
+        self.history = [rng.randint(0, 1 << 20) for i in range(8)]
+        self.attrs = {"pos": (rng.uniform(-1, 1), rng.uniform(-1, 1)), "big": long(idx) << 40}
+
+def counter(start):
+    while True:
+        yield start
+        start += 1
+
+def build_world_state(rng):
+    records = [Record(i, rng) for i in range(NOBJS)]
+    index = dict((r.name, r) for r in records)
+    # Cross-references between the objects, so that the pickler has to 
+    # deal with shared and self-referencing objects
+    for r in records:
+        r.neighbour = records[rng.randrange(len(records))]
+    return {
+        "records": records,
+        "index": index,
+        "blob": bytearray(rng.getrandbits(8) for i in range(256 * 1024)),
+        "text": u"".join(unichr(0x41 + (i % 26)) for i in range(64 * 1024)),
+        "counter": counter(0),
+        "callbacks": [lambda x, i=i: x + i for i in range(256)],
+    }
+
+world_state = None
+results = {}
+
+def random_map_points(n, rng):
+    extent = 16 * pf.TILES_PER_CHUNK_WIDTH * pf.X_COORDS_PER_TILE
+    ret = []
+    for i in range(n * 1000):
+        if len(ret) == n:
+            break
+        x = rng.uniform(-extent, extent)
+        z = rng.uniform(-extent, extent)
+        if pf.map_height_at_point(x, z) is None:
+            continue
+        xz = pf.map_nearest_pathable((x, z))
+        if xz is not None:
+            ret.append(xz)
+    return ret
+
+def spawn_entities(rng):
+    ents = []
+    for xz in random_map_points(NENTS, rng):
+        ent = pf.Entity("assets/models/barrel", "barrel.pfobj", "save_bench_barrel")
+        ent.pos = (xz[0], pf.map_height_at_point(*xz), xz[1])
+        ents.append(ent)
+    return ents
+
+def time_pickling(obj):
+    pickle_ms, unpickle_ms = [], []
+    for i in range(NITERS):
+        start = time.time()
+        s = pf.pickle_object(obj)
+        pickle_ms.append((time.time() - start) * 1000.0)
+        start = time.time()
+        pf.unpickle_object(s)
+        unpickle_ms.append((time.time() - start) * 1000.0)
+    return {
+        "bytes": len(s),
+        "pickle_ms": {"mean": sum(pickle_ms) / len(pickle_ms), "min": min(pickle_ms)},
+        "unpickle_ms": {"mean": sum(unpickle_ms) / len(unpickle_ms), "min": min(unpickle_ms)},
+    }
+
+def write_results():
+    with open(OUT, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+
+def print_profile(kind, profile):
+    print("{0}: {1:.1f} ms, {2} bytes".format(kind, profile["total_ms"], profile["file_bytes"]))
+    for section in profile["sections"]:
+        print("    {0}{1:<16} {2:10.2f} ms {3:12d} bytes".format("  " * section["depth"], 
+            section["name"], section["ms"], section["bytes"]))
+
+def on_tick(user, event):
+    # The session is only saved once the scene has been fully set up
+    pf.unregister_event_handler(pf.EVENT_UPDATE_START, on_tick)
+    results["save_requested"] = time.time()
+    pf.save_session(SAVEFILE)
+
+def on_saved(user, event):
+    # Note that the session is captured before this handler runs, so the 
+    # results are passed on to the loaded session through the output file.
+    results["save_e2e_ms"] = (time.time() - results.pop("save_requested")) * 1000.0
+    results["save"] = pf.session_profile(True)
+    print_profile("save", results["save"])
+    results["load_requested"] = time.time()
+    write_results()
+    pf.load_session(SAVEFILE)
+
+def on_loaded(user, event):
+    global results
+    with open(OUT, "r") as f:
+        results = json.load(f)
+    results["load_e2e_ms"] = (time.time() - results.pop("load_requested")) * 1000.0
+    results["load"] = pf.session_profile(False)
+    print_profile("load", results["load"])
+    write_results()
+    print("Wrote save/load benchmark results to: " + OUT)
+    pf.global_event(pf.SDL_QUIT, None)
+
+def on_failed(user, event):
+    print("Session save/load failed: " + str(event))
+    pf.global_event(pf.SDL_QUIT, None)
+
+def run():
+    global world_state
+    rng = random.Random(SEED)
+    pf.load_map("assets/maps", MAP)
+    spawn_entities(rng)
+    world_state = build_world_state(rng)
+
+    results.update({"map": MAP, "entities": NENTS, "objects": NOBJS, "seed": SEED})
+    results["pickle"] = time_pickling(world_state)
+    print("pickle: {0} bytes, {1:.1f} ms, unpickle: {2:.1f} ms".format(results["pickle"]["bytes"], 
+        results["pickle"]["pickle_ms"]["mean"], results["pickle"]["unpickle_ms"]["mean"]))
+
+    pf.register_event_handler(pf.EVENT_SESSION_SAVED, on_saved, None)
+    pf.register_event_handler(pf.EVENT_SESSION_LOADED, on_loaded, None)
+    pf.register_event_handler(pf.EVENT_SESSION_FAIL_SAVE, on_failed, None)
+    pf.register_event_handler(pf.EVENT_SESSION_FAIL_LOAD, on_failed, None)
+    pf.register_event_handler(pf.EVENT_UPDATE_START, on_tick, None)
+
+run()
@@ -143,6 +143,9 @@ def start_war(user, event):
 
     if event[0] != pf.SDL_SCANCODE_W:
         return
+    declare_war()
+
+def declare_war():
 
     global war_on, red_army_units, blue_army_units
     if war_on:
@@ -171,9 +174,20 @@ setup_scene()
 setup_armies()
 fixup_anim_combatable()
 
-perf_stats_win = psw.PerfStatsWindow()
-perf_stats_win.show()
-
-pf.register_event_handler(pf.SDL_KEYDOWN, start_war, None)
-pf.register_ui_event_handler(pf.SDL_KEYDOWN, toggle_pause, None)
+# When run with '--bench=<ticks>', the engine steps the simulation headless 
+# and writes out the subsystem timings. Start the fight right away, as there 
+# is no one to press a key.
+if "--bench" in sys.argv:
+    declare_war()
+# When run with '--render_bench=<frames>', the engine flies the camera over 
+# the scene once it has been paused. Keep the armies standing so that every 
+# run renders the same frames.
+elif "--render_bench" in sys.argv:
+    pass
+else:
+    perf_stats_win = psw.PerfStatsWindow()
+    perf_stats_win.show()
+
+    pf.register_event_handler(pf.SDL_KEYDOWN, start_war, None)
+    pf.register_ui_event_handler(pf.SDL_KEYDOWN, toggle_pause, None)
 
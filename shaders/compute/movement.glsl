@@ -35,15 +35,30 @@
 
 #version 430 core
 
+#define X_COORDS_PER_TILE           (8)
+#define Z_COORDS_PER_TILE           (8)
+
+#define ENTITY_FLAG_MOVABLE         (1u << 3)
+#define ENTITY_FLAG_AIR             (1u << 15)
+#define ENTITY_FLAG_GARRISONED      (1u << 18)
+
+#define EPSILON                     (1.0/1024)
+#define MAX_FORCE                   (0.75)
+#define SEPARATION_NEIGHB_RADIUS    (30.0)
+
 struct move_input{
     uint  flock_id;
     uint  movestate;
     uint  has_dest_los;
+    uint  flags;
     float dest_x;
     float dest_z;
+    float pos_x;
+    float pos_z;
+    float radius;
 };
 
-layout(local_size_x = 1) in;
+layout(local_size_x = 64) in;
 layout(std430, binding = 0) readonly buffer in_data
 {
     move_input moveattrs[];
@@ -51,12 +66,73 @@ layout(std430, binding = 0) readonly buffer in_data
 layout(r32ui, binding = 1) uniform readonly uimage2D in_pos_id_map;
 layout(std430, binding = 2) writeonly buffer o_data
 {
-    float vpref[];
+    vec2 separation[];
 };
 
+uniform ivec4 map_resolution;
+uniform vec2 map_pos;
+
+vec2 truncate(vec2 v, float max_len)
+{
+    float len = length(v);
+    if(len > max_len)
+        return v / len * max_len;
+    return v;
+}
+
+/* Same as the 'separation_force' of the CPU steering code, except that the 
+ * neighbours are found by scanning the texels around the entity in the 
+ * position-to-ID map.
+ */
+vec2 separation_force(uint idx)
+{
+    move_input ent = moveattrs[idx];
+    ivec2 size = imageSize(in_pos_id_map);
+    int resx = map_resolution.x * map_resolution.z * X_COORDS_PER_TILE;
+    int resz = map_resolution.y * map_resolution.w * Z_COORDS_PER_TILE;
+
+    /* Invert the mapping of the 'posbuff' vertex shader */
+    vec2 uv = vec2(1.0 - (ent.pos_x + map_pos.x) / resx, (ent.pos_z - map_pos.y) / resz);
+    ivec2 center = ivec2(uv * vec2(size));
+    ivec2 extent = ivec2(ceil(SEPARATION_NEIGHB_RADIUS * vec2(size) / vec2(resx, resz)));
+
+    ivec2 begin = max(center - extent, ivec2(0));
+    ivec2 end = min(center + extent, size - ivec2(1));
+    vec2 ret = vec2(0.0);
+
+    for(int y = begin.y; y <= end.y; y++) {
+    for(int x = begin.x; x <= end.x; x++) {
+
+        uint gpu_id = imageLoad(in_pos_id_map, ivec2(x, y)).r;
+        if(gpu_id == 0u || gpu_id - 1u == idx)
+            continue;
+
+        move_input curr = moveattrs[gpu_id - 1u];
+        if((curr.flags & ENTITY_FLAG_GARRISONED) != 0u)
+            continue;
+        if((curr.flags & ENTITY_FLAG_MOVABLE) == 0u)
+            continue;
+        if((ent.flags & ENTITY_FLAG_AIR) != (curr.flags & ENTITY_FLAG_AIR))
+            continue;
+
+        vec2 diff = vec2(curr.pos_x - ent.pos_x, curr.pos_z - ent.pos_z);
+        float len = length(diff);
+        if(len > SEPARATION_NEIGHB_RADIUS || len < EPSILON)
+            continue;
+
+        float radius = ent.radius + curr.radius;
+        float t = (len - radius * 0.85) / len;
+        ret += diff * exp(-20.0 * t);
+    }}
+
+    return truncate(-ret, MAX_FORCE);
+}
+
 void main()
 {
     uint idx = gl_GlobalInvocationID.x;
-    vpref[idx] = 0.0f;
+    if(idx >= uint(moveattrs.length()))
+        return;
+    separation[idx] = separation_force(idx);
 }
 
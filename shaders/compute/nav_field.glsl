@@ -0,0 +1,214 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+
+#version 430 core
+
+#define FIELD_RES_R         (64)
+#define FIELD_RES_C         (64)
+#define NTILES              (FIELD_RES_R * FIELD_RES_C)
+#define OUT_WORDS           (NTILES / 8)
+#define LOCAL_SIZE          (256)
+#define TILES_PER_INV       (NTILES / LOCAL_SIZE)
+#define WORDS_PER_INV       (OUT_WORDS / LOCAL_SIZE)
+
+#define COST_IMPASSABLE     (0xffu)
+#define INF                 (0xffffffffu)
+
+#define FD_NONE             (0u)
+#define FD_NW               (1u)
+#define FD_N                (2u)
+#define FD_NE               (3u)
+#define FD_W                (4u)
+#define FD_E                (5u)
+#define FD_SW               (6u)
+#define FD_S                (7u)
+#define FD_SE               (8u)
+
+/* Mirrors 'struct field_gpu_job'. The costs are packed four per word and 
+ * the seeds hold bit 'c' of row 'r' for the tiles of the initial frontier. */
+struct field_job{
+    uint  cost[NTILES / 4];
+    uvec2 seeds[FIELD_RES_R];
+    uint  seed_dir;
+    uint  pad0;
+    uint  pad1;
+    uint  pad2;
+};
+
+layout(local_size_x = LOCAL_SIZE) in;
+layout(std430, binding = 0) readonly buffer in_data
+{
+    field_job jobs[];
+};
+layout(std430, binding = 1) writeonly buffer o_data
+{
+    uint dirs[];
+};
+
+/* The integration field of the chunk handled by this workgroup */
+shared uint s_intf[NTILES];
+shared uint s_changed;
+
+uint tile_cost(uint job, uint tile)
+{
+    return (jobs[job].cost[tile >> 2] >> ((tile & 3u) * 8u)) & 0xffu;
+}
+
+bool tile_seed(uint job, uint r, uint c)
+{
+    uvec2 row = jobs[job].seeds[r];
+    uint word = (c < 32u) ? row.x : row.y;
+    return ((word >> (c & 31u)) & 1u) != 0u;
+}
+
+uint intf_at(int r, int c)
+{
+    if(r < 0 || r >= FIELD_RES_R || c < 0 || c >= FIELD_RES_C)
+        return INF;
+    return s_intf[r * FIELD_RES_C + c];
+}
+
+/* Same selection as 'field_build_flow': the cardinal directions take 
+ * priority over the diagonal ones, which are only considered when both 
+ * of the side tiles sharing an edge with the corner are passable. */
+uint flow_dir(int r, int c, uint seed_dir)
+{
+    uint curr = intf_at(r, c);
+    if(curr == INF)
+        return FD_NONE;
+    if(curr == 0u)
+        return seed_dir;
+
+    uint n = intf_at(r - 1, c);
+    uint s = intf_at(r + 1, c);
+    uint w = intf_at(r, c - 1);
+    uint e = intf_at(r, c + 1);
+    uint nw = intf_at(r - 1, c - 1);
+    uint ne = intf_at(r - 1, c + 1);
+    uint sw = intf_at(r + 1, c - 1);
+    uint se = intf_at(r + 1, c + 1);
+
+    uint min_cost = min(min(n, s), min(w, e));
+    if(n != INF && w != INF) min_cost = min(min_cost, nw);
+    if(n != INF && e != INF) min_cost = min(min_cost, ne);
+    if(s != INF && w != INF) min_cost = min(min_cost, sw);
+    if(s != INF && e != INF) min_cost = min(min_cost, se);
+
+    if(n == min_cost)  return FD_N;
+    if(s == min_cost)  return FD_S;
+    if(e == min_cost)  return FD_E;
+    if(w == min_cost)  return FD_W;
+    if(nw == min_cost) return FD_NW;
+    if(ne == min_cost) return FD_NE;
+    if(sw == min_cost) return FD_SW;
+    if(se == min_cost) return FD_SE;
+    return FD_NONE;
+}
+
+void main()
+{
+    uint job = gl_WorkGroupID.x;
+    uint lid = gl_LocalInvocationIndex;
+    uint cost[TILES_PER_INV];
+
+    for(uint i = 0u; i < TILES_PER_INV; i++) {
+
+        uint tile = i * LOCAL_SIZE + lid;
+        cost[i] = tile_cost(job, tile);
+        s_intf[tile] = tile_seed(job, tile / FIELD_RES_C, tile % FIELD_RES_C) ? 0u : INF;
+    }
+
+    /* Relax all the tiles against their neighbours until no cost can be 
+     * lowered any further. The costs are integers, so the result is the 
+     * same as that of the CPU wavefront regardless of the order in which 
+     * the tiles end up being updated. */
+    for(;;) {
+
+        if(lid == 0u)
+            s_changed = 0u;
+        memoryBarrierShared();
+        barrier();
+
+        bool changed = false;
+        for(uint i = 0u; i < TILES_PER_INV; i++) {
+
+            if(cost[i] == COST_IMPASSABLE)
+                continue;
+
+            uint tile = i * LOCAL_SIZE + lid;
+            int r = int(tile / FIELD_RES_C);
+            int c = int(tile % FIELD_RES_C);
+
+            uint best = min(min(intf_at(r - 1, c), intf_at(r + 1, c)), 
+                            min(intf_at(r, c - 1), intf_at(r, c + 1)));
+            if(best == INF)
+                continue;
+
+            best += cost[i];
+            if(best < s_intf[tile]) {
+                s_intf[tile] = best;
+                changed = true;
+            }
+        }
+        if(changed)
+            s_changed = 1u;
+        memoryBarrierShared();
+        barrier();
+
+        if(s_changed == 0u)
+            break;
+        /* Everyone must have seen the flag before it is cleared */
+        barrier();
+    }
+
+    uint seed_dir = jobs[job].seed_dir;
+    for(uint i = 0u; i < WORDS_PER_INV; i++) {
+
+        /* Matches the layout of 'struct flow_field' - two directions per 
+         * byte, with the even column in the high nibble */
+        uint word = i * LOCAL_SIZE + lid;
+        int r = int(word / 8u);
+        int c = int(word % 8u) * 8;
+
+        uint bits = 0u;
+        for(int b = 0; b < 4; b++) {
+
+            uint hi = flow_dir(r, c + 2 * b, seed_dir);
+            uint lo = flow_dir(r, c + 2 * b + 1, seed_dir);
+            bits |= ((hi << 4) | lo) << (8 * b);
+        }
+        dirs[job * OUT_WORDS + word] = bits;
+    }
+}
+
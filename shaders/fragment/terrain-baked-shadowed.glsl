@@ -0,0 +1,394 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2019-2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+
+#define SPECULAR_STRENGTH  0.5
+#define SPECULAR_SHININESS 2
+
+#define Y_COORDS_PER_TILE  4 
+#define X_COORDS_PER_TILE  8 
+#define Z_COORDS_PER_TILE  8 
+
+#define EXTRA_AMBIENT_PER_LEVEL 0.03
+
+#define BLEND_MODE_NOBLEND  0
+#define BLEND_MODE_BLUR     1
+
+#define TERRAIN_AMBIENT     float(0.7)
+#define TERRAIN_DIFFUSE     vec3(0.9, 0.9, 0.9)
+#define TERRAIN_SPECULAR    vec3(0.1, 0.1, 0.1)
+
+#define SHADOW_MAP_BIAS 0.002
+#define SHADOW_MULTIPLIER 0.7
+
+#define STATE_UNEXPLORED 0
+#define STATE_IN_FOG     1
+#define STATE_VISIBLE    2
+
+/*****************************************************************************/
+/* INPUTS                                                                    */
+/*****************************************************************************/
+
+in VertexToFrag {
+         vec2  uv;
+    flat int   mat_idx;
+         vec3  world_pos;
+         vec3  normal;
+    flat int   blend_mode;
+    flat int   mid_indices;
+    flat ivec2 c1_indices;
+    flat ivec2 c2_indices; 
+    flat int   tb_indices;
+    flat int   lr_indices;
+         vec4  light_space_pos;
+}from_vertex;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+out vec4 o_frag_color;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
+
+uniform sampler2D shadow_map;
+
+uniform sampler2DArray tex_array0;
+/* The baked pages of all the chunks, one layer per chunk */
+uniform sampler2DArray tex_array2;
+
+uniform usamplerBuffer visbuff;
+uniform int visbuff_offset;
+
+uniform ivec4 map_resolution;
+uniform vec2 map_pos;
+
+/*****************************************************************************/
+/* PROGRAM                                                                   */
+/*****************************************************************************/
+
+/*
+ * x = chunk_r
+ * y = chunk_c
+ * z = tile_r
+ * a = tile_c
+ */
+ivec4 tile_desc_at(vec3 ws_pos)
+{
+    int chunk_w = map_resolution[0];
+    int chunk_h = map_resolution[1];
+    int tile_w = map_resolution[2];
+    int tile_h = map_resolution[3];
+    int tiles_per_chunk = tile_w * tile_h;
+
+    int chunk_x_dist = tile_w * X_COORDS_PER_TILE;
+    int chunk_z_dist = tile_h * Z_COORDS_PER_TILE;
+
+    int chunk_r = int(abs(map_pos.y - ws_pos.z) / chunk_z_dist);
+    int chunk_c = int(abs(map_pos.x - ws_pos.x) / chunk_x_dist);
+
+    int chunk_base_x = int(map_pos.x - (chunk_c * chunk_x_dist));
+    int chunk_base_z = int(map_pos.y + (chunk_r * chunk_z_dist));
+
+    int tile_c = int(abs(chunk_base_x - ws_pos.x) / X_COORDS_PER_TILE);
+    int tile_r = int(abs(chunk_base_z - ws_pos.z) / Z_COORDS_PER_TILE);
+
+    return ivec4(chunk_r, chunk_c, tile_r, tile_c);
+}
+
+ivec4 tile_relative_desc(ivec4 desc, int dr, int dc)
+{
+    int abs_r = desc.x * map_resolution.z + desc.z + dr;
+    int abs_c = desc.y * map_resolution.a + desc.a + dc;
+
+    abs_r = clamp(abs_r, 0, map_resolution.x * map_resolution.z - 1);
+    abs_c = clamp(abs_c, 0, map_resolution.y * map_resolution.a - 1);
+
+    return ivec4(
+        abs_r / map_resolution.z,
+        abs_c / map_resolution.a,
+        int(mod(abs_r, map_resolution.z)),
+        int(mod(abs_c, map_resolution.a))
+    );
+}
+
+int visbuff_idx(ivec4 td)
+{
+    int chunk_w = map_resolution[0];
+    int tile_w = map_resolution[2];
+    int tile_h = map_resolution[3];
+    int tiles_per_chunk = tile_w * tile_h;
+
+    return visbuff_offset + (td.x * tiles_per_chunk * chunk_w) 
+                          + (td.y * tiles_per_chunk) 
+                          + (td.z * tile_w) 
+                          + td.a;
+}
+
+float tf_for_state(uint state)
+{
+    if(state == uint(STATE_UNEXPLORED))
+        return 0.0;
+    else if(state == uint(STATE_IN_FOG))
+        return 0.5;
+    return 1.0;
+}
+
+/* (0,0) is in the bottom-left corner, and (1,1) is in the top right corner */
+float bilinear_interp_unit_square(float tl, float tr, float bl, float br, vec2 coord)
+{
+    return bl * (1.0 - coord.x) * (1.0 - coord.y) 
+         + br * (coord.x) * (1.0 - coord.y)
+         + tl * (1.0 - coord.x) * (coord.y)
+         + tr * (coord.x) * (coord.y);
+}
+
+uvec4 fetch_safe(usamplerBuffer buff, int idx)
+{
+    int batch_size = map_resolution[0] * map_resolution[1] * map_resolution[2] * map_resolution[3];
+    int buff_size = textureSize(buff);
+    int begin_idx = visbuff_offset;
+    int end_idx = int(mod(visbuff_offset + batch_size, buff_size));
+
+    if(end_idx > begin_idx) {
+        idx = clamp(idx, begin_idx, end_idx-1);
+    }else{
+        int dist = begin_idx - end_idx;
+        if(idx < end_idx + dist/2)
+            idx = clamp(idx, 0, end_idx-1);
+        else
+            idx = clamp(idx, begin_idx, buff_size-1);
+    }
+    return texelFetch(buff, idx);
+}
+
+/* The tint factor is in the range of [0,1]. It is a color multiplier based on 
+ * the fog-of-war state of the current and adjacent tiles. */
+float tint_factor(ivec4 td, vec2 uv)
+{
+    float c  = tf_for_state(fetch_safe(visbuff, visbuff_idx(td)).r);
+    float tl = tf_for_state(fetch_safe(visbuff, visbuff_idx(tile_relative_desc(td, -1, -1))).r);
+    float tr = tf_for_state(fetch_safe(visbuff, visbuff_idx(tile_relative_desc(td, -1, +1))).r);
+    float l  = tf_for_state(fetch_safe(visbuff, visbuff_idx(tile_relative_desc(td,  0, -1))).r);
+    float r  = tf_for_state(fetch_safe(visbuff, visbuff_idx(tile_relative_desc(td,  0, +1))).r);
+    float bl = tf_for_state(fetch_safe(visbuff, visbuff_idx(tile_relative_desc(td, +1, -1))).r);
+    float br = tf_for_state(fetch_safe(visbuff, visbuff_idx(tile_relative_desc(td, +1, +1))).r);
+    float t  = tf_for_state(fetch_safe(visbuff, visbuff_idx(tile_relative_desc(td, -1,  0))).r);
+    float b  = tf_for_state(fetch_safe(visbuff, visbuff_idx(tile_relative_desc(td, +1,  0))).r);
+
+    float tl_corner = (c + t + l + tl) / 4.0;
+    float tr_corner = (c + t + r + tr) / 4.0;
+    float bl_corner = (c + l + b + bl) / 4.0;
+    float br_corner = (c + r + b + br) / 4.0;
+
+    return bilinear_interp_unit_square(tl_corner, tr_corner, bl_corner, br_corner, uv);
+}
+
+vec4 texture_val(int mat_idx, vec2 uv)
+{
+    return texture(tex_array0, vec3(uv, mat_idx));
+}
+
+/* The blended material colors of the chunk, as baked into its' page. The page 
+ * covers the chunk top-down, with (0,0) at its' north-east corner. */
+vec4 page_val(ivec4 td, vec3 ws_pos)
+{
+    int chunk_x_dist = map_resolution[2] * X_COORDS_PER_TILE;
+    int chunk_z_dist = map_resolution[3] * Z_COORDS_PER_TILE;
+
+    float chunk_base_x = map_pos.x - (td.y * chunk_x_dist);
+    float chunk_base_z = map_pos.y + (td.x * chunk_z_dist);
+
+    vec2 page_uv = vec2(
+        (chunk_base_x - ws_pos.x) / chunk_x_dist,
+        (ws_pos.z - chunk_base_z) / chunk_z_dist
+    );
+    int layer = td.x * map_resolution[0] + td.y;
+    return texture(tex_array2, vec3(page_uv, layer));
+}
+
+float shadow_factor(vec4 light_space_pos)
+{
+    vec3 proj_coords = (light_space_pos.xyz / light_space_pos.w) * 0.5 + 0.5;
+    if(proj_coords.x < 0 || proj_coords.x >= textureSize(shadow_map, 0).x)
+        return 0.0;
+    if(proj_coords.y < 0 || proj_coords.y >= textureSize(shadow_map, 0).y)
+        return 0.0;
+    if(proj_coords.z > 0.95)
+        return 0.0;
+
+    float closest_depth = texture(shadow_map, proj_coords.xy).r;
+    float current_depth = proj_coords.z;
+    if(current_depth - SHADOW_MAP_BIAS > closest_depth) {
+        return 1.0;
+    }else {
+        return 0.0;
+    }
+}
+
+float shadow_factor_pcf(vec4 light_space_pos)
+{
+    vec3 proj_coords = (light_space_pos.xyz / light_space_pos.w) * 0.5 + 0.5;
+    if(proj_coords.x < 0 || proj_coords.x >= textureSize(shadow_map, 0).x)
+        return 0.0;
+    if(proj_coords.y < 0 || proj_coords.y >= textureSize(shadow_map, 0).y)
+        return 0.0;
+    if(proj_coords.z > 0.95)
+        return 0.0;
+
+    float shadow = 0.0;
+    vec2 texel_size = 1.0 / textureSize(shadow_map, 0);
+    float current_depth = proj_coords.z;
+
+    for(int x = -1; x <= 1; x++) {
+    for(int y = -1; y <= 1; y++) {
+
+        float pcf_depth = texture(shadow_map, proj_coords.xy + vec2(x, y) * texel_size).r; 
+        shadow += (current_depth - SHADOW_MAP_BIAS > pcf_depth ? 1.0 : 0.0);
+    }}
+
+    shadow /= 9.0;
+    return shadow;
+}
+
+float shadow_factor_poisson(vec4 light_space_pos)
+{
+    vec2 poisson_disk[4] = vec2[](
+        vec2( -0.94201624,  -0.39906216 ),
+        vec2(  0.94558609,  -0.76890725 ),
+        vec2( -0.094184101, -0.92938870 ),
+        vec2(  0.34495938,   0.29387760 )
+    );
+
+    vec3 proj_coords = (light_space_pos.xyz / light_space_pos.w) * 0.5 + 0.5;
+    if(proj_coords.x < 0 || proj_coords.x >= textureSize(shadow_map, 0).x)
+        return 0.0;
+    if(proj_coords.y < 0 || proj_coords.y >= textureSize(shadow_map, 0).y)
+        return 0.0;
+    if(proj_coords.z > 0.95)
+        return 0.0;
+
+    float current_depth = proj_coords.z;
+    float closest_depth = texture(shadow_map, proj_coords.xy).r;
+    float shadow = (current_depth - SHADOW_MAP_BIAS > closest_depth) ? 1.0 : 0.0;
+    float visibility = 1.0;
+
+    for(int i = 0; i < 4; i++) {
+    
+        float depth = texture(shadow_map, proj_coords.xy + poisson_disk[i]/256.0).r; 
+        if(current_depth - SHADOW_MAP_BIAS <= depth)
+            visibility -= 0.25;
+    }
+    return shadow * visibility;
+}
+
+void main()
+{
+    ivec4 td = tile_desc_at(from_vertex.world_pos);
+    float tf = tint_factor(td, from_vertex.uv);
+
+    if(tf == 0.0) {
+        o_frag_color = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    vec4 tex_color;
+
+    switch(from_vertex.blend_mode) {
+    case BLEND_MODE_NOBLEND:
+        tex_color = texture_val(from_vertex.mat_idx, from_vertex.uv);
+        break;
+    case BLEND_MODE_BLUR:
+
+        /* The blending of the adjacent tiles' materials is resolved ahead 
+         * of time, so a single sample of the page stands in for it. */
+        tex_color = page_val(td, from_vertex.world_pos);
+        break;
+    default:
+        o_frag_color = vec4(1.0, 0.0, 1.0, 1.0);
+        return;
+    }
+
+    /* Simple alpha test to reject transparent pixels (with mipmapping) */
+    tex_color.rgb *= tex_color.a;
+    if(tex_color.a <= 0.5)
+        discard;
+
+    /* We increase the amount of ambient light that taller tiles get, in order to make
+     * them not blend with lower terrain. */
+    float height = from_vertex.world_pos.y / Y_COORDS_PER_TILE;
+
+    /* Ambient calculations */
+    vec3 ambient = (TERRAIN_AMBIENT + height * EXTRA_AMBIENT_PER_LEVEL) * ambient_color;
+
+    /* Diffuse calculations */
+    /* Always use light direction relative to world origin. Otherwise different parts of a
+     * large map have too distinct differences in lighting */
+    vec3 light_dir = normalize(light_pos); 
+    float diff = max(dot(from_vertex.normal, light_dir), 0.0);
+    vec3 diffuse = light_color * (diff * TERRAIN_DIFFUSE);
+
+    /* Specular calculations */
+    vec3 view_dir = normalize(view_pos - from_vertex.world_pos);
+    vec3 reflect_dir = reflect(-light_dir, from_vertex.normal);  
+    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), SPECULAR_SHININESS);
+    vec3 specular = SPECULAR_STRENGTH * light_color * (spec * TERRAIN_SPECULAR);
+
+    vec4 final_color = vec4( (ambient + diffuse + specular) * tex_color.xyz, 1.0);
+    float shadow = shadow_factor_poisson(from_vertex.light_space_pos);
+    if(shadow > 0.0) {
+        o_frag_color = vec4(final_color.xyz * (SHADOW_MULTIPLIER + (1.0 - shadow) * (1.0 - SHADOW_MULTIPLIER)), 1.0);
+    }else{
+        o_frag_color = vec4(final_color.xyz, 1.0);
+    }
+
+    o_frag_color = o_frag_color * tf;
+}
+
@@ -82,7 +82,16 @@ uniform float water_move_factor;
 uniform float cam_near;
 uniform float cam_far;
 
-uniform vec3 light_color;
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
 
 uniform vec2 water_tiling;
 
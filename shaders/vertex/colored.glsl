@@ -39,8 +39,16 @@ layout (location = 0) in vec3 in_pos;
 layout (location = 1) in vec4 in_color;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
 
 out VertexToFrag {
     vec4 color;
@@ -42,8 +42,16 @@ layout (location = 4) in int  in_draw_id;
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-uniform mat4 light_space_transform;
-uniform vec4 clip_plane0;
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
 
 /* Per-instance buffer contents:
  *  +--------------------------------------------------+ <-- base
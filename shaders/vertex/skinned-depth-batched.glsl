@@ -48,8 +48,16 @@ layout (location = 8) in int   in_draw_id;
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-uniform mat4 light_space_transform;
-uniform vec4 clip_plane0;
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
 
 /* The per-instance static attributes have the follwing layout in the buffer:
  *
@@ -62,12 +70,14 @@ uniform vec4 clip_plane0;
  *  +--------------------------------------------------+
  *  | mat4x4_t (16 floats)                             | (normal matrix)
  *  +--------------------------------------------------+
- *  | MAX_JOINTS * mat4x4_t (1536 floats)              | (curr pose matrices)
+ *  | float, float (2 floats)                          | (curr pose, inverse bind pose offsets)
  *  +--------------------------------------------------+
- *  | MAX_JOINTS * mat4x4_t (1536 floats)              | (inverse bind pose matrices)
+ *  | float[2] (2 floats)                              | (padding)
  *  +--------------------------------------------------+
  *
- * In total, 3264 floats (13056 bytes) are pushed per instance.
+ * In total, 196 floats (784 bytes) are pushed per instance. The instances
+ * are followed by the joint matrices, which may be shared between instances.
+ * The offsets are in floats, relative to the start of the pushed range.
  */
 
 uniform samplerBuffer attrbuff;
@@ -108,16 +118,21 @@ mat4 read_mat4(int base)
     );
 }
 
+int joint_mats_base(int offset_idx)
+{
+    int size = textureSize(attrbuff);
+    int offset = int(texelFetch(attrbuff, (inst_attr_base(in_draw_id) + 192 + offset_idx) % size).r);
+    return attrbuff_offset / 4 + offset;
+}
+
 mat4 anim_curr_pose_mats(int joint_idx)
 {
-    int base = inst_attr_base(in_draw_id) + 176 + 16;
-    return read_mat4(base + (16 * joint_idx));
+    return read_mat4(joint_mats_base(0) + (16 * joint_idx));
 }
 
 mat4 anim_inv_bind_mats(int joint_idx)
 {
-    int base = inst_attr_base(in_draw_id) + 176 + 16 + (MAX_JOINTS * 16);
-    return read_mat4(base + (16 * joint_idx));
+    return read_mat4(joint_mats_base(1) + (16 * joint_idx));
 }
 
 void main()
@@ -48,8 +48,16 @@ layout (location = 7) in vec3  in_joint_weights1;
 /*****************************************************************************/
 
 uniform mat4 model;
-uniform mat4 light_space_transform;
-uniform vec4 clip_plane0;
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
 
 uniform mat4 anim_curr_pose_mats[MAX_JOINTS];
 uniform mat4 anim_inv_bind_mats [MAX_JOINTS];
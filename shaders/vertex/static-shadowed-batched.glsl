@@ -58,11 +58,17 @@ out VertexToFrag {
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
 
-uniform mat4 light_space_transform;
-uniform vec4 clip_plane0;
 
 /* Per-instance buffer contents:
  *  +--------------------------------------------------+ <-- base
@@ -37,8 +37,9 @@
 
 layout (location = 0) in vec3 in_pos;
 layout (location = 1) in vec2 in_uv;
-
-#define MAX_HBS   (256)
+/* Per-instance attributes */
+layout (location = 2) in vec2 in_ent_top_offset_ss;
+layout (location = 3) in float in_ent_health_pc;
 
 /* Must match the definition in the fragment shader */
 #define CURR_HB_HEIGHT  (max(4.0/1080 * curr_res.y, 4.0))
@@ -58,14 +59,19 @@ out VertexToFrag {
 /*****************************************************************************/
 
 /* Should be set up for screenspace rendering */
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
 
 uniform ivec2 curr_res;
 
-uniform vec2  ent_top_offsets_ss[MAX_HBS];
-uniform float ent_health_pc[MAX_HBS];
-
 /*****************************************************************************/
 /* PROGRAM
 /*****************************************************************************/
@@ -73,10 +79,10 @@ uniform float ent_health_pc[MAX_HBS];
 void main()
 {
     to_fragment.uv = in_uv;
-    to_fragment.health_pc = ent_health_pc[gl_InstanceID];
+    to_fragment.health_pc = in_ent_health_pc;
 
     vec2 ss_pos = vec2(in_pos.x * CURR_HB_WIDTH, in_pos.y * CURR_HB_HEIGHT);
-    ss_pos += ent_top_offsets_ss[gl_InstanceID];
+    ss_pos += in_ent_top_offset_ss;
     gl_Position = projection * view * vec4(ss_pos, 0.0, 1.0);
 }
 
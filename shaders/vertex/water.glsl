@@ -54,11 +54,17 @@ out VertexToFrag {
 /*****************************************************************************/
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Globals {
+    mat4 view;
+    mat4 projection;
+    mat4 light_space_transform;
+    vec4 clip_plane0;
+    vec3 view_pos;
+    vec3 light_pos;
+    vec3 light_color;
+    vec3 ambient_color;
+};
 
-uniform vec3 view_pos;
-uniform vec3 light_pos;
 
 uniform vec2 water_tiling;
 
@@ -43,6 +43,7 @@
 #include "../asset_load.h"
 #include "../lib/public/attr.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/vec.h"
 #include "../render/public/render.h"
 #include "../render/public/render_ctrl.h"
 
@@ -57,13 +58,30 @@
             return false;     \
     }while(0)
 
-KHASH_MAP_INIT_INT(ctx, struct anim_ctx)
+struct anim_event{
+    uint32_t       uid;
+    enum eventtype type;
+};
+
+KHASH_MAP_INIT_INT(idx, int)
+
+VEC_TYPE(ctx, struct anim_ctx)
+VEC_IMPL(static inline, ctx, struct anim_ctx)
+
+VEC_TYPE(aevent, struct anim_event)
+VEC_IMPL(static inline, aevent, struct anim_event)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static khash_t(ctx) *s_anim_ctx;
+/* The contexts are kept densely packed so that they can be swept in order
+ * by A_Update. The table maps an entity's UID to its' context's index. 
+ */
+static vec_ctx_t      s_anim_ctx;
+static khash_t(idx)  *s_anim_ctx_idx;
+/* Events raised during the sweep, notified once it is done */
+static vec_aevent_t   s_anim_events;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -71,10 +89,20 @@ static khash_t(ctx) *s_anim_ctx;
 
 static struct anim_ctx *a_ctx_for_uid(uint32_t uid)
 {
-    khiter_t k = kh_get(ctx, s_anim_ctx, uid);
-    if(k == kh_end(s_anim_ctx))
+    khiter_t k = kh_get(idx, s_anim_ctx_idx, uid);
+    if(k == kh_end(s_anim_ctx_idx))
         return NULL;
-    return &kh_value(s_anim_ctx, k);
+    return &vec_AT(&s_anim_ctx, kh_value(s_anim_ctx_idx, k));
+}
+
+static void a_set_active_clip(struct anim_ctx *ctx, const struct anim_clip *clip,
+                              enum anim_mode mode, unsigned key_fps, uint32_t curr_ticks)
+{
+    ctx->active = clip;
+    ctx->mode = mode;
+    ctx->key_fps = key_fps;
+    ctx->curr_frame = 0;
+    ctx->curr_frame_start_ticks = curr_ticks;
 }
 
 static const struct anim_clip *a_clip_for_name(const struct anim_data *data, const char *name)
@@ -130,11 +158,9 @@ static void a_make_bind_mat(int joint_idx, const struct skeleton *skel, mat4x4_t
     *out = bind_trans;
 }
 
-static void a_make_pose_mat(uint32_t uid, int joint_idx, const struct skeleton *skel, mat4x4_t *out)
+static void a_make_pose_mat(const struct anim_sample *sample, int joint_idx, 
+                            const struct skeleton *skel, mat4x4_t *out)
 {
-    struct anim_ctx *ctx = a_ctx_for_uid(uid);
-    struct anim_sample *sample = &ctx->active->samples[ctx->curr_frame];
-
     mat4x4_t pose_trans;
     PFM_Mat4x4_Identity(&pose_trans);
 
@@ -154,6 +180,11 @@ static void a_make_pose_mat(uint32_t uid, int joint_idx, const struct skeleton *
     *out = pose_trans;
 }
 
+static const mat4x4_t *a_curr_pose_mats(const struct anim_ctx *ctx)
+{
+    return ctx->active->samples[ctx->curr_frame].pose_mats;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -175,55 +206,56 @@ void A_SetActiveClip(uint32_t uid, const char *name,
     const struct anim_clip *clip = a_clip_for_name(ctx->data, name);
     assert(clip);
 
-    ctx->active = clip;
-    ctx->mode = mode;
-    ctx->key_fps = key_fps;
-    ctx->curr_frame = 0;
-    ctx->curr_frame_start_ticks = SDL_GetTicks();
+    a_set_active_clip(ctx, clip, mode, key_fps, SDL_GetTicks());
 }
 
 void A_Update(void)
 {
     uint32_t curr_ticks = SDL_GetTicks();
-    uint32_t uid;
+    vec_aevent_reset(&s_anim_events);
 
-    kh_foreach(s_anim_ctx, uid, (struct anim_ctx){0}, {
+    for(int i = 0; i < vec_size(&s_anim_ctx); i++) {
 
-        struct anim_ctx *ctx = a_ctx_for_uid(uid);
+        struct anim_ctx *ctx = &vec_AT(&s_anim_ctx, i);
         float frame_period_secs = 1.0f/ctx->key_fps;
         float elapsed_secs = (curr_ticks - ctx->curr_frame_start_ticks)/1000.0f;
 
-        if(elapsed_secs > frame_period_secs) {
+        if(elapsed_secs <= frame_period_secs)
+            continue;
 
-            ctx->curr_frame = (ctx->curr_frame + 1) % ctx->active->num_frames;
-            ctx->curr_frame_start_ticks = curr_ticks;
+        ctx->curr_frame = (ctx->curr_frame + 1) % ctx->active->num_frames;
+        ctx->curr_frame_start_ticks = curr_ticks;
 
-            if(ctx->curr_frame == ctx->active->num_frames - 1) {
+        if(ctx->curr_frame == ctx->active->num_frames - 1) {
 
-                E_Entity_Notify(EVENT_ANIM_CYCLE_FINISHED, uid, NULL, ES_ENGINE);
-                if(ctx->mode == ANIM_MODE_ONCE) {
-                    E_Entity_Notify(EVENT_ANIM_FINISHED, uid, NULL, ES_ENGINE);
-                }
+            vec_aevent_push(&s_anim_events, (struct anim_event){ctx->uid, EVENT_ANIM_CYCLE_FINISHED});
+            if(ctx->mode == ANIM_MODE_ONCE) {
+                vec_aevent_push(&s_anim_events, (struct anim_event){ctx->uid, EVENT_ANIM_FINISHED});
             }
+        }
 
-            if(ctx->curr_frame == 0 && ctx->mode == ANIM_MODE_ONCE) {
-                A_SetActiveClip(uid, ctx->idle->name, ANIM_MODE_LOOP, ctx->key_fps);
-            }
+        if(ctx->curr_frame == 0 && ctx->mode == ANIM_MODE_ONCE) {
+            a_set_active_clip(ctx, ctx->idle, ANIM_MODE_LOOP, ctx->key_fps, curr_ticks);
         }
-    });
+    }
+
+    for(int i = 0; i < vec_size(&s_anim_events); i++) {
+        const struct anim_event *event = &vec_AT(&s_anim_events, i);
+        E_Entity_Notify(event->type, event->uid, NULL, ES_ENGINE);
+    }
 }
 
 void A_GetRenderState(uint32_t uid, size_t *out_njoints, 
-                      mat4x4_t *out_curr_pose, const mat4x4_t **out_inv_bind_pose)
+                      const mat4x4_t **out_curr_pose, const mat4x4_t **out_inv_bind_pose)
 {
     PERF_ENTER();
 
     struct anim_ctx *ctx = a_ctx_for_uid(uid);
     const struct anim_data *data = ctx->data;
 
-    for(int j = 0; j < data->skel.num_joints; j++) {
-        a_make_pose_mat(uid, j, &data->skel, out_curr_pose + j);
-    }
+    /* The pose matrices only depend on the clip frame, so they are shared 
+     * between all the entities that are currently showing the same frame. */
+    *out_curr_pose = a_curr_pose_mats(ctx);
 
     *out_njoints = data->skel.num_joints;
     *out_inv_bind_pose = data->skel.inv_bind_poses;
@@ -271,11 +303,11 @@ const struct skeleton *A_GetCurrPoseSkeleton(uint32_t uid)
 
     ret->inv_bind_poses = (void*)((char*)ret->bind_sqts + num_joints * sizeof(struct SQT));
 
+    const mat4x4_t *pose_mats = a_curr_pose_mats(ctx);
     for(int i = 0; i < ret->num_joints; i++) {
     
         /* Update the inverse bind matrices for the current frame */
-        mat4x4_t pose_mat;
-        a_make_pose_mat(uid, i, ret, &pose_mat);
+        mat4x4_t pose_mat = pose_mats[i];
         PFM_Mat4x4_Inverse(&pose_mat, &ret->inv_bind_poses[i]);
     }
 
@@ -294,6 +326,38 @@ void A_PrepareInvBindMatrices(const struct skeleton *skel)
     }
 }
 
+void A_PreparePoseMatrices(const struct anim_clip *clip)
+{
+    for(int f = 0; f < clip->num_frames; f++) {
+
+        const struct anim_sample *sample = &clip->samples[f];
+        const struct skeleton *skel = clip->skel;
+
+        /* Joints are normally listed parent-first, which lets us build each 
+         * joint's matrix from its' parent's with a single multiply. Fall back
+         * to walking the whole chain for any joint which precedes its' parent. 
+         */
+        for(int i = 0; i < skel->num_joints; i++) {
+
+            int parent_idx = skel->joints[i].parent_idx;
+            if(parent_idx >= i) {
+                a_make_pose_mat(sample, i, skel, &sample->pose_mats[i]);
+                continue;
+            }
+
+            mat4x4_t to_parent;
+            a_mat_from_sqt(&sample->local_joint_poses[i], &to_parent);
+            if(parent_idx < 0) {
+                sample->pose_mats[i] = to_parent;
+                continue;
+            }
+
+            mat4x4_t parent_mat = sample->pose_mats[parent_idx];
+            PFM_Mat4x4_Mult4x4(&parent_mat, &to_parent, &sample->pose_mats[i]);
+        }
+    }
+}
+
 const struct aabb *A_GetCurrPoseAABB(uint32_t uid)
 {
     struct anim_ctx *ctx = a_ctx_for_uid(uid);
@@ -410,30 +474,46 @@ bool A_LoadState(struct SDL_RWops *stream, uint32_t uid)
 
 void A_ClearState(void)
 {
-    kh_clear(ctx, s_anim_ctx);
+    vec_ctx_reset(&s_anim_ctx);
+    vec_aevent_reset(&s_anim_events);
+    kh_clear(idx, s_anim_ctx_idx);
 }
 
 bool A_Init(void)
 {
-    s_anim_ctx = kh_init(ctx);
-    return (s_anim_ctx != NULL);
+    vec_ctx_init(&s_anim_ctx);
+    vec_aevent_init(&s_anim_events);
+    s_anim_ctx_idx = kh_init(idx);
+    return (s_anim_ctx_idx != NULL);
 }
 
 void A_Shutdown(void)
 {
-    kh_destroy(ctx, s_anim_ctx);
+    kh_destroy(idx, s_anim_ctx_idx);
+    vec_aevent_destroy(&s_anim_events);
+    vec_ctx_destroy(&s_anim_ctx);
 }
 
 bool A_AddEntity(uint32_t uid)
 {
-    int status;
-    khiter_t k = kh_put(ctx, s_anim_ctx, uid, &status);
-    if(status == -1 || status == 0)
+    if(kh_get(idx, s_anim_ctx_idx, uid) != kh_end(s_anim_ctx_idx))
         return false;
 
-    struct anim_ctx *ctx = &kh_value(s_anim_ctx, k);
     const struct entity *ent = AL_EntityGet(uid);
-    ctx->data = ent->anim_private;
+    struct anim_ctx ctx = (struct anim_ctx){
+        .uid = uid,
+        .data = ent->anim_private
+    };
+    if(!vec_ctx_push(&s_anim_ctx, ctx))
+        return false;
+
+    int status;
+    khiter_t k = kh_put(idx, s_anim_ctx_idx, uid, &status);
+    if(status == -1) {
+        vec_ctx_pop(&s_anim_ctx);
+        return false;
+    }
+    kh_value(s_anim_ctx_idx, k) = vec_size(&s_anim_ctx) - 1;
 
     A_SetIdleClip(uid, A_GetClip(uid, 0), 24);
     return true;
@@ -441,9 +521,20 @@ bool A_AddEntity(uint32_t uid)
 
 void A_RemoveEntity(uint32_t uid)
 {
-    khiter_t k = kh_get(ctx, s_anim_ctx, uid);
-    if(k == kh_end(s_anim_ctx))
+    khiter_t k = kh_get(idx, s_anim_ctx_idx, uid);
+    if(k == kh_end(s_anim_ctx_idx))
         return;
-    kh_del(ctx, s_anim_ctx, k);
+
+    /* The last context is moved into the freed slot */
+    int del_idx = kh_value(s_anim_ctx_idx, k);
+    kh_del(idx, s_anim_ctx_idx, k);
+    vec_ctx_del(&s_anim_ctx, del_idx);
+
+    if(del_idx < vec_size(&s_anim_ctx)) {
+        uint32_t moved = vec_AT(&s_anim_ctx, del_idx).uid;
+        k = kh_get(idx, s_anim_ctx_idx, moved);
+        assert(k != kh_end(s_anim_ctx_idx));
+        kh_value(s_anim_ctx_idx, k) = del_idx;
+    }
 }
 
@@ -40,6 +40,7 @@
 
 #include "../asset_load.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/mem.h"
 
 #include <string.h>
 
@@ -155,11 +156,13 @@ size_t al_data_buffsize_from_header(const struct pfobj_hdr *header)
      *    1. a 'struct anim_sample' (for referencing this frame's SQT array)
      *    2. num_joint number of 'struct SQT's (each joint's transform
      *       for the current frame)
+     *    3. num_joint number of 'mat4x4_t's (each joint's pose matrix
+     *       for the current frame)
      */
     for(unsigned as_idx  = 0; as_idx < header->num_as; as_idx++) {
 
         ret += header->frame_counts[as_idx] * 
-               (sizeof(struct anim_sample) + header->num_joints * sizeof(struct SQT));
+               (sizeof(struct anim_sample) + header->num_joints * (sizeof(struct SQT) + sizeof(mat4x4_t)));
     }
 
     return ret;
@@ -194,12 +197,15 @@ size_t A_AL_CtxBuffSize(void)
  *  | struct SQT[num_as * num_joints] |
  *  |    (stored in clip-major order) |
  *  +---------------------------------+
+ *  | mat4x4_t[num_as * num_joints]   |
+ *  |    (stored in clip-major order) |
+ *  +---------------------------------+
  *
  */
 
 void *A_AL_PrivFromStream(const struct pfobj_hdr *header, SDL_RWops *stream)
 {
-    struct anim_data *ret = malloc(al_data_buffsize_from_header(header));
+    struct anim_data *ret = pf_tmalloc(MEM_TAG_ANIM, al_data_buffsize_from_header(header));
     if(!ret)
         goto fail_alloc;
 
@@ -244,6 +250,14 @@ void *A_AL_PrivFromStream(const struct pfobj_hdr *header, SDL_RWops *stream)
         }
     }
 
+    for(int i = 0; i < header->num_as; i++) {
+        for(int f = 0; f < header->frame_counts[i]; f++) {
+
+            ret->anims[i].samples[f].pose_mats = (void*)unused_base;
+            unused_base += sizeof(mat4x4_t) * header->num_joints;
+        }
+    }
+
     /*---------------------------------------------------------------
      * Then we populate priv members with the file data 
      *---------------------------------------------------------------
@@ -261,10 +275,13 @@ void *A_AL_PrivFromStream(const struct pfobj_hdr *header, SDL_RWops *stream)
     }
 
     A_PrepareInvBindMatrices(&ret->skel);
+    for(int i = 0; i < header->num_as; i++) {
+        A_PreparePoseMatrices(&ret->anims[i]);
+    }
     return ret;
 
 fail_parse:
-    free(ret);
+    pf_tfree(ret);
 fail_alloc:
     return NULL;
 }
@@ -37,8 +37,10 @@
 #define ANIM_CTX_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct anim_ctx{
+    uint32_t                uid;
     const struct anim_clip *active;
     const struct anim_clip *idle;
     const struct anim_data *data;
@@ -46,6 +46,9 @@
 
 struct anim_sample{
     struct SQT  *local_joint_poses;
+    /* Object-space pose matrix of each joint, computed once at load time 
+     * so that all entities showing this frame share the same matrices. */
+    mat4x4_t    *pose_mats;
     struct aabb  sample_aabb;
 };
 
@@ -37,6 +37,7 @@
 #define ANIM_PRIVATE_H
 
 struct skeleton;
+struct anim_clip;
 
 /* Computes the inverse bind matrix for each joint based on the 
  * joint's bind SQT. The inverse bind matrix will be used by the vertex
@@ -48,4 +49,10 @@ struct skeleton;
  */
 void A_PrepareInvBindMatrices(const struct skeleton *skel);
 
+/* Computes the object-space pose matrix of each joint for every frame 
+ * of the clip. The matrices will be written to the memory pointed to by 
+ * each sample's 'pose_mats', which is expected to be allocated already.
+ */
+void A_PreparePoseMatrices(const struct anim_clip *clip);
+
 #endif
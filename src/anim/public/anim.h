@@ -74,11 +74,13 @@ void                   A_SetActiveClip(uint32_t uid, const char *name,
                                        enum anim_mode mode, unsigned key_fps);
 
 /* ---------------------------------------------------------------------------
- * Retreive a copy of the state needed to render an animated entity.
+ * Retreive the state needed to render an animated entity. The pose matrices
+ * are shared by all entities showing the same clip frame and remain valid 
+ * for the lifetime of the entity's animation data.
  * ---------------------------------------------------------------------------
  */
 void                   A_GetRenderState(uint32_t uid, size_t *out_njoints, 
-                                        mat4x4_t *out_curr_pose, 
+                                        const mat4x4_t **out_curr_pose, 
                                         const mat4x4_t **out_inv_bind_pose);
 
 /* ---------------------------------------------------------------------------
@@ -185,7 +187,8 @@ size_t A_AL_CtxBuffSize(void);
 
 /* ---------------------------------------------------------------------------
  * Consumes lines of the stream and uses them to populate the private data, 
- * which is then returned in a malloc'd buffer.
+ * which is then returned in a buffer allocated with 'pf_tmalloc'. It must 
+ * be released with 'pf_tfree'.
  * ---------------------------------------------------------------------------
  */
 void  *A_AL_PrivFromStream(const struct pfobj_hdr *header, SDL_RWops *stream);
@@ -46,6 +46,7 @@
 #include "lib/public/pf_string.h"
 #include "lib/public/mpool_allocator.h"
 #include "lib/public/mem.h"
+#include "sched.h"
 
 #include <SDL.h>
 
@@ -72,7 +73,22 @@ struct shared_resource{
 };
 
 KHASH_MAP_INIT_STR(entity_res, struct shared_resource)
-KHASH_MAP_INIT_INT(uid_ent, struct entity*)
+
+/* Entities are looked up by the slot index of their UID. The full UID is 
+ * kept alongside so that stale UIDs of recycled slots don't match. */
+struct ent_slot{
+    uint32_t       uid;
+    struct entity *ent;
+};
+
+VEC_TYPE(entslot, struct ent_slot)
+VEC_IMPL(static inline, entslot, struct ent_slot)
+
+/* The files to be read by the workers during a preload */
+struct preload_work{
+    char      (*paths)[512];
+    SDL_RWops **streams;
+};
 
 MPOOL_ALLOCATOR_TYPE(ent, struct entity)
 MPOOL_ALLOCATOR_PROTOTYPES(static, ent, struct entity)
@@ -83,8 +99,9 @@ MPOOL_ALLOCATOR_IMPL(static, ent, struct entity)
 /*****************************************************************************/
 
 static khash_t(entity_res) *s_name_resource_table;
-static khash_t(uid_ent)    *s_uid_ent_table;
+static vec_entslot_t        s_ent_slots;
 static mpa_ent_t            s_mpool;
+static struct task_group    s_preload_group;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -174,22 +191,43 @@ fail:
     return false;
 }
 
-static bool al_get_resource(const char *path, const char *basedir, 
-                            const char *pfobj_name, struct shared_resource *out)
+static int SDLCALL al_mem_stream_close(SDL_RWops *stream)
 {
-    SDL_RWops *stream;
-    struct pfobj_hdr header;
+    free(stream->hidden.mem.base);
+    SDL_FreeRW(stream);
+    return 0;
+}
 
-    khiter_t k = kh_get(entity_res, s_name_resource_table, path);
-    if(k != kh_end(s_name_resource_table)) {
+static bool al_read_line_mem(SDL_RWops *stream, char *outbuff)
+{
+    Uint8 *here = stream->hidden.mem.here;
+    size_t left = stream->hidden.mem.stop - here;
+    size_t max = (left < MAX_LINE_LEN-1) ? left : MAX_LINE_LEN-1;
+
+    Uint8 *newline = memchr(here, '\n', max);
+    if(!newline) {
+        /* Consume the same bytes as a byte-by-byte read would */
+        memcpy(outbuff, here, max);
+        stream->hidden.mem.here += max;
+        return false;
+    }
 
-        *out = kh_value(s_name_resource_table, k);
-        return true;
+    size_t idx = newline - here;
+    memcpy(outbuff, here, idx + 1);
+    stream->hidden.mem.here += idx + 1;
+
+    if(idx && outbuff[idx-1] == '\r') {
+        outbuff[idx-1] = '\n';
+        outbuff[idx] = '\0';
     }
+    outbuff[idx + 1] = '\0';
+    return true;
+}
 
-    stream = SDL_RWFromFile(path, "r");
-    if(!stream)
-        goto fail_init; 
+static bool al_resource_from_stream(SDL_RWops *stream, const char *path, const char *basedir, 
+                                    const char *pfobj_name, struct shared_resource *out)
+{
+    struct pfobj_hdr header;
 
     if(!al_parse_pfobj_header(stream, &header))
         goto fail_parse;
@@ -222,25 +260,56 @@ static bool al_get_resource(const char *path, const char *basedir,
     out->filename = pf_strdup(pfobj_name);
 
     int put_ret;
-    k = kh_put(entity_res, s_name_resource_table, pf_strdup(path), &put_ret);
+    khiter_t k = kh_put(entity_res, s_name_resource_table, pf_strdup(path), &put_ret);
     assert(put_ret != -1 && put_ret != 0);
     kh_value(s_name_resource_table, k) = *out;
-
-    SDL_RWclose(stream);
     return true;
 
 fail_parse:
-    SDL_RWclose(stream);
-fail_init:
     return false;
 }
 
-static void al_save_mapping(uint32_t uid, struct entity *ent)
+static bool al_get_resource(const char *path, const char *basedir, 
+                            const char *pfobj_name, struct shared_resource *out)
 {
-    int ret;
-    khiter_t k = kh_put(uid_ent, s_uid_ent_table, uid, &ret);
-    assert(ret != -1);
-    kh_value(s_uid_ent_table, k) = ent;
+    khiter_t k = kh_get(entity_res, s_name_resource_table, path);
+    if(k != kh_end(s_name_resource_table)) {
+
+        *out = kh_value(s_name_resource_table, k);
+        return true;
+    }
+
+    SDL_RWops *stream = AL_StreamFromFile(path);
+    if(!stream)
+        return false;
+
+    bool ret = al_resource_from_stream(stream, path, basedir, pfobj_name, out);
+    SDL_RWclose(stream);
+    return ret;
+}
+
+static void al_read_files_task(size_t begin, size_t end, void *arg)
+{
+    struct preload_work *work = arg;
+    for(size_t i = begin; i < end; i++) {
+        work->streams[i] = AL_StreamFromFile(work->paths[i]);
+    }
+}
+
+static bool al_save_mapping(uint32_t uid, struct entity *ent)
+{
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    while(vec_size(&s_ent_slots) <= idx) {
+        if(!vec_entslot_push(&s_ent_slots, (struct ent_slot){NULL_UID, NULL}))
+            return false;
+    }
+    /* Entities restored from a session file bring their own UIDs */
+    if(!Entity_ClaimUID(uid))
+        return false;
+
+    assert(s_ent_slots.array[idx].ent == NULL);
+    s_ent_slots.array[idx] = (struct ent_slot){uid, ent};
+    return true;
 }
 
 /*****************************************************************************/
@@ -273,11 +342,12 @@ bool AL_EntityFromPFObj(const char *base_path, const char *pfobj_name,
     newent->anim_private = res.anim_private;
     newent->identity_aabb = res.aabb;
 
+    if(!al_save_mapping(uid, newent))
+        goto fail_init;
+
     Entity_SetRot(uid, (quat_t){0.0f, 0.0f, 0.0f, 1.0f});
     Entity_SetScale(uid, (vec3_t){1.0f, 1.0f, 1.0f});
     *out_flags = res.ent_flags;
-
-    al_save_mapping(uid, newent);
     return true;
 
 fail_init:
@@ -291,11 +361,14 @@ fail_alloc:
 
 struct entity *AL_EntityGet(uint32_t uid)
 {
-    khiter_t k = kh_get(uid_ent, s_uid_ent_table, uid);
-    if(k == kh_end(s_uid_ent_table))
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    if(idx >= vec_size(&s_ent_slots))
         return NULL;
 
-    return kh_value(s_uid_ent_table, k);
+    const struct ent_slot *slot = &s_ent_slots.array[idx];
+    if(slot->uid != uid)
+        return NULL;
+    return slot->ent;
 }
 
 bool AL_EntitySetPFObj(uint32_t uid, const char *base_path, const char *pfobj_name)
@@ -360,15 +433,16 @@ void AL_EntityFree(uint32_t uid)
     PF_FREE(entity->filename);
     PF_FREE(entity->name);
 
-    khiter_t k = kh_get(uid_ent, s_uid_ent_table, uid);
-    assert(k != kh_end(s_uid_ent_table));
-    kh_del(uid_ent, s_uid_ent_table, k);
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    assert(s_ent_slots.array[idx].uid == uid);
+    s_ent_slots.array[idx] = (struct ent_slot){NULL_UID, NULL};
     mpa_ent_free(&s_mpool, entity);
+    Entity_FreeUID(uid);
 }
 
 void AL_ClearState(void)
 {
-    kh_clear(uid_ent, s_uid_ent_table);
+    vec_entslot_reset(&s_ent_slots);
     mpa_ent_clear(&s_mpool);
 }
 
@@ -417,6 +491,68 @@ bool AL_PreloadPFObj(const char *base_path, const char *pfobj_name)
     return true;
 }
 
+bool AL_PreloadPFObjs(size_t count, const char *base_paths[], const char *pfobj_names[])
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(count == 0)
+        return true;
+
+    bool ret = false;
+    struct preload_work work = (struct preload_work){
+        .paths = malloc(count * sizeof(*work.paths)),
+        .streams = calloc(count, sizeof(*work.streams)),
+    };
+    int *idx = malloc(count * sizeof(int));
+    if(!work.paths || !work.streams || !idx)
+        goto out;
+
+    /* Skip the models that are already loaded or listed more than once */
+    size_t nload = 0;
+    for(size_t i = 0; i < count; i++) {
+
+        char *path = work.paths[nload];
+        pf_snprintf(path, sizeof(*work.paths), "%s/%s/%s", g_basepath, base_paths[i], pfobj_names[i]);
+        if(kh_get(entity_res, s_name_resource_table, path) != kh_end(s_name_resource_table))
+            continue;
+
+        bool dup = false;
+        for(size_t j = 0; j < nload && !dup; j++) {
+            dup = (0 == strcmp(work.paths[j], path));
+        }
+        if(dup)
+            continue;
+        idx[nload++] = i;
+    }
+
+    /* The file reads are spread between the workers. The parsing is done
+     * in order on this thread, as it issues render commands. All the mesh 
+     * uploads are then performed by the render thread in a single batch. 
+     */
+    Sched_TaskGroupInit(&s_preload_group);
+    Sched_ParallelForAsync(&s_preload_group, 0, nload, 1, al_read_files_task, &work, 0, 0);
+    Sched_TaskGroupJoin(&s_preload_group);
+
+    ret = true;
+    for(size_t i = 0; i < nload; i++) {
+
+        struct shared_resource res;
+        if(!work.streams[i]) {
+            ret = false;
+            continue;
+        }
+        ret &= al_resource_from_stream(work.streams[i], work.paths[i], 
+            base_paths[idx[i]], pfobj_names[idx[i]], &res);
+        SDL_RWclose(work.streams[i]);
+    }
+
+out:
+    free(idx);
+    free(work.streams);
+    free(work.paths);
+    return ret;
+}
+
 struct map *AL_MapFromPFMapStream(SDL_RWops *stream, bool update_navgrid)
 {
     struct map *ret;
@@ -463,8 +599,44 @@ void AL_MapFree(struct map *map)
     PF_FREE(map);
 }
 
+SDL_RWops *AL_StreamFromFile(const char *path)
+{
+    SDL_RWops *file = SDL_RWFromFile(path, "rb");
+    if(!file)
+        goto fail_open;
+
+    Sint64 size = SDL_RWsize(file);
+    if(size < 0)
+        goto fail_size;
+
+    void *buff = malloc(size + 1);
+    if(!buff)
+        goto fail_size;
+
+    if(SDL_RWread(file, buff, 1, size) != size)
+        goto fail_read;
+
+    SDL_RWops *ret = SDL_RWFromConstMem(buff, size);
+    if(!ret)
+        goto fail_read;
+
+    ret->close = al_mem_stream_close;
+    SDL_RWclose(file);
+    return ret;
+
+fail_read:
+    free(buff);
+fail_size:
+    SDL_RWclose(file);
+fail_open:
+    return NULL;
+}
+
 bool AL_ReadLine(SDL_RWops *stream, char *outbuff)
 {
+    if(stream->type == SDL_RWOPS_MEMORY || stream->type == SDL_RWOPS_MEMORY_RO)
+        return al_read_line_mem(stream, outbuff);
+
     int idx = 0;
     do { 
         if(!SDL_RWread(stream, outbuff + idx, 1, 1))
@@ -515,9 +687,9 @@ bool AL_Init(void)
     if(!s_name_resource_table)
         goto fail_name_res_table;
 
-    s_uid_ent_table = kh_init(uid_ent);
-    if(!s_uid_ent_table)
-        goto fail_uid_ent_table;
+    vec_entslot_init(&s_ent_slots);
+    if(!vec_entslot_resize(&s_ent_slots, 1024))
+        goto fail_ent_slots;
 
     mpa_ent_init(&s_mpool, 1024, 1024);
     if(!mpa_ent_reserve(&s_mpool, 1024))
@@ -526,8 +698,8 @@ bool AL_Init(void)
     return true;
 
 fail_mpool:
-    kh_destroy(uid_ent, s_uid_ent_table);
-fail_uid_ent_table:
+    vec_entslot_destroy(&s_ent_slots);
+fail_ent_slots:
     kh_destroy(entity_res, s_name_resource_table);
 fail_name_res_table:
     return false;
@@ -541,11 +713,11 @@ void AL_Shutdown(void)
     kh_foreach(s_name_resource_table, key, curr, {
         PF_FREE(key);
         PF_FREE(curr.render_private);
-        PF_FREE(curr.anim_private);
+        pf_tfree(curr.anim_private);
         PF_FREE(curr.basedir);
         PF_FREE(curr.filename);
     });
-    kh_destroy(uid_ent, s_uid_ent_table);
+    vec_entslot_destroy(&s_ent_slots);
     kh_destroy(entity_res, s_name_resource_table);
     mpa_ent_destroy(&s_mpool);
 }
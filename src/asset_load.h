@@ -88,11 +88,18 @@ void          *AL_RenderPrivateForName(const char *base_path, const char *pfobj_
 bool           AL_NameForRenderPrivate(void *render_private, char out_dir[], 
                                        char out_name[]);
 bool           AL_PreloadPFObj(const char *base_path, const char *pfobj_name);
+/* Loads a set of models at once, reading the files on the worker threads. */
+bool           AL_PreloadPFObjs(size_t count, const char *base_paths[], const char *pfobj_names[]);
 
 struct map    *AL_MapFromPFMapStream(SDL_RWops *stream, bool update_navgrid);
 void           AL_MapFree(struct map *map);
 size_t         AL_MapShallowCopySize(SDL_RWops *stream);
 
+/* Reads the entire file into memory and returns a read-only stream over it. 
+ * Lines are then read from the buffer directly instead of making a call 
+ * per byte. The buffer is freed when the stream is closed.
+ */
+SDL_RWops     *AL_StreamFromFile(const char *path);
 bool           AL_ReadLine(SDL_RWops *stream, char *outbuff);
 bool           AL_ParseAABB(SDL_RWops *stream, struct aabb *out);
 
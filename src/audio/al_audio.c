@@ -64,6 +64,11 @@
 #define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
 #define EPSILON         (1.0f/1024)
 
+/* Music tracks are streamed from disk through a small queue of buffers 
+ * instead of being fully decoded into memory up front. */
+#define MUSIC_NBUFFS     (4)
+#define MUSIC_CHUNK_SIZE (64 * 1024)
+
 #define CHK_TRUE_RET(_pred)             \
     do{                                 \
         if(!(_pred))                    \
@@ -76,7 +81,34 @@ struct al_buffer{
     ALenum format;
 };
 
+/* The layout of the PCM data of a WAV file */
+struct wav_info{
+    ALenum  format;
+    ALsizei freq;
+    size_t  block_align;
+    size_t  data_begin;
+    size_t  data_size;
+};
+
+struct music_stream{
+    SDL_RWops      *file;
+    const char     *name;
+    struct wav_info info;
+    size_t          data_pos;
+    ALuint          buffers[MUSIC_NBUFFS];
+    /* The next chunk of the track is read from disk on a background 
+     * task while the queued buffers are playing. */
+    unsigned char  *chunk;
+    size_t          chunk_size;
+    bool            task_running;
+    uint32_t        tid;
+    struct future   future;
+};
+
 KHASH_MAP_INIT_STR(buffer, struct al_buffer)
+KHASH_MAP_INIT_STR(track, const char*)
+
+typedef bool (*index_func_t)(const char *name, const char *path, void *table);
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -85,12 +117,14 @@ KHASH_MAP_INIT_STR(buffer, struct al_buffer)
 static ALCdevice             *s_device = NULL;
 static ALCcontext            *s_context = NULL;
 
-static khash_t(buffer)       *s_music;
+static khash_t(track)        *s_music;
+static struct music_stream    s_stream;
 static khash_t(buffer)       *s_effects;
 static ALuint                 s_music_source;
 static ALuint                 s_foreground_sources[AUDIO_NUM_FG_CHANNELS];
 
 static bool                   s_mute_on_focus_loss = false;
+static bool                   s_show_hearing_range = false;
 static ALfloat                s_master_volume = 0.5f;
 static ALfloat                s_music_volume = 0.5f;
 static enum playback_mode     s_music_mode = MUSIC_MODE_PLAYLIST;
@@ -154,6 +188,207 @@ static void audio_free_buffer(struct al_buffer *buff)
     AL_ASSERT_OK();
 }
 
+static bool audio_read_wav_header(SDL_RWops *file, struct wav_info *out)
+{
+    char id[4];
+    CHK_TRUE_RET(SDL_RWread(file, id, sizeof(id), 1) == 1);
+    CHK_TRUE_RET(!memcmp(id, "RIFF", sizeof(id)));
+    SDL_ReadLE32(file);
+    CHK_TRUE_RET(SDL_RWread(file, id, sizeof(id), 1) == 1);
+    CHK_TRUE_RET(!memcmp(id, "WAVE", sizeof(id)));
+
+    bool has_fmt = false;
+    int channels = 0, bits = 0;
+
+    while(SDL_RWread(file, id, sizeof(id), 1) == 1) {
+
+        Uint32 size = SDL_ReadLE32(file);
+        Sint64 begin = SDL_RWtell(file);
+        CHK_TRUE_RET(begin >= 0);
+
+        if(!memcmp(id, "fmt ", sizeof(id))) {
+
+            /* Only uncompressed PCM data can be streamed as-is */
+            Uint16 tag = SDL_ReadLE16(file);
+            CHK_TRUE_RET(tag == 0x0001 || tag == 0xfffe);
+            channels = SDL_ReadLE16(file);
+            out->freq = SDL_ReadLE32(file);
+            SDL_ReadLE32(file);
+            out->block_align = SDL_ReadLE16(file);
+            bits = SDL_ReadLE16(file);
+            has_fmt = true;
+
+        }else if(!memcmp(id, "data", sizeof(id))) {
+
+            CHK_TRUE_RET(has_fmt);
+            out->data_begin = begin;
+            out->data_size = size;
+            break;
+        }
+        /* Chunks are padded to an even size */
+        CHK_TRUE_RET(SDL_RWseek(file, begin + size + (size & 0x1), RW_SEEK_SET) >= 0);
+    }
+
+    CHK_TRUE_RET(has_fmt && out->data_size > 0 && out->block_align > 0);
+    CHK_TRUE_RET(bits == 8 || bits == 16);
+
+    switch(channels) {
+    case 1: out->format = (bits == 8) ? AL_FORMAT_MONO8 : AL_FORMAT_MONO16; break;
+    case 2: out->format = (bits == 8) ? AL_FORMAT_STEREO8 : AL_FORMAT_STEREO16; break;
+    default: return false;
+    }
+    return true;
+}
+
+static struct result music_read_task(void *arg)
+{
+    struct music_stream *stream = arg;
+
+    size_t chunk_max = MUSIC_CHUNK_SIZE - (MUSIC_CHUNK_SIZE % stream->info.block_align);
+    size_t left = stream->info.data_size - stream->data_pos;
+    size_t size = MIN(chunk_max, left);
+
+    stream->chunk_size = 0;
+    if(size > 0) {
+        stream->chunk_size = SDL_RWread(stream->file, stream->chunk, 1, size);
+        stream->data_pos += stream->chunk_size;
+    }
+    return NULL_RESULT;
+}
+
+static void music_join(void)
+{
+    if(!s_stream.task_running)
+        return;
+
+    while(!Sched_FutureIsReady(&s_stream.future)) {
+        Sched_RunSync(s_stream.tid);
+    }
+    s_stream.task_running = false;
+}
+
+static void music_read_next(void)
+{
+    assert(!s_stream.task_running);
+
+    SDL_AtomicSet(&s_stream.future.status, FUTURE_INCOMPLETE);
+    s_stream.tid = Sched_Create(4, music_read_task, &s_stream, &s_stream.future, 
+        TASK_RUN_DURING_PAUSE);
+    s_stream.task_running = true;
+
+    if(s_stream.tid == NULL_TID) {
+        music_read_task(&s_stream);
+        SDL_AtomicSet(&s_stream.future.status, FUTURE_COMPLETE);
+        s_stream.task_running = false;
+    }
+}
+
+static void music_close(void)
+{
+    music_join();
+
+    alSourceStop(s_music_source);
+    alSourcei(s_music_source, AL_BUFFER, 0);
+    AL_ASSERT_OK();
+
+    if(s_stream.file) {
+        SDL_RWclose(s_stream.file);
+    }
+    s_stream.file = NULL;
+    s_stream.name = NULL;
+}
+
+static bool music_open(const char *name, const char *path)
+{
+    music_close();
+
+    SDL_RWops *file = SDL_RWFromFile(path, "rb");
+    if(!file)
+        return false;
+
+    struct wav_info info;
+    if(!audio_read_wav_header(file, &info)
+    || SDL_RWseek(file, info.data_begin, RW_SEEK_SET) < 0) {
+        SDL_RWclose(file);
+        return false;
+    }
+
+    s_stream.file = file;
+    s_stream.name = name;
+    s_stream.info = info;
+    s_stream.data_pos = 0;
+
+    /* Prime the queue synchronously so that playback can start right away */
+    int nqueued = 0;
+    for(int i = 0; i < MUSIC_NBUFFS; i++) {
+
+        music_read_task(&s_stream);
+        if(s_stream.chunk_size == 0)
+            break;
+
+        alBufferData(s_stream.buffers[i], info.format, s_stream.chunk, 
+            s_stream.chunk_size, info.freq);
+        alSourceQueueBuffers(s_music_source, 1, &s_stream.buffers[i]);
+        nqueued++;
+    }
+    AL_ASSERT_OK();
+
+    if(nqueued == 0) {
+        music_close();
+        return false;
+    }
+
+    alSourcePlay(s_music_source);
+    music_read_next();
+    return true;
+}
+
+/* Returns false when the track has finished playing */
+static bool music_update(void)
+{
+    if(!s_stream.file)
+        return true;
+
+    ALint nprocessed = 0;
+    alGetSourcei(s_music_source, AL_BUFFERS_PROCESSED, &nprocessed);
+
+    while(nprocessed > 0) {
+
+        if(s_stream.task_running && !Sched_FutureIsReady(&s_stream.future))
+            break;
+        music_join();
+
+        if(s_stream.chunk_size == 0)
+            break;
+
+        ALuint buffer;
+        alSourceUnqueueBuffers(s_music_source, 1, &buffer);
+        alBufferData(buffer, s_stream.info.format, s_stream.chunk, 
+            s_stream.chunk_size, s_stream.info.freq);
+        alSourceQueueBuffers(s_music_source, 1, &buffer);
+        nprocessed--;
+
+        music_read_next();
+    }
+    AL_ASSERT_OK();
+
+    ALint state;
+    alGetSourcei(s_music_source, AL_SOURCE_STATE, &state);
+    if(state != AL_STOPPED)
+        return true;
+
+    bool done = !s_stream.task_running && (s_stream.chunk_size == 0);
+    if(done)
+        return false;
+
+    /* The disk reads couldn't keep up and we ran dry. Pick up 
+     * where we left off once there's new data queued. */
+    if(nprocessed == 0) {
+        alSourcePlay(s_music_source);
+    }
+    return true;
+}
+
 static void audio_create_global_source(ALuint *src, ALfloat volume)
 {
     alGenSources(1, src);
@@ -168,7 +403,62 @@ static void audio_create_global_source(ALuint *src, ALfloat volume)
     AL_ASSERT_OK();
 }
 
-static void audio_index_directory(const char *prefix, const char *dir, khash_t(buffer) *table)
+static bool audio_add_effect(const char *name, const char *path, void *table)
+{
+    struct al_buffer audio;
+    if(!audio_load_wav(path, &audio))
+        return false;
+
+    const char *key = pf_strdup(name);
+    if(!key) {
+        audio_free_buffer(&audio);
+        return false;
+    }
+
+    int status;
+    khiter_t k = kh_put(buffer, table, key, &status);
+    if(status == -1) {
+        free((void*)key);
+        audio_free_buffer(&audio);
+        return false;
+    }
+    kh_value((khash_t(buffer)*)table, k) = audio;
+    return true;
+}
+
+static bool audio_add_music(const char *name, const char *path, void *table)
+{
+    /* Only peek at the header for now - the track is 
+     * streamed from disk when it gets played. */
+    SDL_RWops *file = SDL_RWFromFile(path, "rb");
+    if(!file)
+        return false;
+
+    struct wav_info info;
+    bool valid = audio_read_wav_header(file, &info);
+    SDL_RWclose(file);
+    if(!valid)
+        return false;
+
+    const char *key = pf_strdup(name);
+    const char *value = pf_strdup(path);
+    if(!key || !value)
+        goto fail;
+
+    int status;
+    khiter_t k = kh_put(track, table, key, &status);
+    if(status == -1)
+        goto fail;
+    kh_value((khash_t(track)*)table, k) = value;
+    return true;
+
+fail:
+    free((void*)key);
+    free((void*)value);
+    return false;
+}
+
+static void audio_index_directory(const char *prefix, const char *dir, index_func_t add, void *table)
 {
     char absdir[NK_MAX_PATH_LEN];
     pf_snprintf(absdir, sizeof(absdir), "%s/%s", g_basepath, dir);
@@ -193,7 +483,7 @@ static void audio_index_directory(const char *prefix, const char *dir, khash_t(b
             }
             pf_strlcat(newprefix, files[i].name, sizeof(newprefix));
 
-            audio_index_directory(newprefix, dirpath, table);
+            audio_index_directory(newprefix, dirpath, add, table);
             continue;
         }
 
@@ -203,10 +493,6 @@ static void audio_index_directory(const char *prefix, const char *dir, khash_t(b
         char path[NK_MAX_PATH_LEN];
         pf_snprintf(path, sizeof(path), "%s/%s", absdir, files[i].name);
 
-        struct al_buffer audio;
-        if(!audio_load_wav(path, &audio))
-            continue;
-
         char name[NK_MAX_PATH_LEN] = "";
         if(prefix && strlen(prefix) > 0) {
             pf_strlcat(name, prefix, sizeof(name));
@@ -215,20 +501,7 @@ static void audio_index_directory(const char *prefix, const char *dir, khash_t(b
         pf_strlcat(name, files[i].name, sizeof(name));
         name[strlen(name) - strlen(".wav")] = '\0';
 
-        const char *key = pf_strdup(name);
-        if(!key) {
-            audio_free_buffer(&audio);
-            continue;
-        }
-
-        int status;
-        khiter_t k = kh_put(buffer, table, key, &status);
-        if(status == -1) {
-            free((void*)key);
-            audio_free_buffer(&audio);
-            continue;
-        }
-        kh_value(table, k) = audio;
+        add(name, path, table);
     }
 
     free(files);
@@ -267,6 +540,11 @@ static void audio_mute_focus_commit(const struct sval *val)
     s_mute_on_focus_loss = val->as_bool;
 }
 
+static void audio_hearing_range_commit(const struct sval *val)
+{
+    s_show_hearing_range = val->as_bool;
+}
+
 static bool audio_music_mode_validate(const struct sval *val)
 {
     if(val->type != ST_TYPE_INT)
@@ -342,7 +620,7 @@ static void audio_create_settings(void)
         },
         .prio = 0,
         .validate = audio_bool_validate,
-        .commit = NULL
+        .commit = audio_hearing_range_commit
     });
     assert(status == SS_OKAY);
 }
@@ -363,24 +641,13 @@ static void audio_window_event(void *user, void *arg)
     }
 }
 
-static const char *audio_music_name(ALuint buffer)
-{
-    const char *name;
-    struct al_buffer curr;
-
-    kh_foreach(s_music, name, curr, {
-        if(curr.buffer == buffer)
-            return name;
-    });
-    return NULL;
-}
-
-static bool audio_name_music(const char *name, ALint *out)
+static bool audio_music_path(const char *name, const char **out_key, const char **out_path)
 {
-    khiter_t k = kh_get(buffer, s_music, name);
+    khiter_t k = kh_get(track, s_music, name);
     if(k == kh_end(s_music))
         return false;
-    *out = kh_value(s_music, k).buffer;
+    *out_key = kh_key(s_music, k);
+    *out_path = kh_value(s_music, k);
     return true;
 }
 
@@ -389,10 +656,7 @@ static void audio_next_music_track(void)
     STALLOC(const char*, tracks, kh_size(s_music));
     size_t ntracks = Audio_GetAllMusic(kh_size(s_music), tracks);
 
-    ALint play_buffer = 0;
-    alGetSourcei(s_music_source, AL_BUFFER, &play_buffer);
-
-    const char *curr = audio_music_name(play_buffer);
+    const char *curr = s_stream.name;
     const char *next = curr;
 
     int curr_idx = -1;
@@ -452,10 +716,7 @@ static void audio_update_listener(void)
 
 static void audio_on_update(void *user, void *event)
 {
-    ALint src_state;
-    alGetSourcei(s_music_source, AL_SOURCE_STATE, &src_state);
-
-    if(src_state == AL_STOPPED) {
+    if(!music_update()) {
         audio_next_music_track();
     }
     audio_update_listener();
@@ -470,12 +731,7 @@ static int compare_strings(const void* a, const void* b)
 
 static void on_render_3d(void *user, void *event)
 {
-    struct sval setting;
-    ss_e status;
-    (void)status;
-
-    status = Settings_Get("pf.debug.show_hearing_range", &setting);
-    if(!setting.as_bool)
+    if(!s_show_hearing_range)
         return;
 
     if(!G_MapLoaded())
@@ -512,12 +768,16 @@ bool Audio_Init(void)
         goto fail_context;
     alcMakeContextCurrent(s_context);
 
-    if(NULL == (s_music = kh_init(buffer)))
+    if(NULL == (s_music = kh_init(track)))
         goto fail_music_table;
 
     if(NULL == (s_effects = kh_init(buffer)))
         goto fail_effects_table;
 
+    if(NULL == (s_stream.chunk = malloc(MUSIC_CHUNK_SIZE)))
+        goto fail_stream;
+    alGenBuffers(MUSIC_NBUFFS, s_stream.buffers);
+
     audio_create_global_source(&s_music_source, s_music_volume);
     for(int i = 0; i < AUDIO_NUM_FG_CHANNELS; i++) {
         audio_create_global_source(&s_foreground_sources[i], Audio_EffectVolume());
@@ -527,8 +787,8 @@ bool Audio_Init(void)
     if(!Audio_Effect_Init())
         goto fail_effects;
 
-    audio_index_directory(NULL, "assets/music", s_music);
-    audio_index_directory(NULL, "assets/sounds", s_effects);
+    audio_index_directory(NULL, "assets/music", audio_add_music, s_music);
+    audio_index_directory(NULL, "assets/sounds", audio_add_effect, s_effects);
 
     audio_create_settings();
 
@@ -540,9 +800,12 @@ bool Audio_Init(void)
 fail_effects:
     alDeleteSources(1, &s_music_source);
     alDeleteSources(AUDIO_NUM_FG_CHANNELS, s_foreground_sources);
+    alDeleteBuffers(MUSIC_NBUFFS, s_stream.buffers);
+    PF_FREE(s_stream.chunk);
+fail_stream:
     kh_destroy(buffer, s_effects);
 fail_effects_table:
-    kh_destroy(buffer, s_music);
+    kh_destroy(track, s_music);
 fail_music_table:
     alcMakeContextCurrent(NULL);
     alcDestroyContext(s_context);
@@ -555,10 +818,13 @@ fail_open:
 void Audio_Shutdown(void)
 {
     const char *name;
+    const char *path;
     struct al_buffer curr;
 
-    alSourceStop(s_music_source);
+    music_close();
     alDeleteSources(1, &s_music_source);
+    alDeleteBuffers(MUSIC_NBUFFS, s_stream.buffers);
+    PF_FREE(s_stream.chunk);
 
     for(int i = 0; i < AUDIO_NUM_FG_CHANNELS; i++) {
         alSourceStop(s_foreground_sources[i]);
@@ -567,11 +833,11 @@ void Audio_Shutdown(void)
 
     Audio_Effect_Shutdown();
 
-    kh_foreach(s_music, name, curr, {
+    kh_foreach(s_music, name, path, {
         free((void*)name);
-        audio_free_buffer(&curr);
+        free((void*)path);
     });
-    kh_destroy(buffer, s_music);
+    kh_destroy(track, s_music);
 
     kh_foreach(s_effects, name, curr, {
         free((void*)name);
@@ -590,25 +856,16 @@ void Audio_Shutdown(void)
 
 bool Audio_PlayMusic(const char *name)
 {
-    ALint src_state;
-    alGetSourcei(s_music_source, AL_SOURCE_STATE, &src_state);
-
     if(name == NULL) {
-        alSourceStop(s_music_source);
-        alSourcei(s_music_source, AL_BUFFER, 0);
+        music_close();
         return true;
     }
 
-    ALint play_buffer = 0;
-    if(!audio_name_music(name, &play_buffer))
+    const char *key, *path;
+    if(!audio_music_path(name, &key, &path))
         return false;
 
-    alSourceStop(s_music_source);
-    alSourcei(s_music_source, AL_BUFFER, play_buffer);
-    alSourcePlay(s_music_source);
-
-    AL_ASSERT_OK();
-    return true;
+    return music_open(key, path);
 }
 
 void Audio_PlayMusicFirst(void)
@@ -655,7 +912,7 @@ size_t Audio_GetAllMusic(size_t maxout, const char *out[])
     size_t ntracks = 0;
 
     const char *name;
-    kh_foreach(s_music, name, (struct al_buffer){0}, {
+    kh_foreach_key(s_music, name, {
         tracks[ntracks++] = name;
     });
     qsort(tracks, ntracks, sizeof(const char*), compare_strings);
@@ -669,9 +926,7 @@ size_t Audio_GetAllMusic(size_t maxout, const char *out[])
 
 const char *Audio_CurrMusic(void)
 {
-    ALint play_buffer = 0;
-    alGetSourcei(s_music_source, AL_BUFFER, &play_buffer);
-    return audio_music_name(play_buffer);
+    return s_stream.name;
 }
 
 const char *Audio_ErrString(ALenum err)
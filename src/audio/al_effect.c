@@ -48,6 +48,7 @@
 #include "../lib/public/vec.h"
 #include "../lib/public/quadtree.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/mem.h"
 
 #include <stdint.h>
 #include <assert.h>
@@ -59,7 +60,15 @@
 
 #define MIN(a, b)       ((a) < (b) ? (a) : (b))
 #define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
-#define INVALID_SOURCE  (~((ALuint)0))
+
+/* The number of OpenAL sources that are shared by all the positional effects.
+ * Effects that don't get a voice are still tracked and will start playing 
+ * (from the right offset) once one frees up. */
+#define MAX_VOICES      (32)
+/* Identical effects started within this many milliseconds of each other 
+ * and this close together are merged into one. */
+#define COALESCE_MS     (50)
+#define COALESCE_RADIUS (4.0f)
 
 #define CHK_TRUE_RET(_pred)             \
     do{                                 \
@@ -72,7 +81,18 @@ struct al_effect{
     vec3_t   pos;
     uint32_t start_tick;
     uint32_t end_tick;
-    ALuint   source;
+    ALint    buffer;
+};
+
+struct al_voice{
+    ALuint           source;
+    /* NULL_UID when the voice is free */
+    uint32_t         uid;
+};
+
+struct al_candidate{
+    float            dist;
+    struct al_effect effect;
 };
 
 VEC_TYPE(effect, struct al_effect)
@@ -88,8 +108,12 @@ QUADTREE_IMPL(static, effect, struct al_effect)
 
 static vec_effect_t     s_effects;
 static qt_effect_t      s_effect_tree;
-static vec_effect_t     s_active;
+static struct al_voice  s_voices[MAX_VOICES];
+static size_t           s_nvoices;
 static ALfloat          s_effect_volume = 5.0f;
+/* Effect timestamps are kept on a clock that doesn't advance while paused */
+static uint32_t         s_paused_ms;
+static bool             s_paused;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -100,22 +124,49 @@ static bool effects_equal(const struct al_effect *a, const struct al_effect *b)
     return (a->uid == b->uid);
 }
 
-static int compare_effects(const void* a, const void* b)
+static int compare_candidates(const void* a, const void* b)
 {
-    struct al_effect *effa = (struct al_effect*)a;
-    struct al_effect *effb = (struct al_effect*)b;
-    return (effa->uid - effb->uid);
+    const struct al_candidate *canda = (const struct al_candidate*)a;
+    const struct al_candidate *candb = (const struct al_candidate*)b;
+
+    if(canda->dist != candb->dist)
+        return (canda->dist < candb->dist) ? -1 : 1;
+    /* Favor the more recent effect among equally distant ones */
+    return (int)(candb->effect.start_tick - canda->effect.start_tick);
 }
 
-static void audio_update_active_set(vec_effect_t *active)
+static uint32_t audio_now(void)
 {
-    vec_effect_reset(active);
+    return SDL_GetTicks() - s_paused_ms;
+}
 
+static struct al_voice *audio_voice_for(uint32_t uid)
+{
+    for(int i = 0; i < s_nvoices; i++) {
+        if(s_voices[i].uid == uid)
+            return &s_voices[i];
+    }
+    return NULL;
+}
+
+static void audio_voice_release(struct al_voice *voice)
+{
+    alSourceStop(voice->source);
+    alSourceRewind(voice->source);
+    alSourcei(voice->source, AL_BUFFER, 0);
+    voice->uid = NULL_UID;
+}
+
+static size_t audio_audible_set(struct al_candidate *out, size_t maxout)
+{
     vec2_t center = Audio_ListenerPosXZ();
-    struct al_effect potential[512];
+    uint32_t now = audio_now();
+
+    STALLOC(struct al_effect, potential, maxout);
     size_t npotential = qt_effect_inrange_circle(&s_effect_tree, center.x, center.z, HEARING_RANGE,
-        potential, ARR_SIZE(potential));
+        potential, maxout);
 
+    size_t ret = 0;
     for(int i = 0; i < npotential; i++) {
 
         const struct al_effect *curr = &potential[i];
@@ -123,11 +174,19 @@ static void audio_update_active_set(vec_effect_t *active)
         if(!G_Fog_PlayerVisible(xz_pos))
             continue;
 
-        if(SDL_TICKS_PASSED(SDL_GetTicks(), curr->end_tick))
+        if(SDL_TICKS_PASSED(now, curr->end_tick))
             continue;
 
-        vec_effect_push(active, potential[i]);
+        vec2_t delta;
+        PFM_Vec2_Sub(&xz_pos, &center, &delta);
+        out[ret++] = (struct al_candidate){
+            .dist = PFM_Vec2_Len(&delta),
+            .effect = *curr
+        };
     }
+
+    STFREE(potential);
+    return ret;
 }
 
 static size_t audio_nsamples(ALuint buffer)
@@ -139,110 +198,84 @@ static size_t audio_nsamples(ALuint buffer)
     return nbytes * 8 / (channels * bits);
 }
 
-static void audio_advance(const struct al_effect *effect)
+static ALint audio_sample_offset(const struct al_effect *effect)
 {
-    ALint state;
-    alGetSourcei(effect->source, AL_SOURCE_STATE, &state);
-    assert(state == AL_INITIAL);
-
-    uint32_t curr = SDL_GetTicks();
-    uint32_t elapsed = curr - effect->start_tick;
+    uint32_t elapsed = audio_now() - effect->start_tick;
     uint32_t total = effect->end_tick - effect->start_tick;
+    const size_t nsamples = audio_nsamples(effect->buffer);
 
-    ALint buffer;
-    alGetSourcei(effect->source, AL_BUFFER, &buffer);
-    const size_t nsamples = audio_nsamples(buffer);
+    if(total == 0 || nsamples == 0)
+        return 0;
 
     ALint sample_offset = (((float)elapsed) / total) * nsamples;
-    sample_offset = MIN(sample_offset, nsamples-1);
-    alSourcei(effect->source, AL_SAMPLE_OFFSET, sample_offset);
-    AL_ASSERT_OK();
+    return MIN(sample_offset, nsamples-1);
 }
 
-static void audio_active_difference(vec_effect_t *curr, vec_effect_t *prev,
-                                    vec_effect_t *added, vec_effect_t *removed)
+static bool audio_voice_play(struct al_voice *voice, const struct al_effect *effect)
 {
-    vec_effect_reset(added);
-    vec_effect_reset(removed);
-
-    size_t n = vec_size(curr);
-    size_t m = vec_size(prev);
-
-    qsort(curr->array, n, sizeof(struct al_effect), compare_effects);
-    qsort(prev->array, m, sizeof(struct al_effect), compare_effects);
-
-    /* use the algorithm for finding the symmetric difference 
-     * of two sorted arrays: */
-
-    size_t nchanged = 0;
-    int i = 0, j = 0;
-    while(i < n && j < m) {
-
-        if(curr->array[i].uid < prev->array[j].uid) {
-            vec_effect_push(added, curr->array[i]);
-            i++;
-        }else if(prev->array[j].uid < curr->array[i].uid) {
-            vec_effect_push(removed, prev->array[j]);
-            j++;
-        }else{
-            i++;
-            j++;
-        }
-    }
-
-    while(i < n) {
-        vec_effect_push(added, curr->array[i]);
-        i++;
-    }
-
-    while(j < m) {
-        vec_effect_push(removed, prev->array[j]);
-        j++;
+    alSourcei(voice->source, AL_BUFFER, effect->buffer);
+    alSource3f(voice->source, AL_POSITION, effect->pos.x, effect->pos.y, effect->pos.z);
+    alSourcef(voice->source, AL_GAIN, s_effect_volume);
+    alSourcei(voice->source, AL_SAMPLE_OFFSET, audio_sample_offset(effect));
+    alSourcePlay(voice->source);
+
+    if(alGetError() != AL_NO_ERROR) {
+        audio_voice_release(voice);
+        return false;
     }
+    voice->uid = effect->uid;
+    return true;
 }
 
 static void on_update_start(void *user, void *event)
 {
+    if(s_paused)
+        return;
+
     PERF_PUSH("audio_effect::on_update_start");
 
-    vec_effect_t prev, added, removed;
-    vec_effect_init(&prev);
-    vec_effect_init(&added);
-    vec_effect_init(&removed);
-
-    vec_effect_copy(&prev, &s_active);
-
-    audio_update_active_set(&s_active);
-    audio_active_difference(&s_active, &prev, &added, &removed);
-
-    for(int i = 0; i < vec_size(&added); i++) {
-        struct al_effect *curr = &added.array[i];
-        audio_advance(curr);
-        alSourcef(curr->source, AL_GAIN, s_effect_volume);
-        alSourcePlay(curr->source);
-        /* We couldn't play the source - possibly due to hitting 
-         * the maximum source limit on our hardware. Keep huffing 
-         * and puffing along. There unfortunaly doesn't seem to be
-         * a foolproof, portable way to query this limit in OpenAL.
-         */
-        if(alGetError() != AL_NO_ERROR) {
-            alSourceStop(curr->source);
-            int idx = vec_effect_indexof(&s_active, *curr, effects_equal);
-            assert(idx >= 0);
-            vec_effect_del(&s_active, idx);
+    /* Only the closest effects get to play - the rest are virtualized
+     * and cost nothing besides being tracked in the tree. */
+    STALLOC(struct al_candidate, cands, 512);
+    size_t ncands = audio_audible_set(cands, 512);
+    qsort(cands, ncands, sizeof(cands[0]), compare_candidates);
+    ncands = MIN(ncands, s_nvoices);
+
+    /* Free up the voices of the effects that went out of range, finished,
+     * or got outranked by closer effects. */
+    for(int i = 0; i < s_nvoices; i++) {
+
+        struct al_voice *voice = &s_voices[i];
+        if(voice->uid == NULL_UID)
+            continue;
+
+        bool keep = false;
+        for(int j = 0; j < ncands; j++) {
+            if(cands[j].effect.uid == voice->uid) {
+                keep = true;
+                break;
+            }
+        }
+        if(!keep) {
+            audio_voice_release(voice);
         }
     }
 
-    for(int i = 0; i < vec_size(&removed); i++) {
-        struct al_effect *curr = &removed.array[i];
-        alSourceStop(curr->source);
-        alSourceRewind(curr->source);
-    }
+    int next_free = 0;
+    for(int i = 0; i < ncands; i++) {
 
-    vec_effect_destroy(&prev);
-    vec_effect_destroy(&added);
-    vec_effect_destroy(&removed);
+        const struct al_effect *curr = &cands[i].effect;
+        if(audio_voice_for(curr->uid))
+            continue;
+
+        while(next_free < s_nvoices && s_voices[next_free].uid != NULL_UID)
+            next_free++;
+        assert(next_free < s_nvoices);
+
+        audio_voice_play(&s_voices[next_free], curr);
+    }
 
+    STFREE(cands);
     AL_ASSERT_OK();
     PERF_POP();
 }
@@ -254,7 +287,6 @@ static void on_new_map(void *user, void *event)
         return;
 
     Audio_EffectClearState();
-    assert(vec_size(&s_active) == 0);
     assert(vec_size(&s_effects) == 0);
     assert(s_effect_tree.nrecs == 0);
 
@@ -276,24 +308,22 @@ static void on_new_map(void *user, void *event)
 static void on_1hz_tick(void *user, void *event)
 {
     PERF_PUSH("audio_effect::on_1hz_tick");
-    uint32_t now = SDL_GetTicks();
+    uint32_t now = audio_now();
 
     for(int i = vec_size(&s_effects)-1; i >= 0; i--) {
         struct al_effect curr = s_effects.array[i];
         if(!SDL_TICKS_PASSED(now, curr.end_tick))
             continue;
 
-        int idx = vec_effect_indexof(&s_active, curr, effects_equal);
-        if(idx != -1)
+        if(audio_voice_for(curr.uid))
             continue;
 
-        alDeleteSources(1, &curr.source);
+        Entity_FreeUID(curr.uid);
         vec_effect_del(&s_effects, i);
         qt_effect_delete(&s_effect_tree, curr.pos.x, curr.pos.z, curr);
     }
 
     assert(s_effect_tree.nrecs == vec_size(&s_effects));
-    AL_ASSERT_OK();
     PERF_POP();
 }
 
@@ -310,9 +340,8 @@ static void audio_effect_volume_commit(const struct sval *val)
 {
     s_effect_volume = val->as_float;
 
-    for(int i = 0; i < vec_size(&s_active); i++) {
-        const struct al_effect *curr = &vec_AT(&s_active, i);
-        alSourcef(curr->source, AL_GAIN, s_effect_volume);
+    for(int i = 0; i < s_nvoices; i++) {
+        alSourcef(s_voices[i].source, AL_GAIN, s_effect_volume);
     }
     Audio_SetForegroundEffectVolume(s_effect_volume);
 }
@@ -335,39 +364,54 @@ static void audio_create_settings(void)
     assert(status == SS_OKAY);
 }
 
-static void audio_make_effect_source(ALuint *out, vec3_t pos, ALint buffer)
+static void audio_create_voices(void)
 {
-    ALuint source;
-    alGenSources(1, &source);
-
-    /* Resort to dropping the request if we are not able 
-     * to generate more sources */
-    ALenum error = alGetError();
-    if(error == AL_OUT_OF_MEMORY) {
-        *out = INVALID_SOURCE;
-        return;
-    }
+    s_nvoices = 0;
+    for(int i = 0; i < MAX_VOICES; i++) {
+
+        ALuint source;
+        alGenSources(1, &source);
 
-    alSourcef(source,  AL_PITCH, 1);
-    alSourcef(source,  AL_GAIN, s_effect_volume);
-    alSourcei(source,  AL_BUFFER, buffer);
-    alSource3f(source, AL_POSITION, pos.x, pos.y, pos.z);
-    alSource3f(source, AL_VELOCITY, 0, 0, 0);
-    alSourcei(source,  AL_LOOPING, AL_FALSE);
-    alSourcei(source,  AL_SOURCE_RELATIVE, AL_FALSE);
-    alSourcef(source,  AL_MAX_DISTANCE, HEARING_RANGE * 2.0f);
-    alSourcef(source,  AL_ROLLOFF_FACTOR, 0.5f);
-
-    *out = source;
+        /* Settle for fewer voices if we are not able to 
+         * generate any more sources */
+        if(alGetError() != AL_NO_ERROR)
+            break;
+
+        alSourcef(source,  AL_PITCH, 1);
+        alSourcef(source,  AL_GAIN, s_effect_volume);
+        alSource3f(source, AL_VELOCITY, 0, 0, 0);
+        alSourcei(source,  AL_LOOPING, AL_FALSE);
+        alSourcei(source,  AL_SOURCE_RELATIVE, AL_FALSE);
+        alSourcef(source,  AL_MAX_DISTANCE, HEARING_RANGE * 2.0f);
+        alSourcef(source,  AL_ROLLOFF_FACTOR, 0.5f);
+
+        s_voices[s_nvoices++] = (struct al_voice){
+            .source = source,
+            .uid = NULL_UID
+        };
+    }
     AL_ASSERT_OK();
 }
 
-static bool audio_save_effect(SDL_RWops *stream, const struct al_effect *effect)
+static bool audio_coalesce(vec3_t pos, ALint buffer)
 {
-    ALint buffer;
-    alGetSourcei(effect->source, AL_BUFFER, &buffer);
+    struct al_effect near[16];
+    size_t nnear = qt_effect_inrange_circle(&s_effect_tree, pos.x, pos.z, COALESCE_RADIUS,
+        near, ARR_SIZE(near));
+    uint32_t now = audio_now();
+
+    for(int i = 0; i < nnear; i++) {
+        if(near[i].buffer != buffer)
+            continue;
+        if(now - near[i].start_tick <= COALESCE_MS)
+            return true;
+    }
+    return false;
+}
 
-    const char *name = Audio_GetEffectName(buffer);
+static bool audio_save_effect(SDL_RWops *stream, const struct al_effect *effect)
+{
+    const char *name = Audio_GetEffectName(effect->buffer);
     struct attr name_attr = (struct attr){ .type = TYPE_STRING, };
     pf_strlcpy(name_attr.val.as_string, name, sizeof(name_attr.val.as_string));
     CHK_TRUE_RET(Attr_Write(stream, &name_attr, "name"));
@@ -384,19 +428,17 @@ static bool audio_save_effect(SDL_RWops *stream, const struct al_effect *effect)
     };
     CHK_TRUE_RET(Attr_Write(stream, &pos_attr, "pos"));
 
-    ALint offset;
-    alGetSourcei(effect->source, AL_SAMPLE_OFFSET, &offset);
     struct attr offset_attr = (struct attr){
         .type = TYPE_INT, 
-        .val.as_int = offset
+        .val.as_int = audio_sample_offset(effect)
     };
     CHK_TRUE_RET(Attr_Write(stream, &offset_attr, "offset"));
 
-    ALint state;
-    alGetSourcei(effect->source, AL_SOURCE_STATE, &state);
+    /* Which effects are audible is re-derived after loading, so 
+     * the state is only kept for compatibility. */
     struct attr state_attr = (struct attr){
         .type = TYPE_INT, 
-        .val.as_int = state
+        .val.as_int = audio_voice_for(effect->uid) ? AL_PLAYING : AL_INITIAL
     };
     CHK_TRUE_RET(Attr_Write(stream, &state_attr, "state"));
 
@@ -426,65 +468,28 @@ static bool audio_load_effect(SDL_RWops *stream)
 
     CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
     CHK_TRUE_RET(attr.type == TYPE_INT);
-    ALint state = attr.val.as_int;
 
     ALint buffer;
-    if(Audio_GetEffectBuffer(name, &buffer)) {
-
-        ALuint source;
-        audio_make_effect_source(&source, pos, buffer);
-        if(source == INVALID_SOURCE)
-            return false;
-        alSourcei(source, AL_SAMPLE_OFFSET, offset);
-
-        if(alGetError() != AL_NO_ERROR) {
-            alDeleteSources(1, &source);
-            return true;
-        }
-
-        switch(state){
-        case AL_INITIAL:
-            break;
-        case AL_PLAYING:
-            alSourcePlay(source);
-            break;
-        case AL_PAUSED:
-            alSourcePlay(source);
-            alSourcePause(source);
-            break;
-        case AL_STOPPED:
-            alSourcePlay(source);
-            alSourceStop(source);
-            break;
-        }
-
-        if(alGetError() != AL_NO_ERROR) {
-            alSourceStop(source);
-            alDeleteSources(1, &source);
-            return true;
-        }
-
-        const size_t nsamples = audio_nsamples(buffer);
-        const float duration = Audio_BufferDuration(buffer);
-        const float elapsed = (((float)offset) / nsamples) * duration;
+    if(!Audio_GetEffectBuffer(name, &buffer))
+        return true;
 
-        uint32_t start_tick = SDL_GetTicks() - elapsed * 1000;
-        uint32_t end_tick = start_tick + duration * 1000;
+    const size_t nsamples = audio_nsamples(buffer);
+    const float duration = Audio_BufferDuration(buffer);
+    const float elapsed = nsamples ? (((float)offset) / nsamples) * duration : 0.0f;
 
-        struct al_effect effect = (struct al_effect) {
-            .uid = uid,
-            .pos = pos,
-            .start_tick = start_tick,
-            .end_tick = end_tick,
-            .source = source
-        };
-        vec_effect_push(&s_effects, effect);
-        qt_effect_insert(&s_effect_tree, pos.x, pos.z, effect);
+    uint32_t start_tick = audio_now() - elapsed * 1000;
+    uint32_t end_tick = start_tick + duration * 1000;
 
-        if(state == AL_PLAYING || state == AL_PAUSED) {
-            vec_effect_push(&s_active, effect);
-        }
-    }
+    struct al_effect effect = (struct al_effect) {
+        .uid = uid,
+        .pos = pos,
+        .start_tick = start_tick,
+        .end_tick = end_tick,
+        .buffer = buffer
+    };
+    Entity_ClaimUID(uid);
+    vec_effect_push(&s_effects, effect);
+    qt_effect_insert(&s_effect_tree, pos.x, pos.z, effect);
     return true;
 }
 
@@ -509,9 +514,9 @@ bool Audio_Effect_Init(void)
     if(!qt_effect_reserve(&s_effect_tree, 4096))
         goto fail_tree;
 
-    vec_effect_init(&s_active);
-    if(!vec_effect_resize(&s_effects, 64))
-        goto fail_active;
+    audio_create_voices();
+    s_paused_ms = 0;
+    s_paused = false;
 
     audio_create_settings();
     E_Global_Register(EVENT_NEW_GAME, on_new_map, NULL, G_ALL);
@@ -521,8 +526,6 @@ bool Audio_Effect_Init(void)
     E_Global_Register(EVENT_1HZ_TICK, on_1hz_tick, NULL, G_RUNNING);
     return true;
 
-fail_active:
-    qt_effect_destroy(&s_effect_tree);
 fail_tree:
     vec_effect_destroy(&s_effects);
 fail_vec:
@@ -531,15 +534,11 @@ fail_vec:
 
 void Audio_Effect_Shutdown(void)
 {
-    for(int i = 0; i < vec_size(&s_active); i++) {
-        struct al_effect *curr = &s_active.array[i];
-        alSourceStop(curr->source);
-    }
-
-    for(int i = 0; i < vec_size(&s_effects); i++) {
-        struct al_effect *curr = &s_effects.array[i];
-        alDeleteSources(1, &curr->source);
+    for(int i = 0; i < s_nvoices; i++) {
+        alSourceStop(s_voices[i].source);
+        alDeleteSources(1, &s_voices[i].source);
     }
+    s_nvoices = 0;
 
     E_Global_Unregister(EVENT_NEW_GAME, on_new_map);
     E_Global_Unregister(EVENT_SESSION_LOADED, on_new_map);
@@ -547,7 +546,6 @@ void Audio_Effect_Shutdown(void)
     E_Global_Unregister(EVENT_UPDATE_START, on_update_start);
     E_Global_Unregister(EVENT_1HZ_TICK, on_1hz_tick);
 
-    vec_effect_destroy(&s_active);
     vec_effect_destroy(&s_effects);
     qt_effect_destroy(&s_effect_tree);
 }
@@ -558,21 +556,25 @@ bool Audio_Effect_Add(vec3_t pos, const char *track)
     if(!Audio_GetEffectBuffer(track, &buffer))
         return false;
 
-    ALuint source;
-    audio_make_effect_source(&source, pos, buffer);
-    if(source == INVALID_SOURCE)
+    /* In a big fight, the same sound gets triggered by many entities at 
+     * once - it's enough to only play one of them. */
+    if(audio_coalesce(pos, buffer))
+        return true;
+
+    uint32_t uid = Entity_NewUID();
+    if(uid == NULL_UID)
         return false;
 
-    uint32_t start_tick = SDL_GetTicks();
+    uint32_t start_tick = audio_now();
     float duration = Audio_BufferDuration(buffer);
     uint32_t end_tick = start_tick + duration * 1000;
 
     struct al_effect effect = (struct al_effect) {
-        .uid = Entity_NewUID(),
+        .uid = uid,
         .pos = pos,
         .start_tick = start_tick,
         .end_tick = end_tick,
-        .source = source
+        .buffer = buffer
     };
 
     vec_effect_push(&s_effects, effect);
@@ -587,33 +589,36 @@ float Audio_EffectVolume(void)
 
 void Audio_EffectPause(void)
 {
-    for(int i = 0; i < vec_size(&s_active); i++) {
-        struct al_effect *curr = &s_active.array[i];
-        alSourcePause(curr->source);
+    for(int i = 0; i < s_nvoices; i++) {
+        if(s_voices[i].uid == NULL_UID)
+            continue;
+        alSourcePause(s_voices[i].source);
     }
+    s_paused = true;
 }
 
 void Audio_EffectResume(uint32_t dt)
 {
-    for(int i = 0; i < vec_size(&s_active); i++) {
-        struct al_effect *curr = &s_active.array[i];
-        alSourcePlay(curr->source);
-        curr->start_tick += dt;
-        curr->end_tick += dt;
+    for(int i = 0; i < s_nvoices; i++) {
+        if(s_voices[i].uid == NULL_UID)
+            continue;
+        alSourcePlay(s_voices[i].source);
     }
+    s_paused_ms += dt;
+    s_paused = false;
 }
 
 void Audio_EffectClearState(void)
 {
-    for(int i = 0; i < vec_size(&s_active); i++) {
-        struct al_effect *curr = &s_active.array[i];
-        alSourceStop(curr->source);
+    for(int i = 0; i < s_nvoices; i++) {
+        if(s_voices[i].uid == NULL_UID)
+            continue;
+        audio_voice_release(&s_voices[i]);
     }
     for(int i = 0; i < vec_size(&s_effects); i++) {
         struct al_effect *curr = &s_effects.array[i];
-        alDeleteSources(1, &curr->source);
+        Entity_FreeUID(curr->uid);
     }
-    vec_effect_reset(&s_active);
     vec_effect_reset(&s_effects);
     qt_effect_clear(&s_effect_tree);
 }
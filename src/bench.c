@@ -0,0 +1,246 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "bench.h"
+#include "perf.h"
+#include "main.h"
+#include "lib/public/pf_string.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+enum subsystem{
+    SS_MOVEMENT,
+    SS_NAV,
+    SS_COMBAT,
+    SS_FOG,
+    SS_PROJECTILE,
+    SS_SCRIPT,
+    SS_COUNT
+};
+
+struct bench_stat{
+    double total_us;
+    double tick_us;
+    double max_tick_us;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char *s_subsystem_names[SS_COUNT] = {
+    [SS_MOVEMENT]   = "movement",
+    [SS_NAV]        = "nav",
+    [SS_COMBAT]     = "combat",
+    [SS_FOG]        = "fog",
+    [SS_PROJECTILE] = "projectile",
+    [SS_SCRIPT]     = "script",
+};
+
+/* The perf scopes which make up the work of each subsystem. The timings
+ * are inclusive, so the work that one subsystem does on behalf of another 
+ * (ex. a script handler spawning a projectile) is accounted to both. 
+ */
+static const struct{
+    const char     *scope;
+    enum subsystem  ss;
+}s_scopes[] = {
+    {"movement::on_20hz_tick",      SS_MOVEMENT     },
+    {"movement::move_task",         SS_MOVEMENT     },
+    {"N_Update",                    SS_NAV          },
+    {"nav::field_task",             SS_NAV          },
+    {"combat::on_20hz_tick",        SS_COMBAT       },
+    {"fog::update_vision_state",    SS_FOG          },
+    {"P_Projectile_Update",         SS_PROJECTILE   },
+    {"projectile::on_30hz_tick",    SS_PROJECTILE   },
+    {"script::event_handler",       SS_SCRIPT       },
+};
+
+static bool              s_active = false;
+static bool              s_prev_trace;
+static uint32_t          s_nticks;
+static uint32_t          s_ticks_done;
+static unsigned          s_seed;
+static char              s_outpath[512];
+static uint64_t          s_start_pc;
+static struct bench_stat s_stats[SS_COUNT];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void on_slice(const struct perf_slice *slice, void *user)
+{
+    for(int i = 0; i < ARR_SIZE(s_scopes); i++) {
+        if(0 == strcmp(slice->name, s_scopes[i].scope)) {
+            s_stats[s_scopes[i].ss].tick_us += slice->dur_us;
+            return;
+        }
+    }
+}
+
+static void write_percentiles(FILE *stream, const char *name, enum perf_metric metric)
+{
+    struct perf_percentiles pc;
+    Perf_GetPercentiles(metric, &pc);
+    fprintf(stream, "    \"%s\": {\"samples\": %u, \"p50_ms\": %.4f, \"p95_ms\": %.4f, "
+        "\"p99_ms\": %.4f, \"max_ms\": %.4f, \"mean_ms\": %.4f}", 
+        name, pc.nsamples, pc.p50_ms, pc.p95_ms, pc.p99_ms, pc.max_ms, pc.mean_ms);
+}
+
+static bool write_results(void)
+{
+    FILE *stream = fopen(s_outpath, "w");
+    if(!stream)
+        return false;
+
+    double wall_ms = (SDL_GetPerformanceCounter() - s_start_pc) * 1000.0 
+                   / SDL_GetPerformanceFrequency();
+
+    fprintf(stream, "{\n");
+    fprintf(stream, "  \"ticks\": %u,\n", s_ticks_done);
+    fprintf(stream, "  \"seed\": %u,\n", s_seed);
+    fprintf(stream, "  \"wall_ms\": %.4f,\n", wall_ms);
+    fprintf(stream, "  \"ms_per_tick\": %.4f,\n", wall_ms / MAX(s_ticks_done, 1));
+    fprintf(stream, "  \"subsystems\": {\n");
+
+    for(int i = 0; i < SS_COUNT; i++) {
+        fprintf(stream, "    \"%s\": {\"total_ms\": %.4f, \"mean_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+            s_subsystem_names[i],
+            s_stats[i].total_us / 1000.0,
+            s_stats[i].total_us / 1000.0 / MAX(s_ticks_done, 1),
+            s_stats[i].max_tick_us / 1000.0,
+            (i == SS_COUNT - 1) ? "" : ",");
+    }
+    fprintf(stream, "  },\n");
+
+    /* The percentiles are over the most recent window of samples only */
+    fprintf(stream, "  \"percentiles\": {\n");
+    write_percentiles(stream, "frame", PERF_METRIC_FRAME);
+    fprintf(stream, ",\n");
+    write_percentiles(stream, "sim", PERF_METRIC_SIM);
+    fprintf(stream, "\n  }\n");
+    fprintf(stream, "}\n");
+
+    bool ret = !ferror(stream);
+    fclose(stream);
+    return ret;
+}
+
+static void reset_stats(void)
+{
+    memset(s_stats, 0, sizeof(s_stats));
+    s_ticks_done = 0;
+    s_start_pc = SDL_GetPerformanceCounter();
+    Perf_ResetPercentiles();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Bench_Init(uint32_t nticks, unsigned seed, const char *outpath)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!s_active);
+
+    if(Perf_CaptureActive())
+        return false;
+
+    s_prev_trace = Perf_TraceEnabled();
+    Perf_SetTraceEnabled(true);
+    if(!Perf_TraceEnabled())
+        return false;
+
+    s_nticks = nticks;
+    s_seed = seed;
+    pf_strlcpy(s_outpath, outpath, sizeof(s_outpath));
+    srand(seed);
+
+    Perf_TraceDrain(NULL, NULL);
+    reset_stats();
+    s_active = true;
+    return true;
+}
+
+void Bench_Shutdown(void)
+{
+    if(!s_active)
+        return;
+    Perf_SetTraceEnabled(s_prev_trace);
+    s_active = false;
+}
+
+bool Bench_Active(void)
+{
+    return s_active;
+}
+
+bool Bench_Step(bool sim_ran)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_active);
+
+    if(!sim_ran) {
+        Perf_TraceDrain(NULL, NULL);
+        reset_stats();
+        return true;
+    }
+
+    Perf_TraceDrain(on_slice, NULL);
+    for(int i = 0; i < SS_COUNT; i++) {
+        s_stats[i].total_us += s_stats[i].tick_us;
+        s_stats[i].max_tick_us = MAX(s_stats[i].max_tick_us, s_stats[i].tick_us);
+        s_stats[i].tick_us = 0.0;
+    }
+
+    if(++s_ticks_done < s_nticks)
+        return true;
+
+    if(!write_results()) {
+        fprintf(stderr, "Failed to write benchmark results to: %s\n", s_outpath);
+    }else{
+        printf("Wrote benchmark results (%u ticks) to: %s\n", s_ticks_done, s_outpath);
+    }
+    return false;
+}
+
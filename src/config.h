@@ -40,13 +40,32 @@
 #include <SDL.h>
 
 #define CONFIG_SCHED_TARGET_FPS     (30)
+/* Fraction of the tick after which the main thread stops running background tasks */
+#define CONFIG_SCHED_BG_BUDGET      (0.75f)
+/* Pin each worker thread to its' own hardware thread */
+#define CONFIG_SCHED_PIN_WORKERS    (true)
 #define CONFIG_USE_BATCH_RENDERING  (true)
+/* A script event handler running for longer than this is reported as an overrun */
+#define CONFIG_SCRIPT_HANDLER_BUDGET_MS (2.0f)
+/* Script garbage collection, run by the engine at the end of every tick. The 
+ * young generation is collected once this many objects have been allocated, 
+ * the middle one after this many young collections, if it fits the budget. */
+#define CONFIG_SCRIPT_GC_YOUNG_THRESH   (700)
+#define CONFIG_SCRIPT_GC_MID_THRESH     (10)
+#define CONFIG_SCRIPT_GC_BUDGET_MS      (1.0f)
+#define CONFIG_SCRIPT_GC_MAX_DEFERRED   (30)
+/* The number of middle generation collections after which the oldest 
+ * generation is collected even outside of loading */
+#define CONFIG_SCRIPT_GC_FULL_CAP       (1000)
 
 /* The far end of the camera's clipping frustrum, in OpenGL coordinates */
 #define CONFIG_DRAWDIST             (1000)
 #define CONFIG_TILE_TEX_RES         (128)
 #define CONFIG_ARR_TEX_RES          (512)
 #define CONFIG_LOADING_SCREEN       "assets/loading_screens/default.png"
+/* The desktop resolution reported when running without a display */
+#define CONFIG_HEADLESS_RES_X       (1920)
+#define CONFIG_HEADLESS_RES_Y       (1080)
 
 #define CONFIG_SHADOW_MAP_RES       (2048)
 /* Determines the draw distance from the light source when creating the
@@ -61,14 +80,37 @@
 #define CONFIG_SHADOW_FOV           (160)
 
 #define CONFIG_SETTINGS_FILENAME    "pf.conf"
+/* Linked shader program binaries, keyed by driver and shader source. 
+ * Stored alongside the settings file. 
+ */
+#define CONFIG_SHADER_CACHE_FILENAME "pf.shadercache"
 
-#define CONFIG_LOS_CACHE_SZ         (2048)
-#define CONFIG_FLOW_CACHE_SZ        (2048)
+/* The LOS and flow field caches are budgeted in bytes. The number of 
+ * entries is derived from the size of a single field. The grid path cache 
+ * is capped both by entry count and by the total size of the cached paths.
+ */
+#define CONFIG_LOS_CACHE_BYTES      (8 * 1024 * 1024)
+#define CONFIG_FLOW_CACHE_BYTES     (8 * 1024 * 1024)
 #define CONFIG_MAPPING_CACHE_SZ     (4096)
 #define CONFIG_GRID_PATH_CACHE_SZ   (8192)
+#define CONFIG_GRID_PATH_CACHE_BYTES (2 * 1024 * 1024)
+
+/* The number of portal hops with known routes to a destination portal that 
+ * are kept per navigation layer. The routes are dropped whenever the portal 
+ * graph changes, and when this limit is reached.
+ */
+#define CONFIG_PORTAL_ROUTE_CACHE_SZ (16384)
 
 #define CONFIG_FRAME_STEP_HOTKEY    (SDL_SCANCODE_SPACE)
 
+/* Back the large arena blocks (stalloc memblocks, navigation chunks) with 
+ * huge pages. On Linux, explicit (MAP_HUGETLB) pages are used if any have 
+ * been reserved, otherwise the mapping is made eligible for transparent 
+ * huge pages. On Windows, large pages require the 'Lock pages in memory' 
+ * privilege. When they are not available, regular pages are used.
+ */
+#define CONFIG_HUGE_PAGES           (true)
+
 /* Some debug configurations to allow overriding malloc/free and friends 
  * on Linux builds to assist in debuggin memory problems. See debug_malloc.c
  * for details.
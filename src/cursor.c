@@ -151,6 +151,13 @@ static struct cursor_resource  s_cursors[_CURSOR_MAX];
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+/* Without a video subsystem, no cursors can be created. The resources 
+ * are still kept track of, with NULL cursors. */
+static bool headless(void)
+{
+    return !SDL_WasInit(SDL_INIT_VIDEO);
+}
+
 static void cursor_rts_set_active(int mouse_x, int mouse_y)
 {
     if(!s_rts_mode) {
@@ -238,7 +245,7 @@ bool Cursor_InitDefault(const char *basedir)
         || !Cursor_LoadBMP(i, curr->path, curr->hot_x, curr->hot_y)) {
 
             curr->cursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_ARROW);
-            if(!curr->cursor)
+            if(!curr->cursor && !headless())
                 goto fail;
         }
     }
@@ -293,7 +300,7 @@ bool Cursor_LoadBMP(enum cursortype type, const char *path, int hotx, int hoty)
         goto fail;
 
     cursor = SDL_CreateColorCursor(surface, hotx, hoty);
-    if(!cursor)
+    if(!cursor && !headless())
         goto fail;
 
     struct cursor_resource *curr = &s_cursors[type];
@@ -325,7 +332,7 @@ bool Cursor_NamedLoadBMP(const char *name, const char *path, int hotx, int hoty)
         goto fail;
 
     cursor = SDL_CreateColorCursor(surface, hotx, hoty);
-    if(!cursor)
+    if(!cursor && !headless())
         goto fail;
 
     struct cursor_resource entry = (struct cursor_resource) {
@@ -34,8 +34,6 @@
  */
 
 #include "entity.h" 
-#include "sched.h"
-#include "task.h"
 #include "event.h"
 #include "main.h"
 #include "camera.h"
@@ -48,27 +46,60 @@
 #include "lib/public/mpool.h"
 #include "lib/public/pf_string.h"
 #include "lib/public/string_intern.h"
+#include "lib/public/vec.h"
+#include "lib/public/mem.h"
 
 #include <assert.h>
+#include <string.h>
 
 
 #define EPSILON     (1.0/1024)
 #define MIN(a, b)   ((a) < (b) ? (a) : (b))
 #define MAX(a, b)   ((a) > (b) ? (a) : (b))
 
-KHASH_SET_INIT_INT(uid)
-KHASH_MAP_INIT_STR(ents, kh_uid_t)
+/* Word index (uid / 64) to the bits of the 64 UIDs in that word */
+KHASH_MAP_INIT_INT(words, uint64_t)
+/* Interned tag string ID to tag index */
+KHASH_MAP_INIT_INT(tagid, int)
+
+/* Every distinct tag gets a small integer ID indexing one of these. The 
+ * set of tagged entities is kept as a sparse bitset over the UID space, 
+ * so that multi-tag queries are just word-wise set operations. */
+struct tag_index{
+    const char      *name; /* interned */
+    khash_t(words)  *bits;
+    size_t           count;
+};
 
 struct taglist{
     uint64_t ntags;
     const char *tags[MAX_TAGS];
 };
 
-struct dis_arg{
-    uint32_t uid;
+/* The ping and disappear effects are plain records advanced by a single 
+ * pass over all of them, rather than each getting its' own task. */
+struct ping_effect{
+    uint32_t    uid;
+    uint32_t    flags;
+    uint32_t    start;
+    float       radius;
+    struct obb  obb;
+};
+
+struct disappear_effect{
+    uint32_t    uid;
     const struct map *map;
-    void (*on_finish)(void*);
-    void *arg;
+    void      (*on_finish)(void*);
+    void       *arg;
+    vec3_t      start_pos;
+    int         faction_id;
+    uint32_t    flags;
+    struct obb  obb;
+    int         height;
+    vec2_t      curr_shift;
+    vec2_t      prev_shift;
+    uint32_t    start;
+    uint32_t    elapsed;
 };
 
 struct iconlist{
@@ -76,27 +107,53 @@ struct iconlist{
     const char *icons[MAX_ICONS]; 
 };
 
+/* A UID is a slot index in the low ENTITY_UID_INDEX_BITS and the slot's 
+ * generation in the remaining high bits. Freed slots are recycled in FIFO 
+ * order with their generation bumped, so that a stale UID never aliases 
+ * the slot's new occupant and the slot index space stays dense. */
+struct uid_slot{
+    uint16_t gen;
+    bool     live;
+};
+
 MPOOL_TYPE(taglist, struct taglist)
 MPOOL_PROTOTYPES(static, taglist, struct taglist)
 MPOOL_IMPL(static, taglist, struct taglist)
 
 KHASH_MAP_INIT_INT(tags, struct taglist)
+VEC_TYPE(uidslot, struct uid_slot)
+VEC_IMPL(static inline, uidslot, struct uid_slot)
+VEC_TYPE(idx, uint32_t)
+VEC_IMPL(static inline, idx, uint32_t)
+VEC_TYPE(tagidx, struct tag_index)
+VEC_IMPL(static inline, tagidx, struct tag_index)
 KHASH_MAP_INIT_INT(icons, struct iconlist)
+VEC_TYPE(ping, struct ping_effect)
+VEC_IMPL(static inline, ping, struct ping_effect)
+VEC_TYPE(dis, struct disappear_effect)
+VEC_IMPL(static inline, dis, struct disappear_effect)
 __KHASH_IMPL(trans, extern, khint32_t, struct transform, 1, kh_int_hash_func, kh_int_hash_equal)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static uint32_t          s_next_uid = 0;
-static khash_t(stridx)  *s_stridx;
-static mp_strbuff_t      s_stringpool;
+static vec_uidslot_t     s_uid_slots;
+static vec_idx_t         s_free_slots;
+static size_t            s_free_head = 0;
+/* The most recent UID that could not be claimed because its' slot 
+ * was already held by a different UID */
+static uint32_t          s_uid_conflict = NULL_UID;
 
-static kh_ents_t        *s_tag_ent_map;
+static khash_t(tagid)   *s_tag_ids;
+static vec_tagidx_t      s_tag_indices;
 static kh_tags_t        *s_ent_tag_map;
 static kh_trans_t       *s_ent_trans_map;
 static kh_icons_t       *s_ent_icons_map;
 
+static vec_ping_t        s_pings;
+static vec_dis_t         s_disappearing;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -114,42 +171,106 @@ static struct taglist *entity_taglist(uint32_t uid)
     return &kh_value(s_ent_tag_map, k);
 }
 
-static bool tag_add_entity(const char *tag, uint32_t uid)
+static struct tag_index *tag_index_get(const char *tag)
 {
-    const char *str = si_intern(tag, &s_stringpool, s_stridx);
+    si_id_t id = si_lookup(tag);
+    if(id == SI_ID_NONE)
+        return NULL;
+    khiter_t k = kh_get(tagid, s_tag_ids, id);
+    if(k == kh_end(s_tag_ids))
+        return NULL;
+    return &vec_AT(&s_tag_indices, kh_value(s_tag_ids, k));
+}
+
+static struct tag_index *tag_index_get_or_create(const char *tag)
+{
+    struct tag_index *ret = tag_index_get(tag);
+    if(ret)
+        return ret;
+
+    si_id_t id;
+    const char *str = si_intern(tag, &id);
     if(!str)
-        return false;
+        return NULL;
 
-    khiter_t k = kh_get(ents, s_tag_ent_map, str);
-    if(k == kh_end(s_tag_ent_map)) {
-        int status;
-        k = kh_put(ents, s_tag_ent_map, str, &status);
-        if(status == -1)
-            return false;
-        memset(&kh_value(s_tag_ent_map, k), 0, sizeof(kh_uid_t));
+    struct tag_index ti = (struct tag_index){
+        .name = str,
+        .bits = kh_init(words),
+        .count = 0
+    };
+    if(!ti.bits)
+        return NULL;
+    if(!vec_tagidx_push(&s_tag_indices, ti))
+        goto fail;
+
+    int status;
+    khiter_t k = kh_put(tagid, s_tag_ids, id, &status);
+    if(status == -1) {
+        vec_tagidx_pop(&s_tag_indices);
+        goto fail;
     }
+    kh_value(s_tag_ids, k) = vec_size(&s_tag_indices) - 1;
+    return &vec_AT(&s_tag_indices, vec_size(&s_tag_indices) - 1);
+
+fail:
+    kh_destroy(words, ti.bits);
+    return NULL;
+}
 
+static void tag_indices_clear(void)
+{
+    for(int i = 0; i < vec_size(&s_tag_indices); i++) {
+        kh_destroy(words, vec_AT(&s_tag_indices, i).bits);
+    }
+    vec_tagidx_reset(&s_tag_indices);
+    kh_clear(tagid, s_tag_ids);
+}
+
+static uint64_t tag_word(const struct tag_index *ti, uint32_t word_idx)
+{
+    khiter_t k = kh_get(words, ti->bits, word_idx);
+    if(k == kh_end(ti->bits))
+        return 0;
+    return kh_value(ti->bits, k);
+}
+
+static bool tag_test(const struct tag_index *ti, uint32_t uid)
+{
+    return !!(tag_word(ti, uid / 64) & (((uint64_t)1) << (uid % 64)));
+}
+
+static bool tag_set(struct tag_index *ti, uint32_t uid)
+{
     int status;
-    kh_uid_t *set = &kh_value(s_tag_ent_map, k);
-    kh_put(uid, set, uid, &status);
-    return (status != -1);
+    khiter_t k = kh_put(words, ti->bits, uid / 64, &status);
+    if(status == -1)
+        return false;
+    if(status != 0) {
+        kh_value(ti->bits, k) = 0;
+    }
+
+    uint64_t bit = ((uint64_t)1) << (uid % 64);
+    if(!(kh_value(ti->bits, k) & bit)) {
+        kh_value(ti->bits, k) |= bit;
+        ti->count++;
+    }
+    return true;
 }
 
-static void tag_remove_entity(const char *tag, uint32_t uid)
+static void tag_clear(struct tag_index *ti, uint32_t uid)
 {
-    const char *str = si_intern(tag, &s_stringpool, s_stridx);
-    if(!str)
+    khiter_t k = kh_get(words, ti->bits, uid / 64);
+    if(k == kh_end(ti->bits))
         return;
 
-    khiter_t k = kh_get(ents, s_tag_ent_map, str);
-    if(k == kh_end(s_tag_ent_map))
+    uint64_t bit = ((uint64_t)1) << (uid % 64);
+    if(!(kh_value(ti->bits, k) & bit))
         return;
 
-    kh_uid_t *set = &kh_value(s_tag_ent_map, k);
-
-    khiter_t iter = kh_get(uid, set, uid);
-    if(iter != kh_end(set)) {
-        kh_del(uid, set, iter);
+    kh_value(ti->bits, k) &= ~bit;
+    ti->count--;
+    if(kh_value(ti->bits, k) == 0) {
+        kh_del(words, ti->bits, k);
     }
 }
 
@@ -166,136 +287,130 @@ static struct iconlist *entity_iconlist(uint32_t uid)
     return &kh_value(s_ent_icons_map, k);
 }
 
-static struct result ping_task(void *arg)
-{
-    uint32_t uid = (uintptr_t)arg;
+#define PING_DURATION_MS      (1200)
+#define PING_BLINK_MS         (400)
+#define DISAPPEAR_DURATION_MS (2500.0f)
+#define DISAPPEAR_SHAKE_MS    (250)
 
-    /* Cache all the params - the entity can die on us */
-    vec2_t pos = G_Pos_GetXZ(uid);
-    float radius = G_GetSelectionRadius(uid);
+static void draw_ping(const struct ping_effect *ping)
+{
     const float width = 0.4f;
-    vec3_t color = (vec3_t){1.0f, 1.0f, 0.0f};
-    uint32_t flags = G_FlagsGet(uid);
+    const vec3_t color = (vec3_t){1.0f, 1.0f, 0.0f};
+
+    if(ping->flags & ENTITY_FLAG_BUILDING) {
+
+        R_PushCmd((struct rcmd){
+            .func = R_GL_DrawSelectionRectangle,
+            .nargs = 4,
+            .args = {
+                R_PushArg(&ping->obb, sizeof(ping->obb)),
+                R_PushArg(&width, sizeof(width)),
+                R_PushArg(&color, sizeof(color)),
+                (void*)G_GetPrevTickMap(),
+            },
+        });
+    }else{
 
-    struct obb obb;
-    Entity_CurrentOBB(uid, &obb, false);
+        vec2_t pos = G_Pos_GetXZ(ping->uid);
+        R_PushCmd((struct rcmd){
+            .func = R_GL_DrawSelectionCircle,
+            .nargs = 5,
+            .args = {
+                R_PushArg(&pos, sizeof(pos)),
+                R_PushArg(&ping->radius, sizeof(ping->radius)),
+                R_PushArg(&width, sizeof(width)),
+                R_PushArg(&color, sizeof(color)),
+                (void*)G_GetPrevTickMap(),
+            },
+        });
+    }
+}
 
-    uint32_t elapsed = 0;
-    uint32_t start = SDL_GetTicks();
-    int source;
+static void on_render_pings(void *user, void *event)
+{
+    uint32_t now = SDL_GetTicks();
+    int nkept = 0;
 
-    while(elapsed < 1200) {
-        Task_AwaitEvent(EVENT_RENDER_3D_POST, &source);
+    for(int i = 0; i < vec_size(&s_pings); i++) {
 
-        uint32_t curr = SDL_GetTicks();
-        elapsed = curr - start;
+        struct ping_effect *ping = &vec_AT(&s_pings, i);
+        uint32_t elapsed = now - ping->start;
 
-        if((elapsed / 400) == 1)
+        if(elapsed >= PING_DURATION_MS || !G_EntityExists(ping->uid))
             continue;
 
-        if(!G_EntityExists(uid))
-            break;
-
-        pos = G_Pos_GetXZ(uid);
-        if(flags & ENTITY_FLAG_BUILDING) {
-
-            R_PushCmd((struct rcmd){
-                .func = R_GL_DrawSelectionRectangle,
-                .nargs = 4,
-                .args = {
-                    R_PushArg(&obb, sizeof(obb)),
-                    R_PushArg(&width, sizeof(width)),
-                    R_PushArg(&color, sizeof(color)),
-                    (void*)G_GetPrevTickMap(),
-                },
-            });
-        }else{
-
-            R_PushCmd((struct rcmd){
-                .func = R_GL_DrawSelectionCircle,
-                .nargs = 5,
-                .args = {
-                    R_PushArg(&pos, sizeof(pos)),
-                    R_PushArg(&radius, sizeof(radius)),
-                    R_PushArg(&width, sizeof(width)),
-                    R_PushArg(&color, sizeof(color)),
-                    (void*)G_GetPrevTickMap(),
-                },
-            });
+        if((elapsed / PING_BLINK_MS) != 1) {
+            draw_ping(ping);
         }
+        vec_AT(&s_pings, nkept++) = *ping;
     }
-
-    /* Ensure render thread is no longer touching our stack */
-    Task_AwaitEvent(EVENT_UPDATE_START, &source);
-    return NULL_RESULT;
+    s_pings.size = nkept;
 }
 
-static struct result disappear_task(void *arg)
+/* Returns true when the animation has run its' course */
+static bool disappear_update(struct disappear_effect *dis, uint32_t now)
 {
-    struct dis_arg darg = *(struct dis_arg*)arg;
-    vec3_t start_pos = G_Pos_Get(darg.uid);
-    int faction_id = G_GetFactionID(darg.uid);
-    uint32_t flags = G_FlagsGet(darg.uid);
-
-    struct obb obb;
-    Entity_CurrentOBB(darg.uid, &obb, false);
-
-    if(darg.map) {
-        M_NavBlockersIncrefOBB(darg.map, faction_id, flags, &obb);
+    uint32_t prev_long = dis->elapsed / DISAPPEAR_SHAKE_MS;
+    uint32_t curr_long = (now - dis->start) / DISAPPEAR_SHAKE_MS;
+    dis->elapsed = now - dis->start;
+
+    /* Add a slight shake */
+    if(curr_long != prev_long) {
+        dis->prev_shift = dis->curr_shift;
+        dis->curr_shift.x = ((float)rand()) / RAND_MAX * 2.5f;
+        dis->curr_shift.y = ((float)rand()) / RAND_MAX * 2.5f;
     }
 
-    int height = obb.half_lengths[1] * 2.0f;
+    float pc = (dis->elapsed - (prev_long * DISAPPEAR_SHAKE_MS)) / DISAPPEAR_SHAKE_MS;
+    vec3_t curr_pos = (vec3_t){
+        dis->start_pos.x + (dis->curr_shift.x * pc + dis->prev_shift.x * (1.0f - pc)) / 2.0f, 
+        dis->start_pos.y - (dis->elapsed / DISAPPEAR_DURATION_MS) * dis->height,
+        dis->start_pos.z + (dis->curr_shift.y * pc + dis->prev_shift.y * (1.0f - pc)) / 2.0f,
+    };
+    G_Pos_Set(dis->uid, curr_pos);
+    return (dis->elapsed >= DISAPPEAR_DURATION_MS);
+}
 
-    vec2_t curr_shift = (vec2_t){0, 0};
-    vec2_t prev_shift = (vec2_t){0, 0};
+static void on_update_disappearing(void *user, void *event)
+{
+    if(vec_size(&s_disappearing) == 0)
+        return;
 
-    uint32_t newflags = G_FlagsGet(darg.uid);
-    newflags |= ENTITY_FLAG_TRANSLUCENT;
-    G_FlagsSet(darg.uid, newflags);
+    uint32_t now = SDL_GetTicks();
+    vec_dis_t finished;
+    vec_dis_init(&finished);
+    int nkept = 0;
 
-    const float duration = 2500.0f;
-    uint32_t elapsed = 0;
-    uint32_t start = SDL_GetTicks();
+    for(int i = 0; i < vec_size(&s_disappearing); i++) {
 
-    while(elapsed < duration) {
-    
-        Task_AwaitEvent(EVENT_UPDATE_START, &(int){0});
-        uint32_t curr = SDL_GetTicks();
+        struct disappear_effect *dis = &vec_AT(&s_disappearing, i);
 
         /* The entity can theoretically be forecefully removed during the 
          * disappearing animation. Make sure we don't crap out if this happens
          */
-        if(!G_EntityExists(darg.uid))
-            return NULL_RESULT;
-
-        uint32_t prev_long = elapsed / 250;
-        uint32_t curr_long =  (curr - start) / 250;
-        elapsed = curr - start;
-
-        /* Add a slight shake */
-        if(curr_long != prev_long) {
-            prev_shift = curr_shift;
-            curr_shift.x = ((float)rand()) / RAND_MAX * 2.5f;
-            curr_shift.y = ((float)rand()) / RAND_MAX * 2.5f;
-        }
+        if(!G_EntityExists(dis->uid))
+            continue;
 
-        float pc = (elapsed - (prev_long * 250)) / 250;
-        vec3_t curr_pos = (vec3_t){
-            start_pos.x + (curr_shift.x * pc + prev_shift.x * (1.0f - pc)) / 2.0f, 
-            start_pos.y - (elapsed / duration) * height,
-            start_pos.z + (curr_shift.y * pc + prev_shift.y * (1.0f - pc)) / 2.0f,
-        };
-        G_Pos_Set(darg.uid, curr_pos);
+        if(disappear_update(dis, now)) {
+            vec_dis_push(&finished, *dis);
+            continue;
+        }
+        vec_AT(&s_disappearing, nkept++) = *dis;
     }
+    s_disappearing.size = nkept;
 
-    if(darg.map) {
-        M_NavBlockersDecrefOBB(darg.map, faction_id, flags, &obb);
-    }
+    /* The callbacks are free to start new effects */
+    for(int i = 0; i < vec_size(&finished); i++) {
 
-    if(darg.on_finish) {
-        darg.on_finish(darg.arg);
+        struct disappear_effect *dis = &vec_AT(&finished, i);
+        if(dis->map) {
+            M_NavBlockersDecrefOBB(dis->map, dis->faction_id, dis->flags, &dis->obb);
+        }
+        if(dis->on_finish) {
+            dis->on_finish(dis->arg);
+        }
     }
-    return NULL_RESULT;
+    vec_dis_destroy(&finished);
 }
 
 /*****************************************************************************/
@@ -311,14 +426,110 @@ void Entity_ModelMatrix(uint32_t uid, mat4x4_t *out)
     Entity_ModelMatrixFrom(pos, rot, scale, out);
 }
 
+static uint32_t make_uid(uint32_t idx)
+{
+    return (((uint32_t)s_uid_slots.array[idx].gen) << ENTITY_UID_INDEX_BITS) | idx;
+}
+
+static bool uid_slots_extend(uint32_t nslots)
+{
+    if(nslots > ENTITY_UID_MAX_SLOTS)
+        return false;
+    while(vec_size(&s_uid_slots) < nslots) {
+        uint32_t idx = vec_size(&s_uid_slots);
+        if(!vec_uidslot_push(&s_uid_slots, (struct uid_slot){0}))
+            return false;
+        if(!vec_idx_push(&s_free_slots, idx))
+            return false;
+    }
+    return true;
+}
+
+static void uid_slots_compact(void)
+{
+    if(s_free_head < 1024 || s_free_head < vec_size(&s_free_slots) / 2)
+        return;
+    size_t left = vec_size(&s_free_slots) - s_free_head;
+    memmove(s_free_slots.array, s_free_slots.array + s_free_head, left * sizeof(uint32_t));
+    s_free_slots.size = left;
+    s_free_head = 0;
+}
+
 uint32_t Entity_NewUID(void)
 {
-    return s_next_uid++;
+    while(true) {
+        if(s_free_head == vec_size(&s_free_slots)) {
+            if(!uid_slots_extend(vec_size(&s_uid_slots) + 1))
+                return NULL_UID;
+        }
+        uint32_t idx = s_free_slots.array[s_free_head++];
+        /* Slots which were claimed explicitly are lazily dropped from the 
+         * free list here */
+        if(s_uid_slots.array[idx].live)
+            continue;
+        s_uid_slots.array[idx].live = true;
+        uid_slots_compact();
+        return make_uid(idx);
+    }
+}
+
+void Entity_FreeUID(uint32_t uid)
+{
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    if(idx >= vec_size(&s_uid_slots))
+        return;
+    struct uid_slot *slot = &s_uid_slots.array[idx];
+    if(!slot->live || slot->gen != ENTITY_UID_GEN(uid))
+        return;
+
+    slot->live = false;
+    slot->gen = (slot->gen + 1) & ((1 << (32 - ENTITY_UID_INDEX_BITS)) - 1);
+    vec_idx_push(&s_free_slots, idx);
+}
+
+bool Entity_ClaimUID(uint32_t uid)
+{
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    if(idx >= ENTITY_UID_MAX_SLOTS)
+        return false;
+    if(!uid_slots_extend(idx + 1))
+        return false;
+
+    struct uid_slot *slot = &s_uid_slots.array[idx];
+    if(slot->live) {
+        if(make_uid(idx) == uid)
+            return true;
+        s_uid_conflict = uid;
+        return false;
+    }
+    slot->gen = ENTITY_UID_GEN(uid);
+    slot->live = true;
+    return true;
+}
+
+bool Entity_UIDLive(uint32_t uid)
+{
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    if(idx >= vec_size(&s_uid_slots))
+        return false;
+    return s_uid_slots.array[idx].live && (make_uid(idx) == uid);
+}
+
+uint32_t Entity_TakeUIDConflict(void)
+{
+    uint32_t ret = s_uid_conflict;
+    s_uid_conflict = NULL_UID;
+    return ret;
+}
+
+uint32_t Entity_NextUID(void)
+{
+    return vec_size(&s_uid_slots);
 }
 
 void Entity_SetNextUID(uint32_t uid)
 {
-    s_next_uid = uid;
+    uid_slots_extend(ENTITY_UID_INDEX(uid));
 }
 
 void Entity_CurrentOBB(uint32_t uid, struct obb *out, bool identity)
@@ -389,8 +600,17 @@ void Entity_FaceTowards(uint32_t uid, vec2_t point)
 
 void Entity_Ping(uint32_t uid)
 {
-    uint32_t tid = Sched_Create(1, ping_task, (void*)(uintptr_t)uid, NULL, TASK_MAIN_THREAD_PINNED);
-    Sched_RunSync(tid);
+    ASSERT_IN_MAIN_THREAD();
+
+    /* Cache all the params - the entity can die on us */
+    struct ping_effect ping = (struct ping_effect){
+        .uid = uid,
+        .flags = G_FlagsGet(uid),
+        .start = SDL_GetTicks(),
+        .radius = G_GetSelectionRadius(uid),
+    };
+    Entity_CurrentOBB(uid, &ping.obb, false);
+    vec_ping_push(&s_pings, ping);
 }
 
 vec2_t Entity_TopScreenPos(uint32_t uid, int screenw, int screenh)
@@ -437,14 +657,14 @@ bool Entity_AddTag(uint32_t uid, const char *tag)
     struct taglist *tl = entity_taglist(uid);
     if(!tl || tl->ntags == MAX_TAGS)
         return false;
-    if(Entity_HasTag(uid, tag))
-        return true;
-    const char *str = si_intern(tag, &s_stringpool, s_stridx);
-    if(!str)
+    struct tag_index *ti = tag_index_get_or_create(tag);
+    if(!ti)
         return false;
-    if(!tag_add_entity(str, uid))
+    if(tag_test(ti, uid))
+        return true;
+    if(!tag_set(ti, uid))
         return false;
-    tl->tags[tl->ntags++] = str;
+    tl->tags[tl->ntags++] = ti->name;
     return true;
 }
 
@@ -453,26 +673,24 @@ void Entity_RemoveTag(uint32_t uid, const char *tag)
     struct taglist *tl = entity_taglist(uid);
     if(!tl)
         return;
-    if(!Entity_HasTag(uid, tag))
+    struct tag_index *ti = tag_index_get(tag);
+    if(!ti || !tag_test(ti, uid))
         return;
     for(int i = 0; i < tl->ntags; i++) {
-        if(0 == strcmp(tl->tags[i], tag)) {
+        if(tl->tags[i] == ti->name) {
             tl->tags[i] = tl->tags[--tl->ntags];
             break;
         }
     }
-    tag_remove_entity(tag, uid);
+    tag_clear(ti, uid);
 }
 
 bool Entity_HasTag(uint32_t uid, const char *tag)
 {
-    khiter_t k = kh_get(ents, s_tag_ent_map, tag);
-    if(k == kh_end(s_tag_ent_map))
+    const struct tag_index *ti = tag_index_get(tag);
+    if(!ti)
         return false;
-
-    kh_uid_t *set = &kh_value(s_tag_ent_map, k);
-    khiter_t l = kh_get(uid, set, uid);
-    return (l != kh_end(set));
+    return tag_test(ti, uid);
 }
 
 void Entity_ClearTags(uint32_t uid)
@@ -481,26 +699,69 @@ void Entity_ClearTags(uint32_t uid)
     if(!tl)
         return;
     for(int i = 0; i < tl->ntags; i++) {
-        tag_remove_entity(tl->tags[i], uid);
+        struct tag_index *ti = tag_index_get(tl->tags[i]);
+        assert(ti);
+        tag_clear(ti, uid);
     }
     tl->ntags = 0;
 }
 
 size_t Entity_EntsForTag(const char *tag, size_t maxout, uint32_t out[])
 {
-    khiter_t k = kh_get(ents, s_tag_ent_map, tag);
-    if(k == kh_end(s_tag_ent_map))
+    return Entity_EntsForTags(1, &tag, 0, NULL, maxout, out);
+}
+
+size_t Entity_EntsForTags(size_t ninclude, const char *include[], 
+                          size_t nexclude, const char *exclude[],
+                          size_t maxout, uint32_t out[])
+{
+    if(ninclude == 0)
         return 0;
 
     size_t ret = 0;
-    kh_uid_t *set = &kh_value(s_tag_ent_map, k);
-    for(khiter_t l = kh_begin(set); l != kh_end(set); l++) {
-        if(!kh_exist(set, l))
-            continue;
-        if(ret == maxout)
-            return ret;
-        out[ret++] = kh_key(set, l);
+    size_t nexcl = 0;
+    STALLOC(const struct tag_index*, incl, ninclude);
+    STALLOC(const struct tag_index*, excl, MAX(nexclude, 1));
+
+    /* Walk the words of the smallest of the included sets */
+    int driver = 0;
+    for(int i = 0; i < ninclude; i++) {
+        incl[i] = tag_index_get(include[i]);
+        if(!incl[i])
+            goto out;
+        if(incl[i]->count < incl[driver]->count)
+            driver = i;
     }
+    for(int i = 0; i < nexclude; i++) {
+        const struct tag_index *ti = tag_index_get(exclude[i]);
+        if(ti && ti->count > 0)
+            excl[nexcl++] = ti;
+    }
+
+    uint32_t word_idx;
+    uint64_t word;
+    kh_foreach(incl[driver]->bits, word_idx, word, {
+
+        for(int i = 0; word && i < ninclude; i++) {
+            if(i == driver)
+                continue;
+            word &= tag_word(incl[i], word_idx);
+        }
+        for(int i = 0; word && i < nexcl; i++) {
+            word &= ~tag_word(excl[i], word_idx);
+        }
+
+        while(word) {
+            if(ret == maxout)
+                goto out;
+            out[ret++] = word_idx * 64 + __builtin_ctzll(word);
+            word &= (word - 1);
+        }
+    });
+
+out:
+    STFREE(incl);
+    STFREE(excl);
     return ret;
 }
 
@@ -516,18 +777,33 @@ size_t Entity_TagsForEnt(uint32_t uid, size_t maxout, const char *out[])
 
 void Entity_DisappearAnimated(uint32_t uid, const struct map *map, void (*on_finish)(void*), void *arg)
 {
-    /* It's safe to pass a pointer to stack data here due to the 'Shced_RunSync' 
-     * call later - by the time we return from it, we will have copied the data.
-     */
-    struct dis_arg darg = (struct dis_arg){
+    ASSERT_IN_MAIN_THREAD();
+
+    struct disappear_effect dis = (struct disappear_effect){
         .uid = uid,
         .map = map,
         .on_finish = on_finish,
         .arg = arg,
+        .start_pos = G_Pos_Get(uid),
+        .faction_id = G_GetFactionID(uid),
+        .flags = G_FlagsGet(uid),
+        .curr_shift = (vec2_t){0, 0},
+        .prev_shift = (vec2_t){0, 0},
+        .start = SDL_GetTicks(),
+        .elapsed = 0,
     };
-    uint32_t tid = Sched_Create(1, disappear_task, &darg, NULL, 
-        TASK_MAIN_THREAD_PINNED | TASK_BIG_STACK);
-    Sched_RunSync(tid);
+    Entity_CurrentOBB(uid, &dis.obb, false);
+    dis.height = dis.obb.half_lengths[1] * 2.0f;
+
+    if(map) {
+        M_NavBlockersIncrefOBB(map, dis.faction_id, dis.flags, &dis.obb);
+    }
+
+    uint32_t newflags = G_FlagsGet(uid);
+    newflags |= ENTITY_FLAG_TRANSLUCENT;
+    G_FlagsSet(uid, newflags);
+
+    vec_dis_push(&s_disappearing, dis);
 }
 
 int Entity_NavLayer(uint32_t uid)
@@ -563,12 +839,10 @@ int Entity_NavLayerWithRadius(uint32_t flags, float radius)
 
 bool Entity_Init(void)
 {
-    if(!si_init(&s_stringpool, &s_stridx, 2048))
-        goto fail_strintern;
-
-    s_tag_ent_map = kh_init(ents);
-    if(!s_tag_ent_map)
-        goto fail_tag_ent_map;
+    s_tag_ids = kh_init(tagid);
+    if(!s_tag_ids)
+        goto fail_tag_ids;
+    vec_tagidx_init(&s_tag_indices);
 
     s_ent_tag_map = kh_init(tags);
     if(!s_ent_tag_map)
@@ -582,6 +856,14 @@ bool Entity_Init(void)
     if(!s_ent_icons_map)
         goto fail_ent_icons_map;
 
+    vec_uidslot_init(&s_uid_slots);
+    vec_idx_init(&s_free_slots);
+    s_free_head = 0;
+
+    vec_ping_init(&s_pings);
+    vec_dis_init(&s_disappearing);
+    E_Global_Register(EVENT_RENDER_3D_POST, on_render_pings, NULL, G_ALL);
+    E_Global_Register(EVENT_UPDATE_START, on_update_disappearing, NULL, G_ALL);
     return true;
 
 fail_ent_icons_map:
@@ -589,29 +871,40 @@ fail_ent_icons_map:
 fail_ent_trans_map:
     kh_destroy(tags, s_ent_tag_map);
 fail_ent_tag_map:
-    kh_destroy(ents, s_tag_ent_map);
-fail_tag_ent_map:
-    si_shutdown(&s_stringpool, s_stridx);
-fail_strintern:
+    vec_tagidx_destroy(&s_tag_indices);
+    kh_destroy(tagid, s_tag_ids);
+fail_tag_ids:
     return false;
 }
 
 void Entity_Shutdown(void)
 {
+    E_Global_Unregister(EVENT_UPDATE_START, on_update_disappearing);
+    E_Global_Unregister(EVENT_RENDER_3D_POST, on_render_pings);
+    vec_dis_destroy(&s_disappearing);
+    vec_ping_destroy(&s_pings);
+    vec_idx_destroy(&s_free_slots);
+    vec_uidslot_destroy(&s_uid_slots);
     kh_destroy(icons, s_ent_icons_map);
     kh_destroy(trans, s_ent_trans_map);
     kh_destroy(tags, s_ent_tag_map);
-    kh_destroy(ents, s_tag_ent_map);
-    si_shutdown(&s_stringpool, s_stridx);
+    tag_indices_clear();
+    vec_tagidx_destroy(&s_tag_indices);
+    kh_destroy(tagid, s_tag_ids);
 }
 
 void Entity_ClearState(void)
 {
+    vec_ping_reset(&s_pings);
+    vec_dis_reset(&s_disappearing);
     kh_clear(icons, s_ent_icons_map);
     kh_clear(trans, s_ent_trans_map);
     kh_clear(tags, s_ent_tag_map);
-    kh_clear(ents, s_tag_ent_map);
-    si_clear(&s_stringpool, s_stridx);
+    tag_indices_clear();
+    vec_uidslot_reset(&s_uid_slots);
+    vec_idx_reset(&s_free_slots);
+    s_free_head = 0;
+    s_uid_conflict = NULL_UID;
 }
 
 quat_t Entity_GetRot(uint32_t uid)
@@ -687,29 +980,11 @@ vec3_t Entity_GetScaleFrom(khash_t(trans) *table, uint32_t uid)
 
 void Entity_ModelMatrixFrom(vec3_t pos, quat_t rot, vec3_t scale, mat4x4_t *out)
 {
-    mat4x4_t mtrans, mscale, mrot, mtmp;
-
-    PFM_Mat4x4_MakeTrans(pos.x, pos.y, pos.z, &mtrans);
-    PFM_Mat4x4_MakeScale(scale.x, scale.y, scale.z, &mscale);
-    PFM_Mat4x4_RotFromQuat(&rot, &mrot);
-
-    PFM_Mat4x4_Mult4x4(&mscale, &mrot, &mtmp);
-    PFM_Mat4x4_Mult4x4(&mtrans, &mtmp, out);
+    PFM_Mat4x4_MakeTRS(&pos, &rot, &scale, out);
 }
 
 void Entity_CurrentOBBFrom(const struct aabb *aabb, mat4x4_t model, vec3_t scale, struct obb *out)
 {
-    vec4_t identity_verts_homo[8] = {
-        {aabb->x_min, aabb->y_min, aabb->z_min, 1.0f},
-        {aabb->x_min, aabb->y_min, aabb->z_max, 1.0f},
-        {aabb->x_min, aabb->y_max, aabb->z_min, 1.0f},
-        {aabb->x_min, aabb->y_max, aabb->z_max, 1.0f},
-        {aabb->x_max, aabb->y_min, aabb->z_min, 1.0f},
-        {aabb->x_max, aabb->y_min, aabb->z_max, 1.0f},
-        {aabb->x_max, aabb->y_max, aabb->z_min, 1.0f},
-        {aabb->x_max, aabb->y_max, aabb->z_max, 1.0f},
-    };
-
     vec4_t identity_center_homo = (vec4_t){
         (aabb->x_min + aabb->x_max) / 2.0f,
         (aabb->y_min + aabb->y_max) / 2.0f,
@@ -717,16 +992,9 @@ void Entity_CurrentOBBFrom(const struct aabb *aabb, mat4x4_t model, vec3_t scale
         1.0f
     };
 
-    vec4_t obb_verts_homo[8];
-    for(int i = 0; i < 8; i++) {
-        PFM_Mat4x4_Mult4x1(&model, identity_verts_homo + i, obb_verts_homo + i);
-        out->corners[i] = (vec3_t){
-            obb_verts_homo[i].x / obb_verts_homo[i].w,
-            obb_verts_homo[i].y / obb_verts_homo[i].w,
-            obb_verts_homo[i].z / obb_verts_homo[i].w,
-        };
-    }
-
+    /* The model matrix is affine, so only the center needs a full transform.
+     * The corners are the center offset by the transformed half-extents of 
+     * the box along each of its' axes. */
     vec4_t obb_center_homo;
     PFM_Mat4x4_Mult4x1(&model, &identity_center_homo, &obb_center_homo);
     out->center = (vec3_t){
@@ -735,18 +1003,41 @@ void Entity_CurrentOBBFrom(const struct aabb *aabb, mat4x4_t model, vec3_t scale
         obb_center_homo.z / obb_center_homo.w,
     };
 
-    out->half_lengths[0] = (aabb->x_max - aabb->x_min) / 2.0f * scale.x;
-    out->half_lengths[1] = (aabb->y_max - aabb->y_min) / 2.0f * scale.y;
-    out->half_lengths[2] = (aabb->z_max - aabb->z_min) / 2.0f * scale.z;
+    const float extents[3] = {
+        (aabb->x_max - aabb->x_min) / 2.0f,
+        (aabb->y_max - aabb->y_min) / 2.0f,
+        (aabb->z_max - aabb->z_min) / 2.0f,
+    };
+
+    vec3_t half_axes[3];
+    for(int i = 0; i < 3; i++) {
+        half_axes[i] = (vec3_t){
+            model.cols[i][0] * extents[i],
+            model.cols[i][1] * extents[i],
+            model.cols[i][2] * extents[i],
+        };
+    }
+
+    /* Corner 'i' is on the max side of the X, Y and Z 
+     * axes when bits 2, 1 and 0 are set, respectively */
+    for(int i = 0; i < 8; i++) {
+        float sx = (i & 0x4) ? 1.0f : -1.0f;
+        float sy = (i & 0x2) ? 1.0f : -1.0f;
+        float sz = (i & 0x1) ? 1.0f : -1.0f;
+        out->corners[i] = (vec3_t){
+            out->center.x + sx * half_axes[0].x + sy * half_axes[1].x + sz * half_axes[2].x,
+            out->center.y + sx * half_axes[0].y + sy * half_axes[1].y + sz * half_axes[2].y,
+            out->center.z + sx * half_axes[0].z + sy * half_axes[1].z + sz * half_axes[2].z,
+        };
+    }
 
-    vec3_t axis0, axis1, axis2;   
-    PFM_Vec3_Sub(&out->corners[4], &out->corners[0], &axis0);
-    PFM_Vec3_Sub(&out->corners[2], &out->corners[0], &axis1);
-    PFM_Vec3_Sub(&out->corners[1], &out->corners[0], &axis2);
+    out->half_lengths[0] = extents[0] * scale.x;
+    out->half_lengths[1] = extents[1] * scale.y;
+    out->half_lengths[2] = extents[2] * scale.z;
 
-    PFM_Vec3_Normal(&axis0, &out->axes[0]);
-    PFM_Vec3_Normal(&axis1, &out->axes[1]);
-    PFM_Vec3_Normal(&axis2, &out->axes[2]);
+    PFM_Vec3_Normal(&half_axes[0], &out->axes[0]);
+    PFM_Vec3_Normal(&half_axes[1], &out->axes[1]);
+    PFM_Vec3_Normal(&half_axes[2], &out->axes[2]);
 }
 
 uint64_t Entity_TypeID(uint32_t uid)
@@ -766,7 +1057,7 @@ bool Entity_SetIcons(uint32_t uid, size_t nicons, const char **icons)
     nicons = MIN(nicons, MAX_ICONS);
     list->nicons = 0;
     for(int i = 0; i < nicons; i++) {
-        const char *str = si_intern(icons[i], &s_stringpool, s_stridx);
+        const char *str = si_intern(icons[i], NULL);
         if(!str)
             return false;
         list->icons[list->nicons++] = str;
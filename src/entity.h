@@ -50,6 +50,13 @@
 #define MAX_ICONS   (4)
 #define NULL_UID    (~((uint32_t)0))
 
+/* The low bits of a UID index a dense slot, the high bits hold the slot's 
+ * generation. Per-entity state can be kept in arrays indexed by the slot. */
+#define ENTITY_UID_INDEX_BITS   (20)
+#define ENTITY_UID_MAX_SLOTS    ((1u << ENTITY_UID_INDEX_BITS) - 1)
+#define ENTITY_UID_INDEX(uid)   ((uid) & ((1u << ENTITY_UID_INDEX_BITS) - 1))
+#define ENTITY_UID_GEN(uid)     ((uid) >> ENTITY_UID_INDEX_BITS)
+
 enum{
     ENTITY_FLAG_ANIMATED            = (1 << 0),
     ENTITY_FLAG_COLLISION           = (1 << 1),
@@ -100,7 +107,8 @@ struct ent_anim_rstate{
     bool            translucent;
     size_t          njoints;
     const mat4x4_t *inv_bind_pose; /* static, use shallow copy */
-    mat4x4_t        curr_pose[MAX_JOINTS];
+    const mat4x4_t *curr_pose;     /* shared by all entities showing the same 
+                                    * clip frame, use shallow copy */
 };
 
 struct transform{
@@ -123,7 +131,17 @@ void     Entity_Shutdown(void);
 void     Entity_ClearState(void);
 
 void     Entity_ModelMatrix(uint32_t uid, mat4x4_t *out);
+/* Returns NULL_UID once all ENTITY_UID_MAX_SLOTS slots are in use */
 uint32_t Entity_NewUID(void);
+void     Entity_FreeUID(uint32_t uid);
+/* Mark a specific UID (i.e. one restored from a session file) as in use */
+bool     Entity_ClaimUID(uint32_t uid);
+bool     Entity_UIDLive(uint32_t uid);
+/* Returns and clears the last UID which Entity_ClaimUID rejected because 
+ * another UID held its' slot, or NULL_UID if there was none */
+uint32_t Entity_TakeUIDConflict(void);
+/* One past the highest slot index handed out so far */
+uint32_t Entity_NextUID(void);
 void     Entity_SetNextUID(uint32_t uid);
 void     Entity_CurrentOBB(uint32_t uid, struct obb *out, bool identity);
 vec3_t   Entity_CenterPos(uint32_t uid);
@@ -140,6 +158,10 @@ void     Entity_RemoveTag(uint32_t uid, const char *tag);
 bool     Entity_HasTag(uint32_t uid, const char *tag);
 void     Entity_ClearTags(uint32_t uid);
 size_t   Entity_EntsForTag(const char *tag, size_t maxout, uint32_t out[]);
+/* Entities that have all of the 'include' tags and none of the 'exclude' tags */
+size_t   Entity_EntsForTags(size_t ninclude, const char *include[], 
+                            size_t nexclude, const char *exclude[],
+                            size_t maxout, uint32_t out[]);
 size_t   Entity_TagsForEnt(uint32_t uid, size_t maxout, const char *out[]);
 void     Entity_DisappearAnimated(uint32_t uid, const struct map *map, 
                                   void (*on_finish)(void*), void *arg);
@@ -41,6 +41,7 @@
 #include "lib/public/khash.h"
 #include "lib/public/vec.h"
 #include "lib/public/queue.h"
+#include "lib/public/timer_wheel.h"
 #include "game/public/game.h"
 
 #include <assert.h>
@@ -60,6 +61,7 @@ struct handler_desc{
     void          *user_arg;
     int            simmask;    /* Specifies during which simulation states the handler gets invoked */
     uint32_t       register_tick;
+    bool           dead;       /* Unregistered while the list was being dispatched */
 };
 
 struct event{
@@ -70,6 +72,27 @@ struct event{
     uint32_t           tick;
 };
 
+struct batch_desc{
+    batch_handler_t    handler;
+    void              *user_arg;
+    int                simmask;
+};
+
+struct script_batch_desc{
+    enum eventtype     type;
+    script_opaque_t    handler;
+    script_opaque_t    user_arg;
+    int                simmask;
+};
+
+/* An event that is held until the end of the tick for the script batch 
+ * handlers. The argument is already wrapped. */
+struct batch_entry{
+    enum eventtype     type;
+    uint32_t           receiver_id;
+    script_opaque_t    arg;
+};
+
 /* Used in the place of the entity ID for key generation for global events,
  * which are not associated with any entity. This is the maximum 32-bit 
  * entity ID, we will assume entity IDs will never reach this high.
@@ -79,11 +102,49 @@ struct event{
 VEC_TYPE(hd, struct handler_desc)
 VEC_IMPL(static inline, hd, struct handler_desc)
 
-KHASH_MAP_INIT_INT64(handler_desc, vec_hd_t)
+struct handler_list{
+    vec_hd_t handlers;
+    /* The number of (possibly nested) dispatches currently iterating over 
+     * the list. While non-zero, handlers are never removed from the list - 
+     * they are only marked as dead - so that the indices stay stable. */
+    int      ndispatching;
+    int      ndead;
+};
+
+KHASH_MAP_INIT_INT64(handler_desc, struct handler_list)
+
+VEC_TYPE(batch, struct batch_desc)
+VEC_IMPL(static inline, batch, struct batch_desc)
+
+KHASH_MAP_INIT_INT(batch, vec_batch_t)
+KHASH_MAP_INIT_INT(count, int)
+
+VEC_TYPE(uid, uint32_t)
+VEC_IMPL(static inline, uid, uint32_t)
+
+VEC_TYPE(arg, void*)
+VEC_IMPL(static inline, arg, void*)
+
+VEC_TYPE(sbatch, struct script_batch_desc)
+VEC_IMPL(static inline, sbatch, struct script_batch_desc)
+
+VEC_TYPE(entry, struct batch_entry)
+VEC_IMPL(static inline, entry, struct batch_entry)
+
+VEC_TYPE(event, struct event)
+VEC_IMPL(static inline, event, struct event)
 
 QUEUE_TYPE(event, struct event)
 QUEUE_IMPL(static, event, struct event)
 
+struct timer_desc{
+    handler_t  handler;
+    void      *arg;
+};
+
+VEC_TYPE(timer, struct timer_desc)
+VEC_IMPL(static inline, timer, struct timer_desc)
+
 #define STR(_event) [_event - EVENT_UPDATE_START] = #_event
 
 /*****************************************************************************/
@@ -154,11 +215,31 @@ static const char *s_event_str_table[] = {
     STR(EVENT_RALLY_POINT_SET),
     STR(EVENT_UNIT_BECAME_IDLE),
     STR(EVENT_UNIT_BECAME_ACTIVE),
+    STR(EVENT_20HZ_SUBTICK),
 };
 
 static khash_t(handler_desc) *s_event_handler_table;
+/* The number of handler lists in 's_event_handler_table' for every event 
+ * type. Used to skip the per-receiver lookups for a whole run of queued 
+ * events when nobody could be listening for them. */
+static khash_t(count)        *s_event_type_nlists;
+/* Batch handlers for entity events, keyed by event type */
+static khash_t(batch)        *s_batch_handler_table;
 static queue(event)           s_event_queues[2];
 static int                    s_front_queue_idx = 0;
+/* Scratch buffers for servicing a run of events */
+static vec_event_t            s_run;
+static vec_uid_t              s_batch_uids;
+static vec_arg_t              s_batch_args;
+/* Script handlers that get all the events of a type once per tick */
+static vec_sbatch_t           s_script_batch_handlers;
+static khash_t(count)        *s_script_batch_ntypes;
+static vec_entry_t            s_script_batch_pending;
+/* Delayed callbacks. The wheel holds indices into 's_timers', whose unused 
+ * entries are recycled via the free list. */
+static struct twheel          s_timer_wheel;
+static vec_timer_t            s_timers;
+static vec_uid_t              s_free_timers;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -176,16 +257,52 @@ static inline bool e_handlers_equal(const struct handler_desc *a, const struct h
     }
 }
 
-static inline bool e_ptrs_equal(const struct handler_desc *a, const struct handler_desc *b)
+static int e_handler_idx(const struct handler_list *list, const struct handler_desc *desc)
 {
-    if(a->type != b->type)
-        return false;
+    for(int i = 0; i < vec_size(&list->handlers); i++) {
+        /* The scripting objects of dead handlers have already been released */
+        const struct handler_desc *curr = &vec_AT(&list->handlers, i);
+        if(curr->dead)
+            continue;
+        if(e_handlers_equal(curr, desc))
+            return i;
+    }
+    return -1;
+}
 
-    if(a->type == HANDLER_TYPE_SCRIPT) {
-        return a->handler.as_script_callable == b->handler.as_script_callable;
-    }else {
-        return a->handler.as_function == b->handler.as_function;
+static void e_release_handler(const struct handler_desc *hd)
+{
+    if(hd->type == HANDLER_TYPE_SCRIPT) {
+
+        S_Release(hd->handler.as_script_callable);
+        S_Release(hd->user_arg); 
+    }
+}
+
+static void e_compact(struct handler_list *list)
+{
+    assert(list->ndispatching == 0);
+    if(list->ndead == 0)
+        return;
+
+    /* Preserve the order of the live handlers */
+    int nlive = 0;
+    for(int i = 0; i < vec_size(&list->handlers); i++) {
+        struct handler_desc curr = vec_AT(&list->handlers, i);
+        if(curr.dead)
+            continue;
+        vec_AT(&list->handlers, nlive++) = curr;
     }
+    list->handlers.size = nlive;
+    list->ndead = 0;
+}
+
+static struct handler_list *e_list_for_key(uint64_t key)
+{
+    khiter_t k = kh_get(handler_desc, s_event_handler_table, key);
+    if(k == kh_end(s_event_handler_table))
+        return NULL;
+    return &kh_value(s_event_handler_table, k);
 }
 
 static uint64_t e_key(uint32_t ent_id, enum eventtype event)
@@ -206,70 +323,227 @@ static bool e_is_timer_event(enum eventtype type)
     || type == EVENT_20HZ_TICK
     || type == EVENT_15HZ_TICK
     || type == EVENT_10HZ_TICK
-    || type == EVENT_1HZ_TICK)
+    || type == EVENT_1HZ_TICK
+    || type == EVENT_20HZ_SUBTICK)
         return true;
     return false;
 }
 
-static bool e_register_handler(uint64_t key, struct handler_desc *desc)
+static void e_type_count_add(enum eventtype type, int delta)
 {
-    khiter_t k;
-    k = kh_get(handler_desc, s_event_handler_table, key);
-
-    if(k == kh_end(s_event_handler_table)) {
-
-        vec_hd_t newv;
-        vec_hd_init(&newv);
-        vec_hd_push(&newv, *desc);
+    khiter_t k = kh_get(count, s_event_type_nlists, type);
+    if(k == kh_end(s_event_type_nlists)) {
 
         int ret;
-        k = kh_put(handler_desc, s_event_handler_table, key, &ret);
+        k = kh_put(count, s_event_type_nlists, type, &ret);
         assert(ret == 1 || ret == 2);
-        kh_value(s_event_handler_table, k) = newv;
+        kh_value(s_event_type_nlists, k) = 0;
+    }
+    kh_value(s_event_type_nlists, k) += delta;
+    assert(kh_value(s_event_type_nlists, k) >= 0);
+}
 
-    }else{
-    
-        vec_hd_t vec = kh_value(s_event_handler_table, k);
+static bool e_type_has_lists(enum eventtype type)
+{
+    khiter_t k = kh_get(count, s_event_type_nlists, type);
+    if(k == kh_end(s_event_type_nlists))
+        return false;
+    return (kh_value(s_event_type_nlists, k) > 0);
+}
 
-        int idx = vec_hd_indexof(&vec, *desc, e_handlers_equal);
-        if(idx != -1)
-            return false; /* Don't allow registering duplicate handlers for the same event */
+static bool e_type_has_script_batch(enum eventtype type)
+{
+    khiter_t k = kh_get(count, s_script_batch_ntypes, type);
+    if(k == kh_end(s_script_batch_ntypes))
+        return false;
+    return (kh_value(s_script_batch_ntypes, k) > 0);
+}
 
-        vec_hd_push(&vec, *desc);
-        kh_value(s_event_handler_table, k) = vec;
+static void e_script_batch_count_add(enum eventtype type, int delta)
+{
+    int ret;
+    khiter_t k = kh_put(count, s_script_batch_ntypes, type, &ret);
+    if(ret == -1)
+        return;
+    if(ret != 0) {
+        kh_value(s_script_batch_ntypes, k) = 0;
     }
+    kh_value(s_script_batch_ntypes, k) += delta;
+    assert(kh_value(s_script_batch_ntypes, k) >= 0);
+}
 
-    return true;
+static int e_script_batch_idx(enum eventtype type, script_opaque_t handler)
+{
+    for(int i = 0; i < vec_size(&s_script_batch_handlers); i++) {
+        const struct script_batch_desc *curr = &vec_AT(&s_script_batch_handlers, i);
+        if(curr->type == type && S_ObjectsEqual(curr->handler, handler))
+            return i;
+    }
+    return -1;
 }
 
-static bool e_unregister_handler(uint64_t key, const struct handler_desc *desc)
+static void e_script_batch_del(int idx)
 {
-    khiter_t k;
-    k = kh_get(handler_desc, s_event_handler_table, key);
+    struct script_batch_desc *sbd = &vec_AT(&s_script_batch_handlers, idx);
+    e_script_batch_count_add(sbd->type, -1);
+    S_Release(sbd->handler);
+    S_Release(sbd->user_arg);
+    vec_sbatch_del(&s_script_batch_handlers, idx);
+}
 
-    if(k == kh_end(s_event_handler_table))
+static void e_batch_push(struct event event, script_opaque_t arg)
+{
+    struct batch_entry entry = (struct batch_entry){
+        .type = event.type,
+        .receiver_id = event.receiver_id,
+        .arg = arg
+    };
+    if(!vec_entry_push(&s_script_batch_pending, entry))
+        return;
+    S_Retain(arg);
+}
+
+static void e_batch_release(vec_entry_t *entries)
+{
+    for(int i = 0; i < vec_size(entries); i++) {
+        S_Release(vec_AT(entries, i).arg);
+    }
+    vec_entry_reset(entries);
+}
+
+static void e_run_script_batch_handlers(void)
+{
+    if(vec_size(&s_script_batch_pending) == 0)
+        return;
+
+    /* The handlers may generate more events for the batch handlers. These 
+     * get delivered in the next tick. */
+    vec_entry_t pending = s_script_batch_pending;
+    vec_entry_init(&s_script_batch_pending);
+
+    /* The handlers may also register or unregister batch handlers. Walk a
+     * retained copy of the list and skip the ones that have gone away. */
+    vec_sbatch_t handlers;
+    vec_sbatch_init_alloc(&handlers, Sched_FrameRealloc, Sched_FrameFree);
+    vec_sbatch_copy(&handlers, &s_script_batch_handlers);
+    for(int i = 0; i < vec_size(&handlers); i++) {
+        S_Retain(vec_AT(&handlers, i).handler);
+        S_Retain(vec_AT(&handlers, i).user_arg);
+    }
+
+    enum simstate ss = G_GetSimState();
+    for(int i = 0; i < vec_size(&handlers); i++) {
+
+        struct script_batch_desc curr = vec_AT(&handlers, i);
+        if((curr.simmask & ss) == 0)
+            continue;
+
+        int idx = e_script_batch_idx(curr.type, curr.handler);
+        if(idx == -1)
+            continue;
+
+        if(S_WeakrefDied(curr.user_arg)) {
+            e_script_batch_del(idx);
+            continue;
+        }
+
+        vec_uid_reset(&s_batch_uids);
+        vec_arg_reset(&s_batch_args);
+
+        for(int j = 0; j < vec_size(&pending); j++) {
+            const struct batch_entry *entry = &vec_AT(&pending, j);
+            if(entry->type != curr.type)
+                continue;
+            vec_uid_push(&s_batch_uids, entry->receiver_id);
+            vec_arg_push(&s_batch_args, entry->arg);
+        }
+
+        if(vec_size(&s_batch_uids) == 0)
+            continue;
+
+        script_opaque_t user_arg = S_UnwrapIfWeakref(curr.user_arg);
+
+        PERF_PUSH("script::batch_event_handler");
+        S_RunBatchEventHandler(curr.handler, user_arg, vec_size(&s_batch_uids),
+            s_batch_uids.array, s_batch_args.array);
+        PERF_POP();
+
+        S_Release(user_arg);
+    }
+
+    for(int i = 0; i < vec_size(&handlers); i++) {
+        S_Release(vec_AT(&handlers, i).handler);
+        S_Release(vec_AT(&handlers, i).user_arg);
+    }
+    vec_sbatch_destroy(&handlers);
+
+    e_batch_release(&pending);
+    vec_entry_destroy(&pending);
+}
+
+static bool e_register_handler(uint64_t key, struct handler_desc *desc)
+{
+    struct handler_list *list = e_list_for_key(key);
+    if(!list) {
+
+        struct handler_list newl = (struct handler_list){0};
+        vec_hd_init(&newl.handlers);
+
+        int ret;
+        khiter_t k = kh_put(handler_desc, s_event_handler_table, key, &ret);
+        assert(ret == 1 || ret == 2);
+        kh_value(s_event_handler_table, k) = newl;
+        list = &kh_value(s_event_handler_table, k);
+
+        e_type_count_add(key & 0xffffffff, 1);
+    }
+
+    /* Don't allow registering duplicate handlers for the same event */
+    if(e_handler_idx(list, desc) != -1)
         return false;
 
-    vec_hd_t vec = kh_value(s_event_handler_table, k);
+    desc->dead = false;
+    vec_hd_push(&list->handlers, *desc);
+    return true;
+}
+
+static bool e_unregister_handler(uint64_t key, const struct handler_desc *desc)
+{
+    struct handler_list *list = e_list_for_key(key);
+    if(!list)
+        return false;
 
-    int idx = vec_hd_indexof(&vec, *desc, e_handlers_equal);
+    int idx = e_handler_idx(list, desc);
     if(idx == -1)
         return false;
-    struct handler_desc to_del = vec_AT(&vec, idx);
 
-    if(to_del.type == HANDLER_TYPE_SCRIPT) {
+    struct handler_desc *to_del = &vec_AT(&list->handlers, idx);
+    e_release_handler(to_del);
 
-        S_Release(to_del.handler.as_script_callable);
-        S_Release(to_del.user_arg); 
+    if(list->ndispatching > 0) {
+        to_del->dead = true;
+        list->ndead++;
+    }else{
+        vec_hd_del(&list->handlers, idx);
     }
-
-    vec_hd_del(&vec, idx);
-    kh_value(s_event_handler_table, k) = vec;
-
     return true;
 }
 
-static void e_invoke(const struct handler_desc hd, struct event event)
+/* The wrapped argument is shared by all the script handlers of a single 
+ * dispatch. All the wrapped engine arguments are immutable objects, so 
+ * a handler can't observe what a previous one did with it. */
+static script_opaque_t e_script_arg(struct event event, script_opaque_t *cache)
+{
+    if(!*cache) {
+        *cache = (event.source == ES_SCRIPT) 
+            ? S_UnwrapIfWeakref(event.arg)
+            : S_WrapEngineEventArg(event.type, event.arg);
+    }
+    assert(*cache);
+    return *cache;
+}
+
+static void e_invoke(const struct handler_desc hd, struct event event, script_opaque_t *script_arg)
 {
     if(hd.type == HANDLER_TYPE_ENGINE) {
 
@@ -287,20 +561,18 @@ static void e_invoke(const struct handler_desc hd, struct event event)
             return;
         }
 
-        script_opaque_t script_arg = (event.source == ES_SCRIPT) 
-            ? S_UnwrapIfWeakref(event.arg)
-            : S_WrapEngineEventArg(event.type, event.arg);
-        assert(script_arg);
+        script_opaque_t arg = e_script_arg(event, script_arg);
         script_opaque_t user_arg = S_UnwrapIfWeakref(hd.user_arg);
 
-        S_RunEventHandler(hd.handler.as_script_callable, user_arg, script_arg);
+        PERF_PUSH("script::event_handler");
+        S_RunEventHandler(hd.handler.as_script_callable, user_arg, arg);
+        PERF_POP();
 
-        S_Release(script_arg);
         S_Release(user_arg);
     }
 }
 
-static void e_handle_event(struct event event, bool immediate)
+static void e_dispatch(struct event event, bool immediate, bool lookup)
 {
     if((G_GetSimState() != G_RUNNING) && e_is_timer_event(event.type))
         return;
@@ -309,72 +581,163 @@ static void e_handle_event(struct event event, bool immediate)
 
     uint64_t key = e_key(event.receiver_id, event.type);
     enum simstate ss = G_GetSimState();
+    script_opaque_t script_arg = NULL;
+
+    if(e_type_has_script_batch(event.type)) {
+        e_batch_push(event, e_script_arg(event, &script_arg));
+    }
+
+    if(!lookup)
+        goto out;
 
     if(event.receiver_id != GLOBAL_ID 
     && G_EntityIsZombie(event.receiver_id) 
     && !e_zombie_can_receive(event.type))
-        return;
+        goto out;
     
     /* The execution of an event handler can cause one or more event handlers 
-     * to be unregistered. We want to provide a guarantee that once an event 
-     * handler is unregistered, it will never be executed. So, keep fetching 
-     * the handlers vector from the table after every execution, in case it's
-     * been changed by the prior handler call.
+     * to be registered or unregistered. We want to provide a guarantee that 
+     * once an event handler is unregistered, it will never be executed. While
+     * we are iterating, unregistered handlers are left in place as tombstones
+     * and skipped, so every handler is visited exactly once. Registering may 
+     * grow the list or rehash the table, so the list is re-fetched after 
+     * every handler call.
      */
+    struct handler_list *list = e_list_for_key(key);
+    if(list) {
 
-    vec_hd_t execd_handlers;
-    vec_hd_init(&execd_handlers);
-    bool ran; 
-
-    vec_hd_t curr;
-    vec_hd_init(&curr);
-
-    do{
-        ran = false;
-        khiter_t k = kh_get(handler_desc, s_event_handler_table, key);
-        if(k == kh_end(s_event_handler_table))
-            break; 
-
-        vec_hd_reset(&curr);
-        vec_hd_copy(&curr, &kh_value(s_event_handler_table, k));
+        list->ndispatching++;
+        for(int i = 0; i < vec_size(&list->handlers); i++) {
 
-        for(int i = 0; i < vec_size(&curr); i++) {
-
-            /* Since any of the executed handlers may have subsequently 
-             * been deleted, the pointers to scripting objects in the 
-             * executed handlers must be treated as dangling references
-             * and must not be dereferenced 
-             */
-            struct handler_desc elem = vec_AT(&curr, i);
-            int idx = vec_hd_indexof(&execd_handlers, elem, e_ptrs_equal); 
-            if(idx != -1)
+            struct handler_desc elem = vec_AT(&list->handlers, i);
+            if(elem.dead)
                 continue;
-            /* memoize any handlers that we've already ran */
-            vec_hd_push(&execd_handlers, elem);
-
             if(!immediate && ((elem.simmask & ss) == 0))
                 continue;
             if(event.tick != elem.register_tick && SDL_TICKS_PASSED(elem.register_tick, event.tick))
                 continue;
 
-            e_invoke(elem, event);
-            ran = true;
-            break;
+            e_invoke(elem, event, &script_arg);
+
+            list = e_list_for_key(key);
+            assert(list);
         }
-    
-    }while(ran);
 
-    vec_hd_destroy(&execd_handlers);
-    vec_hd_destroy(&curr);
+        if(--list->ndispatching == 0)
+            e_compact(list);
+    }
 
+out:
+    S_Release(script_arg);
     if(event.source == ES_SCRIPT)
         S_Release(event.arg);
 }
 
+static void e_handle_event(struct event event, bool immediate)
+{
+    e_dispatch(event, immediate, true);
+}
+
+static void e_run_batch_handlers(const struct event *events, size_t nevents)
+{
+    enum eventtype type = events[0].type;
+    khiter_t k = kh_get(batch, s_batch_handler_table, type);
+    if(k == kh_end(s_batch_handler_table) || vec_size(&kh_value(s_batch_handler_table, k)) == 0)
+        return;
+
+    vec_uid_reset(&s_batch_uids);
+    vec_arg_reset(&s_batch_args);
+
+    for(int i = 0; i < nevents; i++) {
+
+        const struct event *curr = &events[i];
+        if(curr->receiver_id == GLOBAL_ID)
+            continue;
+        if(G_EntityIsZombie(curr->receiver_id) && !e_zombie_can_receive(type))
+            continue;
+        vec_uid_push(&s_batch_uids, curr->receiver_id);
+        vec_arg_push(&s_batch_args, curr->arg);
+    }
+
+    if(vec_size(&s_batch_uids) == 0)
+        return;
+
+    /* The handlers may register or unregister batch handlers */
+    vec_batch_t handlers;
+    vec_batch_init_alloc(&handlers, Sched_FrameRealloc, Sched_FrameFree);
+    vec_batch_copy(&handlers, &kh_value(s_batch_handler_table, k));
+
+    enum simstate ss = G_GetSimState();
+    for(int i = 0; i < vec_size(&handlers); i++) {
+
+        struct batch_desc curr = vec_AT(&handlers, i);
+        if((curr.simmask & ss) == 0)
+            continue;
+        curr.handler(curr.user_arg, vec_size(&s_batch_uids), 
+            s_batch_uids.array, s_batch_args.array);
+    }
+    vec_batch_destroy(&handlers);
+}
+
+static size_t e_run_length(const queue_event_t *queue)
+{
+    if(queue_size(*queue) == 0)
+        return 0;
+
+    enum eventtype type = queue->mem[queue->ihead].type;
+    size_t ret = 1;
+    int idx = queue->ihead;
+
+    while(ret < queue_size(*queue)) {
+        idx = (idx + 1) % queue->capacity;
+        if(queue->mem[idx].type != type)
+            break;
+        ret++;
+    }
+    return ret;
+}
+
+static void e_service_run(queue_event_t *queue, size_t nevents)
+{
+    assert(nevents > 0 && nevents <= queue_size(*queue));
+
+    /* Gather the run into a contiguous buffer for the batch handlers. The
+     * queue we are servicing is no longer the front queue, so it can't get
+     * modified by the handlers. */
+    vec_event_reset(&s_run);
+    if(!vec_event_resize(&s_run, nevents)) {
+        /* Fall back to servicing the events one at a time */
+        struct event event;
+        for(int i = 0; i < nevents; i++) {
+            queue_event_pop(queue, &event);
+            e_handle_event(event, false);
+        }
+        return;
+    }
+
+    for(int i = 0; i < nevents; i++) {
+        struct event event;
+        bool ret = queue_event_pop(queue, &event);
+        assert(ret);
+        vec_event_push(&s_run, event);
+    }
+    const struct event *events = s_run.array;
+
+    e_run_batch_handlers(events, nevents);
+
+    /* Every event still has to go through the scheduler, as tasks may be 
+     * blocked on it, but the handler lookups for every receiver can be 
+     * skipped when there are no handlers at all for this event type. */
+    bool lookup = e_type_has_lists(events[0].type);
+    for(int i = 0; i < nevents; i++) {
+        e_dispatch(events[i], false, lookup);
+    }
+}
+
 static void e_notify_entities_update_start(uint32_t ticks, bool immediate)
 {
     uint64_t key;
-    vec_hd_t curr;
+    struct handler_list curr;
     (void)curr;
 
     kh_foreach(s_event_handler_table, key, curr, {
@@ -388,6 +751,25 @@ static void e_notify_entities_update_start(uint32_t ticks, bool immediate)
     });
 }
 
+static uint64_t e_now_ms(void)
+{
+    return SDL_GetPerformanceCounter() * 1000 / SDL_GetPerformanceFrequency();
+}
+
+static void e_fire_timer(uint64_t idx, void *arg)
+{
+    struct timer_desc desc = vec_AT(&s_timers, idx);
+    vec_uid_push(&s_free_timers, idx);
+    desc.handler(desc.arg, NULL);
+}
+
+static void e_clear_timers(void)
+{
+    twheel_clear(&s_timer_wheel, e_now_ms());
+    vec_timer_reset(&s_timers);
+    vec_uid_reset(&s_free_timers);
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -403,8 +785,34 @@ bool E_Init(void)
     if(!queue_event_init(&s_event_queues[1], 2048))
         goto fail_back_queue;
 
+    s_event_type_nlists = kh_init(count);
+    if(!s_event_type_nlists)
+        goto fail_type_nlists;
+
+    s_batch_handler_table = kh_init(batch);
+    if(!s_batch_handler_table)
+        goto fail_batch_table;
+
+    s_script_batch_ntypes = kh_init(count);
+    if(!s_script_batch_ntypes)
+        goto fail_script_batch_ntypes;
+
+    vec_event_init(&s_run);
+    vec_uid_init(&s_batch_uids);
+    vec_arg_init(&s_batch_args);
+    vec_sbatch_init(&s_script_batch_handlers);
+    vec_entry_init(&s_script_batch_pending);
+    vec_timer_init(&s_timers);
+    vec_uid_init(&s_free_timers);
+    twheel_init(&s_timer_wheel, e_now_ms());
     return true;
         
+fail_script_batch_ntypes:
+    kh_destroy(batch, s_batch_handler_table);
+fail_batch_table:
+    kh_destroy(count, s_event_type_nlists);
+fail_type_nlists:
+    queue_event_destroy(&s_event_queues[1]);
 fail_back_queue:
     queue_event_destroy(&s_event_queues[0]);
 fail_front_queue:
@@ -421,10 +829,26 @@ void E_Shutdown(void)
         if(!kh_exist(s_event_handler_table, k))
             continue; 
 
-        vec_hd_t vec = kh_value(s_event_handler_table, k);
-        vec_hd_destroy(&vec);
+        struct handler_list *list = &kh_value(s_event_handler_table, k);
+        vec_hd_destroy(&list->handlers);
     }
 
+    vec_batch_t batch;
+    kh_foreach_value(s_batch_handler_table, batch, {
+        vec_batch_destroy(&batch);
+    });
+
+    vec_event_destroy(&s_run);
+    vec_uid_destroy(&s_batch_uids);
+    vec_arg_destroy(&s_batch_args);
+    vec_sbatch_destroy(&s_script_batch_handlers);
+    vec_entry_destroy(&s_script_batch_pending);
+    twheel_destroy(&s_timer_wheel);
+    vec_timer_destroy(&s_timers);
+    vec_uid_destroy(&s_free_timers);
+    kh_destroy(count, s_script_batch_ntypes);
+    kh_destroy(batch, s_batch_handler_table);
+    kh_destroy(count, s_event_type_nlists);
     kh_destroy(handler_desc, s_event_handler_table);
     queue_event_destroy(&s_event_queues[1]);
     queue_event_destroy(&s_event_queues[0]);
@@ -440,14 +864,19 @@ void E_ServiceQueue(void)
 
     e_handle_event( (struct event){EVENT_UPDATE_START, NULL, ES_ENGINE, GLOBAL_ID, ticks}, false);
     e_notify_entities_update_start(ticks, false);
+    twheel_advance(&s_timer_wheel, e_now_ms(), e_fire_timer, NULL);
 
-    struct event event;
-    while(queue_event_pop(queue, &event)) {
+    /* Service runs of back-to-back events of the same type together. This 
+     * is common for entity events, i.e. when a group of units is issued an 
+     * order or finishes an animation cycle in the same tick. */
+    size_t nrun;
+    while((nrun = e_run_length(queue)) > 0) {
     
-        e_handle_event(event, false);
-        /* event arg already released */
+        e_service_run(queue, nrun);
+        /* event args already released */
     }
 
+    e_run_script_batch_handlers();
     e_handle_event( (struct event){EVENT_UPDATE_END, NULL, ES_ENGINE, GLOBAL_ID, ticks}, false);
 
     PERF_RETURN_VOID();
@@ -456,6 +885,33 @@ void E_ServiceQueue(void)
 void E_ClearPendingEvents(void)
 {
     queue_event_clear(&s_event_queues[s_front_queue_idx]);
+    e_clear_timers();
+}
+
+bool E_ScheduleAfter(uint32_t ms, handler_t handler, void *arg)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    struct timer_desc desc = (struct timer_desc){
+        .handler = handler,
+        .arg = arg
+    };
+
+    uint32_t idx;
+    if(vec_size(&s_free_timers) > 0) {
+        idx = vec_uid_pop(&s_free_timers);
+        vec_AT(&s_timers, idx) = desc;
+    }else{
+        if(!vec_timer_push(&s_timers, desc))
+            return false;
+        idx = vec_size(&s_timers) - 1;
+    }
+
+    if(!twheel_add(&s_timer_wheel, e_now_ms() + ms, idx)) {
+        vec_uid_push(&s_free_timers, idx);
+        return false;
+    }
+    return true;
 }
 
 void E_FlushEventQueue(void)
@@ -488,54 +944,61 @@ void E_DeleteScriptHandlers(void)
     STALLOC(uint64_t, keys_to_del, kh_size(s_event_handler_table));
     size_t ntodel = 0;
 
-    uint64_t key;
-    vec_hd_t curr;
+    for(khiter_t k = kh_begin(s_event_handler_table); k != kh_end(s_event_handler_table); ++k) {
 
-    kh_foreach(s_event_handler_table, key, curr, {
+        if(!kh_exist(s_event_handler_table, k))
+            continue; 
 
-        /* iterate backwards to delete while iterating */
-        for(int i = vec_size(&curr)-1; i >= 0; i--) {
+        struct handler_list *list = &kh_value(s_event_handler_table, k);
+        for(int i = 0; i < vec_size(&list->handlers); i++) {
 
-            struct handler_desc hd = vec_AT(&curr, i);
-            if(hd.type == HANDLER_TYPE_ENGINE)
+            struct handler_desc *hd = &vec_AT(&list->handlers, i);
+            if(hd->type == HANDLER_TYPE_ENGINE || hd->dead)
                 continue;
 
-            S_Release(hd.handler.as_script_callable);
-            S_Release(hd.user_arg); 
-            vec_hd_del(&curr, i);
+            e_release_handler(hd);
+            hd->dead = true;
+            list->ndead++;
         }
 
-        khiter_t k = kh_get(handler_desc, s_event_handler_table, key);
-        assert(k != kh_end(s_event_handler_table));
-        kh_value(s_event_handler_table, k) = curr;
+        if(list->ndispatching > 0)
+            continue;
 
-        if(vec_size(&curr) == 0) {
-            keys_to_del[ntodel++] = key;
+        e_compact(list);
+        if(vec_size(&list->handlers) == 0) {
+            keys_to_del[ntodel++] = kh_key(s_event_handler_table, k);
         }
-    });
+    }
     
     for(int i = 0; i < ntodel; i++) {
 
         khiter_t k = kh_get(handler_desc, s_event_handler_table, keys_to_del[i]);
         assert(k != kh_end(s_event_handler_table));
-        vec_hd_destroy(&kh_value(s_event_handler_table, k));
+        vec_hd_destroy(&kh_value(s_event_handler_table, k).handlers);
         kh_del(handler_desc, s_event_handler_table, k);
+        e_type_count_add(keys_to_del[i] & 0xffffffff, -1);
+    }
+    STFREE(keys_to_del);
+
+    while(vec_size(&s_script_batch_handlers) > 0) {
+        e_script_batch_del(vec_size(&s_script_batch_handlers) - 1);
     }
+    e_batch_release(&s_script_batch_pending);
 }
 
 size_t E_GetScriptHandlers(size_t max_out, struct script_handler *out)
 {
     size_t ret = 0;
     uint64_t key;
-    vec_hd_t curr;
+    struct handler_list curr;
 
     kh_foreach(s_event_handler_table, key, curr, {
 
-        for(int i = 0; i < vec_size(&curr); i++) {
+        for(int i = 0; i < vec_size(&curr.handlers); i++) {
 
             (void)key;
-            struct handler_desc hd = vec_AT(&curr, i);
-            if(hd.type == HANDLER_TYPE_ENGINE)
+            struct handler_desc hd = vec_AT(&curr.handlers, i);
+            if(hd.type == HANDLER_TYPE_ENGINE || hd.dead)
                 continue;
 
             if(ret == max_out)
@@ -547,14 +1010,60 @@ size_t E_GetScriptHandlers(size_t max_out, struct script_handler *out)
                 .id = key >> 32,
                 .simmask = hd.simmask,
                 .handler = hd.handler.as_script_callable,
-                .arg = (script_opaque_t)hd.user_arg
+                .arg = (script_opaque_t)hd.user_arg,
+                .batch = false
             };
             ret++;
         }
     });
+
+    for(int i = 0; i < vec_size(&s_script_batch_handlers); i++) {
+
+        if(ret == max_out)
+            break;
+
+        struct script_batch_desc curr = vec_AT(&s_script_batch_handlers, i);
+        out[ret++] = (struct script_handler){
+            .event = curr.type,
+            .id = GLOBAL_ID,
+            .simmask = curr.simmask,
+            .handler = curr.handler,
+            .arg = curr.user_arg,
+            .batch = true
+        };
+    }
     return ret;
 }
 
+bool E_ScriptRegisterBatch(enum eventtype event, script_opaque_t handler, 
+                           script_opaque_t user_arg, int simmask)
+{
+    if(e_script_batch_idx(event, handler) != -1)
+        return false;
+
+    struct script_batch_desc sbd = (struct script_batch_desc){
+        .type = event,
+        .handler = handler,
+        .user_arg = user_arg,
+        .simmask = simmask
+    };
+    if(!vec_sbatch_push(&s_script_batch_handlers, sbd))
+        return false;
+
+    e_script_batch_count_add(event, 1);
+    return true;
+}
+
+bool E_ScriptUnregisterBatch(enum eventtype event, script_opaque_t handler)
+{
+    int idx = e_script_batch_idx(event, handler);
+    if(idx == -1)
+        return false;
+
+    e_script_batch_del(idx);
+    return true;
+}
+
 /*
  * Global Events
  */
@@ -663,6 +1172,49 @@ bool E_Entity_ScriptUnregister(enum eventtype event, uint32_t ent_uid,
     return e_unregister_handler(e_key(ent_uid, event), &hd);
 }
 
+bool E_Entity_RegisterBatch(enum eventtype event, batch_handler_t handler, 
+                            void *user_arg, int simmask)
+{
+    khiter_t k = kh_get(batch, s_batch_handler_table, event);
+    if(k == kh_end(s_batch_handler_table)) {
+
+        int ret;
+        k = kh_put(batch, s_batch_handler_table, event, &ret);
+        if(ret == -1)
+            return false;
+        vec_batch_init(&kh_value(s_batch_handler_table, k));
+    }
+
+    vec_batch_t *vec = &kh_value(s_batch_handler_table, k);
+    for(int i = 0; i < vec_size(vec); i++) {
+        if(vec_AT(vec, i).handler == handler)
+            return false;
+    }
+
+    struct batch_desc bd = (struct batch_desc){
+        .handler = handler,
+        .user_arg = user_arg,
+        .simmask = simmask
+    };
+    return vec_batch_push(vec, bd);
+}
+
+bool E_Entity_UnregisterBatch(enum eventtype event, batch_handler_t handler)
+{
+    khiter_t k = kh_get(batch, s_batch_handler_table, event);
+    if(k == kh_end(s_batch_handler_table))
+        return false;
+
+    vec_batch_t *vec = &kh_value(s_batch_handler_table, k);
+    for(int i = 0; i < vec_size(vec); i++) {
+        if(vec_AT(vec, i).handler == handler) {
+            vec_batch_del(vec, i);
+            return true;
+        }
+    }
+    return false;
+}
+
 void E_Entity_Notify(enum eventtype event, uint32_t ent_uid, void *event_arg, 
                      enum event_source source)
 {
@@ -123,6 +123,7 @@ enum eventtype{
     EVENT_RALLY_POINT_SET,
     EVENT_UNIT_BECAME_IDLE,
     EVENT_UNIT_BECAME_ACTIVE,
+    EVENT_20HZ_SUBTICK,
 
     EVENT_ENGINE_LAST = 0x1ffff,
 };
@@ -133,6 +134,8 @@ enum event_source{
 };
 
 typedef void (*handler_t)(void*, void*);
+/* (user_arg, nevents, receiver entity IDs, event args) */
+typedef void (*batch_handler_t)(void*, size_t, const uint32_t*, void**);
 
 struct script_handler{
     enum eventtype  event;
@@ -140,6 +143,7 @@ struct script_handler{
     int             simmask;
     script_opaque_t handler;
     script_opaque_t arg;
+    bool            batch;
 };
 
 /*###########################################################################*/
@@ -155,6 +159,18 @@ void        E_ClearPendingEvents(void);
 void        E_FlushEventQueue(void);
 const char *E_EngineEventString(enum eventtype event);
 bool        E_EventsQueued(void);
+/* Invoke 'handler' with 'arg' (and a NULL event argument) on the main thread 
+ * once at least 'ms' milliseconds have passed. The callback fires at the start 
+ * of the first event servicing after the deadline. Pending callbacks are 
+ * dropped along with the pending events. */
+bool        E_ScheduleAfter(uint32_t ms, handler_t handler, void *arg);
+
+/* Script batch handlers get every event of the type, global or not, that 
+ * was dispatched during a tick in a single call at the end of the tick. 
+ * The handler and user_arg references are stolen on success. */
+bool        E_ScriptRegisterBatch(enum eventtype event, script_opaque_t handler, 
+                                  script_opaque_t user_arg, int simmask);
+bool        E_ScriptUnregisterBatch(enum eventtype event, script_opaque_t handler);
 
 /*###########################################################################*/
 /* EVENT GLOBAL                                                              */
@@ -185,6 +201,13 @@ bool E_Entity_ScriptRegister(enum eventtype event, uint32_t ent_uid,
 bool E_Entity_ScriptUnregister(enum eventtype event, uint32_t ent_uid, 
                                script_opaque_t handler);
 void E_Entity_Notify(enum eventtype, uint32_t ent_uid, void *event_arg, enum event_source);
+
+/* Batch handlers receive every run of back-to-back queued events of the 
+ * given type, for all receiving entities at once, before the per-entity 
+ * handlers for the same events are run. Immediate events bypass them. */
+bool E_Entity_RegisterBatch(enum eventtype event, batch_handler_t handler, 
+                            void *user_arg, int simmask);
+bool E_Entity_UnregisterBatch(enum eventtype event, batch_handler_t handler);
 void E_Entity_NotifyImmediate(enum eventtype event, uint32_t ent_uid, void *event_arg, 
                               enum event_source source);
 
@@ -47,6 +47,7 @@
 #include "../camera.h"
 #include "../sched.h"
 #include "../lib/public/khash.h"
+#include "../lib/public/pqueue.h"
 #include "../lib/public/stalloc.h"
 #include "../lib/public/pf_string.h"
 #include "../lib/public/attr.h"
@@ -54,10 +55,14 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 
 #define TRANSIENT_STATE_TICKS        (2) 
 #define TRANSPORT_UNIT_COST_DISTANCE (150)
+/* Transport jobs are planned on every n'th 20Hz tick */
+#define TRANSPORT_PLAN_PERIOD_TICKS  (5)
 #define ARR_SIZE(a)                  (sizeof(a)/sizeof((a)[0]))
+#define MAX(a, b)                    ((a) > (b) ? (a) : (b))
 
 #define CHK_TRUE_RET(_pred)             \
     do{                                 \
@@ -83,15 +88,33 @@ struct automation_state{
     uint32_t          transport_target;
 };
 
-struct cost_mapping{
+struct transport_cand{
     uint32_t site;
-    int      cost;
     float    distance;
-    int      num_assigned;
+};
+
+struct transport_worker{
+    uint32_t uid;
+    /* Range in the candidates array */
+    size_t   first;
+    size_t   ncands;
+    bool     assigned;
+};
+
+struct transport_job{
+    int worker;
+    int cand;
+    /* The number of transporters assigned to the site when the 
+     * job's priority was computed */
+    int num_assigned;
 };
 
 KHASH_MAP_INIT_INT(state, struct automation_state)
 KHASH_MAP_INIT_INT(count, uint32_t);
+KHASH_SET_INIT_INT(uid)
+
+PQUEUE_TYPE(job, struct transport_job)
+PQUEUE_IMPL(static, job, struct transport_job)
 
 static void on_order_issued(void *user, void *event);
 
@@ -100,8 +123,16 @@ static void on_order_issued(void *user, void *event);
 /*****************************************************************************/
 
 static khash_t(state) *s_entity_state_table;
+/* The entities whose idleness may have changed or which are in one of the 
+ * transient states. Only these are examined on every tick. */
+static khash_t(uid)   *s_watched;
+/* The entities currently in the 'IDLE' state */
+static khash_t(uid)   *s_idle;
 /* Maps storage sites to the number of automated transporters servicing it */
 static khash_t(count) *s_transport_count;
+static int             s_plan_ticks;
+/* Cached value of the debug setting read every frame */
+static struct sval     s_show_state;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -132,6 +163,38 @@ static void astate_remove(uint32_t uid)
         kh_del(state, s_entity_state_table, k);
 }
 
+static void uid_set_add(khash_t(uid) *set, uint32_t uid)
+{
+    int status;
+    kh_put(uid, set, uid, &status);
+    assert(status != -1);
+}
+
+static void uid_set_remove(khash_t(uid) *set, uint32_t uid)
+{
+    khiter_t k = kh_get(uid, set, uid);
+    if(k != kh_end(set))
+        kh_del(uid, set, k);
+}
+
+static void astate_set_state(uint32_t uid, struct automation_state *astate, 
+                             enum worker_state state)
+{
+    if(state == STATE_IDLE) {
+        uid_set_add(s_idle, uid);
+    }else{
+        uid_set_remove(s_idle, uid);
+    }
+    astate->state = state;
+}
+
+static int compare_uids(const void *a, const void *b)
+{
+    uint32_t uida = *(const uint32_t*)a;
+    uint32_t uidb = *(const uint32_t*)b;
+    return (uida > uidb) - (uida < uidb);
+}
+
 static bool idle(uint32_t uid)
 {
     uint32_t flags = G_FlagsGet(uid);
@@ -159,7 +222,7 @@ static bool transporter_compatible_for_resource(uint32_t worker, uint32_t site,
     return true;
 }
 
-static int transport_job_cost(uint32_t worker, uint32_t site, int *out_num_assigned, float *out_dist)
+static int transport_job_cost(float distance, int num_assigned)
 {
     /* The job 'cost' takes into account both the distance from
      * the target site, and the number of automated workers 
@@ -167,103 +230,54 @@ static int transport_job_cost(uint32_t worker, uint32_t site, int *out_num_assig
      * balance between 'fairness' and redundant traveling due 
      * to far-off assignments.
      */
-    vec2_t worker_pos = G_Pos_GetXZ(worker);
-    vec2_t site_pos = G_Pos_GetXZ(site);
-
-    vec2_t delta;
-    PFM_Vec2_Sub(&site_pos, &worker_pos, &delta);
-    float len = PFM_Vec2_Len(&delta);
-    *out_dist = len;
-
-    int num_assigned = 0;
-    khiter_t k = kh_get(count, s_transport_count, site);
-    if(k != kh_end(s_transport_count)) {
-        num_assigned = kh_value(s_transport_count, k);
-    }
-    *out_num_assigned = num_assigned;
-
-    int distance_cost = ((int)len) / TRANSPORT_UNIT_COST_DISTANCE;
+    int distance_cost = ((int)distance) / TRANSPORT_UNIT_COST_DISTANCE;
     int fairness_cost = num_assigned;
     return (distance_cost + fairness_cost);
 }
 
-static int compare_jobs(const void *a, const void *b)
+static float transport_job_priority(float distance, int num_assigned)
 {
-    struct cost_mapping mappinga = *(const struct cost_mapping*)a;
-    struct cost_mapping mappingb = *(const struct cost_mapping*)b;
-
-    if (mappinga.cost < mappingb.cost) return -1;
-    if (mappinga.cost > mappingb.cost) return 1;
-
-    /* When costs are the same, resort to sorting by number of
-     * assigned workers.
-     */
-    if(mappinga.num_assigned < mappingb.num_assigned) return -1;
-    if(mappinga.num_assigned > mappingb.num_assigned) return 1;
-
-    /* Lastly, resort to distance. 
+    /* The integral part is the job cost. When costs are the same, 
+     * the fractional part orders the jobs by the number of assigned
+     * workers, and lastly by distance. As the cost is the sum of the 
+     * distance band and the assigned count, the latter never exceeds 
+     * the cost, which keeps the fraction below 1.
      */
-    if(mappinga.distance < mappingb.distance) return -1;
-    if(mappinga.distance > mappingb.distance) return 1;
-
-    return 0;
+    int cost = transport_job_cost(distance, num_assigned);
+    int band = ((int)distance) / TRANSPORT_UNIT_COST_DISTANCE;
+    float rem = (distance - band * TRANSPORT_UNIT_COST_DISTANCE) / TRANSPORT_UNIT_COST_DISTANCE;
+    return cost + (num_assigned + rem) / (cost + 1);
 }
 
-static uint32_t target_site_for_resource(uint32_t uid, const char *rname)
-{
-    uint32_t ret = NULL_UID;
-
-    vec_entity_t sites;
-    vec_entity_init(&sites);
-    G_StorageSite_GetAll(&sites);
-
-    const size_t nsites = vec_size(&sites);
-    STALLOC(struct cost_mapping, costs, nsites);
-
-    /* Prune sites which are not compatible */
-    for(int i = nsites - 1; i >= 0; i--) {
-        uint32_t site = vec_AT(&sites, i);
-        if(!transporter_compatible_for_resource(uid, site, rname)) {
-            vec_entity_del(&sites, i);
-        }
-    }
-
-    size_t left = vec_size(&sites);
-    for(int i = 0; i < left; i++) {
-
-        uint32_t site = vec_AT(&sites, i);
-        int num_assigned;
-        float distance;
-        int cost = transport_job_cost(uid, site, &num_assigned, &distance);
-
-        costs[i] = (struct cost_mapping){
-            .site = site,
-            .cost = cost,
-            .num_assigned = num_assigned,
-            .distance = distance,
-        };
-    }
-    qsort(costs, left, sizeof(struct cost_mapping), compare_jobs);
-    if(left > 0) {
-        ret = costs[0].site;
-    }
-
-    STFREE(costs);
-    vec_entity_destroy(&sites);
-    return ret;
-}
-
-static uint32_t target_site(uint32_t uid)
+static size_t candidate_sites(uint32_t uid, const vec_entity_t *sites, 
+                              struct transport_cand *out)
 {
     const char *transportable[64];
     size_t ntransportable = G_Harvester_GetTransportPrio(uid, ARR_SIZE(transportable), transportable);
+    int faction_id = G_GetFactionID(uid);
+    vec2_t worker_pos = G_Pos_GetXZ(uid);
 
+    /* Only the sites for the highest-priority resource that is 
+     * wanted anywhere are considered */
     for(int i = 0; i < ntransportable; i++) {
-        uint32_t target = target_site_for_resource(uid, transportable[i]);
-        if(target != NULL_UID)
-            return target;
+
+        size_t ret = 0;
+        for(int j = 0; j < vec_size(sites); j++) {
+
+            uint32_t site = vec_AT(sites, j);
+            if(G_GetFactionID(site) != faction_id)
+                continue;
+            if(!transporter_compatible_for_resource(uid, site, transportable[i]))
+                continue;
+
+            vec2_t delta, site_pos = G_Pos_GetXZ(site);
+            PFM_Vec2_Sub(&site_pos, &worker_pos, &delta);
+            out[ret++] = (struct transport_cand){site, PFM_Vec2_Len(&delta)};
+        }
+        if(ret > 0)
+            return ret;
     }
-    return NULL_UID;
+    return 0;
 }
 
 static void increment_assigned_transporters(uint32_t site)
@@ -294,104 +308,203 @@ static int get_assigned_transporters(uint32_t site)
     return kh_val(s_transport_count, k);
 }
 
-static void recompute_idle(void)
+/* Returns true if the entity needs to be examined again on the next tick 
+ * even if none of its' subsystems report a change.
+ */
+static bool update_state(uint32_t uid, struct automation_state *astate)
 {
-    uint32_t uid;
-    struct automation_state *astate;
-
-    kh_foreach_val_ptr(s_entity_state_table, uid, astate, {
-        
-        switch(astate->state) {
-        case STATE_IDLE: {
-            if(!idle(uid)) {
-                astate->state = STATE_WAKING;
-            }
-            break;
+    switch(astate->state) {
+    case STATE_IDLE: {
+        if(!idle(uid)) {
+            astate_set_state(uid, astate, STATE_WAKING);
+            return true;
         }
-        case STATE_WAKING: {
-            if(idle(uid)) {
-                astate->transient_ticks = 0;
-                astate->state = STATE_IDLE;
-                break;
-            }
-            astate->transient_ticks++;
-            if(astate->transient_ticks == TRANSIENT_STATE_TICKS) {
-                astate->transient_ticks = 0;
-                astate->state = STATE_ACTIVE;
-                E_Global_Notify(EVENT_UNIT_BECAME_ACTIVE, (void*)((uintptr_t)uid), ES_ENGINE);
-            }
-            break;
+        return false;
+    }
+    case STATE_WAKING: {
+        if(idle(uid)) {
+            astate->transient_ticks = 0;
+            astate_set_state(uid, astate, STATE_IDLE);
+            return false;
         }
-        case STATE_ACTIVE: {
-            if(idle(uid)) {
-                astate->state = STATE_STOPPING;
-            }
-            break;
+        astate->transient_ticks++;
+        if(astate->transient_ticks == TRANSIENT_STATE_TICKS) {
+            astate->transient_ticks = 0;
+            astate_set_state(uid, astate, STATE_ACTIVE);
+            E_Global_Notify(EVENT_UNIT_BECAME_ACTIVE, (void*)((uintptr_t)uid), ES_ENGINE);
+            return false;
         }
-        case STATE_STOPPING: {
-            if(!idle(uid)) {
-                astate->transient_ticks = 0;
-                astate->state = STATE_ACTIVE;
-                break;
-            }
-            astate->transient_ticks++;
-            if(astate->transient_ticks == TRANSIENT_STATE_TICKS) {
-                astate->transient_ticks = 0;
-                astate->state = STATE_IDLE;
-                if(astate->transport_target != NULL_UID) {
-                    try_decrement_assigned_transporters(astate->transport_target);
-                    astate->transport_target = NULL_UID;
-                }
-                E_Global_Notify(EVENT_UNIT_BECAME_IDLE, (void*)((uintptr_t)uid), ES_ENGINE);
+        return true;
+    }
+    case STATE_ACTIVE: {
+        if(idle(uid)) {
+            astate_set_state(uid, astate, STATE_STOPPING);
+            return true;
+        }
+        return false;
+    }
+    case STATE_STOPPING: {
+        if(!idle(uid)) {
+            astate->transient_ticks = 0;
+            astate_set_state(uid, astate, STATE_ACTIVE);
+            return false;
+        }
+        astate->transient_ticks++;
+        if(astate->transient_ticks == TRANSIENT_STATE_TICKS) {
+            astate->transient_ticks = 0;
+            astate_set_state(uid, astate, STATE_IDLE);
+            if(astate->transport_target != NULL_UID) {
+                try_decrement_assigned_transporters(astate->transport_target);
+                astate->transport_target = NULL_UID;
             }
-            break;
+            E_Global_Notify(EVENT_UNIT_BECAME_IDLE, (void*)((uintptr_t)uid), ES_ENGINE);
+            return false;
         }
-        default: assert(0);
+        return true;
+    }
+    default: assert(0);
+    }
+    return false;
+}
+
+static void recompute_idle(void)
+{
+    for(khiter_t k = kh_begin(s_watched); k != kh_end(s_watched); k++) {
+
+        if(!kh_exist(s_watched, k))
+            continue;
+
+        uint32_t uid = kh_key(s_watched, k);
+        struct automation_state *astate = astate_get(uid);
+        if(!astate || !update_state(uid, astate)) {
+            kh_del(uid, s_watched, k);
         }
-    });
+    }
 }
 
 static void assign_transport_jobs(void)
 {
+    vec_entity_t idle;
+    vec_entity_init(&idle);
+
     uint32_t uid;
-    struct automation_state *astate;
+    kh_foreach_key(s_idle, uid, {
+        struct automation_state *astate = astate_get(uid);
+        assert(astate && astate->state == STATE_IDLE);
+        if(!(G_FlagsGet(uid) & ENTITY_FLAG_HARVESTER))
+            continue;
+        if(!astate->automatic_transport)
+            continue;
+        vec_entity_push(&idle, uid);
+    });
 
-    kh_foreach_val_ptr(s_entity_state_table, uid, astate, {
+    const size_t nidle = vec_size(&idle);
+    if(nidle == 0) {
+        vec_entity_destroy(&idle);
+        return;
+    }
+    /* Hand out the jobs independently of the hash table layout */
+    qsort(idle.array, nidle, sizeof(uint32_t), compare_uids);
 
-        if(astate->state != STATE_IDLE)
-            continue;
+    vec_entity_t sites;
+    vec_entity_init(&sites);
+    G_StorageSite_GetAll(&sites);
 
-        if(!(G_FlagsGet(uid) & ENTITY_FLAG_HARVESTER))
+    pq(job) jobs;
+    pq_job_init(&jobs);
+
+    const size_t nsites = vec_size(&sites);
+    struct transport_worker *workers = malloc(nidle * sizeof(struct transport_worker));
+    struct transport_cand *cands = malloc(MAX(nidle * nsites, 1) * sizeof(struct transport_cand));
+    if(!workers || !cands)
+        goto out;
+
+    /* Gather the candidate sites of all idle transporters up-front, 
+     * then hand out the jobs in order of global cost rather than 
+     * letting each worker greedily grab its' own favourite site. 
+     * The fairness term of the cost is updated as jobs are handed 
+     * out, which spreads the workers over all the sites that need 
+     * servicing instead of having them converge on the same one.
+     */
+    size_t nworkers = 0, ncands = 0;
+    for(int i = 0; i < nidle; i++) {
+
+        uint32_t uid = vec_AT(&idle, i);
+        size_t n = candidate_sites(uid, &sites, cands + ncands);
+        if(n == 0)
             continue;
-        
-        if(!astate->automatic_transport)
+
+        for(int j = 0; j < n; j++) {
+            struct transport_cand *cand = &cands[ncands + j];
+            int num_assigned = get_assigned_transporters(cand->site);
+            struct transport_job job = (struct transport_job){
+                .worker = nworkers,
+                .cand = ncands + j,
+                .num_assigned = num_assigned
+            };
+            if(!pq_job_push(&jobs, transport_job_priority(cand->distance, num_assigned), job))
+                goto out;
+        }
+
+        workers[nworkers++] = (struct transport_worker){
+            .uid = uid,
+            .first = ncands,
+            .ncands = n,
+            .assigned = false
+        };
+        ncands += n;
+    }
+
+    /* Handing out a job only ever increases the assigned count of its' 
+     * site, which can only push the other jobs for that site further back. 
+     * Stale entries are re-queued with their up-to-date priority once they 
+     * make it to the front of the queue.
+     */
+    struct transport_job job;
+    while(pq_job_pop(&jobs, &job)) {
+
+        struct transport_worker *worker = &workers[job.worker];
+        if(worker->assigned)
             continue;
 
-        uint32_t site = target_site(uid);
-        if(site == NULL_UID)
+        struct transport_cand *cand = &cands[job.cand];
+        int num_assigned = get_assigned_transporters(cand->site);
+        if(num_assigned != job.num_assigned) {
+            job.num_assigned = num_assigned;
+            if(!pq_job_push(&jobs, transport_job_priority(cand->distance, num_assigned), job))
+                goto out;
             continue;
+        }
 
-        increment_assigned_transporters(site);
-        astate->transport_target = site;
-        G_Harvester_Transport(uid, site);
-    });
+        worker->assigned = true;
+        struct automation_state *astate = astate_get(worker->uid);
+        assert(astate);
+
+        increment_assigned_transporters(cand->site);
+        astate->transport_target = cand->site;
+        G_Harvester_Transport(worker->uid, cand->site);
+    }
+
+out:
+    pq_job_destroy(&jobs);
+    free(cands);
+    free(workers);
+    vec_entity_destroy(&sites);
+    vec_entity_destroy(&idle);
 }
 
 static void on_20hz_tick(void *user, void *event)
 {
     recompute_idle();
-    assign_transport_jobs();
+    if(++s_plan_ticks == TRANSPORT_PLAN_PERIOD_TICKS) {
+        s_plan_ticks = 0;
+        assign_transport_jobs();
+    }
 }
 
 static void on_update_ui(void *user, void *event)
 {
-    struct sval setting;
-    ss_e status;
-    (void)status;
-
-    status = Settings_Get("pf.debug.show_automation_state", &setting);
-    assert(status == SS_OKAY);
-    if(!setting.as_bool)
+    if(!s_show_state.as_bool)
         return;
 
     struct camera *cam = G_GetActiveCamera();
@@ -486,7 +599,11 @@ bool G_Automation_AddEntity(uint32_t uid)
         .automatic_transport = false,
         .transport_target = NULL_UID,
     };
-    return astate_set(uid, state);
+    if(!astate_set(uid, state))
+        return false;
+    uid_set_add(s_idle, uid);
+    uid_set_add(s_watched, uid);
+    return true;
 }
 
 void G_Automation_RemoveEntity(uint32_t uid)
@@ -495,24 +612,45 @@ void G_Automation_RemoveEntity(uint32_t uid)
     if(!astate)
         return;
     E_Entity_Unregister(EVENT_ORDER_ISSUED, uid, on_order_issued);
+    uid_set_remove(s_idle, uid);
+    uid_set_remove(s_watched, uid);
     astate_remove(uid);
 }
 
+void G_Automation_NotifyStateChanged(uint32_t uid)
+{
+    if(!s_entity_state_table || !astate_get(uid))
+        return;
+    uid_set_add(s_watched, uid);
+}
+
 bool G_Automation_Init(void)
 {
+    Settings_Bind("pf.debug.show_automation_state", &s_show_state);
+
     if((s_entity_state_table = kh_init(state)) == NULL)
         goto fail_entity_state_table;
     if((s_transport_count = kh_init(count)) == NULL)
         goto fail_transport_count_table;
+    if((s_watched = kh_init(uid)) == NULL)
+        goto fail_watched;
+    if((s_idle = kh_init(uid)) == NULL)
+        goto fail_idle;
 
+    s_plan_ticks = 0;
     E_Global_Register(EVENT_20HZ_TICK, on_20hz_tick, NULL, G_RUNNING);
     E_Global_Register(EVENT_UPDATE_UI, on_update_ui, NULL, G_RUNNING);
     E_Global_Register(EVENT_ORDER_ISSUED, on_order_issued, NULL, G_RUNNING);
     return true;
 
+fail_idle:
+    kh_destroy(uid, s_watched);
+fail_watched:
+    kh_destroy(count, s_transport_count);
 fail_transport_count_table:
     kh_destroy(state, s_entity_state_table);
 fail_entity_state_table:
+    s_entity_state_table = NULL;
     return false;
 }
 
@@ -521,8 +659,11 @@ void G_Automation_Shutdown(void)
     E_Global_Unregister(EVENT_ORDER_ISSUED, on_order_issued);
     E_Global_Unregister(EVENT_UPDATE_UI, on_update_ui);
     E_Global_Unregister(EVENT_20HZ_TICK, on_20hz_tick);
+    kh_destroy(uid, s_idle);
+    kh_destroy(uid, s_watched);
     kh_destroy(count, s_transport_count);
     kh_destroy(state, s_entity_state_table);
+    s_entity_state_table = NULL;
 }
 
 void G_Automation_GetIdle(vec_entity_t *out)
@@ -530,11 +671,7 @@ void G_Automation_GetIdle(vec_entity_t *out)
     size_t ret = 0;
 
     uint32_t uid;
-    struct automation_state *astate;
-
-    kh_foreach_val_ptr(s_entity_state_table, uid, astate, {
-        if(astate->state != STATE_IDLE)
-            continue;
+    kh_foreach_key(s_idle, uid, {
         vec_entity_push(out, uid);
     });
 }
@@ -675,7 +812,8 @@ bool G_Automation_LoadState(struct SDL_RWops *stream)
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_INT);
-        astate->state = attr.val.as_int;
+        astate_set_state(uid, astate, attr.val.as_int);
+        uid_set_add(s_watched, uid);
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_INT);
@@ -46,6 +46,10 @@ void G_Automation_Shutdown(void);
 
 bool G_Automation_AddEntity(uint32_t uid);
 void G_Automation_RemoveEntity(uint32_t uid);
+/* Called by the other subsystems whenever an entity switches between being 
+ * idle and busy, so that only the affected workers need to be re-examined. 
+ */
+void G_Automation_NotifyStateChanged(uint32_t uid);
 
 bool G_Automation_SaveState(struct SDL_RWops *stream);
 bool G_Automation_LoadState(struct SDL_RWops *stream);
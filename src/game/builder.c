@@ -37,6 +37,7 @@
 #include "building.h"
 #include "harvester.h"
 #include "storage_site.h"
+#include "automation.h"
 #include "game_private.h"
 #include "movement.h"
 #include "position.h"
@@ -46,6 +47,8 @@
 #include "../perf.h"
 #include "../event.h"
 #include "../cursor.h"
+#include "../replay.h"
+#include "../net.h"
 #include "../phys/public/collision.h"
 #include "../map/public/map.h"
 #include "../lib/public/khash.h"
@@ -114,6 +117,15 @@ static void builderstate_remove(uint32_t uid)
         kh_del(state, s_entity_state_table, k);
 }
 
+static void builderstate_set_state(uint32_t uid, struct builderstate *bs, int state)
+{
+    bool was_idle = (bs->state == STATE_NOT_BUILDING);
+    bs->state = state;
+    if(was_idle != (state == STATE_NOT_BUILDING)) {
+        G_Automation_NotifyStateChanged(uid);
+    }
+}
+
 static void on_motion_begin(void *user, void *event)
 {
     uint32_t uid = (uintptr_t)user;
@@ -124,7 +136,7 @@ static void on_motion_begin(void *user, void *event)
     E_Entity_Unregister(EVENT_MOTION_START, uid, on_motion_begin);
     E_Entity_Unregister(EVENT_ANIM_CYCLE_FINISHED, uid, on_build_anim_finished);
 
-    bs->state = STATE_NOT_BUILDING;
+    builderstate_set_state(uid, bs, STATE_NOT_BUILDING);
     E_Entity_Notify(EVENT_BUILD_END, uid, NULL, ES_ENGINE);
 }
 
@@ -139,7 +151,7 @@ static void finish_building(struct builderstate *bs, uint32_t uid)
     }
 
     uint32_t building = bs->target_uid;
-    bs->state = STATE_NOT_BUILDING;
+    builderstate_set_state(uid, bs, STATE_NOT_BUILDING);
     bs->target_uid = UID_NONE;
 
     if(building == NULL_UID)
@@ -197,7 +209,7 @@ static void on_motion_end(void *user, void *event)
     if(!G_EntityExists(bs->target_uid)
     ||  G_EntityIsZombie(bs->target_uid)
     || !M_NavObjAdjacent(s_map, uid, bs->target_uid)) {
-        bs->state = STATE_NOT_BUILDING;
+        builderstate_set_state(uid, bs, STATE_NOT_BUILDING);
         bs->target_uid = UID_NONE;
         return; /* builder could not reach the building */
     }
@@ -207,7 +219,7 @@ static void on_motion_end(void *user, void *event)
         if(G_Building_Unobstructed(bs->target_uid) && G_Building_Found(bs->target_uid, true)) {
             E_Entity_Notify(EVENT_BUILDING_FOUNDED, bs->target_uid, NULL, ES_ENGINE);
         }else{
-            bs->state = STATE_NOT_BUILDING;
+            builderstate_set_state(uid, bs, STATE_NOT_BUILDING);
             bs->target_uid = UID_NONE;
             E_Entity_Notify(EVENT_BUILD_FAIL_FOUND, uid, NULL, ES_ENGINE);
             return; 
@@ -225,7 +237,7 @@ static void on_motion_end(void *user, void *event)
             G_Harvester_Stop(uid);
             G_Harvester_SupplyBuilding(uid, bs->target_uid);
         }
-        bs->state = STATE_NOT_BUILDING;
+        builderstate_set_state(uid, bs, STATE_NOT_BUILDING);
         return;
     }
 
@@ -236,7 +248,7 @@ static void on_motion_end(void *user, void *event)
         return;
     }
 
-    bs->state = STATE_BUILDING; 
+    builderstate_set_state(uid, bs, STATE_BUILDING);
     E_Entity_Notify(EVENT_BUILD_BEGIN, uid, NULL, ES_ENGINE);
     E_Entity_Register(EVENT_MOTION_START, uid, on_motion_begin, (void*)((uintptr_t)uid), G_RUNNING);
     E_Entity_Register(EVENT_ANIM_CYCLE_FINISHED, uid, on_build_anim_finished, 
@@ -274,14 +286,34 @@ static void on_mousedown(void *user, void *event)
 
     enum selection_type sel_type;
     const vec_entity_t *sel = G_Sel_Get(&sel_type);
-    size_t nbuilding = 0;
 
     if(sel_type != SELECTION_TYPE_PLAYER)
         return;
 
-    for(int i = 0; i < vec_size(sel); i++) {
+    Net_IssueCommand(&(struct replay_cmd){
+        .type = REPLAY_CMD_BUILD,
+        .nents = vec_size(sel),
+        .ents = sel->array,
+        .target = target
+    });
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void G_Builder_BuildOrder(size_t nents, const uint32_t *ents, uint32_t target)
+{
+    if(!G_EntityExists(target))
+        return;
+
+    size_t nbuilding = 0;
+    for(int i = 0; i < nents; i++) {
+
+        uint32_t curr = ents[i];
+        if(!G_EntityExists(curr))
+            continue;
 
-        uint32_t curr = vec_AT(sel, i);
         uint32_t flags = G_FlagsGet(curr);
 
         if(!(flags & ENTITY_FLAG_BUILDER))
@@ -302,10 +334,6 @@ static void on_mousedown(void *user, void *event)
     }
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
-
 bool G_Builder_Init(struct map *map)
 {
     if(NULL == (s_entity_state_table = kh_init(state)))
@@ -336,7 +364,7 @@ bool G_Builder_Build(uint32_t uid, uint32_t building)
     E_Entity_Unregister(EVENT_MOTION_START, uid, on_motion_begin);
     E_Entity_Unregister(EVENT_ANIM_CYCLE_FINISHED, uid, on_build_anim_finished);
 
-    bs->state = STATE_MOVING_TO_TARGET;
+    builderstate_set_state(uid, bs, STATE_MOVING_TO_TARGET);
     bs->target_uid = building;
     E_Entity_Notify(EVENT_BUILD_TARGET_ACQUIRED, uid, (void*)((uintptr_t)building), ES_ENGINE);
 
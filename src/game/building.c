@@ -138,8 +138,6 @@ static const struct map     *s_map;
 static khash_t(state)       *s_entity_state_table;
 
 static mpa_buff_t            s_mpool;
-static khash_t(stridx)      *s_stridx;
-static mp_strbuff_t          s_stringpool;
 static struct memstack       s_eventargs;
 static bool                  s_set_rally_on_lclick = false;
 
@@ -284,8 +282,10 @@ static void building_mark_border(struct buildstate *bs, struct tile_desc *a, str
     uint32_t uid = Entity_NewUID();
     bool result = AL_EntityFromPFObj(MARKER_DIR, MARKER_OBJ, 
         "__build_site_marker__", uid, &flags);
-    if(!result)
+    if(!result) {
+        Entity_FreeUID(uid);
         return;
+    }
 
     if(fabs(acenter.z - bcenter.z) > EPSILON) {
         Entity_SetRot(uid, (quat_t){ 0, 1.0 / sqrt(2.0), 0, 1.0 / sqrt(2.0) });
@@ -304,8 +304,10 @@ static void building_mark_center(struct buildstate *bs, uint32_t uid)
 
     bool result = AL_EntityFromPFObj(CENTER_MARKER_DIR, CENTER_MARKER_OBJ, 
         "__build_site_marker__", marker_uid, &flags);
-    if(!result)
+    if(!result) {
+        Entity_FreeUID(marker_uid);
         return;
+    }
 
     Entity_SetScale(marker_uid, (vec3_t){2.5, 2.5f, 2.5f});
     G_AddEntity(marker_uid, flags, pos);
@@ -370,7 +372,7 @@ static void building_clear_markers(struct buildstate *bs)
 
 static bool bstate_set_key(khash_t(int) *table, const char *name, int val)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
+    const char *key = si_intern(name, NULL);
     if(!key)
         return false;
 
@@ -392,7 +394,7 @@ static bool bstate_set_key(khash_t(int) *table, const char *name, int val)
 
 static bool bstate_get_key(khash_t(int) *table, const char *name, int *out)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
+    const char *key = si_intern(name, NULL);
     if(!key)
         return false;
 
@@ -489,8 +491,6 @@ bool G_Building_Init(const struct map *map)
         goto fail_table;
     if(0 != kh_resize(state, s_entity_state_table, 2048))
         goto fail_res;
-    if(!si_init(&s_stringpool, &s_stridx, 512))
-        goto fail_res;
     if(!stalloc_init(&s_eventargs))
         goto fail_eventargs;
 
@@ -502,7 +502,6 @@ bool G_Building_Init(const struct map *map)
     return true;
 
 fail_eventargs:
-    si_shutdown(&s_stringpool, s_stridx);
 fail_res:
     kh_destroy(state, s_entity_state_table);
 fail_table:
@@ -527,7 +526,6 @@ void G_Building_Shutdown(void)
     });
 
     stalloc_destroy(&s_eventargs);
-    si_shutdown(&s_stringpool, s_stridx);
     kh_destroy(state, s_entity_state_table);
     mpa_buff_destroy(&s_mpool);
 }
@@ -663,6 +661,8 @@ bool G_Building_Found(uint32_t uid, bool blocking)
 
         G_AddEntity(progress_uid, progress_flags, G_Pos_Get(uid));
         bs->progress_model = progress_uid;
+    }else{
+        Entity_FreeUID(progress_uid);
     }
 
     uint32_t ent_flags = G_FlagsGet(uid);
@@ -0,0 +1,227 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "changes.h"
+#include "public/game.h"
+#include "../main.h"
+#include "../lib/public/vec.h"
+#include "../lib/public/khash.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+#define MAX_SUBSCRIBERS (16)
+/* Beyond this, the oldest records are discarded even if some 
+ * subscribers have not read them yet */
+#define MAX_RECORDS     (256 * 1024)
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+VEC_TYPE(change, struct change)
+VEC_IMPL(static inline, change, struct change)
+
+KHASH_MAP_INIT_INT(seq, uint64_t)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static vec_change_t          s_log;
+/* Sequence number of the first record in the log */
+static uint64_t              s_base;
+/* Records at or after this sequence number have not been read by anyone 
+ * yet, and so they can still be merged with newer changes. */
+static uint64_t              s_unread;
+/* The sequence number of every entity's unread record */
+static khash_t(seq)         *s_unread_index;
+static struct change_cursor *s_subscribers[MAX_SUBSCRIBERS];
+static size_t                s_nsubscribers;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint64_t changes_end(void)
+{
+    return s_base + vec_size(&s_log);
+}
+
+static void changes_mark_read(void)
+{
+    s_unread = changes_end();
+    kh_clear(seq, s_unread_index);
+}
+
+static void changes_discard(uint64_t upto)
+{
+    assert(upto >= s_base && upto <= changes_end());
+    size_t ndiscard = upto - s_base;
+    if(ndiscard == 0)
+        return;
+
+    size_t nleft = vec_size(&s_log) - ndiscard;
+    memmove(s_log.array, s_log.array + ndiscard, nleft * sizeof(struct change));
+    s_log.size = nleft;
+    s_base = upto;
+
+    if(s_unread < s_base)
+        changes_mark_read();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Changes_Init(void)
+{
+    vec_change_init(&s_log);
+    if(!(s_unread_index = kh_init(seq)))
+        return false;
+
+    s_base = 0;
+    s_unread = 0;
+    s_nsubscribers = 0;
+    return true;
+}
+
+void G_Changes_Shutdown(void)
+{
+    kh_destroy(seq, s_unread_index);
+    vec_change_destroy(&s_log);
+}
+
+void G_Changes_Clear(void)
+{
+    changes_discard(changes_end());
+    changes_mark_read();
+}
+
+void G_Changes_Trim(void)
+{
+    uint64_t min = changes_end();
+    for(int i = 0; i < s_nsubscribers; i++) {
+        min = MIN(min, s_subscribers[i]->seq);
+    }
+    changes_discard(MAX(min, s_base));
+}
+
+void G_Changes_Mark(uint32_t uid, uint32_t what)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(s_nsubscribers == 0)
+        return;
+
+    khiter_t k = kh_get(seq, s_unread_index, uid);
+    if(k != kh_end(s_unread_index)) {
+        uint64_t seq = kh_val(s_unread_index, k);
+        vec_AT(&s_log, seq - s_base).what |= what;
+        return;
+    }
+
+    if(vec_size(&s_log) == MAX_RECORDS) {
+        G_Changes_Trim();
+    }
+    if(vec_size(&s_log) == MAX_RECORDS) {
+        changes_discard(s_base + MAX_RECORDS / 2);
+    }
+
+    uint64_t seq = changes_end();
+    if(!vec_change_push(&s_log, (struct change){uid, what})) {
+        /* Make sure no subscriber misses the change */
+        G_Changes_Clear();
+        return;
+    }
+
+    int status;
+    k = kh_put(seq, s_unread_index, uid, &status);
+    if(status == -1) {
+        changes_mark_read();
+        return;
+    }
+    kh_val(s_unread_index, k) = seq;
+}
+
+bool G_Changes_Subscribe(struct change_cursor *cursor, uint32_t mask)
+{
+    if(s_nsubscribers == MAX_SUBSCRIBERS)
+        return false;
+
+    /* Don't merge any later changes into records behind the cursor */
+    changes_mark_read();
+    cursor->seq = changes_end();
+    cursor->mask = mask;
+    s_subscribers[s_nsubscribers++] = cursor;
+    return true;
+}
+
+void G_Changes_Unsubscribe(struct change_cursor *cursor)
+{
+    for(int i = 0; i < s_nsubscribers; i++) {
+        if(s_subscribers[i] != cursor)
+            continue;
+        s_subscribers[i] = s_subscribers[--s_nsubscribers];
+        break;
+    }
+}
+
+int G_Changes_Read(struct change_cursor *cursor, size_t maxout, struct change out[])
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(cursor->seq < s_base) {
+        cursor->seq = changes_end();
+        return -1;
+    }
+
+    size_t ret = 0;
+    uint64_t end = changes_end();
+
+    while(cursor->seq < end && ret < maxout) {
+
+        const struct change *curr = &vec_AT(&s_log, cursor->seq - s_base);
+        cursor->seq++;
+        if(!(curr->what & cursor->mask))
+            continue;
+        out[ret++] = *curr;
+    }
+
+    if(cursor->seq > s_unread)
+        changes_mark_read();
+    return ret;
+}
+
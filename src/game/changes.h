@@ -0,0 +1,83 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef CHANGES_H
+#define CHANGES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A log of the entities whose state was changed, with the kind of the 
+ * change (one of the 'entity_change' flags). Within the span of time 
+ * where no subscriber reads the log, every entity has at most a single 
+ * record with all its' changes combined. 
+ *
+ * Subscribers hold a cursor into the log and read the changes that were 
+ * made since their last read, such that they can update their own state 
+ * incrementally instead of rescanning every entity. Records are kept only 
+ * until every subscriber has read past them. When a subscriber falls so 
+ * far behind that records it has not read are discarded, its' next read 
+ * reports that it must rescan everything.
+ */
+
+struct change{
+    uint32_t uid;
+    uint32_t what;
+};
+
+struct change_cursor{
+    uint64_t seq;
+    uint32_t mask;
+};
+
+bool G_Changes_Init(void);
+void G_Changes_Shutdown(void);
+void G_Changes_Clear(void);
+/* Discard the records that have been read by all subscribers */
+void G_Changes_Trim(void);
+
+/* The cursor only sees the changes made after subscribing, and only those 
+ * matching the 'mask' */
+bool G_Changes_Subscribe(struct change_cursor *cursor, uint32_t mask);
+void G_Changes_Unsubscribe(struct change_cursor *cursor);
+/* Returns the number of changes written to 'out', which is 0 only once the 
+ * cursor has reached the end of the log. Returns -1 if changes were lost 
+ * before the cursor could read them - the cursor is then moved to the end 
+ * of the log, and the subscriber must rescan all entities. */
+int  G_Changes_Read(struct change_cursor *cursor, size_t maxout, struct change out[]);
+
+#endif
+
@@ -57,6 +57,7 @@
 #include "../map/public/map.h"
 #include "../lib/public/pf_string.h"
 #include "../lib/public/mem.h"
+#include "../lib/public/simd.h"
 
 #include <assert.h>
 #include <stdbool.h>
@@ -87,6 +88,17 @@ struct HRVO{
     vec2_t xz_right_side;
 };
 
+/* The combined velocity obstacle, with the apex and the unit left and right 
+ * sides of every VO kept in structure-of-arrays form, so that a point can 
+ * be tested against VW of the VOs at once.
+ */
+struct pcr{
+    size_t n_vos;
+    float *apex_x, *apex_z;
+    float *left_x, *left_z;
+    float *right_x, *right_z;
+};
+
 struct saved_ctx{
     struct cp_ent cpent;
     vec2_t        ent_des_v;
@@ -105,6 +117,8 @@ struct saved_ctx{
 /*****************************************************************************/
 
 static struct saved_ctx s_debug_saved;
+/* Cached value of the debug setting read for every moving entity */
+static struct sval      s_show_combined_hrvo;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -235,43 +249,91 @@ static size_t compute_all_hrvos(struct cp_ent ent, vec_cp_ent_t dyn_neighbs,
     return ret;
 }
 
-/* Points exactly 'on' the boundary will be considered as 'not inside' of the PCR for our purposes. */
-static bool inside_pcr(const struct line_2d *vo_lr_pairs, size_t n_rays, vec2_t test)
+static void pcr_init(struct pcr *pcr, const struct line_2d *vo_lr_pairs, size_t n_rays, float *buff)
 {
     assert(n_rays % 2 == 0);
-    for(int i = 0; i < n_rays; i+=2) {
-
-        assert(fabs(PFM_Vec2_Len(&vo_lr_pairs[i + 0].dir) - 1.0f) < EPSILON);
-        const float left_dir_x = vo_lr_pairs[i + 0].dir.x;
-        const float left_dir_z = vo_lr_pairs[i + 0].dir.z;
-
-        vec2_t point_to_test;
-        PFM_Vec2_Sub(&test, (vec2_t*)&vo_lr_pairs[i + 0].point, &point_to_test);
-        PFM_Vec2_Normal(&point_to_test, &point_to_test);
+    const size_t n_vos = n_rays / 2;
 
-        float left_det = (point_to_test.z * left_dir_x) - (point_to_test.x * left_dir_z);
-        bool left_of_vo = (left_det < EPSILON);
+    pcr->n_vos = n_vos;
+    pcr->apex_x = buff + 0 * n_vos;
+    pcr->apex_z = buff + 1 * n_vos;
+    pcr->left_x = buff + 2 * n_vos;
+    pcr->left_z = buff + 3 * n_vos;
+    pcr->right_x = buff + 4 * n_vos;
+    pcr->right_z = buff + 5 * n_vos;
 
-        if(left_of_vo)
-            continue;
-
-        assert(fabs(PFM_Vec2_Len(&vo_lr_pairs[i + 1].dir) - 1.0f) < EPSILON);
-        const float right_dir_x = vo_lr_pairs[i + 1].dir.x;
-        const float right_dir_z = vo_lr_pairs[i + 1].dir.z;
+    for(int i = 0; i < n_vos; i++) {
 
-        PFM_Vec2_Sub(&test, (vec2_t*)&vo_lr_pairs[i + 1].point, &point_to_test);
-        PFM_Vec2_Normal(&point_to_test, &point_to_test);
+        const struct line_2d *left = &vo_lr_pairs[i * 2 + 0];
+        const struct line_2d *right = &vo_lr_pairs[i * 2 + 1];
+        assert(fabs(PFM_Vec2_Len((vec2_t*)&left->dir) - 1.0f) < EPSILON);
+        assert(fabs(PFM_Vec2_Len((vec2_t*)&right->dir) - 1.0f) < EPSILON);
+        assert(same_position(left->point, right->point));
+
+        pcr->apex_x[i] = left->point.x;
+        pcr->apex_z[i] = left->point.z;
+        pcr->left_x[i] = left->dir.x;
+        pcr->left_z[i] = left->dir.z;
+        pcr->right_x[i] = right->dir.x;
+        pcr->right_z[i] = right->dir.z;
+    }
+}
 
-        float right_det = (point_to_test.z * right_dir_x) - (point_to_test.x * right_dir_z);
-        bool right_of_vo = (right_det > -EPSILON);
+/* The point is left of a side when the sine of the angle between the side and 
+ * the (apex -> point) vector is less than EPSILON. Rather than normalizing the 
+ * vector, the determinant is compared against EPSILON scaled by its' length, 
+ * squaring both sides to avoid taking the root. 
+ */
+static bool inside_vo(const struct pcr *pcr, int i, vec2_t test)
+{
+    const float eps2 = EPSILON * EPSILON;
+    float dx = test.x - pcr->apex_x[i];
+    float dz = test.z - pcr->apex_z[i];
+    float thresh = eps2 * (dx * dx + dz * dz);
+
+    float left_det = (dz * pcr->left_x[i]) - (dx * pcr->left_z[i]);
+    bool left_of_vo = (left_det < 0.0f) || (left_det * left_det < thresh);
+    if(left_of_vo)
+        return false;
 
-        if(right_of_vo)
-            continue;
+    float right_det = (dz * pcr->right_x[i]) - (dx * pcr->right_z[i]);
+    bool right_of_vo = (right_det > 0.0f) || (right_det * right_det < thresh);
+    return !right_of_vo;
+}
 
-        assert(!left_of_vo && !right_of_vo);
-        return true;
+/* Points exactly 'on' the boundary will be considered as 'not inside' of the PCR for our purposes. */
+static bool inside_pcr(const struct pcr *pcr, vec2_t test)
+{
+    int i = 0;
+    const vfloat_t zero = V_SET1(0.0f);
+    const vfloat_t eps2 = V_SET1(EPSILON * EPSILON);
+    const vfloat_t test_x = V_SET1(test.x);
+    const vfloat_t test_z = V_SET1(test.z);
+
+    for(; i + VW <= pcr->n_vos; i += VW) {
+
+        vfloat_t dx = V_SUB(test_x, V_LOAD(pcr->apex_x + i));
+        vfloat_t dz = V_SUB(test_z, V_LOAD(pcr->apex_z + i));
+        vfloat_t thresh = V_MUL(eps2, V_ADD(V_MUL(dx, dx), V_MUL(dz, dz)));
+
+        vfloat_t left_det = V_SUB(V_MUL(dz, V_LOAD(pcr->left_x + i)), 
+                                  V_MUL(dx, V_LOAD(pcr->left_z + i)));
+        vmask_t left_of_vo = VM_OR(V_LT(left_det, zero), 
+                                   V_LT(V_MUL(left_det, left_det), thresh));
+
+        vfloat_t right_det = V_SUB(V_MUL(dz, V_LOAD(pcr->right_x + i)), 
+                                   V_MUL(dx, V_LOAD(pcr->right_z + i)));
+        vmask_t right_of_vo = VM_OR(V_GT(right_det, zero), 
+                                    V_LT(V_MUL(right_det, right_det), thresh));
+
+        if(!VM_ALL(VM_OR(left_of_vo, right_of_vo)))
+            return true;
     }
 
+    for(; i < pcr->n_vos; i++) {
+        if(inside_vo(pcr, i, test))
+            return true;
+    }
     return false;
 }
 
@@ -304,7 +366,8 @@ static void rays_repr(const struct HRVO *hrvos, size_t n_hrvos,
     }
 }
 
-static size_t compute_vo_xpoints(struct line_2d *rays, size_t n_rays, vec_vec2_t *inout)
+static size_t compute_vo_xpoints(struct line_2d *rays, size_t n_rays, 
+                                 const struct pcr *pcr, vec_vec2_t *inout)
 {
     size_t ret = 0;
     for(int i = 0; i < n_rays; i++) {
@@ -317,7 +380,7 @@ static size_t compute_vo_xpoints(struct line_2d *rays, size_t n_rays, vec_vec2_t
             if(!C_RayRayIntersection2D(rays[i], rays[j], &isec_point))
                 continue;
 
-            if(inside_pcr(rays, n_rays, isec_point))
+            if(inside_pcr(pcr, isec_point))
                 continue;
 
             vec_vec2_push(inout, isec_point);
@@ -329,7 +392,8 @@ static size_t compute_vo_xpoints(struct line_2d *rays, size_t n_rays, vec_vec2_t
 }
 
 static size_t compute_vdes_proj_points(struct line_2d *rays, size_t n_rays,
-                                       vec2_t des_v, vec_vec2_t *inout)
+                                       const struct pcr *pcr, vec2_t des_v, 
+                                       vec_vec2_t *inout)
 {
     vec2_t proj;
     size_t ret = 0;
@@ -342,7 +406,7 @@ static size_t compute_vdes_proj_points(struct line_2d *rays, size_t n_rays,
         PFM_Vec2_Scale(&rays[i].dir, len, &proj);
         PFM_Vec2_Add(&rays[i].point, &proj, &proj);
 
-        if(!inside_pcr(rays, n_rays, proj)) {
+        if(!inside_pcr(pcr, proj)) {
         
             vec_vec2_push(inout, proj);
             ret++;
@@ -565,6 +629,10 @@ static bool clearpath_new_velocity(struct cp_ent cpent,
     STALLOC(struct line_2d, rays, n_rays);
     rays_repr(dyn_hrvos, n_hrvos, stat_vos, n_vos, rays);
 
+    struct pcr pcr;
+    STALLOC(float, pcr_buff, n_rays * 3);
+    pcr_init(&pcr, rays, n_rays, pcr_buff);
+
     if(save_debug) {
 
         size_t nsaved_hrvos = n_hrvos <= MAX_SAVED_VOS ? n_hrvos : MAX_SAVED_VOS;
@@ -585,7 +653,7 @@ static bool clearpath_new_velocity(struct cp_ent cpent,
 
     vec2_t des_v_ws;
     PFM_Vec2_Add(&cpent.xz_pos, &ent_des_v, &des_v_ws);
-    if(!inside_pcr(rays, n_rays, des_v_ws)) {
+    if(!inside_pcr(&pcr, des_v_ws)) {
 
         s_debug_saved.des_v_in_pcr = false;
         *out = ent_des_v;
@@ -601,14 +669,14 @@ static bool clearpath_new_velocity(struct cp_ent cpent,
      * The remaining intersection points are permissible new velocities on the 
      * boundary of the combined hybrid reciprocal velocity obstacle.
      */
-    compute_vo_xpoints(rays, n_rays, &xpoints); 
+    compute_vo_xpoints(rays, n_rays, &pcr, &xpoints); 
 
     /* In addition we project the preferred velocity (des_v) on to the line 
      * segments (xz_left_side and xz_right_side of each hrvo) and also retain 
      * those points that are outside the combined hybrid reciprocal velocity 
      * obstacle.
      */
-    compute_vdes_proj_points(rays, n_rays, ent_des_v, &xpoints);
+    compute_vdes_proj_points(rays, n_rays, &pcr, ent_des_v, &xpoints);
 
     if(vec_size(&xpoints) == 0) {
         goto out;    
@@ -631,6 +699,7 @@ out:
     STFREE(dyn_hrvos);
     STFREE(stat_vos);
     STFREE(rays);
+    STFREE(pcr_buff);
     return status;
 }
 
@@ -647,11 +716,7 @@ bool G_ClearPath_ShouldSaveDebug(uint32_t ent_uid)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    struct sval setting;
-    ss_e status = Settings_Get("pf.debug.show_first_sel_combined_hrvo", &setting);
-    assert(status == SS_OKAY);
-
-    if(!setting.as_bool)
+    if(!s_show_combined_hrvo.as_bool)
         return false;
 
     enum selection_type seltype;
@@ -665,6 +730,7 @@ bool G_ClearPath_ShouldSaveDebug(uint32_t ent_uid)
 
 void G_ClearPath_Init(const struct map *map)
 {
+    Settings_Bind("pf.debug.show_first_sel_combined_hrvo", &s_show_combined_hrvo);
     E_Global_Register(EVENT_RENDER_3D_POST, on_render_3d, (struct map*)map, 
         G_RUNNING | G_PAUSED_FULL | G_PAUSED_UI_RUNNING);
     vec_vec2_init(&s_debug_saved.xpoints);
@@ -40,12 +40,17 @@
 #include "fog_of_war.h"
 #include "position.h"
 #include "garrison.h"
+#include "automation.h"
+#include "timer_events.h"
+#include "changes.h"
 #include "public/game.h"
 #include "../ui.h"
 #include "../event.h"
 #include "../entity.h"
 #include "../main.h"
 #include "../perf.h"
+#include "../replay.h"
+#include "../net.h"
 #include "../settings.h"
 #include "../sched.h"
 #include "../task.h"
@@ -74,7 +79,8 @@
 #define ARR_SIZE(a)                 (sizeof(a)/sizeof(a[0]))
 #define X_BINS_PER_CHUNK            (8)
 #define Z_BINS_PER_CHUNK            (8)
-#define MAX_COMBAT_TASKS            (64)
+#define COMBAT_TASK_GRAIN           (32)
+#define MAX_BIN_LEVELS              (16)
 
 #define CHK_TRUE_RET(_pred)         \
     do{                             \
@@ -171,15 +177,12 @@ struct combat_work_out{
     uint32_t           ent_uid;
     struct combatstate next_state;
     bool               notify_attack_end;
+    /* There is nothing for the entity to do until something changes */
+    bool               sleep;
     enum combat_action action;
     struct attr        action_args[2];
 };
 
-struct combat_task_arg{
-    size_t begin_idx;
-    size_t end_idx;
-};
-
 /* The substet of the gamestate necessary
  * for deriving the next combat state for 
  * each entity.
@@ -188,27 +191,27 @@ struct combat_gamestate{
     uint16_t               factions;
     uint16_t               player_factions;
     bool                   fog_enabled;
-    khash_t(id)           *flags;
+    vec_erec_t            *ents;
     khash_t(pos)          *positions;
     qt_ent_t              *postree;
     void                  *transforms;
-    khash_t(range)        *sel_radiuses;
-    khash_t(id)           *faction_ids;
     enum diplomacy_state (*diptable)[MAX_FACTIONS];
     void                  *buildstate;
     khash_t(aabb)         *aabbs;
-    uint32_t              *fog_state;
+    const uint32_t        *fog_state;
+    /* The factions each faction is at war with */
+    uint16_t               hostile[MAX_FACTIONS];
 };
 
 struct combat_work{
     struct memstack         mem;
+    struct pos_snapshot     pos_snapshot;
+    vec_erec_t              records;
     struct combat_gamestate gamestate;
     struct combat_work_in  *in;
     struct combat_work_out *out;
     size_t                  nwork;
-    size_t                  ntasks;
-    uint32_t                tids[MAX_COMBAT_TASKS];
-    struct future           futures[MAX_COMBAT_TASKS];
+    struct task_group       group;
 };
 
 enum combat_cmd_type{
@@ -238,10 +241,16 @@ struct combat_cmd{
 };
 
 KHASH_MAP_INIT_INT(state, struct combatstate)
+KHASH_SET_INIT_INT(uid)
+KHASH_MAP_INIT_INT(sleep, int)
+KHASH_MAP_INIT_INT(binents, vec_entity_t)
 
 QUEUE_TYPE(cmd, struct combat_cmd)
 QUEUE_IMPL(static, cmd, struct combat_cmd)
 
+VEC_TYPE(hit, struct combat_hit)
+VEC_IMPL(static inline, hit, struct combat_hit)
+
 static void combat_push_cmd(struct combat_cmd cmd);
 static void on_attack_anim_finish(void *user, void *event);
 static void on_death_anim_finish(void *user, void *event);
@@ -273,9 +282,39 @@ static const struct map  *s_map;
 /* How many units of a faction currently currently occupy that bin.
  * For quickly finding that there are no enemy units nearby */
 static uint16_t          *s_fac_refcnts[MAX_FACTIONS];
+/* A pyramid of the factions present in every bin. The bins of a level are in 
+ * row-major order. Each bin of a level holds the union of the (up to) 4 bins
+ * underneath it in the previous level. Level 0 has the same bins as the 
+ * refcounts. */
+static uint16_t          *s_bin_presence[MAX_BIN_LEVELS];
+static int                s_bin_w[MAX_BIN_LEVELS];
+static int                s_bin_h[MAX_BIN_LEVELS];
+static int                s_bin_nlevels;
+
+/* Entities in the 'not in combat' state with nothing to do are put to sleep 
+ * and left out of the combat ticks. Those which are idle due to their stance
+ * or stats are only woken by commands. The rest are waiting for an enemy to 
+ * show up and are additionally indexed by the level 0 bin they are in, such 
+ * that they can be woken when a new faction enters a nearby bin. Both kinds 
+ * are woken when they move or when the diplomacy between factions changes.
+ */
+static khash_t(uid)      *s_awake;
+/* Maps a sleeping entity to the index of its' level 0 bin, or -1 */
+static khash_t(sleep)    *s_sleeping;
+static khash_t(binents)  *s_bin_sleepers;
+static struct change_cursor s_sleep_changes;
+static uint16_t           s_prev_hostile[MAX_FACTIONS];
 
 static struct combat_work s_combat_work;
 static queue_cmd_t        s_combat_commands;
+/* The hits landed during the current and the previous combat ticks. The 
+ * latter can be taken by scripts all at once, instead of them having to 
+ * handle an event for every hit. */
+static vec_hit_t          s_hits[2];
+static int                s_curr_hits;
+/* Cached values of the debug settings read every frame */
+static struct sval        s_show_targets;
+static struct sval        s_show_ranges;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -293,12 +332,76 @@ static struct combatstate *combatstate_get(uint32_t uid)
     return &kh_value(s_entity_state_table, k);
 }
 
+static bool entities_equal(uint32_t *a, uint32_t *b)
+{
+    return ((*a) == (*b));
+}
+
+static void combat_wake(uint32_t uid)
+{
+    khiter_t k = kh_get(sleep, s_sleeping, uid);
+    if(k == kh_end(s_sleeping))
+        return;
+
+    int bin = kh_value(s_sleeping, k);
+    kh_del(sleep, s_sleeping, k);
+    kh_put(uid, s_awake, uid, &(int){0});
+
+    if(bin < 0)
+        return;
+
+    khiter_t bk = kh_get(binents, s_bin_sleepers, bin);
+    assert(bk != kh_end(s_bin_sleepers));
+    vec_entity_t *ents = &kh_value(s_bin_sleepers, bk);
+
+    int idx = vec_entity_indexof(ents, uid, entities_equal);
+    assert(idx != -1);
+    vec_entity_del(ents, idx);
+}
+
+static void combat_sleep(uint32_t uid, int bin)
+{
+    khiter_t k = kh_get(uid, s_awake, uid);
+    if(k == kh_end(s_awake))
+        return;
+
+    kh_del(uid, s_awake, k);
+    k = kh_put(sleep, s_sleeping, uid, &(int){0});
+    kh_value(s_sleeping, k) = bin;
+
+    if(bin < 0)
+        return;
+
+    int status;
+    khiter_t bk = kh_put(binents, s_bin_sleepers, bin, &status);
+    if(status != 0) {
+        vec_entity_init(&kh_value(s_bin_sleepers, bk));
+    }
+    vec_entity_push(&kh_value(s_bin_sleepers, bk), uid);
+}
+
+static void combat_wake_all(void)
+{
+    uint32_t uid;
+    kh_foreach_key(s_sleeping, uid, {
+        kh_put(uid, s_awake, uid, &(int){0});
+    });
+    kh_clear(sleep, s_sleeping);
+
+    vec_entity_t ents;
+    kh_foreach_value(s_bin_sleepers, ents, {
+        vec_entity_destroy(&ents);
+    });
+    kh_clear(binents, s_bin_sleepers);
+}
+
 static void combatstate_set(uint32_t uid, const struct combatstate *cs)
 {
     int ret;
     khiter_t k = kh_put(state, s_entity_state_table, uid, &ret);
     assert(ret != -1 && ret != 0);
     kh_value(s_entity_state_table, k) = *cs;
+    kh_put(uid, s_awake, uid, &ret);
 }
 
 static void combatstate_remove(uint32_t uid)
@@ -306,11 +409,11 @@ static void combatstate_remove(uint32_t uid)
     khiter_t k = kh_get(state, s_entity_state_table, uid);
     assert(k != kh_end(s_entity_state_table));
     kh_del(state, s_entity_state_table, k);
-}
 
-static bool entities_equal(uint32_t *a, uint32_t *b)
-{
-    return ((*a) == (*b));
+    combat_wake(uid);
+    k = kh_get(uid, s_awake, uid);
+    assert(k != kh_end(s_awake));
+    kh_del(uid, s_awake, k);
 }
 
 static void combat_dying_remove(uint32_t uid)
@@ -334,8 +437,8 @@ static struct proj_desc combat_default_proj(void)
 static bool enemies(uint32_t a, uint32_t b)
 {
     struct combat_gamestate *gs = &s_combat_work.gamestate;
-    int faction_a = G_GetFactionIDFrom(gs->faction_ids, a);
-    int faction_b = G_GetFactionIDFrom(gs->faction_ids, b);
+    int faction_a = G_GetFactionIDFrom(gs->ents, a);
+    int faction_b = G_GetFactionIDFrom(gs->ents, b);
     if(faction_a == faction_b)
         return false;
 
@@ -346,44 +449,119 @@ static bool enemies(uint32_t a, uint32_t b)
     return (ds == DIPLOMACY_STATE_WAR);
 }
 
-static bool enemies_in_bin(int faction_id, struct map_resolution binres, struct tile_desc td)
+static bool bins_init(struct map_resolution res)
 {
-    struct combat_gamestate *gs = &s_combat_work.gamestate;
-    uint16_t facs = gs->factions;
+    int w = res.chunk_w * X_BINS_PER_CHUNK;
+    int h = res.chunk_h * Z_BINS_PER_CHUNK;
 
-    size_t x = td.chunk_c * X_BINS_PER_CHUNK + td.tile_c;
-    size_t z = td.chunk_r * Z_BINS_PER_CHUNK + td.tile_r;
-    size_t idx = x * (binres.chunk_w * binres.tile_w) + z;
+    s_bin_nlevels = 0;
+    while(s_bin_nlevels < MAX_BIN_LEVELS) {
 
-    for(int i = 0; facs; facs >>= 1, i++) {
+        int level = s_bin_nlevels;
+        s_bin_presence[level] = calloc(w * h, sizeof(uint16_t));
+        if(!s_bin_presence[level])
+            return false;
 
-        if(!(facs & 0x1))
-            continue;
-        if(i == faction_id)
-            continue;
+        s_bin_w[level] = w;
+        s_bin_h[level] = h;
+        s_bin_nlevels++;
 
-        enum diplomacy_state ds;
-        G_GetDiplomacyStateFrom(gs->diptable, faction_id, i, &ds);
-        if(ds != DIPLOMACY_STATE_WAR)
+        if(w == 1 && h == 1)
+            break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    return true;
+}
+
+static void bins_destroy(void)
+{
+    for(int i = 0; i < s_bin_nlevels; i++) {
+        PF_FREE(s_bin_presence[i]);
+    }
+    s_bin_nlevels = 0;
+}
+
+static uint16_t bins_union(int level, int x, int z)
+{
+    uint16_t ret = 0;
+    for(int dz = 0; dz < 2; dz++) {
+    for(int dx = 0; dx < 2; dx++) {
+        int cx = 2 * x + dx, cz = 2 * z + dz;
+        if(cx >= s_bin_w[level - 1] || cz >= s_bin_h[level - 1])
             continue;
+        ret |= s_bin_presence[level - 1][cz * s_bin_w[level - 1] + cx];
+    }}
+    return ret;
+}
 
-        if(s_fac_refcnts[i][idx] > 0)
-            return true;
+/* Propagate a change to the presence of a level 0 bin up the pyramid */
+static void bins_update(int x, int z)
+{
+    for(int level = 1; level < s_bin_nlevels; level++) {
+
+        x /= 2;
+        z /= 2;
+        uint16_t *bin = &s_bin_presence[level][z * s_bin_w[level] + x];
+        uint16_t val = bins_union(level, x, z);
+        if(*bin == val)
+            break;
+        *bin = val;
     }
+}
+
+/* Check if any of the factions in the mask are present in the inclusive
+ * range of level 0 bins. The range is clipped to the map bounds. 
+ */
+static bool bins_any(uint16_t mask, int x0, int z0, int x1, int z1)
+{
+    x0 = MAX(x0, 0);
+    z0 = MAX(z0, 0);
+    x1 = MIN(x1, s_bin_w[0] - 1);
+    z1 = MIN(z1, s_bin_h[0] - 1);
+    if(x0 > x1 || z0 > z1)
+        return false;
+
+    /* First check the (up to) 4 bins of the coarsest level that
+     * still has the range spanning at most 2 bins on each axis */
+    int level = 0;
+    while(level + 1 < s_bin_nlevels
+       && ((x1 >> (level + 1)) - (x0 >> (level + 1))) <= 1
+       && ((z1 >> (level + 1)) - (z0 >> (level + 1))) <= 1) {
+        level++;
+    }
+
+    if(level > 0) {
+        bool any = false;
+        for(int z = (z0 >> level); z <= (z1 >> level); z++) {
+        for(int x = (x0 >> level); x <= (x1 >> level); x++) {
+            any |= !!(s_bin_presence[level][z * s_bin_w[level] + x] & mask);
+        }}
+        if(!any)
+            return false;
+    }
+
+    for(int z = z0; z <= z1; z++) {
+    for(int x = x0; x <= x1; x++) {
+        if(s_bin_presence[0][z * s_bin_w[0] + x] & mask)
+            return true;
+    }}
     return false;
 }
 
-static bool maybe_enemy_near(uint32_t uid)
+/* The number of bins on each side of an entity's bin that can hold 
+ * entities within its' target acquisition range */
+static int bins_acquisition_range(void)
 {
-    PERF_ENTER();
-    struct combat_gamestate *gs = &s_combat_work.gamestate;
-    vec2_t pos = G_Pos_GetXZFrom(gs->positions, uid);
     int binlen = MAX(
         (float)(X_COORDS_PER_TILE * TILES_PER_CHUNK_WIDTH)  / X_BINS_PER_CHUNK,
         (float)(Z_COORDS_PER_TILE * TILES_PER_CHUNK_HEIGHT) / Z_BINS_PER_CHUNK
     );
-    int binrange = ceil(TARGET_ACQUISITION_RANGE / binlen);
+    return ceil(TARGET_ACQUISITION_RANGE / binlen);
+}
 
+static bool bins_coords(vec2_t pos, int *out_x, int *out_z)
+{
     struct map_resolution mapres;
     M_GetResolution(s_map, &mapres);
 
@@ -394,23 +572,61 @@ static bool maybe_enemy_near(uint32_t uid)
     };
 
     struct tile_desc td;
-    bool found = M_Tile_DescForPoint2D(binres, M_GetPos(s_map), pos, &td);
-    assert(found);
+    if(!M_Tile_DescForPoint2D(binres, M_GetPos(s_map), pos, &td))
+        return false;
 
-    size_t binx = td.chunk_c * X_COORDS_PER_TILE + td.tile_c;
-    size_t binz = td.chunk_r * Z_COORDS_PER_TILE + td.tile_r;
+    *out_x = td.chunk_c * X_BINS_PER_CHUNK + td.tile_c;
+    *out_z = td.chunk_r * Z_BINS_PER_CHUNK + td.tile_r;
+    return true;
+}
+
+/* A new faction has entered the level 0 bin - wake up everyone who 
+ * could now have an enemy in range. */
+static void bins_wake_near(int x, int z)
+{
+    if(kh_size(s_bin_sleepers) == 0)
+        return;
 
-    for(int dr = -binrange; dr <= binrange; dr++) {
-    for(int dc = -binrange; dc <= binrange; dc++) {
+    int binrange = bins_acquisition_range();
+    int x0 = MAX(x - binrange, 0);
+    int z0 = MAX(z - binrange, 0);
+    int x1 = MIN(x + binrange, s_bin_w[0] - 1);
+    int z1 = MIN(z + binrange, s_bin_h[0] - 1);
 
-        struct tile_desc bin = td;
-        if(!M_Tile_RelativeDesc(binres, &bin, dc, dr))
+    for(int bz = z0; bz <= z1; bz++) {
+    for(int bx = x0; bx <= x1; bx++) {
+
+        khiter_t k = kh_get(binents, s_bin_sleepers, bz * s_bin_w[0] + bx);
+        if(k == kh_end(s_bin_sleepers))
             continue;
-        int faction_id = G_GetFactionIDFrom(gs->faction_ids, uid);
-        if(enemies_in_bin(faction_id, binres, bin))
-            PERF_RETURN(true);
+
+        vec_entity_t *ents = &kh_value(s_bin_sleepers, k);
+        while(vec_size(ents) > 0) {
+            combat_wake(vec_AT(ents, vec_size(ents) - 1));
+        }
     }}
-    PERF_RETURN(false);
+}
+
+static bool maybe_enemy_near(uint32_t uid)
+{
+    PERF_ENTER();
+    struct combat_gamestate *gs = &s_combat_work.gamestate;
+    vec2_t pos = G_Pos_GetXZFrom(gs->positions, uid);
+    int binrange = bins_acquisition_range();
+
+    int faction_id = G_GetFactionIDFrom(gs->ents, uid);
+    uint16_t hostile = gs->hostile[faction_id];
+    if(!hostile)
+        PERF_RETURN(false);
+
+    int binx, binz;
+    bool found = bins_coords(pos, &binx, &binz);
+    assert(found);
+    (void)found;
+
+    bool ret = bins_any(hostile, binx - binrange, binz - binrange, 
+        binx + binrange, binz + binrange);
+    PERF_RETURN(ret);
 }
 
 static void entity_move_in_range(uint32_t uid, uint32_t target)
@@ -455,15 +671,15 @@ static void current_obb_from_gamestate(uint32_t uid, struct obb *out)
 static bool entities_adjacent(uint32_t ent, uint32_t target)
 {
     struct combat_gamestate *gs = &s_combat_work.gamestate;
-    uint32_t flags = G_FlagsGetFrom(gs->flags, target);
+    uint32_t flags = G_FlagsGetFrom(gs->ents, target);
 
     if(flags & ENTITY_FLAG_MOVABLE) {
 
         vec2_t ent_pos = G_Pos_GetXZFrom(gs->positions, ent);
         vec2_t target_pos = G_Pos_GetXZFrom(gs->positions, target);
 
-        float ent_radius = G_GetSelectionRadiusFrom(gs->sel_radiuses, ent);
-        float target_radius = G_GetSelectionRadiusFrom(gs->sel_radiuses, target);
+        float ent_radius = G_GetSelectionRadiusFrom(gs->ents, ent);
+        float target_radius = G_GetSelectionRadiusFrom(gs->ents, target);
 
         return M_NavObjAdjacentToDynamicWith(s_map, ent_pos, ent_radius, 
             target_pos, target_radius);
@@ -473,7 +689,7 @@ static bool entities_adjacent(uint32_t ent, uint32_t target)
         current_obb_from_gamestate(target, &obb);
 
         vec2_t ent_pos = G_Pos_GetXZFrom(gs->positions, ent);
-        float ent_radius = G_GetSelectionRadiusFrom(gs->sel_radiuses, ent);
+        float ent_radius = G_GetSelectionRadiusFrom(gs->ents, ent);
 
         return M_NavObjAdjacentToStaticWith(s_map, ent_pos, ent_radius, &obb);
     }
@@ -504,8 +720,8 @@ static bool valid_enemy(uint32_t curr, void *arg)
 {
     struct combat_gamestate *gs = &s_combat_work.gamestate;
     uint32_t ent = (uintptr_t)arg;
-    uint32_t ent_flags = G_FlagsGetFrom(gs->flags, ent);
-    uint32_t curr_flags = G_FlagsGetFrom(gs->flags, curr);
+    uint32_t ent_flags = G_FlagsGetFrom(gs->ents, ent);
+    uint32_t curr_flags = G_FlagsGetFrom(gs->ents, curr);
 
     struct combatstate *ent_cs = combatstate_get(ent);
     assert(ent_cs);
@@ -569,6 +785,15 @@ static quat_t entity_turn_dir(uint32_t uid, uint32_t target)
     return quat_from_vec(ent_to_target);
 }
 
+static void combatstate_set_state(uint32_t uid, struct combatstate *cs, int state)
+{
+    bool was_idle = (cs->state == STATE_NOT_IN_COMBAT);
+    cs->state = state;
+    if(was_idle != (state == STATE_NOT_IN_COMBAT)) {
+        G_Automation_NotifyStateChanged(uid);
+    }
+}
+
 static void entity_turn_to_target(uint32_t uid, uint32_t target)
 {
     struct combat_gamestate *gs = &s_combat_work.gamestate;
@@ -581,13 +806,13 @@ static void entity_turn_to_target(uint32_t uid, uint32_t target)
     }
     G_Move_Stop(uid);
 
-    uint32_t flags = G_FlagsGetFrom(gs->flags, uid);
+    uint32_t flags = G_FlagsGetFrom(gs->ents, uid);
     if(!(flags & ENTITY_FLAG_MOVABLE)) {
-        cs->state = STATE_CAN_ATTACK;
+        combatstate_set_state(uid, cs, STATE_CAN_ATTACK);
     }else{
         quat_t rot = entity_turn_dir(uid, target);
         G_Move_SetChangeDirection(uid, rot);
-        cs->state = STATE_TURNING_TO_TARGET;
+        combatstate_set_state(uid, cs, STATE_TURNING_TO_TARGET);
     }
 }
 
@@ -639,16 +864,13 @@ static void entity_die(uint32_t uid)
     && !(flags & ENTITY_FLAG_AIR)) {
 
         struct combatstate *cs = combatstate_get(uid);
-        cs->state = STATE_DEATH_ANIM_PLAYING;
+        combatstate_set_state(uid, cs, STATE_DEATH_ANIM_PLAYING);
         E_Entity_Register(EVENT_ANIM_CYCLE_FINISHED, uid, on_death_anim_finish, 
             (void*)((uintptr_t)uid), G_RUNNING);
 
     }else{
 
-        khash_t(id) *flags = s_combat_work.gamestate.flags;
-        khiter_t k = kh_get(id, flags, uid);
-        assert(k != kh_end(flags));
-        kh_value(flags, k) = kh_value(flags, k) | ENTITY_FLAG_ZOMBIE;
+        G_RecordFrom(s_combat_work.gamestate.ents, uid)->flags |= ENTITY_FLAG_ZOMBIE;
 
         G_Zombiefy(uid, false);
         Entity_DisappearAnimated(uid, s_map, on_disappear_finish, (void*)((uintptr_t)uid));
@@ -665,7 +887,10 @@ static void entity_melee_attack(uint32_t uid, uint32_t target)
     float dmg = cs->stats.base_dmg  * (1.0f - target_cs->stats.base_armour_pc);
     target_cs->current_hp = MAX(0, target_cs->current_hp - dmg);
 
-    if(target_cs->current_hp == 0 && target_cs->stats.max_hp > 0) {
+    bool killed = (target_cs->current_hp == 0 && target_cs->stats.max_hp > 0);
+    vec_hit_push(&s_hits[s_curr_hits], (struct combat_hit){uid, target, dmg, killed});
+
+    if(killed) {
         entity_die(target);
     }
 }
@@ -689,14 +914,14 @@ static void entity_ranged_attack(uint32_t uid, uint32_t target)
         return;
     }
 
-    P_Projectile_Add(ent_pos, vel, uid, G_GetFactionIDFrom(gs->faction_ids, uid), 
+    P_Projectile_Add(ent_pos, vel, uid, G_GetFactionIDFrom(gs->ents, uid), 
         ent_dmg, PROJ_ONLY_HIT_COMBATABLE | PROJ_ONLY_HIT_ENEMIES, cs->pd);
 }
 
 static bool garrisoned(uint32_t uid)
 {
     struct combat_gamestate *gs = &s_combat_work.gamestate;
-    uint32_t flags = G_FlagsGetFrom(gs->flags, uid);
+    uint32_t flags = G_FlagsGetFrom(gs->ents, uid);
     return (flags & ENTITY_FLAG_GARRISONED);
 }
 
@@ -704,10 +929,7 @@ static void on_death_anim_finish(void *user, void *event)
 {
     uint32_t self = (uintptr_t)user;
 
-    khash_t(id) *flags = s_combat_work.gamestate.flags;
-    khiter_t k = kh_get(id, flags, self);
-    assert(k != kh_end(flags));
-    kh_value(flags, k) = kh_value(flags, k) | ENTITY_FLAG_ZOMBIE;
+    G_RecordFrom(s_combat_work.gamestate.ents, self)->flags |= ENTITY_FLAG_ZOMBIE;
 
     E_Entity_Unregister(EVENT_ANIM_CYCLE_FINISHED, self, on_death_anim_finish);
     G_Zombiefy(self, true);
@@ -768,7 +990,7 @@ static void do_tryhit(uint32_t uid)
     || cs->state == STATE_NOT_IN_COMBAT)
         return;
 
-    cs->state = STATE_CAN_ATTACK;
+    combatstate_set_state(uid, cs, STATE_CAN_ATTACK);
     if(entity_dead(cs->target_uid) || garrisoned(cs->target_uid)) {
         return; /* Our target already got 'killed' */
     }
@@ -807,7 +1029,11 @@ static void do_proj_tryhit(struct proj_hit *hit)
     float dmg = hit->cookie * (1.0f - cs->stats.base_armour_pc);
     cs->current_hp = MAX(0, cs->current_hp - dmg);
 
-    if(cs->current_hp == 0 && cs->stats.max_hp > 0) {
+    bool killed = (cs->current_hp == 0 && cs->stats.max_hp > 0);
+    vec_hit_push(&s_hits[s_curr_hits], 
+        (struct combat_hit){hit->parent_uid, hit->ent_uid, dmg, killed});
+
+    if(killed) {
         entity_die(hit->ent_uid);
     }
 }
@@ -830,7 +1056,7 @@ static void do_set_stance(uint32_t uid, enum combat_stance stance)
     && (cs->state == STATE_MOVING_TO_TARGET || cs->state == STATE_MOVING_TO_TARGET_LOCKED)) {
 
         G_Move_Stop(uid);
-        cs->state = STATE_NOT_IN_COMBAT;
+        combatstate_set_state(uid, cs, STATE_NOT_IN_COMBAT);
         cs->move_cmd_interrupted = false;
     }
 
@@ -858,12 +1084,12 @@ static void do_attack_unit(uint32_t uid, uint32_t target)
     do_stop_attack(uid);
     cs->stance = COMBAT_STANCE_AGGRESSIVE;
 
-    uint32_t flags = G_FlagsGetFrom(gs->flags, uid);
+    uint32_t flags = G_FlagsGetFrom(gs->ents, uid);
     if(flags & ENTITY_FLAG_MOVABLE) {
     
         cs->sticky = true;
         cs->target_uid = target;
-        cs->state = STATE_MOVING_TO_TARGET_LOCKED;
+        combatstate_set_state(uid, cs, STATE_MOVING_TO_TARGET_LOCKED);
         cs->move_cmd_interrupted = false;
 
         entity_move_in_range(uid, target);
@@ -872,7 +1098,7 @@ static void do_attack_unit(uint32_t uid, uint32_t target)
     
         cs->sticky = true;
         cs->target_uid = target;
-        cs->state = STATE_CAN_ATTACK;
+        combatstate_set_state(uid, cs, STATE_CAN_ATTACK);
     }
 }
 
@@ -892,8 +1118,7 @@ static void do_stop_attack(uint32_t uid)
         E_Entity_Notify(EVENT_ATTACK_END, uid, NULL, ES_ENGINE);
     }
 
-    cs->state = STATE_NOT_IN_COMBAT;
-
+    combatstate_set_state(uid, cs, STATE_NOT_IN_COMBAT);
     struct combat_cmd *cmd = snoop_most_recent_command(COMBAT_CMD_CLEAR_SAVED_MOVE_CMD,
         (void*)(uintptr_t)uid, uids_match);
 
@@ -940,7 +1165,11 @@ static void do_add_ref(int faction_id, vec2_t pos)
     size_t idx = x * (binres.chunk_w * binres.tile_w) + z;
 
     assert(s_fac_refcnts[faction_id][idx] < UINT16_MAX);
-    s_fac_refcnts[faction_id][idx]++;
+    if(s_fac_refcnts[faction_id][idx]++ == 0) {
+        s_bin_presence[0][z * s_bin_w[0] + x] |= (0x1 << faction_id);
+        bins_update(x, z);
+        bins_wake_near(x, z);
+    }
 }
 
 static void do_remove_ref(int faction_id, vec2_t pos)
@@ -965,7 +1194,10 @@ static void do_remove_ref(int faction_id, vec2_t pos)
     size_t idx = x * (binres.chunk_w * binres.tile_w) + z;
 
     assert(s_fac_refcnts[faction_id][idx] > 0);
-    s_fac_refcnts[faction_id][idx]--;
+    if(--s_fac_refcnts[faction_id][idx] == 0) {
+        s_bin_presence[0][z * s_bin_w[0] + x] &= ~(0x1 << faction_id);
+        bins_update(x, z);
+    }
 }
 
 static void do_update_ref(int oldfac, int newfac, vec2_t pos)
@@ -1056,7 +1288,7 @@ static bool entity_dead(uint32_t uid)
 {
     struct combatstate *cs = combatstate_get(uid);
     if(!cs || (cs->state == STATE_DEATH_ANIM_PLAYING)
-    || (G_FlagsGetFrom(s_combat_work.gamestate.flags, uid) & ENTITY_FLAG_ZOMBIE))
+    || (G_FlagsGetFrom(s_combat_work.gamestate.ents, uid) & ENTITY_FLAG_ZOMBIE))
         return true;
 
     return false;
@@ -1078,12 +1310,11 @@ static void entity_target_enemy(uint32_t uid, uint32_t enemy)
         return;
     }
 
-    uint32_t flags = G_FlagsGetFrom(gs->flags, uid);
+    uint32_t flags = G_FlagsGetFrom(gs->ents, uid);
     if(cs->stance == COMBAT_STANCE_AGGRESSIVE && (flags & ENTITY_FLAG_MOVABLE)) {
 
         cs->target_uid = enemy;
-        cs->state = STATE_MOVING_TO_TARGET;
-
+        combatstate_set_state(uid, cs, STATE_MOVING_TO_TARGET);
         if(!cs->move_cmd_interrupted 
         && G_Move_GetDest(uid, &cs->move_cmd_xz, &cs->move_cmd_attacking)) {
             cs->move_cmd_interrupted = true; 
@@ -1096,8 +1327,7 @@ static void entity_stop_combat(uint32_t uid)
 {
     struct combatstate *cs = combatstate_get(uid);
     assert(cs);
-    cs->state = STATE_NOT_IN_COMBAT; 
-
+    combatstate_set_state(uid, cs, STATE_NOT_IN_COMBAT);
     uint32_t flags = G_FlagsGet(uid);
     if(!(flags & ENTITY_FLAG_MOVABLE))
         return;
@@ -1119,11 +1349,11 @@ uint32_t closest_eligible_entity(uint32_t uid)
     struct combatstate *cs = combatstate_get(uid);
     vec2_t pos = G_Pos_GetXZFrom(gs->positions, uid);
     float range = MAX(TARGET_ACQUISITION_RANGE, cs->stats.attack_range);
-    int faction_id = G_GetFactionIDFrom(gs->faction_ids, uid);
+    int faction_id = G_GetFactionIDFrom(gs->ents, uid);
 
     uint32_t ents[128];
     size_t nents = G_Pos_EntsInCircleWithPredFrom(
-        gs->postree, gs->flags, pos, range, ents, 
+        gs->postree, gs->ents, pos, range, ents, 
         ARR_SIZE(ents), valid_enemy, (void*)((uintptr_t)uid));
 
     if(!nents)
@@ -1157,10 +1387,27 @@ uint32_t closest_eligible_entity(uint32_t uid)
     return ret;
 }
 
+/* Entities for which 'entity_compute_update' would leave the state as-is and 
+ * not take any action. These are left out of the work entirely, sparing both 
+ * the parallel and the serial passes.
+ */
+static bool combat_state_idle(const struct combatstate *cs)
+{
+    switch(cs->state) {
+    case STATE_NOT_IN_COMBAT:
+        return (cs->stance == COMBAT_STANCE_NO_ENGAGEMENT) || (cs->stats.base_dmg == 0);
+    case STATE_ATTACK_ANIM_PLAYING:
+    case STATE_DEATH_ANIM_PLAYING:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static void entity_compute_update(uint32_t uid, struct combat_work_out *out)
 {
     struct combat_gamestate *gs = &s_combat_work.gamestate;
-    uint32_t flags = G_FlagsGetFrom(gs->flags, uid);
+    uint32_t flags = G_FlagsGetFrom(gs->ents, uid);
 
     const struct combatstate *old = combatstate_get(uid);
     struct combatstate *curr = &out->next_state;
@@ -1168,6 +1415,7 @@ static void entity_compute_update(uint32_t uid, struct combat_work_out *out)
 
     out->action = COMBAT_ACTION_NONE;
     out->notify_attack_end = false;
+    out->sleep = false;
     out->ent_uid = uid;
 
     switch(curr->state) {
@@ -1183,8 +1431,10 @@ static void entity_compute_update(uint32_t uid, struct combat_work_out *out)
         if(curr->stats.base_dmg == 0)
             break;
 
-        if(!maybe_enemy_near(uid))
+        if(!maybe_enemy_near(uid)) {
+            out->sleep = true;
             break;
+        }
 
         uint32_t enemy = closest_eligible_entity(uid);
         if(enemy == NULL_UID)
@@ -1427,12 +1677,24 @@ static void entity_apply_update(struct combat_work_out *out)
     uint32_t uid = out->ent_uid;
     struct combatstate *cs = combatstate_get(uid);
     assert(cs);
+    int prev_state = cs->state;
     *cs = out->next_state;
 
+    if((prev_state == STATE_NOT_IN_COMBAT) != (cs->state == STATE_NOT_IN_COMBAT)) {
+        G_Automation_NotifyStateChanged(uid);
+    }
+
     if(out->notify_attack_end) {
         E_Entity_Notify(EVENT_ATTACK_END, uid, NULL, ES_ENGINE);
     }
 
+    if(out->sleep && cs->state == STATE_NOT_IN_COMBAT) {
+        int x, z;
+        if(bins_coords(G_Pos_GetXZ(uid), &x, &z)) {
+            combat_sleep(uid, z * s_bin_w[0] + x);
+        }
+    }
+
     switch(out->action) {
     case COMBAT_ACTION_NONE:
         break;
@@ -1483,7 +1745,7 @@ static void entity_apply_update(struct combat_work_out *out)
         uint32_t uid = out->action_args[0].val.as_int;
         assert(old_uid == uid);
         if(G_Move_Still(uid)) {
-            cs->state = STATE_CAN_ATTACK;
+            combatstate_set_state(uid, cs, STATE_CAN_ATTACK);
             E_Entity_Notify(EVENT_ATTACK_START, uid, NULL, ES_ENGINE);
         }
         break;
@@ -1551,28 +1813,33 @@ static void combat_process_cmds(void)
         }
         case COMBAT_CMD_TRYHIT: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             do_tryhit(uid);
             break;
         }
         case COMBAT_CMD_SET_STANCE: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             enum combat_stance stance = cmd.args[1].val.as_int;
             do_set_stance(uid, stance);
             break;
         }
         case COMBAT_CMD_CLEAR_SAVED_MOVE_CMD: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             do_clear_saved_move_cmd(uid);
             break;
         }
         case COMBAT_CMD_ATTACK_UNIT: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             uint32_t target = cmd.args[1].val.as_int;
             do_attack_unit(uid, target);
             break;
         }
         case COMBAT_CMD_STOP_ATTACK: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             do_stop_attack(uid);
             break;
         }
@@ -1602,36 +1869,42 @@ static void combat_process_cmds(void)
         }
         case COMBAT_CMD_SET_BASE_ARMOUR: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             float armour_pc = cmd.args[1].val.as_float;
             do_set_base_armour(uid, armour_pc);
             break;
         }
         case COMBAT_CMD_SET_BASE_DAMAGE: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             int dmg = cmd.args[1].val.as_int;
             do_set_base_damage(uid, dmg);
             break;
         }
         case COMBAT_CMD_SET_CURRENT_HP: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             int hp = cmd.args[1].val.as_int;
             do_set_current_hp(uid, hp);
             break;
         }
         case COMBAT_CMD_SET_MAX_HP: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             int hp = cmd.args[1].val.as_int;
             do_set_max_hp(uid, hp);
             break;
         }
         case COMBAT_CMD_SET_RANGE: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             float range  = cmd.args[1].val.as_float;
             do_set_range(uid, range);
             break;
         }
         case COMBAT_CMD_SET_PROJ_DESC: {
             uint32_t uid = cmd.args[0].val.as_int;
+            combat_wake(uid);
             struct proj_desc *pd = cmd.args[1].val.as_pointer;
             do_set_proj_desc(uid, pd);
             PF_FREE(pd->basedir);
@@ -1641,6 +1914,7 @@ static void combat_process_cmds(void)
         }
         case COMBAT_CMD_PROJ_HIT: {
             struct proj_hit *hit = cmd.args[0].val.as_pointer;
+            combat_wake(hit->ent_uid);
             do_proj_tryhit(hit);
             PF_FREE(hit);
             break;
@@ -1651,39 +1925,24 @@ static void combat_process_cmds(void)
     }
 }
 
-static void combat_work(int begin_idx, int end_idx)
+static void combat_task(size_t begin, size_t end, void *arg)
 {
-    for(int i = begin_idx; i <= end_idx; i++) {
+    size_t ncomputed = 0;
+
+    for(size_t i = begin; i < end; i++) {
     
         struct combat_work_in *in = &s_combat_work.in[i];
         struct combat_work_out *out = &s_combat_work.out[i];
         entity_compute_update(in->ent_uid, out);
-    }
-}
-
-static struct result combat_task(void *arg)
-{
-    struct combat_task_arg *combat_arg = arg;
-    size_t ncomputed = 0;
-
-    for(int i = combat_arg->begin_idx; i <= combat_arg->end_idx; i++) {
-
-        combat_work(i, i);
-        ncomputed++;
 
-        if(ncomputed % 64 == 0)
-            Task_Yield();
+        if(++ncomputed % 64 == 0)
+            Sched_TryYield();
     }
-    return NULL_RESULT;
 }
 
 static void combat_complete_work(void)
 {
-    for(int i = 0; i < s_combat_work.ntasks; i++) {
-        while(!Sched_FutureIsReady(&s_combat_work.futures[i])) {
-            Sched_RunSync(s_combat_work.tids[i]);
-        }
-    }
+    Sched_TaskGroupJoin(&s_combat_work.group);
 }
 
 static khash_t(aabb) *combat_copy_aabbs(void)
@@ -1711,46 +1970,50 @@ static void combat_copy_gamestate(void)
     s_combat_work.gamestate.factions = G_GetFactions(NULL, NULL, NULL);
     s_combat_work.gamestate.player_factions = G_GetPlayerControlledFactions();
     s_combat_work.gamestate.fog_enabled = G_Fog_Enabled();
-    s_combat_work.gamestate.flags = G_FlagsCopyTable();
-    s_combat_work.gamestate.positions = G_Pos_CopyTable();
-    s_combat_work.gamestate.postree = G_Pos_CopyQuadTree();
+    if(G_RecordsCopy(&s_combat_work.records)) {
+        s_combat_work.gamestate.ents = &s_combat_work.records;
+    }
+    G_Pos_SnapshotSync(&s_combat_work.pos_snapshot);
+    s_combat_work.gamestate.positions = s_combat_work.pos_snapshot.table;
+    s_combat_work.gamestate.postree = &s_combat_work.pos_snapshot.tree;
     s_combat_work.gamestate.transforms = Entity_CopyTransforms();
-    s_combat_work.gamestate.sel_radiuses = G_SelectionRadiusCopyTable();
-    s_combat_work.gamestate.faction_ids = G_FactionIDCopyTable();
     s_combat_work.gamestate.diptable = G_CopyDiplomacyTable();
     s_combat_work.gamestate.buildstate = G_Building_CopyState();
     s_combat_work.gamestate.aabbs = combat_copy_aabbs();
-    s_combat_work.gamestate.fog_state = G_Fog_CopyState();
+    s_combat_work.gamestate.fog_state = G_Fog_AcquireState();
+
+    uint16_t facs = s_combat_work.gamestate.factions;
+    memcpy(s_prev_hostile, s_combat_work.gamestate.hostile, sizeof(s_prev_hostile));
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+        s_combat_work.gamestate.hostile[i] = 0;
+        if(!(facs & (0x1 << i)))
+            continue;
+        for(int j = 0; j < MAX_FACTIONS; j++) {
+            if(i == j || !(facs & (0x1 << j)))
+                continue;
+            enum diplomacy_state ds;
+            G_GetDiplomacyStateFrom(s_combat_work.gamestate.diptable, i, j, &ds);
+            if(ds == DIPLOMACY_STATE_WAR)
+                s_combat_work.gamestate.hostile[i] |= (0x1 << j);
+        }
+    }
+    if(memcmp(s_prev_hostile, s_combat_work.gamestate.hostile, sizeof(s_prev_hostile))) {
+        combat_wake_all();
+    }
     PERF_RETURN_VOID();
 }
 
 static void combat_release_gamestate(void)
 {
     PERF_ENTER();
-    if(s_combat_work.gamestate.flags) {
-        kh_destroy(id, s_combat_work.gamestate.flags);
-        s_combat_work.gamestate.flags = NULL;
-    }
-    if(s_combat_work.gamestate.positions) {
-        kh_destroy(pos, s_combat_work.gamestate.positions);
-        s_combat_work.gamestate.positions = NULL;
-    }
-    if(s_combat_work.gamestate.postree) {
-        G_Pos_DestroyQuadTree(s_combat_work.gamestate.postree);
-        s_combat_work.gamestate.postree = NULL;
-    }
+    /* The records and positions are owned by the persistent copies */
+    s_combat_work.gamestate.ents = NULL;
+    s_combat_work.gamestate.positions = NULL;
+    s_combat_work.gamestate.postree = NULL;
     if(s_combat_work.gamestate.transforms) {
         kh_destroy(trans, s_combat_work.gamestate.transforms);
         s_combat_work.gamestate.transforms = NULL;
     }
-    if(s_combat_work.gamestate.sel_radiuses) {
-        kh_destroy(range, s_combat_work.gamestate.sel_radiuses);
-        s_combat_work.gamestate.sel_radiuses = NULL;
-    }
-    if(s_combat_work.gamestate.faction_ids) {
-        kh_destroy(id, s_combat_work.gamestate.faction_ids);
-        s_combat_work.gamestate.faction_ids = NULL;
-    }
     if(s_combat_work.gamestate.diptable) {
         PF_FREE(s_combat_work.gamestate.diptable);
         s_combat_work.gamestate.diptable = NULL;
@@ -1764,7 +2027,7 @@ static void combat_release_gamestate(void)
         s_combat_work.gamestate.aabbs = NULL;
     }
     if(s_combat_work.gamestate.fog_state) {
-        PF_FREE(s_combat_work.gamestate.fog_state);
+        G_Fog_ReleaseState(s_combat_work.gamestate.fog_state);
         s_combat_work.gamestate.fog_state = NULL;
     }
     PERF_RETURN_VOID();
@@ -1803,7 +2066,6 @@ static void combat_finish_work(void)
     s_combat_work.in = NULL;
     s_combat_work.out = NULL;
     s_combat_work.nwork = 0;
-    s_combat_work.ntasks = 0;
 
     PERF_RETURN_VOID();
 }
@@ -1818,48 +2080,75 @@ static void combat_submit_work(void)
     if(s_combat_work.nwork == 0)
         return;
 
-    size_t ntasks = SDL_GetCPUCount();
-    if(s_combat_work.nwork < 64)
-        ntasks = 1;
-    ntasks = MIN(ntasks, MAX_COMBAT_TASKS);
-
-    for(int i = 0; i < ntasks; i++) {
-
-        struct combat_task_arg *arg = stalloc(&s_combat_work.mem, sizeof(struct combat_task_arg));
-        size_t nitems = ceil((float)s_combat_work.nwork / ntasks);
-
-        arg->begin_idx = nitems * i;
-        arg->end_idx = MIN(nitems * (i + 1) - 1, s_combat_work.nwork-1);
-
-        SDL_AtomicSet(&s_combat_work.futures[s_combat_work.ntasks].status, FUTURE_INCOMPLETE);
-        s_combat_work.tids[s_combat_work.ntasks] = Sched_Create(4, combat_task, arg, 
-            &s_combat_work.futures[s_combat_work.ntasks], TASK_BIG_STACK);
+    /* The chunks are claimed dynamically, so the faster cores take 
+     * on a bigger share of the entities */
+    Sched_TaskGroupInit(&s_combat_work.group);
+    Sched_ParallelForAsync(&s_combat_work.group, 0, s_combat_work.nwork, COMBAT_TASK_GRAIN, 
+        combat_task, NULL, 4, TASK_BIG_STACK);
+}
 
-        if(s_combat_work.tids[s_combat_work.ntasks] == NULL_TID) {
-            combat_work(arg->begin_idx, arg->end_idx);
-        }else{
-            s_combat_work.ntasks++;
+/* Process the entities of the given shard, or all of them if the shard is -1 */
+static void combat_wake_changed(void)
+{
+    struct change changes[256];
+    int nchanges;
+    while((nchanges = G_Changes_Read(&s_sleep_changes, ARR_SIZE(changes), changes))) {
+        if(nchanges < 0) {
+            combat_wake_all();
+            continue;
+        }
+        for(int i = 0; i < nchanges; i++) {
+            combat_wake(changes[i].uid);
         }
     }
 }
 
-static void on_20hz_tick(void *user, void *event)
+static void combat_tick(int shard)
 {
-    PERF_PUSH("combat::on_20hz_tick");
-
     combat_finish_work();
+    combat_wake_changed();
     combat_process_cmds();
     combat_release_gamestate();
 
+    /* The hits are always buffered for an entire 20Hz period */
+    if(shard <= 0) {
+        s_curr_hits = !s_curr_hits;
+        vec_hit_reset(&s_hits[s_curr_hits]);
+    }
+
     combat_prepare_work();
     combat_copy_gamestate();
 
     uint32_t uid;
-    kh_foreach_key(s_entity_state_table, uid, {
+    kh_foreach_key(s_awake, uid, {
+        if(shard >= 0 && G_TICK_SHARD(uid) != shard)
+            continue;
+        const struct combatstate *cs = combatstate_get(uid);
+        if(combat_state_idle(cs)) {
+            if(cs->state == STATE_NOT_IN_COMBAT) {
+                combat_sleep(uid, -1);
+            }
+            continue;
+        }
         combat_push_work((struct combat_work_in){uid});
     });
     combat_submit_work();
+}
 
+static void on_20hz_tick(void *user, void *event)
+{
+    if(G_Timer_Sharded())
+        return;
+
+    PERF_PUSH("combat::on_20hz_tick");
+    combat_tick(-1);
+    PERF_POP();
+}
+
+static void on_20hz_subtick(void *user, void *event)
+{
+    PERF_PUSH("combat::on_20hz_subtick");
+    combat_tick((uintptr_t)event);
     PERF_POP();
 }
 
@@ -1888,7 +2177,6 @@ static void on_mousedown(void *user, void *event)
 
     enum selection_type sel_type;
     const vec_entity_t *sel = G_Sel_Get(&sel_type);
-    size_t nattacking = 0;
 
     if(vec_size(sel) == 0 || sel_type != SELECTION_TYPE_PLAYER)
         return;
@@ -1900,21 +2188,12 @@ static void on_mousedown(void *user, void *event)
     || !(G_FlagsGet(target) & ENTITY_FLAG_COMBATABLE) || !enemies(first, target))
         return;
 
-    for(int i = 0; i < vec_size(sel); i++) {
-
-        uint32_t curr = vec_AT(sel, i);
-        uint32_t flags = G_FlagsGet(curr);
-
-        if(!(flags & ENTITY_FLAG_COMBATABLE))
-            continue;
-
-        G_Combat_AttackUnit(curr, target);
-        nattacking++;
-    }
-
-    if(nattacking) {
-        Entity_Ping(target);
-    }
+    Net_IssueCommand(&(struct replay_cmd){
+        .type = REPLAY_CMD_ATTACK,
+        .nents = vec_size(sel),
+        .ents = sel->array,
+        .target = target
+    });
 }
 
 static void combat_render_targets(void)
@@ -2037,21 +2316,10 @@ static void combat_render_ranges(void)
 
 static void on_render_3d(void *user, void *event)
 {
-    struct sval setting;
-    ss_e status;
-    (void)status;
-
-    status = Settings_Get("pf.debug.show_combat_targets", &setting);
-    assert(status == SS_OKAY);
-
-    if(setting.as_bool) {
+    if(s_show_targets.as_bool) {
         combat_render_targets();
     }
-
-    status = Settings_Get("pf.debug.show_combat_ranges", &setting);
-    assert(status == SS_OKAY);
-
-    if(setting.as_bool) {
+    if(s_show_ranges.as_bool) {
         combat_render_ranges();
     }
 }
@@ -2079,8 +2347,21 @@ static void on_proj_hit(void *user, void *event)
 
 bool G_Combat_Init(const struct map *map)
 {
+    Settings_Bind("pf.debug.show_combat_targets", &s_show_targets);
+    Settings_Bind("pf.debug.show_combat_ranges", &s_show_ranges);
+
     if(NULL == (s_entity_state_table = kh_init(state)))
         return false;
+    if(NULL == (s_awake = kh_init(uid)))
+        goto fail_awake;
+    if(NULL == (s_sleeping = kh_init(sleep)))
+        goto fail_sleeping;
+    if(NULL == (s_bin_sleepers = kh_init(binents)))
+        goto fail_bin_sleepers;
+    if(!G_Changes_Subscribe(&s_sleep_changes, 
+        CHANGE_POS | CHANGE_FACTION | CHANGE_FLAGS | CHANGE_REMOVED))
+        goto fail_changes;
+    memset(s_prev_hostile, 0, sizeof(s_prev_hostile));
 
     memset(&s_combat_work, 0, sizeof(s_combat_work));
     if(!stalloc_init(&s_combat_work.mem))
@@ -2100,8 +2381,19 @@ bool G_Combat_Init(const struct map *map)
             goto fail_refcnts;
     }
 
+    if(!bins_init(res))
+        goto fail_bins;
+
+    if(!G_Pos_SnapshotInit(&s_combat_work.pos_snapshot))
+        goto fail_bins;
+
+    vec_erec_init(&s_combat_work.records);
     vec_entity_init(&s_dying_ents);
+    vec_hit_init(&s_hits[0]);
+    vec_hit_init(&s_hits[1]);
+    s_curr_hits = 0;
     E_Global_Register(EVENT_20HZ_TICK, on_20hz_tick, NULL, G_RUNNING);
+    E_Global_Register(EVENT_20HZ_SUBTICK, on_20hz_subtick, NULL, G_RUNNING);
     E_Global_Register(SDL_MOUSEBUTTONDOWN, on_mousedown, NULL, G_RUNNING);
     E_Global_Register(EVENT_RENDER_3D_POST, on_render_3d, NULL, G_ALL);
     E_Global_Register(EVENT_PROJECTILE_HIT, on_proj_hit, NULL, G_RUNNING);
@@ -2109,6 +2401,8 @@ bool G_Combat_Init(const struct map *map)
     combat_copy_gamestate();
     return true;
 
+fail_bins:
+    bins_destroy();
 fail_refcnts:
     for(int i = 0; i < MAX_FACTIONS; i++)
         PF_FREE(s_fac_refcnts[i]);
@@ -2116,6 +2410,14 @@ fail_refcnts:
 fail_queue:
     stalloc_destroy(&s_combat_work.mem);
 fail_stack:
+    G_Changes_Unsubscribe(&s_sleep_changes);
+fail_changes:
+    kh_destroy(binents, s_bin_sleepers);
+fail_bin_sleepers:
+    kh_destroy(sleep, s_sleeping);
+fail_sleeping:
+    kh_destroy(uid, s_awake);
+fail_awake:
     kh_destroy(state, s_entity_state_table);
     return false;
 }
@@ -2125,6 +2427,7 @@ void G_Combat_Shutdown(void)
     combat_complete_work();
     s_map = NULL;
 
+    E_Global_Unregister(EVENT_20HZ_SUBTICK, on_20hz_subtick);
     E_Global_Unregister(EVENT_20HZ_TICK, on_20hz_tick);
     E_Global_Unregister(SDL_MOUSEBUTTONDOWN, on_mousedown);
     E_Global_Unregister(EVENT_RENDER_3D_POST, on_render_3d);
@@ -2137,12 +2440,22 @@ void G_Combat_Shutdown(void)
     });
 
     combat_release_gamestate();
+    G_Pos_SnapshotDestroy(&s_combat_work.pos_snapshot);
+    vec_erec_destroy(&s_combat_work.records);
     vec_entity_destroy(&s_dying_ents);
+    vec_hit_destroy(&s_hits[0]);
+    vec_hit_destroy(&s_hits[1]);
     for(int i = 0; i < MAX_FACTIONS; i++) {
         PF_FREE(s_fac_refcnts[i]);
     }
+    bins_destroy();
     queue_cmd_destroy(&s_combat_commands);
     stalloc_destroy(&s_combat_work.mem);
+    combat_wake_all();
+    G_Changes_Unsubscribe(&s_sleep_changes);
+    kh_destroy(binents, s_bin_sleepers);
+    kh_destroy(sleep, s_sleeping);
+    kh_destroy(uid, s_awake);
     kh_destroy(state, s_entity_state_table);
 }
 
@@ -2198,6 +2511,13 @@ void G_Combat_SetStance(uint32_t uid, enum combat_stance stance)
     });
 }
 
+size_t G_Combat_GetHits(const struct combat_hit **out)
+{
+    const vec_hit_t *hits = &s_hits[!s_curr_hits];
+    *out = hits->array;
+    return vec_size(hits);
+}
+
 enum combat_stance G_Combat_GetStance(uint32_t uid)
 {
     struct combat_cmd *cmd = snoop_most_recent_command(COMBAT_CMD_SET_STANCE,
@@ -2299,6 +2619,33 @@ void G_Combat_AttackUnit(uint32_t uid, uint32_t target)
     });
 }
 
+void G_Combat_AttackOrder(size_t nents, const uint32_t *ents, uint32_t target)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!G_EntityExists(target))
+        return;
+
+    size_t nattacking = 0;
+    for(int i = 0; i < nents; i++) {
+
+        uint32_t curr = ents[i];
+        if(!G_EntityExists(curr))
+            continue;
+
+        uint32_t flags = G_FlagsGet(curr);
+        if(!(flags & ENTITY_FLAG_COMBATABLE))
+            continue;
+
+        G_Combat_AttackUnit(curr, target);
+        nattacking++;
+    }
+
+    if(nattacking) {
+        Entity_Ping(target);
+    }
+}
+
 void G_Combat_StopAttack(uint32_t uid)
 {
     combat_push_cmd((struct combat_cmd){
@@ -2719,6 +3066,7 @@ bool G_Combat_LoadState(struct SDL_RWops *stream)
         khiter_t k = kh_get(state, s_entity_state_table, uid);
         CHK_TRUE_RET(k != kh_end(s_entity_state_table));
         cs = &kh_value(s_entity_state_table, k);
+        combat_wake(uid);
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_INT);
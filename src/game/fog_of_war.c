@@ -38,6 +38,7 @@
 #include "position.h"
 #include "game_private.h"
 #include "../event.h"
+#include "../main.h"
 #include "../settings.h"
 #include "../sched.h"
 #include "../render/public/render.h"
@@ -46,6 +47,7 @@
 #include "../lib/public/khash.h"
 #include "../lib/public/attr.h"
 #include "../lib/public/mem.h"
+#include "../lib/public/vec.h"
 #include "../map/public/map.h"
 #include "../map/public/tile.h"
 
@@ -61,6 +63,8 @@
 #define FAC_STATE(val, fac_id)  (((val) >> ((fac_id) * 2)) & 0x3)
 #define IDX(r, width, c)        ((r) * (width) + (c))
 
+#define NUM_SNAPSHOTS           (3)
+
 #define CHK_TRUE_RET(_pred)             \
     do{                                 \
         if(!(_pred))                    \
@@ -73,16 +77,52 @@ enum fog_state{
     STATE_VISIBLE,
 };
 
+/* The tiles seen from an origin tile when there is nothing blocking the 
+ * line of sight. Only depends on the vision radius. */
+struct vis_stencil{
+    int   xrad, zrad;
+    /* One byte for every tile of the (2 * zrad + 1) * (2 * xrad + 1) box 
+     * around the origin, set for the tiles within the radius. */
+    bool *mask;
+    size_t noffsets;
+    struct{
+        int dr, dc;
+    }    *offsets;
+};
+
+/* A vision reference count change held back until the end of a batch */
+struct vis_ref{
+    struct tile_desc origin;
+    int              faction_id;
+    float            radius;
+    int              delta;
+};
+
+/* A read-only copy of the fog state, published for the worker tasks. 
+ * It is only brought up to date while no reader is holding it, and only 
+ * the chunks written since its' last update are copied over. */
+struct fog_snapshot{
+    uint32_t  version;
+    int       refcount;
+    uint32_t *state;
+};
+
 PQUEUE_TYPE(td, struct tile_desc)
 PQUEUE_IMPL(static, td, struct tile_desc)
 
+VEC_TYPE(vref, struct vis_ref)
+VEC_IMPL(static inline, vref, struct vis_ref)
+
 KHASH_SET_INIT_INT(uid)
+KHASH_MAP_INIT_INT(stencil, struct vis_stencil*)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static const struct map *s_map;
+static int               s_batch_depth;
+static vec_vref_t        s_batch;
 /* Holds a 32-bit value for every tile of the map. The chunks are stored in row-major
  * order. Within a chunk, the tiles are in row-major order. Each 32-bit value encodes
  * a 2-bit faction state for up to 16 factions. */
@@ -92,6 +132,29 @@ static uint8_t          *s_vision_refcnts[MAX_FACTIONS];
 /* Cache all the entities that have been explored by the player, for faster queries */
 static khash_t(uid)     *s_explored_cache;
 static bool              s_enabled = true;
+/* Set for every chunk whose tiles may have changed state since the last
+ * time the fog-of-war was sent to the renderer. */
+static bool             *s_dirty_chunks;
+static uint32_t          s_last_player_mask;
+static bool              s_last_enabled;
+/* Vision stencils, keyed by the bits of the radius */
+static khash_t(stencil) *s_stencils;
+/* A copy of the 'visible' and 'explored' states of every faction, with a bit per
+ * tile. The tiles are in row-major order for the whole map, with every row padded
+ * to a whole number of words. Allows testing many tiles at a time. */
+static uint64_t         *s_visible_bits[MAX_FACTIONS];
+static uint64_t         *s_explored_bits[MAX_FACTIONS];
+static size_t            s_row_words;
+/* Cached value of the debug setting read every frame */
+static struct sval       s_show_faction_vision;
+/* The version currently being written to 's_fog_state' and, for every chunk, the
+ * version during which it was last written. Snapshots at an older version copy 
+ * over the chunks written since. */
+static uint32_t          s_write_version;
+static bool              s_write_pending;
+static uint32_t         *s_chunk_versions;
+static struct fog_snapshot s_snapshots[NUM_SNAPSHOTS];
+static int               s_front = -1;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -124,10 +187,86 @@ static int td_index(struct tile_desc td)
         + (td.tile_r * res.tile_w + td.tile_c);
 }
 
+static void mark_dirty(struct tile_desc td)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+    s_dirty_chunks[td.chunk_r * res.chunk_w + td.chunk_c] = true;
+    s_chunk_versions[td.chunk_r * res.chunk_w + td.chunk_c] = s_write_version;
+    s_write_pending = true;
+}
+
+static void mark_all_dirty(void)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+    memset(s_dirty_chunks, true, res.chunk_w * res.chunk_h * sizeof(s_dirty_chunks[0]));
+    for(int i = 0; i < res.chunk_w * res.chunk_h; i++) {
+        s_chunk_versions[i] = s_write_version;
+    }
+    s_write_pending = true;
+}
+
+static void td_global(struct tile_desc td, int *out_r, int *out_c)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+    *out_r = td.chunk_r * res.tile_h + td.tile_r;
+    *out_c = td.chunk_c * res.tile_w + td.tile_c;
+}
+
+static void bit_set(uint64_t *plane, int r, int c, bool set)
+{
+    uint64_t *word = plane + r * s_row_words + (c / 64);
+    uint64_t bit = ((uint64_t)1) << (c % 64);
+    if(set)
+        *word |= bit;
+    else
+        *word &= ~bit;
+}
+
+static bool bit_get(const uint64_t *plane, int r, int c)
+{
+    return !!(plane[r * s_row_words + (c / 64)] & (((uint64_t)1) << (c % 64)));
+}
+
+static void bits_sync(struct tile_desc td, int faction_id)
+{
+    int r, c;
+    td_global(td, &r, &c);
+    enum fog_state state = FAC_STATE(s_fog_state[td_index(td)], faction_id);
+    bit_set(s_visible_bits[faction_id], r, c, state == STATE_VISIBLE);
+    bit_set(s_explored_bits[faction_id], r, c, state != STATE_UNEXPLORED);
+}
+
+static void bits_rebuild(void)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+    const size_t nrows = res.chunk_h * res.tile_h;
+
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+        memset(s_visible_bits[i], 0, nrows * s_row_words * sizeof(uint64_t));
+        memset(s_explored_bits[i], 0, nrows * s_row_words * sizeof(uint64_t));
+    }
+
+    for(int cr = 0; cr < res.chunk_h; cr++) {
+    for(int cc = 0; cc < res.chunk_w; cc++) {
+        for(int tr = 0; tr < res.tile_h; tr++) {
+        for(int tc = 0; tc < res.tile_w; tc++) {
+            struct tile_desc td = (struct tile_desc){cr, cc, tr, tc};
+            for(int i = 0; i < MAX_FACTIONS; i++) {
+                bits_sync(td, i);
+            }
+        }}
+    }}
+}
+
 static void update_tile(int faction_id, struct tile_desc td, int delta)
 {
     uint8_t old = s_vision_refcnts[faction_id][td_index(td)];
     uint8_t new = old + delta;
+    uint32_t prev = s_fog_state[td_index(td)];
 
     if(new) {
         fog_set_state(s_fog_state + td_index(td), faction_id, STATE_VISIBLE);
@@ -135,9 +274,26 @@ static void update_tile(int faction_id, struct tile_desc td, int delta)
         fog_set_state(s_fog_state + td_index(td), faction_id, STATE_IN_FOG);
     }
 
+    if(s_fog_state[td_index(td)] != prev) {
+        mark_dirty(td);
+        bits_sync(td, faction_id);
+    }
     s_vision_refcnts[faction_id][td_index(td)] = new;
 }
 
+/* A faction state never holds the value 0x3, so a set upper bit means 'visible'.
+ * Kept free of branches so that it can be vectorized by the compiler. */
+static void fog_convert_chunk(const uint32_t *restrict state, unsigned char *restrict out, 
+                              size_t ntiles, uint32_t player_mask)
+{
+    for(size_t i = 0; i < ntiles; i++) {
+        uint32_t ps = state[i] & player_mask;
+        unsigned char explored = (ps != 0);
+        unsigned char visible = ((ps & 0xaaaaaaaa) != 0);
+        out[i] = explored * STATE_IN_FOG + visible * (STATE_VISIBLE - STATE_IN_FOG);
+    }
+}
+
 static size_t neighbours(struct tile_desc curr, struct tile_desc *out)
 {
     size_t ret = 0;
@@ -173,6 +329,13 @@ static vec2_t tile_center_pos(struct tile_desc td)
     };
 }
 
+static int td_height(struct tile_desc td)
+{
+    struct tile *tile;
+    M_TileForDesc(s_map, td, &tile);
+    return M_Tile_BaseHeight(tile);
+}
+
 static bool td_los_blocked(struct tile_desc td, int ref_height)
 {
     struct tile *tile;
@@ -268,21 +431,12 @@ void td_delta(struct tile_desc a, struct tile_desc b, int *out_dr, int *out_dc)
     *out_dc = bc - ac;
 }
 
-static void fog_update_visible(int faction_id, vec2_t xz_pos, float radius, int delta)
+static void fog_update_visible_occluded(int faction_id, struct tile_desc origin, float radius, int delta)
 {
-    if(radius == 0.0f)
-        return;
-
     struct map_resolution res;
     M_GetResolution(s_map, &res);
 
-    struct tile_desc origin;
-    bool status = M_Tile_DescForPoint2D(res, M_GetPos(s_map), xz_pos, &origin);
-    assert(status);
-
-    struct tile *tile;
-    M_TileForDesc(s_map, origin, &tile);
-    int origin_height = M_Tile_BaseHeight(tile);
+    int origin_height = td_height(origin);
 
     const int tile_x_radius = ceil(radius / X_COORDS_PER_TILE) + 1;
     const int tile_z_radius = ceil(radius / Z_COORDS_PER_TILE) + 1;
@@ -354,7 +508,274 @@ static void fog_update_visible(int faction_id, vec2_t xz_pos, float radius, int
     STFREE(visited);
 }
 
-static bool fog_obj_matches(uint32_t *state, uint16_t fac_mask, const struct obb *obj, 
+static void stencil_free(struct vis_stencil *st)
+{
+    PF_FREE(st->mask);
+    PF_FREE(st->offsets);
+    PF_FREE(st);
+}
+
+static struct vis_stencil *fog_stencil(float radius)
+{
+    uint32_t key;
+    memcpy(&key, &radius, sizeof(key));
+
+    khiter_t k = kh_get(stencil, s_stencils, key);
+    if(k != kh_end(s_stencils))
+        return kh_val(s_stencils, k);
+
+    struct vis_stencil *st = calloc(1, sizeof(struct vis_stencil));
+    if(!st)
+        return NULL;
+
+    st->xrad = ceil(radius / X_COORDS_PER_TILE) + 1;
+    st->zrad = ceil(radius / Z_COORDS_PER_TILE) + 1;
+
+    const size_t count = (2 * st->xrad + 1) * (2 * st->zrad + 1);
+    st->mask = calloc(count, sizeof(bool));
+    st->offsets = malloc(count * sizeof(st->offsets[0]));
+    if(!st->mask || !st->offsets)
+        goto fail;
+
+    for(int dr = -st->zrad; dr <= st->zrad; dr++) {
+    for(int dc = -st->xrad; dc <= st->xrad; dc++) {
+
+        vec2_t delta = (vec2_t){dc * X_COORDS_PER_TILE, dr * Z_COORDS_PER_TILE};
+        if(PFM_Vec2_Len(&delta) > radius)
+            continue;
+
+        st->mask[IDX(st->zrad + dr, 2 * st->xrad + 1, st->xrad + dc)] = true;
+        st->offsets[st->noffsets].dr = dr;
+        st->offsets[st->noffsets].dc = dc;
+        st->noffsets++;
+    }}
+
+    int ret;
+    k = kh_put(stencil, s_stencils, key, &ret);
+    if(ret == -1)
+        goto fail;
+    kh_val(s_stencils, k) = st;
+    return st;
+
+fail:
+    stencil_free(st);
+    return NULL;
+}
+
+static bool stencil_contains(const struct vis_stencil *st, int dr, int dc)
+{
+    if(abs(dr) > st->zrad || abs(dc) > st->xrad)
+        return false;
+    return st->mask[IDX(st->zrad + dr, 2 * st->xrad + 1, st->xrad + dc)];
+}
+
+/* When none of the tiles within the stencil block the line of sight from 
+ * the origin, the visible tiles are exactly the ones of the stencil. 
+ */
+static bool fog_unoccluded(struct tile_desc origin, const struct vis_stencil *st)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+    int origin_height = td_height(origin);
+
+    for(int i = 0; i < st->noffsets; i++) {
+
+        struct tile_desc td = origin;
+        if(!M_Tile_RelativeDesc(res, &td, st->offsets[i].dc, st->offsets[i].dr))
+            continue;
+        if(td_los_blocked(td, origin_height))
+            return false;
+    }
+    return true;
+}
+
+/* Update every tile of the stencil around 'origin', skipping the ones which
+ * also fall into the stencil around 'exclude', if it is provided.
+ */
+static void fog_apply_stencil(int faction_id, struct tile_desc origin, const struct vis_stencil *st, 
+                              int delta, const struct tile_desc *exclude)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+
+    int ex_dr = 0, ex_dc = 0;
+    if(exclude) {
+        td_delta(origin, *exclude, &ex_dr, &ex_dc);
+    }
+
+    for(int i = 0; i < st->noffsets; i++) {
+
+        int dr = st->offsets[i].dr;
+        int dc = st->offsets[i].dc;
+
+        if(exclude && stencil_contains(st, dr - ex_dr, dc - ex_dc))
+            continue;
+
+        struct tile_desc td = origin;
+        if(!M_Tile_RelativeDesc(res, &td, dc, dr))
+            continue;
+        update_tile(faction_id, td, delta);
+    }
+}
+
+static bool fog_origin(vec2_t xz_pos, struct tile_desc *out)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+    return M_Tile_DescForPoint2D(res, M_GetPos(s_map), xz_pos, out);
+}
+
+static void fog_update_visible_at(int faction_id, struct tile_desc origin, float radius, int delta)
+{
+    /* The common case of open terrain doesn't need a search */
+    const struct vis_stencil *st = fog_stencil(radius);
+    if(st && fog_unoccluded(origin, st)) {
+        fog_apply_stencil(faction_id, origin, st, delta, NULL);
+        return;
+    }
+    fog_update_visible_occluded(faction_id, origin, radius, delta);
+}
+
+static void fog_update_visible(int faction_id, vec2_t xz_pos, float radius, int delta)
+{
+    if(radius == 0.0f)
+        return;
+
+    struct tile_desc origin;
+    bool status = fog_origin(xz_pos, &origin);
+    assert(status);
+
+    if(s_batch_depth > 0) {
+        struct vis_ref ref = (struct vis_ref){origin, faction_id, radius, delta};
+        if(vec_vref_push(&s_batch, ref))
+            return;
+    }
+    fog_update_visible_at(faction_id, origin, radius, delta);
+}
+
+static int compare_vrefs(const void *a, const void *b)
+{
+    const struct vis_ref *va = a, *vb = b;
+
+    if(va->faction_id != vb->faction_id)
+        return va->faction_id - vb->faction_id;
+    if(va->radius != vb->radius)
+        return (va->radius > vb->radius) ? 1 : -1;
+    if(va->origin.chunk_r != vb->origin.chunk_r)
+        return va->origin.chunk_r - vb->origin.chunk_r;
+    if(va->origin.chunk_c != vb->origin.chunk_c)
+        return va->origin.chunk_c - vb->origin.chunk_c;
+    if(va->origin.tile_r != vb->origin.tile_r)
+        return va->origin.tile_r - vb->origin.tile_r;
+    return va->origin.tile_c - vb->origin.tile_c;
+}
+
+/* Get the bitplanes that are equivalent to matching any of the states, if there
+ * are any. */
+static uint64_t **fog_states_planes(enum fog_state *states, size_t nstates)
+{
+    bool match[3] = {0};
+    for(int i = 0; i < nstates; i++) {
+        match[states[i]] = true;
+    }
+    if(!match[STATE_UNEXPLORED] && !match[STATE_IN_FOG] && match[STATE_VISIBLE])
+        return s_visible_bits;
+    if(!match[STATE_UNEXPLORED] && match[STATE_IN_FOG] && match[STATE_VISIBLE])
+        return s_explored_bits;
+    return NULL;
+}
+
+/* Check if any of the tiles in the inclusive range of global rows and columns
+ * is set in the plane of any faction in the mask. The range is clipped to the 
+ * map bounds.
+ */
+static bool fog_bits_any(uint64_t **planes, uint16_t fac_mask, int r0, int c0, int r1, int c1)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+
+    r0 = MAX(r0, 0);
+    c0 = MAX(c0, 0);
+    r1 = MIN(r1, (int)(res.chunk_h * res.tile_h) - 1);
+    c1 = MIN(c1, (int)(res.chunk_w * res.tile_w) - 1);
+    if(r0 > r1 || c0 > c1)
+        return false;
+
+    const int w0 = c0 / 64, w1 = c1 / 64;
+    const uint64_t first_mask = ~((uint64_t)0) << (c0 % 64);
+    const uint64_t last_mask = ~((uint64_t)0) >> (63 - (c1 % 64));
+
+    for(int i = 0; fac_mask; fac_mask >>= 1, i++) {
+
+        if(!(fac_mask & 0x1))
+            continue;
+
+        const uint64_t *plane = planes[i];
+        for(int r = r0; r <= r1; r++) {
+
+            const uint64_t *row = plane + r * s_row_words;
+            uint64_t acc = 0;
+            for(int w = w0; w <= w1; w++) {
+                uint64_t word = row[w];
+                if(w == w0)
+                    word &= first_mask;
+                if(w == w1)
+                    word &= last_mask;
+                acc |= word;
+            }
+            if(acc)
+                return true;
+        }
+    }
+    return false;
+}
+
+/* Quickly settle a query over some area using the bitplanes. The area must lie
+ * within the XZ bounds and must contain 'center'. Returns false if the tiles of 
+ * the area need to be tested one at a time.
+ */
+static bool fog_bits_test(uint16_t fac_mask, enum fog_state *states, size_t nstates,
+                          vec2_t center, float minx, float maxx, float minz, float maxz,
+                          bool *out)
+{
+    uint64_t **planes = fog_states_planes(states, nstates);
+    if(!planes)
+        return false;
+
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+    vec3_t pos = M_GetPos(s_map);
+
+    const float tile_x_dim = res.field_w / res.tile_w;
+    const float tile_z_dim = res.field_h / res.tile_h;
+
+    /* Columns go in the direction of decreasing X coordinates. Grow 
+     * the range by a tile to be conservative at the tile boundaries. */
+    int c0 = floor((pos.x - maxx) / tile_x_dim) - 1;
+    int c1 = floor((pos.x - minx) / tile_x_dim) + 1;
+    int r0 = floor((minz - pos.z) / tile_z_dim) - 1;
+    int r1 = floor((maxz - pos.z) / tile_z_dim) + 1;
+
+    if(!fog_bits_any(planes, fac_mask, r0, c0, r1, c1)) {
+        *out = false;
+        return true;
+    }
+
+    struct tile_desc td;
+    if(M_Tile_DescForPoint2D(res, pos, center, &td)) {
+        int r, c;
+        td_global(td, &r, &c);
+        for(int i = 0; i < MAX_FACTIONS; i++) {
+            if((fac_mask & (0x1 << i)) && bit_get(planes[i], r, c)) {
+                *out = true;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool fog_obj_matches(const uint32_t *state, uint16_t fac_mask, const struct obb *obj, 
                             enum fog_state *states, size_t nstates)
 {
     assert(Sched_UsingBigStack());
@@ -363,6 +784,23 @@ static bool fog_obj_matches(uint32_t *state, uint16_t fac_mask, const struct obb
     struct map_resolution res;
     M_GetResolution(s_map, &res);
 
+    if(state == s_fog_state) {
+
+        float minx = obj->corners[0].x, maxx = obj->corners[0].x;
+        float minz = obj->corners[0].z, maxz = obj->corners[0].z;
+        for(int i = 1; i < ARR_SIZE(obj->corners); i++) {
+            minx = MIN(minx, obj->corners[i].x);
+            maxx = MAX(maxx, obj->corners[i].x);
+            minz = MIN(minz, obj->corners[i].z);
+            maxz = MAX(maxz, obj->corners[i].z);
+        }
+
+        bool result;
+        vec2_t center = (vec2_t){obj->center.x, obj->center.z};
+        if(fog_bits_test(fac_mask, states, nstates, center, minx, maxx, minz, maxz, &result))
+            return result;
+    }
+
     uint32_t facstate_mask = 0;
     for(int i = 0; fac_mask; fac_mask >>= 1, i++) {
         if(fac_mask & 0x1) {
@@ -395,6 +833,12 @@ static bool fog_circle_matches(uint16_t fac_mask, vec2_t xz_center, float radius
     struct map_resolution res;
     M_GetResolution(s_map, &res);
 
+    bool result;
+    if(fog_bits_test(fac_mask, states, nstates, xz_center, 
+        xz_center.x - radius, xz_center.x + radius,
+        xz_center.z - radius, xz_center.z + radius, &result))
+        return result;
+
     uint32_t facstate_mask = 0;
     for(int i = 0; fac_mask; fac_mask >>= 1, i++) {
         if(fac_mask & 0x1) {
@@ -427,6 +871,12 @@ static bool fog_rect_matches(uint16_t fac_mask, vec2_t xz_center, float halfx, f
     struct map_resolution res;
     M_GetResolution(s_map, &res);
 
+    bool result;
+    if(fog_bits_test(fac_mask, states, nstates, xz_center, 
+        xz_center.x - halfx, xz_center.x + halfx,
+        xz_center.z - halfz, xz_center.z + halfz, &result))
+        return result;
+
     uint32_t facstate_mask = 0;
     for(int i = 0; fac_mask; fac_mask >>= 1, i++) {
         if(fac_mask & 0x1) {
@@ -451,21 +901,73 @@ static bool fog_rect_matches(uint16_t fac_mask, vec2_t xz_center, float halfx, f
     return false;
 }
 
-static void on_render_3d(void *user, void *event)
+static bool fog_snapshot_sync(struct fog_snapshot *snap)
 {
-    const struct camera *cam = G_GetActiveCamera();
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
 
-    struct sval setting;
-    ss_e status;
-    (void)status;
+    const size_t nchunks = res.chunk_w * res.chunk_h;
+    const size_t chunk_tiles = res.tile_w * res.tile_h;
+
+    if(!snap->state) {
+        snap->state = calloc(nchunks * chunk_tiles, sizeof(snap->state[0]));
+        snap->version = 0;
+        if(!snap->state)
+            return false;
+    }
 
-    status = Settings_Get("pf.debug.show_faction_vision", &setting);
-    assert(status == SS_OKAY);
+    for(int i = 0; i < nchunks; i++) {
+        if(s_chunk_versions[i] <= snap->version)
+            continue;
+        memcpy(snap->state + i * chunk_tiles, s_fog_state + i * chunk_tiles, 
+            chunk_tiles * sizeof(s_fog_state[0]));
+    }
+    snap->version = s_write_version;
+    return true;
+}
+
+/* Flip the writes made since the last publish into a snapshot that no 
+ * reader is holding, making it the new front. When every snapshot is 
+ * still held, the readers keep getting the previous front. 
+ */
+static void fog_publish(void)
+{
+    if(s_front >= 0 && !s_write_pending)
+        return;
+
+    for(int i = 0; i < NUM_SNAPSHOTS; i++) {
+
+        struct fog_snapshot *snap = &s_snapshots[i];
+        if(snap->refcount > 0)
+            continue;
+        if(!fog_snapshot_sync(snap))
+            continue;
+
+        s_front = i;
+        s_write_version++;
+        s_write_pending = false;
+        return;
+    }
+}
+
+static void fog_snapshots_free(void)
+{
+    for(int i = 0; i < NUM_SNAPSHOTS; i++) {
+        assert(s_snapshots[i].refcount == 0);
+        PF_FREE(s_snapshots[i].state);
+    }
+    memset(s_snapshots, 0, sizeof(s_snapshots));
+    s_front = -1;
+}
+
+static void on_render_3d(void *user, void *event)
+{
+    const struct camera *cam = G_GetActiveCamera();
 
-    if(setting.as_int == -1)
+    if(s_show_faction_vision.as_int == -1)
         return;
 
-    M_RenderChunkVisibility(s_map, G_GetActiveCamera(), setting.as_int);
+    M_RenderChunkVisibility(s_map, G_GetActiveCamera(), s_show_faction_vision.as_int);
 }
 
 /*****************************************************************************/
@@ -492,7 +994,35 @@ bool G_Fog_Init(const struct map *map)
     if(!s_explored_cache)
         goto fail;
 
+    s_dirty_chunks = malloc(sizeof(s_dirty_chunks[0]) * res.chunk_w * res.chunk_h);
+    if(!s_dirty_chunks)
+        goto fail;
+
+    s_chunk_versions = calloc(res.chunk_w * res.chunk_h, sizeof(s_chunk_versions[0]));
+    if(!s_chunk_versions)
+        goto fail;
+    s_write_version = 1;
+    s_write_pending = false;
+    s_front = -1;
+
+    s_stencils = kh_init(stencil);
+    if(!s_stencils)
+        goto fail;
+
+    const size_t nrows = res.chunk_h * res.tile_h;
+    s_row_words = (res.chunk_w * res.tile_w + 63) / 64;
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+        s_visible_bits[i] = calloc(nrows * s_row_words, sizeof(uint64_t));
+        s_explored_bits[i] = calloc(nrows * s_row_words, sizeof(uint64_t));
+        if(!s_visible_bits[i] || !s_explored_bits[i])
+            goto fail;
+    }
+
     s_map = map;
+    s_last_player_mask = 0;
+    s_last_enabled = s_enabled;
+    mark_all_dirty();
+    Settings_Bind("pf.debug.show_faction_vision", &s_show_faction_vision);
     E_Global_Register(EVENT_RENDER_3D_POST, on_render_3d, NULL, G_RUNNING | G_PAUSED_UI_RUNNING | G_PAUSED_FULL);
     return true;
 
@@ -502,6 +1032,13 @@ fail:
     for(int i = 0; i < MAX_FACTIONS; i++) {
         PF_FREE(s_vision_refcnts[i]);
     }
+    PF_FREE(s_dirty_chunks);
+    PF_FREE(s_chunk_versions);
+    kh_destroy(stencil, s_stencils);
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+        PF_FREE(s_visible_bits[i]);
+        PF_FREE(s_explored_bits[i]);
+    }
     return false;
 }
 
@@ -516,6 +1053,25 @@ void G_Fog_Shutdown(void)
         PF_FREE(s_vision_refcnts[i]);
     }
     memset(s_vision_refcnts, 0, sizeof(s_vision_refcnts));
+    PF_FREE(s_dirty_chunks);
+    s_dirty_chunks = NULL;
+    PF_FREE(s_chunk_versions);
+    s_chunk_versions = NULL;
+    fog_snapshots_free();
+
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+        PF_FREE(s_visible_bits[i]);
+        PF_FREE(s_explored_bits[i]);
+    }
+    memset(s_visible_bits, 0, sizeof(s_visible_bits));
+    memset(s_explored_bits, 0, sizeof(s_explored_bits));
+
+    struct vis_stencil *st;
+    kh_foreach_value(s_stencils, st, {
+        stencil_free(st);
+    });
+    kh_destroy(stencil, s_stencils);
+    s_stencils = NULL;
     s_map = NULL;
 }
 
@@ -529,6 +1085,40 @@ void G_Fog_RemoveVision(vec2_t xz_pos, int faction_id, float radius)
     fog_update_visible(faction_id, xz_pos, radius, -1);
 }
 
+/* Equivalent to removing the vision at 'old_pos' and adding it at 'new_pos', 
+ * but only the tiles which differ between the two are touched.
+ */
+void G_Fog_MoveVision(vec2_t old_pos, vec2_t new_pos, int faction_id, float radius)
+{
+    if(radius == 0.0f)
+        return;
+
+    if(s_batch_depth > 0) {
+        fog_update_visible(faction_id, old_pos, radius, -1);
+        fog_update_visible(faction_id, new_pos, radius, +1);
+        return;
+    }
+
+    struct tile_desc old_origin, new_origin;
+    bool old_status = fog_origin(old_pos, &old_origin);
+    bool new_status = fog_origin(new_pos, &new_origin);
+    assert(old_status && new_status);
+
+    /* The visible tiles only depend on the origin tile */
+    if(0 == memcmp(&old_origin, &new_origin, sizeof(struct tile_desc)))
+        return;
+
+    const struct vis_stencil *st = fog_stencil(radius);
+    if(st && fog_unoccluded(old_origin, st) && fog_unoccluded(new_origin, st)) {
+        fog_apply_stencil(faction_id, old_origin, st, -1, &new_origin);
+        fog_apply_stencil(faction_id, new_origin, st, +1, &old_origin);
+        return;
+    }
+
+    fog_update_visible(faction_id, old_pos, radius, -1);
+    fog_update_visible(faction_id, new_pos, radius, +1);
+}
+
 void G_Fog_ExploreCircle(vec2_t xz_pos, int faction_id, float radius)
 {
     assert(Sched_UsingBigStack());
@@ -703,43 +1293,51 @@ void G_Fog_UpdateVisionState(void)
             player_mask |= (0x3 << (i * 2));
     }
 
+    if(player_mask != s_last_player_mask || s_enabled != s_last_enabled) {
+        mark_all_dirty();
+        s_last_player_mask = player_mask;
+        s_last_enabled = s_enabled;
+    }
+
     struct map_resolution res;
     M_GetResolution(s_map, &res);
 
-    size_t size = res.chunk_h * res.tile_h * res.chunk_w * res.tile_w;
-    unsigned char *visbuff = stalloc(&G_GetSimWS()->args, size);
+    const size_t nchunks = res.chunk_w * res.chunk_h;
+    const size_t chunk_tiles = res.tile_w * res.tile_h;
 
-    if(!s_enabled) {
-        memset(visbuff, STATE_VISIBLE, size);
-        goto submit;
+    size_t ndirty = 0;
+    for(int i = 0; i < nchunks; i++) {
+        ndirty += s_dirty_chunks[i];
     }
 
-    for(int cr = 0; cr < res.chunk_h; cr++) {
-    for(int cc = 0; cc < res.chunk_w; cc++) {
+    /* Only the chunks that have changed are sent to the renderer */
+    unsigned char *visbuff = stalloc(&G_GetSimWS()->args, ndirty * chunk_tiles);
+    uint32_t *indices = stalloc(&G_GetSimWS()->args, ndirty * sizeof(uint32_t));
 
-        for(int tr = 0; tr < res.tile_h; tr++) {
-        for(int tc = 0; tc < res.tile_w; tc++) {
+    size_t curr = 0;
+    for(int i = 0; i < nchunks; i++) {
 
-            struct tile_desc td = (struct tile_desc){cr, cc, tr, tc};
-            int idx = td_index(td);
-            uint32_t player_state = s_fog_state[idx] & player_mask;
-
-            if(!player_state)
-                visbuff[idx] = STATE_UNEXPLORED;
-            else if(fog_any_matches(player_state, STATE_VISIBLE))
-                visbuff[idx] = STATE_VISIBLE;
-            else
-                visbuff[idx] = STATE_IN_FOG;
-        }}
-    }}
+        if(!s_dirty_chunks[i])
+            continue;
+
+        unsigned char *out = visbuff + curr * chunk_tiles;
+        if(!s_enabled) {
+            memset(out, STATE_VISIBLE, chunk_tiles);
+        }else{
+            fog_convert_chunk(s_fog_state + i * chunk_tiles, out, chunk_tiles, player_mask);
+        }
+        indices[curr++] = i;
+        s_dirty_chunks[i] = false;
+    }
+    assert(curr == ndirty);
 
-submit:
     R_PushCmd((struct rcmd){
         .func = R_GL_MapUpdateFog,
-        .nargs = 2,
+        .nargs = 3,
         .args = {
             visbuff,
-            R_PushArg(&size, sizeof(size)),
+            indices,
+            R_PushArg(&ndirty, sizeof(ndirty)),
         },
     });
 }
@@ -834,6 +1432,41 @@ bool G_Fog_NearVisibleWater(uint16_t fac_mask, vec2_t xz_pos, float radius)
     return false;
 }
 
+void G_Fog_BeginBatch(void)
+{
+    if(s_batch_depth++ == 0) {
+        vec_vref_init(&s_batch);
+    }
+}
+
+void G_Fog_EndBatch(void)
+{
+    assert(s_batch_depth > 0);
+    if(--s_batch_depth > 0)
+        return;
+
+    size_t nrefs = vec_size(&s_batch);
+    qsort(s_batch.array, nrefs, sizeof(struct vis_ref), compare_vrefs);
+
+    /* Sum up the changes for the same origin, faction and radius, 
+     * so that every one of them is only traced once */
+    for(int i = 0; i < nrefs;) {
+
+        const struct vis_ref *ref = &vec_AT(&s_batch, i);
+        int delta = 0;
+        int j = i;
+        for(; j < nrefs && compare_vrefs(ref, &vec_AT(&s_batch, j)) == 0; j++) {
+            delta += vec_AT(&s_batch, j).delta;
+        }
+
+        if(delta) {
+            fog_update_visible_at(ref->faction_id, ref->origin, ref->radius, delta);
+        }
+        i = j;
+    }
+    vec_vref_destroy(&s_batch);
+}
+
 void G_Fog_UpdateVisionRange(vec2_t xz_pos, int faction_id, float oldr, float newr)
 {
     G_Fog_RemoveVision(xz_pos, faction_id, oldr);
@@ -904,6 +1537,8 @@ bool G_Fog_LoadState(struct SDL_RWops *stream)
         s_fog_state[i] = attr.val.as_int;
     }
 
+    mark_all_dirty();
+    bits_rebuild();
     return true;
 }
 
@@ -926,27 +1561,41 @@ void G_Fog_ExploreMap(int faction_id)
             if(((ts >> (faction_id * 2)) & 0x3) == STATE_UNEXPLORED) {
                 ts &= ~(0x3 << (faction_id * 2));
                 ts |= (STATE_IN_FOG << (faction_id * 2));
+                mark_dirty(td);
             }
             s_fog_state[td_index(td)] = ts;
+            bits_sync(td, faction_id);
         }}
     }}
 }
 
-uint32_t *G_Fog_CopyState(void)
+const uint32_t *G_Fog_AcquireState(void)
 {
-    struct map_resolution res;
-    M_GetResolution(s_map, &res);
-    const size_t ntiles = res.chunk_w * res.chunk_h * res.tile_w * res.tile_h;
+    ASSERT_IN_MAIN_THREAD();
 
-    uint32_t *ret = malloc(sizeof(s_fog_state[0]) * ntiles);
-    if(!ret)
+    fog_publish();
+    if(s_front < 0)
         return NULL;
 
-    memcpy(ret, s_fog_state, sizeof(s_fog_state[0]) * ntiles);
-    return ret;
+    s_snapshots[s_front].refcount++;
+    return s_snapshots[s_front].state;
+}
+
+void G_Fog_ReleaseState(const uint32_t *state)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    for(int i = 0; i < NUM_SNAPSHOTS; i++) {
+        if(s_snapshots[i].state != state)
+            continue;
+        assert(s_snapshots[i].refcount > 0);
+        s_snapshots[i].refcount--;
+        return;
+    }
+    assert(0);
 }
 
-bool G_Fog_ObjVisibleFrom(uint32_t *state, bool enabled, uint16_t fac_mask, const struct obb *obb)
+bool G_Fog_ObjVisibleFrom(const uint32_t *state, bool enabled, uint16_t fac_mask, const struct obb *obb)
 {
     if(!enabled)
         return true;
@@ -50,8 +50,15 @@ void G_Fog_Shutdown(void);
 
 void G_Fog_AddVision(vec2_t xz_pos, int faction_id, float radius);
 void G_Fog_RemoveVision(vec2_t xz_pos, int faction_id, float radius);
+void G_Fog_MoveVision(vec2_t old_pos, vec2_t new_pos, int faction_id, float radius);
 void G_Fog_UpdateVisionRange(vec2_t xz_pos, int faction_id, float oldr, float newr);
 
+/* The vision changes made between these calls are applied together at the 
+ * end of the outermost batch. The fog state is not up-to-date until then. 
+ */
+void G_Fog_BeginBatch(void);
+void G_Fog_EndBatch(void);
+
 bool G_Fog_CircleExplored(uint16_t fac_mask, vec2_t xz_pos, float radius);
 bool G_Fog_RectExplored(uint16_t fac_mask, vec2_t xz_pos, float halfx, float halfz);
 bool G_Fog_NearVisibleWater(uint16_t fac_mask, vec2_t xz_pos, float radius);
@@ -67,9 +74,14 @@ bool G_Fog_LoadState(struct SDL_RWops *stream);
 
 bool G_Fog_Enabled(void);
 
-uint32_t *G_Fog_CopyState(void);
-bool      G_Fog_ObjVisibleFrom(uint32_t *state, bool enabled, 
-                               uint16_t fac_mask, const struct obb *obb);
+/* Get a read-only view of the fog state as of the last tick boundary, 
+ * which can be shared by any number of worker tasks. It must be given
+ * back with 'G_Fog_ReleaseState' once the workers are done with it.
+ */
+const uint32_t *G_Fog_AcquireState(void);
+void            G_Fog_ReleaseState(const uint32_t *state);
+bool            G_Fog_ObjVisibleFrom(const uint32_t *state, bool enabled, 
+                                     uint16_t fac_mask, const struct obb *obb);
 
 #endif
 
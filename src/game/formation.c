@@ -76,6 +76,7 @@
 #define EPSILON                  (1.0f/1024)
 #define FIELD_RECOMPUTE_INTERVAL (1.0f) /* seconds */
 #define MAX_CELL_ASSIGNMENT_WORK (256)
+#define SIM_TICK_MS              (50) /* one 20Hz tick */
 
 #define CHK_TRUE_RET(_pred)             \
     do{                                 \
@@ -333,11 +334,37 @@ static khash_t(type)      *s_preferred;
 static formation_id_t      s_next_id;
 static SDL_TLSID           s_workspace;
 static queue_event_t       s_events;
+/* With deterministic movement, the formation timestamps are taken from 
+ * the simulation clock, advanced once per 20Hz tick, rather than from 
+ * the wall clock. The asynchronous work is then collected on the 20Hz 
+ * tick following its' dispatch, waiting for it if necessary, instead of 
+ * whenever it happens to complete. */
+static bool                s_deterministic;
+static uint32_t            s_sim_ticks;
+
+/* Cached values of the debug settings read every frame */
+static struct{
+    struct sval nav_layer;
+    struct sval cell_index;
+    struct sval show_formations;
+    struct sval show_occupied_field;
+    struct sval show_assignment;
+    struct sval show_cell_arrival_field;
+    struct sval show_forces;
+    struct sval deterministic;
+}s_settings;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static uint32_t formation_ticks(void)
+{
+    if(s_deterministic)
+        return s_sim_ticks * SIM_TICK_MS;
+    return SDL_GetTicks();
+}
+
 static size_t workspace_size(void)
 {
     size_t padding = 64;
@@ -1645,433 +1672,90 @@ static void create_cost_matrix(struct cell_assignment_work *work, int *out_costs
     });
 }
 
-static int row_minimum(int *costs, int irow, size_t nents)
+/* Use the Hungarian algorithm to find an optimal assignment of entities to cells
+ * (minimizing the combined distance that needs to be traveled by the entities).
+ * The rows (entities) are added one at a time, each time growing the assignment 
+ * along the shortest augmenting path with respect to the row and column 
+ * potentials. This takes O(n^3) time overall. 
+ */
+static void compute_cell_assignment(struct cell_assignment_work *work)
 {
-    int (*rows)[nents] = (void*)costs;
-    int min = rows[irow][0];
-    for(int i = 1; i < nents; i++) {
-        min = MIN(min, rows[irow][i]);
-    }
-    return min;
-}
+    size_t nents = kh_size(work->ents);
+    STALLOC(int, costs, nents * nents);
+    STALLOC(struct coord, idx_to_cell, nents);
+    /* The potentials, the matching and the path bookkeeping are 
+     * 1-indexed, with index 0 being a virtual source column. */
+    STALLOC(int64_t, u, nents + 1);
+    STALLOC(int64_t, v, nents + 1);
+    STALLOC(int64_t, minv, nents + 1);
+    STALLOC(int, col_row, nents + 1);
+    STALLOC(int, way, nents + 1);
+    STALLOC(bool, used, nents + 1);
+    STALLOC(int, assignment, nents);
 
-static int column_minimum(int *costs, int icol, size_t nents)
-{
+    create_cost_matrix(work, costs, idx_to_cell);
     int (*rows)[nents] = (void*)costs;
-    int min = rows[0][icol];
-    for(int i = 1; i < nents; i++) {
-        min = MIN(min, rows[i][icol]);
-    }
-    return min;
-}
-
-static bool assigned_in_column(bool *starred, size_t nents, size_t icol)
-{
-    bool (*rows)[nents] = (void*)starred;
-    for(int i = 0; i < nents; i++) {
-        if(rows[i][icol])
-            return true;
-    }
-    return false;
-}
-
-static bool row_is_covered(bool *covered, size_t nents, size_t irow)
-{
-    bool (*rows)[nents] = (void*)covered;
-    size_t ncovered = 0;
-    for(int i = 0; i < nents; i++) {
-        if(rows[irow][i])
-            ncovered++;
-    }
-    return (ncovered == nents);
-}
-
-static void cover_column(bool *covered, size_t nents, size_t icol)
-{
-    bool (*rows)[nents] = (void*)covered;
-    for(int i = 0; i < nents; i++) {
-        rows[i][icol] = true;
-    }
-}
-
-static void uncover_column(bool *covered, size_t nents, size_t icol)
-{
-    bool (*rows)[nents] = (void*)covered;
-    for(int i = 0; i < nents; i++) {
-        if(!row_is_covered(covered, nents, i)) {
-            rows[i][icol] = false;
-        }
-    }
-}
-
-static void cover_row(bool *covered, size_t nents, size_t irow)
-{
-    bool (*rows)[nents] = (void*)covered;
-    for(int i = 0; i < nents; i++) {
-        rows[irow][i] = true;
-    }
-}
-
-static bool row_has_starred(bool *starred, size_t nents, size_t irow, int *out_col)
-{
-    bool (*rows)[nents] = (void*)starred;
-    for(int i = 0; i < nents; i++) {
-        if(rows[irow][i]) {
-            *out_col = i;
-            return true;
-        }
-    }
-    return false;
-}
-
-static bool column_is_covered(bool *covered, size_t nents, size_t icol)
-{
-    bool (*rows)[nents] = (void*)covered;
-    size_t ncovered = 0;
-    for(int i = 0; i < nents; i++) {
-        if(rows[i][icol])
-            ncovered++;
-    }
-    return (ncovered == nents);
-}
-
-static bool column_has_starred(bool *starred, size_t nents, size_t icol, int *out_row)
-{
-    bool (*rows)[nents] = (void*)starred;
-    for(int i = 0; i < nents; i++) {
-        if(rows[i][icol]) {
-            *out_row = i;
-            return true;
-        }
-    }
-    return false;
-}
-
-static int primed_zero_at_row(bool *primed, size_t nents, size_t irow)
-{
-    bool (*rows)[nents] = (void*)primed;
-    for(int i = 0; i < nents; i++) {
-        if(rows[irow][i])
-            return i;
-    }
-    assert(0);
-    return -1;
-}
-
-static size_t count_covered_rows(bool *covered, size_t nents)
-{
-    bool (*rows)[nents] = (void*)covered;
-    size_t ret = 0;
-    for(int i = 0; i < nents; i++) {
-        size_t ncovered = 0;
-        for(int j = 0; j < nents; j++) {
-            if(rows[i][j])
-                ncovered++;
-        }
-        if(ncovered == nents)
-            ret++;
-    }
-    return ret;
-}
-
-static size_t count_covered_columns(bool *covered, size_t nents)
-{
-    bool (*rows)[nents] = (void*)covered;
-    size_t ret = 0;
-    for(int i = 0; i < nents; i++) {
-        size_t ncovered = 0;
-        for(int j = 0; j < nents; j++) {
-            if(rows[j][i])
-                ncovered++;
-        }
-        if(ncovered == nents)
-            ret++;
-    }
-    return ret;
-}
-
-static void dump_cost_matrix_only(int *costs, size_t nents)
-{
-    int (*cost_rows)[nents] = (void*)costs;
-    for(int r = 0; r < nents; r++) {
-        for(int c = 0; c < nents; c++) {
-            printf("%03d", cost_rows[r][c]);
-            if(c != nents-1)
-                printf("  ");
-        }
-        printf("\n");
-    }
-}
-
-static void dump_cost_matrix(int *costs, size_t nents,
-                             bool *starred, bool *covered, bool *primed)
-{
-    int  (*cost_rows)[nents] = (void*)costs;
-    bool (*starred_rows)[nents] = (void*)starred;
-    bool (*covered_rows)[nents] = (void*)covered;
-    bool (*primed_rows)[nents] = (void*)primed;
+    const int64_t inf = INT64_MAX / 4;
 
-    for(int r = 0; r < nents; r++) {
-        for(int c = 0; c < nents; c++) {
-            printf("%03d%c%c%c", 
-                cost_rows[r][c],
-                starred_rows[r][c] ? '*'  : ' ',
-                primed_rows[r][c]  ? '\'' : ' ',
-                covered_rows[r][c] ? 'C'  : ' ');
-            if(c != nents-1)
-                printf("  ");
-        }
-        printf("\n");
-    }
-}
+    memset(u, 0, (nents + 1) * sizeof(int64_t));
+    memset(v, 0, (nents + 1) * sizeof(int64_t));
+    memset(col_row, 0, (nents + 1) * sizeof(int));
+    memset(way, 0, (nents + 1) * sizeof(int));
 
-static int min_uncovered_value(int *costs, bool *covered, size_t nents)
-{
-    int  (*cost_rows)[nents] = (void*)costs;
-    bool (*covered_rows)[nents] = (void*)covered;
+    for(int i = 1; i <= nents; i++) {
 
-    int min = INT_MAX;
-    for(int r = 0; r < nents; r++) {
-        for(int c = 0; c < nents; c++) {
-            if(!covered_rows[r][c]) {
-                min = MIN(cost_rows[r][c], min);
-            }
+        col_row[0] = i;
+        int j0 = 0;
+        for(int j = 0; j <= nents; j++) {
+            minv[j] = inf;
+            used[j] = false;
         }
-    }
-    return min;
-}
-
-static int min_lines_to_cover_zeroes(int *costs, int *out_next, 
-                                     struct coord *out_assignment, size_t nents)
-{
-    STALLOC(bool, starred, nents * nents);
-    STALLOC(bool, covered, nents * nents);
-    STALLOC(bool, primed, nents * nents);
 
-    memset(starred, 0, nents * nents * sizeof(bool));
-    memset(covered, 0, nents * nents * sizeof(bool));
-    memset(primed, 0, nents * nents * sizeof(bool));
-
-    int  (*cost_rows)[nents] = (void*)costs;
-    bool (*starred_rows)[nents] = (void*)starred;
-    bool (*covered_rows)[nents] = (void*)covered;
-    bool (*primed_rows)[nents] = (void*)primed;
-
-iterate:
-    /* For each row, try to assign an arbitrary zero. Assigned tasks
-     * are represented by starring a zero. Note that assignments can't 
-     * be in the same row or column.
-     */
-    for(int row = 0; row < nents; row++) {
-        for(int col = 0; col < nents; col++) {
-            if(starred_rows[row][col])
-                break;
-            if((cost_rows[row][col] == 0) && !assigned_in_column(starred, nents, col)) {
-                starred_rows[row][col] = true;
-                break;
-            }
-        }
-    }
-
-    /* Cover all columns containing a (starred) zero.
-     */
-    for(int row = 0; row < nents; row++) {
-        for(int col = 0; col < nents; col++) {
-            if(starred_rows[row][col])
-                cover_column(covered, nents, col);
-        }
-    }
-
-    bool has_uncovered;
-    int primed_r, primed_c;
-    do{
-        /* Find a non-covered zero and prime it */
-        has_uncovered = false;
-        for(int row = 0; row < nents; row++) {
-            for(int col = 0; col < nents; col++) {
-                if(cost_rows[row][col] == 0 && !covered_rows[row][col]) {
-                    has_uncovered = true;
-                    primed_rows[row][col] = true;
-                    primed_r = row;
-                    primed_c = col;
-                    break;
-                }
-            }
-            if(has_uncovered)
-                break;
-        }
-
-        if(has_uncovered) {
-            /* If the zero is on the same row as a starred zero, 
-             * cover the corresponding row, and uncover the column 
-             * of the starred zero 
-             */
-            int starred_c;
-            if(row_has_starred(starred, nents, primed_r, &starred_c)) {
-                uncover_column(covered, nents, starred_c);
-                cover_row(covered, nents, primed_r);
-            }else{
-                size_t npath = 0;
-                STALLOC(struct coord, path, nents * nents);
-                path[npath++] = (struct coord){primed_r, primed_c};
-                /* Else the non-covered zero has no assigned zero on its row. 
-                 * We make a path starting from the zero by performing the following steps: 
-                 *
-                 * Substep 1: Find a starred zero on the corresponding column. If there is one, 
-                 * go to Substep 2, else, stop.
-                 */
-            next_path_zero:;
-                int starred_r;
-                if(column_has_starred(starred, nents, primed_c, &starred_r)) {
-                    path[npath++] = (struct coord){starred_r, primed_c};
-                    /*
-                     * Substep 2: Find a primed zero on the corresponding row (there should always 
-                     * be one). Go to Substep 1. 
-                     */
-                    primed_c = primed_zero_at_row(primed, nents, starred_r);
-                    primed_r = starred_r;
-                    path[npath++] = (struct coord){primed_r, primed_c};
-                    goto next_path_zero;
-                }
-
-                /* For all zeros encountered during the path, star primed zeros 
-                 * and unstar starred zeros.
-                 */
-                for(int i = 0; i < npath; i++) {
-                    struct coord curr = path[i];
-                    assert(starred_rows[curr.r][curr.c] ^ primed_rows[curr.r][curr.c]);
-                    if(starred_rows[curr.r][curr.c]) {
-                        starred_rows[curr.r][curr.c] = false;
-                    }else if(primed_rows[curr.r][curr.c]) {
-                        starred_rows[curr.r][curr.c] = true;
-                    }
+        do{
+            used[j0] = true;
+            int i0 = col_row[j0];
+            int64_t delta = inf;
+            int j1 = 0;
+
+            for(int j = 1; j <= nents; j++) {
+                if(used[j])
+                    continue;
+                int64_t cur = rows[i0 - 1][j - 1] - u[i0] - v[j];
+                if(cur < minv[j]) {
+                    minv[j] = cur;
+                    way[j] = j0;
                 }
-
-                /* Unprime all primed zeroes and uncover all tiles.
-                 */
-                for(int i = 0; i < nents; i++) {
-                    for(int j = 0; j < nents; j++) {
-                        primed_rows[i][j] = false;
-                        covered_rows[i][j] = false;
-                    }
+                if(minv[j] < delta) {
+                    delta = minv[j];
+                    j1 = j;
                 }
-                STFREE(path);
-                Sched_TryYield();
-                goto iterate;
             }
-        }
-    }while(has_uncovered); 
-
-    size_t ncovered_rows = count_covered_rows(covered, nents);
-    size_t ncovered_cols = count_covered_columns(covered, nents);
 
-    size_t ret;
-    if((ncovered_rows == nents) || (ncovered_cols == nents)) {
-        ret = nents;
-    }else{
-        ret = (ncovered_rows + ncovered_cols);
-    }
-
-    if(ret < nents) {
-        /* Find the lowest uncovered value. Subtract this from every 
-         * unmarked element and add it to every element covered by two lines.  
-         * This is equivalent to subtracting a number from all rows which are 
-         * not covered and adding the same number to all columns which are 
-         * covered. These operations do not change optimal assignments. 
-         */
-        int (*next_rows)[nents] = (void*)out_next;
-        memcpy(out_next, costs, sizeof(int) * nents * nents);
-
-        int min = min_uncovered_value(costs, covered, nents);
-        for(int r = 0; r < nents; r++) {
-            if(!row_is_covered(covered, nents, r)) {
-                for(int c = 0; c < nents; c++) {
-                    next_rows[r][c] -= min;
-                }
-            }
-        }
-        for(int c = 0; c < nents; c++) {
-            if(column_is_covered(covered, nents, c)) {
-                for(int r = 0; r < nents; r++) {
-                    next_rows[r][c] += min;
+            for(int j = 0; j <= nents; j++) {
+                if(used[j]) {
+                    u[col_row[j]] += delta;
+                    v[j] -= delta;
+                }else{
+                    minv[j] -= delta;
                 }
             }
-        }
-    }else{
-        int i = 0;
-        for(int r = 0; r < nents; r++) {
-            for(int c = 0; c < nents; c++) {
-                if(starred_rows[r][c]) {
-                    out_assignment[i++] = (struct coord){r, c};
-                }
-            }
-        }
-        assert(i == nents);
-    }
-
-    STFREE(starred);
-    STFREE(covered);
-    STFREE(primed);
+            j0 = j1;
+        }while(col_row[j0] != 0);
 
-    return ret;
-}
-
-/* Use the Hungarian algorithm to find an optimal assignment of entities to cells
- * (minimizing the combined distance that needs to be traveled by the entities).
- */
-static void compute_cell_assignment(struct cell_assignment_work *work)
-{
-    size_t nents = kh_size(work->ents);
-    STALLOC(int, costs, nents * nents);
-    STALLOC(int, next, nents * nents);
-    STALLOC(struct coord, assignment, nents);
-    STALLOC(struct coord, idx_to_cell, nents);
-
-    create_cost_matrix(work, costs, idx_to_cell);
-    int (*rows)[nents] = (void*)costs;
+        /* Flip the matching along the augmenting path */
+        do{
+            int j1 = way[j0];
+            col_row[j0] = col_row[j1];
+            j0 = j1;
+        }while(j0 != 0);
 
-    /* Step 1: Subtract row minima
-     * For each row, find the lowest element and subtract it from each element in that row.
-     */
-    for(int i = 0; i < nents; i++) {
-        int row_min = row_minimum(costs, i, nents);
-        for(int j = 0; j < nents; j++) {
-            rows[i][j] -= row_min;
-        }
+        Sched_TryYield();
     }
 
-    /* Step  2: Subtract column minima 
-     * For each column, find the lowest element and subtract it from each element in that 
-     * column.
-     */
-    for(int i = 0; i < nents; i++) {
-        int col_min = column_minimum(costs, i, nents);
-        for(int j = 0; j < nents; j++) {
-            rows[j][i] -= col_min;
-        }
+    for(int j = 1; j <= nents; j++) {
+        assignment[col_row[j] - 1] = j - 1;
     }
 
-    size_t min_lines;
-    do{
-        Sched_TryYield();
-        /* Step 3: Cover all zeros with a minimum number of lines
-         * Cover all zeros in the resulting matrix using a minimum number of horizontal and 
-         * vertical lines. If n lines are required, an optimal assignment exists among the zeros. 
-         * The algorithm stops.
-         *
-         * If less than n lines are required, continue with Step 4.
-         */
-        min_lines = min_lines_to_cover_zeroes(costs, next, assignment, nents);
-
-        /* Step 4: Create additional zeros
-         * Find the smallest element (call it k) that is not covered by a line in Step 3. 
-         * Subtract k from all uncovered elements, and add k to all elements that are covered twice.
-         */
-        if(min_lines < nents) {
-            memcpy(costs, next, sizeof(int) * nents * nents);
-        }
-    }while(min_lines < nents);
-
     int i = 0;
     uint32_t uid;
     kh_foreach_key(work->ents, uid, {
@@ -2079,7 +1763,7 @@ static void compute_cell_assignment(struct cell_assignment_work *work)
         int status;
         khiter_t k = kh_put(assignment, work->assignment, uid, &status);
         assert(status != -1);
-        size_t meta_idx = assignment[i].c;
+        size_t meta_idx = assignment[i];
         struct coord cell_coord = idx_to_cell[meta_idx];
         kh_val(work->assignment, k) = cell_coord;
         size_t cell_idx = CELL_IDX(cell_coord.r, cell_coord.c, work->ncols);
@@ -2096,9 +1780,14 @@ static void compute_cell_assignment(struct cell_assignment_work *work)
     });
 
     STFREE(costs);
-    STFREE(next)
-    STFREE(assignment);
     STFREE(idx_to_cell);
+    STFREE(u);
+    STFREE(v);
+    STFREE(minv);
+    STFREE(col_row);
+    STFREE(way);
+    STFREE(used);
+    STFREE(assignment);
 }
 
 static mat4x4_t cell_field_model_matrix(vec2_t center)
@@ -2876,50 +2565,23 @@ static void render_formation_forces(void)
 
 static void on_render_3d(void *user, void *event)
 {
-    enum nav_layer layer;
-    struct sval setting;
-    int cell_index;
-    ss_e status;
-    (void)status;
-
-    status = Settings_Get("pf.debug.navigation_layer", &setting);
-    assert(status == SS_OKAY);
-    layer = setting.as_int;
-
-    status = Settings_Get("pf.debug.formation_cell_index", &setting);
-    assert(status == SS_OKAY);
-    cell_index = setting.as_int;
+    enum nav_layer layer = s_settings.nav_layer.as_int;
+    int cell_index = s_settings.cell_index.as_int;
 
-    status = Settings_Get("pf.debug.show_formations", &setting);
-    assert(status == SS_OKAY);
-    bool enabled = setting.as_bool;
-
-    if(enabled) {
+    if(s_settings.show_formations.as_bool) {
         render_formations();
     }
 
-    status = Settings_Get("pf.debug.show_formations_occupied_field", &setting);
-    assert(status == SS_OKAY);
-    enabled = setting.as_bool;
-
-    if(enabled) {
+    if(s_settings.show_occupied_field.as_bool) {
         render_formations_occupied_field(layer);
         render_islands_field(layer);
     }
 
-    status = Settings_Get("pf.debug.show_formations_assignment", &setting);
-    assert(status == SS_OKAY);
-    enabled = setting.as_bool;
-
-    if(enabled) {
+    if(s_settings.show_assignment.as_bool) {
         render_formation_assignment();
     }
 
-    status = Settings_Get("pf.debug.show_formations_cell_arrival_field", &setting);
-    assert(status == SS_OKAY);
-    enabled = setting.as_bool;
-
-    if(enabled) {
+    if(s_settings.show_cell_arrival_field.as_bool) {
         formation_id_t fid;
         enum selection_type type;
         const vec_entity_t *sel = G_Sel_Get(&type);
@@ -2932,11 +2594,7 @@ static void on_render_3d(void *user, void *event)
         }
     }
 
-    status = Settings_Get("pf.debug.show_formations_forces", &setting);
-    assert(status == SS_OKAY);
-    enabled = setting.as_bool;
-
-    if(enabled) {
+    if(s_settings.show_forces.as_bool) {
         render_formation_forces();
     }
 }
@@ -2979,7 +2637,7 @@ static bool event_triggered_recalculate(struct formation *formation, struct bloc
 static void on_entity_unblock(void *user, void *event)
 {
     uint32_t uid = (uintptr_t)event;
-    uint32_t tick = SDL_GetTicks();
+    uint32_t tick = formation_ticks();
     struct block_event block_event = (struct block_event){
         .type = EVENT_MOVABLE_ENTITY_UNBLOCK,
         .arg = event,
@@ -2990,7 +2648,7 @@ static void on_entity_unblock(void *user, void *event)
 
 static void on_entity_block(void *user, void *event)
 {
-    uint32_t tick = SDL_GetTicks();
+    uint32_t tick = formation_ticks();
     struct block_event block_event = (struct block_event){
         .type = EVENT_MOVABLE_ENTITY_BLOCK,
         .arg = event,
@@ -3001,7 +2659,7 @@ static void on_entity_block(void *user, void *event)
 
 static void on_building_found(void *user, void *event)
 {
-    uint32_t tick = SDL_GetTicks();
+    uint32_t tick = formation_ticks();
     struct block_event block_event = (struct block_event){
         .type = EVENT_MOVABLE_ENTITY_BLOCK,
         .arg = event,
@@ -3012,7 +2670,7 @@ static void on_building_found(void *user, void *event)
 
 static void on_building_remove(void *user, void *event)
 {
-    uint32_t tick = SDL_GetTicks();
+    uint32_t tick = formation_ticks();
     struct block_event block_event = (struct block_event){
         .type = EVENT_MOVABLE_ENTITY_UNBLOCK,
         .arg = event,
@@ -3024,7 +2682,6 @@ static void on_building_remove(void *user, void *event)
 static void on_1hz_tick(void *user, void *event)
 {
     khash_t(entity) *need_recompute = kh_init(entity);
-    uint32_t ticks = SDL_GetTicks();
     struct block_event block_event;
     while(queue_event_pop(&s_events, &block_event)) {
 
@@ -3208,7 +2865,7 @@ static void dispatch_cell_task(struct formation *parent, vec2_t center, uint32_t
     work->recompute_pending = false;
     work->map = rmap;
     work->uid = uid;
-    work->last_update_ticks = SDL_GetTicks();
+    work->last_update_ticks = formation_ticks();
 
     work->input.layer = formation->layer;
     work->input.enemy_faction_mask = G_GetEnemyFactions(formation->faction_id);
@@ -3249,22 +2906,31 @@ static void dispatch_cell_field_work(struct formation *parent, vec2_t center,
     });
 }
 
+static void complete_cell_field_task(struct cell_field_work *work, bool yield)
+{
+    if(work->tid == NULL_TID)
+        return;
+    while(!Sched_FutureIsReady(&work->future)) {
+        Sched_RunSync(work->tid);
+        if(yield) {
+            Sched_TryYield();
+        }
+    }
+}
+
 static void complete_cell_field_work(struct subformation *formation, bool yield)
 {
     for(int j = 0; j < vec_size(&formation->futures); j++) {
         struct cell_field_work *curr = &vec_AT(&formation->futures, j);
-        if(curr->tid == NULL_TID)
-            continue;
-        while(!Sched_FutureIsReady(&curr->future)) {
-            Sched_RunSync(curr->tid);
-            if(yield) {
-                Sched_TryYield();
-            }
-        }
+        complete_cell_field_task(curr, yield);
     }
 }
 
-static void on_update_start(void *user, void *event)
+/* When 'wait' is set, all the outstanding work is completed and collected, 
+ * such that the results are published at the same point in the simulation 
+ * regardless of how long the tasks took to run.
+ */
+static void consume_work(bool wait)
 {
     /* Consume cell assignment work results 
     */
@@ -3276,6 +2942,9 @@ static void on_update_start(void *user, void *event)
             if(work->destroyed)
                 continue;
             struct subformation *sub = &vec_AT(&formation->subformations, i);
+            if(wait) {
+                complete_cell_assignment_work(work, false);
+            }
             if(Sched_FutureIsReady(&work->future)) {
                 collect_cell_assignment_result(work, sub);
                 cell_assignment_work_destroy(work);
@@ -3306,6 +2975,9 @@ static void on_update_start(void *user, void *event)
                     dispatch_cell_task(formation, formation->center, uid, sub, curr, cell,
                         cell_field_task);
                 }
+                if(!curr->consumed && wait) {
+                    complete_cell_field_task(curr, false);
+                }
                 if(!curr->consumed && Sched_FutureIsReady(&curr->future)) {
                     /* Publish the result */
                     int ret;
@@ -3319,6 +2991,25 @@ static void on_update_start(void *user, void *event)
     });
 }
 
+static void on_update_start(void *user, void *event)
+{
+    if(s_deterministic)
+        return;
+    consume_work(false);
+}
+
+static void on_20hz_tick(void *user, void *event)
+{
+    s_deterministic = s_settings.deterministic.as_bool;
+    if(!s_deterministic)
+        return;
+
+    PERF_PUSH("formation::on_20hz_tick");
+    s_sim_ticks++;
+    consume_work(true);
+    PERF_POP();
+}
+
 static struct cell_arrival_field *cell_get_field(uint32_t uid)
 {
     formation_id_t fid = G_Formation_GetForEnt(uid);
@@ -3438,6 +3129,9 @@ static void recompute_cell_arrival_fields(struct formation *parent, vec2_t cente
     uint32_t uid;
     kh_foreach_key(formation->ents, uid, {
         struct cell_field_work *curr = &vec_AT(&formation->futures, i);
+        if(!curr->consumed && s_deterministic) {
+            complete_cell_field_task(curr, false);
+        }
         if(!curr->consumed && !Sched_FutureIsReady(&curr->future)) {
             curr->recompute_pending = true;
             continue;
@@ -4228,6 +3922,18 @@ bool G_Formation_Init(const struct map *map)
 {
     ASSERT_IN_MAIN_THREAD();
 
+    Settings_Bind("pf.debug.navigation_layer", &s_settings.nav_layer);
+    Settings_Bind("pf.debug.formation_cell_index", &s_settings.cell_index);
+    Settings_Bind("pf.debug.show_formations", &s_settings.show_formations);
+    Settings_Bind("pf.debug.show_formations_occupied_field", &s_settings.show_occupied_field);
+    Settings_Bind("pf.debug.show_formations_assignment", &s_settings.show_assignment);
+    Settings_Bind("pf.debug.show_formations_cell_arrival_field", 
+        &s_settings.show_cell_arrival_field);
+    Settings_Bind("pf.debug.show_formations_forces", &s_settings.show_forces);
+    Settings_Bind("pf.game.deterministic_movement", &s_settings.deterministic);
+    s_deterministic = s_settings.deterministic.as_bool;
+    s_sim_ticks = 0;
+
     if(NULL == (s_ent_formation_map = kh_init(mapping)))
         return false;
     if(NULL == (s_formations = kh_init(formation)))
@@ -4255,6 +3961,7 @@ bool G_Formation_Init(const struct map *map)
     E_Global_Register(EVENT_BUILDING_FOUNDED, on_building_found, NULL, G_RUNNING);
     E_Global_Register(EVENT_BUILDING_REMOVED, on_building_remove, NULL, G_RUNNING);
     E_Global_Register(EVENT_1HZ_TICK, on_1hz_tick, NULL, G_RUNNING);
+    E_Global_Register(EVENT_20HZ_TICK, on_20hz_tick, NULL, G_RUNNING);
     return true;
 
 fail_tls:
@@ -4277,6 +3984,7 @@ void G_Formation_Shutdown(void)
         destroy_formation(formation);
     });
 
+    E_Global_Unregister(EVENT_20HZ_TICK, on_20hz_tick);
     E_Global_Unregister(EVENT_1HZ_TICK, on_1hz_tick);
     E_Global_Unregister(EVENT_BUILDING_FOUNDED, on_building_found);
     E_Global_Unregister(EVENT_BUILDING_REMOVED, on_building_remove);
@@ -4353,7 +4061,7 @@ void G_Formation_Create(vec2_t target, vec2_t orientation,
         .center = field_center(target, orientation),
         .ents = copy_vector(ents),
         .speed = formation_speed(ents),
-        .created_tick = SDL_GetTicks(),
+        .created_tick = formation_ticks(),
         .sub_assignment = kh_init(assignment),
         .map_snapshots = kh_init(map)
     };
@@ -4674,7 +4382,7 @@ void G_Formation_UpdateFieldIfNeeded(uint32_t uid)
      * field too often. Wait for a number of changes to pile up
      * and do it perfodically, as necessary.
      */
-    uint32_t curr = SDL_GetTicks();
+    uint32_t curr = formation_ticks();
     float elapsed = (curr - work->last_update_ticks) / 1000.0f;
     if(elapsed < FIELD_RECOMPUTE_INTERVAL) {
         bool ret = SDL_AtomicDecRef(&rmap->refcount);
@@ -4924,7 +4632,7 @@ void G_Formation_RenderPlacement(const vec_entity_t *ents, vec2_t target, vec2_t
         .center = field_center(target, orientation),
         .ents = copy_vector(ents),
         .speed = formation_speed(ents),
-        .created_tick = SDL_GetTicks(),
+        .created_tick = formation_ticks(),
         .sub_assignment = kh_init(assignment),
         .map_snapshots = kh_init(map)
     };
@@ -5135,7 +4843,7 @@ bool G_Formation_SaveState(struct SDL_RWops *stream)
 
 bool G_Formation_LoadState(struct SDL_RWops *stream)
 {
-    uint32_t curr_tick = SDL_GetTicks();
+    uint32_t curr_tick = formation_ticks();
     struct attr attr;
 
     /* Load next formation ID */
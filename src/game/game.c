@@ -48,13 +48,19 @@
 #include "builder.h"
 #include "harvester.h"
 #include "storage_site.h"
+#include "restable.h"
 #include "resource.h"
 #include "region.h"
 #include "garrison.h"
 #include "automation.h"
+#include "orders.h"
+#include "snapshot.h"
+#include "changes.h"
+#include "influence.h"
 #include "../render/public/render.h"
 #include "../render/public/render_ctrl.h"
 #include "../anim/public/anim.h"
+#include "../script/public/script.h"
 #include "../map/public/map.h"
 #include "../map/public/tile.h"
 #include "../audio/public/audio.h"
@@ -75,6 +81,8 @@
 #include "../perf.h"
 #include "../cursor.h"
 #include "../sched.h"
+#include "../session.h"
+#include "../lib/public/SDL_vec_rwops.h"
 
 #include <assert.h> 
 
@@ -85,6 +93,8 @@
 #define CAM_SENS            0.05f
 #define MAX_VIS_RANGE       150.0f
 #define WATER_ADJ_DISTANCE  25.0f
+#define MINIMAP_UNITS_MS    100 /* 10 Hz */
+#define ANIM_RSTATE_GRAIN   64
 
 #define MIN(a, b)           ((a) < (b) ? (a) : (b))
 #define MAX(a, b)           ((a) > (b) ? (a) : (b))
@@ -100,6 +110,7 @@ VEC_IMPL(extern, obb, struct obb)
 __KHASH_IMPL(entity,  extern, khint32_t, uint32_t, 0, kh_int_hash_func, kh_int_hash_equal)
 __KHASH_IMPL(id,      extern, khint32_t, int,      1, kh_int_hash_func, kh_int_hash_equal)
 __KHASH_IMPL(range,   extern, khint32_t, float,    1, kh_int_hash_func, kh_int_hash_equal)
+__KHASH_IMPL(rcache,  extern, khint32_t, struct stat_rcache, 1, kh_int_hash_func, kh_int_hash_equal)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -107,10 +118,67 @@ __KHASH_IMPL(range,   extern, khint32_t, float,    1, kh_int_hash_func, kh_int_h
 
 static struct gamestate s_gs;
 
+/* Cached values of the settings that are read every frame */
+static struct sval      s_hb_mode;
+static struct sval      s_shadows_enabled;
+static struct sval      s_occlusion_culling;
+static struct sval      s_water_refraction;
+static struct sval      s_water_reflection;
+
+/* The per-subsystem entity state is saved as a sequence of independent, 
+ * length-prefixed sections. The savers only read their own subsystem's 
+ * state, so they are run concurrently, each into its' own buffer. The 
+ * loaders are run in order, as they reach into the state of other subsystems 
+ * and register event handlers (ex. building loading sets the combat HP). */
+static const struct state_section{
+    bool (*save)(SDL_RWops *stream);
+    bool (*load)(SDL_RWops *stream);
+}s_entity_sections[] = {
+    {G_Move_SaveState,          G_Move_LoadState        },
+    {G_Formation_SaveState,     G_Formation_LoadState   },
+    {G_Combat_SaveState,        G_Combat_LoadState      },
+    {G_Building_SaveState,      G_Building_LoadState    },
+    {G_Builder_SaveState,       G_Builder_LoadState     },
+    {G_StorageSite_SaveState,   G_StorageSite_LoadState },
+    {G_Resource_SaveState,      G_Resource_LoadState    },
+    {G_Harvester_SaveState,     G_Harvester_LoadState   },
+    {G_Garrison_SaveState,      G_Garrison_LoadState    },
+    {G_Automation_SaveState,    G_Automation_LoadState  },
+};
+
+static struct section_work{
+    SDL_RWops        *streams[ARR_SIZE(s_entity_sections)];
+    SDL_atomic_t      failed;
+    struct task_group group;
+}s_section_work;
+
+/* The render states of the visible animated entities are filled in by 
+ * the workers while the main thread carries on pushing the rest of the 
+ * frame. Until the work is joined, the animated entity arrays of the 
+ * pushed copies of the render input are left empty. */
+static struct render_work{
+    struct render_input  in;
+    struct render_input *copy;
+    struct render_input *water_copy;
+    struct task_group    group;
+    bool                 pending;
+}s_render_work;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static uint64_t g_hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    /* FNV-1a */
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
 static vec2_t g_default_minimap_pos(void)
 {
     struct sval res = (struct sval){ 
@@ -154,6 +222,10 @@ static bool g_init_camera(void)
 
 static void g_init_map(void)
 {
+    /* The water settings are only created along with the renderer */
+    Settings_Bind("pf.video.water_refraction", &s_water_refraction);
+    Settings_Bind("pf.video.water_reflection", &s_water_reflection);
+
     M_CenterAtOrigin(s_gs.map);
     M_RestrictRTSCamToMap(s_gs.map, s_gs.active_cam);
     M_Raycast_Install(s_gs.map, s_gs.active_cam);
@@ -164,10 +236,12 @@ static void g_init_map(void)
     G_Fog_Init(s_gs.map);
     G_Combat_Init(s_gs.map);
     G_Move_Init(s_gs.map);
+    G_Snapshot_Init();
     G_Formation_Init(s_gs.map);
     G_Builder_Init(s_gs.map);
     G_Resource_Init(s_gs.map);
     G_Region_Init(s_gs.map);
+    G_Influence_Init(s_gs.map);
     G_Harvester_Init(s_gs.map);
     G_Automation_Init();
     G_ClearPath_Init(s_gs.map);
@@ -202,6 +276,21 @@ static void g_shadow_pass(struct render_input *in)
     });
 
 #else // !CONFIG_USE_BATCH_RENDERING
+    for(int i = 0; i < vec_size(&in->light_vis_stat); i++) {
+    
+        struct ent_stat_rstate *curr = &vec_AT(&in->light_vis_stat, i);
+        R_PushCmd((struct rcmd){
+            .func = R_GL_RenderDepthMap,
+            .nargs = 2,
+            .args = {
+                curr->render_private,
+                R_PushArg(&curr->model, sizeof(curr->model)),
+            },
+        });
+    }
+
+    R_PushCmd((struct rcmd){ R_GL_DepthPassDynamic, 0 });
+
     for(int i = 0; i < vec_size(&in->light_vis_anim); i++) {
     
         struct ent_anim_rstate *curr = &vec_AT(&in->light_vis_anim, i);
@@ -215,7 +304,7 @@ static void g_shadow_pass(struct render_input *in)
             .nargs = 4,
             .args = {
                 (void*)curr->inv_bind_pose, 
-                R_PushArg(curr->curr_pose, sizeof(curr->curr_pose)),
+                (void*)curr->curr_pose, 
                 R_PushArg(&normal, sizeof(normal)),
                 R_PushArg(&curr->njoints, sizeof(curr->njoints)),
             },
@@ -230,19 +319,6 @@ static void g_shadow_pass(struct render_input *in)
             },
         });
     }
-
-    for(int i = 0; i < vec_size(&in->light_vis_stat); i++) {
-    
-        struct ent_stat_rstate *curr = &vec_AT(&in->light_vis_stat, i);
-        R_PushCmd((struct rcmd){
-            .func = R_GL_RenderDepthMap,
-            .nargs = 2,
-            .args = {
-                curr->render_private,
-                R_PushArg(&curr->model, sizeof(curr->model)),
-            },
-        });
-    }
 #endif
 
     R_PushCmd((struct rcmd){ R_GL_DepthPassEnd, 0 });
@@ -252,6 +328,9 @@ static void g_draw_pass(struct render_input *in)
 {
     if(in->map) {
         M_RenderVisibleMap(in->map, in->cam, in->shadows, RENDER_PASS_REGULAR);
+        if(in->pick) {
+            M_Raycast_PushPick(in->cam);
+        }
     }
 
 #if CONFIG_USE_BATCH_RENDERING
@@ -276,7 +355,7 @@ static void g_draw_pass(struct render_input *in)
             .nargs = 4,
             .args = {
                 (void*)curr->inv_bind_pose, 
-                R_PushArg(curr->curr_pose, sizeof(curr->curr_pose)),
+                (void*)curr->curr_pose, 
                 R_PushArg(&normal, sizeof(normal)),
                 R_PushArg(&curr->njoints, sizeof(curr->njoints)),
             },
@@ -313,12 +392,7 @@ static void g_render_healthbars(void)
 {
     PERF_ENTER();
 
-    struct sval hb_setting;
-    ss_e status = Settings_Get("pf.game.healthbar_mode", &hb_setting);
-    assert(status == SS_OKAY);
-    (void)status;
-
-    if(hb_setting.as_int == HB_MODE_NEVER)
+    if(s_hb_mode.as_int == HB_MODE_NEVER)
         PERF_RETURN_VOID();
 
     size_t max_ents = vec_size(&s_gs.visible);
@@ -347,7 +421,7 @@ static void g_render_healthbars(void)
 
         if(curr_health == 0 || max_health == 0)
             continue;
-        if(hb_setting.as_int == HB_MODE_DAMAGED && curr_health == max_health)
+        if(s_hb_mode.as_int == HB_MODE_DAMAGED && curr_health == max_health)
             continue;
 
         int yoffset = -20;
@@ -381,40 +455,57 @@ static void g_render_healthbars(void)
     PERF_RETURN_VOID();
 }
 
-static void g_sort_stat_list(vec_rstat_t *inout)
+/* Recompute the model matrix and tile of a static entity only if it has been
+ * moved, rotated or scaled since it was last drawn.
+ */
+static const struct stat_rcache *g_stat_rcache(uint32_t uid, struct map_resolution res)
 {
-    PERF_ENTER();
-    int i = 1;
-    while(i < vec_size(inout)) {
-        int j = i;
-        while(j > 0 && vec_AT(inout, j - 1).translucent && !vec_AT(inout, j).translucent) {
-
-            struct ent_stat_rstate tmp = vec_AT(inout, j - 1);
-            vec_AT(inout, j - 1) = vec_AT(inout, j);
-            vec_AT(inout, j) = tmp;
-            j--;
-        }
-        i++;
+    static struct stat_rcache s_uncached;
+
+    khiter_t k = kh_get(rcache, s_gs.stat_rcache, uid);
+    if(k != kh_end(s_gs.stat_rcache))
+        return &kh_value(s_gs.stat_rcache, k);
+
+    int status;
+    k = kh_put(rcache, s_gs.stat_rcache, uid, &status);
+    struct stat_rcache *ret = (status != -1) 
+                            ? &kh_value(s_gs.stat_rcache, k) 
+                            : &s_uncached;
+
+    vec3_t pos = G_Pos_Get(uid);
+    Entity_ModelMatrixFrom(pos, Entity_GetRot(uid), Entity_GetScale(uid), &ret->model);
+    ret->td = (struct tile_desc){0};
+    if(s_gs.map) {
+        M_Tile_DescForPoint2D(res, M_GetPos(s_gs.map), (vec2_t){pos.x, pos.z}, &ret->td);
     }
-    PERF_RETURN_VOID();
+    return ret;
 }
 
-static void g_sort_anim_list(vec_ranim_t *inout)
+static void g_stat_rcache_invalidate(uint32_t uid)
 {
-    PERF_ENTER();
-    int i = 1;
-    while(i < vec_size(inout)) {
-        int j = i;
-        while(j > 0 && vec_AT(inout, j - 1).translucent && !vec_AT(inout, j).translucent) {
-
-            struct ent_anim_rstate tmp = vec_AT(inout, j - 1);
-            vec_AT(inout, j - 1) = vec_AT(inout, j);
-            vec_AT(inout, j) = tmp;
-            j--;
+    khiter_t k = kh_get(rcache, s_gs.stat_rcache, uid);
+    if(k != kh_end(s_gs.stat_rcache)) {
+        kh_del(rcache, s_gs.stat_rcache, k);
+    }
+}
+
+/* Drop the cached state of every entity that has been changed since the 
+ * last sync.
+ */
+static void g_stat_rcache_sync(void)
+{
+    struct change changes[256];
+    int nchanges;
+    while((nchanges = G_Changes_Read(&s_gs.rcache_changes, ARR_SIZE(changes), changes))) {
+
+        if(nchanges < 0) {
+            kh_clear(rcache, s_gs.stat_rcache);
+            continue;
+        }
+        for(int i = 0; i < nchanges; i++) {
+            g_stat_rcache_invalidate(changes[i].uid);
         }
-        i++;
     }
-    PERF_RETURN_VOID();
 }
 
 static void g_make_draw_list(vec_entity_t ents, vec_rstat_t *out_stat, vec_ranim_t *out_anim,
@@ -443,41 +534,47 @@ static void g_make_draw_list(vec_entity_t ents, vec_rstat_t *out_stat, vec_ranim
 
         PERF_PUSH("process entity");
 
-        mat4x4_t model;
-        Entity_ModelMatrix(curr, &model);
-
         if(flags & ENTITY_FLAG_ANIMATED) {
 
+            /* The rest is filled in by g_anim_rstate_range */
             struct ent_anim_rstate rstate = (struct ent_anim_rstate){
                 .uid = curr,
                 .render_private = ent->render_private, 
-                .model = model,
                 .translucent = !!(flags & ENTITY_FLAG_TRANSLUCENT),
             };
-            A_GetRenderState(curr, &rstate.njoints, rstate.curr_pose, &rstate.inv_bind_pose);
             vec_ranim_push(out_anim, rstate);
 
         }else{
-        
-            struct tile_desc td = {0};
-            if(s_gs.map) {
-                M_Tile_DescForPoint2D(res, M_GetPos(s_gs.map), G_Pos_GetXZ(curr), &td);
-            }
 
+            const struct stat_rcache *cached = g_stat_rcache(curr, res);
             struct ent_stat_rstate rstate = (struct ent_stat_rstate){
                 .uid = curr,
                 .render_private = ent->render_private, 
-                .model = model,
+                .model = cached->model,
                 .translucent = !!(flags & ENTITY_FLAG_TRANSLUCENT),
-                .td = td
+                .td = cached->td
             };
             vec_rstat_push(out_stat, rstate);
         }
         PERF_POP();
     }
 
-    g_sort_stat_list(out_stat);
-    g_sort_anim_list(out_anim);
+    PERF_RETURN_VOID();
+}
+
+static void g_anim_rstate_range(size_t begin, size_t end, void *arg)
+{
+    PERF_ENTER();
+    struct render_input *in = arg;
+    const size_t ncam = vec_size(&in->cam_vis_anim);
+
+    for(size_t i = begin; i < end; i++) {
+
+        struct ent_anim_rstate *rstate = (i < ncam) ? &vec_AT(&in->cam_vis_anim, i)
+                                                    : &vec_AT(&in->light_vis_anim, i - ncam);
+        Entity_ModelMatrix(rstate->uid, &rstate->model);
+        A_GetRenderState(rstate->uid, &rstate->njoints, &rstate->curr_pose, &rstate->inv_bind_pose);
+    }
     PERF_RETURN_VOID();
 }
 
@@ -485,13 +582,12 @@ static void g_create_render_input(struct render_input *out)
 {
     PERF_ENTER();
 
-    struct sval shadows_setting;
-    ss_e status = Settings_Get("pf.video.shadows_enabled", &shadows_setting);
-    assert(status == SS_OKAY);
+    g_stat_rcache_sync();
 
     out->cam = s_gs.active_cam;
-    out->map = s_gs.prev_tick_map;
-    out->shadows = shadows_setting.as_bool;
+    out->map = G_GetPrevTickMap();
+    out->shadows = s_shadows_enabled.as_bool;
+    out->pick = false;
     out->light_pos = s_gs.light_pos;
 
     vec_rstat_init(&out->cam_vis_stat);
@@ -509,6 +605,14 @@ static void g_create_render_input(struct render_input *out)
     g_make_draw_list(s_gs.visible, &out->cam_vis_stat, &out->cam_vis_anim, false);
     g_make_draw_list(s_gs.light_visible, &out->light_vis_stat, &out->light_vis_anim, true);
 
+    /* Every animated entity has its' own slot in the output arrays, 
+     * so the workers don't need to synchronize with each other */
+    size_t nanim = vec_size(&out->cam_vis_anim) + vec_size(&out->light_vis_anim);
+    Sched_TaskGroupInit(&s_render_work.group);
+    Sched_ParallelForAsync(&s_render_work.group, 0, nanim, ANIM_RSTATE_GRAIN, 
+        g_anim_rstate_range, out, 0, 0);
+    s_render_work.pending = true;
+
     PERF_RETURN_VOID();
 }
 
@@ -521,30 +625,44 @@ static void g_destroy_render_input(struct render_input *rinput)
     vec_ranim_destroy(&rinput->light_vis_anim);
 }
 
-static void *g_push_render_input(struct render_input in)
+static void g_push_anim_input(struct render_input *dst, const struct render_input *in)
 {
-    struct render_input *ret = R_PushArg(&in, sizeof(in));
-
-    ret->cam = R_PushArg(in.cam, g_sizeof_camera);
-
-    if(in.cam_vis_stat.size) {
-        ret->cam_vis_stat.array = R_PushArg(in.cam_vis_stat.array, 
-            in.cam_vis_stat.size * sizeof(struct ent_stat_rstate));
+    dst->cam_vis_anim = in->cam_vis_anim;
+    dst->cam_vis_anim.array = NULL;
+    if(in->cam_vis_anim.size) {
+        dst->cam_vis_anim.array = R_PushArg(in->cam_vis_anim.array, 
+            in->cam_vis_anim.size * sizeof(struct ent_anim_rstate));
     }
-    if(in.cam_vis_anim.size) {
-        ret->cam_vis_anim.array = R_PushArg(in.cam_vis_anim.array, 
-            in.cam_vis_anim.size * sizeof(struct ent_anim_rstate));
+
+    dst->light_vis_anim = in->light_vis_anim;
+    dst->light_vis_anim.array = NULL;
+    if(in->light_vis_anim.size) {
+        dst->light_vis_anim.array = R_PushArg(in->light_vis_anim.array, 
+            in->light_vis_anim.size * sizeof(struct ent_anim_rstate));
     }
+}
 
-    if(in.light_vis_stat.size) {
-        ret->light_vis_stat.array = R_PushArg(in.light_vis_stat.array, 
-            in.light_vis_stat.size * sizeof(struct ent_stat_rstate));
+static void *g_push_render_input(const struct render_input *in)
+{
+    struct render_input *ret = R_PushArg(in, sizeof(*in));
+
+    ret->cam = R_PushArg(in->cam, g_sizeof_camera);
+
+    if(in->cam_vis_stat.size) {
+        ret->cam_vis_stat.array = R_PushArg(in->cam_vis_stat.array, 
+            in->cam_vis_stat.size * sizeof(struct ent_stat_rstate));
     }
-    if(in.light_vis_anim.size) {
-        ret->light_vis_anim.array = R_PushArg(in.light_vis_anim.array, 
-            in.light_vis_anim.size * sizeof(struct ent_anim_rstate));
+    if(in->light_vis_stat.size) {
+        ret->light_vis_stat.array = R_PushArg(in->light_vis_stat.array, 
+            in->light_vis_stat.size * sizeof(struct ent_stat_rstate));
     }
 
+    /* The animated entities are pushed once their states are complete */
+    ret->cam_vis_anim = (vec_ranim_t){0};
+    ret->light_vis_anim = (vec_ranim_t){0};
+    if(!s_render_work.pending) {
+        g_push_anim_input(ret, in);
+    }
     return ret;
 }
 
@@ -591,6 +709,15 @@ static bool int_validate(const struct sval *new_val)
     return true;
 }
 
+static bool influence_hz_validate(const struct sval *new_val)
+{
+    if(new_val->type != ST_TYPE_INT)
+        return false;
+    if(new_val->as_int < 1 || new_val->as_int > 60)
+        return false;
+    return true;
+}
+
 static bool hb_mode_validate(const struct sval *new_val)
 {
     if(new_val->type != ST_TYPE_INT)
@@ -600,6 +727,22 @@ static bool hb_mode_validate(const struct sval *new_val)
     return true;
 }
 
+static bool pipeline_depth_validate(const struct sval *new_val)
+{
+    if(new_val->type != ST_TYPE_INT)
+        return false;
+    if(new_val->as_int < 2 || new_val->as_int > G_MAX_PIPELINE_DEPTH)
+        return false;
+    return true;
+}
+
+static void pipeline_depth_commit(const struct sval *new_val)
+{
+    /* This only limits how many workspaces may be submitted at once, 
+     * so it's fine for it to take effect in the middle of a frame */
+    s_gs.pipeline_depth = new_val->as_int;
+}
+
 static bool fac_vision_validate(const struct sval *new_val)
 {
     if(new_val->type != ST_TYPE_INT)
@@ -704,6 +847,86 @@ static bool g_load_anim_state(SDL_RWops *stream)
     return true;
 }
 
+static void g_save_sections_range(size_t begin, size_t end, void *arg)
+{
+    for(size_t i = begin; i < end; i++) {
+        if(!s_entity_sections[i].save(s_section_work.streams[i]))
+            SDL_AtomicSet(&s_section_work.failed, 1);
+    }
+}
+
+static bool g_save_sections(SDL_RWops *stream)
+{
+    const size_t nsections = ARR_SIZE(s_entity_sections);
+    bool ret = false;
+
+    memset(s_section_work.streams, 0, sizeof(s_section_work.streams));
+    for(int i = 0; i < nsections; i++) {
+        s_section_work.streams[i] = PFSDL_VectorRWOps();
+        if(!s_section_work.streams[i])
+            goto out;
+    }
+    SDL_AtomicSet(&s_section_work.failed, 0);
+
+    Sched_TaskGroupInit(&s_section_work.group);
+    Sched_ParallelForAsync(&s_section_work.group, 0, nsections, 1, 
+        g_save_sections_range, NULL, 4, TASK_BIG_STACK);
+    Sched_TaskGroupJoin(&s_section_work.group);
+
+    if(SDL_AtomicGet(&s_section_work.failed))
+        goto out;
+
+    for(int i = 0; i < nsections; i++) {
+
+        SDL_RWops *section = s_section_work.streams[i];
+        const size_t size = SDL_RWsize(section);
+
+        struct attr section_size = (struct attr){
+            .type = TYPE_INT,
+            .val.as_int = size
+        };
+        if(!Attr_Write(stream, &section_size, "section_size"))
+            goto out;
+        if(size && !SDL_RWwrite(stream, PFSDL_VectorRWOpsRaw(section), size, 1))
+            goto out;
+    }
+    ret = true;
+
+out:
+    for(int i = 0; i < nsections; i++) {
+        if(s_section_work.streams[i])
+            SDL_RWclose(s_section_work.streams[i]);
+    }
+    return ret;
+}
+
+static bool g_load_section(SDL_RWops *stream, bool (*load)(SDL_RWops*))
+{
+    struct attr attr;
+    CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
+    CHK_TRUE_RET(attr.type == TYPE_INT && attr.val.as_int >= 0);
+    const size_t size = attr.val.as_int;
+
+    char *buff = malloc(size ? size : 1);
+    CHK_TRUE_RET(buff);
+
+    bool ret = false;
+    if(size && !SDL_RWread(stream, buff, size, 1))
+        goto out;
+
+    /* Each loader only gets to see its' own section, so a loader that 
+     * under- or over-reads can't throw off the ones that follow */
+    SDL_RWops *section = SDL_RWFromConstMem(buff, size);
+    if(!section)
+        goto out;
+    ret = load(section);
+    SDL_RWclose(section);
+
+out:
+    PF_FREE(buff);
+    return ret;
+}
+
 static size_t g_num_factions(void)
 {
     size_t ret = 0;
@@ -769,28 +992,36 @@ static void g_clear_map_state(void)
         M_FreeMinimap(s_gs.map);
         G_Garrison_Shutdown();
         G_Building_Shutdown();
-        G_Fog_Shutdown();
+        /* The combat workers read the fog state until they are joined */
         G_Combat_Shutdown();
+        G_Fog_Shutdown();
         G_Formation_Shutdown();
         G_Move_Shutdown();
         G_Builder_Shutdown();
         G_Resource_Shutdown();
         G_Region_Shutdown();
+        G_Influence_Shutdown();
         G_Harvester_Shutdown();
         G_Automation_Shutdown();
         G_ClearPath_Shutdown();
+        G_Snapshot_Shutdown();
         G_Pos_Shutdown();
 
         AL_MapFree(s_gs.map);
         s_gs.map = NULL;
     }
 
-    if(s_gs.prev_tick_map) {
-        /* The render thread still owns the previous tick map. Wait 
-         * for it to complete before we free the buffer. */
+    /* The cached tiles are only valid for the map they were computed on */
+    kh_clear(rcache, s_gs.stat_rcache);
+
+    if(s_gs.prev_tick_map[0]) {
+        /* The render thread still owns the previous tick maps. Wait 
+         * for it to complete before we free the buffers. */
         Engine_WaitRenderWorkDone();
-        PF_FREE(s_gs.prev_tick_map);
-        s_gs.prev_tick_map = NULL;
+        for(int i = 0; i < G_MAX_PIPELINE_DEPTH; i++) {
+            PF_FREE(s_gs.prev_tick_map[i]);
+            s_gs.prev_tick_map[i] = NULL;
+        }
     }
 }
 
@@ -890,6 +1121,18 @@ static void g_create_settings(void)
     });
     assert(status == SS_OKAY);
 
+    status = Settings_Create((struct setting){
+        .name = "pf.game.render_pipeline_depth",
+        .val = (struct sval) {
+            .type = ST_TYPE_INT,
+            .as_int = 2
+        },
+        .prio = 0,
+        .validate = pipeline_depth_validate,
+        .commit = pipeline_depth_commit,
+    });
+    assert(status == SS_OKAY);
+
     status = Settings_Create((struct setting){
         .name = "pf.game.fog_of_war_enabled",
         .val = (struct sval) {
@@ -902,6 +1145,78 @@ static void g_create_settings(void)
     });
     assert(status == SS_OKAY);
 
+    status = Settings_Create((struct setting){
+        .name = "pf.game.occlusion_culling",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = true
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.game.gpu_steering_enabled",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.game.gpu_nav_enabled",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.game.deterministic_movement",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.game.sharded_20hz_ticks",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.game.influence_update_hz",
+        .val = (struct sval) {
+            .type = ST_TYPE_INT,
+            .as_int = 4
+        },
+        .prio = 0,
+        .validate = influence_hz_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
     status = Settings_Create((struct setting){
         .name = "pf.game.camera_zoom",
         .val = (struct sval) {
@@ -1182,6 +1497,10 @@ static void g_create_settings(void)
         .validate = bool_val_validate,
         .commit = NULL,
     });
+
+    Settings_Bind("pf.game.healthbar_mode", &s_hb_mode);
+    Settings_Bind("pf.video.shadows_enabled", &s_shadows_enabled);
+    Settings_Bind("pf.game.occlusion_culling", &s_occlusion_culling);
 }
 
 static void g_render_minimap_units(void)
@@ -1190,6 +1509,17 @@ static void g_render_minimap_units(void)
     assert(Sched_UsingBigStack());
     PERF_ENTER();
 
+    /* The dots are tiny - refreshing their positions at a lower rate than the
+     * framerate is not noticeable. In between, the renderer re-draws the last 
+     * set of positions it was given. */
+    uint32_t curr_tick = SDL_GetTicks();
+    if(s_gs.minimap_units_tick 
+    && !SDL_TICKS_PASSED(curr_tick, s_gs.minimap_units_tick + MINIMAP_UNITS_MS)) {
+        M_RenderMinimapUnits(s_gs.map);
+        PERF_RETURN_VOID();
+    }
+    s_gs.minimap_units_tick = MAX(curr_tick, 1);
+
     STALLOC(vec2_t, positions, kh_size(s_gs.active));
     STALLOC(vec3_t, colors, kh_size(s_gs.active));
     size_t nunits = 0;
@@ -1215,7 +1545,8 @@ static void g_render_minimap_units(void)
         nunits++;
     });
 
-    M_RenderMinimapUnits(s_gs.map, nunits, positions, colors);
+    M_UpdateMinimapUnits(s_gs.map, nunits, positions, colors);
+    M_RenderMinimapUnits(s_gs.map);
 
     STFREE(positions);
     STFREE(colors);
@@ -1233,7 +1564,7 @@ static void g_remove_queued(void)
     vec_entity_reset(&s_gs.removed);
 }
 
-static void g_prune_water_input(struct render_input *in)
+static void g_prune_water_stat(struct render_input *in)
 {
     PERF_ENTER();
 
@@ -1260,6 +1591,17 @@ static void g_prune_water_input(struct render_input *in)
         }
     }
 
+    PERF_RETURN_VOID();
+}
+
+static void g_prune_water_anim(struct render_input *in)
+{
+    PERF_ENTER();
+
+    assert(s_gs.map);
+    assert(!s_render_work.pending);
+    uint16_t pm = g_player_mask();
+
     for(int i = vec_size(&in->cam_vis_anim) - 1; i >= 0; i--) {
 
         const struct ent_anim_rstate *rstate = &vec_AT(&in->cam_vis_anim, i);
@@ -1283,42 +1625,83 @@ static void g_prune_water_input(struct render_input *in)
     PERF_RETURN_VOID();
 }
 
-void g_delete_gpuid(uint32_t uid)
+/* Wait for the animated entities' render states and fill them into the 
+ * copies of the render input that have been pushed in the meantime. */
+static void g_render_input_join(void)
 {
-    khiter_t k = kh_get(entity, s_gs.dynamic, uid);
-    assert(k != kh_end(s_gs.dynamic));
-    kh_del(entity, s_gs.dynamic, k);
+    PERF_ENTER();
+
+    if(!s_render_work.pending)
+        PERF_RETURN_VOID();
+
+    Sched_TaskGroupJoin(&s_render_work.group);
+    s_render_work.pending = false;
+
+    struct render_input *in = &s_render_work.in;
+    g_push_anim_input(s_render_work.copy, in);
+
+    if(s_render_work.water_copy) {
+        g_prune_water_anim(in);
+        g_push_anim_input(s_render_work.water_copy, in);
+    }
+    PERF_RETURN_VOID();
+}
+
+static struct ent_record *g_record(uint32_t uid)
+{
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    assert(idx < vec_size(&s_gs.records));
+    assert(vec_AT(&s_gs.records, idx).uid == uid);
+    return &vec_AT(&s_gs.records, idx);
+}
+
+static bool g_records_extend(vec_erec_t *table, uint32_t idx)
+{
+    size_t size = vec_size(table);
+    if(idx < size)
+        return true;
 
-    k = kh_get(id, s_gs.ent_gpu_id_map, uid);
-    assert(k != kh_end(s_gs.ent_gpu_id_map));
-    uint32_t old_id = kh_value(s_gs.ent_gpu_id_map, k);
-    uint32_t old_size = kh_size(s_gs.ent_gpu_id_map);
-    kh_del(id, s_gs.ent_gpu_id_map, k);
+    if(!vec_erec_resize(table, MAX(idx + 1, table->capacity * 2)))
+        return false;
+    for(size_t i = size; i <= idx; i++) {
+        table->array[i] = (struct ent_record){ .uid = NULL_UID };
+    }
+    table->size = idx + 1;
+    return true;
+}
 
-    k = kh_get(id, s_gs.gpu_id_ent_map, old_id);
-    assert(k != kh_end(s_gs.gpu_id_ent_map));
-    kh_del(id, s_gs.gpu_id_ent_map, k);
+static struct ent_record *g_record_get_or_add(uint32_t uid)
+{
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    if(!g_records_extend(&s_gs.records, idx))
+        return NULL;
 
-    /* Make sure all existing values in the GPU ID table 
-     * are in the range of [1:table_size] */
-    k = kh_get(id, s_gs.gpu_id_ent_map, old_size);
-    if(k != kh_end(s_gs.gpu_id_ent_map)) {
+    struct ent_record *ret = &vec_AT(&s_gs.records, idx);
+    if(ret->uid != uid) {
+        *ret = (struct ent_record){ .uid = uid };
+    }
+    return ret;
+}
 
-        uint32_t uid = kh_value(s_gs.gpu_id_ent_map, k);
-        kh_del(id, s_gs.gpu_id_ent_map, k);
+void g_delete_gpuid(uint32_t uid)
+{
+    khiter_t k = kh_get(entity, s_gs.dynamic, uid);
+    assert(k != kh_end(s_gs.dynamic));
+    kh_del(entity, s_gs.dynamic, k);
 
-        k = kh_get(id, s_gs.ent_gpu_id_map, uid);
-        assert(k != kh_end(s_gs.ent_gpu_id_map));
-        kh_value(s_gs.ent_gpu_id_map, k) = old_id;
+    struct ent_record *rec = g_record(uid);
+    uint32_t old_id = rec->gpu_id;
+    assert(old_id >= 1 && old_id <= vec_size(&s_gs.gpu_id_ents));
+    rec->gpu_id = 0;
 
-        int ret;
-        k = kh_put(id, s_gs.gpu_id_ent_map, old_id, &ret);
-        assert(ret != -1);
-        kh_value(s_gs.gpu_id_ent_map, k) = uid;
+    /* Make sure all existing GPU IDs are in the range of [1:table_size] */
+    uint32_t last = vec_entity_pop(&s_gs.gpu_id_ents);
+    if(last != uid) {
+        vec_AT(&s_gs.gpu_id_ents, old_id - 1) = last;
+        g_record(last)->gpu_id = old_id;
     }
 
-    assert(kh_size(s_gs.dynamic) == kh_size(s_gs.ent_gpu_id_map));
-    assert(kh_size(s_gs.ent_gpu_id_map) == kh_size(s_gs.gpu_id_ent_map));
+    assert(kh_size(s_gs.dynamic) == vec_size(&s_gs.gpu_id_ents));
 }
 
 static void on_update_ui(void *user, void *event)
@@ -1388,6 +1771,13 @@ static void on_update_ui(void *user, void *event)
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static void g_write_perf_stats(perf_stat_cb_t emit, void *arg)
+{
+    emit("game.entities", kh_size(s_gs.active), arg);
+    emit("game.dynamic_entities", kh_size(s_gs.dynamic), arg);
+    emit("game.visible_entities", vec_size(&s_gs.visible), arg);
+}
+
 bool G_Init(void)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -1395,48 +1785,45 @@ bool G_Init(void)
     vec_entity_init(&s_gs.visible);
     vec_entity_init(&s_gs.light_visible);
     vec_obb_init(&s_gs.visible_obbs);
+    vec_entity_init(&s_gs.cull_ents);
+    vec_obb_init(&s_gs.cull_obbs);
+    vec_mask_init(&s_gs.cull_masks);
     vec_entity_init(&s_gs.removed);
+    vec_erec_init(&s_gs.records);
+    vec_entity_init(&s_gs.gpu_id_ents);
 
     s_gs.active = kh_init(entity);
     if(!s_gs.active)
         goto fail_active;
 
-    s_gs.ent_faction_map = kh_init(id);
-    if(!s_gs.ent_faction_map)
-        goto fail_faction;
-
-    s_gs.ent_visrange_map = kh_init(range);
-    if(!s_gs.ent_visrange_map)
-        goto fail_visrange;
-
-    s_gs.selection_radiuses = kh_init(range);
-    if(!s_gs.selection_radiuses)
-        goto fail_sel_rad;
-
     s_gs.dynamic = kh_init(entity);
     if(!s_gs.dynamic)
         goto fail_dynamic;
 
-    s_gs.ent_gpu_id_map = kh_init(id);
-    if(!s_gs.ent_gpu_id_map)
-        goto fail_ent_gpu_id_map;
+    s_gs.stat_rcache = kh_init(rcache);
+    if(!s_gs.stat_rcache)
+        goto fail_stat_rcache;
+
+    if(!G_Changes_Init())
+        goto fail_changes;
 
-    s_gs.gpu_id_ent_map = kh_init(id);
-    if(!s_gs.ent_gpu_id_map)
-        goto fail_gpu_id_ent_map;
+    if(!G_Orders_Init())
+        goto fail_orders;
 
-    s_gs.ent_flag_map = kh_init(id);
-    if(!s_gs.ent_flag_map)
-        goto fail_ent_flag_map;
+    if(!G_Changes_Subscribe(&s_gs.rcache_changes, CHANGE_POS | CHANGE_TRANSFORM | CHANGE_REMOVED))
+        goto fail_subscribe;
 
     if(!g_init_camera())
         goto fail_cam; 
 
-    if(!R_InitWS(&s_gs.ws[0]))
-        goto fail_ws;
-
-    if(!R_InitWS(&s_gs.ws[1])) {
-        R_DestroyWS(&s_gs.ws[0]);
+    int nws = 0;
+    for(; nws < G_MAX_PIPELINE_DEPTH; nws++) {
+        if(!R_InitWS(&s_gs.ws[nws]))
+            break;
+    }
+    if(nws < G_MAX_PIPELINE_DEPTH) {
+        while(nws--)
+            R_DestroyWS(&s_gs.ws[nws]);
         goto fail_ws;
     }
 
@@ -1445,13 +1832,16 @@ bool G_Init(void)
     G_Sel_Init();
     G_Sel_Enable();
     G_Timer_Init();
+    G_ResTable_Init();
     G_StorageSite_Init();
     g_create_settings();
+    Perf_AddStatsSource(g_write_perf_stats);
 
     R_PushCmd((struct rcmd){ R_GL_WaterInit, 0 });
 
-    s_gs.prev_tick_map = NULL;
+    memset(s_gs.prev_tick_map, 0, sizeof(s_gs.prev_tick_map));
     s_gs.curr_ws_idx = 0;
+    s_gs.render_ws_idx = G_MAX_PIPELINE_DEPTH - 1;
     s_gs.light_pos = (vec3_t){120.0f, 150.0f, 120.0f};
     s_gs.ss = G_RUNNING;
     s_gs.requested_ss = G_RUNNING;
@@ -1463,22 +1853,20 @@ bool G_Init(void)
 fail_ws:
     Camera_Free(s_gs.active_cam);
 fail_cam:
-    kh_destroy(id, s_gs.ent_flag_map);
-fail_ent_flag_map:
-    kh_destroy(id, s_gs.gpu_id_ent_map);
-fail_gpu_id_ent_map:
-    kh_destroy(id, s_gs.ent_gpu_id_map);
-fail_ent_gpu_id_map:
+    G_Changes_Unsubscribe(&s_gs.rcache_changes);
+fail_subscribe:
+    G_Orders_Shutdown();
+fail_orders:
+    G_Changes_Shutdown();
+fail_changes:
+    kh_destroy(rcache, s_gs.stat_rcache);
+fail_stat_rcache:
     kh_destroy(entity, s_gs.dynamic);
 fail_dynamic:
-    kh_destroy(range, s_gs.selection_radiuses);
-fail_sel_rad:
-    kh_destroy(range, s_gs.ent_visrange_map);
-fail_visrange:
-    kh_destroy(id, s_gs.ent_faction_map);
-fail_faction:
     kh_destroy(entity, s_gs.active);
 fail_active:
+    vec_entity_destroy(&s_gs.gpu_id_ents);
+    vec_erec_destroy(&s_gs.records);
     return false;
 }
 
@@ -1490,16 +1878,20 @@ bool G_LoadMap(SDL_RWops *stream, bool update_navgrid)
     g_clear_map_state();
 
     size_t copysize = AL_MapShallowCopySize(stream);
-    s_gs.prev_tick_map = malloc(copysize);
-    if(!s_gs.prev_tick_map)
-        PERF_RETURN(false);
+    for(int i = 0; i < G_MAX_PIPELINE_DEPTH; i++) {
+        s_gs.prev_tick_map[i] = malloc(copysize);
+        if(!s_gs.prev_tick_map[i])
+            PERF_RETURN(false);
+    }
 
     s_gs.map = AL_MapFromPFMapStream(stream, update_navgrid);
     if(!s_gs.map)
         PERF_RETURN(false);
 
     g_init_map();
-    M_AL_ShallowCopy((struct map*)s_gs.prev_tick_map, s_gs.map);
+    for(int i = 0; i < G_MAX_PIPELINE_DEPTH; i++) {
+        M_AL_ShallowCopy((struct map*)s_gs.prev_tick_map[i], s_gs.map);
+    }
 
     E_Global_Notify(EVENT_NEW_GAME, s_gs.map, ES_ENGINE);
 
@@ -1536,17 +1928,16 @@ void G_ClearState(void)
 
     kh_clear(entity, s_gs.active);
     kh_clear(entity, s_gs.dynamic);
-    kh_clear(id, s_gs.ent_gpu_id_map);
-    kh_clear(id, s_gs.gpu_id_ent_map);
-    kh_clear(id, s_gs.ent_faction_map);
-    kh_clear(id, s_gs.ent_flag_map);
-    kh_clear(range, s_gs.ent_visrange_map);
-    kh_clear(range, s_gs.selection_radiuses);
+    vec_entity_reset(&s_gs.gpu_id_ents);
+    vec_erec_reset(&s_gs.records);
+    kh_clear(rcache, s_gs.stat_rcache);
     vec_entity_reset(&s_gs.visible);
     vec_entity_reset(&s_gs.light_visible);
     vec_obb_reset(&s_gs.visible_obbs);
 
     g_clear_map_state();
+    G_Changes_Clear();
+    G_Orders_Clear();
     M_MinimapClearBorderClr();
 
     g_reset_camera(s_gs.active_cam);
@@ -1559,6 +1950,7 @@ void G_ClearState(void)
     s_gs.factions_allocd = 0;
     s_gs.hide_healthbars = false;
     s_gs.minimap_render_all = false;
+    s_gs.minimap_units_tick = 0;
     s_gs.show_unit_icons = false;
 
     vec3_t white = (vec3_t){1.0f, 1.0f, 1.0f};
@@ -1592,8 +1984,11 @@ bool G_HasWork(void)
 void G_ClearRenderWork(void)
 {
     Engine_WaitRenderWorkDone();
-    R_ClearWS(&s_gs.ws[0]);
-    R_ClearWS(&s_gs.ws[1]);
+    for(int i = 0; i < G_MAX_PIPELINE_DEPTH; i++) {
+        R_ClearWS(&s_gs.ws[i]);
+    }
+    /* Drop any workspaces that were queued up */
+    s_gs.render_ws_idx = (s_gs.curr_ws_idx + G_MAX_PIPELINE_DEPTH - 1) % G_MAX_PIPELINE_DEPTH;
 }
 
 bool G_GetMinimapPos(float *out_x, float *out_y)
@@ -1658,6 +2053,7 @@ void G_SetMinimapRenderAllEntities(bool on)
 {
     ASSERT_IN_MAIN_THREAD();
     s_gs.minimap_render_all = on;
+    s_gs.minimap_units_tick = 0;
 }
 
 bool G_MouseOverMinimap(void)
@@ -1694,6 +2090,15 @@ bool G_MapClosestPathable(vec2_t xz, vec2_t *out, enum nav_layer layer)
     return M_NavClosestPathable(s_gs.map, layer, xz, out);
 }
 
+bool G_MapNavBenchmark(const struct nav_bench_desc *desc, struct nav_bench_result *out)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gs.map)
+        return false;
+    return M_NavBenchmark(s_gs.map, desc, out);
+}
+
 bool G_PointInsideMap(vec2_t xz)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -1771,14 +2176,17 @@ void G_Shutdown(void)
     ASSERT_IN_MAIN_THREAD();
 
     E_Global_Unregister(EVENT_UPDATE_UI, on_update_ui);
+    Perf_RemoveStatsSource(g_write_perf_stats);
     G_ClearState();
 
-    R_DestroyWS(&s_gs.ws[0]);
-    R_DestroyWS(&s_gs.ws[1]);
+    for(int i = 0; i < G_MAX_PIPELINE_DEPTH; i++) {
+        R_DestroyWS(&s_gs.ws[i]);
+    }
 
     R_PushCmd((struct rcmd){ R_GL_WaterShutdown, 0 });
 
     G_StorageSite_Shutdown();
+    G_ResTable_Shutdown();
     G_Timer_Shutdown();
     G_Sel_Shutdown();
 
@@ -1786,15 +2194,18 @@ void G_Shutdown(void)
 
     kh_destroy(entity, s_gs.active);
     kh_destroy(entity, s_gs.dynamic);
-    kh_destroy(id, s_gs.ent_gpu_id_map);
-    kh_destroy(id, s_gs.gpu_id_ent_map);
-    kh_destroy(id, s_gs.ent_faction_map);
-    kh_destroy(id, s_gs.ent_flag_map);
-    kh_destroy(range, s_gs.ent_visrange_map);
-    kh_destroy(range, s_gs.selection_radiuses);
+    vec_entity_destroy(&s_gs.gpu_id_ents);
+    vec_erec_destroy(&s_gs.records);
+    G_Changes_Unsubscribe(&s_gs.rcache_changes);
+    G_Orders_Shutdown();
+    G_Changes_Shutdown();
+    kh_destroy(rcache, s_gs.stat_rcache);
     vec_entity_destroy(&s_gs.light_visible);
     vec_entity_destroy(&s_gs.visible);
     vec_obb_destroy(&s_gs.visible_obbs);
+    vec_entity_destroy(&s_gs.cull_ents);
+    vec_obb_destroy(&s_gs.cull_obbs);
+    vec_mask_destroy(&s_gs.cull_masks);
     vec_entity_destroy(&s_gs.removed);
 }
 
@@ -1803,9 +2214,14 @@ void G_Update(void)
     PERF_ENTER();
     ASSERT_IN_MAIN_THREAD();
 
+    G_Orders_Apply();
+    G_Snapshot_Invalidate();
+
     if(s_gs.map) {
         M_Update(s_gs.map);
+        PERF_PUSH("fog::update_vision_state");
         G_Fog_UpdateVisionState();
+        PERF_POP();
     }
 
     vec_entity_reset(&s_gs.visible);
@@ -1815,11 +2231,10 @@ void G_Update(void)
     vec3_t pos = Camera_GetPos(s_gs.active_cam);
     vec3_t dir = Camera_GetDir(s_gs.active_cam);
 
-    struct frustum cam_frust;
-    Camera_MakeFrustum(s_gs.active_cam, &cam_frust);
-
-    struct frustum light_frust;
-    R_LightVisibilityFrustum(s_gs.active_cam, &light_frust);
+    enum{ FRUST_CAM, FRUST_LIGHT, NFRUSTA };
+    struct frustum frusta[NFRUSTA];
+    Camera_MakeFrustum(s_gs.active_cam, &frusta[FRUST_CAM]);
+    R_LightVisibilityFrustum(s_gs.active_cam, &frusta[FRUST_LIGHT]);
 
     uint16_t pm = g_player_mask();
     uint32_t curr;
@@ -1828,33 +2243,62 @@ void G_Update(void)
         A_Update();
     }
 
+    size_t nactive = kh_size(s_gs.active);
+    vec_entity_reset(&s_gs.cull_ents);
+    vec_obb_reset(&s_gs.cull_obbs);
+    vec_mask_reset(&s_gs.cull_masks);
+
+    if(!vec_entity_resize(&s_gs.cull_ents, nactive)
+    || !vec_obb_resize(&s_gs.cull_obbs, nactive)
+    || !vec_mask_resize(&s_gs.cull_masks, nactive)) {
+        nactive = 0;
+    }
+
+    size_t ncull = 0;
     kh_foreach_key(s_gs.active, curr, {
+        if(ncull == nactive)
+            break;
+        vec_AT(&s_gs.cull_ents, ncull) = curr;
+        Entity_CurrentOBB(curr, &vec_AT(&s_gs.cull_obbs, ncull), false);
+        ncull++;
+    });
 
-        struct obb obb;
-        Entity_CurrentOBB(curr, &obb, false);
-        bool vis_checked = false;
-        bool vis = false;
+    C_FrustumOBBCullFast(NFRUSTA, frusta, ncull, s_gs.cull_obbs.array, s_gs.cull_masks.array);
+
+    bool occlusion = s_gs.map && s_occlusion_culling.as_bool;
+    if(occlusion) {
+        M_Occlusion_Update(s_gs.map, s_gs.active_cam);
+    }
+
+    for(int i = 0; i < ncull; i++) {
+
+        uint8_t mask = vec_AT(&s_gs.cull_masks, i);
+        if(!mask)
+            continue;
+
+        curr = vec_AT(&s_gs.cull_ents, i);
+        const struct obb *obb = &vec_AT(&s_gs.cull_obbs, i);
+
+        /* Entities hidden behind the terrain may still cast visible shadows, 
+         * so only the camera visibility is dropped. */
+        if(occlusion && (mask & (1 << FRUST_CAM)) && M_Occlusion_OBBHidden(obb)) {
+            mask &= ~(1 << FRUST_CAM);
+        }
 
         /* Note that there may be some false positives due to using the fast frustum cull. */
-        if(C_FrustumOBBIntersectionFast(&cam_frust, &obb) != VOLUME_INTERSEC_OUTSIDE) {
-            vis = g_ent_visible(pm, curr, &obb);
-            vis_checked = true;
-            if(vis) {
-                vec_entity_push(&s_gs.visible, curr);
-                vec_obb_push(&s_gs.visible_obbs, obb);
-            }
+        bool vis = g_ent_visible(pm, curr, obb);
+        if(vis && (mask & (1 << FRUST_CAM))) {
+            vec_entity_push(&s_gs.visible, curr);
+            vec_obb_push(&s_gs.visible_obbs, *obb);
         }
 
-        if(C_FrustumOBBIntersectionFast(&light_frust, &obb) != VOLUME_INTERSEC_OUTSIDE) {
-            if(!vis_checked) {
-                vis = g_ent_visible(pm, curr, &obb);
-            }
+        if(mask & (1 << FRUST_LIGHT)) {
             uint32_t flags = G_FlagsGet(curr);
             if(vis || !(flags & ENTITY_FLAG_MOVABLE)) {
                 vec_entity_push(&s_gs.light_visible, curr);
             }
         }
-    });
+    }
 
     if(s_gs.map) {
         G_Region_Update();
@@ -1865,6 +2309,11 @@ void G_Update(void)
     g_set_contextual_cursor();
 
     E_Global_NotifyImmediate(EVENT_UPDATE_UI, NULL, ES_ENGINE);
+    G_Changes_Trim();
+
+    /* All the handlers for this tick have run. This is the one place 
+     * where a script collection pause doesn't interrupt anything. */
+    S_GC_Step();
 
     PERF_RETURN_VOID();
 }
@@ -1873,42 +2322,41 @@ void G_Render(void)
 {
     PERF_ENTER();
     ASSERT_IN_MAIN_THREAD();
-    ss_e status;
-    (void)status;
 
     R_PushCmd((struct rcmd){ R_GL_BeginFrame, 0 });
     E_Global_NotifyImmediate(EVENT_RENDER_3D_PRE, NULL, ES_ENGINE);
 
-    struct render_input in;
-    g_create_render_input(&in);
-
-    struct render_input *rcopy = g_push_render_input(in);
-    G_RenderMapAndEntities(rcopy);
+    struct render_input *in = &s_render_work.in;
+    g_create_render_input(in);
 
-    struct sval refract_setting;
-    status = Settings_Get("pf.video.water_refraction", &refract_setting);
-    assert(status == SS_OKAY);
-
-    struct sval reflect_setting;
-    status = Settings_Get("pf.video.water_reflection", &reflect_setting);
-    assert(status == SS_OKAY);
+    in->pick = true;
+    s_render_work.copy = g_push_render_input(in);
+    s_render_work.water_copy = NULL;
+#if !CONFIG_USE_BATCH_RENDERING
+    /* The draw commands of every entity are pushed right away */
+    g_render_input_join();
+#endif
+    G_RenderMapAndEntities(s_render_work.copy);
+    in->pick = false;
 
     if(s_gs.map && M_WaterMaybeVisible(s_gs.map, s_gs.active_cam)) {
 
-        g_prune_water_input(&in);
-        struct render_input *water_rcopy = g_push_render_input(in);
+        g_prune_water_stat(in);
+        if(!s_render_work.pending) {
+            g_prune_water_anim(in);
+        }
+        s_render_work.water_copy = g_push_render_input(in);
 
         R_PushCmd((struct rcmd){
             .func = R_GL_DrawWater,
             .nargs = 3,
             .args = { 
-                water_rcopy,
-                R_PushArg(&refract_setting.as_bool, sizeof(bool)),
-                R_PushArg(&reflect_setting.as_bool, sizeof(bool)),
+                s_render_work.water_copy,
+                R_PushArg(&s_water_refraction.as_bool, sizeof(bool)),
+                R_PushArg(&s_water_reflection.as_bool, sizeof(bool)),
             },
         });
     }
-    g_destroy_render_input(&in);
 
     enum selection_type sel_type;
     const vec_entity_t *selected = G_Sel_Get(&sel_type);
@@ -1930,7 +2378,7 @@ void G_Render(void)
                     R_PushArg(&obb, sizeof(obb)),
                     R_PushArg(&width, sizeof(width)),
                     R_PushArg(&g_seltype_color_map[sel_type], sizeof(g_seltype_color_map[0])),
-                    (void*)s_gs.prev_tick_map,
+                    (void*)G_GetPrevTickMap(),
                 },
             });
         }else{
@@ -1944,12 +2392,17 @@ void G_Render(void)
                     R_PushArg(&sel_radius, sizeof(sel_radius)),
                     R_PushArg(&width, sizeof(width)),
                     R_PushArg(&g_seltype_color_map[sel_type], sizeof(g_seltype_color_map[0])),
-                    (void*)s_gs.prev_tick_map,
+                    (void*)G_GetPrevTickMap(),
                 },
             });
         }
     }
 
+    /* The event handlers are free to add, move or remove entities, 
+     * so the workers must be done reading their state by then */
+    g_render_input_join();
+    g_destroy_render_input(in);
+
     E_Global_NotifyImmediate(EVENT_RENDER_3D_POST, NULL, ES_ENGINE);
     R_PushCmd((struct rcmd) { R_GL_SetScreenspaceDrawMode, 0 });
 
@@ -1983,60 +2436,70 @@ void G_FlagsSet(uint32_t uid, uint32_t flags)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    khiter_t k = kh_get(id, s_gs.ent_flag_map, uid);
-    if(k == kh_end(s_gs.ent_flag_map)) {
-        int status;
-        k = kh_put(id, s_gs.ent_flag_map, uid, &status);
-        assert(status != -1);
+    struct ent_record *rec = g_record_get_or_add(uid);
+    assert(rec);
+    if(rec->flags != flags) {
+        /* Garrisoning and the subsystem flags factor into idleness */
+        G_Automation_NotifyStateChanged(uid);
     }
-    kh_value(s_gs.ent_flag_map, k) = flags;
+    rec->flags = flags;
+    G_Changes_Mark(uid, CHANGE_FLAGS);
 }
 
 uint32_t G_FlagsGet(uint32_t uid)
 {
-    khiter_t k = kh_get(id, s_gs.ent_flag_map, uid);
-    assert(k != kh_end(s_gs.ent_flag_map));
-    return kh_value(s_gs.ent_flag_map, k);
+    return g_record(uid)->flags;
 }
 
-uint32_t G_FlagsGetFrom(khash_t(id) *table, uint32_t uid)
+uint32_t G_FlagsGetFrom(const vec_erec_t *table, uint32_t uid)
 {
-    khiter_t k = kh_get(id, table, uid);
-    assert(k != kh_end(table));
-    return kh_value(table, k);
+    return G_RecordFrom(table, uid)->flags;
 }
 
-khash_t(id) *G_FlagsCopyTable(void)
+bool G_RecordsCopy(vec_erec_t *out)
 {
-    return kh_copy_id(s_gs.ent_flag_map);
+    return vec_erec_copy(out, &s_gs.records);
 }
 
-bool G_AddEntity(uint32_t uid, uint32_t flags, vec3_t pos)
+struct ent_record G_RecordGet(uint32_t uid)
 {
-    ASSERT_IN_MAIN_THREAD();
-    assert(!(flags & ENTITY_FLAG_BUILDING) || !(flags & ENTITY_FLAG_BUILDER));
+    return *g_record(uid);
+}
 
-    int ret;
-    khiter_t k;
+struct ent_record *G_RecordFrom(const vec_erec_t *table, uint32_t uid)
+{
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    assert(idx < vec_size(table));
+    assert(table->array[idx].uid == uid);
+    return &table->array[idx];
+}
 
-    k = kh_put(entity, s_gs.active, uid, &ret);
-    if(ret == -1 || ret == 0)
+bool G_RecordSetIn(vec_erec_t *table, struct ent_record rec)
+{
+    uint32_t idx = ENTITY_UID_INDEX(rec.uid);
+    if(!g_records_extend(table, idx))
         return false;
+    table->array[idx] = rec;
+    return true;
+}
 
-    k = kh_put(id, s_gs.ent_faction_map, uid, &ret);
-    if(ret == -1 || ret == 0)
-        return false;
-    kh_value(s_gs.ent_faction_map, k) = 0;
+bool G_AddEntity(uint32_t uid, uint32_t flags, vec3_t pos)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!(flags & ENTITY_FLAG_BUILDING) || !(flags & ENTITY_FLAG_BUILDER));
 
-    k = kh_put(range, s_gs.ent_visrange_map, uid, &ret);
+    int ret;
+    kh_put(entity, s_gs.active, uid, &ret);
     if(ret == -1 || ret == 0)
         return false;
-    kh_value(s_gs.ent_visrange_map, k) = 0.0f;
 
-    k = kh_put(range, s_gs.selection_radiuses, uid, &ret);
-    if(ret == -1 || ret == 0)
+    struct ent_record *rec = g_record_get_or_add(uid);
+    if(!rec)
         return false;
-    kh_value(s_gs.selection_radiuses, k) = 0.0f;
+    rec->faction_id = 0;
+    rec->vision_range = 0.0f;
+    rec->sel_radius = 0.0f;
+    rec->gpu_id = 0;
 
     G_FlagsSet(uid, flags);
     G_Pos_Set(uid, pos);
@@ -2070,22 +2533,15 @@ bool G_AddEntity(uint32_t uid, uint32_t flags, vec3_t pos)
 
     if(flags & ENTITY_FLAG_MOVABLE) {
     
-        k = kh_put(entity, s_gs.dynamic, uid, &ret);
+        kh_put(entity, s_gs.dynamic, uid, &ret);
         assert(ret != -1 && ret != 0);
 
         G_Move_AddEntity(uid, pos, 0.0f, 0);
 
-        uint32_t gpu_id = kh_size(s_gs.ent_gpu_id_map) + 1;
-        k = kh_put(id, s_gs.ent_gpu_id_map, uid, &ret);
-        assert(ret != -1 && ret != 0);
-        kh_value(s_gs.ent_gpu_id_map, k) = gpu_id;
-
-        k = kh_put(id, s_gs.gpu_id_ent_map, gpu_id, &ret);
-        assert(ret != -1 && ret != 0);
-        kh_value(s_gs.gpu_id_ent_map, k) = uid;
-
-        assert(kh_size(s_gs.dynamic) == kh_size(s_gs.ent_gpu_id_map));
-        assert(kh_size(s_gs.ent_gpu_id_map) == kh_size(s_gs.gpu_id_ent_map));
+        ret = vec_entity_push(&s_gs.gpu_id_ents, uid);
+        assert(ret);
+        g_record(uid)->gpu_id = vec_size(&s_gs.gpu_id_ents);
+        assert(kh_size(s_gs.dynamic) == vec_size(&s_gs.gpu_id_ents));
 
         G_Formation_SetPreferred(uid, FORMATION_NONE);
     }
@@ -2097,6 +2553,7 @@ bool G_AddEntity(uint32_t uid, uint32_t flags, vec3_t pos)
         G_Automation_AddEntity(uid);
     }
 
+    G_Changes_Mark(uid, CHANGE_ADDED);
     return true;
 }
 
@@ -2124,6 +2581,7 @@ bool G_RemoveEntity(uint32_t uid)
         vec_entity_del(&s_gs.light_visible, idx);
     }
 
+    G_Changes_Mark(uid, CHANGE_REMOVED);
     A_RemoveEntity(uid);
     G_Sel_Remove(uid);
     G_Move_RemoveEntity(uid);
@@ -2141,20 +2599,67 @@ bool G_RemoveEntity(uint32_t uid)
     G_Pos_Delete(uid);
     Entity_Remove(uid);
 
-    k = kh_get(id, s_gs.ent_faction_map, uid);
-    assert(k != kh_end(s_gs.ent_faction_map));
-    kh_del(id, s_gs.ent_faction_map, k);
+    G_Sel_MarkHoveredDirty();
+    return true;
+}
 
-    k = kh_get(range, s_gs.ent_visrange_map, uid);
-    assert(k != kh_end(s_gs.ent_visrange_map));
-    kh_del(range, s_gs.ent_visrange_map, k);
+void G_BeginEntityBatch(size_t nents)
+{
+    ASSERT_IN_MAIN_THREAD();
 
-    k = kh_get(range, s_gs.selection_radiuses, uid);
-    assert(k != kh_end(s_gs.selection_radiuses));
-    kh_del(range, s_gs.selection_radiuses, k);
+    if(s_gs.batch_depth++ == 0) {
+        M_NavBlockersBeginBatch();
+        G_Fog_BeginBatch();
+        G_Region_BeginBatch();
+    }
+    if(!nents)
+        return;
 
-    G_Sel_MarkHoveredDirty();
-    return true;
+    /* Stay under the load factor at which the tables would grow */
+    size_t nactive = kh_size(s_gs.active) + nents;
+    kh_resize(entity, s_gs.active, nactive + nactive / 3 + 1);
+    vec_erec_resize(&s_gs.records, MAX(s_gs.records.capacity, nactive));
+    G_Pos_Reserve(nents);
+}
+
+void G_EndEntityBatch(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_gs.batch_depth > 0);
+
+    if(--s_gs.batch_depth > 0)
+        return;
+
+    /* The regions go last, as entering them notifies the scripts, 
+     * which should see the blockers and the fog up-to-date */
+    M_NavBlockersEndBatch();
+    G_Fog_EndBatch();
+    G_Region_EndBatch();
+}
+
+size_t G_AddEntities(size_t nents, const uint32_t *uids, const uint32_t *flags, 
+                     const vec3_t *pos)
+{
+    size_t ret = 0;
+    G_BeginEntityBatch(nents);
+    for(int i = 0; i < nents; i++) {
+        if(G_AddEntity(uids[i], flags[i], pos[i]))
+            ret++;
+    }
+    G_EndEntityBatch();
+    return ret;
+}
+
+size_t G_RemoveEntities(size_t nents, const uint32_t *uids)
+{
+    size_t ret = 0;
+    G_BeginEntityBatch(0);
+    for(int i = 0; i < nents; i++) {
+        if(G_RemoveEntity(uids[i]))
+            ret++;
+    }
+    G_EndEntityBatch();
+    return ret;
 }
 
 void G_StopEntity(uint32_t uid, bool stop_move, bool stop_garrison)
@@ -2193,24 +2698,27 @@ void G_FreeEntity(uint32_t uid)
 {
     ASSERT_IN_MAIN_THREAD();
     AL_EntityFree(uid);
+
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    if(idx < vec_size(&s_gs.records) && vec_AT(&s_gs.records, idx).uid == uid) {
+        vec_AT(&s_gs.records, idx).uid = NULL_UID;
+    }
 }
 
 uint32_t G_GPUIDForEnt(uint32_t uid)
 {
     ASSERT_IN_MAIN_THREAD();
-    khiter_t k = kh_get(id, s_gs.ent_gpu_id_map, uid);
-    if(k == kh_end(s_gs.ent_gpu_id_map))
+    uint32_t idx = ENTITY_UID_INDEX(uid);
+    if(idx >= vec_size(&s_gs.records) || vec_AT(&s_gs.records, idx).uid != uid)
         return 0;
-    return kh_value(s_gs.ent_gpu_id_map, k);
+    return vec_AT(&s_gs.records, idx).gpu_id;
 }
 
 uint32_t G_EntForGPUID(uint32_t gpuid)
 {
     ASSERT_IN_MAIN_THREAD();
     assert(gpuid >= 1 && gpuid <= kh_size(G_GetDynamicEntsSet()));
-    khiter_t k = kh_get(id, s_gs.gpu_id_ent_map, gpuid);
-    assert(k != kh_end(s_gs.gpu_id_ent_map));
-    return kh_value(s_gs.gpu_id_ent_map, k);
+    return vec_AT(&s_gs.gpu_id_ents, gpuid - 1);
 }
 
 bool G_AddFaction(const char *name, vec3_t color)
@@ -2339,9 +2847,7 @@ void G_SetFactionID(uint32_t uid, int faction_id)
     if(old == faction_id)
         return;
 
-    khiter_t k = kh_get(id, s_gs.ent_faction_map, uid);
-    assert(k != kh_end(s_gs.ent_faction_map));
-    kh_value(s_gs.ent_faction_map, k) = faction_id;
+    g_record(uid)->faction_id = faction_id;
 
     vec2_t xz_pos = G_Pos_GetXZ(uid);
     float vrange = G_GetVisionRange(uid);
@@ -2354,79 +2860,56 @@ void G_SetFactionID(uint32_t uid, int faction_id)
     G_StorageSite_UpdateFaction(uid, old, faction_id);
     G_Resource_UpdateFactionID(uid, old, faction_id);
     G_Building_UpdateFactionID(uid, old, faction_id);
+    G_Changes_Mark(uid, CHANGE_FACTION);
 }
 
 int G_GetFactionID(uint32_t uid)
 {
-    khiter_t k = kh_get(id, s_gs.ent_faction_map, uid);
-    assert(k != kh_end(s_gs.ent_faction_map));
-    return kh_value(s_gs.ent_faction_map, k);
+    return g_record(uid)->faction_id;
 }
 
-khash_t(id) *G_FactionIDCopyTable(void)
+int G_GetFactionIDFrom(const vec_erec_t *table, uint32_t uid)
 {
-    return kh_copy_id(s_gs.ent_faction_map);
-}
-
-int G_GetFactionIDFrom(khash_t(id) *table, uint32_t uid)
-{
-    khiter_t k = kh_get(id, table, uid);
-    assert(k != kh_end(table));
-    return kh_value(table, k);
+    return G_RecordFrom(table, uid)->faction_id;
 }
 
 void G_SetVisionRange(uint32_t uid, float range)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    khiter_t k = kh_get(range, s_gs.ent_visrange_map, uid);
-    assert(k != kh_end(s_gs.ent_visrange_map));
-
-    float oldrange = kh_value(s_gs.ent_visrange_map, k);
+    struct ent_record *rec = g_record(uid);
+    float oldrange = rec->vision_range;
     vec2_t xz_pos = G_Pos_GetXZ(uid);
 
-    G_Fog_UpdateVisionRange(xz_pos, G_GetFactionID(uid), oldrange, range);
-    kh_value(s_gs.ent_visrange_map, k) = range;
+    G_Fog_UpdateVisionRange(xz_pos, rec->faction_id, oldrange, range);
+    rec->vision_range = range;
 }
 
 float G_GetVisionRange(uint32_t uid)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    khiter_t k = kh_get(range, s_gs.ent_visrange_map, uid);
-    assert(k != kh_end(s_gs.ent_visrange_map));
-    return kh_value(s_gs.ent_visrange_map, k);
+    return g_record(uid)->vision_range;
 }
 
 void G_SetSelectionRadius(uint32_t uid, float range)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    khiter_t k = kh_get(range, s_gs.selection_radiuses, uid);
-    assert(k != kh_end(s_gs.selection_radiuses));
-
     G_Move_UpdateSelectionRadius(uid, range);
     G_Resource_UpdateSelectionRadius(uid, range);
-    kh_value(s_gs.selection_radiuses, k) = range;
+    g_record(uid)->sel_radius = range;
+    G_Changes_Mark(uid, CHANGE_SEL_RADIUS);
 }
 
 float G_GetSelectionRadius(uint32_t uid)
 {
-    khiter_t k = kh_get(range, s_gs.selection_radiuses, uid);
-    assert(k != kh_end(s_gs.selection_radiuses));
-    return kh_value(s_gs.selection_radiuses, k);
+    return g_record(uid)->sel_radius;
 }
 
-khash_t(range) *G_SelectionRadiusCopyTable(void)
+float G_GetSelectionRadiusFrom(const vec_erec_t *table, uint32_t uid)
 {
-    return kh_copy_range(s_gs.selection_radiuses);
-}
-
-float G_GetSelectionRadiusFrom(khash_t(range) *table, uint32_t uid)
-{
-    khiter_t k = kh_get(range, table, uid);
-    assert(k != kh_end(table));
-    return kh_value(table, k);
+    return G_RecordFrom(table, uid)->sel_radius;
 }
 
 bool G_SetDiplomacyState(int fac_id_a, int fac_id_b, enum diplomacy_state ds)
@@ -2552,6 +3035,15 @@ bool G_UpdateTile(const struct tile_desc *desc, const struct tile *tile)
     return M_AL_UpdateTile(s_gs.map, desc, tile);
 }
 
+bool G_UpdateTiles(size_t ntiles, const struct tile_desc *descs, const struct tile *tiles)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gs.map)
+        return false;
+    return M_AL_UpdateTiles(s_gs.map, ntiles, descs, tiles);
+}
+
 bool G_GetTile(const struct tile_desc *desc, struct tile *out)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -2672,6 +3164,33 @@ bool G_EntityExists(uint32_t uid)
     return (k != kh_end(s_gs.active));
 }
 
+uint64_t G_StateHash(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    /* The per-entity hashes are summed, so that the result does not 
+     * depend on the iteration order of the entity table */
+    uint64_t ret = G_Move_StateHash();
+    uint32_t uid;
+
+    kh_foreach_key(s_gs.active, uid, {
+
+        uint32_t flags = G_FlagsGet(uid);
+        int faction_id = G_GetFactionID(uid);
+        vec3_t pos = G_Pos_Get(uid);
+        int hp = (flags & ENTITY_FLAG_COMBATABLE) ? G_Combat_GetCurrentHP(uid) : 0;
+
+        uint64_t hash = 0xcbf29ce484222325ull;
+        hash = g_hash_bytes(hash, &uid, sizeof(uid));
+        hash = g_hash_bytes(hash, &flags, sizeof(flags));
+        hash = g_hash_bytes(hash, &faction_id, sizeof(faction_id));
+        hash = g_hash_bytes(hash, &pos, sizeof(pos));
+        hash = g_hash_bytes(hash, &hp, sizeof(hp));
+        ret += hash;
+    });
+    return ret;
+}
+
 bool G_EntityIsZombie(uint32_t uid)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -2697,28 +3216,64 @@ struct render_workspace *G_GetSimWS(void)
 
 struct render_workspace *G_GetRenderWS(void)
 {
-    return &s_gs.ws[(s_gs.curr_ws_idx + 1) % 2];
+    return &s_gs.ws[s_gs.render_ws_idx];
 }
 
-void G_SwapBuffers(void)
+static void g_submit_sim_ws(void)
 {
-    ASSERT_IN_MAIN_THREAD();
-
-    int sim_idx = s_gs.curr_ws_idx;
-    int render_idx = (sim_idx + 1) % 2;
+    int next = (s_gs.curr_ws_idx + 1) % G_MAX_PIPELINE_DEPTH;
+    assert(next != s_gs.render_ws_idx);
 
     if(s_gs.map) {
-        M_AL_ShallowCopy((struct map*)s_gs.prev_tick_map, s_gs.map);
+        M_AL_RefreshShallowCopy((struct map*)s_gs.prev_tick_map[next], s_gs.map);
     }
 
     g_remove_queued();
-    assert(queue_size(s_gs.ws[render_idx].commands) == 0);
-    R_ClearWS(&s_gs.ws[render_idx]);
-    s_gs.curr_ws_idx = render_idx;
+    s_gs.curr_ws_idx = next;
 
     g_change_simstate();
 }
 
+void G_SwapBuffers(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    G_RetireRenderBuffers();
+    g_submit_sim_ws();
+}
+
+void G_QueueBuffers(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(G_CanQueueBuffers());
+
+    g_submit_sim_ws();
+}
+
+bool G_CanQueueBuffers(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    /* The workspace being rendered is one of the 'pipeline_depth' */
+    return (G_NumQueuedBuffers() + 2 < s_gs.pipeline_depth);
+}
+
+int G_NumQueuedBuffers(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    return (s_gs.curr_ws_idx - s_gs.render_ws_idx - 1 + G_MAX_PIPELINE_DEPTH) 
+         % G_MAX_PIPELINE_DEPTH;
+}
+
+void G_RetireRenderBuffers(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    int render_idx = s_gs.render_ws_idx;
+    assert(R_WSDone(&s_gs.ws[render_idx]));
+    R_ClearWS(&s_gs.ws[render_idx]);
+    s_gs.render_ws_idx = (render_idx + 1) % G_MAX_PIPELINE_DEPTH;
+}
+
 bool G_MapLoaded(void)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -2728,7 +3283,7 @@ bool G_MapLoaded(void)
 const struct map *G_GetPrevTickMap(void)
 {
     ASSERT_IN_MAIN_THREAD();
-    return s_gs.prev_tick_map;
+    return s_gs.prev_tick_map[s_gs.curr_ws_idx];
 }
 
 bool G_MouseInTargetMode(void)
@@ -2788,6 +3343,7 @@ void G_UpdateBounds(uint32_t uid)
 {
     ASSERT_IN_MAIN_THREAD();
 
+    G_Changes_Mark(uid, CHANGE_TRANSFORM);
     if(!G_EntityExists(uid))
         return;
 
@@ -2805,6 +3361,15 @@ bool G_GetShowUnitIcons(void)
     return s_gs.show_unit_icons;
 }
 
+bool G_WriteMapNavData(SDL_RWops *stream)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gs.map)
+        return false;
+    return M_AL_WriteNavData(s_gs.map, stream);
+}
+
 bool G_SaveGlobalState(SDL_RWops *stream)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -2815,9 +3380,15 @@ bool G_SaveGlobalState(SDL_RWops *stream)
     };
     CHK_TRUE_RET(Attr_Write(stream, &hasmap, "has_map"));
 
+    /* The navigation data is loaded along with the map */
+    Session_ProfileBegin("map", stream);
     if(hasmap.val.as_bool && !M_AL_WritePFMap(s_gs.map, stream))
         return false;
 
+    if(hasmap.val.as_bool && !M_AL_WriteNavData(s_gs.map, stream))
+        return false;
+    Session_ProfileEnd(stream);
+
     if(hasmap.val.as_bool) {
     
         vec2_t mm_pos;
@@ -2849,7 +3420,9 @@ bool G_SaveGlobalState(SDL_RWops *stream)
         };
         CHK_TRUE_RET(Attr_Write(stream, &highlight_size, "highlight_size"));
 
+        Session_ProfileBegin("fog", stream);
         CHK_TRUE_RET(G_Fog_SaveState(stream));
+        Session_ProfileEnd(stream);
     }
 
     Sched_TryYield();
@@ -2981,8 +3554,10 @@ bool G_SaveGlobalState(SDL_RWops *stream)
 
     Sched_TryYield();
 
+    Session_ProfileBegin("regions", stream);
     if(!G_Region_SaveState(stream))
         return false;
+    Session_ProfileEnd(stream);
 
     return true;
 }
@@ -2997,7 +3572,9 @@ bool G_LoadGlobalState(SDL_RWops *stream)
     Sched_TryYield();
 
     if(attr.val.as_bool) {
+        Session_ProfileBegin("map", stream);
         CHK_TRUE_RET(G_LoadMap(stream, true));
+        Session_ProfileEnd(stream);
         Sched_TryYield();
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
@@ -3016,7 +3593,9 @@ bool G_LoadGlobalState(SDL_RWops *stream)
         CHK_TRUE_RET(attr.type == TYPE_INT);
         M_Raycast_SetHighlightSize(attr.val.as_int);
 
+        Session_ProfileBegin("fog", stream);
         CHK_TRUE_RET(G_Fog_LoadState(stream));
+        Session_ProfileEnd(stream);
         Sched_TryYield();
     }else{
         G_ClearState();
@@ -3116,8 +3695,10 @@ bool G_LoadGlobalState(SDL_RWops *stream)
     s_gs.minimap_render_all = attr.val.as_bool;
     Sched_TryYield();
 
+    Session_ProfileBegin("regions", stream);
     if(!G_Region_LoadState(stream))
         return false;
+    Session_ProfileEnd(stream);
 
     return true;
 }
@@ -3136,38 +3717,8 @@ bool G_SaveEntityState(SDL_RWops *stream)
     /* Movement, combat, etc. state is only saved for sessions with a loaded map */
     if(!s_gs.map)
         return true;
-    
-    if(!G_Move_SaveState(stream))
-        return false;
-
-    if(!G_Formation_SaveState(stream))
-        return false;
-
-    if(!G_Combat_SaveState(stream))
-        return false;
-
-    if(!G_Building_SaveState(stream))
-        return false;
 
-    if(!G_Builder_SaveState(stream))
-        return false;
-
-    if(!G_StorageSite_SaveState(stream))
-        return false;
-
-    if(!G_Resource_SaveState(stream))
-        return false;
-
-    if(!G_Harvester_SaveState(stream))
-        return false;
-
-    if(!G_Garrison_SaveState(stream))
-        return false;
-
-    if(!G_Automation_SaveState(stream))
-        return false;
-
-    return true;
+    return g_save_sections(stream);
 }
 
 bool G_LoadEntityState(SDL_RWops *stream)
@@ -3187,36 +3738,11 @@ bool G_LoadEntityState(SDL_RWops *stream)
     if(!s_gs.map)
         return true;
 
-    if(!G_Move_LoadState(stream))
-        return false;
-
-    if(!G_Formation_LoadState(stream))
-        return false;
-
-    if(!G_Combat_LoadState(stream))
-        return false;
-
-    if(!G_Building_LoadState(stream))
-        return false;
-
-    if(!G_Builder_LoadState(stream))
-        return false;
-
-    if(!G_StorageSite_LoadState(stream))
-        return false;
-
-    if(!G_Resource_LoadState(stream))
-        return false;
-
-    if(!G_Harvester_LoadState(stream))
-        return false;
-
-    if(!G_Garrison_LoadState(stream))
-        return false;
-
-    if(!G_Automation_LoadState(stream))
-        return false;
-
+    for(int i = 0; i < ARR_SIZE(s_entity_sections); i++) {
+        if(!g_load_section(stream, s_entity_sections[i].load))
+            return false;
+        Sched_TryYield();
+    }
     return true;
 }
 
@@ -57,14 +57,15 @@ const khash_t(entity) *G_GetAllEntsSet(void);
 enum ctx_action        G_CurrContextualAction(void);
 void                   G_NotifyOrderIssued(uint32_t uid, bool clear_harvester);
 
-khash_t(id)           *G_FlagsCopyTable(void);
-uint32_t               G_FlagsGetFrom(khash_t(id) *table, uint32_t uid);
+/* Copies of the entity records can be read from any thread */
+bool                   G_RecordsCopy(vec_erec_t *out);
+struct ent_record      G_RecordGet(uint32_t uid);
+struct ent_record     *G_RecordFrom(const vec_erec_t *table, uint32_t uid);
+bool                   G_RecordSetIn(vec_erec_t *table, struct ent_record rec);
 
-khash_t(range)        *G_SelectionRadiusCopyTable(void);
-float                  G_GetSelectionRadiusFrom(khash_t(range) *table, uint32_t uid);
-
-khash_t(id)           *G_FactionIDCopyTable(void);
-int                    G_GetFactionIDFrom(khash_t(id) *table, uint32_t uid);
+uint32_t               G_FlagsGetFrom(const vec_erec_t *table, uint32_t uid);
+float                  G_GetSelectionRadiusFrom(const vec_erec_t *table, uint32_t uid);
+int                    G_GetFactionIDFrom(const vec_erec_t *table, uint32_t uid);
 
 enum diplomacy_state (*G_CopyDiplomacyTable(void))[MAX_FACTIONS];
 bool                   G_GetDiplomacyStateFrom(enum diplomacy_state (*table)[MAX_FACTIONS],
@@ -39,14 +39,43 @@
 #include "public/game.h"
 #include "faction.h"
 #include "selection.h"
+#include "changes.h"
 #include "../lib/public/vec.h"
 #include "../render/public/render_ctrl.h"
 
 #include <stdint.h>
 
+#define G_MAX_PIPELINE_DEPTH (3)
+
 KHASH_DECLARE(id, khint32_t, int)
 KHASH_DECLARE(range, khint32_t, float)
 
+struct stat_rcache{
+    mat4x4_t         model;
+    struct tile_desc td;
+};
+
+KHASH_DECLARE(rcache, khint32_t, struct stat_rcache)
+
+/* The state of an entity which is read most frequently by the game 
+ * subsystems, packed together such that a single lookup fetches all 
+ * of it. 
+ */
+struct ent_record{
+    uint32_t uid;
+    uint32_t flags;
+    int      faction_id;
+    float    vision_range;
+    float    sel_radius;
+    uint32_t gpu_id;
+};
+
+VEC_TYPE(erec, struct ent_record)
+VEC_IMPL(static inline, erec, struct ent_record)
+
+VEC_TYPE(mask, uint8_t)
+VEC_IMPL(static inline, mask, uint8_t)
+
 
 struct gamestate{
     enum simstate           ss;
@@ -81,6 +110,12 @@ struct gamestate{
      *-------------------------------------------------------------------------
      */
     bool                    minimap_render_all;
+    /*-------------------------------------------------------------------------
+     * The SDL tick during which the minimap unit positions were last sent to 
+     * the renderer. Zero when they must be refreshed on the next frame.
+     *-------------------------------------------------------------------------
+     */
+    uint32_t                minimap_units_tick;
     /*-------------------------------------------------------------------------
      * Boolean to toggle showing of icons over entities.
      *-------------------------------------------------------------------------
@@ -102,23 +137,14 @@ struct gamestate{
      */
     khash_t(entity)        *active;
     /*-------------------------------------------------------------------------
-     * Table mapping an entity to its' faction ID for all active entities.
-     * Synchronized with 'active' table at function call boundaries.
+     * The record of every entity, indexed by the slot index of its' UID. The
+     * flags are valid from the time the entity is created until it is freed.
+     * The faction ID, vision range and selection radius are valid for active
+     * entities, and the GPU ID for dynamic ones. The 'uid' of a record whose
+     * slot is not in use is NULL_UID.
      *-------------------------------------------------------------------------
      */
-    khash_t(id)           *ent_faction_map;
-    /*-------------------------------------------------------------------------
-     * Table mapping an entity to its' vision range for active entities.
-     * Synchronized with 'active' table at function call boundaries.
-     *-------------------------------------------------------------------------
-     */
-    khash_t(range)         *ent_visrange_map;
-    /*-------------------------------------------------------------------------
-     * Table mapping an entity to its' selection radius for active entities.
-     * Synchronized with 'active' table at function call boundaries.
-     *-------------------------------------------------------------------------
-     */
-    khash_t(range)         *selection_radiuses;
+    vec_erec_t              records;
     /*-------------------------------------------------------------------------
      * Up-to-date set of all non-static entities. (Subset of 'active' set). 
      * Used for collision avoidance force computations.
@@ -126,18 +152,29 @@ struct gamestate{
      */
     khash_t(entity)        *dynamic;
     /*-------------------------------------------------------------------------
-     * A bidirectional mapping of entity IDs to GPU IDs for every dynamic entity.
-     * The GPU IDs are in the range of [1:kh_size(dynamic)] and thus are 
-     * better suited to be used as indices. An ID of 0 represents a NULL ID.
+     * The entity for every GPU ID, at index (GPU ID - 1). GPU IDs are given 
+     * to dynamic entities only and are in the range of [1:kh_size(dynamic)],
+     * and thus are better suited to be used as indices. An ID of 0 represents
+     * a NULL ID.
      *-------------------------------------------------------------------------
      */
-    khash_t(id)            *ent_gpu_id_map;
-    khash_t(id)            *gpu_id_ent_map;
+    vec_entity_t            gpu_id_ents;
     /*-------------------------------------------------------------------------
-     * A table mapping the entity's ID to its' flags.
+     * The nesting depth of 'G_BeginEntityBatch' calls. While non-zero, the
+     * nav blocker, fog and region updates of entities are held back.
      *-------------------------------------------------------------------------
      */
-    khash_t(id)            *ent_flag_map;
+    int                     batch_depth;
+    /*-------------------------------------------------------------------------
+     * The model matrix and the tile of every static (non-animated) entity, as
+     * of the last time it was added to a draw list. Entries are dropped when
+     * the change log reports that the entity has been moved, rotated, scaled
+     * or removed. Most such entities are structures and trees which never 
+     * move.
+     *-------------------------------------------------------------------------
+     */
+    khash_t(rcache)        *stat_rcache;
+    struct change_cursor    rcache_changes;
     /*-------------------------------------------------------------------------
      * The set of entities potentially visible by the active camera. Updated
      * every frame.
@@ -155,6 +192,14 @@ struct gamestate{
      *-------------------------------------------------------------------------
      */
     vec_obb_t               visible_obbs;
+    /*-------------------------------------------------------------------------
+     * Scratch buffers for culling all the active entities against the camera
+     * and light frusta in a single batch. Only valid during 'G_Update'.
+     *-------------------------------------------------------------------------
+     */
+    vec_entity_t            cull_ents;
+    vec_obb_t               cull_obbs;
+    vec_mask_t              cull_masks;
     /*-------------------------------------------------------------------------
      * The state of the factions in the current game. 'factions_allocd' has a 
      * set bit for every faction index that's 'allocated'. Clear bits are 'free'.
@@ -169,20 +214,27 @@ struct gamestate{
      */
     enum diplomacy_state    diplomacy_table[MAX_FACTIONS][MAX_FACTIONS];
     /*-------------------------------------------------------------------------
-     * The index indo the 'ws' field, where the rendering commands are stored.
-     * The previous frame workspace is owned by the render thread. The render
-     * and simulatino workspaces are swapped at the end of every frame.
+     * The render workspaces form a ring. The simulation records its' commands 
+     * into 'curr_ws_idx' and the render thread executes 'render_ws_idx'. The 
+     * workspaces in between have been submitted and are queued up behind the 
+     * one being rendered. With a pipeline depth of 2 there are never any queued
+     * workspaces and the simulation and rendering run in lockstep. A depth of 3
+     * lets the simulation run a frame ahead when the render thread falls behind.
      *-------------------------------------------------------------------------
      */
     int                     curr_ws_idx;
-    struct render_workspace ws[2];
+    int                     render_ws_idx;
+    int                     pipeline_depth;
+    struct render_workspace ws[G_MAX_PIPELINE_DEPTH];
     /*-------------------------------------------------------------------------
-     * A readonly snapshot (copy) of the map from the previous simulation tick. 
-     * This is used by the render thread for making certain queries like size,
-     * height at a point, etc.
+     * A readonly snapshot (copy) of the map from the previous simulation tick,
+     * one for each workspace. This is used by the render thread for making 
+     * certain queries like size, height at a point, etc. The snapshot for a 
+     * workspace is taken when it starts to be recorded into, so it isn't 
+     * overwritten while any earlier workspace is still being rendered.
      *-------------------------------------------------------------------------
      */
-    const struct map       *prev_tick_map;
+    const struct map       *prev_tick_map[G_MAX_PIPELINE_DEPTH];
     /*-------------------------------------------------------------------------
      * Entities currently scheduled for removal. They will be removed from the
      * game simulation at the end of the tick.
@@ -39,21 +39,21 @@
 #include "selection.h"
 #include "movement.h"
 #include "position.h"
+#include "timer_events.h"
 #include "../main.h"
 #include "../ui.h"
 #include "../entity.h"
 #include "../event.h"
 #include "../sched.h"
-#include "../task.h"
 #include "../lib/public/khash.h"
 #include "../lib/public/vec.h"
 #include "../lib/public/attr.h"
 #include "../lib/public/pf_nuklear.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/mem.h"
 
 #include <assert.h>
 
-#define EVICT_DELAY_MS          (1000)
 #define GARRISON_THRESHOLD_DIST (25.0f)
 #define GARRISON_BUFFER_DIST    (15.0f)
 #define GARRISON_WAIT_TICKS     (5)
@@ -100,18 +100,9 @@ struct garrisonable_state{
     vec_entity_t      garrisoned;
 };
 
-struct evict_work{
-    uint32_t      uid;
-    vec2_t        target;
-    uint32_t      tid;
-};
-
 KHASH_MAP_INIT_INT(garrison, struct garrison_state)
 KHASH_MAP_INIT_INT(garrisonable, struct garrisonable_state)
 
-VEC_TYPE(evict, struct evict_work)
-VEC_IMPL(static inline, evict, struct evict_work)
-
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
@@ -120,7 +111,6 @@ static const struct map      *s_map;
 static khash_t(garrison)     *s_garrison_state_table;
 static khash_t(garrisonable) *s_garrisonable_state_table;
 static bool                   s_evict_on_lclick = false;
-static vec_evict_t            s_evicting;
 
 static char                   s_garrison_icon_path[512] = {0};
 static struct nk_style_item   s_bg_style = {0};
@@ -389,13 +379,16 @@ static bool adjacent(uint32_t unit, uint32_t garrisonable)
     }
 }
 
-static void on_20hz_tick(void *user, void *event)
+/* Process the entities of the given shard, or all of them if the shard is -1 */
+static void garrison_tick(int shard)
 {
     uint32_t uid;
 
     /* Process GARRISON entities */
     struct garrison_state *gu_state;
     kh_foreach_val_ptr(s_garrison_state_table, uid, gu_state, {
+        if(shard >= 0 && G_TICK_SHARD(uid) != shard)
+            continue;
         switch(gu_state->state) {
         case STATE_GARRISONED:
         case STATE_NOT_GARRISONED:
@@ -494,6 +487,9 @@ static void on_20hz_tick(void *user, void *event)
     struct garrisonable_state *gb_state;
     kh_foreach_val_ptr(s_garrisonable_state_table, uid, gb_state, {
 
+        if(shard >= 0 && G_TICK_SHARD(uid) != shard)
+            continue;
+
         enum nav_layer garrisonable_layer = Entity_NavLayer(uid);
         float garrisonable_radius = G_GetSelectionRadius(uid);
         vec2_t garrisonable_pos = G_Pos_GetXZ(uid);
@@ -573,42 +569,21 @@ static void on_20hz_tick(void *user, void *event)
     });
 }
 
-static bool compare_uids(uint32_t *a, uint32_t *b)
+static void on_20hz_tick(void *user, void *event)
 {
-    return *a == *b;
+    if(G_Timer_Sharded())
+        return;
+    garrison_tick(-1);
 }
 
-static bool compare_evict_work(struct evict_work *a, struct evict_work *b)
+static void on_20hz_subtick(void *user, void *event)
 {
-    return a->uid == b->uid;
+    garrison_tick((uintptr_t)event);
 }
 
-static struct result evict_task(void *arg)
+static bool compare_uids(uint32_t *a, uint32_t *b)
 {
-    ASSERT_IN_MAIN_THREAD();
-
-    struct evict_work *work = arg;
-    struct garrisonable_state *gbs = gb_state_get(work->uid);
-    if(!gbs)
-        goto out;
-
-    vec_evict_push(&s_evicting, *work);
-
-    struct garrisonable_state copy = *gbs;
-    for(int i = 0; i < vec_size(&copy.garrisoned); i++) {
-        uint32_t curr = vec_AT(&copy.garrisoned, i);
-        G_Garrison_Evict(work->uid, curr, work->target);
-        Task_Sleep(EVICT_DELAY_MS);
-    }
-
-    int idx = vec_evict_indexof(&s_evicting, *work, compare_evict_work);
-    if(idx != -1) {
-        vec_evict_del(&s_evicting, idx);
-    }
-
-out:
-    free(arg);
-    return NULL_RESULT;
+    return *a == *b;
 }
 
 static bool transport_move(uint32_t garrisonable, vec2_t target)
@@ -732,7 +707,6 @@ bool G_Garrison_Init(const struct map *map)
         goto fail_garrison;
     if((s_garrisonable_state_table = kh_init(garrisonable)) == NULL)
         goto fail_garrisonable;
-    vec_evict_init(&s_evicting);
 
     struct nk_context ctx;
     nk_style_default(&ctx);
@@ -743,6 +717,7 @@ bool G_Garrison_Init(const struct map *map)
         G_RUNNING | G_PAUSED_UI_RUNNING | G_PAUSED_FULL);
     E_Global_Register(SDL_MOUSEBUTTONDOWN, on_mousedown, NULL, G_RUNNING);
     E_Global_Register(EVENT_20HZ_TICK, on_20hz_tick, NULL, G_RUNNING);
+    E_Global_Register(EVENT_20HZ_SUBTICK, on_20hz_subtick, NULL, G_RUNNING);
 
     s_map = map;
     return true;
@@ -755,10 +730,10 @@ fail_garrison:
 
 void G_Garrison_Shutdown(void)
 {
+    E_Global_Unregister(EVENT_20HZ_SUBTICK, on_20hz_subtick);
     E_Global_Unregister(EVENT_20HZ_TICK, on_20hz_tick);
     E_Global_Unregister(SDL_MOUSEBUTTONDOWN, on_mousedown);
     E_Global_Unregister(EVENT_UPDATE_UI, on_update_ui);
-    vec_evict_destroy(&s_evicting);
     kh_destroy(garrisonable, s_garrisonable_state_table);
     kh_destroy(garrison, s_garrison_state_table);
 }
@@ -918,6 +893,53 @@ bool G_Garrison_Enter(uint32_t garrisonable, uint32_t unit)
     return true;
 }
 
+static bool evict_possible(uint32_t garrisonable, uint32_t unit, vec2_t exit)
+{
+    vec2_t garrisonable_pos = G_Pos_GetXZ(garrisonable);
+    uint32_t garrisonable_flags = G_FlagsGet(garrisonable);
+
+    if(garrisonable_flags & ENTITY_FLAG_BUILDING) {
+
+        struct obb obb;
+        Entity_CurrentOBB(garrisonable, &obb, true);
+        return M_NavObjAdjacentToStaticWith(s_map, exit, GARRISON_THRESHOLD_DIST, &obb);
+    }
+
+    vec2_t delta;
+    PFM_Vec2_Sub(&exit, &garrisonable_pos, &delta);
+    float distance = PFM_Vec2_Len(&delta);
+
+    float garrisonable_radius = G_GetSelectionRadius(garrisonable);
+    float unit_radius = G_GetSelectionRadius(unit);
+    float threshold = garrisonable_radius + unit_radius + GARRISON_THRESHOLD_DIST;
+    return (distance <= threshold);
+}
+
+static void evict_unit(struct garrisonable_state *gbs, int idx, vec2_t pos, vec2_t target)
+{
+    uint32_t unit = vec_AT(&gbs->garrisoned, idx);
+    struct garrison_state *gus = gu_state_get(unit);
+    assert(gus);
+
+    vec_entity_del(&gbs->garrisoned, idx);
+    gbs->current -= gus->capacity_consumed;
+
+    /* Place the evicted unit at the location and issue it a move order */
+    uint32_t flags = G_FlagsGet(unit);
+    flags &= ~ENTITY_FLAG_GARRISONED;
+    G_FlagsSet(unit, flags);
+
+    vec3_t pos3 = (vec3_t){
+        pos.x,
+        M_HeightAtPoint(s_map, pos),
+        pos.z
+    };
+
+    G_Pos_Ungarrison(unit, pos3);
+    G_Move_BlockAt(unit, pos3);
+    G_Move_SetDest(unit, target, false);
+}
+
 bool G_Garrison_Evict(uint32_t garrisonable, uint32_t unit, vec2_t target)
 {
     struct garrison_state *gus = gu_state_get(unit);
@@ -934,54 +956,15 @@ bool G_Garrison_Evict(uint32_t garrisonable, uint32_t unit, vec2_t target)
 
     enum nav_layer target_layer = Entity_NavLayer(unit);
     vec2_t garrisonable_pos = G_Pos_GetXZ(garrisonable);
-    float garrisonable_radius = G_GetSelectionRadius(garrisonable);
-    uint32_t garrisonable_flags = G_FlagsGet(garrisonable);
-    uint32_t unit_flags = G_FlagsGet(unit);
 
     vec2_t closest;
     if(!M_NavClosestPathable(s_map, target_layer, garrisonable_pos, &closest))
         return false;
 
-    /* Check if we are able to evict the unit */
-    if(garrisonable_flags & ENTITY_FLAG_BUILDING) {
-
-        struct obb obb;
-        Entity_CurrentOBB(garrisonable, &obb, true);
-        if(!M_NavObjAdjacentToStaticWith(s_map, closest, GARRISON_THRESHOLD_DIST, &obb))
-            return false;
-    }else{
-
-        vec2_t delta;
-        PFM_Vec2_Sub(&closest, &garrisonable_pos, &delta);
-        float distance = PFM_Vec2_Len(&delta);
-
-        float garrisonable_radius = G_GetSelectionRadius(garrisonable);
-        float unit_radius = G_GetSelectionRadius(unit);
-        float threshold = garrisonable_radius + unit_radius + GARRISON_THRESHOLD_DIST;
-        if(distance > threshold)
-            return false;
-    }
-
-    /* Now it is certain that eviction can take place */
-    int capacity_consumed = gus->capacity_consumed;
-    vec_entity_del(&gbs->garrisoned, idx);
-    gbs->current -= capacity_consumed;
-
-    /* Place the evicted unit at the closest location and issue it a move order */
-    uint32_t flags = G_FlagsGet(unit);
-    flags &= ~ENTITY_FLAG_GARRISONED;
-    G_FlagsSet(unit, flags);
-
-    vec3_t pos = (vec3_t){
-        closest.x,
-        M_HeightAtPoint(s_map, closest),
-        closest.z
-    };
-
-    G_Pos_Ungarrison(unit, pos);
-    G_Move_BlockAt(unit, pos);
-    G_Move_SetDest(unit, target, false);
+    if(!evict_possible(garrisonable, unit, closest))
+        return false;
 
+    evict_unit(gbs, idx, closest, target);
     return true;
 }
 
@@ -989,18 +972,58 @@ bool G_Garrison_EvictAll(uint32_t garrisonable, vec2_t target)
 {
     if(transport_move(garrisonable, target))
         return true;
-    struct evict_work *work = malloc(sizeof(struct evict_work));
-    if(!work)
+
+    struct garrisonable_state *gbs = gb_state_get(garrisonable);
+    if(!gbs)
         return false;
-    work->uid = garrisonable;
-    work->target = target;
-    work->tid = Sched_Create(16, evict_task, work, NULL, TASK_MAIN_THREAD_PINNED | TASK_BIG_STACK);
-    if(work->tid == NULL_TID) {
-        free(work);
+
+    size_t ngarrisoned = vec_size(&gbs->garrisoned);
+    if(ngarrisoned == 0)
         return false;
+
+    /* Plan the exit positions of all the units with a single search of
+     * the navigation grid around the garrisonable. Every unit gets its 
+     * own cell, spaced far enough apart that the units don't overlap.
+     */
+    float spacing = 0.0f;
+    enum nav_layer layer = Entity_NavLayer(vec_AT(&gbs->garrisoned, 0));
+    for(int i = 0; i < ngarrisoned; i++) {
+        uint32_t curr = vec_AT(&gbs->garrisoned, i);
+        float radius = G_GetSelectionRadius(curr);
+        if(2 * radius > spacing) {
+            spacing = 2 * radius;
+            layer = Entity_NavLayer(curr);
+        }
     }
-    Sched_RunSync(work->tid);
-    return true;
+
+    STALLOC(vec2_t, exits, ngarrisoned);
+    vec2_t garrisonable_pos = G_Pos_GetXZ(garrisonable);
+    size_t nexits = M_NavClosestPathableSet(s_map, layer, garrisonable_pos, 
+        spacing, ngarrisoned, exits);
+
+    bool ret = false;
+    if(nexits == 0)
+        goto out;
+
+    /* Units are evicted in order. The ones that are not able to leave
+     * remain garrisoned.
+     */
+    int idx = 0, next_exit = 0;
+    while(idx < vec_size(&gbs->garrisoned)) {
+
+        uint32_t curr = vec_AT(&gbs->garrisoned, idx);
+        if(!evict_possible(garrisonable, curr, exits[0])) {
+            idx++;
+            continue;
+        }
+        evict_unit(gbs, idx, exits[next_exit], target);
+        next_exit = (next_exit + 1) % nexits;
+        ret = true;
+    }
+
+out:
+    STFREE(exits);
+    return ret;
 }
 
 void G_Garrison_SetFontColor(const struct nk_color *clr)
@@ -1281,26 +1304,9 @@ bool G_Garrison_SaveState(struct SDL_RWops *stream)
 
     struct attr num_evicting = (struct attr){
         .type = TYPE_INT,
-        .val.as_int = vec_size(&s_evicting)
+        .val.as_int = 0
     };
     CHK_TRUE_RET(Attr_Write(stream, &num_evicting, "num_evicting"));
-
-    for(int i = 0; i < vec_size(&s_evicting); i++) {
-
-        struct evict_work curr = vec_AT(&s_evicting, i);
-
-        struct attr uid = (struct attr){
-            .type = TYPE_INT,
-            .val.as_int = curr.uid
-        };
-        CHK_TRUE_RET(Attr_Write(stream, &uid, "evicting_uid"));
-
-        struct attr target = (struct attr){
-            .type = TYPE_VEC2,
-            .val.as_vec2 = curr.target
-        };
-        CHK_TRUE_RET(Attr_Write(stream, &target, "evicting_target"));
-    }
     Sched_TryYield();
 
     return true;
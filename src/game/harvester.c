@@ -37,6 +37,8 @@
 #include "movement.h"
 #include "resource.h"
 #include "storage_site.h"
+#include "automation.h"
+#include "restable.h"
 #include "game_private.h"
 #include "public/game.h"
 #include "../sched.h"
@@ -44,11 +46,12 @@
 #include "../entity.h"
 #include "../cursor.h"
 #include "../settings.h"
+#include "../replay.h"
+#include "../net.h"
 #include "../camera.h"
 #include "../lib/public/vec.h"
 #include "../lib/public/khash.h"
 #include "../lib/public/pf_string.h"
-#include "../lib/public/string_intern.h"
 #include "../lib/public/mpool_allocator.h"
 #include "../lib/public/attr.h"
 
@@ -83,9 +86,6 @@ static void  pfree(void *ptr);
 #define krealloc prealloc
 #define kfree    pfree
 
-KHASH_MAP_INIT_STR(int, int)
-KHASH_MAP_INIT_STR(float, float)
-
 VEC_TYPE(name, const char*)
 VEC_IMPL(static, name, const char*)
 
@@ -107,10 +107,10 @@ struct hstate{
     uint32_t    res_uid;
     vec2_t      res_last_pos;
     const char *res_name;         /* borrowed */
-    kh_float_t *gather_speeds;    /* How much of each resource the entity gets each cycle */
-    kh_int_t   *max_carry;        /* The maximum amount of each resource the entity can carry */
-    kh_int_t   *curr_carry;       /* The amount of each resource the entity currently holds */
-    kh_int_t   *do_not_transport; /* Per-resource flag to disable transporting */
+    struct restable_float gather_speeds; /* How much of each resource the entity gets each cycle */
+    struct restable max_carry;        /* The maximum amount of each resource the entity can carry */
+    struct restable curr_carry;       /* The amount of each resource the entity currently holds */
+    struct restable do_not_transport; /* Per-resource flag to disable transporting */
     vec_name_t  priority;         /* The order in which the harvester will transport resources */
     bool        drop_off_only;
     float       accum;            /* How much we gathered - only integer amounts are taken */ 
@@ -176,8 +176,6 @@ static void on_harvest_anim_finished_source(void *user, void *event);
 /*****************************************************************************/
 
 static mpa_buff_t        s_mpool;
-static khash_t(stridx)  *s_stridx;
-static mp_strbuff_t      s_stringpool;
 static khash_t(state)   *s_entity_state_table;
 static const struct map *s_map;
 
@@ -185,6 +183,8 @@ static bool              s_gather_on_lclick = false;
 static bool              s_pick_up_on_lclick = false;
 static bool              s_drop_off_on_lclick = false;
 static bool              s_transport_on_lclick = false;
+/* Cached value of the debug setting read every frame */
+static struct sval       s_show_state;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -267,30 +267,24 @@ static void hstate_remove(uint32_t uid)
 static void hstate_destroy(struct hstate *hs)
 {
     vec_name_destroy(&hs->priority);
-    kh_destroy(float, hs->gather_speeds);
-    kh_destroy(int, hs->max_carry);
-    kh_destroy(int, hs->curr_carry);
-    kh_destroy(int, hs->do_not_transport);
+}
+
+static void hstate_set_state(uint32_t uid, struct hstate *hs, enum harvester_state state)
+{
+    bool was_idle = (hs->state == STATE_NOT_HARVESTING);
+    hs->state = state;
+    if(was_idle != (state == STATE_NOT_HARVESTING)) {
+        G_Automation_NotifyStateChanged(uid);
+    }
 }
 
 static bool hstate_init(struct hstate *hs)
 {
+    memset(hs, 0, sizeof(*hs));
     vec_name_init_alloc(&hs->priority, prealloc, pfree);
     if(!vec_name_resize(&hs->priority, sizeof(buff_t) / sizeof(char*)))
         return false;
 
-    hs->gather_speeds = kh_init(float);
-    hs->max_carry = kh_init(int);
-    hs->curr_carry = kh_init(int);
-    hs->do_not_transport = kh_init(int);
-
-    if(!hs->gather_speeds || !hs->max_carry 
-    || !hs->curr_carry || !hs->do_not_transport) {
-
-        hstate_destroy(hs);
-        return false;
-    }
-
     hs->ss_uid = NULL_UID;
     hs->res_uid = NULL_UID;
     hs->res_last_pos = (vec2_t){0};
@@ -305,81 +299,30 @@ static bool hstate_init(struct hstate *hs)
     return true;
 }
 
-static bool hstate_set_key_int(khash_t(int) *table, const char *name, int val)
+static bool hstate_set_key_int(struct restable *table, const char *name, int val)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
-    if(!key)
-        return false;
-
-    khiter_t k = kh_get(int, table, key);
-    if(k != kh_end(table)) {
-        kh_value(table, k) = val;
-        return true;
-    }
-
-    int status;
-    k = kh_put(int, table, key, &status);
-    if(status == -1) {
-        return false;
-    }
-
-    assert(status == 1);
-    kh_value(table, k) = val;
-    return true;
+    return restable_set(table, G_ResTable_IDForName(name), val);
 }
 
-static bool hstate_get_key_int(khash_t(int) *table, const char *name, int *out)
+static bool hstate_get_key_int(const struct restable *table, const char *name, int *out)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
-    if(!key)
-        return false;
-
-    khiter_t k = kh_get(int, table, key);
-    if(k == kh_end(table))
-        return false;
-    *out = kh_value(table, k);
-    return true;
+    return restable_get(table, G_ResTable_LookupID(name), out);
 }
 
-static bool hstate_set_key_float(khash_t(float) *table, const char *name, float val)
+static bool hstate_set_key_float(struct restable_float *table, const char *name, float val)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
-    if(!key)
-        return false;
-
-    khiter_t k = kh_get(float, table, key);
-    if(k != kh_end(table)) {
-        kh_value(table, k) = val;
-        return true;
-    }
-
-    int status;
-    k = kh_put(float, table, key, &status);
-    if(status == -1) {
-        return false;
-    }
-
-    assert(status == 1);
-    kh_value(table, k) = val;
-    return true;
+    return restable_float_set(table, G_ResTable_IDForName(name), val);
 }
 
-static bool hstate_get_key_float(khash_t(float) *table, const char *name, float *out)
+static bool hstate_get_key_float(const struct restable_float *table, const char *name, float *out)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
-    if(!key)
-        return false;
-
-    khiter_t k = kh_get(float, table, key);
-    if(k == kh_end(table))
-        return false;
-    *out = kh_value(table, k);
-    return true;
+    return restable_float_get(table, G_ResTable_LookupID(name), out);
 }
 
 static bool compare_keys(const char **a, const char **b)
 {
-    /* Since all strings are interned, we can use direct pointer comparision */
+    /* Since all strings are interned in the resource table, we can use 
+     * direct pointer comparision */
     return *a == *b;
 }
 
@@ -536,18 +479,21 @@ uint32_t nearest_storage_site_dropoff(uint32_t uid, const char *rname)
 {
     vec2_t pos = G_Pos_GetXZ(uid);
     struct searcharg arg = (struct searcharg){uid, NULL_UID, rname};
-    return G_Pos_NearestWithPred(pos, valid_storage_site_dropoff, (void*)&arg, 0.0f);
+    return G_StorageSite_NearestWithPred(G_GetFactionID(uid), pos, 
+        valid_storage_site_dropoff, (void*)&arg);
 }
 
 uint32_t nearest_storage_site_source(uint32_t uid, uint32_t storage, const char *rname, enum tstrategy strat)
 {
     vec2_t pos = G_Pos_GetXZ(storage);
     struct searcharg arg = (struct searcharg){uid, storage, rname, strat};
-    uint32_t ret = G_Pos_NearestWithPred(pos, valid_storage_site_source, (void*)&arg, 0.0f);
+    uint32_t ret = G_StorageSite_NearestWithPred(G_GetFactionID(uid), pos, 
+        valid_storage_site_source, (void*)&arg);
 
     if((ret == NULL_UID) && (strat == TRANSPORT_STRATEGY_EXCESS)) {
         arg = (struct searcharg){uid, storage, rname, TRANSPORT_STRATEGY_NEAREST};
-        ret = G_Pos_NearestWithPred(pos, valid_storage_site_source, (void*)&arg, 0.0f);
+        ret = G_StorageSite_NearestWithPred(G_GetFactionID(uid), pos, 
+            valid_storage_site_source, (void*)&arg);
     }
     return ret;
 }
@@ -562,7 +508,7 @@ uint32_t nearest_resource(uint32_t uid, const char *name)
         .rname = name,
         .exclude = UID_NONE
     };
-    return G_Pos_NearestWithPred(pos, valid_resource, (void*)&arg, REACQUIRE_RADIUS);
+    return G_Resource_NearestWithPred(name, pos, valid_resource, (void*)&arg, REACQUIRE_RADIUS);
 }
 
 uint32_t nearest_resource_with_exclusion(uint32_t uid, const char *name, uint32_t exclude)
@@ -575,7 +521,7 @@ uint32_t nearest_resource_with_exclusion(uint32_t uid, const char *name, uint32_
         .rname = name,
         .exclude = exclude
     };
-    return G_Pos_NearestWithPred(pos, valid_resource, (void*)&arg, REACQUIRE_RADIUS);
+    return G_Resource_NearestWithPred(name, pos, valid_resource, (void*)&arg, REACQUIRE_RADIUS);
 }
 
 static void finish_harvesting(struct hstate *hs, uint32_t uid)
@@ -586,7 +532,7 @@ static void finish_harvesting(struct hstate *hs, uint32_t uid)
     E_Entity_Unregister(EVENT_MOTION_END, uid, on_arrive_at_resource);
     E_Entity_Unregister(EVENT_MOTION_END, uid, on_arrive_at_resource_source);
 
-    hs->state = STATE_NOT_HARVESTING;
+    hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
     hs->res_uid = NULL_UID;
     hs->res_last_pos = (vec2_t){0};
     hs->res_name = NULL;
@@ -597,12 +543,11 @@ static void finish_harvesting(struct hstate *hs, uint32_t uid)
 
 static const char *carried_resource_name(struct hstate *hs)
 {
-    const char *key;
-    int curr;
+    int id, curr;
 
-    kh_foreach(hs->curr_carry, key, curr, {
+    restable_foreach(&hs->curr_carry, id, curr, {
         if(curr > 0)
-            return key;
+            return G_ResTable_NameForID(id);
     });
     return NULL;
 }
@@ -612,7 +557,7 @@ static void entity_drop_off(uint32_t uid, uint32_t ss)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    hs->state = STATE_HARVESTING_SEEK_STORAGE;
+    hstate_set_state(uid, hs, STATE_HARVESTING_SEEK_STORAGE);
     hs->ss_uid = ss;
 
     E_Entity_Register(EVENT_MOTION_END, uid, on_arrive_at_storage, 
@@ -630,13 +575,13 @@ static void entity_try_drop_off(uint32_t uid)
     assert(hs);
 
     if(!G_Harvester_GetCurrTotalCarry(uid)) {
-        hs->state = STATE_NOT_HARVESTING;
+        hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
         return;
     }
 
     uint32_t ss = nearest_storage_site_dropoff(uid, carried_resource_name(hs));
     if(ss == NULL_UID) {
-        hs->state = STATE_NOT_HARVESTING;
+        hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
     }else{
         entity_drop_off(uid, ss);
     }
@@ -684,7 +629,7 @@ uint32_t target_resource(uint32_t uid, struct hstate *hs, const char *rname)
             .rname = rname,
             .exclude = UID_NONE,
         };
-        return G_Pos_NearestWithPred(hs->res_last_pos, valid_resource, 
+        return G_Resource_NearestWithPred(rname, hs->res_last_pos, valid_resource, 
             (void*)&arg, REACQUIRE_RADIUS);
     }
     return hs->res_uid;
@@ -746,12 +691,12 @@ uint32_t transport_source(uint32_t uid, uint32_t storage, const char *rname)
     return nearest_storage_site_source(uid, storage, rname, hs->strategy);
 }
 
-static void finish_transporing(struct hstate *hs)
+static void finish_transporing(uint32_t uid, struct hstate *hs)
 {
     hs->transport_dest_uid = NULL_UID;
     hs->transport_src_uid = NULL_UID;
     hs->res_name = NULL;
-    hs->state = STATE_NOT_HARVESTING;
+    hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
 }
 
 static void on_harvest_anim_finished(void *user, void *event)
@@ -885,7 +830,7 @@ static void on_arrive_at_resource(void *user, void *event)
     }
 
     E_Entity_Notify(EVENT_HARVEST_BEGIN, uid, NULL, ES_ENGINE);
-    hs->state = STATE_HARVESTING; 
+    hstate_set_state(uid, hs, STATE_HARVESTING);
     E_Entity_Register(EVENT_MOTION_START, uid, on_motion_begin_harvest, (void*)((uintptr_t)uid), G_RUNNING);
     E_Entity_Register(EVENT_ANIM_CYCLE_FINISHED, uid, on_harvest_anim_finished, 
         (void*)((uintptr_t)uid), G_RUNNING);
@@ -931,7 +876,7 @@ static void on_arrive_at_storage(void *user, void *event)
 
         uint32_t resource = target_resource(uid, hs, rname);
         if(hs->drop_off_only) {
-            hs->state = STATE_NOT_HARVESTING;
+            hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
             hs->ss_uid = NULL_UID;
             hs->res_name = NULL;
             clear_queued_command(uid);
@@ -972,7 +917,7 @@ static void on_arrive_at_transport_source(void *user, void *event)
         /* harvester could not reach the storage site, 
          * or the 'do not take' option for it was set */
         uint32_t dest = hs->transport_dest_uid;
-        finish_transporing(hs);
+        finish_transporing(uid, hs);
 
         /* If the destination is still there, re-try */
         if(G_EntityExists(dest) && !G_EntityIsZombie(dest)) {
@@ -1027,7 +972,7 @@ static void on_arrive_at_transport_source(void *user, void *event)
         hs->transport_dest_uid = NULL_UID;
         hs->transport_src_uid = NULL_UID;
         hs->res_name = NULL;
-        hs->state = STATE_NOT_HARVESTING;
+        hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
         return;
     }
 
@@ -1055,7 +1000,7 @@ static void on_arrive_at_transport_source(void *user, void *event)
         hs->transport_dest_uid = NULL_UID;
         hs->transport_src_uid = NULL_UID;
         hs->res_name = NULL;
-        hs->state = STATE_NOT_HARVESTING;
+        hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
         return;
     }
 
@@ -1067,7 +1012,7 @@ static void on_arrive_at_transport_source(void *user, void *event)
         (void*)((uintptr_t)uid), G_RUNNING);
 
     G_Move_SetSurroundEntity(uid, hs->transport_dest_uid);
-    hs->state = STATE_TRANSPORT_PUTTING;
+    hstate_set_state(uid, hs, STATE_TRANSPORT_PUTTING);
     E_Entity_Notify(EVENT_TRANSPORT_TARGET_ACQUIRED, uid, 
         (void*)(uintptr_t)hs->transport_dest_uid, ES_ENGINE);
 }
@@ -1095,7 +1040,7 @@ static void on_arrive_at_transport_dest(void *user, void *event)
     && G_Harvester_GetGatherSpeed(uid, G_Resource_GetName(dest_uid)) > 0
     && (!(G_FlagsGet(dest_uid) & ENTITY_FLAG_BUILDING) || G_Building_IsCompleted(dest_uid))) {
 
-        finish_transporing(hs);
+        finish_transporing(uid, hs);
         G_Harvester_Gather(uid, dest_uid);
         return;
     }
@@ -1104,7 +1049,7 @@ static void on_arrive_at_transport_dest(void *user, void *event)
     || !(G_FlagsGet(dest_uid) & ENTITY_FLAG_STORAGE_SITE)
     || !M_NavObjAdjacent(s_map, uid, dest_uid)) {
         /* harvester could not reach the destination storage site */
-        finish_transporing(hs);
+        finish_transporing(uid, hs);
         return;
     }
 
@@ -1138,7 +1083,7 @@ static void on_arrive_at_transport_dest(void *user, void *event)
     && G_StorageSite_IsSaturated(ss_uid)) {
 
         G_Resource_SetReplenished(ss_uid);
-        finish_transporing(hs);
+        finish_transporing(uid, hs);
         if(G_Harvester_GetGatherSpeed(uid, rname) > 0) {
             G_Harvester_Gather(uid, ss_uid);
         }
@@ -1146,7 +1091,7 @@ static void on_arrive_at_transport_dest(void *user, void *event)
     }
 
     uint32_t dest = hs->transport_dest_uid;
-    finish_transporing(hs);
+    finish_transporing(uid, hs);
     G_Harvester_Transport(uid, dest);
 }
 
@@ -1165,15 +1110,29 @@ static void selection_try_order_gather(bool targeting)
 
     enum selection_type sel_type;
     const vec_entity_t *sel = G_Sel_Get(&sel_type);
-    size_t ngather = 0;
-    const char *rname = G_Resource_GetName(target);
 
     if(sel_type != SELECTION_TYPE_PLAYER)
         return;
 
-    for(int i = 0; i < vec_size(sel); i++) {
+    Net_IssueCommand(&(struct replay_cmd){
+        .type = REPLAY_CMD_GATHER,
+        .nents = vec_size(sel),
+        .ents = sel->array,
+        .target = target
+    });
+}
+
+static void gather_order(size_t nents, const uint32_t *ents, uint32_t target)
+{
+    size_t ngather = 0;
+    const char *rname = G_Resource_GetName(target);
+
+    for(int i = 0; i < nents; i++) {
+
+        uint32_t curr = ents[i];
+        if(!G_EntityExists(curr))
+            continue;
 
-        uint32_t curr = vec_AT(sel, i);
         uint32_t flags = G_FlagsGet(curr);
 
         if(!(flags & ENTITY_FLAG_HARVESTER))
@@ -1376,7 +1335,7 @@ static const char *transport_resource(struct hstate *hs, uint32_t target)
 
         const char *rname = vec_AT(&hs->priority, i);
         int do_not_transport = 0;
-        hstate_get_key_int(hs->do_not_transport, rname, &do_not_transport);
+        hstate_get_key_int(&hs->do_not_transport, rname, &do_not_transport);
         if(do_not_transport)
             continue;
 
@@ -1410,7 +1369,7 @@ static const char *pick_up_resource(struct hstate *hs, uint32_t target)
 static bool harvester_can_gather(struct hstate *hs, const char *rname)
 {
     float speed = 0.0f;
-    hstate_get_key_float(hs->gather_speeds, rname, &speed);
+    hstate_get_key_float(&hs->gather_speeds, rname, &speed);
     return (speed > 0.0f);
 }
 
@@ -1460,7 +1419,7 @@ static void on_arrive_at_resource_source(void *user, void *event)
         hs->transport_dest_uid = NULL_UID;
         hs->transport_src_uid = NULL_UID;
         hs->res_name = NULL;
-        hs->state = STATE_NOT_HARVESTING;
+        hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
         return;
     }
 
@@ -1484,14 +1443,14 @@ static void on_arrive_at_resource_source(void *user, void *event)
             (void*)((uintptr_t)uid), G_RUNNING);
 
         G_Move_SetSurroundEntity(uid, hs->res_uid);
-        hs->state = STATE_TRANSPORT_PUTTING;
+        hstate_set_state(uid, hs, STATE_TRANSPORT_PUTTING);
         E_Entity_Notify(EVENT_TRANSPORT_TARGET_ACQUIRED, uid, 
             (void*)(uintptr_t)hs->transport_dest_uid, ES_ENGINE);
         return;
     }
 
     E_Entity_Notify(EVENT_HARVEST_BEGIN, uid, NULL, ES_ENGINE);
-    hs->state = STATE_TRANSPORT_HARVESTING; 
+    hstate_set_state(uid, hs, STATE_TRANSPORT_HARVESTING);
     E_Entity_Register(EVENT_MOTION_START, uid, on_motion_begin_harvest, (void*)((uintptr_t)uid), G_RUNNING);
     E_Entity_Register(EVENT_ANIM_CYCLE_FINISHED, uid, on_harvest_anim_finished_source, 
         (void*)((uintptr_t)uid), G_RUNNING);
@@ -1576,7 +1535,7 @@ static void on_harvest_anim_finished_source(void *user, void *event)
             (void*)((uintptr_t)uid), G_RUNNING);
 
         G_Move_SetSurroundEntity(uid, hs->transport_dest_uid);
-        hs->state = STATE_TRANSPORT_PUTTING;
+        hstate_set_state(uid, hs, STATE_TRANSPORT_PUTTING);
         E_Entity_Notify(EVENT_TRANSPORT_TARGET_ACQUIRED, uid, 
             (void*)(uintptr_t)hs->transport_dest_uid, ES_ENGINE);
     }
@@ -1597,14 +1556,14 @@ static bool harvester_transport_from_resources(uint32_t harvester, uint32_t stor
         .rname = rname,
         .exclude = UID_NONE,
     };
-    uint32_t resource = G_Pos_NearestWithPred(pos, valid_resource, (void*)&arg, 0);
+    uint32_t resource = G_Resource_NearestWithPred(rname, pos, valid_resource, (void*)&arg, 0);
     if(resource == NULL_UID)
         return false;
 
     if(!harvester_can_gather(hs, rname))
         return false;
 
-    hs->state = STATE_TRANSPORT_SEEK_RESOURCE;
+    hstate_set_state(harvester, hs, STATE_TRANSPORT_SEEK_RESOURCE);
     hs->transport_dest_uid = storage;
     hs->res_uid = resource;
     hs->res_last_pos = G_Pos_GetXZ(resource);
@@ -1627,13 +1586,7 @@ static bool harvester_transport_from_resources(uint32_t harvester, uint32_t stor
 
 static void on_render_ui(void *user, void *event)
 {
-    struct sval setting;
-    ss_e status;
-    (void)status;
-
-    status = Settings_Get("pf.debug.show_harvester_state", &setting);
-    assert(status == SS_OKAY);
-    if(!setting.as_bool)
+    if(!s_show_state.as_bool)
         return;
 
     struct camera *cam = G_GetActiveCamera();
@@ -1662,21 +1615,18 @@ static void on_render_ui(void *user, void *event)
 bool G_Harvester_Init(const struct map *map)
 {
     mpa_buff_init(&s_mpool, 1024, 0);
+    Settings_Bind("pf.debug.show_harvester_state", &s_show_state);
 
     if(!mpa_buff_reserve(&s_mpool, 1024))
         goto fail_mpool; 
     if(!(s_entity_state_table = kh_init(state)))
         goto fail_table;
-    if(!si_init(&s_stringpool, &s_stridx, 512))
-        goto fail_strintern;
 
     s_map = map;
     E_Global_Register(SDL_MOUSEBUTTONDOWN, on_mousedown, NULL, G_RUNNING);
     E_Global_Register(EVENT_RENDER_UI, on_render_ui, NULL, G_RUNNING);
     return true;
 
-fail_strintern:
-    kh_destroy(state, s_entity_state_table);
 fail_table:
     mpa_buff_destroy(&s_mpool);
 fail_mpool:
@@ -1689,7 +1639,6 @@ void G_Harvester_Shutdown(void)
     E_Global_Unregister(EVENT_RENDER_UI, on_render_ui);
     E_Global_Unregister(SDL_MOUSEBUTTONDOWN, on_mousedown);
 
-    si_shutdown(&s_stringpool, s_stridx);
     kh_destroy(state, s_entity_state_table);
     mpa_buff_destroy(&s_mpool);
 }
@@ -1719,7 +1668,7 @@ bool G_Harvester_SetGatherSpeed(uint32_t uid, const char *rname, float speed)
 {
     struct hstate *hs = hstate_get(uid);
     assert(hs);
-    return hstate_set_key_float(hs->gather_speeds, rname, speed);
+    return hstate_set_key_float(&hs->gather_speeds, rname, speed);
 }
 
 float G_Harvester_GetGatherSpeed(uint32_t uid, const char *rname)
@@ -1728,7 +1677,7 @@ float G_Harvester_GetGatherSpeed(uint32_t uid, const char *rname)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    hstate_get_key_float(hs->gather_speeds, rname, &ret);
+    hstate_get_key_float(&hs->gather_speeds, rname, &ret);
     return ret;
 }
 
@@ -1737,16 +1686,17 @@ bool G_Harvester_SetMaxCarry(uint32_t uid, const char *rname, int max)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    const char *key = si_intern(rname, &s_stringpool, s_stridx);
-    if(!key)
+    int id = G_ResTable_IDForName(rname);
+    if(id == RESOURCE_ID_NONE)
         return false;
 
+    const char *key = G_ResTable_NameForID(id);
     if(max == 0) {
         hstate_remove_prio(hs, key);
     }else{
         hstate_insert_prio(hs, key);
     }
-    return hstate_set_key_int(hs->max_carry, rname, max);
+    return restable_set(&hs->max_carry, id, max);
 }
 
 int G_Harvester_GetMaxCarry(uint32_t uid, const char *rname)
@@ -1755,7 +1705,7 @@ int G_Harvester_GetMaxCarry(uint32_t uid, const char *rname)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    hstate_get_key_int(hs->max_carry, rname, &ret);
+    hstate_get_key_int(&hs->max_carry, rname, &ret);
     return ret;
 }
 
@@ -1763,7 +1713,7 @@ bool G_Harvester_SetCurrCarry(uint32_t uid, const char *rname, int curr)
 {
     struct hstate *hs = hstate_get(uid);
     assert(hs);
-    return hstate_set_key_int(hs->curr_carry, rname, curr);
+    return hstate_set_key_int(&hs->curr_carry, rname, curr);
 }
 
 int G_Harvester_GetCurrCarry(uint32_t uid, const char *rname)
@@ -1772,7 +1722,7 @@ int G_Harvester_GetCurrCarry(uint32_t uid, const char *rname)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    hstate_get_key_int(hs->curr_carry, rname, &ret);
+    hstate_get_key_int(&hs->curr_carry, rname, &ret);
     return ret;
 }
 
@@ -1780,14 +1730,14 @@ void G_Harvester_ClearCurrCarry(uint32_t uid)
 {
     struct hstate *hs = hstate_get(uid);
     assert(hs);
-    kh_clear(int, hs->curr_carry);
+    restable_clear(&hs->curr_carry);
 
     if(hs->state == STATE_HARVESTING_SEEK_STORAGE 
     || hs->state == STATE_TRANSPORT_PUTTING) {
 
         E_Entity_Unregister(EVENT_MOTION_END, uid, on_arrive_at_storage);
         E_Entity_Unregister(EVENT_MOTION_END, uid, on_arrive_at_transport_dest);
-        hs->state = STATE_NOT_HARVESTING;
+        hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
     }
 }
 
@@ -1810,10 +1760,11 @@ bool G_Harvester_IncreaseTransportPrio(uint32_t uid, const char *rname)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    const char *key = si_intern(rname, &s_stringpool, s_stridx);
-    if(!key)
+    int id = G_ResTable_LookupID(rname);
+    if(id == RESOURCE_ID_NONE)
         return false;
 
+    const char *key = G_ResTable_NameForID(id);
     int idx = vec_name_indexof(&hs->priority, key, compare_keys);
     if(idx == -1)
         return false;
@@ -1832,10 +1783,11 @@ bool G_Harvester_DecreaseTransportPrio(uint32_t uid, const char *rname)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    const char *key = si_intern(rname, &s_stringpool, s_stridx);
-    if(!key)
+    int id = G_ResTable_LookupID(rname);
+    if(id == RESOURCE_ID_NONE)
         return false;
 
+    const char *key = G_ResTable_NameForID(id);
     int idx = vec_name_indexof(&hs->priority, key, compare_keys);
     if(idx == -1)
         return false;
@@ -1865,11 +1817,10 @@ int G_Harvester_GetCurrTotalCarry(uint32_t uid)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    const char *key;
-    (void)key;
-    int curr;
+    int id, curr;
+    (void)id;
 
-    kh_foreach(hs->curr_carry, key, curr, {
+    restable_foreach(&hs->curr_carry, id, curr, {
         ret += curr;
     });
 
@@ -1880,7 +1831,7 @@ bool G_Harvester_SetDoNotTransport(uint32_t uid, const char *rname, bool set)
 {
     struct hstate *hs = hstate_get(uid);
     assert(hs);
-    return hstate_set_key_int(hs->do_not_transport, rname, set);
+    return hstate_set_key_int(&hs->do_not_transport, rname, set);
 }
 
 bool G_Harvester_GetDoNotTransport(uint32_t uid, const char *rname)
@@ -1889,7 +1840,7 @@ bool G_Harvester_GetDoNotTransport(uint32_t uid, const char *rname)
     struct hstate *hs = hstate_get(uid);
     assert(hs);
 
-    hstate_get_key_int(hs->do_not_transport, rname, &ret);
+    hstate_get_key_int(&hs->do_not_transport, rname, &ret);
     return ret;
 }
 
@@ -1925,6 +1876,13 @@ void G_Harvester_SetPickUpOnLeftClick(void)
     s_transport_on_lclick = false;
 }
 
+void G_Harvester_GatherOrder(size_t nents, const uint32_t *ents, uint32_t resource)
+{
+    if(!G_EntityExists(resource) || !(G_FlagsGet(resource) & ENTITY_FLAG_RESOURCE))
+        return;
+    gather_order(nents, ents, resource);
+}
+
 bool G_Harvester_Gather(uint32_t harvester, uint32_t resource)
 {
     struct hstate *hs = hstate_get(harvester);
@@ -1953,7 +1911,7 @@ bool G_Harvester_Gather(uint32_t harvester, uint32_t resource)
         }
     }
 
-    hs->state = STATE_HARVESTING_SEEK_RESOURCE;
+    hstate_set_state(harvester, hs, STATE_HARVESTING_SEEK_RESOURCE);
     hs->res_uid = resource;
     hs->res_last_pos = G_Pos_GetXZ(resource);
     hs->res_name = G_Resource_GetName(resource);
@@ -2014,7 +1972,7 @@ bool G_Harvester_PickUp(uint32_t harvester, uint32_t storage)
         return false;
 
     G_Harvester_Stop(harvester);
-    hs->state = STATE_TRANSPORT_GETTING;
+    hstate_set_state(harvester, hs, STATE_TRANSPORT_GETTING);
     hs->transport_dest_uid = NULL_UID;
     hs->transport_src_uid = storage;
     hs->res_name = rname;
@@ -2092,7 +2050,7 @@ bool G_Harvester_Transport(uint32_t harvester, uint32_t storage)
         return false;
 
     G_Harvester_Stop(harvester);
-    hs->state = STATE_TRANSPORT_GETTING;
+    hstate_set_state(harvester, hs, STATE_TRANSPORT_GETTING);
     hs->transport_dest_uid = storage;
     hs->transport_src_uid = src;
     hs->res_name = rname;
@@ -2187,7 +2145,7 @@ void G_Harvester_Stop(uint32_t uid)
     if(hs->state == STATE_HARVESTING) {
         E_Entity_Notify(EVENT_HARVEST_END, uid, NULL, ES_ENGINE);
     }
-    hs->state = STATE_NOT_HARVESTING;
+    hstate_set_state(uid, hs, STATE_NOT_HARVESTING);
 
     E_Entity_Unregister(EVENT_ANIM_CYCLE_FINISHED, uid, on_harvest_anim_finished);
     E_Entity_Unregister(EVENT_ANIM_CYCLE_FINISHED, uid, on_harvest_anim_finished_source);
@@ -2353,16 +2311,17 @@ bool G_Harvester_SaveState(struct SDL_RWops *stream)
 
         struct attr num_speeds = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.gather_speeds)
+            .val.as_int = restable_float_size(&curr.gather_speeds)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_speeds, "num_speeds"));
 
-        const char *speed_key;
+        int speed_id;
         float speed_amount;
-        kh_foreach(curr.gather_speeds, speed_key, speed_amount, {
+        restable_foreach(&curr.gather_speeds, speed_id, speed_amount, {
         
             struct attr speed_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(speed_key_attr.val.as_string, speed_key, sizeof(speed_key_attr.val.as_string));
+            pf_strlcpy(speed_key_attr.val.as_string, G_ResTable_NameForID(speed_id), 
+                sizeof(speed_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &speed_key_attr, "speed_key"));
 
             struct attr speed_amount_attr = (struct attr){
@@ -2375,16 +2334,17 @@ bool G_Harvester_SaveState(struct SDL_RWops *stream)
 
         struct attr num_max = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.max_carry)
+            .val.as_int = restable_size(&curr.max_carry)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_max, "num_max"));
 
-        const char *max_key;
+        int max_id;
         int max_amount;
-        kh_foreach(curr.max_carry, max_key, max_amount, {
+        restable_foreach(&curr.max_carry, max_id, max_amount, {
         
             struct attr max_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(max_key_attr.val.as_string, max_key, sizeof(max_key_attr.val.as_string));
+            pf_strlcpy(max_key_attr.val.as_string, G_ResTable_NameForID(max_id), 
+                sizeof(max_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &max_key_attr, "max_key"));
 
             struct attr max_amount_attr = (struct attr){
@@ -2397,16 +2357,17 @@ bool G_Harvester_SaveState(struct SDL_RWops *stream)
 
         struct attr num_carry = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.curr_carry)
+            .val.as_int = restable_size(&curr.curr_carry)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_carry, "num_carry"));
 
-        const char *curr_key;
+        int curr_id;
         int curr_amount;
-        kh_foreach(curr.curr_carry, curr_key, curr_amount, {
+        restable_foreach(&curr.curr_carry, curr_id, curr_amount, {
         
             struct attr curr_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(curr_key_attr.val.as_string, curr_key, sizeof(curr_key_attr.val.as_string));
+            pf_strlcpy(curr_key_attr.val.as_string, G_ResTable_NameForID(curr_id), 
+                sizeof(curr_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &curr_key_attr, "curr_key"));
 
             struct attr curr_amount_attr = (struct attr){
@@ -2419,15 +2380,16 @@ bool G_Harvester_SaveState(struct SDL_RWops *stream)
 
         struct attr num_dnt = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.do_not_transport)
+            .val.as_int = restable_size(&curr.do_not_transport)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_dnt, "num_dnt"));
 
         int curr_flag;
-        kh_foreach(curr.do_not_transport, curr_key, curr_flag, {
+        restable_foreach(&curr.do_not_transport, curr_id, curr_flag, {
         
             struct attr curr_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(curr_key_attr.val.as_string, curr_key, sizeof(curr_key_attr.val.as_string));
+            pf_strlcpy(curr_key_attr.val.as_string, G_ResTable_NameForID(curr_id), 
+                sizeof(curr_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &curr_key_attr, "curr_key"));
 
             struct attr curr_flag_attr = (struct attr){
@@ -2593,8 +2555,9 @@ bool G_Harvester_LoadState(struct SDL_RWops *stream)
         
             CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
             CHK_TRUE_RET(attr.type == TYPE_STRING);
-            const char *key = si_intern(attr.val.as_string, &s_stringpool, s_stridx);
-            hs->res_name = key;
+            int id = G_ResTable_IDForName(attr.val.as_string);
+            CHK_TRUE_RET(id != RESOURCE_ID_NONE);
+            hs->res_name = G_ResTable_NameForID(id);
         }
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
@@ -2684,8 +2647,9 @@ bool G_Harvester_LoadState(struct SDL_RWops *stream)
             CHK_TRUE_RET(Attr_Parse(stream, &keyattr, true));
             CHK_TRUE_RET(keyattr.type == TYPE_STRING);
 
-            const char *key = si_intern(keyattr.val.as_string, &s_stringpool, s_stridx);
-            vec_name_push(&hs->priority, key);
+            int id = G_ResTable_IDForName(keyattr.val.as_string);
+            CHK_TRUE_RET(id != RESOURCE_ID_NONE);
+            vec_name_push(&hs->priority, G_ResTable_NameForID(id));
         }
         Sched_TryYield();
 
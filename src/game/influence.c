@@ -0,0 +1,444 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "influence.h"
+#include "changes.h"
+#include "game_private.h"
+#include "public/game.h"
+#include "../main.h"
+#include "../event.h"
+#include "../entity.h"
+#include "../perf.h"
+#include "../sched.h"
+#include "../task.h"
+#include "../settings.h"
+#include "../map/public/map.h"
+#include "../map/public/tile.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/vec.h"
+#include "../lib/public/mem.h"
+
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+#define BINS_PER_CHUNK      (8)
+/* On every update, this fraction of the tracked entities is sampled anew 
+ * to pick up the changes that are not recorded in the change log, such as 
+ * changes to the base damage or the resource amount */
+#define RESAMPLE_SLICES     (16)
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+
+/* What a single entity adds to the grids of its' faction */
+struct contrib{
+    int   binx, binz;
+    int   faction_id;
+    float strength;
+    float resources;
+    int   vision_bins;
+};
+
+struct delta{
+    struct contrib prev;
+    struct contrib next;
+};
+
+KHASH_MAP_INIT_INT(contrib, struct contrib)
+
+VEC_TYPE(delta, struct delta)
+VEC_IMPL(static inline, delta, struct delta)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const struct map     *s_map;
+static int                   s_w, s_h;
+static float                 s_binlen;
+/* The grids accumulated into by the background task. When done, the task 
+ * copies them to the back grids, which are swapped with the front grids 
+ * (the ones visible to queries) at the start of the next update. */
+static float                *s_work;
+static float                *s_back;
+static float                *s_front;
+static khash_t(contrib)     *s_contribs;
+static vec_delta_t           s_deltas;
+static struct change_cursor  s_changes;
+static khint_t               s_resample_cursor;
+static unsigned              s_ticks;
+static bool                  s_task_running;
+static uint32_t              s_tid;
+static struct future         s_future;
+/* Cached value of the setting read every tick */
+static struct sval           s_update_hz;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static size_t grid_size(void)
+{
+    return MAX_FACTIONS * INFLUENCE_LAYER_MAX * s_w * s_h;
+}
+
+static float *grid_at(float *grids, int faction_id, enum influence_layer layer)
+{
+    return grids + (faction_id * INFLUENCE_LAYER_MAX + layer) * s_w * s_h;
+}
+
+static bool bins_coords(vec2_t pos, int *out_x, int *out_z)
+{
+    struct map_resolution mapres;
+    M_GetResolution(s_map, &mapres);
+
+    struct map_resolution binres = (struct map_resolution){
+        mapres.chunk_w, mapres.chunk_h,
+        BINS_PER_CHUNK, BINS_PER_CHUNK,
+        mapres.field_w, mapres.field_h
+    };
+
+    struct tile_desc td;
+    if(!M_Tile_DescForPoint2D(binres, M_GetPos(s_map), pos, &td))
+        return false;
+
+    *out_x = td.chunk_c * BINS_PER_CHUNK + td.tile_c;
+    *out_z = td.chunk_r * BINS_PER_CHUNK + td.tile_r;
+    return true;
+}
+
+static bool contribs_equal(const struct contrib *a, const struct contrib *b)
+{
+    if(a->binx < 0 && b->binx < 0)
+        return true;
+    return (a->binx == b->binx)
+        && (a->binz == b->binz)
+        && (a->faction_id == b->faction_id)
+        && (a->strength == b->strength)
+        && (a->resources == b->resources)
+        && (a->vision_bins == b->vision_bins);
+}
+
+static struct contrib influence_sample(uint32_t uid)
+{
+    struct contrib ret = (struct contrib){ .binx = -1, .vision_bins = -1 };
+    if(!G_EntityExists(uid))
+        return ret;
+
+    uint32_t flags = G_FlagsGet(uid);
+    if(flags & (ENTITY_FLAG_ZOMBIE | ENTITY_FLAG_MARKER | ENTITY_FLAG_GARRISONED))
+        return ret;
+
+    int faction_id = G_GetFactionID(uid);
+    if(faction_id < 0 || faction_id >= MAX_FACTIONS)
+        return ret;
+
+    int binx, binz;
+    if(!bins_coords(G_Pos_GetXZ(uid), &binx, &binz))
+        return ret;
+
+    ret.binx = binx;
+    ret.binz = binz;
+    ret.faction_id = faction_id;
+
+    if(flags & ENTITY_FLAG_COMBATABLE) {
+        ret.strength = MAX(G_Combat_GetBaseDamage(uid), 0);
+    }
+    if(flags & ENTITY_FLAG_RESOURCE) {
+        ret.resources = MAX(G_Resource_GetAmount(uid), 0);
+    }
+    float vision = G_GetVisionRange(uid);
+    if(vision > 0.0f) {
+        ret.vision_bins = ceil(vision / s_binlen);
+    }
+    return ret;
+}
+
+static void influence_track(uint32_t uid)
+{
+    struct contrib next = influence_sample(uid);
+    struct contrib prev = (struct contrib){ .binx = -1, .vision_bins = -1 };
+
+    khiter_t k = kh_get(contrib, s_contribs, uid);
+    if(k != kh_end(s_contribs)) {
+        prev = kh_value(s_contribs, k);
+    }
+    if(contribs_equal(&prev, &next))
+        return;
+
+    vec_delta_push(&s_deltas, (struct delta){prev, next});
+
+    if(next.binx < 0) {
+        kh_del(contrib, s_contribs, k);
+        return;
+    }
+    int status;
+    k = kh_put(contrib, s_contribs, uid, &status);
+    if(status == -1)
+        return;
+    kh_value(s_contribs, k) = next;
+}
+
+static void influence_rescan(void)
+{
+    uint32_t uid;
+    kh_foreach_key(s_contribs, uid, {
+        influence_track(uid);
+    });
+    kh_foreach_key(G_GetAllEntsSet(), uid, {
+        influence_track(uid);
+    });
+}
+
+static void influence_gather(void)
+{
+    struct change changes[256];
+    int nchanges;
+    while((nchanges = G_Changes_Read(&s_changes, ARR_SIZE(changes), changes))) {
+        if(nchanges < 0) {
+            influence_rescan();
+            continue;
+        }
+        for(int i = 0; i < nchanges; i++) {
+            influence_track(changes[i].uid);
+        }
+    }
+
+    khint_t nbuckets = kh_end(s_contribs);
+    khint_t nresample = (nbuckets + RESAMPLE_SLICES - 1) / RESAMPLE_SLICES;
+    khint_t begin = (s_resample_cursor < nbuckets) ? s_resample_cursor : 0;
+    khint_t end = MIN(begin + nresample, nbuckets);
+
+    /* Entries can only be removed while iterating, which does not move
+     * any other entry between buckets */
+    for(khint_t i = begin; i < end; i++) {
+        if(!kh_exist(s_contribs, i))
+            continue;
+        influence_track(kh_key(s_contribs, i));
+    }
+    s_resample_cursor = end;
+}
+
+static void apply_contrib(const struct contrib *c, float sign)
+{
+    if(c->binx < 0)
+        return;
+
+    size_t idx = c->binz * s_w + c->binx;
+    grid_at(s_work, c->faction_id, INFLUENCE_STRENGTH)[idx] += sign * c->strength;
+    grid_at(s_work, c->faction_id, INFLUENCE_RESOURCES)[idx] += sign * c->resources;
+
+    if(c->vision_bins < 0)
+        return;
+
+    float *vision = grid_at(s_work, c->faction_id, INFLUENCE_VISION);
+    int r = c->vision_bins;
+    for(int z = MAX(c->binz - r, 0); z <= MIN(c->binz + r, s_h - 1); z++) {
+    for(int x = MAX(c->binx - r, 0); x <= MIN(c->binx + r, s_w - 1); x++) {
+        int dx = x - c->binx, dz = z - c->binz;
+        if(dx * dx + dz * dz > r * r)
+            continue;
+        vision[z * s_w + x] += sign;
+    }}
+}
+
+static struct result influence_task(void *arg)
+{
+    for(int i = 0; i < vec_size(&s_deltas); i++) {
+        const struct delta *curr = &vec_AT(&s_deltas, i);
+        apply_contrib(&curr->prev, -1.0f);
+        apply_contrib(&curr->next, +1.0f);
+        if((i + 1) % 1024 == 0)
+            Task_Yield();
+    }
+    memcpy(s_back, s_work, grid_size() * sizeof(float));
+    return NULL_RESULT;
+}
+
+static void influence_join(void)
+{
+    if(!s_task_running)
+        return;
+
+    while(!Sched_FutureIsReady(&s_future)) {
+        Sched_RunSync(s_tid);
+    }
+    s_task_running = false;
+
+    float *tmp = s_front;
+    s_front = s_back;
+    s_back = tmp;
+}
+
+static void influence_update(void)
+{
+    PERF_ENTER();
+
+    influence_join();
+    vec_delta_reset(&s_deltas);
+    influence_gather();
+
+    if(vec_size(&s_deltas) == 0)
+        PERF_RETURN_VOID();
+
+    SDL_AtomicSet(&s_future.status, FUTURE_INCOMPLETE);
+    s_tid = Sched_Create(4, influence_task, NULL, &s_future, 0);
+    s_task_running = true;
+
+    if(s_tid == NULL_TID) {
+        influence_task(NULL);
+        SDL_AtomicSet(&s_future.status, FUTURE_COMPLETE);
+        influence_join();
+    }
+    PERF_RETURN_VOID();
+}
+
+static void on_60hz_tick(void *user, void *event)
+{
+    unsigned period = 60 / MAX(s_update_hz.as_int, 1);
+    if(s_ticks++ % period)
+        return;
+    influence_update();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Influence_Init(const struct map *map)
+{
+    Settings_Bind("pf.game.influence_update_hz", &s_update_hz);
+
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+
+    s_map = map;
+    s_w = res.chunk_w * BINS_PER_CHUNK;
+    s_h = res.chunk_h * BINS_PER_CHUNK;
+    s_binlen = MAX(
+        (float)(X_COORDS_PER_TILE * TILES_PER_CHUNK_WIDTH)  / BINS_PER_CHUNK,
+        (float)(Z_COORDS_PER_TILE * TILES_PER_CHUNK_HEIGHT) / BINS_PER_CHUNK
+    );
+
+    if(!(s_work = calloc(grid_size(), sizeof(float))))
+        goto fail_work;
+    if(!(s_back = calloc(grid_size(), sizeof(float))))
+        goto fail_back;
+    if(!(s_front = calloc(grid_size(), sizeof(float))))
+        goto fail_front;
+    if(!(s_contribs = kh_init(contrib)))
+        goto fail_contribs;
+    if(!G_Changes_Subscribe(&s_changes, 
+        CHANGE_POS | CHANGE_FACTION | CHANGE_FLAGS | CHANGE_ADDED | CHANGE_REMOVED))
+        goto fail_changes;
+
+    vec_delta_init(&s_deltas);
+    s_resample_cursor = 0;
+    s_ticks = 0;
+    s_task_running = false;
+
+    influence_rescan();
+    E_Global_Register(EVENT_60HZ_TICK, on_60hz_tick, NULL, G_RUNNING);
+    return true;
+
+fail_changes:
+    kh_destroy(contrib, s_contribs);
+fail_contribs:
+    PF_FREE(s_front);
+fail_front:
+    PF_FREE(s_back);
+fail_back:
+    PF_FREE(s_work);
+fail_work:
+    s_map = NULL;
+    return false;
+}
+
+void G_Influence_Shutdown(void)
+{
+    if(!s_map)
+        return;
+
+    E_Global_Unregister(EVENT_60HZ_TICK, on_60hz_tick);
+    influence_join();
+
+    vec_delta_destroy(&s_deltas);
+    G_Changes_Unsubscribe(&s_changes);
+    kh_destroy(contrib, s_contribs);
+    PF_FREE(s_front);
+    PF_FREE(s_back);
+    PF_FREE(s_work);
+    s_map = NULL;
+}
+
+const float *G_Influence_Get(int faction_id, enum influence_layer layer, 
+                             int *out_w, int *out_h)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_map)
+        return NULL;
+    if(faction_id < 0 || faction_id >= MAX_FACTIONS)
+        return NULL;
+    if(layer < 0 || layer >= INFLUENCE_LAYER_MAX)
+        return NULL;
+
+    *out_w = s_w;
+    *out_h = s_h;
+    return grid_at(s_front, faction_id, layer);
+}
+
+float G_Influence_At(int faction_id, enum influence_layer layer, vec2_t xz_pos)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    int w, h;
+    const float *grid = G_Influence_Get(faction_id, layer, &w, &h);
+    if(!grid)
+        return 0.0f;
+
+    int x, z;
+    if(!bins_coords(xz_pos, &x, &z))
+        return 0.0f;
+    return grid[z * w + x];
+}
+
+float G_Influence_BinSize(void)
+{
+    return s_binlen;
+}
+
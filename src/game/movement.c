@@ -39,6 +39,8 @@
 #include "combat.h"
 #include "clearpath.h"
 #include "position.h"
+#include "automation.h"
+#include "timer_events.h"
 #include "public/game.h"
 #include "../config.h"
 #include "../camera.h"
@@ -52,6 +54,8 @@
 #include "../sched.h"
 #include "../task.h"
 #include "../main.h"
+#include "../replay.h"
+#include "../net.h"
 #include "../navigation/public/nav.h"
 #include "../lib/public/queue.h"
 #include "../phys/public/collision.h"
@@ -75,6 +79,10 @@
 #define ENTITY_MASS     (1.0f)
 #define EPSILON         (1.0f/1024)
 #define MAX_FORCE       (0.75f)
+#define MAX_GPU_MOVE_ENTS (32768)
+/* The GPU results are used for at most this many ticks after the work 
+ * was dispatched. After that, the CPU computation takes over again. */
+#define GPU_MOVE_MAX_LAG  (4)
 
 #define SIGNUM(x)    (((x) > 0) - ((x) < 0))
 #define MAX(a, b)    ((a) > (b) ? (a) : (b))
@@ -97,7 +105,10 @@
     }while(0)
 
 #define VEL_HIST_LEN (14)
-#define MAX_MOVE_TASKS (64)
+#define MOVE_TASK_GRAIN (64)
+#define SEEK_TASK_GRAIN (64)
+/* The work must be completed before the next 20Hz tick */
+#define MOVE_TASK_DEADLINE_MS (50)
 
 enum arrival_state{
     /* Entity is moving towards the flock's destination point */
@@ -147,6 +158,14 @@ struct movestate{
     bool               blocking;
     vec2_t             last_stop_pos;
     float              last_stop_radius;
+    /* An entity which comes to a stop only gets written into the navigation
+     * blockers once it has stayed put for a few ticks, so that brief stops
+     * (ex. while waiting for a neighbour to move out of the way) do not 
+     * cause any field invalidations. 
+     */
+    bool               nav_blocked;
+    bool               settling;
+    uint32_t           settle_tick;
     /* Information for waking up from the 'WAITING' state 
      */
     enum arrival_state wait_prev;
@@ -167,6 +186,16 @@ struct movestate{
      * from one field to another. 
      */
     bool               using_surround_field;
+    /* Set for the current tick when the surround target is an enemy. The
+     * field shared by all the units of the faction, guiding to the closest 
+     * of the enemies that it is attacking, is then used instead. 
+     */
+    bool               using_faction_field;
+    /* The separation force computed on the GPU, and the tick during which 
+     * the work for it was dispatched. 0 if it was never computed.
+     */
+    vec2_t             gpu_separation;
+    uint32_t           gpu_separation_tick;
     /* Additional state for entities in 'ENTER_ENTITY_RANGE' state 
      */
     vec2_t             target_prev_pos;
@@ -180,6 +209,11 @@ struct flock{
     khash_t(entity) *ents;
     vec2_t           target_xz; 
     dest_id_t        dest_id;
+    /* The sum of the members' positions, refreshed once every tick
+     * so that the forces of the members don't need to walk the flock. 
+     */
+    vec2_t           pos_sum;
+    size_t           npos;
 };
 
 struct move_work_in{
@@ -204,11 +238,6 @@ struct move_work_out{
     vec2_t   ent_vel;
 };
 
-struct move_task_arg{
-    size_t begin_idx;
-    size_t end_idx;
-};
-
 /* The subset of the gamestate that is necessary 
  * to derive the new entity velocities and positions. 
  * We make a copy of this state so that movement 
@@ -216,23 +245,63 @@ struct move_task_arg{
  * or even be spread over multiple frames. 
  */
 struct move_gamestate{
-    khash_t(id)      *flags;
+    vec_erec_t       *ents;
     khash_t(pos)     *positions;
     qt_ent_t         *postree;
-    khash_t(range)   *sel_radiuses;
-    khash_t(id)      *faction_ids;
     const struct map *map;
 };
 
+/* The result of the thread-safe point seek queries for a single entity. 
+ * Entities for which the queries could not be answered from the already 
+ * cached fields are left for the main thread. 
+ */
+struct seek_result{
+    uint32_t              uid;
+    bool                  resolved;
+    bool                  has_dest_los;
+    vec2_t                vdes;
+};
+
+/* An entity as seen by the neighbour queries. The attributes needed 
+ * by the steering computations are kept alongside the position to save 
+ * a round of hash table lookups for every neighbour.
+ */
+struct neighb_ent{
+    uint32_t uid;
+    uint32_t flags;
+    vec2_t   xz_pos;
+    float    radius;
+};
+
+/* A uniform grid of the positions of all the entities, rebuilt once every 
+ * tick with a counting sort. The entries of every cell are contiguous 
+ * and the cells are sized for the fixed radii of the neighbour queries.
+ */
+struct neighb_grid{
+    float              xmin, zmin;
+    int                nrows, ncols;
+    size_t             ncells;
+    uint32_t          *cell_offsets;
+    struct neighb_ent *ents;
+    struct neighb_ent *staging;
+    uint32_t          *staging_cells;
+    size_t             capacity;
+};
+
 struct move_work{
     struct memstack       mem;
+    struct pos_snapshot   pos_snapshot;
+    vec_erec_t            records;
     struct move_gamestate gamestate;
+    struct neighb_grid    neighbs;
     struct move_work_in  *in;
     struct move_work_out *out;
     size_t                nwork;
-    size_t                ntasks;
-    uint32_t              tids[MAX_MOVE_TASKS];
-    struct future         futures[MAX_MOVE_TASKS];
+    struct seek_result   *seek;
+    size_t                nseek;
+    /* The tick shard of the entities being processed, or -1 for all */
+    int                   shard;
+    struct task_group     group;
 };
 
 enum move_cmd_type{
@@ -253,13 +322,49 @@ enum move_cmd_type{
     MOVE_CMD_BLOCK
 };
 
+enum gpu_move_state{
+    GPU_MOVE_IDLE,
+    GPU_MOVE_DISPATCHED,
+    GPU_MOVE_READING,
+};
+
+/* The steering work offloaded to the GPU is dispatched on one tick and 
+ * its' results are read back on the next. Then, they are picked up by the 
+ * simulation once the render thread has flagged the generation as ready. 
+ * The buffers are statically allocated, as the render thread may still 
+ * write to them after the work has been abandoned.
+ */
+struct gpu_move{
+    bool                enabled;
+    enum gpu_move_state state;
+    uint32_t            dispatch_tick;
+    int                 gen;
+    SDL_atomic_t        ready_gen;
+    size_t              nents;
+    uint32_t            uids[MAX_GPU_MOVE_ENTS];
+    vec2_t              results[MAX_GPU_MOVE_ENTS];
+};
+
+/* Keys for looking up the most recent queued command of an entity 
+ * irrespective of its' type, and the most recent one of the commands 
+ * which determine whether the entity is still. 
+ */
+#define CMD_KEY_ANY   (0xffff)
+#define CMD_KEY_STILL (0xfffe)
+
 struct move_cmd{
     bool               deleted;
     enum move_cmd_type type;
+    /* The sequence number of the previously pushed command with the 
+     * same type for the same entity, or 0 if there is none.
+     */
+    uint64_t           prev;
     struct attr        args[6];
 };
 
-KHASH_MAP_INIT_INT(state, struct movestate)
+KHASH_MAP_INIT_INT(slot, uint32_t)
+KHASH_MAP_INIT_INT(flock_idx, int)
+KHASH_MAP_INIT_INT64(cmd_index, uint64_t)
 
 QUEUE_TYPE(cmd, struct move_cmd)
 QUEUE_IMPL(static, cmd, struct move_cmd)
@@ -267,6 +372,9 @@ QUEUE_IMPL(static, cmd, struct move_cmd)
 VEC_TYPE(flock, struct flock)
 VEC_IMPL(static inline, flock, struct flock)
 
+VEC_TYPE(movestate, struct movestate)
+VEC_IMPL(static inline, movestate, struct movestate)
+
 static void move_push_cmd(struct move_cmd cmd);
 static void do_set_dest(uint32_t uid, vec2_t dest_xz, bool attack);
 static void do_stop(uint32_t uid);
@@ -279,16 +387,20 @@ static void do_update_pos(uint32_t uid, vec2_t pos);
 #define ALIGNMENT_FORCE_SCALE           (0.15f)
 
 #define SEPARATION_BUFFER_DIST          (0.0f)
-#define COHESION_NEIGHBOUR_RADIUS       (50.0f)
 #define ARRIVE_SLOWING_RADIUS           (10.0f)
 #define ADJACENCY_SEP_DIST              (5.0f)
 #define ALIGN_NEIGHBOUR_RADIUS          (10.0f)
 #define SEPARATION_NEIGHB_RADIUS        (30.0f)
+#define NEIGHB_CELL_SIZE                (SEPARATION_NEIGHB_RADIUS)
 #define CELL_ARRIVAL_RADIUS             (30.0f)
 
 #define COLLISION_MAX_SEE_AHEAD         (10.0f)
 #define WAIT_TICKS                      (60)
+#define BLOCK_SETTLE_TICKS              (3)
 #define MAX_TURN_RATE                   (15.0f) /* degree/tick */
+#define LOD_TICK_INTERVAL               (4)
+#define LOD_CLEAR_RADIUS                (2 * SEPARATION_NEIGHB_RADIUS)
+#define LOD_MIN_DEST_DIST               (100.0f)
 
 #define SURROUND_LOW_WATER_X            (CHUNK_WIDTH/3.0f)
 #define SURROUND_HIGH_WATER_X           (CHUNK_WIDTH/2.0f)
@@ -311,16 +423,66 @@ static bool                    s_drag_attacking;
 
 static vec_entity_t            s_move_markers;
 static vec_flock_t             s_flocks;
-static khash_t(state)         *s_entity_state_table;
+/* Indices into 's_flocks' for every flock member and every 
+ * destination with a flock.
+ */
+static khash_t(flock_idx)     *s_ent_flocks;
+static khash_t(flock_idx)     *s_dest_flocks;
+/* The movement states are densely packed, with the UID of the entity 
+ * owning each slot kept in a parallel array. This way, the per-tick 
+ * passes over all the entities are linear sweeps rather than walks 
+ * over the sparse buckets of a hash table.
+ */
+static vec_movestate_t         s_movestates;
+static vec_entity_t            s_movestate_uids;
+static khash_t(slot)          *s_movestate_slots;
 
 /* Store the most recently issued move command location for debug rendering */
 static bool                    s_last_cmd_dest_valid = false;
 static dest_id_t               s_last_cmd_dest;
 
 static struct move_work        s_move_work;
+static struct gpu_move         s_gpu_move;
+/* Incremented every 20Hz tick, starting from 1 */
+static uint32_t                s_move_tick = 1;
+/* Entities which have stopped, but are not yet nav blockers */
+static vec_entity_t            s_settling;
+/* When set, none of the inputs to the movement simulation depend on timing 
+ * or hardware, and a hash of the movement state is taken every tick. Peers 
+ * running the same build will then stay in sync when replaying the same 
+ * commands, which can be checked by comparing the hashes.
+ */
+static bool                    s_deterministic = false;
+static uint64_t                s_state_hash;
 static queue_cmd_t             s_move_commands;
+/* Every queued command is given a sequence number, starting from 1,
+ * which can be used to locate it in the queue. The index maps entity 
+ * and command type pairs to the most recently pushed command and is 
+ * reset every time the queue is drained.
+ */
+static uint64_t                s_move_cmds_pushed;
+static uint64_t                s_move_cmds_popped;
+static khash_t(cmd_index)     *s_move_cmd_index;
 static struct memstack         s_eventargs;
 
+/* Cached values of the settings read every tick or frame */
+static struct{
+    struct sval nav_layer;
+    struct sval show_last_cmd_flow_field;
+    struct sval show_first_sel_movestate;
+    struct sval show_enemy_seek_fields;
+    struct sval enemy_seek_fields_faction_id;
+    struct sval show_navigation_blockers;
+    struct sval show_navigation_portals;
+    struct sval show_navigation_cost_base;
+    struct sval show_chunk_boundaries;
+    struct sval show_navigation_island_ids;
+    struct sval show_navigation_local_island_ids;
+    struct sval gpu_steering_enabled;
+    struct sval gpu_nav_enabled;
+    struct sval deterministic_movement;
+}s_settings;
+
 static const char *s_state_str[] = {
     [STATE_MOVING]              = STR(STATE_MOVING),
     [STATE_MOVING_IN_FORMATION] = STR(STATE_MOVING_IN_FORMATION),
@@ -338,14 +500,277 @@ static const char *s_state_str[] = {
 /*****************************************************************************/
 
 /* The returned pointer is guaranteed to be valid to write to for
- * so long as we don't add anything to the table. At that point, there
- * is a case that a 'realloc' might take place. */
+ * so long as we don't add or remove any states. Adding may 'realloc' 
+ * the array and removing moves the last state into the freed slot. */
 static struct movestate *movestate_get(uint32_t uid)
 {
-    khiter_t k = kh_get(state, s_entity_state_table, uid);
-    if(k == kh_end(s_entity_state_table))
+    khiter_t k = kh_get(slot, s_movestate_slots, uid);
+    if(k == kh_end(s_movestate_slots))
         return NULL;
-    return &kh_value(s_entity_state_table, k);
+    return &vec_AT(&s_movestates, kh_value(s_movestate_slots, k));
+}
+
+static bool movestate_add(uint32_t uid, struct movestate ms)
+{
+    int ret;
+    khiter_t k = kh_put(slot, s_movestate_slots, uid, &ret);
+    if(ret == -1 || ret == 0)
+        return false;
+    kh_value(s_movestate_slots, k) = vec_size(&s_movestates);
+
+    if(!vec_movestate_push(&s_movestates, ms))
+        goto fail_state;
+    if(!vec_entity_push(&s_movestate_uids, uid))
+        goto fail_uid;
+    return true;
+
+fail_uid:
+    vec_movestate_pop(&s_movestates);
+fail_state:
+    kh_del(slot, s_movestate_slots, k);
+    return false;
+}
+
+static void movestate_remove(uint32_t uid)
+{
+    khiter_t k = kh_get(slot, s_movestate_slots, uid);
+    if(k == kh_end(s_movestate_slots))
+        return;
+
+    uint32_t slot = kh_value(s_movestate_slots, k);
+    kh_del(slot, s_movestate_slots, k);
+
+    /* Fill the hole with the last state to keep the array dense */
+    vec_movestate_del(&s_movestates, slot);
+    vec_entity_del(&s_movestate_uids, slot);
+
+    if(slot < vec_size(&s_movestates)) {
+        uint32_t moved = vec_AT(&s_movestate_uids, slot);
+        k = kh_get(slot, s_movestate_slots, moved);
+        assert(k != kh_end(s_movestate_slots));
+        kh_value(s_movestate_slots, k) = slot;
+    }
+}
+
+static bool neighb_grid_init(struct neighb_grid *grid, const qt_ent_t *tree)
+{
+    grid->xmin = tree->xmin;
+    grid->zmin = tree->ymin;
+    grid->ncols = ceil((tree->xmax - tree->xmin) / NEIGHB_CELL_SIZE) + 1;
+    grid->nrows = ceil((tree->ymax - tree->ymin) / NEIGHB_CELL_SIZE) + 1;
+    grid->ncells = grid->nrows * grid->ncols;
+
+    grid->cell_offsets = calloc(grid->ncells + 1, sizeof(uint32_t));
+    if(!grid->cell_offsets)
+        return false;
+
+    grid->ents = NULL;
+    grid->staging = NULL;
+    grid->staging_cells = NULL;
+    grid->capacity = 0;
+    return true;
+}
+
+static void neighb_grid_destroy(struct neighb_grid *grid)
+{
+    PF_FREE(grid->cell_offsets);
+    PF_FREE(grid->ents);
+    PF_FREE(grid->staging);
+    PF_FREE(grid->staging_cells);
+    grid->capacity = 0;
+}
+
+static int neighb_grid_col(const struct neighb_grid *grid, float x)
+{
+    int ret = (x - grid->xmin) / NEIGHB_CELL_SIZE;
+    return MIN(MAX(ret, 0), grid->ncols - 1);
+}
+
+static int neighb_grid_row(const struct neighb_grid *grid, float z)
+{
+    int ret = (z - grid->zmin) / NEIGHB_CELL_SIZE;
+    return MIN(MAX(ret, 0), grid->nrows - 1);
+}
+
+static bool neighb_grid_reserve(struct neighb_grid *grid, size_t size)
+{
+    if(grid->capacity >= size)
+        return true;
+
+    size_t new_cap = MAX(size, grid->capacity * 2);
+    struct neighb_ent *ents = realloc(grid->ents, new_cap * sizeof(struct neighb_ent));
+    if(!ents)
+        return false;
+    grid->ents = ents;
+
+    struct neighb_ent *staging = realloc(grid->staging, new_cap * sizeof(struct neighb_ent));
+    if(!staging)
+        return false;
+    grid->staging = staging;
+
+    uint32_t *staging_cells = realloc(grid->staging_cells, new_cap * sizeof(uint32_t));
+    if(!staging_cells)
+        return false;
+    grid->staging_cells = staging_cells;
+
+    grid->capacity = new_cap;
+    return true;
+}
+
+static void neighb_grid_build(struct neighb_grid *grid, const struct move_gamestate *gs)
+{
+    PERF_ENTER();
+    memset(grid->cell_offsets, 0, (grid->ncells + 1) * sizeof(uint32_t));
+
+    if(!neighb_grid_reserve(grid, kh_size(gs->positions))) {
+        /* Leave the grid empty */
+        PERF_RETURN_VOID();
+    }
+
+    size_t nents = 0;
+    uint32_t uid;
+    vec3_t pos;
+
+    kh_foreach(gs->positions, uid, pos, {
+
+        uint32_t flags = G_FlagsGetFrom(gs->ents, uid);
+        if(flags & ENTITY_FLAG_GARRISONED)
+            continue;
+
+        uint32_t cell = neighb_grid_row(grid, pos.z) * grid->ncols 
+                      + neighb_grid_col(grid, pos.x);
+        grid->staging[nents] = (struct neighb_ent){
+            .uid = uid,
+            .flags = flags,
+            .xz_pos = (vec2_t){pos.x, pos.z},
+            .radius = G_GetSelectionRadiusFrom(gs->ents, uid)
+        };
+        grid->staging_cells[nents] = cell;
+        grid->cell_offsets[cell + 1]++;
+        nents++;
+    });
+
+    for(int i = 0; i < grid->ncells; i++) {
+        grid->cell_offsets[i + 1] += grid->cell_offsets[i];
+    }
+
+    /* Scatter using the offsets as cursors, which then leaves every 
+     * offset pointing one past the end of its' cell. */
+    for(int i = 0; i < nents; i++) {
+        uint32_t cell = grid->staging_cells[i];
+        grid->ents[grid->cell_offsets[cell]++] = grid->staging[i];
+    }
+    memmove(grid->cell_offsets + 1, grid->cell_offsets, grid->ncells * sizeof(uint32_t));
+    grid->cell_offsets[0] = 0;
+
+    PERF_RETURN_VOID();
+}
+
+/* Get the entities within 'radius' of a point, in the same way as a 
+ * 'G_Pos_EntsInCircleFrom' query on the tree the grid was built from.
+ */
+static int neighb_grid_query(const struct neighb_grid *grid, vec2_t xz_point, float radius,
+                             const struct neighb_ent **out, size_t maxout)
+{
+    int ret = 0;
+    int cmin = neighb_grid_col(grid, xz_point.x - radius);
+    int cmax = neighb_grid_col(grid, xz_point.x + radius);
+    int rmin = neighb_grid_row(grid, xz_point.z - radius);
+    int rmax = neighb_grid_row(grid, xz_point.z + radius);
+
+    for(int r = rmin; r <= rmax; r++) {
+    for(int c = cmin; c <= cmax; c++) {
+
+        size_t cell = r * grid->ncols + c;
+        for(int i = grid->cell_offsets[cell]; i < grid->cell_offsets[cell + 1]; i++) {
+
+            const struct neighb_ent *curr = &grid->ents[i];
+            vec2_t diff, pos = curr->xz_pos;
+            PFM_Vec2_Sub(&pos, &xz_point, &diff);
+            if(PFM_Vec2_Dot(&diff, &diff) > radius * radius)
+                continue;
+
+            out[ret++] = curr;
+            if(ret == maxout)
+                return ret;
+        }
+    }}
+    return ret;
+}
+
+static void flock_idx_set(khash_t(flock_idx) *table, uint32_t key, int idx)
+{
+    int status;
+    khiter_t k = kh_put(flock_idx, table, key, &status);
+    assert(status != -1);
+    kh_val(table, k) = idx;
+}
+
+static int flock_idx_get(const khash_t(flock_idx) *table, uint32_t key)
+{
+    khiter_t k = kh_get(flock_idx, (khash_t(flock_idx)*)table, key);
+    if(k == kh_end(table))
+        return -1;
+    return kh_val(table, k);
+}
+
+static void flock_idx_del(khash_t(flock_idx) *table, uint32_t key)
+{
+    khiter_t k = kh_get(flock_idx, table, key);
+    if(k != kh_end(table)) {
+        kh_del(flock_idx, table, k);
+    }
+}
+
+/* Get the index of the flock in 's_flocks', or -1 if
+ * it's not been added yet. 
+ */
+static int flock_index(const struct flock *flock)
+{
+    if(vec_size(&s_flocks) == 0)
+        return -1;
+    if(flock < &vec_AT(&s_flocks, 0) || flock > &vec_AT(&s_flocks, vec_size(&s_flocks) - 1))
+        return -1;
+    return flock - &vec_AT(&s_flocks, 0);
+}
+
+static void flock_reindex(int idx)
+{
+    struct flock *flock = &vec_AT(&s_flocks, idx);
+    flock_idx_set(s_dest_flocks, flock->dest_id, idx);
+
+    uint32_t uid;
+    kh_foreach_key(flock->ents, uid, {
+        flock_idx_set(s_ent_flocks, uid, idx);
+    });
+}
+
+static bool flock_push(struct flock flock)
+{
+    if(!vec_flock_push(&s_flocks, flock))
+        return false;
+    flock_reindex(vec_size(&s_flocks) - 1);
+    return true;
+}
+
+/* The last flock in the vector takes the place of the deleted one */
+static void flock_delete(int idx)
+{
+    struct flock *flock = &vec_AT(&s_flocks, idx);
+    if(flock_idx_get(s_dest_flocks, flock->dest_id) == idx) {
+        flock_idx_del(s_dest_flocks, flock->dest_id);
+    }
+
+    uint32_t uid;
+    kh_foreach_key(flock->ents, uid, {
+        flock_idx_del(s_ent_flocks, uid);
+    });
+    kh_destroy(entity, flock->ents);
+
+    vec_flock_del(&s_flocks, idx);
+    if(idx < vec_size(&s_flocks)) {
+        flock_reindex(idx);
+    }
 }
 
 static void flock_try_remove(struct flock *flock, uint32_t uid)
@@ -354,6 +779,9 @@ static void flock_try_remove(struct flock *flock, uint32_t uid)
     if((k = kh_get(entity, flock->ents, uid)) != kh_end(flock->ents)) {
         kh_del(entity, flock->ents, k);
         G_Formation_RemoveUnit(uid);
+        if(flock_index(flock) >= 0) {
+            flock_idx_del(s_ent_flocks, uid);
+        }
     }
 }
 
@@ -362,60 +790,72 @@ static void flock_add(struct flock *flock, uint32_t uid)
     int ret;
     khiter_t k = kh_put(entity, flock->ents, uid, &ret);
     assert(ret != -1 && ret != 0);
-}
 
-static bool flock_contains(const struct flock *flock, uint32_t uid)
-{
-    khiter_t k = kh_get(entity, flock->ents, uid);
-    if(k != kh_end(flock->ents))
-        return true;
-    return false;
+    int idx = flock_index(flock);
+    if(idx >= 0) {
+        flock_idx_set(s_ent_flocks, uid, idx);
+    }
 }
 
 static struct flock *flock_for_ent(uint32_t uid)
 {
-    for(int i = 0; i < vec_size(&s_flocks); i++) {
-
-        struct flock *curr_flock = &vec_AT(&s_flocks, i);            
-        if(flock_contains(curr_flock, uid))
-            return curr_flock;
-    }
-    return NULL;
+    int idx = flock_idx_get(s_ent_flocks, uid);
+    if(idx < 0)
+        return NULL;
+    return &vec_AT(&s_flocks, idx);
 }
 
 uint32_t flock_id_for_ent(uint32_t uid, const struct flock **out)
 {
-    for(int i = 0; i < vec_size(&s_flocks); i++) {
-
-        struct flock *curr_flock = &vec_AT(&s_flocks, i);            
-        khiter_t k = kh_get(entity, curr_flock->ents, uid);
-        if(k != kh_end(curr_flock->ents)) {
-            *out = curr_flock;
-            return (i + 1);
-        }
+    int idx = flock_idx_get(s_ent_flocks, uid);
+    if(idx < 0) {
+        *out = NULL;
+        return 0;
     }
-    *out = NULL;
-    return 0;
+    *out = &vec_AT(&s_flocks, idx);
+    return (idx + 1);
 }
 
 static struct flock *flock_for_dest(dest_id_t id)
 {
+    int idx = flock_idx_get(s_dest_flocks, id);
+    if(idx < 0)
+        return NULL;
+    return &vec_AT(&s_flocks, idx);
+}
+
+static void flocks_update_aggregates(void)
+{
+    PERF_ENTER();
     for(int i = 0; i < vec_size(&s_flocks); i++) {
 
-        struct flock *curr_flock = &vec_AT(&s_flocks, i);            
-        if(curr_flock->dest_id == id)
-            return curr_flock;
+        struct flock *flock = &vec_AT(&s_flocks, i);
+        flock->pos_sum = (vec2_t){0.0f, 0.0f};
+        flock->npos = 0;
+
+        uint32_t uid;
+        kh_foreach_key(flock->ents, uid, {
+            vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
+            PFM_Vec2_Add(&flock->pos_sum, &pos, &flock->pos_sum);
+            flock->npos++;
+        });
     }
-    return NULL;
+    PERF_RETURN_VOID();
 }
 
-static void entity_block(uint32_t uid)
+static void entity_nav_block(uint32_t uid, struct movestate *ms)
 {
-    float sel_radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
+    assert(ms->blocking && !ms->nav_blocked);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
+    M_NavBlockersIncref(ms->last_stop_pos, ms->last_stop_radius, 
+        G_GetFactionIDFrom(s_move_work.gamestate.ents, uid), flags, s_map);
+    ms->nav_blocked = true;
+}
+
+static void entity_block(uint32_t uid, bool settle)
+{
+    float sel_radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
     vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
-    M_NavBlockersIncref(pos, sel_radius, 
-        G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid), flags, s_map);
 
     struct movestate *ms = movestate_get(uid);
     assert(!ms->blocking);
@@ -423,6 +863,17 @@ static void entity_block(uint32_t uid)
     ms->blocking = true;
     ms->last_stop_pos = pos;
     ms->last_stop_radius = sel_radius;
+
+    if(settle) {
+        ms->settle_tick = s_move_tick + BLOCK_SETTLE_TICKS;
+        if(!ms->settling && vec_entity_push(&s_settling, uid)) {
+            ms->settling = true;
+        }
+    }
+    if(!ms->settling) {
+        entity_nav_block(uid, ms);
+    }
+
     struct entity_block_desc *desc = stalloc(&s_eventargs, sizeof(struct entity_block_desc));
     *desc = (struct entity_block_desc){
         .uid = uid,
@@ -437,9 +888,12 @@ static void entity_unblock(uint32_t uid)
     struct movestate *ms = movestate_get(uid);
     assert(ms->blocking);
 
-    int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid);
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
-    M_NavBlockersDecref(ms->last_stop_pos, ms->last_stop_radius, faction_id, flags, s_map);
+    if(ms->nav_blocked) {
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
+        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
+        M_NavBlockersDecref(ms->last_stop_pos, ms->last_stop_radius, faction_id, flags, s_map);
+        ms->nav_blocked = false;
+    }
     ms->blocking = false;
 
     struct entity_block_desc *desc = stalloc(&s_eventargs, sizeof(struct entity_block_desc));
@@ -451,6 +905,31 @@ static void entity_unblock(uint32_t uid)
     E_Global_Notify(EVENT_MOVABLE_ENTITY_UNBLOCK, desc, ES_ENGINE);
 }
 
+/* Entities which started moving again before settling are dropped without 
+ * ever having touched the navigation data. The list may hold stale or 
+ * duplicate UIDs, which are harmless.
+ */
+static void settle_blockers(void)
+{
+    PERF_ENTER();
+    for(int i = vec_size(&s_settling) - 1; i >= 0; i--) {
+
+        uint32_t uid = vec_AT(&s_settling, i);
+        struct movestate *ms = movestate_get(uid);
+
+        if(ms && ms->blocking && !ms->nav_blocked) {
+            if((int32_t)(s_move_tick - ms->settle_tick) < 0)
+                continue;
+            entity_nav_block(uid, ms);
+        }
+        if(ms) {
+            ms->settling = false;
+        }
+        vec_entity_del(&s_settling, i);
+    }
+    PERF_RETURN_VOID();
+}
+
 static bool stationary(uint32_t uid)
 {
     struct movestate *ms = movestate_get(uid);
@@ -518,7 +997,10 @@ static void entity_finish_moving(uint32_t uid, enum arrival_state newstate, bool
     ms->vnew = (vec2_t){0.0f, 0.0f};
 
     if(block) {
-        entity_block(uid);
+        entity_block(uid, true);
+    }
+    if(newstate == STATE_ARRIVED) {
+        G_Automation_NotifyStateChanged(uid);
     }
     assert(ent_still(ms));
 }
@@ -541,19 +1023,14 @@ static void remove_from_flocks(uint32_t uid)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    /* Remove any flocks which may have become empty. Iterate vector in backwards order 
-     * so that we can delete while iterating, since the last element in the vector takes
-     * the place of the deleted one. 
-     */
-    for(int i = vec_size(&s_flocks)-1; i >= 0; i--) {
-
-        struct flock *curr_flock = &vec_AT(&s_flocks, i);
-        flock_try_remove(curr_flock, uid);
+    /* Remove the flock if it has become empty */
+    struct flock *flock = flock_for_ent(uid);
+    if(!flock)
+        return;
 
-        if(kh_size(curr_flock->ents) == 0) {
-            kh_destroy(entity, curr_flock->ents);
-            vec_flock_del(&s_flocks, i);
-        }
+    flock_try_remove(flock, uid);
+    if(kh_size(flock->ents) == 0) {
+        flock_delete(flock_index(flock));
     }
     assert(NULL == flock_for_ent(uid));
 }
@@ -571,8 +1048,8 @@ static void filter_selection_pathable(const vec_entity_t *in_sel, vec_entity_t *
             continue;
 
         vec2_t xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, curr);
-        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, curr);
-        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, curr);
+        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, curr);
+        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, curr);
         if(!M_NavPositionPathable(s_map, Entity_NavLayerWithRadius(flags, radius), xz_pos))
             continue;
         vec_entity_push(out_sel, curr);
@@ -590,8 +1067,8 @@ static void split_into_layers(const vec_entity_t *sel, vec_entity_t layer_flocks
     for(int i = 0; i < vec_size(sel); i++) {
 
         uint32_t curr = vec_AT(sel, i);
-        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, curr);
-        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, curr);
+        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, curr);
+        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, curr);
         enum nav_layer layer = Entity_NavLayerWithRadius(flags, radius);
         vec_entity_push(&layer_flocks[layer], curr);
     }
@@ -641,6 +1118,7 @@ static bool make_flock(const vec_entity_t *units, vec2_t target_xz,
         if(ent_still(ms)) {
             entity_unblock(curr_ent); 
             E_Entity_Notify(EVENT_MOTION_START, curr_ent, NULL, ES_ENGINE);
+            G_Automation_NotifyStateChanged(curr_ent);
         }
 
         flock_add(&new_flock, curr_ent);
@@ -650,7 +1128,7 @@ static bool make_flock(const vec_entity_t *units, vec2_t target_xz,
     /* The flow fields will be computed on-demand during the next movement update tick */
     new_flock.target_xz = target_xz;
     if(attack) {
-        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, first);
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, first);
         new_flock.dest_id = M_NavDestIDForPosAttacking(s_map, target_xz, layer, faction_id);
     }else{
         new_flock.dest_id = M_NavDestIDForPos(s_map, target_xz, layer);
@@ -671,8 +1149,8 @@ static bool make_flock(const vec_entity_t *units, vec2_t target_xz,
     
     }else{
         formation_id_t fid;
-        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, first);
-        vec_flock_push(&s_flocks, new_flock);
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, first);
+        flock_push(new_flock);
     }
 
     s_last_cmd_dest_valid = true;
@@ -719,8 +1197,8 @@ static size_t adjacent_flock_members(uint32_t uid, const struct flock *flock,
         vec2_t curr_xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, curr);
         PFM_Vec2_Sub(&ent_xz_pos, &curr_xz_pos, &diff);
 
-        float radius_uid = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
-        float radius_curr = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, curr);
+        float radius_uid = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+        float radius_curr = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, curr);
 
         if(PFM_Vec2_Len(&diff) <= radius_uid + radius_curr + ADJACENCY_SEP_DIST) {
             out[ret++] = curr;  
@@ -738,8 +1216,10 @@ static void move_marker_add(vec3_t pos, bool attack)
                                      "__move_marker__", uid, &flags) 
                 : AL_EntityFromPFObj("assets/models/arrow", "arrow-green.pfobj", 
                                      "__move_marker__", uid, &flags);
-    if(!loaded)
+    if(!loaded) {
+        Entity_FreeUID(uid);
         return;
+    }
 
     flags |= ENTITY_FLAG_MARKER;
     G_AddEntity(uid, flags, pos);
@@ -805,6 +1285,19 @@ static void move_order(const vec_entity_t *sel, bool attack, vec3_t mouse_coord,
     }
 }
 
+static void issue_move_order(const vec_entity_t *sel, bool attack, vec3_t mouse_coord, 
+                             vec2_t orientation)
+{
+    Net_IssueCommand(&(struct replay_cmd){
+        .type = REPLAY_CMD_MOVE,
+        .nents = vec_size(sel),
+        .ents = sel->array,
+        .attack = attack,
+        .pos = mouse_coord,
+        .orientation = orientation
+    });
+}
+
 static void on_mousedown(void *user, void *event)
 {
     SDL_MouseButtonEvent *mouse_event = &(((SDL_Event*)event)->button);
@@ -861,7 +1354,7 @@ static void on_mousedown(void *user, void *event)
         return;
     }
 
-    move_order(sel, attack, mouse_coord, (vec2_t){0.0f, 0.0f});
+    issue_move_order(sel, attack, mouse_coord, (vec2_t){0.0f, 0.0f});
 }
 
 static void on_mouseup(void *user, void *event)
@@ -885,7 +1378,7 @@ static void on_mouseup(void *user, void *event)
     }else{
         PFM_Vec2_Normal(&orientation, &orientation);
     }
-    move_order(sel, s_drag_attacking, s_drag_begin_pos, orientation);
+    issue_move_order(sel, s_drag_attacking, s_drag_begin_pos, orientation);
 }
 
 static void on_mousemotion(void *user, void *event)
@@ -940,29 +1433,16 @@ static void on_render_3d(void *user, void *event)
     }
 
     const struct camera *cam = G_GetActiveCamera();
-    enum nav_layer layer;
-
-    struct sval setting;
-    ss_e status;
-    (void)status;
+    enum nav_layer layer = s_settings.nav_layer.as_int;
 
-    status = Settings_Get("pf.debug.navigation_layer", &setting);
-    assert(status == SS_OKAY);
-    layer = setting.as_int;
-
-    status = Settings_Get("pf.debug.show_last_cmd_flow_field", &setting);
-    assert(status == SS_OKAY);
-    if(setting.as_bool && s_last_cmd_dest_valid) {
+    if(s_settings.show_last_cmd_flow_field.as_bool && s_last_cmd_dest_valid) {
         M_NavRenderVisiblePathFlowField(s_map, cam, s_last_cmd_dest);
     }
 
-    status = Settings_Get("pf.debug.show_first_sel_movestate", &setting);
-    assert(status == SS_OKAY);
-
     enum selection_type seltype;
     const vec_entity_t *sel = G_Sel_Get(&seltype);
 
-    if(setting.as_bool && vec_size(sel) > 0) {
+    if(s_settings.show_first_sel_movestate.as_bool && vec_size(sel) > 0) {
     
         uint32_t ent = vec_AT(sel, 0);
         struct movestate *ms = movestate_get(ent);
@@ -991,8 +1471,8 @@ static void on_render_3d(void *user, void *event)
 
                 if(ms->using_surround_field) {
                     float radius = G_GetSelectionRadiusFrom(
-                        s_move_work.gamestate.sel_radiuses, ent);
-                    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, ent);
+                        s_move_work.gamestate.ents, ent);
+                    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, ent);
                     int layer = Entity_NavLayerWithRadius(flags, radius); 
                     M_NavRenderVisibleSurroundField(s_map, cam, layer, ms->surround_target_uid);
                     UI_DrawText("(Surround Field)", (struct rect){5,75,600,50}, text_color);
@@ -1008,10 +1488,10 @@ static void on_render_3d(void *user, void *event)
                 break;
             case STATE_SEEK_ENEMIES: {
                 float radius = G_GetSelectionRadiusFrom(
-                    s_move_work.gamestate.sel_radiuses, ent);
-                uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, ent);
+                    s_move_work.gamestate.ents, ent);
+                uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, ent);
                 int layer = Entity_NavLayerWithRadius(flags, radius); 
-                int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, ent);
+                int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, ent);
                 M_NavRenderVisibleEnemySeekField(s_map, cam, layer, faction_id);
                 break;
             }
@@ -1024,49 +1504,32 @@ static void on_render_3d(void *user, void *event)
         }
     }
 
-    status = Settings_Get("pf.debug.show_enemy_seek_fields", &setting);
-    assert(status == SS_OKAY);
-    if(setting.as_bool) {
-
-        status = Settings_Get("pf.debug.enemy_seek_fields_faction_id", &setting);
-        assert(status == SS_OKAY);
-    
-        M_NavRenderVisibleEnemySeekField(s_map, cam, layer, setting.as_int);
+    if(s_settings.show_enemy_seek_fields.as_bool) {
+        M_NavRenderVisibleEnemySeekField(s_map, cam, layer, 
+            s_settings.enemy_seek_fields_faction_id.as_int);
     }
 
-    status = Settings_Get("pf.debug.show_navigation_blockers", &setting);
-    assert(status == SS_OKAY);
-    if(setting.as_bool) {
+    if(s_settings.show_navigation_blockers.as_bool) {
         M_NavRenderNavigationBlockers(s_map, cam, layer);
     }
 
-    status = Settings_Get("pf.debug.show_navigation_portals", &setting);
-    assert(status == SS_OKAY);
-    if(setting.as_bool) {
+    if(s_settings.show_navigation_portals.as_bool) {
         M_NavRenderNavigationPortals(s_map, cam, layer);
     }
 
-    status = Settings_Get("pf.debug.show_navigation_cost_base", &setting);
-    assert(status == SS_OKAY);
-    if(setting.as_bool) {
+    if(s_settings.show_navigation_cost_base.as_bool) {
         M_RenderVisiblePathableLayer(s_map, cam, layer);
     }
 
-    status = Settings_Get("pf.debug.show_chunk_boundaries", &setting);
-    assert(status == SS_OKAY);
-    if(setting.as_bool) {
+    if(s_settings.show_chunk_boundaries.as_bool) {
         M_RenderChunkBoundaries(s_map, cam);
     }
 
-    status = Settings_Get("pf.debug.show_navigation_island_ids", &setting);
-    assert(status == SS_OKAY);
-    if(setting.as_bool) {
+    if(s_settings.show_navigation_island_ids.as_bool) {
         M_NavRenderNavigationIslandIDs(s_map, cam, layer);
     }
 
-    status = Settings_Get("pf.debug.show_navigation_local_island_ids", &setting);
-    assert(status == SS_OKAY);
-    if(setting.as_bool) {
+    if(s_settings.show_navigation_local_island_ids.as_bool) {
         M_NavRenderNavigationLocalIslandIDs(s_map, cam, layer);
     }
 }
@@ -1097,29 +1560,38 @@ static void request_async_field(uint32_t uid)
 
     switch(ms->state) {
     case STATE_SEEK_ENEMIES:  {
-        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
-        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
         int layer = Entity_NavLayerWithRadius(flags, radius);
-        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid);
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
         return M_NavRequestAsyncEnemySeekField(s_map, layer, pos_xz, faction_id);
     }
     case STATE_SURROUND_ENTITY: {
 
         if(!G_EntityExists(ms->surround_target_uid))
-            return;
+            return M_NavRequestAsyncPath(s_map, fl->dest_id, pos_xz, fl->target_xz);
 
         if(ms->using_surround_field) {
-            float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
-            uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+            float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+            uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
             int layer = Entity_NavLayerWithRadius(flags, radius);
-            int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid);
+            int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
+            if(ms->using_faction_field)
+                return M_NavRequestAsyncFactionTargetsField(s_map, layer, pos_xz, faction_id);
             return M_NavRequestAsyncSurroundField(s_map, layer, pos_xz, 
                 ms->surround_target_uid, faction_id);
         }
-        break;
+        return M_NavRequestAsyncPath(s_map, fl->dest_id, pos_xz, fl->target_xz);
     }
-    default:;
-        /* No-op */
+    case STATE_TURNING:
+    case STATE_ARRIVING_TO_CELL:
+        break;
+    default:
+        /* Batch up the path requests of all the entities that are
+         * about to need one */
+        if(fl) {
+            M_NavRequestAsyncPath(s_map, fl->dest_id, pos_xz, fl->target_xz);
+        }
     }
 }
 
@@ -1136,10 +1608,10 @@ static vec2_t ent_desired_velocity(uint32_t uid)
         return (vec2_t){0.0f, 0.0f};
 
     case STATE_SEEK_ENEMIES:  {
-        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
-        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
         int layer = Entity_NavLayerWithRadius(flags, radius);
-        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid);
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
         return M_NavDesiredEnemySeekVelocity(s_map, layer, pos_xz, faction_id);
     }
     case STATE_SURROUND_ENTITY: {
@@ -1163,10 +1635,12 @@ static vec2_t ent_desired_velocity(uint32_t uid)
         }
 
         if(ms->using_surround_field) {
-            float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
-            uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+            float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+            uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
             int layer = Entity_NavLayerWithRadius(flags, radius);
-            int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid);
+            int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
+            if(ms->using_faction_field)
+                return M_NavDesiredFactionTargetsVelocity(s_map, layer, pos_xz, faction_id);
             return M_NavDesiredSurroundVelocity(s_map, layer, pos_xz, 
                 ms->surround_target_uid, faction_id);
         }else{
@@ -1317,38 +1791,20 @@ static vec2_t alignment_force(uint32_t uid, const struct flock *flock)
     return ret;
 }
 
-/* Cohesion is a behaviour that causes agents to steer towards the center of mass of nearby agents.
+/* Cohesion is a behaviour that causes agents to steer towards the center of mass of the 
+ * other agents in the flock.
  */
 static vec2_t cohesion_force(uint32_t uid, const struct flock *flock)
 {
-    vec2_t COM = (vec2_t){0.0f};
-    size_t neighbour_count = 0;
-    vec2_t ent_xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
-
-    uint32_t curr;
-    kh_foreach_key(flock->ents, curr, {
-
-        if(curr == uid)
-            continue;
-
-        vec2_t diff;
-        vec2_t curr_xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, curr);
-        PFM_Vec2_Sub(&curr_xz_pos, &ent_xz_pos, &diff);
-
-        float t = (PFM_Vec2_Len(&diff) 
-                - COHESION_NEIGHBOUR_RADIUS*0.75) / COHESION_NEIGHBOUR_RADIUS;
-        float scale = exp(-6.0f * t);
-
-        PFM_Vec2_Scale(&curr_xz_pos, scale, &curr_xz_pos);
-        PFM_Vec2_Add(&COM, &curr_xz_pos, &COM);
-        neighbour_count++;
-    });
-
-    if(0 == neighbour_count)
+    if(flock->npos < 2)
         return (vec2_t){0.0f};
 
+    vec2_t ent_xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
+    vec2_t COM = flock->pos_sum;
+    PFM_Vec2_Sub(&COM, &ent_xz_pos, &COM);
+    PFM_Vec2_Scale(&COM, 1.0f / (flock->npos - 1), &COM);
+
     vec2_t ret;
-    PFM_Vec2_Scale(&COM, 1.0f / neighbour_count, &COM);
     PFM_Vec2_Sub(&COM, &ent_xz_pos, &ret);
     vec2_truncate(&ret, MAX_FORCE);
     return ret;
@@ -1358,32 +1814,34 @@ static vec2_t cohesion_force(uint32_t uid, const struct flock *flock)
  */
 static vec2_t separation_force(uint32_t uid, float buffer_dist)
 {
+    const struct movestate *ms = movestate_get(uid);
+    if(s_gpu_move.enabled 
+    && ms && ms->gpu_separation_tick 
+    && (s_move_tick - ms->gpu_separation_tick) <= GPU_MOVE_MAX_LAG)
+        return ms->gpu_separation;
+
     vec2_t ret = (vec2_t){0.0f};
-    uint32_t ent_flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
-    uint32_t near_ents[128];
-    int num_near = G_Pos_EntsInCircleFrom(s_move_work.gamestate.postree,
-        s_move_work.gamestate.flags,
-        G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid), 
+    uint32_t ent_flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
+    vec2_t ent_xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
+    float ent_radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+
+    const struct neighb_ent *near_ents[128];
+    int num_near = neighb_grid_query(&s_move_work.neighbs, ent_xz_pos,
         SEPARATION_NEIGHB_RADIUS, near_ents, ARR_SIZE(near_ents));
 
     for(int i = 0; i < num_near; i++) {
 
-        uint32_t curr = near_ents[i];
-        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, curr);
-        if(curr == uid)
+        const struct neighb_ent *curr = near_ents[i];
+        if(curr->uid == uid)
             continue;
-        if(!(flags & ENTITY_FLAG_MOVABLE))
+        if(!(curr->flags & ENTITY_FLAG_MOVABLE))
             continue;
-        if((ent_flags & ENTITY_FLAG_AIR) != (flags & ENTITY_FLAG_AIR))
+        if((ent_flags & ENTITY_FLAG_AIR) != (curr->flags & ENTITY_FLAG_AIR))
             continue;
 
         vec2_t diff;
-        vec2_t ent_xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
-        vec2_t curr_xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, curr);
-
-        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid) 
-                     + G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, curr) 
-                     + buffer_dist;
+        vec2_t curr_xz_pos = curr->xz_pos;
+        float radius = ent_radius + curr->radius + buffer_dist;
         PFM_Vec2_Sub(&curr_xz_pos, &ent_xz_pos, &diff);
 
         if(PFM_Vec2_Len(&diff) < EPSILON)
@@ -1497,8 +1955,8 @@ static vec2_t new_pos_for_vel(uint32_t uid, vec2_t velocity)
 static void nullify_impass_components(uint32_t uid, vec2_t *inout_force)
 {
     vec2_t nt_dims = N_TileDims();
-    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
     enum nav_layer layer = Entity_NavLayerWithRadius(flags, radius);
 
     vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
@@ -1723,72 +2181,88 @@ static vec2_t vel_wma(const struct movestate *ms)
     return ret;
 }
 
-static bool uids_match(void *arg, struct move_cmd *cmd)
+static uint64_t cmd_key(uint32_t uid, int type)
 {
-    uint32_t desired_uid = (uintptr_t)arg;
-    uint32_t actual_uid = cmd->args[0].val.as_int;
-    return (desired_uid == actual_uid);
+    return (((uint64_t)uid) << 32) | (uint32_t)type;
 }
 
-static struct move_cmd *snoop_most_recent_command(enum move_cmd_type type, void *arg,
-                                                  bool (*pred)(void*, struct move_cmd*),
-                                                  bool remove)
+static uint64_t cmd_index_get(uint32_t uid, int type)
+{
+    khiter_t k = kh_get(cmd_index, s_move_cmd_index, cmd_key(uid, type));
+    if(k == kh_end(s_move_cmd_index))
+        return 0;
+    return kh_val(s_move_cmd_index, k);
+}
+
+static void cmd_index_set(uint32_t uid, int type, uint64_t seq)
 {
-    if(queue_size(s_move_commands) == 0)
+    int status;
+    khiter_t k = kh_put(cmd_index, s_move_cmd_index, cmd_key(uid, type), &status);
+    if(status == -1)
+        return;
+    kh_val(s_move_cmd_index, k) = seq;
+}
+
+/* Get the queued command with the specified sequence number, or NULL
+ * if it has already been popped.
+ */
+static struct move_cmd *cmd_at(uint64_t seq)
+{
+    if(seq <= s_move_cmds_popped)
         return NULL;
+    assert(seq <= s_move_cmds_pushed);
+    size_t offset = seq - s_move_cmds_popped - 1;
+    size_t idx = (s_move_commands.ihead + offset) % s_move_commands.capacity;
+    return &s_move_commands.mem[idx];
+}
 
-    size_t left = queue_size(s_move_commands);
-    for(int i = s_move_commands.itail; left > 0;) {
-        struct move_cmd *curr = &s_move_commands.mem[i];
-        if(!curr->deleted && curr->type == type) {
-            if(pred(arg, curr)) {
-                curr->deleted = true;
-                return curr;
-            }
-        }
-        i--;
-        left--;
-        if(i < 0) {
-            i = s_move_commands.capacity - 1; /* Wrap around */
-        }
-    }
-    return NULL;
+/* All commands, except for the ones that operate on a set of
+ * entities, have the entity's UID as their' first argument.
+ */
+static bool cmd_has_uid(enum move_cmd_type type)
+{
+    return (type != MOVE_CMD_MAKE_FLOCKS);
 }
 
-static bool snoop_still(uint32_t uid)
+static bool cmd_sets_still(enum move_cmd_type type)
 {
-    if(queue_size(s_move_commands) == 0) {
-        struct movestate *ms = movestate_get(uid);
-        assert(ms);
-        return (ms->state == STATE_ARRIVED);
+    switch(type) {
+    case MOVE_CMD_SET_DEST:
+    case MOVE_CMD_CHANGE_DIRECTION:
+    case MOVE_CMD_SET_ENTER_RANGE:
+    case MOVE_CMD_SET_SEEK_ENEMIES:
+    case MOVE_CMD_SET_SURROUND_ENTITY:
+    case MOVE_CMD_STOP:
+        return true;
+    default:
+        return false;
     }
+}
 
-    size_t left = queue_size(s_move_commands);
-    for(int i = s_move_commands.itail; left > 0;) {
-        struct move_cmd *curr = &s_move_commands.mem[i];
-        switch(curr->type) {
-        case MOVE_CMD_SET_DEST:
-        case MOVE_CMD_CHANGE_DIRECTION:
-        case MOVE_CMD_SET_ENTER_RANGE:
-        case MOVE_CMD_SET_SEEK_ENEMIES:
-        case MOVE_CMD_SET_SURROUND_ENTITY: {
-            if(curr->args[0].val.as_int == uid)
-                return false;
-            break;
-        }
-        case MOVE_CMD_STOP:
-            if(curr->args[0].val.as_int == uid)
-                return true;
-            break;
-        default:
-            break;
-        }
-        i--;
-        left--;
-        if(i < 0) {
-            i = s_move_commands.capacity - 1; /* Wrap around */
+static struct move_cmd *snoop_most_recent_command(enum move_cmd_type type, uint32_t uid,
+                                                  bool remove)
+{
+    struct move_cmd *curr;
+    uint64_t seq = cmd_index_get(uid, type);
+
+    while((curr = cmd_at(seq))) {
+        assert(curr->type == type);
+        if(!curr->deleted) {
+            if(remove) {
+                curr->deleted = true;
+            }
+            return curr;
         }
+        seq = curr->prev;
     }
+    return NULL;
+}
+
+static bool snoop_still(uint32_t uid)
+{
+    struct move_cmd *curr = cmd_at(cmd_index_get(uid, CMD_KEY_STILL));
+    if(curr)
+        return (curr->type == MOVE_CMD_STOP);
 
     struct movestate *ms = movestate_get(uid);
     assert(ms);
@@ -1798,8 +2272,7 @@ static bool snoop_still(uint32_t uid)
 static void flush_update_pos_commands(uint32_t uid)
 {
     struct move_cmd *cmd;
-    while((cmd = snoop_most_recent_command(MOVE_CMD_UPDATE_POS, 
-        (void*)(uintptr_t)uid, uids_match, true))) {
+    while((cmd = snoop_most_recent_command(MOVE_CMD_UPDATE_POS, uid, true))) {
 
         uint32_t uid = cmd->args[0].val.as_int;
         vec2_t pos = cmd->args[1].val.as_vec2;
@@ -1815,9 +2288,9 @@ static bool arrived(uint32_t uid)
     assert(flock);
 
     PFM_Vec2_Sub((vec2_t*)&flock->target_xz, &xz_pos, &diff_to_target);
-    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
+    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
     float arrive_thresh = radius * 1.5f;
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
     enum nav_layer layer = Entity_NavLayerWithRadius(flags, radius);
 
     if(PFM_Vec2_Len(&diff_to_target) < arrive_thresh
@@ -1837,26 +2310,36 @@ static bool arrived(uint32_t uid)
     return false;
 }
 
-static float unit_height(uint32_t uid, vec2_t pos)
+/* The height of the unit, given the height of the terrain underneath it */
+static float unit_height_over(uint32_t uid, float terrain_height)
 {
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
     if(flags & ENTITY_FLAG_WATER)
         return 0.0f;
     if(flags & ENTITY_FLAG_AIR) {
-        return M_HeightAtPoint(s_map, pos) + AIR_UNIT_HEIGHT;
+        return terrain_height + AIR_UNIT_HEIGHT;
     }
-    return M_HeightAtPoint(s_map, pos);
+    return terrain_height;
+}
+
+static float unit_height(uint32_t uid, vec2_t pos)
+{
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
+    if(flags & ENTITY_FLAG_WATER)
+        return 0.0f;
+    return unit_height_over(uid, M_HeightAtPoint(s_map, pos));
 }
 
-static void entity_update(uint32_t uid, vec2_t new_vel)
+/* 'terrain_height' is the height of the map at the entity's new position */
+static void entity_update(uint32_t uid, vec2_t new_vel, float terrain_height)
 {
     ASSERT_IN_MAIN_THREAD();
     struct movestate *ms = movestate_get(uid);
     assert(ms);
 
     vec2_t new_pos_xz = new_pos_for_vel(uid, new_vel);
-    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
     enum nav_layer layer = Entity_NavLayerWithRadius(flags, radius);
 
     if(flags & ENTITY_FLAG_GARRISONED) {
@@ -1869,7 +2352,7 @@ static void entity_update(uint32_t uid, vec2_t new_vel)
     if(PFM_Vec2_Len(&new_vel) > 0
     && M_NavPositionPathable(s_map, layer, new_pos_xz)) {
     
-        vec3_t new_pos = (vec3_t){new_pos_xz.x, unit_height(uid, new_pos_xz), new_pos_xz.z};
+        vec3_t new_pos = (vec3_t){new_pos_xz.x, unit_height_over(uid, terrain_height), new_pos_xz.z};
         G_Pos_Set(uid, new_pos);
         flush_update_pos_commands(uid);
         ms->velocity = new_vel;
@@ -2127,38 +2610,35 @@ static void find_neighbours(uint32_t uid,
      * meaning they will not perform collision avoidance maneuvers of
      * their own. */
 
-    uint32_t ent_flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
-    uint32_t near_ents[512];
-    int num_near = G_Pos_EntsInCircleFrom(s_move_work.gamestate.postree, 
-        s_move_work.gamestate.flags,
+    uint32_t ent_flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
+    const struct neighb_ent *near_ents[512];
+    int num_near = neighb_grid_query(&s_move_work.neighbs,
         G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid), 
         CLEARPATH_NEIGHBOUR_RADIUS, near_ents, ARR_SIZE(near_ents));
 
     for(int i = 0; i < num_near; i++) {
 
-        uint32_t curr = near_ents[i];
-        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, curr);
+        const struct neighb_ent *curr = near_ents[i];
 
-        if(curr == uid)
+        if(curr->uid == uid)
             continue;
 
-        if(!(flags & ENTITY_FLAG_MOVABLE))
+        if(!(curr->flags & ENTITY_FLAG_MOVABLE))
             continue;
 
-        if(G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, curr) == 0.0f)
+        if(curr->radius == 0.0f)
             continue;
 
-        if((ent_flags & ENTITY_FLAG_AIR) != (flags & ENTITY_FLAG_AIR))
+        if((ent_flags & ENTITY_FLAG_AIR) != (curr->flags & ENTITY_FLAG_AIR))
             continue;
 
-        struct movestate *ms = movestate_get(curr);
+        struct movestate *ms = movestate_get(curr->uid);
         assert(ms);
 
-        vec2_t curr_xz_pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, curr);
         struct cp_ent newdesc = (struct cp_ent) {
-            .xz_pos = curr_xz_pos,
+            .xz_pos = curr->xz_pos,
             .xz_vel = ms->velocity,
-            .radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, curr)
+            .radius = curr->radius
         };
 
         if(ent_still(ms))
@@ -2197,8 +2677,7 @@ static void disband_empty_flocks(void)
             kh_foreach_key(flock->ents, uid, {
                 G_Formation_RemoveUnit(uid);
             });
-            kh_destroy(entity, flock->ents);
-            vec_flock_del(&s_flocks, i);
+            flock_delete(i);
         }
     }
     PERF_RETURN_VOID();
@@ -2209,23 +2688,13 @@ static void do_add_entity(uint32_t uid, vec3_t pos, float selection_radius, int
     ASSERT_IN_MAIN_THREAD();
 
     int ret;
-    khiter_t k = kh_put(pos, s_move_work.gamestate.positions, uid, &ret);
-    assert(ret != -1);
-    kh_val(s_move_work.gamestate.positions, k) = pos;
-
-    qt_ent_insert(s_move_work.gamestate.postree, pos.x, pos.z, uid);
-
-    k = kh_put(range, s_move_work.gamestate.sel_radiuses, uid, &ret);
-    assert(ret != -1);
-    kh_value(s_move_work.gamestate.sel_radiuses, k) = selection_radius;
-
-    k = kh_put(id, s_move_work.gamestate.faction_ids, uid, &ret);
-    assert(ret != -1);
-    kh_value(s_move_work.gamestate.faction_ids, k) = faction_id;
+    G_Pos_SnapshotSet(&s_move_work.pos_snapshot, uid, pos);
 
-    k = kh_put(id, s_move_work.gamestate.flags, uid, &ret);
-    assert(ret != -1);
-    kh_value(s_move_work.gamestate.flags, k) = G_FlagsGet(uid);
+    struct ent_record rec = G_RecordGet(uid);
+    rec.sel_radius = selection_radius;
+    rec.faction_id = faction_id;
+    ret = G_RecordSetIn(s_move_work.gamestate.ents, rec);
+    assert(ret);
 
     struct movestate new_ms = (struct movestate) {
         .velocity = {0.0f}, 
@@ -2239,29 +2708,27 @@ static void do_add_entity(uint32_t uid, vec3_t pos, float selection_radius, int
     };
     memset(new_ms.vel_hist, 0, sizeof(new_ms.vel_hist));
 
-    k = kh_put(state, s_entity_state_table, uid, &ret);
-    assert(ret != -1 && ret != 0);
-    kh_value(s_entity_state_table, k) = new_ms;
+    ret = movestate_add(uid, new_ms);
+    assert(ret);
 
-    entity_block(uid);
+    entity_block(uid, false);
 }
 
 static void do_remove_entity(uint32_t uid)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    khiter_t k = kh_get(state, s_entity_state_table, uid);
-    if(k == kh_end(s_entity_state_table))
+    if(!movestate_get(uid))
         return;
 
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
 
     do_stop(uid);
     if(!(flags & ENTITY_FLAG_GARRISONED)) {
         entity_unblock(uid);
     }
 
-    kh_del(state, s_entity_state_table, k);
+    movestate_remove(uid);
 }
 
 static void do_stop(uint32_t uid)
@@ -2278,14 +2745,15 @@ static void do_stop(uint32_t uid)
 
     remove_from_flocks(uid);
     ms->state = STATE_ARRIVED;
+    G_Automation_NotifyStateChanged(uid);
 }
 
 static void do_set_dest(uint32_t uid, vec2_t dest_xz, bool attack)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
     enum nav_layer layer = Entity_NavLayerWithRadius(flags, radius);
     vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
     dest_xz = M_NavClosestReachableDest(s_map, layer, pos, dest_xz);
@@ -2297,7 +2765,7 @@ static void do_set_dest(uint32_t uid, vec2_t dest_xz, bool attack)
      */
     dest_id_t dest_id;
     if(attack) {
-        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid);
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
         dest_id = M_NavDestIDForPosAttacking(s_map, dest_xz, layer, faction_id);
     }else{
         dest_id = M_NavDestIDForPos(s_map, dest_xz, layer);
@@ -2319,6 +2787,8 @@ static void do_set_dest(uint32_t uid, vec2_t dest_xz, bool attack)
 
         assert(fl != flock_for_ent(uid));
         remove_from_flocks(uid);
+        /* Removing the entity may have moved the flock */
+        fl = flock_for_dest(dest_id);
         flock_add(fl, uid);
 
         struct movestate *ms = movestate_get(uid);
@@ -2373,7 +2843,7 @@ static void do_set_enter_range(uint32_t uid, uint32_t target, float range)
 
     vec2_t xz_src = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
     vec2_t xz_dst = G_Pos_GetXZFrom(s_move_work.gamestate.positions, target);
-    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, uid);
+    float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
     range = MAX(0.0f, range - radius);
 
     vec2_t delta;
@@ -2383,7 +2853,7 @@ static void do_set_enter_range(uint32_t uid, uint32_t target, float range)
         return;
     }
 
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
     vec2_t xz_target = M_NavClosestReachableInRange(s_map, 
         Entity_NavLayerWithRadius(flags, radius), xz_src, xz_dst, range - radius);
     do_set_dest(uid, xz_target, false);
@@ -2451,20 +2921,19 @@ static void do_update_pos(uint32_t uid, vec2_t pos)
         pos.z
     };
 
-    khiter_t k = kh_get(pos, s_move_work.gamestate.positions, uid);
-    assert(k != kh_end(s_move_work.gamestate.positions));
-    vec3_t oldpos = kh_val(s_move_work.gamestate.positions, k);
-    qt_ent_delete(s_move_work.gamestate.postree, oldpos.x, oldpos.z, uid);
-    qt_ent_insert(s_move_work.gamestate.postree, newpos.x, newpos.z, uid);
-    kh_val(s_move_work.gamestate.positions, k) = newpos;
+    assert(kh_get(pos, s_move_work.gamestate.positions, uid) 
+        != kh_end(s_move_work.gamestate.positions));
+    G_Pos_SnapshotSet(&s_move_work.pos_snapshot, uid, newpos);
 
     if(!ms->blocking)
         return;
 
-    int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid);
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
-    M_NavBlockersDecref(ms->last_stop_pos, ms->last_stop_radius, faction_id, flags, s_map);
-    M_NavBlockersIncref(pos, ms->last_stop_radius, faction_id, flags, s_map);
+    if(ms->nav_blocked) {
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
+        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
+        M_NavBlockersDecref(ms->last_stop_pos, ms->last_stop_radius, faction_id, flags, s_map);
+        M_NavBlockersIncref(pos, ms->last_stop_radius, faction_id, flags, s_map);
+    }
     ms->last_stop_pos = pos;
 }
 
@@ -2476,14 +2945,12 @@ static void do_update_faction_id(uint32_t uid, int oldfac, int newfac)
     if(!ms)
         return;
 
-    khiter_t k = kh_get(id, s_move_work.gamestate.faction_ids, uid);
-    assert(k != kh_end(s_move_work.gamestate.faction_ids));
-    kh_val(s_move_work.gamestate.faction_ids, k) = newfac;
+    G_RecordFrom(s_move_work.gamestate.ents, uid)->faction_id = newfac;
 
-    if(!ms->blocking)
+    if(!ms->nav_blocked)
         return;
 
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
+    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
     M_NavBlockersDecref(ms->last_stop_pos, ms->last_stop_radius, oldfac, flags, s_map);
     M_NavBlockersIncref(ms->last_stop_pos, ms->last_stop_radius, newfac, flags, s_map);
 }
@@ -2496,44 +2963,71 @@ static void do_update_selection_radius(uint32_t uid, float sel_radius)
     if(!ms)
         return;
 
-    khiter_t k = kh_get(range, s_move_work.gamestate.sel_radiuses, uid);
-    assert(k != kh_end(s_move_work.gamestate.sel_radiuses));
-    kh_val(s_move_work.gamestate.sel_radiuses, k) = sel_radius;
+    G_RecordFrom(s_move_work.gamestate.ents, uid)->sel_radius = sel_radius;
 
     if(!ms->blocking)
         return;
 
-    int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.faction_ids, uid);
-    uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.flags, uid);
-    M_NavBlockersDecref(ms->last_stop_pos, ms->last_stop_radius, faction_id, flags, s_map);
-    M_NavBlockersIncref(ms->last_stop_pos, sel_radius, faction_id, flags, s_map);
+    if(ms->nav_blocked) {
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
+        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
+        M_NavBlockersDecref(ms->last_stop_pos, ms->last_stop_radius, faction_id, flags, s_map);
+        M_NavBlockersIncref(ms->last_stop_pos, sel_radius, faction_id, flags, s_map);
+    }
     ms->last_stop_radius = sel_radius;
 }
 
 static void do_set_max_speed(uint32_t uid, float speed)
 {
-    khiter_t k = kh_get(state, s_entity_state_table, uid);
-    if(k == kh_end(s_entity_state_table))
+    struct movestate *ms = movestate_get(uid);
+    if(!ms)
         return;
-    struct movestate *ms = &kh_value(s_entity_state_table, k);
     ms->max_speed = speed;
 }
 
 static void do_block(uint32_t uid, vec3_t newpos)
 {
-    khiter_t k = kh_get(pos, s_move_work.gamestate.positions, uid);
-    assert(k != kh_end(s_move_work.gamestate.positions));
-    vec3_t oldpos = kh_val(s_move_work.gamestate.positions, k);
-    qt_ent_delete(s_move_work.gamestate.postree, oldpos.x, oldpos.z, uid);
-    qt_ent_insert(s_move_work.gamestate.postree, newpos.x, newpos.z, uid);
-    kh_val(s_move_work.gamestate.positions, k) = newpos;
+    assert(kh_get(pos, s_move_work.gamestate.positions, uid) 
+        != kh_end(s_move_work.gamestate.positions));
+    G_Pos_SnapshotSet(&s_move_work.pos_snapshot, uid, newpos);
 
-    entity_block(uid);
+    entity_block(uid, false);
 }
 
+/* Position updates and destinations are last-writer-wins: when the most 
+ * recent queued command for the entity sets the same thing, it is dropped 
+ * in favour of the new one.
+ */
 static void move_push_cmd(struct move_cmd cmd)
 {
-    queue_cmd_push(&s_move_commands, &cmd);
+    uint64_t seq = s_move_cmds_pushed + 1;
+    if(!cmd_has_uid(cmd.type)) {
+        if(queue_cmd_push(&s_move_commands, &cmd)) {
+            s_move_cmds_pushed = seq;
+        }
+        return;
+    }
+
+    uint32_t uid = cmd.args[0].val.as_int;
+    cmd.prev = cmd_index_get(uid, cmd.type);
+
+    if(cmd.type == MOVE_CMD_UPDATE_POS || cmd.type == MOVE_CMD_SET_DEST) {
+        struct move_cmd *last = cmd_at(cmd_index_get(uid, CMD_KEY_ANY));
+        if(last && last->type == cmd.type) {
+            last->deleted = true;
+        }
+    }
+
+    if(!queue_cmd_push(&s_move_commands, &cmd))
+        return;
+    s_move_cmds_pushed = seq;
+
+    cmd_index_set(uid, cmd.type, seq);
+    cmd_index_set(uid, CMD_KEY_ANY, seq);
+    if(cmd_sets_still(cmd.type)) {
+        cmd_index_set(uid, CMD_KEY_STILL, seq);
+        G_Automation_NotifyStateChanged(uid);
+    }
 }
 
 static void move_process_cmds(void)
@@ -2541,6 +3035,7 @@ static void move_process_cmds(void)
     struct move_cmd cmd;
     while(queue_cmd_pop(&s_move_commands, &cmd)) {
 
+        s_move_cmds_popped++;
         if(cmd.deleted)
             continue;
 
@@ -2653,6 +3148,10 @@ static void move_process_cmds(void)
             assert(0);
         }
     }
+
+    if(queue_size(s_move_commands) == 0) {
+        kh_clear(cmd_index, s_move_cmd_index);
+    }
 }
 
 static void *cp_vec_realloc(void *ptr, size_t size)
@@ -2736,66 +3235,201 @@ static void move_work(int begin_idx, int end_idx)
     }
 }
 
-static struct result move_task(void *arg)
+static void move_task(size_t begin, size_t end, void *arg)
+{
+    PERF_PUSH("movement::move_task");
+    move_work(begin, end - 1);
+    PERF_POP();
+}
+
+static bool ent_point_seeking(const struct movestate *ms)
+{
+    /* These are the states which take the 'default' case 
+     * of 'ent_desired_velocity' */
+    switch(ms->state) {
+    case STATE_TURNING:
+    case STATE_SEEK_ENEMIES:
+    case STATE_SURROUND_ENTITY:
+    case STATE_ARRIVING_TO_CELL:
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* Runs while the main thread is blocked waiting on it, so nothing can be 
+ * modifying the navigation state or the movement state concurrently. This
+ * makes it safe to look up the cached fields without taking any locks. 
+ */
+static void seek_task(size_t begin, size_t end, void *arg)
 {
-    struct move_task_arg *move_arg = arg;
-    size_t ncomputed = 0;
+    PERF_PUSH("movement::seek_task");
+
+    for(size_t i = begin; i < end; i++) {
 
-    for(int i = move_arg->begin_idx; i <= move_arg->end_idx; i++) {
+        struct seek_result *res = &s_move_work.seek[i];
+        const struct movestate *ms = movestate_get(res->uid);
+        const struct flock *flock = flock_for_ent(res->uid);
 
-        move_work(i, i);
-        ncomputed++;
+        res->resolved = false;
+        if(!flock || !ent_point_seeking(ms))
+            continue;
+
+        vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, res->uid);
+        if(!M_NavTryDesiredPointSeekVelocity(s_map, flock->dest_id, pos, &res->vdes))
+            continue;
 
-        if(ncomputed % 64 == 0)
-            Task_Yield();
+        res->resolved = true;
+        res->has_dest_los = M_NavHasDestLOS(s_map, flock->dest_id, pos);
     }
-    return NULL_RESULT;
+
+    PERF_POP();
 }
 
-static void move_complete_work(void)
+static bool ent_surrounding_enemy(uint32_t uid, const struct movestate *ms)
 {
-    for(int i = 0; i < s_move_work.ntasks; i++) {
-        while(!Sched_FutureIsReady(&s_move_work.futures[i])) {
-            Sched_RunSync(s_move_work.tids[i]);
-        }
+    if(ms->state != STATE_SURROUND_ENTITY || !ms->using_surround_field)
+        return false;
+    if(!G_EntityExists(ms->surround_target_uid))
+        return false;
+
+    int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, uid);
+    int target_faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, 
+        ms->surround_target_uid);
+
+    enum diplomacy_state ds;
+    if(!G_GetDiplomacyState(faction_id, target_faction_id, &ds))
+        return false;
+    return (ds == DIPLOMACY_STATE_WAR);
+}
+
+/* Rather than building a set of fields for every one of the entities being 
+ * attacked in a battle, build a single set per faction, guiding towards the 
+ * closest of all the enemies that the faction's units are converging on. 
+ */
+static void set_faction_targets(void)
+{
+    size_t ndynamic = kh_size(G_GetDynamicEntsSet());
+    uint32_t *targets = stalloc(&s_move_work.mem, ndynamic * sizeof(uint32_t));
+    int *factions = stalloc(&s_move_work.mem, ndynamic * sizeof(int));
+    size_t ntargets = 0;
+    size_t counts[MAX_FACTIONS] = {0};
+
+    uint32_t curr;
+    kh_foreach_key(G_GetDynamicEntsSet(), curr, {
+
+        struct movestate *ms = movestate_get(curr);
+        assert(ms);
+
+        ms->using_faction_field = ent_surrounding_enemy(curr, ms);
+        if(!ms->using_faction_field)
+            continue;
+
+        int faction_id = G_GetFactionIDFrom(s_move_work.gamestate.ents, curr);
+        targets[ntargets] = ms->surround_target_uid;
+        factions[ntargets] = faction_id;
+        counts[faction_id]++;
+        ntargets++;
+    });
+
+    uint32_t *sorted = stalloc(&s_move_work.mem, ndynamic * sizeof(uint32_t));
+    size_t offsets[MAX_FACTIONS];
+    size_t base = 0;
+
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+        offsets[i] = base;
+        base += counts[i];
+    }
+    for(int i = 0; i < ntargets; i++) {
+        sorted[offsets[factions[i]]++] = targets[i];
     }
+    for(int i = 0; i < MAX_FACTIONS; i++) {
+        M_NavSetFactionTargets(s_map, i, sorted + offsets[i] - counts[i], counts[i]);
+    }
+}
+
+/* Entities walking through open terrain, with nothing else around them and 
+ * their destination still far away, keep their last computed velocity and 
+ * only get the full steering update once every LOD_TICK_INTERVAL ticks. The 
+ * ticks are staggered by UID to spread the work. Only the simulation state 
+ * is taken into account, so that the results stay deterministic.
+ */
+static bool move_lod_skip(uint32_t uid, const struct movestate *ms)
+{
+    if((s_move_tick + uid) % LOD_TICK_INTERVAL == 0)
+        return false;
+    if(ms->state != STATE_MOVING && ms->state != STATE_MOVING_IN_FORMATION)
+        return false;
+    if(PFM_Vec2_Len(&ms->velocity) < EPSILON)
+        return false;
+
+    const struct flock *flock = flock_for_ent(uid);
+    if(!flock)
+        return false;
+
+    vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
+    vec2_t target = flock->target_xz;
+    vec2_t diff;
+    PFM_Vec2_Sub(&target, &pos, &diff);
+    if(PFM_Vec2_Len(&diff) < LOD_MIN_DEST_DIST)
+        return false;
+
+    /* The entity itself is always returned by the query */
+    const struct neighb_ent *near[2];
+    int nnear = neighb_grid_query(&s_move_work.neighbs, pos, LOD_CLEAR_RADIUS, 
+        near, ARR_SIZE(near));
+    return (nnear < 2);
+}
+
+static void seek_submit_work(void)
+{
+    s_move_work.nseek = 0;
+    uint32_t curr;
+
+    kh_foreach_key(G_GetDynamicEntsSet(), curr, {
+
+        if(s_move_work.shard >= 0 && G_TICK_SHARD(curr) != s_move_work.shard)
+            continue;
+
+        struct movestate *ms = movestate_get(curr);
+        assert(ms);
+
+        if(ent_still(ms))
+            continue;
+        if(move_lod_skip(curr, ms))
+            continue;
+        s_move_work.seek[s_move_work.nseek++] = (struct seek_result){ .uid = curr };
+    });
+
+    Sched_ParallelFor(0, s_move_work.nseek, SEEK_TASK_GRAIN, seek_task, NULL);
+}
+
+static void move_complete_work(void)
+{
+    Sched_TaskGroupJoin(&s_move_work.group);
 }
 
 static void move_copy_gamestate(void)
 {
     PERF_ENTER();
-    s_move_work.gamestate.flags = G_FlagsCopyTable();
-    s_move_work.gamestate.positions = G_Pos_CopyTable();
-    s_move_work.gamestate.postree = G_Pos_CopyQuadTree();
-    s_move_work.gamestate.sel_radiuses = G_SelectionRadiusCopyTable();
-    s_move_work.gamestate.faction_ids = G_FactionIDCopyTable();
+    if(G_RecordsCopy(&s_move_work.records)) {
+        s_move_work.gamestate.ents = &s_move_work.records;
+    }
+    G_Pos_SnapshotSync(&s_move_work.pos_snapshot);
+    s_move_work.gamestate.positions = s_move_work.pos_snapshot.table;
+    s_move_work.gamestate.postree = &s_move_work.pos_snapshot.tree;
     s_move_work.gamestate.map = M_AL_CopyWithFields(s_map);
+    neighb_grid_build(&s_move_work.neighbs, &s_move_work.gamestate);
     PERF_RETURN_VOID();
 }
 
 static void move_release_gamestate(void)
 {
     PERF_ENTER();
-    if(s_move_work.gamestate.flags) {
-        kh_destroy(id, s_move_work.gamestate.flags);
-        s_move_work.gamestate.flags = NULL;
-    }
-    if(s_move_work.gamestate.positions) {
-        kh_destroy(pos, s_move_work.gamestate.positions);
-        s_move_work.gamestate.positions = NULL;
-    }
-    if(s_move_work.gamestate.postree) {
-        G_Pos_DestroyQuadTree(s_move_work.gamestate.postree);
-        s_move_work.gamestate.postree = NULL;
-    }
-    if(s_move_work.gamestate.sel_radiuses) {
-        kh_destroy(range, s_move_work.gamestate.sel_radiuses);
-        s_move_work.gamestate.sel_radiuses = NULL;
-    }
-    if(s_move_work.gamestate.faction_ids) {
-        kh_destroy(id, s_move_work.gamestate.faction_ids);
-        s_move_work.gamestate.faction_ids = NULL;
-    }
+    /* The records and positions are owned by the persistent copies */
+    s_move_work.gamestate.ents = NULL;
+    s_move_work.gamestate.positions = NULL;
+    s_move_work.gamestate.postree = NULL;
     if(s_move_work.gamestate.map) {
         PF_FREE(s_move_work.gamestate.map);
         s_move_work.gamestate.map = NULL;
@@ -2836,23 +3470,39 @@ static void move_finish_work(void)
     }
     PERF_POP();
 
-    uint32_t key;
-    struct movestate curr;
-
     PERF_PUSH("position updates");
-    kh_foreach(s_entity_state_table, key, curr, {
+    /* Sample the terrain under all the new positions in one batch */
+    size_t nstates = vec_size(&s_movestates);
+    vec2_t *new_xz = stalloc(&s_move_work.mem, nstates * sizeof(vec2_t) + 1);
+    float *heights = stalloc(&s_move_work.mem, nstates * sizeof(float) + 1);
+
+    for(int i = 0; i < nstates; i++) {
+        uint32_t uid = vec_AT(&s_movestate_uids, i);
+        new_xz[i] = (vec2_t){0.0f, 0.0f};
+        /* Every entity moves exactly once per 20Hz period */
+        if(s_move_work.shard >= 0 && G_TICK_SHARD(uid) != s_move_work.shard)
+            continue;
         /* The entity has been removed already */
-        if(!G_EntityExists(key))
+        if(!G_EntityExists(uid))
             continue;
-        entity_update(key, curr.vnew);
-    });
+        new_xz[i] = new_pos_for_vel(uid, vec_AT(&s_movestates, i).vnew);
+    }
+    M_HeightAtPoints(s_map, nstates, new_xz, heights);
+
+    for(int i = 0; i < nstates; i++) {
+        uint32_t uid = vec_AT(&s_movestate_uids, i);
+        if(s_move_work.shard >= 0 && G_TICK_SHARD(uid) != s_move_work.shard)
+            continue;
+        if(!G_EntityExists(uid))
+            continue;
+        entity_update(uid, vec_AT(&s_movestates, i).vnew, heights[i]);
+    }
     PERF_POP();
 
     stalloc_clear(&s_move_work.mem);
     s_move_work.in = NULL;
     s_move_work.out = NULL;
     s_move_work.nwork = 0;
-    s_move_work.ntasks = 0;
 
     PERF_RETURN_VOID();
 }
@@ -2862,6 +3512,7 @@ static void move_prepare_work(void)
     size_t ndynamic = kh_size(G_GetDynamicEntsSet());
     s_move_work.in = stalloc(&s_move_work.mem, ndynamic * sizeof(struct move_work_in));
     s_move_work.out = stalloc(&s_move_work.mem, ndynamic * sizeof(struct move_work_out));
+    s_move_work.seek = stalloc(&s_move_work.mem, ndynamic * sizeof(struct seek_result));
 }
 
 static void move_push_work(struct move_work_in in)
@@ -2874,42 +3525,206 @@ static void move_submit_work(void)
     if(s_move_work.nwork == 0)
         return;
 
-    size_t ntasks = SDL_GetCPUCount();
-    if(s_move_work.nwork < 64)
-        ntasks = 1;
-    ntasks = MIN(ntasks, MAX_MOVE_TASKS);
+    Sched_ParallelForAsync(&s_move_work.group, 0, s_move_work.nwork, MOVE_TASK_GRAIN, 
+        move_task, NULL, 4, TASK_BIG_STACK);
+}
+
+static void gpu_move_dispatch(void)
+{
+    const size_t nents = kh_size(G_GetDynamicEntsSet());
+    if(nents == 0 || nents > MAX_GPU_MOVE_ENTS)
+        return;
+
+    for(int gpu_id = 1; gpu_id <= nents; gpu_id++) {
+        s_gpu_move.uids[gpu_id - 1] = G_EntForGPUID(gpu_id);
+    }
+    s_gpu_move.nents = nents;
+    s_gpu_move.dispatch_tick = s_move_tick;
+
+    G_Pos_Upload();
+    G_Move_Upload();
+    R_PushCmd((struct rcmd){
+        .func = R_GL_MoveDispatchWork,
+        .nargs = 1,
+        .args = {
+            R_PushArg(&nents, sizeof(nents)),
+        },
+    });
+    s_gpu_move.state = GPU_MOVE_DISPATCHED;
+}
+
+static void gpu_move_read(void)
+{
+    const size_t maxout = sizeof(s_gpu_move.results);
+    s_gpu_move.gen++;
 
-    for(int i = 0; i < ntasks; i++) {
+    R_PushCmd((struct rcmd){
+        .func = R_GL_MoveReadNewVelocities,
+        .nargs = 5,
+        .args = {
+            s_gpu_move.results,
+            R_PushArg(&s_gpu_move.nents, sizeof(s_gpu_move.nents)),
+            R_PushArg(&maxout, sizeof(maxout)),
+            &s_gpu_move.ready_gen,
+            R_PushArg(&s_gpu_move.gen, sizeof(s_gpu_move.gen)),
+        },
+    });
+    R_PushCmd((struct rcmd){ .func = R_GL_MoveInvalidateData });
+    R_PushCmd((struct rcmd){ .func = R_GL_PositionsInvalidateData });
+    s_gpu_move.state = GPU_MOVE_READING;
+}
 
-        struct move_task_arg *arg = stalloc(&s_move_work.mem, sizeof(struct move_task_arg));
-        size_t nitems = ceil((float)s_move_work.nwork / ntasks);
+static void gpu_move_collect(void)
+{
+    for(int i = 0; i < s_gpu_move.nents; i++) {
 
-        arg->begin_idx = nitems * i;
-        arg->end_idx = MIN(nitems * (i + 1) - 1, s_move_work.nwork-1);
+        /* The entity may have been removed in the meantime */
+        struct movestate *ms = movestate_get(s_gpu_move.uids[i]);
+        if(!ms)
+            continue;
+        ms->gpu_separation = s_gpu_move.results[i];
+        ms->gpu_separation_tick = s_gpu_move.dispatch_tick;
+    }
+}
 
-        SDL_AtomicSet(&s_move_work.futures[s_move_work.ntasks].status, FUTURE_INCOMPLETE);
-        s_move_work.tids[s_move_work.ntasks] = Sched_Create(4, move_task, arg, 
-            &s_move_work.futures[s_move_work.ntasks], TASK_BIG_STACK);
+/* Advance the GPU steering work by one step. The separation forces of all 
+ * the dynamic entities are computed by the 'movement' compute shader, and 
+ * are used in place of the CPU ones for as long as they're fresh. 
+ */
+static void gpu_move_update(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    PERF_ENTER();
 
-        if(s_move_work.tids[s_move_work.ntasks] == NULL_TID) {
-            move_work(arg->begin_idx, arg->end_idx);
+    /* The results arrive after a variable number of ticks */
+    s_gpu_move.enabled = s_settings.gpu_steering_enabled.as_bool 
+                      && !s_deterministic && R_ComputeShaderSupported();
+
+    switch(s_gpu_move.state) {
+    case GPU_MOVE_READING:
+        if(SDL_AtomicGet(&s_gpu_move.ready_gen) == s_gpu_move.gen) {
+            gpu_move_collect();
+            s_gpu_move.state = GPU_MOVE_IDLE;
+        }else if(s_move_tick - s_gpu_move.dispatch_tick > GPU_MOVE_MAX_LAG) {
+            /* The commands were dropped or the renderer is falling behind */
+            s_gpu_move.state = GPU_MOVE_IDLE;
         }else{
-            s_move_work.ntasks++;
+            break;
+        }
+        /* fallthrough */
+    case GPU_MOVE_IDLE:
+        if(s_gpu_move.enabled) {
+            gpu_move_dispatch();
         }
+        break;
+    case GPU_MOVE_DISPATCHED:
+        gpu_move_read();
+        break;
+    default: assert(0);
     }
+    PERF_RETURN_VOID();
 }
 
-static void on_20hz_tick(void *user, void *event)
+/* The flow fields along paths may be built by the 'nav_field' compute 
+ * shader, in which case they arrive in the cache a few ticks after being
+ * requested. */
+static void gpu_nav_update(void)
 {
-    PERF_PUSH("movement::on_20hz_tick");
+    N_FG_SetEnabled(s_settings.gpu_nav_enabled.as_bool 
+                 && !s_deterministic && R_ComputeShaderSupported());
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    /* FNV-1a */
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* The movestates are stored in the order the entities were added 
+ * and removed in, which is the same for all peers.
+ */
+static void move_update_state_hash(void)
+{
+    PERF_ENTER();
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hash_bytes(hash, &s_move_tick, sizeof(s_move_tick));
+
+    for(int i = 0; i < vec_size(&s_movestates); i++) {
+
+        uint32_t uid = vec_AT(&s_movestate_uids, i);
+        const struct movestate *ms = &vec_AT(&s_movestates, i);
+        uint32_t state = ms->state;
+        vec3_t pos = G_Pos_Get(uid);
+
+        hash = hash_bytes(hash, &uid, sizeof(uid));
+        hash = hash_bytes(hash, &state, sizeof(state));
+        hash = hash_bytes(hash, &pos, sizeof(pos));
+        hash = hash_bytes(hash, &ms->velocity, sizeof(ms->velocity));
+    }
+    s_state_hash = hash;
+    PERF_RETURN_VOID();
+}
+
+static bool move_deterministic_setting(void)
+{
+    return s_settings.deterministic_movement.as_bool;
+}
+
+static void move_bind_settings(void)
+{
+    Settings_Bind("pf.debug.navigation_layer", &s_settings.nav_layer);
+    Settings_Bind("pf.debug.show_last_cmd_flow_field", &s_settings.show_last_cmd_flow_field);
+    Settings_Bind("pf.debug.show_first_sel_movestate", &s_settings.show_first_sel_movestate);
+    Settings_Bind("pf.debug.show_enemy_seek_fields", &s_settings.show_enemy_seek_fields);
+    Settings_Bind("pf.debug.enemy_seek_fields_faction_id", &s_settings.enemy_seek_fields_faction_id);
+    Settings_Bind("pf.debug.show_navigation_blockers", &s_settings.show_navigation_blockers);
+    Settings_Bind("pf.debug.show_navigation_portals", &s_settings.show_navigation_portals);
+    Settings_Bind("pf.debug.show_navigation_cost_base", &s_settings.show_navigation_cost_base);
+    Settings_Bind("pf.debug.show_chunk_boundaries", &s_settings.show_chunk_boundaries);
+    Settings_Bind("pf.debug.show_navigation_island_ids", &s_settings.show_navigation_island_ids);
+    Settings_Bind("pf.debug.show_navigation_local_island_ids", 
+        &s_settings.show_navigation_local_island_ids);
+    Settings_Bind("pf.game.gpu_steering_enabled", &s_settings.gpu_steering_enabled);
+    Settings_Bind("pf.game.gpu_nav_enabled", &s_settings.gpu_nav_enabled);
+    Settings_Bind("pf.game.deterministic_movement", &s_settings.deterministic_movement);
+}
+
+/* Update the entities of the given shard, or all of them if the shard is -1.
+ * The positions and velocities of each entity are still updated exactly once 
+ * per 20Hz period, so the results are the same as when updating everything 
+ * at once, save for neighbours being observed up to 2 sub-ticks apart.
+ */
+static void move_tick(int shard)
+{
+    s_deterministic = move_deterministic_setting();
 
+    /* All the blocker changes of the tick are applied at once, with the 
+     * ones for entities that stopped and started again cancelling out */
+    M_NavBlockersBeginBatch();
     move_finish_work();
     move_process_cmds();
+    settle_blockers();
+    M_NavBlockersEndBatch();
+    if(s_deterministic) {
+        move_update_state_hash();
+    }
     move_release_gamestate();
     disband_empty_flocks();
 
     move_prepare_work();
     move_copy_gamestate();
+    flocks_update_aggregates();
+    s_move_work.shard = shard;
+    if(shard <= 0) {
+        gpu_move_update();
+        gpu_nav_update();
+        s_move_tick++;
+    }
 
     uint32_t curr;
 
@@ -2919,23 +3734,33 @@ static void on_20hz_tick(void *user, void *event)
      */
     PERF_PUSH("compute volatile fields");
     N_PrepareAsyncWork();
+    set_faction_targets();
     kh_foreach_key(G_GetDynamicEntsSet(), curr, {
+        if(shard >= 0 && G_TICK_SHARD(curr) != shard)
+            continue;
         request_async_field(curr);
     });
     N_AwaitAsyncFields();
     PERF_POP();
 
     PERF_PUSH("desired velocity computations");
-    kh_foreach_key(G_GetDynamicEntsSet(), curr, {
+    seek_submit_work();
 
-        struct movestate *ms = movestate_get(curr);
-        assert(ms);
+    for(size_t i = 0; i < s_move_work.nseek; i++) {
 
-        if(ent_still(ms))
-            continue;
+        const struct seek_result *res = &s_move_work.seek[i];
+        curr = res->uid;
 
+        struct movestate *ms = movestate_get(curr);
         struct flock *flock = flock_for_ent(curr);
-        ms->vdes = ent_desired_velocity(curr);
+        vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, curr);
+
+        if(res->resolved) {
+            ms->vdes = res->vdes;
+            M_NavTouchDestFields(s_map, flock->dest_id, pos);
+        }else{
+            ms->vdes = ent_desired_velocity(curr);
+        }
 
         vec_cp_ent_t *dyn, *stat;
         dyn = stalloc(&s_move_work.mem, sizeof(vec_cp_ent_t));
@@ -2947,8 +3772,7 @@ static void on_20hz_tick(void *user, void *event)
         vec_cp_ent_resize(dyn, 16);
         vec_cp_ent_resize(stat, 16);
 
-        vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, curr);
-        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.sel_radiuses, curr);
+        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, curr);
 
         struct cp_ent curr_cp = (struct cp_ent) {
             .xz_pos = pos,
@@ -2971,7 +3795,8 @@ static void on_20hz_tick(void *user, void *event)
             .save_debug = G_ClearPath_ShouldSaveDebug(curr),
             .stat_neighbs = stat,
             .dyn_neighbs = dyn,
-            .has_dest_los = (flock && (ms->state != STATE_SURROUND_ENTITY || !ms->using_surround_field)) 
+            .has_dest_los = res->resolved ? res->has_dest_los
+                          : (flock && (ms->state != STATE_SURROUND_ENTITY || !ms->using_surround_field)) 
                           ? M_NavHasDestLOS(s_map, flock->dest_id, pos) : false,
             .fid = fid,
             .formation_assignment_ready = (fid == NULL_FID) ? false 
@@ -2983,11 +3808,31 @@ static void on_20hz_tick(void *user, void *event)
             .normal_form_drag_force = ((fid != NULL_FID) ? G_Formation_DragForce(curr)
                                                          : (vec2_t){0.0f, 0.0f})
         });
-    });
+    }
     PERF_POP();
 
     move_submit_work();
+}
+
+/* Deterministic movement is never sharded, as the state hash is taken 
+ * over every entity at the end of each tick */
+static void on_20hz_tick(void *user, void *event)
+{
+    if(G_Timer_Sharded() && !move_deterministic_setting())
+        return;
+
+    PERF_PUSH("movement::on_20hz_tick");
+    move_tick(-1);
+    PERF_POP();
+}
+
+static void on_20hz_subtick(void *user, void *event)
+{
+    if(move_deterministic_setting())
+        return;
 
+    PERF_PUSH("movement::on_20hz_subtick");
+    move_tick((uintptr_t)event);
     PERF_POP();
 }
 
@@ -3003,29 +3848,101 @@ static void on_update(void *user, void *event)
 bool G_Move_Init(const struct map *map)
 {
     assert(map);
-    if(NULL == (s_entity_state_table = kh_init(state))) {
+    if(NULL == (s_movestate_slots = kh_init(slot))) {
         return false;
     }
+    vec_movestate_init(&s_movestates);
+    vec_entity_init(&s_movestate_uids);
+    vec_entity_init(&s_settling);
+    move_bind_settings();
 
     memset(&s_move_work, 0, sizeof(s_move_work));
+    Sched_TaskGroupInit(&s_move_work.group);
+    Sched_TaskGroupSetDeadline(&s_move_work.group, MOVE_TASK_DEADLINE_MS);
     if(!stalloc_init(&s_move_work.mem)) {
-        kh_destroy(state, s_entity_state_table);
+        vec_entity_destroy(&s_movestate_uids);
+        vec_entity_destroy(&s_settling);
+        vec_movestate_destroy(&s_movestates);
+        kh_destroy(slot, s_movestate_slots);
         return NULL;
     }
 
     if(!queue_cmd_init(&s_move_commands, 256)) {
         stalloc_destroy(&s_move_work.mem);
-        kh_destroy(state, s_entity_state_table);
+        vec_entity_destroy(&s_movestate_uids);
+        vec_entity_destroy(&s_settling);
+        vec_movestate_destroy(&s_movestates);
+        kh_destroy(slot, s_movestate_slots);
+        return NULL;
+    }
+    s_move_cmds_pushed = 0;
+    s_move_cmds_popped = 0;
+
+    if(NULL == (s_move_cmd_index = kh_init(cmd_index))) {
+        queue_cmd_destroy(&s_move_commands);
+        stalloc_destroy(&s_move_work.mem);
+        vec_entity_destroy(&s_movestate_uids);
+        vec_entity_destroy(&s_settling);
+        vec_movestate_destroy(&s_movestates);
+        kh_destroy(slot, s_movestate_slots);
         return NULL;
     }
 
     if(!stalloc_init(&s_eventargs)) {
         stalloc_destroy(&s_move_work.mem);
-        kh_destroy(state, s_entity_state_table);
+        vec_entity_destroy(&s_movestate_uids);
+        vec_entity_destroy(&s_settling);
+        vec_movestate_destroy(&s_movestates);
+        kh_destroy(slot, s_movestate_slots);
+        queue_cmd_destroy(&s_move_commands);
+        kh_destroy(cmd_index, s_move_cmd_index);
+        return NULL;
+    }
+
+    if(!G_Pos_SnapshotInit(&s_move_work.pos_snapshot)) {
+        stalloc_destroy(&s_eventargs);
+        stalloc_destroy(&s_move_work.mem);
+        vec_entity_destroy(&s_movestate_uids);
+        vec_entity_destroy(&s_settling);
+        vec_movestate_destroy(&s_movestates);
+        kh_destroy(slot, s_movestate_slots);
+        queue_cmd_destroy(&s_move_commands);
+        kh_destroy(cmd_index, s_move_cmd_index);
+        return NULL;
+    }
+
+    if(!neighb_grid_init(&s_move_work.neighbs, &s_move_work.pos_snapshot.tree)) {
+        G_Pos_SnapshotDestroy(&s_move_work.pos_snapshot);
+        stalloc_destroy(&s_eventargs);
+        stalloc_destroy(&s_move_work.mem);
+        vec_entity_destroy(&s_movestate_uids);
+        vec_entity_destroy(&s_settling);
+        vec_movestate_destroy(&s_movestates);
+        kh_destroy(slot, s_movestate_slots);
+        queue_cmd_destroy(&s_move_commands);
+        kh_destroy(cmd_index, s_move_cmd_index);
+        return NULL;
+    }
+
+    s_ent_flocks = kh_init(flock_idx);
+    s_dest_flocks = kh_init(flock_idx);
+    if(!s_ent_flocks || !s_dest_flocks) {
+        kh_destroy(flock_idx, s_ent_flocks);
+        kh_destroy(flock_idx, s_dest_flocks);
+        neighb_grid_destroy(&s_move_work.neighbs);
+        G_Pos_SnapshotDestroy(&s_move_work.pos_snapshot);
+        stalloc_destroy(&s_eventargs);
+        stalloc_destroy(&s_move_work.mem);
+        vec_entity_destroy(&s_movestate_uids);
+        vec_entity_destroy(&s_settling);
+        vec_movestate_destroy(&s_movestates);
+        kh_destroy(slot, s_movestate_slots);
         queue_cmd_destroy(&s_move_commands);
+        kh_destroy(cmd_index, s_move_cmd_index);
         return NULL;
     }
 
+    vec_erec_init(&s_move_work.records);
     vec_entity_init(&s_move_markers);
     vec_flock_init(&s_flocks);
 
@@ -3036,6 +3953,7 @@ bool G_Move_Init(const struct map *map)
     E_Global_Register(EVENT_RENDER_3D_POST, on_render_3d, NULL, 
         G_RUNNING | G_PAUSED_FULL | G_PAUSED_UI_RUNNING);
     E_Global_Register(EVENT_20HZ_TICK, on_20hz_tick, NULL, G_RUNNING);
+    E_Global_Register(EVENT_20HZ_SUBTICK, on_20hz_subtick, NULL, G_RUNNING);
 
     s_map = map;
     s_attack_on_lclick = false;
@@ -3051,6 +3969,7 @@ void G_Move_Shutdown(void)
     move_complete_work();
     s_map = NULL;
 
+    E_Global_Unregister(EVENT_20HZ_SUBTICK, on_20hz_subtick);
     E_Global_Unregister(EVENT_20HZ_TICK, on_20hz_tick);
     E_Global_Unregister(EVENT_RENDER_3D_POST, on_render_3d);
     E_Global_Unregister(SDL_MOUSEBUTTONDOWN, on_mousedown);
@@ -3065,12 +3984,21 @@ void G_Move_Shutdown(void)
     }
 
     move_release_gamestate();
+    neighb_grid_destroy(&s_move_work.neighbs);
+    G_Pos_SnapshotDestroy(&s_move_work.pos_snapshot);
+    vec_erec_destroy(&s_move_work.records);
     vec_flock_destroy(&s_flocks);
+    kh_destroy(flock_idx, s_ent_flocks);
+    kh_destroy(flock_idx, s_dest_flocks);
     vec_entity_destroy(&s_move_markers);
     stalloc_destroy(&s_eventargs);
     queue_cmd_destroy(&s_move_commands);
+    kh_destroy(cmd_index, s_move_cmd_index);
     stalloc_destroy(&s_move_work.mem);
-    kh_destroy(state, s_entity_state_table);
+    vec_entity_destroy(&s_movestate_uids);
+    vec_entity_destroy(&s_settling);
+    vec_movestate_destroy(&s_movestates);
+    kh_destroy(slot, s_movestate_slots);
 }
 
 bool G_Move_HasWork(void)
@@ -3080,8 +4008,10 @@ bool G_Move_HasWork(void)
 
 void G_Move_FlushWork(void)
 {
+    M_NavBlockersBeginBatch();
     move_finish_work();
     move_process_cmds();
+    M_NavBlockersEndBatch();
 }
 
 void G_Move_AddEntity(uint32_t uid, vec3_t pos, float sel_radius, int faction_id)
@@ -3134,8 +4064,7 @@ void G_Move_Stop(uint32_t uid)
 
 bool G_Move_GetDest(uint32_t uid, vec2_t *out_xz, bool *out_attack)
 {
-    struct move_cmd *cmd = snoop_most_recent_command(MOVE_CMD_SET_DEST,
-        (void*)(uintptr_t)uid, uids_match, false);
+    struct move_cmd *cmd = snoop_most_recent_command(MOVE_CMD_SET_DEST, uid, false);
 
     if(cmd) {
         *out_xz = cmd->args[1].val.as_vec2;
@@ -3153,8 +4082,7 @@ bool G_Move_GetDest(uint32_t uid, vec2_t *out_xz, bool *out_attack)
 
 bool G_Move_GetSurrounding(uint32_t uid, uint32_t *out_uid)
 {
-    struct move_cmd *cmd = snoop_most_recent_command(MOVE_CMD_SET_SURROUND_ENTITY,
-        (void*)(uintptr_t)uid, uids_match, false);
+    struct move_cmd *cmd = snoop_most_recent_command(MOVE_CMD_SET_SURROUND_ENTITY, uid, false);
 
     if(cmd) {
         *out_uid = cmd->args[1].val.as_int;
@@ -3197,6 +4125,22 @@ void G_Move_SetDest(uint32_t uid, vec2_t dest_xz, bool attack)
     });
 }
 
+void G_Move_Order(size_t nents, const uint32_t *ents, bool attack, vec3_t pos, 
+                  vec2_t orientation)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    vec_entity_t sel;
+    vec_entity_init(&sel);
+    for(int i = 0; i < nents; i++) {
+        if(G_EntityExists(ents[i])) {
+            vec_entity_push(&sel, ents[i]);
+        }
+    }
+    move_order(&sel, attack, pos, orientation);
+    vec_entity_destroy(&sel);
+}
+
 void G_Move_SetChangeDirection(uint32_t uid, quat_t target)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -3368,20 +4312,23 @@ bool G_Move_GetClickEnabled(void)
     return s_click_move_enabled;
 }
 
+uint64_t G_Move_StateHash(void)
+{
+    return s_state_hash;
+}
+
 bool G_Move_GetMaxSpeed(uint32_t uid, float *out)
 {
-    struct move_cmd *cmd = snoop_most_recent_command(MOVE_CMD_SET_MAX_SPEED,
-        (void*)(uintptr_t)uid, uids_match, false);
+    struct move_cmd *cmd = snoop_most_recent_command(MOVE_CMD_SET_MAX_SPEED, uid, false);
 
     if(cmd) {
         *out = cmd->args[1].val.as_float;
         return true;
     }
 
-    khiter_t k = kh_get(state, s_entity_state_table, uid);
-    if(k == kh_end(s_entity_state_table))
+    struct movestate *ms = movestate_get(uid);
+    if(!ms)
         return false;
-    struct movestate *ms = &kh_value(s_entity_state_table, k);
     *out = ms->max_speed;
     return true;
 }
@@ -3475,7 +4422,7 @@ void G_Move_Upload(void)
     PERF_ENTER();
 
     const size_t nents = kh_size(G_GetDynamicEntsSet());
-    const size_t buffsize = nents * (sizeof(uint32_t) * 3 + sizeof(vec2_t));
+    const size_t buffsize = nents * (sizeof(uint32_t) * 4 + sizeof(vec2_t) * 2 + sizeof(float));
     struct render_workspace *ws = G_GetSimWS();
     void *buff = stalloc(&ws->args, buffsize);
     unsigned char *cursor = buff;
@@ -3483,9 +4430,8 @@ void G_Move_Upload(void)
     for(int gpu_id = 1; gpu_id <= nents; gpu_id++) {
 
         uint32_t uid = G_EntForGPUID(gpu_id);
-        khiter_t k = kh_get(state, s_entity_state_table, uid);
-        assert(k != kh_end(s_entity_state_table));
-        const struct movestate *curr = &kh_value(s_entity_state_table, k);
+        const struct movestate *curr = movestate_get(uid);
+        assert(curr);
 
         const struct flock *flock;
         uint32_t flock_id = flock_id_for_ent(uid, &flock);
@@ -3493,11 +4439,16 @@ void G_Move_Upload(void)
         vec2_t pos = G_Pos_GetXZFrom(s_move_work.gamestate.positions, uid);
         uint32_t has_dest_los = flock ? M_NavHasDestLOS(s_map, flock->dest_id, pos) : false;
         vec2_t dest_xz = flock ? flock->target_xz : (vec2_t){0.0f, 0.0f};
+        uint32_t flags = G_FlagsGetFrom(s_move_work.gamestate.ents, uid);
+        float radius = G_GetSelectionRadiusFrom(s_move_work.gamestate.ents, uid);
 
         *((uint32_t*)cursor) = flock_id;        cursor += sizeof(uint32_t);
         *((uint32_t*)cursor) = movestate;       cursor += sizeof(uint32_t);
         *((uint32_t*)cursor) = has_dest_los;    cursor += sizeof(uint32_t);
+        *((uint32_t*)cursor) = flags;           cursor += sizeof(uint32_t);
         *((vec2_t*)cursor) = dest_xz;           cursor += sizeof(vec2_t);
+        *((vec2_t*)cursor) = pos;               cursor += sizeof(vec2_t);
+        *((float*)cursor) = radius;             cursor += sizeof(float);
     }
     assert(cursor == ((unsigned char*)buff) + buffsize);
 
@@ -3569,15 +4520,15 @@ bool G_Move_SaveState(struct SDL_RWops *stream)
     /* save the movement state */
     struct attr num_ents = (struct attr){
         .type = TYPE_INT,
-        .val.as_int = kh_size(s_entity_state_table)
+        .val.as_int = vec_size(&s_movestates)
     };
     CHK_TRUE_RET(Attr_Write(stream, &num_ents, "num_ents"));
     Sched_TryYield();
 
-    uint32_t key;
-    struct movestate curr;
+    for(int i = 0; i < vec_size(&s_movestates); i++) {
 
-    kh_foreach(s_entity_state_table, key, curr, {
+        uint32_t key = vec_AT(&s_movestate_uids, i);
+        struct movestate curr = vec_AT(&s_movestates, i);
 
         struct attr uid = (struct attr){
             .type = TYPE_INT,
@@ -3631,11 +4582,11 @@ bool G_Move_SaveState(struct SDL_RWops *stream)
         };
         CHK_TRUE_RET(Attr_Write(stream, &wait_ticks_left, "wait_ticks_left"));
 
-        for(int i = 0; i < VEL_HIST_LEN; i++) {
+        for(int j = 0; j < VEL_HIST_LEN; j++) {
         
             struct attr hist_entry = (struct attr){
                 .type = TYPE_VEC2,
-                .val.as_vec2 = curr.vel_hist[i]
+                .val.as_vec2 = curr.vel_hist[j]
             };
             CHK_TRUE_RET(Attr_Write(stream, &hist_entry, "hist_entry"));
         }
@@ -3688,7 +4639,7 @@ bool G_Move_SaveState(struct SDL_RWops *stream)
         };
         CHK_TRUE_RET(Attr_Write(stream, &target_dir, "target_dir"));
         Sched_TryYield();
-    });
+    }
 
     return true;
 }
@@ -3713,7 +4664,7 @@ bool G_Move_LoadState(struct SDL_RWops *stream)
     assert(vec_size(&s_flocks) == 0);
     for(int i = 0; i < num_flocks; i++) {
 
-        struct flock new_flock;
+        struct flock new_flock = (struct flock){0};
         new_flock.ents = kh_init(entity);
         CHK_TRUE_RET(new_flock.ents);
 
@@ -3738,7 +4689,7 @@ bool G_Move_LoadState(struct SDL_RWops *stream)
         CHK_TRUE_JMP(attr.type == TYPE_INT, fail_flock);
         new_flock.dest_id = attr.val.as_int;
 
-        vec_flock_push(&s_flocks, new_flock);
+        CHK_TRUE_JMP(flock_push(new_flock), fail_flock);
         Sched_TryYield();
         continue;
 
@@ -3762,9 +4713,8 @@ bool G_Move_LoadState(struct SDL_RWops *stream)
         uid = attr.val.as_int;
 
         /* The entity should have already been loaded by the scripting state */
-        khiter_t k = kh_get(state, s_entity_state_table, uid);
-        CHK_TRUE_RET(k != kh_end(s_entity_state_table));
-        ms = &kh_value(s_entity_state_table, k);
+        ms = movestate_get(uid);
+        CHK_TRUE_RET(ms);
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_INT);
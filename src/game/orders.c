@@ -0,0 +1,169 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "orders.h"
+#include "game_private.h"
+#include "public/game.h"
+#include "../main.h"
+#include "../perf.h"
+#include "../lib/public/vec.h"
+
+#include <SDL.h>
+#include <assert.h>
+
+
+struct order{
+    enum order_type type;
+    uint32_t        uid;
+    vec2_t          target;
+};
+
+VEC_TYPE(order, struct order)
+VEC_IMPL(static inline, order, struct order)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Orders are queued into 'pending' under the lock, and the main thread 
+ * swaps the buffers to carry them out without holding it. */
+static SDL_mutex     *s_lock;
+static vec_order_t    s_pending;
+static vec_order_t    s_applying;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void order_apply(const struct order *order)
+{
+    if(!G_EntityExists(order->uid))
+        return;
+
+    uint32_t flags = G_FlagsGet(order->uid);
+    if(flags & ENTITY_FLAG_ZOMBIE)
+        return;
+
+    switch(order->type) {
+    case ORDER_MOVE:
+        if(!(flags & ENTITY_FLAG_MOVABLE))
+            break;
+        G_Move_SetDest(order->uid, order->target, false);
+        break;
+    case ORDER_ATTACK:
+        if(!(flags & ENTITY_FLAG_COMBATABLE))
+            break;
+        G_Combat_SetStance(order->uid, COMBAT_STANCE_AGGRESSIVE);
+        if(flags & ENTITY_FLAG_MOVABLE) {
+            G_Move_SetDest(order->uid, order->target, true);
+        }
+        break;
+    case ORDER_STOP:
+        G_StopEntity(order->uid, true, true);
+        break;
+    case ORDER_HOLD_POSITION:
+        if(!(flags & ENTITY_FLAG_COMBATABLE))
+            break;
+        G_StopEntity(order->uid, true, true);
+        G_Combat_SetStance(order->uid, COMBAT_STANCE_HOLD_POSITION);
+        break;
+    default: assert(0);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Orders_Init(void)
+{
+    vec_order_init(&s_pending);
+    vec_order_init(&s_applying);
+
+    s_lock = SDL_CreateMutex();
+    if(!s_lock)
+        return false;
+    return true;
+}
+
+void G_Orders_Shutdown(void)
+{
+    SDL_DestroyMutex(s_lock);
+    vec_order_destroy(&s_pending);
+    vec_order_destroy(&s_applying);
+}
+
+void G_Orders_Clear(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    SDL_LockMutex(s_lock);
+    vec_order_reset(&s_pending);
+    SDL_UnlockMutex(s_lock);
+}
+
+void G_Orders_Queue(enum order_type type, size_t nents, const uint32_t *uids, vec2_t target)
+{
+    assert(type >= 0 && type < ORDER_MAX);
+
+    SDL_LockMutex(s_lock);
+    if(vec_order_resize(&s_pending, vec_size(&s_pending) + nents)) {
+        for(int i = 0; i < nents; i++) {
+            vec_order_push(&s_pending, (struct order){ type, uids[i], target });
+        }
+    }
+    SDL_UnlockMutex(s_lock);
+}
+
+void G_Orders_Apply(void)
+{
+    PERF_ENTER();
+    ASSERT_IN_MAIN_THREAD();
+
+    SDL_LockMutex(s_lock);
+    vec_order_t tmp = s_applying;
+    s_applying = s_pending;
+    s_pending = tmp;
+    SDL_UnlockMutex(s_lock);
+
+    /* In the order they were queued, so a later order for an entity wins */
+    for(int i = 0; i < vec_size(&s_applying); i++) {
+        order_apply(&vec_AT(&s_applying, i));
+    }
+    vec_order_reset(&s_applying);
+    PERF_RETURN_VOID();
+}
+
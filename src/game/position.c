@@ -46,6 +46,7 @@
 #include "../perf.h"
 #include "../sched.h"
 #include "../lib/public/mem.h"
+#include "../lib/public/vec.h"
 #include "../map/public/map.h"
 #include "../map/public/tile.h"
 #include "../render/public/render.h"
@@ -60,17 +61,45 @@ __KHASH_IMPL(pos,  extern, khint32_t, vec3_t, 1, kh_int_hash_func, kh_int_hash_e
 
 #define POSBUF_INIT_SIZE (16384)
 #define MAX_SEARCH_ENTS  (8192)
+/* The side length of a cell of the position grid */
+#define GRID_CELL_SIZE   ((TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE) / 8.0f)
+/* When more than 1/SNAPSHOT_REBUILD_DIV of all the entities have changed, 
+ * copying the entire table is cheaper than replaying the changes. */
+#define SNAPSHOT_REBUILD_DIV (4)
 #define MAX(a, b)        ((a) > (b) ? (a) : (b))
 #define MIN(a, b)        ((a) < (b) ? (a) : (b))
 #define ARR_SIZE(a)      (sizeof(a)/sizeof(a[0]))
 
+struct grid_ent{
+    uint32_t uid;
+    float    x, z;
+};
+
+VEC_TYPE(gent, struct grid_ent)
+VEC_IMPL(static inline, gent, struct grid_ent)
+
+/* A uniform grid of buckets, each holding the entities whose position 
+ * falls inside the cell. Unlike the quadtree, moving an entity within 
+ * the same cell is just an in-place update of its' coordinates, and 
+ * queries scan a handful of contiguous arrays rather than chasing 
+ * node links. Points outside the map are clamped to the edge cells.
+ */
+struct pos_grid{
+    float        xmin, xmax;
+    float        zmin, zmax;
+    int          ncols, nrows;
+    vec_gent_t  *cells;
+    size_t       nrecs;
+};
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static khash_t(pos) *s_postable;
-/* The quadtree is always synchronized with the postable, at function call boundaries */
-static qt_ent_t      s_postree;
+static khash_t(pos)  *s_postable;
+/* The grid is always synchronized with the postable, at function call boundaries */
+static struct pos_grid s_posgrid;
+
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -86,7 +115,176 @@ static bool uids_equal(const uint32_t *a, const uint32_t *b)
     return (*a == *b);
 }
 
-static int filter_garrisoned(khash_t(id) *flags, uint32_t *candidates, int count)
+static bool grid_init(struct pos_grid *grid, float xmin, float xmax, float zmin, float zmax)
+{
+    grid->xmin = xmin;
+    grid->xmax = xmax;
+    grid->zmin = zmin;
+    grid->zmax = zmax;
+    grid->ncols = MAX(1, (int)ceilf((xmax - xmin) / GRID_CELL_SIZE));
+    grid->nrows = MAX(1, (int)ceilf((zmax - zmin) / GRID_CELL_SIZE));
+    grid->nrecs = 0;
+
+    grid->cells = malloc(sizeof(vec_gent_t) * grid->ncols * grid->nrows);
+    if(!grid->cells)
+        return false;
+
+    for(int i = 0; i < grid->ncols * grid->nrows; i++) {
+        vec_gent_init(&grid->cells[i]);
+    }
+    return true;
+}
+
+static void grid_destroy(struct pos_grid *grid)
+{
+    for(int i = 0; i < grid->ncols * grid->nrows; i++) {
+        vec_gent_destroy(&grid->cells[i]);
+    }
+    free(grid->cells);
+    memset(grid, 0, sizeof(*grid));
+}
+
+static int grid_col(const struct pos_grid *grid, float x)
+{
+    int ret = (x - grid->xmin) / GRID_CELL_SIZE;
+    return MIN(MAX(ret, 0), grid->ncols - 1);
+}
+
+static int grid_row(const struct pos_grid *grid, float z)
+{
+    int ret = (z - grid->zmin) / GRID_CELL_SIZE;
+    return MIN(MAX(ret, 0), grid->nrows - 1);
+}
+
+static vec_gent_t *grid_cell(struct pos_grid *grid, float x, float z)
+{
+    return &grid->cells[grid_row(grid, z) * grid->ncols + grid_col(grid, x)];
+}
+
+static int grid_cell_find(const vec_gent_t *cell, uint32_t uid)
+{
+    for(int i = 0; i < vec_size(cell); i++) {
+        if(vec_AT(cell, i).uid == uid)
+            return i;
+    }
+    return -1;
+}
+
+static bool grid_insert(struct pos_grid *grid, uint32_t uid, float x, float z)
+{
+    vec_gent_t *cell = grid_cell(grid, x, z);
+    if(!vec_gent_push(cell, (struct grid_ent){uid, x, z}))
+        return false;
+    grid->nrecs++;
+    return true;
+}
+
+static bool grid_delete(struct pos_grid *grid, uint32_t uid, float x, float z)
+{
+    vec_gent_t *cell = grid_cell(grid, x, z);
+    int idx = grid_cell_find(cell, uid);
+    if(idx == -1)
+        return false;
+
+    vec_AT(cell, idx) = vec_AT(cell, vec_size(cell) - 1);
+    vec_gent_pop(cell);
+    grid->nrecs--;
+    return true;
+}
+
+static bool grid_move(struct pos_grid *grid, uint32_t uid, vec3_t from, vec3_t to)
+{
+    vec_gent_t *src = grid_cell(grid, from.x, from.z);
+    vec_gent_t *dst = grid_cell(grid, to.x, to.z);
+
+    if(src == dst) {
+        int idx = grid_cell_find(src, uid);
+        if(idx == -1)
+            return false;
+        vec_AT(src, idx).x = to.x;
+        vec_AT(src, idx).z = to.z;
+        return true;
+    }
+
+    if(!grid_delete(grid, uid, from.x, from.z))
+        return false;
+    return grid_insert(grid, uid, to.x, to.z);
+}
+
+static int grid_inrange_rect(struct pos_grid *grid, float xmin, float xmax, 
+                             float zmin, float zmax, uint32_t *out, size_t maxout)
+{
+    int ret = 0;
+    int cmin = grid_col(grid, xmin), cmax = grid_col(grid, xmax);
+    int rmin = grid_row(grid, zmin), rmax = grid_row(grid, zmax);
+
+    for(int r = rmin; r <= rmax; r++) {
+    for(int c = cmin; c <= cmax; c++) {
+
+        const vec_gent_t *cell = &grid->cells[r * grid->ncols + c];
+        for(int i = 0; i < vec_size(cell); i++) {
+
+            const struct grid_ent *ent = &vec_AT(cell, i);
+            if(ent->x < xmin || ent->x > xmax)
+                continue;
+            if(ent->z < zmin || ent->z > zmax)
+                continue;
+            if(ret == maxout)
+                return ret;
+            out[ret++] = ent->uid;
+        }
+    }}
+    return ret;
+}
+
+static int grid_inrange_circle(struct pos_grid *grid, float x, float z, float range,
+                               uint32_t *out, size_t maxout)
+{
+    int ret = 0;
+    const float range_sq = range * range;
+    int cmin = grid_col(grid, x - range), cmax = grid_col(grid, x + range);
+    int rmin = grid_row(grid, z - range), rmax = grid_row(grid, z + range);
+
+    for(int r = rmin; r <= rmax; r++) {
+    for(int c = cmin; c <= cmax; c++) {
+
+        const vec_gent_t *cell = &grid->cells[r * grid->ncols + c];
+        for(int i = 0; i < vec_size(cell); i++) {
+
+            const struct grid_ent *ent = &vec_AT(cell, i);
+            float dx = ent->x - x;
+            float dz = ent->z - z;
+            if(dx * dx + dz * dz > range_sq)
+                continue;
+            if(ret == maxout)
+                return ret;
+            out[ret++] = ent->uid;
+        }
+    }}
+    return ret;
+}
+
+static bool tree_build(const khash_t(pos) *table, qt_ent_t *out)
+{
+    qt_ent_init(out, s_posgrid.xmin, s_posgrid.xmax, 
+        s_posgrid.zmin, s_posgrid.zmax, uids_equal);
+    if(!qt_ent_reserve(out, kh_size(table))) {
+        qt_ent_destroy(out);
+        return false;
+    }
+
+    uint32_t uid;
+    vec3_t pos;
+    kh_foreach(table, uid, pos, {
+        if(!qt_ent_insert(out, pos.x, pos.z, uid)) {
+            qt_ent_destroy(out);
+            return false;
+        }
+    });
+    return true;
+}
+
+static int filter_garrisoned(const vec_erec_t *flags, uint32_t *candidates, int count)
 {
     int ret = count;
     for(int i = count-1; i >=0; i--) {
@@ -107,6 +305,53 @@ static int filter_garrisoned(khash_t(id) *flags, uint32_t *candidates, int count
     return ret;
 }
 
+static void snapshot_remove(struct pos_snapshot *snap, uint32_t uid)
+{
+    khiter_t k = kh_get(pos, snap->table, uid);
+    if(k == kh_end(snap->table))
+        return;
+
+    vec3_t pos = kh_val(snap->table, k);
+    qt_ent_delete(&snap->tree, pos.x, pos.z, uid);
+    kh_del(pos, snap->table, k);
+}
+
+static bool snapshot_insert(struct pos_snapshot *snap, uint32_t uid, vec3_t pos)
+{
+    if(!qt_ent_insert(&snap->tree, pos.x, pos.z, uid))
+        return false;
+
+    int ret;
+    khiter_t k = kh_put(pos, snap->table, uid, &ret);
+    if(ret == -1) {
+        qt_ent_delete(&snap->tree, pos.x, pos.z, uid);
+        return false;
+    }
+    kh_val(snap->table, k) = pos;
+    return true;
+}
+
+static bool snapshot_copy_all(struct pos_snapshot *snap)
+{
+    khash_t(pos) *table = kh_copy_pos(s_postable);
+    if(!table)
+        return false;
+
+    qt_ent_t tree;
+    if(!tree_build(table, &tree)) {
+        kh_destroy(pos, table);
+        return false;
+    }
+
+    if(snap->table) {
+        kh_destroy(pos, snap->table);
+        qt_ent_destroy(&snap->tree);
+    }
+    snap->table = table;
+    snap->tree = tree;
+    return true;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -118,39 +363,49 @@ bool G_Pos_Set(uint32_t uid, vec3_t pos)
     khiter_t k = kh_get(pos, s_postable, uid);
     bool overwrite = (k != kh_end(s_postable));
     float vrange = G_GetVisionRange(uid);
+    vec3_t old_pos = overwrite ? kh_val(s_postable, k) : (vec3_t){0};
 
     if(overwrite) {
-        vec3_t old_pos = kh_val(s_postable, k);
-        bool ret = qt_ent_delete(&s_postree, old_pos.x, old_pos.z, uid);
-        assert(ret);
-
         G_Combat_RemoveRef(G_GetFactionID(uid), (vec2_t){old_pos.x, old_pos.z});
-        G_Region_RemoveRef(uid, (vec2_t){old_pos.x, old_pos.z});
-        G_Fog_RemoveVision((vec2_t){old_pos.x, old_pos.z}, G_GetFactionID(uid), vrange);
-    }
 
-    if(!qt_ent_insert(&s_postree, pos.x, pos.z, uid))
-        return false;
+        if(!grid_move(&s_posgrid, uid, old_pos, pos)) {
+            G_Region_RemoveRef(uid, (vec2_t){old_pos.x, old_pos.z});
+            G_Fog_RemoveVision((vec2_t){old_pos.x, old_pos.z}, G_GetFactionID(uid), vrange);
+            return false;
+        }
+    }else{
+        if(!grid_insert(&s_posgrid, uid, pos.x, pos.z))
+            return false;
 
-    if(!overwrite) {
         int ret;
         kh_put(pos, s_postable, uid, &ret); 
         if(ret == -1) {
-            qt_ent_delete(&s_postree, pos.x, pos.z, uid);
+            grid_delete(&s_posgrid, uid, pos.x, pos.z);
             return false;
         }
         k = kh_get(pos, s_postable, uid);
     }
 
     kh_val(s_postable, k) = pos;
-    assert(kh_size(s_postable) == s_postree.nrecs);
+    assert(kh_size(s_postable) == s_posgrid.nrecs);
+    G_Changes_Mark(uid, CHANGE_POS);
 
     G_Move_UpdatePos(uid, (vec2_t){pos.x, pos.z});
     G_Combat_AddRef(G_GetFactionID(uid), (vec2_t){pos.x, pos.z});
-    G_Region_AddRef(uid, (vec2_t){pos.x, pos.z});
+    if(overwrite) {
+        G_Region_MoveRef(uid, (vec2_t){old_pos.x, old_pos.z}, (vec2_t){pos.x, pos.z});
+    }else{
+        G_Region_AddRef(uid, (vec2_t){pos.x, pos.z});
+    }
     G_Building_UpdateBounds(uid);
     G_Resource_UpdateBounds(uid);
-    G_Fog_AddVision((vec2_t){pos.x, pos.z}, G_GetFactionID(uid), vrange);
+
+    if(overwrite) {
+        G_Fog_MoveVision((vec2_t){old_pos.x, old_pos.z}, (vec2_t){pos.x, pos.z}, 
+            G_GetFactionID(uid), vrange);
+    }else{
+        G_Fog_AddVision((vec2_t){pos.x, pos.z}, G_GetFactionID(uid), vrange);
+    }
 
     return true; 
 }
@@ -175,6 +430,106 @@ khash_t(pos) *G_Pos_CopyTable(void)
     return kh_copy_pos(s_postable);
 }
 
+bool G_Pos_SnapshotInit(struct pos_snapshot *snap)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(NULL == (snap->dirty = kh_init(entity)))
+        goto fail_dirty;
+
+    snap->table = NULL;
+    snap->rebuild = false;
+    if(!snapshot_copy_all(snap))
+        goto fail_copy;
+
+    if(!G_Changes_Subscribe(&snap->changes, CHANGE_POS))
+        goto fail_subscribe;
+
+    return true;
+
+fail_subscribe:
+    kh_destroy(pos, snap->table);
+    qt_ent_destroy(&snap->tree);
+fail_copy:
+    kh_destroy(entity, snap->dirty);
+fail_dirty:
+    return false;
+}
+
+void G_Pos_SnapshotDestroy(struct pos_snapshot *snap)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    G_Changes_Unsubscribe(&snap->changes);
+    kh_destroy(entity, snap->dirty);
+    kh_destroy(pos, snap->table);
+    qt_ent_destroy(&snap->tree);
+    memset(snap, 0, sizeof(*snap));
+}
+
+void G_Pos_SnapshotSync(struct pos_snapshot *snap)
+{
+    PERF_ENTER();
+    ASSERT_IN_MAIN_THREAD();
+
+    struct change changes[256];
+    int nchanges;
+    while((nchanges = G_Changes_Read(&snap->changes, ARR_SIZE(changes), changes))) {
+
+        if(nchanges < 0) {
+            snap->rebuild = true;
+            continue;
+        }
+        for(int i = 0; !snap->rebuild && i < nchanges; i++) {
+            int ret;
+            kh_put(entity, snap->dirty, changes[i].uid, &ret);
+            if(ret == -1)
+                snap->rebuild = true;
+        }
+    }
+
+    if(!snap->rebuild && kh_size(snap->dirty) > kh_size(s_postable) / SNAPSHOT_REBUILD_DIV)
+        snap->rebuild = true;
+
+    if(!snap->rebuild) {
+
+        uint32_t uid;
+        kh_foreach_key(snap->dirty, uid, {
+
+            snapshot_remove(snap, uid);
+            khiter_t k = kh_get(pos, s_postable, uid);
+            if(k == kh_end(s_postable))
+                continue;
+            if(!snapshot_insert(snap, uid, kh_val(s_postable, k))) {
+                snap->rebuild = true;
+                break;
+            }
+        });
+    }
+
+    /* On failure, keep the stale snapshot and try again on the next sync */
+    if(snap->rebuild && snapshot_copy_all(snap))
+        snap->rebuild = false;
+
+    if(!snap->rebuild)
+        kh_clear(entity, snap->dirty);
+    PERF_RETURN_VOID();
+}
+
+void G_Pos_SnapshotSet(struct pos_snapshot *snap, uint32_t uid, vec3_t pos)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    snapshot_remove(snap, uid);
+    if(!snapshot_insert(snap, uid, pos))
+        snap->rebuild = true;
+
+    int ret;
+    kh_put(entity, snap->dirty, uid, &ret);
+    if(ret == -1)
+        snap->rebuild = true;
+}
+
 vec3_t G_Pos_GetFrom(khash_t(pos) *table, uint32_t uid)
 {
     khiter_t k = kh_get(pos, table, uid);
@@ -200,9 +555,18 @@ void G_Pos_Delete(uint32_t uid)
     vec3_t pos = kh_val(s_postable, k);
     kh_del(pos, s_postable, k);
 
-    bool ret = qt_ent_delete(&s_postree, pos.x, pos.z, uid);
+    bool ret = grid_delete(&s_posgrid, uid, pos.x, pos.z);
     assert(ret);
-    assert(kh_size(s_postable) == s_postree.nrecs);
+    (void)ret;
+    assert(kh_size(s_postable) == s_posgrid.nrecs);
+    G_Changes_Mark(uid, CHANGE_POS);
+}
+
+void G_Pos_Reserve(size_t nents)
+{
+    /* Stay under the load factor at which the table would grow */
+    size_t size = kh_size(s_postable) + nents;
+    kh_resize(pos, s_postable, size + size / 3 + 1);
 }
 
 void G_Pos_Garrison(uint32_t uid)
@@ -227,10 +591,10 @@ void G_Pos_Ungarrison(uint32_t uid, vec3_t pos)
     assert(k != kh_end(s_postable));
 
     vec3_t old_pos = kh_val(s_postable, k);
-    qt_ent_delete(&s_postree, old_pos.x, old_pos.z, uid);
-    qt_ent_insert(&s_postree, pos.x, pos.z, uid);
+    grid_move(&s_posgrid, uid, old_pos, pos);
 
     kh_val(s_postable, k) = pos;
+    G_Changes_Mark(uid, CHANGE_POS);
     float vrange = G_GetVisionRange(uid);
 
     G_Combat_AddRef(G_GetFactionID(uid), (vec2_t){pos.x, pos.z});
@@ -257,8 +621,7 @@ bool G_Pos_Init(const struct map *map)
     float zmin = center.z - (res.tile_h * res.chunk_h * Z_COORDS_PER_TILE) / 2.0f;
     float zmax = center.z + (res.tile_h * res.chunk_h * Z_COORDS_PER_TILE) / 2.0f;
 
-    qt_ent_init(&s_postree, xmin, xmax, zmin, zmax, uids_equal);
-    if(!qt_ent_reserve(&s_postree, POSBUF_INIT_SIZE)) {
+    if(!grid_init(&s_posgrid, xmin, xmax, zmin, zmax)) {
         kh_destroy(pos, s_postable);
         return false;
     }
@@ -271,13 +634,13 @@ void G_Pos_Shutdown(void)
     ASSERT_IN_MAIN_THREAD();
 
     kh_destroy(pos, s_postable);
-    qt_ent_destroy(&s_postree);
+    grid_destroy(&s_posgrid);
 }
 
 int G_Pos_EntsInRect(vec2_t xz_min, vec2_t xz_max, uint32_t *out, size_t maxout)
 {
     PERF_ENTER();
-    int ret = qt_ent_inrange_rect(&s_postree, 
+    int ret = grid_inrange_rect(&s_posgrid, 
         xz_min.x, xz_max.x, xz_min.z, xz_max.z, out, maxout);
     ret = filter_garrisoned(NULL, out, ret);
     PERF_RETURN(ret);
@@ -291,7 +654,7 @@ int G_Pos_EntsInRectWithPred(vec2_t xz_min, vec2_t xz_max, uint32_t *out, size_t
 
     STALLOC(uint32_t, ent_ids, maxout);
 
-    int ntotal = qt_ent_inrange_rect(&s_postree, 
+    int ntotal = grid_inrange_rect(&s_posgrid, 
         xz_min.x, xz_max.x, xz_min.z, xz_max.z, ent_ids, maxout);
     ntotal = filter_garrisoned(NULL, ent_ids, ntotal);
     int ret = 0;
@@ -312,7 +675,7 @@ int G_Pos_EntsInCircle(vec2_t xz_point, float range, uint32_t *out, size_t maxou
 {
     PERF_ENTER();
     ASSERT_IN_MAIN_THREAD();
-    int ret = qt_ent_inrange_circle(&s_postree, 
+    int ret = grid_inrange_circle(&s_posgrid, 
         xz_point.x, xz_point.z, range, out, maxout);
     ret = filter_garrisoned(NULL, out, ret);
     PERF_RETURN(ret);
@@ -321,8 +684,28 @@ int G_Pos_EntsInCircle(vec2_t xz_point, float range, uint32_t *out, size_t maxou
 int G_Pos_EntsInCircleWithPred(vec2_t xz_point, float range, uint32_t *out, size_t maxout,
                                bool (*predicate)(uint32_t ent, void *arg), void *arg)
 {
+    PERF_ENTER();
     ASSERT_IN_MAIN_THREAD();
-    return G_Pos_EntsInCircleWithPredFrom(&s_postree, NULL, xz_point, range, out, maxout, predicate, arg);
+    assert(Sched_UsingBigStack());
+
+    STALLOC(uint32_t, ent_ids, maxout);
+
+    int ntotal = grid_inrange_circle(&s_posgrid, 
+        xz_point.x, xz_point.z, range, ent_ids, maxout);
+    ntotal = filter_garrisoned(NULL, ent_ids, ntotal);
+    int ret = 0;
+
+    for(int i = 0; i < ntotal; i++) {
+
+        uint32_t curr = ent_ids[i];
+        if(!predicate(curr, arg))
+            continue;
+
+        out[ret++] = curr;
+    }
+
+    STFREE(ent_ids);
+    PERF_RETURN(ret);
 }
 
 qt_ent_t *G_Pos_CopyQuadTree(void)
@@ -330,7 +713,10 @@ qt_ent_t *G_Pos_CopyQuadTree(void)
     qt_ent_t *ret = malloc(sizeof(qt_ent_t));
     if(!ret)
         return NULL;
-    qt_ent_copy(&s_postree, ret);
+    if(!tree_build(s_postable, ret)) {
+        free(ret);
+        return NULL;
+    }
     return ret;
 }
 
@@ -340,7 +726,7 @@ void G_Pos_DestroyQuadTree(qt_ent_t *tree)
     free(tree);
 }
 
-int G_Pos_EntsInCircleFrom(qt_ent_t *tree, khash_t(id) *flags, vec2_t xz_point, float range, 
+int G_Pos_EntsInCircleFrom(qt_ent_t *tree, const vec_erec_t *flags, vec2_t xz_point, float range, 
                            uint32_t *out, size_t maxout)
 {
     PERF_ENTER();
@@ -349,7 +735,17 @@ int G_Pos_EntsInCircleFrom(qt_ent_t *tree, khash_t(id) *flags, vec2_t xz_point,
     PERF_RETURN(ret);
 }
 
-int G_Pos_EntsInCircleWithPredFrom(qt_ent_t *tree, khash_t(id) *flags, vec2_t xz_point, float range, 
+int G_Pos_EntsInRectFrom(qt_ent_t *tree, const vec_erec_t *flags, vec2_t xz_min, vec2_t xz_max, 
+                         uint32_t *out, size_t maxout)
+{
+    PERF_ENTER();
+    int ret = qt_ent_inrange_rect(tree, 
+        xz_min.x, xz_max.x, xz_min.z, xz_max.z, out, maxout);
+    ret = filter_garrisoned(flags, out, ret);
+    PERF_RETURN(ret);
+}
+
+int G_Pos_EntsInCircleWithPredFrom(qt_ent_t *tree, const vec_erec_t *flags, vec2_t xz_point, float range, 
                                    uint32_t *out, size_t maxout,
                                    bool (*predicate)(uint32_t ent, void *arg), void *arg)
 {
@@ -385,7 +781,7 @@ uint32_t G_Pos_NearestWithPred(vec2_t xz_point,
     assert(Sched_UsingBigStack());
 
     uint32_t ent_ids[MAX_SEARCH_ENTS];
-    const float qt_len = MAX(s_postree.xmax - s_postree.xmin, s_postree.ymax - s_postree.ymin);
+    const float qt_len = MAX(s_posgrid.xmax - s_posgrid.xmin, s_posgrid.zmax - s_posgrid.zmin);
     float len = (TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE) / 8.0f;
 
     if(max_range == 0.0) {
@@ -398,7 +794,7 @@ uint32_t G_Pos_NearestWithPred(vec2_t xz_point,
         float min_dist = FLT_MAX;
         uint32_t ret = NULL_UID;
 
-        int num_cands = qt_ent_inrange_circle(&s_postree, xz_point.x, xz_point.z,
+        int num_cands = grid_inrange_circle(&s_posgrid, xz_point.x, xz_point.z,
             len, ent_ids, ARR_SIZE(ent_ids));
         num_cands = filter_garrisoned(NULL, ent_ids, num_cands);
 
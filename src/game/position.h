@@ -37,6 +37,7 @@
 #define POSITION_H
 
 #include "game_private.h"
+#include "changes.h"
 #include "../pf_math.h"
 #include "../lib/public/khash.h"
 #include "../lib/public/quadtree.h"
@@ -48,21 +49,47 @@ QUADTREE_PROTOTYPES(extern, ent, uint32_t)
 
 KHASH_DECLARE(pos, khint32_t, vec3_t)
 
+/* A persistent copy of the position table and quadtree which is safe to 
+ * read from worker threads. Rather than copying the whole world every 
+ * tick, the snapshot reads the entities that have been moved since it 
+ * was last synchronized from the change log and only replays those.
+ */
+struct pos_snapshot{
+    khash_t(pos)        *table;
+    qt_ent_t             tree;
+    khash_t(entity)     *dirty;
+    struct change_cursor changes;
+    bool                 rebuild;
+};
+
 bool      G_Pos_Init(const struct map *map);
 void      G_Pos_Shutdown(void);
 void      G_Pos_Delete(uint32_t uid);
+/* Make room for this many more entities ahead of adding them */
+void      G_Pos_Reserve(size_t nents);
 void      G_Pos_Upload(void);
 
 qt_ent_t *G_Pos_CopyQuadTree(void);
 void      G_Pos_DestroyQuadTree(qt_ent_t *tree);
-int       G_Pos_EntsInCircleFrom(qt_ent_t *tree, khash_t(id) *flags, vec2_t xz_point, float range, 
+int       G_Pos_EntsInCircleFrom(qt_ent_t *tree, const vec_erec_t *flags, vec2_t xz_point, float range, 
                                  uint32_t *out, size_t maxout);
-int       G_Pos_EntsInCircleWithPredFrom(qt_ent_t *tree, khash_t(id) *flags, 
+int       G_Pos_EntsInRectFrom(qt_ent_t *tree, const vec_erec_t *flags, vec2_t xz_min, vec2_t xz_max, 
+                               uint32_t *out, size_t maxout);
+int       G_Pos_EntsInCircleWithPredFrom(qt_ent_t *tree, const vec_erec_t *flags, 
                                          vec2_t xz_point, float range, 
                                          uint32_t *out, size_t maxout,
                                          bool (*predicate)(uint32_t ent, void *arg), void *arg);
 
 khash_t(pos) *G_Pos_CopyTable(void);
+
+bool      G_Pos_SnapshotInit(struct pos_snapshot *snap);
+void      G_Pos_SnapshotDestroy(struct pos_snapshot *snap);
+/* Bring the snapshot up to date with the current positions. Must not be 
+ * called while there are any readers of the snapshot. */
+void      G_Pos_SnapshotSync(struct pos_snapshot *snap);
+/* Update the position of an entity in the snapshot only. The entity is 
+ * re-synchronized with its' true position on the next sync. */
+void      G_Pos_SnapshotSet(struct pos_snapshot *snap, uint32_t uid, vec3_t pos);
 vec3_t        G_Pos_GetFrom(khash_t(pos) *table, uint32_t uid);
 vec2_t        G_Pos_GetXZFrom(khash_t(pos) *table, uint32_t uid);
 
@@ -93,6 +93,8 @@ struct render_input{
     const struct camera *cam;
     const struct map    *map;
     bool                 shadows;
+    /* Read back the depth under the cursor after drawing the map */
+    bool                 pick;
     vec3_t               light_pos;
     /* The visible entities to render */
     vec_rstat_t         cam_vis_stat;
@@ -109,6 +111,18 @@ enum hb_mode{
     HB_MODE_NEVER
 };
 
+/* The kinds of entity state changes recorded in the change log */
+enum entity_change{
+    CHANGE_POS          = (1 << 0),
+    CHANGE_FACTION      = (1 << 1),
+    CHANGE_FLAGS        = (1 << 2),
+    CHANGE_SEL_RADIUS   = (1 << 3),
+    CHANGE_TRANSFORM    = (1 << 4),
+    CHANGE_ADDED        = (1 << 5),
+    CHANGE_REMOVED      = (1 << 6),
+    CHANGE_ALL          = (1 << 7) - 1
+};
+
 enum formation_type{
     FORMATION_NONE,
     FORMATION_RANK,
@@ -131,7 +145,28 @@ void            G_ClearRenderWork(void);
 
 void            G_Update(void);
 void            G_Render(void);
+/* Advance the fixed-timestep simulation clock by the real time elapsed since 
+ * the last call and notify the 60Hz ticks that are due. Returns the number 
+ * of ticks notified. In free-running mode, every call notifies exactly one 
+ * tick, such that the simulation runs as fast as possible. */
+int             G_Timer_Advance(void);
+/* Notify exactly 'nticks' ticks, regardless of the real time elapsed. Used 
+ * for reproducing the tick schedule of a recorded session. */
+void            G_Timer_AdvanceBy(int nticks);
+void            G_Timer_SetFreeRunning(bool on);
+bool            G_Timer_GetFreeRunning(void);
+/* Retire the render workspace and submit the simulation one. The render 
+ * thread must be done with its' current workspace. */
 void            G_SwapBuffers(void);
+/* Submit the simulation workspace to be rendered after the ones already 
+ * submitted, while the render thread is still busy. Only allowed when 
+ * 'G_CanQueueBuffers' returns true, as set by 'pf.game.render_pipeline_depth'. */
+void            G_QueueBuffers(void);
+bool            G_CanQueueBuffers(void);
+int             G_NumQueuedBuffers(void);
+/* Move on to the next submitted workspace, once the render thread is 
+ * done with its' current one. */
+void            G_RetireRenderBuffers(void);
 
 /* This does not have any side effects besides  making draw calls, 
  * so it is safe to invoke from the render thread. 
@@ -148,19 +183,36 @@ bool            G_MouseOverMinimap(void);
 bool            G_MouseInTargetMode(void);
 bool            G_MapHeightAtPoint(vec2_t xz, float *out_height);
 bool            G_MapClosestPathable(vec2_t xz, vec2_t *out, enum nav_layer layer);
+bool            G_MapNavBenchmark(const struct nav_bench_desc *desc, struct nav_bench_result *out);
 bool            G_PointInsideMap(vec2_t xz);
 bool            G_PointOverWater(vec2_t xz);
 bool            G_PointOverLand(vec2_t xz);
 
 void            G_BakeNavDataForScene(void);
+bool            G_WriteMapNavData(SDL_RWops *stream);
 
 bool            G_AddEntity(uint32_t uid, uint32_t flags, vec3_t pos);
 bool            G_RemoveEntity(uint32_t uid);
+/* Between these calls, the nav blocker, fog and region updates caused by
+ * adding, removing and moving entities are held back and applied together
+ * at the end of the outermost batch. 'nents' is the number of entities
+ * expected to be added, for which room is made ahead of time. */
+void            G_BeginEntityBatch(size_t nents);
+void            G_EndEntityBatch(void);
+/* Returns the number of entities which were added or removed */
+size_t          G_AddEntities(size_t nents, const uint32_t *uids, const uint32_t *flags, 
+                              const vec3_t *pos);
+size_t          G_RemoveEntities(size_t nents, const uint32_t *uids);
 void            G_StopEntity(uint32_t uid, bool stop_move, bool stop_garrison);
 void            G_UpdateBounds(uint32_t uid);
+/* Record that the state of the entity has changed ('entity_change' flags) */
+void            G_Changes_Mark(uint32_t uid, uint32_t what);
 void            G_Zombiefy(uint32_t uid, bool invis);
 bool            G_EntityExists(uint32_t uid);
 bool            G_EntityIsZombie(uint32_t uid);
+/* A hash of the positions, flags, factions and hitpoints of all the entities, 
+ * for detecting simulations diverging */
+uint64_t        G_StateHash(void);
 bool            G_EntityIsGarrisoned(uint32_t uid);
 
 void            G_FreeEntity(uint32_t uid);
@@ -191,6 +243,7 @@ void            G_MoveActiveCamera(vec2_t xz_ground_pos);
 
 bool            G_UpdateMinimapChunk(int chunk_r, int chunk_c);
 bool            G_UpdateTile(const struct tile_desc *desc, const struct tile *tile);
+bool            G_UpdateTiles(size_t ntiles, const struct tile_desc *descs, const struct tile *tiles);
 bool            G_GetTile(const struct tile_desc *desc, struct tile *out);
 
 void            G_SetSimState(enum simstate ss);
@@ -253,6 +306,13 @@ void G_Move_SetClickEnabled(bool on);
 bool G_Move_GetClickEnabled(void);
 bool G_Move_GetMaxSpeed(uint32_t uid, float *out);
 bool G_Move_SetMaxSpeed(uint32_t uid, float speed);
+/* Only computed when the 'pf.game.deterministic_movement' setting is on */
+uint64_t G_Move_StateHash(void);
+
+/* Carry out a move order of the player, as if the ground had been clicked at 
+ * 'pos' with the entities selected. A zero 'orientation' uses the default. */
+void G_Move_Order(size_t nents, const uint32_t *ents, bool attack, vec3_t pos, 
+                  vec2_t orientation);
 
 void G_Move_ArrangeInFormation(vec_entity_t *ents, vec2_t target, 
                                vec2_t orientation, enum formation_type type);
@@ -275,6 +335,9 @@ enum combat_stance{
 };
 
 void  G_Combat_AttackUnit(uint32_t uid, uint32_t target);
+/* Carry out an attack order of the player, as if 'target' had been clicked 
+ * with the entities selected. */
+void  G_Combat_AttackOrder(size_t nents, const uint32_t *ents, uint32_t target);
 
 void  G_Combat_SetStance(uint32_t uid, enum combat_stance stance);
 void  G_Combat_SetCurrentHP(uint32_t uid, int hp);
@@ -294,6 +357,17 @@ void  G_Combat_SetProjDesc(uint32_t uid, const struct proj_desc *pd);
 
 enum combat_stance G_Combat_GetStance(uint32_t uid);
 
+struct combat_hit{
+    uint32_t attacker;
+    uint32_t target;
+    float    damage;
+    bool     killed;
+};
+
+/* Get all the hits that landed during the most recent combat tick. The
+ * returned buffer is valid until the next combat tick. */
+size_t G_Combat_GetHits(const struct combat_hit **out);
+
 /*###########################################################################*/
 /* GAME POSITION                                                             */
 /*###########################################################################*/
@@ -314,6 +388,46 @@ uint32_t       G_Pos_NearestWithPred(vec2_t xz_point,
                                      bool (*predicate)(uint32_t ent, void *arg), 
                                      void *arg, float max_range);
 
+/*###########################################################################*/
+/* GAME WORLD SNAPSHOT                                                       */
+/*###########################################################################*/
+
+enum snapshot_query_shape{
+    SNAPSHOT_QUERY_CIRCLE,
+    SNAPSHOT_QUERY_RECT,
+};
+
+struct snapshot_query{
+    enum snapshot_query_shape shape;
+    vec2_t    a, b;         /* the center and (radius, 0), or the min and max corners */
+    int       faction_id;   /* negative for any */
+    uint32_t  flags;        /* all must be set */
+    uint32_t *out;
+    size_t    maxout;
+    size_t    nout;
+};
+
+/* The queries are answered in parallel from a copy of the positions and 
+ * the entity records, taken on the first batch of every tick. */
+void  G_Snapshot_QueryBatch(size_t nqueries, struct snapshot_query *queries);
+
+/*###########################################################################*/
+/* GAME ORDERS                                                               */
+/*###########################################################################*/
+
+enum order_type{
+    ORDER_MOVE,
+    ORDER_ATTACK,
+    ORDER_STOP,
+    ORDER_HOLD_POSITION,
+    ORDER_MAX
+};
+
+/* Orders can be queued from any thread. They are carried out on the main 
+ * thread at the start of the next update, skipping the entities that have 
+ * since gone or that can't carry them out. */
+void  G_Orders_Queue(enum order_type type, size_t nents, const uint32_t *uids, vec2_t target);
+
 /*###########################################################################*/
 /* GAME FOG-OF-WAR                                                           */
 /*###########################################################################*/
@@ -358,6 +472,7 @@ void   G_Building_SetPositionRallyPointOnLeftClick(void);
 /*###########################################################################*/
 
 bool G_Builder_Build(uint32_t uid, uint32_t building);
+void G_Builder_BuildOrder(size_t nents, const uint32_t *ents, uint32_t building);
 void G_Builder_SetBuildSpeed(uint32_t uid, int speed);
 int  G_Builder_GetBuildSpeed(uint32_t uid);
 void G_Builder_SetBuildOnLeftClick(void);
@@ -408,6 +523,7 @@ void  G_Harvester_SetDropOffOnLeftClick(void);
 void  G_Harvester_SetTransportOnLeftClick(void);
 
 bool  G_Harvester_Gather(uint32_t uid, uint32_t storage);
+void  G_Harvester_GatherOrder(size_t nents, const uint32_t *ents, uint32_t resource);
 bool  G_Harvester_PickUp(uint32_t uid, uint32_t storage);
 bool  G_Harvester_DropOff(uint32_t uid, uint32_t storage);
 bool  G_Harvester_Transport(uint32_t uid, uint32_t storage);
@@ -491,6 +607,30 @@ bool   G_Region_ContainsEnt(const char *name, uint32_t uid);
 bool   G_Region_ExploreFog(const char *name, int faction_id);
 bool   G_Region_Explored(const char *name, uint16_t player_mask, bool *out);
 
+/*###########################################################################*/
+/* GAME INFLUENCE                                                            */
+/*###########################################################################*/
+
+enum influence_layer{
+    /* The summed base damage of the faction's combatable entities */
+    INFLUENCE_STRENGTH,
+    /* The number of the faction's entities with vision of the bin */
+    INFLUENCE_VISION,
+    /* The summed amount of the faction's resources */
+    INFLUENCE_RESOURCES,
+    INFLUENCE_LAYER_MAX
+};
+
+/* Returns the most recently published grid for the faction and layer, as
+ * (h x w) floats in row-major order. Rows and columns are in the same order
+ * as the map's tiles. The data is valid until the next game update. Returns 
+ * NULL if there is no map. */
+const float *G_Influence_Get(int faction_id, enum influence_layer layer, 
+                             int *out_w, int *out_h);
+float        G_Influence_At(int faction_id, enum influence_layer layer, vec2_t xz_pos);
+/* The side length of a single bin in worldspace coordinates */
+float        G_Influence_BinSize(void);
+
 /*###########################################################################*/
 /* GAME FORMATION                                                            */
 /*###########################################################################*/
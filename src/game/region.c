@@ -56,7 +56,11 @@
 
 
 #define MAX(a, b)    ((a) > (b) ? (a) : (b))
+#define MIN(a, b)    ((a) < (b) ? (a) : (b))
 #define ARR_SIZE(a)  (sizeof(a)/sizeof(a[0]))
+/* Regions are bucketed by the grid cells that they overlap. Every chunk 
+ * is split into this many cells along each dimension. */
+#define CELLS_PER_CHUNK (4)
 #define EPSILON      (1.0f/1024)
 
 #define CHK_TRUE_RET(_pred)             \
@@ -68,8 +72,19 @@
 VEC_TYPE(str, const char*)
 VEC_IMPL(static inline, str, const char*)
 
-VEC_TYPE(uid, uint32_t)
-VEC_IMPL(static inline, uid, uint32_t)
+/* Cells fully inside the region can never have entities crossing the 
+ * region boundary without also crossing the cell boundary */
+struct cell_entry{
+    const char *name;
+    bool        interior;
+};
+
+VEC_TYPE(cell, struct cell_entry)
+VEC_IMPL(static inline, cell, struct cell_entry)
+
+KHASH_SET_INIT_INT(uid)
+/* +1 for entering, -1 for exiting since the last update */
+KHASH_MAP_INIT_INT(delta, int)
 
 struct region{
     enum region_type type;
@@ -82,8 +97,8 @@ struct region{
     };
     bool shown;
     vec2_t pos;
-    vec_uid_t curr_ents;
-    vec_uid_t prev_ents;
+    khash_t(uid)   *members;
+    khash_t(delta) *pending;
 };
 
 enum op{
@@ -100,25 +115,89 @@ KHASH_SET_INIT_STR(name)
 static const struct map *s_map;
 static khash_t(region)  *s_regions;
 static bool              s_render = false;
-/* Keep track of which regions intersect every chunk, 
+/* Keep track of which regions intersect every grid cell, 
  * making a poor man's 2-level tree */
-static vec_str_t        *s_intersecting;
+static vec_cell_t       *s_cells;
+static int               s_cells_per_chunk;
+static int               s_cell_rows, s_cell_cols;
 static khash_t(name)    *s_dirty;
 /* Keep the event argument strings around for one tick, so that 
  * they can be used by the event handlers safely */
 static vec_str_t         s_eventargs;
+/* The entities added during a batch. Their membership is only 
+ * resolved at the end of it, at their final positions. */
+static int               s_batch_depth;
+static khash_t(uid)     *s_batch_ents;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static bool region_intersects_chunk(const struct region *reg, struct map_resolution res, struct tile_desc td)
+static bool region_contains(const struct region *reg, vec2_t point)
+{
+    switch(reg->type) {
+    case REGION_CIRCLE: {
+        return C_PointInsideCircle2D(point, reg->pos, reg->radius);
+    }
+    case REGION_RECTANGLE: {
+        vec2_t corners[4] = {
+            (vec2_t){reg->pos.x + reg->xlen/2.0f, reg->pos.z - reg->zlen/2.0f},
+            (vec2_t){reg->pos.x - reg->xlen/2.0f, reg->pos.z - reg->zlen/2.0f},
+            (vec2_t){reg->pos.x - reg->xlen/2.0f, reg->pos.z + reg->zlen/2.0f},
+            (vec2_t){reg->pos.x + reg->xlen/2.0f, reg->pos.z + reg->zlen/2.0f},
+        };
+        return C_PointInsideRect2D(point, corners[0], corners[2], corners[1], corners[3]);
+    }
+    default: 
+        return (assert(0), false);
+    }
+}
+
+static bool cell_for_point(vec2_t point, int *out_r, int *out_c)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+
+    struct tile_desc td;
+    if(!M_Tile_DescForPoint2D(res, M_GetPos(s_map), point, &td))
+        return false;
+
+    *out_r = td.chunk_r * s_cells_per_chunk + td.tile_r / (res.tile_h / s_cells_per_chunk);
+    *out_c = td.chunk_c * s_cells_per_chunk + td.tile_c / (res.tile_w / s_cells_per_chunk);
+    return true;
+}
+
+static vec_cell_t *cell_at_point(vec2_t point)
 {
-    struct box chunk = M_Tile_ChunkBounds(res, M_GetPos(s_map), td.chunk_r, td.chunk_c);
+    int r, c;
+    if(!cell_for_point(point, &r, &c))
+        return NULL;
+    return &s_cells[r * s_cell_cols + c];
+}
+
+static struct box cell_bounds(int r, int c)
+{
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+
+    struct box chunk = M_Tile_ChunkBounds(res, M_GetPos(s_map), 
+        r / s_cells_per_chunk, c / s_cells_per_chunk);
+    float width = chunk.width / s_cells_per_chunk;
+    float height = chunk.height / s_cells_per_chunk;
+
+    return (struct box){
+        chunk.x - (c % s_cells_per_chunk) * width,
+        chunk.z + (r % s_cells_per_chunk) * height,
+        width,
+        height
+    };
+}
 
+static bool region_intersects_box(const struct region *reg, struct box box)
+{
     switch(reg->type) {
     case REGION_CIRCLE: {
-        return C_CircleRectIntersection(reg->pos, reg->radius, chunk);
+        return C_CircleRectIntersection(reg->pos, reg->radius, box);
     }
     case REGION_RECTANGLE: {
         struct box bounds = (struct box) {
@@ -127,73 +206,79 @@ static bool region_intersects_chunk(const struct region *reg, struct map_resolut
             reg->xlen,
             reg->zlen
         };
-        return C_RectRectIntersection(bounds, chunk);
+        return C_RectRectIntersection(bounds, box);
     }
     default: return (assert(0), false);
     }
 }
 
-static bool compare_keys(const char **a, const char **b)
+static bool region_contains_box(const struct region *reg, struct box box)
 {
-    return *a == *b;
-}
-
-static bool compare_uids(uint32_t *a, uint32_t *b)
-{
-    return *a == *b;
+    /* Both region shapes are convex */
+    vec2_t corners[4] = {
+        (vec2_t){box.x,             box.z             },
+        (vec2_t){box.x - box.width, box.z             },
+        (vec2_t){box.x,             box.z + box.height},
+        (vec2_t){box.x - box.width, box.z + box.height},
+    };
+    for(int i = 0; i < ARR_SIZE(corners); i++) {
+        if(!region_contains(reg, corners[i]))
+            return false;
+    }
+    return true;
 }
 
-static int compare_uint32s(const void* a, const void* b)
+static int cell_indexof(const vec_cell_t *cell, const char *name)
 {
-    uint32_t uida = *(uint32_t*)a;
-    uint32_t uidb = *(uint32_t*)b;
-    return (uida - uidb);
+    for(int i = 0; i < vec_size(cell); i++) {
+        if(vec_AT(cell, i).name == name)
+            return i;
+    }
+    return -1;
 }
 
 static void region_update_intersecting(const char *name, const struct region *reg, int op)
 {
-    struct map_resolution res;
-    M_GetResolution(s_map, &res);
-
-    int delta = 0;
-    int chunklen = MAX(X_COORDS_PER_TILE * res.chunk_w * res.tile_w, Z_COORDS_PER_TILE * res.chunk_h * res.tile_h);
-
+    vec2_t half;
     switch(reg->type) {
     case REGION_CIRCLE:
-        delta = ceil(reg->radius / chunklen);
+        half = (vec2_t){reg->radius, reg->radius};
         break;
     case REGION_RECTANGLE:
-        delta = MAX(ceil(reg->xlen/2.0f / chunklen), ceil(reg->zlen/2.0f / chunklen));
+        half = (vec2_t){reg->xlen/2.0f, reg->zlen/2.0f};
         break;
     default: assert(0);
+        return;
     }
 
-    struct tile_desc td;
-    if(!M_Tile_DescForPoint2D(res, M_GetPos(s_map), reg->pos, &td))
-        return;
+    vec2_t a = M_ClampedMapCoordinate(s_map, (vec2_t){reg->pos.x - half.x, reg->pos.z - half.z});
+    vec2_t b = M_ClampedMapCoordinate(s_map, (vec2_t){reg->pos.x + half.x, reg->pos.z + half.z});
 
-    for(int dr = -delta; dr <= delta; dr++) {
-    for(int dc = -delta; dc <= delta; dc++) {
+    int ar, ac, br, bc;
+    if(!cell_for_point(a, &ar, &ac) || !cell_for_point(b, &br, &bc))
+        return;
 
-        struct tile_desc curr = td;
-        if(!M_Tile_RelativeDesc(res, &curr, dc * res.tile_h, dr * res.tile_w))
-            continue;
+    for(int r = MIN(ar, br); r <= MAX(ar, br); r++) {
+    for(int c = MIN(ac, bc); c <= MAX(ac, bc); c++) {
 
-        if(!region_intersects_chunk(reg, res, curr))
-            continue;
-
-        vec_str_t *chunk = &s_intersecting[curr.chunk_r * res.chunk_w + curr.chunk_c];
+        vec_cell_t *cell = &s_cells[r * s_cell_cols + c];
 
         switch(op) {
         case REMOVE: {
-            int idx = vec_str_indexof(chunk, name, compare_keys);
+            int idx = cell_indexof(cell, name);
             if(idx != -1) {
-                vec_str_del(chunk, idx);
+                vec_cell_del(cell, idx);
             }
             break;
         }
         case ADD: {
-            vec_str_push(chunk, name);
+            struct box bounds = cell_bounds(r, c);
+            if(!region_intersects_box(reg, bounds))
+                break;
+            vec_cell_push(cell, (struct cell_entry){
+                .name = name,
+                .interior = region_contains_box(reg, bounds)
+            });
             break;
         }
         default: assert(0);
@@ -201,6 +286,71 @@ static void region_update_intersecting(const char *name, const struct region *re
     }}
 }
 
+static struct region *region_get(const char *name, const char **out_key)
+{
+    khiter_t k = kh_get(region, s_regions, name);
+    if(k == kh_end(s_regions))
+        return NULL;
+    if(out_key) {
+        *out_key = kh_key(s_regions, k);
+    }
+    return &kh_value(s_regions, k);
+}
+
+static void region_pending_add(struct region *reg, uint32_t uid, int delta)
+{
+    int status;
+    khiter_t k = kh_put(delta, reg->pending, uid, &status);
+    if(status == -1)
+        return;
+    if(status != 0) {
+        kh_value(reg->pending, k) = 0;
+    }
+    kh_value(reg->pending, k) += delta;
+    if(kh_value(reg->pending, k) == 0) {
+        kh_del(delta, reg->pending, k);
+    }
+}
+
+/* 'key' must be the region's own key string */
+static void region_enter(const char *key, struct region *reg, uint32_t uid)
+{
+    int status;
+    kh_put(uid, reg->members, uid, &status);
+    if(status == 0 || status == -1)
+        return;
+    region_pending_add(reg, uid, +1);
+    kh_put(name, s_dirty, key, &(int){0});
+}
+
+static void region_exit(const char *key, struct region *reg, uint32_t uid)
+{
+    khiter_t k = kh_get(uid, reg->members, uid);
+    if(k == kh_end(reg->members))
+        return;
+    kh_del(uid, reg->members, k);
+    region_pending_add(reg, uid, -1);
+    kh_put(name, s_dirty, key, &(int){0});
+}
+
+static bool region_init(struct region *reg)
+{
+    reg->members = kh_init(uid);
+    reg->pending = kh_init(delta);
+    if(!reg->members || !reg->pending) {
+        kh_destroy(uid, reg->members);
+        kh_destroy(delta, reg->pending);
+        return false;
+    }
+    return true;
+}
+
+static void region_destroy(struct region *reg)
+{
+    kh_destroy(uid, reg->members);
+    kh_destroy(delta, reg->pending);
+}
+
 static bool region_add(const char *name, struct region reg)
 {
     if(kh_get(region, s_regions, name) != kh_end(s_regions))
@@ -212,104 +362,118 @@ static bool region_add(const char *name, struct region reg)
 
     int status;
     khiter_t k = kh_put(region, s_regions, key, &status);
-    if(status == -1)
+    if(status == -1) {
+        PF_FREE(key);
         return false;
+    }
 
     kh_value(s_regions, k) = reg;
     region_update_intersecting(key, &reg, ADD);
     return true;
 }
 
-static bool region_contains(const struct region *reg, vec2_t point)
+static bool regions_batched(uint32_t uid)
 {
-    switch(reg->type) {
-    case REGION_CIRCLE: {
-        return C_PointInsideCircle2D(point, reg->pos, reg->radius);
-    }
-    case REGION_RECTANGLE: {
-        vec2_t corners[4] = {
-            (vec2_t){reg->pos.x + reg->xlen/2.0f, reg->pos.z - reg->zlen/2.0f},
-            (vec2_t){reg->pos.x - reg->xlen/2.0f, reg->pos.z - reg->zlen/2.0f},
-            (vec2_t){reg->pos.x - reg->xlen/2.0f, reg->pos.z + reg->zlen/2.0f},
-            (vec2_t){reg->pos.x + reg->xlen/2.0f, reg->pos.z + reg->zlen/2.0f},
-        };
-        return C_PointInsideRect2D(point, corners[0], corners[2], corners[1], corners[3]);
-    }
-    default: 
-        return (assert(0), false);
-    }
+    return s_batch_ents && (kh_get(uid, s_batch_ents, uid) != kh_end(s_batch_ents));
 }
 
-static size_t regions_at_point(vec2_t point, size_t maxout, struct region *out[], 
-                               const char *out_names[])
+static void regions_unbatch(uint32_t uid)
 {
-    struct map_resolution res;
-    M_GetResolution(s_map, &res);
-
-    struct tile_desc td;
-    if(!M_Tile_DescForPoint2D(res, M_GetPos(s_map), point, &td))
-        return 0;
-
-    size_t ret = 0;
-    vec_str_t *chunk = &s_intersecting[td.chunk_r * res.chunk_w + td.chunk_c];
-    for(int i = 0; i < vec_size(chunk); i++) {
-
-        if(ret == maxout)
-            break;
-
-        const char *name = vec_AT(chunk, i);
-        khiter_t k = kh_get(region, s_regions, name);
-        assert(k != kh_end(s_regions));
-
-        struct region *reg = &kh_value(s_regions, k);
-        if(!region_contains(reg, point))
-            continue;
+    khiter_t k = kh_get(uid, s_batch_ents, uid);
+    kh_del(uid, s_batch_ents, k);
+}
 
-        out[ret] = reg;
-        out_names[ret] = name;
-        ret++;
-    }
-    return ret;
+static bool regions_can_contain(uint32_t uid)
+{
+    return G_EntityExists(uid) 
+        && !(G_FlagsGet(uid) & (ENTITY_FLAG_ZOMBIE | ENTITY_FLAG_MARKER));
 }
 
 static void regions_remove_ent(uint32_t uid, vec2_t pos)
 {
-    const char *names[512];
-    struct region *regs[512];
-    size_t nregs = regions_at_point(pos, ARR_SIZE(regs), regs, names);
+    vec_cell_t *cell = cell_at_point(pos);
+    if(!cell)
+        return;
 
-    for(int i = 0; i < nregs; i++) {
-        int idx = vec_uid_indexof(&regs[i]->curr_ents, uid, compare_uids);
-        if(idx == -1)
-            continue;
-        vec_uid_del(&regs[i]->curr_ents, idx);
-        kh_put(name, s_dirty, names[i], &(int){0});
+    for(int i = 0; i < vec_size(cell); i++) {
+        const char *key;
+        struct region *reg = region_get(vec_AT(cell, i).name, &key);
+        assert(reg);
+        region_exit(key, reg, uid);
     }
 }
 
 static void regions_add_ent(uint32_t uid, vec2_t pos)
 {
-    assert(Sched_UsingBigStack());
+    if(!regions_can_contain(uid))
+        return;
 
-    if(!G_EntityExists(uid) || (G_FlagsGet(uid) & (ENTITY_FLAG_ZOMBIE | ENTITY_FLAG_MARKER)))
+    vec_cell_t *cell = cell_at_point(pos);
+    if(!cell)
         return;
 
-    const char *names[512];
-    struct region *regs[512];
-    size_t nregs = regions_at_point(pos, ARR_SIZE(regs), regs, names);
+    for(int i = 0; i < vec_size(cell); i++) {
+
+        const struct cell_entry *entry = &vec_AT(cell, i);
+        const char *key;
+        struct region *reg = region_get(entry->name, &key);
+        assert(reg);
+
+        if(entry->interior || region_contains(reg, pos)) {
+            region_enter(key, reg, uid);
+        }
+    }
+}
+
+/* Only the regions on the boundary of the cells being moved through 
+ * need to be tested. When staying within a cell that is not crossed 
+ * by any region boundary, this is a no-op. */
+static void regions_move_ent(uint32_t uid, vec2_t oldpos, vec2_t newpos)
+{
+    if(!regions_can_contain(uid)) {
+        regions_remove_ent(uid, oldpos);
+        return;
+    }
+
+    vec_cell_t *oldcell = cell_at_point(oldpos);
+    vec_cell_t *newcell = cell_at_point(newpos);
+
+    if(oldcell && oldcell != newcell) {
+        for(int i = 0; i < vec_size(oldcell); i++) {
+
+            const char *name = vec_AT(oldcell, i).name;
+            if(newcell && cell_indexof(newcell, name) != -1)
+                continue;
+
+            const char *key;
+            struct region *reg = region_get(name, &key);
+            assert(reg);
+            region_exit(key, reg, uid);
+        }
+    }
+
+    if(!newcell)
+        return;
 
-    for(int i = 0; i < nregs; i++) {
+    for(int i = 0; i < vec_size(newcell); i++) {
 
-        int idx = vec_uid_indexof(&regs[i]->curr_ents, uid, compare_uids);
-        if(idx != -1)
+        const struct cell_entry *entry = &vec_AT(newcell, i);
+        if(entry->interior && oldcell == newcell)
             continue;
 
-        vec_uid_push(&regs[i]->curr_ents, uid);
-        kh_put(name, s_dirty, names[i], &(int){0});
+        const char *key;
+        struct region *reg = region_get(entry->name, &key);
+        assert(reg);
+
+        if(entry->interior || region_contains(reg, newpos)) {
+            region_enter(key, reg, uid);
+        }else{
+            region_exit(key, reg, uid);
+        }
     }
 }
 
-static void region_update_ents(const char *name, struct region *reg)
+static void region_update_ents(const char *key, struct region *reg)
 {
     uint32_t ents[1024];
     size_t nents = 0;
@@ -328,19 +492,26 @@ static void region_update_ents(const char *name, struct region *reg)
     default: assert(0);
     }
 
-    vec_uid_reset(&reg->curr_ents);
+    khash_t(uid) *inside = kh_init(uid);
+    if(!inside)
+        return;
+
     for(int i = 0; i < nents; i++) {
-        uint32_t flags = G_FlagsGet(ents[i]);
-        if(flags & ENTITY_FLAG_MARKER)
-            continue;
-        if(flags & ENTITY_FLAG_ZOMBIE)
+        if(!regions_can_contain(ents[i]))
             continue;
-        vec_uid_push(&reg->curr_ents, ents[i]);
+        kh_put(uid, inside, ents[i], &(int){0});
+        region_enter(key, reg, ents[i]);
     }
 
-    khiter_t k = kh_get(region, s_regions, name);
-    assert(k != kh_end(s_regions));
-    kh_put(name, s_dirty, kh_key(s_regions, k), &(int){0});
+    for(khiter_t k = kh_begin(reg->members); k != kh_end(reg->members); k++) {
+        if(!kh_exist(reg->members, k))
+            continue;
+        uint32_t uid = kh_key(reg->members, k);
+        if(kh_get(uid, inside, uid) != kh_end(inside))
+            continue;
+        region_exit(key, reg, uid);
+    }
+    kh_destroy(uid, inside);
 }
 
 static vec2_t region_ss_pos(vec2_t pos)
@@ -368,81 +539,30 @@ static vec2_t region_ss_pos(vec2_t pos)
 
 static void region_notify_changed(const char *name, struct region *reg)
 {
-    size_t n = reg->curr_ents.size;
-    size_t m = reg->prev_ents.size;
-
-    qsort(reg->curr_ents.array, n, sizeof(uint32_t), compare_uint32s);
-    qsort(reg->prev_ents.array, m, sizeof(uint32_t), compare_uint32s);
-
-    /* use the algorithm for finding the symmetric difference 
-     * of two sorted arrays: */
     size_t nchanged = 0;
-    int i = 0, j = 0;
-    while(i < n && j < m) {
-
-        if(reg->curr_ents.array[i] < reg->prev_ents.array[j]) {
-
-            const char *arg = pf_strdup(name);
-            vec_str_push(&s_eventargs, arg);
-
-            uint32_t uid = reg->curr_ents.array[i];
-            E_Entity_Notify(EVENT_ENTERED_REGION, uid, (void*)arg, ES_ENGINE);
-            E_Global_Notify(EVENT_ENTERED_REGION, (void*)arg, ES_ENGINE);
 
-            i++;
-            nchanged++;
+    for(khiter_t k = kh_begin(reg->pending); k != kh_end(reg->pending); k++) {
 
-        }else if(reg->prev_ents.array[j] < reg->curr_ents.array[i]) {
-
-            const char *arg = pf_strdup(name);
-            vec_str_push(&s_eventargs, arg);
-
-            uint32_t uid = reg->prev_ents.array[j];
-            E_Entity_Notify(EVENT_EXITED_REGION, uid, (void*)arg, ES_ENGINE);
-            E_Global_Notify(EVENT_EXITED_REGION, (void*)arg, ES_ENGINE);
-
-            j++;
-            nchanged++;
-
-        }else{
-
-            i++;
-            j++;
-        }
-    }
-
-    while(i < n) {
-    
-        const char *arg = pf_strdup(name);
-        vec_str_push(&s_eventargs, arg);
-
-        uint32_t uid = reg->curr_ents.array[i];
-        E_Entity_Notify(EVENT_ENTERED_REGION, uid, (void*)arg, ES_ENGINE);
-        E_Global_Notify(EVENT_ENTERED_REGION, (void*)arg, ES_ENGINE);
+        if(!kh_exist(reg->pending, k))
+            continue;
 
-        i++;
-        nchanged++;
-    }
+        uint32_t uid = kh_key(reg->pending, k);
+        int delta = kh_value(reg->pending, k);
+        assert(delta == 1 || delta == -1);
+        enum eventtype event = (delta > 0) ? EVENT_ENTERED_REGION : EVENT_EXITED_REGION;
 
-    while(j < m) {
-    
         const char *arg = pf_strdup(name);
         vec_str_push(&s_eventargs, arg);
 
-        uint32_t uid = reg->prev_ents.array[j];
-        E_Entity_Notify(EVENT_EXITED_REGION, uid, (void*)arg, ES_ENGINE);
-        E_Global_Notify(EVENT_EXITED_REGION, (void*)arg, ES_ENGINE);
-
-        j++;
+        E_Entity_Notify(event, uid, (void*)arg, ES_ENGINE);
+        E_Global_Notify(event, (void*)arg, ES_ENGINE);
         nchanged++;
     }
+    kh_clear(delta, reg->pending);
 
     if(nchanged) {
         S_Region_NotifyContentsChanged(name);
     }
-
-    vec_uid_reset(&reg->prev_ents);
-    vec_uid_copy(&reg->prev_ents, &reg->curr_ents);
 }
 
 static void on_render_3d(void *user, void *event)
@@ -530,13 +650,18 @@ bool G_Region_Init(const struct map *map)
     struct map_resolution res;
     M_GetResolution(map, &res);
 
-    s_intersecting = calloc(res.chunk_w * res.chunk_h, sizeof(vec_str_t));
-    if(!s_intersecting)
-        goto fail_intersecting;
+    bool divisible = (res.tile_w % CELLS_PER_CHUNK == 0) 
+                  && (res.tile_h % CELLS_PER_CHUNK == 0);
+    s_cells_per_chunk = divisible ? CELLS_PER_CHUNK : 1;
+    s_cell_rows = res.chunk_h * s_cells_per_chunk;
+    s_cell_cols = res.chunk_w * s_cells_per_chunk;
+
+    s_cells = calloc(s_cell_rows * s_cell_cols, sizeof(vec_cell_t));
+    if(!s_cells)
+        goto fail_cells;
 
-    for(int i = 0; i < res.chunk_w * res.chunk_h; i++) {
-        vec_str_t *vec = ((vec_str_t*)s_intersecting) + i;
-        vec_str_init(vec);
+    for(int i = 0; i < s_cell_rows * s_cell_cols; i++) {
+        vec_cell_init(&s_cells[i]);
     }
 
     vec_str_init(&s_eventargs);
@@ -544,7 +669,7 @@ bool G_Region_Init(const struct map *map)
     s_map = map;
     return true;
 
-fail_intersecting:
+fail_cells:
     kh_destroy(name, s_dirty);
 fail_dirty:
     kh_destroy(region, s_regions);
@@ -554,22 +679,17 @@ fail_regions:
 
 void G_Region_Shutdown(void)
 {
-    struct map_resolution res;
-    M_GetResolution(s_map, &res);
-
-    for(int i = 0; i < res.chunk_w * res.chunk_h; i++) {
-        vec_str_t *vec = ((vec_str_t*)s_intersecting) + i;
-        vec_str_destroy(vec);
+    for(int i = 0; i < s_cell_rows * s_cell_cols; i++) {
+        vec_cell_destroy(&s_cells[i]);
     }
-    PF_FREE(s_intersecting);
+    PF_FREE(s_cells);
 
     const char *key;
     struct region reg;
 
     kh_foreach(s_regions, key, reg, {
         PF_FREE(key);
-        vec_uid_destroy(&reg.curr_ents);
-        vec_uid_destroy(&reg.prev_ents);
+        region_destroy(&reg);
     });
 
     for(int i = 0; i < vec_size(&s_eventargs); i++) {
@@ -591,16 +711,18 @@ bool G_Region_AddCircle(const char *name, vec2_t pos, float radius)
         .shown = false,
         .pos = pos
     };
-    vec_uid_init(&newreg.curr_ents);
-    vec_uid_init(&newreg.prev_ents);
+    if(!region_init(&newreg))
+        return false;
 
-    if(!region_add(name, newreg))
+    if(!region_add(name, newreg)) {
+        region_destroy(&newreg);
         return false;
+    }
 
-    khiter_t k = kh_get(region, s_regions, name);
-    assert(k != kh_end(s_regions));
-    struct region *added = &kh_val(s_regions, k);
-    region_update_ents(name, added);
+    const char *key;
+    struct region *added = region_get(name, &key);
+    assert(added);
+    region_update_ents(key, added);
     return true;
 }
 
@@ -613,16 +735,18 @@ bool G_Region_AddRectangle(const char *name, vec2_t pos, float xlen, float zlen)
         .shown = false,
         .pos = pos
     };
-    vec_uid_init(&newreg.curr_ents);
-    vec_uid_init(&newreg.prev_ents);
+    if(!region_init(&newreg))
+        return false;
 
-    if(!region_add(name, newreg))
+    if(!region_add(name, newreg)) {
+        region_destroy(&newreg);
         return false;
+    }
 
-    khiter_t k = kh_get(region, s_regions, name);
-    assert(k != kh_end(s_regions));
-    struct region *added = &kh_val(s_regions, k);
-    region_update_ents(name, added);
+    const char *key;
+    struct region *added = region_get(name, &key);
+    assert(added);
+    region_update_ents(key, added);
     return true;
 }
 
@@ -635,18 +759,20 @@ void G_Region_Remove(const char *name)
     const char *key = kh_key(s_regions, k);
     struct region *reg = &kh_value(s_regions, k);
 
-    for(int i = 0; i < vec_size(&reg->curr_ents); i++) {
+    for(khiter_t l = kh_begin(reg->members); l != kh_end(reg->members); l++) {
+
+        if(!kh_exist(reg->members, l))
+            continue;
 
         const char *arg = pf_strdup(name);
         vec_str_push(&s_eventargs, arg);
 
-        uint32_t uid = vec_AT(&reg->curr_ents, i);
+        uint32_t uid = kh_key(reg->members, l);
         E_Entity_Notify(EVENT_EXITED_REGION, uid, (void*)arg, ES_ENGINE);
     }
 
-    region_update_intersecting(key, &kh_value(s_regions, k), REMOVE);
-    vec_uid_destroy(&kh_val(s_regions, k).curr_ents);
-    vec_uid_destroy(&kh_val(s_regions, k).prev_ents);
+    region_update_intersecting(key, reg, REMOVE);
+    region_destroy(reg);
     kh_del(region, s_regions, k);
 
     k = kh_get(name, s_dirty, name);
@@ -718,9 +844,12 @@ int G_Region_GetEnts(const char *name, size_t maxout, uint32_t ents[])
     const struct region *reg = &kh_value(s_regions, k);
     size_t ret = 0;
 
-    for(int i = 0; i < vec_size(&reg->curr_ents); i++) {
+    for(khiter_t l = kh_begin(reg->members); l != kh_end(reg->members); l++) {
 
-        uint32_t ent = vec_AT(&reg->curr_ents, i);
+        if(!kh_exist(reg->members, l))
+            continue;
+
+        uint32_t ent = kh_key(reg->members, l);
         if(!G_EntityExists(ent))
             continue;
 
@@ -738,30 +867,73 @@ bool G_Region_ContainsEnt(const char *name, uint32_t uid)
         return false;
 
     const struct region *reg = &kh_value(s_regions, k);
-    for(int i = 0; i < vec_size(&reg->curr_ents); i++) {
-        uint32_t curr = vec_AT(&reg->curr_ents, i);
-        if(curr == uid)
-            return true;
-    }
-    return false;
+    return (kh_get(uid, reg->members, uid) != kh_end(reg->members));
 }
 
 void G_Region_RemoveRef(uint32_t uid, vec2_t oldpos)
 {
+    if(regions_batched(uid)) {
+        regions_unbatch(uid);
+        return;
+    }
     regions_remove_ent(uid, oldpos);
 }
 
 void G_Region_AddRef(uint32_t uid, vec2_t newpos)
 {
+    if(s_batch_ents) {
+        int ret;
+        kh_put(uid, s_batch_ents, uid, &ret);
+        if(ret != -1)
+            return;
+    }
     regions_add_ent(uid, newpos);
 }
 
+void G_Region_MoveRef(uint32_t uid, vec2_t oldpos, vec2_t newpos)
+{
+    if(regions_batched(uid))
+        return;
+    regions_move_ent(uid, oldpos, newpos);
+}
+
 void G_Region_RemoveEnt(uint32_t uid)
 {
+    if(regions_batched(uid)) {
+        regions_unbatch(uid);
+        return;
+    }
     vec2_t pos = G_Pos_GetXZ(uid);
     regions_remove_ent(uid, pos);
 }
 
+void G_Region_BeginBatch(void)
+{
+    if(s_batch_depth++ == 0) {
+        s_batch_ents = kh_init(uid);
+    }
+}
+
+void G_Region_EndBatch(void)
+{
+    assert(s_batch_depth > 0);
+    if(--s_batch_depth > 0)
+        return;
+
+    khash_t(uid) *ents = s_batch_ents;
+    s_batch_ents = NULL;
+    if(!ents)
+        return;
+
+    uint32_t uid;
+    kh_foreach_key(ents, uid, {
+        if(G_EntityExists(uid)) {
+            regions_add_ent(uid, G_Pos_GetXZ(uid));
+        }
+    });
+    kh_destroy(uid, ents);
+}
+
 void G_Region_SetRender(bool on)
 {
     s_render = on;
@@ -941,30 +1113,65 @@ bool G_Region_SaveState(struct SDL_RWops *stream)
 
         struct attr num_curr = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = vec_size(&curr.curr_ents)
+            .val.as_int = kh_size(curr.members)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_curr, "num_curr"));
 
-        for(int i = 0; i < vec_size(&curr.curr_ents); i++) {
+        for(khiter_t k = kh_begin(curr.members); k != kh_end(curr.members); k++) {
+
+            if(!kh_exist(curr.members, k))
+                continue;
 
             struct attr ent = (struct attr){
                 .type = TYPE_INT,
-                .val.as_int = vec_AT(&curr.curr_ents, i)
+                .val.as_int = kh_key(curr.members, k)
             };
             CHK_TRUE_RET(Attr_Write(stream, &ent, "curr_ent"));
         }
 
+        /* The membership as of the last update is the current membership 
+         * with the pending changes undone */
+        int nentered = 0, nexited = 0;
+        for(khiter_t k = kh_begin(curr.pending); k != kh_end(curr.pending); k++) {
+            if(!kh_exist(curr.pending, k))
+                continue;
+            if(kh_value(curr.pending, k) > 0)
+                nentered++;
+            else
+                nexited++;
+        }
+
         struct attr num_prev = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = vec_size(&curr.prev_ents)
+            .val.as_int = kh_size(curr.members) - nentered + nexited
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_prev, "num_prev"));
 
-        for(int i = 0; i < vec_size(&curr.prev_ents); i++) {
+        for(khiter_t k = kh_begin(curr.members); k != kh_end(curr.members); k++) {
+
+            if(!kh_exist(curr.members, k))
+                continue;
+
+            uint32_t uid = kh_key(curr.members, k);
+            khiter_t l = kh_get(delta, curr.pending, uid);
+            if(l != kh_end(curr.pending) && kh_value(curr.pending, l) > 0)
+                continue;
 
             struct attr ent = (struct attr){
                 .type = TYPE_INT,
-                .val.as_int = vec_AT(&curr.prev_ents, i)
+                .val.as_int = uid
+            };
+            CHK_TRUE_RET(Attr_Write(stream, &ent, "prev_ent"));
+        }
+
+        for(khiter_t k = kh_begin(curr.pending); k != kh_end(curr.pending); k++) {
+
+            if(!kh_exist(curr.pending, k) || kh_value(curr.pending, k) > 0)
+                continue;
+
+            struct attr ent = (struct attr){
+                .type = TYPE_INT,
+                .val.as_int = kh_key(curr.pending, k)
             };
             CHK_TRUE_RET(Attr_Write(stream, &ent, "prev_ent"));
         }
@@ -1052,11 +1259,15 @@ bool G_Region_LoadState(struct SDL_RWops *stream)
         default: assert(0);
         }
 
-        khiter_t k = kh_get(region, s_regions, name.val.as_string);
-        assert(k != kh_end(s_regions));
-        struct region *reg = &kh_value(s_regions, k);
+        const char *key;
+        struct region *reg = region_get(name.val.as_string, &key);
+        assert(reg);
         reg->shown = shown.val.as_bool;
 
+        /* The saved membership replaces the one computed when adding */
+        kh_clear(uid, reg->members);
+        kh_clear(delta, reg->pending);
+
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_INT);
         const size_t num_curr = attr.val.as_int;
@@ -1066,7 +1277,8 @@ bool G_Region_LoadState(struct SDL_RWops *stream)
             struct attr curr;
             CHK_TRUE_RET(Attr_Parse(stream, &curr, true));
             CHK_TRUE_RET(curr.type == TYPE_INT);
-            vec_uid_push(&reg->curr_ents, curr.val.as_int);
+            kh_put(uid, reg->members, curr.val.as_int, &(int){0});
+            region_pending_add(reg, curr.val.as_int, +1);
         }
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
@@ -1078,7 +1290,7 @@ bool G_Region_LoadState(struct SDL_RWops *stream)
             struct attr curr;
             CHK_TRUE_RET(Attr_Parse(stream, &curr, true));
             CHK_TRUE_RET(curr.type == TYPE_INT);
-            vec_uid_push(&reg->prev_ents, curr.val.as_int);
+            region_pending_add(reg, curr.val.as_int, -1);
         }
         Sched_TryYield();
     }
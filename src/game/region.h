@@ -49,7 +49,13 @@ bool G_Region_Init(const struct map *map);
 void G_Region_Shutdown(void);
 void G_Region_RemoveRef(uint32_t uid, vec2_t oldpos);
 void G_Region_AddRef(uint32_t uid, vec2_t newpos);
+void G_Region_MoveRef(uint32_t uid, vec2_t oldpos, vec2_t newpos);
 void G_Region_RemoveEnt(uint32_t uid);
+/* The region membership of the entities added between these calls is only 
+ * resolved at the end of the outermost batch, at their final positions. 
+ */
+void G_Region_BeginBatch(void);
+void G_Region_EndBatch(void);
 void G_Region_Update(void);
 
 bool G_Region_SaveState(struct SDL_RWops *stream);
@@ -37,17 +37,26 @@
 #include "game_private.h"
 #include "public/game.h"
 #include "storage_site.h"
+#include "position.h"
+#include "../main.h"
 #include "../sched.h"
 #include "../event.h"
 #include "../entity.h"
 #include "../phys/public/collision.h"
 #include "../map/public/map.h"
+#include "../map/public/tile.h"
 #include "../lib/public/khash.h"
-#include "../lib/public/string_intern.h"
 #include "../lib/public/attr.h"
 #include "../lib/public/pf_string.h"
 #include "../lib/public/string_intern.h"
 
+#include <float.h>
+
+
+#define MAX_SEARCH_ENTS (4096)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
 
 #define CHK_TRUE_RET(_pred)             \
     do{                                 \
@@ -69,6 +78,8 @@ struct rstate{
     int         restored_amount;
     vec2_t      blocking_pos;
     float       blocking_radius;
+    /* The position at which the entity is stored in its' name index */
+    vec2_t      index_pos;
     bool        replenishable;
     kh_int_t   *replenish_resources;
     bool        is_storage_site;
@@ -80,18 +91,22 @@ struct rstate{
 KHASH_MAP_INIT_INT(state, struct rstate)
 KHASH_MAP_INIT_STR(icon, const char*)
 KHASH_SET_INIT_STR(name)
+KHASH_MAP_INIT_STR(tree, qt_ent_t*)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static khash_t(stridx)  *s_stridx;
-static mp_strbuff_t      s_stringpool;
 static khash_t(state)   *s_entity_state_table;
 static const struct map *s_map;
 /* The set of all resources that exist (or have existed) in the current session */
 static khash_t(name)    *s_all_names;
 static khash_t(icon)    *s_icon_table;
+/* A separate spatial index for every resource name, so that 'nearest 
+ * resource of type X' queries don't have to wade through all the other 
+ * entities in the vicinity. Keyed by the interned resource name. */
+static khash_t(tree)    *s_name_trees;
+static float             s_xmin, s_xmax, s_zmin, s_zmax;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -130,6 +145,72 @@ static int compare_keys(const void *a, const void *b)
     return strcmp(stra, strb);
 }
 
+static bool uids_equal(const uint32_t *a, const uint32_t *b)
+{
+    return (*a == *b);
+}
+
+static qt_ent_t *name_tree_get(const char *name)
+{
+    khiter_t k = kh_get(tree, s_name_trees, name);
+    if(k == kh_end(s_name_trees))
+        return NULL;
+    return kh_value(s_name_trees, k);
+}
+
+static qt_ent_t *name_tree_get_or_create(const char *name)
+{
+    qt_ent_t *ret = name_tree_get(name);
+    if(ret)
+        return ret;
+
+    ret = malloc(sizeof(qt_ent_t));
+    if(!ret)
+        return NULL;
+    qt_ent_init(ret, s_xmin, s_xmax, s_zmin, s_zmax, uids_equal);
+
+    int status;
+    khiter_t k = kh_put(tree, s_name_trees, name, &status);
+    if(status == -1) {
+        qt_ent_destroy(ret);
+        free(ret);
+        return NULL;
+    }
+    kh_value(s_name_trees, k) = ret;
+    return ret;
+}
+
+static void name_trees_clear(void)
+{
+    qt_ent_t *tree;
+    kh_foreach_value(s_name_trees, tree, {
+        qt_ent_destroy(tree);
+        free(tree);
+    });
+    kh_clear(tree, s_name_trees);
+}
+
+static void index_remove(uint32_t uid, struct rstate *rs)
+{
+    if(!strlen(rs->name))
+        return;
+    qt_ent_t *tree = name_tree_get(rs->name);
+    if(!tree)
+        return;
+    qt_ent_delete(tree, rs->index_pos.x, rs->index_pos.z, uid);
+}
+
+static void index_insert(uint32_t uid, struct rstate *rs)
+{
+    if(!strlen(rs->name))
+        return;
+    qt_ent_t *tree = name_tree_get_or_create(rs->name);
+    if(!tree)
+        return;
+    rs->index_pos = G_Pos_GetXZ(uid);
+    qt_ent_insert(tree, rs->index_pos.x, rs->index_pos.z, uid);
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -138,21 +219,30 @@ bool G_Resource_Init(const struct map *map)
 {
     if(!(s_entity_state_table = kh_init(state)))
         goto fail_table;
-    if(!si_init(&s_stringpool, &s_stridx, 512))
-        goto fail_strintern;
     if(!(s_all_names = kh_init(name)))
         goto fail_name_set;
     if(!(s_icon_table = kh_init(icon)))
         goto fail_icon_table;
+    if(!(s_name_trees = kh_init(tree)))
+        goto fail_name_trees;
+
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+    vec3_t center = M_GetCenterPos(map);
+
+    s_xmin = center.x - (res.tile_w * res.chunk_w * X_COORDS_PER_TILE) / 2.0f;
+    s_xmax = center.x + (res.tile_w * res.chunk_w * X_COORDS_PER_TILE) / 2.0f;
+    s_zmin = center.z - (res.tile_h * res.chunk_h * Z_COORDS_PER_TILE) / 2.0f;
+    s_zmax = center.z + (res.tile_h * res.chunk_h * Z_COORDS_PER_TILE) / 2.0f;
 
     s_map = map;
     return true;
 
+fail_name_trees:
+    kh_destroy(icon, s_icon_table);
 fail_icon_table:
     kh_destroy(name, s_all_names);
 fail_name_set:
-    si_shutdown(&s_stringpool, s_stridx);
-fail_strintern:
     kh_destroy(state, s_entity_state_table);
 fail_table:
     return false;
@@ -160,9 +250,10 @@ fail_table:
 
 void G_Resource_Shutdown(void)
 {
+    name_trees_clear();
+    kh_destroy(tree, s_name_trees);
     kh_destroy(icon, s_icon_table);
     kh_destroy(name, s_all_names);
-    si_shutdown(&s_stringpool, s_stridx);
     kh_destroy(state, s_entity_state_table);
 }
 
@@ -205,6 +296,7 @@ void G_Resource_RemoveEntity(uint32_t uid)
             flags, s_map);
     }
 
+    index_remove(uid, rs);
     kh_destroy(int, rs->replenish_resources);
     rstate_remove(uid);
 }
@@ -215,6 +307,12 @@ void G_Resource_UpdateBounds(uint32_t uid)
     if(!rs)
         return;
 
+    vec2_t pos = G_Pos_GetXZ(uid);
+    if(pos.x != rs->index_pos.x || pos.z != rs->index_pos.z) {
+        index_remove(uid, rs);
+        index_insert(uid, rs);
+    }
+
     uint32_t flags = G_FlagsGet(uid);
     if(!(flags & ENTITY_FLAG_BUILDING)) {
         M_NavBlockersDecref(rs->blocking_pos, rs->blocking_radius, G_GetFactionID(uid), 
@@ -273,7 +371,7 @@ bool G_Resource_SetReplenishAmount(uint32_t uid, const char *rname, int amount)
     struct rstate *rs = rstate_get(uid);
     assert(rs);
 
-    const char *key = si_intern(rname, &s_stringpool, s_stridx);
+    const char *key = si_intern(rname, NULL);
     if(!key)
         return false;
 
@@ -291,7 +389,7 @@ int G_Resource_GetReplenishAmount(uint32_t uid, const char *rname)
     struct rstate *rs = rstate_get(uid);
     assert(rs);
 
-    const char *key = si_intern(rname, &s_stringpool, s_stridx);
+    const char *key = si_intern(rname, NULL);
     if(!key)
         return 0;
 
@@ -414,11 +512,13 @@ bool G_Resource_SetName(uint32_t uid, const char *name)
     struct rstate *rs = rstate_get(uid);
     assert(rs);
 
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
+    const char *key = si_intern(name, NULL);
     if(!key)
         return false;
 
+    index_remove(uid, rs);
     rs->name = key;
+    index_insert(uid, rs);
     kh_put(name, s_all_names, key, &(int){0});
     return true;
 }
@@ -435,7 +535,7 @@ bool G_Resource_SetCursor(uint32_t uid, const char *cursor)
     struct rstate *rs = rstate_get(uid);
     assert(rs);
 
-    const char *key = si_intern(cursor, &s_stringpool, s_stridx);
+    const char *key = si_intern(cursor, NULL);
     if(!key)
         return false;
 
@@ -445,11 +545,11 @@ bool G_Resource_SetCursor(uint32_t uid, const char *cursor)
 
 void G_Resource_SetIcon(const char *name, const char *path)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
+    const char *key = si_intern(name, NULL);
     if(!key)
         return;
 
-    const char *value = si_intern(path, &s_stringpool, s_stridx);
+    const char *value = si_intern(path, NULL);
     if(!path)
         return;
 
@@ -481,6 +581,63 @@ int G_Resource_GetAllNames(size_t maxout, const char *out[])
     return ret;
 }
 
+uint32_t G_Resource_NearestWithPred(const char *name, vec2_t xz_point,
+                                    bool (*predicate)(uint32_t ent, void *arg),
+                                    void *arg, float max_range)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    const char *key = si_intern(name, NULL);
+    if(!key)
+        return NULL_UID;
+
+    qt_ent_t *tree = name_tree_get(key);
+    if(!tree || tree->nrecs == 0)
+        return NULL_UID;
+
+    uint32_t ent_ids[MAX_SEARCH_ENTS];
+    const float qt_len = MAX(s_xmax - s_xmin, s_zmax - s_zmin);
+    float len = (TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE) / 8.0f;
+
+    if(max_range == 0.0) {
+        max_range = qt_len;
+    }
+    max_range = MIN(qt_len, max_range);
+
+    /* Same expanding search as G_Pos_NearestWithPred, but over a tree
+     * that holds only the resources of the requested type. */
+    while(len <= max_range) {
+
+        float min_dist = FLT_MAX;
+        uint32_t ret = NULL_UID;
+
+        int num_cands = qt_ent_inrange_circle(tree, xz_point.x, xz_point.z,
+            len, ent_ids, ARR_SIZE(ent_ids));
+
+        for(int i = 0; i < num_cands; i++) {
+
+            uint32_t curr = ent_ids[i];
+            vec2_t delta, can_pos_xz = G_Pos_GetXZ(curr);
+            PFM_Vec2_Sub(&xz_point, &can_pos_xz, &delta);
+
+            if(PFM_Vec2_Len(&delta) < min_dist && predicate(curr, arg)) {
+                min_dist = PFM_Vec2_Len(&delta);
+                ret = curr;
+            }
+        }
+
+        if(ret != NULL_UID)
+            return ret;
+
+        if(len == max_range)
+            break;
+
+        len *= 2.0f;
+        len = MIN(max_range, len);
+    }
+    return NULL_UID;
+}
+
 bool G_Resource_SaveState(struct SDL_RWops *stream)
 {
     struct attr num_ents = (struct attr){
@@ -672,7 +829,7 @@ bool G_Resource_LoadState(struct SDL_RWops *stream)
 
             CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
             CHK_TRUE_RET(attr.type == TYPE_STRING);
-            const char *key = si_intern(attr.val.as_string, &s_stringpool, s_stridx);
+            const char *key = si_intern(attr.val.as_string, NULL);
 
             CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
             CHK_TRUE_RET(attr.type == TYPE_INT);
@@ -710,7 +867,7 @@ bool G_Resource_LoadState(struct SDL_RWops *stream)
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_STRING);
 
-        const char *key = si_intern(attr.val.as_string, &s_stringpool, s_stridx);
+        const char *key = si_intern(attr.val.as_string, NULL);
         kh_put(name, s_all_names, key, &(int){0});
         Sched_TryYield();
     }
@@ -724,11 +881,11 @@ bool G_Resource_LoadState(struct SDL_RWops *stream)
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_STRING);
-        const char *key = si_intern(attr.val.as_string, &s_stringpool, s_stridx);
+        const char *key = si_intern(attr.val.as_string, NULL);
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_STRING);
-        const char *val = si_intern(attr.val.as_string, &s_stringpool, s_stridx);
+        const char *val = si_intern(attr.val.as_string, NULL);
 
         G_Resource_SetIcon(key, val);
     }
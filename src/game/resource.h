@@ -36,6 +36,8 @@
 #ifndef RESOURCE_H
 #define RESOURCE_H
 
+#include "../pf_math.h"
+
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -53,6 +55,12 @@ void G_Resource_SetReplenishing(uint32_t uid);
 void G_Resource_SetReplenished(uint32_t uid);
 bool G_Resource_IsReplenishing(uint32_t uid);
 
+/* Like G_Pos_NearestWithPred, but only resources with the specified 
+ * name are considered. */
+uint32_t G_Resource_NearestWithPred(const char *name, vec2_t xz_point,
+                                    bool (*predicate)(uint32_t ent, void *arg),
+                                    void *arg, float max_range);
+
 bool G_Resource_SaveState(struct SDL_RWops *stream);
 bool G_Resource_LoadState(struct SDL_RWops *stream);
 
@@ -0,0 +1,115 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "restable.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/pf_string.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+#define MAX_NAME_LEN (256)
+
+KHASH_MAP_INIT_STR(id, int)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The names are never freed or moved, so the pointers handed out remain 
+ * valid (and can be compared directly) for the lifetime of the game. */
+static char          s_names[MAX_RESOURCE_TYPES][MAX_NAME_LEN];
+static int           s_nnames;
+static khash_t(id)  *s_ids;
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_ResTable_Init(void)
+{
+    if(!(s_ids = kh_init(id)))
+        return false;
+    s_nnames = 0;
+    return true;
+}
+
+void G_ResTable_Shutdown(void)
+{
+    kh_destroy(id, s_ids);
+    s_ids = NULL;
+    s_nnames = 0;
+}
+
+int G_ResTable_IDForName(const char *name)
+{
+    int ret = G_ResTable_LookupID(name);
+    if(ret != RESOURCE_ID_NONE)
+        return ret;
+
+    if(s_nnames == MAX_RESOURCE_TYPES)
+        return RESOURCE_ID_NONE;
+    if(strlen(name) >= MAX_NAME_LEN)
+        return RESOURCE_ID_NONE;
+
+    int id = s_nnames;
+    pf_strlcpy(s_names[id], name, sizeof(s_names[id]));
+
+    int status;
+    khiter_t k = kh_put(id, s_ids, s_names[id], &status);
+    if(status == -1)
+        return RESOURCE_ID_NONE;
+
+    kh_value(s_ids, k) = id;
+    s_nnames++;
+    return id;
+}
+
+int G_ResTable_LookupID(const char *name)
+{
+    khiter_t k = kh_get(id, s_ids, name);
+    if(k == kh_end(s_ids))
+        return RESOURCE_ID_NONE;
+    return kh_value(s_ids, k);
+}
+
+const char *G_ResTable_NameForID(int id)
+{
+    assert(id >= 0 && id < s_nnames);
+    return s_names[id];
+}
+
@@ -0,0 +1,132 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef RESTABLE_H
+#define RESTABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAX_RESOURCE_TYPES  (64)
+#define RESOURCE_ID_NONE    (-1)
+
+/* Resource names are interned to small integer IDs on first use, 
+ * allowing per-entity resource amounts to be stored in fixed-size 
+ * arrays rather than string-keyed hash tables. The 'present' mask 
+ * records which slots have been explicitly set. */
+
+struct restable{
+    uint64_t present;
+    int      val[MAX_RESOURCE_TYPES];
+};
+
+struct restable_float{
+    uint64_t present;
+    float    val[MAX_RESOURCE_TYPES];
+};
+
+bool        G_ResTable_Init(void);
+void        G_ResTable_Shutdown(void);
+/* Returns the ID of the resource, registering it if necessary. 
+ * RESOURCE_ID_NONE is returned when no more IDs are available. */
+int         G_ResTable_IDForName(const char *name);
+/* Like G_ResTable_IDForName, but never registers a new name */
+int         G_ResTable_LookupID(const char *name);
+const char *G_ResTable_NameForID(int id);
+
+#define restable_foreach(table, idvar, valvar, ...)                 \
+    do{                                                             \
+        uint64_t __mask = (table)->present;                         \
+        while(__mask) {                                             \
+            (idvar) = __builtin_ctzll(__mask);                      \
+            __mask &= __mask - 1;                                   \
+            (valvar) = (table)->val[(idvar)];                       \
+            __VA_ARGS__                                             \
+        }                                                           \
+    }while(0)
+
+static inline bool restable_get(const struct restable *table, int id, int *out)
+{
+    if(id == RESOURCE_ID_NONE || !(table->present & (((uint64_t)1) << id)))
+        return false;
+    *out = table->val[id];
+    return true;
+}
+
+static inline bool restable_set(struct restable *table, int id, int val)
+{
+    if(id == RESOURCE_ID_NONE)
+        return false;
+    table->present |= (((uint64_t)1) << id);
+    table->val[id] = val;
+    return true;
+}
+
+static inline void restable_clear(struct restable *table)
+{
+    table->present = 0;
+}
+
+static inline size_t restable_size(const struct restable *table)
+{
+    return __builtin_popcountll(table->present);
+}
+
+static inline bool restable_float_get(const struct restable_float *table, int id, float *out)
+{
+    if(id == RESOURCE_ID_NONE || !(table->present & (((uint64_t)1) << id)))
+        return false;
+    *out = table->val[id];
+    return true;
+}
+
+static inline bool restable_float_set(struct restable_float *table, int id, float val)
+{
+    if(id == RESOURCE_ID_NONE)
+        return false;
+    table->present |= (((uint64_t)1) << id);
+    table->val[id] = val;
+    return true;
+}
+
+static inline size_t restable_float_size(const struct restable_float *table)
+{
+    return __builtin_popcountll(table->present);
+}
+
+#endif
+
@@ -45,16 +45,23 @@
 #include "../main.h"
 #include "../perf.h"
 #include "../sched.h"
+#include "../replay.h"
+#include "../lib/public/mem.h"
 
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <float.h>
+#include <stdlib.h>
 
 #include <SDL.h>
 
 #define MIN(a, b)     ((a) < (b) ? (a) : (b))
 #define MAX(a, b)     ((a) > (b) ? (a) : (b))
+#define CLAMP(a, min, max) (MIN(MAX((a), (min)), (max)))
+
+/* Side length, in pixels, of a single cell of the screen-space grid */
+#define GRID_CELL_PX  (64)
 
 #define CHK_TRUE_RET(_pred)             \
     do{                                 \
@@ -95,6 +102,32 @@ static vec_entity_t  s_selected;
 static bool     s_hovered_dirty = true;
 static uint32_t s_hovered_uid = NULL_UID;
 
+/* A screen-space grid of the visible entities' projected OBB bounds. It is 
+ * rebuilt (at most once per frame) when a hover or box selection query needs 
+ * it, so that the queries only have to test the entities whose screen rects 
+ * overlap the cells under the cursor or selection box, rather than every 
+ * visible entity. The indices are into the 'visible' and 'visible_obbs' arrays.
+ */
+struct screen_rect{
+    int minx, miny;
+    int maxx, maxy;
+};
+
+static struct screen_grid{
+    int                 cols, rows;
+    size_t              nrects;
+    size_t              rects_cap;
+    struct screen_rect *rects;
+    unsigned           *stamps;
+    unsigned            curr_stamp;
+    size_t              cells_cap;
+    int                *cell_start;
+    size_t              idx_cap;
+    int                *indices;
+    size_t              cand_cap;
+    int                *cands;
+}s_grid;
+
 /*****************************************************************************/
 /* GLOBAL VARIABLES                                                          */
 /*****************************************************************************/
@@ -260,6 +293,183 @@ static void sel_make_frustum(struct camera *cam, vec2_t mouse_down, vec2_t mouse
     PFM_Vec3_Normal(&out->left.normal, &out->left.normal);
 }
 
+static bool grid_reserve(void **buff, size_t *cap, size_t want, size_t elemsz)
+{
+    if(*cap >= want)
+        return true;
+    size_t newcap = MAX(want, *cap * 2);
+    void *ret = realloc(*buff, newcap * elemsz);
+    if(!ret)
+        return false;
+    *buff = ret;
+    *cap = newcap;
+    return true;
+}
+
+static struct screen_rect sel_project_obb(const mat4x4_t *view_proj, const struct obb *obb, int w, int h)
+{
+    float minx = FLT_MAX, miny = FLT_MAX;
+    float maxx = -FLT_MAX, maxy = -FLT_MAX;
+
+    for(int i = 0; i < 8; i++) {
+
+        vec4_t homo = (vec4_t){obb->corners[i].x, obb->corners[i].y, obb->corners[i].z, 1.0f};
+        vec4_t clip;
+        PFM_Mat4x4_Mult4x1((mat4x4_t*)view_proj, &homo, &clip);
+
+        /* A corner behind the camera projects to nonsense - be conservative 
+         * and have the entity cover the whole screen. */
+        if(clip.w <= FLT_EPSILON)
+            return (struct screen_rect){0, 0, w-1, h-1};
+
+        float sx = (clip.x / clip.w + 1.0f) * 0.5f * w;
+        float sy = (1.0f - clip.y / clip.w) * 0.5f * h;
+        minx = MIN(minx, sx);
+        miny = MIN(miny, sy);
+        maxx = MAX(maxx, sx);
+        maxy = MAX(maxy, sy);
+    }
+
+    if(maxx < 0.0f || maxy < 0.0f || minx > w-1 || miny > h-1)
+        return (struct screen_rect){1, 1, 0, 0};
+
+    return (struct screen_rect){
+        CLAMP((int)minx,     0, w-1),
+        CLAMP((int)miny,     0, h-1),
+        CLAMP((int)maxx + 1, 0, w-1),
+        CLAMP((int)maxy + 1, 0, h-1),
+    };
+}
+
+static bool sel_grid_build(struct camera *cam, const vec_obb_t *visible_obbs)
+{
+    int w, h;
+    Engine_WinDrawableSize(&w, &h);
+
+    size_t nrects = vec_size(visible_obbs);
+    s_grid.cols = MAX(1, (w + GRID_CELL_PX - 1) / GRID_CELL_PX);
+    s_grid.rows = MAX(1, (h + GRID_CELL_PX - 1) / GRID_CELL_PX);
+    s_grid.nrects = 0;
+    size_t ncells = s_grid.cols * s_grid.rows;
+
+    size_t old_cap = s_grid.rects_cap;
+    if(!grid_reserve((void**)&s_grid.rects, &s_grid.rects_cap, nrects, sizeof(s_grid.rects[0])))
+        return false;
+    if(s_grid.rects_cap != old_cap) {
+        unsigned *stamps = realloc(s_grid.stamps, s_grid.rects_cap * sizeof(s_grid.stamps[0]));
+        if(!stamps)
+            return false;
+        s_grid.stamps = stamps;
+        memset(s_grid.stamps, 0, s_grid.rects_cap * sizeof(s_grid.stamps[0]));
+        s_grid.curr_stamp = 0;
+    }
+    if(!grid_reserve((void**)&s_grid.cell_start, &s_grid.cells_cap, ncells + 1, sizeof(int)))
+        return false;
+
+    mat4x4_t view, proj, view_proj;
+    Camera_MakeViewMat(cam, &view);
+    Camera_MakeProjMat(cam, &proj);
+    PFM_Mat4x4_Mult4x4(&proj, &view, &view_proj);
+
+    /* Count the entries of every cell, turn the counts into offsets and then 
+     * scatter the indices into place. The indices within a cell end up in
+     * ascending order, the same as the order of the 'visible' array. */
+    memset(s_grid.cell_start, 0, (ncells + 1) * sizeof(int));
+    size_t total = 0;
+    for(int i = 0; i < nrects; i++) {
+
+        struct screen_rect r = sel_project_obb(&view_proj, &vec_AT(visible_obbs, i), w, h);
+        s_grid.rects[i] = r;
+        if(r.minx > r.maxx)
+            continue;
+
+        for(int y = r.miny / GRID_CELL_PX; y <= r.maxy / GRID_CELL_PX; y++) {
+        for(int x = r.minx / GRID_CELL_PX; x <= r.maxx / GRID_CELL_PX; x++) {
+            s_grid.cell_start[y * s_grid.cols + x + 1]++;
+            total++;
+        }}
+    }
+    for(int i = 0; i < ncells; i++) {
+        s_grid.cell_start[i + 1] += s_grid.cell_start[i];
+    }
+
+    if(!grid_reserve((void**)&s_grid.indices, &s_grid.idx_cap, total, sizeof(int)))
+        return false;
+
+    STALLOC(int, fill, ncells);
+    memcpy(fill, s_grid.cell_start, ncells * sizeof(int));
+
+    for(int i = 0; i < nrects; i++) {
+
+        struct screen_rect r = s_grid.rects[i];
+        if(r.minx > r.maxx)
+            continue;
+
+        for(int y = r.miny / GRID_CELL_PX; y <= r.maxy / GRID_CELL_PX; y++) {
+        for(int x = r.minx / GRID_CELL_PX; x <= r.maxx / GRID_CELL_PX; x++) {
+            s_grid.indices[fill[y * s_grid.cols + x]++] = i;
+        }}
+    }
+
+    STFREE(fill);
+    s_grid.nrects = nrects;
+    return true;
+}
+
+static int compare_ints(const void *a, const void *b)
+{
+    return (*(const int*)a - *(const int*)b);
+}
+
+/* Returns the indices of all the entities whose screen rects overlap the 
+ * given (inclusive) pixel range, in ascending order. A negative return value 
+ * means that the grid is not available and the caller should fall back to 
+ * testing all the visible entities. */
+static int sel_grid_query(int minx, int miny, int maxx, int maxy, const int **out)
+{
+    if(s_grid.nrects == 0)
+        return -1;
+
+    if(++s_grid.curr_stamp == 0) {
+        memset(s_grid.stamps, 0, s_grid.rects_cap * sizeof(s_grid.stamps[0]));
+        s_grid.curr_stamp = 1;
+    }
+
+    int cminx = CLAMP(minx / GRID_CELL_PX, 0, s_grid.cols - 1);
+    int cminy = CLAMP(miny / GRID_CELL_PX, 0, s_grid.rows - 1);
+    int cmaxx = CLAMP(maxx / GRID_CELL_PX, 0, s_grid.cols - 1);
+    int cmaxy = CLAMP(maxy / GRID_CELL_PX, 0, s_grid.rows - 1);
+
+    int ret = 0;
+    for(int y = cminy; y <= cmaxy; y++) {
+    for(int x = cminx; x <= cmaxx; x++) {
+
+        int cell = y * s_grid.cols + x;
+        for(int j = s_grid.cell_start[cell]; j < s_grid.cell_start[cell + 1]; j++) {
+
+            int idx = s_grid.indices[j];
+            if(s_grid.stamps[idx] == s_grid.curr_stamp)
+                continue;
+            s_grid.stamps[idx] = s_grid.curr_stamp;
+
+            const struct screen_rect *r = &s_grid.rects[idx];
+            if(r->maxx < minx || r->minx > maxx || r->maxy < miny || r->miny > maxy)
+                continue;
+
+            if(!grid_reserve((void**)&s_grid.cands, &s_grid.cand_cap, ret + 1, sizeof(int)))
+                return -1;
+            s_grid.cands[ret++] = idx;
+        }
+    }}
+
+    /* Candidates gathered from multiple cells are no longer sorted */
+    if(cminx != cmaxx || cminy != cmaxy)
+        qsort(s_grid.cands, ret, sizeof(int), compare_ints);
+
+    *out = s_grid.cands;
+    return ret;
+}
+
 static bool sel_shift_pressed(void)
 {
     const Uint8 *state = SDL_GetKeyboardState(NULL);
@@ -292,8 +502,16 @@ static void sel_compute_hovered(struct camera *cam, const vec_entity_t *visible,
     bool selectable_hovered = false;
     bool collision_hovered = false;
 
-    for(int i = 0; i < vec_size(visible_obbs); i++) {
+    const int *cands = NULL;
+    int ncands = sel_grid_query(mouse_x, mouse_y, mouse_x, mouse_y, &cands);
+    if(ncands < 0) {
+        cands = NULL;
+        ncands = vec_size(visible_obbs);
+    }
+
+    for(int c = 0; c < ncands; c++) {
 
+        int i = cands ? cands[c] : c;
         if(G_EntityIsZombie(vec_AT(visible, i)))
             continue;
 
@@ -476,6 +694,13 @@ void G_Sel_Shutdown(void)
     G_Sel_Disable();
     E_Global_Unregister(SDL_MOUSEMOTION, on_mousemove);
     vec_entity_destroy(&s_selected);
+
+    free(s_grid.rects);
+    free(s_grid.stamps);
+    free(s_grid.cell_start);
+    free(s_grid.indices);
+    free(s_grid.cands);
+    memset(&s_grid, 0, sizeof(s_grid));
 }
 
 void G_Sel_Enable(void)
@@ -506,6 +731,11 @@ void G_Sel_Update(struct camera *cam, const vec_entity_t *visible, const vec_obb
 {
     PERF_ENTER();
 
+    if(s_hovered_dirty || s_ctx.state == STATE_MOUSE_SEL_RELEASED) {
+        if(!sel_grid_build(cam, visible_obbs))
+            s_grid.nrects = 0;
+    }
+
     sel_compute_hovered(cam, visible, visible_obbs);
 
     if(G_MouseInTargetMode())
@@ -561,8 +791,21 @@ void G_Sel_Update(struct camera *cam, const vec_entity_t *visible, const vec_obb
         struct frustum frust;
         sel_make_frustum(cam, s_ctx.mouse_down_coord, s_ctx.mouse_up_coord, &frust);
 
-        for(int i = 0; i < vec_size(visible_obbs); i++) {
+        const int *cands = NULL;
+        int ncands = sel_grid_query(
+            MIN(s_ctx.mouse_down_coord.x, s_ctx.mouse_up_coord.x),
+            MIN(s_ctx.mouse_down_coord.y, s_ctx.mouse_up_coord.y),
+            MAX(s_ctx.mouse_down_coord.x, s_ctx.mouse_up_coord.x),
+            MAX(s_ctx.mouse_down_coord.y, s_ctx.mouse_up_coord.y),
+            &cands);
+        if(ncands < 0) {
+            cands = NULL;
+            ncands = vec_size(visible_obbs);
+        }
+
+        for(int c = 0; c < ncands; c++) {
 
+            int i = cands ? cands[c] : c;
             uint32_t flags = G_FlagsGet(vec_AT(visible, i));
             if(!(flags & ENTITY_FLAG_SELECTABLE))
                 continue;
@@ -586,6 +829,11 @@ void G_Sel_Update(struct camera *cam, const vec_entity_t *visible, const vec_obb
     if(!sel_empty) {
         sel_filter_and_set_type();
         E_Global_Notify(EVENT_UNIT_SELECTION_CHANGED, NULL, ES_ENGINE);
+        Replay_RecordCommand(&(struct replay_cmd){
+            .type = REPLAY_CMD_SELECT,
+            .nents = vec_size(&s_selected),
+            .ents = s_selected.array
+        });
     }
     PERF_RETURN_VOID();
 }
@@ -0,0 +1,177 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "snapshot.h"
+#include "game_private.h"
+#include "position.h"
+#include "public/game.h"
+#include "../main.h"
+#include "../perf.h"
+#include "../sched.h"
+
+#include <assert.h>
+
+
+#define QUERY_GRAIN (4)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* A read-only view of the world which is only brought up to date when 
+ * it is first queried in a tick, such that any number of queries can 
+ * be serviced from worker threads at once. */
+static struct pos_snapshot s_pos;
+static vec_erec_t          s_records;
+static bool                s_synced;
+static bool                s_inited;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool snapshot_sync(void)
+{
+    if(s_synced)
+        return true;
+
+    PERF_PUSH("snapshot::sync");
+    bool ret = G_RecordsCopy(&s_records);
+    if(ret) {
+        G_Pos_SnapshotSync(&s_pos);
+    }
+    PERF_POP();
+
+    s_synced = ret;
+    return ret;
+}
+
+static void snapshot_query(struct snapshot_query *query)
+{
+    int nents;
+    switch(query->shape) {
+    case SNAPSHOT_QUERY_CIRCLE:
+        nents = G_Pos_EntsInCircleFrom(&s_pos.tree, &s_records, 
+            query->a, query->b.x, query->out, query->maxout);
+        break;
+    case SNAPSHOT_QUERY_RECT:
+        nents = G_Pos_EntsInRectFrom(&s_pos.tree, &s_records,
+            query->a, query->b, query->out, query->maxout);
+        break;
+    default: 
+        assert(0);
+        nents = 0;
+    }
+
+    size_t ret = 0;
+    for(int i = 0; i < nents; i++) {
+
+        uint32_t curr = query->out[i];
+        const struct ent_record *rec = G_RecordFrom(&s_records, curr);
+
+        if(query->faction_id >= 0 && rec->faction_id != query->faction_id)
+            continue;
+        if((rec->flags & query->flags) != query->flags)
+            continue;
+        query->out[ret++] = curr;
+    }
+    query->nout = ret;
+}
+
+static void snapshot_query_range(size_t begin, size_t end, void *arg)
+{
+    struct snapshot_query *queries = arg;
+    for(size_t i = begin; i < end; i++) {
+        snapshot_query(&queries[i]);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Snapshot_Init(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    vec_erec_init(&s_records);
+    if(!G_Pos_SnapshotInit(&s_pos)) {
+        vec_erec_destroy(&s_records);
+        return false;
+    }
+    s_synced = false;
+    s_inited = true;
+    return true;
+}
+
+void G_Snapshot_Shutdown(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_inited)
+        return;
+
+    G_Pos_SnapshotDestroy(&s_pos);
+    vec_erec_destroy(&s_records);
+    s_synced = false;
+    s_inited = false;
+}
+
+void G_Snapshot_Invalidate(void)
+{
+    s_synced = false;
+}
+
+void G_Snapshot_QueryBatch(size_t nqueries, struct snapshot_query *queries)
+{
+    PERF_ENTER();
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_inited || !snapshot_sync()) {
+        for(int i = 0; i < nqueries; i++) {
+            queries[i].nout = 0;
+        }
+        PERF_RETURN_VOID();
+    }
+
+    if(nqueries > 1 && Sched_UsingBigStack()) {
+        Sched_ParallelFor(0, nqueries, QUERY_GRAIN, snapshot_query_range, queries);
+    }else{
+        snapshot_query_range(0, nqueries, queries);
+    }
+    PERF_RETURN_VOID();
+}
+
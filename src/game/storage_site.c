@@ -36,6 +36,7 @@
 #include "storage_site.h"
 #include "game_private.h"
 #include "selection.h"
+#include "restable.h"
 #include "../sched.h"
 #include "../ui.h"
 #include "../event.h"
@@ -43,27 +44,11 @@
 #include "../lib/public/pf_nuklear.h"
 #include "../lib/public/pf_string.h"
 #include "../lib/public/khash.h"
-#include "../lib/public/mpool_allocator.h"
-#include "../lib/public/string_intern.h"
 #include "../lib/public/attr.h"
+#include "../lib/public/mem.h"
 
 #include <assert.h>
 
-static void *pmalloc(size_t size);
-static void *pcalloc(size_t n, size_t size);
-static void *prealloc(void *ptr, size_t size);
-static void  pfree(void *ptr);
-
-#undef kmalloc
-#undef kcalloc
-#undef krealloc
-#undef kfree
-
-#define kmalloc  pmalloc
-#define kcalloc  pcalloc
-#define krealloc prealloc
-#define kfree    pfree
-
 #define ARR_SIZE(a) (sizeof(a)/sizeof((a)[0]))
 #define MAX(a, b)   ((a) > (b) ? (a) : (b))
 #define MIN(a, b)   ((a) < (b) ? (a) : (b))
@@ -74,93 +59,43 @@ static void  pfree(void *ptr);
             return false;               \
     }while(0)
 
-KHASH_MAP_INIT_STR(int, int)
-
 struct ss_state{
-    kh_int_t              *capacity;
-    kh_int_t              *curr;
-    kh_int_t              *desired;
+    struct restable        capacity;
+    struct restable        curr;
+    struct restable        desired;
     struct ss_delta_event  last_change;
     /* Alternative capacity/desired parameters that 
      *can be turned on/off */
     bool                   use_alt;
-    kh_int_t              *alt_capacity;
-    kh_int_t              *alt_desired;
+    struct restable        alt_capacity;
+    struct restable        alt_desired;
     /* Flags to inform harvesters not to take anything 
      * from this site */
     bool                   do_not_take_land;
     bool                   do_not_take_water;
 };
 
-typedef char buff_t[512];
-
-MPOOL_ALLOCATOR_TYPE(buff, buff_t)
-MPOOL_ALLOCATOR_PROTOTYPES(static, buff, buff_t)
-MPOOL_ALLOCATOR_IMPL(static, buff, buff_t)
-
-#undef kmalloc
-#undef kcalloc
-#undef krealloc
-#undef kfree
-
-#define kmalloc  malloc
-#define kcalloc  calloc
-#define krealloc realloc
-#define kfree    free
-
 KHASH_MAP_INIT_INT(state, struct ss_state)
-KHASH_MAP_INIT_STR(res, int)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static mpa_buff_t       s_mpool;
-static khash_t(stridx) *s_stridx;
-static mp_strbuff_t     s_stringpool;
 static khash_t(state)  *s_entity_state_table;
-static khash_t(res)    *s_global_resource_tables[MAX_FACTIONS];
-static khash_t(res)    *s_global_capacity_tables[MAX_FACTIONS];
+static struct restable  s_global_resource_tables[MAX_FACTIONS];
+static struct restable  s_global_capacity_tables[MAX_FACTIONS];
 
 static struct nk_style_item s_bg_style = {0};
 static struct nk_color      s_border_clr = {0};
 static struct nk_color      s_font_clr = {0};
 static bool                 s_show_ui = true;
+/* Cached value of the setting read every frame */
+static struct sval          s_ui_mode;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void *pmalloc(size_t size)
-{
-    if(size > sizeof(buff_t))
-        return NULL;
-    return mpa_buff_alloc(&s_mpool);
-}
-
-static void *pcalloc(size_t n, size_t size)
-{
-    void *ret = pmalloc(n * size);
-    if(!ret)
-        return NULL;
-    memset(ret, 0, n * size);
-    return ret;
-}
-
-static void *prealloc(void *ptr, size_t size)
-{
-    if(!ptr)
-        return pmalloc(size);
-    if(size <= sizeof(buff_t))
-        return ptr;
-    return NULL;
-}
-
-static void pfree(void *ptr)
-{
-    mpa_buff_free(&s_mpool, ptr);
-}
-
 static struct ss_state *ss_state_get(uint32_t uid)
 {
     khiter_t k = kh_get(state, s_entity_state_table, uid);
@@ -187,36 +122,13 @@ static void ss_state_remove(uint32_t uid)
         kh_del(state, s_entity_state_table, k);
 }
 
-static void ss_state_destroy(struct ss_state *hs)
+static void ss_state_init(struct ss_state *hs)
 {
-    kh_destroy(int, hs->capacity);
-    kh_destroy(int, hs->curr);
-    kh_destroy(int, hs->desired);
-
-    kh_destroy(int, hs->alt_capacity);
-    kh_destroy(int, hs->alt_desired);
-}
-
-static bool ss_state_init(struct ss_state *hs)
-{
-    hs->capacity = kh_init(int);
-    hs->curr = kh_init(int);
-    hs->desired = kh_init(int);
-    hs->alt_capacity = kh_init(int);
-    hs->alt_desired = kh_init(int);
-
-    if(!hs->capacity || !hs->curr || !hs->desired
-    || !hs->alt_capacity || !hs->alt_desired) {
-
-        ss_state_destroy(hs);
-        return false;
-    }
-
+    memset(hs, 0, sizeof(*hs));
     hs->last_change = (struct ss_delta_event){0};
     hs->use_alt = false;
     hs->do_not_take_land = false;
     hs->do_not_take_water = false;
-    return true;
 }
 
 static int compare_keys(const void *a, const void *b)
@@ -226,118 +138,68 @@ static int compare_keys(const void *a, const void *b)
     return strcmp(stra, strb);
 }
 
+static struct restable *ss_cap_table(struct ss_state *ss)
+{
+    return ss->use_alt ? &ss->alt_capacity : &ss->capacity;
+}
+
+static struct restable *ss_desired_table(struct ss_state *ss)
+{
+    return ss->use_alt ? &ss->alt_desired : &ss->desired;
+}
+
 static size_t ss_get_keys(struct ss_state *hs, const char **out, size_t maxout)
 {
     size_t ret = 0;
 
-    const char *key;
-    int amount;
-    khash_t(int) *table = (hs->use_alt) ? hs->alt_capacity : hs->capacity;
-
-    kh_foreach(table, key, amount, {
+    int id, amount;
+    restable_foreach(ss_cap_table(hs), id, amount, {
         if(ret == maxout)
             break;
         if(amount == 0)
             continue;
-        out[ret++] = key;
+        out[ret++] = G_ResTable_NameForID(id);
     });
 
     qsort(out, ret, sizeof(char*), compare_keys);
     return ret;
 }
 
-static bool ss_state_set_key(khash_t(int) *table, const char *name, int val)
+static bool ss_state_set_key(struct restable *table, const char *name, int val)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
-    if(!key)
-        return false;
-
-    khiter_t k = kh_get(int, table, key);
-    if(k != kh_end(table)) {
-        kh_value(table, k) = val;
-        return true;
-    }
-
-    int status;
-    k = kh_put(int, table, key, &status);
-    if(status == -1)
-        return false;
-
-    assert(status == 1);
-    kh_value(table, k) = val;
-    return true;
+    return restable_set(table, G_ResTable_IDForName(name), val);
 }
 
-static bool ss_state_get_key(khash_t(int) *table, const char *name, int *out)
+static bool ss_state_get_key(const struct restable *table, const char *name, int *out)
 {
-    const char *key = si_intern(name, &s_stringpool, s_stridx);
-    if(!key)
-        return false;
-
-    khiter_t k = kh_get(int, table, key);
-    if(k == kh_end(table))
-        return false;
-    *out = kh_value(table, k);
-    return true;
+    return restable_get(table, G_ResTable_LookupID(name), out);
 }
 
-static bool update_res_delta(const char *rname, int delta, int faction_id)
+static void update_res_delta(int id, int delta, int faction_id)
 {
-    const char *key = si_intern(rname, &s_stringpool, s_stridx);
-    if(!key)
-        return false;
-
-    khiter_t k = kh_get(res, s_global_resource_tables[faction_id], key);
-    if(k != kh_end(s_global_resource_tables[faction_id])) {
-        int val = kh_value(s_global_resource_tables[faction_id], k);
-        val += delta;
-        kh_value(s_global_resource_tables[faction_id], k) = val;
-        return true;
-    }
-
-    int status;
-    k = kh_put(res, s_global_resource_tables[faction_id], key, &status);
-    if(status == -1)
-        return false;
-
-    assert(status == 1);
-    kh_value(s_global_resource_tables[faction_id], k) = delta;
-    return true;
+    struct restable *table = &s_global_resource_tables[faction_id];
+    int val = 0;
+    restable_get(table, id, &val);
+    restable_set(table, id, val + delta);
 }
 
-static bool update_cap_delta(const char *rname, int delta, int faction_id)
+static void update_cap_delta(int id, int delta, int faction_id)
 {
-    const char *key = si_intern(rname, &s_stringpool, s_stridx);
-    if(!key)
-        return false;
-
-    khiter_t k = kh_get(res, s_global_capacity_tables[faction_id], key);
-    if(k != kh_end(s_global_capacity_tables[faction_id])) {
-        int val = kh_value(s_global_capacity_tables[faction_id], k);
-        val += delta;
-        kh_value(s_global_capacity_tables[faction_id], k) = val;
-        return true;
-    }
-
-    int status;
-    k = kh_put(res, s_global_capacity_tables[faction_id], key, &status);
-    if(status == -1)
-        return false;
-
-    assert(status == 1);
-    kh_value(s_global_capacity_tables[faction_id], k) = delta;
-    return true;
+    struct restable *table = &s_global_capacity_tables[faction_id];
+    int val = 0;
+    restable_get(table, id, &val);
+    restable_set(table, id, val + delta);
 }
 
-static void constrain_desired(struct ss_state *ss, const char *rname)
+static void constrain_desired(struct ss_state *ss, int id)
 {
     int cap = 0, desired = 0;
-    ss_state_get_key(ss->capacity, rname, &cap);
-    ss_state_get_key(ss->desired, rname, &desired);
+    restable_get(&ss->capacity, id, &cap);
+    restable_get(&ss->desired, id, &desired);
 
     desired = MIN(desired, cap);
     desired = MAX(desired, 0);
-    ss_state_set_key(ss->desired, rname, desired);
+    restable_set(&ss->desired, id, desired);
 }
 
 static void on_update_ui(void *user, void *event)
@@ -345,11 +207,7 @@ static void on_update_ui(void *user, void *event)
     if(!s_show_ui)
         return;
 
-    struct sval ui_setting;
-    ss_e status = Settings_Get("pf.game.storage_site_ui_mode", &ui_setting);
-    assert(status == SS_OKAY);
-
-    if(ui_setting.as_int == SS_UI_SHOW_NEVER)
+    if(s_ui_mode.as_int == SS_UI_SHOW_NEVER)
         return;
 
     uint32_t key;
@@ -362,7 +220,7 @@ static void on_update_ui(void *user, void *event)
 
     kh_foreach(s_entity_state_table, key, curr, {
 
-        if(ui_setting.as_int == SS_UI_SHOW_SELECTED && !G_Sel_IsSelected(key))
+        if(s_ui_mode.as_int == SS_UI_SHOW_SELECTED && !G_Sel_IsSelected(key))
             continue;
 
         struct obb obb;
@@ -495,17 +353,18 @@ static bool save_global_resources(int i, SDL_RWops *stream)
 {
     struct attr num_global_resources = (struct attr){
         .type = TYPE_INT,
-        .val.as_int = kh_size(s_global_resource_tables[i])
+        .val.as_int = restable_size(&s_global_resource_tables[i])
     };
     CHK_TRUE_RET(Attr_Write(stream, &num_global_resources, "num_global_resources"));
 
-    const char *resource_key;
+    int resource_id;
     int resource_amount;
 
-    kh_foreach(s_global_resource_tables[i], resource_key, resource_amount, {
+    restable_foreach(&s_global_resource_tables[i], resource_id, resource_amount, {
     
         struct attr resource_key_attr = (struct attr){ .type = TYPE_STRING, };
-        pf_strlcpy(resource_key_attr.val.as_string, resource_key, sizeof(resource_key_attr.val.as_string));
+        pf_strlcpy(resource_key_attr.val.as_string, G_ResTable_NameForID(resource_id), 
+            sizeof(resource_key_attr.val.as_string));
         CHK_TRUE_RET(Attr_Write(stream, &resource_key_attr, "resource_key"));
 
         struct attr resource_amount_attr = (struct attr){
@@ -530,17 +389,13 @@ static bool load_global_resources(int i, SDL_RWops *stream)
         struct attr keyattr;
         CHK_TRUE_RET(Attr_Parse(stream, &keyattr, true));
         CHK_TRUE_RET(keyattr.type == TYPE_STRING);
-        const char *key = si_intern(keyattr.val.as_string, &s_stringpool, s_stridx);
+        int id = G_ResTable_IDForName(keyattr.val.as_string);
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_INT);
         int val = attr.val.as_int;
 
-        khiter_t k = kh_get(res, s_global_resource_tables[i], key);
-        if(k == kh_end(s_global_resource_tables[i])) {
-            k = kh_put(res, s_global_resource_tables[i], key, &(int){0});
-        }
-        kh_value(s_global_resource_tables[i], k) = val;
+        CHK_TRUE_RET(restable_set(&s_global_resource_tables[i], id, val));
     }
     return true;
 }
@@ -549,17 +404,18 @@ static bool save_global_capacities(int i, SDL_RWops *stream)
 {
     struct attr num_global_capacities = (struct attr){
         .type = TYPE_INT,
-        .val.as_int = kh_size(s_global_capacity_tables[i])
+        .val.as_int = restable_size(&s_global_capacity_tables[i])
     };
     CHK_TRUE_RET(Attr_Write(stream, &num_global_capacities, "num_global_capacities"));
 
-    const char *capacity_key;
+    int capacity_id;
     int capacity_amount;
 
-    kh_foreach(s_global_capacity_tables[i], capacity_key, capacity_amount, {
+    restable_foreach(&s_global_capacity_tables[i], capacity_id, capacity_amount, {
     
         struct attr capacity_key_attr = (struct attr){ .type = TYPE_STRING, };
-        pf_strlcpy(capacity_key_attr.val.as_string, capacity_key, sizeof(capacity_key_attr.val.as_string));
+        pf_strlcpy(capacity_key_attr.val.as_string, G_ResTable_NameForID(capacity_id), 
+            sizeof(capacity_key_attr.val.as_string));
         CHK_TRUE_RET(Attr_Write(stream, &capacity_key_attr, "capacity_key"));
 
         struct attr capacity_amount_attr = (struct attr){
@@ -584,17 +440,13 @@ static bool load_global_capacities(int i, SDL_RWops *stream)
         struct attr keyattr;
         CHK_TRUE_RET(Attr_Parse(stream, &keyattr, true));
         CHK_TRUE_RET(keyattr.type == TYPE_STRING);
-        const char *key = si_intern(keyattr.val.as_string, &s_stringpool, s_stridx);
+        int id = G_ResTable_IDForName(keyattr.val.as_string);
 
         CHK_TRUE_RET(Attr_Parse(stream, &attr, true));
         CHK_TRUE_RET(attr.type == TYPE_INT);
         int val = attr.val.as_int;
 
-        khiter_t k = kh_get(res, s_global_capacity_tables[i], key);
-        if(k == kh_end(s_global_capacity_tables[i])) {
-            k = kh_put(res, s_global_capacity_tables[i], key, &(int){0});
-        }
-        kh_value(s_global_capacity_tables[i], k) = val;
+        CHK_TRUE_RET(restable_set(&s_global_capacity_tables[i], id, val));
     }
     return true;
 }
@@ -614,31 +466,11 @@ static bool storage_site_ui_mode_validate(const struct sval *val)
 
 bool G_StorageSite_Init(void)
 {
-    mpa_buff_init(&s_mpool, 1024, 0);
-
-    if(!mpa_buff_reserve(&s_mpool, 1024))
-        goto fail_mpool; 
     if(!(s_entity_state_table = kh_init(state)))
-        goto fail_table;
-
-    for(int i = 0; i < MAX_FACTIONS; i++) {
-        if(!(s_global_resource_tables[i] = kh_init(res))) {
-            for(--i; i; i--)
-                kh_destroy(res, s_global_resource_tables[i]);
-            goto fail_res;
-        }
-    }
-
-    for(int i = 0; i < MAX_FACTIONS; i++) {
-        if(!(s_global_capacity_tables[i] = kh_init(res))) {
-            for(--i; i; i--)
-                kh_destroy(res, s_global_capacity_tables[i]);
-            goto fail_cap;
-        }
-    }
+        return false;
 
-    if(!si_init(&s_stringpool, &s_stridx, 512))
-        goto fail_strintern;
+    memset(s_global_resource_tables, 0, sizeof(s_global_resource_tables));
+    memset(s_global_capacity_tables, 0, sizeof(s_global_capacity_tables));
 
     struct nk_context ctx;
     nk_style_default(&ctx);
@@ -660,36 +492,16 @@ bool G_StorageSite_Init(void)
         .commit = NULL,
     });
     assert(status == SS_OKAY);
+    Settings_Bind("pf.game.storage_site_ui_mode", &s_ui_mode);
 
     E_Global_Register(EVENT_UPDATE_UI, on_update_ui, NULL, G_RUNNING | G_PAUSED_UI_RUNNING | G_PAUSED_FULL);
     return true;
-
-fail_strintern:
-    for(int i = 0; i < MAX_FACTIONS; i++)
-        kh_destroy(res, s_global_capacity_tables[i]);
-fail_cap:
-    for(int i = 0; i < MAX_FACTIONS; i++)
-        kh_destroy(res, s_global_resource_tables[i]);
-fail_res:
-    kh_destroy(state, s_entity_state_table);
-fail_table:
-    mpa_buff_destroy(&s_mpool);
-fail_mpool:
-    return false;
 }
 
 void G_StorageSite_Shutdown(void)
 {
     E_Global_Unregister(EVENT_UPDATE_UI, on_update_ui);
-
-    for(int i = 0; i < MAX_FACTIONS; i++)
-        kh_destroy(res, s_global_capacity_tables[i]);
-    for(int i = 0; i < MAX_FACTIONS; i++)
-        kh_destroy(res, s_global_resource_tables[i]);
-
-    si_shutdown(&s_stringpool, s_stridx);
     kh_destroy(state, s_entity_state_table);
-    mpa_buff_destroy(&s_mpool);
 }
 
 void G_StorageSite_ClearState(void)
@@ -701,8 +513,7 @@ void G_StorageSite_ClearState(void)
 bool G_StorageSite_AddEntity(uint32_t uid)
 {
     struct ss_state ss;
-    if(!ss_state_init(&ss))
-        return false;
+    ss_state_init(&ss);
     if(!ss_state_set(uid, ss))
         return false;
     return true;
@@ -714,19 +525,16 @@ void G_StorageSite_RemoveEntity(uint32_t uid)
     if(!ss)
         return;
 
-    const char *key;
-    int amount;
+    int id, amount;
 
-    kh_foreach(ss->curr, key, amount, {
-        update_res_delta(key, -amount, G_GetFactionID(uid));
+    restable_foreach(&ss->curr, id, amount, {
+        update_res_delta(id, -amount, G_GetFactionID(uid));
     });
 
-    khash_t(int) *cap = ss->use_alt ? ss->alt_capacity : ss->capacity;
-    kh_foreach(cap, key, amount, {
-        update_cap_delta(key, -amount, G_GetFactionID(uid));
+    restable_foreach(ss_cap_table(ss), id, amount, {
+        update_cap_delta(id, -amount, G_GetFactionID(uid));
     });
 
-    ss_state_destroy(ss);
     ss_state_remove(uid);
 }
 
@@ -735,12 +543,10 @@ bool G_StorageSite_IsSaturated(uint32_t uid)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
-    const char *key;
-    int amount;
-    khash_t(int) *table = ss->use_alt ? ss->alt_capacity : ss->capacity;
-
-    kh_foreach(table, key, amount, {
-        int curr = G_StorageSite_GetCurr(uid, key);
+    int id, amount;
+    restable_foreach(ss_cap_table(ss), id, amount, {
+        int curr = 0;
+        restable_get(&ss->curr, id, &curr);
         if(curr < amount)
             return false;
     });
@@ -752,16 +558,20 @@ bool G_StorageSite_SetCapacity(uint32_t uid, const char *rname, int max)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
+    int id = G_ResTable_IDForName(rname);
+    if(id == RESOURCE_ID_NONE)
+        return false;
+
     int prev = 0;
-    ss_state_get_key(ss->curr, rname, &prev);
+    restable_get(&ss->curr, id, &prev);
     int delta = max - prev;
 
     if(!ss->use_alt) {
-        update_cap_delta(rname, delta, G_GetFactionID(uid));
+        update_cap_delta(id, delta, G_GetFactionID(uid));
     }
 
-    bool ret = ss_state_set_key(ss->capacity, rname, max);
-    constrain_desired(ss, rname);
+    bool ret = restable_set(&ss->capacity, id, max);
+    constrain_desired(ss, id);
     return ret;
 }
 
@@ -771,8 +581,7 @@ int G_StorageSite_GetCapacity(uint32_t uid, const char *rname)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
-    khash_t(int) *table = (ss->use_alt) ? ss->alt_capacity : ss->capacity;
-    ss_state_get_key(table, rname, &ret);
+    ss_state_get_key(ss_cap_table(ss), rname, &ret);
     return ret;
 }
 
@@ -781,9 +590,12 @@ bool G_StorageSite_SetCurr(uint32_t uid, const char *rname, int curr)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
+    int id = G_ResTable_IDForName(rname);
+    if(id == RESOURCE_ID_NONE)
+        return false;
+
     int cap = 0;
-    khash_t(int) *table = (ss->use_alt) ? ss->alt_capacity : ss->capacity;
-    ss_state_get_key(table, rname, &cap);
+    restable_get(ss_cap_table(ss), id, &cap);
 
     if(curr > cap)
         return false;
@@ -791,19 +603,19 @@ bool G_StorageSite_SetCurr(uint32_t uid, const char *rname, int curr)
         return false;
 
     int prev = 0;
-    ss_state_get_key(ss->curr, rname, &prev);
+    restable_get(&ss->curr, id, &prev);
     int delta = curr - prev;
-    update_res_delta(rname, delta, G_GetFactionID(uid));
+    update_res_delta(id, delta, G_GetFactionID(uid));
 
     if(delta) {
         ss->last_change = (struct ss_delta_event){
-            .name = si_intern(rname, &s_stringpool, s_stridx),
+            .name = G_ResTable_NameForID(id),
             .delta = delta
         };
         E_Entity_Notify(EVENT_STORAGE_SITE_AMOUNT_CHANGED, uid, &ss->last_change, ES_ENGINE);
     }
 
-    return ss_state_set_key(ss->curr, rname, curr);
+    return restable_set(&ss->curr, id, curr);
 }
 
 int G_StorageSite_GetCurr(uint32_t uid, const char *rname)
@@ -812,7 +624,7 @@ int G_StorageSite_GetCurr(uint32_t uid, const char *rname)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
-    ss_state_get_key(ss->curr, rname, &ret);
+    ss_state_get_key(&ss->curr, rname, &ret);
     return ret;
 }
 
@@ -820,8 +632,12 @@ bool G_StorageSite_SetDesired(uint32_t uid, const char *rname, int des)
 {
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
-    bool ret = ss_state_set_key(ss->desired, rname, des);
-    constrain_desired(ss, rname);
+
+    int id = G_ResTable_IDForName(rname);
+    bool ret = restable_set(&ss->desired, id, des);
+    if(ret) {
+        constrain_desired(ss, id);
+    }
     return ret;
 }
 
@@ -831,7 +647,7 @@ int G_StorageSite_GetDesired(uint32_t uid, const char *rname)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
-    ss_state_get_key(ss->desired, rname, &ret);
+    ss_state_get_key(&ss->desired, rname, &ret);
     return ret;
 }
 
@@ -840,13 +656,16 @@ int G_StorageSite_GetPlayerStored(const char *rname)
     int ret = 0;
     uint16_t pfacs = G_GetPlayerControlledFactions();
 
+    int id = G_ResTable_LookupID(rname);
+    if(id == RESOURCE_ID_NONE)
+        return 0;
+
     for(int i = 0; i < MAX_FACTIONS; i++) {
         if(!(pfacs & (0x1 << i)))
             continue;
-        khiter_t k = kh_get(res, s_global_resource_tables[i], rname);
-        if(k == kh_end(s_global_resource_tables[i]))
-            continue;
-        ret += kh_value(s_global_resource_tables[i], k);
+        int val = 0;
+        restable_get(&s_global_resource_tables[i], id, &val);
+        ret += val;
     }
     return ret;
 }
@@ -856,13 +675,16 @@ int G_StorageSite_GetPlayerCapacity(const char *rname)
     int ret = 0;
     uint16_t pfacs = G_GetPlayerControlledFactions();
 
+    int id = G_ResTable_LookupID(rname);
+    if(id == RESOURCE_ID_NONE)
+        return 0;
+
     for(int i = 0; i < MAX_FACTIONS; i++) {
         if(!(pfacs & (0x1 << i)))
             continue;
-        khiter_t k = kh_get(res, s_global_capacity_tables[i], rname);
-        if(k == kh_end(s_global_capacity_tables[i]))
-            continue;
-        ret += kh_value(s_global_capacity_tables[i], k);
+        int val = 0;
+        restable_get(&s_global_capacity_tables[i], id, &val);
+        ret += val;
     }
     return ret;
 }
@@ -907,6 +729,57 @@ void G_StorageSite_GetAll(vec_entity_t *out)
     });
 }
 
+struct ss_cand{
+    uint32_t uid;
+    float    dist;
+};
+
+static int compare_cands(const void *a, const void *b)
+{
+    float da = ((const struct ss_cand*)a)->dist;
+    float db = ((const struct ss_cand*)b)->dist;
+    return (da > db) - (da < db);
+}
+
+uint32_t G_StorageSite_NearestWithPred(int faction_id, vec2_t xz_point,
+                                       bool (*predicate)(uint32_t ent, void *arg),
+                                       void *arg)
+{
+    size_t nsites = kh_size(s_entity_state_table);
+    if(nsites == 0)
+        return NULL_UID;
+
+    STALLOC(struct ss_cand, cands, nsites);
+    size_t ncands = 0;
+
+    /* Storage sites are few compared to all the entities surrounding 
+     * a harvester, so it's cheaper to rank all the faction's sites by 
+     * distance and only run the (expensive) predicate until the first 
+     * match than to do a spatial search over every nearby entity. */
+    uint32_t uid;
+    kh_foreach_key(s_entity_state_table, uid, {
+        if(G_GetFactionID(uid) != faction_id)
+            continue;
+        if(G_FlagsGet(uid) & (ENTITY_FLAG_ZOMBIE | ENTITY_FLAG_GARRISONED))
+            continue;
+        vec2_t delta, pos = G_Pos_GetXZ(uid);
+        PFM_Vec2_Sub(&xz_point, &pos, &delta);
+        cands[ncands++] = (struct ss_cand){uid, PFM_Vec2_Len(&delta)};
+    });
+    qsort(cands, ncands, sizeof(struct ss_cand), compare_cands);
+
+    uint32_t ret = NULL_UID;
+    for(int i = 0; i < ncands; i++) {
+        if(predicate(cands[i].uid, arg)) {
+            ret = cands[i].uid;
+            break;
+        }
+    }
+
+    STFREE(cands);
+    return ret;
+}
+
 bool G_StorageSite_GetDoNotTakeLand(uint32_t uid)
 {
     struct ss_state *ss = ss_state_get(uid);
@@ -952,22 +825,21 @@ void G_StorageSite_SetUseAlt(uint32_t uid, bool use)
     if(use == ss->use_alt)
         return;
 
-    const char *key;
-    int amount;
+    int id, amount;
 
     if(use) {
-        kh_foreach(ss->capacity, key, amount, {
-            update_cap_delta(key, -amount, G_GetFactionID(uid));
+        restable_foreach(&ss->capacity, id, amount, {
+            update_cap_delta(id, -amount, G_GetFactionID(uid));
         });
-        kh_foreach(ss->alt_capacity, key, amount, {
-            update_cap_delta(key, amount, G_GetFactionID(uid));
+        restable_foreach(&ss->alt_capacity, id, amount, {
+            update_cap_delta(id, amount, G_GetFactionID(uid));
         });
     }else{
-        kh_foreach(ss->alt_capacity, key, amount, {
-            update_cap_delta(key, -amount, G_GetFactionID(uid));
+        restable_foreach(&ss->alt_capacity, id, amount, {
+            update_cap_delta(id, -amount, G_GetFactionID(uid));
         });
-        kh_foreach(ss->capacity, key, amount, {
-            update_cap_delta(key, amount, G_GetFactionID(uid));
+        restable_foreach(&ss->capacity, id, amount, {
+            update_cap_delta(id, amount, G_GetFactionID(uid));
         });
     }
     ss->use_alt = use;
@@ -986,16 +858,15 @@ void G_StorageSite_ClearAlt(uint32_t uid)
     assert(ss);
 
     if(ss->use_alt) {
-        const char *key;
-        int amount;
+        int id, amount;
 
-        kh_foreach(ss->alt_capacity, key, amount, {
-            update_cap_delta(key, -amount, G_GetFactionID(uid));
+        restable_foreach(&ss->alt_capacity, id, amount, {
+            update_cap_delta(id, -amount, G_GetFactionID(uid));
         });
     }
 
-    kh_clear(int, ss->alt_capacity);
-    kh_clear(int, ss->alt_desired);
+    restable_clear(&ss->alt_capacity);
+    restable_clear(&ss->alt_desired);
 }
 
 void G_StorageSite_ClearCurr(uint32_t uid)
@@ -1003,14 +874,13 @@ void G_StorageSite_ClearCurr(uint32_t uid)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
-    const char *key;
-    int amount;
+    int id, amount;
 
-    kh_foreach(ss->alt_capacity, key, amount, {
-        update_cap_delta(key, -amount, G_GetFactionID(uid));
+    restable_foreach(&ss->alt_capacity, id, amount, {
+        update_cap_delta(id, -amount, G_GetFactionID(uid));
     });
 
-    kh_clear(int, ss->curr);
+    restable_clear(&ss->curr);
 }
 
 bool G_StorageSite_SetAltCapacity(uint32_t uid, const char *rname, int max)
@@ -1018,16 +888,20 @@ bool G_StorageSite_SetAltCapacity(uint32_t uid, const char *rname, int max)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
+    int id = G_ResTable_IDForName(rname);
+    if(id == RESOURCE_ID_NONE)
+        return false;
+
     int prev = 0;
-    ss_state_get_key(ss->curr, rname, &prev);
+    restable_get(&ss->curr, id, &prev);
     int delta = max - prev;
 
     if(ss->use_alt) {
-        update_cap_delta(rname, delta, G_GetFactionID(uid));
+        update_cap_delta(id, delta, G_GetFactionID(uid));
     }
 
-    bool ret = ss_state_set_key(ss->alt_capacity, rname, max);
-    constrain_desired(ss, rname);
+    bool ret = restable_set(&ss->alt_capacity, id, max);
+    constrain_desired(ss, id);
     return ret;
 }
 
@@ -1037,7 +911,7 @@ int G_StorageSite_GetAltCapacity(uint32_t uid, const char *rname)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
-    ss_state_get_key(ss->alt_capacity, rname, &ret);
+    ss_state_get_key(&ss->alt_capacity, rname, &ret);
     return ret;
 }
 
@@ -1045,8 +919,12 @@ bool G_StorageSite_SetAltDesired(uint32_t uid, const char *rname, int des)
 {
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
-    bool ret = ss_state_set_key(ss->alt_desired, rname, des);
-    constrain_desired(ss, rname);
+
+    int id = G_ResTable_IDForName(rname);
+    bool ret = restable_set(&ss->alt_desired, id, des);
+    if(ret) {
+        constrain_desired(ss, id);
+    }
     return ret;
 }
 
@@ -1056,7 +934,7 @@ int G_StorageSite_GetAltDesired(uint32_t uid, const char *rname)
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
 
-    ss_state_get_key(ss->alt_desired, rname, &ret);
+    ss_state_get_key(&ss->alt_desired, rname, &ret);
     return ret;
 }
 
@@ -1066,18 +944,16 @@ void G_StorageSite_UpdateFaction(uint32_t uid, int oldfac, int newfac)
     if(!ss)
         return;
 
-    const char *key;
-    int amount;
+    int id, amount;
 
-    khash_t(int) *cap = ss->use_alt ? ss->alt_capacity : ss->capacity;
-    kh_foreach(cap, key, amount, {
-        update_cap_delta(key, -amount, oldfac);
-        update_cap_delta(key,  amount, newfac);
+    restable_foreach(ss_cap_table(ss), id, amount, {
+        update_cap_delta(id, -amount, oldfac);
+        update_cap_delta(id,  amount, newfac);
     });
 
-    kh_foreach(ss->curr, key, amount, {
-        update_res_delta(key, -amount, oldfac);
-        update_res_delta(key,  amount, newfac);
+    restable_foreach(&ss->curr, id, amount, {
+        update_res_delta(id, -amount, oldfac);
+        update_res_delta(id,  amount, newfac);
     });
 }
 
@@ -1085,13 +961,13 @@ bool G_StorageSite_Desires(uint32_t uid, const char *rname)
 {
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
-    khash_t(int) *des = ss->use_alt ? ss->alt_desired  : ss->desired;
 
+    int id = G_ResTable_LookupID(rname);
     int rdes, rcurr = 0;
-    if(!ss_state_get_key(des, rname, &rdes))
+    if(!restable_get(ss_desired_table(ss), id, &rdes))
         return false;
 
-    ss_state_get_key(ss->curr, rname, &rcurr);
+    restable_get(&ss->curr, id, &rcurr);
     return (rdes > rcurr);
 }
 
@@ -1099,8 +975,7 @@ float G_StorageSite_GetWindowHeight(uint32_t uid)
 {
     struct ss_state *ss = ss_state_get(uid);
     assert(ss);
-    khash_t(int) *table = (ss->use_alt) ? ss->alt_capacity : ss->capacity;
-    return MIN(kh_size(table), 16) * 20 + 32;
+    return MIN(restable_size(ss_cap_table(ss)), 16) * 20 + 32;
 }
 
 bool G_StorageSite_SaveState(struct SDL_RWops *stream)
@@ -1131,16 +1006,17 @@ bool G_StorageSite_SaveState(struct SDL_RWops *stream)
 
         struct attr num_capacity = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.capacity)
+            .val.as_int = restable_size(&curr.capacity)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_capacity, "num_capacity"));
 
-        const char *cap_key;
+        int cap_id;
         int cap_amount;
-        kh_foreach(curr.capacity, cap_key, cap_amount, {
+        restable_foreach(&curr.capacity, cap_id, cap_amount, {
         
             struct attr cap_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(cap_key_attr.val.as_string, cap_key, sizeof(cap_key_attr.val.as_string));
+            pf_strlcpy(cap_key_attr.val.as_string, G_ResTable_NameForID(cap_id), 
+                sizeof(cap_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &cap_key_attr, "cap_key"));
 
             struct attr cap_amount_attr = (struct attr){
@@ -1152,16 +1028,17 @@ bool G_StorageSite_SaveState(struct SDL_RWops *stream)
 
         struct attr num_curr = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.curr)
+            .val.as_int = restable_size(&curr.curr)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_curr, "num_curr"));
 
-        const char *curr_key;
+        int curr_id;
         int curr_amount;
-        kh_foreach(curr.curr, curr_key, curr_amount, {
+        restable_foreach(&curr.curr, curr_id, curr_amount, {
         
             struct attr curr_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(curr_key_attr.val.as_string, curr_key, sizeof(curr_key_attr.val.as_string));
+            pf_strlcpy(curr_key_attr.val.as_string, G_ResTable_NameForID(curr_id), 
+                sizeof(curr_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &curr_key_attr, "curr_key"));
 
             struct attr curr_amount_attr = (struct attr){
@@ -1173,16 +1050,17 @@ bool G_StorageSite_SaveState(struct SDL_RWops *stream)
 
         struct attr num_desired = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.desired)
+            .val.as_int = restable_size(&curr.desired)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_desired, "num_desired"));
 
-        const char *desired_key;
+        int desired_id;
         int desired_amount;
-        kh_foreach(curr.desired, desired_key, desired_amount, {
+        restable_foreach(&curr.desired, desired_id, desired_amount, {
         
             struct attr desired_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(desired_key_attr.val.as_string, desired_key, sizeof(desired_key_attr.val.as_string));
+            pf_strlcpy(desired_key_attr.val.as_string, G_ResTable_NameForID(desired_id), 
+                sizeof(desired_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &desired_key_attr, "desired_key"));
 
             struct attr desired_amount_attr = (struct attr){
@@ -1194,16 +1072,17 @@ bool G_StorageSite_SaveState(struct SDL_RWops *stream)
 
         struct attr num_alt_cap = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.alt_capacity)
+            .val.as_int = restable_size(&curr.alt_capacity)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_alt_cap, "num_alt_cap"));
 
-        const char *alt_cap_key;
+        int alt_cap_id;
         int alt_cap_amount;
-        kh_foreach(curr.alt_capacity, alt_cap_key, alt_cap_amount, {
+        restable_foreach(&curr.alt_capacity, alt_cap_id, alt_cap_amount, {
         
             struct attr alt_cap_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(alt_cap_key_attr.val.as_string, alt_cap_key, sizeof(alt_cap_key_attr.val.as_string));
+            pf_strlcpy(alt_cap_key_attr.val.as_string, G_ResTable_NameForID(alt_cap_id), 
+                sizeof(alt_cap_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &alt_cap_key_attr, "alt_cap_key"));
 
             struct attr alt_cap_amount_attr = (struct attr){
@@ -1215,16 +1094,17 @@ bool G_StorageSite_SaveState(struct SDL_RWops *stream)
 
         struct attr num_alt_desired = (struct attr){
             .type = TYPE_INT,
-            .val.as_int = kh_size(curr.alt_desired)
+            .val.as_int = restable_size(&curr.alt_desired)
         };
         CHK_TRUE_RET(Attr_Write(stream, &num_alt_desired, "num_alt_desired"));
 
-        const char *alt_desired_key;
+        int alt_desired_id;
         int alt_desired_amount;
-        kh_foreach(curr.alt_desired, alt_desired_key, alt_desired_amount, {
+        restable_foreach(&curr.alt_desired, alt_desired_id, alt_desired_amount, {
         
             struct attr alt_desired_key_attr = (struct attr){ .type = TYPE_STRING, };
-            pf_strlcpy(alt_desired_key_attr.val.as_string, alt_desired_key, sizeof(alt_desired_key_attr.val.as_string));
+            pf_strlcpy(alt_desired_key_attr.val.as_string, G_ResTable_NameForID(alt_desired_id), 
+                sizeof(alt_desired_key_attr.val.as_string));
             CHK_TRUE_RET(Attr_Write(stream, &alt_desired_key_attr, "alt_desired_key"));
 
             struct attr alt_desired_amount_attr = (struct attr){
@@ -1321,7 +1201,7 @@ bool G_StorageSite_LoadState(struct SDL_RWops *stream)
              * when building builings or replenishing reources 
              */
             struct ss_state newstate;
-            CHK_TRUE_RET(ss_state_init(&newstate));
+            ss_state_init(&newstate);
             CHK_TRUE_RET(ss_state_set(uid, newstate));
             ss = ss_state_get(uid);
             CHK_TRUE_RET(ss);
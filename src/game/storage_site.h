@@ -53,6 +53,12 @@ bool G_StorageSite_IsSaturated(uint32_t uid);
 void G_StorageSite_UpdateFaction(uint32_t uid, int oldfac, int newfac);
 bool G_StorageSite_Desires(uint32_t uid, const char *rname);
 
+/* Returns the nearest storage site of the faction that satisfies 
+ * the predicate, or NULL_UID if there is none. */
+uint32_t G_StorageSite_NearestWithPred(int faction_id, vec2_t xz_point,
+                                       bool (*predicate)(uint32_t ent, void *arg),
+                                       void *arg);
+
 bool G_StorageSite_SaveState(struct SDL_RWops *stream);
 bool G_StorageSite_LoadState(struct SDL_RWops *stream);
 void G_StorageSite_ClearState(void);
@@ -36,72 +36,75 @@
 #include "public/game.h"
 #include "timer_events.h"
 #include "../event.h"
+#include "../main.h"
+#include "../settings.h"
 
-#include <math.h>
 #include <assert.h>
 #include <SDL.h>
 
-#define TIMER_INTERVAL  (1000.0f/60.0f)
+#define TICK_HZ             (60)
+/* When the simulation falls behind by more than this many ticks (such as 
+ * after loading a session or a hitch), the remaining time is dropped 
+ * instead of running a burst of ticks to catch up. */
+#define MAX_CATCHUP_TICKS   (4)
+#define PHASE_20HZ          (1)
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
+/* The lower-frequency ticks are derived from the 60Hz tick. Each one is 
+ * given a phase offset such that no more than two of them land on the 
+ * same 60Hz tick, rather than all of them landing together every 12th 
+ * tick. */
+static const struct{
+    enum eventtype type;
+    unsigned       period;
+    unsigned       phase;
+}s_derived_ticks[] = {
+    {EVENT_30HZ_TICK,  2, 1},
+    {EVENT_20HZ_TICK,  3, PHASE_20HZ},
+    {EVENT_15HZ_TICK,  4, 0},
+    {EVENT_10HZ_TICK,  6, 2},
+    {EVENT_1HZ_TICK,  60, 6},
+};
+
 static unsigned long long s_num_60hz_ticks;
-static SDL_TimerID        s_60hz_timer;
+static uint64_t           s_last_counter;
+/* The real time that has elapsed but has not yet been simulated, in 
+ * units of (performance counter ticks * TICK_HZ) so that no rounding 
+ * error accumulates. A tick is due for every 'SDL_GetPerformanceFrequency()' 
+ * units. */
+static uint64_t           s_accum;
+static bool               s_free_running;
+static bool               s_sharded;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-/* Timer callback gets called from another thread. In the callback, push 
- * a user event (threadsafe) with the code '0' and handle the 'EVENT_60HZ_TICK' 
- * event in the main thread.
- */
-static uint32_t timer_callback(uint32_t interval, void *param)
-{
-    static double s_error = 0.0f;
-    s_error += (TIMER_INTERVAL - interval);
-
-    double intpart, fracpart;
-    fracpart = modf(s_error, &intpart);
-    (void)fracpart;
-
-    s_error -= intpart;
-    interval = ((int)TIMER_INTERVAL) + intpart;
-
-    SDL_Event event = (SDL_Event) {
-        .type = SDL_USEREVENT,
-        .user = (SDL_UserEvent) {
-            .type = SDL_USEREVENT,
-            .code = 0,
-            .data1 = NULL,
-            .data2 = NULL,
-        },
-    };
-
-    SDL_PushEvent(&event);
-    return interval;
-}
-
 static void timer_60hz_handler(void *unused1, void *unused2)
 {
     s_num_60hz_ticks++;
 
-    if(s_num_60hz_ticks % 2 == 0)
-        E_Global_Notify(EVENT_30HZ_TICK, NULL, ES_ENGINE);
-
-    if(s_num_60hz_ticks % 3 == 0)
-        E_Global_Notify(EVENT_20HZ_TICK, NULL, ES_ENGINE);
-
-    if(s_num_60hz_ticks % 4 == 0)
-        E_Global_Notify(EVENT_15HZ_TICK, NULL, ES_ENGINE);
-
-    if(s_num_60hz_ticks % 6 == 0)
-        E_Global_Notify(EVENT_10HZ_TICK, NULL, ES_ENGINE);
-
-    if(s_num_60hz_ticks % 60 == 0)
-        E_Global_Notify(EVENT_1HZ_TICK, NULL, ES_ENGINE);
+    unsigned subtick = (s_num_60hz_ticks + G_TICK_SHARDS - PHASE_20HZ) % G_TICK_SHARDS;
+    if(subtick == 0) {
+        struct sval setting;
+        if(Settings_Get("pf.game.sharded_20hz_ticks", &setting) == SS_OKAY) {
+            s_sharded = setting.as_bool;
+        }
+    }
+
+    for(int i = 0; i < ARR_SIZE(s_derived_ticks); i++) {
+        if(s_num_60hz_ticks % s_derived_ticks[i].period != s_derived_ticks[i].phase)
+            continue;
+        E_Global_Notify(s_derived_ticks[i].type, NULL, ES_ENGINE);
+    }
+
+    if(s_sharded) {
+        E_Global_Notify(EVENT_20HZ_SUBTICK, (void*)((uintptr_t)subtick), ES_ENGINE);
+    }
 }
 
 /*****************************************************************************/
@@ -110,9 +113,10 @@ static void timer_60hz_handler(void *unused1, void *unused2)
 
 bool G_Timer_Init(void)
 {
-    s_60hz_timer = SDL_AddTimer(TIMER_INTERVAL, timer_callback, NULL);
-    if(0 == s_60hz_timer)
-        return false;
+    s_num_60hz_ticks = 0;
+    s_sharded = false;
+    s_last_counter = SDL_GetPerformanceCounter();
+    s_accum = 0;
 
     /* We will still generate timer events while the simulation is paused.
      * Most handlers should be masked out, however. */
@@ -124,6 +128,65 @@ bool G_Timer_Init(void)
 void G_Timer_Shutdown(void)
 {
     E_Global_Unregister(EVENT_60HZ_TICK, timer_60hz_handler);
-    SDL_RemoveTimer(s_60hz_timer);
+}
+
+int G_Timer_Advance(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t elapsed = now - s_last_counter;
+    s_last_counter = now;
+
+    if(s_free_running) {
+        s_accum = 0;
+        E_Global_Notify(EVENT_60HZ_TICK, NULL, ES_ENGINE);
+        return 1;
+    }
+
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    const uint64_t max_accum = (MAX_CATCHUP_TICKS + 1) * freq;
+    s_accum += (elapsed < max_accum / TICK_HZ) ? elapsed * TICK_HZ : max_accum;
+
+    int ret = 0;
+    while(s_accum >= freq && ret < MAX_CATCHUP_TICKS) {
+        E_Global_Notify(EVENT_60HZ_TICK, NULL, ES_ENGINE);
+        s_accum -= freq;
+        ret++;
+    }
+
+    if(s_accum >= freq) {
+        s_accum %= freq;
+    }
+    return ret;
+}
+
+void G_Timer_AdvanceBy(int nticks)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    s_last_counter = SDL_GetPerformanceCounter();
+    s_accum = 0;
+    for(int i = 0; i < nticks; i++) {
+        E_Global_Notify(EVENT_60HZ_TICK, NULL, ES_ENGINE);
+    }
+}
+
+void G_Timer_SetFreeRunning(bool on)
+{
+    ASSERT_IN_MAIN_THREAD();
+    s_free_running = on;
+    s_last_counter = SDL_GetPerformanceCounter();
+    s_accum = 0;
+}
+
+bool G_Timer_Sharded(void)
+{
+    return s_sharded;
+}
+
+bool G_Timer_GetFreeRunning(void)
+{
+    return s_free_running;
 }
 
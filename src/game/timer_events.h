@@ -39,8 +39,21 @@
 #include <stdbool.h>
 
 
+/* When the 'pf.game.sharded_20hz_ticks' setting is on, the modules which 
+ * process all their entities on every 20Hz tick instead spread the work 
+ * over the 3 60Hz ticks of every 20Hz period. The EVENT_20HZ_SUBTICK event
+ * is then notified on every 60Hz tick, with the index of the sub-tick as 
+ * the argument, and an entity is processed only on the sub-tick given by 
+ * G_TICK_SHARD. Every entity is still processed at 20Hz. Sub-tick 0 lands 
+ * on the same 60Hz tick as the EVENT_20HZ_TICK. */
+#define G_TICK_SHARDS       (3)
+#define G_TICK_SHARD(uid)   ((uid) % G_TICK_SHARDS)
+
 bool G_Timer_Init(void);
 void G_Timer_Shutdown(void);
+/* The setting is only applied at the start of a 20Hz period, so that the 
+ * modules can't see a partially sharded period */
+bool G_Timer_Sharded(void);
 
 #endif
 
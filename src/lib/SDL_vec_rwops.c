@@ -151,3 +151,9 @@ bool PFSDL_VectorRWOpsReserve(SDL_RWops* ctx, size_t size)
 {
     return vec_uchar_resize(VEC(ctx), size);
 }
+
+bool PFSDL_IsVectorRWOps(const SDL_RWops *ctx)
+{
+    return (ctx->type == SDL_RWOPS_VEC);
+}
+
@@ -35,6 +35,7 @@
 
 #include "public/attr.h"
 #include "public/pf_string.h"
+#include "public/SDL_vec_rwops.h"
 #include "../asset_load.h"
 
 #include <string.h>
@@ -43,6 +44,191 @@
 
 
 #define CHK_TRUE(_pred, _label) do{ if(!(_pred)) goto _label; }while(0)
+#define MIN(a, b)               ((a) < (b) ? (a) : (b))
+
+/* Binary records start with a tag byte that has the high bit set, which can 
+ * never be the first character of a text attribute line. The low bits hold 
+ * the type. 
+ *
+ *   [tag] [name length (1 byte)] [name bytes] (if named)
+ *   [value]
+ *
+ * Ints are zigzag-encoded varints, floats and vectors are raw little-endian 
+ * IEEE floats, bools a single byte and strings are a varint length followed 
+ * by the bytes. 
+ */
+#define BIN_TAG             (0x80)
+#define BIN_NAMED           (0x40)
+#define BIN_TYPE_MASK       (0x0f)
+#define BIN_MAX_RECORD      (1 + 1 + 64 + 5 + 256)
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static size_t attr_put_varint(unsigned char *out, uint32_t val)
+{
+    size_t ret = 0;
+    while(val >= 0x80) {
+        out[ret++] = (unsigned char)(val | 0x80);
+        val >>= 7;
+    }
+    out[ret++] = (unsigned char)val;
+    return ret;
+}
+
+static bool attr_get_varint(SDL_RWops *stream, uint32_t *out)
+{
+    uint32_t ret = 0;
+    for(int shift = 0; shift < 35; shift += 7) {
+        unsigned char byte;
+        if(!SDL_RWread(stream, &byte, 1, 1))
+            return false;
+        ret |= ((uint32_t)(byte & 0x7f)) << shift;
+        if(!(byte & 0x80)) {
+            *out = ret;
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t attr_put_floats(unsigned char *out, const float *in, size_t n)
+{
+    for(int i = 0; i < n; i++) {
+        uint32_t bits;
+        memcpy(&bits, &in[i], sizeof(bits));
+        bits = SDL_SwapLE32(bits);
+        memcpy(out + i * sizeof(bits), &bits, sizeof(bits));
+    }
+    return n * sizeof(uint32_t);
+}
+
+static bool attr_get_floats(SDL_RWops *stream, float *out, size_t n)
+{
+    uint32_t bits[4];
+    assert(n <= 4);
+    if(!SDL_RWread(stream, bits, sizeof(uint32_t) * n, 1))
+        return false;
+    for(int i = 0; i < n; i++) {
+        bits[i] = SDL_SwapLE32(bits[i]);
+        memcpy(&out[i], &bits[i], sizeof(float));
+    }
+    return true;
+}
+
+/* In-memory streams hold engine state (sessions, pickled objects) that is 
+ * never meant to be read by a human, so they get the compact encoding. 
+ * Anything else (i.e. map and scene files) is kept as text. */
+static bool attr_use_binary(SDL_RWops *stream)
+{
+    return PFSDL_IsVectorRWOps(stream);
+}
+
+static bool attr_write_binary(SDL_RWops *stream, const struct attr *in, const char name[])
+{
+    unsigned char buff[BIN_MAX_RECORD];
+    size_t len = 0;
+
+    buff[len++] = BIN_TAG | (name ? BIN_NAMED : 0) | (in->type & BIN_TYPE_MASK);
+    if(name) {
+        size_t namelen = MIN(strlen(name), sizeof(in->key) - 1);
+        buff[len++] = (unsigned char)namelen;
+        memcpy(buff + len, name, namelen);
+        len += namelen;
+    }
+
+    switch(in->type) {
+    case TYPE_STRING: {
+        size_t slen = strnlen(in->val.as_string, sizeof(in->val.as_string) - 1);
+        len += attr_put_varint(buff + len, slen);
+        memcpy(buff + len, in->val.as_string, slen);
+        len += slen;
+        break;
+    }
+    case TYPE_FLOAT:
+        len += attr_put_floats(buff + len, &in->val.as_float, 1);
+        break;
+    case TYPE_INT: {
+        uint32_t zz = ((uint32_t)in->val.as_int << 1) ^ (uint32_t)(in->val.as_int >> 31);
+        len += attr_put_varint(buff + len, zz);
+        break;
+    }
+    case TYPE_VEC2:
+        len += attr_put_floats(buff + len, in->val.as_vec2.raw, 2);
+        break;
+    case TYPE_VEC3:
+        len += attr_put_floats(buff + len, in->val.as_vec3.raw, 3);
+        break;
+    case TYPE_QUAT:
+        len += attr_put_floats(buff + len, in->val.as_quat.raw, 4);
+        break;
+    case TYPE_BOOL:
+        buff[len++] = !!in->val.as_bool;
+        break;
+    default: assert(0);
+    }
+
+    assert(len <= sizeof(buff));
+    return (SDL_RWwrite(stream, buff, len, 1) == 1);
+}
+
+static bool attr_parse_binary(SDL_RWops *stream, unsigned char tag, struct attr *out, bool named)
+{
+    if(!!(tag & BIN_NAMED) != named)
+        return false;
+
+    if(named) {
+        unsigned char namelen;
+        CHK_TRUE(SDL_RWread(stream, &namelen, 1, 1), fail);
+        CHK_TRUE(namelen < sizeof(out->key), fail);
+        CHK_TRUE(namelen == 0 || SDL_RWread(stream, out->key, namelen, 1), fail);
+        out->key[namelen] = '\0';
+    }
+
+    out->type = tag & BIN_TYPE_MASK;
+    switch(out->type) {
+    case TYPE_STRING: {
+        uint32_t slen;
+        CHK_TRUE(attr_get_varint(stream, &slen), fail);
+        CHK_TRUE(slen < sizeof(out->val.as_string), fail);
+        CHK_TRUE(slen == 0 || SDL_RWread(stream, out->val.as_string, slen, 1), fail);
+        out->val.as_string[slen] = '\0';
+        break;
+    }
+    case TYPE_FLOAT:
+        CHK_TRUE(attr_get_floats(stream, &out->val.as_float, 1), fail);
+        break;
+    case TYPE_INT: {
+        uint32_t zz;
+        CHK_TRUE(attr_get_varint(stream, &zz), fail);
+        out->val.as_int = (int)((zz >> 1) ^ (~(zz & 1) + 1));
+        break;
+    }
+    case TYPE_VEC2:
+        CHK_TRUE(attr_get_floats(stream, out->val.as_vec2.raw, 2), fail);
+        break;
+    case TYPE_VEC3:
+        CHK_TRUE(attr_get_floats(stream, out->val.as_vec3.raw, 3), fail);
+        break;
+    case TYPE_QUAT:
+        CHK_TRUE(attr_get_floats(stream, out->val.as_quat.raw, 4), fail);
+        break;
+    case TYPE_BOOL: {
+        unsigned char val;
+        CHK_TRUE(SDL_RWread(stream, &val, 1, 1), fail);
+        CHK_TRUE(val == 0 || val == 1, fail);
+        out->val.as_bool = val;
+        break;
+    }
+    default:
+        goto fail;
+    }
+    return true;
+
+fail:
+    return false;
+}
 
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
@@ -50,6 +236,14 @@
 
 bool Attr_Parse(struct SDL_RWops *stream, struct attr *out, bool named)
 {
+    unsigned char tag;
+    if(!SDL_RWread(stream, &tag, 1, 1))
+        return false;
+
+    if(tag & BIN_TAG)
+        return attr_parse_binary(stream, tag, out, named);
+    SDL_RWseek(stream, -1, RW_SEEK_CUR);
+
     char line[MAX_LINE_LEN];
     READ_LINE(stream, line, fail);
     char *saveptr;
@@ -142,6 +336,9 @@ fail:
 
 bool Attr_Write(struct SDL_RWops *stream, const struct attr *in, const char name[])
 {
+    if(attr_use_binary(stream))
+        return attr_write_binary(stream, in, name);
+
     if(name) {
         CHK_TRUE(SDL_RWwrite(stream, name, strlen(name), 1), fail);
         CHK_TRUE(SDL_RWwrite(stream, " ", 1, 1), fail);
@@ -0,0 +1,292 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/mem.h"
+#include "../config.h"
+
+#include <SDL_atomic.h>
+#include <assert.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* Tagged allocations are prefixed with a header recording the size and 
+ * the owner tag. It is padded to keep the returned memory aligned to the 
+ * largest builtin type. */
+#define HDR_SZ          (((sizeof(struct mem_hdr)) + (sizeof(intmax_t) - 1)) & ~(sizeof(intmax_t) - 1))
+#define ALIGNED(val, a)  (((val) + ((a) - 1)) & ~((size_t)(a) - 1))
+#define PAGE_SZ          (4096)
+#define HUGE_PAGE_SZ     (2 * 1024 * 1024)
+
+struct mem_hdr{
+    size_t       size;
+    enum mem_tag tag;
+};
+
+struct tag_counters{
+    int64_t  live;
+    int64_t  peak;
+    uint64_t nallocs;
+    uint64_t nfrees;
+    uint64_t nallocs_last_tick;
+    uint64_t tick_allocs;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char *s_tag_names[MEM_TAG_COUNT] = {
+    [MEM_TAG_MISC]          = "misc",
+    [MEM_TAG_STALLOC]       = "stalloc",
+    [MEM_TAG_MPOOL]         = "mpool",
+    [MEM_TAG_FIELD_CACHE]   = "field_cache",
+    [MEM_TAG_FRAME_ARENA]   = "frame_arena",
+    [MEM_TAG_TASK_STACKS]   = "task_stacks",
+    [MEM_TAG_ANIM]          = "anim",
+    [MEM_TAG_NAV]           = "nav",
+    [MEM_TAG_GL_MESH]       = "gl_mesh",
+    [MEM_TAG_GL_BATCH]      = "gl_batch",
+    [MEM_TAG_GL_RING]       = "gl_ring",
+};
+
+static SDL_SpinLock        s_lock;
+static struct tag_counters s_counters[MEM_TAG_COUNT];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void *hdr_init(void *mem, enum mem_tag tag, size_t size)
+{
+    if(!mem)
+        return NULL;
+    struct mem_hdr *hdr = mem;
+    hdr->size = size;
+    hdr->tag = tag;
+    pf_mem_account(tag, size);
+    return (char*)mem + HDR_SZ;
+}
+
+static size_t large_size(size_t size)
+{
+    return ALIGNED(size, CONFIG_HUGE_PAGES ? HUGE_PAGE_SZ : PAGE_SZ);
+}
+
+#ifdef _WIN32
+
+static void *large_map(size_t size)
+{
+    if(CONFIG_HUGE_PAGES) {
+        SIZE_T min = GetLargePageMinimum();
+        if(min && (size % min) == 0) {
+            void *ret = VirtualAlloc(NULL, size, 
+                MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if(ret)
+                return ret;
+        }
+    }
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+static void large_unmap(void *ptr, size_t size)
+{
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+#else
+
+static void *large_map(size_t size)
+{
+    if(!CONFIG_HUGE_PAGES) {
+        void *ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return (ret == MAP_FAILED) ? NULL : ret;
+    }
+
+#ifdef MAP_HUGETLB
+    /* This only succeeds if the system has a pool of reserved huge pages */
+    void *huge = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(huge != MAP_FAILED)
+        return huge;
+#endif
+
+    /* Transparent huge pages can only back huge page-aligned ranges, 
+     * so over-map and trim the mapping to an aligned boundary */
+    char *base = mmap(NULL, size + HUGE_PAGE_SZ, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED)
+        return NULL;
+
+    char *ret = (char*)ALIGNED((uintptr_t)base, HUGE_PAGE_SZ);
+    size_t head = ret - base;
+    size_t tail = HUGE_PAGE_SZ - head;
+    if(head) {
+        munmap(base, head);
+    }
+    if(tail) {
+        munmap(ret + size, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(ret, size, MADV_HUGEPAGE);
+#endif
+    return ret;
+}
+
+static void large_unmap(void *ptr, size_t size)
+{
+    munmap(ptr, size);
+}
+
+#endif
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void pf_mem_account(enum mem_tag tag, ptrdiff_t delta)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    if(delta == 0)
+        return;
+
+    SDL_AtomicLock(&s_lock);
+    struct tag_counters *ctr = &s_counters[tag];
+    ctr->live += delta;
+    if(delta > 0) {
+        ctr->nallocs++;
+        if(ctr->live > ctr->peak)
+            ctr->peak = ctr->live;
+    }else{
+        ctr->nfrees++;
+    }
+    SDL_AtomicUnlock(&s_lock);
+}
+
+void *pf_tmalloc(enum mem_tag tag, size_t size)
+{
+    return hdr_init(malloc(HDR_SZ + size), tag, size);
+}
+
+void *pf_tcalloc(enum mem_tag tag, size_t n, size_t size)
+{
+    return hdr_init(calloc(1, HDR_SZ + n * size), tag, n * size);
+}
+
+void *pf_trealloc(enum mem_tag tag, void *ptr, size_t size)
+{
+    if(!ptr)
+        return pf_tmalloc(tag, size);
+
+    struct mem_hdr *hdr = (struct mem_hdr*)((char*)ptr - HDR_SZ);
+    size_t old_size = hdr->size;
+    enum mem_tag old_tag = hdr->tag;
+
+    void *ret = realloc(hdr, HDR_SZ + size);
+    if(!ret)
+        return NULL;
+
+    pf_mem_account(old_tag, -((ptrdiff_t)old_size));
+    return hdr_init(ret, tag, size);
+}
+
+void pf_tfree(void *ptr)
+{
+    if(!ptr)
+        return;
+    struct mem_hdr *hdr = (struct mem_hdr*)((char*)ptr - HDR_SZ);
+    pf_mem_account(hdr->tag, -((ptrdiff_t)hdr->size));
+    free(hdr);
+}
+
+void *pf_large_alloc(enum mem_tag tag, size_t size, bool prefault)
+{
+    size_t mapsize = large_size(size);
+    unsigned char *ret = large_map(mapsize);
+    if(!ret)
+        return NULL;
+
+    if(prefault) {
+        for(size_t off = 0; off < size; off += PAGE_SZ) {
+            ((volatile unsigned char*)ret)[off] = 0;
+        }
+    }
+    pf_mem_account(tag, mapsize);
+    return ret;
+}
+
+void pf_large_free(enum mem_tag tag, void *ptr, size_t size)
+{
+    if(!ptr)
+        return;
+    size_t mapsize = large_size(size);
+    large_unmap(ptr, mapsize);
+    pf_mem_account(tag, -(ptrdiff_t)mapsize);
+}
+
+size_t pf_mem_get_stats(struct mem_tag_stats out[MEM_TAG_COUNT])
+{
+    SDL_AtomicLock(&s_lock);
+    for(int i = 0; i < MEM_TAG_COUNT; i++) {
+        const struct tag_counters *ctr = &s_counters[i];
+        out[i] = (struct mem_tag_stats){
+            .name = s_tag_names[i],
+            .live_bytes = ctr->live > 0 ? ctr->live : 0,
+            .peak_bytes = ctr->peak,
+            .nallocs = ctr->nallocs,
+            .nfrees = ctr->nfrees,
+            .tick_allocs = ctr->tick_allocs
+        };
+    }
+    SDL_AtomicUnlock(&s_lock);
+    return MEM_TAG_COUNT;
+}
+
+void pf_mem_tick(void)
+{
+    SDL_AtomicLock(&s_lock);
+    for(int i = 0; i < MEM_TAG_COUNT; i++) {
+        struct tag_counters *ctr = &s_counters[i];
+        ctr->tick_allocs = ctr->nallocs - ctr->nallocs_last_tick;
+        ctr->nallocs_last_tick = ctr->nallocs;
+    }
+    SDL_AtomicUnlock(&s_lock);
+}
+
@@ -34,10 +34,12 @@
  */
 
 #include "public/pf_malloc.h"
+#include "public/khash.h"
 
 #include <stdint.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <limits.h>
 
 /* The maximum number of discrete allocations from 
  * a single slab. */
@@ -78,6 +80,36 @@ struct memheap{
     size_t           nblocks;
 };
 
+#define SL_BITS     (4)
+#define SL_COUNT    (1 << SL_BITS)
+#define FL_COUNT    (32 - SL_BITS + 1)
+#define NIL         (~((uint32_t)0))
+
+KHASH_MAP_INIT_INT(offblk, uint32_t)
+
+struct tlsf_block{
+    size_t   offset;
+    size_t   size;
+    bool     free;
+    uint32_t prev_phys, next_phys; /* Adjacent blocks in the buffer, for coalescing */
+    uint32_t prev_free, next_free; /* Blocks in the same size class bin */
+};
+
+struct tlsf{
+    size_t             size;
+    uint32_t           fl_bitmap;
+    uint32_t           sl_bitmap[FL_COUNT];
+    uint32_t           heads[FL_COUNT][SL_COUNT];
+    struct tlsf_block *blocks;
+    uint32_t           nblocks;
+    uint32_t           capacity;
+    uint32_t           free_records;
+    /* Offset of every allocated block to its' record */
+    khash_t(offblk)   *offset_map;
+    size_t             nused, nfree;
+    size_t             used_bytes, free_bytes;
+};
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -183,61 +215,228 @@ static void heap_coalese_blocks(struct memheap *heap, unsigned ifirst, unsigned
     first->next = post;
 }
 
-static struct memblock *meta_split_block_aligned(struct memheap *heap, unsigned i, 
-                                                 size_t newsize, size_t newalign)
+/* The metadata-only allocator is a TLSF (two-level segregated fit) allocator. 
+ * Free blocks are binned into size classes by the position of the size's most 
+ * significant bit (first level) and the next SL_BITS bits (second level). 
+ * Bitmaps over the non-empty bins let allocation and freeing run in constant 
+ * time, regardless of how fragmented the buffer is. The block records live in 
+ * a growable array, linked by their indices.
+ */
+
+static uint32_t tlsf_fls(size_t val)
 {
-    struct memblock *top = heap->blocks[i]; 
-    newsize = align(newsize, newalign);
+    uint32_t ret = 0;
+    while(val >>= 1)
+        ret++;
+    return ret;
+}
 
-    struct memblock *new = top + 1;
-    new->size = newsize + (top->offset + (top->size - newsize)) % newalign;
-    new->offset = align_down(top->offset + (top->size - newsize), newalign);
-    new->free = false;
-    top->size = new->offset - top->offset;
+static uint32_t tlsf_ffs(uint32_t val)
+{
+    assert(val);
+    uint32_t ret = 0;
+    while(!(val & 0x1)) {
+        val >>= 1;
+        ret++;
+    }
+    return ret;
+}
 
-    /* Re-insert the block we just resized into the heap */
-    heap_remove(heap, i);
-    heap_insert(heap, top);
+static void tlsf_mapping(size_t size, uint32_t *out_fl, uint32_t *out_sl)
+{
+    if(size < (1 << SL_BITS)) {
+        *out_fl = 0;
+        *out_sl = size;
+        return;
+    }
+    uint32_t fl = tlsf_fls(size);
+    *out_sl = (size >> (fl - SL_BITS)) ^ (1 << SL_BITS);
+    *out_fl = fl - SL_BITS + 1;
+}
 
-    new->prev = top;
-    new->next = top->next;
-    top->next = new;
+/* Round the size up to the next bin boundary, such that any block in 
+ * the resulting bin is large enough to hold it. */
+static size_t tlsf_round_up(size_t size)
+{
+    if(size < (1 << SL_BITS))
+        return size;
+    size_t round = (((size_t)1) << (tlsf_fls(size) - SL_BITS)) - 1;
+    return size + round;
+}
 
-    heap_insert(heap, new);
-    return new;
+static uint32_t tlsf_new_record(struct tlsf *tlsf)
+{
+    if(tlsf->free_records != NIL) {
+        uint32_t ret = tlsf->free_records;
+        tlsf->free_records = tlsf->blocks[ret].next_free;
+        return ret;
+    }
+    if(tlsf->nblocks == tlsf->capacity) {
+        uint32_t newcap = tlsf->capacity ? tlsf->capacity * 2 : 64;
+        struct tlsf_block *blocks = realloc(tlsf->blocks, newcap * sizeof(struct tlsf_block));
+        if(!blocks)
+            return NIL;
+        tlsf->blocks = blocks;
+        tlsf->capacity = newcap;
+    }
+    return tlsf->nblocks++;
 }
 
-static void meta_coalese_blocks(struct memheap *heap, unsigned ifirst, unsigned inext)
+static void tlsf_free_record(struct tlsf *tlsf, uint32_t idx)
 {
-    struct memblock *first = heap->blocks[ifirst];
-    struct memblock *next = heap->blocks[inext];
+    tlsf->blocks[idx].next_free = tlsf->free_records;
+    tlsf->free_records = idx;
+}
 
-    struct memblock *pre = first->prev;
-    struct memblock *post = next->next;
+static void tlsf_insert_free(struct tlsf *tlsf, uint32_t idx)
+{
+    struct tlsf_block *block = &tlsf->blocks[idx];
+    uint32_t fl, sl;
+    tlsf_mapping(block->size, &fl, &sl);
+
+    block->free = true;
+    block->prev_free = NIL;
+    block->next_free = tlsf->heads[fl][sl];
+    if(block->next_free != NIL)
+        tlsf->blocks[block->next_free].prev_free = idx;
+    tlsf->heads[fl][sl] = idx;
+
+    tlsf->fl_bitmap |= (1u << fl);
+    tlsf->sl_bitmap[fl] |= (1u << sl);
+    tlsf->nfree++;
+    tlsf->free_bytes += block->size;
+}
 
-    first->size += next->size;
-    heap_remove(heap, inext);
-    first->prev = pre;
-    first->next = post;
+static void tlsf_remove_free(struct tlsf *tlsf, uint32_t idx)
+{
+    struct tlsf_block *block = &tlsf->blocks[idx];
+    assert(block->free);
+    uint32_t fl, sl;
+    tlsf_mapping(block->size, &fl, &sl);
+
+    if(block->prev_free != NIL)
+        tlsf->blocks[block->prev_free].next_free = block->next_free;
+    else
+        tlsf->heads[fl][sl] = block->next_free;
+    if(block->next_free != NIL)
+        tlsf->blocks[block->next_free].prev_free = block->prev_free;
+
+    if(tlsf->heads[fl][sl] == NIL) {
+        tlsf->sl_bitmap[fl] &= ~(1u << sl);
+        if(!tlsf->sl_bitmap[fl])
+            tlsf->fl_bitmap &= ~(1u << fl);
+    }
+    block->free = false;
+    tlsf->nfree--;
+    tlsf->free_bytes -= block->size;
 }
 
-static struct memblock *meta_block_for_offset(struct memheap *heap, size_t offset)
+static uint32_t tlsf_find_free(const struct tlsf *tlsf, size_t size)
 {
-    int low = 1;
-    int high = heap->nblocks;
-    int mid = (low + high) / 2;
+    uint32_t fl, sl;
+    tlsf_mapping(tlsf_round_up(size), &fl, &sl);
+    if(fl >= FL_COUNT)
+        return NIL;
+
+    uint32_t sl_map = tlsf->sl_bitmap[fl] & (~0u << sl);
+    if(!sl_map) {
+        uint32_t fl_map = (fl + 1 < FL_COUNT) ? (tlsf->fl_bitmap & (~0u << (fl + 1))) : 0;
+        if(!fl_map)
+            return NIL;
+        fl = tlsf_ffs(fl_map);
+        sl_map = tlsf->sl_bitmap[fl];
+    }
+    sl = tlsf_ffs(sl_map);
+    return tlsf->heads[fl][sl];
+}
 
-    while(heap->blocks[mid]->offset != offset) {
+/* 'tlsf_find_free' only looks at the bins where every block is large 
+ * enough, skipping the ones between the request's own bin and the rounded 
+ * up one, although some of their blocks may still fit. Notably, a fully 
+ * free buffer sits in one of them for requests close to its' full size. 
+ * Check the blocks of these bins one by one as a last resort. */
+static uint32_t tlsf_find_fit(const struct tlsf *tlsf, size_t alignment, size_t size)
+{
+    uint32_t fl, sl, end_fl, end_sl;
+    tlsf_mapping(size, &fl, &sl);
+    tlsf_mapping(tlsf_round_up(size + alignment - 1), &end_fl, &end_sl);
+    if(end_fl >= FL_COUNT) {
+        end_fl = FL_COUNT;
+        end_sl = 0;
+    }
 
-        if(heap->blocks[mid]->offset > offset) {
-            high = mid - 1;
-        }else{
-            low = mid + 1;
+    for(; fl < FL_COUNT && fl <= end_fl; fl++, sl = 0) {
+        uint32_t sl_map = tlsf->sl_bitmap[fl] & (~0u << sl);
+        if(fl == end_fl)
+            sl_map &= (1u << end_sl) - 1;
+
+        while(sl_map) {
+            uint32_t curr_sl = tlsf_ffs(sl_map);
+            sl_map &= ~(1u << curr_sl);
+
+            uint32_t curr = tlsf->heads[fl][curr_sl];
+            for(; curr != NIL; curr = tlsf->blocks[curr].next_free) {
+                const struct tlsf_block *block = &tlsf->blocks[curr];
+                size_t pad = align(block->offset, alignment) - block->offset;
+                if(block->size >= pad && block->size - pad >= size)
+                    return curr;
+            }
         }
-        mid = (low + high) / 2;
     }
+    return NIL;
+}
 
-    return heap->blocks[mid];
+/* Split off the tail of the block past 'size' into a new free block */
+static bool tlsf_split(struct tlsf *tlsf, uint32_t idx, size_t size)
+{
+    uint32_t rest = tlsf_new_record(tlsf);
+    if(rest == NIL)
+        return false;
+
+    struct tlsf_block *block = &tlsf->blocks[idx];
+    struct tlsf_block *rblock = &tlsf->blocks[rest];
+    rblock->offset = block->offset + size;
+    rblock->size = block->size - size;
+    rblock->prev_phys = idx;
+    rblock->next_phys = block->next_phys;
+    if(block->next_phys != NIL)
+        tlsf->blocks[block->next_phys].prev_phys = rest;
+    block->next_phys = rest;
+    block->size = size;
+
+    tlsf_insert_free(tlsf, rest);
+    return true;
+}
+
+/* Merge the (non-free) block 'next' into its' physical predecessor 'idx' */
+static void tlsf_absorb(struct tlsf *tlsf, uint32_t idx, uint32_t next)
+{
+    struct tlsf_block *block = &tlsf->blocks[idx];
+    struct tlsf_block *nblock = &tlsf->blocks[next];
+    assert(block->next_phys == next);
+
+    block->size += nblock->size;
+    block->next_phys = nblock->next_phys;
+    if(nblock->next_phys != NIL)
+        tlsf->blocks[nblock->next_phys].prev_phys = idx;
+    tlsf_free_record(tlsf, next);
+}
+
+static void tlsf_release(struct tlsf *tlsf, uint32_t idx)
+{
+    uint32_t prev = tlsf->blocks[idx].prev_phys;
+    if(prev != NIL && tlsf->blocks[prev].free) {
+        tlsf_remove_free(tlsf, prev);
+        tlsf_absorb(tlsf, prev, idx);
+        idx = prev;
+    }
+
+    uint32_t next = tlsf->blocks[idx].next_phys;
+    if(next != NIL && tlsf->blocks[next].free) {
+        tlsf_remove_free(tlsf, next);
+        tlsf_absorb(tlsf, idx, next);
+    }
+    tlsf_insert_free(tlsf, idx);
 }
 
 /*****************************************************************************/
@@ -296,83 +495,136 @@ void pf_free(void *slab, void *ptr)
 
 void *pf_metamalloc_init(size_t size)
 {
-    size_t metasize = sizeof(struct memheap) + MAX_HEAP_SZ * sizeof(struct memblock);
-    struct memheap *heap = malloc(metasize);
-    if(!heap)
+    if(size > INT_MAX)
         return NULL;
 
-    struct memblock *head = (struct memblock*)((char*)heap + ALIGNED(sizeof(struct memheap)));
-    head->size = size;
-    head->offset = 0;
-    head->free = true;
-    head->next = NULL;
-    head->prev = NULL;
+    struct tlsf *tlsf = calloc(1, sizeof(struct tlsf));
+    if(!tlsf)
+        return NULL;
 
-    heap->blocks[1] = head;
-    heap->nblocks = 1;
-    return heap;
+    tlsf->offset_map = kh_init(offblk);
+    if(!tlsf->offset_map) {
+        free(tlsf);
+        return NULL;
+    }
+
+    for(int i = 0; i < FL_COUNT; i++) {
+    for(int j = 0; j < SL_COUNT; j++) {
+        tlsf->heads[i][j] = NIL;
+    }}
+    tlsf->free_records = NIL;
+    tlsf->size = size;
+
+    uint32_t head = tlsf_new_record(tlsf);
+    if(head == NIL) {
+        pf_metamalloc_destroy(tlsf);
+        return NULL;
+    }
+    tlsf->blocks[head] = (struct tlsf_block){
+        .offset = 0,
+        .size = size,
+        .prev_phys = NIL,
+        .next_phys = NIL,
+    };
+    tlsf_insert_free(tlsf, head);
+    return tlsf;
 }
 
 void pf_metamalloc_destroy(void *meta)
 {
-    free(meta);
+    struct tlsf *tlsf = meta;
+    kh_destroy(offblk, tlsf->offset_map);
+    free(tlsf->blocks);
+    free(tlsf);
 }
 
 int pf_metamalloc(void *meta, size_t size)
 {
-    struct memheap *heap = (struct memheap*)meta;
-    struct memblock *top = heap->blocks[1];
-
-    if(!top->free || size > top->size || heap->nblocks == MAX_HEAP_SZ) {
-        return -1;
-    }
-
-    if(top->size == size) {
-        top->free = false;
-        return top->offset;
-    }
-
-    return meta_split_block_aligned(heap, 1, size, sizeof(intmax_t))->offset;
+    return pf_metamemalign(meta, sizeof(intmax_t), size);
 }
 
 int pf_metamemalign(void *meta, size_t alignment, size_t size)
 {
-    struct memheap *heap = (struct memheap*)meta;
-    struct memblock *top = heap->blocks[1];
-
-    if(!top->free || heap->nblocks == MAX_HEAP_SZ) {
+    struct tlsf *tlsf = meta;
+    if(size == 0)
+        size = 1;
+    if(alignment == 0)
+        alignment = 1;
+
+    /* Any block of at least this size can hold an aligned allocation */
+    uint32_t idx = tlsf_find_free(tlsf, size + alignment - 1);
+    if(idx == NIL)
+        idx = tlsf_find_fit(tlsf, alignment, size);
+    if(idx == NIL)
         return -1;
+    tlsf_remove_free(tlsf, idx);
+
+    size_t pad = align(tlsf->blocks[idx].offset, alignment) - tlsf->blocks[idx].offset;
+    if(pad > 0) {
+        /* Leave the padding at the front as a free block of its' own */
+        if(!tlsf_split(tlsf, idx, pad)) {
+            tlsf_insert_free(tlsf, idx);
+            return -1;
+        }
+        uint32_t aligned = tlsf->blocks[idx].next_phys;
+        tlsf_remove_free(tlsf, aligned);
+        tlsf_insert_free(tlsf, idx);
+        idx = aligned;
     }
 
-    size_t pad = align(top->offset, alignment) - top->offset;
-    if(top->size + pad < size) {
-        return -1;
+    if(tlsf->blocks[idx].size > size) {
+        /* When out of records, just hand out the whole block */
+        tlsf_split(tlsf, idx, size);
     }
 
-    if(top->size + pad == size) {
-        top->free = false;
-        top->offset += pad;
-        if(top->prev)
-            top->prev->size += pad;
-        return top->offset;
+    int status;
+    khiter_t k = kh_put(offblk, tlsf->offset_map, tlsf->blocks[idx].offset, &status);
+    if(status == -1) {
+        tlsf_release(tlsf, idx);
+        return -1;
     }
-
-    int ret = meta_split_block_aligned(heap, 1, size, alignment)->offset;
-    return ret;
+    kh_val(tlsf->offset_map, k) = idx;
+    tlsf->nused++;
+    tlsf->used_bytes += tlsf->blocks[idx].size;
+    return tlsf->blocks[idx].offset;
 }
 
 void pf_metafree(void *meta, size_t offset)
 {
-    struct memheap *heap = (struct memheap*)meta;
-    struct memblock *mem = meta_block_for_offset(heap, offset);
+    struct tlsf *tlsf = meta;
+    khiter_t k = kh_get(offblk, tlsf->offset_map, offset);
+    assert(k != kh_end(tlsf->offset_map));
+    if(k == kh_end(tlsf->offset_map))
+        return;
+
+    uint32_t idx = kh_val(tlsf->offset_map, k);
+    kh_del(offblk, tlsf->offset_map, k);
+    tlsf->nused--;
+    tlsf->used_bytes -= tlsf->blocks[idx].size;
+    tlsf_release(tlsf, idx);
+}
 
-    if(CAN_COALESE_WITH_NEXT(mem)) {
-        mem->free = true;
-        meta_coalese_blocks(heap, mem->index, mem->next->index);
-    }
-    if(CAN_COALESE_WITH_PREV(mem)) {
-        mem->prev->free = true;
-        meta_coalese_blocks(heap, mem->prev->index, mem->index);
+void pf_metamalloc_stats(void *meta, struct pf_meta_stats *out)
+{
+    struct tlsf *tlsf = meta;
+    out->size = tlsf->size;
+    out->used_bytes = tlsf->used_bytes;
+    out->free_bytes = tlsf->free_bytes;
+    out->nused_blocks = tlsf->nused;
+    out->nfree_blocks = tlsf->nfree;
+
+    /* The largest free block is at the head of the highest non-empty bin, 
+     * give or take the spread of sizes within a single bin. */
+    out->largest_free = 0;
+    if(tlsf->fl_bitmap) {
+        uint32_t fl = tlsf_fls(tlsf->fl_bitmap);
+        uint32_t sl = tlsf_fls(tlsf->sl_bitmap[fl]);
+        for(uint32_t curr = tlsf->heads[fl][sl]; curr != NIL; curr = tlsf->blocks[curr].next_free) {
+            if(tlsf->blocks[curr].size > out->largest_free)
+                out->largest_free = tlsf->blocks[curr].size;
+        }
     }
+    out->fragmentation = !tlsf->free_bytes ? 0.0f
+        : 1.0f - ((float)out->largest_free) / tlsf->free_bytes;
 }
 
@@ -42,6 +42,7 @@
 SDL_RWops  *PFSDL_VectorRWOps(void);
 const char *PFSDL_VectorRWOpsRaw(SDL_RWops *ctx);
 bool        PFSDL_VectorRWOpsReserve(SDL_RWops* ctx, size_t size);
+bool        PFSDL_IsVectorRWOps(const SDL_RWops *ctx);
 
 #endif
 
@@ -0,0 +1,248 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef IPQUEUE_H
+#define IPQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* An indexed min-priority queue. Every element is identified by an integer 
+ * key in the range [0, nkeys), which is typically the index of a tile in a 
+ * grid. The queue holds at most one element per key - pushing a key that is 
+ * already present lowers its' priority instead (a 'decrease-key'), and is 
+ * ignored if the new priority is not lower. This lets label-correcting 
+ * searches update the frontier in place, rather than pushing duplicates or 
+ * scanning for the key.
+ *
+ * The heap is 4-ary, which makes it shallower and more cache-friendly than 
+ * a binary heap for the push-heavy workloads of grid searches.
+ */
+
+#define IPQ_ARITY   (4)
+#define IPQ_NONE    (~((uint32_t)0))
+
+/***********************************************************************************************/
+
+#define IPQUEUE_TYPE(name, type)                                                                \
+                                                                                                \
+    typedef struct ipq_##name##_node_s {                                                        \
+        float    priority;                                                                      \
+        uint32_t key;                                                                           \
+        type     data;                                                                          \
+    } ipq_##name##_node_t;                                                                      \
+                                                                                                \
+    typedef struct ipq_##name##_s {                                                             \
+        ipq_##name##_node_t *nodes;                                                             \
+        size_t               capacity;                                                          \
+        size_t               size;                                                              \
+        /* Heap position of every key, or IPQ_NONE */                                           \
+        uint32_t            *pos;                                                               \
+        size_t               nkeys;                                                             \
+        void *(*prealloc)(void *ptr, size_t size);                                              \
+        void  (*pfree)(void *ptr);                                                              \
+    } ipq_##name##_t;
+
+/***********************************************************************************************/
+
+#define ipq(name)                                                                               \
+    ipq_##name##_t
+
+#define ipq_size(ipq)                                                                           \
+    ((ipq)->size)
+
+/***********************************************************************************************/
+
+#define IPQUEUE_PROTOTYPES(scope, name, type)                                                   \
+                                                                                                \
+    static void _ipq_##name##_sift_up  (ipq(name) *ipq, size_t idx);                            \
+    static void _ipq_##name##_sift_down(ipq(name) *ipq, size_t idx);                            \
+    scope  bool  ipq_##name##_init      (ipq(name) *ipq, size_t nkeys);                         \
+    scope  bool  ipq_##name##_init_alloc(ipq(name) *ipq, size_t nkeys,                          \
+                                         void *(*prealloc)(void *ptr, size_t size),             \
+                                         void (*pfree)(void *ptr));                             \
+    scope  void  ipq_##name##_destroy   (ipq(name) *ipq);                                       \
+    scope  bool  ipq_##name##_push      (ipq(name) *ipq, uint32_t key, float in_prio, type in); \
+    scope  bool  ipq_##name##_pop       (ipq(name) *ipq, type *out);                            \
+    scope  bool  ipq_##name##_contains  (ipq(name) *ipq, uint32_t key);                         \
+    scope  bool  ipq_##name##_top_prio  (ipq(name) *ipq, float *out);                           \
+    scope  void  ipq_##name##_clear     (ipq(name) *ipq);
+
+/***********************************************************************************************/
+
+#define IPQUEUE_IMPL(scope, name, type)                                                         \
+                                                                                                \
+    static void _ipq_##name##_sift_up(ipq(name) *ipq, size_t idx)                               \
+    {                                                                                           \
+        ipq_##name##_node_t node = ipq->nodes[idx];                                             \
+        while(idx > 0) {                                                                        \
+                                                                                                \
+            size_t parent = (idx - 1) / IPQ_ARITY;                                              \
+            if(ipq->nodes[parent].priority <= node.priority)                                    \
+                break;                                                                          \
+            ipq->nodes[idx] = ipq->nodes[parent];                                               \
+            ipq->pos[ipq->nodes[idx].key] = idx;                                                \
+            idx = parent;                                                                       \
+        }                                                                                       \
+        ipq->nodes[idx] = node;                                                                 \
+        ipq->pos[node.key] = idx;                                                               \
+    }                                                                                           \
+                                                                                                \
+    static void _ipq_##name##_sift_down(ipq(name) *ipq, size_t idx)                             \
+    {                                                                                           \
+        ipq_##name##_node_t node = ipq->nodes[idx];                                             \
+        while(true) {                                                                           \
+                                                                                                \
+            size_t first = idx * IPQ_ARITY + 1;                                                 \
+            if(first >= ipq->size)                                                              \
+                break;                                                                          \
+            size_t last = first + IPQ_ARITY;                                                    \
+            if(last > ipq->size)                                                                \
+                last = ipq->size;                                                               \
+                                                                                                \
+            size_t min = first;                                                                 \
+            for(size_t i = first + 1; i < last; i++) {                                          \
+                if(ipq->nodes[i].priority < ipq->nodes[min].priority)                           \
+                    min = i;                                                                    \
+            }                                                                                   \
+            if(ipq->nodes[min].priority >= node.priority)                                       \
+                break;                                                                          \
+            ipq->nodes[idx] = ipq->nodes[min];                                                  \
+            ipq->pos[ipq->nodes[idx].key] = idx;                                                \
+            idx = min;                                                                          \
+        }                                                                                       \
+        ipq->nodes[idx] = node;                                                                 \
+        ipq->pos[node.key] = idx;                                                               \
+    }                                                                                           \
+                                                                                                \
+    scope bool ipq_##name##_init_alloc(ipq(name) *ipq, size_t nkeys,                            \
+                                       void *(*prealloc)(void *ptr, size_t size),               \
+                                       void (*pfree)(void *ptr))                                \
+    {                                                                                           \
+        ipq->nodes = NULL;                                                                      \
+        ipq->capacity = 0;                                                                      \
+        ipq->size = 0;                                                                          \
+        ipq->nkeys = nkeys;                                                                     \
+        ipq->prealloc = prealloc;                                                               \
+        ipq->pfree = pfree;                                                                     \
+        ipq->pos = prealloc(NULL, nkeys * sizeof(uint32_t));                                    \
+        if(!ipq->pos)                                                                           \
+            return false;                                                                       \
+        memset(ipq->pos, 0xff, nkeys * sizeof(uint32_t));                                       \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool ipq_##name##_init(ipq(name) *ipq, size_t nkeys)                                  \
+    {                                                                                           \
+        return ipq_##name##_init_alloc(ipq, nkeys, realloc, free);                              \
+    }                                                                                           \
+                                                                                                \
+    scope void ipq_##name##_destroy(ipq(name) *ipq)                                             \
+    {                                                                                           \
+        ipq->pfree(ipq->nodes);                                                                 \
+        ipq->pfree(ipq->pos);                                                                   \
+        memset(ipq, 0, sizeof(*ipq));                                                           \
+    }                                                                                           \
+                                                                                                \
+    scope bool ipq_##name##_push(ipq(name) *ipq, uint32_t key, float in_prio, type in)          \
+    {                                                                                           \
+        assert(key < ipq->nkeys);                                                               \
+        uint32_t idx = ipq->pos[key];                                                           \
+        if(idx != IPQ_NONE) {                                                                   \
+            if(in_prio >= ipq->nodes[idx].priority)                                             \
+                return true;                                                                    \
+            ipq->nodes[idx].priority = in_prio;                                                 \
+            ipq->nodes[idx].data = in;                                                          \
+            _ipq_##name##_sift_up(ipq, idx);                                                    \
+            return true;                                                                        \
+        }                                                                                       \
+                                                                                                \
+        if(ipq->size == ipq->capacity) {                                                        \
+                                                                                                \
+            size_t newcap = ipq->capacity ? ipq->capacity * 2 : 32;                             \
+            void *nodes = ipq->prealloc(ipq->nodes, newcap * sizeof(ipq_##name##_node_t));      \
+            if(!nodes)                                                                          \
+                return false;                                                                   \
+            ipq->nodes = nodes;                                                                 \
+            ipq->capacity = newcap;                                                             \
+        }                                                                                       \
+                                                                                                \
+        ipq->nodes[ipq->size] = (ipq_##name##_node_t){in_prio, key, in};                        \
+        _ipq_##name##_sift_up(ipq, ipq->size++);                                                \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool ipq_##name##_pop(ipq(name) *ipq, type *out)                                      \
+    {                                                                                           \
+        if(ipq->size == 0)                                                                      \
+            return false;                                                                       \
+                                                                                                \
+        *out = ipq->nodes[0].data;                                                              \
+        ipq->pos[ipq->nodes[0].key] = IPQ_NONE;                                                 \
+        if(--ipq->size > 0) {                                                                   \
+            ipq->nodes[0] = ipq->nodes[ipq->size];                                              \
+            _ipq_##name##_sift_down(ipq, 0);                                                    \
+        }                                                                                       \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool ipq_##name##_contains(ipq(name) *ipq, uint32_t key)                              \
+    {                                                                                           \
+        assert(key < ipq->nkeys);                                                               \
+        return (ipq->pos[key] != IPQ_NONE);                                                     \
+    }                                                                                           \
+                                                                                                \
+    scope bool ipq_##name##_top_prio(ipq(name) *ipq, float *out)                                \
+    {                                                                                           \
+        if(ipq->size == 0)                                                                      \
+            return false;                                                                       \
+        *out = ipq->nodes[0].priority;                                                          \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope void ipq_##name##_clear(ipq(name) *ipq)                                               \
+    {                                                                                           \
+        for(size_t i = 0; i < ipq->size; i++) {                                                 \
+            ipq->pos[ipq->nodes[i].key] = IPQ_NONE;                                             \
+        }                                                                                       \
+        ipq->size = 0;                                                                          \
+    }
+
+#endif
+
@@ -45,12 +45,31 @@
 
 /***********************************************************************************************/
 
+/* LRU_POLICY_LRU keeps the entries strictly ordered by last use, which costs a handful of 
+ * pointer writes on every hit. LRU_POLICY_CLOCK only sets a reference bit on a hit and 
+ * gives referenced entries a second chance at eviction time, approximating LRU order 
+ * for caches which see many more hits than insertions. */
+enum lru_policy{
+    LRU_POLICY_LRU,
+    LRU_POLICY_CLOCK,
+};
+
+struct lru_stats{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+/***********************************************************************************************/
+
 #define LRU_CACHE_TYPE(name, type)                                                              \
                                                                                                 \
     typedef struct lru_##name##_node_s {                                                        \
         mp_ref_t next;                                                                          \
         mp_ref_t prev;                                                                          \
         khint64_t key;                                                                          \
+        size_t cost;                                                                            \
+        bool referenced;                                                                        \
         type entry;                                                                             \
     } lru_##name##_node_t;                                                                      \
                                                                                                 \
@@ -58,14 +77,22 @@
 	__KHASH_TYPE(name, khint64_t, mp_ref_t) 								                    \
                                                                                                 \
     typedef struct lru_##name##_s {                                                             \
-        size_t         capacity;                                                                \
-        size_t         used;                                                                    \
-        mp_ref_t       ilru_head;                                                               \
-        mp_ref_t       ilru_tail;                                                               \
-        khash_t(name) *key_node_table;                                                          \
-        mp(name)       node_pool;                                                               \
+        size_t          capacity;                                                               \
+        size_t          used;                                                                   \
+        mp_ref_t        ilru_head;                                                              \
+        mp_ref_t        ilru_tail;                                                              \
+        khash_t(name)  *key_node_table;                                                         \
+        mp(name)        node_pool;                                                              \
         /* Optional hook to clean up entries' resources before eviction */                      \
-        void           (*on_evict)(type *victim);                                               \
+        void            (*on_evict)(type *victim);                                              \
+        enum lru_policy policy;                                                                 \
+        /* When 'budget' is non-zero, entries are additionally evicted to keep the sum */       \
+        /* of the entries' costs (i.e. their size in bytes) within it */                        \
+        size_t          budget;                                                                 \
+        size_t          used_cost;                                                              \
+        size_t          (*cost)(const type *entry);                                             \
+        /* Hits and misses are counted by 'get' and 'contains' only */                          \
+        struct lru_stats stats;                                                                 \
     } lru_##name##_t;
 
 /***********************************************************************************************/
@@ -98,17 +125,27 @@
     MPOOL_PROTOTYPES(scope, name, lru_node(name))                                               \
 	__KHASH_PROTOTYPES(name, khint64_t, mp_ref_t)                                               \
                                                                                                 \
+    static void _lru_##name##_move_front(lru(name) *lru, mp_ref_t ref);                         \
     static void _lru_##name##_reference(lru(name) *lru, mp_ref_t ref);                          \
+    static void _lru_##name##_evict(lru(name) *lru);                                            \
     scope  bool  lru_##name##_init     (lru(name) *lru, size_t capacity,                        \
                                         void (*on_evict)(type *victim));                        \
     scope  void  lru_##name##_destroy  (lru(name) *lru);                                        \
     scope  void  lru_##name##_clear    (lru(name) *lru);                                        \
+    scope  void  lru_##name##_set_policy(lru(name) *lru, enum lru_policy policy);               \
+    scope  void  lru_##name##_set_budget(lru(name) *lru, size_t budget,                         \
+                                        size_t (*cost)(const type *entry));                     \
     scope  bool  lru_##name##_get      (lru(name) *lru, uint64_t key, type *out);               \
     /* Returned pointer is invalidated when new entries are added; it should not be cached  */  \
     scope  const type *lru_##name##_at (lru(name) *lru, uint64_t key);                          \
     scope  bool  lru_##name##_contains (lru(name) *lru, uint64_t key);                          \
+    /* Like 'at', but does not update the age history. Safe to call concurrently from       */  \
+    /* multiple threads, so long as no thread is modifying the cache at the same time.      */  \
+    scope  const type *lru_##name##_peek(const lru(name) *lru, uint64_t key);                   \
     scope  void  lru_##name##_put      (lru(name) *lru, uint64_t key, const type *in);          \
     scope  bool  lru_##name##_remove   (lru(name) *lru, uint64_t key);                          \
+    scope  void  lru_##name##_get_stats(const lru(name) *lru, struct lru_stats *out);           \
+    scope  void  lru_##name##_clear_stats(lru(name) *lru);
 
 /***********************************************************************************************/
 
@@ -117,7 +154,7 @@
     MPOOL_IMPL(static, name, lru_node(name))                                                    \
     __KHASH_IMPL(name, extern, khint64_t, mp_ref_t, 1, kh_int_hash_func, kh_int_hash_equal)     \
                                                                                                 \
-    static void _lru_##name##_reference(lru(name) *lru, mp_ref_t ref)                           \
+    static void _lru_##name##_move_front(lru(name) *lru, mp_ref_t ref)                          \
     {                                                                                           \
         if(ref == lru->ilru_head)                                                               \
             return;                                                                             \
@@ -149,6 +186,50 @@
         }                                                                                       \
     }                                                                                           \
                                                                                                 \
+    static void _lru_##name##_reference(lru(name) *lru, mp_ref_t ref)                           \
+    {                                                                                           \
+        if(lru->policy == LRU_POLICY_CLOCK) {                                                   \
+            mp_##name##_entry(&lru->node_pool, ref)->referenced = true;                         \
+            return;                                                                             \
+        }                                                                                       \
+        _lru_##name##_move_front(lru, ref);                                                     \
+    }                                                                                           \
+                                                                                                \
+    static void _lru_##name##_evict(lru(name) *lru)                                             \
+    {                                                                                           \
+        assert(lru->used > 0);                                                                  \
+                                                                                                \
+        /* Give the referenced entries at the tail a second chance */                           \
+        if(lru->policy == LRU_POLICY_CLOCK) {                                                   \
+            lru_node(name) *tail;                                                               \
+            while((tail = mp_##name##_entry(&lru->node_pool, lru->ilru_tail))->referenced) {    \
+                tail->referenced = false;                                                       \
+                _lru_##name##_move_front(lru, lru->ilru_tail);                                  \
+            }                                                                                   \
+        }                                                                                       \
+                                                                                                \
+        mp_ref_t ref = lru->ilru_tail;                                                          \
+        lru_node(name) *vict = mp_##name##_entry(&lru->node_pool, ref);                         \
+        if(lru->on_evict) {                                                                     \
+            lru->on_evict(&vict->entry);                                                        \
+        }                                                                                       \
+                                                                                                \
+        /* Remember to delete the victim's key */                                               \
+        khiter_t k = kh_get(name, lru->key_node_table, vict->key);                              \
+        kh_del(name, lru->key_node_table, k);                                                   \
+                                                                                                \
+        lru->ilru_tail = vict->prev;                                                            \
+        if(vict->prev)                                                                          \
+            mp_##name##_entry(&lru->node_pool, vict->prev)->next = 0;                           \
+        else                                                                                    \
+            lru->ilru_head = 0;                                                                 \
+                                                                                                \
+        lru->used_cost -= vict->cost;                                                           \
+        --(lru->used);                                                                          \
+        ++(lru->stats.evictions);                                                               \
+        mp_##name##_free(&lru->node_pool, ref);                                                 \
+    }                                                                                           \
+                                                                                                \
     scope bool lru_##name##_init(lru(name) *lru, size_t capacity,                               \
                                      void (*on_evict)(type *victim))                            \
     {                                                                                           \
@@ -165,6 +246,7 @@
         }                                                                                       \
         lru->capacity = capacity;                                                               \
         lru->on_evict = on_evict;                                                               \
+        lru->policy = LRU_POLICY_LRU;                                                           \
         return true;                                                                            \
     }                                                                                           \
                                                                                                 \
@@ -194,19 +276,36 @@
         lru->ilru_head = 0;                                                                     \
         lru->ilru_tail = 0;                                                                     \
         lru->used = 0;                                                                          \
+        lru->used_cost = 0;                                                                     \
+    }                                                                                           \
+                                                                                                \
+    scope void lru_##name##_set_policy(lru(name) *lru, enum lru_policy policy)                  \
+    {                                                                                           \
+        lru->policy = policy;                                                                   \
+    }                                                                                           \
+                                                                                                \
+    scope void lru_##name##_set_budget(lru(name) *lru, size_t budget,                           \
+                                       size_t (*cost)(const type *entry))                       \
+    {                                                                                           \
+        assert(lru->used == 0);                                                                 \
+        lru->budget = budget;                                                                   \
+        lru->cost = cost;                                                                       \
     }                                                                                           \
                                                                                                 \
     scope bool lru_##name##_get(lru(name) *lru, uint64_t key, type *out)                        \
     {                                                                                           \
         khiter_t k;                                                                             \
-        if((k = kh_get(name, lru->key_node_table, key)) == kh_end(lru->key_node_table))         \
+        if((k = kh_get(name, lru->key_node_table, key)) == kh_end(lru->key_node_table)) {       \
+            ++(lru->stats.misses);                                                              \
             return false;                                                                       \
+        }                                                                                       \
                                                                                                 \
         mp_ref_t ref = kh_val(lru->key_node_table, k);                                          \
         lru_node(name) *mpn = mp_##name##_entry(&lru->node_pool, ref);                          \
                                                                                                 \
         *out = mpn->entry;                                                                      \
         _lru_##name##_reference(lru, ref);                                                      \
+        ++(lru->stats.hits);                                                                    \
         return true;                                                                            \
     }                                                                                           \
                                                                                                 \
@@ -225,57 +324,56 @@
                                                                                                 \
     scope bool lru_##name##_contains(lru(name) *lru, uint64_t key)                              \
     {                                                                                           \
-        return (lru_##name##_at(lru, key) != NULL);                                             \
+        bool ret = (lru_##name##_at(lru, key) != NULL);                                         \
+        if(ret)                                                                                 \
+            ++(lru->stats.hits);                                                                \
+        else                                                                                    \
+            ++(lru->stats.misses);                                                              \
+        return ret;                                                                             \
     }                                                                                           \
                                                                                                 \
-    scope void lru_##name##_put(lru(name) *lru, uint64_t key, const type *in)                   \
+    scope const type *lru_##name##_peek(const lru(name) *lru, uint64_t key)                     \
     {                                                                                           \
         khiter_t k;                                                                             \
-        if((k = kh_get(name, lru->key_node_table, key)) == kh_end(lru->key_node_table)) {       \
-            /* There is no existing entry for this key */                                       \
-                                                                                                \
-            mp_ref_t new_ref = 0;                                                               \
-            lru_node(name) *new_node = NULL;                                                    \
-            if(lru->used == 0) {                                                                \
-                                                                                                \
-                new_ref = mp_##name##_alloc(&lru->node_pool);                                   \
-                new_node = mp_##name##_entry(&lru->node_pool, new_ref);                         \
-                new_node->prev = 0;                                                             \
-                new_node->next = 0;                                                             \
-                lru->ilru_head = lru->ilru_tail = new_ref;                                      \
-                ++(lru->used);                                                                  \
-                                                                                                \
-            }else if(lru->used == lru->capacity) {                                              \
-                                                                                                \
-                lru_node(name) *vict = mp_##name##_entry(&lru->node_pool, lru->ilru_tail);      \
-                if(lru->on_evict) {                                                             \
-                    lru->on_evict(&vict->entry);                                                \
-                }                                                                               \
-                                                                                                \
-                /* Remember to delete the victim's key */                                       \
-                k = kh_get(name, lru->key_node_table, vict->key);                               \
-                kh_del(name, lru->key_node_table, k);                                           \
+        if((k = kh_get(name, lru->key_node_table, key)) == kh_end(lru->key_node_table))         \
+            return NULL;                                                                        \
                                                                                                 \
-                new_ref = lru->ilru_tail;                                                       \
-                new_node = vict;                                                                \
-                _lru_##name##_reference(lru, new_ref);                                          \
+        mp_ref_t ref = kh_val(lru->key_node_table, k);                                          \
+        lru_node(name) *mpn = mp_##name##_entry((mp(name)*)&lru->node_pool, ref);               \
+        return &mpn->entry;                                                                     \
+    }                                                                                           \
                                                                                                 \
-            }else {                                                                             \
+    scope void lru_##name##_put(lru(name) *lru, uint64_t key, const type *in)                   \
+    {                                                                                           \
+        size_t cost = lru->cost ? lru->cost(in) : 0;                                            \
                                                                                                 \
-                new_ref = mp_##name##_alloc(&lru->node_pool);                                   \
-                new_node = mp_##name##_entry(&lru->node_pool, new_ref);                         \
-                lru_node(name) *old_head = mp_##name##_entry(&lru->node_pool, lru->ilru_head);  \
+        khiter_t k;                                                                             \
+        if((k = kh_get(name, lru->key_node_table, key)) == kh_end(lru->key_node_table)) {       \
+            /* There is no existing entry for this key */                                       \
                                                                                                 \
-                new_node->prev = 0;                                                             \
-                new_node->next = lru->ilru_head;                                                \
-                lru->ilru_head = new_ref;                                                       \
-                old_head->prev = new_ref;                                                       \
-                ++(lru->used);                                                                  \
+            while(lru->used == lru->capacity                                                    \
+            || (lru->budget && lru->used > 0 && lru->used_cost + cost > lru->budget)) {         \
+                _lru_##name##_evict(lru);                                                       \
             }                                                                                   \
                                                                                                 \
+            mp_ref_t new_ref = mp_##name##_alloc(&lru->node_pool);                              \
+            lru_node(name) *new_node = mp_##name##_entry(&lru->node_pool, new_ref);             \
             assert(new_ref > 0);                                                                \
+                                                                                                \
+            new_node->prev = 0;                                                                 \
+            new_node->next = lru->ilru_head;                                                    \
+            if(lru->ilru_head)                                                                  \
+                mp_##name##_entry(&lru->node_pool, lru->ilru_head)->prev = new_ref;             \
+            else                                                                                \
+                lru->ilru_tail = new_ref;                                                       \
+            lru->ilru_head = new_ref;                                                           \
+            ++(lru->used);                                                                      \
+                                                                                                \
             new_node->entry = *in;                                                              \
             new_node->key = key;                                                                \
+            new_node->cost = cost;                                                              \
+            new_node->referenced = false;                                                       \
+            lru->used_cost += cost;                                                             \
                                                                                                 \
             int ret;                                                                            \
             k = kh_put(name, lru->key_node_table, key, &ret);                                   \
@@ -291,6 +389,9 @@
                 lru->on_evict(&mpn->entry);                                                     \
             }                                                                                   \
                                                                                                 \
+            lru->used_cost -= mpn->cost;                                                        \
+            lru->used_cost += cost;                                                             \
+            mpn->cost = cost;                                                                   \
             mpn->entry = *in;                                                                   \
             _lru_##name##_reference(lru, ref);                                                  \
         }                                                                                       \
@@ -315,10 +416,21 @@
             lru->ilru_tail = mpn->prev;                                                         \
                                                                                                 \
         --(lru->used);                                                                          \
+        lru->used_cost -= mpn->cost;                                                            \
         kh_del(name, lru->key_node_table, k);                                                   \
         mp_##name##_free(&lru->node_pool, ref);                                                 \
         return true;                                                                            \
     }                                                                                           \
+                                                                                                \
+    scope void lru_##name##_get_stats(const lru(name) *lru, struct lru_stats *out)              \
+    {                                                                                           \
+        *out = lru->stats;                                                                      \
+    }                                                                                           \
+                                                                                                \
+    scope void lru_##name##_clear_stats(lru(name) *lru)                                         \
+    {                                                                                           \
+        memset(&lru->stats, 0, sizeof(lru->stats));                                             \
+    }                                                                                           \
+                                                                                                \
 
 #endif
-
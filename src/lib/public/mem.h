@@ -38,6 +38,8 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #ifdef _MSC_VER
 #include <malloc.h>
@@ -49,6 +51,62 @@
         __VA_ARGS__ = (void*)((uintptr_t)0xDEADBEEF);   \
     }while(0)
 
+/* Tagged memory accounting. Every subsystem that owns a significant 
+ * amount of heap memory reports its allocations against one of these 
+ * tags, so that the live footprint, the high-water mark and the 
+ * allocation rate of each can be inspected at runtime. */
+
+enum mem_tag{
+    MEM_TAG_MISC = 0,
+    MEM_TAG_STALLOC,
+    MEM_TAG_MPOOL,
+    MEM_TAG_FIELD_CACHE,
+    MEM_TAG_FRAME_ARENA,
+    MEM_TAG_TASK_STACKS,
+    MEM_TAG_ANIM,
+    MEM_TAG_NAV,
+    MEM_TAG_GL_MESH,
+    MEM_TAG_GL_BATCH,
+    MEM_TAG_GL_RING,
+    MEM_TAG_COUNT
+};
+
+struct mem_tag_stats{
+    const char *name;
+    uint64_t    live_bytes;
+    uint64_t    peak_bytes;
+    uint64_t    nallocs;
+    uint64_t    nfrees;
+    /* Number of allocations made during the last full tick */
+    uint64_t    tick_allocs;
+};
+
+/* Record a change of 'delta' bytes owned by the subsystem 'tag'. 
+ * Used for memory that is not allocated through the tagged 
+ * wrappers below (i.e. memory pools, GPU buffers). */
+void  pf_mem_account(enum mem_tag tag, ptrdiff_t delta);
+
+/* Drop-in replacements for the standard allocation functions which 
+ * account the allocated size against 'tag'. Memory returned by these 
+ * must only be released with 'pf_tfree'/'pf_trealloc'. */
+void *pf_tmalloc(enum mem_tag tag, size_t size);
+void *pf_tcalloc(enum mem_tag tag, size_t n, size_t size);
+void *pf_trealloc(enum mem_tag tag, void *ptr, size_t size);
+void  pf_tfree(void *ptr);
+
+/* Large blocks (arena memblocks, navigation chunks) are mapped directly 
+ * from the OS. When CONFIG_HUGE_PAGES is set, they will be backed by huge 
+ * pages where the OS allows it, reducing TLB misses in the loops walking 
+ * them. With 'prefault', all the pages are touched up-front so that the 
+ * page faults aren't taken piecemeal by the first user of the memory. 
+ * The same 'size' must be passed when freeing the block. */
+void *pf_large_alloc(enum mem_tag tag, size_t size, bool prefault);
+void  pf_large_free(enum mem_tag tag, void *ptr, size_t size);
+
+size_t pf_mem_get_stats(struct mem_tag_stats out[MEM_TAG_COUNT]);
+/* Latches the per-tick allocation counts. Called once per tick. */
+void  pf_mem_tick(void);
+
 #endif
 
 #ifdef _MSC_VER
@@ -44,6 +44,8 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "mem.h"
+
 /* Hold on to objects by their handles. Unlike pointers, they don't need to be */
 /* invalidated when a realloc takes place. */
 typedef uint32_t mp_ref_t;
@@ -63,6 +65,7 @@ typedef uint32_t mp_ref_t;
         mp_ref_t ifree_head;                                                                    \
         mp_##name##_node_t *pool;                                                               \
         bool can_grow;                                                                          \
+        enum mem_tag tag;                                                                       \
     } mp_##name##_t;                                                                            \
 
 /***********************************************************************************************/
@@ -75,6 +78,8 @@ typedef uint32_t mp_ref_t;
 #define MPOOL_PROTOTYPES(scope, name, type)                                                     \
                                                                                                 \
     scope void     mp_##name##_init   (mp(name) *mp, bool can_grow);                            \
+    /* Account the pool's memory against a specific subsystem (MEM_TAG_MPOOL by default) */     \
+    scope void     mp_##name##_set_tag(mp(name) *mp, enum mem_tag tag);                         \
     scope bool     mp_##name##_reserve(mp(name) *mp, size_t new_cap);                           \
     scope void     mp_##name##_destroy(mp(name) *mp);                                           \
     scope mp_ref_t mp_##name##_alloc  (mp(name) *mp);                                           \
@@ -94,6 +99,17 @@ typedef uint32_t mp_ref_t;
     {                                                                                           \
         memset(mp, 0, sizeof(*mp));                                                             \
         mp->can_grow = can_grow;                                                                \
+        mp->tag = MEM_TAG_MPOOL;                                                                \
+    }                                                                                           \
+                                                                                                \
+    scope void mp_##name##_set_tag(mp(name) *mp, enum mem_tag tag)                              \
+    {                                                                                           \
+        if(mp->pool) {                                                                          \
+            ptrdiff_t size = (mp->capacity + 1) * sizeof(mp_##name##_node_t);                   \
+            pf_mem_account(mp->tag, -size);                                                     \
+            pf_mem_account(tag, size);                                                          \
+        }                                                                                       \
+        mp->tag = tag;                                                                          \
     }                                                                                           \
                                                                                                 \
     scope bool mp_##name##_reserve(mp(name) *mp, size_t new_cap)                                \
@@ -106,6 +122,8 @@ typedef uint32_t mp_ref_t;
             (new_cap + 1) * sizeof(mp_##name##_node_t));                                        \
         if(!new_entry)                                                                          \
             return false;                                                                       \
+        pf_mem_account(mp->tag, (ptrdiff_t)((new_cap - old_cap)                                 \
+            * sizeof(mp_##name##_node_t) + (old_cap ? 0 : sizeof(mp_##name##_node_t))));        \
                                                                                                 \
         for(int i = old_cap + 1; i < new_cap; ++i) {                                            \
             new_entry[i].inext_free = i + 1;                                                    \
@@ -128,6 +146,10 @@ typedef uint32_t mp_ref_t;
                                                                                                 \
     scope void mp_##name##_destroy(mp(name) *mp)                                                \
     {                                                                                           \
+        if(mp->pool) {                                                                          \
+            pf_mem_account(mp->tag,                                                             \
+                -(ptrdiff_t)((mp->capacity + 1) * sizeof(mp_##name##_node_t)));                 \
+        }                                                                                       \
         free(mp->pool);                                                                         \
         memset(mp, 0, sizeof(*mp));                                                             \
     }                                                                                           \
@@ -193,11 +215,13 @@ typedef uint32_t mp_ref_t;
         to->pool = malloc(size);                                                                \
         if(!to->pool)                                                                           \
             return false;                                                                       \
+        pf_mem_account(from->tag, size);                                                        \
         memcpy(to->pool, from->pool, size);                                                     \
         to->capacity = from->capacity;                                                          \
         to->num_allocd = from->num_allocd;                                                      \
         to->ifree_head = from->ifree_head;                                                      \
         to->can_grow = from->can_grow;                                                          \
+        to->tag = from->tag;                                                                    \
         return true;                                                                            \
     }
 
@@ -49,7 +49,21 @@ void  pf_free(void *slab, void *ptr);
 /* Same as above, except the actual memory slab is 
  * stored separately. The allocation simply updates 
  * the block metadata and returns an offset into the 
- * slab buffer, or -1 if the allocation failed. */
+ * slab buffer, or -1 if the allocation failed. Free 
+ * blocks are kept in segregated size classes, so both 
+ * allocating and freeing take constant time. */
+
+struct pf_meta_stats{
+    size_t size;
+    size_t used_bytes;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t nused_blocks;
+    size_t nfree_blocks;
+    /* 0 when all the free space is contiguous, approaching 1 
+     * as it gets split up into many small blocks */
+    float  fragmentation;
+};
 
 void *pf_metamalloc_init(size_t size);
 void  pf_metamalloc_destroy(void *meta);
@@ -57,6 +71,7 @@ int   pf_metamalloc(void *meta, size_t size);
 /* Supports any alignment, not just powers of two */
 int   pf_metamemalign(void *meta, size_t alignment, size_t size);
 void  pf_metafree(void *meta, size_t offset);
+void  pf_metamalloc_stats(void *meta, struct pf_meta_stats *out);
 
 #endif
 
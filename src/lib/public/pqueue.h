@@ -146,7 +146,7 @@
                                                                                                 \
     scope void pq_##name##_destroy(pq(name) *pqueue)                                            \
     {                                                                                           \
-        free(pqueue->nodes);                                                                    \
+        pqueue->pfree(pqueue->nodes);                                                           \
         memset(pqueue, 0, sizeof(*pqueue));                                                     \
     }                                                                                           \
                                                                                                 \
@@ -394,11 +394,11 @@
                                                                                                 \
     static bool _qt_##name##_node_sib_append(qt(name) *qt, mp_ref_t ref, type record)           \
     {                                                                                           \
-        qt_node(name) *node = mp_##name##_entry(&qt->node_pool, ref);                           \
-                                                                                                \
         mp_ref_t sib = mp_##name##_alloc(&qt->node_pool);                                       \
         _CHK_TRUE_RET(sib, false);                                                              \
                                                                                                 \
+        /* The allocation may have moved the pool */                                            \
+        qt_node(name) *node = mp_##name##_entry(&qt->node_pool, ref);                           \
         qt_node(name) *sib_node = mp_##name##_entry(&qt->node_pool, sib);                       \
         _qt_##name##_node_init(sib_node, node->depth);                                          \
         sib_node->x = node->x;                                                                  \
@@ -541,10 +541,18 @@
             _qt_##name##_set_divide_coords(qt, parent, ref);                                    \
         }                                                                                       \
                                                                                                 \
-        _CHK_TRUE_JMP((node->nw = mp_##name##_alloc(&qt->node_pool)), fail);                    \
-        _CHK_TRUE_JMP((node->ne = mp_##name##_alloc(&qt->node_pool)), fail);                    \
-        _CHK_TRUE_JMP((node->sw = mp_##name##_alloc(&qt->node_pool)), fail);                    \
-        _CHK_TRUE_JMP((node->se = mp_##name##_alloc(&qt->node_pool)), fail);                    \
+        mp_ref_t nw = 0, ne = 0, sw = 0, se = 0;                                                \
+        _CHK_TRUE_JMP((nw = mp_##name##_alloc(&qt->node_pool)), fail);                          \
+        _CHK_TRUE_JMP((ne = mp_##name##_alloc(&qt->node_pool)), fail);                          \
+        _CHK_TRUE_JMP((sw = mp_##name##_alloc(&qt->node_pool)), fail);                          \
+        _CHK_TRUE_JMP((se = mp_##name##_alloc(&qt->node_pool)), fail);                          \
+                                                                                                \
+        /* The allocations may have moved the pool */                                           \
+        node = mp_##name##_entry(&qt->node_pool, ref);                                          \
+        node->nw = nw;                                                                          \
+        node->ne = ne;                                                                          \
+        node->sw = sw;                                                                          \
+        node->se = se;                                                                          \
                                                                                                 \
         /* NW node */                                                                           \
         curr = mp_##name##_entry(&qt->node_pool, node->nw);                                     \
@@ -590,10 +598,10 @@
         return true;                                                                            \
                                                                                                 \
     fail:                                                                                       \
-        node->nw ? mp_##name##_free(&qt->node_pool, node->nw), 0 : 0;                           \
-        node->ne ? mp_##name##_free(&qt->node_pool, node->ne), 0 : 0;                           \
-        node->sw ? mp_##name##_free(&qt->node_pool, node->sw), 0 : 0;                           \
-        node->se ? mp_##name##_free(&qt->node_pool, node->se), 0 : 0;                           \
+        nw ? mp_##name##_free(&qt->node_pool, nw), 0 : 0;                                       \
+        ne ? mp_##name##_free(&qt->node_pool, ne), 0 : 0;                                       \
+        sw ? mp_##name##_free(&qt->node_pool, sw), 0 : 0;                                       \
+        se ? mp_##name##_free(&qt->node_pool, se), 0 : 0;                                       \
         return false;                                                                           \
     }                                                                                           \
                                                                                                 \
@@ -800,6 +808,7 @@
         /* existing point and the new point lie in different quadrants */                       \
         do{                                                                                     \
             _CHK_TRUE_RET(_qt_##name##_partition(qt, curr_ref), false);                         \
+            curr_node = mp_##name##_entry(&qt->node_pool, curr_ref);                            \
             assert(!curr_node->has_record);                                                     \
                                                                                                 \
             curr_ref = _qt_##name##_quadrant(curr_node, x, y);                                  \
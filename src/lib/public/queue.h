@@ -53,6 +53,8 @@
         int ihead;                                                                              \
         int itail;                                                                              \
         type *mem;                                                                              \
+        void *(*qrealloc)(void *ptr, size_t size);                                              \
+        void  (*qfree)(void *ptr);                                                              \
     } queue_##name##_t;                                                                         \
 
 /***********************************************************************************************/
@@ -69,6 +71,9 @@
                                                                                                 \
     static bool _queue_##name##_resize  (queue(name) *queue, size_t new_cap);                   \
     scope  bool  queue_##name##_init    (queue(name) *queue, size_t init_cap);                  \
+    scope  bool  queue_##name##_init_alloc(queue(name) *queue, size_t init_cap,                 \
+                                        void *(*qrealloc)(void *ptr, size_t size),              \
+                                        void (*qfree)(void *ptr));                              \
     scope  void  queue_##name##_destroy (queue(name) *queue);                                   \
     scope  bool  queue_##name##_push    (queue(name) *queue, type *entry);                      \
     scope  bool  queue_##name##_pop     (queue(name) *queue, type *out);                        \
@@ -80,7 +85,9 @@
                                                                                                 \
     static bool _queue_##name##_resize(queue(name) *queue, size_t new_cap)                      \
     {                                                                                           \
-        type *new_mem = realloc((void*)queue->mem, sizeof(type) * new_cap);                     \
+        /* A zero-initialized queue uses the default allocator */                               \
+        void *(*qrealloc)(void*, size_t) = queue->qrealloc ? queue->qrealloc : realloc;         \
+        type *new_mem = qrealloc((void*)queue->mem, sizeof(type) * new_cap);                    \
         if(!new_mem)                                                                            \
             return false;                                                                       \
                                                                                                 \
@@ -122,12 +129,26 @@
     {                                                                                           \
         memset(queue, 0, sizeof(*queue));                                                       \
         queue->itail = -1;                                                                      \
+        queue->qrealloc = realloc;                                                              \
+        queue->qfree = free;                                                                    \
+        return _queue_##name##_resize(queue, init_cap);                                         \
+    }                                                                                           \
+                                                                                                \
+    scope bool queue_##name##_init_alloc(queue(name) *queue, size_t init_cap,                   \
+                                         void *(*qrealloc)(void *ptr, size_t size),             \
+                                         void (*qfree)(void *ptr))                              \
+    {                                                                                           \
+        memset(queue, 0, sizeof(*queue));                                                       \
+        queue->itail = -1;                                                                      \
+        queue->qrealloc = qrealloc;                                                             \
+        queue->qfree = qfree;                                                                   \
         return _queue_##name##_resize(queue, init_cap);                                         \
     }                                                                                           \
                                                                                                 \
     scope void queue_##name##_destroy(queue(name) *queue)                                       \
     {                                                                                           \
-        free((void*)queue->mem);                                                                \
+        void (*qfree)(void*) = queue->qfree ? queue->qfree : free;                              \
+        qfree((void*)queue->mem);                                                               \
         memset(queue, 0, sizeof(*queue));                                                       \
     }                                                                                           \
                                                                                                 \
@@ -0,0 +1,415 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef SHASH_H
+#define SHASH_H
+
+#include "khash.h"
+
+#include <SDL_atomic.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* A hash map keyed by 32-bit integers (i.e. entity UIDs) which supports 
+ * lock-free lookups concurrently with modifications.
+ *
+ * The keyspace is split between SHASH_NSHARDS shards, each of which is 
+ * an independent open-addressing table. Writers to the same shard are 
+ * serialized by a per-shard spinlock, so writers to different shards 
+ * don't contend. Every shard additionally has a sequence counter which 
+ * is odd for the duration of a write - readers take no locks, and simply 
+ * retry the lookup when the counter changed underneath them.
+ *
+ * Slot arrays that are replaced when a shard grows may still be in use 
+ * by concurrent readers, so they are retired rather than freed. They are 
+ * released by 'reclaim', which must only be called when there are no 
+ * readers in flight (i.e. at the tick boundary, once the workers are 
+ * joined).
+ *
+ * Freezing the table declares that there will be no more writes until 
+ * it is thawed. Readers of a frozen table skip the sequence validation 
+ * altogether, giving a zero-overhead read-only view for the duration of 
+ * a tick's parallel work.
+ */
+
+#define SHASH_NSHARDS       (16)
+#define SHASH_SHARD_BITS    (4)
+#define SHASH_MIN_SLOTS     (16)
+
+enum{
+    SHASH_SLOT_EMPTY = 0,
+    SHASH_SLOT_FULL,
+    SHASH_SLOT_DELETED,
+};
+
+/***********************************************************************************************/
+
+#define SHASH_TYPE(name, type)                                                                  \
+                                                                                                \
+    typedef struct sh_##name##_slot_s {                                                         \
+        uint32_t key;                                                                           \
+        uint32_t state;                                                                         \
+        type     val;                                                                           \
+    } sh_##name##_slot_t;                                                                       \
+                                                                                                \
+    typedef struct sh_##name##_table_s {                                                        \
+        uint32_t           mask;                                                                \
+        sh_##name##_slot_t slots[];                                                             \
+    } sh_##name##_table_t;                                                                      \
+                                                                                                \
+    typedef struct sh_##name##_shard_s {                                                        \
+        /* Serializes writers */                                                                \
+        SDL_SpinLock          lock;                                                             \
+        /* Odd while the shard is being modified */                                             \
+        SDL_atomic_t          seq;                                                              \
+        /* The current slot array - loaded atomically by readers */                             \
+        void                 *table;                                                            \
+        uint32_t              size;                                                             \
+        uint32_t              used;                                                             \
+        /* Slot arrays replaced by a resize, waiting to be freed */                             \
+        sh_##name##_table_t **retired;                                                          \
+        size_t                nretired;                                                         \
+    } sh_##name##_shard_t;                                                                      \
+                                                                                                \
+    typedef struct sh_##name##_s {                                                              \
+        sh_##name##_shard_t shards[SHASH_NSHARDS];                                              \
+        SDL_atomic_t        frozen;                                                             \
+    } sh_##name##_t;
+
+/***********************************************************************************************/
+
+#define sh(name)                                                                                \
+                                                                                                \
+    sh_##name##_t
+
+#define SHASH_FOREACH(name, _sh, _key, _val, ...)                                               \
+                                                                                                \
+    do{                                                                                         \
+        for(int __s = 0; __s < SHASH_NSHARDS; __s++) {                                          \
+            sh_##name##_table_t *__tbl = (_sh)->shards[__s].table;                              \
+            for(uint32_t __i = 0; __i <= __tbl->mask; __i++) {                                  \
+                if(__tbl->slots[__i].state != SHASH_SLOT_FULL)                                  \
+                    continue;                                                                   \
+                _key = __tbl->slots[__i].key;                                                   \
+                _val = __tbl->slots[__i].val;                                                   \
+                __VA_ARGS__                                                                     \
+            }                                                                                   \
+        }                                                                                       \
+    }while(0)
+
+/***********************************************************************************************/
+
+#define SHASH_PROTOTYPES(scope, name, type)                                                     \
+                                                                                                \
+    scope bool   sh_##name##_init   (sh(name) *sh);                                             \
+    scope void   sh_##name##_destroy(sh(name) *sh);                                             \
+    scope void   sh_##name##_clear  (sh(name) *sh);                                             \
+    /* Safe to call from any thread, concurrently with writers */                               \
+    scope bool   sh_##name##_get    (const sh(name) *sh, uint32_t key, type *out);              \
+    scope bool   sh_##name##_contains(const sh(name) *sh, uint32_t key);                        \
+    scope size_t sh_##name##_size   (const sh(name) *sh);                                       \
+    /* Insert or overwrite. Writers to different shards proceed in parallel */                  \
+    scope bool   sh_##name##_put    (sh(name) *sh, uint32_t key, type val);                     \
+    scope bool   sh_##name##_del    (sh(name) *sh, uint32_t key);                               \
+    /* Free the slot arrays retired by resizing. No readers may be in flight */                 \
+    scope void   sh_##name##_reclaim(sh(name) *sh);                                             \
+    scope void   sh_##name##_freeze (sh(name) *sh);                                             \
+    scope void   sh_##name##_thaw   (sh(name) *sh);
+
+/***********************************************************************************************/
+
+#define SHASH_IMPL(scope, name, type)                                                           \
+                                                                                                \
+    static uint32_t _sh_##name##_hash(uint32_t key)                                             \
+    {                                                                                           \
+        return __ac_Wang_hash(key);                                                             \
+    }                                                                                           \
+                                                                                                \
+    static sh_##name##_table_t *_sh_##name##_table_new(uint32_t nslots)                         \
+    {                                                                                           \
+        assert((nslots & (nslots - 1)) == 0);                                                   \
+        sh_##name##_table_t *ret = calloc(1, sizeof(sh_##name##_table_t)                        \
+                                           + nslots * sizeof(sh_##name##_slot_t));              \
+        if(!ret)                                                                                \
+            return NULL;                                                                        \
+        ret->mask = nslots - 1;                                                                 \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    static sh_##name##_shard_t *_sh_##name##_shard(sh(name) *sh, uint32_t hash)                 \
+    {                                                                                           \
+        return &sh->shards[hash >> (32 - SHASH_SHARD_BITS)];                                    \
+    }                                                                                           \
+                                                                                                \
+    static void _sh_##name##_write_begin(sh_##name##_shard_t *shard)                            \
+    {                                                                                           \
+        SDL_AtomicLock(&shard->lock);                                                           \
+        SDL_AtomicIncRef(&shard->seq);                                                          \
+    }                                                                                           \
+                                                                                                \
+    static void _sh_##name##_write_end(sh_##name##_shard_t *shard)                              \
+    {                                                                                           \
+        SDL_AtomicIncRef(&shard->seq);                                                          \
+        SDL_AtomicUnlock(&shard->lock);                                                         \
+    }                                                                                           \
+                                                                                                \
+    /* Returns the index of the key's slot, or -1 */                                            \
+    static int64_t _sh_##name##_find(const sh_##name##_table_t *tbl,                            \
+                                     uint32_t hash, uint32_t key)                               \
+    {                                                                                           \
+        uint32_t idx = hash & tbl->mask;                                                        \
+        /* The probe is bounded so that a reader racing with a writer */                        \
+        /* can never spin forever on a torn view of the table. */                               \
+        for(uint32_t i = 0; i <= tbl->mask; i++) {                                              \
+            const sh_##name##_slot_t *slot = &tbl->slots[idx];                                  \
+            if(slot->state == SHASH_SLOT_EMPTY)                                                 \
+                return -1;                                                                      \
+            if(slot->state == SHASH_SLOT_FULL && slot->key == key)                              \
+                return idx;                                                                     \
+            idx = (idx + 1) & tbl->mask;                                                        \
+        }                                                                                       \
+        return -1;                                                                              \
+    }                                                                                           \
+                                                                                                \
+    static void _sh_##name##_insert_new(sh_##name##_table_t *tbl, uint32_t hash,                \
+                                        uint32_t key, type val)                                 \
+    {                                                                                           \
+        uint32_t idx = hash & tbl->mask;                                                        \
+        while(tbl->slots[idx].state == SHASH_SLOT_FULL)                                         \
+            idx = (idx + 1) & tbl->mask;                                                        \
+        tbl->slots[idx].key = key;                                                              \
+        tbl->slots[idx].val = val;                                                              \
+        SDL_CompilerBarrier();                                                                  \
+        tbl->slots[idx].state = SHASH_SLOT_FULL;                                                \
+    }                                                                                           \
+                                                                                                \
+    static bool _sh_##name##_grow(sh_##name##_shard_t *shard)                                   \
+    {                                                                                           \
+        sh_##name##_table_t *old = shard->table;                                                \
+        uint32_t nslots = old->mask + 1;                                                        \
+        while((shard->size + 1) * 2 > nslots)                                                   \
+            nslots *= 2;                                                                        \
+                                                                                                \
+        sh_##name##_table_t **retired = realloc(shard->retired,                                 \
+            sizeof(sh_##name##_table_t*) * (shard->nretired + 1));                              \
+        if(!retired)                                                                            \
+            return false;                                                                       \
+        shard->retired = retired;                                                               \
+                                                                                                \
+        sh_##name##_table_t *tbl = _sh_##name##_table_new(nslots);                              \
+        if(!tbl)                                                                                \
+            return false;                                                                       \
+                                                                                                \
+        for(uint32_t i = 0; i <= old->mask; i++) {                                              \
+            const sh_##name##_slot_t *slot = &old->slots[i];                                    \
+            if(slot->state != SHASH_SLOT_FULL)                                                  \
+                continue;                                                                       \
+            _sh_##name##_insert_new(tbl, _sh_##name##_hash(slot->key), slot->key, slot->val);   \
+        }                                                                                       \
+                                                                                                \
+        SDL_AtomicSetPtr(&shard->table, tbl);                                                   \
+        shard->retired[shard->nretired++] = old;                                                \
+        shard->used = shard->size;                                                              \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool sh_##name##_init(sh(name) *sh)                                                   \
+    {                                                                                           \
+        memset(sh, 0, sizeof(*sh));                                                             \
+        for(int i = 0; i < SHASH_NSHARDS; i++) {                                                \
+            sh->shards[i].table = _sh_##name##_table_new(SHASH_MIN_SLOTS);                      \
+            if(!sh->shards[i].table) {                                                          \
+                for(--i; i >= 0; i--)                                                           \
+                    free(sh->shards[i].table);                                                  \
+                return false;                                                                   \
+            }                                                                                   \
+        }                                                                                       \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope void sh_##name##_destroy(sh(name) *sh)                                                \
+    {                                                                                           \
+        sh_##name##_reclaim(sh);                                                                \
+        for(int i = 0; i < SHASH_NSHARDS; i++) {                                                \
+            free(sh->shards[i].table);                                                          \
+            free(sh->shards[i].retired);                                                        \
+        }                                                                                       \
+        memset(sh, 0, sizeof(*sh));                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope void sh_##name##_clear(sh(name) *sh)                                                  \
+    {                                                                                           \
+        assert(!SDL_AtomicGet(&sh->frozen));                                                    \
+        for(int i = 0; i < SHASH_NSHARDS; i++) {                                                \
+            sh_##name##_shard_t *shard = &sh->shards[i];                                        \
+            _sh_##name##_write_begin(shard);                                                    \
+            sh_##name##_table_t *tbl = shard->table;                                            \
+            for(uint32_t j = 0; j <= tbl->mask; j++)                                            \
+                tbl->slots[j].state = SHASH_SLOT_EMPTY;                                         \
+            shard->size = 0;                                                                    \
+            shard->used = 0;                                                                    \
+            _sh_##name##_write_end(shard);                                                      \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    scope bool sh_##name##_get(const sh(name) *sh, uint32_t key, type *out)                     \
+    {                                                                                           \
+        uint32_t hash = _sh_##name##_hash(key);                                                 \
+        sh_##name##_shard_t *shard = _sh_##name##_shard((sh(name)*)sh, hash);                   \
+                                                                                                \
+        if(SDL_AtomicGet((SDL_atomic_t*)&sh->frozen)) {                                         \
+            const sh_##name##_table_t *tbl = shard->table;                                      \
+            int64_t idx = _sh_##name##_find(tbl, hash, key);                                    \
+            if(idx < 0)                                                                         \
+                return false;                                                                   \
+            *out = tbl->slots[idx].val;                                                         \
+            return true;                                                                        \
+        }                                                                                       \
+                                                                                                \
+        while(true) {                                                                           \
+            int seq = SDL_AtomicGet(&shard->seq);                                               \
+            if(seq & 0x1)                                                                       \
+                continue;                                                                       \
+                                                                                                \
+            const sh_##name##_table_t *tbl = SDL_AtomicGetPtr(&shard->table);                   \
+            int64_t idx = _sh_##name##_find(tbl, hash, key);                                    \
+            type val;                                                                           \
+            if(idx >= 0)                                                                        \
+                val = tbl->slots[idx].val;                                                      \
+                                                                                                \
+            SDL_MemoryBarrierAcquire();                                                         \
+            if(SDL_AtomicGet(&shard->seq) != seq)                                               \
+                continue;                                                                       \
+            if(idx < 0)                                                                         \
+                return false;                                                                   \
+            *out = val;                                                                         \
+            return true;                                                                        \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    scope bool sh_##name##_contains(const sh(name) *sh, uint32_t key)                           \
+    {                                                                                           \
+        type dummy;                                                                             \
+        return sh_##name##_get(sh, key, &dummy);                                                \
+    }                                                                                           \
+                                                                                                \
+    scope size_t sh_##name##_size(const sh(name) *sh)                                           \
+    {                                                                                           \
+        size_t ret = 0;                                                                         \
+        for(int i = 0; i < SHASH_NSHARDS; i++)                                                  \
+            ret += sh->shards[i].size;                                                          \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope bool sh_##name##_put(sh(name) *sh, uint32_t key, type val)                            \
+    {                                                                                           \
+        assert(!SDL_AtomicGet(&sh->frozen));                                                    \
+        uint32_t hash = _sh_##name##_hash(key);                                                 \
+        sh_##name##_shard_t *shard = _sh_##name##_shard(sh, hash);                              \
+        bool ret = true;                                                                        \
+                                                                                                \
+        _sh_##name##_write_begin(shard);                                                        \
+        sh_##name##_table_t *tbl = shard->table;                                                \
+        int64_t idx = _sh_##name##_find(tbl, hash, key);                                        \
+        if(idx >= 0) {                                                                          \
+            tbl->slots[idx].val = val;                                                          \
+            goto out;                                                                           \
+        }                                                                                       \
+                                                                                                \
+        if((shard->used + 1) * 4 > (tbl->mask + 1) * 3) {                                       \
+            if(!_sh_##name##_grow(shard)) {                                                     \
+                ret = false;                                                                    \
+                goto out;                                                                       \
+            }                                                                                   \
+            tbl = shard->table;                                                                 \
+        }                                                                                       \
+                                                                                                \
+        uint32_t slot = hash & tbl->mask;                                                       \
+        while(tbl->slots[slot].state == SHASH_SLOT_FULL)                                        \
+            slot = (slot + 1) & tbl->mask;                                                      \
+        if(tbl->slots[slot].state == SHASH_SLOT_EMPTY)                                          \
+            shard->used++;                                                                      \
+        _sh_##name##_insert_new(tbl, hash, key, val);                                           \
+        shard->size++;                                                                          \
+    out:                                                                                        \
+        _sh_##name##_write_end(shard);                                                          \
+        return ret;                                                                             \
+    }                                                                                           \
+                                                                                                \
+    scope bool sh_##name##_del(sh(name) *sh, uint32_t key)                                      \
+    {                                                                                           \
+        assert(!SDL_AtomicGet(&sh->frozen));                                                    \
+        uint32_t hash = _sh_##name##_hash(key);                                                 \
+        sh_##name##_shard_t *shard = _sh_##name##_shard(sh, hash);                              \
+                                                                                                \
+        _sh_##name##_write_begin(shard);                                                        \
+        sh_##name##_table_t *tbl = shard->table;                                                \
+        int64_t idx = _sh_##name##_find(tbl, hash, key);                                        \
+        if(idx >= 0) {                                                                          \
+            tbl->slots[idx].state = SHASH_SLOT_DELETED;                                         \
+            shard->size--;                                                                      \
+        }                                                                                       \
+        _sh_##name##_write_end(shard);                                                          \
+        return (idx >= 0);                                                                      \
+    }                                                                                           \
+                                                                                                \
+    scope void sh_##name##_reclaim(sh(name) *sh)                                                \
+    {                                                                                           \
+        for(int i = 0; i < SHASH_NSHARDS; i++) {                                                \
+            sh_##name##_shard_t *shard = &sh->shards[i];                                        \
+            SDL_AtomicLock(&shard->lock);                                                       \
+            for(size_t j = 0; j < shard->nretired; j++)                                         \
+                free(shard->retired[j]);                                                        \
+            shard->nretired = 0;                                                                \
+            SDL_AtomicUnlock(&shard->lock);                                                     \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    scope void sh_##name##_freeze(sh(name) *sh)                                                 \
+    {                                                                                           \
+        SDL_AtomicSet(&sh->frozen, 1);                                                          \
+    }                                                                                           \
+                                                                                                \
+    scope void sh_##name##_thaw(sh(name) *sh)                                                   \
+    {                                                                                           \
+        SDL_AtomicSet(&sh->frozen, 0);                                                          \
+    }
+
+#endif
+
@@ -0,0 +1,130 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2019-2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+
+/* A minimal vector abstraction over 4-wide float operations, for code which 
+ * processes VW elements at once where SSE2 or NEON are available. Without 
+ * either, it falls back to plain scalar operations with a width of 1.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define VW                  (4)
+typedef __m128              vfloat_t;
+typedef __m128              vmask_t;
+#define V_LOAD(p)           _mm_loadu_ps(p)
+#define V_STORE(p, v)       _mm_storeu_ps((p), (v))
+#define V_SET1(x)           _mm_set1_ps(x)
+#define V_ADD(a, b)         _mm_add_ps((a), (b))
+#define V_SUB(a, b)         _mm_sub_ps((a), (b))
+#define V_MUL(a, b)         _mm_mul_ps((a), (b))
+#define V_MIN(a, b)         _mm_min_ps((a), (b))
+#define V_LT(a, b)          _mm_cmplt_ps((a), (b))
+#define V_GT(a, b)          _mm_cmpgt_ps((a), (b))
+#define V_EQ(a, b)          _mm_cmpeq_ps((a), (b))
+#define V_SELECT(m, a, b)   _mm_or_ps(_mm_and_ps((m), (a)), _mm_andnot_ps((m), (b)))
+#define VM_NONE()           _mm_setzero_ps()
+#define VM_AND(a, b)        _mm_and_ps((a), (b))
+#define VM_OR(a, b)         _mm_or_ps((a), (b))
+#define VM_ANY(m)           (_mm_movemask_ps(m) != 0)
+#define VM_ALL(m)           (_mm_movemask_ps(m) == 0xf)
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#define VW                  (4)
+typedef float32x4_t         vfloat_t;
+typedef uint32x4_t          vmask_t;
+#define V_LOAD(p)           vld1q_f32(p)
+#define V_STORE(p, v)       vst1q_f32((p), (v))
+#define V_SET1(x)           vdupq_n_f32(x)
+#define V_ADD(a, b)         vaddq_f32((a), (b))
+#define V_SUB(a, b)         vsubq_f32((a), (b))
+#define V_MUL(a, b)         vmulq_f32((a), (b))
+#define V_MIN(a, b)         vminq_f32((a), (b))
+#define V_LT(a, b)          vcltq_f32((a), (b))
+#define V_GT(a, b)          vcgtq_f32((a), (b))
+#define V_EQ(a, b)          vceqq_f32((a), (b))
+#define V_SELECT(m, a, b)   vbslq_f32((m), (a), (b))
+#define VM_NONE()           vdupq_n_u32(0)
+#define VM_AND(a, b)        vandq_u32((a), (b))
+#define VM_OR(a, b)         vorrq_u32((a), (b))
+#define VM_ANY(m)           vm_any(m)
+#define VM_ALL(m)           vm_all(m)
+
+static inline bool vm_any(uint32x4_t m)
+{
+    uint32x2_t half = vorr_u32(vget_low_u32(m), vget_high_u32(m));
+    return (vget_lane_u32(half, 0) | vget_lane_u32(half, 1)) != 0;
+}
+
+static inline bool vm_all(uint32x4_t m)
+{
+    uint32x2_t half = vand_u32(vget_low_u32(m), vget_high_u32(m));
+    return (vget_lane_u32(half, 0) & vget_lane_u32(half, 1)) != 0;
+}
+
+#else
+
+#define VW                  (1)
+typedef float               vfloat_t;
+typedef bool                vmask_t;
+#define V_LOAD(p)           (*(p))
+#define V_STORE(p, v)       (*(p) = (v))
+#define V_SET1(x)           ((float)(x))
+#define V_ADD(a, b)         ((a) + (b))
+#define V_SUB(a, b)         ((a) - (b))
+#define V_MUL(a, b)         ((a) * (b))
+#define V_MIN(a, b)         ((a) < (b) ? (a) : (b))
+#define V_LT(a, b)          ((a) < (b))
+#define V_GT(a, b)          ((a) > (b))
+#define V_EQ(a, b)          ((a) == (b))
+#define V_SELECT(m, a, b)   ((m) ? (a) : (b))
+#define VM_NONE()           (false)
+#define VM_AND(a, b)        ((a) && (b))
+#define VM_OR(a, b)         ((a) || (b))
+#define VM_ANY(m)           (m)
+#define VM_ALL(m)           (m)
+
+#endif
+
+#endif
+
@@ -51,6 +51,8 @@
  * another one is allocated from the OS and appended to it. The purpose is to 
  * allow arbitrary many allocations without needing to invalidate pointers to
  * prior allocations, which would be required with a 'realloc'-based approach. 
+ * The memblocks are mapped with 'pf_large_alloc' (possibly huge pages) and 
+ * are kept across clears for as long as they keep getting used.
  *
  * The allocations cannot be freed in arbitrary order. The API provides only a
  * means to clear all the allocations at once. Hence, this allocator is good 
@@ -74,6 +76,9 @@ void  stalloc_destroy(struct memstack *st);
 
 void *stalloc(struct memstack *st, size_t size);
 void  stalloc_clear(struct memstack *st);
+/* The number of bytes handed out since the last clear, including the 
+ * alignment padding and the unused tails of the exhausted memblocks */
+size_t stalloc_used(const struct memstack *st);
 
 /* The smemstack is just like the memstack, except that the first 'STATIC_BUFF_SZ' 
  * bytes of allocations will be from the local 'mem' buffer, which can be declared 
@@ -36,25 +36,32 @@
 #ifndef STRING_INTERN_H
 #define STRING_INTERN_H
 
-#include "mpool.h"
-#include "khash.h"
-
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
-#ifndef STRBUFF_SZ
-#define STRBUFF_SZ (256)
-#endif
+/* A single global table of interned strings. Interning the same string 
+ * always yields the same pointer and the same non-zero 32-bit ID, so 
+ * interned strings can be compared by either. Strings are never removed 
+ * for the lifetime of the engine.
+ *
+ * All functions other than init/shutdown are safe to call from any thread. 
+ * Looking up a string which is already interned does not take any locks.
+ */
 
-typedef char strbuff_t[STRBUFF_SZ];
+typedef uint32_t si_id_t;
 
-MPOOL_TYPE(strbuff, strbuff_t)
-__KHASH_TYPE(stridx, khint32_t, mp_ref_t)
+#define SI_ID_NONE (0)
 
-bool        si_init(mp_strbuff_t *pool, khash_t(stridx) **index, size_t size);
-const char *si_intern(const char *str, mp_strbuff_t *pool, khash_t(stridx) *index);
-void        si_shutdown(mp_strbuff_t *pool, khash_t(stridx) *index);
-void        si_clear(mp_strbuff_t *pool, khash_t(stridx) *index);
+bool        si_init(void);
+void        si_shutdown(void);
+/* Returns NULL on failure. 'out_id' may be NULL */
+const char *si_intern(const char *str, si_id_t *out_id);
+si_id_t     si_intern_id(const char *str);
+/* Returns SI_ID_NONE if the string has not been interned */
+si_id_t     si_lookup(const char *str);
+const char *si_str(si_id_t id);
+size_t      si_count(void);
 
 #endif
 
@@ -0,0 +1,95 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "vec.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define TW_SLOT_BITS (6)
+#define TW_SLOTS     (1 << TW_SLOT_BITS)
+#define TW_LEVELS    (4)
+
+/* The timer wheel keeps timers bucketed by their expiry time, with a 
+ * resolution of one millisecond. The first level holds the timers that 
+ * expire within the next TW_SLOTS milliseconds, one slot per millisecond. 
+ * Every subsequent level covers TW_SLOTS times the span of the previous 
+ * one. As time advances, the slots of the coarser levels are re-distributed 
+ * ('cascaded') into the finer ones, so that every timer is touched at most 
+ * once per level. Adding a timer is O(1) and advancing is proportional to 
+ * the elapsed time plus the number of timers that are due, independent of 
+ * the total number of pending timers. Stretches of time where the finer levels 
+ * are empty are skipped over entirely.
+ *
+ * Timers further out than the span of the wheel (~4.6 hours) are kept in 
+ * the last slot of the coarsest level and get re-inserted until they are 
+ * in range.
+ */
+
+struct tw_timer{
+    uint64_t expiry;
+    uint64_t data;
+};
+
+VEC_TYPE(tw_timer, struct tw_timer)
+
+struct twheel{
+    uint64_t       now;
+    size_t         ntimers;
+    size_t         nlevel[TW_LEVELS];
+    vec_tw_timer_t slots[TW_LEVELS][TW_SLOTS];
+};
+
+typedef void (*tw_expire_t)(uint64_t data, void *arg);
+
+void   twheel_init(struct twheel *tw, uint64_t now);
+void   twheel_destroy(struct twheel *tw);
+
+bool   twheel_add(struct twheel *tw, uint64_t expiry, uint64_t data);
+/* Invoke 'on_expire' for every timer with an expiry time up to and including 
+ * 'now'. Timers may be added from within the callback. Returns the number of 
+ * timers fired. */
+size_t twheel_advance(struct twheel *tw, uint64_t now, tw_expire_t on_expire, void *arg);
+void   twheel_clear(struct twheel *tw, uint64_t now);
+size_t twheel_size(const struct twheel *tw);
+
+#endif
+
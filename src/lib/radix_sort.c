@@ -0,0 +1,91 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2019-2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "public/radix_sort.h"
+
+#include <string.h>
+
+#define NDIGITS (sizeof(uint64_t))
+#define RADIX   (256)
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void pf_radix_sort_idx(const uint64_t *keys, uint32_t *inout_idx, uint32_t *scratch, size_t n)
+{
+    if(n < 2)
+        return;
+
+    /* Count all the digits up front, in a single pass over the keys */
+    size_t hist[NDIGITS][RADIX] = {0};
+    for(size_t i = 0; i < n; i++) {
+        uint64_t key = keys[inout_idx[i]];
+        for(int d = 0; d < NDIGITS; d++) {
+            hist[d][(key >> (d * 8)) & 0xff]++;
+        }
+    }
+
+    uint32_t *src = inout_idx;
+    uint32_t *dst = scratch;
+
+    for(int d = 0; d < NDIGITS; d++) {
+
+        uint64_t digit = (keys[src[0]] >> (d * 8)) & 0xff;
+        if(hist[d][digit] == n)
+            continue;
+
+        size_t offsets[RADIX];
+        size_t sum = 0;
+        for(int i = 0; i < RADIX; i++) {
+            offsets[i] = sum;
+            sum += hist[d][i];
+        }
+
+        for(size_t i = 0; i < n; i++) {
+            uint32_t idx = src[i];
+            dst[offsets[(keys[idx] >> (d * 8)) & 0xff]++] = idx;
+        }
+
+        uint32_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if(src != inout_idx) {
+        memcpy(inout_idx, src, n * sizeof(uint32_t));
+    }
+}
+
@@ -34,6 +34,7 @@
  */
 
 #include "public/stalloc.h"
+#include "public/mem.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -46,7 +47,7 @@
 
 bool stalloc_init(struct memstack *st)
 {
-    st->head = malloc(sizeof(struct st_mem));
+    st->head = pf_large_alloc(MEM_TAG_STALLOC, sizeof(struct st_mem), false);
     if(!st->head)
         return false;
 
@@ -61,7 +62,7 @@ void stalloc_destroy(struct memstack *st)
     struct st_mem *curr = st->head, *tmp;
     while(curr) {
         tmp = curr->next;
-        free(curr);
+        pf_large_free(MEM_TAG_STALLOC, curr, sizeof(struct st_mem));
         curr = tmp;
     }
     memset(st, 0, sizeof(*st));
@@ -90,12 +91,14 @@ void *stalloc(struct memstack *st, size_t size)
         return ret;
     }
 
-    st->tail->next = malloc(sizeof(struct st_mem));
-    if(!st->tail->next)
-        return NULL;
-
+    /* Re-use a memblock retained from the previous cycle, if there is one */
+    if(!st->tail->next) {
+        st->tail->next = pf_large_alloc(MEM_TAG_STALLOC, sizeof(struct st_mem), true);
+        if(!st->tail->next)
+            return NULL;
+        st->tail->next->next = NULL;
+    }
     st->tail = st->tail->next;
-    st->tail->next = NULL;
 
     void *ret = st->tail->raw;
     st->top = st->tail->raw + aligned_size;
@@ -107,19 +110,31 @@ void *stalloc(struct memstack *st, size_t size)
 
 void stalloc_clear(struct memstack *st)
 {
-    /* Don't free the very first memblock */
-    struct st_mem *curr = st->head->next, *tmp;
+    /* Hold on to the memblocks that were used since the last clear, 
+     * so that the next cycle with a similar amount of allocations 
+     * doesn't go back to the OS and fault in fresh pages. Only the 
+     * ones which went unused for an entire cycle are released. */
+    struct st_mem *curr = st->tail->next, *tmp;
     while(curr) {
         tmp = curr->next;
-        free(curr);
+        pf_large_free(MEM_TAG_STALLOC, curr, sizeof(struct st_mem));
         curr = tmp;
     }
 
-    st->head->next = NULL;
+    st->tail->next = NULL;
     st->top = st->head->raw;
     st->tail = st->head;
 }
 
+size_t stalloc_used(const struct memstack *st)
+{
+    size_t ret = 0;
+    for(const struct st_mem *curr = st->head; curr != st->tail; curr = curr->next) {
+        ret += MEMBLOCK_SZ;
+    }
+    return ret + ((unsigned char*)st->top - st->tail->raw);
+}
+
 bool sstalloc_init(struct smemstack *st)
 {
     st->top = st->mem;
@@ -129,7 +144,7 @@ bool sstalloc_init(struct smemstack *st)
 
 void sstalloc_destroy(struct smemstack *st)
 {
-    if(st->top)
+    if(!st->extra.head)
         return;
     stalloc_destroy(&st->extra);
 }
@@ -154,7 +169,7 @@ void *sstalloc(struct smemstack *st, size_t size)
         return ret;
     }
 
-    if(!stalloc_init(&st->extra))
+    if(!st->extra.head && !stalloc_init(&st->extra))
         return NULL;
 
     st->top = NULL;
@@ -163,8 +178,8 @@ void *sstalloc(struct smemstack *st, size_t size)
 
 void sstalloc_clear(struct smemstack *st)
 {
-    if(!st->top)
-        stalloc_destroy(&st->extra);
+    if(st->extra.head)
+        stalloc_clear(&st->extra);
     st->top = st->mem;
 }
 
@@ -34,83 +34,254 @@
  */
 
 #include "public/string_intern.h"
-#include "public/pf_string.h"
+#include "public/khash.h"
 
+#include <SDL_atomic.h>
+
+#include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+
+#define CHUNK_SZ        (64 * 1024)
+#define ENTRY_CHUNK_SZ  (4096)
+#define MAX_ENTRY_CHUNKS (1024)
+#define MIN_SLOTS       (1024)
+
+/* The interned strings are appended to a list of fixed-size chunks, which 
+ * are never moved or freed until shutdown, so the returned pointers are 
+ * stable. Every string is assigned the next ID in order, starting from 1. 
+ * The ID to string mapping is held in another chunked array, which is never 
+ * reallocated, such that readers can index it without taking a lock.
+ *
+ * The lookup table is an insert-only open-addressing table of IDs. Entries 
+ * are fully written before their ID is published into a slot with a single 
+ * atomic store, so a lock-free reader only ever sees an empty slot or a 
+ * complete entry. Inserting serializes on a spinlock and re-checks the 
+ * current table. When the table grows, the new one is published atomically 
+ * and the old one is retired until shutdown, since readers may still be 
+ * probing it. A reader probing a stale table may miss a recently added 
+ * string - it then falls through to the locked path, which finds it.
+ */
+
+struct chunk{
+    struct chunk *next;
+    size_t        used;
+    size_t        size;
+    char          data[];
+};
 
-MPOOL_PROTOTYPES(static, strbuff, strbuff_t)
-MPOOL_IMPL(static, strbuff, strbuff_t)
+struct entry{
+    const char *str;
+    uint32_t    hash;
+};
 
-__KHASH_IMPL(stridx, static, khint32_t, mp_ref_t, 1, kh_int_hash_func, kh_int_hash_equal)
+struct table{
+    struct table *prev; /* retired */
+    uint32_t      mask;
+    SDL_atomic_t  slots[];
+};
+
+static SDL_SpinLock  s_lock;
+static struct chunk *s_chunks;
+static struct entry *s_entries[MAX_ENTRY_CHUNKS];
+static SDL_atomic_t  s_nentries;
+static void         *s_table;
 
 /*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
+/* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-bool si_init(mp_strbuff_t *pool, khash_t(stridx) **index, size_t size)
+static struct table *table_new(uint32_t nslots)
+{
+    assert((nslots & (nslots - 1)) == 0);
+    struct table *ret = calloc(1, sizeof(struct table) + nslots * sizeof(SDL_atomic_t));
+    if(!ret)
+        return NULL;
+    ret->mask = nslots - 1;
+    return ret;
+}
+
+static const struct entry *entry_get(si_id_t id)
+{
+    uint32_t idx = id - 1;
+    return &s_entries[idx / ENTRY_CHUNK_SZ][idx % ENTRY_CHUNK_SZ];
+}
+
+static si_id_t table_find(const struct table *table, const char *str, uint32_t hash)
+{
+    uint32_t idx = hash & table->mask;
+    for(uint32_t i = 0; i <= table->mask; i++) {
+        si_id_t id = SDL_AtomicGet((SDL_atomic_t*)&table->slots[idx]);
+        if(id == SI_ID_NONE)
+            return SI_ID_NONE;
+        const struct entry *entry = entry_get(id);
+        if(entry->hash == hash && !strcmp(entry->str, str))
+            return id;
+        idx = (idx + 1) & table->mask;
+    }
+    return SI_ID_NONE;
+}
+
+static void table_insert(struct table *table, si_id_t id, uint32_t hash)
 {
-    mp_strbuff_init(pool, true);
+    uint32_t idx = hash & table->mask;
+    while(SDL_AtomicGet(&table->slots[idx]) != SI_ID_NONE)
+        idx = (idx + 1) & table->mask;
+    SDL_AtomicSet(&table->slots[idx], id);
+}
 
-    if(!mp_strbuff_reserve(pool, size))
-        goto fail_stringpool; 
-    if(!(*index = kh_init(stridx)))
-        goto fail_stridx;
-    if(0 != kh_resize(stridx, *index, size))
-        goto fail_resize;
+static bool table_grow(void)
+{
+    struct table *old = SDL_AtomicGetPtr(&s_table);
+    struct table *new = table_new((old->mask + 1) * 2);
+    if(!new)
+        return false;
 
+    int nentries = SDL_AtomicGet(&s_nentries);
+    for(int i = 1; i <= nentries; i++) {
+        table_insert(new, i, entry_get(i)->hash);
+    }
+    new->prev = old;
+    SDL_AtomicSetPtr(&s_table, new);
     return true;
+}
+
+static const char *chunk_copy(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    if(!s_chunks || s_chunks->size - s_chunks->used < len) {
 
-fail_resize:
-    kh_destroy(stridx, *index);
-fail_stridx:
-    mp_strbuff_destroy(pool);
-fail_stringpool:
-    return false;
+        size_t size = len > CHUNK_SZ ? len : CHUNK_SZ;
+        struct chunk *chunk = malloc(sizeof(struct chunk) + size);
+        if(!chunk)
+            return NULL;
+        chunk->used = 0;
+        chunk->size = size;
+        chunk->next = s_chunks;
+        s_chunks = chunk;
+    }
+    char *ret = s_chunks->data + s_chunks->used;
+    memcpy(ret, str, len);
+    s_chunks->used += len;
+    return ret;
 }
 
-const char *si_intern(const char *str, mp_strbuff_t *pool, khash_t(stridx) *index)
+static si_id_t intern_locked(const char *str, uint32_t hash)
 {
-    khint_t hash = kh_str_hash_func(str);
-    khiter_t k = kh_get(stridx, index, hash);
+    struct table *table = SDL_AtomicGetPtr(&s_table);
+    si_id_t ret = table_find(table, str, hash);
+    if(ret != SI_ID_NONE)
+        return ret;
+
+    int nentries = SDL_AtomicGet(&s_nentries);
+    if(nentries == MAX_ENTRY_CHUNKS * ENTRY_CHUNK_SZ)
+        return SI_ID_NONE;
 
-    if(k != kh_end(index)) {
-        mp_ref_t ref = kh_value(index, k);
-        return (const char *)mp_strbuff_entry(pool, ref);
+    /* Keep the load factor under 1/2 */
+    if((nentries + 1) * 2 > table->mask + 1) {
+        if(!table_grow())
+            return SI_ID_NONE;
+        table = SDL_AtomicGetPtr(&s_table);
     }
 
-    mp_ref_t ref = mp_strbuff_alloc(pool);
-    if(ref == 0)
-        return NULL;
+    uint32_t idx = nentries;
+    if(idx % ENTRY_CHUNK_SZ == 0 && !s_entries[idx / ENTRY_CHUNK_SZ]) {
+        s_entries[idx / ENTRY_CHUNK_SZ] = malloc(ENTRY_CHUNK_SZ * sizeof(struct entry));
+        if(!s_entries[idx / ENTRY_CHUNK_SZ])
+            return SI_ID_NONE;
+    }
 
-    int status;
-    k = kh_put(stridx, index, hash, &status);
-    if(status == -1) {
-        mp_strbuff_free(pool, ref);
-        return NULL;
+    const char *copy = chunk_copy(str);
+    if(!copy)
+        return SI_ID_NONE;
+
+    ret = idx + 1;
+    s_entries[idx / ENTRY_CHUNK_SZ][idx % ENTRY_CHUNK_SZ] = (struct entry){copy, hash};
+    SDL_AtomicSet(&s_nentries, ret);
+    table_insert(table, ret, hash);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool si_init(void)
+{
+    struct table *table = table_new(MIN_SLOTS);
+    if(!table)
+        return false;
+    SDL_AtomicSet(&s_nentries, 0);
+    SDL_AtomicSetPtr(&s_table, table);
+    return true;
+}
+
+void si_shutdown(void)
+{
+    struct table *table = SDL_AtomicGetPtr(&s_table);
+    while(table) {
+        struct table *prev = table->prev;
+        free(table);
+        table = prev;
     }
-    assert(status == 1);
-    kh_value(index, k) = ref;
+    SDL_AtomicSetPtr(&s_table, NULL);
 
-    if(strlen(str) > sizeof(strbuff_t)-1) {
-        kh_del(stridx, index, k);
-        mp_strbuff_free(pool, ref);
-        return NULL;
+    while(s_chunks) {
+        struct chunk *next = s_chunks->next;
+        free(s_chunks);
+        s_chunks = next;
+    }
+    for(int i = 0; i < MAX_ENTRY_CHUNKS; i++) {
+        free(s_entries[i]);
+        s_entries[i] = NULL;
     }
+    SDL_AtomicSet(&s_nentries, 0);
+}
+
+const char *si_intern(const char *str, si_id_t *out_id)
+{
+    si_id_t id = si_intern_id(str);
+    if(out_id)
+        *out_id = id;
+    return si_str(id);
+}
+
+si_id_t si_intern_id(const char *str)
+{
+    uint32_t hash = kh_str_hash_func(str);
+    si_id_t ret = table_find(SDL_AtomicGetPtr(&s_table), str, hash);
+    if(ret != SI_ID_NONE)
+        return ret;
 
-    char *ret = (char *)mp_strbuff_entry(pool, ref);
-    pf_strlcpy(ret, str, sizeof(strbuff_t));
+    SDL_AtomicLock(&s_lock);
+    ret = intern_locked(str, hash);
+    SDL_AtomicUnlock(&s_lock);
     return ret;
 }
 
-void si_shutdown(mp_strbuff_t *pool, khash_t(stridx) *index)
+si_id_t si_lookup(const char *str)
 {
-    kh_destroy(stridx, index);
-    mp_strbuff_destroy(pool);
+    uint32_t hash = kh_str_hash_func(str);
+    si_id_t ret = table_find(SDL_AtomicGetPtr(&s_table), str, hash);
+    if(ret != SI_ID_NONE)
+        return ret;
+
+    /* The string may have just been added to a newer table */
+    SDL_AtomicLock(&s_lock);
+    ret = table_find(SDL_AtomicGetPtr(&s_table), str, hash);
+    SDL_AtomicUnlock(&s_lock);
+    return ret;
+}
+
+const char *si_str(si_id_t id)
+{
+    if(id == SI_ID_NONE || id > (si_id_t)SDL_AtomicGet(&s_nentries))
+        return NULL;
+    return entry_get(id)->str;
 }
 
-void si_clear(mp_strbuff_t *pool, khash_t(stridx) *index)
+size_t si_count(void)
 {
-    kh_clear(stridx, index);
-    mp_strbuff_clear(pool);
+    return SDL_AtomicGet(&s_nentries);
 }
 
@@ -0,0 +1,194 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/timer_wheel.h"
+
+#include <assert.h>
+
+
+VEC_IMPL(static inline, tw_timer, struct tw_timer)
+
+#define SLOT_MASK   ((uint64_t)(TW_SLOTS - 1))
+#define LEVEL_SPAN(level) (((uint64_t)1) << ((level) * TW_SLOT_BITS))
+#define SLOT_IDX(time, level) (((time) >> ((level) * TW_SLOT_BITS)) & SLOT_MASK)
+#define MAX_DELTA   (LEVEL_SPAN(TW_LEVELS) - 1)
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool tw_insert(struct twheel *tw, struct tw_timer timer)
+{
+    /* Timers that are already due fire on the next millisecond */
+    uint64_t when = (timer.expiry > tw->now) ? timer.expiry : tw->now + 1;
+    uint64_t delta = when - tw->now;
+
+    if(delta > MAX_DELTA) {
+        when = tw->now + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    int level = 0;
+    while(level < TW_LEVELS - 1 && delta >= LEVEL_SPAN(level + 1))
+        level++;
+
+    if(!vec_tw_timer_push(&tw->slots[level][SLOT_IDX(when, level)], timer))
+        return false;
+    tw->nlevel[level]++;
+    return true;
+}
+
+static void tw_cascade(struct twheel *tw, int level, size_t idx)
+{
+    vec_tw_timer_t *slot = &tw->slots[level][idx];
+    tw->nlevel[level] -= vec_size(slot);
+    for(int i = 0; i < vec_size(slot); i++) {
+        /* The timers always land in a different slot than the one 
+         * being cascaded, so the iteration is not disturbed. */
+        if(!tw_insert(tw, vec_AT(slot, i)))
+            tw->ntimers--;
+    }
+    vec_tw_timer_reset(slot);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void twheel_init(struct twheel *tw, uint64_t now)
+{
+    tw->now = now;
+    tw->ntimers = 0;
+    for(int i = 0; i < TW_LEVELS; i++) {
+        tw->nlevel[i] = 0;
+    for(int j = 0; j < TW_SLOTS; j++) {
+        vec_tw_timer_init(&tw->slots[i][j]);
+    }}
+}
+
+void twheel_destroy(struct twheel *tw)
+{
+    for(int i = 0; i < TW_LEVELS; i++) {
+    for(int j = 0; j < TW_SLOTS; j++) {
+        vec_tw_timer_destroy(&tw->slots[i][j]);
+    }}
+    tw->ntimers = 0;
+}
+
+bool twheel_add(struct twheel *tw, uint64_t expiry, uint64_t data)
+{
+    struct tw_timer timer = (struct tw_timer){
+        .expiry = expiry,
+        .data = data
+    };
+    if(!tw_insert(tw, timer))
+        return false;
+    tw->ntimers++;
+    return true;
+}
+
+size_t twheel_advance(struct twheel *tw, uint64_t now, tw_expire_t on_expire, void *arg)
+{
+    size_t nfired = 0;
+
+    while(tw->now < now) {
+
+        /* Nothing can fire, so there is no need to walk the slots */
+        if(tw->ntimers == 0) {
+            tw->now = now;
+            break;
+        }
+
+        /* When the finer levels are empty, skip straight to the next 
+         * point where a slot of a non-empty level is cascaded. */
+        int lowest = 0;
+        while(tw->nlevel[lowest] == 0)
+            lowest++;
+        if(lowest > 0) {
+            uint64_t next = ((tw->now >> (lowest * TW_SLOT_BITS)) + 1) << (lowest * TW_SLOT_BITS);
+            if(next > now) {
+                tw->now = now;
+                break;
+            }
+            tw->now = next - 1;
+        }
+
+        uint64_t t = ++tw->now;
+
+        /* When the first level wraps around, pull down the timers of the 
+         * next slot of the coarser levels, starting from the coarsest one 
+         * that has wrapped around as well. */
+        if(SLOT_IDX(t, 0) == 0) {
+            int top = 1;
+            while(top < TW_LEVELS - 1 && SLOT_IDX(t, top) == 0)
+                top++;
+            for(int level = top; level > 0; level--) {
+                tw_cascade(tw, level, SLOT_IDX(t, level));
+            }
+        }
+
+        /* A timer added from the callback is never placed in the slot 
+         * being fired, as it has an expiry of at least 't + 1' */
+        vec_tw_timer_t *slot = &tw->slots[0][SLOT_IDX(t, 0)];
+        for(int i = 0; i < vec_size(slot); i++) {
+            struct tw_timer curr = vec_AT(slot, i);
+            assert(curr.expiry <= t);
+            tw->ntimers--;
+            tw->nlevel[0]--;
+            nfired++;
+            on_expire(curr.data, arg);
+        }
+        vec_tw_timer_reset(slot);
+    }
+    return nfired;
+}
+
+void twheel_clear(struct twheel *tw, uint64_t now)
+{
+    for(int i = 0; i < TW_LEVELS; i++) {
+        tw->nlevel[i] = 0;
+    for(int j = 0; j < TW_SLOTS; j++) {
+        vec_tw_timer_reset(&tw->slots[i][j]);
+    }}
+    tw->ntimers = 0;
+    tw->now = now;
+}
+
+size_t twheel_size(const struct twheel *tw)
+{
+    return tw->ntimers;
+}
+
@@ -42,6 +42,7 @@
 #include "lib/public/stb_image.h"
 #include "lib/public/vec.h"
 #include "lib/public/pf_string.h"
+#include "lib/public/string_intern.h"
 #include "script/public/script.h"
 #include "game/public/game.h"
 #include "navigation/public/nav.h"
@@ -55,6 +56,11 @@
 #include "session.h"
 #include "perf.h"
 #include "sched.h"
+#include "bench.h"
+#include "render_bench.h"
+#include "replay.h"
+#include "net.h"
+#include "metrics.h"
 
 #include <stdbool.h>
 #include <assert.h>
@@ -110,10 +116,28 @@ static struct future             s_request_done;
  */
 static bool                      s_step_frame = false;
 static bool                      s_quit = false; 
+/* In benchmark mode, the window is never shown and the simulation clock 
+ * is free-running: it is stepped by exactly one 60Hz tick every frame, as 
+ * fast as possible. 
+ */
+static bool                      s_bench = false;
+/* In render benchmark mode, the camera is driven along a path and the 
+ * simulation is paused once the scene has been set up. */
+static bool                      s_render_bench = false;
+/* In replay mode, a recorded session is played back in benchmark mode, 
+ * following the recorded tick schedule instead of a free-running clock. */
+static bool                      s_replay = false;
+/* In headless mode, there is no window, GL context, or audio output. The 
+ * render thread discards all the commands, and the simulation is paced 
+ * to run at the tick rate. */
+static bool                      s_headless = false;
 static vec_event_t               s_prev_tick_events;
 
 static SDL_Thread               *s_render_thread;
 static struct render_sync_state  s_rstate;
+/* Set when the render thread has been started on a workspace and 
+ * its' 'done' signal hasn't yet been acknowledged */
+static bool                      s_render_busy = false;
 
 static int                       s_argc;
 static char                    **s_argv;
@@ -143,11 +167,6 @@ static void process_sdl_events(void)
             }
             break;
 
-        case SDL_USEREVENT:
-            if(event.user.code == 0) {
-                E_Global_Notify(EVENT_60HZ_TICK, NULL, ES_ENGINE); 
-            }
-            break;
         default: 
             break;
         }
@@ -229,6 +248,7 @@ static void render_thread_start_work(void)
     SDL_LockMutex(s_rstate.done_lock);
     s_rstate.done = false;
     SDL_UnlockMutex(s_rstate.done_lock);
+    s_render_busy = true;
 
     SDL_LockMutex(s_rstate.sq_lock);
     s_rstate.start = true;
@@ -245,10 +265,40 @@ void render_thread_wait_done(void)
         SDL_CondWait(s_rstate.done_cond, s_rstate.done_lock);
     s_rstate.done = false;
     SDL_UnlockMutex(s_rstate.done_lock);
+    s_render_busy = false;
 
     PERF_RETURN_VOID();
 }
 
+/* Like 'render_thread_wait_done', but returns false 
+ * immediately if the render thread is still busy. */
+static bool render_thread_poll_done(void)
+{
+    SDL_LockMutex(s_rstate.done_lock);
+    bool ret = s_rstate.done;
+    s_rstate.done = false;
+    SDL_UnlockMutex(s_rstate.done_lock);
+
+    if(ret) {
+        s_render_busy = false;
+    }
+    return ret;
+}
+
+/* Run all the workspaces queued up behind the one that the 
+ * render thread is currently working on. */
+static void render_thread_drain(void)
+{
+    while(G_NumQueuedBuffers() > 0) {
+
+        if(!s_render_busy)
+            render_thread_start_work();
+        render_thread_wait_done();
+        G_RetireRenderBuffers();
+        render_thread_start_work();
+    }
+}
+
 static void render_maybe_enable(void)
 {
     /* Simulate a single frame after a session change without rendering 
@@ -256,6 +306,8 @@ static void render_maybe_enable(void)
      * noticing. */
     if(((uint64_t)g_frame_idx) - Session_ChangeTick() <= 1)
         return;
+    if(s_bench || s_headless)
+        return;
     s_rstate.swap_buffers = true;
 }
 
@@ -282,6 +334,28 @@ static void frame_step_commit(const struct sval *new_val)
     }
 }
 
+static bool perf_trace_validate(const struct sval *new_val)
+{
+    return (new_val->type == ST_TYPE_BOOL);
+}
+
+static void perf_trace_commit(const struct sval *new_val)
+{
+    Perf_SetTraceEnabled(new_val->as_bool);
+}
+
+static bool hitch_threshold_validate(const struct sval *new_val)
+{
+    if(new_val->type != ST_TYPE_FLOAT)
+        return false;
+    return (new_val->as_float >= 0.0f);
+}
+
+static void hitch_threshold_commit(const struct sval *new_val)
+{
+    Perf_SetHitchThreshold(new_val->as_float);
+}
+
 static void engine_create_settings(void)
 {
     ss_e status = Settings_Create((struct setting){
@@ -295,6 +369,31 @@ static void engine_create_settings(void)
         .commit = frame_step_commit,
     });
     assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.debug.perf_trace_enabled",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false 
+        },
+        .prio = 0,
+        .validate = perf_trace_validate,
+        .commit = perf_trace_commit,
+    });
+    assert(status == SS_OKAY);
+
+    /* A value of 0 turns the hitch recorder off */
+    status = Settings_Create((struct setting){
+        .name = "pf.debug.hitch_threshold_ms",
+        .val = (struct sval) {
+            .type = ST_TYPE_FLOAT,
+            .as_float = 0.0f
+        },
+        .prio = 0,
+        .validate = hitch_threshold_validate,
+        .commit = hitch_threshold_commit,
+    });
+    assert(status == SS_OKAY);
 }
 
 static SDL_Surface *engine_create_loading_screen(void)
@@ -373,6 +472,11 @@ static bool engine_init(void)
     if(!vec_event_resize(&s_prev_tick_events, 8192))
         goto fail_resize;
 
+    if(!si_init()) {
+        fprintf(stderr, "Failed to initialize string interning.\n");
+        goto fail_strintern;
+    }
+
     /* Initialize 'Settings' before any subsystem to allow all of them 
      * to register settings. */
     if(Settings_Init() != SS_OKAY) {
@@ -386,16 +490,16 @@ static bool engine_init(void)
             Settings_GetFile(), status);
     }
 
-    if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) < 0) {
+    Uint32 sdl_flags = s_headless ? (SDL_INIT_EVENTS | SDL_INIT_TIMER)
+                                  : (SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
+    if(SDL_Init(sdl_flags) < 0) {
         fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
         goto fail_sdl;
     }
 
-    SDL_DisplayMode dm;
-    SDL_GetDesktopDisplayMode(0, &dm);
-
     struct sval setting;
-    int res[2] = {dm.w, dm.h};
+    int res[2];
+    Engine_DesktopRes(&res[0], &res[1]);
 
     if(Settings_Get("pf.video.resolution", &setting) == SS_OKAY) {
         res[0] = (int)setting.as_vec2.x;
@@ -409,24 +513,33 @@ static bool engine_init(void)
     if(Settings_Get("pf.video.window_always_on_top", &setting) == SS_OKAY) {
         extra_flags = setting.as_bool ? SDL_WINDOW_ALWAYS_ON_TOP : 0;
     }
+    if(s_bench) {
+        wf = 0;
+        extra_flags = 0;
+    }
 
-    R_InitAttributes();
-
-    char appname[64] = "Permafrost Engine";
-    Engine_GetArg("appname", sizeof(appname), appname);
-    s_window = SDL_CreateWindow(
-        appname,
-        SDL_WINDOWPOS_UNDEFINED, 
-        SDL_WINDOWPOS_UNDEFINED,
-        res[0], 
-        res[1], 
-        SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | wf | extra_flags);
-
-    s_loading_screen = engine_create_loading_screen();
-    engine_set_icon();
     stbi_set_flip_vertically_on_load(true);
-
-    Engine_LoadingScreen();
+    if(!s_headless) {
+
+        R_InitAttributes();
+
+        char appname[64] = "Permafrost Engine";
+        Engine_GetArg("appname", sizeof(appname), appname);
+        s_window = SDL_CreateWindow(
+            appname,
+            SDL_WINDOWPOS_UNDEFINED, 
+            SDL_WINDOWPOS_UNDEFINED,
+            res[0], 
+            res[1], 
+            SDL_WINDOW_OPENGL | (s_bench ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN) | wf | extra_flags);
+
+        s_loading_screen = engine_create_loading_screen();
+        engine_set_icon();
+        Engine_LoadingScreen();
+    }else{
+        /* Mix the audio without opening any output device */
+        SDL_setenv("ALSOFT_DRIVERS", "null", true);
+    }
 
     if(!rstate_init(&s_rstate)) {
         fprintf(stderr, "Failed to initialize the render sync state.\n");
@@ -437,6 +550,7 @@ static bool engine_init(void)
         .in_window = s_window,
         .in_width = res[0],
         .in_height = res[1],
+        .in_headless = s_headless,
     };
 
     s_rstate.arg = &rarg;
@@ -531,7 +645,7 @@ static bool engine_init(void)
     }
 
     engine_create_settings();
-    s_rstate.swap_buffers = true;
+    s_rstate.swap_buffers = !s_bench && !s_headless;
     return true;
 
 fail_phys:
@@ -568,17 +682,152 @@ fail_rstate:
     if(s_loading_screen) {
         SDL_FreeSurface(s_loading_screen);
     }
-    SDL_DestroyWindow(s_window);
+    if(s_window) {
+        SDL_DestroyWindow(s_window);
+    }
     SDL_Quit();
 fail_sdl:
     Settings_Shutdown();
 fail_settings:
+    si_shutdown();
+fail_strintern:
     Perf_Shutdown();
 fail_resize:
     vec_event_destroy(&s_prev_tick_events);
     return false; 
 }
 
+/* Arguments: --bench=<ticks> [--bench_seed=<seed>] [--bench_out=<path>] */
+static bool engine_bench_init(const char *ticks_arg)
+{
+    char seed_arg[32] = "0";
+    char outpath[512] = "bench.json";
+    Engine_GetArg("bench_seed", sizeof(seed_arg), seed_arg);
+    Engine_GetArg("bench_out", sizeof(outpath), outpath);
+
+    long nticks = strtol(ticks_arg, NULL, 10);
+    if(nticks <= 0) {
+        fprintf(stderr, "Invalid number of benchmark ticks: %s\n", ticks_arg);
+        return false;
+    }
+
+    unsigned long seed = strtoul(seed_arg, NULL, 10);
+    if(!Bench_Init(nticks, seed, outpath)) {
+        fprintf(stderr, "Failed to initialize benchmark mode.\n");
+        return false;
+    }
+    return true;
+}
+
+/* Arguments: --replay=<path> [--bench_out=<path>] */
+static bool engine_replay_init(const char *path)
+{
+    char outpath[512] = "bench.json";
+    Engine_GetArg("bench_out", sizeof(outpath), outpath);
+
+    uint32_t nframes;
+    unsigned seed;
+    if(!Replay_InitPlayback(path, &nframes, &seed)) {
+        fprintf(stderr, "Failed to load the replay: %s\n", path);
+        return false;
+    }
+
+    if(!Bench_Init(nframes, seed, outpath)) {
+        fprintf(stderr, "Failed to initialize benchmark mode.\n");
+        Replay_Shutdown();
+        return false;
+    }
+    return true;
+}
+
+/* Arguments: --record=<path> [--record_seed=<seed>] [--replay_hash_interval=<frames>] */
+static bool engine_record_init(void)
+{
+    char path[512];
+    if(!Engine_GetArg("record", sizeof(path), path))
+        return true;
+
+    char seed_arg[32] = "";
+    char interval_arg[32] = "60";
+    Engine_GetArg("record_seed", sizeof(seed_arg), seed_arg);
+    Engine_GetArg("replay_hash_interval", sizeof(interval_arg), interval_arg);
+
+    /* A network session is recorded with the seed shared by all the peers */
+    unsigned seed = Net_Active()    ? Net_Seed()
+                  : strlen(seed_arg) ? strtoul(seed_arg, NULL, 10) 
+                                     : (unsigned)SDL_GetPerformanceCounter();
+    long interval = strtol(interval_arg, NULL, 10);
+    if(interval <= 0) {
+        fprintf(stderr, "Invalid replay hash interval: %s\n", interval_arg);
+        return false;
+    }
+
+    if(!Replay_InitRecord(path, seed, interval)) {
+        fprintf(stderr, "Failed to open the replay file for recording: %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/* Arguments: --net_peers=<host:port,host:port,...> --net_id=<index> [--net_timeout=<seconds>] */
+static bool engine_net_init(const char *peers)
+{
+    char id_arg[32] = "";
+    char timeout_arg[32] = "60";
+    Engine_GetArg("net_id", sizeof(id_arg), id_arg);
+    Engine_GetArg("net_timeout", sizeof(timeout_arg), timeout_arg);
+
+    char *end;
+    long id = strtol(id_arg, &end, 10);
+    if(!strlen(id_arg) || *end != '\0') {
+        fprintf(stderr, "The '--net_id' option must be given along with '--net_peers'.\n");
+        return false;
+    }
+
+    long timeout = strtol(timeout_arg, NULL, 10);
+    if(timeout <= 0) {
+        fprintf(stderr, "Invalid network timeout: %s\n", timeout_arg);
+        return false;
+    }
+
+    return Net_Init(peers, id, timeout * 1000);
+}
+
+/* Arguments: --render_bench=<frames> [--render_bench_path=<path>] [--bench_out=<path>] */
+static bool engine_render_bench_init(const char *frames_arg)
+{
+    char pathfile[512] = "";
+    char outpath[512] = "render_bench.json";
+    bool has_path = Engine_GetArg("render_bench_path", sizeof(pathfile), pathfile);
+    Engine_GetArg("bench_out", sizeof(outpath), outpath);
+
+    long nframes = strtol(frames_arg, NULL, 10);
+    if(nframes <= 0) {
+        fprintf(stderr, "Invalid number of render benchmark frames: %s\n", frames_arg);
+        return false;
+    }
+
+    if(!RenderBench_Init(nframes, has_path ? pathfile : NULL, outpath)) {
+        fprintf(stderr, "Failed to initialize render benchmark mode.\n");
+        return false;
+    }
+    return true;
+}
+
+/* Arguments: --camera_record=<path> */
+static bool engine_camera_record_init(void)
+{
+    char pathfile[512];
+    if(!Engine_GetArg("camera_record", sizeof(pathfile), pathfile))
+        return true;
+
+    if(!RenderBench_RecordInit(pathfile)) {
+        fprintf(stderr, "Failed to open the camera recording file: %s\n", pathfile);
+        return false;
+    }
+    return true;
+}
+
 static void engine_shutdown(void)
 {
     P_Projectile_Shutdown();
@@ -589,6 +838,7 @@ static void engine_shutdown(void)
     /* Execute the last batch of commands that may have been queued by the 
      * shutdown routines. 
      */
+    render_thread_drain();
     render_thread_start_work();
     render_thread_wait_done();
     render_thread_quit();
@@ -616,10 +866,13 @@ static void engine_shutdown(void)
     if(s_loading_screen) {
         SDL_FreeSurface(s_loading_screen);
     }
-    SDL_DestroyWindow(s_window); 
+    if(s_window) {
+        SDL_DestroyWindow(s_window); 
+    }
     SDL_Quit();
 
     Settings_Shutdown();
+    si_shutdown();
 }
 
 /*****************************************************************************/
@@ -632,6 +885,8 @@ static void engine_shutdown(void)
 void Engine_LoadingScreen(void)
 {
     ASSERT_IN_MAIN_THREAD();
+    if(s_headless)
+        return;
     assert(s_window);
 
     /* Make sure the render therad doesn't overwrite the screen... */
@@ -666,6 +921,9 @@ int Engine_SetRes(int w, int h)
         .driverdata = NULL,
     };
 
+    if(!s_window)
+        return 0;
+
     SDL_SetWindowSize(s_window, w, h);
     SDL_SetWindowPosition(s_window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
     return SDL_SetWindowDisplayMode(s_window, &dm);
@@ -673,6 +931,8 @@ int Engine_SetRes(int w, int h)
 
 void Engine_SetDispMode(enum pf_window_flags wf)
 {
+    if(!s_window)
+        return;
     SDL_SetWindowFullscreen(s_window, wf & SDL_WINDOW_FULLSCREEN);
     SDL_SetWindowBordered(s_window, !(wf & (SDL_WINDOW_BORDERLESS | SDL_WINDOW_FULLSCREEN)));
     SDL_SetWindowPosition(s_window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
@@ -680,12 +940,35 @@ void Engine_SetDispMode(enum pf_window_flags wf)
 
 void Engine_WinDrawableSize(int *out_w, int *out_h)
 {
-    SDL_GL_GetDrawableSize(s_window, out_w, out_h);
+    if(s_window) {
+        SDL_GL_GetDrawableSize(s_window, out_w, out_h);
+        return;
+    }
+
+    struct sval res;
+    ss_e status = Settings_Get("pf.video.resolution", &res);
+    assert(status == SS_OKAY);
+    (void)status;
+    *out_w = res.as_vec2.x;
+    *out_h = res.as_vec2.y;
+}
+
+void Engine_DesktopRes(int *out_w, int *out_h)
+{
+    SDL_DisplayMode dm;
+    if(SDL_GetDesktopDisplayMode(0, &dm) != 0) {
+        *out_w = CONFIG_HEADLESS_RES_X;
+        *out_h = CONFIG_HEADLESS_RES_Y;
+        return;
+    }
+    *out_w = dm.w;
+    *out_h = dm.h;
 }
 
 void Engine_FlushRenderWorkQueue(void)
 {
     ASSERT_IN_MAIN_THREAD();
+    render_thread_drain();
 
     /* Wait for the render thread to finish its' current batch */
     render_thread_start_work();
@@ -709,7 +992,7 @@ void Engine_SetRenderThreadID(SDL_threadID id)
 void Engine_EnableRendering(bool on)
 {
     Engine_WaitRenderWorkDone();
-    s_rstate.swap_buffers = on;
+    s_rstate.swap_buffers = on && !s_bench;
 }
 
 void Engine_WaitRenderWorkDone(void)
@@ -719,6 +1002,8 @@ void Engine_WaitRenderWorkDone(void)
         PERF_RETURN_VOID();
     }
 
+    render_thread_drain();
+
     /* Wait for the render thread to finish, but don't yet clear/ack the 'done' flag */
     SDL_LockMutex(s_rstate.done_lock);
     while(!s_rstate.done) {
@@ -754,6 +1039,29 @@ bool Engine_GetArg(const char *name, size_t maxout, char out[])
     return false;
 }
 
+static bool engine_has_flag(const char *name)
+{
+    for(int i = 2; i < s_argc; i++) {
+        const char *curr = s_argv[i];
+        if(strstr(curr, "--") != curr)
+            continue;
+        if(0 == strcmp(curr + 2, name))
+            return true;
+    }
+    return false;
+}
+
+/* Without vsync, pace the headless main loop to the simulation tick rate */
+static void engine_headless_throttle(uint64_t frame_start)
+{
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    uint64_t period = freq / 60;
+    uint64_t elapsed = SDL_GetPerformanceCounter() - frame_start;
+    if(elapsed < period) {
+        SDL_Delay((period - elapsed) * 1000 / freq);
+    }
+}
+
 #if defined(_WIN32)
 int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, 
                      LPSTR lpCmdLine, int nCmdShow)
@@ -778,13 +1086,108 @@ int main(int argc, char **argv)
     s_argc = argc;
     s_argv = argv;
 
+    char bench_arg[32];
+    s_bench = Engine_GetArg("bench", sizeof(bench_arg), bench_arg);
+
+    char render_bench_arg[32];
+    s_render_bench = Engine_GetArg("render_bench", sizeof(render_bench_arg), render_bench_arg);
+
+    char replay_arg[512];
+    s_replay = Engine_GetArg("replay", sizeof(replay_arg), replay_arg);
+
+    char record_arg[512];
+    bool record = Engine_GetArg("record", sizeof(record_arg), record_arg);
+
+    if((s_bench + s_render_bench + s_replay + record) > 1) {
+        fprintf(stderr, "The '--bench', '--render_bench', '--replay' and '--record' options "
+            "are mutually exclusive.\n");
+        ret = EXIT_FAILURE;
+        goto fail_args;
+    }
+
+    s_headless = engine_has_flag("headless");
+    if(s_headless && s_render_bench) {
+        fprintf(stderr, "The '--render_bench' option requires rendering, and can't be used "
+            "with '--headless'.\n");
+        ret = EXIT_FAILURE;
+        goto fail_args;
+    }
+
+    char net_arg[1024];
+    bool net = Engine_GetArg("net_peers", sizeof(net_arg), net_arg);
+
+    if(net && (s_bench || s_render_bench || s_replay)) {
+        fprintf(stderr, "The '--net_peers' option can't be combined with the benchmark or "
+            "replay modes.\n");
+        ret = EXIT_FAILURE;
+        goto fail_args;
+    }
+    s_bench = s_bench || s_replay;
+
     if(!engine_init()) {
         ret = EXIT_FAILURE; 
         goto fail_init;
     }
 
+    if(s_replay && !engine_replay_init(replay_arg)) {
+        ret = EXIT_FAILURE;
+        goto fail_bench;
+    }
+    if(s_bench && !s_replay && !engine_bench_init(bench_arg)) {
+        ret = EXIT_FAILURE;
+        goto fail_bench;
+    }
+    if(net && !engine_net_init(net_arg)) {
+        ret = EXIT_FAILURE;
+        goto fail_bench;
+    }
+    if(!engine_record_init()) {
+        Net_Shutdown();
+        ret = EXIT_FAILURE;
+        goto fail_bench;
+    }
+    if(s_render_bench && !engine_render_bench_init(render_bench_arg)) {
+        ret = EXIT_FAILURE;
+        goto fail_bench;
+    }
+    if(!engine_camera_record_init()) {
+        Net_Shutdown();
+        Replay_Shutdown();
+        RenderBench_Shutdown();
+        Bench_Shutdown();
+        ret = EXIT_FAILURE;
+        goto fail_bench;
+    }
+    G_Timer_SetFreeRunning(s_bench);
+
+    /* The metrics endpoint is only for monitoring, so failing 
+     * to open it doesn't prevent the session from running */
+    char metrics_arg[16];
+    if(Engine_GetArg("metrics_port", sizeof(metrics_arg), metrics_arg)
+    && !Metrics_Init(strtol(metrics_arg, NULL, 10))) {
+        fprintf(stderr, "Could not open the metrics endpoint on port '%s'.\n", metrics_arg);
+    }
+
     Audio_PlayMusicFirst();
-    S_RunFileAsync(argv[2], 0, NULL, &s_request_done);
+    /* Let the script know to set up a scene which runs without any input. 
+     * A replay runs the script the same way as it was recorded. */
+    static char *s_bench_argv[] = {"--bench", NULL};
+    static char *s_render_bench_argv[] = {"--render_bench", NULL};
+    /* In a network session, let the script know which player is local */
+    static char s_net_id_arg[32];
+    static char *s_net_argv[] = {s_net_id_arg, NULL};
+    if(s_bench && !s_replay) {
+        S_RunFileAsync(argv[2], 1, s_bench_argv, &s_request_done);
+    }else if(s_render_bench) {
+        S_RunFileAsync(argv[2], 1, s_render_bench_argv, &s_request_done);
+    }else if(Net_Active()) {
+        char id_arg[16] = "";
+        Engine_GetArg("net_id", sizeof(id_arg), id_arg);
+        pf_snprintf(s_net_id_arg, sizeof(s_net_id_arg), "--net_id=%s", id_arg);
+        S_RunFileAsync(argv[2], 1, s_net_argv, &s_request_done);
+    }else{
+        S_RunFileAsync(argv[2], 0, NULL, &s_request_done);
+    }
     s_state = ENGINE_STATE_WAITING;
 
     /* Run the first frame of the simulation, and prepare the buffers for rendering. */
@@ -796,6 +1199,7 @@ int main(int argc, char **argv)
 
     while(!s_quit) {
 
+        uint64_t frame_start = SDL_GetPerformanceCounter();
         Perf_BeginTick();
         enum simstate curr_ss = G_GetSimState();
         bool prev_step_frame = s_step_frame;
@@ -805,35 +1209,85 @@ int main(int argc, char **argv)
             G_SetSimState(G_RUNNING);
         }
 
-        if(s_state == ENGINE_STATE_WAITING) {
-            R_PushCmdImmediate((struct rcmd){
-                .func = R_GL_DrawLoadingScreen,
-                .nargs = 0
-            });
-        }
+        /* The render thread may still be busy with a workspace from an earlier 
+         * frame if the simulation ran ahead. In that case, it will be picked up 
+         * again at the end of this frame. */
+        if(!s_render_busy) {
 
-        render_maybe_enable();
-        render_thread_start_work();
+            if(s_state == ENGINE_STATE_WAITING) {
+                R_PushCmdImmediate((struct rcmd){
+                    .func = R_GL_DrawLoadingScreen,
+                    .nargs = 0
+                });
+            }
+
+            render_maybe_enable();
+            render_thread_start_work();
+        }
         Sched_StartBackgroundTasks();
         process_sdl_events();
 
+        if(Net_Active()) {
+            Net_Service();
+        }
+
         bool request = Session_ServiceRequests(&s_request_done);
         if(request) {
             s_state = ENGINE_STATE_WAITING;
         }
 
+        bool sim_ran = (s_state == ENGINE_STATE_RUNNING);
         switch(s_state) {
-        case ENGINE_STATE_RUNNING:
-
-            E_ServiceQueue();
-            G_Update();
-            G_Render();
+        case ENGINE_STATE_RUNNING: {
+
+            uint64_t sim_start = SDL_GetPerformanceCounter();
+            if(Net_Active() && !Net_FrameReady()) {
+                /* Waiting for the time of the next frame, or for the commands 
+                 * of the other peers. Keep drawing the last frame meanwhile. */
+                sim_ran = false;
+            }else{
+                if(Replay_Playing()) {
+                    int nticks = Replay_FrameTicks();
+                    G_Timer_AdvanceBy(nticks);
+                    Replay_BeginFrame(nticks);
+                }else if(Net_Active()) {
+                    G_Timer_AdvanceBy(1);
+                    Replay_BeginFrame(1);
+                    Net_BeginFrame();
+                }else{
+                    Replay_BeginFrame(G_Timer_Advance());
+                }
+                E_ServiceQueue();
+                Replay_BeginUpdate();
+                G_Update();
+                Replay_EndFrame();
+                if(Net_Active()) {
+                    Net_EndFrame();
+                }
+            }
+            if(s_render_bench) {
+                RenderBench_Prepare();
+            }
+            RenderBench_RecordStep();
+            if(!s_bench && !s_headless) {
+                G_Render();
+            }
             Sched_Tick();
-            render_thread_wait_done();
-            G_SwapBuffers();
+            Perf_RecordSample(PERF_METRIC_SIM, SDL_GetPerformanceCounter() - sim_start);
+
+            if(render_thread_poll_done()) {
+                G_SwapBuffers();
+            }else if(!request && G_CanQueueBuffers()) {
+                /* Don't wait for the render thread to catch up - 
+                 * let the simulation run ahead by a frame */
+                G_QueueBuffers();
+            }else{
+                render_thread_wait_done();
+                G_SwapBuffers();
+            }
 
             break;
-
+        }
         case ENGINE_STATE_WAITING:
 
             Sched_Tick();
@@ -841,27 +1295,55 @@ int main(int argc, char **argv)
                 s_state = ENGINE_STATE_RUNNING;
             }
             render_thread_wait_done();
+            /* Let the render thread pick up any workspaces 
+             * that were queued before we started waiting */
+            if(G_NumQueuedBuffers() > 0) {
+                G_RetireRenderBuffers();
+            }
             break;
 
         default: assert(0); break;
         }
 
         Perf_FinishTick();
+        Metrics_Service();
+
+        if(s_bench && !Bench_Step(sim_ran)) {
+            s_quit = true;
+        }
+        if(s_render_bench && !RenderBench_Step(sim_ran)) {
+            s_quit = true;
+        }
 
         if(prev_step_frame) {
             G_SetSimState(curr_ss);
             s_step_frame = false;
         }
 
+        if(s_headless && !s_bench) {
+            engine_headless_throttle(frame_start);
+        }
         ++g_frame_idx;
     }
 
+    /* A headless instance doesn't get to overwrite the player's settings */
     ss_e status;
-    if((status = Settings_SaveToFile()) != SS_OKAY) {
+    if(!s_headless && (status = Settings_SaveToFile()) != SS_OKAY) {
         fprintf(stderr, "Could not save settings to file: %s [status: %d]\n", 
             Settings_GetFile(), status);
     }
 
+    Metrics_Shutdown();
+    if(!Net_Shutdown()) {
+        ret = EXIT_FAILURE;
+    }
+    if(!Replay_Shutdown()) {
+        ret = EXIT_FAILURE;
+    }
+    RenderBench_RecordShutdown();
+    RenderBench_Shutdown();
+    Bench_Shutdown();
+fail_bench:
     engine_shutdown();
 fail_init:
 fail_args:
@@ -67,6 +67,8 @@ enum pf_window_flags {
 int  Engine_SetRes(int w, int h);
 void Engine_SetDispMode(enum pf_window_flags wf);
 void Engine_WinDrawableSize(int *out_w, int *out_h);
+/* Falls back to a default resolution when there is no display (headless mode) */
+void Engine_DesktopRes(int *out_w, int *out_h);
 void Engine_LoadingScreen(void);
 void Engine_EnableRendering(bool on);
 void Engine_SetRenderThreadID(SDL_threadID id);
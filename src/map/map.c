@@ -43,6 +43,8 @@
 #include "../phys/public/collision.h"
 #include "../render/public/render.h"
 #include "../render/public/render_ctrl.h"
+#include "../lib/public/stalloc.h"
+#include "../lib/public/simd.h"
 #include "../navigation/public/nav.h"
 #include "../game/public/game.h"
 
@@ -57,6 +59,20 @@
 #define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
 
 
+/*****************************************************************************/
+/* TYPES                                                                     */
+/*****************************************************************************/
+
+/* The chunks of a single map pass. Depth pass draws are pushed one at a time,
+ * as they may be recorded by the shadow cache. Regular pass draws are gathered
+ * and pushed as a single command, so that the state that is the same for all
+ * of the chunks only needs to be set up once. */
+struct chunk_draws{
+    size_t           nchunks;
+    void           **rprivates;
+    mat4x4_t        *models;
+};
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -114,6 +130,82 @@ static struct tile *tile_for_desc(const struct map *map, const struct tile_desc
     return ret;
 }
 
+static void m_chunk_draws_init(const struct map *map, struct chunk_draws *out)
+{
+    size_t max = map->width * map->height;
+    struct memstack *args = &G_GetSimWS()->args;
+
+    out->nchunks = 0;
+    out->rprivates = stalloc(args, max * sizeof(out->rprivates[0]));
+    out->models = stalloc(args, max * sizeof(out->models[0]));
+}
+
+static void m_chunk_draws_add(const struct map *map, struct chunkpos p, 
+                              enum render_pass pass, struct chunk_draws *draws)
+{
+    mat4x4_t chunk_model;
+    const struct pfchunk *chunk = &map->chunks[p.r * map->width + p.c];
+    M_ModelMatrixForChunk(map, p, &chunk_model);
+
+    switch(pass) {
+    case RENDER_PASS_DEPTH: 
+        R_PushCmd((struct rcmd){
+            .func = R_GL_RenderDepthMap,
+            .nargs = 2,
+            .args = {
+                chunk->render_private,
+                R_PushArg(&chunk_model, sizeof(chunk_model)),
+            },
+        });
+        break;
+    case RENDER_PASS_REGULAR:
+        draws->rprivates[draws->nchunks] = chunk->render_private;
+        draws->models[draws->nchunks] = chunk_model;
+        draws->nchunks++;
+        break;
+    default: assert(0);
+    }
+}
+
+static void m_chunk_draws_push(const struct chunk_draws *draws)
+{
+    if(draws->nchunks == 0)
+        return;
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_MapDrawChunks,
+        .nargs = 3,
+        .args = {
+            draws->rprivates,
+            draws->models,
+            R_PushArg(&draws->nchunks, sizeof(draws->nchunks)),
+        },
+    });
+}
+
+/* Find the cached heights of the tile under the point and the position within
+ * it. Points outside the map are clamped to the nearest tile on its' edge. */
+static const struct tile_heights *m_heights_at_point(const struct map *map, vec2_t xz, 
+                                                     float *out_frac_width, 
+                                                     float *out_frac_height)
+{
+    const int ncols = map->width * TILES_PER_CHUNK_WIDTH;
+    const int nrows = map->height * TILES_PER_CHUNK_HEIGHT;
+
+    float col = -(xz.raw[0] - map->pos.x) / X_COORDS_PER_TILE;
+    float row =  (xz.raw[1] - map->pos.z) / Z_COORDS_PER_TILE;
+    int c = CLAMP((int)col, 0, ncols - 1);
+    int r = CLAMP((int)row, 0, nrows - 1);
+
+    *out_frac_width = CLAMP(col - c, 0.0f, 1.0f);
+    *out_frac_height = CLAMP(row - r, 0.0f, 1.0f);
+
+    const struct pfchunk *chunk = &map->chunks[(r / TILES_PER_CHUNK_HEIGHT) * map->width 
+                                             + (c / TILES_PER_CHUNK_WIDTH)];
+    return &chunk->heights[(r % TILES_PER_CHUNK_HEIGHT) * TILES_PER_CHUNK_WIDTH 
+                         + (c % TILES_PER_CHUNK_WIDTH)];
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -135,7 +227,6 @@ void M_ModelMatrixForChunk(const struct map *map, struct chunkpos p, mat4x4_t *o
 void M_RenderEntireMap(const struct map *map, bool shadows, enum render_pass pass)
 {
     vec2_t pos = (vec2_t){map->pos.x, map->pos.z};
-    const bool fval = false;
 
     R_PushCmd((struct rcmd){ 
         .func = R_GL_MapBegin,
@@ -146,39 +237,15 @@ void M_RenderEntireMap(const struct map *map, bool shadows, enum render_pass pas
         },
     });
 
+    struct chunk_draws draws;
+    m_chunk_draws_init(map, &draws);
+
     for(int r = 0; r < map->height; r++) {
     for(int c = 0; c < map->width;  c++) {
-    
-        mat4x4_t chunk_model;
-        const struct pfchunk *chunk = &map->chunks[r * map->width + c];
-        M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
-
-        switch(pass) {
-        case RENDER_PASS_DEPTH: 
-            R_PushCmd((struct rcmd){
-                .func = R_GL_RenderDepthMap,
-                .nargs = 2,
-                .args = {
-                    chunk->render_private,
-                    R_PushArg(&chunk_model, sizeof(chunk_model)),
-                },
-            });
-            break;
-        case RENDER_PASS_REGULAR:
-            R_PushCmd((struct rcmd){
-                .func = R_GL_Draw,
-                .nargs = 3,
-                .args = {
-                    chunk->render_private,
-                    R_PushArg(&chunk_model, sizeof(chunk_model)),
-                    R_PushArg(&fval, sizeof(fval)),
-                },
-            });
-            break;
-        default: assert(0);
-        }
+        m_chunk_draws_add(map, (struct chunkpos) {r, c}, pass, &draws);
     }}
 
+    m_chunk_draws_push(&draws);
     R_PushCmd((struct rcmd){ R_GL_MapEnd, 0 });
 }
 
@@ -188,7 +255,6 @@ void M_RenderVisibleMap(const struct map *map, const struct camera *cam,
     struct frustum frustum;
     Camera_MakeFrustum(cam, &frustum);
     vec2_t pos = (vec2_t){map->pos.x, map->pos.z};
-    const bool fval = false;
 
     R_PushCmd((struct rcmd){ 
         .func = R_GL_MapBegin, 
@@ -199,6 +265,9 @@ void M_RenderVisibleMap(const struct map *map, const struct camera *cam,
         },
     });
 
+    struct chunk_draws draws;
+    m_chunk_draws_init(map, &draws);
+
     for(int r = 0; r < map->height; r++) {
     for(int c = 0; c < map->width;  c++) {
 
@@ -209,39 +278,24 @@ void M_RenderVisibleMap(const struct map *map, const struct camera *cam,
          * intersection test will yield too many false positives. As each chunk mesh has 
          * a high vertex count, this is undesirable. It is absolutely worth it to do the 
          * precise frustrum intersection test. With it, the map rendering performance
-         * scales great for large maps. */
-        if(!C_FrustumAABBIntersectionExact(&frustum, &chunk_aabb))
+         * scales great for large maps. However, the fast test is still definitive for
+         * the chunks that are entirely on one side of the frustum, which are most of
+         * them. So only the ones it's unsure about are given the precise test. */
+        switch(C_FrustumAABBIntersectionFast(&frustum, &chunk_aabb)) {
+        case VOLUME_INTERSEC_OUTSIDE:
             continue;
-
-        mat4x4_t chunk_model;
-        const struct pfchunk *chunk = &map->chunks[r * map->width + c];
-        M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
-
-        switch(pass) {
-        case RENDER_PASS_DEPTH: 
-            R_PushCmd((struct rcmd){
-                .func = R_GL_RenderDepthMap,
-                .nargs = 2,
-                .args = {
-                    chunk->render_private,
-                    R_PushArg(&chunk_model, sizeof(chunk_model)),
-                },
-            });
+        case VOLUME_INTERSEC_INTERSECTION:
+            if(!C_FrustumAABBIntersectionExact(&frustum, &chunk_aabb))
+                continue;
             break;
-        case RENDER_PASS_REGULAR:
-            R_PushCmd((struct rcmd){
-                .func = R_GL_Draw,
-                .nargs = 3,
-                .args = {
-                    chunk->render_private,
-                    R_PushArg(&chunk_model, sizeof(chunk_model)),
-                    R_PushArg(&fval, sizeof(fval)),
-                },
-            });
+        default:
             break;
-        default: assert(0);
         }
+
+        m_chunk_draws_add(map, (struct chunkpos) {r, c}, pass, &draws);
     }}
+
+    m_chunk_draws_push(&draws);
     R_PushCmd((struct rcmd){ R_GL_MapEnd, 0 });
 }
 
@@ -397,29 +451,60 @@ float M_HeightAtPoint(const struct map *map, vec2_t xz)
 {
     assert(M_PointInsideMap(map, xz));
 
-    float x = xz.raw[0];
-    float z = xz.raw[1];
+    float frac_width, frac_height;
+    const struct tile_heights *heights = m_heights_at_point(map, xz, &frac_width, &frac_height);
+    return M_Tile_HeightsAtPos(heights, frac_width, frac_height);
+}
 
-    int chunk_r, chunk_c;
-    chunk_r = CLAMP( (z - map->pos.z) / (TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE), 0, map->height-1);
-    chunk_c = CLAMP(-(x - map->pos.x) / (TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE), 0, map->width-1);
+void M_HeightAtPoints(const struct map *map, size_t npoints, const vec2_t *xz, float *out)
+{
+    PERF_ENTER();
 
-    float chunk_off_r = fmod(z - map->pos.z, TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE);
-    float chunk_off_c = fmod(-(x - map->pos.x), TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE);
-    assert(chunk_off_r >= 0 && chunk_off_c >= 0);
+    for(size_t base = 0; base < npoints; base += VW) {
 
-    int tile_r, tile_c;    
-    tile_r = CLAMP(chunk_off_r / Z_COORDS_PER_TILE, 0, TILES_PER_CHUNK_HEIGHT-1);
-    tile_c = CLAMP(chunk_off_c / X_COORDS_PER_TILE, 0, TILES_PER_CHUNK_WIDTH-1);
-    
-    float tile_frac_width, tile_frac_height;
-    tile_frac_width =  fmod(chunk_off_c, X_COORDS_PER_TILE) / X_COORDS_PER_TILE;
-    tile_frac_height = fmod(chunk_off_r, Z_COORDS_PER_TILE) / Z_COORDS_PER_TILE;
-    assert(tile_frac_width >= 0.0f && tile_frac_width <= 1.0f);
-    assert(tile_frac_height >= 0.0f && tile_frac_height <= 1.0f);
+        /* Gather the corners of the tiles under the points, padding 
+         * the last group with copies of the final point */
+        float x[VW], z[VW], nw[VW], ne[VW], sw[VW], se[VW], split[VW];
+        for(int i = 0; i < VW; i++) {
+
+            size_t idx = MIN(base + i, npoints - 1);
+            const struct tile_heights *heights = m_heights_at_point(map, xz[idx], &x[i], &z[i]);
+            nw[i] = heights->nw;
+            ne[i] = heights->ne;
+            sw[i] = heights->sw;
+            se[i] = heights->se;
+            split[i] = heights->split;
+        }
+
+        /* Evaluate all the ways the face can be split and pick the right one */
+        vfloat_t vx = V_LOAD(x), vz = V_LOAD(z);
+        vfloat_t vnw = V_LOAD(nw), vne = V_LOAD(ne), vsw = V_LOAD(sw), vse = V_LOAD(se);
+        vfloat_t one = V_SET1(1.0f);
+
+        vfloat_t dx_n = V_SUB(vne, vnw);
+        vfloat_t dz_w = V_SUB(vsw, vnw);
+        vfloat_t bilinear = V_ADD(V_ADD(vnw, V_MUL(dx_n, vx)), V_MUL(dz_w, vz));
+        bilinear = V_ADD(bilinear, V_MUL(V_SUB(V_SUB(vse, vne), dz_w), V_MUL(vx, vz)));
+
+        vfloat_t nwse_upper = V_ADD(V_ADD(vnw, V_MUL(dx_n, vx)), V_MUL(V_SUB(vse, vne), vz));
+        vfloat_t nwse_lower = V_ADD(V_ADD(vnw, V_MUL(V_SUB(vse, vsw), vx)), V_MUL(dz_w, vz));
+        vfloat_t nwse = V_SELECT(V_LT(vx, vz), nwse_lower, nwse_upper);
+
+        vfloat_t nesw_upper = V_ADD(V_ADD(vnw, V_MUL(dx_n, vx)), V_MUL(dz_w, vz));
+        vfloat_t nesw_lower = V_ADD(V_ADD(vse, V_MUL(V_SUB(vsw, vse), V_SUB(one, vx))), 
+                                    V_MUL(V_SUB(vne, vse), V_SUB(one, vz)));
+        vfloat_t nesw = V_SELECT(V_GT(V_ADD(vx, vz), one), nesw_lower, nesw_upper);
+
+        vfloat_t vsplit = V_LOAD(split);
+        vfloat_t result = V_SELECT(V_EQ(vsplit, V_SET1(TILE_SPLIT_NW_SE)), nwse, bilinear);
+        result = V_SELECT(V_EQ(vsplit, V_SET1(TILE_SPLIT_NE_SW)), nesw, result);
+
+        float heights[VW];
+        V_STORE(heights, result);
+        memcpy(out + base, heights, MIN(VW, npoints - base) * sizeof(float));
+    }
 
-    const struct tile *tile = &map->chunks[chunk_r * map->width + chunk_c].tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c];
-    return M_Tile_HeightAtPos(tile, tile_frac_width, tile_frac_height);
+    PERF_RETURN_VOID();
 }
 
 bool M_DescForPoint2D(const struct map *map, vec2_t point_xz, struct tile_desc *out)
@@ -450,6 +535,31 @@ bool M_NavRequestPath(const struct map *map, vec2_t xz_src, vec2_t xz_dest,
     return N_RequestPath(map->nav_private, xz_src, xz_dest, map->pos, layer, out_dest_id);
 }
 
+bool M_NavBenchmark(const struct map *map, const struct nav_bench_desc *desc, 
+                    struct nav_bench_result *out)
+{
+    STALLOC(const struct tile*, chunk_tiles, map->width * map->height);
+    for(int i = 0; i < map->width * map->height; i++) {
+        chunk_tiles[i] = map->chunks[i].tiles;
+    }
+
+    uint64_t begin = SDL_GetPerformanceCounter();
+    void *nav_private = N_BuildForMapData(map->width, map->height, 
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles, true);
+    float build_ms = (SDL_GetPerformanceCounter() - begin) * 1000.0 
+                   / SDL_GetPerformanceFrequency();
+    STFREE(chunk_tiles);
+
+    if(!nav_private)
+        return false;
+    N_FreePrivate(nav_private);
+
+    if(!N_Benchmark(map->nav_private, map->pos, desc, out))
+        return false;
+    out->build_ms = build_ms;
+    return true;
+}
+
 void M_NavRenderVisiblePathFlowField(const struct map *map, const struct camera *cam, 
                                      dest_id_t id)
 {
@@ -623,6 +733,16 @@ vec2_t M_NavDesiredPointSeekVelocity(const struct map *map, dest_id_t id, vec2_t
     return N_DesiredPointSeekVelocity(id, curr_pos, xz_dest, map->nav_private, map->pos);
 }
 
+bool M_NavTryDesiredPointSeekVelocity(const struct map *map, dest_id_t id, vec2_t curr_pos, vec2_t *out)
+{
+    return N_TryDesiredPointSeekVelocity(id, curr_pos, map->nav_private, map->pos, out);
+}
+
+void M_NavTouchDestFields(const struct map *map, dest_id_t id, vec2_t curr_pos)
+{
+    N_TouchDestFields(id, curr_pos, map->nav_private, map->pos);
+}
+
 vec2_t M_NavDesiredEnemySeekVelocity(const struct map *map, enum nav_layer layer, 
                                      vec2_t curr_pos, int faction_id)
 {
@@ -635,6 +755,18 @@ vec2_t M_NavDesiredSurroundVelocity(const struct map *map, enum nav_layer layer,
     return N_DesiredSurroundVelocity(curr_pos, map->nav_private, layer, map->pos, uid, faction_id);
 }
 
+vec2_t M_NavDesiredFactionTargetsVelocity(const struct map *map, enum nav_layer layer, 
+                                          vec2_t curr_pos, int faction_id)
+{
+    return N_DesiredFactionTargetsVelocity(curr_pos, map->nav_private, layer, map->pos, faction_id);
+}
+
+void M_NavSetFactionTargets(const struct map *map, int faction_id, 
+                            const uint32_t *targets, size_t ntargets)
+{
+    N_SetFactionTargets(faction_id, targets, ntargets);
+}
+
 bool M_NavHasDestLOS(const struct map *map, dest_id_t id, vec2_t curr_pos)
 {
     return N_HasDestLOS(id, curr_pos, map->nav_private, map->pos);
@@ -698,6 +830,13 @@ bool M_NavClosestPathable(const struct map *map, enum nav_layer layer, vec2_t xz
     return N_ClosestPathable(map->nav_private, layer, map->pos, xz_src, out);
 }
 
+size_t M_NavClosestPathableSet(const struct map *map, enum nav_layer layer, 
+                               vec2_t xz_src, float spacing, size_t maxout, vec2_t *out)
+{
+    return N_ClosestPathableSet(map->nav_private, layer, map->pos, xz_src, 
+        spacing, maxout, out);
+}
+
 bool M_NavLocationsReachable(const struct map *map, enum nav_layer layer, 
                              vec2_t a, vec2_t b)
 {
@@ -728,6 +867,16 @@ void M_NavBlockersDecrefOBB(const struct map *map, int faction_id,
     N_BlockersDecrefOBB(map->nav_private, faction_id, flags, map->pos, obb);
 }
 
+void M_NavBlockersBeginBatch(void)
+{
+    N_BlockersBeginBatch();
+}
+
+void M_NavBlockersEndBatch(void)
+{
+    N_BlockersEndBatch();
+}
+
 bool M_TileForDesc(const struct map *map, struct tile_desc desc, struct tile **out)
 {
     if(desc.chunk_r < 0 || desc.chunk_r >= map->height)
@@ -894,6 +1043,17 @@ void M_NavRequestAsyncSurroundField(const struct map *map, enum nav_layer layer,
     N_RequestAsyncSurroundField(curr_pos, map->nav_private, layer, map->pos, ent, faction_id);
 }
 
+void M_NavRequestAsyncFactionTargetsField(const struct map *map, enum nav_layer layer, 
+                                          vec2_t curr_pos, int faction_id)
+{
+    N_RequestAsyncFactionTargetsField(curr_pos, map->nav_private, layer, map->pos, faction_id);
+}
+
+void M_NavRequestAsyncPath(const struct map *map, dest_id_t id, vec2_t curr_pos, vec2_t xz_dest)
+{
+    N_RequestAsyncPath(id, curr_pos, xz_dest, map->nav_private, map->pos);
+}
+
 void M_NavCopyIslandsFieldView(const struct map *map, vec2_t center,
                                int nrows, int ncols, enum nav_layer layer, uint16_t *out_field)
 {
@@ -44,17 +44,20 @@
 #include "../game/public/game.h"
 #include "../lib/public/pf_string.h"
 #include "../lib/public/mem.h"
+#include "../lib/public/SDL_vec_rwops.h"
 #include "../ui.h"
 
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
 
 /* ASCII to integer - argument must be an ascii digit */
 #define A2I(_a) ((_a) - '0')
 #define MINIMAP_DFLT_SZ (256)
 #define PFMAP_VER       (1.0f)
 #define CHK_TRUE(_pred, _label) do{ if(!(_pred)) goto _label; }while(0)
+#define NAV_MARKER      "navdata"
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -133,9 +136,29 @@ static bool m_al_read_pfchunk(SDL_RWops *stream, struct pfchunk *out)
         tiles_read += tiles_in_row;
     }
 
+    out->version = 0;
     return true;
 }
 
+/* If a 'navdata' marker line follows, consumes it and returns the size of 
+ * the binary section after it. Otherwise, the stream is left untouched.
+ */
+static bool m_al_read_nav_marker(SDL_RWops *stream, int *out_size)
+{
+    char line[MAX_LINE_LEN];
+    Sint64 pos = SDL_RWtell(stream);
+    if(pos < 0)
+        return false;
+
+    if(AL_ReadLine(stream, line) 
+    && 1 == sscanf(line, NAV_MARKER " %d\n", out_size)
+    && *out_size >= 0)
+        return true;
+
+    SDL_RWseek(stream, pos, RW_SEEK_SET);
+    return false;
+}
+
 static bool m_al_read_material(SDL_RWops *stream, char *out_texname)
 {
     char line[MAX_LINE_LEN];
@@ -157,44 +180,6 @@ fail:
     return false;
 }
 
-static void m_al_patch_adjacency_info(struct map *map)
-{
-    for(int r = 0; r < map->height; r++) {
-    for(int c = 0; c < map->width;  c++) {
-
-        void *chunk_rprivate = map->chunks[r * map->width + c].render_private;
-        for(int tile_r = 0; tile_r < TILES_PER_CHUNK_HEIGHT; tile_r++) {
-        for(int tile_c = 0; tile_c < TILES_PER_CHUNK_HEIGHT; tile_c++) {
-        
-            struct tile_desc desc = (struct tile_desc){r, c, tile_r, tile_c};
-            const struct tile *tile = &map->chunks[r * map->width + c].tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c];
-
-            R_PushCmd((struct rcmd){
-                .func = R_GL_TilePatchVertsBlend,
-                .nargs = 3,
-                .args = {
-                    chunk_rprivate,
-                    (void*)G_GetPrevTickMap(),
-                    R_PushArg(&desc, sizeof(desc)),
-                },
-            });
-
-            if(!tile->blend_normals)
-                continue;
-
-            R_PushCmd((struct rcmd){
-                .func = R_GL_TilePatchVertsSmooth,
-                .nargs = 3,
-                .args = {
-                    chunk_rprivate,
-                    (void*)G_GetPrevTickMap(),
-                    R_PushArg(&desc, sizeof(desc)),
-                },
-            });
-        }}
-    }}
-}
-
 static void set_minimap_defaults(struct map *map)
 {
     map->minimap_vres = (vec2_t){1920, 1080};
@@ -259,23 +244,26 @@ bool M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedir,
 
         if(!m_al_read_pfchunk(stream, map->chunks + i))
             return false;
+
+        for(int j = 0; j < TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT; j++) {
+            M_Tile_GetHeights(&map->chunks[i].tiles[j], &map->chunks[i].heights[j]);
+        }
     }
 
+    STALLOC(void*, privs, num_chunks);
     for(int i = 0; i < num_chunks; i++) {
     
         map->chunks[i].render_private = (void*)unused_base;
         size_t renderbuff_sz = R_AL_PrivBuffSizeForChunk(
                                TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 0);
         unused_base += renderbuff_sz;
-
-        if(!R_AL_InitPrivFromTiles(map, i / header->num_cols, i % header->num_cols,
-                                   map->chunks[i].tiles, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT,
-                                   map->chunks[i].render_private, basedir)) {
-            return false;
-        }
+        privs[i] = map->chunks[i].render_private;
     }
 
-    m_al_patch_adjacency_info(map);
+    bool built = R_AL_InitPrivFromChunks(map, num_chunks, privs);
+    STFREE(privs);
+    if(!built)
+        return false;
 
     /* Build navigation grid */
     STALLOC(const struct tile*, chunk_tiles, map->width * map->height);
@@ -285,8 +273,44 @@ bool M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedir,
         chunk_tiles[r * map->width + c] = map->chunks[r * map->width + c].tiles;
     }}
 
-    map->nav_private = N_BuildForMapData(map->width, map->height, 
-        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles, update_navgrid);
+    /* The tiles may be followed by an optional section with the navigation 
+     * data already built from them. Use it if it is still up-to-date. Hold
+     * on to the bytes, so that they can be written out as-is when the map
+     * is saved again. */
+    int navsize;
+    map->nav_private = NULL;
+    map->nav_baked = NULL;
+    map->nav_baked_size = 0;
+
+    if(m_al_read_nav_marker(stream, &navsize)) {
+
+        void *baked = malloc(navsize ? navsize : 1);
+        if(!baked || (navsize && !SDL_RWread(stream, baked, navsize, 1))) {
+            PF_FREE(baked);
+            STFREE(chunk_tiles);
+            return false;
+        }
+
+        SDL_RWops *navstream = SDL_RWFromConstMem(baked, navsize);
+        if(update_navgrid && navstream) {
+            map->nav_private = N_LoadBaked(map->width, map->height, 
+                TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles, navstream);
+        }
+        if(navstream)
+            SDL_RWclose(navstream);
+
+        if(map->nav_private) {
+            map->nav_baked = baked;
+            map->nav_baked_size = navsize;
+        }else{
+            PF_FREE(baked);
+        }
+    }
+
+    if(!map->nav_private) {
+        map->nav_private = N_BuildForMapData(map->width, map->height, 
+            TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles, update_navgrid);
+    }
     STFREE(chunk_tiles);
 
     if(!map->nav_private)
@@ -295,6 +319,78 @@ bool M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedir,
     return true;
 }
 
+static bool m_al_bake_nav(struct map *map)
+{
+    bool ret = false;
+
+    /* Build the data from scratch, as the map's own may already have
+     * been modified by the objects in the scene. */
+    STALLOC(const struct tile*, chunk_tiles, map->width * map->height);
+    for(int i = 0; i < map->width * map->height; i++) {
+        chunk_tiles[i] = map->chunks[i].tiles;
+    }
+
+    void *nav_private = N_BuildForMapData(map->width, map->height, 
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles, true);
+    if(!nav_private)
+        goto fail_build;
+
+    SDL_RWops *baked = PFSDL_VectorRWOps();
+    if(!baked)
+        goto fail_stream;
+
+    CHK_TRUE(N_SaveBaked(nav_private, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 
+        chunk_tiles, baked), fail_write);
+
+    Sint64 size = SDL_RWsize(baked);
+    CHK_TRUE(size >= 0 && size <= INT32_MAX, fail_write);
+
+    map->nav_baked = malloc(size ? size : 1);
+    CHK_TRUE(map->nav_baked, fail_write);
+    memcpy(map->nav_baked, PFSDL_VectorRWOpsRaw(baked), size);
+    map->nav_baked_size = size;
+    ret = true;
+
+#ifndef NDEBUG
+    /* The loader must accept what was just baked, or the maps will 
+     * silently fall back to re-building the data from the tiles. */
+    SDL_RWops *check = SDL_RWFromConstMem(map->nav_baked, map->nav_baked_size);
+    assert(check);
+    void *loaded = N_LoadBaked(map->width, map->height, TILES_PER_CHUNK_WIDTH, 
+        TILES_PER_CHUNK_HEIGHT, chunk_tiles, check);
+    assert(loaded);
+    assert(SDL_RWtell(check) == map->nav_baked_size);
+    N_FreePrivate(loaded);
+    SDL_RWclose(check);
+#endif
+
+fail_write:
+    SDL_RWclose(baked);
+fail_stream:
+    N_FreePrivate(nav_private);
+fail_build:
+    STFREE(chunk_tiles);
+    return ret;
+}
+
+bool M_AL_WriteNavData(struct map *map, SDL_RWops *stream)
+{
+    char line[MAX_LINE_LEN];
+
+    if(!map->nav_baked && !m_al_bake_nav(map))
+        return false;
+
+    pf_snprintf(line, sizeof(line), NAV_MARKER " %010d\n", (int)map->nav_baked_size);
+    CHK_TRUE(SDL_RWwrite(stream, line, strlen(line), 1), fail);
+    if(map->nav_baked_size) {
+        CHK_TRUE(SDL_RWwrite(stream, map->nav_baked, map->nav_baked_size, 1), fail);
+    }
+    return true;
+
+fail:
+    return false;
+}
+
 size_t M_AL_BuffSizeFromHeader(const struct pfmap_hdr *header)
 {
     size_t num_chunks = header->num_rows * header->num_cols;
@@ -304,37 +400,106 @@ size_t M_AL_BuffSizeFromHeader(const struct pfmap_hdr *header)
                                      TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 0));
 }
 
+static int m_al_compare_tds(const void *a, const void *b)
+{
+    const struct tile_desc *ta = a, *tb = b;
+
+    int ret;
+    if((ret = ta->chunk_r - tb->chunk_r))
+        return ret;
+    if((ret = ta->chunk_c - tb->chunk_c))
+        return ret;
+    if((ret = ta->tile_r - tb->tile_r))
+        return ret;
+    return ta->tile_c - tb->tile_c;
+}
+
+static bool m_al_same_chunk(const struct tile_desc *a, const struct tile_desc *b)
+{
+    return (a->chunk_r == b->chunk_r) && (a->chunk_c == b->chunk_c);
+}
+
 bool M_AL_UpdateTile(struct map *map, const struct tile_desc *desc, const struct tile *tile)
 {
-    if(desc->chunk_r >= map->height || desc->chunk_c >= map->width)
+    return M_AL_UpdateTiles(map, 1, desc, tile);
+}
+
+bool M_AL_UpdateTiles(struct map *map, size_t ntiles, const struct tile_desc *descs, 
+                      const struct tile *tiles)
+{
+    for(int i = 0; i < ntiles; i++) {
+        if(descs[i].chunk_r >= map->height || descs[i].chunk_c >= map->width)
+            return false;
+    }
+    if(ntiles == 0)
+        return true;
+
+    struct tile_desc *dirty = malloc(ntiles * 9 * sizeof(struct tile_desc));
+    if(!dirty)
         return false;
 
-    struct pfchunk *chunk = &map->chunks[desc->chunk_r * map->width + desc->chunk_c];
-    chunk->tiles[desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c] = *tile;
+    /* The baked navigation data no longer matches the tiles */
+    PF_FREE(map->nav_baked);
+    map->nav_baked = NULL;
+    map->nav_baked_size = 0;
 
     struct map_resolution res;
     M_GetResolution(map, &res);
+    size_t ndirty = 0;
 
-    for(int dr = -1; dr <= 1; dr++) {
-    for(int dc = -1; dc <= 1; dc++) {
-    
-        struct tile_desc curr = *desc;
-        int ret = M_Tile_RelativeDesc(res, &curr, dc, dr);
-        if(ret) {
-        
-            struct pfchunk *chunk = &map->chunks[curr.chunk_r * map->width + curr.chunk_c];
-            R_PushCmd((struct rcmd){
-                .func = R_GL_TileUpdate,
-                .nargs = 3,
-                .args = {
-                    chunk->render_private,
-                    (void*)G_GetPrevTickMap(),
-                    R_PushArg(&curr, sizeof(curr)),
-                },
-            });
-        }
-    }}
+    for(int i = 0; i < ntiles; i++) {
+
+        const struct tile_desc *desc = &descs[i];
+        struct pfchunk *chunk = &map->chunks[desc->chunk_r * map->width + desc->chunk_c];
+        chunk->tiles[desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c] = tiles[i];
+        M_Tile_GetHeights(&tiles[i], &chunk->heights[desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c]);
+        chunk->version++;
+
+        /* The vertices of the surrounding tiles also depend on this tile's 
+         * attributes, so they are to be updated as well. */
+        for(int dr = -1; dr <= 1; dr++) {
+        for(int dc = -1; dc <= 1; dc++) {
+
+            struct tile_desc curr = *desc;
+            if(M_Tile_RelativeDesc(res, &curr, dc, dr))
+                dirty[ndirty++] = curr;
+        }}
+    }
+
+    /* Group the dirty tiles by chunk, dropping the duplicates, so that every
+     * tile gets rebuilt only once and every chunk gets only a single upload. */
+    qsort(dirty, ndirty, sizeof(struct tile_desc), m_al_compare_tds);
+    size_t nunique = 0;
+    for(int i = 0; i < ndirty; i++) {
+        if(nunique > 0 && 0 == m_al_compare_tds(&dirty[nunique - 1], &dirty[i]))
+            continue;
+        dirty[nunique++] = dirty[i];
+    }
+
+    for(int begin = 0; begin < nunique;) {
+
+        int end = begin + 1;
+        while(end < nunique && m_al_same_chunk(&dirty[begin], &dirty[end]))
+            end++;
+
+        const struct tile_desc *first = &dirty[begin];
+        struct pfchunk *chunk = &map->chunks[first->chunk_r * map->width + first->chunk_c];
+        size_t count = end - begin;
+
+        R_PushCmd((struct rcmd){
+            .func = R_GL_TileUpdateBatch,
+            .nargs = 4,
+            .args = {
+                chunk->render_private,
+                (void*)G_GetPrevTickMap(),
+                R_PushArg(&count, sizeof(count)),
+                R_PushArg(first, count * sizeof(struct tile_desc)),
+            },
+        });
+        begin = end;
+    }
 
+    PF_FREE(dirty);
     return true;
 }
 
@@ -343,6 +508,7 @@ void M_AL_FreePrivate(struct map *map)
     R_PushCmd((struct rcmd){ .func = R_GL_MapShutdown });
     assert(map->nav_private);
     N_FreePrivate(map->nav_private);
+    PF_FREE(map->nav_baked);
 }
 
 size_t M_AL_ShallowCopySize(size_t nrows, size_t ncols)
@@ -356,6 +522,19 @@ void M_AL_ShallowCopy(struct map *dst, const struct map *src)
     memcpy(dst, src, M_AL_ShallowCopySize(src->width, src->height));
 }
 
+void M_AL_RefreshShallowCopy(struct map *dst, const struct map *src)
+{
+    assert(dst->width == src->width && dst->height == src->height);
+    memcpy(dst, src, sizeof(struct map));
+
+    size_t nchunks = src->width * src->height;
+    for(int i = 0; i < nchunks; i++) {
+        if(dst->chunks[i].version == src->chunks[i].version)
+            continue;
+        dst->chunks[i] = src->chunks[i];
+    }
+}
+
 struct map *M_AL_CopyWithFields(const struct map *src)
 {
     size_t map_size = M_AL_ShallowCopySize(src->width, src->height);
@@ -80,6 +80,16 @@ struct map{
      * ------------------------------------------------------------------------
      */
     void *nav_private;
+    /* ------------------------------------------------------------------------
+     * The serialized navigation data built from the tiles alone (before any 
+     * objects in the scene have modified it). Kept around so that saving 
+     * the map (ex. pushing a subsession) does not need to rebuild it from
+     * scratch each time. Dropped whenever a tile is updated. Shallow copies
+     * of the map do not own this buffer.
+     * ------------------------------------------------------------------------
+     */
+    void  *nav_baked;
+    size_t nav_baked_size;
     /* ------------------------------------------------------------------------
      * Save the materials information read from the source PFMap file. This is 
      * used when saving to a new PFMAp file.
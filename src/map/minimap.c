@@ -406,7 +406,30 @@ void M_RenderMinimap(const struct map *map, const struct camera *cam)
     });
 }
 
-void M_RenderMinimapUnits(const struct map *map, size_t nunits, vec2_t *posbuff, vec3_t *colorbuff)
+void M_UpdateMinimapUnits(const struct map *map, size_t nunits, vec2_t *posbuff, vec3_t *colorbuff)
+{
+    assert(map);
+    if(map->minimap_sz == 0)
+        return;
+
+    void *pbuff = stalloc(&G_GetSimWS()->args, nunits * sizeof(vec2_t));
+    void *cbuff = stalloc(&G_GetSimWS()->args, nunits * sizeof(vec3_t));
+
+    memcpy(pbuff, posbuff, nunits * sizeof(vec2_t));
+    memcpy(cbuff, colorbuff, nunits * sizeof(vec3_t));
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_MinimapUpdateUnits,
+        .nargs = 3,
+        .args = {
+            R_PushArg(&nunits, sizeof(nunits)),
+            pbuff,
+            cbuff
+        },
+    });
+}
+
+void M_RenderMinimapUnits(const struct map *map)
 {
     assert(map);
     if(map->minimap_sz == 0)
@@ -424,22 +447,13 @@ void M_RenderMinimapUnits(const struct map *map, size_t nunits, vec2_t *posbuff,
     PFM_Vec2_Sub(&curr_bounds.b, &curr_bounds.a, &ab);
     int len = PFM_Vec2_Len(&ab);
 
-    void *pbuff = stalloc(&G_GetSimWS()->args, nunits * sizeof(vec2_t));
-    void *cbuff = stalloc(&G_GetSimWS()->args, nunits * sizeof(vec3_t));
-
-    memcpy(pbuff, posbuff, nunits * sizeof(vec2_t));
-    memcpy(cbuff, colorbuff, nunits * sizeof(vec3_t));
-
     R_PushCmd((struct rcmd){
         .func = R_GL_MinimapRenderUnits,
-        .nargs = 6,
+        .nargs = 3,
         .args = {
             (void*)G_GetPrevTickMap(),
             R_PushArg(&center, sizeof(center)),
             R_PushArg(&len, sizeof(len)),
-            R_PushArg(&nunits, sizeof(nunits)),
-            pbuff,
-            cbuff
         },
     });
 }
@@ -0,0 +1,294 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "map_private.h"
+#include "public/tile.h"
+#include "public/map.h"
+#include "../pf_math.h"
+#include "../camera.h"
+#include "../phys/public/collision.h"
+
+#include <float.h>
+#include <math.h>
+
+
+#define OCCL_W          (256)
+#define OCCL_H          (128)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define CLAMP(a, min, max) (MIN(MAX((a), (min)), (max)))
+
+struct occl_vert{
+    float x, y; /* screen-space, in buffer pixels */
+    float z;    /* NDC depth */
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The nearest occluder depth of every pixel, in NDC. Pixels not covered
+ * by any occluder hold 1.0 (the far plane). */
+static float    s_depth[OCCL_W * OCCL_H];
+static mat4x4_t s_view_proj;
+static bool     s_valid = false;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool occl_project(vec3_t ws, struct occl_vert *out)
+{
+    vec4_t homo = (vec4_t){ws.x, ws.y, ws.z, 1.0f};
+    vec4_t clip;
+    PFM_Mat4x4_Mult4x1(&s_view_proj, &homo, &clip);
+
+    if(clip.w <= FLT_EPSILON)
+        return false;
+
+    out->x = (clip.x / clip.w + 1.0f) * 0.5f * OCCL_W;
+    out->y = (1.0f - clip.y / clip.w) * 0.5f * OCCL_H;
+    out->z = clip.z / clip.w;
+    return true;
+}
+
+static float occl_edge(const struct occl_vert *a, const struct occl_vert *b, float px, float py)
+{
+    return (b->x - a->x) * (py - a->y) - (b->y - a->y) * (px - a->x);
+}
+
+/* Depth-only rasterization, sampled at the pixel centers. NDC depth is 
+ * affine in screen space, so it can be interpolated with the barycentrics 
+ * directly. */
+static void occl_raster_tri(const struct occl_vert *a, const struct occl_vert *b, 
+                            const struct occl_vert *c)
+{
+    float area = occl_edge(a, b, c->x, c->y);
+    if(fabsf(area) < FLT_EPSILON)
+        return;
+
+    int minx = MAX((int)floorf(MIN(a->x, MIN(b->x, c->x))), 0);
+    int miny = MAX((int)floorf(MIN(a->y, MIN(b->y, c->y))), 0);
+    int maxx = MIN((int)ceilf (MAX(a->x, MAX(b->x, c->x))), OCCL_W - 1);
+    int maxy = MIN((int)ceilf (MAX(a->y, MAX(b->y, c->y))), OCCL_H - 1);
+
+    const float inv_area = 1.0f / area;
+
+    for(int y = miny; y <= maxy; y++) {
+    for(int x = minx; x <= maxx; x++) {
+
+        float px = x + 0.5f, py = y + 0.5f;
+        float w0 = occl_edge(b, c, px, py) * inv_area;
+        float w1 = occl_edge(c, a, px, py) * inv_area;
+        float w2 = occl_edge(a, b, px, py) * inv_area;
+
+        if(w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+            continue;
+
+        float z = w0 * a->z + w1 * b->z + w2 * c->z;
+        float *out = &s_depth[y * OCCL_W + x];
+        *out = MIN(*out, z);
+    }}
+}
+
+static void occl_raster_quad(vec3_t a, vec3_t b, vec3_t c, vec3_t d)
+{
+    /* Quads touching the near plane are dropped rather than clipped. This 
+     * only ever loses occluders, so the result stays conservative. */
+    struct occl_vert sa, sb, sc, sd;
+    if(!occl_project(a, &sa) || !occl_project(b, &sb)
+    || !occl_project(c, &sc) || !occl_project(d, &sd))
+        return;
+
+    occl_raster_tri(&sa, &sb, &sc);
+    occl_raster_tri(&sa, &sc, &sd);
+}
+
+static const struct tile *occl_tile(const struct map *map, int r, int c)
+{
+    const int nrows = map->height * TILES_PER_CHUNK_HEIGHT;
+    const int ncols = map->width * TILES_PER_CHUNK_WIDTH;
+    if(r < 0 || r >= nrows || c < 0 || c >= ncols)
+        return NULL;
+
+    const struct pfchunk *chunk = &map->chunks[(r / TILES_PER_CHUNK_HEIGHT) * map->width 
+                                              + (c / TILES_PER_CHUNK_WIDTH)];
+    return &chunk->tiles[(r % TILES_PER_CHUNK_HEIGHT) * TILES_PER_CHUNK_WIDTH 
+                       + (c % TILES_PER_CHUNK_WIDTH)];
+}
+
+/* The occluders are the tile tops flattened to their base height and the 
+ * vertical walls between tiles of different base heights. All of them lie 
+ * on or below the rendered terrain surface, inside the solid ground, so 
+ * anything they hide is also hidden by the real terrain. */
+static void occl_raster_chunk(const struct map *map, int chunk_r, int chunk_c)
+{
+    const float chunk_x = map->pos.x - chunk_c * TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    const float chunk_z = map->pos.z + chunk_r * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+    const struct pfchunk *chunk = &map->chunks[chunk_r * map->width + chunk_c];
+
+    for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
+
+        const float z0 = chunk_z + r * Z_COORDS_PER_TILE;
+        const float z1 = z0 + Z_COORDS_PER_TILE;
+        const struct tile *row = &chunk->tiles[r * TILES_PER_CHUNK_WIDTH];
+
+        /* Merge runs of tiles with the same base height into a single quad */
+        int start = 0;
+        for(int c = 1; c <= TILES_PER_CHUNK_WIDTH; c++) {
+
+            if(c < TILES_PER_CHUNK_WIDTH && row[c].base_height == row[start].base_height)
+                continue;
+
+            const float y = row[start].base_height * Y_COORDS_PER_TILE;
+            const float x0 = chunk_x - start * X_COORDS_PER_TILE;
+            const float x1 = chunk_x - c * X_COORDS_PER_TILE;
+            occl_raster_quad(
+                (vec3_t){x0, y, z0}, (vec3_t){x1, y, z0},
+                (vec3_t){x1, y, z1}, (vec3_t){x0, y, z1});
+            start = c;
+        }
+
+        for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+
+            const int gr = chunk_r * TILES_PER_CHUNK_HEIGHT + r;
+            const int gc = chunk_c * TILES_PER_CHUNK_WIDTH + c;
+            const float x0 = chunk_x - c * X_COORDS_PER_TILE;
+            const float x1 = x0 - X_COORDS_PER_TILE;
+            const int h = row[c].base_height;
+
+            const struct tile *right = occl_tile(map, gr, gc + 1);
+            if(right && right->base_height != h) {
+                float ylo = MIN(h, right->base_height) * Y_COORDS_PER_TILE;
+                float yhi = MAX(h, right->base_height) * Y_COORDS_PER_TILE;
+                occl_raster_quad(
+                    (vec3_t){x1, ylo, z0}, (vec3_t){x1, ylo, z1},
+                    (vec3_t){x1, yhi, z1}, (vec3_t){x1, yhi, z0});
+            }
+
+            const struct tile *bot = occl_tile(map, gr + 1, gc);
+            if(bot && bot->base_height != h) {
+                float ylo = MIN(h, bot->base_height) * Y_COORDS_PER_TILE;
+                float yhi = MAX(h, bot->base_height) * Y_COORDS_PER_TILE;
+                occl_raster_quad(
+                    (vec3_t){x0, ylo, z1}, (vec3_t){x1, ylo, z1},
+                    (vec3_t){x1, yhi, z1}, (vec3_t){x0, yhi, z1});
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void M_Occlusion_Update(const struct map *map, const struct camera *cam)
+{
+    mat4x4_t view, proj;
+    Camera_MakeViewMat(cam, &view);
+    Camera_MakeProjMat(cam, &proj);
+    PFM_Mat4x4_Mult4x4(&proj, &view, &s_view_proj);
+
+    for(int i = 0; i < OCCL_W * OCCL_H; i++) {
+        s_depth[i] = 1.0f;
+    }
+
+    struct frustum frustum;
+    Camera_MakeFrustum(cam, &frustum);
+
+    const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+
+    for(int r = 0; r < map->height; r++) {
+    for(int c = 0; c < map->width;  c++) {
+
+        struct aabb chunk_aabb = (struct aabb){
+            .x_max = map->pos.x - c * chunk_x_dim,
+            .x_min = map->pos.x - (c + 1) * chunk_x_dim,
+            .y_min = 0.0f,
+            .y_max = MAX_HEIGHT_LEVEL * Y_COORDS_PER_TILE,
+            .z_min = map->pos.z + r * chunk_z_dim,
+            .z_max = map->pos.z + (r + 1) * chunk_z_dim,
+        };
+        if(C_FrustumAABBIntersectionFast(&frustum, &chunk_aabb) == VOLUME_INTERSEC_OUTSIDE)
+            continue;
+
+        occl_raster_chunk(map, r, c);
+    }}
+
+    s_valid = true;
+}
+
+bool M_Occlusion_OBBHidden(const struct obb *obb)
+{
+    if(!s_valid)
+        return false;
+
+    float minx = FLT_MAX, miny = FLT_MAX, minz = FLT_MAX;
+    float maxx = -FLT_MAX, maxy = -FLT_MAX;
+
+    for(int i = 0; i < 8; i++) {
+
+        struct occl_vert v;
+        if(!occl_project(obb->corners[i], &v))
+            return false;
+
+        minx = MIN(minx, v.x);
+        miny = MIN(miny, v.y);
+        minz = MIN(minz, v.z);
+        maxx = MAX(maxx, v.x);
+        maxy = MAX(maxy, v.y);
+    }
+
+    /* Off-screen objects are the frustum test's business */
+    if(maxx < 0.0f || maxy < 0.0f || minx > OCCL_W || miny > OCCL_H)
+        return false;
+
+    /* Pad the footprint by a pixel, since the occluders are only sampled at 
+     * the pixel centers and may not cover the whole of the edge pixels. */
+    int x0 = CLAMP((int)floorf(minx) - 1, 0, OCCL_W - 1);
+    int y0 = CLAMP((int)floorf(miny) - 1, 0, OCCL_H - 1);
+    int x1 = CLAMP((int)ceilf(maxx) + 1, 0, OCCL_W - 1);
+    int y1 = CLAMP((int)ceilf(maxy) + 1, 0, OCCL_H - 1);
+
+    for(int y = y0; y <= y1; y++) {
+    for(int x = x0; x <= x1; x++) {
+        if(s_depth[y * OCCL_W + x] >= minz)
+            return false;
+    }}
+    return true;
+}
+
@@ -41,6 +41,7 @@
 #include "../pf_math.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct pfchunk{
 
@@ -55,11 +56,23 @@ struct pfchunk{
      * ------------------------------------------------------------------------
      */
     vec3_t          position;
+    /* ------------------------------------------------------------------------
+     * Incremented every time one of the chunk's tiles is modified. Allows
+     * copies of the map to be refreshed by only copying the changed chunks.
+     * ------------------------------------------------------------------------
+     */
+    uint32_t        version;
     /* ------------------------------------------------------------------------
      * Each tiles' attributes, stored in row-major order.
      * ------------------------------------------------------------------------
      */
     struct tile     tiles[TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH];
+    /* ------------------------------------------------------------------------
+     * The decoded corner heights of each tile, in the same order. Must be 
+     * refreshed whenever a tile is modified.
+     * ------------------------------------------------------------------------
+     */
+    struct tile_heights heights[TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH];
 };
 
 #endif
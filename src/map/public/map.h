@@ -216,6 +216,32 @@ bool   M_Raycast_MouseIntersecCoord(vec3_t *out);
  */
 bool   M_Raycast_CameraIntersecCoord(const struct camera *cam, vec3_t *out);
 
+/* ------------------------------------------------------------------------
+ * When the 'pf.video.gpu_picking' setting is enabled, queue up a readback
+ * of the depth buffer under the mouse cursor. This must be called right 
+ * after the map has been drawn, before any entities. The result is used to 
+ * resolve the hovered tile and position on the next frame instead of 
+ * walking the tiles under the mouse ray on the CPU.
+ * ------------------------------------------------------------------------
+ */
+void   M_Raycast_PushPick(const struct camera *cam);
+
+/* ------------------------------------------------------------------------
+ * Rasterize a coarse depth buffer of the terrain in view of 'cam'. The 
+ * occluders are kept on or below the actual terrain surface, so that the 
+ * result is conservative. Should be called once per frame, before any of 
+ * the 'M_Occlusion_OBBHidden' queries.
+ * ------------------------------------------------------------------------
+ */
+void   M_Occlusion_Update(const struct map *map, const struct camera *cam);
+
+/* ------------------------------------------------------------------------
+ * Returns true if the OBB is entirely hidden behind the terrain, as seen 
+ * by the camera passed to the last 'M_Occlusion_Update' call.
+ * ------------------------------------------------------------------------
+ */
+bool   M_Occlusion_OBBHidden(const struct obb *obb);
+
 /* ------------------------------------------------------------------------
  * Utility function to convert an XZ worldspace coordinate to one in the 
  * range (-1, -1) in the 'top left' corner to (1, 1) in the 'bottom right' 
@@ -279,6 +305,13 @@ vec2_t M_ClampedMapCoordinate(const struct map *map, vec2_t xz);
  */
 float  M_HeightAtPoint(const struct map *map, vec2_t xz);
 
+/* ------------------------------------------------------------------------
+ * Writes the Y coordinates of 'npoints' XZ points on the map's surface to 
+ * 'out'. Points outside the map bounds are clamped to its' edges.
+ * ------------------------------------------------------------------------
+ */
+void   M_HeightAtPoints(const struct map *map, size_t npoints, const vec2_t *xz, float *out);
+
 /* ------------------------------------------------------------------------
  * Sets 'out to a tile descriptor for an XZ point on a the map. 'out' is valid
  * if the function returns true.
@@ -316,6 +349,14 @@ void   M_NavUpdateIslandsField(const struct map *map);
 bool   M_NavRequestPath(const struct map *map, vec2_t xz_src, vec2_t xz_dest, 
                         enum nav_layer layer, dest_id_t *out_dest_id);
 
+/* ------------------------------------------------------------------------
+ * Time building the navigation data for the map from scratch, followed by
+ * a batch of queries against the map's navigation data (see N_Benchmark).
+ * ------------------------------------------------------------------------
+ */
+bool   M_NavBenchmark(const struct map *map, const struct nav_bench_desc *desc, 
+                      struct nav_bench_result *out);
+
 /* ------------------------------------------------------------------------
  * Render the flow field that will steer entities towards a particular 
  * destination over the map surface.
@@ -341,6 +382,23 @@ void   M_RenderChunkVisibility(const struct map *map, const struct camera *cam,
 vec2_t M_NavDesiredPointSeekVelocity(const struct map *map, dest_id_t id, 
                                      vec2_t curr_pos, vec2_t xz_dest);
 
+/* ------------------------------------------------------------------------
+ * Like 'M_NavDesiredPointSeekVelocity', but only uses the already cached 
+ * fields and may be called from worker threads so long as nothing is 
+ * modifying the navigation state. Returns false if the full query is 
+ * needed.
+ * ------------------------------------------------------------------------
+ */
+bool   M_NavTryDesiredPointSeekVelocity(const struct map *map, dest_id_t id, 
+                                        vec2_t curr_pos, vec2_t *out);
+
+/* ------------------------------------------------------------------------
+ * Mark the fields used by the thread-safe queries at 'curr_pos' as recently
+ * used, so that they are not evicted from the caches.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavTouchDestFields(const struct map *map, dest_id_t id, vec2_t curr_pos);
+
 /* ------------------------------------------------------------------------
  * Returns the desired velocity vector for moving with the flow field 
  * for approaching enemies of a particular faction.
@@ -358,6 +416,24 @@ vec2_t M_NavDesiredEnemySeekVelocity(const struct map *map, enum nav_layer layer
 vec2_t M_NavDesiredSurroundVelocity(const struct map *map, enum nav_layer layer, 
                                     vec2_t curr_pos, const uint32_t uid, int faction_id);
 
+/* ------------------------------------------------------------------------
+ * Returns the desired velocity vector for getting as close as possible to
+ * the nearest of the targets set for the faction. The same fields are shared
+ * by all the faction's units. Like 'M_NavDesiredSurroundVelocity', this only 
+ * works within a chunk-sized box centered at the target.
+ * ------------------------------------------------------------------------
+ */
+vec2_t M_NavDesiredFactionTargetsVelocity(const struct map *map, enum nav_layer layer, 
+                                          vec2_t curr_pos, int faction_id);
+
+/* ------------------------------------------------------------------------
+ * Set the entities which the units of the faction are surrounding during
+ * the current tick.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavSetFactionTargets(const struct map *map, int faction_id, 
+                              const uint32_t *targets, size_t ntargets);
+
 /* ------------------------------------------------------------------------
  * Returns true if the specified coordinate is in direct line of sight of 
  * the specified destination.
@@ -426,6 +502,15 @@ vec2_t M_NavClosestReachableInRange(const struct map *map, enum nav_layer layer,
 bool M_NavClosestPathable(const struct map *map, enum nav_layer layer, 
                           vec2_t xz_src, vec2_t *out);
 
+/* ------------------------------------------------------------------------
+ * Will write up to 'maxout' mutually reachable pathable positions, at least
+ * 'spacing' apart, in order of increasing distance from the source to 'out'. 
+ * Returns the number of positions written.
+ * ------------------------------------------------------------------------
+ */
+size_t M_NavClosestPathableSet(const struct map *map, enum nav_layer layer, 
+                               vec2_t xz_src, float spacing, size_t maxout, vec2_t *out);
+
 /* ------------------------------------------------------------------------
  * Returns the closest position to 'pos' that is adjacent to a land tile.
  * ------------------------------------------------------------------------
@@ -464,6 +549,14 @@ void   M_NavBlockersIncrefOBB(const struct map *map, int faction_id,
 void   M_NavBlockersDecrefOBB(const struct map *map, int faction_id, 
                               uint32_t flags, const struct obb *obb);
 
+/* ------------------------------------------------------------------------
+ * Hold back the blocker changes made between these calls, so that they 
+ * can be applied all at once. Batches may be nested.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavBlockersBeginBatch(void);
+void   M_NavBlockersEndBatch(void);
+
 /* ------------------------------------------------------------------------
  * Wrapper around navigation APIs.
  * ------------------------------------------------------------------------
@@ -501,6 +594,9 @@ void M_NavRequestAsyncEnemySeekField(const struct map *map, enum nav_layer layer
                                      vec2_t curr_pos, int faction_id);
 void M_NavRequestAsyncSurroundField(const struct map *map, enum nav_layer layer, 
                                     vec2_t curr_pos, uint32_t ent, int faction_id);
+void M_NavRequestAsyncFactionTargetsField(const struct map *map, enum nav_layer layer, 
+                                          vec2_t curr_pos, int faction_id);
+void M_NavRequestAsyncPath(const struct map *map, dest_id_t id, vec2_t curr_pos, vec2_t xz_dest);
 
 /* ------------------------------------------------------------------------
  * Returns true if the tiles under the entity selection cirlce overlap or 
@@ -617,12 +713,21 @@ void   M_SetMinimapResizeMask(struct map *map, int resize_mask);
 void   M_RenderMinimap   (const struct map *map, const struct camera *cam);
 
 /* ------------------------------------------------------------------------
- * Render a coloroed box for every specified unit in the minimap region.
+ * Set the units to be drawn in the minimap region. The positions are kept
+ * by the renderer until the next call, so this does not need to be called
+ * every frame.
  * ------------------------------------------------------------------------
  */
-void   M_RenderMinimapUnits(const struct map *map, size_t nunits, 
+void   M_UpdateMinimapUnits(const struct map *map, size_t nunits, 
                             vec2_t *posbuff, vec3_t *colorbuff);
 
+/* ------------------------------------------------------------------------
+ * Render a colored box for every unit set by the last 'M_UpdateMinimapUnits'
+ * call in the minimap region.
+ * ------------------------------------------------------------------------
+ */
+void   M_RenderMinimapUnits(const struct map *map);
+
 /* ------------------------------------------------------------------------
  * Render the minimap at the location specified by 'M_SetMinimapPos'.
  * ------------------------------------------------------------------------
@@ -695,6 +800,15 @@ bool   M_AL_UpdateChunkMats(const struct map *map, int chunk_r, int chunk_c,
 bool   M_AL_UpdateTile(struct map *map, const struct tile_desc *desc, 
                        const struct tile *tile);
 
+/* ------------------------------------------------------------------------
+ * Set a number of tiles at once. The vertex data of the tiles (and of their
+ * neighbours) is rebuilt only once for the whole batch, with a single buffer
+ * update per affected chunk.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_UpdateTiles(struct map *map, size_t ntiles, const struct tile_desc *descs, 
+                        const struct tile *tiles);
+
 /* ------------------------------------------------------------------------
  * The size (in bytes) needed to store a shallow copy of the map.
  * ------------------------------------------------------------------------
@@ -709,6 +823,13 @@ size_t M_AL_ShallowCopySize(size_t nrows, size_t ncols);
  */
 void   M_AL_ShallowCopy(struct map *dst, const struct map *src);
 
+/* ------------------------------------------------------------------------
+ * Bring 'dst', which must hold an earlier shallow copy of 'src', up to 
+ * date with it. Only the chunks which have been modified since are copied.
+ * ------------------------------------------------------------------------
+ */
+void   M_AL_RefreshShallowCopy(struct map *dst, const struct map *src);
+
 /* ------------------------------------------------------------------------
  * Makes a copy of the map, also copying cost field, blocked fields and
  * faction refcounts from the navigation data.
@@ -722,6 +843,13 @@ struct map *M_AL_CopyWithFields(const struct map *src);
  */
 bool   M_AL_WritePFMap(const struct map *map, SDL_RWops *stream);
 
+/* ------------------------------------------------------------------------
+ * Write the precomputed navigation data for the map's tiles to the stream.
+ * When appended to a PFMap, it will be loaded instead of being rebuilt.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_WriteNavData(struct map *map, SDL_RWops *stream);
+
 
 
 #endif
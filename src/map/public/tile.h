@@ -96,6 +96,19 @@ struct tile{
     bool            blend_normals;
 };
 
+enum tile_split{
+    /* The top face is bilinearly interpolated between the corners */
+    TILE_SPLIT_NONE,
+    /* The top face is made up of two triangles sharing the given diagonal */
+    TILE_SPLIT_NW_SE,
+    TILE_SPLIT_NE_SW,
+};
+
+struct tile_heights{
+    float nw, ne, sw, se;
+    enum tile_split split;
+};
+
 struct tile_desc{
     int chunk_r, chunk_c;
     int tile_r, tile_c;
@@ -143,6 +156,13 @@ bool  M_Tile_RightFaceVisible(const struct tile *tiles, int r, int c);
  */
 float      M_Tile_HeightAtPos(const struct tile *tile, float frac_width, float frac_height);
 
+/* Decode the worldspace heights of the corners of the tile's top face. These are
+ * cached alongside the tiles of the map, so that querying the height at a point 
+ * does not need to look at the tile type.
+ */
+void       M_Tile_GetHeights(const struct tile *tile, struct tile_heights *out);
+float      M_Tile_HeightsAtPos(const struct tile_heights *heights, float frac_width, float frac_height);
+
 struct box M_Tile_Bounds(struct map_resolution res, vec3_t map_pos, struct tile_desc desc);
 struct box M_Tile_ChunkBounds(struct map_resolution res, vec3_t map_pos, int chunk_r, int chunk_c);
 bool       M_Tile_RelativeDesc(struct map_resolution res, struct tile_desc *inout, 
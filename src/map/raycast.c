@@ -34,6 +34,7 @@
  */
 
 #include "map_private.h"
+#include "pfchunk.h"
 #include "public/tile.h"
 #include "public/map.h"
 #include "../event.h"
@@ -41,6 +42,7 @@
 #include "../camera.h"
 #include "../config.h"
 #include "../main.h"
+#include "../settings.h"
 
 #include "../phys/public/collision.h"
 #include "../render/public/render.h"
@@ -50,10 +52,14 @@
 #include <SDL.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 
 
-#define MAX_CANDIDATE_TILES 1024
 #define EPSILON             (1.0f/1024)
+#define MAX_MIP_LEVELS      (16)
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define CLAMP(a, min, max)  (MIN(MAX((a), (min)), (max)))
 
 struct ray{
     vec3_t origin;
@@ -70,13 +76,34 @@ struct rc_ctx{
     bool              valid;
     struct tile_desc  intersec_tile;
     vec3_t            intersec_pos;
+    /* Only GPU pick results written after the raycast was installed 
+     * are considered. */
+    int               pick_base_seq;
+};
+
+/* The maximum height of the tiles' top faces. Every cell of a level holds 
+ * the maximum of the 2x2 cells under it in the previous level, with the 
+ * last level being a single cell. A ray which passes above the maximum of 
+ * a cell cannot hit any of the tiles under it, so the whole cell can be 
+ * skipped over. Cells are refreshed when the chunk versions change. 
+ */
+struct rc_maxmip{
+    const struct map *map;
+    int               nlevels;
+    int               ncols[MAX_MIP_LEVELS];
+    int               nrows[MAX_MIP_LEVELS];
+    float            *levels[MAX_MIP_LEVELS];
+    uint32_t         *versions;
 };
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static struct rc_ctx s_ctx;
+static struct rc_ctx      s_ctx;
+static struct pick_result s_pick;
+static struct rc_maxmip   s_maxmip;
+static struct sval        s_gpu_picking;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -133,56 +160,258 @@ static vec3_t rc_unproject_mouse_coords(void)
     return (vec3_t){ret_homo.x/ret_homo.w, ret_homo.y/ret_homo.w, ret_homo.z/ret_homo.w};
 }
 
+static void rc_maxmip_free(void)
+{
+    for(int i = 0; i < s_maxmip.nlevels; i++) {
+        PF_FREE(s_maxmip.levels[i]);
+    }
+    PF_FREE(s_maxmip.versions);
+    memset(&s_maxmip, 0, sizeof(s_maxmip));
+}
+
+static bool rc_maxmip_alloc(const struct map *map)
+{
+    s_maxmip.map = map;
+    s_maxmip.ncols[0] = map->width * TILES_PER_CHUNK_WIDTH;
+    s_maxmip.nrows[0] = map->height * TILES_PER_CHUNK_HEIGHT;
+    s_maxmip.nlevels = 1;
+
+    while(s_maxmip.ncols[s_maxmip.nlevels - 1] > 1 || s_maxmip.nrows[s_maxmip.nlevels - 1] > 1) {
+
+        int prev = s_maxmip.nlevels - 1;
+        assert(s_maxmip.nlevels < MAX_MIP_LEVELS);
+        s_maxmip.ncols[prev + 1] = (s_maxmip.ncols[prev] + 1) / 2;
+        s_maxmip.nrows[prev + 1] = (s_maxmip.nrows[prev] + 1) / 2;
+        s_maxmip.nlevels++;
+    }
+
+    for(int i = 0; i < s_maxmip.nlevels; i++) {
+        s_maxmip.levels[i] = malloc(s_maxmip.ncols[i] * s_maxmip.nrows[i] * sizeof(float));
+        if(!s_maxmip.levels[i])
+            goto fail;
+    }
+
+    /* Start out of date with every chunk so that all of them get refreshed */
+    s_maxmip.versions = calloc(map->width * map->height, sizeof(uint32_t));
+    if(!s_maxmip.versions)
+        goto fail;
+    for(int i = 0; i < map->width * map->height; i++) {
+        s_maxmip.versions[i] = map->chunks[i].version + 1;
+    }
+    return true;
+
+fail:
+    rc_maxmip_free();
+    return false;
+}
+
+static void rc_maxmip_refresh_region(int level, int r0, int c0, int r1, int c1)
+{
+    const int ncols = s_maxmip.ncols[level];
+    const int prev_ncols = s_maxmip.ncols[level - 1];
+    const int prev_nrows = s_maxmip.nrows[level - 1];
+    const float *prev = s_maxmip.levels[level - 1];
+    float *curr = s_maxmip.levels[level];
+
+    for(int r = r0; r <= r1; r++) {
+    for(int c = c0; c <= c1; c++) {
+
+        float max = -INFINITY;
+        for(int dr = 0; dr < 2; dr++) {
+        for(int dc = 0; dc < 2; dc++) {
+
+            int pr = r * 2 + dr, pc = c * 2 + dc;
+            if(pr < prev_nrows && pc < prev_ncols)
+                max = MAX(max, prev[pr * prev_ncols + pc]);
+        }}
+        curr[r * ncols + c] = max;
+    }}
+}
+
+static bool rc_maxmip_update(const struct map *map)
+{
+    if(s_maxmip.map != map) {
+        rc_maxmip_free();
+        if(!rc_maxmip_alloc(map))
+            return false;
+    }
+
+    for(int chunk_r = 0; chunk_r < map->height; chunk_r++) {
+    for(int chunk_c = 0; chunk_c < map->width; chunk_c++) {
+
+        const struct pfchunk *chunk = &map->chunks[chunk_r * map->width + chunk_c];
+        uint32_t *version = &s_maxmip.versions[chunk_r * map->width + chunk_c];
+        if(*version == chunk->version)
+            continue;
+        *version = chunk->version;
+
+        const int ncols = s_maxmip.ncols[0];
+        for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
+        for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+
+            const struct tile_heights *h = &chunk->heights[r * TILES_PER_CHUNK_WIDTH + c];
+            int abs_r = chunk_r * TILES_PER_CHUNK_HEIGHT + r;
+            int abs_c = chunk_c * TILES_PER_CHUNK_WIDTH + c;
+            s_maxmip.levels[0][abs_r * ncols + abs_c] = MAX(MAX(h->nw, h->ne), MAX(h->sw, h->se));
+        }}
+
+        int r0 = chunk_r * TILES_PER_CHUNK_HEIGHT, r1 = r0 + TILES_PER_CHUNK_HEIGHT - 1;
+        int c0 = chunk_c * TILES_PER_CHUNK_WIDTH,  c1 = c0 + TILES_PER_CHUNK_WIDTH - 1;
+        for(int level = 1; level < s_maxmip.nlevels; level++) {
+            r0 /= 2; r1 /= 2; c0 /= 2; c1 /= 2;
+            rc_maxmip_refresh_region(level, r0, c0, r1, c1);
+        }
+    }}
+    return true;
+}
+
+/* Test the ray against the exact triangle mesh of the tile, including its' sides */
+static bool rc_tile_intersection(vec3_t ray_origin, vec3_t ray_dir, struct tile_desc td,
+                                 vec3_t *out_pos)
+{
+    vec3_t tile_mesh[VERTS_PER_TILE];
+    mat4x4_t model;
+    float t;
+
+    M_ModelMatrixForChunk(s_ctx.map, (struct chunkpos){td.chunk_r, td.chunk_c}, &model);
+    int num_verts = R_TileGetTriMesh(s_ctx.map, &td, &model, tile_mesh);
+
+    if(!C_RayIntersectsTriMesh(ray_origin, ray_dir, tile_mesh, num_verts, &t))
+        return false;
+
+    PFM_Vec3_Scale(&ray_dir, t, &ray_dir);
+    PFM_Vec3_Add(&ray_origin, &ray_dir, out_pos);
+    return true;
+}
+
+/* Clip the ray against the slab [lo, hi] along one axis */
+static bool rc_clip_slab(float origin, float dir, float lo, float hi, float *tmin, float *tmax)
+{
+    if(fabsf(dir) < EPSILON * EPSILON)
+        return (origin >= lo && origin <= hi);
+
+    float t0 = (lo - origin) / dir;
+    float t1 = (hi - origin) / dir;
+    *tmin = MAX(*tmin, MIN(t0, t1));
+    *tmax = MIN(*tmax, MAX(t0, t1));
+    return (*tmin <= *tmax);
+}
+
+/* March the ray over the max-height pyramid. At every step, the ray is 
+ * checked against the coarsest cell containing its' current position that 
+ * it may not be passing over. Cells which are passed over are skipped in a
+ * single step and the ray moves back up the pyramid. Only the tiles that
+ * the ray may dip into are tested against their exact triangle meshes. 
+ */
 static bool rc_find_intersection(vec3_t ray_origin, vec3_t ray_dir,
                                  struct tile_desc *out_intersec, vec3_t *out_pos)
 {
-    struct map_resolution res;
-	M_GetResolution(s_ctx.map, &res);
-
-    /* Project the ray on the Y=(-TILE_DEPTH*Y_COORDS_PER_TILE) plane between the ray origin and where the 
-     * ray intersects the Y=(-TILE_DEPTH*Y_COORDS_PER_TILE) plane. */
-    float t = fabs((ray_origin.y + TILE_DEPTH*Y_COORDS_PER_TILE) / ray_dir.y);
-    struct line_seg_2d y_eq_0_seg = {
-        ray_origin.x, 
-        ray_origin.z,
-        ray_origin.x + t * ray_dir.x, 
-        ray_origin.z + t * ray_dir.z,
-    };
+    if(!rc_maxmip_update(s_ctx.map))
+        return false;
 
-    struct tile_desc cts[MAX_CANDIDATE_TILES];
-    int len = M_Tile_LineSupercoverTilesSorted(res, s_ctx.map->pos, y_eq_0_seg, cts, MAX_CANDIDATE_TILES);
+    /* Work in the tile grid, with columns increasing along -X 
+     * and rows increasing along +Z */
+    const vec3_t map_pos = s_ctx.map->pos;
+    const float gc = (map_pos.x - ray_origin.x) / X_COORDS_PER_TILE;
+    const float gr = (ray_origin.z - map_pos.z) / Z_COORDS_PER_TILE;
+    const float dc = -ray_dir.x / X_COORDS_PER_TILE;
+    const float dr = ray_dir.z / Z_COORDS_PER_TILE;
+
+    const int top = s_maxmip.nlevels - 1;
+    float tmin = 0.0f, tmax = INFINITY;
+    if(!rc_clip_slab(gc, dc, 0.0f, s_maxmip.ncols[0], &tmin, &tmax)
+    || !rc_clip_slab(gr, dr, 0.0f, s_maxmip.nrows[0], &tmin, &tmax)
+    || !rc_clip_slab(ray_origin.y, ray_dir.y, -TILE_DEPTH * Y_COORDS_PER_TILE, 
+                     s_maxmip.levels[top][0], &tmin, &tmax))
+        return false;
 
-    for(int i = 0; i < len; i++) {
-    
-        struct aabb tile_aabb = aabb_for_tile(cts[i], s_ctx.map);
-        float t;
+    int level = top;
+    float t = tmin;
 
-        /* The first level check is to see if the ray intersects the AABB */
-        if(C_RayIntersectsAABB(ray_origin, ray_dir, tile_aabb, &t)) {
+    while(t <= tmax) {
 
-            /* If the ray hits the AABB, perform the second level check:
-             * Check if it intersects the exact triangle mesh of the tile. */
-            vec3_t tile_mesh[VERTS_PER_TILE];
-            mat4x4_t model;
+        float c = gc + dc * t, r = gr + dr * t;
+        int cell_c = CLAMP((int)c, 0, s_maxmip.ncols[0] - 1) >> level;
+        int cell_r = CLAMP((int)r, 0, s_maxmip.nrows[0] - 1) >> level;
 
-            M_ModelMatrixForChunk(s_ctx.map, (struct chunkpos){cts[i].chunk_r, cts[i].chunk_c}, &model);
-            int num_verts = R_TileGetTriMesh(s_ctx.map, &cts[i], &model, tile_mesh);
+        /* Find where the ray leaves the cell */
+        float span = (float)(1 << level);
+        float t_exit = tmax;
+        if(dc > 0.0f) t_exit = MIN(t_exit, ((cell_c + 1) * span - gc) / dc);
+        if(dc < 0.0f) t_exit = MIN(t_exit, (cell_c * span - gc) / dc);
+        if(dr > 0.0f) t_exit = MIN(t_exit, ((cell_r + 1) * span - gr) / dr);
+        if(dr < 0.0f) t_exit = MIN(t_exit, (cell_r * span - gr) / dr);
+        t_exit = MAX(t_exit, t);
 
-            if(C_RayIntersectsTriMesh(ray_origin, ray_dir, tile_mesh, num_verts, &t)) {
+        float y_lo = MIN(ray_origin.y + ray_dir.y * t, ray_origin.y + ray_dir.y * t_exit);
+        float max_height = s_maxmip.levels[level][cell_r * s_maxmip.ncols[level] + cell_c];
 
-                PFM_Vec3_Scale(&ray_dir, t, &ray_dir);
-                PFM_Vec3_Add(&ray_origin, &ray_dir, out_pos);
+        if(y_lo > max_height + EPSILON) {
+            t = t_exit + EPSILON;
+            level = MIN(level + 1, top);
+            continue;
+        }
 
-                *out_intersec = cts[i]; 
-                return true;
-            }
+        if(level > 0) {
+            level--;
+            continue;
         }
+
+        struct tile_desc td = (struct tile_desc){
+            .chunk_r = cell_r / TILES_PER_CHUNK_HEIGHT,
+            .chunk_c = cell_c / TILES_PER_CHUNK_WIDTH,
+            .tile_r  = cell_r % TILES_PER_CHUNK_HEIGHT,
+            .tile_c  = cell_c % TILES_PER_CHUNK_WIDTH,
+        };
+        if(rc_tile_intersection(ray_origin, ray_dir, td, out_pos)) {
+            *out_intersec = td;
+            return true;
+        }
+        t = t_exit + EPSILON;
     }
     return false;
 }
 
+static bool rc_gpu_picking(void)
+{
+    return s_gpu_picking.as_bool;
+}
+
+static bool rc_gpu_result(bool *out_hit, vec3_t *out_pos)
+{
+    int seq = SDL_AtomicGet(&s_pick.seq);
+    if((seq & 0x1) || seq <= s_ctx.pick_base_seq)
+        return false;
+
+    bool hit = s_pick.hit;
+    vec3_t pos = s_pick.pos;
+
+    /* The render thread wrote a newer result while we were reading */
+    if(SDL_AtomicGet(&s_pick.seq) != seq)
+        return false;
+
+    *out_hit = hit;
+    *out_pos = pos;
+    return true;
+}
+
 static void rc_compute(void)
 {
+    bool hit;
+    vec3_t pos;
+
+    if(rc_gpu_picking() && rc_gpu_result(&hit, &pos)) {
+
+        struct map_resolution res;
+        M_GetResolution(s_ctx.map, &res);
+
+        s_ctx.tile_active = hit 
+            && M_Tile_DescForPoint2D(res, s_ctx.map->pos, (vec2_t){pos.x, pos.z}, &s_ctx.intersec_tile);
+        s_ctx.intersec_pos = pos;
+        s_ctx.valid = true;
+        return;
+    }
+
     vec3_t ray_origin = rc_unproject_mouse_coords();
     vec3_t cam_pos = Camera_GetPos(s_ctx.cam);
 
@@ -271,6 +500,8 @@ int M_Raycast_Install(struct map *map, struct camera *cam)
 {
     s_ctx.map = map; 
     s_ctx.cam = cam;
+    s_ctx.pick_base_seq = SDL_AtomicGet(&s_pick.seq);
+    Settings_Bind("pf.video.gpu_picking", &s_gpu_picking);
 
     E_Global_Register(SDL_MOUSEMOTION, on_mousemove, NULL, G_RUNNING);
     E_Global_Register(EVENT_RENDER_3D_POST, on_render, NULL, G_RUNNING | G_PAUSED_FULL | G_PAUSED_UI_RUNNING);
@@ -284,11 +515,13 @@ void M_Raycast_Uninstall(void)
     E_Global_Unregister(SDL_MOUSEMOTION, on_mousemove);
     E_Global_Unregister(EVENT_RENDER_3D_POST, on_render);
     E_Global_Unregister(EVENT_UPDATE_START, on_update_start);
+    Settings_Unbind("pf.video.gpu_picking", &s_gpu_picking);
 
     s_ctx.map = NULL;
     s_ctx.cam = NULL;
     s_ctx.tile_active = false;
     s_ctx.valid = false;
+    rc_maxmip_free();
 }
 
 void M_Raycast_SetHighlightSize(size_t size)
@@ -321,3 +554,28 @@ bool M_Raycast_CameraIntersecCoord(const struct camera *cam, vec3_t *out)
     return rc_find_intersection(ray_origin, ray_dir, &(struct tile_desc){0}, out);
 }
 
+void M_Raycast_PushPick(const struct camera *cam)
+{
+    if(!s_ctx.map || !rc_gpu_picking())
+        return;
+
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+
+    mat4x4_t view, proj, view_proj, inv_view_proj;
+    Camera_MakeViewMat(cam, &view);
+    Camera_MakeProjMat(cam, &proj);
+    PFM_Mat4x4_Mult4x4(&proj, &view, &view_proj);
+    PFM_Mat4x4_Inverse(&view_proj, &inv_view_proj);
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_PickReadDepth,
+        .nargs = 4,
+        .args = {
+            R_PushArg(&mouse_x, sizeof(mouse_x)),
+            R_PushArg(&mouse_y, sizeof(mouse_y)),
+            R_PushArg(&inv_view_proj, sizeof(inv_view_proj)),
+            &s_pick,
+        },
+    });
+}
@@ -236,113 +236,60 @@ bool M_Tile_RightFaceVisible(const struct tile *tiles, int r, int c)
         || (M_Tile_SEHeight(curr) > M_Tile_SWHeight(right));
 }
 
-float M_Tile_HeightAtPos(const struct tile *tile, float frac_width, float frac_height)
+void M_Tile_GetHeights(const struct tile *tile, struct tile_heights *out)
 {
-    if(tile->type == TILETYPE_FLAT) {
-        return tile->base_height * Y_COORDS_PER_TILE;
-
-    }else if(TILETYPE_IS_RAMP(tile->type)) {
-        return PFM_BilinearInterp(
-            M_Tile_NWHeight(tile) * Y_COORDS_PER_TILE, M_Tile_SWHeight(tile) * Y_COORDS_PER_TILE,
-            M_Tile_NEHeight(tile) * Y_COORDS_PER_TILE, M_Tile_SEHeight(tile) * Y_COORDS_PER_TILE,
-            0.0f, 1.0f, 0.0f, 1.0f,
-            frac_width, frac_height);
-
-    }else /*corner tiles */ {
-
-        /* For corner tiles, we break up the top face into two triangles, 
-         * figure out which triangle the point is in, and determine the map 
-         * height by finding the intersection point of a downward facing ray
-         * and the plane of the triangle. */
-
-        vec3_t corners[] = {
-            (vec3_t){0.0f, M_Tile_NWHeight(tile) * Y_COORDS_PER_TILE, 0.0f},
-            (vec3_t){1.0f, M_Tile_NEHeight(tile) * Y_COORDS_PER_TILE, 0.0f},
-            (vec3_t){0.0f, M_Tile_SWHeight(tile) * Y_COORDS_PER_TILE, 1.0f},
-            (vec3_t){1.0f, M_Tile_SEHeight(tile) * Y_COORDS_PER_TILE, 1.0f}
-        };
-
-        /* Triangles are defined in screen coordinates */
-        vec3_t first_tri[3] = {0}, second_tri[3] = {0};
-
-        switch(tile->type){
-        case TILETYPE_CORNER_CONVEX_NE:
-        case TILETYPE_CORNER_CONCAVE_NE:
-        case TILETYPE_CORNER_CONVEX_SW:
-        case TILETYPE_CORNER_CONCAVE_SW: 
-            {
-                first_tri[0] = corners[1];
-                first_tri[1] = corners[3];
-                first_tri[2] = corners[0];
-
-                second_tri[0] = corners[2];
-                second_tri[1] = corners[0];
-                second_tri[2] = corners[3];
-                break;
-            }
-        case TILETYPE_CORNER_CONVEX_NW:
-        case TILETYPE_CORNER_CONCAVE_NW:
-        case TILETYPE_CORNER_CONVEX_SE:
-        case TILETYPE_CORNER_CONCAVE_SE:
-            {
-                first_tri[0] = corners[0];
-                first_tri[1] = corners[1];
-                first_tri[2] = corners[2];
-
-                second_tri[0] = corners[3];
-                second_tri[1] = corners[2];
-                second_tri[2] = corners[1];
-                break;
-            }
-        default: assert(0);
-        }
-
-        vec3_t tri_normal;
-        vec3_t tri_point;
-        vec3_t edge1, edge2;
-
-        if(C_PointInsideTriangle2D(
-            (vec2_t){frac_width, frac_height}, 
-            (vec2_t){first_tri[0].x, first_tri[0].z}, 
-            (vec2_t){first_tri[1].x, first_tri[1].z}, 
-            (vec2_t){first_tri[2].x, first_tri[2].z})) {
-
-            PFM_Vec3_Sub(&first_tri[1], &first_tri[0], &edge1);
-            PFM_Vec3_Sub(&first_tri[2], &first_tri[0], &edge2);
-            tri_point = first_tri[0];
-
-        }else{
-
-            PFM_Vec3_Sub(&second_tri[1], &second_tri[0], &edge1);
-            PFM_Vec3_Sub(&second_tri[2], &second_tri[0], &edge2);
-            tri_point = second_tri[0];
-        }
-
-        PFM_Vec3_Cross(&edge2, &edge1, &tri_normal);
-        PFM_Vec3_Normal(&tri_normal, &tri_normal);
-        assert(tri_normal.y > 0.0f);
-
-        struct plane tri_plane = (struct plane){
-            .point = tri_point,
-            .normal = tri_normal
-        };
-
-        vec3_t ray_origin = (vec3_t){frac_width, (MAX_HEIGHT_LEVEL * Y_COORDS_PER_TILE) + 10, frac_height};
-        vec3_t ray_dir = (vec3_t){0.0f, -1.0f, 0.0f};
-
-        float t;
-        bool result = C_RayIntersectsPlane(ray_origin, ray_dir, tri_plane, &t);
-        (void)result;
-        assert(result);
-
-        vec3_t intersec_point;
-        PFM_Vec3_Scale(&ray_dir, t, &ray_dir);
-        PFM_Vec3_Add(&ray_origin, &ray_dir, &intersec_point);
+    out->nw = M_Tile_NWHeight(tile) * Y_COORDS_PER_TILE;
+    out->ne = M_Tile_NEHeight(tile) * Y_COORDS_PER_TILE;
+    out->sw = M_Tile_SWHeight(tile) * Y_COORDS_PER_TILE;
+    out->se = M_Tile_SEHeight(tile) * Y_COORDS_PER_TILE;
+
+    /* The top face of corner tiles is made up of two triangles. The diagonal 
+     * they share runs between the corners which are not the odd one out. */
+    switch(tile->type) {
+    case TILETYPE_CORNER_CONVEX_NE:
+    case TILETYPE_CORNER_CONCAVE_NE:
+    case TILETYPE_CORNER_CONVEX_SW:
+    case TILETYPE_CORNER_CONCAVE_SW: 
+        out->split = TILE_SPLIT_NW_SE;
+        break;
+    case TILETYPE_CORNER_CONVEX_NW:
+    case TILETYPE_CORNER_CONCAVE_NW:
+    case TILETYPE_CORNER_CONVEX_SE:
+    case TILETYPE_CORNER_CONCAVE_SE:
+        out->split = TILE_SPLIT_NE_SW;
+        break;
+    default:
+        out->split = TILE_SPLIT_NONE;
+        break;
+    }
+}
 
-        return intersec_point.y;
+float M_Tile_HeightsAtPos(const struct tile_heights *h, float frac_width, float frac_height)
+{
+    const float x = frac_width, z = frac_height;
+
+    switch(h->split) {
+    case TILE_SPLIT_NW_SE:
+        if(x >= z)
+            return h->nw + (h->ne - h->nw) * x + (h->se - h->ne) * z;
+        return h->nw + (h->se - h->sw) * x + (h->sw - h->nw) * z;
+    case TILE_SPLIT_NE_SW:
+        if(x + z <= 1.0f)
+            return h->nw + (h->ne - h->nw) * x + (h->sw - h->nw) * z;
+        return h->se + (h->sw - h->se) * (1.0f - x) + (h->ne - h->se) * (1.0f - z);
+    default:
+        return h->nw + (h->ne - h->nw) * x + (h->sw - h->nw) * z 
+             + (h->nw - h->ne - h->sw + h->se) * x * z;
     }
 }
 
+float M_Tile_HeightAtPos(const struct tile *tile, float frac_width, float frac_height)
+{
+    struct tile_heights heights;
+    M_Tile_GetHeights(tile, &heights);
+    return M_Tile_HeightsAtPos(&heights, frac_width, frac_height);
+}
+
 struct box M_Tile_Bounds(struct map_resolution res, vec3_t map_pos, struct tile_desc desc)
 {
     const int TILE_X_DIM = res.field_w / res.tile_w;
@@ -0,0 +1,677 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "metrics.h"
+#include "main.h"
+#include "perf.h"
+#include "sched.h"
+#include "lib/public/mem.h"
+#include "lib/public/pf_string.h"
+#include "render/public/render_ctrl.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#define MAX_CLIENTS         (8)
+#define MAX_REQUEST         (2048)
+#define CLIENT_TIMEOUT_MS   (5000)
+#define MAX_THREADS         (64)
+#define MAX_SCOPES          (128)
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+
+#ifdef _WIN32
+typedef SOCKET sock_t;
+#define BAD_SOCKET          INVALID_SOCKET
+#define close_socket        closesocket
+#define SEND_FLAGS          (0)
+#else
+typedef int sock_t;
+#define BAD_SOCKET          (-1)
+#define close_socket        close
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS          (MSG_NOSIGNAL)
+#else
+#define SEND_FLAGS          (0)
+#endif
+#endif
+
+struct writer{
+    char   *data;
+    size_t  size;
+    size_t  cap;
+    bool    overflow;
+};
+
+struct client{
+    sock_t   sock;
+    uint32_t accepted;
+    char     request[MAX_REQUEST];
+    size_t   request_size;
+    /* Set once the full request has been read */
+    char    *response;
+    size_t   response_size;
+    size_t   sent;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool          s_active = false;
+static sock_t        s_sock = BAD_SOCKET;
+static struct client s_clients[MAX_CLIENTS];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void put_fmt(struct writer *w, const char *fmt, ...)
+{
+    if(w->overflow)
+        return;
+
+    va_list args;
+    while(true) {
+        va_start(args, fmt);
+        int len = vsnprintf(w->data + w->size, w->cap - w->size, fmt, args);
+        va_end(args);
+
+        if(len < 0) {
+            w->overflow = true;
+            return;
+        }
+        if(w->size + len < w->cap) {
+            w->size += len;
+            return;
+        }
+        size_t newcap = (w->cap == 0) ? 16384 : w->cap * 2;
+        while(newcap <= w->size + len)
+            newcap *= 2;
+        char *data = realloc(w->data, newcap);
+        if(!data) {
+            w->overflow = true;
+            return;
+        }
+        w->data = data;
+        w->cap = newcap;
+    }
+}
+
+/* Metric names may only contain [a-zA-Z0-9_:] */
+static void put_name(struct writer *w, const char *name)
+{
+    char buff[128] = "pf_";
+    size_t len = strlen(buff);
+    for(const char *c = name; *c && len < sizeof(buff) - 1; c++) {
+        bool valid = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z')
+                  || (*c >= '0' && *c <= '9') || (*c == '_');
+        buff[len++] = valid ? *c : '_';
+    }
+    buff[len] = '\0';
+    put_fmt(w, "%s", buff);
+}
+
+static void put_label_value(struct writer *w, const char *value)
+{
+    put_fmt(w, "\"");
+    for(const char *c = value; *c; c++) {
+        switch(*c) {
+        case '\\': put_fmt(w, "\\\\");  break;
+        case '"':  put_fmt(w, "\\\"");  break;
+        case '\n': put_fmt(w, "\\n");   break;
+        default:   put_fmt(w, "%c", *c); break;
+        }
+    }
+    put_fmt(w, "\"");
+}
+
+static void put_type(struct writer *w, const char *name, const char *type)
+{
+    put_fmt(w, "# TYPE ");
+    put_name(w, name);
+    put_fmt(w, " %s\n", type);
+}
+
+static void put_value(struct writer *w, const char *name, double value)
+{
+    put_name(w, name);
+    put_fmt(w, " %.10g\n", value);
+}
+
+static void put_labelled(struct writer *w, const char *name, const char *label, 
+                         const char *lvalue, double value)
+{
+    put_name(w, name);
+    put_fmt(w, "{%s=", label);
+    put_label_value(w, lvalue);
+    put_fmt(w, "} %.10g\n", value);
+}
+
+static void put_gauge(struct writer *w, const char *name, double value)
+{
+    put_type(w, name, "gauge");
+    put_value(w, name, value);
+}
+
+static void write_percentiles(struct writer *w)
+{
+    static const char *s_names[] = {
+        [PERF_METRIC_FRAME]  = "frame",
+        [PERF_METRIC_SIM]    = "sim",
+        [PERF_METRIC_RENDER] = "render",
+        [PERF_METRIC_SCRIPT] = "script",
+        [PERF_METRIC_GC]     = "gc",
+    };
+    _Static_assert(ARR_SIZE(s_names) == PERF_METRIC_COUNT, "");
+
+    struct perf_percentiles pcts[PERF_METRIC_COUNT];
+    for(int i = 0; i < PERF_METRIC_COUNT; i++) {
+        Perf_GetPercentiles(i, &pcts[i]);
+    }
+
+    put_type(w, "perf_ms", "gauge");
+    for(int i = 0; i < PERF_METRIC_COUNT; i++) {
+        const struct { const char *quantile; double value; } rows[] = {
+            {"0.5",  pcts[i].p50_ms},
+            {"0.95", pcts[i].p95_ms},
+            {"0.99", pcts[i].p99_ms},
+            {"1",    pcts[i].max_ms},
+        };
+        for(int j = 0; j < ARR_SIZE(rows); j++) {
+            put_name(w, "perf_ms");
+            put_fmt(w, "{metric=\"%s\",quantile=\"%s\"} %.10g\n", 
+                s_names[i], rows[j].quantile, rows[j].value);
+        }
+    }
+    put_type(w, "perf_mean_ms", "gauge");
+    for(int i = 0; i < PERF_METRIC_COUNT; i++) {
+        put_labelled(w, "perf_mean_ms", "metric", s_names[i], pcts[i].mean_ms);
+    }
+    put_type(w, "perf_samples", "gauge");
+    for(int i = 0; i < PERF_METRIC_COUNT; i++) {
+        put_labelled(w, "perf_samples", "metric", s_names[i], pcts[i].nsamples);
+    }
+}
+
+/* The time spent in the outermost two levels of the instrumented scopes 
+ * of every thread. The perf trees are only recorded in debug builds. */
+static void write_scopes(struct writer *w)
+{
+    struct perf_info *infos[MAX_THREADS];
+    size_t nthreads = Perf_Report(ARR_SIZE(infos), infos);
+
+    put_type(w, "scope_ms", "gauge");
+    for(int i = 0; i < nthreads; i++) {
+
+        const struct perf_info *info = infos[i];
+        const char *names[MAX_SCOPES];
+        double totals[MAX_SCOPES];
+        size_t nscopes = 0;
+
+        for(int j = 0; j < info->nentries; j++) {
+
+            int parent = info->entries[j].parent_idx;
+            if(parent >= 0 && info->entries[parent].parent_idx >= 0)
+                continue;
+
+            const char *name = info->entries[j].funcname;
+            int k = 0;
+            for(; k < nscopes; k++) {
+                if(!strcmp(names[k], name))
+                    break;
+            }
+            if(k == nscopes) {
+                if(nscopes == MAX_SCOPES)
+                    continue;
+                names[nscopes] = name;
+                totals[nscopes] = 0.0;
+                nscopes++;
+            }
+            totals[k] += info->entries[j].ms_delta;
+        }
+
+        for(int j = 0; j < nscopes; j++) {
+            put_name(w, "scope_ms");
+            put_fmt(w, "{thread=");
+            put_label_value(w, info->threadname);
+            put_fmt(w, ",scope=");
+            put_label_value(w, names[j]);
+            put_fmt(w, "} %.10g\n", totals[j]);
+        }
+        free(infos[i]);
+    }
+}
+
+static void write_sched_stats(struct writer *w)
+{
+    struct sched_stats stats;
+    Sched_GetStats(&stats);
+
+    put_gauge(w, "sched_workers", stats.nworkers);
+    put_gauge(w, "sched_tick_ms", stats.tick_ms);
+    put_gauge(w, "sched_tasks_live", stats.ntasks_live);
+    put_gauge(w, "sched_tasks_created", stats.ntasks_created);
+    put_gauge(w, "sched_switches", stats.nswitches);
+    put_gauge(w, "sched_steals", stats.nsteals);
+    put_gauge(w, "sched_deadline_misses", stats.ndeadline_misses);
+    put_gauge(w, "sched_max_queue_depth", stats.max_queue_depth);
+    put_gauge(w, "sched_ready_wait_ms", stats.ready_wait_ms);
+    put_gauge(w, "sched_ready_wait_max_ms", stats.ready_wait_max_ms);
+
+    put_type(w, "sched_blocked_ms", "gauge");
+    put_labelled(w, "sched_blocked_ms", "on", "message", stats.blocked_msg_ms);
+    put_labelled(w, "sched_blocked_ms", "on", "event", stats.blocked_event_ms);
+
+    struct sched_topology topo;
+    Sched_GetTopology(&topo);
+    put_type(w, "sched_cpus", "gauge");
+    put_labelled(w, "sched_cpus", "kind", "logical", topo.nlogical);
+    put_labelled(w, "sched_cpus", "kind", "core", topo.ncores);
+    put_labelled(w, "sched_cpus", "kind", "efficiency_core", topo.nefficiency);
+    put_labelled(w, "sched_cpus", "kind", "package", topo.npackages);
+    put_labelled(w, "sched_cpus", "kind", "node", topo.nnodes);
+    put_gauge(w, "sched_capacity", topo.capacity);
+
+    /* The fraction of the scheduler's tick each thread spent running tasks */
+    double tick_ms = stats.tick_ms > 0.0 ? stats.tick_ms : 1.0;
+    put_type(w, "sched_utilization", "gauge");
+    put_labelled(w, "sched_utilization", "worker", "main", stats.main_busy_ms / tick_ms);
+    for(int i = 0; i < stats.nworkers && i < SCHED_MAX_WORKERS; i++) {
+        char id[16];
+        pf_snprintf(id, sizeof(id), "%d", i);
+        put_labelled(w, "sched_utilization", "worker", id, stats.worker_busy_ms[i] / tick_ms);
+    }
+}
+
+static void write_mem_stats(struct writer *w)
+{
+    struct mem_tag_stats stats[MEM_TAG_COUNT];
+    size_t ntags = pf_mem_get_stats(stats);
+
+    put_type(w, "mem_live_bytes", "gauge");
+    for(int i = 0; i < ntags; i++) {
+        put_labelled(w, "mem_live_bytes", "tag", stats[i].name, stats[i].live_bytes);
+    }
+    put_type(w, "mem_peak_bytes", "gauge");
+    for(int i = 0; i < ntags; i++) {
+        put_labelled(w, "mem_peak_bytes", "tag", stats[i].name, stats[i].peak_bytes);
+    }
+    put_type(w, "mem_allocs_total", "counter");
+    for(int i = 0; i < ntags; i++) {
+        put_labelled(w, "mem_allocs_total", "tag", stats[i].name, stats[i].nallocs);
+    }
+    put_type(w, "mem_frees_total", "counter");
+    for(int i = 0; i < ntags; i++) {
+        put_labelled(w, "mem_frees_total", "tag", stats[i].name, stats[i].nfrees);
+    }
+    put_type(w, "mem_tick_allocs", "gauge");
+    for(int i = 0; i < ntags; i++) {
+        put_labelled(w, "mem_tick_allocs", "tag", stats[i].name, stats[i].tick_allocs);
+    }
+}
+
+enum render_field{
+    RENDER_FIELD_DRAWS,
+    RENDER_FIELD_INDIRECT,
+    RENDER_FIELD_INSTANCES,
+    RENDER_FIELD_TRIS,
+    RENDER_FIELD_PROG_BINDS,
+    RENDER_FIELD_TEX_BINDS,
+    RENDER_FIELD_UPLOAD_BYTES,
+    RENDER_FIELD_COUNT
+};
+
+static double render_field(const struct render_pass_stats *stats, enum render_field field)
+{
+    switch(field) {
+    case RENDER_FIELD_DRAWS:        return stats->ndraws + stats->nindirect;
+    case RENDER_FIELD_INDIRECT:     return stats->nindirect;
+    case RENDER_FIELD_INSTANCES:    return stats->ninstances;
+    case RENDER_FIELD_TRIS:         return stats->ntris;
+    case RENDER_FIELD_PROG_BINDS:   return stats->nprog_binds;
+    case RENDER_FIELD_TEX_BINDS:    return stats->ntex_binds;
+    case RENDER_FIELD_UPLOAD_BYTES: return stats->upload_bytes;
+    default: assert(0); return 0.0;
+    }
+}
+
+static void write_render_stats(struct writer *w)
+{
+    static const char *s_names[] = {
+        [RENDER_FIELD_DRAWS]        = "render_draws",
+        [RENDER_FIELD_INDIRECT]     = "render_indirect_draws",
+        [RENDER_FIELD_INSTANCES]    = "render_instances",
+        [RENDER_FIELD_TRIS]         = "render_triangles",
+        [RENDER_FIELD_PROG_BINDS]   = "render_program_binds",
+        [RENDER_FIELD_TEX_BINDS]    = "render_texture_binds",
+        [RENDER_FIELD_UPLOAD_BYTES] = "render_upload_bytes",
+    };
+    _Static_assert(ARR_SIZE(s_names) == RENDER_FIELD_COUNT, "");
+
+    struct render_stats stats;
+    R_GetStats(&stats);
+
+    put_gauge(w, "render_frame", stats.frame);
+    put_gauge(w, "render_commands", stats.ncmds);
+    put_gauge(w, "render_arg_bytes", stats.arg_bytes);
+
+    for(int i = 0; i < RENDER_FIELD_COUNT; i++) {
+        put_type(w, s_names[i], "gauge");
+        put_labelled(w, s_names[i], "pass", "total", render_field(&stats.total, i));
+        for(int j = 0; j < RENDER_STAT_PASS_COUNT; j++) {
+            put_labelled(w, s_names[i], "pass", R_StatPassName(j), 
+                render_field(&stats.passes[j], i));
+        }
+    }
+}
+
+static void write_source_stat(const char *name, double value, void *arg)
+{
+    put_gauge(arg, name, value);
+}
+
+static char *build_response(const char *request, size_t *out_size)
+{
+    struct writer body = {0};
+    bool found = !strncmp(request, "GET / ", 6) 
+              || !strncmp(request, "GET /metrics ", 13)
+              || !strncmp(request, "GET /metrics?", 13);
+
+    if(found) {
+        put_gauge(&body, "frame_index", g_frame_idx);
+        write_percentiles(&body);
+        write_scopes(&body);
+        write_sched_stats(&body);
+        Perf_EmitStats(write_source_stat, &body);
+        write_mem_stats(&body);
+        write_render_stats(&body);
+    }else{
+        put_fmt(&body, "Not Found\n");
+    }
+
+    if(body.overflow) {
+        free(body.data);
+        return NULL;
+    }
+
+    struct writer out = {0};
+    put_fmt(&out, "HTTP/1.0 %s\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %lu\r\n"
+        "Connection: close\r\n\r\n", 
+        found ? "200 OK" : "404 Not Found", (unsigned long)body.size);
+    /* The body may contain '%' characters, so it's not used as a format */
+    if(!out.overflow && body.size > 0) {
+        char *data = realloc(out.data, out.size + body.size);
+        if(data) {
+            memcpy(data + out.size, body.data, body.size);
+            out.data = data;
+            out.size += body.size;
+        }else{
+            out.overflow = true;
+        }
+    }
+    free(body.data);
+
+    if(out.overflow) {
+        free(out.data);
+        return NULL;
+    }
+    *out_size = out.size;
+    return out.data;
+}
+
+static bool would_block(void)
+{
+#ifdef _WIN32
+    return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+    return (errno == EAGAIN || errno == EWOULDBLOCK);
+#endif
+}
+
+static bool set_nonblocking(sock_t sock)
+{
+#ifdef _WIN32
+    u_long nonblocking = 1;
+    return (ioctlsocket(sock, FIONBIO, &nonblocking) == 0);
+#else
+    return (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) == 0);
+#endif
+}
+
+static bool open_socket(int port)
+{
+    s_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(s_sock == BAD_SOCKET)
+        return false;
+
+    int reuse = 1;
+    setsockopt(s_sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    struct sockaddr_in local = {0};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    local.sin_port = htons(port);
+
+    bool ret = (bind(s_sock, (struct sockaddr*)&local, sizeof(local)) == 0)
+            && (listen(s_sock, MAX_CLIENTS) == 0)
+            && set_nonblocking(s_sock);
+    if(!ret) {
+        close_socket(s_sock);
+        s_sock = BAD_SOCKET;
+    }
+    return ret;
+}
+
+static void close_client(struct client *client)
+{
+    close_socket(client->sock);
+    free(client->response);
+    memset(client, 0, sizeof(*client));
+    client->sock = BAD_SOCKET;
+}
+
+static void accept_clients(uint32_t now)
+{
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+
+        struct client *client = &s_clients[i];
+        if(client->sock != BAD_SOCKET)
+            continue;
+
+        sock_t sock = accept(s_sock, NULL, NULL);
+        if(sock == BAD_SOCKET)
+            return;
+        if(!set_nonblocking(sock)) {
+            close_socket(sock);
+            continue;
+        }
+        client->sock = sock;
+        client->accepted = now;
+    }
+}
+
+/* Returns false when the connection should be closed */
+static bool read_request(struct client *client)
+{
+    while(client->request_size < MAX_REQUEST - 1) {
+
+        int len = recv(client->sock, client->request + client->request_size, 
+            MAX_REQUEST - 1 - client->request_size, 0);
+        if(len == 0)
+            return false;
+        if(len < 0)
+            return would_block();
+
+        client->request_size += len;
+        client->request[client->request_size] = '\0';
+        if(strstr(client->request, "\r\n\r\n") || strstr(client->request, "\n\n"))
+            break;
+    }
+
+    /* The request line is all that's needed, so an oversized 
+     * request is answered as soon as the buffer fills up */
+    bool done = (client->request_size == MAX_REQUEST - 1)
+             || strstr(client->request, "\r\n\r\n") 
+             || strstr(client->request, "\n\n");
+    if(!done)
+        return true;
+
+    client->response = build_response(client->request, &client->response_size);
+    return (client->response != NULL);
+}
+
+/* Returns false when the connection should be closed */
+static bool write_response(struct client *client)
+{
+    while(client->sent < client->response_size) {
+
+        int len = send(client->sock, client->response + client->sent, 
+            client->response_size - client->sent, SEND_FLAGS);
+        if(len < 0)
+            return would_block();
+        client->sent += len;
+    }
+    return false;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Metrics_Init(int port)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!s_active);
+
+    if(port <= 0 || port > 65535)
+        return false;
+
+#ifdef _WIN32
+    WSADATA wsa;
+    if(WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return false;
+#endif
+
+    if(!open_socket(port)) {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return false;
+    }
+
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        memset(&s_clients[i], 0, sizeof(s_clients[i]));
+        s_clients[i].sock = BAD_SOCKET;
+    }
+    s_active = true;
+    return true;
+}
+
+void Metrics_Shutdown(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_active)
+        return;
+
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+        if(s_clients[i].sock != BAD_SOCKET) {
+            close_client(&s_clients[i]);
+        }
+    }
+    close_socket(s_sock);
+    s_sock = BAD_SOCKET;
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    s_active = false;
+}
+
+bool Metrics_Active(void)
+{
+    return s_active;
+}
+
+void Metrics_Service(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_active)
+        return;
+
+    uint32_t now = SDL_GetTicks();
+    accept_clients(now);
+
+    for(int i = 0; i < MAX_CLIENTS; i++) {
+
+        struct client *client = &s_clients[i];
+        if(client->sock == BAD_SOCKET)
+            continue;
+
+        bool keep = true;
+        if(!client->response) {
+            keep = read_request(client);
+        }
+        if(keep && client->response) {
+            keep = write_response(client);
+        }
+        if(keep && SDL_TICKS_PASSED(now, client->accepted + CLIENT_TIMEOUT_MS)) {
+            keep = false;
+        }
+        if(!keep) {
+            close_client(client);
+        }
+    }
+}
+
@@ -0,0 +1,56 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+
+/* The metrics endpoint serves a snapshot of the engine's statistics (frame 
+ * time percentiles, the time spent in the subsystems, scheduler utilization, 
+ * memory per tag, render counters and the values of all the registered perf 
+ * stats sources) in the Prometheus text exposition format over HTTP, for 
+ * scraping by external dashboards. It only listens on the loopback interface. 
+ */
+
+bool Metrics_Init(int port);
+void Metrics_Shutdown(void);
+bool Metrics_Active(void);
+/* Accept new connections and answer the pending requests. Must be called 
+ * once per iteration of the main loop, after the tick has been finished. */
+void Metrics_Service(void);
+
+#endif
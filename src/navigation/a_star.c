@@ -36,8 +36,11 @@
 #include "a_star.h"
 #include "nav_private.h"
 #include "../perf.h"
+#include "../config.h"
 #include "../lib/public/pqueue.h"
+#include "../lib/public/ipqueue.h"
 #include "../lib/public/khash.h"
+#include "../lib/public/mem.h"
 #include "fieldcache.h"
 
 #include <assert.h>
@@ -46,9 +49,11 @@
 #include <math.h>
 #include <float.h>
 
+#include <SDL.h>
 
-PQUEUE_TYPE(coord, struct coord)
-PQUEUE_IMPL(static, coord, struct coord)
+
+IPQUEUE_TYPE(coord, struct coord)
+IPQUEUE_IMPL(static, coord, struct coord)
 
 PQUEUE_TYPE(portal, struct portal_hop)
 PQUEUE_IMPL(static, portal, struct portal_hop)
@@ -58,8 +63,14 @@ KHASH_MAP_INIT_INT64(key_portal, struct portal_hop)
 KHASH_MAP_INIT_INT64(key_float, float)
 
 #define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
 #define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
 #define MAX_PORTAL_NEIGHBS  (256)
+/* The side length of a cluster, in chunks */
+#define CLUSTER_DIM         (4)
+#define MAX_LINK_COMPS      (8)
+/* Searches between clusters closer than this are not narrowed down */
+#define MIN_CLUSTER_DIST    (2)
 
 #define kh_put_val(name, table, key, val)               \
     do{                                                 \
@@ -69,6 +80,56 @@ KHASH_MAP_INIT_INT64(key_float, float)
         kh_value(table, k) = val;                       \
     }while(0)
 
+/* A hop of a previously found route, along with the cost of 
+ * getting from it to the route's destination */
+struct route_hop{
+    struct portal_hop next;
+    float             cost;
+};
+
+KHASH_MAP_INIT_INT64(key_route, struct route_hop)
+KHASH_MAP_INIT_INT64(key_routes, khash_t(key_route)*)
+
+/* The set of components of the portals crossing 
+ * the boundary between two adjacent clusters. */
+struct cluster_link{
+    /* -1 when there were too many to hold */
+    int ncomps;
+    int comps[MAX_LINK_COMPS];
+};
+
+/* Clusters are squares of CLUSTER_DIM * CLUSTER_DIM chunks. The
+ * links of every cluster to the one east of it (+c) and to the
+ * one south of it (+r) are kept, which is all the information
+ * needed to tell through which clusters a path may possibly go. 
+ */
+struct cluster_graph{
+    const struct nav_private *priv;
+    bool                      dirty;
+    int                       nrows, ncols;
+    struct cluster_link      *east;
+    struct cluster_link      *south;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The search used by 'AStar_GridPath' for every layer */
+static enum grid_search s_grid_search[NAV_LAYER_MAX] = {0};
+
+static struct cluster_graph      s_clusters[NAV_LAYER_MAX];
+/* key: (destination portal hop) */
+static khash_t(key_routes)      *s_routes[NAV_LAYER_MAX];
+static size_t                    s_nroutes[NAV_LAYER_MAX];
+static const struct nav_private *s_routes_priv[NAV_LAYER_MAX];
+
+/* Grid searches may be run from worker threads */
+static SDL_atomic_t              s_grid_searches;
+static SDL_atomic_t              s_grid_expanded;
+static SDL_atomic_t              s_portal_searches;
+static SDL_atomic_t              s_portal_expanded;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -78,6 +139,12 @@ static uint64_t coord_to_key(struct coord c)
     return (((uint64_t)c.r) << 32) | (((uint64_t)c.c) & ~((uint32_t)0));
 }
 
+/* Index of the tile within the chunk, for keying the frontier */
+static uint32_t coord_to_idx(struct coord c)
+{
+    return c.r * FIELD_RES_C + c.c;
+}
+
 static uint64_t phop_to_key(const struct portal_hop *ph)
 {
     return (((uint64_t)ph->liid                   & 0xffff) << 48)
@@ -288,35 +355,19 @@ static float portal_node_penalty(void)
     return sqrt(pow(FIELD_RES_R, 2.0f) + pow(FIELD_RES_C, 2.0f));
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
-
-bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
-                    const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
-                    enum nav_layer layer, vec_coord_t *out_path, float *out_cost)
+/* Returns false only if the search could not be carried out. Whether a path
+ * was found is returned in 'out_found'.
+ */
+static bool grid_path_astar(struct coord start, struct coord finish, 
+                            const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
+                            bool *out_found, vec_coord_t *out_path, float *out_cost)
 {
-    PERF_ENTER();
-
-    struct grid_path_desc gp = {0};
-    vec_coord_init(&gp.path);
-    vec_coord_resize(&gp.path, 512);
-
-    if(N_FC_GetGridPath(start, finish, chunk, layer, &gp)) {
-
-        if(!gp.exists)
-            PERF_RETURN(false);
-
-        *out_cost = gp.cost;
-        vec_coord_copy(out_path, &gp.path);
-        PERF_RETURN(true);
-    }
-
-    pq_coord_t          frontier;
+    ipq_coord_t         frontier;
     khash_t(key_coord) *came_from;
     khash_t(key_float) *running_cost;
     
-    pq_coord_init(&frontier);
+    if(!ipq_coord_init(&frontier, FIELD_RES_R * FIELD_RES_C))
+        goto fail_frontier;
     if(NULL == (came_from = kh_init(key_coord)))
         goto fail_came_from;
     if(NULL == (running_cost = kh_init(key_float)))
@@ -326,12 +377,14 @@ bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
     kh_resize(key_float, running_cost, 1024);
 
     kh_put_val(key_float, running_cost, coord_to_key(start), 0.0f);
-    pq_coord_push(&frontier, 0.0f, start);
+    ipq_coord_push(&frontier, coord_to_idx(start), 0.0f, start);
 
-    while(pq_size(&frontier) > 0) {
+    int nexpanded = 0;
+    while(ipq_size(&frontier) > 0) {
 
         struct coord curr;
-        pq_coord_pop(&frontier, &curr);
+        ipq_coord_pop(&frontier, &curr);
+        nexpanded++;
 
         if(0 == memcmp(&curr, &finish, sizeof(struct coord)))
             break;
@@ -352,11 +405,13 @@ bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
 
                 kh_put_val(key_float, running_cost, coord_to_key(*next), new_cost);
                 float priority = new_cost + heuristic(finish, *next);
-                pq_coord_push(&frontier, priority, *next);
+                ipq_coord_push(&frontier, coord_to_idx(*next), priority, *next);
                 kh_put_val(key_coord, came_from, coord_to_key(*next), curr);
             }
         }
     }
+    SDL_AtomicAdd(&s_grid_searches, 1);
+    SDL_AtomicAdd(&s_grid_expanded, nexpanded);
     
     if(kh_get(key_coord, came_from, coord_to_key(finish)) == kh_end(came_from))
         goto fail_find_path;
@@ -385,39 +440,585 @@ bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
     khiter_t k = kh_get(key_float, running_cost, coord_to_key(finish));
     assert(k != kh_end(running_cost));
     *out_cost = kh_value(running_cost, k);
+    *out_found = true;
 
-    pq_coord_destroy(&frontier);
+    ipq_coord_destroy(&frontier);
     kh_destroy(key_float, running_cost);
     kh_destroy(key_coord, came_from);
+    return true;
 
-    /* Cache the result */
-    gp.exists = true;
-    vec_coord_copy(&gp.path, out_path);
-    gp.cost = *out_cost;
-    N_FC_PutGridPath(start, finish, chunk, layer, &gp);
-    PERF_RETURN(true);
+fail_find_path:
+    *out_found = false;
+
+    ipq_coord_destroy(&frontier);
+    kh_destroy(key_float, running_cost);
+    kh_destroy(key_coord, came_from);
+    return true;
+
+fail_running_cost:
+    kh_destroy(key_coord, came_from);
+fail_came_from:
+    ipq_coord_destroy(&frontier);
+fail_frontier:
+    return false;
+}
+
+
+static bool grid_walkable(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], int r, int c)
+{
+    if(r < 0 || r >= FIELD_RES_R)
+        return false;
+    if(c < 0 || c >= FIELD_RES_C)
+        return false;
+    return (cost_field[r][c] != COST_IMPASSABLE);
+}
+
+/* Jump Point Search is only optimal when every passable tile has the same
+ * traversal cost.
+ */
+static bool grid_uniform_cost(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C])
+{
+    int cost = -1;
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        if(cost_field[r][c] == COST_IMPASSABLE)
+            continue;
+        if(cost == -1)
+            cost = cost_field[r][c];
+        if(cost != cost_field[r][c])
+            return false;
+    }}
+    return true;
+}
+
+static int sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+/* Advance from 'from' in the direction (dr, dc) until reaching a jump point: a
+ * tile with a 'forced' neighbour that can't be reached optimally without
+ * passing through it, or the finish tile. Diagonal steps follow the rules of
+ * 'neighbours_grid': they may cut a corner but not squeeze between two
+ * impassable tiles.
+ */
+static bool jps_jump(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], struct coord from,
+                     int dr, int dc, struct coord finish, struct coord *out)
+{
+    int r = from.r, c = from.c;
+
+    while(true) {
+
+        if(dr && dc
+        && !grid_walkable(cost_field, r + dr, c)
+        && !grid_walkable(cost_field, r, c + dc))
+            return false;
+
+        r += dr;
+        c += dc;
+
+        if(!grid_walkable(cost_field, r, c))
+            return false;
+        if(r == finish.r && c == finish.c)
+            break;
+
+        if(dr && dc) {
+
+            if((grid_walkable(cost_field, r - dr, c + dc) && !grid_walkable(cost_field, r - dr, c))
+            || (grid_walkable(cost_field, r + dr, c - dc) && !grid_walkable(cost_field, r, c - dc)))
+                break;
+
+            /* A diagonal move is also stopped by any jump point
+             * along its' vertical and horizontal components */
+            struct coord jp;
+            if(jps_jump(cost_field, (struct coord){r, c}, dr, 0, finish, &jp)
+            || jps_jump(cost_field, (struct coord){r, c}, 0, dc, finish, &jp))
+                break;
+
+        }else if(dr) {
+
+            if((grid_walkable(cost_field, r + dr, c + 1) && !grid_walkable(cost_field, r, c + 1))
+            || (grid_walkable(cost_field, r + dr, c - 1) && !grid_walkable(cost_field, r, c - 1)))
+                break;
+        }else{
+
+            if((grid_walkable(cost_field, r + 1, c + dc) && !grid_walkable(cost_field, r + 1, c))
+            || (grid_walkable(cost_field, r - 1, c + dc) && !grid_walkable(cost_field, r - 1, c)))
+                break;
+        }
+    }
+
+    *out = (struct coord){r, c};
+    return true;
+}
+
+/* Get the directions worth searching from a jump point, given the direction
+ * (dr, dc) it was reached in. The rest are pruned, as the tiles in those
+ * directions can be reached at least as cheaply without going through it.
+ */
+static int jps_directions(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], struct coord coord,
+                          int dr, int dc, struct coord out_dirs[8])
+{
+    int ret = 0;
+    int r = coord.r, c = coord.c;
+
+    if(dr == 0 && dc == 0) {
+
+        for(int i = -1; i <= 1; i++) {
+        for(int j = -1; j <= 1; j++) {
+            if(i == 0 && j == 0)
+                continue;
+            out_dirs[ret++] = (struct coord){i, j};
+        }}
+
+    }else if(dr && dc) {
+
+        bool vert = grid_walkable(cost_field, r + dr, c);
+        bool horz = grid_walkable(cost_field, r, c + dc);
+
+        if(vert)
+            out_dirs[ret++] = (struct coord){dr, 0};
+        if(horz)
+            out_dirs[ret++] = (struct coord){0, dc};
+        if(vert || horz)
+            out_dirs[ret++] = (struct coord){dr, dc};
+        if(vert && !grid_walkable(cost_field, r, c - dc))
+            out_dirs[ret++] = (struct coord){dr, -dc};
+        if(horz && !grid_walkable(cost_field, r - dr, c))
+            out_dirs[ret++] = (struct coord){-dr, dc};
+
+    }else if(dr) {
+
+        if(grid_walkable(cost_field, r + dr, c)) {
+            out_dirs[ret++] = (struct coord){dr, 0};
+            if(!grid_walkable(cost_field, r, c + 1))
+                out_dirs[ret++] = (struct coord){dr, 1};
+            if(!grid_walkable(cost_field, r, c - 1))
+                out_dirs[ret++] = (struct coord){dr, -1};
+        }
+    }else{
+
+        if(grid_walkable(cost_field, r, c + dc)) {
+            out_dirs[ret++] = (struct coord){0, dc};
+            if(!grid_walkable(cost_field, r + 1, c))
+                out_dirs[ret++] = (struct coord){1, dc};
+            if(!grid_walkable(cost_field, r - 1, c))
+                out_dirs[ret++] = (struct coord){-1, dc};
+        }
+    }
+
+    assert(ret <= 8);
+    return ret;
+}
+
+/* Like 'grid_path_astar', but only expanding the jump points. The resulting
+ * path is filled in with every tile between the jump points, so that it is
+ * in the same form as that of 'grid_path_astar', with the same cost.
+ */
+static bool grid_path_jps(struct coord start, struct coord finish,
+                          const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C],
+                          bool *out_found, vec_coord_t *out_path, float *out_cost)
+{
+    ipq_coord_t         frontier;
+    khash_t(key_coord) *came_from;
+    khash_t(key_float) *running_cost;
+
+    if(!ipq_coord_init(&frontier, FIELD_RES_R * FIELD_RES_C))
+        goto fail_frontier;
+    if(NULL == (came_from = kh_init(key_coord)))
+        goto fail_came_from;
+    if(NULL == (running_cost = kh_init(key_float)))
+        goto fail_running_cost;
+
+    kh_resize(key_coord, came_from, 256);
+    kh_resize(key_float, running_cost, 256);
+
+    kh_put_val(key_float, running_cost, coord_to_key(start), 0.0f);
+    ipq_coord_push(&frontier, coord_to_idx(start), 0.0f, start);
+
+    int nexpanded = 0;
+    while(ipq_size(&frontier) > 0) {
+
+        struct coord curr;
+        ipq_coord_pop(&frontier, &curr);
+        nexpanded++;
+
+        if(0 == memcmp(&curr, &finish, sizeof(struct coord)))
+            break;
+
+        int dr = 0, dc = 0;
+        khiter_t k = kh_get(key_coord, came_from, coord_to_key(curr));
+        if(k != kh_end(came_from)) {
+            struct coord parent = kh_value(came_from, k);
+            dr = sign(curr.r - parent.r);
+            dc = sign(curr.c - parent.c);
+        }
+
+        k = kh_get(key_float, running_cost, coord_to_key(curr));
+        assert(k != kh_end(running_cost));
+        float curr_cost = kh_value(running_cost, k);
+
+        struct coord dirs[8];
+        int ndirs = jps_directions(cost_field, curr, dr, dc, dirs);
+
+        for(int i = 0; i < ndirs; i++) {
+
+            struct coord next;
+            if(!jps_jump(cost_field, curr, dirs[i].r, dirs[i].c, finish, &next))
+                continue;
+
+            /* All the passable tiles have the same cost and the tiles between
+             * jump points lie on a straight or diagonal line. */
+            float new_cost = curr_cost + heuristic(curr, next) * cost_field[next.r][next.c];
+
+            if((k = kh_get(key_float, running_cost, coord_to_key(next))) == kh_end(running_cost)
+            || new_cost < kh_value(running_cost, k)) {
+
+                kh_put_val(key_float, running_cost, coord_to_key(next), new_cost);
+                float priority = new_cost + heuristic(finish, next);
+                ipq_coord_push(&frontier, coord_to_idx(next), priority, next);
+                kh_put_val(key_coord, came_from, coord_to_key(next), curr);
+            }
+        }
+    }
+    SDL_AtomicAdd(&s_grid_searches, 1);
+    SDL_AtomicAdd(&s_grid_expanded, nexpanded);
+
+    if(kh_get(key_coord, came_from, coord_to_key(finish)) == kh_end(came_from))
+        goto fail_find_path;
+
+    vec_coord_reset(out_path);
+
+    /* Walk backwards along the jump points, pushing every tile
+     * between them, and then reverse the path vector. */
+    struct coord curr = finish;
+    while(0 != memcmp(&curr, &start, sizeof(struct coord))) {
+
+        khiter_t k = kh_get(key_coord, came_from, coord_to_key(curr));
+        assert(k != kh_end(came_from));
+        struct coord prev = kh_value(came_from, k);
+
+        int dr = sign(prev.r - curr.r);
+        int dc = sign(prev.c - curr.c);
+        while(0 != memcmp(&curr, &prev, sizeof(struct coord))) {
+            vec_coord_push(out_path, curr);
+            curr.r += dr;
+            curr.c += dc;
+        }
+    }
+    vec_coord_push(out_path, start);
+
+    for(int i = 0, j = vec_size(out_path) - 1; i < j; i++, j--) {
+        struct coord tmp = vec_AT(out_path, i);
+        vec_AT(out_path, i) = vec_AT(out_path, j);
+        vec_AT(out_path, j) = tmp;
+    }
+
+    /* Accumulate the cost one tile at a time, in the
+     * same way as it is done by 'grid_path_astar' */
+    float cost = 0.0f;
+    for(int i = 1; i < vec_size(out_path); i++) {
+        struct coord prev = vec_AT(out_path, i - 1);
+        struct coord next = vec_AT(out_path, i);
+        bool diag = (prev.r != next.r) && (prev.c != next.c);
+        float cost_mult = diag ? sqrt(2) : 1.0f;
+        cost += cost_field[next.r][next.c] * cost_mult;
+    }
+    *out_cost = cost;
+    *out_found = true;
+
+    ipq_coord_destroy(&frontier);
+    kh_destroy(key_float, running_cost);
+    kh_destroy(key_coord, came_from);
+    return true;
 
 fail_find_path:
-    gp.exists = false;
-    N_FC_PutGridPath(start, finish, chunk, layer, &gp);
+    *out_found = false;
 
-    pq_coord_destroy(&frontier);
+    ipq_coord_destroy(&frontier);
     kh_destroy(key_float, running_cost);
+    kh_destroy(key_coord, came_from);
+    return true;
+
 fail_running_cost:
     kh_destroy(key_coord, came_from);
 fail_came_from:
-    PERF_RETURN(false);
+    ipq_coord_destroy(&frontier);
+fail_frontier:
+    return false;
 }
 
-bool AStar_PortalGraphPath(struct tile_desc start_tile, struct tile_desc end_tile, 
-                           const struct portal *finish, const struct nav_private *priv, 
-                           enum nav_layer layer, vec_portal_t *out_path, float *out_cost)
+static bool grid_path(struct coord start, struct coord finish,
+                      const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], enum nav_layer layer,
+                      bool *out_found, vec_coord_t *out_path, float *out_cost)
 {
-    PERF_ENTER();
+    bool jps = (s_grid_search[layer] == GRID_SEARCH_JPS) && grid_uniform_cost(cost_field);
+    return jps ? grid_path_jps(start, finish, cost_field, out_found, out_path, out_cost)
+               : grid_path_astar(start, finish, cost_field, out_found, out_path, out_cost);
+}
+
+static int cluster_idx(const struct cluster_graph *graph, struct coord chunk)
+{
+    return (chunk.r / CLUSTER_DIM) * graph->ncols + (chunk.c / CLUSTER_DIM);
+}
+
+static void cluster_link_add(struct cluster_link *link, int comp)
+{
+    if(link->ncomps < 0)
+        return;
+    for(int i = 0; i < link->ncomps; i++) {
+        if(link->comps[i] == comp)
+            return;
+    }
+    if(link->ncomps == MAX_LINK_COMPS) {
+        link->ncomps = -1;
+        return;
+    }
+    link->comps[link->ncomps++] = comp;
+}
+
+static bool cluster_link_open(const struct cluster_link *link, int comp)
+{
+    if(link->ncomps < 0)
+        return true;
+    for(int i = 0; i < link->ncomps; i++) {
+        if(link->comps[i] == comp)
+            return true;
+    }
+    return false;
+}
+
+static void cluster_graph_free(struct cluster_graph *graph)
+{
+    free(graph->east);
+    free(graph->south);
+    memset(graph, 0, sizeof(*graph));
+}
+
+static bool cluster_graph_update(const struct nav_private *priv, enum nav_layer layer)
+{
+    struct cluster_graph *graph = &s_clusters[layer];
+    if(graph->priv == priv && !graph->dirty)
+        return true;
+
+    int nrows = (priv->height + CLUSTER_DIM - 1) / CLUSTER_DIM;
+    int ncols = (priv->width + CLUSTER_DIM - 1) / CLUSTER_DIM;
+
+    if(graph->priv != priv || graph->nrows != nrows || graph->ncols != ncols) {
+
+        cluster_graph_free(graph);
+        graph->east = malloc(nrows * ncols * sizeof(struct cluster_link));
+        graph->south = malloc(nrows * ncols * sizeof(struct cluster_link));
+        if(!graph->east || !graph->south) {
+            cluster_graph_free(graph);
+            return false;
+        }
+        graph->priv = priv;
+        graph->nrows = nrows;
+        graph->ncols = ncols;
+    }
+
+    for(int i = 0; i < nrows * ncols; i++) {
+        graph->east[i].ncomps = 0;
+        graph->south[i].ncomps = 0;
+    }
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+
+        const struct nav_chunk *chunk = &priv->chunks[layer][i];
+        for(int j = 0; j < chunk->num_portals; j++) {
+
+            const struct portal *port = &chunk->portals[j];
+            const struct portal *conn = port->connected;
+            int a = cluster_idx(graph, port->chunk);
+            int b = cluster_idx(graph, conn->chunk);
+
+            /* Every crossing is seen from both sides, so 
+             * it is enough to record it from one of them */
+            if(b == a + 1)
+                cluster_link_add(&graph->east[a], port->component_id);
+            if(b == a + graph->ncols)
+                cluster_link_add(&graph->south[a], port->component_id);
+        }
+    }
+
+    graph->dirty = false;
+    return true;
+}
+
+/* Find the shortest chain of clusters between the ones holding the source 
+ * and destination chunks which could be crossed by a path through the 
+ * portals of the 'comp' component. The clusters along it, along with the 
+ * ones surrounding them, make up the corridor which the portal search is 
+ * then narrowed down to. Returns false if there is no such chain. 
+ */
+static bool cluster_corridor(const struct cluster_graph *graph, struct coord src_chunk,
+                             struct coord dst_chunk, int comp, uint8_t *out_corridor)
+{
+    const int nclusters = graph->nrows * graph->ncols;
+    int *came_from = malloc(nclusters * sizeof(int));
+    int *queue = malloc(nclusters * sizeof(int));
+    bool ret = false;
+
+    if(!came_from || !queue)
+        goto out;
+
+    for(int i = 0; i < nclusters; i++) {
+        came_from[i] = -1;
+    }
+
+    int src = cluster_idx(graph, src_chunk);
+    int dst = cluster_idx(graph, dst_chunk);
+    size_t head = 0, tail = 0;
+
+    queue[tail++] = src;
+    came_from[src] = src;
+
+    /* Every link has the same cost, so a breadth-first 
+     * search finds the shortest chain */
+    while(head < tail) {
+
+        int curr = queue[head++];
+        if(curr == dst)
+            break;
+
+        int r = curr / graph->ncols, c = curr % graph->ncols;
+        int neighbs[4];
+        bool open[4];
+
+        neighbs[0] = curr + 1;
+        open[0] = (c + 1 < graph->ncols) && cluster_link_open(&graph->east[curr], comp);
+        neighbs[1] = curr - 1;
+        open[1] = (c > 0) && cluster_link_open(&graph->east[curr - 1], comp);
+        neighbs[2] = curr + graph->ncols;
+        open[2] = (r + 1 < graph->nrows) && cluster_link_open(&graph->south[curr], comp);
+        neighbs[3] = curr - graph->ncols;
+        open[3] = (r > 0) && cluster_link_open(&graph->south[curr - graph->ncols], comp);
+
+        for(int i = 0; i < 4; i++) {
+            if(!open[i] || came_from[neighbs[i]] != -1)
+                continue;
+            came_from[neighbs[i]] = curr;
+            queue[tail++] = neighbs[i];
+        }
+    }
+
+    if(came_from[dst] == -1)
+        goto out;
+
+    memset(out_corridor, 0, nclusters);
+    int curr = dst;
+    while(true) {
+
+        int r = curr / graph->ncols, c = curr % graph->ncols;
+        for(int dr = -1; dr <= 1; dr++) {
+        for(int dc = -1; dc <= 1; dc++) {
+
+            int nr = r + dr, nc = c + dc;
+            if(nr < 0 || nr >= graph->nrows || nc < 0 || nc >= graph->ncols)
+                continue;
+            out_corridor[nr * graph->ncols + nc] = 1;
+        }}
+
+        if(curr == src)
+            break;
+        curr = came_from[curr];
+    }
+    ret = true;
+
+out:
+    free(came_from);
+    free(queue);
+    return ret;
+}
+
+static khash_t(key_route) *routes_to(enum nav_layer layer, const struct portal_hop *finish)
+{
+    if(!s_routes[layer])
+        return NULL;
+
+    khiter_t k = kh_get(key_routes, s_routes[layer], phop_to_key(finish));
+    if(k == kh_end(s_routes[layer]))
+        return NULL;
+    return kh_value(s_routes[layer], k);
+}
+
+static void routes_clear(enum nav_layer layer)
+{
+    if(!s_routes[layer])
+        return;
+
+    uint64_t key;
+    khash_t(key_route) *curr;
+    (void)key;
+
+    kh_foreach(s_routes[layer], key, curr, {
+        kh_destroy(key_route, curr);
+    });
+    kh_clear(key_routes, s_routes[layer]);
+    s_nroutes[layer] = 0;
+}
+
+/* Remember the route from the first 'nhops' hops of the path to its' last 
+ * hop. Every part of a shortest path is itself the shortest path between its' 
+ * endpoints, so later searches towards the same hop can stop as soon as they 
+ * reach any of these. 'costs' holds the running cost at each of the hops. 
+ */
+static void routes_put(enum nav_layer layer, const vec_portal_t *path, size_t nhops, 
+                       const float *costs, float total)
+{
+    size_t npath = vec_size(path);
+    if(npath < 2)
+        return;
+
+    if(!s_routes[layer] && NULL == (s_routes[layer] = kh_init(key_routes)))
+        return;
+    if(s_nroutes[layer] + nhops > CONFIG_PORTAL_ROUTE_CACHE_SZ)
+        routes_clear(layer);
+
+    const struct portal_hop *finish = &vec_AT(path, npath - 1);
+    khash_t(key_route) *routes = routes_to(layer, finish);
+
+    if(!routes) {
+        if(NULL == (routes = kh_init(key_route)))
+            return;
+        kh_put_val(key_routes, s_routes[layer], phop_to_key(finish), routes);
+    }
 
+    for(int i = 0; i < MIN(nhops, npath - 1); i++) {
+
+        const struct portal_hop *curr = &vec_AT(path, i);
+        int ret;
+        khiter_t k = kh_put(key_route, routes, phop_to_key(curr), &ret);
+        if(ret == -1)
+            return;
+        if(ret != 0) {
+            s_nroutes[layer]++;
+        }
+        kh_value(routes, k) = (struct route_hop){
+            .next = vec_AT(path, i + 1),
+            .cost = total - costs[i]
+        };
+    }
+}
+
+/* The search over the portal graph. When a 'corridor' is given, only the 
+ * portals in its' clusters are considered. Hops with a known route to the 
+ * finish are not expanded further, but the search runs on until no cheaper 
+ * path can be found. Returns false only if the search could not be carried
+ * out. Whether a path was found is returned in 'out_found'.
+ */
+static bool portal_graph_search(struct tile_desc start_tile, const struct portal *finish, 
+                                uint16_t start_liid, uint16_t end_liid,
+                                const struct nav_private *priv, enum nav_layer layer, 
+                                const uint8_t *corridor, bool use_routes,
+                                bool *out_found, vec_portal_t *out_path, float *out_cost)
+{
     pq_portal_t          frontier;
     khash_t(key_portal) *came_from;
     khash_t(key_float)  *running_cost;
+    const struct cluster_graph *graph = &s_clusters[layer];
     
     pq_portal_init(&frontier);
     if(NULL == (came_from = kh_init(key_portal)))
@@ -426,14 +1027,12 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, struct tile_desc end_til
         goto fail_running_cost;
 
     const struct nav_chunk *bchunk = &priv->chunks[layer][start_tile.chunk_r * priv->width + start_tile.chunk_c];
-    uint16_t start_liid = N_ClosestPathableLocalIsland(priv, bchunk, start_tile);
-    if(start_liid == ISLAND_NONE)
-        goto fail_find_path;
+    const struct portal_hop finish_hop = (struct portal_hop){finish, end_liid};
+    khash_t(key_route) *routes = use_routes ? routes_to(layer, &finish_hop) : NULL;
 
-    const struct nav_chunk *echunk = &priv->chunks[layer][end_tile.chunk_r * priv->width + end_tile.chunk_c];
-    uint16_t end_liid = N_ClosestPathableLocalIsland(priv, echunk, end_tile);
-    if(end_liid == ISLAND_NONE)
-        goto fail_find_path;
+    /* The cheapest path found to end in a hop with a known route */
+    struct portal_hop joined;
+    float joined_cost = FLT_MAX;
 
     /* Intitialize the frontier with all the portals in the source chunk that are 
      * reachable from the source tile. */
@@ -454,14 +1053,30 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, struct tile_desc end_til
         }
     }
 
+    int nexpanded = 0;
     while(pq_size(&frontier) > 0) {
 
         struct portal_hop curr;
         pq_portal_pop(&frontier, &curr);
+        nexpanded++;
+
+        khiter_t k = kh_get(key_float, running_cost, phop_to_key(&curr));
+        assert(k != kh_end(running_cost));
+        float curr_cost = kh_value(running_cost, k);
+
+        if(curr_cost >= joined_cost)
+            break;
 
         if(curr.portal == finish && curr.liid == end_liid)
             break;
 
+        if(routes && (k = kh_get(key_route, routes, phop_to_key(&curr))) != kh_end(routes)) {
+
+            joined = curr;
+            joined_cost = curr_cost + kh_value(routes, k).cost;
+            continue;
+        }
+
         const struct portal *neighbours[MAX_PORTAL_NEIGHBS];
         float neighbour_costs[MAX_PORTAL_NEIGHBS];
         uint16_t neighb_enter_liids[MAX_PORTAL_NEIGHBS];
@@ -474,9 +1089,10 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, struct tile_desc end_til
             const struct portal *next = neighbours[i];
             struct portal_hop next_hop = (struct portal_hop){next, neighb_enter_liids[i]};
 
-            khiter_t k = kh_get(key_float, running_cost, phop_to_key(&curr));
-            assert(k != kh_end(running_cost));
-            float new_cost = kh_value(running_cost, k) + neighbour_costs[i] + portal_node_penalty();
+            if(corridor && !corridor[cluster_idx(graph, next->chunk)])
+                continue;
+
+            float new_cost = curr_cost + neighbour_costs[i] + portal_node_penalty();
 
             if((k = kh_get(key_float, running_cost, phop_to_key(&next_hop))) == kh_end(running_cost)
             || new_cost < kh_value(running_cost, k)) {
@@ -489,11 +1105,22 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, struct tile_desc end_til
             }
         }
     }
+    SDL_AtomicAdd(&s_portal_searches, 1);
+    SDL_AtomicAdd(&s_portal_expanded, nexpanded);
     
     struct portal_hop last;
-    if(!portal_path_found(priv, layer, came_from, finish, end_liid, &last))
+    bool direct = portal_path_found(priv, layer, came_from, finish, end_liid, &last);
+    if(direct) {
+        khiter_t k = kh_get(key_float, running_cost, phop_to_key(&last));
+        assert(k != kh_end(running_cost));
+        direct = (kh_value(running_cost, k) < joined_cost);
+    }
+    if(!direct && joined_cost == FLT_MAX)
         goto fail_find_path;
 
+    if(!direct) {
+        last = joined;
+    }
     vec_portal_reset(out_path);
 
     /* We have our path at this point. Walk backwards along the path to build a 
@@ -515,22 +1142,209 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, struct tile_desc end_til
         vec_AT(out_path, j) = tmp;
     }
 
-    khiter_t k = kh_get(key_float, running_cost, phop_to_key(&last));
-    assert(k != kh_end(running_cost));
-    *out_cost = kh_value(running_cost, k);
+    size_t nsearched = vec_size(out_path);
+    if(!direct) {
+
+        /* Follow the known route the rest of the way. Should it be cut 
+         * short, the search is simply repeated without the routes. */
+        struct portal_hop hop = joined;
+        while(!(hop.portal == finish && hop.liid == end_liid)) {
+
+            khiter_t k = kh_get(key_route, routes, phop_to_key(&hop));
+            if(k == kh_end(routes) || vec_size(out_path) > s_nroutes[layer] + nsearched) {
+                pq_portal_destroy(&frontier);
+                kh_destroy(key_float, running_cost);
+                kh_destroy(key_portal, came_from);
+                return portal_graph_search(start_tile, finish, start_liid, end_liid, priv, layer,
+                    corridor, false, out_found, out_path, out_cost);
+            }
+            hop = kh_value(routes, k).next;
+            vec_portal_push(out_path, hop);
+        }
+    }
+
+    {
+        STALLOC(float, costs, nsearched);
+        for(int i = 0; i < nsearched; i++) {
+            khiter_t k = kh_get(key_float, running_cost, phop_to_key(&vec_AT(out_path, i)));
+            assert(k != kh_end(running_cost));
+            costs[i] = kh_value(running_cost, k);
+        }
+        *out_cost = direct ? costs[nsearched - 1] : joined_cost;
+        routes_put(layer, out_path, nsearched, costs, *out_cost);
+        STFREE(costs);
+    }
+
+    *out_found = true;
 
     pq_portal_destroy(&frontier);
     kh_destroy(key_float, running_cost);
     kh_destroy(key_portal, came_from);
-
-    PERF_RETURN(true);
+    return true;
 
 fail_find_path:
+    *out_found = false;
+
     pq_portal_destroy(&frontier);
     kh_destroy(key_float, running_cost);
+    kh_destroy(key_portal, came_from);
+    return true;
+
 fail_running_cost:
     kh_destroy(key_portal, came_from);
 fail_came_from:
-    PERF_RETURN(false);
+    return false;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
+                    const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
+                    enum nav_layer layer, vec_coord_t *out_path, float *out_cost)
+{
+    PERF_ENTER();
+
+    struct grid_path_desc gp = {0};
+    vec_coord_init(&gp.path);
+    vec_coord_resize(&gp.path, 512);
+
+    if(N_FC_GetGridPath(start, finish, chunk, layer, &gp)) {
+
+        if(!gp.exists)
+            PERF_RETURN(false);
+
+        *out_cost = gp.cost;
+        vec_coord_copy(out_path, &gp.path);
+        PERF_RETURN(true);
+    }
+
+    bool found;
+    if(!grid_path(start, finish, cost_field, layer, &found, out_path, out_cost))
+        PERF_RETURN(false);
+
+    /* Cache the result */
+    gp.exists = found;
+    if(found) {
+        vec_coord_copy(&gp.path, out_path);
+        gp.cost = *out_cost;
+    }
+    N_FC_PutGridPath(start, finish, chunk, layer, &gp);
+    PERF_RETURN(found);
+}
+
+bool AStar_GridPathUncached(struct coord start, struct coord finish,
+                            const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
+                            enum nav_layer layer, vec_coord_t *out_path, float *out_cost)
+{
+    PERF_ENTER();
+
+    bool found;
+    if(!grid_path(start, finish, cost_field, layer, &found, out_path, out_cost))
+        PERF_RETURN(false);
+    PERF_RETURN(found);
+}
+
+void AStar_SetGridSearch(enum nav_layer layer, enum grid_search search)
+{
+    assert(layer >= 0 && layer < NAV_LAYER_MAX);
+    s_grid_search[layer] = search;
 }
 
+enum grid_search AStar_GetGridSearch(enum nav_layer layer)
+{
+    assert(layer >= 0 && layer < NAV_LAYER_MAX);
+    return s_grid_search[layer];
+}
+
+bool AStar_PortalGraphPath(struct tile_desc start_tile, struct tile_desc end_tile, 
+                           const struct portal *finish, const struct nav_private *priv, 
+                           enum nav_layer layer, vec_portal_t *out_path, float *out_cost)
+{
+    PERF_ENTER();
+
+    const struct nav_chunk *bchunk = &priv->chunks[layer][start_tile.chunk_r * priv->width + start_tile.chunk_c];
+    uint16_t start_liid = N_ClosestPathableLocalIsland(priv, bchunk, start_tile);
+    if(start_liid == ISLAND_NONE)
+        PERF_RETURN(false);
+
+    const struct nav_chunk *echunk = &priv->chunks[layer][end_tile.chunk_r * priv->width + end_tile.chunk_c];
+    uint16_t end_liid = N_ClosestPathableLocalIsland(priv, echunk, end_tile);
+    if(end_liid == ISLAND_NONE)
+        PERF_RETURN(false);
+
+    if(s_routes_priv[layer] != priv) {
+        routes_clear(layer);
+        s_routes_priv[layer] = priv;
+    }
+
+    /* Long searches are first carried out on the graph of clusters. The 
+     * portal search is then narrowed down to the corridor of clusters that
+     * the path could possibly go through. It only falls back to searching 
+     * the whole graph if the path through the corridor is cut off by 
+     * blockers, which are not accounted for by the clusters. 
+     */
+    uint8_t *corridor = NULL;
+    int dr = abs(start_tile.chunk_r - finish->chunk.r) / CLUSTER_DIM;
+    int dc = abs(start_tile.chunk_c - finish->chunk.c) / CLUSTER_DIM;
+
+    if(MAX(dr, dc) >= MIN_CLUSTER_DIST && cluster_graph_update(priv, layer)) {
+
+        const struct cluster_graph *graph = &s_clusters[layer];
+        corridor = malloc(graph->nrows * graph->ncols);
+
+        if(corridor && !cluster_corridor(graph, (struct coord){start_tile.chunk_r, start_tile.chunk_c}, 
+            finish->chunk, finish->component_id, corridor)) {
+            free(corridor);
+            PERF_RETURN(false);
+        }
+    }
+
+    bool found = false;
+    bool ok = portal_graph_search(start_tile, finish, start_liid, end_liid, priv, layer, 
+        corridor, true, &found, out_path, out_cost);
+
+    if(ok && !found && corridor) {
+        ok = portal_graph_search(start_tile, finish, start_liid, end_liid, priv, layer, 
+            NULL, true, &found, out_path, out_cost);
+    }
+
+    free(corridor);
+    PERF_RETURN(ok && found);
+}
+
+void AStar_GetStats(struct nav_search_stats *out)
+{
+    out->grid_searches = SDL_AtomicGet(&s_grid_searches);
+    out->grid_expanded = SDL_AtomicGet(&s_grid_expanded);
+    out->portal_searches = SDL_AtomicGet(&s_portal_searches);
+    out->portal_expanded = SDL_AtomicGet(&s_portal_expanded);
+}
+
+void AStar_ClearStats(void)
+{
+    SDL_AtomicSet(&s_grid_searches, 0);
+    SDL_AtomicSet(&s_grid_expanded, 0);
+    SDL_AtomicSet(&s_portal_searches, 0);
+    SDL_AtomicSet(&s_portal_expanded, 0);
+}
+
+void AStar_InvalidatePortalGraph(enum nav_layer layer)
+{
+    assert(layer >= 0 && layer < NAV_LAYER_MAX);
+    s_clusters[layer].dirty = true;
+    routes_clear(layer);
+}
+
+void AStar_Shutdown(void)
+{
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+        cluster_graph_free(&s_clusters[i]);
+        routes_clear(i);
+        if(s_routes[i]) {
+            kh_destroy(key_routes, s_routes[i]);
+            s_routes[i] = NULL;
+        }
+    }
+}
@@ -106,6 +106,13 @@ VEC_TYPE(portal, struct portal_hop)
 VEC_IMPL(static inline, portal, struct portal_hop)
 
 
+enum grid_search{
+    /* Jump Point Search. This is the default. Chunks where the passable 
+     * tiles don't all have the same cost are still searched with A*. */
+    GRID_SEARCH_JPS = 0,
+    GRID_SEARCH_ASTAR,
+};
+
 /* ------------------------------------------------------------------------
  * Finds the shortest path in a rectangular cost field. Returns true if a 
  * path is found, false otherwise. If returning true, 'out_path' holds the
@@ -116,6 +123,23 @@ bool AStar_GridPath(struct coord start, struct coord finish, struct coord chunk,
                     const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
                     enum nav_layer layer, vec_coord_t *out_path, float *out_cost);
 
+/* ------------------------------------------------------------------------
+ * Like 'AStar_GridPath', but without going through the path cache. This is 
+ * safe to call from worker threads.
+ * ------------------------------------------------------------------------
+ */
+bool AStar_GridPathUncached(struct coord start, struct coord finish,
+                            const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
+                            enum nav_layer layer, vec_coord_t *out_path, float *out_cost);
+
+/* ------------------------------------------------------------------------
+ * Select the search used by 'AStar_GridPath' for paths on the given layer.
+ * Both give paths of the same (shortest) cost, so cached paths stay valid.
+ * ------------------------------------------------------------------------
+ */
+void             AStar_SetGridSearch(enum nav_layer layer, enum grid_search search);
+enum grid_search AStar_GetGridSearch(enum nav_layer layer);
+
 /* ------------------------------------------------------------------------
  * Finds the shortest path between a tile and a node in a portal graph. Returns 
  * true if a path is found, false otherwise. If returning true, 'out_path' holds 
@@ -126,5 +150,22 @@ bool AStar_PortalGraphPath(struct tile_desc start_tile, struct tile_desc end_til
                            const struct portal *finish, const struct nav_private *priv, 
                            enum nav_layer layer, vec_portal_t *out_path, float *out_cost);
 
+/* ------------------------------------------------------------------------
+ * Drop the routes and the cluster links derived from the portal graph of 
+ * the layer. Must be called whenever the portals, their edges, their 
+ * components or the local islands of any chunk change.
+ * ------------------------------------------------------------------------
+ */
+void AStar_InvalidatePortalGraph(enum nav_layer layer);
+
+/* ------------------------------------------------------------------------
+ * Counters of the searches carried out and of the nodes expanded by them.
+ * ------------------------------------------------------------------------
+ */
+void AStar_GetStats(struct nav_search_stats *out);
+void AStar_ClearStats(void);
+
+void AStar_Shutdown(void);
+
 #endif
 
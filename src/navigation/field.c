@@ -40,8 +40,9 @@
 #include "../perf.h"
 #include "../map/public/tile.h"
 #include "../game/public/game.h"
-#include "../lib/public/pqueue.h"
+#include "../lib/public/ipqueue.h"
 #include "../lib/public/mem.h"
+#include "../lib/public/simd.h"
 
 #include <string.h>
 #include <assert.h>
@@ -53,12 +54,13 @@
 #define MAX_ENTS_PER_CHUNK  (4096)
 #define SEARCH_BUFFER       (16.0f)
 #define IDX(r, width, c)    ((r) * (width) + (c))
+#define MAX_SWEEP_ITERS     (8)
 
-PQUEUE_TYPE(coord, struct coord)
-PQUEUE_IMPL(static, coord, struct coord)
+IPQUEUE_TYPE(coord, struct coord)
+IPQUEUE_IMPL(static, coord, struct coord)
 
-PQUEUE_TYPE(td, struct tile_desc)
-PQUEUE_IMPL(static, td, struct tile_desc)
+IPQUEUE_TYPE(td, struct tile_desc)
+IPQUEUE_IMPL(static, td, struct tile_desc)
 
 struct box_xz{
     float x_min, x_max;
@@ -71,6 +73,22 @@ struct region{
     size_t r, c;
 };
 
+/* State shared by all the LOS fields of a single batch. Everything that only 
+ * depends on the destination is computed once up front, and the queue and 
+ * integration buffer are reused from one chunk to the next. */
+struct los_batch{
+    const struct nav_private *priv;
+    enum nav_layer            layer;
+    int                       faction_id;
+    uint16_t                  enemies;
+    struct tile_desc          target;
+    vec3_t                    map_pos;
+    struct map_resolution     res;
+    vec2_t                    target_center;
+    ipq_coord_t               frontier;
+    float                     integration_field[FIELD_RES_R][FIELD_RES_C];
+};
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -82,21 +100,10 @@ static int manhattan_dist(struct coord a, struct coord b)
     return dr + dc;
 }
 
-static int field_compare_tiles(void *a, void *b)
-{
-    struct coord *ac = a;
-    struct coord *bc = b;
-    return !((bc->r == ac->r) && (bc->c == ac->c));
-}
-
-static int field_compare_tds(void *a, void *b)
+/* Frontier key of a tile within the chunk */
+static uint32_t field_tile_key(struct coord tile)
 {
-    struct tile_desc *ac = a;
-    struct tile_desc *bc = b;
-    return !((bc->chunk_r == ac->chunk_r) 
-          && (bc->chunk_c == ac->chunk_c)
-          && (bc->tile_r  == ac->tile_r)
-          && (bc->tile_c  == ac->tile_c));
+    return tile.r * FIELD_RES_C + tile.c;
 }
 
 static bool field_tile_passable(const struct nav_chunk *chunk, struct coord tile)
@@ -137,15 +144,7 @@ static bool field_tile_passable_no_enemies(
     if(chunk->cost_base[tile.r][tile.c] == COST_IMPASSABLE)
         return false;
 
-    bool enemies_only = true;
-    for(int i = 0; i < MAX_FACTIONS; i++) {
-        if(chunk->factions[i][tile.r][tile.c] && !(enemies & (0x1 << i))) {
-            enemies_only = false;
-            break;
-        }
-    }
-
-    if(enemies_only)
+    if(!(chunk->faction_mask[tile.r][tile.c] & ~enemies))
         return true;
 
     if(chunk->blockers[tile.r][tile.c] > 0)
@@ -257,16 +256,12 @@ static int field_neighbours_grid_los(
     const struct nav_chunk *chunk,
     const struct LOS_field *los, 
     int                     faction_id,
+    uint16_t                enemies,
     struct coord            coord, 
     struct coord           *out_neighbours, 
     uint8_t                *out_costs)
 {
     int ret = 0;
-    uint16_t enemies = 0;
-    if(faction_id != FACTION_ID_NONE) {
-        enemies = G_GetEnemyFactions(faction_id);
-    }
-
     for(int r = -1; r <= 1; r++) {
     for(int c = -1; c <= 1; c++) {
 
@@ -281,7 +276,7 @@ static int field_neighbours_grid_los(
             continue;
         if((r == c) || (r == -c)) /* diag */
             continue;
-        if(los->field[abs_r][abs_c].wavefront_blocked)
+        if(N_LOSFieldBlocked(los, abs_r, abs_c))
             continue;
 
         out_neighbours[ret] = (struct coord){abs_r, abs_c};
@@ -411,28 +406,34 @@ static bool field_is_los_corner(
     return false;
 }
 
-static void field_create_wavefront_blocked_line(
-    struct tile_desc          target, 
-    struct tile_desc          corner, 
-    const struct nav_private *priv, 
-    vec3_t                    map_pos, 
-    struct LOS_field         *out_los)
+static uint64_t field_hash_bytes(uint64_t hash, const void *data, size_t size)
 {
-    struct map_resolution res;
-    N_GetResolution(priv, &res);
-
-    /* First determine the slope of the LOS blocker line in the XZ plane */
-    struct box target_bounds = M_Tile_Bounds(res, map_pos, target);
-    struct box corner_bounds = M_Tile_Bounds(res, map_pos, corner);
+    /* FNV-1a */
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
 
-    vec2_t target_center = (vec2_t){
-        target_bounds.x - target_bounds.width / 2.0f,
-        target_bounds.z + target_bounds.height / 2.0f
-    };
-    vec2_t corner_center = (vec2_t){
-        corner_bounds.x - corner_bounds.width / 2.0f,
-        corner_bounds.z + corner_bounds.height / 2.0f
+static vec2_t field_tile_center(struct map_resolution res, vec3_t map_pos, struct tile_desc td)
+{
+    struct box bounds = M_Tile_Bounds(res, map_pos, td);
+    return (vec2_t){
+        bounds.x - bounds.width / 2.0f,
+        bounds.z + bounds.height / 2.0f
     };
+}
+
+static void field_create_wavefront_blocked_line(
+    const struct los_batch *batch,
+    struct tile_desc        corner, 
+    struct LOS_field       *out_los)
+{
+    /* First determine the slope of the LOS blocker line in the XZ plane */
+    vec2_t target_center = batch->target_center;
+    vec2_t corner_center = field_tile_center(batch->res, batch->map_pos, corner);
 
     vec2_t slope;
     PFM_Vec2_Sub(&target_center, &corner_center, &slope);
@@ -449,10 +450,15 @@ static void field_create_wavefront_blocked_line(
     int sy = slope.raw[1] < 0.0f ? 1 : -1;
     int err = dx + dy, e2;
 
+    /* The tiles of the line are gathered into a mask for the current row, 
+     * which is merged into the field in a single write once the line steps 
+     * off the row. */
     struct coord curr = (struct coord){corner.tile_r, corner.tile_c};
+    int row = curr.r;
+    uint64_t mask = 0;
     do {
 
-        out_los->field[curr.r][curr.c].wavefront_blocked = 1;
+        mask |= ((uint64_t)1) << curr.c;
 
         e2 = 2 * err;
         if(e2 >= dy) {
@@ -464,39 +470,221 @@ static void field_create_wavefront_blocked_line(
             curr.r += sy;
         }
 
+        if(curr.r != row) {
+            out_los->wavefront_blocked[row] |= mask;
+            row = curr.r;
+            mask = 0;
+        }
+
     }while(curr.r >= 0 && curr.r < FIELD_RES_R && curr.c >= 0 && curr.c < FIELD_RES_C);
+
+    if(mask) {
+        out_los->wavefront_blocked[row] |= mask;
+    }
 }
 
 static void field_pad_wavefront(struct LOS_field *out_los)
 {
+    /* Clear the 'visible' bit of every tile adjacent to a 'wavefront blocked' 
+     * one. With the rows stored as bitsets, the neighbourhood of a row is just 
+     * the row dilated by a bit in either direction. */
+    uint64_t dilated[FIELD_RES_R];
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        uint64_t row = out_los->wavefront_blocked[r];
+        dilated[r] = row | (row << 1) | (row >> 1);
+    }
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+
+        uint64_t mask = dilated[r];
+        if(r > 0)
+            mask |= dilated[r - 1];
+        if(r < FIELD_RES_R - 1)
+            mask |= dilated[r + 1];
+        out_los->visible[r] &= ~mask;
+    }
+}
+
+static void field_los_create(
+    struct los_batch       *batch,
+    struct coord            chunk_coord, 
+    struct LOS_field       *out_los, 
+    const struct LOS_field *prev_los)
+{
+    const struct tile_desc target = batch->target;
+    const struct nav_chunk *chunk = &batch->priv->chunks[batch->layer]
+                                                        [chunk_coord.r * batch->priv->width + chunk_coord.c];
+    ipq_coord_t *frontier = &batch->frontier;
+    float (*integration_field)[FIELD_RES_C] = batch->integration_field;
+
+    out_los->chunk = chunk_coord;
+    memset(out_los->visible, 0x00, sizeof(out_los->visible));
+    memset(out_los->wavefront_blocked, 0x00, sizeof(out_los->wavefront_blocked));
+
+    ipq_coord_clear(frontier);
     for(int r = 0; r < FIELD_RES_R; r++) {
     for(int c = 0; c < FIELD_RES_C; c++) {
+        integration_field[r][c] = INFINITY; 
+    }}
+
+    /* Case 1: LOS for the destination chunk */
+    if(chunk_coord.r == target.chunk_r && chunk_coord.c == target.chunk_c) {
+
+        struct coord tile = (struct coord){target.tile_r, target.tile_c};
+        ipq_coord_push(frontier, field_tile_key(tile), 0.0f, tile);
+        integration_field[target.tile_r][target.tile_c] = 0.0f;
+        assert(NULL == prev_los);
+
+    /* Case 2: LOS for a chunk other than the destination chunk 
+     * In this case, carry over the 'visible' and 'wavefront blocked' flags from 
+     * the shared edge with the previous chunk. Then treat each tile with the 
+     * 'wavefront blocked' flag as a LOS corner. This will make the LOS seamless
+     * accross chunk borders. */
+    }else{
+
+        bool horizontal = {0};
+        int curr_edge_idx = {0};
+        int prev_edge_idx = {0};
+        
+        assert(prev_los);
+        if(prev_los->chunk.r < chunk_coord.r) {
+
+            horizontal = false;
+            curr_edge_idx = 0;
+            prev_edge_idx = FIELD_RES_R-1;
+
+        }else if(prev_los->chunk.r > chunk_coord.r) {
+
+            horizontal = false;
+            curr_edge_idx = FIELD_RES_R-1;
+            prev_edge_idx = 0;
+
+        }else if(prev_los->chunk.c < chunk_coord.c) {
+
+            horizontal = true;
+            curr_edge_idx = 0;
+            prev_edge_idx = FIELD_RES_C-1;
+
+        }else if(prev_los->chunk.c > chunk_coord.c) {
+
+            horizontal = true;
+            curr_edge_idx = FIELD_RES_C-1;
+            prev_edge_idx = 0;
+
+        }else{
+            assert(0);
+        }
+
+        if(horizontal) {
 
-        if(out_los->field[r][c].wavefront_blocked) {
+            for(int r = 0; r < FIELD_RES_R; r++) {
+
+                N_LOSFieldSetVisible(out_los, r, curr_edge_idx, 
+                    N_LOSFieldVisible(prev_los, r, prev_edge_idx));
+                N_LOSFieldSetBlocked(out_los, r, curr_edge_idx, 
+                    N_LOSFieldBlocked(prev_los, r, prev_edge_idx));
+                if(N_LOSFieldBlocked(out_los, r, curr_edge_idx)) {
+
+                    struct tile_desc src_desc = (struct tile_desc) {
+                        chunk_coord.r, chunk_coord.c, 
+                        r, curr_edge_idx
+                    };
+                    field_create_wavefront_blocked_line(batch, src_desc, out_los);
+                }
+                if(N_LOSFieldVisible(out_los, r, curr_edge_idx)) {
+
+                    struct coord tile = (struct coord){r, curr_edge_idx};
+                    ipq_coord_push(frontier, field_tile_key(tile), 0.0f, tile);
+                    integration_field[r][curr_edge_idx] = 0.0f;
+                }
+            }
+        }else{
         
-            for(int rr = r-1; rr <= r+1; rr++) {
-            for(int cc = c-1; cc <= c+1; cc++) {
-            
-                if(rr < 0 || rr > FIELD_RES_R-1)
-                    continue;
-                if(cc < 0 || cc > FIELD_RES_C-1)
+            for(int c = 0; c < FIELD_RES_C; c++) {
+
+                N_LOSFieldSetVisible(out_los, curr_edge_idx, c, 
+                    N_LOSFieldVisible(prev_los, prev_edge_idx, c));
+                N_LOSFieldSetBlocked(out_los, curr_edge_idx, c, 
+                    N_LOSFieldBlocked(prev_los, prev_edge_idx, c));
+                if(N_LOSFieldBlocked(out_los, curr_edge_idx, c)) {
+
+                    struct tile_desc src_desc = (struct tile_desc) {
+                        chunk_coord.r, chunk_coord.c, 
+                        curr_edge_idx, c
+                    };
+                    field_create_wavefront_blocked_line(batch, src_desc, out_los);
+                }
+                if(N_LOSFieldVisible(out_los, curr_edge_idx, c)) {
+
+                    struct coord tile = (struct coord){curr_edge_idx, c};
+                    ipq_coord_push(frontier, field_tile_key(tile), 0.0f, tile);
+                    integration_field[curr_edge_idx][c] = 0.0f; 
+                }
+            }
+        }
+    }
+
+    while(ipq_size(frontier) > 0) {
+
+        struct coord curr;
+        ipq_coord_pop(frontier, &curr);
+
+        struct coord neighbours[8];
+        uint8_t neighbour_costs[8];
+        int num_neighbours = field_neighbours_grid_los(chunk, out_los, batch->faction_id, 
+            batch->enemies, curr, neighbours, neighbour_costs);
+
+        for(int i = 0; i < num_neighbours; i++) {
+
+            int nr = neighbours[i].r, nc = neighbours[i].c;
+            if(neighbour_costs[i] > 1) {
+                
+                if(!field_is_los_corner(neighbours[i], chunk->cost_base, chunk->blockers))
                     continue;
-                out_los->field[rr][cc].visible = 0;
-            }}
+
+                struct tile_desc src_desc = (struct tile_desc) {
+                    .chunk_r = chunk_coord.r,
+                    .chunk_c = chunk_coord.c,
+                    .tile_r = neighbours[i].r,
+                    .tile_c = neighbours[i].c
+                };
+                field_create_wavefront_blocked_line(batch, src_desc, out_los);
+            }else{
+
+                float new_cost = integration_field[curr.r][curr.c] + 1;
+                N_LOSFieldSetVisible(out_los, nr, nc, true);
+
+                if(new_cost < integration_field[neighbours[i].r][neighbours[i].c]) {
+
+                    integration_field[nr][nc] = new_cost;
+                    ipq_coord_push(frontier, field_tile_key(neighbours[i]), 
+                        new_cost, neighbours[i]);
+                }
+            }
         }
-    }}
+    }
+
+    /* Add a single tile-wide padding of invisible tiles around the wavefront. This is 
+     * because we want to be conservative and not mark any tiles visible from which we
+     * can't raycast to the destination point from any point within the tile without 
+     * the ray going over impassable terrain. This is a nice property for the movement
+     * code. */
+    field_pad_wavefront(out_los);
 }
 
-static void field_build_integration(
-    pq_coord_t             *frontier, 
+/* A label-correcting wavefront: the cost of a tile is lowered whenever a 
+ * cheaper path to it is found, and the tile is then expanded once more. 
+ */
+static void field_build_integration_queue(
+    ipq_coord_t             *frontier, 
     const struct nav_chunk *chunk, 
     int                     faction_id, 
     float                   inout[FIELD_RES_R][FIELD_RES_C])
 {
-    while(pq_size(frontier) > 0) {
+    while(ipq_size(frontier) > 0) {
 
         struct coord curr;
-        pq_coord_pop(frontier, &curr);
+        ipq_coord_pop(frontier, &curr);
 
         struct coord neighbours[8];
         uint8_t neighbour_costs[8];
@@ -509,18 +697,109 @@ static void field_build_integration(
             if(total_cost < inout[neighbours[i].r][neighbours[i].c]) {
 
                 inout[neighbours[i].r][neighbours[i].c] = total_cost;
-                if(!pq_coord_contains(frontier, field_compare_tiles, neighbours[i]))
-                    pq_coord_push(frontier, total_cost, neighbours[i]);
+                ipq_coord_push(frontier, field_tile_key(neighbours[i]), 
+                    total_cost, neighbours[i]);
             }
         }
     }
 }
 
+/* Relax every tile in 'dst' against the adjacent tile in the same column, 
+ * which is held in 'src'. Returns true if any tile's cost was lowered. 
+ */
+static bool field_relax_row(int len, float *dst, const float *src, const float *cost)
+{
+    vmask_t changed = VM_NONE();
+    for(int c = 0; c < len; c += VW) {
+
+        vfloat_t curr = V_LOAD(dst + c);
+        vfloat_t cand = V_ADD(V_LOAD(src + c), V_LOAD(cost + c));
+        changed = VM_OR(changed, V_LT(cand, curr));
+        V_STORE(dst + c, V_MIN(curr, cand));
+    }
+    return VM_ANY(changed);
+}
+
+/* Propagate the costs down and then up along every column of the field */
+static bool field_sweep_columns(int nrows, int ncols, float *field, const float *cost)
+{
+    bool changed = false;
+    for(int r = 1; r < nrows; r++) {
+        changed |= field_relax_row(ncols, field + r * ncols, 
+            field + (r - 1) * ncols, cost + r * ncols);
+    }
+    for(int r = nrows - 2; r >= 0; r--) {
+        changed |= field_relax_row(ncols, field + r * ncols, 
+            field + (r + 1) * ncols, cost + r * ncols);
+    }
+    return changed;
+}
+
+static void field_transpose(int nrows, int ncols, const float *in, float *out)
+{
+    for(int r = 0; r < nrows; r++) {
+    for(int c = 0; c < ncols; c++) {
+        out[c * nrows + r] = in[r * ncols + c];
+    }}
+}
+
+/* Computes the same integration field as 'field_build_integration_queue' 
+ * by repeatedly sweeping over the rows and columns of the chunk until no 
+ * tile's cost can be lowered any further. The costs are small integers, 
+ * so they are exact and the result does not depend on the order in which 
+ * the tiles are relaxed. Fields with many turns (ex. mazes) may need more 
+ * sweeps than we're willing to do - these are finished off with the 
+ * wavefront. Every tile with a finite cost must be in the frontier.
+ */
+static void field_build_integration(
+    ipq_coord_t             *frontier, 
+    const struct nav_chunk *chunk, 
+    int                     faction_id, 
+    float                   inout[FIELD_RES_R][FIELD_RES_C])
+{
+    uint16_t enemies = enemies_for_faction(faction_id);
+    float cost[FIELD_RES_R][FIELD_RES_C];
+    float cost_t[FIELD_RES_C][FIELD_RES_R];
+    float inout_t[FIELD_RES_C][FIELD_RES_R];
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        struct coord curr = (struct coord){r, c};
+        bool passable = (faction_id == FACTION_ID_NONE)
+                      ? field_tile_passable(chunk, curr)
+                      : field_tile_passable_no_enemies(chunk, curr, enemies);
+        cost[r][c] = passable ? chunk->cost_base[r][c] : INFINITY;
+        cost_t[c][r] = cost[r][c];
+    }}
+
+    bool changed = true;
+    for(int i = 0; changed && i < MAX_SWEEP_ITERS; i++) {
+
+        changed = field_sweep_columns(FIELD_RES_R, FIELD_RES_C, inout[0], cost[0]);
+        field_transpose(FIELD_RES_R, FIELD_RES_C, inout[0], inout_t[0]);
+        changed |= field_sweep_columns(FIELD_RES_C, FIELD_RES_R, inout_t[0], cost_t[0]);
+        field_transpose(FIELD_RES_C, FIELD_RES_R, inout_t[0], inout[0]);
+    }
+
+    ipq_coord_clear(frontier);
+    if(!changed)
+        return;
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+        if(inout[r][c] < INFINITY)
+            ipq_coord_push(frontier, field_tile_key((struct coord){r, c}), 
+                inout[r][c], (struct coord){r, c});
+    }}
+    field_build_integration_queue(frontier, chunk, faction_id, inout);
+}
+
 /* Like 'field_build_integration', but supporting any sized square region 
  * which may straddle chunk boundaries.
  */
 static void field_build_integration_region(
-    pq_td_t                  *frontier,
+    ipq_td_t                  *frontier,
     const struct nav_private *priv,
     enum nav_layer            layer,
     uint16_t                  enemies,
@@ -530,10 +809,10 @@ static void field_build_integration_region(
     struct map_resolution res;
     N_GetResolution(priv, &res);
 
-    while(pq_size(frontier) > 0) {
+    while(ipq_size(frontier) > 0) {
 
         struct tile_desc curr;
-        pq_td_pop(frontier, &curr);
+        ipq_td_pop(frontier, &curr);
 
         struct tile_desc neighbours[8];
         uint8_t neighbour_costs[8];
@@ -562,8 +841,8 @@ static void field_build_integration_region(
             if(total_cost < inout[neighb_dr * region.r + neighb_dc]) {
 
                 inout[neighb_dr * region.r + neighb_dc] = total_cost;
-                if(!pq_td_contains(frontier, field_compare_tds, neighbours[i]))
-                    pq_td_push(frontier, total_cost, neighbours[i]);
+                ipq_td_push(frontier, neighb_dr * region.r + neighb_dc, 
+                    total_cost, neighbours[i]);
             }
         }
     }
@@ -573,15 +852,15 @@ static void field_build_integration_region(
  * will be added to the frontier 
  */
 static void field_build_integration_nonpass(
-    pq_coord_t             *frontier, 
+    ipq_coord_t             *frontier, 
     const struct nav_chunk *chunk, 
     int                     faction_id, 
     float                   inout[FIELD_RES_R][FIELD_RES_C])
 {
-    while(pq_size(frontier) > 0) {
+    while(ipq_size(frontier) > 0) {
 
         struct coord curr;
-        pq_coord_pop(frontier, &curr);
+        ipq_coord_pop(frontier, &curr);
 
         struct coord neighbours[8];
         uint8_t neighbour_costs[8];
@@ -597,8 +876,8 @@ static void field_build_integration_nonpass(
             if(total_cost < inout[neighbours[i].r][neighbours[i].c]) {
 
                 inout[neighbours[i].r][neighbours[i].c] = total_cost;
-                if(!pq_coord_contains(frontier, field_compare_tiles, neighbours[i]))
-                    pq_coord_push(frontier, total_cost, neighbours[i]);
+                ipq_coord_push(frontier, field_tile_key(neighbours[i]), 
+                    total_cost, neighbours[i]);
             }
         }
     }
@@ -608,7 +887,7 @@ static void field_build_integration_nonpass(
  * which may straddle chunk boundaries.
  */
 static void field_build_integration_nonpass_region(
-    pq_td_t                  *frontier,
+    ipq_td_t                  *frontier,
     const struct nav_private *priv,
     enum nav_layer            layer,
     uint16_t                  enemies,
@@ -618,10 +897,10 @@ static void field_build_integration_nonpass_region(
     struct map_resolution res;
     N_GetResolution(priv, &res);
 
-    while(pq_size(frontier) > 0) {
+    while(ipq_size(frontier) > 0) {
 
         struct tile_desc curr;
-        pq_td_pop(frontier, &curr);
+        ipq_td_pop(frontier, &curr);
 
         struct tile_desc neighbours[8];
         uint8_t neighbour_costs[8];
@@ -654,8 +933,8 @@ static void field_build_integration_nonpass_region(
             if(total_cost < inout[neighb_dr * region.r + neighb_dc]) {
 
                 inout[neighb_dr * region.r + neighb_dc] = total_cost;
-                if(!pq_td_contains(frontier, field_compare_tds, neighb))
-                    pq_td_push(frontier, total_cost, neighb);
+                ipq_td_push(frontier, neighb_dr * region.r + neighb_dc, 
+                    total_cost, neighb);
             }
         }
     }
@@ -663,26 +942,89 @@ static void field_build_integration_nonpass_region(
 
 static void field_build_flow(float intf[FIELD_RES_R][FIELD_RES_C], struct flow_field *inout_flow)
 {
+    /* Surround the integration field with a border of impassable tiles, 
+     * so that the neighbours of every tile can be loaded without any bounds 
+     * checks. An out-of-bounds neighbour is never chosen since it can never 
+     * match the (finite) minimum cost. This gives the same directions as 
+     * calling 'field_flow_dir' on every tile. */
+    float padded[FIELD_RES_R + 2][FIELD_RES_C + 2];
+    for(int r = 0; r < FIELD_RES_R + 2; r++) {
+        padded[r][0] = INFINITY;
+        padded[r][FIELD_RES_C + 1] = INFINITY;
+    }
+    for(int c = 0; c < FIELD_RES_C + 2; c++) {
+        padded[0][c] = INFINITY;
+        padded[FIELD_RES_R + 1][c] = INFINITY;
+    }
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        memcpy(&padded[r + 1][1], intf[r], sizeof(intf[r]));
+    }
 
-    /* Build the flow field from the integration field. Don't touch any impassable tiles
-     * as they may have already been set in the case that a single chunk is divided into
-     * multiple passable 'islands', but a computed path takes us through more than one of
-     * these 'islands'. */
+    const vfloat_t inf = V_SET1(INFINITY);
     for(int r = 0; r < FIELD_RES_R; r++) {
-    for(int c = 0; c < FIELD_RES_C; c++) {
 
-        if(intf[r][c] == INFINITY)
-            continue;
+        const float *above = padded[r];
+        const float *row = padded[r + 1];
+        const float *below = padded[r + 2];
+
+        for(int c = 0; c < FIELD_RES_C; c += VW) {
+
+            vfloat_t n = V_LOAD(above + c + 1);
+            vfloat_t s = V_LOAD(below + c + 1);
+            vfloat_t w = V_LOAD(row + c);
+            vfloat_t e = V_LOAD(row + c + 2);
+            vfloat_t nw = V_LOAD(above + c);
+            vfloat_t ne = V_LOAD(above + c + 2);
+            vfloat_t sw = V_LOAD(below + c);
+            vfloat_t se = V_LOAD(below + c + 2);
+
+            vmask_t n_open = V_LT(n, inf);
+            vmask_t s_open = V_LT(s, inf);
+            vmask_t w_open = V_LT(w, inf);
+            vmask_t e_open = V_LT(e, inf);
+
+            /* Diagonal directions are allowed only when _both_ the side 
+             * tiles sharing an edge with the corner tile are passable. */
+            vfloat_t min_cost = V_MIN(V_MIN(n, s), V_MIN(w, e));
+            min_cost = V_MIN(min_cost, V_SELECT(VM_AND(n_open, w_open), nw, inf));
+            min_cost = V_MIN(min_cost, V_SELECT(VM_AND(n_open, e_open), ne, inf));
+            min_cost = V_MIN(min_cost, V_SELECT(VM_AND(s_open, w_open), sw, inf));
+            min_cost = V_MIN(min_cost, V_SELECT(VM_AND(s_open, e_open), se, inf));
+
+            /* Prioritize the cardinal directions over the diagonal ones. The 
+             * highest-priority direction is selected last. */
+            vfloat_t dir = V_SET1(FD_NONE);
+            dir = V_SELECT(V_EQ(se, min_cost), V_SET1(FD_SE), dir);
+            dir = V_SELECT(V_EQ(sw, min_cost), V_SET1(FD_SW), dir);
+            dir = V_SELECT(V_EQ(ne, min_cost), V_SET1(FD_NE), dir);
+            dir = V_SELECT(V_EQ(nw, min_cost), V_SET1(FD_NW), dir);
+            dir = V_SELECT(V_EQ(w, min_cost), V_SET1(FD_W), dir);
+            dir = V_SELECT(V_EQ(e, min_cost), V_SET1(FD_E), dir);
+            dir = V_SELECT(V_EQ(s, min_cost), V_SET1(FD_S), dir);
+            dir = V_SELECT(V_EQ(n, min_cost), V_SET1(FD_N), dir);
+
+            float dirs[VW];
+            V_STORE(dirs, dir);
+
+            /* Don't touch any impassable tiles as they may have already been set 
+             * in the case that a single chunk is divided into multiple passable 
+             * 'islands', but a computed path takes us through more than one of
+             * these 'islands'. */
+            for(int i = 0; i < VW; i++) {
+
+                if(intf[r][c + i] == INFINITY)
+                    continue;
 
-        if(intf[r][c] == 0.0f) {
+                if(intf[r][c + i] == 0.0f) {
+                    N_FlowFieldSetDir(inout_flow, r, c + i, FD_NONE);
+                    continue;
+                }
 
-            inout_flow->field[r][c].dir_idx = FD_NONE;
-            continue;
+                assert(dirs[i] != FD_NONE);
+                N_FlowFieldSetDir(inout_flow, r, c + i, (int)dirs[i]);
+            }
         }
-
-        inout_flow->field[r][c].dir_idx = field_flow_dir(FIELD_RES_R, FIELD_RES_C, 
-            (const float*)intf, (struct coord){r, c});
-    }}
+    }
 }
 
 /* Like 'field_build_flow', but potentially having an integration field that is a different
@@ -708,12 +1050,12 @@ static void field_build_flow_region(
 
         if(intf[infr * rdim + infc] == 0.0f) {
 
-            inout_flow->field[r][c].dir_idx = FD_NONE;
+            N_FlowFieldSetDir(inout_flow, r, c, FD_NONE);
             continue;
         }
 
-        inout_flow->field[r][c].dir_idx = field_flow_dir(rdim ,cdim, 
-            intf, (struct coord){infr, infc});
+        N_FlowFieldSetDir(inout_flow, r, c, field_flow_dir(rdim ,cdim, 
+            intf, (struct coord){infr, infc}));
     }}
 }
 
@@ -774,13 +1116,13 @@ static void field_fixup_portal_edges(
         if(intf[r][c] == 0.0f) {
 
             if(up)
-                inout_flow->field[r][c].dir_idx = FD_N;
+                N_FlowFieldSetDir(inout_flow, r, c, FD_N);
             else if(down)
-                inout_flow->field[r][c].dir_idx = FD_S;
+                N_FlowFieldSetDir(inout_flow, r, c, FD_S);
             else if(left)
-                inout_flow->field[r][c].dir_idx = FD_W;
+                N_FlowFieldSetDir(inout_flow, r, c, FD_W);
             else if(right)
-                inout_flow->field[r][c].dir_idx = FD_E;
+                N_FlowFieldSetDir(inout_flow, r, c, FD_E);
             else
                 assert(0);
         }
@@ -1197,47 +1539,110 @@ static size_t field_entity_initial_frontier(
     return ret;
 }
 
-static size_t field_initial_frontier(
+static size_t field_targets_initial_frontier(
+    struct targets_desc      *targets, 
+    const struct nav_private *priv, 
+    struct tile_desc          base,
+    int                       rdim,
+    int                       cdim,
     enum nav_layer            layer,
-    struct field_target       target, 
-    const struct nav_chunk   *chunk, 
-    const struct nav_private *priv,
-    bool                      ignoreblock, 
-    int                       faction_id,
-    struct coord             *init_frontier, 
+    struct tile_desc         *out, 
     size_t                    maxout)
 {
-    size_t ninit = 0;
-    switch(target.type) {
-    case TARGET_PORTAL:
-        
-        ninit = field_portal_initial_frontier(priv, layer, target.pd, chunk, ignoreblock, 
-            faction_id, init_frontier, maxout);
-        break;
+    assert(Sched_UsingBigStack());
 
-    case TARGET_TILE:
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
 
-        ninit = field_tile_initial_frontier(target.tile, chunk, ignoreblock, 
-            faction_id, init_frontier, maxout);
-        break;
+    size_t nents;
+    const uint32_t *ents = N_FactionTargets(targets->faction_id, &nents);
 
-    case TARGET_ENEMIES:
-    case TARGET_ENTITY:
-        /* Requires special handling */
-        assert(0);
-        break;
+    STALLOC(bool, has_target, rdim * cdim);
+    memset(has_target, 0, sizeof(bool) * rdim * cdim);
 
-    default: assert(0);
-    }
-    return ninit;
-}
+    for(int i = 0; i < nents; i++) {
 
-static void field_fixup(
-    struct field_target     target, 
-    float                   integration_field[FIELD_RES_R][FIELD_RES_C],
-    struct flow_field      *inout_flow, 
-    const struct nav_chunk *chunk)
-{
+        struct entity_desc curr = (struct entity_desc){
+            .target = ents[i],
+            .map_pos = targets->map_pos
+        };
+        if(!G_EntityExists(curr.target))
+            continue;
+
+        struct tile_desc tds[512];
+        size_t ntds = field_entity_initial_frontier(&curr, priv, base, rdim, cdim, 
+            layer, tds, ARR_SIZE(tds));
+
+        for(int j = 0; j < ntds; j++) {
+
+            int dr, dc;
+            M_Tile_Distance(res, &base, &tds[j], &dr, &dc);
+            has_target[dr * rdim + dc] = true;
+        }
+    }
+
+    int ret = 0;
+    for(int r = 0; r < rdim; r++) {
+    for(int c = 0; c < cdim; c++) {
+        
+        if(ret == maxout)
+            goto out;
+        if(!has_target[r * rdim + c])
+            continue;
+
+        struct tile_desc td = base;
+        bool status = M_Tile_RelativeDesc(res, &td, c, r);
+        assert(status);
+        out[ret++] = td;
+    }}
+
+out:
+    STFREE(has_target);
+    return ret;
+}
+
+static size_t field_initial_frontier(
+    enum nav_layer            layer,
+    struct field_target       target, 
+    const struct nav_chunk   *chunk, 
+    const struct nav_private *priv,
+    bool                      ignoreblock, 
+    int                       faction_id,
+    struct coord             *init_frontier, 
+    size_t                    maxout)
+{
+    size_t ninit = 0;
+    switch(target.type) {
+    case TARGET_PORTAL:
+        
+        ninit = field_portal_initial_frontier(priv, layer, target.pd, chunk, ignoreblock, 
+            faction_id, init_frontier, maxout);
+        break;
+
+    case TARGET_TILE:
+
+        ninit = field_tile_initial_frontier(target.tile, chunk, ignoreblock, 
+            faction_id, init_frontier, maxout);
+        break;
+
+    case TARGET_ENEMIES:
+    case TARGET_ENTITY:
+    case TARGET_FACTION_TARGETS:
+        /* Requires special handling */
+        assert(0);
+        break;
+
+    default: assert(0);
+    }
+    return ninit;
+}
+
+static void field_fixup(
+    struct field_target     target, 
+    float                   integration_field[FIELD_RES_R][FIELD_RES_C],
+    struct flow_field      *inout_flow, 
+    const struct nav_chunk *chunk)
+{
     if(target.type == TARGET_PORTAL) {
         field_fixup_portal_edges(integration_field, inout_flow, target.pd.port); 
     }
@@ -1353,115 +1758,102 @@ static size_t field_passable_frontier(
     return ret;
 }
 
-/* Update the field to guide towards the nearest possible enemy of the 
- * specified faction.
+/* Update the field to guide towards the nearest of the tiles occupied by 
+ * the entities of the target: the enemies of a faction, a single entity or 
+ * a set of entities.
  */
-static void field_update_enemies(
-    struct coord              chunk_coord, 
-    const struct nav_private *priv, 
-    enum nav_layer            layer, 
-    struct enemies_desc       target, 
-    struct flow_field        *inout_flow)
+static struct tile_desc field_padded_base(struct coord chunk_coord)
 {
-    struct map_resolution res;
-    N_GetResolution(priv, &res);
-
-    pq_td_t frontier;
-    pq_td_init(&frontier);
-
-    /* Make the integration field have a padding of of half a chunk width/length 
-     * on every side of it. Initially, we will build a flow field with this 'padding'
-     * around it, but then we will cut out the center FIELD_RES_R * FIELD_RES_C 
-     * region and use that as the final field. The purpose of this is to consider 
-     * enemies which are immediately outside the chunk bounds and also guide towards
-     * them if they are optimal targets. 
-     */
-    const int rdim = (priv->height > 1) ? FIELD_RES_R * 2 + (FIELD_RES_R % 2) : FIELD_RES_R;
-    const int cdim = (priv->width  > 1) ? FIELD_RES_C * 2 + (FIELD_RES_C % 2) : FIELD_RES_C;
-
-    STALLOC(float, integration_field, rdim * cdim);
-    for(int r = 0; r < rdim; r++) {
-    for(int c = 0; c < cdim; c++) {
-        integration_field[r * rdim + c] = INFINITY;
-    }}
-
-    struct tile_desc base = (struct tile_desc){
+    return (struct tile_desc){
         .chunk_r = (chunk_coord.r > 0) ? chunk_coord.r - 1 : chunk_coord.r,
         .chunk_c = (chunk_coord.c > 0) ? chunk_coord.c - 1 : chunk_coord.c,
         .tile_r  = (chunk_coord.r > 0) ? FIELD_RES_R / 2 + (FIELD_RES_R % 2) : 0,
         .tile_c  = (chunk_coord.c > 0) ? FIELD_RES_C / 2 + (FIELD_RES_C % 2) : 0,
     };
+}
 
-    STALLOC(struct tile_desc, init_frontier, rdim * cdim);
-    size_t ninit = field_enemies_initial_frontier(&target, priv, base, rdim, cdim,
-        layer, init_frontier, rdim * cdim);
-
-    for(int i = 0; i < ninit; i++) {
-
-        struct tile_desc curr = init_frontier[i];
-
-        int dr, dc;
-        M_Tile_Distance(res, &base, &curr, &dr, &dc);
-        assert(dr >= 0 && dr < rdim);
-        assert(dc >= 0 && dc < cdim);
-
-        pq_td_push(&frontier, 0.0f, curr); 
-        integration_field[dr * rdim + dc] = 0.0f;
+static size_t field_padded_initial_frontier(
+    const struct nav_private *priv, 
+    enum nav_layer            layer, 
+    struct field_target      *target, 
+    struct tile_desc          base,
+    int                       rdim,
+    int                       cdim,
+    struct tile_desc         *out, 
+    size_t                    maxout)
+{
+    switch(target->type) {
+    case TARGET_ENEMIES:
+        return field_enemies_initial_frontier(&target->enemies, priv, base, rdim, cdim,
+            layer, out, maxout);
+    case TARGET_ENTITY:
+        return field_entity_initial_frontier(&target->ent, priv, base, rdim, cdim,
+            layer, out, maxout);
+    case TARGET_FACTION_TARGETS:
+        return field_targets_initial_frontier(&target->targets, priv, base, rdim, cdim,
+            layer, out, maxout);
+    default: assert(0);
     }
+    return 0;
+}
 
-    inout_flow->target = (struct field_target){
-        .type = TARGET_ENEMIES,
-        .enemies = target
-    };
+/* Summarize the set of goal tiles, independent of the order they were found in */
+static uint64_t field_goal_key(struct map_resolution res, struct tile_desc base,
+                               const struct tile_desc *tiles, size_t ntiles)
+{
+    uint64_t sum = 0, mix = 0;
+    for(int i = 0; i < ntiles; i++) {
 
-    const int roff = (chunk_coord.r > 0) ? FIELD_RES_R / 2 + (FIELD_RES_R % 2) : 0;
-    const int coff = (chunk_coord.c > 0) ? FIELD_RES_C / 2 + (FIELD_RES_C % 2) : 0;
+        int dr, dc;
+        M_Tile_Distance(res, &base, (struct tile_desc*)&tiles[i], &dr, &dc);
 
-    struct region region = (struct region){base, rdim, cdim};
-    field_build_integration_region(&frontier, priv, layer, 0, 
-        region, integration_field);
-    field_build_flow_region(rdim, cdim, roff, coff, integration_field, inout_flow);
+        /* splitmix64 finalizer */
+        uint64_t h = ((((uint64_t)dr) & 0xffff) << 16) | (((uint64_t)dc) & 0xffff);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        h = h ^ (h >> 31);
 
-    STFREE(integration_field);
-    STFREE(init_frontier);
-    pq_td_destroy(&frontier);
+        sum += h;
+        mix ^= h;
+    }
+    return (sum ^ (mix << 1) ^ (mix >> 63)) + ntiles;
 }
 
-/* Update the field to guide towards the nearest possible tile which is 
- * adjacent to one of the tiles occupied by the specified entity.
- */
-static void field_update_entity(
+static void field_update_padded(
     struct coord              chunk_coord, 
     const struct nav_private *priv, 
     enum nav_layer            layer, 
-    struct entity_desc        target, 
+    struct field_target       target, 
     struct flow_field        *inout_flow)
 {
     struct map_resolution res;
     N_GetResolution(priv, &res);
 
-    pq_td_t frontier;
-    pq_td_init(&frontier);
-
+    /* Make the integration field have a padding of of half a chunk width/length 
+     * on every side of it. Initially, we will build a flow field with this 'padding'
+     * around it, but then we will cut out the center FIELD_RES_R * FIELD_RES_C 
+     * region and use that as the final field. The purpose of this is to consider 
+     * targets which are immediately outside the chunk bounds and also guide towards
+     * them if they are optimal. 
+     */
     const int rdim = (priv->height > 1) ? FIELD_RES_R * 2 + (FIELD_RES_R % 2) : FIELD_RES_R;
     const int cdim = (priv->width  > 1) ? FIELD_RES_C * 2 + (FIELD_RES_C % 2) : FIELD_RES_C;
 
+    ipq_td_t frontier;
+    if(!ipq_td_init_alloc(&frontier, rdim * cdim, Sched_FrameRealloc, Sched_FrameFree))
+        return;
+
     STALLOC(float, integration_field, rdim * cdim);
     for(int r = 0; r < rdim; r++) {
     for(int c = 0; c < cdim; c++) {
         integration_field[r * rdim + c] = INFINITY;
     }}
 
-    struct tile_desc base = (struct tile_desc){
-        .chunk_r = (chunk_coord.r > 0) ? chunk_coord.r - 1 : chunk_coord.r,
-        .chunk_c = (chunk_coord.c > 0) ? chunk_coord.c - 1 : chunk_coord.c,
-        .tile_r  = (chunk_coord.r > 0) ? FIELD_RES_R / 2 + (FIELD_RES_R % 2) : 0,
-        .tile_c  = (chunk_coord.c > 0) ? FIELD_RES_C / 2 + (FIELD_RES_C % 2) : 0,
-    };
+    struct tile_desc base = field_padded_base(chunk_coord);
 
     STALLOC(struct tile_desc, init_frontier, rdim * cdim);
-    size_t ninit = field_entity_initial_frontier(&target, priv, base, rdim, cdim,
-        layer, init_frontier, rdim * cdim);
+    size_t ninit = field_padded_initial_frontier(priv, layer, &target, base, rdim, cdim,
+        init_frontier, rdim * cdim);
 
     for(int i = 0; i < ninit; i++) {
 
@@ -1472,25 +1864,24 @@ static void field_update_entity(
         assert(dr >= 0 && dr < rdim);
         assert(dc >= 0 && dc < cdim);
 
-        pq_td_push(&frontier, 0.0f, curr); 
+        ipq_td_push(&frontier, dr * rdim + dc, 0.0f, curr); 
         integration_field[dr * rdim + dc] = 0.0f;
     }
 
-    inout_flow->target = (struct field_target){
-        .type = TARGET_ENTITY,
-        .ent = target
-    };
+    inout_flow->target = target;
+    inout_flow->goal_key = field_goal_key(res, base, init_frontier, ninit);
 
     const int roff = (chunk_coord.r > 0) ? FIELD_RES_R / 2 + (FIELD_RES_R % 2) : 0;
     const int coff = (chunk_coord.c > 0) ? FIELD_RES_C / 2 + (FIELD_RES_C % 2) : 0;
 
     struct region region = (struct region){base, rdim, cdim};
-    field_build_integration_region(&frontier, priv, layer, 0, region, integration_field);
+    field_build_integration_region(&frontier, priv, layer, 0, 
+        region, integration_field);
     field_build_flow_region(rdim, cdim, roff, coff, integration_field, inout_flow);
 
     STFREE(integration_field);
     STFREE(init_frontier);
-    pq_td_destroy(&frontier);
+    ipq_td_destroy(&frontier);
 }
 
 static struct region clamped_region(struct nav_private *priv, size_t rdim, size_t cdim,
@@ -1593,6 +1984,15 @@ ff_id_t N_FlowFieldID(struct coord chunk, struct field_target target, enum nav_l
              | (((uint64_t)chunk.r)                        <<  8)
              | (((uint64_t)chunk.c)                        <<  0);
 
+    }else if(target.type == TARGET_FACTION_TARGETS) {
+
+        return (((uint64_t)layer)                          << 60)
+             | (((uint64_t)target.type)                    << 56)
+             | (((uint64_t)target.targets.key & 0xffffff)  << 32)
+             | (((uint64_t)target.targets.faction_id)      << 24)
+             | (((uint64_t)chunk.r)                        <<  8)
+             | (((uint64_t)chunk.c)                        <<  0);
+
     }else {
         assert(0);
         return 0;
@@ -1609,14 +2009,95 @@ int N_FlowFieldTargetType(ff_id_t id)
     return (id >> 56) & 0xf;
 }
 
-void N_FlowFieldInit(struct coord chunk_coord, struct flow_field *out)
+bool N_FlowFieldTargetsPortal(ff_id_t id, const struct portal *port)
 {
+    if(N_FlowFieldTargetType(id) != TARGET_PORTAL)
+        return false;
+
+    return ((id >> 34) & 0x3f) == port->endpoints[0].r
+        && ((id >> 28) & 0x3f) == port->endpoints[0].c
+        && ((id >> 22) & 0x3f) == port->endpoints[1].r
+        && ((id >> 16) & 0x3f) == port->endpoints[1].c;
+}
+
+bool N_FlowFieldContentKey(
+    struct coord              chunk_coord, 
+    const struct nav_private *priv, 
+    int                       faction_id,
+    enum nav_layer            layer, 
+    struct field_target       target, 
+    uint64_t                 *out_key)
+{
+    if(target.type != TARGET_PORTAL && target.type != TARGET_TILE)
+        return false;
+
+    PERF_ENTER();
+    const struct nav_chunk *chunk = &priv->chunks[layer][IDX(chunk_coord.r, priv->width, chunk_coord.c)];
+    uint16_t enemies = enemies_for_faction(faction_id);
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    int type = target.type;
+    hash = field_hash_bytes(hash, &type, sizeof(type));
+    hash = field_hash_bytes(hash, &chunk_coord, sizeof(chunk_coord));
+
+    /* The edge which the field leads off of */
+    if(target.type == TARGET_PORTAL) {
+        struct coord next = target.pd.port->connected->chunk;
+        hash = field_hash_bytes(hash, &next, sizeof(next));
+    }
+
+    /* The goal tiles take in the target, the islands and the blockers */
+    struct coord init_frontier[FIELD_RES_R * FIELD_RES_C];
+    size_t ninit = field_initial_frontier(layer, target, chunk, priv, false, faction_id, 
+        init_frontier, ARR_SIZE(init_frontier));
+    hash = field_hash_bytes(hash, &ninit, sizeof(ninit));
+    hash = field_hash_bytes(hash, init_frontier, sizeof(struct coord) * ninit);
+
+    /* Followed by everything the integration field is built from */
+    uint64_t passable[FIELD_RES_R] = {0};
     for(int r = 0; r < FIELD_RES_R; r++) {
     for(int c = 0; c < FIELD_RES_C; c++) {
-
-        out->field[r][c].dir_idx = FD_NONE;
+        bool pass = (faction_id == FACTION_ID_NONE)
+                  ? field_tile_passable(chunk, (struct coord){r, c})
+                  : field_tile_passable_no_enemies(chunk, (struct coord){r, c}, enemies);
+        passable[r] |= ((uint64_t)pass) << c;
     }}
+    hash = field_hash_bytes(hash, passable, sizeof(passable));
+    hash = field_hash_bytes(hash, chunk->cost_base, sizeof(chunk->cost_base));
+    hash = field_hash_bytes(hash, chunk->local_islands, sizeof(chunk->local_islands));
+
+    *out_key = hash;
+    PERF_RETURN(true);
+}
+
+void N_FlowFieldInit(struct coord chunk_coord, struct flow_field *out)
+{
+    /* FD_NONE is zero in both nibbles */
+    memset(out->dirs, 0x00, sizeof(out->dirs));
     out->chunk = chunk_coord;
+    out->goal_key = 0;
+}
+
+uint64_t N_FlowFieldGoalKey(
+    struct coord              chunk_coord, 
+    const struct nav_private *priv, 
+    enum nav_layer            layer, 
+    struct field_target       target)
+{
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
+
+    const int rdim = (priv->height > 1) ? FIELD_RES_R * 2 + (FIELD_RES_R % 2) : FIELD_RES_R;
+    const int cdim = (priv->width  > 1) ? FIELD_RES_C * 2 + (FIELD_RES_C % 2) : FIELD_RES_C;
+    struct tile_desc base = field_padded_base(chunk_coord);
+
+    STALLOC(struct tile_desc, init_frontier, rdim * cdim);
+    size_t ninit = field_padded_initial_frontier(priv, layer, &target, base, rdim, cdim,
+        init_frontier, rdim * cdim);
+    uint64_t ret = field_goal_key(res, base, init_frontier, ninit);
+
+    STFREE(init_frontier);
+    return ret;
 }
 
 void N_FlowFieldUpdate(
@@ -1628,19 +2109,18 @@ void N_FlowFieldUpdate(
     struct flow_field        *inout_flow)
 {
     PERF_ENTER();
-    if(target.type == TARGET_ENEMIES) {
-        field_update_enemies(chunk_coord, priv, layer, target.enemies, inout_flow);
-        PERF_RETURN_VOID();
-    }
-
-    if(target.type == TARGET_ENTITY) {
-        field_update_entity(chunk_coord, priv, layer, target.ent, inout_flow);
+    if(target.type == TARGET_ENEMIES
+    || target.type == TARGET_ENTITY
+    || target.type == TARGET_FACTION_TARGETS) {
+        field_update_padded(chunk_coord, priv, layer, target, inout_flow);
         PERF_RETURN_VOID();
     }
 
     const struct nav_chunk *chunk = &priv->chunks[layer][IDX(chunk_coord.r, priv->width, chunk_coord.c)];
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
+    ipq_coord_t frontier;
+    if(!ipq_coord_init_alloc(&frontier, FIELD_RES_R * FIELD_RES_C, 
+        Sched_FrameRealloc, Sched_FrameFree))
+        PERF_RETURN_VOID();
 
     float integration_field[FIELD_RES_R][FIELD_RES_C];
     for(int r = 0; r < FIELD_RES_R; r++) {
@@ -1655,7 +2135,7 @@ void N_FlowFieldUpdate(
     for(int i = 0; i < ninit; i++) {
 
         struct coord curr = init_frontier[i];
-        pq_coord_push(&frontier, 0.0f, curr); 
+        ipq_coord_push(&frontier, field_tile_key(curr), 0.0f, curr); 
         integration_field[curr.r][curr.c] = 0.0f;
     }
 
@@ -1664,169 +2144,115 @@ void N_FlowFieldUpdate(
     field_build_flow(integration_field, inout_flow);
     field_fixup(target, integration_field, inout_flow, chunk);
 
-    pq_coord_destroy(&frontier);
+    ipq_coord_destroy(&frontier);
     PERF_RETURN_VOID();
 }
 
-void N_LOSFieldCreate(
-    dest_id_t                 id, 
+bool N_FlowFieldGPUJob(
     struct coord              chunk_coord, 
-    struct tile_desc          target,
     const struct nav_private *priv, 
-    vec3_t                    map_pos, 
-    struct LOS_field         *out_los, 
-    const struct LOS_field   *prev_los)
+    int                       faction_id,
+    enum nav_layer            layer, 
+    struct field_target       target, 
+    struct field_gpu_job     *out)
 {
-    int faction_id = N_DestFactionID(id);
-    out_los->chunk = chunk_coord;
-    memset(out_los->field, 0x00, sizeof(out_los->field));
+    if(target.type != TARGET_PORTAL && target.type != TARGET_TILE)
+        return false;
 
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
-    const struct nav_chunk *chunk = &priv->chunks[N_DestLayer(id)]
-                                                 [chunk_coord.r * priv->width + chunk_coord.c];
+    const struct nav_chunk *chunk = &priv->chunks[layer][IDX(chunk_coord.r, priv->width, chunk_coord.c)];
+    uint16_t enemies = enemies_for_faction(faction_id);
 
-    float integration_field[FIELD_RES_R][FIELD_RES_C];
     for(int r = 0; r < FIELD_RES_R; r++) {
     for(int c = 0; c < FIELD_RES_C; c++) {
-        integration_field[r][c] = INFINITY; 
-    }}
-
-    /* Case 1: LOS for the destination chunk */
-    if(chunk_coord.r == target.chunk_r && chunk_coord.c == target.chunk_c) {
 
-        pq_coord_push(&frontier, 0.0f, (struct coord){target.tile_r, target.tile_c});
-        integration_field[target.tile_r][target.tile_c] = 0.0f;
-        assert(NULL == prev_los);
-
-    /* Case 2: LOS for a chunk other than the destination chunk 
-     * In this case, carry over the 'visible' and 'wavefront blocked' flags from 
-     * the shared edge with the previous chunk. Then treat each tile with the 
-     * 'wavefront blocked' flag as a LOS corner. This will make the LOS seamless
-     * accross chunk borders. */
-    }else{
-
-        bool horizontal = {0};
-        int curr_edge_idx = {0};
-        int prev_edge_idx = {0};
-        
-        assert(prev_los);
-        if(prev_los->chunk.r < chunk_coord.r) {
-
-            horizontal = false;
-            curr_edge_idx = 0;
-            prev_edge_idx = FIELD_RES_R-1;
-
-        }else if(prev_los->chunk.r > chunk_coord.r) {
-
-            horizontal = false;
-            curr_edge_idx = FIELD_RES_R-1;
-            prev_edge_idx = 0;
-
-        }else if(prev_los->chunk.c < chunk_coord.c) {
-
-            horizontal = true;
-            curr_edge_idx = 0;
-            prev_edge_idx = FIELD_RES_C-1;
-
-        }else if(prev_los->chunk.c > chunk_coord.c) {
-
-            horizontal = true;
-            curr_edge_idx = FIELD_RES_C-1;
-            prev_edge_idx = 0;
-
-        }else{
-            assert(0);
-        }
-
-        if(horizontal) {
-
-            for(int r = 0; r < FIELD_RES_R; r++) {
-
-                out_los->field[r][curr_edge_idx] = prev_los->field[r][prev_edge_idx];
-                if(out_los->field[r][curr_edge_idx].wavefront_blocked) {
-
-                    struct tile_desc src_desc = (struct tile_desc) {
-                        chunk_coord.r, chunk_coord.c, 
-                        r, curr_edge_idx
-                    };
-                    field_create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-                }
-                if(out_los->field[r][curr_edge_idx].visible) {
-
-                    pq_coord_push(&frontier, 0.0f, (struct coord){r, curr_edge_idx});
-                    integration_field[r][curr_edge_idx] = 0.0f;
-                }
-            }
-        }else{
-        
-            for(int c = 0; c < FIELD_RES_C; c++) {
-
-                out_los->field[curr_edge_idx][c] = prev_los->field[prev_edge_idx][c];
-                if(out_los->field[curr_edge_idx][c].wavefront_blocked) {
+        struct coord curr = (struct coord){r, c};
+        bool passable = (faction_id == FACTION_ID_NONE)
+                      ? field_tile_passable(chunk, curr)
+                      : field_tile_passable_no_enemies(chunk, curr, enemies);
+        out->cost[r][c] = passable ? chunk->cost_base[r][c] : COST_IMPASSABLE;
+    }}
 
-                    struct tile_desc src_desc = (struct tile_desc) {
-                        chunk_coord.r, chunk_coord.c, 
-                        curr_edge_idx, c
-                    };
-                    field_create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-                }
-                if(out_los->field[curr_edge_idx][c].visible) {
+    struct coord init_frontier[FIELD_RES_R * FIELD_RES_C];
+    size_t ninit = field_initial_frontier(layer, target, chunk, priv, false, faction_id, 
+        init_frontier, ARR_SIZE(init_frontier));
 
-                    pq_coord_push(&frontier, 0.0f, (struct coord){curr_edge_idx, c});
-                    integration_field[curr_edge_idx][c] = 0.0f; 
-                }
-            }
-        }
+    memset(out->seeds, 0, sizeof(out->seeds));
+    for(int i = 0; i < ninit; i++) {
+        struct coord curr = init_frontier[i];
+        out->seeds[curr.r] |= ((uint64_t)1) << curr.c;
     }
 
-    while(pq_size(&frontier) > 0) {
-
-        struct coord curr;
-        pq_coord_pop(&frontier, &curr);
-
-        struct coord neighbours[8];
-        uint8_t neighbour_costs[8];
-        int num_neighbours = field_neighbours_grid_los(chunk, out_los, faction_id, 
-            curr, neighbours, neighbour_costs);
+    /* Same as 'field_fixup_portal_edges' */
+    out->seed_dir = FD_NONE;
+    if(target.type == TARGET_PORTAL) {
 
-        for(int i = 0; i < num_neighbours; i++) {
+        const struct portal *port = target.pd.port;
+        if(port->connected->chunk.r < port->chunk.r)
+            out->seed_dir = FD_N;
+        else if(port->connected->chunk.r > port->chunk.r)
+            out->seed_dir = FD_S;
+        else if(port->connected->chunk.c < port->chunk.c)
+            out->seed_dir = FD_W;
+        else
+            out->seed_dir = FD_E;
+    }
+    return true;
+}
 
-            int nr = neighbours[i].r, nc = neighbours[i].c;
-            if(neighbour_costs[i] > 1) {
-                
-                if(!field_is_los_corner(neighbours[i], chunk->cost_base, chunk->blockers))
-                    continue;
+void N_LOSFieldCreate(
+    dest_id_t                 id, 
+    struct coord              chunk_coord, 
+    struct tile_desc          target,
+    const struct nav_private *priv, 
+    vec3_t                    map_pos, 
+    struct LOS_field         *out_los, 
+    const struct LOS_field   *prev_los)
+{
+    N_LOSFieldCreateBatch(id, 1, &chunk_coord, target, priv, map_pos, out_los, prev_los);
+}
 
-                struct tile_desc src_desc = (struct tile_desc) {
-                    .chunk_r = chunk_coord.r,
-                    .chunk_c = chunk_coord.c,
-                    .tile_r = neighbours[i].r,
-                    .tile_c = neighbours[i].c
-                };
-                field_create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-            }else{
+void N_LOSFieldCreateBatch(
+    dest_id_t                 id, 
+    size_t                    nchunks,
+    const struct coord        chunk_coords[],
+    struct tile_desc          target,
+    const struct nav_private *priv, 
+    vec3_t                    map_pos, 
+    struct LOS_field          out_los[], 
+    const struct LOS_field   *prev_los)
+{
+    PERF_ENTER();
 
-                float new_cost = integration_field[curr.r][curr.c] + 1;
-                out_los->field[nr][nc].visible = 1;
+    struct los_batch *batch = Sched_FrameAlloc(sizeof(struct los_batch));
+    if(!batch)
+        PERF_RETURN_VOID();
 
-                if(new_cost < integration_field[neighbours[i].r][neighbours[i].c]) {
+    if(!ipq_coord_init_alloc(&batch->frontier, FIELD_RES_R * FIELD_RES_C, 
+        Sched_FrameRealloc, Sched_FrameFree)) {
+        Sched_FrameFree(batch);
+        PERF_RETURN_VOID();
+    }
 
-                    integration_field[nr][nc] = new_cost;
-                    if(!pq_coord_contains(&frontier, field_compare_tiles, neighbours[i]))
-                        pq_coord_push(&frontier, new_cost, neighbours[i]);
-                }
-            }
-        }
+    batch->priv = priv;
+    batch->layer = N_DestLayer(id);
+    batch->faction_id = N_DestFactionID(id);
+    batch->enemies = 0;
+    if(batch->faction_id != FACTION_ID_NONE) {
+        batch->enemies = G_GetEnemyFactions(batch->faction_id);
+    }
+    batch->target = target;
+    batch->map_pos = map_pos;
+    N_GetResolution(priv, &batch->res);
+    batch->target_center = field_tile_center(batch->res, map_pos, target);
+
+    for(size_t i = 0; i < nchunks; i++) {
+        field_los_create(batch, chunk_coords[i], &out_los[i], 
+            (i == 0) ? prev_los : &out_los[i - 1]);
     }
-    pq_coord_destroy(&frontier);
 
-    /* Add a single tile-wide padding of invisible tiles around the wavefront. This is 
-     * because we want to be conservative and not mark any tiles visible from which we
-     * can't raycast to the destination point from any point within the tile without 
-     * the ray going over impassable terrain. This is a nice property for the movement
-     * code. */
-    field_pad_wavefront(out_los);
+    ipq_coord_destroy(&batch->frontier);
+    Sched_FrameFree(batch);
+    PERF_RETURN_VOID();
 }
 
 void N_FlowFieldUpdateToNearestPathable(
@@ -1850,8 +2276,10 @@ void N_FlowFieldUpdateToNearestPathable(
     size_t ninit = field_passable_frontier(priv, layer, start_coord, 
         chunk_region, init_frontier, ARR_SIZE(init_frontier), NULL, 0);
 
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
+    ipq_coord_t frontier;
+    if(!ipq_coord_init_alloc(&frontier, FIELD_RES_R * FIELD_RES_C, 
+        Sched_FrameRealloc, Sched_FrameFree))
+        return;
 
     float integration_field[FIELD_RES_R][FIELD_RES_C];
     for(int r = 0; r < FIELD_RES_R; r++) {
@@ -1865,7 +2293,7 @@ void N_FlowFieldUpdateToNearestPathable(
             init_frontier[i].tile_r,
             init_frontier[i].tile_c
         };
-        pq_coord_push(&frontier, 0.0f, curr); 
+        ipq_coord_push(&frontier, field_tile_key(curr), 0.0f, curr); 
         integration_field[curr.r][curr.c] = 0.0f;
     }
 
@@ -1879,11 +2307,11 @@ void N_FlowFieldUpdateToNearestPathable(
             continue;
         if(integration_field[r][c] == 0.0f)
             continue;
-        inout_flow->field[r][c].dir_idx = field_flow_dir(FIELD_RES_R, FIELD_RES_C, 
-            (const float*)integration_field, (struct coord){r, c});
+        N_FlowFieldSetDir(inout_flow, r, c, field_flow_dir(FIELD_RES_R, FIELD_RES_C, 
+            (const float*)integration_field, (struct coord){r, c}));
     }}
 
-    pq_coord_destroy(&frontier);
+    ipq_coord_destroy(&frontier);
 }
 
 void N_FlowFieldUpdateIslandToNearest(
@@ -1903,8 +2331,10 @@ void N_FlowFieldUpdateIslandToNearest(
         .tile_c  = 0,
     };
 
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
+    ipq_coord_t frontier;
+    if(!ipq_coord_init_alloc(&frontier, FIELD_RES_R * FIELD_RES_C, 
+        Sched_FrameRealloc, Sched_FrameFree))
+        return;
 
     struct coord init_frontier[FIELD_RES_R * FIELD_RES_C];
     size_t ninit = 0;
@@ -1934,6 +2364,19 @@ void N_FlowFieldUpdateIslandToNearest(
             };
         }
         assert(ninit == ntds);
+
+    }else if(inout_flow->target.type == TARGET_FACTION_TARGETS) {
+
+        struct tile_desc targets_init_frontier[FIELD_RES_R * FIELD_RES_C];
+        size_t ntds = field_targets_initial_frontier(&inout_flow->target.targets, priv, base, 
+            FIELD_RES_R, FIELD_RES_C, layer, targets_init_frontier, ARR_SIZE(targets_init_frontier));
+        for(int i = 0; i < ntds; i++) {
+            init_frontier[ninit++] = (struct coord){
+                targets_init_frontier[i].tile_r,
+                targets_init_frontier[i].tile_c,
+            };
+        }
+        assert(ninit == ntds);
     
     }else{
         ninit = field_initial_frontier(layer, inout_flow->target, chunk, priv, false, faction_id, 
@@ -1996,7 +2439,7 @@ void N_FlowFieldUpdateIslandToNearest(
     for(int i = 0; i < new_ninit; i++) {
 
         struct coord curr = new_init_frontier[i];
-        pq_coord_push(&frontier, 0.0f, curr); 
+        ipq_coord_push(&frontier, field_tile_key(curr), 0.0f, curr); 
         integration_field[curr.r][curr.c] = 0.0f;
     }
 
@@ -2004,7 +2447,7 @@ void N_FlowFieldUpdateIslandToNearest(
     field_build_flow(integration_field, inout_flow);
     field_fixup(inout_flow->target, integration_field, inout_flow, chunk);
 
-    pq_coord_destroy(&frontier);
+    ipq_coord_destroy(&frontier);
 }
 
 vec2_t N_FlowDir(enum flow_dir dir)
@@ -2039,8 +2482,9 @@ void N_CellArrivalFieldCreate(void *nav_private, size_t rdim, size_t cdim,
     struct map_resolution res;
     N_GetResolution(priv, &res);
 
-    pq_td_t frontier;
-    pq_td_init(&frontier);
+    ipq_td_t frontier;
+    if(!ipq_td_init_alloc(&frontier, rdim * cdim, Sched_FrameRealloc, Sched_FrameFree))
+        PERF_RETURN_VOID();
 
     size_t integration_field_size = sizeof(float) * rdim * cdim;
     assert(workspace_size >= integration_field_size);
@@ -2082,14 +2526,14 @@ void N_CellArrivalFieldCreate(void *nav_private, size_t rdim, size_t cdim,
     assert(dr >= 0 && dr < rdim);
     assert(dc >= 0 && dc < cdim);
 
-    pq_td_push(&frontier, 0.0f, target); 
+    ipq_td_push(&frontier, dr * rdim + dc, 0.0f, target); 
     integration_field[dr * rdim + dc] = 0.0f;
 
     struct region region = (struct region){base, rdim, cdim};
     field_build_integration_region(&frontier, priv, layer, enemies, region, integration_field);
     field_build_flow_unaligned(rdim, cdim, integration_field, out);
 
-    pq_td_destroy(&frontier);
+    ipq_td_destroy(&frontier);
     PERF_RETURN_VOID();
 }
 
@@ -2127,8 +2571,9 @@ void N_CellArrivalFieldUpdateToNearestPathable(void *nav_private, size_t rdim, s
     size_t ninit = field_passable_frontier(priv, layer, start, 
         clamped, init_frontier, rdim * cdim, workspace, workspace_size);
 
-    pq_td_t frontier;
-    pq_td_init(&frontier);
+    ipq_td_t frontier;
+    if(!ipq_td_init_alloc(&frontier, rdim * cdim, Sched_FrameRealloc, Sched_FrameFree))
+        return;
 
     for(int r = 0; r < rdim; r++) {
     for(int c = 0; c < cdim; c++) {
@@ -2162,7 +2607,7 @@ void N_CellArrivalFieldUpdateToNearestPathable(void *nav_private, size_t rdim, s
         assert(dr >= 0 && dr < rdim);
         assert(dc >= 0 && dc < cdim);
 
-        pq_td_push(&frontier, 0.0f, init_frontier[i]);
+        ipq_td_push(&frontier, dr * rdim + dc, 0.0f, init_frontier[i]);
         integration_field[dr * rdim + dc] = 0.0f;
     }
 
@@ -2188,6 +2633,6 @@ void N_CellArrivalFieldUpdateToNearestPathable(void *nav_private, size_t rdim, s
         set_flow_cell(dir, r, c, rdim, cdim, inout);
     }}
 
-    pq_td_destroy(&frontier);
+    ipq_td_destroy(&frontier);
 }
 
@@ -45,14 +45,17 @@
 typedef uint64_t ff_id_t;
 struct nav_private;
 
+/* The LOS field is stored as a pair of bitsets, with bit 'c' of row 'r' 
+ * holding the flag for tile (r, c). A whole row of a chunk fits in a 
+ * single word. Use the 'N_LOSField' accessors below to read and write it.
+ */
 struct LOS_field{
     struct coord chunk;
-    struct{
-        uint8_t visible : 1;
-        uint8_t wavefront_blocked : 1;
-    }field[FIELD_RES_R][FIELD_RES_C];
+    uint64_t     visible[FIELD_RES_R];
+    uint64_t     wavefront_blocked[FIELD_RES_R];
 };
 
+
 struct enemies_desc{
     int          faction_id;
     vec3_t       map_pos;
@@ -64,6 +67,14 @@ struct entity_desc{
     vec3_t       map_pos;
 };
 
+/* Guide to the closest of the targets registered for the faction with 
+ * 'N_SetFactionTargets'. The key identifies the set of targets. */
+struct targets_desc{
+    int          faction_id;
+    uint32_t     key;
+    vec3_t       map_pos;
+};
+
 struct portal_desc{
     const struct portal *port;
     uint16_t             port_iid;
@@ -80,6 +91,7 @@ struct field_target{
          * that the portal at that index is 'eligible'. */
         TARGET_PORTALMASK,
         TARGET_ENTITY,
+        TARGET_FACTION_TARGETS,
     }type;
     union{
         struct portal_desc   pd;
@@ -87,17 +99,83 @@ struct field_target{
         struct enemies_desc  enemies;
         uint64_t             portalmask;
         struct entity_desc   ent;
+        struct targets_desc  targets;
     };
 };
 
+/* The directions are 'enum flow_dir' values packed two per byte, with the 
+ * even column in the high nibble, matching the layout of the unaligned
+ * fields. Use the 'N_FlowField' accessors below to 
+ * read and write them.
+ */
 struct flow_field{
     struct coord chunk;
     struct field_target target;
-    struct{
-        uint8_t dir_idx : 4;
-    }field[FIELD_RES_R][FIELD_RES_C];
+    /* For the enemy, entity and faction targets fields, a summary of the 
+     * tiles the field guides to. See 'N_FlowFieldGoalKey'. */
+    uint64_t     goal_key;
+    uint8_t      dirs[FIELD_RES_R][FIELD_RES_C / 2];
 };
 
+
+/* The inputs for building a field with the 'nav_field' compute shader. The 
+ * layout must match 'struct field_job' of the shader. Impassable tiles have
+ * a cost of COST_IMPASSABLE and bit 'c' of 'seeds[r]' is set for the tiles 
+ * of the initial frontier, which are given the 'seed_dir' direction.
+ */
+struct field_gpu_job{
+    uint8_t      cost[FIELD_RES_R][FIELD_RES_C];
+    uint64_t     seeds[FIELD_RES_R];
+    uint32_t     seed_dir;
+    uint32_t     pad[3];
+};
+
+/* ------------------------------------------------------------------------
+ * Get the direction of the specified tile of the flow field.
+ * ------------------------------------------------------------------------
+ */
+static inline enum flow_dir N_FlowFieldDir(const struct flow_field *ff, int r, int c)
+{
+    return (ff->dirs[r][c >> 1] >> ((~c & 1) << 2)) & 0xf;
+}
+
+/* ------------------------------------------------------------------------
+ * Set the direction of the specified tile of the flow field.
+ * ------------------------------------------------------------------------
+ */
+static inline void N_FlowFieldSetDir(struct flow_field *ff, int r, int c, enum flow_dir dir)
+{
+    int shift = (~c & 1) << 2;
+    uint8_t *byte = &ff->dirs[r][c >> 1];
+    *byte = (*byte & ~(0xf << shift)) | ((dir & 0xf) << shift);
+}
+
+/* ------------------------------------------------------------------------
+ * Get and set the 'visible' and 'wavefront blocked' flags of the specified 
+ * tile of the LOS field.
+ * ------------------------------------------------------------------------
+ */
+static inline bool N_LOSFieldVisible(const struct LOS_field *lf, int r, int c)
+{
+    return (lf->visible[r] >> c) & 0x1;
+}
+
+static inline void N_LOSFieldSetVisible(struct LOS_field *lf, int r, int c, bool set)
+{
+    lf->visible[r] = (lf->visible[r] & ~(((uint64_t)1) << c)) | (((uint64_t)set) << c);
+}
+
+static inline bool N_LOSFieldBlocked(const struct LOS_field *lf, int r, int c)
+{
+    return (lf->wavefront_blocked[r] >> c) & 0x1;
+}
+
+static inline void N_LOSFieldSetBlocked(struct LOS_field *lf, int r, int c, bool set)
+{
+    lf->wavefront_blocked[r] = (lf->wavefront_blocked[r] & ~(((uint64_t)1) << c)) 
+                             | (((uint64_t)set) << c);
+}
+
 /* ------------------------------------------------------------------------
  * Get the unique flow field ID for the specified parameters.
  * ------------------------------------------------------------------------
@@ -106,6 +184,21 @@ ff_id_t        N_FlowFieldID(struct coord        chunk,
                              struct field_target target, 
                              enum nav_layer      layer);
 
+/* ------------------------------------------------------------------------
+ * Compute a key for the inputs a path field (i.e. a 'TARGET_PORTAL' or
+ * 'TARGET_TILE' one) is built from: the goal tiles and the chunk's costs,
+ * blockers and islands as seen by the faction. Fields with equal keys have
+ * the same contents, even when they are for different layers or factions.
+ * Returns false for the other target types.
+ * ------------------------------------------------------------------------
+ */
+bool           N_FlowFieldContentKey(struct coord              chunk, 
+                                     const struct nav_private *priv, 
+                                     int                       faction_id,
+                                     enum nav_layer            layer, 
+                                     struct field_target       target, 
+                                     uint64_t                 *out_key);
+
 /* ------------------------------------------------------------------------
  * Extract the navigation layer from the previously generated flow field ID.
  * ------------------------------------------------------------------------
@@ -118,6 +211,13 @@ enum nav_layer N_FlowFieldLayer(ff_id_t id);
  */
 int            N_FlowFieldTargetType(ff_id_t id);
 
+/* ------------------------------------------------------------------------
+ * Returns true if the previously generated flow field ID is for a field 
+ * guiding towards the specified portal. 
+ * ------------------------------------------------------------------------
+ */
+bool           N_FlowFieldTargetsPortal(ff_id_t id, const struct portal *port);
+
 /* ------------------------------------------------------------------------
  * Initialize the field to have a 'FD_NONE' direction at every tile. Regions
  * of the field can then be made to guide towards specifid targets with 
@@ -140,6 +240,31 @@ void    N_FlowFieldUpdate(struct coord              chunk_coord,
                           struct field_target       target, 
                           struct flow_field        *inout_flow);
 
+/* ------------------------------------------------------------------------
+ * Summarize the tiles which a TARGET_ENEMIES, TARGET_ENTITY or 
+ * TARGET_FACTION_TARGETS field for the target would guide to. A field 
+ * built while the goal tiles were the same will have a matching 'goal_key'
+ * and is still current, so long as the chunks it spans haven't changed.
+ * ------------------------------------------------------------------------
+ */
+uint64_t N_FlowFieldGoalKey(struct coord              chunk_coord, 
+                            const struct nav_private *priv, 
+                            enum nav_layer            layer, 
+                            struct field_target       target);
+
+/* ------------------------------------------------------------------------
+ * Fill in the inputs for building the flow field on the GPU. The directions
+ * computed from these match those of 'N_FlowFieldUpdate' on an empty field.
+ * Returns false if the target type can only be handled by the CPU.
+ * ------------------------------------------------------------------------
+ */
+bool    N_FlowFieldGPUJob(struct coord              chunk_coord, 
+                          const struct nav_private *priv, 
+                          int                       faction_id,
+                          enum nav_layer            layer, 
+                          struct field_target       target, 
+                          struct field_gpu_job     *out);
+
 /* ------------------------------------------------------------------------
  * Update all tiles with a specific local island ID from the
  * 'local_islands' field for the chunk. The new directions will guide to
@@ -187,5 +312,22 @@ void    N_LOSFieldCreate(dest_id_t                 id,
                          struct LOS_field         *out_los, 
                          const struct LOS_field   *prev_los);
 
+/* ------------------------------------------------------------------------
+ * Create the LOS fields for a run of adjacent chunks along a path in one 
+ * go, ordered from the one closest to the destination. Each field is seeded 
+ * from the one before it in 'out_los', with 'prev_los' seeding the first 
+ * (NULL when the first chunk holds the 'target'). The per-destination 
+ * setup and the working buffers are shared by the whole run.
+ * ------------------------------------------------------------------------
+ */
+void    N_LOSFieldCreateBatch(dest_id_t                 id, 
+                              size_t                    nchunks,
+                              const struct coord        chunk_coords[],
+                              struct tile_desc          target,
+                              const struct nav_private *priv, 
+                              vec3_t                    map_pos, 
+                              struct LOS_field          out_los[], 
+                              const struct LOS_field   *prev_los);
+
 #endif
 
@@ -0,0 +1,259 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "field_gpu.h"
+#include "fieldcache.h"
+#include "../render/public/render.h"
+#include "../render/public/render_ctrl.h"
+#include "../main.h"
+#include "../perf.h"
+
+#include <SDL.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define MAX_GPU_FIELDS    (128)
+#define GPU_FIELD_MAX_LAG (4)
+#define FIELD_DIRS_SIZE   (sizeof(((struct flow_field*)0)->dirs))
+
+enum gpu_field_state{
+    GPU_FIELD_IDLE,
+    GPU_FIELD_DISPATCHED,
+    GPU_FIELD_READING,
+};
+
+struct gpu_field_desc{
+    ff_id_t             id;
+    struct coord        chunk;
+    struct field_target target;
+    /* Cleared when the navigation data of the chunk changes in the meantime */
+    bool                valid;
+};
+
+/* Like the GPU steering work, the batch is dispatched on the tick that the
+ * fields are requested on and read back on the next one. Then, the fields 
+ * are put in the cache once the render thread has flagged the generation 
+ * as ready. No new fields are queued until the batch is collected. The 
+ * buffers are statically allocated, as the render thread may still write 
+ * to them after the batch has been abandoned.
+ */
+struct gpu_fields{
+    bool                  enabled;
+    enum gpu_field_state  state;
+    uint32_t              tick;
+    uint32_t              dispatch_tick;
+    int                   gen;
+    SDL_atomic_t          ready_gen;
+    size_t                nfields;
+    struct gpu_field_desc descs[MAX_GPU_FIELDS];
+    struct field_gpu_job  jobs[MAX_GPU_FIELDS];
+    uint8_t               results[MAX_GPU_FIELDS][FIELD_DIRS_SIZE];
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct gpu_fields s_gpu_fields;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void gpu_fields_read(void)
+{
+    const size_t size = s_gpu_fields.nfields * FIELD_DIRS_SIZE;
+    const size_t maxout = sizeof(s_gpu_fields.results);
+    s_gpu_fields.gen++;
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_NavFieldReadResults,
+        .nargs = 5,
+        .args = {
+            s_gpu_fields.results,
+            R_PushArg(&size, sizeof(size)),
+            R_PushArg(&maxout, sizeof(maxout)),
+            &s_gpu_fields.ready_gen,
+            R_PushArg(&s_gpu_fields.gen, sizeof(s_gpu_fields.gen)),
+        },
+    });
+    s_gpu_fields.state = GPU_FIELD_READING;
+}
+
+static void gpu_fields_collect(void)
+{
+    for(int i = 0; i < s_gpu_fields.nfields; i++) {
+
+        const struct gpu_field_desc *desc = &s_gpu_fields.descs[i];
+        if(!desc->valid)
+            continue;
+
+        struct flow_field ff;
+        N_FlowFieldInit(desc->chunk, &ff);
+        ff.target = desc->target;
+        memcpy(ff.dirs, s_gpu_fields.results[i], sizeof(ff.dirs));
+        N_FC_PutFlowField(desc->id, &ff);
+    }
+}
+
+static void gpu_fields_reset(void)
+{
+    s_gpu_fields.nfields = 0;
+    s_gpu_fields.state = GPU_FIELD_IDLE;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void N_FG_SetEnabled(bool enabled)
+{
+    s_gpu_fields.enabled = enabled;
+}
+
+bool N_FG_Push(const struct nav_private *priv, struct coord chunk, struct field_target target, 
+               int faction_id, enum nav_layer layer, ff_id_t id)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gpu_fields.enabled)
+        return false;
+    if(s_gpu_fields.state != GPU_FIELD_IDLE)
+        return false;
+    if(s_gpu_fields.nfields == MAX_GPU_FIELDS)
+        return false;
+
+    size_t idx = s_gpu_fields.nfields;
+    if(!N_FlowFieldGPUJob(chunk, priv, faction_id, layer, target, &s_gpu_fields.jobs[idx]))
+        return false;
+
+    s_gpu_fields.descs[idx] = (struct gpu_field_desc){
+        .id = id,
+        .chunk = chunk,
+        .target = target,
+        .valid = true
+    };
+    s_gpu_fields.nfields++;
+    return true;
+}
+
+bool N_FG_Pending(ff_id_t id)
+{
+    for(int i = 0; i < s_gpu_fields.nfields; i++) {
+        const struct gpu_field_desc *desc = &s_gpu_fields.descs[i];
+        if(desc->valid && desc->id == id)
+            return true;
+    }
+    return false;
+}
+
+void N_FG_Submit(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(s_gpu_fields.state != GPU_FIELD_IDLE || s_gpu_fields.nfields == 0)
+        return;
+
+    const size_t jobsize = sizeof(struct field_gpu_job);
+    const size_t outsize = FIELD_DIRS_SIZE;
+
+    R_PushCmd((struct rcmd){
+        .func = R_GL_NavFieldDispatch,
+        .nargs = 4,
+        .args = {
+            R_PushArg(s_gpu_fields.jobs, s_gpu_fields.nfields * jobsize),
+            R_PushArg(&s_gpu_fields.nfields, sizeof(s_gpu_fields.nfields)),
+            R_PushArg(&jobsize, sizeof(jobsize)),
+            R_PushArg(&outsize, sizeof(outsize)),
+        },
+    });
+    s_gpu_fields.dispatch_tick = s_gpu_fields.tick;
+    s_gpu_fields.state = GPU_FIELD_DISPATCHED;
+}
+
+void N_FG_Update(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    PERF_ENTER();
+
+    switch(s_gpu_fields.state) {
+    case GPU_FIELD_IDLE:
+        break;
+    case GPU_FIELD_DISPATCHED:
+        gpu_fields_read();
+        break;
+    case GPU_FIELD_READING:
+        if(SDL_AtomicGet(&s_gpu_fields.ready_gen) == s_gpu_fields.gen) {
+            gpu_fields_collect();
+            gpu_fields_reset();
+        }else if(s_gpu_fields.tick - s_gpu_fields.dispatch_tick > GPU_FIELD_MAX_LAG) {
+            /* The commands were dropped or the renderer is falling behind. The 
+             * fields will be requested again. */
+            gpu_fields_reset();
+        }
+        break;
+    default: assert(0);
+    }
+
+    s_gpu_fields.tick++;
+    PERF_RETURN_VOID();
+}
+
+void N_FG_InvalidateAllAtChunk(struct coord chunk, enum nav_layer layer)
+{
+    for(int i = 0; i < s_gpu_fields.nfields; i++) {
+
+        struct gpu_field_desc *desc = &s_gpu_fields.descs[i];
+        if(desc->chunk.r == chunk.r && desc->chunk.c == chunk.c
+        && N_FlowFieldLayer(desc->id) == layer) {
+            desc->valid = false;
+        }
+    }
+}
+
+void N_FG_InvalidateAll(void)
+{
+    for(int i = 0; i < s_gpu_fields.nfields; i++) {
+        s_gpu_fields.descs[i].valid = false;
+    }
+}
+
+void N_FG_Clear(void)
+{
+    gpu_fields_reset();
+}
+
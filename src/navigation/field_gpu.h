@@ -0,0 +1,90 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef FIELD_GPU_H
+#define FIELD_GPU_H
+
+#include "public/nav.h"
+#include "field.h"
+
+#include <stdbool.h>
+
+struct nav_private;
+
+/* ------------------------------------------------------------------------
+ * Queue up a build of the (empty) flow field on the GPU. The field will be 
+ * placed in the cache once the results of the batch are read back, a few 
+ * ticks later. Returns false if the field has to be built by the CPU.
+ * ------------------------------------------------------------------------
+ */
+bool N_FG_Push(const struct nav_private *priv, struct coord chunk, struct field_target target, 
+               int faction_id, enum nav_layer layer, ff_id_t id);
+
+/* ------------------------------------------------------------------------
+ * Returns true if the field is being built by the GPU.
+ * ------------------------------------------------------------------------
+ */
+bool N_FG_Pending(ff_id_t id);
+
+/* ------------------------------------------------------------------------
+ * Dispatch all the fields queued up during the tick in a single batch.
+ * ------------------------------------------------------------------------
+ */
+void N_FG_Submit(void);
+
+/* ------------------------------------------------------------------------
+ * Advance the outstanding batch by one step, placing the results in the 
+ * cache when they have been read back.
+ * ------------------------------------------------------------------------
+ */
+void N_FG_Update(void);
+
+/* ------------------------------------------------------------------------
+ * Discard the results of the outstanding fields at the specified chunk, 
+ * or of all of them. They were computed from stale navigation data.
+ * ------------------------------------------------------------------------
+ */
+void N_FG_InvalidateAllAtChunk(struct coord chunk, enum nav_layer layer);
+void N_FG_InvalidateAll(void);
+
+/* ------------------------------------------------------------------------
+ * Abandon the outstanding batch.
+ * ------------------------------------------------------------------------
+ */
+void N_FG_Clear(void);
+
+#endif
+
@@ -44,6 +44,8 @@
 
 #include <assert.h>
 
+#define LOS_CACHE_SZ    (CONFIG_LOS_CACHE_BYTES / sizeof(struct LOS_field))
+#define FLOW_CACHE_SZ   (CONFIG_FLOW_CACHE_BYTES / sizeof(struct flow_field))
 
 LRU_CACHE_TYPE(los, struct LOS_field)
 LRU_CACHE_PROTOTYPES(static, los, struct LOS_field)
@@ -66,6 +68,8 @@ VEC_PROTOTYPES(static, id, uint64_t)
 VEC_IMPL(static, id, uint64_t)
 
 KHASH_MAP_INIT_INT64(idvec, vec_id_t)
+KHASH_SET_INIT_INT64(touched)
+KHASH_MAP_INIT_INT64(borrow, uint16_t)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -79,22 +83,21 @@ static lru(flow)         s_flow_cache;      /* key: (ffid) */
  * many different paths. */
 static lru(ffid)         s_ffid_cache;      /* key: (dest_id, chunk_coord) */
 static lru(grid_path)    s_grid_path_cache; /* key: (chunk coord, tile start coord, tile dest coord) */
+/* Maps the contents of a path field to the ID of a field built from them */
+static lru(ffid)         s_shared_cache;    /* key: (content key) */
 
 /* The following structures are maintained for efficient invalidation of entries:*/
 static khash_t(idvec)   *s_chunk_ffield_map; /* key: (chunk coord) */
 static khash_t(idvec)   *s_chunk_lfield_map; /* key: (chunk coord) */
+/* The mask of the other layers using a shared field */
+static khash_t(borrow)  *s_borrowed_fields;  /* key: (ffid) */
+/* The (dest_id, chunk_coord) keys refreshed via 'N_FC_TouchDest' */
+static khash_t(touched) *s_touched_keys;
 
+/* Hits, misses and evictions are counted by the caches themselves */
 static struct priv_fc_stats{
-    unsigned los_query;
-    unsigned los_hit;
     unsigned los_invalidated;
-    unsigned flow_query;
-    unsigned flow_hit;
     unsigned flow_invalidated;
-    unsigned ffid_query;
-    unsigned ffid_hit;
-    unsigned grid_path_query;
-    unsigned grid_path_hit;
 }s_perfstats = {0};
 
 /*****************************************************************************/
@@ -141,6 +144,17 @@ static void on_grid_path_evict(struct grid_path_desc *victim)
     vec_coord_destroy(&victim->path);
 }
 
+static size_t grid_path_cost(const struct grid_path_desc *entry)
+{
+    return sizeof(*entry) + entry->path.capacity * sizeof(struct coord);
+}
+
+static float hit_rate(const struct lru_stats *stats)
+{
+    uint64_t nqueries = stats->hits + stats->misses;
+    return !nqueries ? 0 : ((float)stats->hits) / nqueries;
+}
+
 static void destroy_all_entries(khash_t(idvec) *hash)
 {
     uint32_t key;
@@ -172,7 +186,7 @@ static void field_map_add(khash_t(idvec) *hash, uint64_t key, uint64_t id)
     }
 }
 
-static bool dest_array_contains(dest_id_t *array, size_t size, dest_id_t item)
+static bool dest_array_contains(const dest_id_t *array, size_t size, dest_id_t item)
 {
     for(int i = 0; i < size; i++) {
         if(array[i] == item)
@@ -204,7 +218,40 @@ static void clear_chunk_los_map(uint64_t key, enum nav_layer layer)
     }
 }
 
-static void clear_chunk_flow_map(uint64_t key, enum nav_layer layer, bool enemies_only)
+static bool padded_field_type(int type)
+{
+    return (type == TARGET_ENEMIES)
+        || (type == TARGET_ENTITY)
+        || (type == TARGET_FACTION_TARGETS);
+}
+
+static bool field_borrowed(ff_id_t ffid, enum nav_layer layer)
+{
+    khiter_t k = kh_get(borrow, s_borrowed_fields, ffid);
+    if(k == kh_end(s_borrowed_fields))
+        return false;
+    return !!(kh_val(s_borrowed_fields, k) & (1u << layer));
+}
+
+/* Drop the mappings of the paths on the other layers to a shared field. They 
+ * will be mapped again the next time they are requested, in case the contents 
+ * of the field they would build no longer match. */
+static void unmap_borrowers(ff_id_t shared)
+{
+    uint64_t key;
+    ff_id_t ffid_val;
+
+    LRU_FOREACH_SAFE_REMOVE(ffid, &s_ffid_cache, key, ffid_val, {
+
+        if(ffid_val != shared)
+            continue;
+        if(N_DestLayer(key_dest(key)) == N_FlowFieldLayer(shared))
+            continue;
+        lru_ffid_remove(&s_ffid_cache, key);
+    });
+}
+
+static void clear_chunk_flow_map(uint64_t key, enum nav_layer layer, bool padded_only)
 {
     khiter_t k = kh_get(idvec, s_chunk_ffield_map, key);
     if(k == kh_end(s_chunk_ffield_map))
@@ -214,15 +261,21 @@ static void clear_chunk_flow_map(uint64_t key, enum nav_layer layer, bool enemie
     for(int i = vec_size(keys)-1; i >= 0; i--) {
 
         ff_id_t key = vec_AT(keys, i);
-        if(N_FlowFieldLayer(key) != layer)
+        if(N_FlowFieldLayer(key) != layer && !field_borrowed(key, layer))
             continue;
 
-        if(enemies_only && (N_FlowFieldTargetType(key) != TARGET_ENEMIES))
+        if(padded_only && !padded_field_type(N_FlowFieldTargetType(key)))
             continue;
 
         bool found = lru_flow_remove(&s_flow_cache, key);
         s_perfstats.flow_invalidated += !!found;
         vec_id_del(keys, i);
+
+        khiter_t bk = kh_get(borrow, s_borrowed_fields, key);
+        if(bk != kh_end(s_borrowed_fields)) {
+            unmap_borrowers(key);
+            kh_del(borrow, s_borrowed_fields, bk);
+        }
     }
     if(vec_size(keys) == 0) {
         vec_id_destroy(keys);
@@ -230,16 +283,47 @@ static void clear_chunk_flow_map(uint64_t key, enum nav_layer layer, bool enemie
     }
 }
 
+/* Find and remove all the flow and LOS fields belonging to the paths */
+static void invalidate_paths(const dest_id_t *paths, size_t npaths)
+{
+    uint64_t key;
+    struct flow_field ff_val;
+    LRU_FOREACH_SAFE_REMOVE(flow, &s_flow_cache, key, ff_val, {
+    
+        (void)ff_val;
+        dest_id_t curr_dest = key_dest(key);
+
+        if(dest_array_contains(paths, npaths, curr_dest)) {
+        
+            bool found = lru_flow_remove(&s_flow_cache, key);
+            s_perfstats.flow_invalidated += !!found;
+        }
+    });
+
+    struct LOS_field los_val;
+    LRU_FOREACH_SAFE_REMOVE(los, &s_los_cache, key, los_val, {
+
+        (void)los_val;
+        dest_id_t curr_dest = key_dest(key);
+
+        if(dest_array_contains(paths, npaths, curr_dest)) {
+        
+            bool found = lru_los_remove(&s_los_cache, key);
+            s_perfstats.los_invalidated += !!found;
+        }
+    });
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
 bool N_FC_Init(void)
 {
-    if(!lru_los_init(&s_los_cache, CONFIG_LOS_CACHE_SZ, NULL))
+    if(!lru_los_init(&s_los_cache, LOS_CACHE_SZ, NULL))
         goto fail_los;
 
-    if(!lru_flow_init(&s_flow_cache, CONFIG_FLOW_CACHE_SZ, NULL))
+    if(!lru_flow_init(&s_flow_cache, FLOW_CACHE_SZ, NULL))
         goto fail_flow;
 
     if(!lru_ffid_init(&s_ffid_cache, CONFIG_MAPPING_CACHE_SZ, NULL))
@@ -248,17 +332,47 @@ bool N_FC_Init(void)
     if(!lru_grid_path_init(&s_grid_path_cache, CONFIG_GRID_PATH_CACHE_SZ, on_grid_path_evict))
         goto fail_grid_path;
 
+    if(!lru_ffid_init(&s_shared_cache, CONFIG_MAPPING_CACHE_SZ, NULL))
+        goto fail_shared;
+
+    /* The fields are looked up many times per tick for every inserted one, so 
+     * don't pay for re-linking the age list on every hit. The grid paths own 
+     * variable-sized buffers, so bound them by their total size. */
+    lru_los_set_policy(&s_los_cache, LRU_POLICY_CLOCK);
+    lru_flow_set_policy(&s_flow_cache, LRU_POLICY_CLOCK);
+    lru_ffid_set_policy(&s_ffid_cache, LRU_POLICY_CLOCK);
+    lru_ffid_set_policy(&s_shared_cache, LRU_POLICY_CLOCK);
+    lru_grid_path_set_budget(&s_grid_path_cache, CONFIG_GRID_PATH_CACHE_BYTES, grid_path_cost);
+
+    mp_los_set_tag(&s_los_cache.node_pool, MEM_TAG_FIELD_CACHE);
+    mp_flow_set_tag(&s_flow_cache.node_pool, MEM_TAG_FIELD_CACHE);
+    mp_ffid_set_tag(&s_ffid_cache.node_pool, MEM_TAG_FIELD_CACHE);
+    mp_grid_path_set_tag(&s_grid_path_cache.node_pool, MEM_TAG_FIELD_CACHE);
+    mp_ffid_set_tag(&s_shared_cache.node_pool, MEM_TAG_FIELD_CACHE);
+
     if(NULL == (s_chunk_ffield_map = kh_init(idvec)))
         goto fail_chunk_ffield;
 
     if(NULL == (s_chunk_lfield_map = kh_init(idvec)))
         goto fail_chunk_lfield;
 
+    if(NULL == (s_touched_keys = kh_init(touched)))
+        goto fail_touched_keys;
+
+    if(NULL == (s_borrowed_fields = kh_init(borrow)))
+        goto fail_borrowed;
+
     return true;
 
+fail_borrowed:
+    kh_destroy(touched, s_touched_keys);
+fail_touched_keys:
+    kh_destroy(idvec, s_chunk_lfield_map);
 fail_chunk_lfield:
     kh_destroy(idvec, s_chunk_ffield_map);
 fail_chunk_ffield:
+    lru_ffid_destroy(&s_shared_cache);
+fail_shared:
     lru_grid_path_destroy(&s_grid_path_cache);
 fail_grid_path:
     lru_ffid_destroy(&s_ffid_cache);
@@ -276,12 +390,16 @@ void N_FC_Shutdown(void)
     lru_flow_destroy(&s_flow_cache);
     lru_ffid_destroy(&s_ffid_cache);
     lru_grid_path_destroy(&s_grid_path_cache);
+    lru_ffid_destroy(&s_shared_cache);
 
     destroy_all_entries(s_chunk_ffield_map);
     kh_destroy(idvec, s_chunk_ffield_map);
 
     destroy_all_entries(s_chunk_lfield_map);
     kh_destroy(idvec, s_chunk_lfield_map);
+
+    kh_destroy(touched, s_touched_keys);
+    kh_destroy(borrow, s_borrowed_fields);
 }
 
 void N_FC_ClearAll(void)
@@ -290,52 +408,64 @@ void N_FC_ClearAll(void)
     lru_flow_clear(&s_flow_cache);
     lru_ffid_clear(&s_ffid_cache);
     lru_grid_path_clear(&s_grid_path_cache);
+    lru_ffid_clear(&s_shared_cache);
 
     destroy_all_entries(s_chunk_ffield_map);
     kh_clear(idvec, s_chunk_ffield_map);
 
     destroy_all_entries(s_chunk_lfield_map);
     kh_clear(idvec, s_chunk_lfield_map);
+
+    kh_clear(touched, s_touched_keys);
+    kh_clear(borrow, s_borrowed_fields);
 }
 
 void N_FC_ClearStats(void)
 {
     memset(&s_perfstats, 0, sizeof(s_perfstats));
+    lru_los_clear_stats(&s_los_cache);
+    lru_flow_clear_stats(&s_flow_cache);
+    lru_ffid_clear_stats(&s_ffid_cache);
+    lru_grid_path_clear_stats(&s_grid_path_cache);
 }
 
 void N_FC_GetStats(struct fc_stats *out_stats)
 {
+    struct lru_stats stats;
+
+    lru_los_get_stats(&s_los_cache, &stats);
     out_stats->los_used = s_los_cache.used;
     out_stats->los_max = s_los_cache.capacity;
-    out_stats->los_hit_rate = !s_perfstats.los_query ? 0
-        : ((float)s_perfstats.los_hit) / s_perfstats.los_query;
+    out_stats->los_hit_rate = hit_rate(&stats);
+    out_stats->los_evicted = stats.evictions;
     out_stats->los_invalidated = s_perfstats.los_invalidated;
 
+    lru_flow_get_stats(&s_flow_cache, &stats);
     out_stats->flow_used = s_flow_cache.used;
     out_stats->flow_max = s_flow_cache.capacity;
-    out_stats->flow_hit_rate = !s_perfstats.flow_query ? 0
-        : ((float)s_perfstats.flow_hit) / s_perfstats.flow_query;
+    out_stats->flow_hit_rate = hit_rate(&stats);
+    out_stats->flow_evicted = stats.evictions;
     out_stats->flow_invalidated = s_perfstats.flow_invalidated;
 
+    lru_ffid_get_stats(&s_ffid_cache, &stats);
     out_stats->ffid_used = s_ffid_cache.used;
     out_stats->ffid_max = s_ffid_cache.capacity;
-    out_stats->ffid_hit_rate = !s_perfstats.ffid_hit ? 0
-        : ((float)s_perfstats.ffid_hit) / s_perfstats.ffid_query;
+    out_stats->ffid_hit_rate = hit_rate(&stats);
+    out_stats->ffid_evicted = stats.evictions;
 
+    lru_grid_path_get_stats(&s_grid_path_cache, &stats);
     out_stats->grid_path_used = s_grid_path_cache.used;
     out_stats->grid_path_max = s_grid_path_cache.capacity;
-    out_stats->grid_path_hit_rate = !s_perfstats.grid_path_hit ? 0
-        : ((float)s_perfstats.grid_path_hit) / s_perfstats.grid_path_query;
+    out_stats->grid_path_bytes = s_grid_path_cache.used_cost;
+    out_stats->grid_path_max_bytes = s_grid_path_cache.budget;
+    out_stats->grid_path_hit_rate = hit_rate(&stats);
+    out_stats->grid_path_evicted = stats.evictions;
 }
 
 bool N_FC_ContainsLOSField(dest_id_t id, struct coord chunk_coord)
 {
     uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
-    bool ret = lru_los_contains(&s_los_cache, key);
-
-    s_perfstats.los_query++;
-    s_perfstats.los_hit += !!ret;
-    return ret;
+    return lru_los_contains(&s_los_cache, key);
 }
 
 const struct LOS_field *N_FC_LOSFieldAt(dest_id_t id, struct coord chunk_coord)
@@ -353,11 +483,7 @@ void N_FC_PutLOSField(dest_id_t id, struct coord chunk_coord, const struct LOS_f
 
 bool N_FC_ContainsFlowField(ff_id_t ffid)
 {
-    bool ret = lru_flow_contains(&s_flow_cache, ffid);
-
-    s_perfstats.flow_query++;
-    s_perfstats.flow_hit += !!ret;
-    return ret;
+    return lru_flow_contains(&s_flow_cache, ffid);
 }
 
 const struct flow_field *N_FC_FlowFieldAt(ff_id_t ffid)
@@ -376,11 +502,7 @@ void N_FC_PutFlowField(ff_id_t ffid, const struct flow_field *ff)
 bool N_FC_GetDestFFMapping(dest_id_t id, struct coord chunk_coord, ff_id_t *out_ff)
 {
     uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
-    bool ret = lru_ffid_get(&s_ffid_cache, key, out_ff);
-
-    s_perfstats.ffid_query++;
-    s_perfstats.ffid_hit += !!ret;
-    return ret;
+    return lru_ffid_get(&s_ffid_cache, key, out_ff);
 }
 
 void N_FC_PutDestFFMapping(dest_id_t dest_id, struct coord chunk_coord, ff_id_t ffid)
@@ -389,15 +511,79 @@ void N_FC_PutDestFFMapping(dest_id_t dest_id, struct coord chunk_coord, ff_id_t
     lru_ffid_put(&s_ffid_cache, key, &ffid);
 }
 
+bool N_FC_GetSharedFlowField(uint64_t content_key, ff_id_t *out_ff)
+{
+    return lru_ffid_get(&s_shared_cache, content_key, out_ff);
+}
+
+void N_FC_PutSharedFlowField(uint64_t content_key, ff_id_t ffid)
+{
+    lru_ffid_put(&s_shared_cache, content_key, &ffid);
+}
+
+void N_FC_BorrowFlowField(ff_id_t ffid, enum nav_layer layer)
+{
+    if(N_FlowFieldLayer(ffid) == layer)
+        return;
+
+    int status;
+    khiter_t k = kh_put(borrow, s_borrowed_fields, ffid, &status);
+    if(status == -1)
+        return;
+    if(status != 0) {
+        kh_val(s_borrowed_fields, k) = 0;
+    }
+    kh_val(s_borrowed_fields, k) |= (1u << layer);
+}
+
+const struct LOS_field *N_FC_PeekLOSField(dest_id_t id, struct coord chunk_coord)
+{
+    uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
+    return lru_los_peek(&s_los_cache, key);
+}
+
+const struct flow_field *N_FC_PeekFlowField(ff_id_t ffid)
+{
+    return lru_flow_peek(&s_flow_cache, ffid);
+}
+
+bool N_FC_PeekDestFFMapping(dest_id_t id, struct coord chunk_coord, ff_id_t *out_ff)
+{
+    uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
+    const ff_id_t *ffid = lru_ffid_peek(&s_ffid_cache, key);
+    if(!ffid)
+        return false;
+    *out_ff = *ffid;
+    return true;
+}
+
+void N_FC_TouchDest(dest_id_t id, struct coord chunk_coord)
+{
+    /* Many entities will share the same fields - only refresh 
+     * them once between calls to 'N_FC_ClearTouched' */
+    int status;
+    uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
+    kh_put(touched, s_touched_keys, key, &status);
+    if(status == 0 || status == -1)
+        return;
+
+    const ff_id_t *ffid = lru_ffid_at(&s_ffid_cache, key);
+    if(ffid) {
+        (void)lru_flow_at(&s_flow_cache, *ffid);
+    }
+    (void)lru_los_at(&s_los_cache, key);
+}
+
+void N_FC_ClearTouched(void)
+{
+    kh_clear(touched, s_touched_keys);
+}
+
 bool N_FC_GetGridPath(struct coord local_start, struct coord local_dest,
                       struct coord chunk, enum nav_layer layer, struct grid_path_desc *out)
 {
     uint64_t key = grid_path_key(local_start, local_dest, chunk, layer);
-    bool ret = lru_grid_path_get(&s_grid_path_cache, key, out);
-
-    s_perfstats.grid_path_query++;
-    s_perfstats.grid_path_hit += !!ret;
-    return ret;
+    return lru_grid_path_get(&s_grid_path_cache, key, out);
 }
 
 void N_FC_PutGridPath(struct coord local_start, struct coord local_dest,
@@ -424,7 +610,7 @@ void N_FC_InvalidateAllThroughChunk(struct coord chunk, enum nav_layer layer)
 {
     assert(Sched_UsingBigStack());
 
-    dest_id_t paths[CONFIG_FLOW_CACHE_SZ];
+    dest_id_t paths[FLOW_CACHE_SZ];
     size_t npaths = 0;
 
     uint64_t key;
@@ -448,38 +634,53 @@ void N_FC_InvalidateAllThroughChunk(struct coord chunk, enum nav_layer layer)
         }
     });
 
-    /* Now that we know all the paths, find and remove all the flow 
-     * fields belonging to them */
-    struct flow_field ff_val;
-    LRU_FOREACH_SAFE_REMOVE(flow, &s_flow_cache, key, ff_val, {
-    
-        (void)ff_val;
-        dest_id_t curr_dest = key_dest(key);
+    invalidate_paths(paths, npaths);
+}
 
-        if(dest_array_contains(paths, npaths, curr_dest)) {
-        
-            bool found = lru_flow_remove(&s_flow_cache, key);
-            s_perfstats.flow_invalidated += !!found;
-        }
-    });
+void N_FC_InvalidateAllThroughPortals(const struct nav_chunk *chunk, struct coord chunk_coord, 
+                                      enum nav_layer layer, uint64_t portalmask)
+{
+    assert(Sched_UsingBigStack());
 
-    /* And remove all the LOS fields as well */
-    struct LOS_field los_val;
-    LRU_FOREACH_SAFE_REMOVE(los, &s_los_cache, key, los_val, {
+    dest_id_t paths[FLOW_CACHE_SZ];
+    size_t npaths = 0;
+
+    uint64_t key;
+    ff_id_t ffid_val;
+
+    /* The field of a path in the chunk guides to the portal via which the path 
+     * leaves it. An edge that changed states is recorded on both of its' portals, 
+     * so a path using the edge will always be leaving via a portal in the mask. 
+     */
+    LRU_FOREACH_SAFE_REMOVE(ffid, &s_ffid_cache, key, ffid_val, {
 
-        (void)los_val;
         dest_id_t curr_dest = key_dest(key);
+        struct coord curr_chunk = key_chunk(key);
 
-        if(dest_array_contains(paths, npaths, curr_dest)) {
-        
-            bool found = lru_los_remove(&s_los_cache, key);
-            s_perfstats.los_invalidated += !!found;
+        if(N_DestLayer(curr_dest) != layer)
+            continue;
+        if(0 != memcmp(&curr_chunk, &chunk_coord, sizeof(chunk_coord)))
+            continue;
+        if(dest_array_contains(paths, npaths, curr_dest))
+            continue;
+
+        bool affected = (N_FlowFieldTargetType(ffid_val) != TARGET_PORTAL);
+        for(int i = 0; !affected && i < chunk->num_portals; i++) {
+            if(!(portalmask & (((uint64_t)1) << i)))
+                continue;
+            affected = N_FlowFieldTargetsPortal(ffid_val, &chunk->portals[i]);
+        }
+
+        if(affected) {
+            paths[npaths++] = curr_dest;
         }
     });
+
+    invalidate_paths(paths, npaths);
 }
 
-void N_FC_InvalidateNeighbourEnemySeekFields(int width, int height, 
-                                             struct coord chunk, enum nav_layer layer)
+void N_FC_InvalidateNeighbourPaddedFields(int width, int height, 
+                                          struct coord chunk, enum nav_layer layer)
 {
     for(int dr = -1; dr <= +1; dr++) {
     for(int dc = -1; dc <= +1; dc++) {
@@ -501,22 +702,3 @@ void N_FC_InvalidateNeighbourEnemySeekFields(int width, int height,
     }}
 }
 
-void N_FC_InvalidateDynamicSurroundFields(void)
-{
-    uint64_t key;
-    struct flow_field ff_val;
-
-    LRU_FOREACH_SAFE_REMOVE(flow, &s_flow_cache, key, ff_val, {
-    
-        int type = N_FlowFieldTargetType(key);
-        if(type != TARGET_ENTITY)
-            continue;
-
-        uint32_t ent = ff_val.target.ent.target;
-        if(!(G_FlagsGet(ent) & ENTITY_FLAG_MOVABLE))
-            continue;
-
-        lru_flow_remove(&s_flow_cache, key);
-    });
-}
-
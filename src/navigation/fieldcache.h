@@ -60,14 +60,21 @@ void N_FC_InvalidateAllAtChunk(struct coord chunk, enum nav_layer layer);
  */
 void N_FC_InvalidateAllThroughChunk(struct coord chunk, enum nav_layer layer);
 
-/* Invalidate 'enemy seek' fields in all chunks which are adjacent to the 
- * current one. This is because 'enemy seek' fields are also dependent
- * on the state of the units in adjacent chunks.
+/* Like 'N_FC_InvalidateAllThroughChunk', but only for the paths which leave the 
+ * chunk via one of the portals in the mask (i.e. the ones whose edges changed 
+ * states). Paths which end in the chunk are always invalidated. Paths through 
+ * the other portals of the chunk are still valid and are kept.
  */
-void N_FC_InvalidateNeighbourEnemySeekFields(int width, int height, 
-                                             struct coord chunk, enum nav_layer layer);
+void N_FC_InvalidateAllThroughPortals(const struct nav_chunk *chunk, struct coord chunk_coord, 
+                                      enum nav_layer layer, uint64_t portalmask);
 
-void N_FC_InvalidateDynamicSurroundFields(void);
+/* Invalidate the 'enemy seek', 'surround' and 'faction targets' fields in all 
+ * chunks which are adjacent to the current one. These fields are built with a
+ * padding of half a chunk and are also dependent on the state of the adjacent 
+ * chunks. Changes of their goal tiles are detected via the 'goal_key' instead.
+ */
+void N_FC_InvalidateNeighbourPaddedFields(int width, int height, 
+                                          struct coord chunk, enum nav_layer layer);
 
 /*###########################################################################*/
 /* LOS FIELD CACHING                                                         */
@@ -97,6 +104,34 @@ bool                     N_FC_GetDestFFMapping(dest_id_t id, struct coord chunk_
 void                     N_FC_PutDestFFMapping(dest_id_t dest_id, struct coord chunk_coord, 
                                                ff_id_t ffid);
 
+/* Path fields built from the same inputs (see 'N_FlowFieldContentKey') are 
+ * identical, so the paths on other layers can be mapped to an existing field 
+ * instead of building their own. The first field put for a content key is the 
+ * one that gets shared. A layer using another layer's field must borrow it, so 
+ * that the field is also invalidated along with the borrower's own fields.
+ */
+bool                     N_FC_GetSharedFlowField(uint64_t content_key, ff_id_t *out_ff);
+void                     N_FC_PutSharedFlowField(uint64_t content_key, ff_id_t ffid);
+void                     N_FC_BorrowFlowField(ff_id_t ffid, enum nav_layer layer);
+
+/*###########################################################################*/
+/* CONCURRENT LOOKUPS                                                        */
+/*###########################################################################*/
+
+/* These lookups leave the age history and the statistics of the caches 
+ * untouched. This makes them safe to call from any number of threads at 
+ * once, so long as nothing is modifying the caches at the same time. The 
+ * entries used this way should later be refreshed from the main thread with 
+ * 'N_FC_TouchDest' so that they do not get evicted while still in use. Every 
+ * key is only refreshed once between calls to 'N_FC_ClearTouched'.
+ */
+const struct LOS_field  *N_FC_PeekLOSField(dest_id_t id, struct coord chunk_coord);
+const struct flow_field *N_FC_PeekFlowField(ff_id_t ffid);
+bool                     N_FC_PeekDestFFMapping(dest_id_t id, struct coord chunk_coord, 
+                                                ff_id_t *out_ff);
+void                     N_FC_TouchDest(dest_id_t id, struct coord chunk_coord);
+void                     N_FC_ClearTouched(void);
+
 /*###########################################################################*/
 /* GRID PATH CACHING                                                         */
 /*###########################################################################*/
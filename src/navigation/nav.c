@@ -38,6 +38,7 @@
 #include "a_star.h"
 #include "field.h"
 #include "fieldcache.h"
+#include "field_gpu.h"
 #include "../map/public/tile.h"
 #include "../game/public/game.h"
 #include "../render/public/render.h"
@@ -45,6 +46,7 @@
 #include "../lib/public/mem.h"
 #include "../lib/public/queue.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/SDL_vec_rwops.h"
 #include "../phys/public/collision.h"
 #include "../pf_math.h"
 #include "../entity.h"
@@ -74,6 +76,11 @@ bool M_TileAdjacentToLand(const struct map *map, const struct tile_desc *td);
 
 #define EPSILON                  (1.0f / 1024)
 #define MAX_FIELD_TASKS          (256)
+#define MAX_FACTION_TARGETS      (1024)
+#define LOS_BATCH_SIZE           (8)
+
+#define BAKED_MAGIC              (0x564e4650) /* 'PFNV' */
+#define BAKED_VERSION            (1)
 
 #define FOREACH_PORTAL(_priv, _layer, _local, ...)                                              \
     do{                                                                                         \
@@ -121,24 +128,105 @@ struct field_work_out{
     struct flow_field field;
 };
 
+struct path_request{
+    struct nav_private *priv;
+    dest_id_t           id;
+    vec2_t              src;
+    vec2_t              dest;
+    vec3_t              map_pos;
+};
+
 VEC_TYPE(in, struct field_work_in)
 VEC_IMPL(static inline, in, struct field_work_in)
 
 VEC_TYPE(out, struct field_work_out)
 VEC_IMPL(static inline, out, struct field_work_out)
 
+VEC_TYPE(req, struct path_request)
+VEC_IMPL(static inline, req, struct path_request)
+
 struct field_work{
     struct memstack mem;
     vec_in_t        in;
     vec_out_t       out;
     size_t          nwork;
-    size_t          ntasks;
-    uint32_t        tids[MAX_FIELD_TASKS];
-    struct future   futures[MAX_FIELD_TASKS];
+    struct task_group group;
+    /* Path requests batched up during the tick. They are serviced 
+     * together, with the flow fields along the paths being computed
+     * by worker tasks (when 'defer' is set). */
+    vec_req_t       paths;
+    bool            defer;
+};
+
+/* The entities which the units of a faction are converging on during the 
+ * current tick. A single field guiding to the nearest of them is shared
+ * by all of the faction's units. */
+struct faction_targets{
+    uint32_t        key;
+    size_t          ntargets;
+    uint32_t        targets[MAX_FACTION_TARGETS];
+};
+
+/* Arguments of the per-chunk jobs which build the navigation data of 
+ * a single layer. */
+struct chunk_work{
+    struct nav_private *priv;
+    enum nav_layer      layer;
+    /* The index of the first island of every chunk in the 'ids' array,
+     * when building the islands field. */
+    size_t             *offsets;
+    uint16_t           *ids;
+};
+
+/* The tiles of a chunk which are occupied by moving entities and by founded
+ * buildings without collision, as bitsets with bit 'c' of row 'r' holding 
+ * the flag for tile (r, c). A chunk is rasterized when it is first queried 
+ * after an update, rather than on every query. */
+struct chunk_occupancy{
+    uint32_t        generation;
+    uint64_t        moving[FIELD_RES_R];
+    uint64_t        buildings[FIELD_RES_R];
+};
+
+/* The tiles of a chunk on which a building could currently be placed,
+ * in the same bitset layout as the occupancy. The 'shore' bitsets are for
+ * buildings which are allowed to be placed on shore tiles. A chunk is 
+ * rasterized when it is first queried after an update or after one of its'
+ * tiles has been blocked or unblocked. */
+struct chunk_buildable{
+    uint32_t        generation;
+    uint64_t        land[FIELD_RES_R];
+    uint64_t        shore[FIELD_RES_R];
+};
+
+/* A blocker reference count change held back until the end of a batch */
+struct blocker_ref{
+    void               *priv;
+    vec3_t              map_pos;
+    vec2_t              xz_pos;
+    float               range;
+    int                 faction_id;
+    bool                air;
+    int                 delta;
+    uint32_t            chunk_key;
+};
+
+/* Adjacent chunks along a path whose LOS fields are still to be built, 
+ * seeded from the cached field of the 'prev' chunk */
+struct los_run{
+    struct coord        prev;
+    size_t              size;
+    struct coord        chunks[LOS_BATCH_SIZE];
+    struct LOS_field    fields[LOS_BATCH_SIZE];
 };
 
+VEC_TYPE(bref, struct blocker_ref)
+VEC_IMPL(static inline, bref, struct blocker_ref)
+
 KHASH_SET_INIT_INT(coord)
 KHASH_SET_INIT_INT64(td)
+KHASH_SET_INIT_INT64(req)
+KHASH_MAP_INIT_INT64(fcount, uint16_t)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -147,6 +235,21 @@ KHASH_SET_INIT_INT64(td)
 static khash_t(coord)   *s_dirty_chunks[NAV_LAYER_MAX];
 static bool              s_local_islands_dirty[NAV_LAYER_MAX] = {0};
 static struct field_work s_field_work;
+/* The (dest_id, chunk) keys of the batched path requests */
+static khash_t(req)     *s_path_request_keys;
+/* The padded fields whose goal tiles have been checked during the current tick */
+static khash_t(req)     *s_validated_fields;
+static struct faction_targets s_faction_targets[MAX_FACTIONS];
+static struct chunk_occupancy *s_occupancy;
+static size_t                  s_occupancy_nchunks;
+static const void             *s_occupancy_priv;
+/* Bumped on every update, making all the occupancy bitsets stale */
+static uint32_t                s_occupancy_generation = 1;
+static struct chunk_buildable *s_buildable[NAV_LAYER_MAX];
+static size_t                  s_buildable_nchunks;
+static const void             *s_buildable_priv;
+static int                     s_blocker_batch_depth;
+static vec_bref_t              s_blocker_batch;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -171,6 +274,36 @@ static void vec_free(void *ptr)
     /* no-op */
 }
 
+static int compare_uids(const void *a, const void *b)
+{
+    uint32_t uida = *(const uint32_t*)a;
+    uint32_t uidb = *(const uint32_t*)b;
+    return (uida > uidb) - (uida < uidb);
+}
+
+/* Order the held back changes by chunk, so that they are applied one chunk 
+ * at a time, with the changes of the same footprint next to one another. */
+static int compare_brefs(const void *a, const void *b)
+{
+    const struct blocker_ref *ba = a, *bb = b;
+
+    if(ba->priv != bb->priv)
+        return ((uintptr_t)ba->priv > (uintptr_t)bb->priv) ? 1 : -1;
+    if(ba->chunk_key != bb->chunk_key)
+        return (ba->chunk_key > bb->chunk_key) ? 1 : -1;
+    if(ba->air != bb->air)
+        return ba->air - bb->air;
+    if(ba->faction_id != bb->faction_id)
+        return ba->faction_id - bb->faction_id;
+    if(ba->range != bb->range)
+        return (ba->range > bb->range) ? 1 : -1;
+    if(ba->xz_pos.x != bb->xz_pos.x)
+        return (ba->xz_pos.x > bb->xz_pos.x) ? 1 : -1;
+    if(ba->xz_pos.z != bb->xz_pos.z)
+        return (ba->xz_pos.z > bb->xz_pos.z) ? 1 : -1;
+    return 0;
+}
+
 static uint64_t td_key(const struct tile_desc *td)
 {
     return (((uint64_t)td->chunk_r << 48)
@@ -581,7 +714,7 @@ static void n_link_chunk_portals(struct nav_chunk *chunk, struct coord chunk_coo
             };
 
             float cost;
-            bool has_path = AStar_GridPath(a, b, chunk_coord, chunk->cost_base, 
+            bool has_path = AStar_GridPathUncached(a, b, chunk->cost_base, 
                 layer, &path, &cost);
             if(has_path) {
                 port->edges[port->num_neighbours] = (struct edge){
@@ -624,6 +757,7 @@ static void n_update_components(struct nav_private *priv, enum nav_layer layer)
     FOREACH_PORTAL(priv, layer, port, {
         n_visit_portal(port, comp_id++);
     });
+    AStar_InvalidatePortalGraph(layer);
 }
 
 /* Two portals are considered reachable from one another if they
@@ -651,9 +785,10 @@ static bool n_local_ports_connected(struct portal *a, struct portal *b,
     return false;
 }
 
-static int n_update_edge_states(struct nav_chunk *chunk)
+/* Returns a mask of the portals which had at least one edge change states */
+static uint64_t n_update_edge_states(struct nav_chunk *chunk)
 {
-    int ret = 0;
+    uint64_t ret = 0;
     for(int i = 0; i < chunk->num_portals; i++) {
 
         struct portal *port = &chunk->portals[i];
@@ -668,7 +803,8 @@ static int n_update_edge_states(struct nav_chunk *chunk)
 
             if(new_es != old_es) {
                 port->edges[j].es = new_es;
-                ret++;
+                ret |= ((uint64_t)1) << i;
+                ret |= ((uint64_t)1) << (neighb - chunk->portals);
             }
         }
     }
@@ -813,53 +949,6 @@ static dest_id_t n_dest_id(struct tile_desc dst_desc, enum nav_layer layer, int
          | (((uint32_t)faction_id       & 0x0f) <<  0);
 }
 
-static void n_visit_island(struct nav_private *priv, uint16_t id, 
-                           struct tile_desc start, enum nav_layer layer)
-{
-    struct map_resolution res;
-    N_GetResolution(priv, &res);
-
-    struct nav_chunk *chunk 
-        = &priv->chunks[layer][IDX(start.chunk_r, priv->width, start.chunk_c)];
-    chunk->islands[start.tile_r][start.tile_c] = id;
-
-    queue_td_t frontier;
-    queue_td_init(&frontier, 1024);
-    queue_td_push(&frontier, &start);
-
-    while(queue_size(frontier) > 0) {
-    
-        struct tile_desc curr;
-        queue_td_pop(&frontier, &curr);
-
-        struct coord deltas[] = {
-            { 0, -1},
-            { 0, +1},
-            {-1,  0},
-            {+1,  0},
-        };
-
-        for(int i = 0; i < ARR_SIZE(deltas); i++) {
-        
-            struct tile_desc neighb = curr;
-            if(!M_Tile_RelativeDesc(res, &neighb, deltas[i].c, deltas[i].r))
-                continue;
-
-            assert(memcmp(&curr, &neighb, sizeof(struct tile_desc)) != 0);
-            chunk = &priv->chunks[layer][IDX(neighb.chunk_r, priv->width, neighb.chunk_c)];
-
-            if(chunk->islands[neighb.tile_r][neighb.tile_c] == ISLAND_NONE
-            && chunk->cost_base[neighb.tile_r][neighb.tile_c] != COST_IMPASSABLE) {
-            
-                chunk->islands[neighb.tile_r][neighb.tile_c] = id;
-                queue_td_push(&frontier, &neighb);
-            }
-        }
-    }
-
-    queue_td_destroy(&frontier);
-}
-
 static void n_visit_island_local(struct nav_private *priv, struct coord chunk_coord,
                                  struct nav_chunk *chunk, uint16_t id, struct coord start)
 {
@@ -943,14 +1032,38 @@ static void n_update_local_islands(struct nav_private *priv, struct coord chunk_
     }}
 }
 
-static void n_update_local_island_field(struct nav_private *priv, enum nav_layer layer)
+/* Run 'fn' for every chunk of the layer on the worker threads, returning 
+ * once all of them are done. The jobs may only touch the data of their 
+ * own chunk. 
+ */
+static void n_for_each_chunk(struct chunk_work *work, range_func_t fn)
 {
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
-    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+    assert(Sched_UsingBigStack());
 
-        struct nav_chunk *curr_chunk = &priv->chunks[layer][IDX(chunk_r, priv->width, chunk_c)];
-        n_update_local_islands(priv, (struct coord){chunk_r, chunk_c}, curr_chunk);
-    }}
+    struct task_group tg;
+    Sched_TaskGroupInit(&tg);
+    Sched_ParallelForAsync(&tg, 0, work->priv->width * work->priv->height, 1, 
+        fn, work, 0, TASK_BIG_STACK);
+    Sched_TaskGroupJoin(&tg);
+}
+
+static void n_local_islands_task(size_t begin, size_t end, void *arg)
+{
+    struct chunk_work *work = arg;
+    struct nav_private *priv = work->priv;
+
+    for(size_t i = begin; i < end; i++) {
+        struct coord chunk_coord = (struct coord){i / priv->width, i % priv->width};
+        n_update_local_islands(priv, chunk_coord, &priv->chunks[work->layer][i]);
+    }
+}
+
+static void n_update_local_island_field(struct nav_private *priv, enum nav_layer layer)
+{
+    PERF_ENTER();
+    struct chunk_work work = (struct chunk_work){ .priv = priv, .layer = layer };
+    n_for_each_chunk(&work, n_local_islands_task);
+    PERF_RETURN_VOID();
 }
 
 static void n_update_dirty_local_islands(void *nav_private, enum nav_layer layer)
@@ -974,6 +1087,53 @@ static void n_update_dirty_local_islands(void *nav_private, enum nav_layer layer
     s_local_islands_dirty[layer] = false;
 }
 
+static void n_buildable_invalidate(struct nav_private *priv, enum nav_layer layer, 
+                                   int chunk_r, int chunk_c)
+{
+    if(s_buildable_priv != priv || !s_buildable[layer])
+        return;
+    s_buildable[layer][IDX(chunk_r, priv->width, chunk_c)].generation = 0;
+}
+
+static uint64_t n_faction_count_key(const struct nav_private *priv, enum nav_layer layer, 
+                                    struct tile_desc td, int faction_id)
+{
+    uint64_t chunk_idx = IDX(td.chunk_r, priv->width, td.chunk_c);
+    uint64_t tile_idx = IDX(td.tile_r, FIELD_RES_C, td.tile_c);
+    return (((uint64_t)layer) << 48)
+         | ((chunk_idx & 0xffffffff) << 16)
+         | ((tile_idx & 0xfff) << 4)
+         | (((uint64_t)faction_id) & 0xf);
+}
+
+static void n_update_faction_count(struct nav_private *priv, enum nav_layer layer, 
+                                   struct nav_chunk *chunk, struct tile_desc td, 
+                                   int faction_id, int ref_delta)
+{
+    khash_t(fcount) *counts = (khash_t(fcount)*)priv->faction_counts;
+    uint64_t key = n_faction_count_key(priv, layer, td, faction_id);
+
+    int ret;
+    khiter_t k = kh_get(fcount, counts, key);
+    if(k == kh_end(counts)) {
+        assert(ref_delta > 0);
+        k = kh_put(fcount, counts, key, &ret);
+        assert(ret != -1);
+        kh_val(counts, k) = 0;
+    }
+
+    int val = kh_val(counts, k) + ref_delta;
+    assert(val >= 0);
+
+    if(val == 0) {
+        kh_del(fcount, counts, k);
+        chunk->faction_mask[td.tile_r][td.tile_c] &= ~(0x1 << faction_id);
+    }else{
+        kh_val(counts, k) = val;
+        chunk->faction_mask[td.tile_r][td.tile_c] |= (0x1 << faction_id);
+    }
+}
+
 static void n_update_blockers(struct nav_private *priv, enum nav_layer layer, int faction_id,
                               struct tile_desc *tds, size_t ntds, int ref_delta)
 {
@@ -989,7 +1149,7 @@ static void n_update_blockers(struct nav_private *priv, enum nav_layer layer, in
 
         int prev_val = chunk->blockers[curr.tile_r][curr.tile_c];
         chunk->blockers[curr.tile_r][curr.tile_c] += ref_delta;
-        chunk->factions[faction_id][curr.tile_r][curr.tile_c] += ref_delta;
+        n_update_faction_count(priv, layer, chunk, curr, faction_id, ref_delta);
         assert(chunk->blockers[curr.tile_r][curr.tile_c] < 16383);
 
         int val = chunk->blockers[curr.tile_r][curr.tile_c];
@@ -1004,6 +1164,7 @@ static void n_update_blockers(struct nav_private *priv, enum nav_layer layer, in
             assert(ret != -1);
 
             s_local_islands_dirty[layer] = true;
+            n_buildable_invalidate(priv, layer, curr.chunk_r, curr.chunk_c);
         }
     }
 }
@@ -1192,7 +1353,7 @@ static int n_closest_island_tiles(const struct nav_private *priv,
     N_GetResolution(priv, &res);
 
     queue_td_t frontier;
-    queue_td_init(&frontier, 1024);
+    queue_td_init_alloc(&frontier, 1024, Sched_FrameRealloc, Sched_FrameFree);
     queue_td_push(&frontier, &target);
 
     const size_t count = res.chunk_h * res.chunk_w * res.tile_h * res.tile_w;
@@ -1524,73 +1685,172 @@ static bool n_non_collidable_building(uint32_t ent, void *arg)
         && G_Building_IsFounded(ent));
 }
 
-static khash_t(td) *n_moving_entities_tileset(struct nav_private *priv, vec3_t map_pos, 
-                                              const struct obb *area)
+static void n_rasterize_occupancy(struct nav_private *priv, vec3_t map_pos, 
+                                  struct coord chunk, struct chunk_occupancy *out)
 {
     assert(Sched_UsingBigStack());
 
     struct map_resolution res;
     N_GetResolution(priv, &res);
 
-    vec2_t center_xz = (vec2_t){area->center.x, area->center.z};
-    float radius = MAX(area->half_lengths[0] * 1.5f, area->half_lengths[2] * 1.5f);
+    memset(out->moving, 0, sizeof(out->moving));
+    memset(out->buildings, 0, sizeof(out->buildings));
+
+    struct box tile = M_Tile_Bounds(res, map_pos, 
+        (struct tile_desc){chunk.r, chunk.c, 0, 0});
+    vec2_t xz_min = (vec2_t){tile.x - tile.width * FIELD_RES_C, tile.z};
+    vec2_t xz_max = (vec2_t){tile.x, tile.z + tile.height * FIELD_RES_R};
 
     uint32_t ents[1024];
-    size_t nents = G_Pos_EntsInCircleWithPred(center_xz, radius, ents, 
+    size_t nents = G_Pos_EntsInRectWithPred(xz_min, xz_max, ents, 
         ARR_SIZE(ents), n_moving_entity, NULL);
 
-    khash_t(td) *ret = kh_init(td);
-    if(!ret)
-        return NULL;
-
     for(int i = 0; i < nents; i++) {
 
-        vec2_t xz_pos = G_Pos_GetXZ(ents[i]);
-        struct tile_desc tile;
-
-        bool result = M_Tile_DescForPoint2D(res, map_pos, xz_pos, &tile);
+        struct tile_desc td;
+        bool result = M_Tile_DescForPoint2D(res, map_pos, G_Pos_GetXZ(ents[i]), &td);
         assert(result);
 
-        int status;
-        kh_put(td, ret, td_key(&tile), &status);
+        if(td.chunk_r != chunk.r || td.chunk_c != chunk.c)
+            continue;
+        out->moving[td.tile_r] |= ((uint64_t)1) << td.tile_c;
     }
 
-    return ret;
+    /* Buildings are found by their position, so also consider those 
+     * centered just outside of the chunk */
+    const float margin = 50.0f;
+    nents = G_Pos_EntsInRectWithPred(
+        (vec2_t){xz_min.x - margin, xz_min.z - margin}, 
+        (vec2_t){xz_max.x + margin, xz_max.z + margin}, 
+        ents, ARR_SIZE(ents), n_non_collidable_building, NULL);
+
+    for(int i = 0; i < nents; i++) {
+
+        struct obb obb;
+        Entity_CurrentOBB(ents[i], &obb, true);
+
+        struct tile_desc tds[1024];
+        size_t ntiles = M_Tile_AllUnderObj(map_pos, res, &obb, tds, ARR_SIZE(tds));
+
+        for(int j = 0; j < ntiles; j++) {
+            if(tds[j].chunk_r != chunk.r || tds[j].chunk_c != chunk.c)
+                continue;
+            out->buildings[tds[j].tile_r] |= ((uint64_t)1) << tds[j].tile_c;
+        }
+    }
 }
 
-static khash_t(td) *n_non_collidable_buildings_tileset(struct nav_private *priv, vec3_t map_pos,
-                                                       const struct obb *area)
+static bool n_tile_occupied(struct nav_private *priv, vec3_t map_pos, struct tile_desc td)
 {
-    assert(Sched_UsingBigStack());
+    ASSERT_IN_MAIN_THREAD();
+
+    size_t nchunks = priv->width * priv->height;
+    if(s_occupancy_priv != priv || s_occupancy_nchunks != nchunks) {
+
+        struct chunk_occupancy *occ = realloc(s_occupancy, nchunks * sizeof(*occ));
+        if(!occ)
+            return false;
+        memset(occ, 0, nchunks * sizeof(*occ));
+        s_occupancy = occ;
+        s_occupancy_nchunks = nchunks;
+        s_occupancy_priv = priv;
+    }
+
+    struct chunk_occupancy *occ = &s_occupancy[IDX(td.chunk_r, priv->width, td.chunk_c)];
+    if(occ->generation != s_occupancy_generation) {
+        n_rasterize_occupancy(priv, map_pos, (struct coord){td.chunk_r, td.chunk_c}, occ);
+        occ->generation = s_occupancy_generation;
+    }
+    return ((occ->moving[td.tile_r] | occ->buildings[td.tile_r]) >> td.tile_c) & 0x1;
+}
 
+static void n_rasterize_buildable(struct nav_private *priv, const struct map *map, 
+                                  enum nav_layer layer, struct coord chunk, 
+                                  struct chunk_buildable *out)
+{
     struct map_resolution res;
     N_GetResolution(priv, &res);
 
-    vec2_t center_xz = (vec2_t){area->center.x, area->center.z};
-    float radius = MAX(area->half_lengths[0] + 50.0f, area->half_lengths[2] + 50.0f);
+    struct map_resolution tile_res;
+    M_GetResolution(map, &tile_res);
 
-    uint32_t ents[1024];
-    size_t nents = G_Pos_EntsInCircleWithPred(center_xz, radius, ents, 
-        ARR_SIZE(ents), n_non_collidable_building, NULL);
+    vec3_t map_pos = M_GetPos(map);
+    const struct nav_chunk *nchunk = &priv->chunks[layer][IDX(chunk.r, priv->width, chunk.c)];
 
-    khash_t(td) *ret = kh_init(td);
-    if(!ret)
-        return NULL;
+    for(int r = 0; r < FIELD_RES_R; r++) {
 
-    for(int i = 0; i < nents; i++) {
+        out->land[r] = 0;
+        out->shore[r] = 0;
 
-        struct obb obb;
-        Entity_CurrentOBB(ents[i], &obb, true);
+        for(int c = 0; c < FIELD_RES_C; c++) {
 
-        struct tile_desc tds[1024];
-        size_t ntiles = M_Tile_AllUnderObj(map_pos, res, &obb, tds, ARR_SIZE(tds));
+            struct tile_desc td = (struct tile_desc){chunk.r, chunk.c, r, c};
+            if(nchunk->blockers[r][c])
+                continue;
+            if(n_tile_occupied(priv, map_pos, td))
+                continue;
 
-        for(int j = 0; j < ntiles; j++) {
-            int status;
-            kh_put(td, ret, td_key(&tds[j]), &status);
+            struct box bounds = M_Tile_Bounds(res, map_pos, td);
+            vec2_t center = (vec2_t){
+                bounds.x - bounds.width / 2.0f,
+                bounds.z + bounds.height / 2.0f
+            };
+            if(!G_Fog_PlayerExplored(center))
+                continue;
+
+            uint64_t bit = ((uint64_t)1) << c;
+            if(nchunk->cost_base[r][c] != COST_IMPASSABLE) {
+                out->land[r] |= bit;
+                out->shore[r] |= bit;
+                continue;
+            }
+
+            struct tile_desc map_td = (struct tile_desc){
+                chunk.r,
+                chunk.c,
+                r / ((float)res.tile_h) * tile_res.tile_h,
+                c / ((float)res.tile_w) * tile_res.tile_w
+            };
+            struct tile *tile = NULL;
+            M_TileForDesc(map, map_td, &tile);
+            assert(tile);
+            if((tile->ramp_height > 1) && (tile->base_height < 0)) {
+                out->shore[r] |= bit;
+            }
         }
     }
-    return ret;
+}
+
+static bool n_tile_buildable(struct nav_private *priv, const struct map *map, 
+                             enum nav_layer layer, bool allow_shore, struct tile_desc td)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    size_t nchunks = priv->width * priv->height;
+    if(s_buildable_priv != priv || s_buildable_nchunks != nchunks) {
+
+        for(int i = 0; i < NAV_LAYER_MAX; i++) {
+            PF_FREE(s_buildable[i]);
+        }
+        s_buildable_nchunks = 0;
+        s_buildable_priv = NULL;
+
+        for(int i = 0; i < NAV_LAYER_MAX; i++) {
+            s_buildable[i] = calloc(nchunks, sizeof(struct chunk_buildable));
+            if(!s_buildable[i])
+                return false;
+        }
+        s_buildable_nchunks = nchunks;
+        s_buildable_priv = priv;
+    }
+
+    struct chunk_buildable *bld = &s_buildable[layer][IDX(td.chunk_r, priv->width, td.chunk_c)];
+    if(bld->generation != s_occupancy_generation) {
+        n_rasterize_buildable(priv, map, layer, (struct coord){td.chunk_r, td.chunk_c}, bld);
+        bld->generation = s_occupancy_generation;
+    }
+    const uint64_t *rows = allow_shore ? bld->shore : bld->land;
+    return (rows[td.tile_r] >> td.tile_c) & 0x1;
 }
 
 bool n_closest_adjacent_pos(void *nav_private, enum nav_layer layer, vec3_t map_pos, vec2_t xz_src, 
@@ -1667,6 +1927,30 @@ static bool n_objects_adjacent(void *nav_private, vec3_t map_pos, vec2_t xz_pos,
     return false;
 }
 
+/* The portals of a chunk are only linked to one another, so every 
+ * chunk can be handled independently once the portals are created. 
+ */
+static void n_link_portals_task(size_t begin, size_t end, void *arg)
+{
+    struct chunk_work *work = arg;
+    struct nav_private *priv = work->priv;
+
+    for(size_t i = begin; i < end; i++) {
+        struct coord chunk_coord = (struct coord){i / priv->width, i % priv->width};
+        struct nav_chunk *curr_chunk = &priv->chunks[work->layer][i];
+        n_link_chunk_portals(curr_chunk, chunk_coord, work->layer);
+
+        /* The travel costs are shared by all layers of a domain and 
+         * only need to be built once, for the base layer. */
+        if(N_LAYER_IS_BASE(work->layer)) {
+            n_build_portal_travel_index(curr_chunk);
+        }else{
+            assert(curr_chunk->num_portals 
+                == priv->chunks[work->layer - (work->layer % NAV_LAYERS_PER_DOMAIN)][i].num_portals);
+        }
+    }
+}
+
 static void n_update_portals(struct nav_private *priv, enum nav_layer layer)
 {
     for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
@@ -1678,14 +1962,105 @@ static void n_update_portals(struct nav_private *priv, enum nav_layer layer)
     
     n_create_portals(priv, layer);
 
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
-    for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
-            
-        struct nav_chunk *curr_chunk = &priv->chunks[layer]
-                                                    [IDX(chunk_r, priv->width, chunk_c)];
-        n_link_chunk_portals(curr_chunk, (struct coord){chunk_r, chunk_c}, layer);
-        n_build_portal_travel_index(curr_chunk);
+    struct chunk_work work = (struct chunk_work){ .priv = priv, .layer = layer };
+    n_for_each_chunk(&work, n_link_portals_task);
+    AStar_InvalidatePortalGraph(layer);
+}
+
+/* Label the connected sets of pathable tiles of the chunk, not considering 
+ * the neighbouring chunks, in the order that they are first encountered.
+ * Returns the number of labels.
+ */
+static size_t n_label_chunk_islands(struct nav_chunk *chunk)
+{
+    struct coord frontier[FIELD_RES_R * FIELD_RES_C];
+    uint16_t label = 0;
+    memset(chunk->islands, 0xff, sizeof(chunk->islands));
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        if(chunk->islands[r][c] != ISLAND_NONE)
+            continue;
+        if(chunk->cost_base[r][c] == COST_IMPASSABLE)
+            continue;
+
+        int head = 0, tail = 0;
+        chunk->islands[r][c] = label;
+        frontier[tail++] = (struct coord){r, c};
+
+        while(head < tail) {
+
+            struct coord curr = frontier[head++];
+            struct coord deltas[] = {
+                { 0, -1},
+                { 0, +1},
+                {-1,  0},
+                {+1,  0},
+            };
+
+            for(int i = 0; i < ARR_SIZE(deltas); i++) {
+
+                int nr = curr.r + deltas[i].r;
+                int nc = curr.c + deltas[i].c;
+                if(nr < 0 || nr >= FIELD_RES_R || nc < 0 || nc >= FIELD_RES_C)
+                    continue;
+                if(chunk->islands[nr][nc] != ISLAND_NONE)
+                    continue;
+                if(chunk->cost_base[nr][nc] == COST_IMPASSABLE)
+                    continue;
+
+                chunk->islands[nr][nc] = label;
+                frontier[tail++] = (struct coord){nr, nc};
+            }
+        }
+        label++;
     }}
+    return label;
+}
+
+static void n_label_islands_task(size_t begin, size_t end, void *arg)
+{
+    struct chunk_work *work = arg;
+    for(size_t i = begin; i < end; i++) {
+        work->offsets[i] = n_label_chunk_islands(&work->priv->chunks[work->layer][i]);
+    }
+}
+
+static void n_assign_islands_task(size_t begin, size_t end, void *arg)
+{
+    struct chunk_work *work = arg;
+    for(size_t i = begin; i < end; i++) {
+
+        struct nav_chunk *chunk = &work->priv->chunks[work->layer][i];
+        for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+            if(chunk->islands[r][c] == ISLAND_NONE)
+                continue;
+            chunk->islands[r][c] = work->ids[work->offsets[i] + chunk->islands[r][c]];
+        }}
+    }
+}
+
+static uint32_t n_island_root(uint32_t *parents, uint32_t label)
+{
+    while(parents[label] != label) {
+        parents[label] = parents[parents[label]];
+        label = parents[label];
+    }
+    return label;
+}
+
+static void n_merge_islands(uint32_t *parents, uint32_t a, uint32_t b)
+{
+    a = n_island_root(parents, a);
+    b = n_island_root(parents, b);
+    /* Keep the label of the tile that comes first in the scan order as 
+     * the root, so that the IDs are handed out in that order. */
+    if(a < b)
+        parents[b] = a;
+    else
+        parents[a] = b;
 }
 
 static void n_update_island_field(struct nav_private *priv, enum nav_layer layer)
@@ -1696,48 +2071,297 @@ static void n_update_island_field(struct nav_private *priv, enum nav_layer layer
      * To build the field, we treat every tile in the cost field as a node in
      * a graph, with cardinally adjacent pathable tiles being the 'neighbors'. 
      * Then we solve an instance of the 'coonected components' problem. 
+     *
+     * The chunks are first labelled independently, in parallel. Then the
+     * labels of pathable tiles touching across chunk borders are merged and
+     * the final IDs are written back to the chunks, again in parallel. The
+     * IDs are the same as those of a single flood fill over the whole map.
      */
+    PERF_ENTER();
 
-    uint16_t island_id = 0;
+    size_t nchunks = priv->width * priv->height;
+    size_t *offsets = malloc(nchunks * sizeof(size_t));
+    if(!offsets)
+        goto fail_offsets;
 
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
-    for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
+    struct chunk_work work = (struct chunk_work){ 
+        .priv = priv, 
+        .layer = layer,
+        .offsets = offsets,
+    };
+    n_for_each_chunk(&work, n_label_islands_task);
 
-        /* Initialize every node as 'unvisited' */
-        struct nav_chunk *curr_chunk = &priv->chunks[layer]
-                                                    [IDX(chunk_r, priv->width, chunk_c)];
-        memset(curr_chunk->islands, 0xff, sizeof(curr_chunk->islands));
-    }}
+    size_t nlabels = 0;
+    for(int i = 0; i < nchunks; i++) {
+        size_t count = offsets[i];
+        offsets[i] = nlabels;
+        nlabels += count;
+    }
+
+    uint32_t *parents = malloc(nlabels * sizeof(uint32_t));
+    if(!parents)
+        goto fail_parents;
+    uint16_t *ids = malloc(nlabels * sizeof(uint16_t));
+    if(!ids)
+        goto fail_ids;
+
+    for(uint32_t i = 0; i < nlabels; i++) {
+        parents[i] = i;
+    }
 
     for(int chunk_r = 0; chunk_r < priv->height; chunk_r++) {
     for(int chunk_c = 0; chunk_c < priv->width;  chunk_c++) {
 
-        struct nav_chunk *curr_chunk = &priv->chunks[layer]
-                                                    [IDX(chunk_r, priv->width, chunk_c)];
+        size_t idx = IDX(chunk_r, priv->width, chunk_c);
+        const struct nav_chunk *curr = &priv->chunks[layer][idx];
+
+        if(chunk_c < priv->width - 1) {
+            size_t ridx = IDX(chunk_r, priv->width, chunk_c + 1);
+            const struct nav_chunk *right = &priv->chunks[layer][ridx];
+            for(int r = 0; r < FIELD_RES_R; r++) {
+                uint16_t a = curr->islands[r][FIELD_RES_C - 1];
+                uint16_t b = right->islands[r][0];
+                if(a != ISLAND_NONE && b != ISLAND_NONE)
+                    n_merge_islands(parents, offsets[idx] + a, offsets[ridx] + b);
+            }
+        }
 
-        for(int tile_r = 0; tile_r < FIELD_RES_R; tile_r++) {
-        for(int tile_c = 0; tile_c < FIELD_RES_C; tile_c++) {
+        if(chunk_r < priv->height - 1) {
+            size_t bidx = IDX(chunk_r + 1, priv->width, chunk_c);
+            const struct nav_chunk *bot = &priv->chunks[layer][bidx];
+            for(int c = 0; c < FIELD_RES_C; c++) {
+                uint16_t a = curr->islands[FIELD_RES_R - 1][c];
+                uint16_t b = bot->islands[0][c];
+                if(a != ISLAND_NONE && b != ISLAND_NONE)
+                    n_merge_islands(parents, offsets[idx] + a, offsets[bidx] + b);
+            }
+        }
+    }}
 
-            if(curr_chunk->islands[tile_r][tile_c] != ISLAND_NONE)
-                continue;
+    uint16_t island_id = 0;
+    for(uint32_t i = 0; i < nlabels; i++) {
+        uint32_t root = n_island_root(parents, i);
+        ids[i] = (root == i) ? island_id++ : ids[root];
+    }
 
-            if(curr_chunk->cost_base[tile_r][tile_c] == COST_IMPASSABLE)
-                continue;
+    work.ids = ids;
+    n_for_each_chunk(&work, n_assign_islands_task);
 
-            struct tile_desc td = {chunk_r, chunk_c, tile_r, tile_c};
-            n_visit_island(priv, island_id, td, layer);
-            island_id++;
-        }}
-    }}
+    free(ids);
+fail_ids:
+    free(parents);
+fail_parents:
+    free(offsets);
+fail_offsets:
+    PERF_RETURN_VOID();
 }
 
-static bool n_request_path(void *nav_private, vec2_t xz_src, vec2_t xz_dest, int faction_id,
-                           vec3_t map_pos, enum nav_layer layer, dest_id_t *out_dest_id)
+static struct result field_task(void *arg)
 {
-    PERF_ENTER();
+    size_t *index = arg;
+    struct field_work_in *in = &vec_AT(&s_field_work.in, *index);
+    struct field_work_out *out = &vec_AT(&s_field_work.out, *index);
 
-    struct nav_private *priv = nav_private;
-    struct map_resolution res;
+    PERF_PUSH("nav::field_task");
+    N_FlowFieldUpdate(in->chunk, in->priv, in->faction_id, in->layer, in->target, &out->field);
+    PERF_POP();
+
+    return NULL_RESULT;
+}
+
+static void field_join_work(void)
+{
+    Sched_TaskGroupJoin(&s_field_work.group);
+}
+
+static bool field_work_pending(ff_id_t id)
+{
+    for(int i = 0; i < s_field_work.nwork; i++) {
+        if(vec_AT(&s_field_work.in, i).id == id)
+            return true;
+    }
+    return N_FG_Pending(id);
+}
+
+/* Start a task computing the field, starting out with the contents of 'base' 
+ * or an empty field if it's NULL. Returns false if the work queue is full.
+ */
+static bool field_push_work(struct nav_private *priv, struct coord chunk, 
+                            struct field_target target, int faction_id, 
+                            enum nav_layer layer, ff_id_t id, const struct flow_field *base)
+{
+    /* We already have a job for this field */
+    if(field_work_pending(id))
+        return true;
+
+    if(s_field_work.nwork == MAX_FIELD_TASKS)
+        return false;
+
+    vec_in_push(&s_field_work.in, (struct field_work_in){
+        .priv = priv,
+        .chunk = chunk,
+        .target = target,
+        .faction_id = faction_id,
+        .layer = layer,
+        .id = id
+    });
+
+    struct field_work_out *out = &vec_AT(&s_field_work.out, s_field_work.nwork);
+    if(base) {
+        out->field = *base;
+    }else{
+        N_FlowFieldInit(chunk, &out->field);
+    }
+
+    size_t *arg = stalloc(&s_field_work.mem, sizeof(size_t));
+    *arg = s_field_work.nwork++;
+
+    if(!Sched_TaskGroupAdd(&s_field_work.group, 1, field_task, arg, TASK_BIG_STACK)) {
+        field_task(arg);
+    }
+    return true;
+}
+
+/* Wait for all the outstanding field tasks and place the results in the cache */
+static void field_commit_work(void)
+{
+    field_join_work();
+    for(int i = 0; i < s_field_work.nwork; i++) {
+        struct field_work_in *in = &vec_AT(&s_field_work.in, i);
+        struct field_work_out *out = &vec_AT(&s_field_work.out, i);
+        N_FC_PutFlowField(in->id, &out->field);
+    }
+    vec_in_reset(&s_field_work.in);
+    s_field_work.nwork = 0;
+}
+
+/* Rather than dropping the enemy seek, surround and faction targets fields 
+ * whenever their targets may have moved, the cached fields are kept for as 
+ * long as they guide to the same set of tiles. Changes to the chunks they 
+ * span invalidate them separately. The goal tiles of a field are checked
+ * at most once per tick.
+ */
+static bool n_padded_field_current(const struct nav_private *priv, enum nav_layer layer,
+                                   struct coord chunk, struct field_target target, 
+                                   ff_id_t id, const struct flow_field *ff)
+{
+    if(kh_get(req, s_validated_fields, id) != kh_end(s_validated_fields))
+        return true;
+
+    if(ff->goal_key != N_FlowFieldGoalKey(chunk, priv, layer, target))
+        return false;
+
+    int status;
+    kh_put(req, s_validated_fields, id, &status);
+    return true;
+}
+
+static void n_mark_padded_field_current(ff_id_t id)
+{
+    int status;
+    kh_put(req, s_validated_fields, id, &status);
+}
+
+/* Compute the field of a path and put it in the cache. When servicing the 
+ * batched path requests, the computation is handed off to a worker task 
+ * instead, and the field will be in the cache once the batch is done. New
+ * fields may also be handed off to the GPU, in which case they will be in
+ * the cache a few ticks later.
+ */
+static void n_build_path_field(struct nav_private *priv, struct coord chunk, 
+                               struct field_target target, int faction_id, 
+                               enum nav_layer layer, ff_id_t id, const struct flow_field *base)
+{
+    if(s_field_work.defer) {
+
+        if(field_work_pending(id))
+            return;
+        if(!base && N_FG_Push(priv, chunk, target, faction_id, layer, id))
+            return;
+        if(field_push_work(priv, chunk, target, faction_id, layer, id, base))
+            return;
+    }
+
+    struct flow_field ff;
+    if(base) {
+        ff = *base;
+    }else{
+        N_FlowFieldInit(chunk, &ff);
+    }
+    N_FlowFieldUpdate(chunk, priv, faction_id, layer, target, &ff);
+    N_FC_PutFlowField(id, &ff);
+}
+
+/* Compare two flow field IDs, ignoring the layer held in the top bits */
+static bool same_field_target(ff_id_t a, ff_id_t b)
+{
+    return (a << 4) == (b << 4);
+}
+
+/* Paths on different layers often need a field with the same contents near 
+ * their target, for example when the terrain around it is open. Rather than 
+ * building another copy, the path is mapped to the field which is already 
+ * cached for these inputs. Returns the ID of the field the path should use.
+ */
+static ff_id_t n_shared_path_field(struct nav_private *priv, struct coord chunk, 
+                                   struct field_target target, int faction_id, 
+                                   enum nav_layer layer, ff_id_t id)
+{
+    if(N_FC_ContainsFlowField(id) || field_work_pending(id))
+        return id;
+
+    uint64_t key;
+    if(!N_FlowFieldContentKey(chunk, priv, faction_id, layer, target, &key))
+        return id;
+
+    ff_id_t shared;
+    if(N_FC_GetSharedFlowField(key, &shared)
+    && same_field_target(shared, id)
+    && N_FC_ContainsFlowField(shared)) {
+
+        N_FC_BorrowFlowField(shared, layer);
+        return shared;
+    }
+
+    N_FC_PutSharedFlowField(key, id);
+    return id;
+}
+
+static bool los_run_contains(const struct los_run *run, struct coord chunk)
+{
+    for(size_t i = 0; i < run->size; i++) {
+        if(run->chunks[i].r == chunk.r && run->chunks[i].c == chunk.c)
+            return true;
+    }
+    return false;
+}
+
+static void los_run_flush(struct nav_private *priv, struct los_run *run, dest_id_t id, 
+                          struct tile_desc target, vec3_t map_pos)
+{
+    if(run->size == 0)
+        return;
+
+    assert(N_FC_ContainsLOSField(id, run->prev));
+    const struct LOS_field *prev_los = N_FC_LOSFieldAt(id, run->prev);
+    assert(prev_los);
+    assert(prev_los->chunk.r == run->prev.r && prev_los->chunk.c == run->prev.c);
+
+    N_LOSFieldCreateBatch(id, run->size, run->chunks, target, priv, map_pos, 
+        run->fields, prev_los);
+    for(size_t i = 0; i < run->size; i++) {
+        N_FC_PutLOSField(id, run->chunks[i], &run->fields[i]);
+    }
+    run->size = 0;
+}
+
+static bool n_request_path(void *nav_private, vec2_t xz_src, vec2_t xz_dest, int faction_id,
+                           vec3_t map_pos, enum nav_layer layer, dest_id_t *out_dest_id)
+{
+    PERF_ENTER();
+
+    struct nav_private *priv = nav_private;
+    struct map_resolution res;
     N_GetResolution(priv, &res);
 
     bool result;
@@ -1781,15 +2405,12 @@ static bool n_request_path(void *nav_private, vec2_t xz_src, vec2_t xz_dest, int
             .tile = (struct coord){dst_desc.tile_r, dst_desc.tile_c}
         };
 
-        struct flow_field ff;
-        id = N_FlowFieldID((struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, target, layer);
+        struct coord chunk = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
+        id = n_shared_path_field(priv, chunk, target, faction_id, layer, 
+            N_FlowFieldID(chunk, target, layer));
 
         if(!N_FC_ContainsFlowField(id)) {
-        
-            struct coord chunk = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
-            N_FlowFieldInit(chunk, &ff);
-            N_FlowFieldUpdate(chunk, priv, faction_id, layer, target, &ff);
-            N_FC_PutFlowField(id, &ff);
+            n_build_path_field(priv, chunk, target, faction_id, layer, id, NULL);
         }
 
         N_FC_PutDestFFMapping(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, id);
@@ -1893,6 +2514,7 @@ static bool n_request_path(void *nav_private, vec2_t xz_src, vec2_t xz_dest, int
     }
 
     struct coord prev_los_coord = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
+    struct los_run los_run = {.size = 0};
 
     /* Traverse the portal path _backwards_ and generate the required fields, 
      * If they are not already cached. Add the results to the fieldcache. */
@@ -1938,9 +2560,9 @@ static bool n_request_path(void *nav_private, vec2_t xz_src, vec2_t xz_dest, int
             }
         };
 
-        ff_id_t new_id = N_FlowFieldID(chunk_coord, target, layer);
+        ff_id_t own_id = N_FlowFieldID(chunk_coord, target, layer);
+        ff_id_t new_id = n_shared_path_field(priv, chunk_coord, target, faction_id, layer, own_id);
         ff_id_t exist_id;
-        struct flow_field ff;
 
         if(N_FC_GetDestFFMapping(ret, chunk_coord, &exist_id)
         && N_FC_ContainsFlowField(exist_id)) {
@@ -1954,77 +2576,60 @@ static bool n_request_path(void *nav_private, vec2_t xz_src, vec2_t xz_dest, int
              * 'islands' by unpathable barriers. 
              */
             const struct flow_field *exist_ff  = N_FC_FlowFieldAt(exist_id);
-            memcpy(&ff, exist_ff, sizeof(struct flow_field));
 
-            N_FlowFieldUpdate(chunk_coord, priv, faction_id, layer, target, &ff);
             /* We set the updated flow field for the new (least recently used) key. Since in 
              * this case more than one flowfield ID maps to the same field but we only keep 
              * one of the IDs, it may be possible that the same flowfield will be redundantly 
              * updated at a later time. However, this is largely inconsequential. 
+             * The merged field is only valid for this layer, so it is never put 
+             * in place of a field shared from another one.
              */
+            new_id = own_id;
             N_FC_PutDestFFMapping(ret, chunk_coord, new_id);
-            N_FC_PutFlowField(new_id, &ff);
+            n_build_path_field(priv, chunk_coord, target, faction_id, layer, new_id, exist_ff);
 
             goto ff_exists;
         }
 
         N_FC_PutDestFFMapping(ret, chunk_coord, new_id);
         if(!N_FC_ContainsFlowField(new_id)) {
-
-            N_FlowFieldInit(chunk_coord, &ff);
-            N_FlowFieldUpdate(chunk_coord, priv, faction_id, layer, target, &ff);
-            N_FC_PutFlowField(new_id, &ff);
+            n_build_path_field(priv, chunk_coord, target, faction_id, layer, new_id, NULL);
         }
 
     ff_exists:
-        assert(N_FC_ContainsFlowField(new_id));
+        assert(N_FC_ContainsFlowField(new_id) || field_work_pending(new_id));
         /* Reference field in the cache */
         (void)N_FC_FlowFieldAt(new_id);
 
-        if(!N_FC_ContainsLOSField(ret, chunk_coord)) {
+        /* Consecutive chunks missing a LOS field are gathered into a run and 
+         * built together. The run is cut short when the path reaches a chunk 
+         * that already has a field (or is revisited), since the chunks after it 
+         * will be seeded from that one. */
+        if(!N_FC_ContainsLOSField(ret, chunk_coord) && !los_run_contains(&los_run, chunk_coord)) {
 
             assert((abs(prev_los_coord.r - chunk_coord.r) 
                   + abs(prev_los_coord.c - chunk_coord.c)) == 1);
-            assert(N_FC_ContainsLOSField(ret, prev_los_coord));
-
-            const struct LOS_field *prev_los = N_FC_LOSFieldAt(ret, prev_los_coord);
-            assert(prev_los);
-            assert(prev_los->chunk.r == prev_los_coord.r && prev_los->chunk.c == prev_los_coord.c);
 
-            struct LOS_field lf;
-            N_LOSFieldCreate(ret, chunk_coord, dst_desc, priv, map_pos, &lf, prev_los);
-            N_FC_PutLOSField(ret, chunk_coord, &lf);
+            if(los_run.size == LOS_BATCH_SIZE) {
+                los_run_flush(priv, &los_run, ret, dst_desc, map_pos);
+            }
+            if(los_run.size == 0) {
+                los_run.prev = prev_los_coord;
+            }
+            los_run.chunks[los_run.size++] = chunk_coord;
+        }else{
+            los_run_flush(priv, &los_run, ret, dst_desc, map_pos);
         }
 
         prev_los_coord = chunk_coord;
     }
+    los_run_flush(priv, &los_run, ret, dst_desc, map_pos);
     vec_portal_destroy(&path);
 
     *out_dest_id = ret; 
     PERF_RETURN(true);
 }
 
-static struct result field_task(void *arg)
-{
-    size_t *index = arg;
-    struct field_work_in *in = &vec_AT(&s_field_work.in, *index);
-    struct field_work_out *out = &vec_AT(&s_field_work.out, *index);
-
-    N_FlowFieldInit(in->chunk, &out->field);
-    N_FlowFieldUpdate(in->chunk, in->priv, in->faction_id, in->layer, in->target, &out->field);
-
-    return NULL_RESULT;
-}
-
-static void field_join_work(void)
-{
-    for(int i = 0; i < s_field_work.ntasks; i++) {
-		while(!Sched_FutureIsReady(&s_field_work.futures[i])) {
-			Sched_RunSync(s_field_work.tids[i]);
-		}
-	}
-}
-
 vec2_t tile_center_location(struct nav_private *priv, vec3_t map_pos, struct tile_desc td)
 {
     struct map_resolution res;
@@ -2041,6 +2646,20 @@ vec2_t tile_center_location(struct nav_private *priv, vec3_t map_pos, struct til
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static void n_write_perf_stats(perf_stat_cb_t emit, void *arg)
+{
+    struct fc_stats stats;
+    N_FC_GetStats(&stats);
+
+    emit("nav.path_requests", kh_size(s_path_request_keys), arg);
+    emit("nav.flow_fields_cached", stats.flow_used, arg);
+    emit("nav.flow_hit_rate", stats.flow_hit_rate, arg);
+    emit("nav.los_fields_cached", stats.los_used, arg);
+    emit("nav.los_hit_rate", stats.los_hit_rate, arg);
+    emit("nav.grid_paths_cached", stats.grid_path_used, arg);
+    emit("nav.grid_path_hit_rate", stats.grid_path_hit_rate, arg);
+}
+
 bool N_Init(void)
 {
     if(!N_FC_Init())
@@ -2052,9 +2671,17 @@ bool N_Init(void)
     }
 
     memset(&s_field_work, 0, sizeof(s_field_work));
+    Sched_TaskGroupInit(&s_field_work.group);
     if(!stalloc_init(&s_field_work.mem))
         goto fail_alloc;
 
+    if((s_path_request_keys = kh_init(req)) == NULL)
+        goto fail_alloc;
+
+    if((s_validated_fields = kh_init(req)) == NULL)
+        goto fail_alloc;
+
+    Perf_AddStatsSource(n_write_perf_stats);
     return true;
 
 fail_alloc:
@@ -2067,7 +2694,7 @@ void N_Update(void *nav_private)
     PERF_ENTER();
 
     struct nav_private *priv = nav_private;
-    N_FC_InvalidateDynamicSurroundFields();
+    s_occupancy_generation++;
 
     for(int layer = 0; layer < NAV_LAYER_MAX; layer++) {
     
@@ -2085,20 +2712,24 @@ void N_Update(void *nav_private)
             struct coord curr = (struct coord){ key >> 16, key & 0xffff };
 
             N_FC_InvalidateAllAtChunk(curr, layer);
-            N_FC_InvalidateNeighbourEnemySeekFields(priv->width, priv->height, curr, layer);
+            N_FG_InvalidateAllAtChunk(curr, layer);
+            N_FC_InvalidateNeighbourPaddedFields(priv->width, priv->height, curr, layer);
 
             struct nav_chunk *chunk = &priv->chunks[layer]
                                                    [IDX(curr.r, priv->width, curr.c)];
-            int nflipped = n_update_edge_states(chunk);
+            uint64_t flipped = n_update_edge_states(chunk);
 
-            if(nflipped) {
+            if(flipped) {
                 components_dirty = true;
-                N_FC_InvalidateAllThroughChunk(curr, layer);
+                N_FC_InvalidateAllThroughPortals(chunk, curr, layer, flipped);
+                N_FG_InvalidateAll();
             }
         }
 
         if(components_dirty) {
             n_update_components(priv, layer);
+        }else if(kh_size(set) > 0) {
+            AStar_InvalidatePortalGraph(layer);
         }
 
         kh_clear(coord, set);
@@ -2109,11 +2740,24 @@ void N_Update(void *nav_private)
 
 void N_Shutdown(void)
 {
+    Perf_RemoveStatsSource(n_write_perf_stats);
     field_join_work();
     stalloc_destroy(&s_field_work.mem);
+    kh_destroy(req, s_path_request_keys);
+    kh_destroy(req, s_validated_fields);
     for(int i = 0; i < NAV_LAYER_MAX; i++) {
         kh_destroy(coord, s_dirty_chunks[i]);
     }
+    free(s_occupancy);
+    s_occupancy = NULL;
+    s_occupancy_nchunks = 0;
+    s_occupancy_priv = NULL;
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+        PF_FREE(s_buildable[i]);
+    }
+    s_buildable_nchunks = 0;
+    s_buildable_priv = NULL;
+    AStar_Shutdown();
     N_FC_Shutdown();
 }
 
@@ -2124,10 +2768,52 @@ void N_ClearState(void)
         s_local_islands_dirty[i] = false;
         kh_clear(coord, s_dirty_chunks[i]);
     }
+    N_FG_Clear();
+    kh_clear(req, s_validated_fields);
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+        AStar_InvalidatePortalGraph(i);
+    }
     N_FC_ClearAll();
     N_FC_ClearStats();
 }
 
+static size_t n_travel_costs_size(void)
+{
+    return MAX_PORTALS_PER_CHUNK * FIELD_RES_R * FIELD_RES_C * sizeof(float);
+}
+
+static bool n_alloc_chunks(struct nav_private *priv, size_t w, size_t h)
+{
+    memset(priv->chunks, 0, sizeof(priv->chunks));
+    memset(priv->travel_costs, 0, sizeof(priv->travel_costs));
+    priv->width = w;
+    priv->height = h;
+
+    priv->faction_counts = (struct kh_fcount_s*)kh_init(fcount);
+    if(!priv->faction_counts)
+        return false;
+
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+        priv->chunks[i] = pf_large_alloc(MEM_TAG_NAV, w * h * sizeof(struct nav_chunk), false);
+        if(!priv->chunks[i])
+            return false;
+    }
+
+    for(int i = 0; i < NAV_DOMAIN_MAX; i++) {
+        priv->travel_costs[i] = pf_large_alloc(MEM_TAG_NAV, w * h * n_travel_costs_size(), false);
+        if(!priv->travel_costs[i])
+            return false;
+    }
+
+    for(int layer = 0; layer < NAV_LAYER_MAX; layer++) {
+        unsigned char *base = (unsigned char*)priv->travel_costs[N_LAYER_DOMAIN(layer)];
+        for(int i = 0; i < w * h; i++) {
+            priv->chunks[layer][i].portal_travel_costs = (void*)(base + i * n_travel_costs_size());
+        }
+    }
+    return true;
+}
+
 void *N_BuildForMapData(size_t w, size_t h, size_t chunk_w, size_t chunk_h,
                         const struct tile **chunk_tiles, bool update)
 {
@@ -2136,15 +2822,8 @@ void *N_BuildForMapData(size_t w, size_t h, size_t chunk_w, size_t chunk_h,
     if(!ret)
         goto fail_alloc;
 
-    memset(ret->chunks, 0, sizeof(ret->chunks));
-    for(int i = 0; i < NAV_LAYER_MAX; i++) {
-        ret->chunks[i] = malloc(w * h * sizeof(struct nav_chunk));
-        if(!ret->chunks[i])
-            goto fail_alloc_chunks;
-    }
-
-    ret->width = w;
-    ret->height = h;
+    if(!n_alloc_chunks(ret, w, h))
+        goto fail_alloc_chunks;
 
     assert(FIELD_RES_R >= chunk_h && FIELD_RES_R % chunk_h == 0);
     assert(FIELD_RES_C >= chunk_w && FIELD_RES_C % chunk_w == 0);
@@ -2171,7 +2850,7 @@ void *N_BuildForMapData(size_t w, size_t h, size_t chunk_w, size_t chunk_h,
                 }
             }}
             memset(curr_chunk->blockers, 0, sizeof(curr_chunk->blockers));
-            memset(curr_chunk->factions, 0, sizeof(curr_chunk->factions));
+            memset(curr_chunk->faction_mask, 0, sizeof(curr_chunk->faction_mask));
         }}
 
         n_make_cliff_edges(ret, chunk_tiles, layer, chunk_w, chunk_h);
@@ -2188,17 +2867,277 @@ fail_alloc:
     return NULL;
 }
 
+/* A 64-bit FNV-1a hash of the tile attributes which the baked navigation
+ * data is derived from. 
+ */
+static uint64_t n_baked_checksum(size_t w, size_t h, size_t chunk_w, size_t chunk_h,
+                                 const struct tile **chunk_tiles)
+{
+    uint64_t ret = 0xcbf29ce484222325ull;
+    int32_t words[] = {w, h, chunk_w, chunk_h};
+
+    for(int i = 0; i < ARR_SIZE(words); i++) {
+        ret = (ret ^ (uint32_t)words[i]) * 0x100000001b3ull;
+    }
+
+    for(int i = 0; i < w * h; i++) {
+    for(int j = 0; j < chunk_w * chunk_h; j++) {
+
+        const struct tile *curr = &chunk_tiles[i][j];
+        int32_t attrs[] = {curr->pathable, curr->type, curr->base_height, curr->ramp_height};
+
+        for(int k = 0; k < ARR_SIZE(attrs); k++) {
+            ret = (ret ^ (uint32_t)attrs[k]) * 0x100000001b3ull;
+        }
+    }}
+    return ret;
+}
+
+static bool n_write_i32(SDL_RWops *stream, int32_t val)
+{
+    return (SDL_RWwrite(stream, &val, sizeof(val), 1) == 1);
+}
+
+static bool n_read_i32(SDL_RWops *stream, int32_t *out)
+{
+    return (SDL_RWread(stream, out, sizeof(*out), 1) == 1);
+}
+
+/* Portals are referenced by their index in the owning chunk */
+static int n_portal_index(const struct nav_private *priv, enum nav_layer layer, 
+                          const struct portal *port)
+{
+    const struct nav_chunk *chunk = 
+        &priv->chunks[layer][IDX(port->chunk.r, priv->width, port->chunk.c)];
+    return port - chunk->portals;
+}
+
+static bool n_write_baked_chunk(SDL_RWops *stream, const struct nav_private *priv, 
+                                enum nav_layer layer, const struct nav_chunk *chunk)
+{
+    if(!SDL_RWwrite(stream, chunk->cost_base, sizeof(chunk->cost_base), 1))
+        return false;
+    if(!SDL_RWwrite(stream, chunk->islands, sizeof(chunk->islands), 1))
+        return false;
+    if(!n_write_i32(stream, chunk->num_portals))
+        return false;
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *port = &chunk->portals[i];
+        assert(port->connected);
+        int32_t words[] = {
+            port->component_id,
+            port->chunk.r,           port->chunk.c,
+            port->endpoints[0].r,    port->endpoints[0].c,
+            port->endpoints[1].r,    port->endpoints[1].c,
+            port->connected->chunk.r, port->connected->chunk.c,
+            n_portal_index(priv, layer, port->connected),
+            port->num_neighbours
+        };
+        for(int j = 0; j < ARR_SIZE(words); j++) {
+            if(!n_write_i32(stream, words[j]))
+                return false;
+        }
+
+        for(int j = 0; j < port->num_neighbours; j++) {
+
+            const struct edge *edge = &port->edges[j];
+            if(!n_write_i32(stream, edge->es))
+                return false;
+            if(!n_write_i32(stream, edge->neighbour - chunk->portals))
+                return false;
+            if(!SDL_RWwrite(stream, &edge->cost, sizeof(edge->cost), 1))
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool n_read_baked_chunk(SDL_RWops *stream, struct nav_private *priv, 
+                               enum nav_layer layer, struct nav_chunk *chunk)
+{
+    int32_t num_portals;
+    if(!SDL_RWread(stream, chunk->cost_base, sizeof(chunk->cost_base), 1))
+        return false;
+    if(!SDL_RWread(stream, chunk->islands, sizeof(chunk->islands), 1))
+        return false;
+    if(!n_read_i32(stream, &num_portals))
+        return false;
+    if(num_portals < 0 || num_portals > MAX_PORTALS_PER_CHUNK)
+        return false;
+    chunk->num_portals = num_portals;
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        struct portal *port = &chunk->portals[i];
+        int32_t words[11];
+        for(int j = 0; j < ARR_SIZE(words); j++) {
+            if(!n_read_i32(stream, &words[j]))
+                return false;
+        }
+
+        int32_t conn_r = words[7], conn_c = words[8], conn_idx = words[9];
+        int32_t num_neighbours = words[10];
+
+        if(conn_r < 0 || conn_r >= priv->height || conn_c < 0 || conn_c >= priv->width)
+            return false;
+        if(conn_idx < 0 || conn_idx >= MAX_PORTALS_PER_CHUNK)
+            return false;
+        if(num_neighbours < 0 || num_neighbours > MAX_PORTALS_PER_CHUNK-1)
+            return false;
+
+        port->component_id = words[0];
+        port->chunk = (struct coord){words[1], words[2]};
+        port->endpoints[0] = (struct coord){words[3], words[4]};
+        port->endpoints[1] = (struct coord){words[5], words[6]};
+        port->connected = &priv->chunks[layer][IDX(conn_r, priv->width, conn_c)].portals[conn_idx];
+        port->num_neighbours = num_neighbours;
+
+        for(int j = 0; j < port->num_neighbours; j++) {
+
+            int32_t es, neighb_idx;
+            struct edge *edge = &port->edges[j];
+            if(!n_read_i32(stream, &es) || !n_read_i32(stream, &neighb_idx))
+                return false;
+            if(neighb_idx < 0 || neighb_idx >= chunk->num_portals)
+                return false;
+            if(!SDL_RWread(stream, &edge->cost, sizeof(edge->cost), 1))
+                return false;
+            edge->es = es;
+            edge->neighbour = &chunk->portals[neighb_idx];
+        }
+    }
+
+    memset(chunk->blockers, 0, sizeof(chunk->blockers));
+    memset(chunk->faction_mask, 0, sizeof(chunk->faction_mask));
+    if(N_LAYER_IS_BASE(layer)) {
+        n_build_portal_travel_index(chunk);
+    }
+    return true;
+}
+
 void N_FreePrivate(void *nav_private)
 {
     assert(nav_private);
     struct nav_private *priv = nav_private;
 
+    if(s_occupancy_priv == priv) {
+        s_occupancy_priv = NULL;
+    }
+
     for(int i = 0; i < NAV_LAYER_MAX; i++) {
-        free(priv->chunks[i]);
+        AStar_InvalidatePortalGraph(i);
+        pf_large_free(MEM_TAG_NAV, priv->chunks[i], 
+            priv->width * priv->height * sizeof(struct nav_chunk));
+    }
+    for(int i = 0; i < NAV_DOMAIN_MAX; i++) {
+        pf_large_free(MEM_TAG_NAV, priv->travel_costs[i], 
+            priv->width * priv->height * n_travel_costs_size());
+    }
+    if(priv->faction_counts) {
+        khash_t(fcount) *counts = (khash_t(fcount)*)priv->faction_counts;
+        kh_destroy(fcount, counts);
     }
     free(nav_private);
 }
 
+bool N_SaveBaked(const void *nav_private, size_t chunk_w, size_t chunk_h,
+                 const struct tile **chunk_tiles, SDL_RWops *stream)
+{
+    const struct nav_private *priv = nav_private;
+    uint64_t checksum = n_baked_checksum(priv->width, priv->height, 
+        chunk_w, chunk_h, chunk_tiles);
+
+    /* The chunks are staged in memory so that the size of the section, 
+     * which lets the loader skip over stale data, can be written ahead 
+     * of them without seeking back. Not all streams support overwriting 
+     * data that was already written. */
+    SDL_RWops *body = PFSDL_VectorRWOps();
+    if(!body)
+        return false;
+
+    bool ret = false;
+    for(int layer = 0; layer < NAV_LAYER_MAX; layer++) {
+        for(int i = 0; i < priv->width * priv->height; i++) {
+            if(!n_write_baked_chunk(body, priv, layer, &priv->chunks[layer][i]))
+                goto out;
+        }
+    }
+
+    Sint64 body_size = SDL_RWsize(body);
+    Sint64 size = 3 * sizeof(int32_t) + sizeof(checksum) + body_size;
+    if(body_size < 0 || size > INT32_MAX)
+        goto out;
+
+    if(!n_write_i32(stream, BAKED_MAGIC))
+        goto out;
+    if(!n_write_i32(stream, BAKED_VERSION))
+        goto out;
+    if(!n_write_i32(stream, size))
+        goto out;
+    if(!SDL_RWwrite(stream, &checksum, sizeof(checksum), 1))
+        goto out;
+    if(body_size && !SDL_RWwrite(stream, PFSDL_VectorRWOpsRaw(body), body_size, 1))
+        goto out;
+    ret = true;
+
+out:
+    SDL_RWclose(body);
+    return ret;
+}
+
+void *N_LoadBaked(size_t w, size_t h, size_t chunk_w, size_t chunk_h,
+                  const struct tile **chunk_tiles, SDL_RWops *stream)
+{
+    int32_t magic, version, size;
+    uint64_t checksum;
+
+    Sint64 begin = SDL_RWtell(stream);
+    if(begin < 0)
+        return NULL;
+
+    if(!n_read_i32(stream, &magic) || magic != BAKED_MAGIC)
+        return NULL;
+    if(!n_read_i32(stream, &version) || !n_read_i32(stream, &size))
+        return NULL;
+    if(!SDL_RWread(stream, &checksum, sizeof(checksum), 1))
+        return NULL;
+
+    /* Skip over the data if it doesn't match the map */
+    if(version != BAKED_VERSION 
+    || checksum != n_baked_checksum(w, h, chunk_w, chunk_h, chunk_tiles)) {
+        SDL_RWseek(stream, begin + size, RW_SEEK_SET);
+        return NULL;
+    }
+
+    struct nav_private *ret;
+    ret = malloc(sizeof(struct nav_private));
+    if(!ret)
+        goto fail_alloc;
+
+    if(!n_alloc_chunks(ret, w, h))
+        goto fail_read;
+
+    for(int layer = 0; layer < NAV_LAYER_MAX; layer++) {
+        for(int i = 0; i < w * h; i++) {
+            if(!n_read_baked_chunk(stream, ret, layer, &ret->chunks[layer][i]))
+                goto fail_read;
+        }
+        n_update_local_island_field(ret, layer);
+    }
+
+    if(SDL_RWtell(stream) != begin + size)
+        goto fail_read;
+    return ret;
+
+fail_read:
+    N_FreePrivate(ret);
+fail_alloc:
+    SDL_RWseek(stream, begin + size, RW_SEEK_SET);
+    return NULL;
+}
+
 void N_RenderOverlayText(const char *text, vec4_t map_pos, 
                          mat4x4_t *model, mat4x4_t *view, mat4x4_t *proj)
 {
@@ -2322,7 +3261,7 @@ void N_RenderPathFlowField(void *nav_private, const struct map *map,
             square_x - square_x_len / 2.0f,
             square_z + square_z_len / 2.0f
         };
-        dirs_buff[r * FIELD_RES_C + c] = N_FlowDir(ff->field[r][c].dir_idx);
+        dirs_buff[r * FIELD_RES_C + c] = N_FlowDir(N_FlowFieldDir(ff, r, c));
     }}
 
     size_t count = FIELD_RES_R * FIELD_RES_C;
@@ -2377,7 +3316,7 @@ void N_RenderLOSField(void *nav_private, const struct map *map, mat4x4_t *chunk_
         *corners_base++ = (vec2_t){square_x - square_x_len, square_z + square_z_len};
         *corners_base++ = (vec2_t){square_x - square_x_len, square_z};
 
-        *colors_base++ = lf->field[r][c].visible ? (vec3_t){1.0f, 1.0f, 0.0f}
+        *colors_base++ = N_LOSFieldVisible(lf, r, c) ? (vec3_t){1.0f, 1.0f, 0.0f}
                                                  : (vec3_t){0.0f, 0.0f, 0.0f};
     }}
 
@@ -2446,14 +3385,14 @@ void N_RenderEnemySeekField(void *nav_private, const struct map *map, mat4x4_t *
             square_x - square_x_len / 2.0f,
             square_z + square_z_len / 2.0f
         };
-        dirs_buff[r * FIELD_RES_C + c] = N_FlowDir(ff->field[r][c].dir_idx);
+        dirs_buff[r * FIELD_RES_C + c] = N_FlowDir(N_FlowFieldDir(ff, r, c));
 
         *corners_base++ = (vec2_t){square_x, square_z};
         *corners_base++ = (vec2_t){square_x, square_z + square_z_len};
         *corners_base++ = (vec2_t){square_x - square_x_len, square_z + square_z_len};
         *corners_base++ = (vec2_t){square_x - square_x_len, square_z};
 
-        *colors_base++ = ff->field[r][c].dir_idx == FD_NONE ? (vec3_t){1.0f, 0.0f, 0.0f}
+        *colors_base++ = N_FlowFieldDir(ff, r, c) == FD_NONE ? (vec3_t){1.0f, 0.0f, 0.0f}
                                                             : (vec3_t){0.0f, 1.0f, 0.0f};
     }}
 
@@ -2524,7 +3463,7 @@ void N_RenderSurroundField(void *nav_private, const struct map *map, mat4x4_t *c
             square_x - square_x_len / 2.0f,
             square_z + square_z_len / 2.0f
         };
-        dirs_buff[r * FIELD_RES_C + c] = N_FlowDir(ff->field[r][c].dir_idx);
+        dirs_buff[r * FIELD_RES_C + c] = N_FlowDir(N_FlowFieldDir(ff, r, c));
     }}
 
     size_t count = FIELD_RES_R * FIELD_RES_C;
@@ -2607,8 +3546,6 @@ void N_RenderBuildableTiles(void *nav_private, const struct map *map,
     assert(Sched_UsingBigStack());
 
     struct nav_private *priv = nav_private;
-    const struct nav_chunk *chunk = &priv->chunks[layer]
-                                                 [IDX(chunk_r, priv->width, chunk_c)];
 
     const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
     const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
@@ -2617,18 +3554,9 @@ void N_RenderBuildableTiles(void *nav_private, const struct map *map,
     N_GetResolution(priv, &res);
     vec3_t map_pos = M_GetPos(map);
 
-    struct map_resolution tile_res;
-    M_GetResolution(map, &tile_res);
-
     struct tile_desc tds[2048];
     size_t ntiles = M_Tile_AllUnderObj(map_pos, res, obb, tds, ARR_SIZE(tds));
 
-    khash_t(td) *tileset = n_moving_entities_tileset(priv, map_pos, obb);
-    assert(tileset);
-
-    khash_t(td) *building_tileset = n_non_collidable_buildings_tileset(priv, map_pos, obb);
-    assert(building_tileset);
-
     vec2_t corners_buff[4 * FIELD_RES_R * FIELD_RES_C];
     vec3_t colors_buff[FIELD_RES_R * FIELD_RES_C];
 
@@ -2653,42 +3581,13 @@ void N_RenderBuildableTiles(void *nav_private, const struct map *map,
         *corners_base++ = (vec2_t){square_x - square_x_len, square_z + square_z_len};
         *corners_base++ = (vec2_t){square_x - square_x_len, square_z};
 
-        vec4_t center_homo = (vec4_t) {
-            square_x - square_x_len / 2.0,
-            0.0,
-            square_z + square_z_len / 2.0,
-            1.0
-        };
-        vec4_t ws_center_homo;
-        PFM_Mat4x4_Mult4x1(chunk_model, &center_homo, &ws_center_homo);
-        ws_center_homo.x /= ws_center_homo.w;
-        ws_center_homo.z /= ws_center_homo.w;
-
-        struct tile_desc map_td = (struct tile_desc){
-            tds[i].chunk_r,
-            tds[i].chunk_c,
-            tds[i].tile_r / ((float)res.tile_h) * tile_res.tile_h,
-            tds[i].tile_c / ((float)res.tile_w) * tile_res.tile_w
-        };
-        struct tile *tile = NULL;
-        M_TileForDesc(map, map_td, &tile);
-        assert(tile);
-        bool shore = (tile->ramp_height > 1) && (tile->base_height < 0);
-
-        if((chunk->blockers [tds[i].tile_r][tds[i].tile_c]
-        || ((allow_shore ? !shore : true) && chunk->cost_base[tds[i].tile_r][tds[i].tile_c] == COST_IMPASSABLE)
-        || !G_Fog_PlayerExplored((vec2_t){ws_center_homo.x, ws_center_homo.z})
-        || (kh_get(td, tileset, td_key(tds + i)) != kh_end(tileset))
-        || (kh_get(td, building_tileset, td_key(tds + i)) != kh_end(building_tileset))) 
-        || blocked) {
+        if(blocked || !n_tile_buildable(priv, map, layer, allow_shore, tds[i])) {
             *colors_base++ = (vec3_t){1.0f, 0.0f, 0.0f};
         }else{
             *colors_base++ = (vec3_t){0.0f, 1.0f, 0.0f};
         }
         count++;
     }
-    free(tileset);
-    free(building_tileset);
 
     bool on_water_surface = true;
     R_PushCmd((struct rcmd){
@@ -2854,6 +3753,7 @@ void N_CutoutStaticObject(void *nav_private, vec3_t map_pos, const struct obb *o
 
             priv->chunks[layer][IDX(tds[i].chunk_r, priv->width, tds[i].chunk_c)]
                 .cost_base[tds[i].tile_r][tds[i].tile_c] = COST_IMPASSABLE;
+            n_buildable_invalidate(priv, layer, tds[i].chunk_r, tds[i].chunk_c);
         }
     }
 }
@@ -2933,8 +3833,12 @@ vec2_t N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
         N_FC_GetDestFFMapping(id, (struct coord){tile.chunk_r, tile.chunk_c}, &ffid);
     }
 
+    /* Hold still until the field arrives from the GPU */
+    if(!N_FC_ContainsFlowField(ffid) && N_FG_Pending(ffid))
+        return (vec2_t){0.0f};
+
     const struct flow_field *ff = N_FC_FlowFieldAt(ffid);
-    if(!ff || ff->field[tile.tile_r][tile.tile_c].dir_idx == FD_NONE) {
+    if(!ff || N_FlowFieldDir(ff, tile.tile_r, tile.tile_c) == FD_NONE) {
 
         dest_id_t ret;
         bool result = n_request_path(nav_private, curr_pos, xz_dest, 
@@ -2954,7 +3858,7 @@ vec2_t N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
      *      would have updated the flow field with a valid direction for
      *      the current tile.
      */
-    if(ff->field[tile.tile_r][tile.tile_c].dir_idx != FD_NONE)
+    if(N_FlowFieldDir(ff, tile.tile_r, tile.tile_c) != FD_NONE)
         goto ff_found;
 
     const struct nav_chunk *chunk = 
@@ -2996,10 +3900,52 @@ vec2_t N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
 
 ff_found:
     assert(ff);
-    dir_idx = ff->field[tile.tile_r][tile.tile_c].dir_idx;
+    dir_idx = N_FlowFieldDir(ff, tile.tile_r, tile.tile_c);
     return N_FlowDir(dir_idx);
 }
 
+bool N_TryDesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, void *nav_private, 
+                                   vec3_t map_pos, vec2_t *out)
+{
+    struct nav_private *priv = nav_private;
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
+
+    struct tile_desc tile;
+    bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &tile);
+    assert(result);
+
+    /* Any of the cases which need the fields to be built or patched up 
+     * are left to 'N_DesiredPointSeekVelocity' */
+    ff_id_t ffid;
+    if(!N_FC_PeekDestFFMapping(id, (struct coord){tile.chunk_r, tile.chunk_c}, &ffid))
+        return false;
+
+    const struct flow_field *ff = N_FC_PeekFlowField(ffid);
+    if(!ff)
+        return false;
+
+    enum flow_dir dir = N_FlowFieldDir(ff, tile.tile_r, tile.tile_c);
+    if(dir == FD_NONE)
+        return false;
+
+    *out = N_FlowDir(dir);
+    return true;
+}
+
+void N_TouchDestFields(dest_id_t id, vec2_t curr_pos, void *nav_private, vec3_t map_pos)
+{
+    struct nav_private *priv = nav_private;
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
+
+    struct tile_desc tile;
+    bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &tile);
+    assert(result);
+
+    N_FC_TouchDest(id, (struct coord){tile.chunk_r, tile.chunk_c});
+}
+
 vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, enum nav_layer layer, 
                                   vec3_t map_pos, int faction_id)
 {
@@ -3026,11 +3972,13 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, enum nav_l
     ff_id_t ffid = N_FlowFieldID(chunk, target, layer);
     struct flow_field ff;
 
-    if(!N_FC_ContainsFlowField(ffid)) {
+    const struct flow_field *cached = N_FC_PeekFlowField(ffid);
+    if(!cached || !n_padded_field_current(priv, layer, chunk, target, ffid, cached)) {
 
         N_FlowFieldInit(chunk, &ff);
         N_FlowFieldUpdate(chunk, priv, faction_id, layer, target, &ff);
         N_FC_PutFlowField(ffid, &ff);
+        n_mark_padded_field_current(ffid);
 
         assert(N_FC_ContainsFlowField(ffid));
     }
@@ -3041,7 +3989,7 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, enum nav_l
     const struct nav_chunk *nchunk = 
         &priv->chunks[layer][IDX(curr_tile.chunk_r, priv->width, curr_tile.chunk_c)];
     uint16_t local_iid = nchunk->local_islands[curr_tile.tile_r][curr_tile.tile_c];
-    int dir_idx = pff->field[curr_tile.tile_r][curr_tile.tile_c].dir_idx;
+    int dir_idx = N_FlowFieldDir(pff, curr_tile.tile_r, curr_tile.tile_c);
 
     if(dir_idx != FD_NONE)
         goto ff_found;
@@ -3068,7 +4016,7 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, enum nav_l
     /* We are on an island that is cut off by blockers or impassable terrain from any 
      * valid enemies - do our best to get as close to the 'action' as possible.
      */
-    dir_idx = pff->field[curr_tile.tile_r][curr_tile.tile_c].dir_idx;
+    dir_idx = N_FlowFieldDir(pff, curr_tile.tile_r, curr_tile.tile_c);
     if(dir_idx == FD_NONE) {
 
         struct flow_field exist_ff = *pff;
@@ -3080,51 +4028,40 @@ vec2_t N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private, enum nav_l
     }
 
 ff_found:
-    dir_idx = pff->field[curr_tile.tile_r][curr_tile.tile_c].dir_idx;
+    dir_idx = N_FlowFieldDir(pff, curr_tile.tile_r, curr_tile.tile_c);
     PERF_RETURN(N_FlowDir(dir_idx));
 }
 
-vec2_t N_DesiredSurroundVelocity(vec2_t curr_pos, void *nav_private, enum nav_layer layer, 
-                                 vec3_t map_pos, uint32_t ent, int faction_id)
+/* Flow towards the nearest of the tiles occupied by the target entities. If
+ * the cached field is for a different set of targets, it is rebuilt.
+ */
+static vec2_t n_desired_padded_field_velocity(struct nav_private *priv, enum nav_layer layer,
+                                              struct tile_desc curr_tile, 
+                                              struct field_target target, int faction_id)
 {
-    PERF_ENTER();
-    struct nav_private *priv = nav_private;
-    struct map_resolution res;
-    N_GetResolution(priv, &res);
-
-    n_update_dirty_local_islands(nav_private, layer);
-
-    struct tile_desc curr_tile;
-    bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &curr_tile);
-    assert(result);
-
     struct coord chunk = (struct coord){curr_tile.chunk_r, curr_tile.chunk_c};
-
-    struct field_target target = (struct field_target){
-        .type = TARGET_ENTITY,
-        .ent.target = ent,
-        .ent.map_pos = map_pos,
-    };
-
     ff_id_t ffid = N_FlowFieldID(chunk, target, layer);
     struct flow_field ff;
 
-    if(!N_FC_ContainsFlowField(ffid)) {
+    const struct flow_field *pff = N_FC_FlowFieldAt(ffid);
+    if(!pff || (target.type == TARGET_FACTION_TARGETS 
+             && pff->target.targets.key != target.targets.key)
+            || !n_padded_field_current(priv, layer, chunk, target, ffid, pff)) {
 
         N_FlowFieldInit(chunk, &ff);
         N_FlowFieldUpdate(chunk, priv, faction_id, layer, target, &ff);
         N_FC_PutFlowField(ffid, &ff);
+        n_mark_padded_field_current(ffid);
 
         assert(N_FC_ContainsFlowField(ffid));
+        pff = N_FC_FlowFieldAt(ffid);
     }
-
-    const struct flow_field *pff = N_FC_FlowFieldAt(ffid);
     assert(pff);
 
     const struct nav_chunk *nchunk = 
         &priv->chunks[layer][IDX(curr_tile.chunk_r, priv->width, curr_tile.chunk_c)];
     uint16_t local_iid = nchunk->local_islands[curr_tile.tile_r][curr_tile.tile_c];
-    int dir_idx = pff->field[curr_tile.tile_r][curr_tile.tile_c].dir_idx;
+    int dir_idx = N_FlowFieldDir(pff, curr_tile.tile_r, curr_tile.tile_c);
 
     /* The entity has somehow ended up on an impassable tile. One example
      * where this can happen is if an adjacent entity 'stops' and occupies 
@@ -3133,44 +4070,124 @@ vec2_t N_DesiredSurroundVelocity(vec2_t curr_pos, void *nav_private, enum nav_la
      */
     if(local_iid == ISLAND_NONE) {
 
-        struct flow_field exist_ff = *pff;
-        struct coord curr = (struct coord){curr_tile.tile_r, curr_tile.tile_c};
+        struct flow_field exist_ff = *pff;
+        struct coord curr = (struct coord){curr_tile.tile_r, curr_tile.tile_c};
+
+        N_FlowFieldUpdateToNearestPathable(priv, layer, chunk, curr, faction_id, &exist_ff);
+        N_FC_PutFlowField(ffid, &exist_ff);
+
+        pff = N_FC_FlowFieldAt(ffid);
+        goto ff_found;
+    }
+
+    /* We are on an island that is cut off by blockers or impassable terrain from any 
+     * valid targets - do our best to get as close to the 'action' as possible.
+     */
+    if(dir_idx == FD_NONE) {
+
+        struct flow_field exist_ff = *pff;
+        N_FlowFieldUpdateIslandToNearest(local_iid, priv, layer, faction_id, &exist_ff);
+        N_FC_PutFlowField(ffid, &exist_ff);
+
+        pff = N_FC_FlowFieldAt(ffid);
+        goto ff_found;
+    }
+
+ff_found:
+    dir_idx = N_FlowFieldDir(pff, curr_tile.tile_r, curr_tile.tile_c);
+    return N_FlowDir(dir_idx);
+}
+
+vec2_t N_DesiredSurroundVelocity(vec2_t curr_pos, void *nav_private, enum nav_layer layer, 
+                                 vec3_t map_pos, uint32_t ent, int faction_id)
+{
+    PERF_ENTER();
+    struct nav_private *priv = nav_private;
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
+
+    n_update_dirty_local_islands(nav_private, layer);
+
+    struct tile_desc curr_tile;
+    bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &curr_tile);
+    assert(result);
+
+    struct field_target target = (struct field_target){
+        .type = TARGET_ENTITY,
+        .ent.target = ent,
+        .ent.map_pos = map_pos,
+    };
+    PERF_RETURN(n_desired_padded_field_velocity(priv, layer, curr_tile, target, faction_id));
+}
 
-        N_FlowFieldUpdateToNearestPathable(priv, layer, 
-            (struct coord){curr_tile.chunk_r, curr_tile.chunk_c},
-            curr, faction_id, &exist_ff);
-        N_FC_PutFlowField(ffid, &exist_ff);
+vec2_t N_DesiredFactionTargetsVelocity(vec2_t curr_pos, void *nav_private, enum nav_layer layer, 
+                                       vec3_t map_pos, int faction_id)
+{
+    PERF_ENTER();
+    struct nav_private *priv = nav_private;
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
 
-        pff = N_FC_FlowFieldAt(ffid);
-        goto ff_found;
-    }
+    n_update_dirty_local_islands(nav_private, layer);
 
-    /* We are on an island that is cut off by blockers or impassable terrain from any 
-     * valid enemies - do our best to get as close to the 'action' as possible.
-     */
-    dir_idx = pff->field[curr_tile.tile_r][curr_tile.tile_c].dir_idx;
-    if(dir_idx == FD_NONE) {
+    struct tile_desc curr_tile;
+    bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &curr_tile);
+    assert(result);
 
-        struct flow_field exist_ff = *pff;
-        N_FlowFieldUpdateIslandToNearest(local_iid, priv, layer, faction_id, &exist_ff);
-        N_FC_PutFlowField(ffid, &exist_ff);
+    struct field_target target = (struct field_target){
+        .type = TARGET_FACTION_TARGETS,
+        .targets.faction_id = faction_id,
+        .targets.key = s_faction_targets[faction_id].key,
+        .targets.map_pos = map_pos,
+    };
+    PERF_RETURN(n_desired_padded_field_velocity(priv, layer, curr_tile, target, faction_id));
+}
 
-        pff = N_FC_FlowFieldAt(ffid);
-        goto ff_found;
+void N_SetFactionTargets(int faction_id, const uint32_t *targets, size_t ntargets)
+{
+    assert(faction_id >= 0 && faction_id < MAX_FACTIONS);
+    struct faction_targets *ft = &s_faction_targets[faction_id];
+
+    ntargets = MIN(ntargets, MAX_FACTION_TARGETS);
+    memcpy(ft->targets, targets, ntargets * sizeof(uint32_t));
+    qsort(ft->targets, ntargets, sizeof(uint32_t), compare_uids);
+
+    /* Drop the duplicates and identify the set by its' contents, so
+     * that it keeps using the same fields while it doesn't change */
+    size_t nunique = 0;
+    uint32_t key = 2166136261u;
+    for(int i = 0; i < ntargets; i++) {
+        if(nunique > 0 && ft->targets[nunique - 1] == ft->targets[i])
+            continue;
+        ft->targets[nunique++] = ft->targets[i];
+        key = (key ^ ft->targets[i]) * 16777619u;
     }
+    ft->ntargets = nunique;
+    ft->key = key;
+}
 
-ff_found:
-    dir_idx = pff->field[curr_tile.tile_r][curr_tile.tile_c].dir_idx;
-    PERF_RETURN(N_FlowDir(dir_idx));
+const uint32_t *N_FactionTargets(int faction_id, size_t *out_ntargets)
+{
+    assert(faction_id >= 0 && faction_id < MAX_FACTIONS);
+    *out_ntargets = s_faction_targets[faction_id].ntargets;
+    return s_faction_targets[faction_id].targets;
 }
 
 void N_PrepareAsyncWork(void)
 {
+    N_FG_Update();
+
     vec_in_init_alloc(&s_field_work.in, vec_realloc, vec_free);
     vec_in_resize(&s_field_work.in, MAX_FIELD_TASKS);
 
     vec_out_init_alloc(&s_field_work.out, vec_realloc, vec_free);
     vec_out_resize(&s_field_work.out, MAX_FIELD_TASKS);
+
+    vec_req_init_alloc(&s_field_work.paths, vec_realloc, vec_free);
+
+    /* Fields are refreshed at most once per tick */
+    N_FC_ClearTouched();
+    kh_clear(req, s_validated_fields);
 }
 
 void N_RequestAsyncEnemySeekField(vec2_t curr_pos, void *nav_private, enum nav_layer layer,
@@ -3196,36 +4213,12 @@ void N_RequestAsyncEnemySeekField(vec2_t curr_pos, void *nav_private, enum nav_l
     };
 
     ff_id_t ffid = N_FlowFieldID(chunk, target, layer);
-    if(N_FC_ContainsFlowField(ffid))
+    const struct flow_field *ff = N_FC_PeekFlowField(ffid);
+    if(ff && n_padded_field_current(priv, layer, chunk, target, ffid, ff))
        return;
 
-    /* We'll compute the missing field on-demand later */
-    if(s_field_work.nwork == MAX_FIELD_TASKS)
-        return;
-
-    for(int i = 0; i < s_field_work.nwork; i++) {
-        /* We already have a job for this field */
-        if(vec_AT(&s_field_work.in, i).id == ffid)
-            return;
-    }
-
-    vec_in_push(&s_field_work.in, (struct field_work_in){
-        .priv = priv,
-        .chunk = chunk,
-        .target = target,
-        .faction_id = faction_id,
-        .layer = layer,
-        .id = ffid
-    });
-    size_t *arg = stalloc(&s_field_work.mem, sizeof(size_t));
-    *arg = s_field_work.nwork++;
-
-    SDL_AtomicSet(&s_field_work.futures[s_field_work.ntasks].status, FUTURE_INCOMPLETE);
-    s_field_work.tids[s_field_work.ntasks] = Sched_Create(1, field_task, arg, 
-        &s_field_work.futures[s_field_work.ntasks], TASK_BIG_STACK);
-    if(s_field_work.tids[s_field_work.ntasks] != NULL_TID) {
-        s_field_work.ntasks++;
-    }
+    /* If the queue is full, we'll compute the missing field on-demand later */
+    field_push_work(priv, chunk, target, faction_id, layer, ffid, NULL);
 }
 
 void N_RequestAsyncSurroundField(vec2_t curr_pos, void *nav_private, enum nav_layer layer,
@@ -3250,49 +4243,103 @@ void N_RequestAsyncSurroundField(vec2_t curr_pos, void *nav_private, enum nav_la
     };
 
     ff_id_t ffid = N_FlowFieldID(chunk, target, layer);
-    if(N_FC_ContainsFlowField(ffid))
+    const struct flow_field *ff = N_FC_PeekFlowField(ffid);
+    if(ff && n_padded_field_current(priv, layer, chunk, target, ffid, ff))
        return;
 
-    /* We'll compute the missing field on-demand later */
-    if(s_field_work.nwork == MAX_FIELD_TASKS)
+    /* If the queue is full, we'll compute the missing field on-demand later */
+    field_push_work(priv, chunk, target, faction_id, layer, ffid, NULL);
+}
+
+void N_RequestAsyncFactionTargetsField(vec2_t curr_pos, void *nav_private, enum nav_layer layer,
+                                       vec3_t map_pos, int faction_id)
+{
+    struct nav_private *priv = nav_private;
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
+
+    n_update_dirty_local_islands(nav_private, layer);
+
+    struct tile_desc curr_tile;
+    bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &curr_tile);
+    assert(result);
+
+    struct coord chunk = (struct coord){curr_tile.chunk_r, curr_tile.chunk_c};
+
+    struct field_target target = (struct field_target){
+        .type = TARGET_FACTION_TARGETS,
+        .targets.faction_id = faction_id,
+        .targets.key = s_faction_targets[faction_id].key,
+        .targets.map_pos = map_pos,
+    };
+
+    ff_id_t ffid = N_FlowFieldID(chunk, target, layer);
+    const struct flow_field *ff = N_FC_PeekFlowField(ffid);
+    if(ff && ff->target.targets.key == target.targets.key
+    && n_padded_field_current(priv, layer, chunk, target, ffid, ff))
+       return;
+
+    /* If the queue is full, we'll compute the missing field on-demand later */
+    field_push_work(priv, chunk, target, faction_id, layer, ffid, NULL);
+}
+
+void N_RequestAsyncPath(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest, 
+                        void *nav_private, vec3_t map_pos)
+{
+    struct nav_private *priv = nav_private;
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
+
+    struct tile_desc curr_tile;
+    bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &curr_tile);
+    assert(result);
+
+    struct coord chunk = (struct coord){curr_tile.chunk_r, curr_tile.chunk_c};
+    ff_id_t ffid;
+    if(N_FC_GetDestFFMapping(id, chunk, &ffid) 
+    && (N_FC_ContainsFlowField(ffid) || N_FG_Pending(ffid)))
         return;
 
-    for(int i = 0; i < s_field_work.nwork; i++) {
-        /* We already have a job for this field */
-        if(vec_AT(&s_field_work.in, i).id == ffid)
-            return;
-    }
+    /* All the entities of a flock in the same chunk need just one request. If 
+     * the request cannot be queued, the path will be requested on-demand. */
+    int status;
+    uint64_t key = (((uint64_t)id) << 32) | (((uint64_t)chunk.r & 0xffff) << 16) 
+                 | ((uint64_t)chunk.c & 0xffff);
+    kh_put(req, s_path_request_keys, key, &status);
+    if(status != 1)
+        return;
 
-    vec_in_push(&s_field_work.in, (struct field_work_in){
+    vec_req_push(&s_field_work.paths, (struct path_request){
         .priv = priv,
-        .chunk = chunk,
-        .target = target,
-        .faction_id = faction_id,
-        .layer = layer,
-        .id = ffid
+        .id = id,
+        .src = curr_pos,
+        .dest = xz_dest,
+        .map_pos = map_pos
     });
-    size_t *arg = stalloc(&s_field_work.mem, sizeof(size_t));
-    *arg = s_field_work.nwork++;
-
-    SDL_AtomicSet(&s_field_work.futures[s_field_work.ntasks].status, FUTURE_INCOMPLETE);
-    s_field_work.tids[s_field_work.ntasks] = Sched_Create(1, field_task, arg, 
-        &s_field_work.futures[s_field_work.ntasks], TASK_BIG_STACK);
-    if(s_field_work.tids[s_field_work.ntasks] != NULL_TID) {
-        s_field_work.ntasks++;
-    }
 }
 
 void N_AwaitAsyncFields(void)
 {
-    field_join_work();
-    for(int i = 0; i < s_field_work.ntasks; i++) {
-        struct field_work_in *in = &vec_AT(&s_field_work.in, i);
-        struct field_work_out *out = &vec_AT(&s_field_work.out, i);
-        N_FC_PutFlowField(in->id, &out->field);
+    field_commit_work();
+
+    /* Nothing is reading the navigation data from other threads at this 
+     * point, so the requests are free to bring it up-to-date. The traversal 
+     * of the portal graph is done here, but the flow fields along the path 
+     * are computed by the workers. */
+    s_field_work.defer = true;
+    for(int i = 0; i < vec_size(&s_field_work.paths); i++) {
+
+        const struct path_request *req = &vec_AT(&s_field_work.paths, i);
+        dest_id_t ret;
+        n_request_path(req->priv, req->src, req->dest, N_DestFactionID(req->id), 
+            req->map_pos, N_DestLayer(req->id), &ret);
     }
+    s_field_work.defer = false;
+    field_commit_work();
+    N_FG_Submit();
+
+    kh_clear(req, s_path_request_keys);
     stalloc_clear(&s_field_work.mem);
-    s_field_work.nwork = 0;
-    s_field_work.ntasks = 0;
 }
 
 bool N_HasEntityLOS(vec2_t curr_pos, uint32_t ent, void *nav_private, 
@@ -3335,12 +4382,10 @@ bool N_HasDestLOS(dest_id_t id, vec2_t curr_pos, void *nav_private, vec3_t map_p
     bool result = M_Tile_DescForPoint2D(res, map_pos, curr_pos, &tile);
     assert(result);
 
-    if(!N_FC_ContainsLOSField(id, (struct coord){tile.chunk_r, tile.chunk_c}))
+    const struct LOS_field *lf = N_FC_PeekLOSField(id, (struct coord){tile.chunk_r, tile.chunk_c});
+    if(!lf)
         return false;
-
-    const struct LOS_field *lf = N_FC_LOSFieldAt(id, (struct coord){tile.chunk_r, tile.chunk_c});
-    assert(lf);
-    return lf->field[tile.tile_r][tile.tile_c].visible;
+    return N_LOSFieldVisible(lf, tile.tile_r, tile.tile_c);
 }
 
 bool N_PositionPathable(vec2_t xz_pos, enum nav_layer layer, void *nav_private, vec3_t map_pos)
@@ -3436,7 +4481,7 @@ bool N_ClosestPathable(void *nav_private, enum nav_layer layer,
 
     bool ret = false;
     queue_td_t frontier;
-    queue_td_init(&frontier, 1024);
+    queue_td_init_alloc(&frontier, 1024, Sched_FrameRealloc, Sched_FrameFree);
     queue_td_push(&frontier, &src_desc);
 
     khash_t(td) *visited = kh_init(td);
@@ -3480,6 +4525,110 @@ done:
     return ret;
 }
 
+size_t N_ClosestPathableSet(void *nav_private, enum nav_layer layer, vec3_t map_pos, 
+                            vec2_t xz_src, float spacing, size_t maxout, vec2_t *out)
+{
+    struct nav_private *priv = nav_private;
+    struct map_resolution res;
+    N_GetResolution(priv, &res);
+
+    bool result;
+    (void)result;
+
+    if(maxout == 0)
+        return 0;
+
+    struct tile_desc src_desc;
+    result = M_Tile_DescForPoint2D(res, map_pos, xz_src, &src_desc);
+    assert(result);
+
+    /* Once the first pathable tile has been found, the search is limited
+     * to a square large enough to fit all the requested positions with 
+     * the specified spacing, so that it stays local even when there are 
+     * not enough free tiles.
+     */
+    const int side = ceil(sqrt(maxout)) + 1;
+    const float max_dist = MAX(spacing, X_COORDS_PER_TILE) * side;
+
+    size_t ret = 0;
+    uint16_t iid = ISLAND_NONE;
+    vec2_t first = (vec2_t){0.0f, 0.0f};
+
+    queue_td_t frontier;
+    queue_td_init_alloc(&frontier, 1024, Sched_FrameRealloc, Sched_FrameFree);
+    queue_td_push(&frontier, &src_desc);
+
+    khash_t(td) *visited = kh_init(td);
+    kh_put(td, visited, td_key(&src_desc), &(int){0});
+
+    while(queue_size(frontier) > 0 && ret < maxout) {
+
+        struct tile_desc curr;
+        queue_td_pop(&frontier, &curr);
+
+        struct box bounds = M_Tile_Bounds(res, map_pos, curr);
+        vec2_t center = (vec2_t){
+            bounds.x - bounds.width / 2.0f, 
+            bounds.z + bounds.height / 2.0f
+        };
+
+        if(ret > 0) {
+            vec2_t delta;
+            PFM_Vec2_Sub(&center, &first, &delta);
+            if(PFM_Vec2_Len(&delta) > max_dist)
+                continue;
+        }
+
+        const struct nav_chunk *chunk = &priv->chunks[layer]
+                                                     [IDX(curr.chunk_r, priv->width, curr.chunk_c)];
+        uint16_t curr_iid = chunk->islands[curr.tile_r][curr.tile_c];
+
+        if(!n_tile_blocked(priv, layer, curr) && (ret == 0 || curr_iid == iid)) {
+
+            bool spaced = true;
+            for(int i = 0; i < ret; i++) {
+                vec2_t delta;
+                PFM_Vec2_Sub(&center, &out[i], &delta);
+                if(PFM_Vec2_Len(&delta) < spacing) {
+                    spaced = false;
+                    break;
+                }
+            }
+            if(spaced) {
+                if(ret == 0) {
+                    iid = curr_iid;
+                    first = center;
+                }
+                out[ret++] = center;
+            }
+        }
+
+        struct coord deltas[] = {
+            { 0, -1},
+            { 0, +1},
+            {-1,  0},
+            {+1,  0},
+        };
+
+        for(int i = 0; i < ARR_SIZE(deltas); i++) {
+        
+            struct tile_desc neighb = curr;
+            if(!M_Tile_RelativeDesc(res, &neighb, deltas[i].c, deltas[i].r))
+                continue;
+
+            if(kh_get(td, visited, td_key(&neighb)) != kh_end(visited))
+                continue;
+
+            kh_put(td, visited, td_key(&neighb), &(int){0});
+            queue_td_push(&frontier, &neighb);
+        }
+    }
+
+    kh_destroy(td, visited);
+    queue_td_destroy(&frontier);
+    return ret;
+}
+
 vec2_t N_ClosestPointAdjacentToLand(const struct map *map, void *nav_private, 
                                     vec3_t map_pos, vec2_t pos)
 {
@@ -3499,7 +4648,7 @@ vec2_t N_ClosestPointAdjacentToLand(const struct map *map, void *nav_private,
 
     vec2_t ret = pos;
     queue_td_t frontier;
-    queue_td_init(&frontier, 1024);
+    queue_td_init_alloc(&frontier, 1024, Sched_FrameRealloc, Sched_FrameFree);
     queue_td_push(&frontier, &src_desc);
 
     khash_t(td) *visited = kh_init(td);
@@ -3565,7 +4714,7 @@ vec2_t N_ClosestPointAdjacentToIsland(void *nav_private, vec3_t map_pos,
 
     vec2_t ret = pos;
     queue_td_t frontier;
-    queue_td_init(&frontier, 1024);
+    queue_td_init_alloc(&frontier, 1024, Sched_FrameRealloc, Sched_FrameFree);
     queue_td_push(&frontier, &src_desc);
 
     khash_t(td) *visited = kh_init(td);
@@ -3681,26 +4830,93 @@ vec2_t N_TileDims(void)
     };
 }
 
-void N_BlockersIncref(vec2_t xz_pos, float range, int faction_id, uint32_t flags,
-                      vec3_t map_pos, void *nav_private)
+static void n_update_blockers_circle(void *nav_private, vec2_t xz_pos, float range, 
+                                     int faction_id, bool air, vec3_t map_pos, int ref_delta)
 {
-    if(flags & ENTITY_FLAG_AIR) {
-        n_update_blockers_circle_air(nav_private, xz_pos, range, faction_id, map_pos, +1);
+    if(air) {
+        n_update_blockers_circle_air(nav_private, xz_pos, range, faction_id, map_pos, ref_delta);
     }else{
-        n_update_blockers_circle_water(nav_private, xz_pos, range, faction_id, map_pos, +1);
-        n_update_blockers_circle_ground(nav_private, xz_pos, range, faction_id, map_pos, +1);
+        n_update_blockers_circle_water(nav_private, xz_pos, range, faction_id, map_pos, ref_delta);
+        n_update_blockers_circle_ground(nav_private, xz_pos, range, faction_id, map_pos, ref_delta);
+    }
+}
+
+static bool n_batch_blockers(vec2_t xz_pos, float range, int faction_id, uint32_t flags,
+                             vec3_t map_pos, void *nav_private, int ref_delta)
+{
+    if(!s_blocker_batch_depth)
+        return false;
+
+    struct nav_private *priv = nav_private;
+    struct tile_desc td = {0};
+    M_Tile_DescForPoint2D(n_res(priv), map_pos, xz_pos, &td);
+
+    struct blocker_ref ref = (struct blocker_ref){
+        .priv = nav_private,
+        .map_pos = map_pos,
+        .xz_pos = xz_pos,
+        .range = range,
+        .faction_id = faction_id,
+        .air = !!(flags & ENTITY_FLAG_AIR),
+        .delta = ref_delta,
+        .chunk_key = (((uint32_t)td.chunk_r & 0xffff) << 16) | ((uint32_t)td.chunk_c & 0xffff)
+    };
+    return vec_bref_push(&s_blocker_batch, ref);
+}
+
+void N_BlockersBeginBatch(void)
+{
+    if(s_blocker_batch_depth++ == 0) {
+        vec_bref_init(&s_blocker_batch);
     }
 }
 
+void N_BlockersEndBatch(void)
+{
+    assert(s_blocker_batch_depth > 0);
+    if(--s_blocker_batch_depth > 0)
+        return;
+
+    size_t nrefs = vec_size(&s_blocker_batch);
+    qsort(s_blocker_batch.array, nrefs, sizeof(struct blocker_ref), compare_brefs);
+
+    /* The changes of the same footprint are summed up, so that the tiles 
+     * under it only need to be found and updated once. The ones which 
+     * cancel out are dropped altogether. */
+    for(int i = 0; i < nrefs;) {
+
+        const struct blocker_ref *ref = &vec_AT(&s_blocker_batch, i);
+        int delta = 0;
+        int j = i;
+        for(; j < nrefs && compare_brefs(ref, &vec_AT(&s_blocker_batch, j)) == 0; j++) {
+            delta += vec_AT(&s_blocker_batch, j).delta;
+        }
+
+        if(delta) {
+            n_update_blockers_circle(ref->priv, ref->xz_pos, ref->range, ref->faction_id, 
+                ref->air, ref->map_pos, delta);
+        }
+        i = j;
+    }
+    vec_bref_destroy(&s_blocker_batch);
+}
+
+void N_BlockersIncref(vec2_t xz_pos, float range, int faction_id, uint32_t flags,
+                      vec3_t map_pos, void *nav_private)
+{
+    if(n_batch_blockers(xz_pos, range, faction_id, flags, map_pos, nav_private, +1))
+        return;
+    n_update_blockers_circle(nav_private, xz_pos, range, faction_id, 
+        !!(flags & ENTITY_FLAG_AIR), map_pos, +1);
+}
+
 void N_BlockersDecref(vec2_t xz_pos, float range, int faction_id, uint32_t flags,
                       vec3_t map_pos, void *nav_private)
 {
-    if(flags & ENTITY_FLAG_AIR) {
-        n_update_blockers_circle_air(nav_private, xz_pos, range, faction_id, map_pos, -1);
-    }else{
-        n_update_blockers_circle_water(nav_private, xz_pos, range, faction_id, map_pos, -1);
-        n_update_blockers_circle_ground(nav_private, xz_pos, range, faction_id, map_pos, -1);
-    }
+    if(n_batch_blockers(xz_pos, range, faction_id, flags, map_pos, nav_private, -1))
+        return;
+    n_update_blockers_circle(nav_private, xz_pos, range, faction_id, 
+        !!(flags & ENTITY_FLAG_AIR), map_pos, -1);
 }
 
 void N_BlockersIncrefOBB(void *nav_private, int faction_id, uint32_t flags,
@@ -4012,6 +5228,16 @@ void N_GetResolution(const void *nav_private, struct map_resolution *out)
     out->field_h = Z_COORDS_PER_TILE * TILES_PER_CHUNK_HEIGHT;
 }
 
+void N_GetSearchStats(struct nav_search_stats *out)
+{
+    AStar_GetStats(out);
+}
+
+void N_ClearSearchStats(void)
+{
+    AStar_ClearStats();
+}
+
 bool N_ObjectBuildable(void *nav_private, const struct map *map, enum nav_layer layer, 
                        bool allow_shore, vec3_t map_pos, const struct obb *obb)
 {
@@ -4021,53 +5247,14 @@ bool N_ObjectBuildable(void *nav_private, const struct map *map, enum nav_layer
     struct map_resolution res;
     N_GetResolution(priv, &res);
 
-    struct map_resolution tile_res;
-    M_GetResolution(map, &tile_res);
-
     struct tile_desc tds[2048];
     size_t ntiles = M_Tile_AllUnderObj(map_pos, res, obb, tds, ARR_SIZE(tds));
 
-    khash_t(td) *tileset = n_moving_entities_tileset(priv, map_pos, obb);
-    assert(tileset);
-
-    khash_t(td) *building_tileset = n_non_collidable_buildings_tileset(priv, map_pos, obb);
-    assert(building_tileset);
-
-    bool ret = false;
     for(int i = 0; i < ntiles; i++) {
-
-        const struct nav_chunk *chunk = 
-            &priv->chunks[layer][IDX(tds[i].chunk_r, priv->width, tds[i].chunk_c)];
-        struct box bounds = M_Tile_Bounds(res, map_pos, tds[i]);
-        vec2_t center = (vec2_t){
-            bounds.x - bounds.width / 2.0f,
-            bounds.z + bounds.height / 2.0f
-        };
-
-        struct tile_desc map_td = (struct tile_desc){
-            tds[i].chunk_r,
-            tds[i].chunk_c,
-            tds[i].tile_r / ((float)res.tile_h) * tile_res.tile_h,
-            tds[i].tile_c / ((float)res.tile_w) * tile_res.tile_w
-        };
-        struct tile *tile = NULL;
-        M_TileForDesc(map, map_td, &tile);
-        assert(tile);
-        bool shore = (tile->ramp_height > 1) && (tile->base_height < 0);
-    
-        if(chunk->blockers [tds[i].tile_r][tds[i].tile_c]
-        || ((allow_shore ? !shore : true) && chunk->cost_base[tds[i].tile_r][tds[i].tile_c] == COST_IMPASSABLE)
-        || !G_Fog_PlayerExplored((vec2_t){center.x, center.z})
-        || (kh_get(td, tileset, td_key(tds + i)) != kh_end(tileset))
-        || (kh_get(td, building_tileset, td_key(tds + i)) != kh_end(building_tileset))) {
-            goto out;
-        }
+        if(!n_tile_buildable(priv, map, layer, allow_shore, tds[i]))
+            return false;
     }
-    ret = true;
-out:
-    free(tileset);
-    free(building_tileset);
-    return ret;
+    return true;
 }
 
 enum nav_layer N_DestLayer(dest_id_t id)
@@ -4159,7 +5346,7 @@ uint16_t N_ClosestPathableLocalIsland(const struct nav_private *priv, const stru
     N_GetResolution(priv, &res);
 
     queue_td_t frontier;
-    queue_td_init(&frontier, 1024);
+    queue_td_init_alloc(&frontier, 1024, Sched_FrameRealloc, Sched_FrameFree);
     queue_td_push(&frontier, &target);
 
     STALLOC(bool, visited, res.tile_h * res.tile_w);
@@ -4254,6 +5441,8 @@ void N_CopyFields(void *nav_private, void *out)
     struct nav_private *to = (struct nav_private*)out;
 
     *to = *from;
+    memset(to->travel_costs, 0, sizeof(to->travel_costs));
+    to->faction_counts = NULL;
     unsigned char *cursor = (unsigned char*)(to + 1);
     size_t chunks_per_layer = from->width * from->height;
     size_t layer_size = chunks_per_layer * sizeof(struct nav_chunk);
@@ -4262,14 +5451,14 @@ void N_CopyFields(void *nav_private, void *out)
 
         size_t cost_size = sizeof(((struct nav_chunk*)0)->cost_base);
         size_t blockers_size = sizeof(((struct nav_chunk*)0)->blockers);
-        size_t factions_size = sizeof(((struct nav_chunk*)0)->factions);
+        size_t mask_size = sizeof(((struct nav_chunk*)0)->faction_mask);
         size_t islands_size = sizeof(((struct nav_chunk*)0)->islands);
         to->chunks[i] = (struct nav_chunk*)cursor;
 
         for(int j = 0; j < chunks_per_layer; j++) {
             memcpy(to->chunks[i][j].cost_base, from->chunks[i][j].cost_base, cost_size);
             memcpy(to->chunks[i][j].blockers, from->chunks[i][j].blockers, blockers_size);
-            memcpy(to->chunks[i][j].factions, from->chunks[i][j].factions, factions_size);
+            memcpy(to->chunks[i][j].faction_mask, from->chunks[i][j].faction_mask, mask_size);
             memcpy(to->chunks[i][j].islands, from->chunks[i][j].islands, islands_size);
         }
         cursor += layer_size;
@@ -0,0 +1,280 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/nav.h"
+#include "../map/public/tile.h"
+#include "../game/public/game.h"
+#include "../lib/public/mem.h"
+#include "../main.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <SDL.h>
+
+#define MAX_POINT_TRIES     (64)
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+struct samples{
+    float  *us;
+    size_t size;
+    size_t capacity;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* A private generator, so that the queries don't depend on, or 
+ * perturb, the state of the C library's one */
+static uint32_t next_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static float rand_unit(uint32_t *state)
+{
+    return (next_rand(state) >> 8) / (float)(1 << 24);
+}
+
+static bool samples_init(struct samples *s, size_t capacity)
+{
+    s->us = malloc(MAX(capacity, 1) * sizeof(float));
+    s->size = 0;
+    s->capacity = MAX(capacity, 1);
+    return (s->us != NULL);
+}
+
+static void samples_push(struct samples *s, uint64_t begin)
+{
+    if(s->size == s->capacity)
+        return;
+    s->us[s->size++] = (SDL_GetPerformanceCounter() - begin) * 1000000.0 
+                     / SDL_GetPerformanceFrequency();
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static void samples_summarize(struct samples *s, struct nav_bench_latency *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->nsamples = s->size;
+    if(s->size == 0)
+        return;
+
+    qsort(s->us, s->size, sizeof(float), compare_floats);
+
+    double sum = 0.0;
+    for(size_t i = 0; i < s->size; i++)
+        sum += s->us[i];
+
+    out->mean_us = sum / s->size;
+    out->p50_us = s->us[(s->size - 1) * 50 / 100];
+    out->p95_us = s->us[(s->size - 1) * 95 / 100];
+    out->p99_us = s->us[(s->size - 1) * 99 / 100];
+    out->max_us = s->us[s->size - 1];
+}
+
+static bool point_inside(struct map_resolution res, vec3_t map_pos, vec2_t xz)
+{
+    struct tile_desc td;
+    return M_Tile_DescForPoint2D(res, map_pos, xz, &td);
+}
+
+static bool random_pathable_point(void *nav_private, vec3_t map_pos, enum nav_layer layer,
+                                  struct map_resolution res, uint32_t *state, vec2_t *out)
+{
+    float width = res.chunk_w * res.field_w;
+    float height = res.chunk_h * res.field_h;
+
+    for(int i = 0; i < MAX_POINT_TRIES; i++) {
+
+        /* Recall X increases to the left in our engine */
+        vec2_t xz = (vec2_t){
+            map_pos.x - (0.01f + 0.98f * rand_unit(state)) * width,
+            map_pos.z + (0.01f + 0.98f * rand_unit(state)) * height,
+        };
+        if(N_PositionPathable(xz, layer, nav_private, map_pos)) {
+            *out = xz;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Surround fields only extend a chunk-sized box around the target,
+ * so the queries are made from positions close to it */
+static bool random_point_near(void *nav_private, vec3_t map_pos, enum nav_layer layer,
+                              struct map_resolution res, vec2_t center, 
+                              uint32_t *state, vec2_t *out)
+{
+    for(int i = 0; i < MAX_POINT_TRIES; i++) {
+
+        vec2_t xz = (vec2_t){
+            center.x + (rand_unit(state) - 0.5f) * res.field_w,
+            center.z + (rand_unit(state) - 0.5f) * res.field_h,
+        };
+        if(point_inside(res, map_pos, xz)
+        && N_PositionPathable(xz, layer, nav_private, map_pos)) {
+            *out = xz;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void get_mem_usage(struct nav_bench_result *out)
+{
+    struct mem_tag_stats stats[MEM_TAG_COUNT];
+    pf_mem_get_stats(stats);
+    out->nav_bytes = stats[MEM_TAG_NAV].live_bytes;
+    out->field_cache_bytes = stats[MEM_TAG_FIELD_CACHE].live_bytes;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool N_Benchmark(void *nav_private, vec3_t map_pos, const struct nav_bench_desc *desc, 
+                 struct nav_bench_result *out)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    struct map_resolution res;
+    N_GetResolution(nav_private, &res);
+
+    size_t npaths = desc->pairs ? desc->npairs : desc->npaths;
+    size_t nsurround = desc->ntargets ? npaths : 0;
+
+    struct samples samples[NAV_BENCH_QUERY_COUNT];
+    size_t ninit = 0;
+    for(; ninit < NAV_BENCH_QUERY_COUNT; ninit++) {
+        size_t cap = (ninit == NAV_BENCH_ENTITY_LOS || ninit == NAV_BENCH_SURROUND) 
+                   ? nsurround : npaths;
+        if(!samples_init(&samples[ninit], cap))
+            goto fail_samples;
+    }
+
+    memset(out, 0, sizeof(*out));
+    uint32_t state = desc->seed ? desc->seed : 1;
+
+    N_FC_ClearAll();
+    N_FC_ClearStats();
+    N_ClearSearchStats();
+
+    for(size_t i = 0; i < npaths; i++) {
+
+        vec2_t src, dest;
+        if(desc->pairs) {
+            src = desc->pairs[i * 2 + 0];
+            dest = desc->pairs[i * 2 + 1];
+            if(!point_inside(res, map_pos, src) || !point_inside(res, map_pos, dest))
+                continue;
+        }else{
+            if(!random_pathable_point(nav_private, map_pos, desc->layer, res, &state, &src))
+                continue;
+            if(!random_pathable_point(nav_private, map_pos, desc->layer, res, &state, &dest))
+                continue;
+        }
+        out->npaths++;
+
+        dest_id_t id;
+        uint64_t begin = SDL_GetPerformanceCounter();
+        bool found = N_RequestPath(nav_private, src, dest, map_pos, desc->layer, &id);
+        samples_push(&samples[NAV_BENCH_PATH], begin);
+
+        if(found) {
+            out->npaths_found++;
+            begin = SDL_GetPerformanceCounter();
+            N_HasDestLOS(id, src, nav_private, map_pos);
+            samples_push(&samples[NAV_BENCH_DEST_LOS], begin);
+        }
+
+        begin = SDL_GetPerformanceCounter();
+        N_RequestPathAttacking(nav_private, src, dest, desc->faction_id, 
+            map_pos, desc->layer, &id);
+        samples_push(&samples[NAV_BENCH_PATH_ATTACKING], begin);
+
+        if(desc->ntargets == 0)
+            continue;
+
+        uint32_t target = desc->targets[next_rand(&state) % desc->ntargets];
+        vec2_t target_pos = G_Pos_GetXZ(target);
+        vec2_t near;
+        if(!random_point_near(nav_private, map_pos, desc->layer, res, target_pos, &state, &near))
+            continue;
+
+        begin = SDL_GetPerformanceCounter();
+        N_HasEntityLOS(near, target, nav_private, desc->layer, map_pos);
+        samples_push(&samples[NAV_BENCH_ENTITY_LOS], begin);
+
+        begin = SDL_GetPerformanceCounter();
+        N_DesiredSurroundVelocity(near, nav_private, desc->layer, map_pos, 
+            target, desc->faction_id);
+        samples_push(&samples[NAV_BENCH_SURROUND], begin);
+    }
+
+    for(int i = 0; i < NAV_BENCH_QUERY_COUNT; i++) {
+        samples_summarize(&samples[i], &out->latency[i]);
+        free(samples[i].us);
+    }
+
+    N_FC_GetStats(&out->fc);
+    N_GetSearchStats(&out->search);
+    get_mem_usage(out);
+
+    /* Don't leave the game with the fields of the benchmark queries */
+    N_FC_ClearAll();
+    return true;
+
+fail_samples:
+    for(size_t i = 0; i < ninit; i++) {
+        free(samples[i].us);
+    }
+    return false;
+}
@@ -86,21 +86,25 @@ struct nav_chunk{
     uint8_t         cost_base[FIELD_RES_R][FIELD_RES_C]; 
     /* Holds the cost to travel from every tile to every portal,
      * when the portal is reachable from the tile. This field is 
-     * synchronized with the 'cost_base' field.
+     * synchronized with the 'cost_base' field. The costs only 
+     * depend on the cost field and portals, which are the same 
+     * for all layers of a domain, so they are stored once per 
+     * domain and referenced by every layer of it.
      */
-    float           portal_travel_costs[MAX_PORTALS_PER_CHUNK][FIELD_RES_R][FIELD_RES_C];
+    float         (*portal_travel_costs)[FIELD_RES_R][FIELD_RES_C];
     /* Every tile in the 'blockers' holds a reference count for
      * how many stationary entities are currently 'retaining' that 
      * tile by being positioned on it. 'Blocked' tiles are treated 
      * as impassable when computing flow fields. 
      */
     uint16_t        blockers[FIELD_RES_R][FIELD_RES_C];
-    /* Keep a reference count of how many unit of every faction are 
+    /* A bit is set for every faction that has at least one unit 
      * currently blocking the corresponding tile. This additional 
      * data allows determine units belonging to which faction are 
-     * blocking specific tiles.
+     * blocking specific tiles. The per-faction reference counts
+     * backing the mask are kept sparsely in the 'nav_private'.
      */
-    uint8_t         factions[MAX_FACTIONS][FIELD_RES_R][FIELD_RES_C];
+    uint16_t        faction_mask[FIELD_RES_R][FIELD_RES_C];
     /* An 'island' is a collection of tiles that are all reachable 
      * from one another. Each island has a unique ID. These are
      * synchronized with the 'cost_base' field, and are not
@@ -42,11 +42,30 @@
 
 #include <stddef.h>
 
+/* The layers are grouped by domain (ground, water, air), with one 
+ * layer for each unit size. The layers of a domain share the same 
+ * cost field and portals, only differing in how blockers are dilated. 
+ */
+#define NAV_LAYERS_PER_DOMAIN   (4)
+#define NAV_DOMAIN_MAX          (NAV_LAYER_MAX / NAV_LAYERS_PER_DOMAIN)
+#define N_LAYER_DOMAIN(layer)   ((layer) / NAV_LAYERS_PER_DOMAIN)
+#define N_LAYER_IS_BASE(layer)  (((layer) % NAV_LAYERS_PER_DOMAIN) == 0)
+
 struct portal;
+struct kh_fcount_s;
 
 struct nav_private{
-    size_t            width, height;
-    struct nav_chunk *chunks[NAV_LAYER_MAX];
+    size_t              width, height;
+    struct nav_chunk   *chunks[NAV_LAYER_MAX];
+    /* Per-domain buffers holding the portal travel costs of every 
+     * chunk. The chunks of all layers of a domain point into these. 
+     */
+    float              *travel_costs[NAV_DOMAIN_MAX];
+    /* Sparse per-(layer, chunk, tile, faction) blocker reference 
+     * counts, backing the chunks' 'faction_mask' fields. Only the 
+     * tiles that are currently blocked have entries. 
+     */
+    struct kh_fcount_s *faction_counts;
 };
 
 enum nav_layer N_DestLayer(dest_id_t id);
@@ -58,6 +77,8 @@ bool           N_PortalReachableFromTile(const struct portal *port, struct coord
 int            N_GridNeighbours(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], struct coord coord, 
                                 struct coord out_neighbours[], float out_costs[]);
 
+const uint32_t *N_FactionTargets(int faction_id, size_t *out_ntargets);
+
 uint16_t       N_ClosestPathableLocalIsland(const struct nav_private *priv, const struct nav_chunk *chunk, 
                                             struct tile_desc target);
 
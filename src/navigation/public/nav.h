@@ -47,6 +47,7 @@ struct obb;
 struct map_resolution;
 struct camera;
 struct tile_desc;
+struct SDL_RWops;
 
 typedef uint32_t dest_id_t;
 
@@ -54,17 +55,30 @@ struct fc_stats{
     unsigned los_used;
     unsigned los_max;
     float    los_hit_rate;
+    unsigned los_evicted;
     unsigned los_invalidated;
     unsigned flow_used;
     unsigned flow_max;
     float    flow_hit_rate;
+    unsigned flow_evicted;
     unsigned flow_invalidated;
     unsigned ffid_used;
     unsigned ffid_max;
     float    ffid_hit_rate;
+    unsigned ffid_evicted;
     unsigned grid_path_used;
     unsigned grid_path_max;
+    size_t   grid_path_bytes;
+    size_t   grid_path_max_bytes;
     float    grid_path_hit_rate;
+    unsigned grid_path_evicted;
+};
+
+struct nav_search_stats{
+    uint64_t grid_searches;
+    uint64_t grid_expanded;
+    uint64_t portal_searches;
+    uint64_t portal_expanded;
 };
 
 /* Pathfinding happens on a per-layer basis. Each layer has 
@@ -103,6 +117,52 @@ enum flow_dir{
 
 #define DEST_ID_INVALID (~((uint32_t)0))
 
+enum nav_bench_query{
+    NAV_BENCH_PATH,
+    NAV_BENCH_PATH_ATTACKING,
+    NAV_BENCH_DEST_LOS,
+    NAV_BENCH_ENTITY_LOS,
+    NAV_BENCH_SURROUND,
+    NAV_BENCH_QUERY_COUNT
+};
+
+struct nav_bench_desc{
+    enum nav_layer  layer;
+    int             faction_id;
+    unsigned        seed;
+    /* The number of random source/destination pairs to path between. 
+     * Ignored when 'pairs' is set. */
+    size_t          npaths;
+    /* Optional recorded pairs to replay instead, laid out as 
+     * (src, dest, src, dest, ...) */
+    const vec2_t   *pairs;
+    size_t          npairs;
+    /* Entities that the LOS and surround queries are made against. 
+     * Those queries are skipped when there are none. */
+    const uint32_t *targets;
+    size_t          ntargets;
+};
+
+struct nav_bench_latency{
+    unsigned nsamples;
+    float    mean_us;
+    float    p50_us;
+    float    p95_us;
+    float    p99_us;
+    float    max_us;
+};
+
+struct nav_bench_result{
+    float                    build_ms;
+    unsigned                 npaths;
+    unsigned                 npaths_found;
+    struct nav_bench_latency latency[NAV_BENCH_QUERY_COUNT];
+    struct fc_stats          fc;
+    struct nav_search_stats  search;
+    uint64_t                 nav_bytes;
+    uint64_t                 field_cache_bytes;
+};
+
 /*###########################################################################*/
 /* NAV GENERAL                                                               */
 /*###########################################################################*/
@@ -147,6 +207,27 @@ void     *N_BuildForMapData(size_t w, size_t h, size_t chunk_w, size_t chunk_h,
  */
 void      N_FreePrivate(void *nav_private);
 
+/* ------------------------------------------------------------------------
+ * Write the navigation data built by 'N_BuildForMapData' in a binary form
+ * which can later be loaded in its' place. Only the data derived from the
+ * map tiles is written, so this should be called before any scene objects
+ * or entities have modified it. The data is tagged with a checksum of the
+ * tiles it was built from.
+ * ------------------------------------------------------------------------
+ */
+bool      N_SaveBaked(const void *nav_private, size_t chunk_w, size_t chunk_h,
+                      const struct tile **chunk_tiles, struct SDL_RWops *stream);
+
+/* ------------------------------------------------------------------------
+ * Load navigation data written by 'N_SaveBaked'. Returns NULL if the data 
+ * is of a different version or was built from different map tiles, in
+ * which case the stream is positioned after it. The result is the same as
+ * that of 'N_BuildForMapData' for the same tiles.
+ * ------------------------------------------------------------------------
+ */
+void     *N_LoadBaked(size_t w, size_t h, size_t chunk_w, size_t chunk_h,
+                      const struct tile **chunk_tiles, struct SDL_RWops *stream);
+
 /* ------------------------------------------------------------------------
  * Render text above a particular map position.
  * ------------------------------------------------------------------------
@@ -321,6 +402,27 @@ bool      N_RequestPathAttacking(void *nav_private, vec2_t xz_src,
 vec2_t    N_DesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest, 
                                      void *nav_private, vec3_t map_pos);
 
+/* ------------------------------------------------------------------------
+ * Like 'N_DesiredPointSeekVelocity', but only consults the fields which are
+ * already cached, never building or modifying any. Returns false if the 
+ * full query is needed to get a direction for the position. This is safe 
+ * to call from multiple threads at once, so long as nothing is modifying 
+ * the navigation state at the same time.
+ * ------------------------------------------------------------------------
+ */
+bool      N_TryDesiredPointSeekVelocity(dest_id_t id, vec2_t curr_pos, void *nav_private, 
+                                        vec3_t map_pos, vec2_t *out);
+
+/* ------------------------------------------------------------------------
+ * Mark the cached fields guiding to the destination from 'curr_pos' as
+ * recently used, so that they don't get evicted. Lookups which can run on
+ * other threads don't do this themselves, so this should be called from the
+ * main thread for the positions they were made at.
+ * ------------------------------------------------------------------------
+ */
+void      N_TouchDestFields(dest_id_t id, vec2_t curr_pos, void *nav_private, 
+                            vec3_t map_pos);
+
 /* ------------------------------------------------------------------------
  * Returns the desired velocity for an entity at 'curr_pos' for it to flow
  * towards the closest enemy units.
@@ -340,6 +442,23 @@ vec2_t    N_DesiredEnemySeekVelocity(vec2_t curr_pos, void *nav_private,
 vec2_t N_DesiredSurroundVelocity(vec2_t curr_pos, void *nav_private, enum nav_layer layer, 
                                  vec3_t map_pos, const uint32_t ent, int faction_id);
 
+/* ------------------------------------------------------------------------
+ * Like 'N_DesiredSurroundVelocity', but flowing towards the closest of the
+ * targets set for the faction with 'N_SetFactionTargets'. The same field 
+ * is shared by all the faction's units, regardless of their own target.
+ * ------------------------------------------------------------------------
+ */
+vec2_t N_DesiredFactionTargetsVelocity(vec2_t curr_pos, void *nav_private, enum nav_layer layer, 
+                                       vec3_t map_pos, int faction_id);
+
+/* ------------------------------------------------------------------------
+ * Set the entities which the units of the faction are converging on. This
+ * should be done once per tick, before any of the faction's fields are 
+ * requested, and not while async field work is running.
+ * ------------------------------------------------------------------------
+ */
+void   N_SetFactionTargets(int faction_id, const uint32_t *targets, size_t ntargets);
+
 /* ------------------------------------------------------------------------
  * Returns true if the particular entity is in direct line of sight of the 
  * specified position.
@@ -351,7 +470,9 @@ bool      N_HasEntityLOS(vec2_t curr_pos, const uint32_t ent,
 
 /* ------------------------------------------------------------------------
  * Returns true if the particular destination is in direct line of sight 
- * of the specified position.
+ * of the specified position. This is safe to call from multiple threads at
+ * once, so long as nothing is modifying the navigation state at the same 
+ * time.
  * ------------------------------------------------------------------------
  */
 bool      N_HasDestLOS(dest_id_t id, vec2_t curr_pos, void *nav_private, 
@@ -408,6 +529,15 @@ bool N_ClosestReachableAdjacentPosDynamic(void *nav_private, enum nav_layer laye
 bool N_ClosestPathable(void *nav_private, enum nav_layer layer, 
                        vec3_t map_pos, vec2_t xz_src, vec2_t *out);
 
+/* ------------------------------------------------------------------------
+ * Writes up to 'maxout' worldspace XZ positions of pathable tiles, closest
+ * to the source first, to 'out'. The positions are all mutually reachable
+ * and at least 'spacing' apart. Returns the number of positions written.
+ * ------------------------------------------------------------------------
+ */
+size_t N_ClosestPathableSet(void *nav_private, enum nav_layer layer, vec3_t map_pos, 
+                            vec2_t xz_src, float spacing, size_t maxout, vec2_t *out);
+
 /* ------------------------------------------------------------------------
  * Returns the closest position to 'pos' that is adjacent to a land tile.
  * ------------------------------------------------------------------------
@@ -457,6 +587,16 @@ void      N_BlockersIncrefOBB(void *nav_private, int faction_id, uint32_t flags,
 void      N_BlockersDecrefOBB(void *nav_private, int faction_id, uint32_t flags,
                               vec3_t map_pos, const struct obb *obb);
 
+/* ------------------------------------------------------------------------
+ * Between these calls, the changes made by 'N_BlockersIncref' and 
+ * 'N_BlockersDecref' are held back. They are applied together at the end 
+ * of the outermost batch, with the ones which cancel out being dropped. 
+ * The blockers are not up-to-date until then.
+ * ------------------------------------------------------------------------
+ */
+void      N_BlockersBeginBatch(void);
+void      N_BlockersEndBatch(void);
+
 /* ------------------------------------------------------------------------
  * Returns true if the entity position (xz_pos) is within a 'tolerance' 
  * range of the closest non-blocked tile that is reachable from the
@@ -586,7 +726,7 @@ void N_PrepareAsyncWork(void);
 
 /* ------------------------------------------------------------------------
  * Await all the outstanding flow field computation jobs and place the
- * result in the fieldcache.
+ * result in the fieldcache. Then service all the queued path requests.
  * ------------------------------------------------------------------------
  */
 void N_AwaitAsyncFields(void);
@@ -607,6 +747,52 @@ void N_RequestAsyncEnemySeekField(vec2_t curr_pos, void *nav_private, enum nav_l
 void N_RequestAsyncSurroundField(vec2_t curr_pos, void *nav_private, enum nav_layer layer,
                                  vec3_t map_pos, uint32_t ent, int faction_id);
 
+/* ------------------------------------------------------------------------
+ * Start an async job computing the required TARGET_FACTION_TARGETS field, 
+ * if it is not in the cache and has not been started already.
+ * ------------------------------------------------------------------------
+ */
+void N_RequestAsyncFactionTargetsField(vec2_t curr_pos, void *nav_private, enum nav_layer layer,
+                                       vec3_t map_pos, int faction_id);
+
+/* ------------------------------------------------------------------------
+ * Queue up a request for the path with the specified dest_id, if the flow 
+ * field for the current chunk is not in the cache. Requests for the same 
+ * path from the same chunk are merged. All the queued requests are serviced 
+ * in 'N_AwaitAsyncFields', with the field computations spread across the 
+ * worker threads.
+ * ------------------------------------------------------------------------
+ */
+void N_RequestAsyncPath(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest, 
+                        void *nav_private, vec3_t map_pos);
+
+/* ------------------------------------------------------------------------
+ * Allow the flow fields along paths to be built by a compute shader. They 
+ * are batched up and dispatched once per tick, with the results arriving
+ * in the cache asynchronously. The LOS fields are always built by the CPU.
+ * ------------------------------------------------------------------------
+ */
+void N_FG_SetEnabled(bool enabled);
+
+/* ------------------------------------------------------------------------
+ * Get the counters of the A* searches over the tile grids and the portal
+ * graphs, including the total number of nodes expanded by them.
+ * ------------------------------------------------------------------------
+ */
+void N_GetSearchStats(struct nav_search_stats *out);
+void N_ClearSearchStats(void);
+
+/* ------------------------------------------------------------------------
+ * Time a batch of path, LOS and surround queries against the navigation 
+ * data. The caches are flushed before and after, so that the results are 
+ * not skewed by earlier queries and so that no fields for this data are 
+ * left behind. Must be called from the main thread, outside of the 
+ * simulation tick.
+ * ------------------------------------------------------------------------
+ */
+bool N_Benchmark(void *nav_private, vec3_t map_pos, const struct nav_bench_desc *desc, 
+                 struct nav_bench_result *out);
+
 /*###########################################################################*/
 /* NAV FIELD CACHE                                                           */
 /*###########################################################################*/
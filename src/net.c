@@ -0,0 +1,1313 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "net.h"
+#include "main.h"
+#include "replay.h"
+#include "settings.h"
+#include "game/public/game.h"
+#include "lib/public/vec.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define NET_MAGIC           (0x544e4650) /* 'PFNT' */
+#define NET_VERSION         (2)
+#define FRAMES_PER_TURN     (3)
+#define TURN_MS             (FRAMES_PER_TURN * 1000.0f / 60.0f)
+#define INITIAL_DELAY       (2)
+#define MAX_DELAY           (12)
+#define TURN_WINDOW         (64)
+#define HASH_INTERVAL       (20)
+#define HASH_HISTORY        (4)
+#define MAX_CMD_ENTS        (512)
+#define CMD_HEADER_SIZE     (28)
+#define BLOCK_HEADER_SIZE   (20)
+#define MAX_TURN_BYTES      (4096)
+#define MAX_DATAGRAM        (MAX_TURN_BYTES + 128)
+#define HELLO_INTERVAL_MS   (100)
+#define RESEND_MS           (40)
+#define KEEPALIVE_MS        (250)
+#define PEER_TIMEOUT_MS     (15000)
+#define NUM_BYES            (3)
+#define BYE_LINGER_MS       (1000)
+#define NO_HASH             (~(uint32_t)0)
+#define NO_TURN             (~(uint32_t)0)
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+#ifdef _WIN32
+typedef SOCKET sock_t;
+#define BAD_SOCKET          INVALID_SOCKET
+#define close_socket        closesocket
+#else
+typedef int sock_t;
+#define BAD_SOCKET          (-1)
+#define close_socket        close
+#endif
+
+enum packet_type{
+    PACKET_HELLO,
+    PACKET_TURNS,
+    PACKET_BYE,
+    PACKET_DROP,
+    PACKET_RELAY,
+};
+
+/* The commands issued by a single peer for a single turn */
+struct turn_block{
+    uint32_t      turn;
+    uint32_t      hash_turn;
+    uint64_t      hash;
+    uint16_t      ncmds;
+    uint16_t      size;
+    unsigned char data[];
+};
+
+struct peer{
+    struct sockaddr_in addr;
+    bool               connected;
+    bool               dropped;
+    uint32_t           last_recv;
+    uint32_t           last_send;
+    /* For measuring the round-trip time */
+    uint32_t           echo_time;
+    uint32_t           echo_recv;
+    bool               has_rtt;
+    float              srtt;
+    float              rttvar;
+    /* All of the peer's turns before 'next_turn' have been received */
+    uint32_t           next_turn;
+    bool               ack_dirty;
+    /* The peer has received all of our turns before 'acked' */
+    uint32_t           acked;
+    /* A hash which arrived before the local one for the same turn was taken */
+    uint32_t           pending_hash_turn;
+    uint64_t           pending_hash;
+    /* Set once the peer has left or timed out. Its' commands are still run 
+     * for the turns before 'drop_turn', which the remaining peers agree on. */
+    bool               leaving;
+    uint32_t           drop_turn;
+    uint32_t           last_drop_send;
+    /* For every peer: the first of this peer's turns it was missing when it 
+     * learned of the drop, the first one it is missing now and whether it 
+     * knows the drop turn */
+    uint32_t           votes[NET_MAX_PEERS];
+    uint32_t           haves[NET_MAX_PEERS];
+    bool               knows[NET_MAX_PEERS];
+    /* The turns are kept after they are run, for relaying them to 
+     * the other peers in case this peer is dropped */
+    struct turn_block *incoming[TURN_WINDOW];
+};
+
+struct writer{
+    unsigned char *data;
+    size_t         size;
+    size_t         cap;
+    bool           overflow;
+};
+
+struct reader{
+    const unsigned char *data;
+    size_t               size;
+    size_t               pos;
+    bool                 error;
+};
+
+VEC_TYPE(byte, unsigned char)
+VEC_IMPL(static inline, byte, unsigned char)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                 s_active = false;
+static int                  s_id;
+static int                  s_npeers;
+static sock_t               s_sock = BAD_SOCKET;
+static struct peer          s_peers[NET_MAX_PEERS];
+static unsigned             s_seed;
+static bool                 s_has_seed;
+static bool                 s_desynced;
+
+static uint32_t             s_frame;
+static uint64_t             s_next_frame_time;
+static uint32_t             s_delay;
+
+/* The commands issued locally which haven't been scheduled for a turn yet */
+static vec_byte_t           s_pending;
+/* Our turns which haven't been acknowledged by all the peers yet */
+static struct turn_block   *s_outgoing[TURN_WINDOW];
+static uint32_t             s_oldest_out;
+static uint32_t             s_next_send;
+static bool                 s_sent_new;
+
+static uint32_t             s_report_turn;
+static uint64_t             s_report_hash;
+static uint32_t             s_hash_turns[HASH_HISTORY];
+static uint64_t             s_hashes[HASH_HISTORY];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void put_bytes(struct writer *w, const void *src, size_t size)
+{
+    if(w->size + size > w->cap) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->data + w->size, src, size);
+    w->size += size;
+}
+
+static void put_u8(struct writer *w, uint8_t val)
+{
+    put_bytes(w, &val, 1);
+}
+
+static void put_u16(struct writer *w, uint16_t val)
+{
+    unsigned char bytes[2] = {val, val >> 8};
+    put_bytes(w, bytes, sizeof(bytes));
+}
+
+static void put_u32(struct writer *w, uint32_t val)
+{
+    unsigned char bytes[4] = {val, val >> 8, val >> 16, val >> 24};
+    put_bytes(w, bytes, sizeof(bytes));
+}
+
+static void put_u64(struct writer *w, uint64_t val)
+{
+    put_u32(w, (uint32_t)val);
+    put_u32(w, (uint32_t)(val >> 32));
+}
+
+static void put_float(struct writer *w, float val)
+{
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    put_u32(w, bits);
+}
+
+static const unsigned char *get_bytes(struct reader *r, size_t size)
+{
+    if(r->pos + size > r->size) {
+        r->error = true;
+        return NULL;
+    }
+    const unsigned char *ret = r->data + r->pos;
+    r->pos += size;
+    return ret;
+}
+
+static uint8_t get_u8(struct reader *r)
+{
+    const unsigned char *b = get_bytes(r, 1);
+    return b ? b[0] : 0;
+}
+
+static uint16_t get_u16(struct reader *r)
+{
+    const unsigned char *b = get_bytes(r, 2);
+    return b ? (b[0] | (b[1] << 8)) : 0;
+}
+
+static uint32_t get_u32(struct reader *r)
+{
+    const unsigned char *b = get_bytes(r, 4);
+    return b ? (b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24)) : 0;
+}
+
+static uint64_t get_u64(struct reader *r)
+{
+    uint64_t lo = get_u32(r);
+    uint64_t hi = get_u32(r);
+    return lo | (hi << 32);
+}
+
+static float get_float(struct reader *r)
+{
+    uint32_t bits = get_u32(r);
+    float ret;
+    memcpy(&ret, &bits, sizeof(ret));
+    return ret;
+}
+
+static uint32_t now_ms(void)
+{
+    return SDL_GetTicks();
+}
+
+static uint32_t curr_turn(void)
+{
+    return s_frame / FRAMES_PER_TURN;
+}
+
+static struct turn_block *block_create(uint32_t turn, const void *data, size_t size, 
+                                       uint16_t ncmds)
+{
+    struct turn_block *ret = malloc(sizeof(struct turn_block) + size);
+    if(!ret)
+        return NULL;
+    ret->turn = turn;
+    ret->hash_turn = NO_HASH;
+    ret->hash = 0;
+    ret->ncmds = ncmds;
+    ret->size = size;
+    memcpy(ret->data, data, size);
+    return ret;
+}
+
+static void free_incoming(struct peer *peer)
+{
+    for(int i = 0; i < TURN_WINDOW; i++) {
+        free(peer->incoming[i]);
+        peer->incoming[i] = NULL;
+    }
+}
+
+static bool remains(int id)
+{
+    return !s_peers[id].dropped && !s_peers[id].leaving;
+}
+
+static void set_deterministic(void)
+{
+    struct sval on = (struct sval){
+        .type = ST_TYPE_BOOL,
+        .as_bool = true
+    };
+    ss_e status = Settings_SetNoPersist("pf.game.deterministic_movement", &on);
+    assert(status == SS_OKAY);
+    (void)status;
+}
+
+static bool parse_peers(const char *list)
+{
+    char copy[1024];
+    if(strlen(list) >= sizeof(copy))
+        return false;
+    strcpy(copy, list);
+
+    s_npeers = 0;
+    char *tok = copy;
+    while(tok) {
+
+        char *next = strchr(tok, ',');
+        if(next) {
+            *next++ = '\0';
+        }
+        if(s_npeers == NET_MAX_PEERS)
+            return false;
+
+        char *port = strrchr(tok, ':');
+        if(!port)
+            return false;
+        *port++ = '\0';
+
+        struct addrinfo hints = {0}, *result;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if(getaddrinfo(tok, port, &hints, &result) != 0)
+            return false;
+
+        memcpy(&s_peers[s_npeers++].addr, result->ai_addr, sizeof(struct sockaddr_in));
+        freeaddrinfo(result);
+        tok = next;
+    }
+    return (s_npeers >= 2);
+}
+
+static bool open_socket(void)
+{
+    s_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(s_sock == BAD_SOCKET)
+        return false;
+
+    struct sockaddr_in local = {0};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = s_peers[s_id].addr.sin_port;
+
+#ifdef _WIN32
+    u_long nonblocking = 1;
+    bool ret = (bind(s_sock, (struct sockaddr*)&local, sizeof(local)) == 0)
+            && (ioctlsocket(s_sock, FIONBIO, &nonblocking) == 0);
+#else
+    bool ret = (bind(s_sock, (struct sockaddr*)&local, sizeof(local)) == 0)
+            && (fcntl(s_sock, F_SETFL, fcntl(s_sock, F_GETFL, 0) | O_NONBLOCK) == 0);
+#endif
+    if(!ret) {
+        close_socket(s_sock);
+        s_sock = BAD_SOCKET;
+    }
+    return ret;
+}
+
+static void write_header(struct writer *w, enum packet_type type, struct peer *peer, 
+                         uint32_t now)
+{
+    put_u32(w, NET_MAGIC);
+    put_u8(w, NET_VERSION);
+    put_u8(w, type);
+    put_u8(w, s_id);
+    put_u32(w, now);
+    put_u32(w, peer->echo_time);
+    put_u32(w, peer->echo_time ? now - peer->echo_recv : 0);
+    put_u32(w, peer->next_turn);
+}
+
+static void send_datagram(struct peer *peer, const struct writer *w, uint32_t now)
+{
+    assert(!w->overflow);
+    sendto(s_sock, (const char*)w->data, w->size, 0, 
+        (const struct sockaddr*)&peer->addr, sizeof(peer->addr));
+    peer->last_send = now;
+}
+
+static void send_simple(struct peer *peer, enum packet_type type, uint32_t now)
+{
+    unsigned char buff[64];
+    struct writer w = {buff, 0, sizeof(buff)};
+    write_header(&w, type, peer, now);
+    if(type == PACKET_HELLO) {
+        put_u32(&w, s_has_seed ? s_seed : 0);
+    }
+    send_datagram(peer, &w, now);
+}
+
+static bool put_block(struct writer *w, const struct turn_block *block)
+{
+    if(w->size + BLOCK_HEADER_SIZE + block->size > w->cap)
+        return false;
+
+    put_u32(w, block->turn);
+    put_u32(w, block->hash_turn);
+    put_u64(w, block->hash);
+    put_u16(w, block->ncmds);
+    put_u16(w, block->size);
+    put_bytes(w, block->data, block->size);
+    return true;
+}
+
+static void send_turns(struct peer *peer, uint32_t now)
+{
+    unsigned char buff[MAX_DATAGRAM];
+    struct writer w = {buff, 0, sizeof(buff)};
+    write_header(&w, PACKET_TURNS, peer, now);
+
+    /* Send as many of the unacknowledged turns as fit */
+    size_t count_pos = w.size;
+    put_u8(&w, 0);
+    int nblocks = 0;
+
+    for(uint32_t turn = peer->acked; turn < s_next_send && nblocks < UINT8_MAX; turn++) {
+
+        const struct turn_block *block = s_outgoing[turn % TURN_WINDOW];
+        assert(block && block->turn == turn);
+        if(!put_block(&w, block))
+            break;
+        nblocks++;
+    }
+    w.data[count_pos] = nblocks;
+
+    send_datagram(peer, &w, now);
+    peer->ack_dirty = false;
+}
+
+static void send_bye(struct peer *peer, bool complete, uint32_t now)
+{
+    unsigned char buff[64];
+    struct writer w = {buff, 0, sizeof(buff)};
+    write_header(&w, PACKET_BYE, peer, now);
+    put_u32(&w, s_next_send);
+    put_u8(&w, complete);
+    send_datagram(peer, &w, now);
+}
+
+static void send_drop(struct peer *peer, int target, uint32_t now)
+{
+    const struct peer *leaving = &s_peers[target];
+    unsigned char buff[64];
+    struct writer w = {buff, 0, sizeof(buff)};
+    write_header(&w, PACKET_DROP, peer, now);
+    put_u8(&w, target);
+    put_u32(&w, leaving->votes[s_id]);
+    put_u32(&w, leaving->next_turn);
+    put_u32(&w, leaving->drop_turn);
+    send_datagram(peer, &w, now);
+}
+
+/* Pass on the turns of a leaving peer which the receiver is missing */
+static void send_relay(struct peer *peer, int target, uint32_t from, uint32_t now)
+{
+    const struct peer *leaving = &s_peers[target];
+    unsigned char buff[MAX_DATAGRAM];
+    struct writer w = {buff, 0, sizeof(buff)};
+    write_header(&w, PACKET_RELAY, peer, now);
+    put_u8(&w, target);
+
+    size_t count_pos = w.size;
+    put_u8(&w, 0);
+    int nblocks = 0;
+
+    for(uint32_t turn = from; turn < leaving->drop_turn && nblocks < UINT8_MAX; turn++) {
+
+        const struct turn_block *block = leaving->incoming[turn % TURN_WINDOW];
+        if(!block || block->turn != turn)
+            continue;
+        if(!put_block(&w, block))
+            break;
+        nblocks++;
+    }
+    w.data[count_pos] = nblocks;
+
+    if(nblocks > 0) {
+        send_datagram(peer, &w, now);
+    }
+}
+
+static void compare_hashes(int peer, uint32_t turn, uint64_t local, uint64_t remote)
+{
+    if(local == remote || s_desynced)
+        return;
+
+    s_desynced = true;
+    fprintf(stderr, "The session desynced from peer %d at turn %u "
+        "[local: %016llx, remote: %016llx]\n", peer, turn,
+        (unsigned long long)local, (unsigned long long)remote);
+}
+
+static void on_remote_hash(int id, uint32_t turn, uint64_t hash)
+{
+    size_t idx = (turn / HASH_INTERVAL) % HASH_HISTORY;
+    if(s_hash_turns[idx] == turn) {
+        compare_hashes(id, turn, s_hashes[idx], hash);
+        return;
+    }
+    s_peers[id].pending_hash_turn = turn;
+    s_peers[id].pending_hash = hash;
+}
+
+static void on_local_hash(uint32_t turn, uint64_t hash)
+{
+    size_t idx = (turn / HASH_INTERVAL) % HASH_HISTORY;
+    s_hash_turns[idx] = turn;
+    s_hashes[idx] = hash;
+
+    s_report_turn = turn;
+    s_report_hash = hash;
+
+    for(int i = 0; i < s_npeers; i++) {
+        struct peer *peer = &s_peers[i];
+        if(i == s_id || peer->pending_hash_turn != turn)
+            continue;
+        compare_hashes(i, turn, hash, peer->pending_hash);
+        peer->pending_hash_turn = NO_HASH;
+    }
+}
+
+static void update_rtt(struct peer *peer, float sample)
+{
+    if(!peer->has_rtt) {
+        peer->srtt = sample;
+        peer->rttvar = sample / 2.0f;
+        peer->has_rtt = true;
+        return;
+    }
+    peer->rttvar = 0.75f * peer->rttvar + 0.25f * fabsf(peer->srtt - sample);
+    peer->srtt = 0.875f * peer->srtt + 0.125f * sample;
+}
+
+static void handle_turns(int id, struct reader *r)
+{
+    struct peer *peer = &s_peers[id];
+    int nblocks = get_u8(r);
+
+    for(int i = 0; i < nblocks; i++) {
+
+        uint32_t turn = get_u32(r);
+        uint32_t hash_turn = get_u32(r);
+        uint64_t hash = get_u64(r);
+        uint16_t ncmds = get_u16(r);
+        uint16_t size = get_u16(r);
+        const unsigned char *data = get_bytes(r, size);
+        if(r->error || size > MAX_TURN_BYTES)
+            return;
+
+        /* Acknowledge duplicates too, as our last ack may have been lost */
+        peer->ack_dirty = true;
+        if(turn < peer->next_turn || turn >= curr_turn() + TURN_WINDOW)
+            continue;
+
+        struct turn_block **slot = &peer->incoming[turn % TURN_WINDOW];
+        if(*slot && (*slot)->turn == turn)
+            continue;
+        free(*slot);
+        if(!(*slot = block_create(turn, data, size, ncmds)))
+            continue;
+
+        if(hash_turn != NO_HASH) {
+            on_remote_hash(id, hash_turn, hash);
+        }
+
+        struct turn_block *next;
+        while((next = peer->incoming[peer->next_turn % TURN_WINDOW]) 
+            && next->turn == peer->next_turn) {
+            peer->next_turn++;
+        }
+    }
+}
+
+/* Every peer decides to drop a peer on its' own, at a different point in 
+ * the game. Our vote is the first of the peer's turns that we don't have, 
+ * and we don't run any turn past it until the drop turn is agreed on. 
+ */
+static void mark_leaving(int id, const char *reason)
+{
+    struct peer *peer = &s_peers[id];
+    if(peer->dropped || peer->leaving)
+        return;
+
+    peer->leaving = true;
+    peer->drop_turn = NO_TURN;
+    peer->last_drop_send = now_ms() - RESEND_MS;
+    for(int i = 0; i < NET_MAX_PEERS; i++) {
+        peer->votes[i] = NO_TURN;
+        peer->haves[i] = NO_TURN;
+        peer->knows[i] = false;
+    }
+    peer->votes[s_id] = peer->next_turn;
+    printf("Peer %d %s.\n", id, reason);
+}
+
+static void handle_bye(int id, struct reader *r)
+{
+    uint32_t final = get_u32(r);
+    bool complete = get_u8(r);
+    if(r->error)
+        return;
+
+    struct peer *peer = &s_peers[id];
+    mark_leaving(id, "has left the session");
+
+    /* All the peers acknowledged the leaver's turns, so all 
+     * of them can be run without waiting for the votes */
+    if(complete && peer->drop_turn == NO_TURN && peer->next_turn >= final) {
+        peer->drop_turn = final;
+    }
+}
+
+static void handle_drop(int id, struct reader *r)
+{
+    uint8_t target = get_u8(r);
+    uint32_t vote = get_u32(r);
+    uint32_t have = get_u32(r);
+    uint32_t drop_turn = get_u32(r);
+    if(r->error || target >= s_npeers || target == s_id || target == id)
+        return;
+
+    /* The sender may not have heard that we are done with the peer yet */
+    struct peer *peer = &s_peers[target];
+    if(peer->dropped) {
+        send_drop(&s_peers[id], target, now_ms());
+        return;
+    }
+
+    mark_leaving(target, "was dropped by another peer");
+    peer->votes[id] = vote;
+    peer->haves[id] = have;
+    peer->knows[id] = (drop_turn != NO_TURN);
+    if(peer->drop_turn == NO_TURN) {
+        peer->drop_turn = drop_turn;
+    }
+}
+
+static void handle_relay(struct reader *r)
+{
+    uint8_t target = get_u8(r);
+    if(r->error || target >= s_npeers || target == s_id)
+        return;
+    if(!s_peers[target].leaving || s_peers[target].dropped)
+        return;
+    handle_turns(target, r);
+}
+
+static bool same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+    return a->sin_family == b->sin_family
+        && a->sin_port == b->sin_port
+        && a->sin_addr.s_addr == b->sin_addr.s_addr;
+}
+
+static void handle_packet(const struct sockaddr_in *from, const unsigned char *data, size_t size)
+{
+    struct reader r = {data, size, 0, false};
+    uint32_t magic = get_u32(&r);
+    uint8_t version = get_u8(&r);
+    uint8_t type = get_u8(&r);
+    uint8_t sender = get_u8(&r);
+    uint32_t send_time = get_u32(&r);
+    uint32_t echo_time = get_u32(&r);
+    uint32_t echo_held = get_u32(&r);
+    uint32_t ack = get_u32(&r);
+
+    if(r.error || magic != NET_MAGIC || version != NET_VERSION)
+        return;
+    if(sender >= s_npeers || sender == s_id || s_peers[sender].dropped)
+        return;
+    /* The sender ID in the packet can't be trusted on its' own: anyone able 
+     * to reach the port could otherwise act on behalf of another player */
+    if(!same_addr(from, &s_peers[sender].addr))
+        return;
+
+    struct peer *peer = &s_peers[sender];
+    uint32_t now = now_ms();
+
+    /* Apart from a late BYE, anything still coming from a 
+     * peer which has been voted out is ignored */
+    if(peer->leaving) {
+        if(type == PACKET_BYE) {
+            handle_bye(sender, &r);
+        }
+        return;
+    }
+
+    peer->connected = true;
+    peer->last_recv = now;
+    peer->echo_time = send_time;
+    peer->echo_recv = now;
+    if(echo_time && (now - echo_time) >= echo_held) {
+        update_rtt(peer, now - echo_time - echo_held);
+    }
+    peer->acked = MAX(peer->acked, MIN(ack, s_next_send));
+
+    switch(type) {
+    case PACKET_HELLO: {
+        uint32_t seed = get_u32(&r);
+        if(!r.error && sender == 0) {
+            s_seed = seed;
+            s_has_seed = true;
+        }
+        /* The peer is still waiting for everyone to connect */
+        if(s_active) {
+            send_simple(peer, PACKET_HELLO, now);
+        }
+        break;
+    }
+    case PACKET_TURNS:
+        handle_turns(sender, &r);
+        break;
+    case PACKET_BYE:
+        handle_bye(sender, &r);
+        break;
+    case PACKET_DROP:
+        handle_drop(sender, &r);
+        break;
+    case PACKET_RELAY:
+        handle_relay(&r);
+        break;
+    default:
+        break;
+    }
+}
+
+static void poll_socket(void)
+{
+    unsigned char buff[MAX_DATAGRAM];
+    while(true) {
+        struct sockaddr_in from;
+        socklen_t fromlen = sizeof(from);
+        int len = recvfrom(s_sock, (char*)buff, sizeof(buff), 0, 
+            (struct sockaddr*)&from, &fromlen);
+        if(len <= 0)
+            break;
+        if(fromlen != sizeof(from))
+            continue;
+        handle_packet(&from, buff, len);
+    }
+}
+
+static bool all_connected(void)
+{
+    for(int i = 0; i < s_npeers; i++) {
+        if(i != s_id && !s_peers[i].connected)
+            return false;
+    }
+    return true;
+}
+
+static void check_timeouts(void)
+{
+    uint32_t now = now_ms();
+    for(int i = 0; i < s_npeers; i++) {
+        if(i == s_id || !remains(i))
+            continue;
+        if(now - s_peers[i].last_recv > PEER_TIMEOUT_MS) {
+            mark_leaving(i, "timed out");
+        }
+    }
+}
+
+/* Once all the remaining peers have voted, the drop turn is the furthest any 
+ * of them got. Nobody can have run a later turn with the peer's commands, and 
+ * the turns before it are relayed to the peers missing them. The peer is only 
+ * forgotten once everyone knows the drop turn and has all of the turns.
+ */
+static void update_drops(void)
+{
+    uint32_t now = now_ms();
+    for(int i = 0; i < s_npeers; i++) {
+
+        struct peer *peer = &s_peers[i];
+        if(!peer->leaving || peer->dropped)
+            continue;
+
+        if(peer->drop_turn == NO_TURN) {
+
+            bool voted = true;
+            uint32_t max_vote = 0;
+            for(int j = 0; j < s_npeers; j++) {
+                if(!remains(j))
+                    continue;
+                voted = voted && (peer->votes[j] != NO_TURN);
+                max_vote = MAX(max_vote, peer->votes[j]);
+            }
+            if(voted) {
+                peer->drop_turn = max_vote;
+            }
+        }
+
+        bool settled = (peer->drop_turn != NO_TURN)
+                    && (peer->next_turn >= peer->drop_turn)
+                    && (curr_turn() >= peer->drop_turn);
+        for(int j = 0; j < s_npeers; j++) {
+            if(j == s_id || !remains(j))
+                continue;
+            settled = settled && peer->knows[j] 
+                   && peer->haves[j] != NO_TURN && peer->haves[j] >= peer->drop_turn;
+        }
+        if(settled) {
+            peer->dropped = true;
+            free_incoming(peer);
+            printf("Peer %d was dropped after turn %u.\n", i, peer->drop_turn - 1);
+            continue;
+        }
+
+        if(now - peer->last_drop_send < RESEND_MS)
+            continue;
+        peer->last_drop_send = now;
+
+        for(int j = 0; j < s_npeers; j++) {
+            if(j == s_id || !remains(j))
+                continue;
+            send_drop(&s_peers[j], i, now);
+            if(peer->drop_turn != NO_TURN 
+            && peer->haves[j] != NO_TURN && peer->haves[j] < peer->drop_turn) {
+                send_relay(&s_peers[j], i, peer->haves[j], now);
+            }
+        }
+    }
+}
+
+static bool all_acked(void)
+{
+    for(int i = 0; i < s_npeers; i++) {
+        if(i != s_id && remains(i) && s_peers[i].acked < s_next_send)
+            return false;
+    }
+    return true;
+}
+
+/* For a peer that is leaving, this is only known once the drop 
+ * turn is agreed on, unless the turn is before our vote */
+static bool runs_turn(const struct peer *peer, uint32_t turn)
+{
+    if(peer->dropped)
+        return false;
+    if(!peer->leaving)
+        return true;
+    if(peer->drop_turn != NO_TURN)
+        return (turn < peer->drop_turn);
+    return (turn < peer->votes[s_id]);
+}
+
+static void free_acked(void)
+{
+    uint32_t min_acked = s_next_send;
+    for(int i = 0; i < s_npeers; i++) {
+        if(i == s_id || !remains(i))
+            continue;
+        min_acked = MIN(min_acked, s_peers[i].acked);
+    }
+    while(s_oldest_out < min_acked) {
+        free(s_outgoing[s_oldest_out % TURN_WINDOW]);
+        s_outgoing[s_oldest_out % TURN_WINDOW] = NULL;
+        s_oldest_out++;
+    }
+}
+
+static void flush(void)
+{
+    uint32_t now = now_ms();
+    for(int i = 0; i < s_npeers; i++) {
+
+        struct peer *peer = &s_peers[i];
+        if(i == s_id || !remains(i))
+            continue;
+
+        bool unacked = (peer->acked < s_next_send);
+        bool resend = unacked && (s_sent_new || (now - peer->last_send >= RESEND_MS));
+        if(resend || peer->ack_dirty || (now - peer->last_send >= KEEPALIVE_MS)) {
+            send_turns(peer, now);
+        }
+    }
+    s_sent_new = false;
+}
+
+/* Use enough turns of delay to cover the one-way latency to the furthest 
+ * peer, plus a margin for jitter */
+static uint32_t input_delay(void)
+{
+    float latency = 0.0f;
+    for(int i = 0; i < s_npeers; i++) {
+        const struct peer *peer = &s_peers[i];
+        if(i == s_id || !remains(i) || !peer->has_rtt)
+            continue;
+        latency = MAX(latency, peer->srtt / 2.0f + 2.0f * peer->rttvar);
+    }
+    uint32_t ret = 1 + (uint32_t)ceilf(latency / TURN_MS);
+    return MIN(ret, MAX_DELAY);
+}
+
+static size_t command_size(const unsigned char *cmd)
+{
+    uint16_t nents = cmd[CMD_HEADER_SIZE - 2] | (cmd[CMD_HEADER_SIZE - 1] << 8);
+    return CMD_HEADER_SIZE + nents * sizeof(uint32_t);
+}
+
+static struct turn_block *take_pending(uint32_t turn)
+{
+    size_t size = 0;
+    uint16_t ncmds = 0;
+    while(size < vec_size(&s_pending)) {
+        size_t next = command_size(s_pending.array + size);
+        if(size + next > MAX_TURN_BYTES)
+            break;
+        size += next;
+        ncmds++;
+    }
+
+    struct turn_block *ret = block_create(turn, s_pending.array, size, ncmds);
+    if(!ret)
+        return NULL;
+
+    memmove(s_pending.array, s_pending.array + size, vec_size(&s_pending) - size);
+    s_pending.size -= size;
+
+    if(s_report_turn != NO_HASH) {
+        ret->hash_turn = s_report_turn;
+        ret->hash = s_report_hash;
+        s_report_turn = NO_HASH;
+    }
+    return ret;
+}
+
+static void queue_turns(void)
+{
+    struct peer *self = &s_peers[s_id];
+    s_delay = input_delay();
+
+    /* A decrease in the delay is absorbed by not sending any turns until 
+     * the current turn catches up - every turn is sent exactly once */
+    while(s_next_send < curr_turn() + s_delay
+       && s_next_send - s_oldest_out < TURN_WINDOW) {
+
+        struct turn_block *block = take_pending(s_next_send);
+        struct turn_block *copy = block ? block_create(block->turn, block->data, 
+            block->size, block->ncmds) : NULL;
+        if(!copy) {
+            free(block);
+            return;
+        }
+
+        /* Our own commands are executed along with everyone else's */
+        s_outgoing[s_next_send % TURN_WINDOW] = block;
+        free(self->incoming[s_next_send % TURN_WINDOW]);
+        self->incoming[s_next_send % TURN_WINDOW] = copy;
+        self->next_turn = ++s_next_send;
+        s_sent_new = true;
+    }
+}
+
+static void execute_block(int id, const struct turn_block *block)
+{
+    struct reader r = {block->data, block->size, 0, false};
+    uint32_t ents[MAX_CMD_ENTS];
+
+    for(int i = 0; i < block->ncmds; i++) {
+
+        struct replay_cmd cmd = {0};
+        cmd.type = get_u8(&r);
+        cmd.attack = get_u8(&r);
+        cmd.target = get_u32(&r);
+        cmd.pos.x = get_float(&r);
+        cmd.pos.y = get_float(&r);
+        cmd.pos.z = get_float(&r);
+        cmd.orientation.x = get_float(&r);
+        cmd.orientation.z = get_float(&r);
+        cmd.nents = get_u16(&r);
+
+        if(r.error || cmd.type == REPLAY_CMD_SELECT || cmd.type >= REPLAY_CMD_SCRIPT 
+        || cmd.nents > MAX_CMD_ENTS) {
+            fprintf(stderr, "Malformed commands from peer %d for turn %u\n", id, block->turn);
+            return;
+        }
+        for(size_t j = 0; j < cmd.nents; j++) {
+            ents[j] = get_u32(&r);
+        }
+        if(r.error)
+            return;
+
+        cmd.ents = ents;
+        Replay_ExecuteCommand(&cmd);
+    }
+}
+
+static void append_command(const struct replay_cmd *cmd, const uint32_t *ents, size_t nents)
+{
+    unsigned char buff[CMD_HEADER_SIZE + MAX_CMD_ENTS * sizeof(uint32_t)];
+    struct writer w = {buff, 0, sizeof(buff)};
+
+    put_u8(&w, cmd->type);
+    put_u8(&w, cmd->attack);
+    put_u32(&w, cmd->target);
+    put_float(&w, cmd->pos.x);
+    put_float(&w, cmd->pos.y);
+    put_float(&w, cmd->pos.z);
+    put_float(&w, cmd->orientation.x);
+    put_float(&w, cmd->orientation.z);
+    put_u16(&w, nents);
+    for(size_t i = 0; i < nents; i++) {
+        put_u32(&w, ents[i]);
+    }
+    assert(!w.overflow);
+
+    size_t base = vec_size(&s_pending);
+    if(base + w.size > s_pending.capacity 
+    && !vec_byte_resize(&s_pending, MAX(base + w.size, s_pending.capacity * 2)))
+        return;
+    memcpy(s_pending.array + base, buff, w.size);
+    s_pending.size += w.size;
+}
+
+static void reset_state(void)
+{
+    memset(s_peers, 0, sizeof(s_peers));
+    for(int i = 0; i < NET_MAX_PEERS; i++) {
+        s_peers[i].next_turn = INITIAL_DELAY;
+        s_peers[i].acked = INITIAL_DELAY;
+        s_peers[i].pending_hash_turn = NO_HASH;
+    }
+    for(int i = 0; i < HASH_HISTORY; i++) {
+        s_hash_turns[i] = NO_HASH;
+    }
+    memset(s_outgoing, 0, sizeof(s_outgoing));
+
+    s_has_seed = false;
+    s_desynced = false;
+    s_frame = 0;
+    s_delay = INITIAL_DELAY;
+    s_oldest_out = INITIAL_DELAY;
+    s_next_send = INITIAL_DELAY;
+    s_sent_new = false;
+    s_report_turn = NO_HASH;
+}
+
+static void close_connection(void)
+{
+    for(int i = 0; i < s_npeers; i++) {
+        free_incoming(&s_peers[i]);
+    }
+    for(int i = 0; i < TURN_WINDOW; i++) {
+        free(s_outgoing[i]);
+        s_outgoing[i] = NULL;
+    }
+    vec_byte_destroy(&s_pending);
+    close_socket(s_sock);
+    s_sock = BAD_SOCKET;
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Net_Init(const char *peers, int id, uint32_t timeout_ms)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!s_active);
+
+    reset_state();
+    if(!parse_peers(peers)) {
+        fprintf(stderr, "Invalid list of peers: %s\n", peers);
+        return false;
+    }
+    if(id < 0 || id >= s_npeers) {
+        fprintf(stderr, "Invalid peer ID: %d\n", id);
+        return false;
+    }
+    s_id = id;
+
+#ifdef _WIN32
+    WSADATA wsa;
+    if(WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return false;
+#endif
+
+    vec_byte_init(&s_pending);
+    if(!open_socket()) {
+        fprintf(stderr, "Failed to open a socket on port %d\n", 
+            ntohs(s_peers[s_id].addr.sin_port));
+        close_connection();
+        return false;
+    }
+
+    if(s_id == 0) {
+        s_seed = (unsigned)SDL_GetPerformanceCounter();
+        s_has_seed = true;
+    }
+
+    printf("Waiting for %d peers to connect...\n", s_npeers - 1);
+    uint32_t start = now_ms();
+    uint32_t last_hello = start - HELLO_INTERVAL_MS;
+
+    while(!all_connected() || !s_has_seed) {
+
+        uint32_t now = now_ms();
+        if(now - start > timeout_ms) {
+            fprintf(stderr, "Timed out waiting for the peers to connect.\n");
+            close_connection();
+            return false;
+        }
+        if(now - last_hello >= HELLO_INTERVAL_MS) {
+            for(int i = 0; i < s_npeers; i++) {
+                if(i != s_id) {
+                    send_simple(&s_peers[i], PACKET_HELLO, now);
+                }
+            }
+            last_hello = now;
+        }
+        poll_socket();
+        SDL_Delay(5);
+    }
+
+    uint32_t now = now_ms();
+    for(int i = 0; i < s_npeers; i++) {
+        s_peers[i].last_recv = now;
+    }
+
+    s_active = true;
+    s_next_frame_time = SDL_GetPerformanceCounter();
+
+    srand(s_seed);
+    set_deterministic();
+    printf("All peers connected [seed: %u].\n", s_seed);
+    return true;
+}
+
+bool Net_Shutdown(void)
+{
+    if(!s_active)
+        return true;
+
+    /* Give the peers a moment to acknowledge all of our turns, so that 
+     * they can run all of them before dropping us */
+    uint32_t start = now_ms();
+    while(!all_acked() && now_ms() - start < BYE_LINGER_MS) {
+        poll_socket();
+        flush();
+        SDL_Delay(5);
+    }
+    bool complete = all_acked();
+
+    uint32_t now = now_ms();
+    for(int i = 0; i < s_npeers; i++) {
+        if(i == s_id || !remains(i))
+            continue;
+        for(int j = 0; j < NUM_BYES; j++) {
+            send_bye(&s_peers[i], complete, now);
+        }
+    }
+
+    close_connection();
+    s_active = false;
+    return !s_desynced;
+}
+
+bool Net_Active(void)
+{
+    return s_active;
+}
+
+unsigned Net_Seed(void)
+{
+    assert(s_active);
+    return s_seed;
+}
+
+void Net_Service(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_active);
+
+    poll_socket();
+    check_timeouts();
+    update_drops();
+    free_acked();
+    flush();
+}
+
+bool Net_FrameReady(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_active);
+
+    if(SDL_GetPerformanceCounter() < s_next_frame_time)
+        return false;
+    if(s_frame % FRAMES_PER_TURN != 0)
+        return true;
+
+    uint32_t turn = curr_turn();
+    if(turn < INITIAL_DELAY)
+        return true;
+
+    for(int i = 0; i < s_npeers; i++) {
+        const struct peer *peer = &s_peers[i];
+        if(peer->leaving && !peer->dropped && peer->drop_turn == NO_TURN 
+        && turn >= peer->votes[s_id])
+            return false;
+        if(runs_turn(peer, turn) && peer->next_turn <= turn)
+            return false;
+    }
+    return true;
+}
+
+void Net_BeginFrame(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_active);
+
+    /* Allow catching up by a couple of frames after a stall, but no more */
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t period = SDL_GetPerformanceFrequency() / 60;
+    s_next_frame_time = MAX(s_next_frame_time + period, now - 2 * period);
+
+    uint32_t turn = curr_turn();
+    if(s_frame % FRAMES_PER_TURN != 0 || turn < INITIAL_DELAY)
+        return;
+
+    /* Apply the commands in the order of the peer IDs, so that 
+     * every peer applies them in the same order */
+    for(int i = 0; i < s_npeers; i++) {
+
+        struct peer *peer = &s_peers[i];
+        if(!runs_turn(peer, turn))
+            continue;
+
+        const struct turn_block *block = peer->incoming[turn % TURN_WINDOW];
+        assert(block && block->turn == turn);
+        execute_block(i, block);
+    }
+}
+
+void Net_EndFrame(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_active);
+
+    s_frame++;
+    if(s_frame % FRAMES_PER_TURN != 0)
+        return;
+
+    uint32_t done = curr_turn() - 1;
+    if(done % HASH_INTERVAL == 0) {
+        on_local_hash(done, G_StateHash());
+    }
+    queue_turns();
+    flush();
+}
+
+void Net_IssueCommand(const struct replay_cmd *cmd)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(cmd->type != REPLAY_CMD_SELECT && cmd->type < REPLAY_CMD_SCRIPT);
+
+    if(!s_active) {
+        Replay_ExecuteCommand(cmd);
+        return;
+    }
+
+    /* Large groups are split into several commands, so 
+     * that every command is guaranteed to fit into a turn */
+    size_t first = 0;
+    do{
+        size_t nents = MIN(cmd->nents - first, MAX_CMD_ENTS);
+        append_command(cmd, cmd->ents + first, nents);
+        first += nents;
+    }while(first < cmd->nents);
+}
+
@@ -0,0 +1,93 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef NET_H
+#define NET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct replay_cmd;
+
+#define NET_MAX_PEERS   (8)
+
+/* The network layer runs a multiplayer session in lockstep: every peer runs 
+ * the same simulation, advancing it by exactly one tick per frame, and only 
+ * the commands issued by the players are exchanged over UDP. The frames are 
+ * grouped into turns and the commands issued during a turn are scheduled for 
+ * execution a few turns into the future (the input delay), which is adapted 
+ * to the measured round-trip time. A turn does not start until the commands 
+ * of all the peers for it have arrived. Every so often, the peers exchange a 
+ * hash of the simulation state to detect a desync. 
+ *
+ * When a peer leaves or times out, the remaining peers first agree on the 
+ * turn from which on its' commands are no longer run, and pass each other 
+ * any of its' turns before that one which they are missing. A peer which 
+ * leaves waits for its' turns to be acknowledged before saying goodbye, so 
+ * that the others can drop it right away.
+ *
+ * As with replays, the commands issued by scripts are not exchanged, so the 
+ * scripts must not issue commands in response to input.
+ */
+
+/* 'peers' is a comma-separated list of 'host:port' addresses of all players 
+ * in the session, which is the same for all of them. 'id' is the index of 
+ * the local player in the list. Blocks until all the peers have connected, 
+ * or until the timeout has elapsed. */
+bool     Net_Init(const char *peers, int id, uint32_t timeout_ms);
+/* Returns false if the session desynced */
+bool     Net_Shutdown(void);
+bool     Net_Active(void);
+/* The seed chosen by the first peer, shared by all peers */
+unsigned Net_Seed(void);
+
+/* Exchange packets with the peers. Must be called every iteration of the 
+ * main loop, including while the session is loading. */
+void     Net_Service(void);
+/* Returns true when it's time to run the next simulation frame and the 
+ * commands of all the peers for it have arrived. */
+bool     Net_FrameReady(void);
+/* The main loop brackets every simulation frame with these calls. The 
+ * commands of the turn are issued at the start of its' first frame. */
+void     Net_BeginFrame(void);
+void     Net_EndFrame(void);
+
+/* Issue a player command. In a network session, it is sent to the other 
+ * peers and executed on a later turn. Otherwise, it is executed right away. */
+void     Net_IssueCommand(const struct replay_cmd *cmd);
+
+#endif
+
@@ -38,6 +38,7 @@
 #include "lib/public/khash.h"
 #include "lib/public/vec.h"
 #include "lib/public/pf_string.h"
+#include "lib/public/mem.h"
 #include "render/public/render.h"
 #include "render/public/render_ctrl.h"
 
@@ -46,11 +47,37 @@
 #include <string.h>
 #include <stdint.h>
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define HAVE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
 
 #define PARENT_NONE     ~((uint32_t)0)
 #define GPU_STATE_NAME  "GPU"
 #define GPU_STATE_KEY   UINT64_MAX
 #define GPU_TIMER_HZ    (1 * 1000 * 1000 * 1000)
+#define TRACE_RING_SZ   (64 * 1024) /* must be a power of 2 */
+#define TRACE_MAX_DEPTH (128)
+#define HITCH_WINDOW_MS (2000)
+#define MAX_STATS_SRCS  (16)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+
+/* The histograms use log-linear buckets over microsecond values: every 
+ * power of 2 is split into (1 << HIST_SUB_BITS) linear sub-buckets, giving 
+ * a relative error of about 3%. Values are clamped to HIST_MAX_US. 
+ */
+#define HIST_SUB_BITS   (5)
+#define HIST_SUB_COUNT  (1 << HIST_SUB_BITS)
+#define HIST_MAX_MSB    (26)
+#define HIST_MAX_US     ((1u << (HIST_MAX_MSB + 1)) - 1)
+#define HIST_NBUCKETS   ((HIST_MAX_MSB - HIST_SUB_BITS + 2) * HIST_SUB_COUNT)
+#define HIST_WINDOW     (1024) /* number of most recent samples tracked */
 
 struct perf_entry{
     union{
@@ -66,6 +93,45 @@ struct perf_entry{
     uint32_t name_id;
 };
 
+struct trace_slice{
+    const char *name; /* interned in the owning thread's name table */
+    uint64_t    begin;
+    uint64_t    end;
+    uint32_t    depth;
+    uint32_t    task; /* the scheduler task that was running, if any */
+};
+
+/* Only the owning thread writes to the ring. The head is the total 
+ * number of slices ever written and is published after each slice is 
+ * fully written, so that a reader can tell which slices may have been 
+ * overwritten while it was copying them out.
+ */
+struct trace_ring{
+    SDL_atomic_t       head;
+    uint32_t           depth;
+    uint32_t           task;
+    uint32_t           drained; /* slices already written to the capture */
+    struct{
+        const char *name;
+        uint64_t    begin;
+    }stack[TRACE_MAX_DEPTH];
+    struct trace_slice slices[TRACE_RING_SZ];
+};
+
+/* A rolling histogram of the last HIST_WINDOW samples. The raw samples are 
+ * kept in a ring so that the oldest one can be removed from its' bucket 
+ * when it falls out of the window. There is only ever one writer for each
+ * histogram, but it may be read concurrently.
+ */
+struct histogram{
+    SDL_SpinLock lock;
+    uint32_t     nsamples;
+    uint32_t     next;
+    uint64_t     sum_us;
+    uint32_t     samples[HIST_WINDOW];
+    uint32_t     buckets[HIST_NBUCKETS];
+};
+
 KHASH_MAP_INIT_STR(name_id, uint32_t)
 KHASH_MAP_INIT_INT(id_name, const char *)
 
@@ -94,6 +160,9 @@ struct perf_state{
      */
     int               perf_tree_idx;
     vec_perf_t        perf_trees[NFRAMES_LOGGED];
+    /* Allocated the first time that tracing is enabled 
+     */
+    struct trace_ring *trace;
 };
 
 KHASH_MAP_INIT_INT64(pstate, struct perf_state)
@@ -107,6 +176,30 @@ static khash_t(pstate) *s_thread_state_table;
 static int              s_last_idx = 0;
 static unsigned         s_last_frames_ms[NFRAMES_LOGGED];
 
+static uint64_t         s_trace_ts_base;
+static uint64_t         s_trace_pc_base;
+
+/* Capture state - only touched by the main thread */
+static FILE            *s_capture_stream;
+static uint32_t         s_capture_end_ms;
+static bool             s_capture_prev_trace;
+static bool             s_capture_first_event;
+static uint64_t         s_capture_gpu_base;
+static uint64_t         s_capture_render_frame;
+
+/* Hitch recorder state - only touched by the main thread */
+static float            s_hitch_threshold_ms;
+static bool             s_hitch_prev_trace;
+static uint32_t         s_hitch_last_dump_ms;
+static bool             s_hitch_dumped;
+static perf_stats_src_t s_stats_srcs[MAX_STATS_SRCS];
+static size_t           s_nstats_srcs;
+
+static uint64_t         s_frame_start_pc;
+static struct histogram s_histograms[PERF_METRIC_COUNT];
+
+bool                    g_perf_trace_enabled = false;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -121,6 +214,114 @@ static uint64_t tid_to_key(SDL_threadID tid)
     return ret.as_u64;
 }
 
+static inline uint64_t trace_timestamp(void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return SDL_GetPerformanceCounter();
+#endif
+}
+
+static double trace_ts_hz(void)
+{
+#ifdef HAVE_TSC
+    /* Calibrate the TSC against the performance counter over the time 
+     * that has passed since tracing was first enabled */
+    uint64_t ts = trace_timestamp();
+    uint64_t pc = SDL_GetPerformanceCounter();
+    if(pc == s_trace_pc_base)
+        return SDL_GetPerformanceFrequency();
+    return (double)(ts - s_trace_ts_base) * SDL_GetPerformanceFrequency() / (pc - s_trace_pc_base);
+#else
+    return SDL_GetPerformanceFrequency();
+#endif
+}
+
+static int msb(uint32_t val)
+{
+    int ret = 0;
+    while(val >>= 1)
+        ret++;
+    return ret;
+}
+
+static int hist_bucket(uint32_t us)
+{
+    if(us < HIST_SUB_COUNT * 2)
+        return us;
+    int shift = msb(us) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + ((us >> shift) - HIST_SUB_COUNT);
+}
+
+/* The midpoint of the range of values covered by the bucket */
+static double hist_bucket_value(int idx)
+{
+    if(idx < HIST_SUB_COUNT * 2)
+        return idx;
+    int shift = idx / HIST_SUB_COUNT - 1;
+    uint32_t lower = (uint32_t)(idx % HIST_SUB_COUNT + HIST_SUB_COUNT) << shift;
+    return lower + ((1u << shift) - 1) / 2.0;
+}
+
+static void hist_add(struct histogram *hist, uint32_t us)
+{
+    us = MIN(us, HIST_MAX_US);
+
+    SDL_AtomicLock(&hist->lock);
+    if(hist->nsamples == HIST_WINDOW) {
+        uint32_t old = hist->samples[hist->next];
+        hist->buckets[hist_bucket(old)]--;
+        hist->sum_us -= old;
+    }else{
+        hist->nsamples++;
+    }
+    hist->samples[hist->next] = us;
+    hist->buckets[hist_bucket(us)]++;
+    hist->sum_us += us;
+    hist->next = (hist->next + 1) % HIST_WINDOW;
+    SDL_AtomicUnlock(&hist->lock);
+}
+
+static void hist_report(struct histogram *hist, struct perf_percentiles *out)
+{
+    const double quantiles[] = {0.50, 0.95, 0.99};
+    double *outs[] = {&out->p50_ms, &out->p95_ms, &out->p99_ms};
+    memset(out, 0, sizeof(*out));
+
+    SDL_AtomicLock(&hist->lock);
+    out->nsamples = hist->nsamples;
+    if(hist->nsamples == 0)
+        goto out;
+
+    uint32_t max = 0;
+    for(int i = 0; i < hist->nsamples; i++) {
+        max = MAX(max, hist->samples[i]);
+    }
+    out->max_ms = max / 1000.0;
+    out->mean_ms = ((double)hist->sum_us / hist->nsamples) / 1000.0;
+
+    int q = 0;
+    uint64_t seen = 0;
+    for(int i = 0; i < HIST_NBUCKETS && q < ARR_SIZE(quantiles); i++) {
+        seen += hist->buckets[i];
+        while(q < ARR_SIZE(quantiles) && seen >= quantiles[q] * hist->nsamples) {
+            *outs[q++] = MIN(hist_bucket_value(i), max) / 1000.0;
+        }
+    }
+out:
+    SDL_AtomicUnlock(&hist->lock);
+}
+
+static struct perf_state *pstate_curr(void)
+{
+    SDL_threadID tid = SDL_ThreadID();
+    khiter_t k = kh_get(pstate, s_thread_state_table, tid_to_key(tid));
+    if(k == kh_end(s_thread_state_table))
+        return NULL;
+    return &kh_val(s_thread_state_table, k);
+}
+
 static uint32_t name_id_get(const char *name, struct perf_state *ps)
 {
     khiter_t k = kh_get(name_id, ps->name_id_table, name);
@@ -153,6 +354,292 @@ const char *name_for_id(struct perf_state *ps, uint32_t id)
     return NULL;
 }
 
+static void capture_write_name(FILE *stream, const char *name)
+{
+    fputc('"', stream);
+    for(const char *c = name; *c; c++) {
+        if(*c == '"' || *c == '\\')
+            fputc('\\', stream);
+        if((unsigned char)*c >= 0x20)
+            fputc(*c, stream);
+    }
+    fputc('"', stream);
+}
+
+static void capture_write_slice(FILE *stream, bool *first, int pid, int tid, const char *name, 
+                                uint32_t task, double ts_us, double dur_us)
+{
+    fprintf(stream, "%s\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+        *first ? "" : ",", pid, tid, ts_us, dur_us);
+    capture_write_name(stream, name);
+    if(task) {
+        fprintf(stream, ",\"args\":{\"task\":%u}", task);
+    }
+    fputc('}', stream);
+    *first = false;
+}
+
+static void capture_write_thread_name(FILE *stream, bool *first, int pid, int tid, const char *name)
+{
+    fprintf(stream, "%s\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":",
+        *first ? "" : ",", pid, tid);
+    capture_write_name(stream, name);
+    fprintf(stream, "}}");
+    *first = false;
+}
+
+static void capture_write_counter(const char *name, double ts_us, 
+                                  const struct render_pass_stats *stats)
+{
+    fprintf(s_capture_stream, "%s\n{\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"name\":",
+        s_capture_first_event ? "" : ",", ts_us);
+    capture_write_name(s_capture_stream, name);
+    fprintf(s_capture_stream, ",\"args\":{\"draws\":%u,\"tris\":%llu,\"prog_binds\":%u,"
+        "\"tex_binds\":%u,\"upload_kb\":%.1f}}",
+        stats->ndraws + stats->nindirect, (unsigned long long)stats->ntris, stats->nprog_binds, 
+        stats->ntex_binds, stats->upload_bytes / 1024.0);
+    s_capture_first_event = false;
+}
+
+/* The render statistics are sampled once per tick, as counter tracks 
+ * of the render thread's most recently completed frame */
+static void capture_write_render_stats(void)
+{
+    struct render_stats stats;
+    R_GetStats(&stats);
+    if(stats.frame == s_capture_render_frame)
+        return;
+    s_capture_render_frame = stats.frame;
+
+    double ts_us = (trace_timestamp() - s_trace_ts_base) * 1000000.0 / trace_ts_hz();
+    capture_write_counter("render", ts_us, &stats.total);
+
+    for(int i = 0; i < RENDER_STAT_PASS_COUNT; i++) {
+        char name[64];
+        pf_snprintf(name, sizeof(name), "render.%s", R_StatPassName(i));
+        capture_write_counter(name, ts_us, &stats.passes[i]);
+    }
+
+    fprintf(s_capture_stream, ",\n{\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"name\":\"render.commands\","
+        "\"args\":{\"commands\":%u,\"arg_kb\":%.1f}}", ts_us, stats.ncmds, stats.arg_bytes / 1024.0);
+}
+
+/* The memory footprint of every subsystem, sampled once per tick */
+static void capture_write_mem_stats(void)
+{
+    struct mem_tag_stats stats[MEM_TAG_COUNT];
+    size_t nstats = pf_mem_get_stats(stats);
+    double ts_us = (trace_timestamp() - s_trace_ts_base) * 1000000.0 / trace_ts_hz();
+
+    for(int i = 0; i < nstats; i++) {
+        fprintf(s_capture_stream, "%s\n{\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"name\":\"mem.%s\","
+            "\"args\":{\"live_kb\":%.1f,\"peak_kb\":%.1f,\"allocs\":%llu}}", 
+            s_capture_first_event ? "" : ",", ts_us, stats[i].name, 
+            stats[i].live_bytes / 1024.0, stats[i].peak_bytes / 1024.0, 
+            (unsigned long long)stats[i].tick_allocs);
+        s_capture_first_event = false;
+    }
+}
+
+/* Hand off all the CPU slices that were completed since the last drain */
+static void trace_drain_ring(int tid, struct perf_state *ps, double hz, 
+                             perf_slice_cb_t fn, void *user)
+{
+    struct trace_ring *ring = ps->trace;
+    uint32_t head = SDL_AtomicGet(&ring->head);
+
+    /* The slices which the ring has wrapped over are lost */
+    if(head - ring->drained > TRACE_RING_SZ) {
+        ring->drained = head - TRACE_RING_SZ;
+    }
+
+    for(; fn && ring->drained != head; ring->drained++) {
+        const struct trace_slice *slice = &ring->slices[ring->drained & (TRACE_RING_SZ - 1)];
+        fn(&(struct perf_slice){
+            .thread = tid,
+            .threadname = ps->name,
+            .name = slice->name,
+            .task = slice->task,
+            .depth = slice->depth,
+            .begin_us = (slice->begin - s_trace_ts_base) * 1000000.0 / hz,
+            .dur_us = (slice->end - slice->begin) * 1000000.0 / hz
+        }, user);
+    }
+    ring->drained = head;
+}
+
+static void capture_write_cpu(const struct perf_slice *slice, void *user)
+{
+    capture_write_slice(s_capture_stream, &s_capture_first_event, 1, slice->thread, 
+        slice->name, slice->task, slice->begin_us, slice->dur_us);
+}
+
+/* Write out the GPU entries of the oldest logged frame, for which the 
+ * timestamps have already been read back. The GPU timestamps are on 
+ * a different clock, so they're shown as a separate process, relative 
+ * to the first GPU timestamp in the capture. 
+ */
+static void trace_write_gpu(FILE *stream, bool *first, struct perf_state *ps, uint64_t *inout_base)
+{
+    int read_idx = (ps->perf_tree_idx + 1) % NFRAMES_LOGGED;
+    for(int i = 0; i < vec_size(&ps->perf_trees[read_idx]); i++) {
+
+        const struct perf_entry *entry = &vec_AT(&ps->perf_trees[read_idx], i);
+        if(entry->begin.gpu_ts == 0 || entry->end.gpu_ts < entry->begin.gpu_ts)
+            continue;
+        if(!*inout_base) {
+            *inout_base = entry->begin.gpu_ts;
+        }
+        if(entry->begin.gpu_ts < *inout_base)
+            continue;
+
+        capture_write_slice(stream, first, 2, 0, name_for_id(ps, entry->name_id), 0,
+            (entry->begin.gpu_ts - *inout_base) * 1000000.0 / GPU_TIMER_HZ,
+            (entry->end.gpu_ts - entry->begin.gpu_ts) * 1000000.0 / GPU_TIMER_HZ);
+    }
+}
+
+static void capture_drain_gpu(struct perf_state *ps)
+{
+    trace_write_gpu(s_capture_stream, &s_capture_first_event, ps, &s_capture_gpu_base);
+}
+
+/* Copy out the slices currently held in the ring, setting the range of 
+ * slice indices that were not overwritten while they were being copied. 
+ */
+static void trace_copy_ring(struct trace_ring *ring, struct trace_slice *copy, 
+                            uint32_t *out_first, uint32_t *out_head)
+{
+    uint32_t head = SDL_AtomicGet(&ring->head);
+    memcpy(copy, ring->slices, sizeof(struct trace_slice) * TRACE_RING_SZ);
+    uint32_t head_after = SDL_AtomicGet(&ring->head);
+
+    uint32_t first = (head > TRACE_RING_SZ) ? head - TRACE_RING_SZ : 0;
+    if(head_after > TRACE_RING_SZ) {
+        first = MAX(first, head_after - TRACE_RING_SZ);
+    }
+    *out_first = first;
+    *out_head = head;
+}
+
+struct hitch_stats_ctx{
+    FILE *stream;
+    bool  first;
+};
+
+static void hitch_write_stat(const char *name, double value, void *arg)
+{
+    struct hitch_stats_ctx *ctx = arg;
+    fprintf(ctx->stream, "%s", ctx->first ? "" : ",");
+    capture_write_name(ctx->stream, name);
+    fprintf(ctx->stream, ":%.3f", value);
+    ctx->first = false;
+}
+
+/* Write out the last HITCH_WINDOW_MS of the trace of every thread, along 
+ * with the statistics of all the registered sources. The rings are only 
+ * read, so that a capture that is running at the same time is unaffected.
+ */
+static void hitch_dump(double frame_ms)
+{
+    char path[64];
+    pf_snprintf(path, sizeof(path), "pf_hitch_%u.json", SDL_GetTicks());
+
+    FILE *stream = fopen(path, "w");
+    if(!stream)
+        return;
+
+    struct trace_slice *copy = malloc(sizeof(struct trace_slice) * TRACE_RING_SZ);
+    if(!copy) {
+        fclose(stream);
+        return;
+    }
+
+    bool first = true;
+    double hz = trace_ts_hz();
+    uint64_t now = trace_timestamp();
+    uint64_t window = (uint64_t)(HITCH_WINDOW_MS * hz / 1000.0);
+    fprintf(stream, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for(khiter_t k = kh_begin(s_thread_state_table); k != kh_end(s_thread_state_table); k++) {
+
+        if(!kh_exist(s_thread_state_table, k))
+            continue;
+
+        struct perf_state *ps = &kh_val(s_thread_state_table, k);
+        if(kh_key(s_thread_state_table, k) == GPU_STATE_KEY) {
+            uint64_t gpu_base = 0;
+            capture_write_thread_name(stream, &first, 2, 0, ps->name);
+            trace_write_gpu(stream, &first, ps, &gpu_base);
+            continue;
+        }
+
+        capture_write_thread_name(stream, &first, 1, k, ps->name);
+        if(!ps->trace)
+            continue;
+
+        uint32_t begin, head;
+        trace_copy_ring(ps->trace, copy, &begin, &head);
+
+        for(uint32_t i = begin; i < head; i++) {
+
+            const struct trace_slice *slice = &copy[i & (TRACE_RING_SZ - 1)];
+            if(slice->end + window < now)
+                continue;
+            capture_write_slice(stream, &first, 1, k, slice->name, slice->task,
+                (slice->begin - s_trace_ts_base) * 1000000.0 / hz,
+                (slice->end - slice->begin) * 1000000.0 / hz);
+        }
+    }
+    free(copy);
+
+    /* The simulation state at the time of the hitch is attached to an 
+     * instant event marking the end of the slow frame */
+    fprintf(stream, "%s\n{\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%.3f,"
+        "\"name\":\"hitch\",\"args\":{", first ? "" : ",", 
+        (now - s_trace_ts_base) * 1000000.0 / hz);
+
+    struct hitch_stats_ctx ctx = (struct hitch_stats_ctx){stream, true};
+    hitch_write_stat("frame_ms", frame_ms, &ctx);
+    hitch_write_stat("threshold_ms", s_hitch_threshold_ms, &ctx);
+    Perf_EmitStats(hitch_write_stat, &ctx);
+    fprintf(stream, "}}\n]}\n");
+    fclose(stream);
+}
+
+static void hitch_check(double frame_ms)
+{
+    if(s_hitch_threshold_ms <= 0.0f || frame_ms < s_hitch_threshold_ms)
+        return;
+
+    /* Don't dump again for a hitch that is already covered by the previous 
+     * dump's window, or which was caused by writing out the previous dump */
+    uint32_t now = SDL_GetTicks();
+    if(s_hitch_dumped && !SDL_TICKS_PASSED(now, s_hitch_last_dump_ms + HITCH_WINDOW_MS))
+        return;
+
+    hitch_dump(frame_ms);
+    s_hitch_last_dump_ms = SDL_GetTicks();
+    s_hitch_dumped = true;
+}
+
+static void capture_drain(void)
+{
+    for(khiter_t k = kh_begin(s_thread_state_table); k != kh_end(s_thread_state_table); k++) {
+
+        if(!kh_exist(s_thread_state_table, k))
+            continue;
+
+        struct perf_state *ps = &kh_val(s_thread_state_table, k);
+        if(kh_key(s_thread_state_table, k) == GPU_STATE_KEY) {
+            capture_drain_gpu(ps);
+        }
+    }
+    Perf_TraceDrain(capture_write_cpu, NULL);
+    capture_write_render_stats();
+    capture_write_mem_stats();
+}
+
 static bool pstate_init(struct perf_state *out, const char *name)
 {
     out->next_id = 0;
@@ -175,6 +662,7 @@ static bool pstate_init(struct perf_state *out, const char *name)
 
     pf_strlcpy(out->name, name, sizeof(out->name));
     out->perf_tree_idx = 0;
+    out->trace = NULL;
     return true;
 
 fail_perf_trees:
@@ -199,6 +687,7 @@ static void pstate_destroy(struct perf_state *in)
         vec_perf_destroy(&in->perf_trees[i]);
     }
     vec_idx_destroy(&in->perf_stack);
+    free(in->trace);
 
     uint32_t key;
     const char *curr;
@@ -277,6 +766,10 @@ bool Perf_RegisterThread(SDL_threadID tid, const char *name)
 
 void Perf_Push(const char *name)
 {
+    if(g_perf_trace_enabled) {
+        Perf_TracePush(name);
+    }
+
     SDL_threadID tid = SDL_ThreadID();
     khiter_t k = kh_get(pstate, s_thread_state_table, tid_to_key(tid));
     if(k == kh_end(s_thread_state_table))
@@ -301,6 +794,10 @@ void Perf_Pop(const char **out)
     if(out)
         *out = NULL;
 
+    if(g_perf_trace_enabled) {
+        Perf_TracePop(NULL);
+    }
+
     SDL_threadID tid = SDL_ThreadID();
     khiter_t k = kh_get(pstate, s_thread_state_table, tid_to_key(tid));
     if(k == kh_end(s_thread_state_table))
@@ -339,6 +836,16 @@ bool Perf_IsRoot(void)
     struct perf_state *ps = &kh_val(s_thread_state_table, k);
     const size_t ssize = vec_size(&ps->perf_stack);
 
+#ifdef NDEBUG
+    /* Only the trace keeps track of the call stack in release builds */
+    if(g_perf_trace_enabled && ps->trace) {
+        struct trace_ring *ring = ps->trace;
+        if(ring->depth == 0 || ring->depth > TRACE_MAX_DEPTH)
+            return true;
+        return (0 == strncmp(ring->stack[ring->depth - 1].name, "Task ", 5));
+    }
+#endif
+
     if(ssize == 0)
         return true;
 
@@ -387,6 +894,7 @@ void Perf_BeginTick(void)
 {
     ASSERT_IN_MAIN_THREAD();
     s_last_frames_ms[s_last_idx] = SDL_GetTicks();
+    s_frame_start_pc = SDL_GetPerformanceCounter();
 
     khiter_t k = kh_get(pstate, s_thread_state_table, GPU_STATE_KEY);
     if(k != kh_end(s_thread_state_table));
@@ -422,6 +930,14 @@ void Perf_BeginTick(void)
 void Perf_FinishTick(void)
 {
     ASSERT_IN_MAIN_THREAD();
+    pf_mem_tick();
+
+    if(s_capture_stream) {
+        capture_drain();
+        if(SDL_TICKS_PASSED(SDL_GetTicks(), s_capture_end_ms)) {
+            Perf_CaptureEnd();
+        }
+    }
 
     for(khiter_t k = kh_begin(s_thread_state_table); k != kh_end(s_thread_state_table); k++) {
 
@@ -431,6 +947,11 @@ void Perf_FinishTick(void)
         struct perf_state *curr = &kh_val(s_thread_state_table, k);
         assert(vec_size(&curr->perf_stack) == 0);
 
+        /* Drop any scopes left open by toggling the trace mid-frame */
+        if(curr->trace) {
+            curr->trace->depth = 0;
+        }
+
         curr->perf_tree_idx = (curr->perf_tree_idx + 1) % NFRAMES_LOGGED;
         vec_perf_reset(&curr->perf_trees[curr->perf_tree_idx]);
     }
@@ -439,6 +960,12 @@ void Perf_FinishTick(void)
     uint32_t last_ts = s_last_frames_ms[s_last_idx];
     s_last_frames_ms[s_last_idx] = curr_time - last_ts;
     s_last_idx = (s_last_idx + 1) % NFRAMES_LOGGED;
+
+    if(s_frame_start_pc) {
+        uint64_t delta = SDL_GetPerformanceCounter() - s_frame_start_pc;
+        Perf_RecordSample(PERF_METRIC_FRAME, delta);
+        hitch_check(delta * 1000.0 / SDL_GetPerformanceFrequency());
+    }
 }
 
 size_t Perf_Report(size_t maxout, struct perf_info **out)
@@ -499,3 +1026,308 @@ uint32_t Perf_CurrFrameMS(void)
     return curr_time - last_ts;
 }
 
+
+void Perf_TracePush(const char *name)
+{
+    struct perf_state *ps = pstate_curr();
+    if(!ps || !ps->trace)
+        return;
+
+    struct trace_ring *ring = ps->trace;
+    if(ring->depth < TRACE_MAX_DEPTH) {
+        uint32_t id = name_id_get(name, ps);
+        ring->stack[ring->depth].name = name_for_id(ps, id);
+        ring->stack[ring->depth].begin = trace_timestamp();
+    }
+    ring->depth++;
+}
+
+void Perf_TracePop(const char **out)
+{
+    if(out)
+        *out = NULL;
+
+    struct perf_state *ps = pstate_curr();
+    if(!ps || !ps->trace)
+        return;
+
+    /* The trace may have been enabled in the middle of this scope */
+    struct trace_ring *ring = ps->trace;
+    if(ring->depth == 0)
+        return;
+
+    ring->depth--;
+    if(ring->depth >= TRACE_MAX_DEPTH)
+        return;
+
+    uint32_t head = SDL_AtomicGet(&ring->head);
+    ring->slices[head & (TRACE_RING_SZ - 1)] = (struct trace_slice){
+        .name = ring->stack[ring->depth].name,
+        .begin = ring->stack[ring->depth].begin,
+        .end = trace_timestamp(),
+        .depth = ring->depth,
+        .task = ring->task
+    };
+    SDL_AtomicSet(&ring->head, (int)(head + 1));
+
+    if(out)
+        *out = ring->stack[ring->depth].name;
+}
+
+void Perf_SetTraceEnabled(bool on)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!on) {
+        /* The hitch recorder needs the trace to be running at all times */
+        if(s_hitch_threshold_ms <= 0.0f) {
+            g_perf_trace_enabled = false;
+        }
+        return;
+    }
+
+    if(!s_trace_pc_base) {
+        s_trace_ts_base = trace_timestamp();
+        s_trace_pc_base = SDL_GetPerformanceCounter();
+    }
+
+    /* The rings are never freed until shutdown, so that they remain valid 
+     * for threads which haven't yet seen the flag being cleared. */
+    for(khiter_t k = kh_begin(s_thread_state_table); k != kh_end(s_thread_state_table); k++) {
+
+        if(!kh_exist(s_thread_state_table, k))
+            continue;
+        if(kh_key(s_thread_state_table, k) == GPU_STATE_KEY)
+            continue;
+
+        struct perf_state *curr = &kh_val(s_thread_state_table, k);
+        if(curr->trace)
+            continue;
+
+        curr->trace = calloc(1, sizeof(struct trace_ring));
+        if(!curr->trace)
+            return;
+    }
+    g_perf_trace_enabled = true;
+}
+
+bool Perf_TraceEnabled(void)
+{
+    return g_perf_trace_enabled;
+}
+
+bool Perf_TraceDump(const char *path)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    FILE *stream = fopen(path, "w");
+    if(!stream)
+        return false;
+
+    struct trace_slice *copy = malloc(sizeof(struct trace_slice) * TRACE_RING_SZ);
+    if(!copy) {
+        fclose(stream);
+        return false;
+    }
+
+    double hz = trace_ts_hz();
+    fprintf(stream, "thread,task,depth,name,start_ms,duration_ms\n");
+
+    for(khiter_t k = kh_begin(s_thread_state_table); k != kh_end(s_thread_state_table); k++) {
+
+        if(!kh_exist(s_thread_state_table, k))
+            continue;
+
+        struct perf_state *ps = &kh_val(s_thread_state_table, k);
+        if(!ps->trace)
+            continue;
+
+        /* Discard the slices which may have been overwritten during the copy */
+        uint32_t first, head;
+        trace_copy_ring(ps->trace, copy, &first, &head);
+
+        for(uint32_t i = first; i < head; i++) {
+
+            const struct trace_slice *slice = &copy[i & (TRACE_RING_SZ - 1)];
+            fprintf(stream, "%s,%u,%u,%s,%.4f,%.4f\n", ps->name, slice->task, slice->depth, slice->name,
+                (slice->begin - s_trace_ts_base) * 1000.0 / hz,
+                (slice->end - slice->begin) * 1000.0 / hz);
+        }
+    }
+
+    free(copy);
+    fclose(stream);
+    return true;
+}
+
+void Perf_TraceSetTask(uint32_t task)
+{
+    struct perf_state *ps = pstate_curr();
+    if(!ps || !ps->trace)
+        return;
+    ps->trace->task = task;
+}
+
+void Perf_TraceDrain(perf_slice_cb_t fn, void *user)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    double hz = trace_ts_hz();
+    for(khiter_t k = kh_begin(s_thread_state_table); k != kh_end(s_thread_state_table); k++) {
+
+        if(!kh_exist(s_thread_state_table, k))
+            continue;
+        if(kh_key(s_thread_state_table, k) == GPU_STATE_KEY)
+            continue;
+
+        struct perf_state *ps = &kh_val(s_thread_state_table, k);
+        if(!ps->trace)
+            continue;
+        trace_drain_ring(k, ps, hz, fn, user);
+    }
+}
+
+bool Perf_CaptureBegin(const char *path, float seconds)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(s_capture_stream)
+        return false;
+
+    s_capture_prev_trace = g_perf_trace_enabled;
+    Perf_SetTraceEnabled(true);
+    if(!g_perf_trace_enabled)
+        return false;
+
+    s_capture_stream = fopen(path, "w");
+    if(!s_capture_stream) {
+        Perf_SetTraceEnabled(s_capture_prev_trace);
+        return false;
+    }
+
+    s_capture_end_ms = SDL_GetTicks() + (uint32_t)(seconds * 1000.0f);
+    s_capture_first_event = true;
+    s_capture_gpu_base = 0;
+    s_capture_render_frame = 0;
+    fprintf(s_capture_stream, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for(khiter_t k = kh_begin(s_thread_state_table); k != kh_end(s_thread_state_table); k++) {
+
+        if(!kh_exist(s_thread_state_table, k))
+            continue;
+
+        struct perf_state *ps = &kh_val(s_thread_state_table, k);
+        if(kh_key(s_thread_state_table, k) == GPU_STATE_KEY) {
+            capture_write_thread_name(s_capture_stream, &s_capture_first_event, 2, 0, ps->name);
+            continue;
+        }
+        capture_write_thread_name(s_capture_stream, &s_capture_first_event, 1, k, ps->name);
+    }
+    /* Only capture the slices completed from this point onwards */
+    Perf_TraceDrain(NULL, NULL);
+    return true;
+}
+
+void Perf_CaptureEnd(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_capture_stream)
+        return;
+
+    capture_drain();
+    fprintf(s_capture_stream, "\n]}\n");
+    fclose(s_capture_stream);
+    s_capture_stream = NULL;
+    Perf_SetTraceEnabled(s_capture_prev_trace);
+}
+
+bool Perf_CaptureActive(void)
+{
+    return (s_capture_stream != NULL);
+}
+
+void Perf_RecordSample(enum perf_metric metric, uint64_t pc_delta)
+{
+    assert(metric >= 0 && metric < PERF_METRIC_COUNT);
+    uint64_t us = pc_delta * 1000000 / SDL_GetPerformanceFrequency();
+    hist_add(&s_histograms[metric], (uint32_t)MIN(us, HIST_MAX_US));
+}
+
+void Perf_GetPercentiles(enum perf_metric metric, struct perf_percentiles *out)
+{
+    assert(metric >= 0 && metric < PERF_METRIC_COUNT);
+    hist_report(&s_histograms[metric], out);
+}
+
+void Perf_ResetPercentiles(void)
+{
+    for(int i = 0; i < PERF_METRIC_COUNT; i++) {
+        struct histogram *hist = &s_histograms[i];
+        SDL_AtomicLock(&hist->lock);
+        hist->nsamples = 0;
+        hist->next = 0;
+        hist->sum_us = 0;
+        memset(hist->buckets, 0, sizeof(hist->buckets));
+        SDL_AtomicUnlock(&hist->lock);
+    }
+}
+
+void Perf_SetHitchThreshold(float ms)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    bool was_on = (s_hitch_threshold_ms > 0.0f);
+    bool on = (ms > 0.0f);
+
+    if(on && !was_on) {
+        s_hitch_prev_trace = g_perf_trace_enabled;
+        Perf_SetTraceEnabled(true);
+        if(!g_perf_trace_enabled)
+            return;
+        s_hitch_dumped = false;
+    }
+
+    s_hitch_threshold_ms = on ? ms : 0.0f;
+    if(!on && was_on && !s_capture_stream) {
+        Perf_SetTraceEnabled(s_hitch_prev_trace);
+    }
+}
+
+float Perf_HitchThreshold(void)
+{
+    return s_hitch_threshold_ms;
+}
+
+bool Perf_AddStatsSource(perf_stats_src_t src)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(s_nstats_srcs == MAX_STATS_SRCS)
+        return false;
+    s_stats_srcs[s_nstats_srcs++] = src;
+    return true;
+}
+
+void Perf_RemoveStatsSource(perf_stats_src_t src)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    for(int i = 0; i < s_nstats_srcs; i++) {
+        if(s_stats_srcs[i] != src)
+            continue;
+        memmove(s_stats_srcs + i, s_stats_srcs + i + 1, 
+            (s_nstats_srcs - i - 1) * sizeof(s_stats_srcs[0]));
+        s_nstats_srcs--;
+        return;
+    }
+}
+
+void Perf_EmitStats(perf_stat_cb_t emit, void *arg)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    for(int i = 0; i < s_nstats_srcs; i++) {
+        s_stats_srcs[i](emit, arg);
+    }
+}
@@ -40,6 +40,12 @@
 #include <stddef.h>
 #include <SDL_thread.h>
 
+/* Set when tracing is turned on via the 'pf.debug.perf_trace_enabled' 
+ * setting. In release builds, this is the only thing the instrumentation 
+ * sites check, so a disabled site is a single load and branch.
+ */
+extern bool g_perf_trace_enabled;
+
 #ifndef NDEBUG
 
 #define PERF_ENTER()            \
@@ -70,18 +76,69 @@
 
 #else
 
-#define PERF_ENTER()
-#define PERF_RETURN(...) do {return (__VA_ARGS__); } while(0)
-#define PERF_RETURN_VOID(...) do { return; } while(0)
-#define PERF_PUSH(name)
-#define PERF_POP()
-#define PERF_POP_NAME(_ptr)
+#define PERF_ENTER()                        \
+    do{                                     \
+        if(g_perf_trace_enabled)            \
+            Perf_TracePush(__func__);       \
+    }while(0)
+
+#define PERF_RETURN(...)                    \
+    do{                                     \
+        if(g_perf_trace_enabled)            \
+            Perf_TracePop(NULL);            \
+        return (__VA_ARGS__);               \
+    }while(0)
+
+#define PERF_RETURN_VOID(...)               \
+    do{                                     \
+        if(g_perf_trace_enabled)            \
+            Perf_TracePop(NULL);            \
+        return;                             \
+    }while(0)
+
+#define PERF_PUSH(name)                     \
+    do{                                     \
+        if(g_perf_trace_enabled)            \
+            Perf_TracePush(name);           \
+    }while(0)
+
+#define PERF_POP()                          \
+    do{                                     \
+        if(g_perf_trace_enabled)            \
+            Perf_TracePop(NULL);            \
+    }while(0)
+
+#define PERF_POP_NAME(_ptr)                 \
+    do{                                     \
+        *(_ptr) = NULL;                     \
+        if(g_perf_trace_enabled)            \
+            Perf_TracePop(_ptr);            \
+    }while(0)
 
 #endif
 
 
 #define NFRAMES_LOGGED  (5)
 
+enum perf_metric{
+    PERF_METRIC_FRAME,  /* the full main thread frame */
+    PERF_METRIC_SIM,    /* the simulation part of the main thread frame */
+    PERF_METRIC_RENDER, /* the render thread's processing of a frame */
+    PERF_METRIC_SCRIPT, /* a single invocation of a script event handler */
+    PERF_METRIC_GC,     /* a single script garbage collection pause */
+    PERF_METRIC_COUNT
+};
+
+/* Taken over a rolling window of the most recent samples */
+struct perf_percentiles{
+    unsigned nsamples;
+    double   p50_ms;
+    double   p95_ms;
+    double   p99_ms;
+    double   max_ms;
+    double   mean_ms;
+};
+
 
 struct perf_info{
     char threadname[64];
@@ -102,6 +159,64 @@ void     Perf_PopGPU(uint32_t cookie);
 
 bool     Perf_IsRoot(void);
 
+/* The trace records the completed slices of each thread into a fixed-size 
+ * ring buffer which is only ever written by its' owning thread. When the 
+ * ring wraps around, the oldest slices are overwritten. The timestamps are 
+ * taken from the TSC where it is available.
+ */
+void     Perf_TracePush(const char *name);
+void     Perf_TracePop(const char **out);
+void     Perf_SetTraceEnabled(bool on);
+bool     Perf_TraceEnabled(void);
+/* Write out the slices currently held in the trace buffers of all threads 
+ * as CSV (thread, depth, name, start_ms, duration_ms). */
+bool     Perf_TraceDump(const char *path);
+/* Tag the slices completed on the calling thread with a scheduler task ID 
+ * (or NULL_TID). */
+void     Perf_TraceSetTask(uint32_t task);
+
+struct perf_slice{
+    int         thread;
+    const char *threadname; /* borrowed */
+    const char *name;       /* borrowed */
+    uint32_t    task;
+    uint32_t    depth;
+    double      begin_us;
+    double      dur_us;
+};
+
+typedef void (*perf_slice_cb_t)(const struct perf_slice *slice, void *user);
+
+/* Invoke the callback for every slice completed since the previous drain. 
+ * Every slice is only handed out once, so there should only be a single 
+ * consumer (i.e. a capture or a benchmark run) at a time. Passing a NULL 
+ * callback just discards the pending slices. */
+void     Perf_TraceDrain(perf_slice_cb_t fn, void *user);
+
+/* Stream the trace slices of all threads (and the GPU timings, in debug 
+ * builds) to a Chrome trace JSON file (viewable in chrome://tracing or 
+ * Perfetto) for the specified duration. The file is written to at the end 
+ * of every tick. */
+bool     Perf_CaptureBegin(const char *path, float seconds);
+void     Perf_CaptureEnd(void);
+bool     Perf_CaptureActive(void);
+
+typedef void (*perf_stat_cb_t)(const char *name, double value, void *arg);
+typedef void (*perf_stats_src_t)(perf_stat_cb_t emit, void *arg);
+
+/* The hitch recorder keeps the trace running and, whenever a frame takes 
+ * longer than the threshold, writes the last 2 seconds of the trace of all 
+ * threads to a Chrome trace JSON file (pf_hitch_<ticks>.json) in the working 
+ * directory. The statistics of all the registered sources are attached to 
+ * the file. A threshold of 0 turns the recorder off. 
+ */
+void     Perf_SetHitchThreshold(float ms);
+float    Perf_HitchThreshold(void);
+bool     Perf_AddStatsSource(perf_stats_src_t src);
+void     Perf_RemoveStatsSource(perf_stats_src_t src);
+/* Invoke the callback for every statistic of all the registered sources */
+void     Perf_EmitStats(perf_stat_cb_t emit, void *arg);
+
 /* Note that due to buffering of the frame timing data, the statistics
  * reported will be from NFRAMES_LOGGED ago. The reason for this is that
  * the GPU may be lagging a couple of frames behind the CPU. We want to get
@@ -116,6 +231,11 @@ size_t   Perf_Report(size_t maxout, struct perf_info **out);
 uint32_t Perf_LastFrameMS(void);
 uint32_t Perf_CurrFrameMS(void);
 
+/* Each metric must only be recorded from a single thread */
+void     Perf_RecordSample(enum perf_metric metric, uint64_t pc_delta);
+void     Perf_GetPercentiles(enum perf_metric metric, struct perf_percentiles *out);
+void     Perf_ResetPercentiles(void);
+
 /* The following can only be called from the main thread, making sure that 
  * none of the other threads are touching the Perf_ API concurrently */
 bool     Perf_Init(void);
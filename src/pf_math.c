@@ -324,6 +324,21 @@ void PFM_Mat4x4_RotFromQuat(const quat_t *quat, mat4x4_t *out)
     out->cols[2][2] = 1 - 2*pow(quat->x, 2) - 2*pow(quat->y, 2);
 }
 
+void PFM_Mat4x4_MakeTRS(const vec3_t *trans, const quat_t *rot, const vec3_t *scale, mat4x4_t *out)
+{
+    PFM_Mat4x4_RotFromQuat(rot, out);
+
+    for(int c = 0; c < 3; c++) {
+        out->cols[c][0] *= scale->x;
+        out->cols[c][1] *= scale->y;
+        out->cols[c][2] *= scale->z;
+    }
+
+    out->cols[3][0] = trans->x;
+    out->cols[3][1] = trans->y;
+    out->cols[3][2] = trans->z;
+}
+
 void PFM_Mat4x4_RotFromEuler(GLfloat deg_x, GLfloat deg_y, GLfloat deg_z, mat4x4_t *out)
 {
     mat4x4_t x, y, z, tmp;
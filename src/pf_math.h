@@ -158,6 +158,8 @@ void    PFM_Mat4x4_MakeRotX    (GLfloat radians, mat4x4_t *out);
 void    PFM_Mat4x4_MakeRotY    (GLfloat radians, mat4x4_t *out);
 void    PFM_Mat4x4_MakeRotZ    (GLfloat radians, mat4x4_t *out);
 void    PFM_Mat4x4_RotFromQuat (const quat_t *quat, mat4x4_t *out);
+/* Equivalent to T * (S * R), without the intermediate matrix products */
+void    PFM_Mat4x4_MakeTRS     (const vec3_t *trans, const quat_t *rot, const vec3_t *scale, mat4x4_t *out);
 void    PFM_Mat4x4_RotFromEuler(GLfloat deg_x, GLfloat deg_y, GLfloat deg_z, mat4x4_t *out);
 void    PFM_Mat4x4_Inverse     (mat4x4_t *in, mat4x4_t *out);
 void    PFM_Mat4x4_Transpose   (mat4x4_t *in, mat4x4_t *out);
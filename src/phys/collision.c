@@ -34,6 +34,7 @@
  */
 
 #include "public/collision.h"
+#include "../lib/public/simd.h"
 #include <assert.h>
 #include <float.h>
 
@@ -562,6 +563,80 @@ enum volume_intersec_type C_FrustumOBBIntersectionFast(const struct frustum *fru
     return VOLUME_INTERSEC_INSIDE;
 }
 
+/* A box is culled when all of its' corners are behind any one of the planes. 
+ * This is conservative in the same way as 'C_FrustumOBBIntersectionFast', but 
+ * without that routine's early-out on the first straddled plane it rejects 
+ * more of the boxes near the frustum's edges. The corners of each box are laid 
+ * out in component arrays once and then tested against all the planes, VW 
+ * at a time.
+ */
+void C_FrustumOBBCullFast(size_t nfrusta, const struct frustum *frusta, 
+                          size_t nobbs, const struct obb *obbs, uint8_t *out_masks)
+{
+    enum{ NPLANES = 6, MAX_FRUSTA = 8 };
+    assert(nfrusta <= MAX_FRUSTA);
+
+    float px[MAX_FRUSTA * NPLANES], py[MAX_FRUSTA * NPLANES], pz[MAX_FRUSTA * NPLANES];
+    float nx[MAX_FRUSTA * NPLANES], ny[MAX_FRUSTA * NPLANES], nz[MAX_FRUSTA * NPLANES];
+
+    for(int i = 0; i < nfrusta; i++) {
+
+        const struct frustum *frustum = &frusta[i];
+        const struct plane *planes[] = {&frustum->top, &frustum->bot, &frustum->left, 
+                                        &frustum->right, &frustum->nearp, &frustum->farp};
+
+        for(int j = 0; j < NPLANES; j++) {
+            int idx = i * NPLANES + j;
+            px[idx] = planes[j]->point.x;
+            py[idx] = planes[j]->point.y;
+            pz[idx] = planes[j]->point.z;
+            nx[idx] = planes[j]->normal.x;
+            ny[idx] = planes[j]->normal.y;
+            nz[idx] = planes[j]->normal.z;
+        }
+    }
+
+    for(int i = 0; i < nobbs; i++) {
+
+        const struct obb *obb = &obbs[i];
+        float cx[8], cy[8], cz[8];
+
+        for(int k = 0; k < 8; k++) {
+            cx[k] = obb->corners[k].x;
+            cy[k] = obb->corners[k].y;
+            cz[k] = obb->corners[k].z;
+        }
+
+        uint8_t mask = 0;
+        for(int j = 0; j < nfrusta; j++) {
+
+            bool outside = false;
+            for(int p = j * NPLANES; p < (j + 1) * NPLANES; p++) {
+
+                vfloat_t ppx = V_SET1(px[p]), ppy = V_SET1(py[p]), ppz = V_SET1(pz[p]);
+                vfloat_t pnx = V_SET1(nx[p]), pny = V_SET1(ny[p]), pnz = V_SET1(nz[p]);
+
+                /* The negated signed distance of the closest corner
+                 * to the plane's inner side */
+                vfloat_t min = V_SET1(FLT_MAX);
+                for(int k = 0; k < 8; k += VW) {
+
+                    vfloat_t dist = V_ADD(V_ADD(
+                        V_MUL(V_SUB(V_LOAD(cx + k), ppx), pnx),
+                        V_MUL(V_SUB(V_LOAD(cy + k), ppy), pny)),
+                        V_MUL(V_SUB(V_LOAD(cz + k), ppz), pnz));
+                    min = V_MIN(min, V_SUB(V_SET1(0.0f), dist));
+                }
+                outside |= VM_ALL(V_GT(min, V_SET1(0.0f)));
+            }
+
+            if(!outside)
+                mask |= (1 << j);
+        }
+        out_masks[i] = mask;
+    }
+}
+
 bool C_FrustumAABBIntersectionExact(const struct frustum *frustum, const struct aabb *aabb)
 {
     vec3_t aabb_axes[3] = {
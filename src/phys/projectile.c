@@ -40,6 +40,7 @@
 #include "../task.h"
 #include "../perf.h"
 #include "../sched.h"
+#include "../camera.h"
 #include "../entity.h"
 #include "../asset_load.h"
 #include "../map/public/tile.h"
@@ -52,6 +53,7 @@
 #include "../lib/public/pf_string.h"
 
 #include <math.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <SDL.h>
 
@@ -62,9 +64,14 @@
 #define GRAVITY         (1.62f * UNITS_PER_METER / (PHYS_HZ * PHYS_HZ))
 #define EPSILON         (1.0f/1024)
 #define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
 #define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
-#define MAX_PROJ_TASKS  (64)
+#define PROJ_TASK_GRAIN (64)
 #define NEAR_TOLERANCE  (100.0f)
+#define SWEEP_CELL_SIZE (NEAR_TOLERANCE)
+#define MAX_SWEEP_ENTS  (1024)
+/* Half-extent of the box used to cull a projectile, per unit of scale */
+#define CULL_EXTENT     (4.0f)
 
 #define CHK_TRUE_RET(_pred)             \
     do{                                 \
@@ -85,21 +92,38 @@ struct projectile{
     mat4x4_t model;
 };
 
-struct proj_task_arg{
-    size_t begin_idx;
-    size_t end_idx;
+struct proj_work{
+    struct memstack   mem;
+    struct task_group group;
 };
 
-struct proj_work{
-    struct memstack mem;
-    size_t          ntasks;
-    struct future   futures[MAX_PROJ_TASKS];
-    uint32_t        tids[MAX_PROJ_TASKS];
+/* A projectile, keyed by the grid cell it is in */
+struct sweep_ref{
+    uint64_t key;
+    int      idx;
+};
+
+/* The state of an entity near a grid cell, shared by the
+ * sweep tests of all the projectiles in the cell */
+struct sweep_cand{
+    uint32_t   uid;
+    uint32_t   flags;
+    int        faction_id;
+    vec3_t     pos;
+    bool       has_obb;
+    struct obb obb;
+    vec3_t     obb_min, obb_max;
 };
 
 VEC_TYPE(proj, struct projectile)
 VEC_IMPL(static inline, proj, struct projectile)
 
+VEC_TYPE(sweep_ref, struct sweep_ref)
+VEC_IMPL(static inline, sweep_ref, struct sweep_ref)
+
+VEC_TYPE(sweep_cand, struct sweep_cand)
+VEC_IMPL(static inline, sweep_cand, struct sweep_cand)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
@@ -111,6 +135,10 @@ static vec_proj_t       s_added;
 static vec_proj_t       s_deleted;
 struct proj_work        s_work;
 static struct memstack  s_eventargs;
+/* Scratch buffers for the sweep tests */
+static vec_sweep_ref_t  s_sweep_refs;
+static vec_sweep_cand_t s_sweep_cands;
+static vec_sweep_ref_t  s_sweep_hits;
 
 static unsigned long    s_last_tick = ULONG_MAX;
 static unsigned         s_simticks = 0;
@@ -156,31 +184,15 @@ static void phys_proj_update(struct projectile *proj)
     PFM_Vec3_Add(&proj->vel, &accel, &proj->vel);
     PFM_Vec3_Add(&proj->pos, &proj->vel, &proj->pos);
 
-    mat4x4_t trans, scale, rot, tmp;
     quat_t qrot = phys_velocity_dir(proj->vel);
-
-    PFM_Mat4x4_MakeTrans(proj->pos.x, proj->pos.y, proj->pos.z, &trans);
-    PFM_Mat4x4_MakeScale(proj->scale.x, proj->scale.y, proj->scale.z, &scale);
-    PFM_Mat4x4_RotFromQuat(&qrot, &rot);
-
-    PFM_Mat4x4_Mult4x4(&scale, &rot, &tmp);
-    PFM_Mat4x4_Mult4x4(&trans, &tmp, &proj->model);
+    PFM_Mat4x4_MakeTRS(&proj->pos, &qrot, &proj->scale, &proj->model);
 }
 
-static struct result phys_proj_task(void *arg)
+static void phys_proj_task(size_t begin, size_t end, void *arg)
 {
-    struct proj_task_arg *proj_arg = arg;
-    size_t ncomputed = 0;
-
-    for(int i = proj_arg->begin_idx; i <= proj_arg->end_idx; i++) {
-
+    for(int i = begin; i < end; i++) {
         phys_proj_update(&vec_AT(&s_back, i));
-
-        ncomputed++;
-        if(ncomputed % 64 == 0)
-            Task_Yield();
     }
-    return NULL_RESULT;
 }
 
 static void phys_filter_out_of_bounds(void)
@@ -198,18 +210,13 @@ static void phys_filter_out_of_bounds(void)
 
 static void phys_proj_join_work(void)
 {
-    for(int i = 0; i < s_work.ntasks; i++) {
-        while(!Sched_FutureIsReady(&s_work.futures[i])) {
-            Sched_RunSync(s_work.tids[i]);
-        }
-    }
+    Sched_TaskGroupJoin(&s_work.group);
 }
 
 static void phys_proj_finish_work(void)
 {
     phys_proj_join_work();
     stalloc_clear(&s_work.mem);
-    s_work.ntasks = 0;
 
     vec_proj_subtract(&s_back, &s_deleted, phys_proj_equal);
     vec_proj_reset(&s_deleted);
@@ -220,24 +227,70 @@ static void phys_proj_finish_work(void)
     s_front = tmp;
 }
 
-static bool phys_enemies(int faction_id, uint32_t ent)
+static uint64_t phys_sweep_key(vec3_t pos)
+{
+    int32_t cx = floor(pos.x / SWEEP_CELL_SIZE);
+    int32_t cz = floor(pos.z / SWEEP_CELL_SIZE);
+    return (((uint64_t)(uint32_t)cx) << 32) | ((uint32_t)cz);
+}
+
+static int compare_sweep_refs(const void *a, const void *b)
+{
+    const struct sweep_ref *ra = a, *rb = b;
+    if(ra->key != rb->key)
+        return (ra->key < rb->key) ? -1 : 1;
+    return (ra->idx - rb->idx);
+}
+
+static int compare_sweep_refs_idx_desc(const void *a, const void *b)
+{
+    const struct sweep_ref *ra = a, *rb = b;
+    return (rb->idx - ra->idx);
+}
+
+/* Gather all the entities that may be within NEAR_TOLERANCE of 
+ * any projectile in the grid cell of the specified projectile. 
+ */
+static void phys_sweep_gather(const struct projectile *proj)
+{
+    float cx = (floor(proj->pos.x / SWEEP_CELL_SIZE) + 0.5f) * SWEEP_CELL_SIZE;
+    float cz = (floor(proj->pos.z / SWEEP_CELL_SIZE) + 0.5f) * SWEEP_CELL_SIZE;
+    float radius = SWEEP_CELL_SIZE * M_SQRT1_2 + NEAR_TOLERANCE;
+
+    uint32_t nearp[MAX_SWEEP_ENTS];
+    size_t nents = G_Pos_EntsInCircle((vec2_t){cx, cz}, radius, nearp, ARR_SIZE(nearp));
+
+    vec_sweep_cand_reset(&s_sweep_cands);
+    for(int i = 0; i < nents; i++) {
+
+        uint32_t flags = G_FlagsGet(nearp[i]);
+        if(flags & ENTITY_FLAG_ZOMBIE)
+            continue;
+
+        vec_sweep_cand_push(&s_sweep_cands, (struct sweep_cand){
+            .uid = nearp[i],
+            .flags = flags,
+            .faction_id = G_GetFactionID(nearp[i]),
+            .pos = G_Pos_Get(nearp[i]),
+            .has_obb = false,
+        });
+    }
+}
+
+static bool phys_sweep_cand_enemies(int faction_id, const struct sweep_cand *cand)
 {
-    if(faction_id == G_GetFactionID(ent))
+    if(faction_id == cand->faction_id)
         return false;
 
     enum diplomacy_state ds;
-    bool result = G_GetDiplomacyState(faction_id, G_GetFactionID(ent), &ds);
+    bool result = G_GetDiplomacyState(faction_id, cand->faction_id, &ds);
 
     assert(result);
     return (ds == DIPLOMACY_STATE_WAR);
 }
 
-static void phys_sweep_test(int front_idx)
+static uint32_t phys_sweep_test(const struct projectile *proj)
 {
-    const struct projectile *proj = &vec_AT(&s_front, front_idx);
-    uint32_t nearp[256];
-    size_t nents = G_Pos_EntsInCircle((vec2_t){proj->pos.x, proj->pos.z}, NEAR_TOLERANCE, nearp, ARR_SIZE(nearp));
-
     /* The collision test gets performed every frame (variable FPS) while, 
      * actual projectile motion is performed at fixed frequency of PHYS_HZ. 
      * Hence, when we perform the collision check, we must account for all
@@ -255,39 +308,84 @@ static void phys_sweep_test(int front_idx)
     PFM_Vec3_Scale(&delta, -1.0f * s_simticks, &delta);
     PFM_Vec3_Add(&begin, &delta, &end);
 
+    vec3_t seg_min = (vec3_t){MIN(begin.x, end.x), MIN(begin.y, end.y), MIN(begin.z, end.z)};
+    vec3_t seg_max = (vec3_t){MAX(begin.x, end.x), MAX(begin.y, end.y), MAX(begin.z, end.z)};
+
     float min_dist = INFINITY;
     uint32_t hit_ent = NULL_UID;
 
-    for(int i = 0; i < nents; i++) {
+    for(int i = 0; i < vec_size(&s_sweep_cands); i++) {
 
-        uint32_t ent = nearp[i];
-        /* A projectile does not collide with its' 'parent' */
-        if(proj->ent_parent == ent)
+        struct sweep_cand *cand = &vec_AT(&s_sweep_cands, i);
+        vec2_t xz_delta = (vec2_t){cand->pos.x - proj->pos.x, cand->pos.z - proj->pos.z};
+        if(PFM_Vec2_Len(&xz_delta) > NEAR_TOLERANCE)
             continue;
-        if(G_FlagsGet(ent) & ENTITY_FLAG_ZOMBIE)
+
+        /* A projectile does not collide with its' 'parent' */
+        if(proj->ent_parent == cand->uid)
             continue;
-        if((proj->flags & PROJ_ONLY_HIT_COMBATABLE) && !(G_FlagsGet(ent) & ENTITY_FLAG_COMBATABLE))
+        if((proj->flags & PROJ_ONLY_HIT_COMBATABLE) && !(cand->flags & ENTITY_FLAG_COMBATABLE))
             continue;
-        if((proj->flags & PROJ_ONLY_HIT_ENEMIES) && !phys_enemies(proj->faction_id, ent))
+        if((proj->flags & PROJ_ONLY_HIT_ENEMIES) && !phys_sweep_cand_enemies(proj->faction_id, cand))
             continue;
 
-        struct obb obb;
-        Entity_CurrentOBB(ent, &obb, false);
+        if(!cand->has_obb) {
+            Entity_CurrentOBB(cand->uid, &cand->obb, false);
+            cand->obb_min = cand->obb_max = cand->obb.corners[0];
+            for(int j = 1; j < ARR_SIZE(cand->obb.corners); j++) {
+                vec3_t c = cand->obb.corners[j];
+                cand->obb_min = (vec3_t){MIN(cand->obb_min.x, c.x), MIN(cand->obb_min.y, c.y), MIN(cand->obb_min.z, c.z)};
+                cand->obb_max = (vec3_t){MAX(cand->obb_max.x, c.x), MAX(cand->obb_max.y, c.y), MAX(cand->obb_max.z, c.z)};
+            }
+            cand->has_obb = true;
+        }
+
+        if(seg_max.x < cand->obb_min.x || seg_min.x > cand->obb_max.x
+        || seg_max.y < cand->obb_min.y || seg_min.y > cand->obb_max.y
+        || seg_max.z < cand->obb_min.z || seg_min.z > cand->obb_max.z)
+            continue;
 
-        if(C_LineSegIntersectsOBB(begin, end, obb)) {
+        if(C_LineSegIntersectsOBB(begin, end, cand->obb)) {
 
             vec3_t diff;
-            vec3_t ent_pos = G_Pos_Get(ent);
-            PFM_Vec3_Sub((vec3_t*)&proj->pos, &ent_pos, &diff);
+            PFM_Vec3_Sub((vec3_t*)&proj->pos, &cand->pos, &diff);
 
             if(PFM_Vec3_Len(&diff) < min_dist) {
                 min_dist = PFM_Vec3_Len(&diff);
-                hit_ent = ent;
+                hit_ent = cand->uid;
             }
         }
     }
+    return hit_ent;
+}
 
-    if(hit_ent != NULL_UID) {
+/* The projectiles are bucketed on a uniform grid so that the nearby entities
+ * are only looked up (and have their OBBs computed) once per occupied cell, 
+ * instead of once per projectile.
+ */
+static void phys_sweep_test_all(void)
+{
+    vec_sweep_ref_reset(&s_sweep_refs);
+    vec_sweep_ref_reset(&s_sweep_hits);
+
+    for(int i = 0; i < vec_size(&s_front); i++) {
+        const struct projectile *proj = &vec_AT(&s_front, i);
+        vec_sweep_ref_push(&s_sweep_refs, (struct sweep_ref){phys_sweep_key(proj->pos), i});
+    }
+    qsort(s_sweep_refs.array, vec_size(&s_sweep_refs), sizeof(struct sweep_ref), compare_sweep_refs);
+
+    for(int i = 0; i < vec_size(&s_sweep_refs); i++) {
+
+        const struct sweep_ref *ref = &vec_AT(&s_sweep_refs, i);
+        const struct projectile *proj = &vec_AT(&s_front, ref->idx);
+
+        if(i == 0 || vec_AT(&s_sweep_refs, i - 1).key != ref->key) {
+            phys_sweep_gather(proj);
+        }
+
+        uint32_t hit_ent = phys_sweep_test(proj);
+        if(hit_ent == NULL_UID)
+            continue;
 
         struct proj_hit *hit = stalloc(&s_eventargs, sizeof(struct proj_hit));
         hit->ent_uid = hit_ent;
@@ -296,8 +394,18 @@ static void phys_sweep_test(int front_idx)
         hit->cookie = proj->cookie;
         E_Global_Notify(EVENT_PROJECTILE_HIT, hit, ES_ENGINE);
 
-        vec_proj_push(&s_deleted, *proj);
-        vec_proj_del(&s_front, front_idx);
+        vec_sweep_ref_push(&s_sweep_hits, *ref);
+    }
+
+    /* Delete from the back, so that the swap with the last 
+     * element doesn't move any of the pending indices */
+    qsort(s_sweep_hits.array, vec_size(&s_sweep_hits), sizeof(struct sweep_ref), 
+        compare_sweep_refs_idx_desc);
+
+    for(int i = 0; i < vec_size(&s_sweep_hits); i++) {
+        int idx = vec_AT(&s_sweep_hits, i).idx;
+        vec_proj_push(&s_deleted, vec_AT(&s_front, idx));
+        vec_proj_del(&s_front, idx);
     }
 }
 
@@ -315,31 +423,7 @@ static void on_30hz_tick(void *user, void *event)
     if(nwork == 0)
         goto done;
 
-    size_t ntasks = SDL_GetCPUCount();
-    if(nwork < 64)
-        ntasks = 1;
-    ntasks = MIN(ntasks, MAX_PROJ_TASKS);
-
-    for(int i = 0; i < ntasks; i++) {
-
-        struct proj_task_arg *arg = stalloc(&s_work.mem, sizeof(struct proj_task_arg));
-        size_t nitems = ceil((float)nwork / ntasks);
-
-        arg->begin_idx = nitems * i;
-        arg->end_idx = MIN(nitems * (i + 1) - 1, nwork-1);
-
-        SDL_AtomicSet(&s_work.futures[s_work.ntasks].status, FUTURE_INCOMPLETE);
-        s_work.tids[s_work.ntasks] = Sched_Create(4, phys_proj_task, arg, 
-            &s_work.futures[s_work.ntasks], 0);
-
-        if(s_work.tids[s_work.ntasks] == NULL_TID) {
-            for(int j = arg->begin_idx; j <= arg->end_idx; j++) {
-                phys_proj_update(&vec_AT(&s_back, j));
-            }
-        }else{
-            s_work.ntasks++;
-        }
-    }
+    Sched_ParallelForAsync(&s_work.group, 0, nwork, PROJ_TASK_GRAIN, phys_proj_task, NULL, 4, 0);
 
 done:
     s_last_tick = g_frame_idx;
@@ -360,11 +444,25 @@ static void phys_create_render_input(struct render_input *out)
     vec_rstat_init(&out->light_vis_stat);
     vec_ranim_init(&out->light_vis_anim);
 
+    struct frustum frust;
+    Camera_MakeFrustum(out->cam, &frust);
+
     for(int i = 0; i < vec_size(&s_front); i++) {
 
         const struct projectile *curr = &vec_AT(&s_front, i);
         if(!curr->render_private)
             continue;
+
+        /* Only the projectiles in view are sent to the renderer */
+        float extent = CULL_EXTENT * MAX(curr->scale.x, MAX(curr->scale.y, curr->scale.z));
+        struct aabb bounds = (struct aabb){
+            curr->pos.x - extent, curr->pos.x + extent,
+            curr->pos.y - extent, curr->pos.y + extent,
+            curr->pos.z - extent, curr->pos.z + extent,
+        };
+        if(C_FrustumAABBIntersectionFast(&frust, &bounds) == VOLUME_INTERSEC_OUTSIDE)
+            continue;
+
         struct ent_stat_rstate rstate = (struct ent_stat_rstate){
             .render_private = curr->render_private,
             .model = curr->model,
@@ -463,9 +561,7 @@ void P_Projectile_Update(void)
     PERF_ENTER();
     stalloc_clear(&s_eventargs);
 
-    for(int i = vec_size(&s_front)-1; i >= 0; i--) {
-        phys_sweep_test(i);
-    }
+    phys_sweep_test_all();
     phys_filter_out_of_bounds();
     s_simticks = 0;
 
@@ -488,8 +584,12 @@ bool P_Projectile_Init(void)
         goto fail_deleted;
     if(!stalloc_init(&s_work.mem))
         goto fail_mem;
+    Sched_TaskGroupInit(&s_work.group);
     if(!stalloc_init(&s_eventargs))
         goto fail_eventargs;
+    vec_sweep_ref_init(&s_sweep_refs);
+    vec_sweep_cand_init(&s_sweep_cands);
+    vec_sweep_ref_init(&s_sweep_hits);
 
     E_Global_Register(EVENT_30HZ_TICK, on_30hz_tick, NULL, G_RUNNING);
     E_Global_Register(EVENT_RENDER_3D_POST, on_render_3d, NULL, G_ALL);
@@ -520,75 +620,102 @@ void P_Projectile_Shutdown(void)
     vec_proj_destroy(&s_back);
     vec_proj_destroy(&s_added);
     vec_proj_destroy(&s_deleted);
+    vec_sweep_ref_destroy(&s_sweep_refs);
+    vec_sweep_cand_destroy(&s_sweep_cands);
+    vec_sweep_ref_destroy(&s_sweep_hits);
 }
 
-bool P_Projectile_VelocityForTarget(vec3_t src, vec3_t dst, float init_speed, vec3_t *out)
+/* To hit a target at range x and altitude y when fired from (0,0) 
+ * and with initial speed v the required angle of launch THETA is: 
+ *
+ *              (v^2 +/- sqrt(v^4 - g(gx^2 + 2yv^2))
+ * tan(THETA) = (----------------------------------)
+ *              (              gx                  )
+ *
+ * The two roots of the equation correspond to the two possible 
+ * launch angles, so long as they aren't imaginary, in which case 
+ * the initial speed is not great enough to reach the point (x,y) 
+ * selected. Returns the discriminant, which is negative when the
+ * target is out of reach.
+ */
+static float proj_discriminant(float x, float y, float v)
+{
+    const float g = GRAVITY;
+    const float v2 = v * v;
+    return v2 * v2 - g * (g * x * x + 2 * y * v2);
+}
+
+static bool proj_velocity_for_target(vec3_t src, vec3_t dst, float init_speed, vec3_t *out)
 {
     vec3_t delta;
     PFM_Vec3_Sub(&dst, &src, &delta);
 
-    if(PFM_Vec3_Len(&delta) < EPSILON)
-        return false;
-
     /* Use a coordinate system such that the y-axis is up and 
      * the x-axis is along the direction of motion (src -> dst). 
      */
-    const float x = sqrt(pow(delta.x, 2) + pow(delta.z, 2));
+    const float x2 = delta.x * delta.x + delta.z * delta.z;
     const float y = delta.y;
     const float v = init_speed / PHYS_HZ;
     const float g = GRAVITY;
 
-    /* To hit a target at range x and altitude y when fired from (0,0) 
-     * and with initial speed v the required angle of launch THETA is: 
-     *
-     *              (v^2 +/- sqrt(v^4 - g(gx^2 + 2yv^2))
-     * tan(THETA) = (----------------------------------)
-     *              (              gx                  )
-     *
-     * The two roots of the equation correspond to the two possible 
-     * launch angles, so long as they aren't imaginary, in which case 
-     * the initial speed is not great enough to reach the point (x,y) 
-     * selected.
-     */
+    if(x2 + y * y < EPSILON * EPSILON)
+        return false;
 
-    float descriminant = pow(v, 4) - g * (g * pow(x, 2) + 2 * y * pow(v, 2));
+    const float x = sqrtf(x2);
+    const float descriminant = proj_discriminant(x, y, v);
     if(descriminant < -EPSILON) {
         /* No real solutions */
         return false;
     }
 
-    size_t nsolutions = 1;
-    if(fabs(descriminant) > EPSILON) {
-        nsolutions = 2;
-    }
-
-    float t1, t2, tan_theta;
-    t1 = pow(v, 2) + sqrt(descriminant);
-    if(nsolutions > 1) {
-        t2 = pow(v, 2) - sqrt(descriminant);
-        tan_theta = MIN(t1, t2) / (g * x);
-    }else{
-        tan_theta = t1 / (g * x);
+    /* Take the lower of the two launch angles */
+    float root = (descriminant > EPSILON) ? sqrtf(descriminant) : 0.0f;
+    float t = v * v - root;
+    if(x <= EPSILON) {
+        /* Straight up or down: there is no horizontal motion to solve for */
+        *out = (vec3_t){0.0f, (y > 0.0f) ? v : -v, 0.0f};
+        return true;
     }
 
     /* Theta is the angle of motion up from the ground along the angle of motion.
-     * Convert this to a velocity vector. 
+     * Convert this to a velocity vector without going through the trig functions:
+     * the horizontal and vertical parts are proportional to (gx, t).
      */
-    float xlen = sqrt(pow(delta.x, 2) + pow(delta.z, 2));
-    float ylen = xlen * tan_theta;
-
-    vec3_t velocity = (vec3_t){ delta.x, ylen, delta.z };
-    if(PFM_Vec3_Len(&velocity) <= EPSILON) {
+    float hx = g * x;
+    float len = sqrtf(hx * hx + t * t);
+    if(len <= EPSILON)
         return false;
-    }
-    assert(PFM_Vec3_Len(&velocity) > EPSILON);
-    PFM_Vec3_Normal(&velocity, &velocity);
-    PFM_Vec3_Scale(&velocity, v, &velocity);
 
-    *out = velocity;
+    float horiz = (hx / len) * v / x;
+    float vert = (t / len) * v;
+    *out = (vec3_t){delta.x * horiz, vert, delta.z * horiz};
     return true;
 }
 
+bool P_Projectile_VelocityForTarget(vec3_t src, vec3_t dst, float init_speed, vec3_t *out)
+{
+    return proj_velocity_for_target(src, dst, init_speed, out);
+}
+
+size_t P_Projectile_VelocitiesForTargets(size_t n, const vec3_t *src, const vec3_t *dst, 
+                                         const float *init_speeds, vec3_t *out, bool *out_ok)
+{
+    size_t ret = 0;
+    for(size_t i = 0; i < n; i++) {
+        out_ok[i] = proj_velocity_for_target(src[i], dst[i], init_speeds[i], &out[i]);
+        ret += out_ok[i];
+    }
+    return ret;
+}
+
+bool P_Projectile_CanReach(vec3_t src, vec3_t dst, float init_speed)
+{
+    float dx = dst.x - src.x;
+    float dz = dst.z - src.z;
+    float x = sqrtf(dx * dx + dz * dz);
+    return (proj_discriminant(x, dst.y - src.y, init_speed / PHYS_HZ) >= -EPSILON);
+}
+
 bool P_Projectile_SaveState(struct SDL_RWops *stream)
 {
     phys_proj_finish_work();
@@ -766,7 +893,7 @@ bool P_Projectile_LoadState(struct SDL_RWops *stream)
 
 void P_Projectile_ClearState(void)
 {
-    s_work.ntasks = 0;
+    Sched_TaskGroupInit(&s_work.group);
     stalloc_clear(&s_eventargs);
     stalloc_clear(&s_work.mem);
     vec_proj_reset(&s_front);
@@ -38,6 +38,8 @@
 
 #include "../../pf_math.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct aabb{
     float x_min, x_max;
@@ -91,6 +93,11 @@ bool C_LineSegIntersectsOBB(vec3_t begin, vec3_t end, struct obb obb);
 enum volume_intersec_type C_FrustumPointIntersectionFast(const struct frustum *frustum, vec3_t point);
 enum volume_intersec_type C_FrustumAABBIntersectionFast (const struct frustum *frustum, const struct aabb *aabb);
 enum volume_intersec_type C_FrustumOBBIntersectionFast  (const struct frustum *frustum, const struct obb *obb);
+/* Cull a batch of OBBs against up to 8 frusta at once. Bit 'j' of 'out_masks[i]' is set when 
+ * 'obbs[i]' may intersect 'frusta[j]'. Gives a subset of the false positives of 
+ * 'C_FrustumOBBIntersectionFast'. */
+void C_FrustumOBBCullFast(size_t nfrusta, const struct frustum *frusta, 
+                          size_t nobbs, const struct obb *obbs, uint8_t *out_masks);
 
 bool C_FrustumAABBIntersectionExact(const struct frustum *frustum, const struct aabb *aabb);
 bool C_FrustumOBBIntersectionExact(const struct frustum *frustum, const struct obb *obb);
@@ -42,6 +42,7 @@ struct SDL_RWops;
 #include "../../pf_math.h"
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
 
@@ -69,6 +70,12 @@ uint32_t P_Projectile_Add(vec3_t origin, vec3_t velocity, uint32_t ent_parent, i
                           uint32_t cookie, int flags, struct proj_desc pd);
 void     P_Projectile_Update(void);
 bool     P_Projectile_VelocityForTarget(vec3_t src, vec3_t dst, float init_speed, vec3_t *out);
+/* Solve the launch velocities for many shots at once. 'out_ok' is set for every
+ * target that can be reached, and the number of such targets is returned. */
+size_t   P_Projectile_VelocitiesForTargets(size_t n, const vec3_t *src, const vec3_t *dst, 
+                                           const float *init_speeds, vec3_t *out, bool *out_ok);
+/* A cheap test of whether a shot with the given initial speed can reach 'dst' */
+bool     P_Projectile_CanReach(vec3_t src, vec3_t dst, float init_speed);
 
 bool     P_Projectile_SaveState(struct SDL_RWops *stream);
 bool     P_Projectile_LoadState(struct SDL_RWops *stream);
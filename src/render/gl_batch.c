@@ -43,26 +43,31 @@
 #include "gl_perf.h"
 #include "gl_vertex.h"
 #include "gl_state.h"
+#include "gl_render.h"
 #include "render_private.h"
 #include "public/render.h"
 #include "../entity.h"
 #include "../lib/public/pf_malloc.h"
 #include "../lib/public/khash.h"
 #include "../lib/public/mem.h"
+#include "../lib/public/radix_sort.h"
 #include "../map/public/tile.h"
 #include "../game/public/game.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 
 #define MESH_BUFF_SZ        (8*1024*1024)
-#define TEX_ARR_SZ          (64)
+#define IDX_BUFF_SZ         (2*1024*1024)
+#define TEX_ARR_SZ          (64) /* one bit per slot in the free mask */
 
 #define MAX_TEX_ARRS        (4)
 #define MAX_MESH_BUFFS      (16)
 
-#define CMD_RING_SZ         (4 * 1024 * sizeof(struct GL_DAI_Cmd))
+#define CMD_RING_SZ         (4 * 1024 * sizeof(struct GL_DEI_Cmd))
 #define STAT_ATTR_RING_SZ   (4*1024*1024)
 #define ANIM_ATTR_RING_SZ   (32*1024*1024)
 
@@ -73,6 +78,8 @@
 #define CMD_RING_TUNIT      (GL_TEXTURE5)
 #define ATTR_RING_TUNIT     (GL_TEXTURE6)
 #define BATCH_ID_NULL       (0)
+/* Size of the per-instance material attributes */
+#define MATS_BLOCK_SZ       (MAX_MATERIALS * (sizeof(vec2_t) + 8 * sizeof(float)))
 
 #define GL_PERF_CALL(name, ...)     \
     do{                             \
@@ -84,23 +91,30 @@
 
 struct mesh_desc{
     int    vbo_idx;
+    /* Byte offsets of the mesh's vertices and indices 
+     * within the buffers of the 'vbo_idx' slot */
     size_t offset;
+    size_t ioffset;
 };
 
 struct tex_desc{
-    int arr_idx;
-    int tex_idx;
+    int      arr_idx;
+    int      tex_idx;
+    /* The render epoch during which the texture was last referenced */
+    uint32_t last_used;
 };
 
 struct tex_arr_desc{
     struct texture_arr arr;
     /* bitfield of free slots */
-    uint32_t           free;
+    uint64_t           free;
 };
 
 struct vbo_desc{
     void   *heap_meta;
+    void   *idx_heap_meta;
     GLuint  VBO;
+    GLuint  IBO;
     GLuint  VAO;
 };
 
@@ -125,10 +139,11 @@ struct draw_call_desc{
 KHASH_MAP_INIT_INT(mdesc, struct mesh_desc)
 KHASH_MAP_INIT_INT(tdesc, struct tex_desc)
 
-struct GL_DAI_Cmd{
+struct GL_DEI_Cmd{
 	GLuint count;
 	GLuint instance_count;
 	GLuint first_index;
+	GLint  base_vertex;
 	GLuint base_instance;
 };
 
@@ -160,13 +175,17 @@ struct gl_batch{
     /* The textues for all the meshes in this batch. All 
      * the textures are packed into a single texture array 
      * with a fixed number of entries. If the array fills 
-     * up, the textures overflow into the next array. */
+     * up, the textures overflow into the next array. Once 
+     * all the arrays are full, the least recently used 
+     * textures are evicted to make room for new ones. */
     struct tex_arr_desc textures[MAX_TEX_ARRS];
-    /* The VBOs holding the combiend meshes for this batch. */
+    /* The VBOs holding the combiend meshes for this batch. Each
+     * VBO is paired with a buffer holding the meshes' indices. */
     struct vbo_desc     vbos[MAX_MESH_BUFFS];
 };
 
 KHASH_MAP_INIT_INT(batch, struct gl_batch*)
+KHASH_MAP_INIT_INT64(pose, uint32_t)
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -176,6 +195,21 @@ static struct gl_batch *s_anim_batch;
 static khash_t(batch)  *s_chunk_batches;
 static khash_t(batch)  *s_id_batches;
 static GLuint           s_draw_id_vbo;
+/* Incremented at the start of every batched render. Textures
+ * referenced during the current epoch are pinned in the arrays. */
+static uint32_t         s_tex_epoch;
+/* Scratch buffers for sorting the entity states */
+static uint64_t        *s_sort_keys;
+static uint32_t        *s_sort_idx;
+static uint32_t        *s_sort_tmp;
+static size_t           s_sort_cap;
+static void            *s_sort_ents;
+static size_t           s_sort_ents_sz;
+/* Staging buffer for the instance attributes of a draw call */
+static void            *s_stage;
+static size_t           s_stage_sz;
+/* Maps a set of joint matrices to its' offset in the staging buffer */
+static khash_t(pose)   *s_pose_offsets;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -193,7 +227,7 @@ uint32_t batch_chunk_key(int chunk_r, int chunk_c)
          |  (( ((uint32_t)chunk_c) & 0xffff) <<  0));
 }
 
-static int batch_first_free_idx(uint32_t mask)
+static int batch_first_free_idx(uint64_t mask)
 {
     int ret = 0;
     while(mask) {
@@ -210,19 +244,19 @@ static bool batch_alloc_texarray(struct gl_batch *batch)
         return false;
 
     R_GL_Texture_ArrayAlloc(TEX_ARR_SZ, &batch->textures[batch->ntexarrs].arr, GL_TEXTURE0 + batch->ntexarrs);
-    batch->textures[batch->ntexarrs].free = ~((uint32_t)0);
+    batch->textures[batch->ntexarrs].free = ~((uint64_t)0);
     batch->ntexarrs++;
     return true;
 }
 
 static size_t batch_vert_alignment(enum batch_type type)
 {
-    return type == BATCH_TYPE_STAT ? sizeof(struct vertex)
-         : type == BATCH_TYPE_ANIM ? sizeof(struct anim_vert)
+    return type == BATCH_TYPE_STAT ? sizeof(struct packed_vert)
+         : type == BATCH_TYPE_ANIM ? sizeof(struct packed_anim_vert)
                                    : (assert(0), 0);
 }
 
-static void batch_init_vao(enum batch_type type, GLuint *out, GLuint src_vbo)
+static void batch_init_vao(enum batch_type type, GLuint *out, GLuint src_vbo, GLuint src_ibo)
 {
     GLuint VAO;
     glGenVertexArrays(1, &VAO);
@@ -230,24 +264,25 @@ static void batch_init_vao(enum batch_type type, GLuint *out, GLuint src_vbo)
 
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, src_vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, src_ibo);
 
     /* Attribute 0 - position */
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
     glEnableVertexAttribArray(0);
 
-    /* Attribute 1 - texture coordinates */
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, 
-        (void*)offsetof(struct vertex, uv));
+    /* Attribute 1 - texture coordinates (half floats) */
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, 
+        (void*)offsetof(struct packed_vert, uv));
     glEnableVertexAttribArray(1);
 
-    /* Attribute 2 - normal */
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, 
-        (void*)offsetof(struct vertex, normal));
+    /* Attribute 2 - normal (snorm 2_10_10_10, the 'w' component is unused) */
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, 
+        (void*)offsetof(struct packed_vert, normal));
     glEnableVertexAttribArray(2);
 
     /* Attribute 3 - material index */
     glVertexAttribIPointer(3, 1, GL_INT, stride, 
-        (void*)offsetof(struct vertex, material_idx));
+        (void*)offsetof(struct packed_vert, material_idx));
     glEnableVertexAttribArray(3);
 
     if(type == BATCH_TYPE_STAT) {
@@ -264,18 +299,18 @@ static void batch_init_vao(enum batch_type type, GLuint *out, GLuint src_vbo)
     
         /* Attribute 4/5 - joint indices */
         glVertexAttribIPointer(4, 3, GL_UNSIGNED_BYTE, stride,
-            (void*)offsetof(struct anim_vert, joint_indices));
+            (void*)offsetof(struct packed_anim_vert, joint_indices));
         glEnableVertexAttribArray(4);  
         glVertexAttribIPointer(5, 3, GL_UNSIGNED_BYTE, stride,
-            (void*)(offsetof(struct anim_vert, joint_indices) + 3*sizeof(GLubyte)));
+            (void*)(offsetof(struct packed_anim_vert, joint_indices) + 3*sizeof(GLubyte)));
         glEnableVertexAttribArray(5);
 
-        /* Attribute 6/7 - joint weights */
-        glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, stride,
-            (void*)offsetof(struct anim_vert, weights));
+        /* Attribute 6/7 - joint weights (unorm8) */
+        glVertexAttribPointer(6, 3, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+            (void*)offsetof(struct packed_anim_vert, weights));
         glEnableVertexAttribArray(6);  
-        glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, stride,
-            (void*)(offsetof(struct anim_vert, weights) + 3*sizeof(GLfloat)));
+        glVertexAttribPointer(7, 3, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+            (void*)(offsetof(struct packed_anim_vert, weights) + 3*sizeof(GLubyte)));
         glEnableVertexAttribArray(7);  
 
         /* Attribute 8 - draw ID 
@@ -300,39 +335,75 @@ static bool batch_alloc_vbo(struct gl_batch *batch)
     if(!heap_meta)
         return false;
 
+    void *idx_heap_meta = pf_metamalloc_init(IDX_BUFF_SZ);
+    if(!idx_heap_meta) {
+        pf_metamalloc_destroy(heap_meta);
+        return false;
+    }
+
     GLuint VBO;
     glGenBuffers(1, &VBO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, MESH_BUFF_SZ, NULL, GL_DYNAMIC_DRAW);
 
+    /* Use a non-VAO target to allocate, since a VAO may still be bound */
+    GLuint IBO;
+    glGenBuffers(1, &IBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, IBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, IDX_BUFF_SZ, NULL, GL_DYNAMIC_DRAW);
+    pf_mem_account(MEM_TAG_GL_BATCH, MESH_BUFF_SZ + IDX_BUFF_SZ);
+
     GLuint VAO;
-    batch_init_vao(batch->type, &VAO, VBO);
+    batch_init_vao(batch->type, &VAO, VBO, IBO);
 
-    batch->vbos[batch->nvbos] = (struct vbo_desc){heap_meta, VBO, VAO};
+    batch->vbos[batch->nvbos] = (struct vbo_desc){heap_meta, idx_heap_meta, VBO, IBO, VAO};
     batch->nvbos++;
     return true;
 }
 
-static bool batch_append_mesh(struct gl_batch *batch, GLuint VBO)
+/* Allocate space for a mesh's vertices and indices in the same buffer slot.
+ * Returns false if either doesn't fit. */
+static bool batch_alloc_mesh(struct gl_batch *batch, int vbo_idx, size_t size, 
+                             size_t isize, int *out_offset, int *out_ioffset)
 {
-    khiter_t k = kh_get(mdesc, batch->vbo_desc_map, VBO);
+    struct vbo_desc *desc = &batch->vbos[vbo_idx];
+    size_t alignment = batch_vert_alignment(batch->type);
+
+    int offset = pf_metamemalign(desc->heap_meta, alignment, size);
+    if(offset < 0)
+        return false;
+
+    int ioffset = pf_metamemalign(desc->idx_heap_meta, sizeof(GLuint), isize);
+    if(ioffset < 0) {
+        pf_metafree(desc->heap_meta, offset);
+        return false;
+    }
+
+    *out_offset = offset;
+    *out_ioffset = ioffset;
+    return true;
+}
+
+static bool batch_append_mesh(struct gl_batch *batch, const struct mesh *mesh)
+{
+    khiter_t k = kh_get(mdesc, batch->vbo_desc_map, mesh->VBO);
     if(k != kh_end(batch->vbo_desc_map))
         return true; /* VBO already in the batch */
 
-    size_t alignment = batch_vert_alignment(batch->type);
+    assert(mesh->num_indices > 0);
+    size_t isize = mesh->num_indices * sizeof(GLuint);
 
     GLint size;
-    glBindBuffer(GL_COPY_READ_BUFFER, VBO);
+    glBindBuffer(GL_COPY_READ_BUFFER, mesh->VBO);
     glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
 
-    if(size > MESH_BUFF_SZ)
+    if(size > MESH_BUFF_SZ || isize > IDX_BUFF_SZ)
         return false;
 
     int curr_vbo_idx = 0;
-    int vbo_offset = -1;
+    int vbo_offset = -1, ibo_offset = -1;
     do{
-        vbo_offset = pf_metamemalign(batch->vbos[curr_vbo_idx].heap_meta, alignment, size);
-        if(vbo_offset >= 0)
+        if(batch_alloc_mesh(batch, curr_vbo_idx, size, isize, &vbo_offset, &ibo_offset))
             break;
     }while(++curr_vbo_idx < batch->nvbos);
 
@@ -342,25 +413,32 @@ static bool batch_append_mesh(struct gl_batch *batch, GLuint VBO)
         if(!batch_alloc_vbo(batch))
             return false;
         curr_vbo_idx = batch->nvbos-1;
-        vbo_offset = pf_metamemalign(batch->vbos[curr_vbo_idx].heap_meta, alignment, size);
+        if(!batch_alloc_mesh(batch, curr_vbo_idx, size, isize, &vbo_offset, &ibo_offset))
+            return false;
     }
     assert(curr_vbo_idx >= 0 && curr_vbo_idx < batch->nvbos);
-    assert(vbo_offset >= 0);
+    assert(vbo_offset >= 0 && ibo_offset >= 0);
 
     /* Perform VBO-to-VBO copy. The data should be copied without having 
-     * to do a round-trip to the CPU.
+     * to do a round-trip to the CPU. The indices stay relative to the 
+     * start of the mesh and are rebased with the draw's base vertex.
      */
     glBindBuffer(GL_COPY_WRITE_BUFFER, batch->vbos[curr_vbo_idx].VBO);
     glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, vbo_offset, size);
 
+    glBindBuffer(GL_COPY_READ_BUFFER, mesh->EBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, batch->vbos[curr_vbo_idx].IBO);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, ibo_offset, isize);
+
     int status;
-    k = kh_put(mdesc, batch->vbo_desc_map, VBO, &status);
+    k = kh_put(mdesc, batch->vbo_desc_map, mesh->VBO, &status);
     if(status == -1) {
         pf_metafree(batch->vbos[curr_vbo_idx].heap_meta, vbo_offset);
+        pf_metafree(batch->vbos[curr_vbo_idx].idx_heap_meta, ibo_offset);
         return false;
     }
 
-    kh_value(batch->vbo_desc_map, k) = (struct mesh_desc){curr_vbo_idx, vbo_offset};
+    kh_value(batch->vbo_desc_map, k) = (struct mesh_desc){curr_vbo_idx, vbo_offset, ibo_offset};
 
     GL_ASSERT_OK();
     return true;
@@ -373,35 +451,83 @@ static void batch_free_mesh(struct gl_batch *batch, GLuint VBO)
 
     struct mesh_desc md = kh_value(batch->vbo_desc_map, k);
     pf_metafree(batch->vbos[md.vbo_idx].heap_meta, md.offset);
+    pf_metafree(batch->vbos[md.vbo_idx].idx_heap_meta, md.ioffset);
 
     kh_del(mdesc, batch->vbo_desc_map, k);
 }
 
+static bool batch_free_slot(struct gl_batch *batch, int *out_arr_idx, int *out_slice_idx)
+{
+    for(int i = 0; i < batch->ntexarrs; i++) {
+        if(batch->textures[i].free == 0)
+            continue;
+        *out_arr_idx = i;
+        *out_slice_idx = batch_first_free_idx(batch->textures[i].free);
+        return true;
+    }
+    return false;
+}
+
+static void batch_free_tex(struct gl_batch *batch, GLuint id)
+{
+    khiter_t k = kh_get(tdesc, batch->tid_desc_map, id);
+    assert(k != kh_end(batch->tid_desc_map));
+
+    struct tex_desc td = kh_value(batch->tid_desc_map, k);
+    batch->textures[td.arr_idx].free |= (((uint64_t)0x1) << td.tex_idx);
+
+    kh_del(tdesc, batch->tid_desc_map, k);
+}
+
+/* Release the slot of the texture that has gone unused for the longest. 
+ * Textures referenced during the current epoch are still needed by the 
+ * draws that are about to be issued, so they are never evicted. */
+static bool batch_evict_tex(struct gl_batch *batch)
+{
+    khiter_t victim = kh_end(batch->tid_desc_map);
+    uint32_t oldest = 0;
+
+    for(khiter_t k = kh_begin(batch->tid_desc_map); k != kh_end(batch->tid_desc_map); k++) {
+        if(!kh_exist(batch->tid_desc_map, k))
+            continue;
+        uint32_t last_used = kh_value(batch->tid_desc_map, k).last_used;
+        if(last_used == s_tex_epoch)
+            continue;
+        if(victim == kh_end(batch->tid_desc_map) || (int32_t)(last_used - oldest) < 0) {
+            victim = k;
+            oldest = last_used;
+        }
+    }
+
+    if(victim == kh_end(batch->tid_desc_map))
+        return false;
+
+    batch_free_tex(batch, kh_key(batch->tid_desc_map, victim));
+    return true;
+}
+
 static bool batch_append_tex(struct gl_batch *batch, GLuint tid, int idx, struct texture_arr *arr)
 {
     khiter_t k = kh_get(tdesc, batch->tid_desc_map, tid);
-    if(k != kh_end(batch->tid_desc_map))
-        return true; /* texture already in the batch */
+    if(k != kh_end(batch->tid_desc_map)) {
+        /* texture already in the batch */
+        kh_value(batch->tid_desc_map, k).last_used = s_tex_epoch;
+        return true; 
+    }
 
-    int curr_arr_idx = 0;
+    int curr_arr_idx = -1;
     int slice_idx = -1;
-    do{
-        if(batch->textures[curr_arr_idx].free == 0)
-            continue;
-        slice_idx = batch_first_free_idx(batch->textures[curr_arr_idx].free);
-        break;
-    }while(++curr_arr_idx < batch->ntexarrs);
 
-    if(slice_idx == -1) {
-        if(curr_arr_idx == MAX_TEX_ARRS)
+    if(!batch_free_slot(batch, &curr_arr_idx, &slice_idx)) {
+        if(batch_alloc_texarray(batch)) {
+            curr_arr_idx = batch->ntexarrs-1;
+            slice_idx = batch_first_free_idx(batch->textures[curr_arr_idx].free);
+        }else if(!batch_evict_tex(batch) || !batch_free_slot(batch, &curr_arr_idx, &slice_idx)) {
             return false;
-        if(!batch_alloc_texarray(batch))
-            return false;
-        curr_arr_idx = batch->ntexarrs-1;
-        slice_idx = batch_first_free_idx(batch->textures[curr_arr_idx].free);
+        }
     }
     assert(curr_arr_idx >= 0 && curr_arr_idx < batch->ntexarrs);
-    assert(slice_idx >= 0 && slice_idx < 32);
+    assert(slice_idx >= 0 && slice_idx < TEX_ARR_SZ);
 
     R_GL_Texture_BindArray(&batch->textures[curr_arr_idx].arr, R_GL_Shader_GetCurrActive());
     assert(glIsTexture(batch->textures[curr_arr_idx].arr.id));
@@ -414,31 +540,21 @@ static bool batch_append_tex(struct gl_batch *batch, GLuint tid, int idx, struct
         return false;
     }
 
-    kh_value(batch->tid_desc_map, k) = (struct tex_desc){curr_arr_idx, slice_idx};
-    batch->textures[curr_arr_idx].free &= ~(((uint32_t)0x1) << slice_idx);
+    kh_value(batch->tid_desc_map, k) = (struct tex_desc){curr_arr_idx, slice_idx, s_tex_epoch};
+    batch->textures[curr_arr_idx].free &= ~(((uint64_t)0x1) << slice_idx);
 
     GL_ASSERT_OK();
     return true;
 }
 
-static void batch_free_tex(struct gl_batch *batch, GLuint id)
-{
-    khiter_t k = kh_get(tdesc, batch->tid_desc_map, id);
-    assert(k != kh_end(batch->tid_desc_map));
-
-    struct tex_desc td = kh_value(batch->tid_desc_map, k);
-    batch->textures[td.arr_idx].free |= (0x1 << td.tex_idx);
-
-    kh_del(tdesc, batch->tid_desc_map, k);
-}
-
 static bool batch_append(struct gl_batch *batch, struct render_private *priv)
 {
-    if(!batch_append_mesh(batch, priv->mesh.VBO))
+    if(!batch_append_mesh(batch, &priv->mesh))
         goto fail_append_mesh;
 
-    int tex_idx = 0;
-    for(; tex_idx < priv->num_materials; tex_idx++) {
+    /* The textures that did make it in may be shared with other meshes. 
+     * They are left to be evicted once they go unused. */
+    for(int tex_idx = 0; tex_idx < priv->num_materials; tex_idx++) {
         if(!batch_append_tex(batch, priv->materials[tex_idx].texture.id, tex_idx, &priv->material_arr))
             goto fail_append_tex;
     }
@@ -447,10 +563,6 @@ static bool batch_append(struct gl_batch *batch, struct render_private *priv)
     return true;
 
 fail_append_tex:
-    do{
-        --tex_idx;
-        batch_free_tex(batch, priv->materials[tex_idx].texture.id);
-    }while(tex_idx > 0);
     batch_free_mesh(batch, priv->mesh.VBO);
 fail_append_mesh:
     GL_ASSERT_OK();
@@ -464,16 +576,16 @@ static struct gl_batch *batch_init(enum batch_type type)
         goto fail_alloc;
 
     batch->type = type;
-    batch->cmd_ring = R_GL_RingbufferInit(CMD_RING_SZ, RING_UBYTE);
+    batch->cmd_ring = R_GL_RingbufferInit(CMD_RING_SZ, RING_UBYTE, RING_GROWABLE | RING_ADAPTIVE);
 	if(!batch->cmd_ring)
         goto fail_cmd_ring;
 
     switch(type) {
     case BATCH_TYPE_STAT: 
-        batch->attr_ring = R_GL_RingbufferInit(STAT_ATTR_RING_SZ, RING_FLOAT);
+        batch->attr_ring = R_GL_RingbufferInit(STAT_ATTR_RING_SZ, RING_FLOAT, RING_GROWABLE | RING_ADAPTIVE);
         break;
     case BATCH_TYPE_ANIM: 
-        batch->attr_ring = R_GL_RingbufferInit(ANIM_ATTR_RING_SZ, RING_FLOAT);
+        batch->attr_ring = R_GL_RingbufferInit(ANIM_ATTR_RING_SZ, RING_FLOAT, RING_GROWABLE | RING_ADAPTIVE);
         break;
     default: assert(0);
     }
@@ -523,6 +635,8 @@ static void batch_destroy(struct gl_batch *batch)
     }
     for(int i = 0; i < batch->nvbos; i++) {
         glDeleteBuffers(1, &batch->vbos[i].VBO);
+        glDeleteBuffers(1, &batch->vbos[i].IBO);
+        pf_mem_account(MEM_TAG_GL_BATCH, -(ptrdiff_t)(MESH_BUFF_SZ + IDX_BUFF_SZ));
     }
 
     kh_destroy(tdesc, batch->tid_desc_map);
@@ -548,32 +662,104 @@ static struct tex_desc batch_tdesc_for_tid(struct gl_batch *batch, GLuint tid)
     return kh_value(batch->tid_desc_map, k);
 }
 
-static bool batch_chunk_compare(struct tile_desc a, struct tile_desc b)
+static bool batch_sort_reserve(size_t nents, size_t entsize)
+{
+    if(nents > s_sort_cap) {
+
+        uint64_t *keys = realloc(s_sort_keys, nents * sizeof(uint64_t));
+        if(!keys)
+            return false;
+        s_sort_keys = keys;
+
+        uint32_t *idx = realloc(s_sort_idx, nents * sizeof(uint32_t));
+        if(!idx)
+            return false;
+        s_sort_idx = idx;
+
+        uint32_t *tmp = realloc(s_sort_tmp, nents * sizeof(uint32_t));
+        if(!tmp)
+            return false;
+        s_sort_tmp = tmp;
+
+        s_sort_cap = nents;
+    }
+
+    if(nents * entsize > s_sort_ents_sz) {
+
+        void *ents = realloc(s_sort_ents, nents * entsize);
+        if(!ents)
+            return false;
+        s_sort_ents = ents;
+        s_sort_ents_sz = nents * entsize;
+    }
+    return true;
+}
+
+/* Stably reorder the 'ents' array by the keys in 's_sort_keys'. The sort is 
+ * done over indices, so every entity state is only copied once, regardless of
+ * how far out of order it is. The buffers must have been reserved with 
+ * 'batch_sort_reserve' beforehand.
+ */
+static void batch_sort_ents(void *ents, size_t nents, size_t entsize)
+{
+    assert(nents <= s_sort_cap);
+    assert(nents * entsize <= s_sort_ents_sz);
+
+    for(int i = 0; i < nents; i++) {
+        s_sort_idx[i] = i;
+    }
+    pf_radix_sort_idx(s_sort_keys, s_sort_idx, s_sort_tmp, nents);
+
+    int first_moved = 0;
+    while(first_moved < nents && s_sort_idx[first_moved] == first_moved)
+        first_moved++;
+    if(first_moved == nents)
+        return;
+
+    unsigned char *src = ents;
+    unsigned char *dst = s_sort_ents;
+    for(int i = first_moved; i < nents; i++) {
+        memcpy(dst + i * entsize, src + s_sort_idx[i] * entsize, entsize);
+    }
+    memcpy(src + first_moved * entsize, dst + first_moved * entsize, 
+        (nents - first_moved) * entsize);
+}
+
+/* The key of the entity's mesh within the batch. Meshes are ordered by the 
+ * buffer holding them, so that entities sharing a mesh end up contiguous and 
+ * the groups of entities sharing a buffer end up contiguous in turn.
+ */
+static uint64_t batch_mesh_key(struct gl_batch *batch, void *render_private)
 {
-    uint32_t ia = batch_td_key(a);
-    uint32_t ib = batch_td_key(b);
-    return ia > ib;
+    GLuint VBO = ((struct render_private*)render_private)->mesh.VBO;
+    struct mesh_desc md = batch_mdesc_for_vbo(batch, VBO);
+    assert(md.offset <= UINT32_MAX);
+    return (((uint64_t)md.vbo_idx) << 32) | ((uint64_t)md.offset);
 }
 
-/* Sort the 'ents' array in-place by the chunk coordinate of the entities. Fill
- * 'out' with a list of descriptors about what subrange of the sorted array 
- * corresponds to which chunk */
-static size_t batch_sort_by_chunk(vec_rstat_t *ents, struct chunk_batch_desc *out, size_t maxout)
+/* Sort the 'ents' array in-place by the chunk coordinate of the entities (if
+ * 'by_chunk' is set) and then to have the opaque entitites before the translucent 
+ * ones. Fill 'out' with a list of descriptors about what subrange of the sorted 
+ * array corresponds to which chunk */
+static size_t batch_sort_by_chunk(vec_rstat_t *ents, bool by_chunk, 
+                                  struct chunk_batch_desc *out, size_t maxout)
 {
     if(vec_size(ents) == 0)
         return 0;
 
-    int i = 1;
-    while(i < vec_size(ents)) {
-        int j = i;
-        while(j > 0 && batch_chunk_compare(vec_AT(ents, j - 1).td, vec_AT(ents, j).td)) {
+    for(int i = 0; i < vec_size(ents); i++) {
+        const struct ent_stat_rstate *curr = &vec_AT(ents, i);
+        uint64_t chunk = by_chunk ? batch_td_key(curr->td) : 0;
+        s_sort_keys[i] = (chunk << 32) | (curr->translucent ? 1 : 0);
+    }
+    batch_sort_ents(ents->array, vec_size(ents), sizeof(struct ent_stat_rstate));
 
-            struct ent_stat_rstate tmp = vec_AT(ents, j - 1);
-            vec_AT(ents, j - 1) = vec_AT(ents, j);
-            vec_AT(ents, j) = tmp;
-            j--;
-        }
-        i++;
+    if(!by_chunk) {
+        out[0] = (struct chunk_batch_desc){
+            .start_idx = 0,
+            .end_idx = vec_size(ents) - 1,
+        };
+        return 1;
     }
 
     size_t ret = 0;
@@ -583,7 +769,7 @@ static size_t batch_sort_by_chunk(vec_rstat_t *ents, struct chunk_batch_desc *ou
         .chunk_c = vec_AT(ents, 0).td.chunk_c,
         .start_idx = 0,
     };
-    for(int i = 1; i < vec_size(ents); i++) {
+    for(int i = 1; i < vec_size(ents) && ret + 1 < maxout; i++) {
     
         if(batch_td_key(vec_AT(ents, i - 1).td) != batch_td_key(vec_AT(ents, i).td)) {
             curr.end_idx = i - 1;
@@ -594,39 +780,19 @@ static size_t batch_sort_by_chunk(vec_rstat_t *ents, struct chunk_batch_desc *ou
                 .start_idx = i,
             };
         }
-        if(ret == maxout)
-            break;
     }
 
-    curr.end_idx = i - 1;
+    curr.end_idx = vec_size(ents) - 1;
     out[ret++] = curr;
 
     return ret;
 }
 
-static size_t batch_sort_by_transparency(vec_rstat_t *ents, const struct chunk_batch_desc *desc)
+static size_t batch_count_translucent(vec_rstat_t *ents, const struct chunk_batch_desc *desc)
 {
-    if(vec_size(ents) == 0)
-        return 0;
-
-    int i = desc->start_idx;
-    while(i <= desc->end_idx) {
-        int j = i;
-        while(j > desc->start_idx 
-            && (vec_AT(ents, j - 1).translucent && !vec_AT(ents, j).translucent)) {
-
-            struct ent_stat_rstate tmp = vec_AT(ents, j - 1);
-            vec_AT(ents, j - 1) = vec_AT(ents, j);
-            vec_AT(ents, j) = tmp;
-            j--;
-        }
-        i++;
-    }
-
     size_t ret = 0;
     for(int i = desc->start_idx; i <= desc->end_idx; i++) {
-        struct ent_stat_rstate *curr = &vec_AT(ents, i);
-        if(curr->translucent)
+        if(vec_AT(ents, i).translucent)
             ret++;
     }
     return ret;
@@ -634,46 +800,27 @@ static size_t batch_sort_by_transparency(vec_rstat_t *ents, const struct chunk_b
 
 static size_t batch_anim_sort_by_transparency(vec_ranim_t *ents, size_t nents)
 {
-    if(vec_size(ents) == 0)
-        return 0;
-
-    int i = 0;
-    while(i < nents) {
-        int j = i;
-        while(j > 0 && (vec_AT(ents, j - 1).translucent && !vec_AT(ents, j).translucent)) {
-
-            struct ent_anim_rstate tmp = vec_AT(ents, j - 1);
-            vec_AT(ents, j - 1) = vec_AT(ents, j);
-            vec_AT(ents, j) = tmp;
-            j--;
-        }
-        i++;
-    }
-
     size_t ret = 0;
     for(int i = 0; i < nents; i++) {
-        struct ent_anim_rstate *curr = &vec_AT(ents, i);
-        if(curr->translucent)
-            ret++;
+        bool translucent = vec_AT(ents, i).translucent;
+        s_sort_keys[i] = translucent ? 1 : 0;
+        ret += translucent;
     }
+    batch_sort_ents(ents->array, nents, sizeof(struct ent_anim_rstate));
     return ret;
 }
 
-static size_t batch_sort_by_inst_stat(struct ent_stat_rstate *ents, size_t nents, 
-                                      struct inst_group_desc *out, size_t maxout)
+static size_t batch_sort_by_inst_stat(struct gl_batch *batch, struct ent_stat_rstate *ents, 
+                                      size_t nents, struct inst_group_desc *out, size_t maxout)
 {
-    int i = 1;
-    while(i < nents) {
-        int j = i;
-        while(j > 0 && ((uintptr_t)ents[j - 1].render_private) > ((uintptr_t)ents[j].render_private)) {
-
-            struct ent_stat_rstate tmp = ents[j - 1];
-            ents[j - 1] = ents[j];
-            ents[j] = tmp;
-            j--;
+    for(int i = 0; i < nents; i++) {
+        if(i > 0 && ents[i].render_private == ents[i - 1].render_private) {
+            s_sort_keys[i] = s_sort_keys[i - 1];
+            continue;
         }
-        i++;
+        s_sort_keys[i] = batch_mesh_key(batch, ents[i].render_private);
     }
+    batch_sort_ents(ents, nents, sizeof(struct ent_stat_rstate));
 
     size_t ret = 0;
 
@@ -681,7 +828,7 @@ static size_t batch_sort_by_inst_stat(struct ent_stat_rstate *ents, size_t nents
         .render_private = ents[0].render_private,
         .start_idx = 0,
     };
-    for(int i = 1; i < nents; i++) {
+    for(int i = 1; i < nents && ret + 1 < maxout; i++) {
     
         if(((uintptr_t)ents[i - 1].render_private) != ((uintptr_t)ents[i].render_private)) {
 
@@ -692,31 +839,25 @@ static size_t batch_sort_by_inst_stat(struct ent_stat_rstate *ents, size_t nents
                 .start_idx = i,
             };
         }
-        if(ret == maxout)
-            break;
     }
 
-    curr.end_idx = i - 1;
+    curr.end_idx = nents - 1;
     out[ret++] = curr;
 
     return ret;
 }
 
-static size_t batch_sort_by_inst_anim(struct ent_anim_rstate *ents, size_t nents, 
-                                      struct inst_group_desc *out, size_t maxout)
+static size_t batch_sort_by_inst_anim(struct gl_batch *batch, struct ent_anim_rstate *ents, 
+                                      size_t nents, struct inst_group_desc *out, size_t maxout)
 {
-    int i = 1;
-    while(i < nents) {
-        int j = i;
-        while(j > 0 && ((uintptr_t)ents[j - 1].render_private) > ((uintptr_t)ents[j].render_private)) {
-
-            struct ent_anim_rstate tmp = ents[j - 1];
-            ents[j - 1] = ents[j];
-            ents[j] = tmp;
-            j--;
+    for(int i = 0; i < nents; i++) {
+        if(i > 0 && ents[i].render_private == ents[i - 1].render_private) {
+            s_sort_keys[i] = s_sort_keys[i - 1];
+            continue;
         }
-        i++;
+        s_sort_keys[i] = batch_mesh_key(batch, ents[i].render_private);
     }
+    batch_sort_ents(ents, nents, sizeof(struct ent_anim_rstate));
 
     size_t ret = 0;
 
@@ -724,7 +865,7 @@ static size_t batch_sort_by_inst_anim(struct ent_anim_rstate *ents, size_t nents
         .render_private = ents[0].render_private,
         .start_idx = 0,
     };
-    for(int i = 1; i < nents; i++) {
+    for(int i = 1; i < nents && ret + 1 < maxout; i++) {
     
         if(((uintptr_t)ents[i - 1].render_private) != ((uintptr_t)ents[i].render_private)) {
 
@@ -735,38 +876,19 @@ static size_t batch_sort_by_inst_anim(struct ent_anim_rstate *ents, size_t nents
                 .start_idx = i,
             };
         }
-        if(ret == maxout)
-            break;
     }
 
-    curr.end_idx = i - 1;
+    curr.end_idx = nents - 1;
     out[ret++] = curr;
 
     return ret;
 }
 
-static size_t batch_sort_by_vbo(struct gl_batch *batch, struct inst_group_desc *descs, 
-                                size_t ndescs, struct draw_call_desc *out, size_t maxout)
+/* The instance groups are already ordered by the buffer of their mesh, so
+ * only the boundaries between the draw calls need to be found. */
+static size_t batch_group_by_vbo(struct gl_batch *batch, struct inst_group_desc *descs, 
+                                 size_t ndescs, struct draw_call_desc *out, size_t maxout)
 {
-    int i = 1;
-    while(i < ndescs) {
-        int j = i;
-
-        GLuint VBO1 = ((struct render_private*)descs[j - 1].render_private)->mesh.VBO;
-        GLuint VBO2 = ((struct render_private*)descs[j].render_private)->mesh.VBO;
-        struct mesh_desc md1 = batch_mdesc_for_vbo(batch, VBO1);
-        struct mesh_desc md2 = batch_mdesc_for_vbo(batch, VBO2);
-
-        while(j > 0 && md1.vbo_idx > md2.vbo_idx) {
-
-            struct inst_group_desc tmp = descs[j - 1];
-            descs[j - 1] = descs[j];
-            descs[j] = tmp;
-            j--;
-        }
-        i++;
-    }
-
     size_t ret = 0;
 
     GLuint VBO = ((struct render_private*)descs[0].render_private)->mesh.VBO;
@@ -776,63 +898,86 @@ static size_t batch_sort_by_vbo(struct gl_batch *batch, struct inst_group_desc *
         .vbo_idx = md.vbo_idx,
         .start_idx = 0,
     };
-    for(int i = 1; i < ndescs; i++) {
+    for(int i = 1; i < ndescs && ret + 1 < maxout; i++) {
     
-        GLuint VBO1 = ((struct render_private*)descs[i - 1].render_private)->mesh.VBO;
-        GLuint VBO2 = ((struct render_private*)descs[i].render_private)->mesh.VBO;
-        struct mesh_desc md1 = batch_mdesc_for_vbo(batch, VBO1);
-        struct mesh_desc md2 = batch_mdesc_for_vbo(batch, VBO2);
+        GLuint VBO = ((struct render_private*)descs[i].render_private)->mesh.VBO;
+        struct mesh_desc md = batch_mdesc_for_vbo(batch, VBO);
 
-        if(md1.vbo_idx != md2.vbo_idx) {
+        if(md.vbo_idx != curr.vbo_idx) {
 
             curr.end_idx = i - 1;
             out[ret++] = curr;
             curr = (struct draw_call_desc){
-                .vbo_idx = md2.vbo_idx,
+                .vbo_idx = md.vbo_idx,
                 .start_idx = i,
             };
         }
-        if(ret == maxout)
-            break;
     }
 
-    curr.end_idx = i - 1;
+    curr.end_idx = ndescs - 1;
     out[ret++] = curr;
 
     return ret;
 }
 
-static void batch_ring_append_mats(struct gl_batch *batch, struct render_private *priv)
+static void *batch_stage_reserve(size_t size)
 {
-    /* Push a lookup table mapping the per-vertex material index to 
+    if(size <= s_stage_sz)
+        return s_stage;
+
+    void *stage = realloc(s_stage, size);
+    if(!stage)
+        return NULL;
+    s_stage = stage;
+    s_stage_sz = size;
+    return s_stage;
+}
+
+/* Fill in the material block, which is the same for all the instances of
+ * a mesh, so that it only needs to be built once per instance group. */
+static void batch_make_mats(struct gl_batch *batch, struct render_private *priv, 
+                            unsigned char out[static MATS_BLOCK_SZ])
+{
+    /* A lookup table mapping the per-vertex material index to 
      * a texture slot inside the list of texture arrays */
+    vec2_t *tex_arr_coords = (vec2_t*)out;
     for(int k = 0; k < MAX_MATERIALS; k++) {
         if(k < priv->num_materials) {
             struct tex_desc td = batch_tdesc_for_tid(batch, priv->materials[k].texture.id);
-            vec2_t tex_arr_coord = (vec2_t){td.arr_idx, td.tex_idx};
-            R_GL_RingbufferAppendLast(batch->attr_ring, &tex_arr_coord, sizeof(vec2_t));
+            tex_arr_coords[k] = (vec2_t){td.arr_idx, td.tex_idx};
         }else{
-            vec2_t tex_arr_coord = (vec2_t){0.0f, 0.0f};
-            R_GL_RingbufferAppendLast(batch->attr_ring, &tex_arr_coord, sizeof(vec2_t));
+            tex_arr_coords[k] = (vec2_t){0.0f, 0.0f};
         }
     }
 
-    /* Push the material attributes */
+    /* The material attributes */
+    float *attrs = (float*)(out + MAX_MATERIALS * sizeof(vec2_t));
     for(int k = 0; k < MAX_MATERIALS; k++) {
+        float *curr = attrs + k * 8;
         if(k < priv->num_materials) {
             struct material *mat = &priv->materials[k];
-            float zero = 0.0f;
-            R_GL_RingbufferAppendLast(batch->attr_ring, &mat->ambient_intensity, sizeof(float));
-            R_GL_RingbufferAppendLast(batch->attr_ring, &zero, sizeof(float));
-            R_GL_RingbufferAppendLast(batch->attr_ring, &mat->diffuse_clr, sizeof(vec3_t));
-            R_GL_RingbufferAppendLast(batch->attr_ring, &mat->specular_clr, sizeof(vec3_t));
+            curr[0] = mat->ambient_intensity;
+            curr[1] = 0.0f;
+            memcpy(curr + 2, &mat->diffuse_clr, sizeof(vec3_t));
+            memcpy(curr + 5, &mat->specular_clr, sizeof(vec3_t));
         }else{
-            float zero[8] = {0};
-            R_GL_RingbufferAppendLast(batch->attr_ring, &zero, sizeof(zero));
+            memset(curr, 0, 8 * sizeof(float));
         }
     }
 }
 
+static size_t batch_dcall_ninsts(struct draw_call_desc dcall, const struct inst_group_desc *descs)
+{
+    size_t ret = 0;
+    for(int i = dcall.start_idx; i <= dcall.end_idx; i++) {
+        ret += descs[i].end_idx - descs[i].start_idx + 1;
+    }
+    return ret;
+}
+
+/* The attributes of all the instances of a draw call are written to a staging
+ * buffer and pushed to the ring all at once, rather than with a ring push for
+ * every matrix and material of every instance. */
 static void batch_push_stat_attrs(struct gl_batch *batch, const struct ent_stat_rstate *ents,
                                   struct draw_call_desc dcall, struct inst_group_desc *descs)
 {
@@ -848,28 +993,34 @@ static void batch_push_stat_attrs(struct gl_batch *batch, const struct ent_stat_
      *
      * In total, 176 floats (704 bytes) are pushed per instance.
      */
-    size_t ninsts = 0;
+    const size_t inst_sz = sizeof(mat4x4_t) + MATS_BLOCK_SZ;
+
+    size_t ninsts = batch_dcall_ninsts(dcall, descs);
+    unsigned char *stage = batch_stage_reserve(ninsts * inst_sz);
+    if(!stage)
+        return;
+
+    unsigned char *out = stage;
     for(int i = dcall.start_idx; i <= dcall.end_idx; i++) {
 
         const struct inst_group_desc *curr = descs + i;
         struct render_private *priv = curr->render_private;
 
+        unsigned char mats[MATS_BLOCK_SZ];
+        batch_make_mats(batch, priv, mats);
+
         for(int j = curr->start_idx; j <= curr->end_idx; j++) {
-        
-            if(i == dcall.start_idx && j == curr->start_idx) {
-                R_GL_RingbufferPush(batch->attr_ring, &ents[j].model, sizeof(mat4x4_t));
-            }else{
-                R_GL_RingbufferAppendLast(batch->attr_ring, &ents[j].model, sizeof(mat4x4_t));
-            }
-            batch_ring_append_mats(batch, priv);
+            memcpy(out, &ents[j].model, sizeof(mat4x4_t));
+            memcpy(out + sizeof(mat4x4_t), mats, MATS_BLOCK_SZ);
+            out += inst_sz;
         }
-        ninsts += curr->end_idx - curr->start_idx + 1;
     }
+    R_GL_RingbufferPush(batch->attr_ring, stage, ninsts * inst_sz);
 
     size_t begin, end;
     R_GL_RingbufferGetLastRange(batch->attr_ring, &begin, &end);
     assert(end > begin ? (end - begin == 704 * ninsts)
-                       : ((STAT_ATTR_RING_SZ - begin) + end == 704 * ninsts));
+                       : ((R_GL_RingbufferGetSize(batch->attr_ring) - begin) + end == 704 * ninsts));
 
     R_GL_StateSet(GL_U_ATTR_STRIDE, (struct uval){ 
         .type = UTYPE_INT, 
@@ -889,27 +1040,26 @@ static void batch_push_stat_attrs_depth(struct gl_batch *batch, const struct ent
      *
      * In total, 16 floats (64 bytes) are pushed per instance.
      */
-    size_t ninsts = 0;
+    size_t ninsts = batch_dcall_ninsts(dcall, descs);
+    unsigned char *stage = batch_stage_reserve(ninsts * sizeof(mat4x4_t));
+    if(!stage)
+        return;
+
+    unsigned char *out = stage;
     for(int i = dcall.start_idx; i <= dcall.end_idx; i++) {
 
         const struct inst_group_desc *curr = descs + i;
-        struct render_private *priv = curr->render_private;
-
         for(int j = curr->start_idx; j <= curr->end_idx; j++) {
-     
-            if(i == dcall.start_idx && j == curr->start_idx) {
-                R_GL_RingbufferPush(batch->attr_ring, &ents[j].model, sizeof(mat4x4_t));
-            }else{
-                R_GL_RingbufferAppendLast(batch->attr_ring, &ents[j].model, sizeof(mat4x4_t));
-            }
+            memcpy(out, &ents[j].model, sizeof(mat4x4_t));
+            out += sizeof(mat4x4_t);
         }
-
-        ninsts += curr->end_idx - curr->start_idx + 1;
     }
+    R_GL_RingbufferPush(batch->attr_ring, stage, ninsts * sizeof(mat4x4_t));
+
     size_t begin, end;
     R_GL_RingbufferGetLastRange(batch->attr_ring, &begin, &end);
     assert(end > begin ? (end - begin == 64 * ninsts)
-                       : ((STAT_ATTR_RING_SZ - begin) + end == 64 * ninsts));
+                       : ((R_GL_RingbufferGetSize(batch->attr_ring) - begin) + end == 64 * ninsts));
 
     R_GL_StateSet(GL_U_ATTR_STRIDE, (struct uval){ 
         .type = UTYPE_INT, 
@@ -918,6 +1068,27 @@ static void batch_push_stat_attrs_depth(struct gl_batch *batch, const struct ent
     R_GL_StateInstall(GL_U_ATTR_STRIDE, R_GL_Shader_GetCurrActive());
 }
 
+/* Push the joint matrices to the staging buffer, unless the same matrices 
+ * have already been pushed for this draw call. Returns their offset (in
+ * floats) from the start of the buffer. */
+static uint32_t batch_stage_joint_mats(const mat4x4_t *mats, size_t njoints, 
+                                       unsigned char *stage, size_t *inout_size)
+{
+    int status;
+    khiter_t k = kh_put(pose, s_pose_offsets, (uint64_t)(uintptr_t)mats, &status);
+    if(status == 0)
+        return kh_value(s_pose_offsets, k);
+
+    uint32_t ret = *inout_size / sizeof(float);
+    memcpy(stage + *inout_size, mats, njoints * sizeof(mat4x4_t));
+    *inout_size += njoints * sizeof(mat4x4_t);
+
+    if(status != -1) {
+        kh_value(s_pose_offsets, k) = ret;
+    }
+    return ret;
+}
+
 static void batch_push_anim_attrs(struct gl_batch *batch, const struct ent_anim_rstate *ents,
                                   struct draw_call_desc dcall, struct inst_group_desc *descs)
 {
@@ -932,54 +1103,62 @@ static void batch_push_anim_attrs(struct gl_batch *batch, const struct ent_anim_
      *  +--------------------------------------------------+
      *  | mat4x4_t (16 floats)                             | (normal matrix)
      *  +--------------------------------------------------+
-     *  | MAX_JOINTS * mat4x4_t (1536 floats)              | (curr pose matrices)
+     *  | float, float (2 floats)                          | (curr pose, inverse bind pose offsets)
      *  +--------------------------------------------------+
-     *  | MAX_JOINTS * mat4x4_t (1536 floats)              | (inverse bind pose matrices)
+     *  | float[2] (2 floats)                              | (padding)
      *  +--------------------------------------------------+
      *
-     * In total, 3264 floats (13056 bytes) are pushed per instance.
+     * In total, 196 floats (784 bytes) are pushed per instance. The instances 
+     * are followed by the joint matrices they reference. Since the pose matrices
+     * are shared by all entities showing the same clip frame, each distinct set 
+     * of matrices is only pushed once per draw call. The offsets are in floats,
+     * relative to the start of the pushed range.
      */
-    size_t ninsts = 0;
+    const size_t inst_sz = 2 * sizeof(mat4x4_t) + MATS_BLOCK_SZ + 4 * sizeof(float);
+    const size_t poses_sz = MAX_JOINTS * sizeof(mat4x4_t);
+
+    size_t ninsts = batch_dcall_ninsts(dcall, descs);
+    unsigned char *stage = batch_stage_reserve(ninsts * (inst_sz + 2 * poses_sz));
+    if(!stage)
+        return;
+
+    kh_clear(pose, s_pose_offsets);
+
+    unsigned char *out = stage;
+    size_t size = ninsts * inst_sz;
+
     for(int i = dcall.start_idx; i <= dcall.end_idx; i++) {
 
         const struct inst_group_desc *curr = descs + i;
         struct render_private *priv = curr->render_private;
 
-        for(int j = curr->start_idx; j <= curr->end_idx; j++) {
-        
-            if(i == dcall.start_idx && j == curr->start_idx) {
-                R_GL_RingbufferPush(batch->attr_ring, &ents[j].model, sizeof(mat4x4_t));
-            }else{
-                R_GL_RingbufferAppendLast(batch->attr_ring, &ents[j].model, sizeof(mat4x4_t));
-            }
-            batch_ring_append_mats(batch, priv);
-
-            mat4x4_t model, normal;
-            PFM_Mat4x4_Inverse((mat4x4_t*)&ents[j].model, &model);
-            PFM_Mat4x4_Transpose(&model, &normal);
-
-            R_GL_RingbufferAppendLast(batch->attr_ring, &ents[j].model, sizeof(mat4x4_t));
+        unsigned char mats[MATS_BLOCK_SZ];
+        batch_make_mats(batch, priv, mats);
 
-            const size_t njoints = ents[j].njoints;
-            const size_t matsize = njoints * sizeof(mat4x4_t);
-            const size_t pad = (MAX_JOINTS - njoints) * sizeof(mat4x4_t);
+        for(int j = curr->start_idx; j <= curr->end_idx; j++) {
 
-            R_GL_RingbufferAppendLast(batch->attr_ring, ents[j].curr_pose, matsize);
-            R_GL_RingbufferExtendLast(batch->attr_ring, pad);
+            float offsets[4] = {
+                batch_stage_joint_mats(ents[j].curr_pose, ents[j].njoints, stage, &size),
+                batch_stage_joint_mats(ents[j].inv_bind_pose, ents[j].njoints, stage, &size),
+            };
 
-            R_GL_RingbufferAppendLast(batch->attr_ring, ents[j].inv_bind_pose, matsize);
-            R_GL_RingbufferExtendLast(batch->attr_ring, pad);
+            memcpy(out, &ents[j].model, sizeof(mat4x4_t));
+            memcpy(out + sizeof(mat4x4_t), mats, MATS_BLOCK_SZ);
+            memcpy(out + sizeof(mat4x4_t) + MATS_BLOCK_SZ, &ents[j].model, sizeof(mat4x4_t));
+            memcpy(out + 2 * sizeof(mat4x4_t) + MATS_BLOCK_SZ, offsets, sizeof(offsets));
+            out += inst_sz;
         }
-        ninsts += curr->end_idx - curr->start_idx + 1;
     }
+    R_GL_RingbufferPush(batch->attr_ring, stage, size);
+
     size_t begin, end;
     R_GL_RingbufferGetLastRange(batch->attr_ring, &begin, &end);
-    assert(end > begin ? (end - begin == 13056 * ninsts)
-                       : ((ANIM_ATTR_RING_SZ - begin) + end == 13056 * ninsts));
+    assert(end > begin ? (end - begin == size)
+                       : ((R_GL_RingbufferGetSize(batch->attr_ring) - begin) + end == size));
 
     R_GL_StateSet(GL_U_ATTR_STRIDE, (struct uval){ 
         .type = UTYPE_INT, 
-        .val.as_int = 3264
+        .val.as_int = 196
     });
     R_GL_StateInstall(GL_U_ATTR_STRIDE, R_GL_Shader_GetCurrActive());
 }
@@ -994,26 +1173,30 @@ static void batch_push_cmds(struct gl_batch *batch, struct draw_call_desc dcall,
         struct mesh_desc mdesc = batch_mdesc_for_vbo(batch, priv->mesh.VBO);
         assert(mdesc.offset % batch_vert_alignment(batch->type) == 0);
 
-        struct GL_DAI_Cmd cmd = (struct GL_DAI_Cmd){
-            .count = priv->mesh.num_verts,
+        assert(mdesc.ioffset % sizeof(GLuint) == 0);
+
+        struct GL_DEI_Cmd cmd = (struct GL_DEI_Cmd){
+            .count = priv->mesh.num_indices,
             .instance_count = descs[i].end_idx - descs[i].start_idx + 1,
-            .first_index = mdesc.offset / batch_vert_alignment(batch->type),
+            .first_index = mdesc.ioffset / sizeof(GLuint),
+            .base_vertex = mdesc.offset / batch_vert_alignment(batch->type),
             .base_instance = inst_idx,
         };
 
         if(i == dcall.start_idx) {
-            R_GL_RingbufferPush(batch->cmd_ring, &cmd, sizeof(struct GL_DAI_Cmd));
+            R_GL_RingbufferPush(batch->cmd_ring, &cmd, sizeof(struct GL_DEI_Cmd));
         }else{
-            R_GL_RingbufferAppendLast(batch->cmd_ring, &cmd, sizeof(struct GL_DAI_Cmd));
+            R_GL_RingbufferAppendLast(batch->cmd_ring, &cmd, sizeof(struct GL_DEI_Cmd));
         }
+        R_GL_StatsIndirect(GL_TRIANGLES, cmd.count, cmd.instance_count);
         inst_idx += cmd.instance_count;
     }
 
     size_t ncmds = dcall.end_idx - dcall.start_idx + 1;
     size_t begin, end;
     R_GL_RingbufferGetLastRange(batch->cmd_ring, &begin, &end);
-    assert(end > begin ? (end - begin == sizeof(struct GL_DAI_Cmd) * ncmds)
-                       : ((CMD_RING_SZ - begin) + end  == sizeof(struct GL_DAI_Cmd) * ncmds));
+    assert(end > begin ? (end - begin == sizeof(struct GL_DEI_Cmd) * ncmds)
+                       : ((R_GL_RingbufferGetSize(batch->cmd_ring) - begin) + end  == sizeof(struct GL_DEI_Cmd) * ncmds));
 }
 
 static void batch_multidraw_legacy(struct gl_batch *batch, struct draw_call_desc dcall,
@@ -1032,11 +1215,13 @@ static void batch_multidraw_legacy(struct gl_batch *batch, struct draw_call_desc
         });
         R_GL_StateInstall(GL_U_ATTR_OFFSET, R_GL_Shader_GetCurrActive());
 
-        GLint first = mdesc.offset / batch_vert_alignment(batch->type);
-        GLint count = priv->mesh.num_verts;
+        GLint base = mdesc.offset / batch_vert_alignment(batch->type);
+        GLint count = priv->mesh.num_indices;
         size_t instcount = curr->end_idx - curr->start_idx + 1;
 
-        glDrawArraysInstanced(GL_TRIANGLES, first, count, instcount);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_INT, 
+            (void*)mdesc.ioffset, instcount, base);
+        R_GL_StatsDraw(GL_TRIANGLES, count, instcount);
         inst_idx += instcount;
     }
 }
@@ -1060,16 +1245,20 @@ static void batch_multidraw(struct gl_batch *batch, struct draw_call_desc dcall,
 
     if(cmd_end < cmd_begin) {
 
-        assert((CMD_RING_SZ - cmd_begin) % sizeof(struct GL_DAI_Cmd) == 0);
-        size_t ncmds_end = (CMD_RING_SZ - cmd_begin) / sizeof(struct GL_DAI_Cmd);
-        GL_PERF_CALL("multidraw", glMultiDrawArraysIndirect(GL_TRIANGLES, (void*)cmd_begin, ncmds_end, 0));
+        size_t cmd_ring_sz = R_GL_RingbufferGetSize(batch->cmd_ring);
+        assert((cmd_ring_sz - cmd_begin) % sizeof(struct GL_DEI_Cmd) == 0);
+        size_t ncmds_end = (cmd_ring_sz - cmd_begin) / sizeof(struct GL_DEI_Cmd);
+        GL_PERF_CALL("multidraw", glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)cmd_begin, ncmds_end, 0));
+        R_GL_StatsDraw(GL_TRIANGLES, 0, 0);
 
-        assert(cmd_end % sizeof(struct GL_DAI_Cmd) == 0);
-        size_t ncmds_begin = cmd_end / sizeof(struct GL_DAI_Cmd);
-        GL_PERF_CALL("multidraw", glMultiDrawArraysIndirect(GL_TRIANGLES, (void*)0, ncmds_begin, 0));
+        assert(cmd_end % sizeof(struct GL_DEI_Cmd) == 0);
+        size_t ncmds_begin = cmd_end / sizeof(struct GL_DEI_Cmd);
+        GL_PERF_CALL("multidraw", glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, ncmds_begin, 0));
+        R_GL_StatsDraw(GL_TRIANGLES, 0, 0);
     }else{
         size_t ncmds = dcall.end_idx - dcall.start_idx + 1;
-        GL_PERF_CALL("multidraw", glMultiDrawArraysIndirect(GL_TRIANGLES, (void*)cmd_begin, ncmds, 0));
+        GL_PERF_CALL("multidraw", glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)cmd_begin, ncmds, 0));
+        R_GL_StatsDraw(GL_TRIANGLES, 0, 0);
     }
 
     R_GL_RingbufferSyncLast(batch->cmd_ring);
@@ -1131,10 +1320,10 @@ static void batch_render_stat(struct gl_batch *batch, struct ent_stat_rstate *en
     GL_PERF_ENTER();
 
     struct inst_group_desc descs[MAX_BATCHES];
-    size_t ninsts = batch_sort_by_inst_stat(ents, nents, descs, ARR_SIZE(descs));
+    size_t ninsts = batch_sort_by_inst_stat(batch, ents, nents, descs, ARR_SIZE(descs));
 
     struct draw_call_desc dcalls[MAX_BATCHES];
-    size_t ndcalls = batch_sort_by_vbo(batch, descs, ninsts, dcalls, ARR_SIZE(dcalls));
+    size_t ndcalls = batch_group_by_vbo(batch, descs, ninsts, dcalls, ARR_SIZE(dcalls));
 
     for(int i = 0; i < batch->ntexarrs; i++) {
         R_GL_Texture_BindArray(&batch->textures[i].arr, R_GL_Shader_GetCurrActive());
@@ -1152,10 +1341,10 @@ static void batch_render_anim(struct gl_batch *batch, struct ent_anim_rstate *en
     GL_PERF_ENTER();
 
     struct inst_group_desc descs[MAX_BATCHES];
-    size_t ninsts = batch_sort_by_inst_anim(ents, nents, descs, ARR_SIZE(descs));
+    size_t ninsts = batch_sort_by_inst_anim(batch, ents, nents, descs, ARR_SIZE(descs));
 
     struct draw_call_desc dcalls[MAX_BATCHES];
-    size_t ndcalls = batch_sort_by_vbo(batch, descs, ninsts, dcalls, ARR_SIZE(dcalls));
+    size_t ndcalls = batch_group_by_vbo(batch, descs, ninsts, dcalls, ARR_SIZE(dcalls));
 
     for(int i = 0; i < batch->ntexarrs; i++) {
         R_GL_Texture_BindArray(&batch->textures[i].arr, R_GL_Shader_GetCurrActive());
@@ -1173,6 +1362,8 @@ static void batch_render_anim_all(vec_ranim_t *ents, bool shadows, enum render_p
     size_t nanim = vec_size(ents);
     if(nanim == 0)
         return;
+    if(!batch_sort_reserve(nanim, sizeof(struct ent_anim_rstate)))
+        return;
 
     switch(pass) {
     case RENDER_PASS_DEPTH:
@@ -1187,6 +1378,8 @@ static void batch_render_anim_all(vec_ranim_t *ents, bool shadows, enum render_p
     size_t ntranslucent = batch_anim_sort_by_transparency(ents, nanim);
     size_t nopaque = nanim - ntranslucent;
 
+    s_tex_epoch++;
+
     for(int i = 0; i < nanim; i++) {
         batch_append(s_anim_batch, vec_AT(ents, i).render_private);
     }
@@ -1205,15 +1398,11 @@ static void batch_render_anim_all(vec_ranim_t *ents, bool shadows, enum render_p
 static void batch_render_stat_all(vec_rstat_t *ents, bool shadows, 
                                   enum render_pass pass, int batch_id)
 {
-    struct chunk_batch_desc descs[MAX_BATCHES];
-    size_t nbatches = vec_size(ents) > 0 ? 1 : 0;
-    descs[0].start_idx = 0;
-    descs[0].end_idx = vec_size(ents) - 1;
-
-    if(batch_id == 0) {
-        nbatches = batch_sort_by_chunk(ents, descs, ARR_SIZE(descs));
-    }
+    if(!batch_sort_reserve(vec_size(ents), sizeof(struct ent_stat_rstate)))
+        return;
 
+    struct chunk_batch_desc descs[MAX_BATCHES];
+    size_t nbatches = batch_sort_by_chunk(ents, batch_id == 0, descs, ARR_SIZE(descs));
     if(nbatches == 0)
         return;
 
@@ -1227,6 +1416,7 @@ static void batch_render_stat_all(vec_rstat_t *ents, bool shadows,
     default: assert(0);
     }
 
+    s_tex_epoch++;
     for(int i = 0; i < nbatches; i++) {
     
         const struct chunk_batch_desc *curr = &descs[i];
@@ -1234,9 +1424,9 @@ static void batch_render_stat_all(vec_rstat_t *ents, bool shadows,
 
         /* Further subdivide each batch into translucent and opaque entities, 
          * and draw each one as separate draw calls, as this requires pipeline
-         * state changes.
+         * state changes. The translucent ones are already sorted to the back.
          */
-        size_t ntranslucent = batch_sort_by_transparency(ents, curr);
+        size_t ntranslucent = batch_count_translucent(ents, curr);
 
         if(batch_id == 0) {
         
@@ -1300,6 +1490,9 @@ bool R_GL_Batch_Init(void)
     s_id_batches = kh_init(batch);
     if(!s_id_batches)
         goto fail_id_batches;
+    s_pose_offsets = kh_init(pose);
+    if(!s_pose_offsets)
+        goto fail_pose_offsets;
 
     GLint draw_id_buff[MAX_INSTS];
     for(int i = 0; i < MAX_INSTS; i++)
@@ -1311,6 +1504,8 @@ bool R_GL_Batch_Init(void)
 
     return true;
 
+fail_pose_offsets:
+    kh_destroy(batch, s_id_batches);
 fail_id_batches:
     kh_destroy(batch, s_chunk_batches);
 fail_chunk_batches:
@@ -1338,6 +1533,23 @@ void R_GL_Batch_Shutdown(void)
     kh_destroy(batch, s_id_batches);
 
     glDeleteBuffers(1, &s_draw_id_vbo);
+
+    free(s_sort_keys);
+    free(s_sort_idx);
+    free(s_sort_tmp);
+    free(s_sort_ents);
+    s_sort_keys = NULL;
+    s_sort_idx = NULL;
+    s_sort_tmp = NULL;
+    s_sort_ents = NULL;
+    s_sort_cap = 0;
+    s_sort_ents_sz = 0;
+
+    free(s_stage);
+    s_stage = NULL;
+    s_stage_sz = 0;
+
+    kh_destroy(pose, s_pose_offsets);
 }
 
 void R_GL_Batch_Draw(struct render_input *in)
@@ -1345,8 +1557,13 @@ void R_GL_Batch_Draw(struct render_input *in)
     GL_PERF_ENTER();
     GL_PERF_PUSH_GROUP(0, "batch::Draw");
 
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_BATCH_ANIM);
     batch_render_anim_all(&in->cam_vis_anim, true, RENDER_PASS_REGULAR);
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_BATCH_ANIM);
+
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_BATCH_STAT);
     batch_render_stat_all(&in->cam_vis_stat, true, RENDER_PASS_REGULAR, BATCH_ID_NULL);
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_BATCH_STAT);
 
     GL_PERF_POP_GROUP();
     GL_PERF_RETURN_VOID();
@@ -1357,8 +1574,13 @@ void R_GL_Batch_DrawWithID(struct render_input *in, enum batch_id *id)
     GL_PERF_ENTER();
     GL_PERF_PUSH_GROUP(0, "batch::DrawWithID");
 
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_BATCH_ANIM);
     batch_render_anim_all(&in->cam_vis_anim, true, RENDER_PASS_REGULAR);
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_BATCH_ANIM);
+
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_BATCH_STAT);
     batch_render_stat_all(&in->cam_vis_stat, true, RENDER_PASS_REGULAR, *id);
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_BATCH_STAT);
 
     GL_PERF_POP_GROUP();
     GL_PERF_RETURN_VOID();
@@ -1369,8 +1591,16 @@ void R_GL_Batch_RenderDepthMap(struct render_input *in)
     GL_PERF_ENTER();
     GL_PERF_PUSH_GROUP(0, "batch::RenderDepthMap");
 
+    if(R_GL_DepthPassStatic(in->light_vis_stat.array, vec_size(&in->light_vis_stat))) {
+        R_GL_StatsGPUBegin(RENDER_GPU_PASS_BATCH_STAT);
+        batch_render_stat_all(&in->light_vis_stat, true, RENDER_PASS_DEPTH, BATCH_ID_NULL);
+        R_GL_StatsGPUEnd(RENDER_GPU_PASS_BATCH_STAT);
+    }
+    R_GL_DepthPassDynamic();
+
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_BATCH_ANIM);
     batch_render_anim_all(&in->light_vis_anim, true, RENDER_PASS_DEPTH);
-    batch_render_stat_all(&in->light_vis_stat, true, RENDER_PASS_DEPTH, BATCH_ID_NULL);
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_BATCH_ANIM);
 
     GL_PERF_POP_GROUP();
     GL_PERF_RETURN_VOID();
@@ -0,0 +1,301 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/render.h"
+#include "gl_render.h"
+#include "gl_perf.h"
+#include "gl_assert.h"
+#include "../main.h"
+
+#include <GL/glew.h>
+#include <assert.h>
+#include <math.h>
+
+
+#define ARR_SIZE(a)         (sizeof(a)/sizeof((a)[0]))
+#define CLAMP(a, min, max)  ((a) < (min) ? (min) : ((a) > (max) ? (max) : (a)))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+#define MIN_SCALE           (0.5f)
+#define MAX_SCALE           (1.0f)
+/* The scale moves in discrete steps, so that the offscreen buffers 
+ * sized off of the viewport (i.e. for water) aren't re-created 
+ * every frame. */
+#define SCALE_STEP          (0.05f)
+#define MAX_SCALE_DELTA     (0.1f)
+/* Only grow the resolution back when there is a comfortable margin */
+#define HEADROOM            (0.85f)
+/* Frames to wait after a change for the timings to reflect it */
+#define COOLDOWN_FRAMES     (8)
+#define EMA_WEIGHT          (0.2f)
+
+/* The timer queries are read back a few frames later, so as not to 
+ * stall on the GPU. */
+struct timing{
+    GLuint begin;
+    GLuint end;
+    bool   pending;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool          s_enabled = false;
+static bool          s_active = false;
+static float         s_target_ms = 16.0f;
+static float         s_scale = MAX_SCALE;
+static float         s_avg_ms = 0.0f;
+static int           s_cooldown = 0;
+
+/* The scene is rendered to the lower-left corner of a target 
+ * the size of the native viewport. */
+static GLuint        s_fbo;
+static GLuint        s_color;
+static GLuint        s_depth;
+static int           s_width, s_height;
+static GLint         s_native_vp[4];
+static int           s_scene_w, s_scene_h;
+
+static int           s_head = 0;
+static struct timing s_timings[4];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void dynres_free(void)
+{
+    if(!s_fbo)
+        return;
+
+    glDeleteFramebuffers(1, &s_fbo);
+    glDeleteRenderbuffers(1, &s_color);
+    glDeleteRenderbuffers(1, &s_depth);
+    s_fbo = 0;
+
+    for(int i = 0; i < ARR_SIZE(s_timings); i++) {
+        glDeleteQueries(1, &s_timings[i].begin);
+        glDeleteQueries(1, &s_timings[i].end);
+        s_timings[i].pending = false;
+    }
+}
+
+static void dynres_alloc(int width, int height)
+{
+    GL_PERF_ENTER();
+    dynres_free();
+
+    glGenRenderbuffers(1, &s_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, s_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &s_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, s_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &s_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, s_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, s_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, s_depth);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    for(int i = 0; i < ARR_SIZE(s_timings); i++) {
+        glGenQueries(1, &s_timings[i].begin);
+        glGenQueries(1, &s_timings[i].end);
+        s_timings[i].pending = false;
+    }
+
+    s_width = width;
+    s_height = height;
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+static void dynres_adjust(float ms)
+{
+    s_avg_ms = (s_avg_ms == 0.0f) ? ms : (s_avg_ms * (1.0f - EMA_WEIGHT) + ms * EMA_WEIGHT);
+
+    if(s_cooldown > 0) {
+        s_cooldown--;
+        return;
+    }
+
+    if(s_avg_ms <= s_target_ms && s_avg_ms >= s_target_ms * HEADROOM)
+        return;
+
+    /* The GPU time scales roughly with the number of pixels shaded */
+    float want = s_scale * sqrtf(s_target_ms / MAX(s_avg_ms, 0.01f));
+    want = CLAMP(want, s_scale - MAX_SCALE_DELTA, s_scale + MAX_SCALE_DELTA);
+    want = roundf(want / SCALE_STEP) * SCALE_STEP;
+    want = CLAMP(want, MIN_SCALE, MAX_SCALE);
+
+    if(want != s_scale) {
+        s_scale = want;
+        s_cooldown = COOLDOWN_FRAMES;
+    }
+}
+
+static void dynres_poll_timings(void)
+{
+    for(int i = 0; i < ARR_SIZE(s_timings); i++) {
+
+        struct timing *curr = &s_timings[(s_head + i) % ARR_SIZE(s_timings)];
+        if(!curr->pending)
+            continue;
+
+        GLint avail = GL_FALSE;
+        glGetQueryObjectiv(curr->end, GL_QUERY_RESULT_AVAILABLE, &avail);
+        if(!avail)
+            continue;
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(curr->begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(curr->end, GL_QUERY_RESULT, &end);
+        curr->pending = false;
+
+        dynres_adjust((end - begin) / 1000000.0f);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_DynresBeginScene(void)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+    assert(!s_active);
+
+    if(!s_enabled)
+        GL_PERF_RETURN_VOID();
+
+    glGetIntegerv(GL_VIEWPORT, s_native_vp);
+    if(s_native_vp[2] <= 0 || s_native_vp[3] <= 0)
+        GL_PERF_RETURN_VOID();
+
+    if(!s_fbo || s_native_vp[2] != s_width || s_native_vp[3] != s_height) {
+        dynres_alloc(s_native_vp[2], s_native_vp[3]);
+    }
+    dynres_poll_timings();
+
+    s_scene_w = MAX(1, (int)(s_native_vp[2] * s_scale));
+    s_scene_h = MAX(1, (int)(s_native_vp[3] * s_scale));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s_fbo);
+    glViewport(0, 0, s_scene_w, s_scene_h);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    /* An unread query from a few frames back gets overwritten */
+    struct timing *curr = &s_timings[s_head];
+    glQueryCounter(curr->begin, GL_TIMESTAMP);
+    curr->pending = false;
+    s_active = true;
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+void R_GL_DynresEndScene(void)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_active)
+        GL_PERF_RETURN_VOID();
+
+    struct timing *curr = &s_timings[s_head];
+    glQueryCounter(curr->end, GL_TIMESTAMP);
+    curr->pending = true;
+    s_head = (s_head + 1) % ARR_SIZE(s_timings);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, s_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, s_scene_w, s_scene_h, 
+        s_native_vp[0], s_native_vp[1], 
+        s_native_vp[0] + s_native_vp[2], s_native_vp[1] + s_native_vp[3],
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(s_native_vp[0], s_native_vp[1], s_native_vp[2], s_native_vp[3]);
+    s_active = false;
+
+    if(!s_enabled) {
+        dynres_free();
+    }
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+float R_GL_DynresSceneScale(void)
+{
+    return s_active ? s_scale : 1.0f;
+}
+
+void R_GL_DynresSetEnabled(const bool *enabled)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    s_enabled = *enabled;
+    s_scale = MAX_SCALE;
+    s_avg_ms = 0.0f;
+    s_cooldown = 0;
+
+    /* Otherwise, the target is released once the scene is resolved */
+    if(!s_enabled && !s_active) {
+        dynres_free();
+    }
+}
+
+void R_GL_DynresSetTarget(const float *ms)
+{
+    ASSERT_IN_RENDER_THREAD();
+    s_target_ms = *ms;
+    s_cooldown = 0;
+}
+
+void R_GL_DynresShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    dynres_free();
+    s_active = false;
+}
+
@@ -42,7 +42,11 @@ struct vertex;
 
 struct mesh{
     unsigned num_verts;
+    /* Number of GLuint indices in the EBO. Meshes without an 
+     * EBO (num_indices == 0) are drawn as a triangle list. */
+    unsigned num_indices;
     GLuint   VBO;
+    GLuint   EBO;
     GLuint   VAO;
 };
 
@@ -73,6 +73,12 @@ struct unit_render_ctx{
     GLuint clr_vbo;
     GLuint off_vbo;
     GLuint vao;
+    /* The number of units currently held in the buffers */
+    size_t nunits;
+    /* The number of units the buffers have storage for */
+    size_t capacity;
+    /* The minimap size for which the unit quad was built */
+    int    side_len_px;
 };
 
 /*****************************************************************************/
@@ -84,6 +90,8 @@ struct render_minimap_ctx{
     struct texture        minimap_texture;
     struct texture        water_texture;
     struct mesh           minimap_mesh;
+    struct mesh           frustum_mesh;
+    struct unit_render_ctx units;
 }s_ctx;
 
 /*****************************************************************************/
@@ -161,18 +169,10 @@ void draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, const s
         (struct vertex) { .pos = (vec3_t) {norm_br.raw[0], norm_br.raw[1], 0.0f} },
     };
 
-    GLuint VAO, VBO;
-
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(box_verts) * sizeof(struct vertex), box_verts, GL_STATIC_DRAW);
-
-    /* Attribute 0 - position */
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)0);
-    glEnableVertexAttribArray(0);
+    glBindVertexArray(s_ctx.frustum_mesh.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.frustum_mesh.VBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(box_verts), box_verts);
+    R_GL_StatsUpload(sizeof(box_verts));
 
     GLuint shader_prog = R_GL_Shader_GetProgForName("mesh.static.colored");
     R_GL_Shader_InstallProg(shader_prog);
@@ -193,6 +193,7 @@ void draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, const s
     R_GL_StateInstall(GL_U_COLOR, shader_prog);
 
     glDrawArrays(GL_LINE_LOOP, 0, 4);
+    R_GL_StatsDraw(GL_LINE_LOOP, 4, 1);
 
     mat4x4_t one_px_trans, new_model;
     PFM_Mat4x4_MakeTrans(-1.0f, -1.0f, 0.0f, &one_px_trans);
@@ -211,9 +212,7 @@ void draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, const s
     R_GL_StateInstall(GL_U_COLOR, shader_prog);
 
     glDrawArrays(GL_LINE_LOOP, 0, 4);
-
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    R_GL_StatsDraw(GL_LINE_LOOP, 4, 1);
 
     GL_PERF_RETURN_VOID();
 }
@@ -448,25 +447,29 @@ static void setup_verts(void)
         (void*)offsetof(struct vertex, uv));
     glEnableVertexAttribArray(1);
 
+    /* The camera frustum box is re-written in place every frame */
+    glGenVertexArrays(1, &s_ctx.frustum_mesh.VAO);
+    glBindVertexArray(s_ctx.frustum_mesh.VAO);
+
+    glGenBuffers(1, &s_ctx.frustum_mesh.VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.frustum_mesh.VBO);
+    glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(struct vertex), NULL, GL_DYNAMIC_DRAW);
+
+    /* Attribute 0 - position */
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)0);
+    glEnableVertexAttribArray(0);
+
     GL_PERF_RETURN_VOID();
 }
 
-static void unit_render_ctx_init(struct unit_render_ctx *in, int side_len_px, 
-                                 size_t nunits, vec2_t *offsets, vec3_t *colors)
+static void unit_render_ctx_init(struct unit_render_ctx *in)
 {
-    vec3_t verts[4] = {
-        (vec3_t) {-1.0f / side_len_px * 4, -1.0f / side_len_px * 4, 0.0f}, 
-        (vec3_t) {-1.0f / side_len_px * 4,  1.0f / side_len_px * 4, 0.0f}, 
-        (vec3_t) { 1.0f / side_len_px * 4,  1.0f / side_len_px * 4, 0.0f}, 
-        (vec3_t) { 1.0f / side_len_px * 4, -1.0f / side_len_px * 4, 0.0f}, 
-    };
-
     glGenVertexArrays(1, &in->vao);
     glBindVertexArray(in->vao);
 
     glGenBuffers(1, &in->vert_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, in->vert_vbo);
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(verts) * sizeof(vec3_t), verts, GL_STREAM_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(vec3_t), NULL, GL_STATIC_DRAW);
 
     /* Attribute 0 - position */
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
@@ -475,7 +478,6 @@ static void unit_render_ctx_init(struct unit_render_ctx *in, int side_len_px,
     /* Attribute 1 - color */
     glGenBuffers(1, &in->clr_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, in->clr_vbo);
-    glBufferData(GL_ARRAY_BUFFER, nunits * sizeof(vec3_t), colors, GL_STREAM_DRAW);
 
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
     glEnableVertexAttribArray(1);
@@ -484,11 +486,52 @@ static void unit_render_ctx_init(struct unit_render_ctx *in, int side_len_px,
     /* Attribute 2 - offset */
     glGenBuffers(1, &in->off_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, in->off_vbo);
-    glBufferData(GL_ARRAY_BUFFER, nunits * sizeof(vec2_t), offsets, GL_STREAM_DRAW);
 
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vec2_t), (void*)0);
     glEnableVertexAttribArray(2);
     glVertexAttribDivisor(2, 1);
+
+    in->nunits = 0;
+    in->capacity = 0;
+    in->side_len_px = 0;
+}
+
+static void unit_render_ctx_set_side_len(struct unit_render_ctx *in, int side_len_px)
+{
+    if(in->side_len_px == side_len_px)
+        return;
+
+    vec3_t verts[4] = {
+        (vec3_t) {-1.0f / side_len_px * 4, -1.0f / side_len_px * 4, 0.0f}, 
+        (vec3_t) {-1.0f / side_len_px * 4,  1.0f / side_len_px * 4, 0.0f}, 
+        (vec3_t) { 1.0f / side_len_px * 4,  1.0f / side_len_px * 4, 0.0f}, 
+        (vec3_t) { 1.0f / side_len_px * 4, -1.0f / side_len_px * 4, 0.0f}, 
+    };
+
+    glBindBuffer(GL_ARRAY_BUFFER, in->vert_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(verts), verts);
+    R_GL_StatsUpload(sizeof(verts));
+    in->side_len_px = side_len_px;
+}
+
+static void unit_render_ctx_upload(struct unit_render_ctx *in, size_t nunits, 
+                                   const vec2_t *offsets, const vec3_t *colors)
+{
+    /* Orphan the old storage so that we don't stall on any draws still 
+     * reading from it. The storage only ever grows. */
+    size_t cap = MAX(in->capacity, nunits);
+
+    glBindBuffer(GL_ARRAY_BUFFER, in->clr_vbo);
+    glBufferData(GL_ARRAY_BUFFER, cap * sizeof(vec3_t), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, nunits * sizeof(vec3_t), colors);
+
+    glBindBuffer(GL_ARRAY_BUFFER, in->off_vbo);
+    glBufferData(GL_ARRAY_BUFFER, cap * sizeof(vec2_t), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, nunits * sizeof(vec2_t), offsets);
+    R_GL_StatsUpload(nunits * (sizeof(vec3_t) + sizeof(vec2_t)));
+
+    in->capacity = cap;
+    in->nunits = nunits;
 }
 
 static void unit_render_ctx_destroy(struct unit_render_ctx *in)
@@ -509,9 +552,15 @@ void R_GL_MinimapBake(const struct map *map, void **chunk_rprivates,
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
 
+    R_GL_StatsPushPass(RENDER_STAT_PASS_MINIMAP);
+
     M_GetResolution(map, &s_ctx.res);
     setup_ortho_view_uniforms(map);
 
+    GLint prev_fb, prev_viewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fb);
+    glGetIntegerv(GL_VIEWPORT, prev_viewport);
+
     /* Render the map top-down view to the texture. */
     glViewport(0,0, MINIMAP_RES, MINIMAP_RES);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -520,14 +569,13 @@ void R_GL_MinimapBake(const struct map *map, void **chunk_rprivates,
     create_water_texture(map);
     create_minimap_texture(map, chunk_rprivates, chunk_model_mats);
 
-    /* Re-bind the default framebuffer when we're done rendering */
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    int width, height;
-    Engine_WinDrawableSize(&width, &height);
-    glViewport(0,0, width, height);
+    /* Re-bind the previous framebuffer when we're done rendering */
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fb);
+    glViewport(prev_viewport[0], prev_viewport[1], prev_viewport[2], prev_viewport[3]);
 
     setup_verts();
+    unit_render_ctx_init(&s_ctx.units);
+    R_GL_StatsPopPass();
 
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
@@ -538,8 +586,13 @@ void R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate,
 {
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
+    R_GL_StatsPushPass(RENDER_STAT_PASS_MINIMAP);
     setup_ortho_view_uniforms(map);
 
+    GLint prev_fb, prev_viewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fb);
+    glGetIntegerv(GL_VIEWPORT, prev_viewport);
+
     /* Render the chunk to the existing minimap texture */
     GLuint fb;
     glGenFramebuffers(1, &fb);
@@ -559,13 +612,12 @@ void R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate,
 
     R_GL_MapInvalidate();
 
-    int width, height;
-    Engine_WinDrawableSize(&width, &height);
-    glViewport(0,0, width, height);
+    glViewport(prev_viewport[0], prev_viewport[1], prev_viewport[2], prev_viewport[3]);
 
-    /* Re-bind the default framebuffer when we're done rendering */
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    /* Re-bind the previous framebuffer when we're done rendering */
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fb);
     glDeleteFramebuffers(1, &fb);
+    R_GL_StatsPopPass();
 
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
@@ -576,6 +628,7 @@ void R_GL_MinimapRender(const struct map *map, const struct camera *cam,
 {
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
+    R_GL_StatsPushPass(RENDER_STAT_PASS_MINIMAP);
 
     mat4x4_t tmp;
     mat4x4_t tilt, trans, scale, model;
@@ -613,6 +666,7 @@ void R_GL_MinimapRender(const struct map *map, const struct camera *cam,
     R_GL_StateInstall(GL_U_COLOR, shader_prog);
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    R_GL_StatsDraw(GL_TRIANGLE_FAN, 4, 1);
 
     /* Mask the minimap region in the stencil buffer before drawing the
      * camera frustum so that it is not drawn outside the minimap region. */
@@ -642,6 +696,7 @@ void R_GL_MinimapRender(const struct map *map, const struct camera *cam,
     R_GL_MapFogBindLast(GL_TEXTURE2, shader_prog, "visbuff");
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    R_GL_StatsDraw(GL_TRIANGLE_FAN, 4, 1);
 
     /* Draw a box around the visible area*/
     if(cam) {
@@ -650,18 +705,35 @@ void R_GL_MinimapRender(const struct map *map, const struct camera *cam,
     }
 
     glDisable(GL_STENCIL_TEST);
+    R_GL_StatsPopPass();
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+void R_GL_MinimapUpdateUnits(size_t *nunits, vec2_t *posbuff, vec3_t *colorbuff)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+    assert(s_ctx.units.vao > 0);
+
+    R_GL_StatsPushPass(RENDER_STAT_PASS_MINIMAP);
+    unit_render_ctx_upload(&s_ctx.units, *nunits, posbuff, colorbuff);
+    R_GL_StatsPopPass();
 
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
 
-void  R_GL_MinimapRenderUnits(const struct map *map, vec2_t *center_pos, 
-                              const int *side_len_px, size_t *nunits, 
-                              vec2_t *posbuff, vec3_t *colorbuff)
+void R_GL_MinimapRenderUnits(const struct map *map, vec2_t *center_pos, 
+                             const int *side_len_px)
 {
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
 
+    if(s_ctx.units.nunits == 0)
+        GL_PERF_RETURN_VOID();
+
     mat4x4_t tmp;
     mat4x4_t tilt, trans, scale, model;
     PFM_Mat4x4_MakeRotZ(DEG_TO_RAD(-45.0f), &tilt);
@@ -670,19 +742,20 @@ void  R_GL_MinimapRenderUnits(const struct map *map, vec2_t *center_pos,
     PFM_Mat4x4_Mult4x4(&scale, &tilt, &tmp);
     PFM_Mat4x4_Mult4x4(&trans, &tmp, &model);
 
-    struct unit_render_ctx ctx;
-    unit_render_ctx_init(&ctx, *side_len_px, *nunits, posbuff, colorbuff);
+    R_GL_StatsPushPass(RENDER_STAT_PASS_MINIMAP);
+    unit_render_ctx_set_side_len(&s_ctx.units, *side_len_px);
 
     R_GL_StateSet(GL_U_MODEL, (struct uval){
         .type = UTYPE_MAT4,
         .val.as_mat4 = model
     });
     R_GL_Shader_Install("minimap-units");
-    glBindVertexArray(ctx.vao);
-    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, *nunits);
-
-    unit_render_ctx_destroy(&ctx);
+    glBindVertexArray(s_ctx.units.vao);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, s_ctx.units.nunits);
+    R_GL_StatsDraw(GL_TRIANGLE_FAN, 4, s_ctx.units.nunits);
+    R_GL_StatsPopPass();
 
+    GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
 
@@ -698,6 +771,9 @@ void R_GL_MinimapFree(void)
     R_GL_Texture_Free(NULL, "__minimap_water__");
     glDeleteVertexArrays(1, &s_ctx.minimap_mesh.VAO);
     glDeleteBuffers(1, &s_ctx.minimap_mesh.VBO);
+    glDeleteVertexArrays(1, &s_ctx.frustum_mesh.VAO);
+    glDeleteBuffers(1, &s_ctx.frustum_mesh.VBO);
+    unit_render_ctx_destroy(&s_ctx.units);
     memset(&s_ctx, 0, sizeof(s_ctx));
 }
 
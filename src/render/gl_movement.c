@@ -38,8 +38,10 @@
 #include "gl_perf.h"
 #include "gl_assert.h"
 #include "gl_shader.h"
+#include "gl_render.h"
 
 #define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define LOCAL_SIZE          (64)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -57,14 +59,19 @@ void R_GL_MoveUploadData(void *buff, size_t *nents, size_t *buffsize)
     GL_PERF_ENTER();
     assert(R_ComputeShaderSupported());
 
+    /* The previous data may not have been invalidated if the 
+     * commands for reading back the results got dropped. */
+    R_GL_MoveInvalidateData();
+
     glGenBuffers(1, &s_move_ssbo);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_move_ssbo);
     glBufferData(GL_SHADER_STORAGE_BUFFER, *buffsize, buff, GL_STREAM_DRAW);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    R_GL_StatsUpload(*buffsize);
 
     glGenBuffers(1, &s_vpref_ssbo);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_vpref_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, *nents * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, *nents * sizeof(vec2_t), NULL, GL_STREAM_READ);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
     GL_ASSERT_OK();
@@ -99,31 +106,35 @@ void R_GL_MoveDispatchWork(const size_t *nents)
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, s_vpref_ssbo);
 
     /* 3. kick off the compute work */
-    int max_size = 0, left = *nents;
+    int max_size = 0;
     glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_size);
 
-    while(left) {
-        const size_t dispatch_size = MIN(left, max_size);
-        glDispatchCompute(dispatch_size, 1, 1);
-        left -= dispatch_size;
-    }
+    const size_t ngroups = (*nents + LOCAL_SIZE - 1) / LOCAL_SIZE;
+    assert(ngroups <= max_size);
+    glDispatchCompute(ngroups, 1, 1);
 
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
 
-void R_GL_MoveReadNewVelocities(void *out, const size_t *nents, const size_t *maxout)
+void R_GL_MoveReadNewVelocities(void *out, const size_t *nents, const size_t *maxout,
+                                SDL_atomic_t *out_gen, const int *gen)
 {
     GL_PERF_ENTER();
 
+    if(s_vpref_ssbo == 0)
+        GL_PERF_RETURN_VOID();
+
     /* Make sure the shader has finished writing the output to the SSBO */
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_vpref_ssbo);
-    size_t read_size = MIN(*nents * sizeof(GLfloat), *maxout);
+    size_t read_size = MIN(*nents * sizeof(vec2_t), *maxout);
     glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, read_size, out);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+    SDL_AtomicSet(out_gen, *gen);
+
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
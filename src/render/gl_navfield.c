@@ -0,0 +1,121 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/render.h"
+#include "public/render_ctrl.h"
+#include "gl_perf.h"
+#include "gl_assert.h"
+#include "gl_shader.h"
+#include "gl_render.h"
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static GLuint s_job_ssbo;
+static GLuint s_dirs_ssbo;
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_NavFieldDispatch(void *jobs, const size_t *njobs, const size_t *jobsize, 
+                           const size_t *outsize)
+{
+    GL_PERF_ENTER();
+    assert(R_ComputeShaderSupported());
+
+    /* The previous buffers may not have been freed if the 
+     * commands for reading back the results got dropped. */
+    R_GL_NavFieldInvalidateData();
+
+    glGenBuffers(1, &s_job_ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_job_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, *njobs * *jobsize, jobs, GL_STREAM_DRAW);
+    R_GL_StatsUpload(*njobs * *jobsize);
+
+    glGenBuffers(1, &s_dirs_ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_dirs_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, *njobs * *outsize, NULL, GL_STREAM_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    R_GL_Shader_Install("nav_field");
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, s_job_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, s_dirs_ssbo);
+
+    /* Every chunk is handled by a single workgroup */
+    int max_size = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_size);
+    assert(*njobs <= max_size);
+    glDispatchCompute(*njobs, 1, 1);
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+void R_GL_NavFieldInvalidateData(void)
+{
+    glDeleteBuffers(1, &s_job_ssbo);
+    s_job_ssbo = 0;
+
+    glDeleteBuffers(1, &s_dirs_ssbo);
+    s_dirs_ssbo = 0;
+}
+
+void R_GL_NavFieldReadResults(void *out, const size_t *size, const size_t *maxout,
+                              SDL_atomic_t *out_gen, const int *gen)
+{
+    GL_PERF_ENTER();
+
+    if(s_dirs_ssbo == 0)
+        GL_PERF_RETURN_VOID();
+
+    /* Make sure the shader has finished writing the output to the SSBO */
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_dirs_ssbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, MIN(*size, *maxout), out);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    R_GL_NavFieldInvalidateData();
+    SDL_AtomicSet(out_gen, *gen);
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
@@ -0,0 +1,189 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/render.h"
+#include "gl_render.h"
+#include "gl_perf.h"
+#include "gl_assert.h"
+#include "../main.h"
+
+#include <GL/glew.h>
+#include <assert.h>
+
+
+#define ARR_SIZE(a)     (sizeof(a)/sizeof((a)[0]))
+#define CLAMP(a, min, max) ((a) < (min) ? (min) : ((a) > (max) ? (max) : (a)))
+
+/* Each readback gets its own pack buffer so that the one issued on the 
+ * previous frame can be resolved while a new one is in flight. */
+struct pick_buff{
+    GLuint   PBO;
+    GLsync   fence;
+    mat4x4_t inv_view_proj;
+    vec2_t   ndc_xy;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool             s_init = false;
+static int              s_head = 0;
+static struct pick_buff s_buffs[2];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void pick_init(void)
+{
+    for(int i = 0; i < ARR_SIZE(s_buffs); i++) {
+
+        glGenBuffers(1, &s_buffs[i].PBO);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s_buffs[i].PBO);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLfloat), NULL, GL_STREAM_READ);
+        s_buffs[i].fence = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    s_init = true;
+}
+
+static void pick_resolve(struct pick_buff *buff, struct pick_result *out)
+{
+    /* Don't stall the pipeline waiting on the readback - if it isn't 
+     * done yet, the result is simply dropped. */
+    GLenum status = glClientWaitSync(buff->fence, 0, 0);
+    glDeleteSync(buff->fence);
+    buff->fence = 0;
+
+    if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buff->PBO);
+    const GLfloat *depth = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(GLfloat), GL_MAP_READ_BIT);
+    if(!depth) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return;
+    }
+    GLfloat z = *depth;
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    vec4_t clip = (vec4_t){buff->ndc_xy.x, buff->ndc_xy.y, z * 2.0f - 1.0f, 1.0f};
+    vec4_t homo;
+    PFM_Mat4x4_Mult4x1(&buff->inv_view_proj, &clip, &homo);
+
+    SDL_AtomicAdd(&out->seq, 1);
+    /* Nothing was drawn under the pixel - the depth buffer still holds the 
+     * cleared value. */
+    out->hit = (z < 1.0f);
+    out->pos = (vec3_t){homo.x / homo.w, homo.y / homo.w, homo.z / homo.w};
+    SDL_AtomicAdd(&out->seq, 1);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_PickReadDepth(const int *x, const int *y, const mat4x4_t *inv_view_proj,
+                        struct pick_result *out)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_init) {
+        pick_init();
+    }
+
+    struct pick_buff *prev = &s_buffs[(s_head + 1) % ARR_SIZE(s_buffs)];
+    struct pick_buff *curr = &s_buffs[s_head];
+
+    if(prev->fence) {
+        pick_resolve(prev, out);
+    }
+
+    /* The buffer we are about to write has an unresolved readback that 
+     * is two frames old by now - discard it. */
+    if(curr->fence) {
+        glDeleteSync(curr->fence);
+        curr->fence = 0;
+    }
+
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if(viewport[2] <= 0 || viewport[3] <= 0)
+        GL_PERF_RETURN_VOID();
+
+    /* The scene may be drawn at a reduced resolution */
+    float scale = R_GL_DynresSceneScale();
+    int px = CLAMP((int)(*x * scale), 0, viewport[2] - 1);
+    int py = CLAMP(viewport[3] - 1 - (int)(*y * scale), 0, viewport[3] - 1);
+
+    curr->inv_view_proj = *inv_view_proj;
+    curr->ndc_xy = (vec2_t){
+        -1.0f + 2.0f * ((px + 0.5f) / viewport[2]),
+        -1.0f + 2.0f * ((py + 0.5f) / viewport[3])
+    };
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, curr->PBO);
+    glReadPixels(viewport[0] + px, viewport[1] + py, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    curr->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    s_head = (s_head + 1) % ARR_SIZE(s_buffs);
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+void R_GL_PickShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(!s_init)
+        return;
+
+    for(int i = 0; i < ARR_SIZE(s_buffs); i++) {
+
+        if(s_buffs[i].fence) {
+            glDeleteSync(s_buffs[i].fence);
+            s_buffs[i].fence = 0;
+        }
+        glDeleteBuffers(1, &s_buffs[i].PBO);
+    }
+    s_init = false;
+}
+
@@ -38,6 +38,7 @@
 #include "gl_assert.h"
 #include "gl_shader.h"
 #include "gl_texture.h"
+#include "gl_render.h"
 #include "gl_state.h"
 #include "../main.h"
 #include "../map/public/map.h"
@@ -70,6 +71,13 @@ void R_GL_PositionsUploadData(vec3_t *posbuff, uint32_t *idbuff,
     const size_t resx = MIN(res.chunk_w * res.tile_w * PIXELS_PER_TILE, MAX_TEX_RES);
     const size_t resy = MIN(res.chunk_h * res.tile_h * PIXELS_PER_TILE, MAX_TEX_RES);
 
+    /* The previous texture may not have been invalidated if the 
+     * commands for reading back the results got dropped. */
+    R_GL_PositionsInvalidateData();
+
+    GLint prev_fb;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fb);
+
     /* Create a framebuffer with a resolution based on the map size */
     GLuint fbo;
 
@@ -103,6 +111,7 @@ void R_GL_PositionsUploadData(vec3_t *posbuff, uint32_t *idbuff,
     glGenBuffers(1, &id_VBO);
     glBindBuffer(GL_ARRAY_BUFFER, id_VBO);
     glBufferData(GL_ARRAY_BUFFER, *nents * sizeof(uint32_t), idbuff, GL_STREAM_DRAW);
+    R_GL_StatsUpload(*nents * (sizeof(vec3_t) + sizeof(uint32_t)));
 
     glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
     glEnableVertexAttribArray(1);
@@ -136,6 +145,7 @@ void R_GL_PositionsUploadData(vec3_t *posbuff, uint32_t *idbuff,
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
     glDrawArrays(GL_POINTS, 0, *nents);
+    R_GL_StatsDraw(GL_POINTS, *nents, 1);
 
     glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
 
@@ -143,7 +153,7 @@ void R_GL_PositionsUploadData(vec3_t *posbuff, uint32_t *idbuff,
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);  
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fb);  
 
     glDeleteFramebuffers(1, &fbo);
     glDeleteVertexArrays(1, &VAO);
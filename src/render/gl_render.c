@@ -42,6 +42,7 @@
 #include "gl_assert.h"
 #include "gl_perf.h"
 #include "gl_state.h"
+#include "gl_ringbuffer.h"
 #include "public/render.h"
 #include "../entity.h"
 #include "../camera.h"
@@ -50,6 +51,7 @@
 #include "../anim/public/anim.h"
 #include "../map/public/map.h"
 #include "../lib/public/mem.h"
+#include "../lib/public/khash.h"
 #include "../ui.h"
 #include "../main.h"
 
@@ -66,14 +68,67 @@
 #define MAX(a, b)                   ((a) > (b) ? (a) : (b))
 #define MIN(a, b)                   ((a) < (b) ? (a) : (b))
 
+KHASH_MAP_INIT_INT64(mesh, struct mesh)
+
 /*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Maps the hash of a mesh's vertex data to the buffers it was uploaded to,
+ * so that identical meshes from different resources share the same buffers.
+ */
+static khash_t(mesh) *s_mesh_table;
+/* The terrain decals (selection circles, rectangles and lines) of 
+ * consecutive render commands, as a triangle list */
+static struct colored_vert *s_decal_verts;
+static size_t               s_decal_nverts;
+static size_t               s_decal_cap;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-void R_GL_Init(struct render_private *priv, const char *shader, const struct vertex *vbuff)
+static uint64_t gl_mesh_hash(const void *data, size_t size, uint64_t seed)
+{
+    /* 64-bit FNV-1a */
+    const unsigned char *bytes = data;
+    uint64_t ret = 14695981039346656037ull ^ seed;
+    for(size_t i = 0; i < size; i++) {
+        ret ^= bytes[i];
+        ret *= 1099511628211ull;
+    }
+    return ret;
+}
+
+static void decals_push_strip(const vec3_t *strip, size_t nverts, const vec3_t *color)
+{
+    if(nverts < 3)
+        return;
+
+    size_t nnew = (nverts - 2) * 3;
+    if(s_decal_nverts + nnew > s_decal_cap) {
+        size_t cap = MAX(s_decal_cap * 2, s_decal_nverts + nnew);
+        void *verts = realloc(s_decal_verts, cap * sizeof(struct colored_vert));
+        if(!verts)
+            return;
+        s_decal_verts = verts;
+        s_decal_cap = cap;
+    }
+
+    vec4_t color4 = (vec4_t){color->x, color->y, color->z, 1.0f};
+    for(size_t i = 0; i < nverts - 2; i++) {
+        /* Every other triangle of a strip has its' winding flipped */
+        size_t a = (i % 2) ? i + 1 : i;
+        size_t b = (i % 2) ? i : i + 1;
+        s_decal_verts[s_decal_nverts++] = (struct colored_vert){strip[a], color4};
+        s_decal_verts[s_decal_nverts++] = (struct colored_vert){strip[b], color4};
+        s_decal_verts[s_decal_nverts++] = (struct colored_vert){strip[i + 2], color4};
+    }
+}
+
+static void gl_mesh_create(struct render_private *priv, const char *shader, 
+                           const void *vbuff, const GLuint *ibuff)
 {
-    GL_PERF_ENTER();
-    ASSERT_IN_RENDER_THREAD();
     struct mesh *mesh = &priv->mesh;
 
     glGenVertexArrays(1, &mesh->VAO);
@@ -83,24 +138,54 @@ void R_GL_Init(struct render_private *priv, const char *shader, const struct ver
     glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
     glBufferData(GL_ARRAY_BUFFER, mesh->num_verts * priv->vertex_stride, vbuff, GL_STATIC_DRAW);
 
+    mesh->EBO = 0;
+    if(ibuff) {
+        /* The element array binding is part of the VAO state */
+        glGenBuffers(1, &mesh->EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->num_indices * sizeof(GLuint), ibuff, GL_STATIC_DRAW);
+        pf_mem_account(MEM_TAG_GL_MESH, mesh->num_indices * sizeof(GLuint));
+    }
+    pf_mem_account(MEM_TAG_GL_MESH, mesh->num_verts * priv->vertex_stride);
+
     /* Attribute 0 - position */
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, priv->vertex_stride, (void*)0);
     glEnableVertexAttribArray(0);
 
-    /* Attribute 1 - texture coordinates */
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, priv->vertex_stride, 
-        (void*)offsetof(struct vertex, uv));
-    glEnableVertexAttribArray(1);
+    if(strstr(shader, "terrain")) {
 
-    /* Attribute 2 - normal */
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, priv->vertex_stride, 
-        (void*)offsetof(struct vertex, normal));
-    glEnableVertexAttribArray(2);
+        /* Attribute 1 - texture coordinates */
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, priv->vertex_stride, 
+            (void*)offsetof(struct terrain_vert, uv));
+        glEnableVertexAttribArray(1);
 
-    /* Attribute 3 - material index */
-    glVertexAttribIPointer(3, 1, GL_INT, priv->vertex_stride, 
-        (void*)offsetof(struct vertex, material_idx));
-    glEnableVertexAttribArray(3);
+        /* Attribute 2 - normal */
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, priv->vertex_stride, 
+            (void*)offsetof(struct terrain_vert, normal));
+        glEnableVertexAttribArray(2);
+
+        /* Attribute 3 - material index */
+        glVertexAttribIPointer(3, 1, GL_INT, priv->vertex_stride, 
+            (void*)offsetof(struct terrain_vert, material_idx));
+        glEnableVertexAttribArray(3);
+
+    }else{
+
+        /* Attribute 1 - texture coordinates (half floats) */
+        glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, priv->vertex_stride, 
+            (void*)offsetof(struct packed_vert, uv));
+        glEnableVertexAttribArray(1);
+
+        /* Attribute 2 - normal (snorm 2_10_10_10, the 'w' component is unused) */
+        glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, priv->vertex_stride, 
+            (void*)offsetof(struct packed_vert, normal));
+        glEnableVertexAttribArray(2);
+
+        /* Attribute 3 - material index */
+        glVertexAttribIPointer(3, 1, GL_INT, priv->vertex_stride, 
+            (void*)offsetof(struct packed_vert, material_idx));
+        glEnableVertexAttribArray(3);
+    }
 
     if(strstr(shader, "animated")) {
 
@@ -109,18 +194,18 @@ void R_GL_Init(struct render_private *priv, const char *shader, const struct ver
 
         /* Attribute 4/5 - joint indices */
         glVertexAttribIPointer(4, 3, GL_UNSIGNED_BYTE, priv->vertex_stride,
-            (void*)offsetof(struct anim_vert, joint_indices));
+            (void*)offsetof(struct packed_anim_vert, joint_indices));
         glEnableVertexAttribArray(4);  
         glVertexAttribIPointer(5, 3, GL_UNSIGNED_BYTE, priv->vertex_stride,
-            (void*)(offsetof(struct anim_vert, joint_indices) + 3*sizeof(GLubyte)));
+            (void*)(offsetof(struct packed_anim_vert, joint_indices) + 3*sizeof(GLubyte)));
         glEnableVertexAttribArray(5);
 
-        /* Attribute 6/7 - joint weights */
-        glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, priv->vertex_stride,
-            (void*)offsetof(struct anim_vert, weights));
+        /* Attribute 6/7 - joint weights (unorm8) */
+        glVertexAttribPointer(6, 3, GL_UNSIGNED_BYTE, GL_TRUE, priv->vertex_stride,
+            (void*)offsetof(struct packed_anim_vert, weights));
         glEnableVertexAttribArray(6);  
-        glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, priv->vertex_stride,
-            (void*)(offsetof(struct anim_vert, weights) + 3*sizeof(GLfloat)));
+        glVertexAttribPointer(7, 3, GL_UNSIGNED_BYTE, GL_TRUE, priv->vertex_stride,
+            (void*)(offsetof(struct packed_anim_vert, weights) + 3*sizeof(GLubyte)));
         glEnableVertexAttribArray(7);  
 
     }else if(strstr(shader, "terrain")) {
@@ -156,6 +241,75 @@ void R_GL_Init(struct render_private *priv, const char *shader, const struct ver
         glEnableVertexAttribArray(9);
     }
 
+    glBindVertexArray(0);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_MeshInit(void)
+{
+    s_mesh_table = kh_init(mesh);
+    return (s_mesh_table != NULL);
+}
+
+void R_GL_MeshShutdown(void)
+{
+    uint64_t key;
+    struct mesh curr;
+    (void)key;
+
+    kh_foreach(s_mesh_table, key, curr, {
+        GLint size = 0;
+        glBindBuffer(GL_ARRAY_BUFFER, curr.VBO);
+        glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+        pf_mem_account(MEM_TAG_GL_MESH, -size);
+
+        glDeleteVertexArrays(1, &curr.VAO);
+        glDeleteBuffers(1, &curr.VBO);
+        if(curr.EBO) {
+            pf_mem_account(MEM_TAG_GL_MESH, -(ptrdiff_t)(curr.num_indices * sizeof(GLuint)));
+            glDeleteBuffers(1, &curr.EBO);
+        }
+    });
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    kh_destroy(mesh, s_mesh_table);
+}
+
+void R_GL_Init(struct render_private *priv, const char *shader, const void *vbuff, 
+               const GLuint *ibuff)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+
+    /* The terrain chunks are all unique, so don't bother looking them up */
+    if(strstr(shader, "terrain")) {
+        gl_mesh_create(priv, shader, vbuff, ibuff);
+    }else{
+
+        size_t size = priv->mesh.num_verts * priv->vertex_stride;
+        uint64_t key = gl_mesh_hash(vbuff, size, priv->vertex_stride);
+        if(ibuff) {
+            key = gl_mesh_hash(ibuff, priv->mesh.num_indices * sizeof(GLuint), key);
+        }
+
+        khiter_t k = kh_get(mesh, s_mesh_table, key);
+        if(k != kh_end(s_mesh_table) 
+        && kh_value(s_mesh_table, k).num_verts == priv->mesh.num_verts
+        && kh_value(s_mesh_table, k).num_indices == priv->mesh.num_indices) {
+            priv->mesh = kh_value(s_mesh_table, k);
+        }else{
+            gl_mesh_create(priv, shader, vbuff, ibuff);
+
+            int status;
+            k = kh_put(mesh, s_mesh_table, key, &status);
+            if(status > 0) {
+                kh_value(s_mesh_table, k) = priv->mesh;
+            }
+        }
+    }
+
     priv->shader_prog = R_GL_Shader_GetProgForName(shader);
 
     if(strstr(shader, "animated")) {
@@ -173,6 +327,20 @@ void R_GL_Init(struct render_private *priv, const char *shader, const struct ver
     GL_PERF_RETURN_VOID();
 }
 
+void R_GL_MeshDraw(const struct mesh *mesh)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    glBindVertexArray(mesh->VAO);
+    if(mesh->num_indices > 0) {
+        glDrawElements(GL_TRIANGLES, mesh->num_indices, GL_UNSIGNED_INT, (void*)0);
+        R_GL_StatsDraw(GL_TRIANGLES, mesh->num_indices, 1);
+    }else{
+        glDrawArrays(GL_TRIANGLES, 0, mesh->num_verts);
+        R_GL_StatsDraw(GL_TRIANGLES, mesh->num_verts, 1);
+    }
+}
+
 void R_GL_Draw(const void *render_private, mat4x4_t *model, const bool *translucent)
 {
     GL_PERF_ENTER();
@@ -203,8 +371,7 @@ void R_GL_Draw(const void *render_private, mat4x4_t *model, const bool *transluc
     }
     R_GL_ShadowMapBind();
     
-    glBindVertexArray(priv->mesh.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+    R_GL_MeshDraw(&priv->mesh);
 
     if(*translucent) {
         glDisable(GL_BLEND);
@@ -225,6 +392,8 @@ void R_GL_BeginFrame(void)
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
 
+    R_GL_RingbufferNewFrame();
+    R_GL_DynresBeginScene();
     GL_PERF_RETURN_VOID();
 }
 
@@ -320,6 +489,10 @@ void R_GL_SetScreenspaceDrawMode(void)
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
 
+    /* Screenspace elements are always drawn at the native resolution */
+    R_GL_DynresEndScene();
+    R_GL_StatsSetPass(RENDER_STAT_PASS_UI);
+
     int width, height;
     Engine_WinDrawableSize(&width, &height);
 
@@ -793,8 +966,7 @@ void R_GL_DrawNormals(const void *render_private, mat4x4_t *model, const bool *a
                                        : "mesh.static.normals.colored";
     R_GL_Shader_Install(normals_shader);
 
-    glBindVertexArray(priv->mesh.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+    R_GL_MeshDraw(&priv->mesh);
 
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
@@ -889,8 +1061,6 @@ void R_GL_DrawSelectionCircle(const vec2_t *xz, const float *radius, const float
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
 
-    GLuint VAO, VBO;
-
     const int NUM_SAMPLES = 48;
     const int nverts = NUM_SAMPLES * 2 + 2;
     STALLOC(vec3_t, vbuff, nverts);
@@ -914,43 +1084,9 @@ void R_GL_DrawSelectionCircle(const vec2_t *xz, const float *radius, const float
     vbuff[NUM_SAMPLES * 2]     = vbuff[0];
     vbuff[NUM_SAMPLES * 2 + 1] = vbuff[1];
 
-    mat4x4_t identity;
-    PFM_Mat4x4_Identity(&identity);
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    /* Set uniforms */
-    R_GL_StateSet(GL_U_MODEL, (struct uval){
-        .type = UTYPE_MAT4,
-        .val.as_mat4 = identity
-    });
-
-    vec4_t color4 = (vec4_t){color->x, color->y, color->z, 1.0f};
-    R_GL_StateSet(GL_U_COLOR, (struct uval){
-        .type = UTYPE_VEC4,
-        .val.as_vec4 = color4
-    });
-
-    R_GL_Shader_Install("mesh.static.colored");
-
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, nverts * sizeof(vec3_t), vbuff, GL_STREAM_DRAW);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, nverts);
-
-    /* cleanup */
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    decals_push_strip(vbuff, nverts, color);
 
     STFREE(vbuff);
-    GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
 
@@ -960,7 +1096,6 @@ void R_GL_DrawSelectionRectangle(const struct obb *box, const float *width,
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
 
-    GLuint VAO, VBO;
     const float PAD = 1.0f;
 
     vec2_t corners[4] = {
@@ -1027,43 +1162,9 @@ void R_GL_DrawSelectionRectangle(const struct obb *box, const float *width,
     vbuff[nsamples * 2 + 0] = vbuff[0];
     vbuff[nsamples * 2 + 1] = vbuff[1];
 
-    mat4x4_t identity;
-    PFM_Mat4x4_Identity(&identity);
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    /* Set uniforms */
-    R_GL_StateSet(GL_U_MODEL, (struct uval){
-        .type = UTYPE_MAT4,
-        .val.as_mat4 = identity
-    });
-
-    vec4_t color4 = (vec4_t){color->x, color->y, color->z, 1.0f};
-    R_GL_StateSet(GL_U_COLOR, (struct uval){
-        .type = UTYPE_VEC4,
-        .val.as_vec4 = color4
-    });
-
-    R_GL_Shader_Install("mesh.static.colored");
-
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, nverts * sizeof(vec3_t), vbuff, GL_STREAM_DRAW);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, nverts);
-
-    /* cleanup */
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    decals_push_strip(vbuff, nverts, color);
 
     STFREE(vbuff);
-    GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
 
@@ -1111,70 +1212,96 @@ void R_GL_DrawLine(vec2_t endpoints[], const float *width, const vec3_t *color,
         t += (1.0f / NUM_SAMPLES) * len;
     }
 
+    decals_push_strip(vbuff, nverts, color);
+
+    STFREE(vbuff);
+    GL_PERF_RETURN_VOID();
+}
+
+void R_GL_DrawQuad(vec2_t corners[], const float *width, const vec3_t *color, const struct map *map)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+
+    vec2_t lines[][2] = {
+        corners[0], corners[1],
+        corners[1], corners[2],
+        corners[2], corners[3],
+        corners[3], corners[0],
+    };
+
+    for(int i = 0; i < ARR_SIZE(lines); i++)
+        R_GL_DrawLine(lines[i], width, color, map);
+
+    GL_PERF_RETURN_VOID();
+}
+
+bool R_GL_DecalCmd(const void *func)
+{
+    return (func == (void*)R_GL_DrawSelectionCircle)
+        || (func == (void*)R_GL_DrawSelectionRectangle)
+        || (func == (void*)R_GL_DrawLine)
+        || (func == (void*)R_GL_DrawQuad);
+}
+
+void R_GL_DecalsFlush(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    if(s_decal_nverts == 0)
+        return;
+
+    GL_PERF_ENTER();
+    GLuint VAO, VBO;
+
     mat4x4_t identity;
     PFM_Mat4x4_Identity(&identity);
 
     /* OpenGL setup */
-    GLuint VAO, VBO;
-
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
 
     glGenBuffers(1, &VBO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
+        (void*)offsetof(struct colored_vert, pos));
     glEnableVertexAttribArray(0);  
 
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
+        (void*)offsetof(struct colored_vert, color));
+    glEnableVertexAttribArray(1);  
+
     /* Set uniforms */
     R_GL_StateSet(GL_U_MODEL, (struct uval){
         .type = UTYPE_MAT4,
         .val.as_mat4 = identity
     });
 
-    vec4_t color4 = (vec4_t){color->x, color->y, color->z, 1.0f};
-    R_GL_StateSet(GL_U_COLOR, (struct uval){
-        .type = UTYPE_VEC4,
-        .val.as_vec4 = color4
-    });
-
-    R_GL_Shader_Install("mesh.static.colored");
-
-    float old_width;
-    glGetFloatv(GL_LINE_WIDTH, &old_width);
-    glLineWidth(*width);
+    R_GL_Shader_Install("mesh.static.colored-per-vert");
 
     /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, nverts * sizeof(vec3_t), vbuff, GL_STREAM_DRAW);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, nverts);
-
-    glLineWidth(old_width);
+    size_t size = s_decal_nverts * sizeof(struct colored_vert);
+    glBufferData(GL_ARRAY_BUFFER, size, s_decal_verts, GL_STREAM_DRAW);
+    R_GL_StatsUpload(size);
+    glDrawArrays(GL_TRIANGLES, 0, s_decal_nverts);
+    R_GL_StatsDraw(GL_TRIANGLES, s_decal_nverts, 1);
 
     /* cleanup */
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
 
-    STFREE(vbuff);
+    s_decal_nverts = 0;
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
 
-void R_GL_DrawQuad(vec2_t corners[], const float *width, const vec3_t *color, const struct map *map)
+void R_GL_DecalsShutdown(void)
 {
-    GL_PERF_ENTER();
-    ASSERT_IN_RENDER_THREAD();
-
-    vec2_t lines[][2] = {
-        corners[0], corners[1],
-        corners[1], corners[2],
-        corners[2], corners[3],
-        corners[3], corners[0],
-    };
-
-    for(int i = 0; i < ARR_SIZE(lines); i++)
-        R_GL_DrawLine(lines[i], width, color, map);
-
-    GL_PERF_RETURN_VOID();
+    free(s_decal_verts);
+    s_decal_verts = NULL;
+    s_decal_nverts = 0;
+    s_decal_cap = 0;
 }
 
 void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, const size_t *count, 
@@ -37,6 +37,7 @@
 #define GL_RENDER_H
 
 #include "public/render.h"
+#include "public/render_ctrl.h"
 #include "../map/public/tile.h"
 #include "../pf_math.h"
 
@@ -49,14 +50,23 @@
 #define SHADOW_MAP_TUNIT (GL_TEXTURE16)
 
 struct render_private;
+struct mesh;
 struct vertex;
 struct tile;
 struct tile_desc;
 struct map;
+struct ent_stat_rstate;
 
 /* General */
 
-void   R_GL_Init(struct render_private *priv, const char *shader, const struct vertex *vbuff);
+bool   R_GL_MeshInit(void);
+void   R_GL_MeshShutdown(void);
+/* Meshes with identical vertex and index data are uploaded once and share their 
+ * buffers. 'ibuff' holds 'priv->mesh.num_indices' indices and may be NULL for 
+ * non-indexed meshes. */
+void   R_GL_Init(struct render_private *priv, const char *shader, const void *vbuff, 
+                 const GLuint *ibuff);
+void   R_GL_MeshDraw(const struct mesh *mesh);
 void   R_GL_GlobalConfig(void);
 void   R_GL_SetViewport(int *x, int *y, int *w, int *h);
 
@@ -66,14 +76,83 @@ void   R_GL_InitShadows(void);
 vec3_t R_GL_GetLightPos(void);
 void   R_GL_SetLightSpaceTrans(const mat4x4_t *trans);
 void   R_GL_ShadowMapBind(void);
+/* Flush the recorded static shadow casters, together with the entities in 'ents'. 
+ * Returns true if the static casters are being redrawn, in which case the caller 
+ * must draw 'ents' before the call to 'R_GL_DepthPassDynamic'. */
+bool   R_GL_DepthPassStatic(const struct ent_stat_rstate *ents, size_t nents);
+void   R_GL_ShadowsInvalidateStatic(void);
 
 /* Water */
 
 void   R_GL_SetClipPlane(vec4_t plane_eq);
+/* The size of the offscreen water buffers, as a fraction of the viewport */
+void   R_GL_WaterSetResolutionScale(const float *scale);
+/* Re-render the water reflection only once every 'interval' frames */
+void   R_GL_WaterSetReflectInterval(const int *interval);
+
+/* Statusbars */
+bool   R_GL_StatusbarInit(void);
+void   R_GL_StatusbarShutdown(void);
+
+/* Picking */
+void   R_GL_PickShutdown(void);
+
+/* Dynamic resolution */
+
+/* When enabled, the 3D scene is drawn to an offscreen target at a fraction 
+ * of the viewport resolution, which is adjusted to keep the GPU time of the 
+ * scene under the target. The target is upscaled to the default framebuffer 
+ * once the scene is done, before any screenspace drawing. */
+void   R_GL_DynresBeginScene(void);
+void   R_GL_DynresEndScene(void);
+/* The fraction of the native resolution the scene is currently drawn at */
+float  R_GL_DynresSceneScale(void);
+void   R_GL_DynresSetEnabled(const bool *enabled);
+void   R_GL_DynresSetTarget(const float *ms);
+void   R_GL_DynresShutdown(void);
+
+/* Statistics */
+
+/* The counters are only touched by the render thread. Each frame's counters 
+ * are published when the render thread is done processing its' commands. 
+ * Everything drawn is attributed to the current pass - the base pass is set 
+ * per-frame, while the offscreen passes nest over it. */
+void   R_GL_StatsBeginFrame(void);
+void   R_GL_StatsEndFrame(size_t ncmds, size_t arg_bytes);
+void   R_GL_StatsSetPass(enum render_stat_pass pass);
+void   R_GL_StatsPushPass(enum render_stat_pass pass);
+void   R_GL_StatsPopPass(void);
+void   R_GL_StatsDraw(GLenum mode, size_t count, size_t ninstances);
+/* The primitives of one command of an indirect draw. The API call itself 
+ * is accounted for with a separate R_GL_StatsDraw with a zero count. */
+void   R_GL_StatsIndirect(GLenum mode, size_t count, size_t ninstances);
+void   R_GL_StatsProgBind(void);
+void   R_GL_StatsTexBind(void);
+void   R_GL_StatsUpload(size_t bytes);
+/* Bracket the GPU work of one of the timed passes. These are no-ops 
+ * unless the timers are enabled. A pass nested in itself is only timed 
+ * at the outermost level. */
+void   R_GL_StatsGPUBegin(enum render_gpu_pass pass);
+void   R_GL_StatsGPUEnd(enum render_gpu_pass pass);
+void   R_GL_StatsShutdown(void);
+
+/* Terrain decals */
+
+/* The selection circles, rectangles and lines drawn over the terrain are 
+ * gathered up and drawn with a single call. The batch is flushed before any 
+ * other render command is executed, so the drawing order is unchanged. */
+bool   R_GL_DecalCmd(const void *func);
+void   R_GL_DecalsFlush(void);
+void   R_GL_DecalsShutdown(void);
 
 /* Terrain */
 void   R_GL_MapFogBindLast(GLuint tunit, GLuint shader_prog, const char *uname);
 void   R_GL_MapUpdateFogClear(void);
+/* Chunks further than 'dist' from the camera are drawn from their baked page. 
+ * A distance of 0 disables the baked pages. */
+void   R_GL_MapSetBakeDistance(const float *dist);
+/* Must be called when the vertices of any of the chunk's tiles change */
+void   R_GL_MapInvalidateBake(int chunk_r, int chunk_c);
 
 
 #endif
@@ -38,7 +38,11 @@
 #include "gl_perf.h"
 #include "gl_shader.h"
 #include "gl_state.h"
+#include "gl_render.h"
 #include "../lib/public/pf_string.h"
+#include "../lib/public/mem.h"
+
+#include <SDL.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +51,13 @@
 /* How many discrete sets of data (guarded by fences) the buffer can hold */
 #define NMAXMARKERS     (256)
 #define TIMEOUT_NSEC    (((uint64_t)10) * 1000 * 1000 * 1000)
+/* How many times its' initial size a growable ring is allowed to become */
+#define MAX_GROWTH      (4)
+/* How many writes are timed in each mode before an adaptive ring settles on one */
+#define NPROBE_WRITES   (128)
+
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
 
 /* On some hardware persistent mapped buffers are faster. However, they
  * are not part of OpenGL 3.3 core which we are targeting. So, fallback 
@@ -54,6 +65,7 @@
 enum mode{
     MODE_UNSYNCHRONIZED_VBO,
     MODE_PERSISTENT_MAPPED_BUFFER,
+    NUM_MODES
 };
 
 struct marker{
@@ -70,9 +82,14 @@ struct buffer_ops{
 struct gl_ring{
     enum mode         mode;
     struct buffer_ops ops;
+    enum ring_format  fmt;
+    int               flags;
     void             *user;
     size_t            pos;
     size_t            size;
+    size_t            max_size;
+    /* Incremented every time the ring moves to a new buffer object */
+    unsigned          generation;
     /* The buffer object backing the ringbuffer */
     GLuint            VBO;
     /* The texture buffer object associated with the VBO - 
@@ -85,22 +102,77 @@ struct gl_ring{
     size_t            nmarkers;
     size_t            imark_head, imark_tail;
     struct marker     markers[NMAXMARKERS];
+    /* Adaptive rings time the writes in each of the modes and then 
+     * switch to the one with the higher throughput */
+    bool              probing;
+    int               probe_left;
+    enum mode         next_mode;
+    uint64_t          probe_ticks[NUM_MODES];
+    uint64_t          probe_bytes[NUM_MODES];
+    /* Telemetry */
+    uint64_t          stall_ticks;
+    size_t            frame_bytes;
+    struct ring_stats stats;
+    struct gl_ring   *next;
 };
 
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* All live rings, for the per-frame accounting */
+static struct gl_ring *s_rings = NULL;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static bool ring_wait_one(struct gl_ring *ring)
+static size_t ring_marker_len(const struct gl_ring *ring, struct marker m)
+{
+    if(m.end > m.begin)
+        return m.end - m.begin;
+    return ring->size - m.begin + m.end;
+}
+
+static size_t ring_used(const struct gl_ring *ring)
+{
+    if(ring->nmarkers == 0)
+        return 0;
+
+    return ring_marker_len(ring, (struct marker){
+        ring->markers[ring->imark_tail].begin,
+        ring->markers[ring->imark_head].end
+    });
+}
+
+/* Release the oldest section once the GPU is done with it. Unless 'block' 
+ * is set, a section that is still in use is left alone. Returns true if 
+ * a section was released. */
+static bool ring_retire_one(struct gl_ring *ring, bool block)
 {
     GL_PERF_ENTER();
-    assert(ring->fences[ring->imark_tail] > 0);
 
     if(ring->nmarkers == 0)
         GL_PERF_RETURN(false);
 
-    GLenum result = glClientWaitSync(ring->fences[ring->imark_tail], 0, TIMEOUT_NSEC);
-    glDeleteSync(ring->fences[ring->imark_tail]);
+    /* The section is still being filled */
+    GLsync fence = ring->fences[ring->imark_tail];
+    if(!fence)
+        GL_PERF_RETURN(false);
+
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if(result == GL_TIMEOUT_EXPIRED) {
+
+        if(!block)
+            GL_PERF_RETURN(false);
+
+        uint64_t begin = SDL_GetPerformanceCounter();
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, TIMEOUT_NSEC);
+        ring->stall_ticks += SDL_GetPerformanceCounter() - begin;
+        ring->stats.nstalls++;
+    }
+
+    glDeleteSync(fence);
     ring->fences[ring->imark_tail] = 0;
     ring->imark_tail = (ring->imark_tail + 1) % NMAXMARKERS;
     ring->nmarkers--;
@@ -174,148 +246,401 @@ static void unsynch_vbo_unmap(struct gl_ring *ring)
     glBindBuffer(GL_TEXTURE_BUFFER, 0);
 }
 
-/*****************************************************************************/
-/* STATIC VARIABLES                                                          */
-/*****************************************************************************/
-
-struct gl_ring *R_GL_RingbufferInit(size_t size, enum ring_format fmt)
+static void ring_set_mode(struct gl_ring *ring, enum mode mode)
 {
-    struct gl_ring *ret = malloc(sizeof(struct gl_ring));
-    if(!ret)
-        return NULL;
-
-    glGenBuffers(1, &ret->VBO);
-    glGenTextures(1, &ret->tex_buff);
-
-    ret->pos = 0;
-    ret->size = size;
-    ret->imark_head = 0;
-    ret->imark_tail = 0;
-    ret->nmarkers = 0;
-    memset(&ret->fences, 0, sizeof(ret->fences));
-    memset(&ret->markers, 0, sizeof(ret->fences));
-
-    if(GLEW_ARB_buffer_storage) {
-        ret->mode = MODE_PERSISTENT_MAPPED_BUFFER;
-        ret->ops = (struct buffer_ops){
-            pmb_init,
-            pmb_map,
-            pmb_unmap
-        };
-    }else{
-        ret->mode = MODE_UNSYNCHRONIZED_VBO;
-        ret->ops = (struct buffer_ops){
+    static const struct buffer_ops s_ops[NUM_MODES] = {
+        [MODE_UNSYNCHRONIZED_VBO] = {
             unsynch_vbo_init,
             unsynch_vbo_map,
             unsynch_vbo_unmap
-        };
+        },
+        [MODE_PERSISTENT_MAPPED_BUFFER] = {
+            pmb_init,
+            pmb_map,
+            pmb_unmap
+        },
+    };
+    ring->mode = mode;
+    ring->ops = s_ops[mode];
+}
+
+static void ring_attach_tex(struct gl_ring *ring)
+{
+    /* Don't disturb the buffer texture bound to the active unit */
+    GLint old;
+    glGetIntegerv(GL_TEXTURE_BINDING_BUFFER, &old);
+
+    glBindTexture(GL_TEXTURE_BUFFER, ring->tex_buff);
+    if(ring->fmt == RING_UBYTE) {
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R8UI, ring->VBO);
+    }else if(ring->fmt == RING_FLOAT) {
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, ring->VBO);
     }
-    ret->ops.init(ret);
+    glBindTexture(GL_TEXTURE_BUFFER, old);
+}
+
+static size_t ring_max_size(size_t size, enum ring_format fmt, int flags)
+{
+    if(!(flags & RING_GROWABLE))
+        return size;
+
+    GLint max_texels;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    size_t texel_sz = (fmt == RING_FLOAT) ? sizeof(GLfloat) : sizeof(GLubyte);
 
-    glBindTexture(GL_TEXTURE_BUFFER, ret->tex_buff);
-    if(fmt == RING_UBYTE) {
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_R8UI, ret->VBO);
-    }else if(fmt == RING_FLOAT) {
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, ret->VBO);
+    return MAX(size, MIN(size * MAX_GROWTH, (size_t)max_texels * texel_sz));
+}
+
+/* Move the ring to a new buffer object of the specified size and mode. The 
+ * sections that were already handed off to the GPU are left in the old buffer, 
+ * which stays alive for as long as there are commands referencing it. The 
+ * section that is still being filled is carried over to the new buffer. */
+static void ring_realloc(struct gl_ring *ring, size_t size, enum mode mode)
+{
+    GL_PERF_ENTER();
+
+    GLuint old_vbo = ring->VBO;
+    bool carry = (ring->nmarkers > 0) && (ring->fences[ring->imark_head] == 0);
+    struct marker head = ring->markers[ring->imark_head];
+    size_t old_size = ring->size;
+    size_t carry_size = carry ? ring_marker_len(ring, head) : 0;
+    assert(carry_size < size);
+
+    for(int i = 0; i < NMAXMARKERS; i++) {
+        if(ring->fences[i])
+            glDeleteSync(ring->fences[i]);
+        ring->fences[i] = 0;
     }
-    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    glGenBuffers(1, &ring->VBO);
+    ring->size = size;
+    ring->pos = 0;
+    ring->nmarkers = 0;
+    ring->imark_head = 0;
+    ring->imark_tail = 0;
+    ring_set_mode(ring, mode);
+    ring->ops.init(ring);
+
+    if(carry) {
+
+        glBindBuffer(GL_COPY_READ_BUFFER, old_vbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ring->VBO);
+
+        if(head.end > head.begin) {
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 
+                head.begin, 0, carry_size);
+        }else{
+            size_t left = old_size - head.begin;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 
+                head.begin, 0, left);
+            if(head.end > 0) {
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 
+                    0, left, head.end);
+            }
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        ring->pos = carry_size;
+        ring->markers[0] = (struct marker){0, carry_size};
+        ring->nmarkers = 1;
+    }
+
+    glDeleteBuffers(1, &old_vbo);
+    pf_mem_account(MEM_TAG_GL_RING, (ptrdiff_t)size - (ptrdiff_t)old_size);
+    ring_attach_tex(ring);
+    ring->generation++;
 
     GL_ASSERT_OK();
-    return ret;
+    GL_PERF_RETURN_VOID();
 }
 
-void R_GL_RingbufferDestroy(struct gl_ring *ring)
+/* Chain to a buffer large enough to hold 'size' more bytes instead of 
+ * waiting for the GPU to release the sections of the current one. */
+static bool ring_grow(struct gl_ring *ring, size_t size)
 {
-    while(ring->nmarkers) {
-        ring_wait_one(ring);
+    if(!(ring->flags & RING_GROWABLE))
+        return false;
+
+    bool carry = (ring->nmarkers > 0) && (ring->fences[ring->imark_head] == 0);
+    size_t carry_size = carry ? ring_marker_len(ring, ring->markers[ring->imark_head]) : 0;
+
+    size_t new_size = ring->size * 2;
+    while(new_size <= carry_size + size) {
+        new_size *= 2;
     }
-    glDeleteBuffers(1, &ring->VBO);
-    glDeleteTextures(1, &ring->tex_buff);
-    free(ring);
+    if(new_size > ring->max_size)
+        return false;
+
+    ring_realloc(ring, new_size, ring->next_mode);
+    ring->stats.ngrows++;
+    return true;
 }
 
-bool R_GL_RingbufferPush(struct gl_ring *ring, const void *data, size_t size)
+/* Make room for the next 'size' bytes, preferring to grow the ring 
+ * over blocking on the GPU. */
+static bool ring_reserve(struct gl_ring *ring, size_t size)
 {
-    if(size > ring->size) {
-        return false;
+    if(ring->next_mode != ring->mode) {
+        ring_realloc(ring, ring->size, ring->next_mode);
     }
 
+    while(!ring_section_free(ring, size) && ring_retire_one(ring, false))
+        ;
+
+    if(ring_section_free(ring, size))
+        return true;
+
+    if(ring_grow(ring, size))
+        return true;
+
     while(!ring_section_free(ring, size)) {
-        if(!ring_wait_one(ring))
+        if(!ring_retire_one(ring, true))
             return false;
     }
+    return true;
+}
 
+static void ring_probe(struct gl_ring *ring, uint64_t ticks, size_t size)
+{
+    if(!ring->probing)
+        return;
+
+    ring->probe_ticks[ring->mode] += ticks;
+    ring->probe_bytes[ring->mode] += size;
+    if(--ring->probe_left > 0)
+        return;
+
+    enum mode other = (ring->mode == MODE_PERSISTENT_MAPPED_BUFFER) 
+                    ? MODE_UNSYNCHRONIZED_VBO 
+                    : MODE_PERSISTENT_MAPPED_BUFFER;
+
+    if(ring->probe_bytes[other] == 0) {
+        ring->next_mode = other;
+        ring->probe_left = NPROBE_WRITES;
+        return;
+    }
+
+    double pmb = (double)ring->probe_ticks[MODE_PERSISTENT_MAPPED_BUFFER] 
+               / MAX(ring->probe_bytes[MODE_PERSISTENT_MAPPED_BUFFER], 1);
+    double vbo = (double)ring->probe_ticks[MODE_UNSYNCHRONIZED_VBO] 
+               / MAX(ring->probe_bytes[MODE_UNSYNCHRONIZED_VBO], 1);
+
+    ring->next_mode = (pmb <= vbo) ? MODE_PERSISTENT_MAPPED_BUFFER : MODE_UNSYNCHRONIZED_VBO;
+    ring->probing = false;
+}
+
+static void ring_write(struct gl_ring *ring, size_t offset, const void *data, size_t size)
+{
+    uint64_t begin = SDL_GetPerformanceCounter();
+    void *ptr = ring->ops.map(ring, offset, size);
+    memcpy(ptr, data, size);
+    ring->ops.unmap(ring);
+    ring_probe(ring, SDL_GetPerformanceCounter() - begin, size);
+}
+
+/* Write the data at the current position, wrapping around the end of the buffer */
+static void ring_write_wrapped(struct gl_ring *ring, const void *data, size_t size)
+{
     size_t left = ring->size - ring->pos;
-    size_t old_pos = ring->pos;
 
     if(size <= left) {
-        void *ptr = ring->ops.map(ring, ring->pos, size);
-        memcpy(ptr, data, size);
+        ring_write(ring, ring->pos, data, size);
         ring->pos = (ring->pos + size) % ring->size;
     }else{
         size_t start = size - left;
         if(left > 0) {
-            void *ptr = ring->ops.map(ring, ring->pos, left);
-            memcpy(ptr, data, left);
-            ring->ops.unmap(ring);
+            ring_write(ring, ring->pos, data, left);
         }
 
         /* wrap around */
-        void *ptr = ring->ops.map(ring, 0, start);
-        memcpy(ptr, ((char*)data) + left, start);
+        ring_write(ring, 0, ((const char*)data) + left, start);
         ring->pos = start;
     }
+}
 
-    ring->ops.unmap(ring);
+static void ring_push_marker(struct gl_ring *ring, size_t begin, size_t end)
+{
     ring->imark_head = (ring->imark_head + 1) % NMAXMARKERS;
-    ring->markers[ring->imark_head] = (struct marker){old_pos, ring->pos};
+    ring->markers[ring->imark_head] = (struct marker){begin, end};
 
     if(!ring->nmarkers)
         ring->imark_tail = ring->imark_head;
 
     ring->nmarkers++;
+}
+
+static void ring_account(struct gl_ring *ring, size_t size)
+{
+    R_GL_StatsUpload(size);
+    ring->frame_bytes += size;
+    ring->stats.high_water = MAX(ring->stats.high_water, ring_used(ring));
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+struct gl_ring *R_GL_RingbufferInit(size_t size, enum ring_format fmt, int flags)
+{
+    struct gl_ring *ret = malloc(sizeof(struct gl_ring));
+    if(!ret)
+        return NULL;
+
+    memset(ret, 0, sizeof(struct gl_ring));
+    glGenBuffers(1, &ret->VBO);
+    glGenTextures(1, &ret->tex_buff);
+
+    ret->fmt = fmt;
+    ret->flags = flags;
+    ret->size = size;
+    ret->max_size = ring_max_size(size, fmt, flags);
+
+    enum mode mode = GLEW_ARB_buffer_storage ? MODE_PERSISTENT_MAPPED_BUFFER 
+                                             : MODE_UNSYNCHRONIZED_VBO;
+    ring_set_mode(ret, mode);
+    ret->next_mode = mode;
+    ret->probing = GLEW_ARB_buffer_storage && (flags & RING_ADAPTIVE);
+    ret->probe_left = NPROBE_WRITES;
+
+    ret->ops.init(ret);
+    ring_attach_tex(ret);
+    pf_mem_account(MEM_TAG_GL_RING, size);
+
+    ret->next = s_rings;
+    s_rings = ret;
 
     GL_ASSERT_OK();
-    return true;
+    return ret;
 }
 
-bool R_GL_RingbufferAppendLast(struct gl_ring *ring, const void *data, size_t size)
+void R_GL_RingbufferDestroy(struct gl_ring *ring)
 {
-    assert(ring->nmarkers);
-    assert(ring->fences[ring->imark_head] == 0);
+    while(ring->nmarkers) {
+        ring_retire_one(ring, true);
+    }
 
-    if(size > ring->size) {
+    struct gl_ring **curr = &s_rings;
+    while(*curr != ring) {
+        curr = &(*curr)->next;
+    }
+    *curr = ring->next;
+
+    glDeleteBuffers(1, &ring->VBO);
+    glDeleteTextures(1, &ring->tex_buff);
+    pf_mem_account(MEM_TAG_GL_RING, -(ptrdiff_t)ring->size);
+    free(ring);
+}
+
+bool R_GL_RingbufferPush(struct gl_ring *ring, const void *data, size_t size)
+{
+    if(size > ring->size && !ring_grow(ring, size)) {
         return false;
     }
 
-    while(!ring_section_free(ring, size)) {
-        if(!ring_wait_one(ring))
-            return false;
+    if(!ring_reserve(ring, size))
+        return false;
+
+    size_t old_pos = ring->pos;
+    ring_write_wrapped(ring, data, size);
+    ring_push_marker(ring, old_pos, ring->pos);
+    ring_account(ring, size);
+
+    GL_ASSERT_OK();
+    return true;
+}
+
+bool R_GL_RingbufferPushRanges(struct gl_ring *ring, const void *data, size_t size,
+                               const struct ring_range *ranges, size_t nranges)
+{
+    /* Moving to a new buffer would lose the earlier contents */
+    assert(!(ring->flags & (RING_GROWABLE | RING_ADAPTIVE)));
+
+    /* The section must be contiguous for the partial writes to line 
+     * up with the earlier contents */
+    if(ring->pos + size > ring->size) {
+        return R_GL_RingbufferPush(ring, data, size);
     }
 
-    size_t left = ring->size - ring->pos;
+    if(!ring_reserve(ring, size))
+        return false;
+
     size_t old_pos = ring->pos;
+    size_t written = 0;
+    uint64_t begin = SDL_GetPerformanceCounter();
+
+    unsigned char *ptr = ring->ops.map(ring, ring->pos, size);
+    for(int i = 0; i < nranges; i++) {
+        assert(ranges[i].begin <= ranges[i].end && ranges[i].end <= size);
+        memcpy(ptr + ranges[i].begin, ((const unsigned char*)data) + ranges[i].begin,
+            ranges[i].end - ranges[i].begin);
+        written += ranges[i].end - ranges[i].begin;
+    }
+    ring->ops.unmap(ring);
+    ring_probe(ring, SDL_GetPerformanceCounter() - begin, written);
 
-    if(size <= left) {
-        void *ptr = ring->ops.map(ring, ring->pos, size);
-        memcpy(ptr, data, size);
-        ring->pos = (ring->pos + size) % ring->size;
-    }else{
-        size_t start = size - left;
-        if(left > 0) {
-            void *ptr = ring->ops.map(ring, ring->pos, left);
-            memcpy(ptr, data, left);
-            ring->ops.unmap(ring);
+    ring->pos = (ring->pos + size) % ring->size;
+    ring_push_marker(ring, old_pos, ring->pos);
+    ring_account(ring, size);
+
+    GL_ASSERT_OK();
+    return true;
+}
+
+bool R_GL_RingbufferPushContiguous(struct gl_ring *ring, const void *data, size_t size, 
+                                   size_t align)
+{
+    assert(align > 0);
+    if(size > ring->size && !ring_grow(ring, size)) {
+        return false;
+    }
+
+    size_t begin, needed;
+    unsigned generation;
+
+    /* Moving to a new buffer changes the position the section is placed at */
+    do{
+        generation = ring->generation;
+        begin = ((ring->pos + align - 1) / align) * align;
+
+        if(begin + size <= ring->size) {
+            needed = (begin - ring->pos) + size;
+        }else{
+            /* The tail of the buffer is wasted */
+            needed = (ring->size - ring->pos) + size;
+            begin = 0;
         }
 
-        /* wrap around */
-        void *ptr = ring->ops.map(ring, 0, start);
-        memcpy(ptr, ((char*)data) + left, start);
-        ring->pos = start;
+        if(!ring_reserve(ring, needed))
+            return false;
+
+    }while(generation != ring->generation);
+
+    ring_write(ring, begin, data, size);
+    ring->pos = (begin + size) % ring->size;
+    ring_push_marker(ring, begin, begin + size);
+    ring_account(ring, needed);
+
+    GL_ASSERT_OK();
+    return true;
+}
+
+bool R_GL_RingbufferAppendLast(struct gl_ring *ring, const void *data, size_t size)
+{
+    assert(ring->nmarkers);
+    assert(ring->fences[ring->imark_head] == 0);
+
+    if(size > ring->size && !ring_grow(ring, size)) {
+        return false;
     }
 
-    ring->ops.unmap(ring);
+    if(!ring_reserve(ring, size))
+        return false;
+
+    ring_write_wrapped(ring, data, size);
     ring->markers[ring->imark_head].end = ring->pos;
+    ring_account(ring, size);
 
     GL_ASSERT_OK();
     return true;
@@ -326,17 +651,14 @@ bool R_GL_RingbufferExtendLast(struct gl_ring *ring, size_t size)
     assert(ring->nmarkers);
     assert(ring->fences[ring->imark_head] == 0);
 
-    if(size > ring->size) {
+    if(size > ring->size && !ring_grow(ring, size)) {
         return false;
     }
 
-    while(!ring_section_free(ring, size)) {
-        if(!ring_wait_one(ring))
-            return false;
-    }
+    if(!ring_reserve(ring, size))
+        return false;
 
     size_t left = ring->size - ring->pos;
-    size_t old_pos = ring->pos;
 
     if(size <= left) {
         ring->pos = (ring->pos + size) % ring->size;
@@ -346,6 +668,7 @@ bool R_GL_RingbufferExtendLast(struct gl_ring *ring, size_t size)
     }
 
     ring->markers[ring->imark_head].end = ring->pos;
+    ring_account(ring, size);
     return true;
 }
 
@@ -370,6 +693,7 @@ void R_GL_RingbufferBindLast(struct gl_ring *ring, GLuint tunit, GLuint shader_p
 
     glActiveTexture(tunit);
     glBindTexture(GL_TEXTURE_BUFFER, ring->tex_buff);
+    R_GL_StatsTexBind();
     R_GL_Shader_InstallProg(shader_prog);
 
     R_GL_StateSet(uname, (struct uval){
@@ -397,3 +721,26 @@ GLuint R_GL_RingbufferGetVBO(struct gl_ring *ring)
     return ring->VBO;
 }
 
+
+size_t R_GL_RingbufferGetSize(const struct gl_ring *ring)
+{
+    return ring->size;
+}
+
+void R_GL_RingbufferGetStats(const struct gl_ring *ring, struct ring_stats *out)
+{
+    *out = ring->stats;
+    out->size = ring->size;
+    out->persistent = (ring->mode == MODE_PERSISTENT_MAPPED_BUFFER);
+    out->stall_ms = ring->stall_ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void R_GL_RingbufferNewFrame(void)
+{
+    for(struct gl_ring *curr = s_rings; curr; curr = curr->next) {
+        curr->stats.last_frame_bytes = curr->frame_bytes;
+        curr->stats.max_frame_bytes = MAX(curr->stats.max_frame_bytes, curr->frame_bytes);
+        curr->frame_bytes = 0;
+    }
+}
+
@@ -53,6 +53,11 @@
  * another with the next frame's data, all without implicit synchronization
  * and minimal state changes.
  *
+ * Rings created with RING_GROWABLE move their contents to a larger buffer 
+ * object instead of blocking on the GPU when they run out of room, so the 
+ * buffer object returned by R_GL_RingbufferGetVBO and the size of the ring 
+ * may change on any push.
+ *
  * Usage: 
  *
  *   ring = R_GL_RingbufferInit(...);
@@ -71,15 +76,62 @@ enum ring_format{
     RING_FLOAT
 };
 
-struct gl_ring *R_GL_RingbufferInit(size_t size, enum ring_format fmt);
+enum ring_flags{
+    /* Grow the ring (up to a limit) rather than waiting on the GPU */
+    RING_GROWABLE = (1 << 0),
+    /* Time the writes through both the persistently mapped and the 
+     * unsynchronized buffer paths and settle on the faster one */
+    RING_ADAPTIVE = (1 << 1),
+};
+
+struct ring_stats{
+    size_t   size;
+    bool     persistent;
+    /* Number of times (and total milliseconds) the CPU blocked on the GPU */
+    unsigned nstalls;
+    double   stall_ms;
+    unsigned ngrows;
+    /* Bytes consumed during the last frame and the most during any frame */
+    size_t   last_frame_bytes;
+    size_t   max_frame_bytes;
+    /* The most bytes that were in flight at once */
+    size_t   high_water;
+};
+
+/* A range of bytes [begin, end) */
+struct ring_range{
+    size_t begin;
+    size_t end;
+};
+
+struct gl_ring *R_GL_RingbufferInit(size_t size, enum ring_format fmt, int flags);
 void            R_GL_RingbufferDestroy(struct gl_ring *ring);
 bool            R_GL_RingbufferPush(struct gl_ring *ring, const void *data, size_t size);
+/* Like R_GL_RingbufferPush, but only the specified ranges of 'data' are written 
+ * to the new section. The rest of the section keeps the contents that were pushed 
+ * to the same part of the buffer earlier. Useful when the same amount of data is 
+ * pushed every frame, so that the sections always land in the same places.
+ * Not supported on growable or adaptive rings.
+ */
+bool            R_GL_RingbufferPushRanges(struct gl_ring *ring, const void *data, size_t size,
+                                          const struct ring_range *ranges, size_t nranges);
+/* Like R_GL_RingbufferPush, but the section is guaranteed not to wrap around and 
+ * to begin on a multiple of 'align' bytes. This allows the section to be sourced 
+ * directly as vertex attributes or indices. Space at the end of the buffer that 
+ * is too small to hold the section is skipped.
+ */
+bool            R_GL_RingbufferPushContiguous(struct gl_ring *ring, const void *data, size_t size, 
+                                              size_t align);
 bool            R_GL_RingbufferAppendLast(struct gl_ring *ring, const void *data, size_t size);
 bool            R_GL_RingbufferExtendLast(struct gl_ring *ring, size_t size);
 bool            R_GL_RingbufferGetLastRange(struct gl_ring *ring, size_t *out_begin, size_t *out_end);
 void            R_GL_RingbufferBindLast(struct gl_ring *ring, GLuint tunit, GLuint shader_prog, const char *uname);
 void            R_GL_RingbufferSyncLast(struct gl_ring *ring);
 GLuint          R_GL_RingbufferGetVBO(struct gl_ring *ring);
+size_t          R_GL_RingbufferGetSize(const struct gl_ring *ring);
+void            R_GL_RingbufferGetStats(const struct gl_ring *ring, struct ring_stats *out);
+/* Called once at the start of every frame to roll over the per-frame stats */
+void            R_GL_RingbufferNewFrame(void);
 
 #endif
 
@@ -37,8 +37,10 @@
 #include "gl_shader.h"
 #include "gl_assert.h"
 #include "gl_state.h"
+#include "gl_render.h"
 #include "gl_material.h"
 #include "../main.h"
+#include "../config.h"
 #include "../lib/public/pf_string.h"
 
 #include <SDL.h>
@@ -51,6 +53,10 @@
 #define SHADER_PATH_LEN 128
 #define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
 
+#define CACHE_MAGIC     (0x43534650) /* 'PFSC' */
+#define CACHE_VERSION   (1)
+#define CACHE_MAX_BIN   (16 * 1024 * 1024)
+
 struct uniform{
     int           type;
     const char   *name;
@@ -66,6 +72,17 @@ struct shader{
     struct uniform *uniforms;
 };
 
+/* A linked program binary as returned by the driver. It is only valid
+ * for the driver that produced it and for the exact shader sources it
+ * was built from, both of which are captured in hashes.
+ */
+struct binary{
+    uint32_t        src_hash;
+    GLenum          format;
+    GLsizei         size;
+    void           *data;
+};
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
@@ -83,8 +100,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/colored.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
             { UTYPE_VEC4,      GL_U_COLOR,            },
             {0}
         },
@@ -98,10 +113,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/textured.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             {0}
         },
@@ -115,13 +126,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/textured-phong.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_VEC3,      GL_U_AMBIENT_COLOR     },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_COMPOSITE, GL_U_MATERIALS,        },
             {0}
@@ -136,8 +140,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/tile-outline.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
             { UTYPE_VEC4,      GL_U_COLOR,            },
             {0},
         },
@@ -151,16 +153,9 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/textured-phong.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
             { UTYPE_ARRAY,     GL_U_CURR_POSE_MATS    },
             { UTYPE_ARRAY,     GL_U_INV_BIND_MATS     },
             { UTYPE_MAT4,      GL_U_NORMAL_MAT        },
-            { UTYPE_VEC3,      GL_U_AMBIENT_COLOR     },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_COMPOSITE, GL_U_MATERIALS,        },
             {0}
@@ -175,9 +170,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/colored.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
             { UTYPE_VEC4,      GL_U_COLOR,            },
             {0}
         },
@@ -191,9 +183,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/colored.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
             { UTYPE_ARRAY,     GL_U_CURR_POSE_MATS    },
             { UTYPE_ARRAY,     GL_U_INV_BIND_MATS     },
             { UTYPE_MAT4,      GL_U_NORMAL_MAT        },
@@ -210,8 +199,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/colored-per-vert.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
             {0}
         },
     },
@@ -224,13 +211,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/terrain.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_VEC3,      GL_U_AMBIENT_COLOR     },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_INT,       "visbuff",             },
             { UTYPE_INT,       "visbuff_offset",      },
@@ -248,14 +228,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/terrain-shadowed.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
-            { UTYPE_VEC3,      GL_U_AMBIENT_COLOR     },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_INT,       "visbuff",             },
             { UTYPE_INT,       "visbuff_offset",      },
@@ -265,6 +237,56 @@ static struct shader s_shaders[] = {
             {0}
         },
     },
+    {
+        .prog_id        = (intptr_t)NULL,
+        .name           = "terrain-bake",
+        .vertex_path    = "shaders/vertex/terrain-bake.glsl",
+        .geo_path       = NULL,
+        .compute_path   = NULL,
+        .frag_path      = "shaders/fragment/terrain-bake.glsl",
+        .uniforms       = (struct uniform[]){
+            { UTYPE_INT,       GL_U_TEX_ARRAY0        },
+            { UTYPE_IVEC4,     GL_U_MAP_RES,          },
+            {0}
+        },
+    },
+    {
+        .prog_id        = (intptr_t)NULL,
+        .name           = "terrain-baked",
+        .vertex_path    = "shaders/vertex/terrain.glsl",
+        .geo_path       = NULL,
+        .compute_path   = NULL,
+        .frag_path      = "shaders/fragment/terrain-baked.glsl",
+        .uniforms       = (struct uniform[]){
+            { UTYPE_MAT4,      GL_U_MODEL             },
+            { UTYPE_INT,       GL_U_TEX_ARRAY0        },
+            { UTYPE_INT,       GL_U_TEX_ARRAY2        },
+            { UTYPE_INT,       "visbuff",             },
+            { UTYPE_INT,       "visbuff_offset",      },
+            { UTYPE_IVEC4,     GL_U_MAP_RES,          },
+            { UTYPE_VEC2,      GL_U_MAP_POS,          },
+            {0}
+        },
+    },
+    {
+        .prog_id        = (intptr_t)NULL,
+        .name           = "terrain-baked-shadowed",
+        .vertex_path    = "shaders/vertex/terrain-shadowed.glsl",
+        .geo_path       = NULL,
+        .compute_path   = NULL,
+        .frag_path      = "shaders/fragment/terrain-baked-shadowed.glsl",
+        .uniforms       = (struct uniform[]){
+            { UTYPE_MAT4,      GL_U_MODEL             },
+            { UTYPE_INT,       GL_U_TEX_ARRAY0        },
+            { UTYPE_INT,       GL_U_TEX_ARRAY2        },
+            { UTYPE_INT,       "visbuff",             },
+            { UTYPE_INT,       "visbuff_offset",      },
+            { UTYPE_IVEC4,     GL_U_MAP_RES,          },
+            { UTYPE_VEC2,      GL_U_MAP_POS,          },
+            { UTYPE_INT,       GL_U_SHADOW_MAP        },
+            {0}
+        },
+    },
     {
         .prog_id        = (intptr_t)NULL,
         .name           = "mesh.static.depth",
@@ -274,8 +296,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/passthrough.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
             {0}
         },
     },
@@ -287,10 +307,6 @@ static struct shader s_shaders[] = {
         .compute_path   = NULL,
         .frag_path      = "shaders/fragment/passthrough.glsl",
         .uniforms       = (struct uniform[]){
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_INT,       GL_U_TEX_ARRAY1        },
             { UTYPE_INT,       GL_U_TEX_ARRAY2        },
@@ -311,8 +327,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/passthrough.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
             { UTYPE_ARRAY,     GL_U_CURR_POSE_MATS    },
             { UTYPE_ARRAY,     GL_U_INV_BIND_MATS     },
             {0}
@@ -326,10 +340,6 @@ static struct shader s_shaders[] = {
         .compute_path   = NULL,
         .frag_path      = "shaders/fragment/passthrough.glsl",
         .uniforms       = (struct uniform[]){
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_INT,       GL_U_TEX_ARRAY1        },
             { UTYPE_INT,       GL_U_TEX_ARRAY2        },
@@ -350,14 +360,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/textured-phong-shadowed.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC3,      GL_U_AMBIENT_COLOR     },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
             { UTYPE_COMPOSITE, GL_U_MATERIALS,        },
             { UTYPE_INT,       GL_U_SHADOW_MAP        },
             {0}
@@ -371,14 +373,6 @@ static struct shader s_shaders[] = {
         .compute_path   = NULL,
         .frag_path      = "shaders/fragment/textured-phong-shadowed-batched.glsl",
         .uniforms       = (struct uniform[]){
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_VEC3,      GL_U_AMBIENT_COLOR     },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_SHADOW_MAP        },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_INT,       GL_U_TEX_ARRAY1        },
@@ -400,17 +394,9 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/textured-phong-shadowed.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
             { UTYPE_ARRAY,     GL_U_CURR_POSE_MATS    },
             { UTYPE_ARRAY,     GL_U_INV_BIND_MATS     },
             { UTYPE_MAT4,      GL_U_NORMAL_MAT        },
-            { UTYPE_VEC3,      GL_U_AMBIENT_COLOR     },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_COMPOSITE, GL_U_MATERIALS,        },
             { UTYPE_INT,       GL_U_SHADOW_MAP        },
@@ -425,14 +411,6 @@ static struct shader s_shaders[] = {
         .compute_path   = NULL,
         .frag_path      = "shaders/fragment/textured-phong-shadowed-batched.glsl",
         .uniforms       = (struct uniform[]){
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_MAT4,      GL_U_LS_TRANS          },
-            { UTYPE_VEC3,      GL_U_AMBIENT_COLOR     },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_TEX_ARRAY0        },
             { UTYPE_INT,       GL_U_TEX_ARRAY1        },
             { UTYPE_INT,       GL_U_TEX_ARRAY2        },
@@ -453,11 +431,7 @@ static struct shader s_shaders[] = {
         .compute_path   = NULL,
         .frag_path      = "shaders/fragment/statusbar.glsl",
         .uniforms       = (struct uniform[]){
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
             { UTYPE_IVEC2,     GL_U_CURR_RES          },
-            { UTYPE_ARRAY,     GL_U_ENT_TOP_OFFSETS_SS},
-            { UTYPE_ARRAY,     GL_U_ENT_HEALTH_PC     },
             {0}
         },
     },
@@ -470,10 +444,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/water.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_IVEC2,     GL_U_WATER_TILING      },
             { UTYPE_INT,       GL_U_DUDV_MAP          },
             { UTYPE_INT,       GL_U_NORMAL_MAP        },
@@ -482,7 +452,6 @@ static struct shader s_shaders[] = {
             { UTYPE_FLOAT,     GL_U_MOVE_FACTOR       },
             { UTYPE_FLOAT,     GL_U_CAM_NEAR          },
             { UTYPE_FLOAT,     GL_U_CAM_FAR           },
-            { UTYPE_VEC3,      GL_U_LIGHT_COLOR       },
             { UTYPE_INT,       "visbuff"              },
             { UTYPE_INT,       "visbuff_offset"       },
             { UTYPE_IVEC4,     GL_U_MAP_RES,          },
@@ -498,7 +467,6 @@ static struct shader s_shaders[] = {
         .compute_path   = NULL,
         .frag_path      = "shaders/fragment/ui.glsl",
         .uniforms       = (struct uniform[]){
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
             { UTYPE_INT,       GL_U_TEXTURE0          },
             {0}
         },
@@ -512,11 +480,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/minimap.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
-            { UTYPE_VEC4,      GL_U_CLIP_PLANE0       },
-            { UTYPE_VEC3,      GL_U_LIGHT_POS         },
-            { UTYPE_VEC3,      GL_U_VIEW_POS          },
             { UTYPE_INT,       GL_U_TEXTURE0          },
             { UTYPE_INT,       "visbuff"              },
             { UTYPE_INT,       "visbuff_offset"       },
@@ -534,8 +497,6 @@ static struct shader s_shaders[] = {
         .frag_path      = "shaders/fragment/colored-per-vert.glsl",
         .uniforms       = (struct uniform[]){
             { UTYPE_MAT4,      GL_U_MODEL             },
-            { UTYPE_MAT4,      GL_U_VIEW              },
-            { UTYPE_MAT4,      GL_U_PROJECTION        },
             {0}
         },
     },
@@ -559,12 +520,30 @@ static struct shader s_shaders[] = {
         .geo_path       = NULL,
         .compute_path   = "shaders/compute/movement.glsl",
         .frag_path      = NULL,
+        .uniforms       = (struct uniform[]){
+            { UTYPE_IVEC4,     GL_U_MAP_RES,          },
+            { UTYPE_VEC2,      GL_U_MAP_POS           },
+            {0}
+        },
+    },
+    {
+        .prog_id        = (intptr_t)NULL,
+        .name           = "nav_field",
+        .vertex_path    = NULL,
+        .geo_path       = NULL,
+        .compute_path   = "shaders/compute/nav_field.glsl",
+        .frag_path      = NULL,
         .uniforms       = (struct uniform[]){
             {0}
         },
     },
 };
 
+/* Indexed in parallel with 's_shaders' */
+static struct binary s_binaries[ARR_SIZE(s_shaders)];
+static bool          s_binaries_dirty = false;
+static uint32_t      s_driver_hash;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -656,7 +635,8 @@ fail:
 }
 
 static bool shader_make_prog(const GLuint vertex_shader, const GLuint geo_shader, 
-                             const GLuint compute_shader, const GLuint frag_shader, GLint *out)
+                             const GLuint compute_shader, const GLuint frag_shader, 
+                             bool retrievable, GLint *out)
 {
     ASSERT_IN_RENDER_THREAD();
 
@@ -676,6 +656,9 @@ static bool shader_make_prog(const GLuint vertex_shader, const GLuint geo_shader
     if(frag_shader) {
         glAttachShader(*out, frag_shader);
     }
+    if(retrievable) {
+        glProgramParameteri(*out, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(*out);
 
     glGetProgramiv(*out, GL_LINK_STATUS, &success);
@@ -690,6 +673,255 @@ static bool shader_make_prog(const GLuint vertex_shader, const GLuint geo_shader
     return true;
 }
 
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t size)
+{
+    /* 32-bit FNV-1a */
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool binary_cache_supported(void)
+{
+    if(!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+        return false;
+
+    GLint nformats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nformats);
+    return (nformats > 0);
+}
+
+static uint32_t binary_driver_hash(void)
+{
+    const GLenum strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    uint32_t ret = 2166136261u;
+
+    for(int i = 0; i < ARR_SIZE(strings); i++) {
+        const char *str = (const char*)glGetString(strings[i]);
+        if(str) {
+            ret = hash_bytes(ret, str, strlen(str) + 1);
+        }
+    }
+    return ret;
+}
+
+static bool shader_source_hash(const char *base_path, const struct shader *shader, uint32_t *out)
+{
+    const char *paths[] = {
+        shader->vertex_path,
+        shader->geo_path,
+        shader->frag_path,
+        shader->compute_path
+    };
+    uint32_t ret = 2166136261u;
+
+    for(int i = 0; i < ARR_SIZE(paths); i++) {
+
+        /* Fold in the stage index so that moving a file between stages changes the hash */
+        ret = hash_bytes(ret, &i, sizeof(i));
+        if(!paths[i])
+            continue;
+
+        char path[512];
+        pf_snprintf(path, sizeof(path), "%s/%s", base_path, paths[i]);
+        const char *text = shader_text_load(path);
+        if(!text)
+            return false;
+
+        ret = hash_bytes(ret, text, strlen(text));
+        free((char*)text);
+    }
+    *out = ret;
+    return true;
+}
+
+static void binary_clear(struct binary *bin)
+{
+    free(bin->data);
+    memset(bin, 0, sizeof(*bin));
+}
+
+static void binary_cache_load(const char *base_path)
+{
+    char path[512];
+    pf_snprintf(path, sizeof(path), "%s/%s", base_path, CONFIG_SHADER_CACHE_FILENAME);
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        return;
+
+    if(SDL_ReadLE32(stream) != CACHE_MAGIC
+    || SDL_ReadLE32(stream) != CACHE_VERSION
+    || SDL_ReadLE32(stream) != s_driver_hash) {
+        /* Stale or foreign cache; it will be overwritten once the 
+         * programs have been rebuilt from source. */
+        s_binaries_dirty = true;
+        goto out;
+    }
+
+    uint32_t nentries = SDL_ReadLE32(stream);
+    for(uint32_t i = 0; i < nentries; i++) {
+
+        char name[64];
+        uint32_t namelen = SDL_ReadLE32(stream);
+        if(namelen == 0 || namelen >= sizeof(name))
+            goto fail;
+        if(SDL_RWread(stream, name, namelen, 1) != 1)
+            goto fail;
+        name[namelen] = '\0';
+
+        struct binary bin = {0};
+        bin.src_hash = SDL_ReadLE32(stream);
+        bin.format = SDL_ReadLE32(stream);
+        bin.size = SDL_ReadLE32(stream);
+
+        if(bin.size <= 0 || bin.size > CACHE_MAX_BIN)
+            goto fail;
+        if(!(bin.data = malloc(bin.size)))
+            goto fail;
+        if(SDL_RWread(stream, bin.data, bin.size, 1) != 1) {
+            free(bin.data);
+            goto fail;
+        }
+
+        int idx = -1;
+        for(int j = 0; j < ARR_SIZE(s_shaders); j++) {
+            if(!strcmp(s_shaders[j].name, name)) {
+                idx = j;
+                break;
+            }
+        }
+
+        if(idx < 0) {
+            free(bin.data);
+            s_binaries_dirty = true;
+            continue;
+        }
+        binary_clear(&s_binaries[idx]);
+        s_binaries[idx] = bin;
+    }
+
+out:
+    SDL_RWclose(stream);
+    return;
+
+fail:
+    PRINT("Shader program cache is corrupt. Recompiling shaders from source.\n");
+    for(int i = 0; i < ARR_SIZE(s_binaries); i++) {
+        binary_clear(&s_binaries[i]);
+    }
+    s_binaries_dirty = true;
+    SDL_RWclose(stream);
+}
+
+static void binary_cache_save(const char *base_path)
+{
+    char path[512];
+    pf_snprintf(path, sizeof(path), "%s/%s", base_path, CONFIG_SHADER_CACHE_FILENAME);
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "wb");
+    if(!stream) {
+        char buff[512];
+        pf_snprintf(buff, sizeof(buff), "Could not write shader program cache: %s\n", path);
+        PRINT(buff);
+        return;
+    }
+
+    uint32_t nentries = 0;
+    for(int i = 0; i < ARR_SIZE(s_binaries); i++) {
+        if(s_binaries[i].data)
+            nentries++;
+    }
+
+    bool ok = true;
+    ok = ok && SDL_WriteLE32(stream, CACHE_MAGIC);
+    ok = ok && SDL_WriteLE32(stream, CACHE_VERSION);
+    ok = ok && SDL_WriteLE32(stream, s_driver_hash);
+    ok = ok && SDL_WriteLE32(stream, nentries);
+
+    for(int i = 0; ok && i < ARR_SIZE(s_binaries); i++) {
+
+        const struct binary *bin = &s_binaries[i];
+        if(!bin->data)
+            continue;
+
+        size_t namelen = strlen(s_shaders[i].name);
+        ok = ok && SDL_WriteLE32(stream, namelen);
+        ok = ok && (SDL_RWwrite(stream, s_shaders[i].name, namelen, 1) == 1);
+        ok = ok && SDL_WriteLE32(stream, bin->src_hash);
+        ok = ok && SDL_WriteLE32(stream, bin->format);
+        ok = ok && SDL_WriteLE32(stream, bin->size);
+        ok = ok && (SDL_RWwrite(stream, bin->data, bin->size, 1) == 1);
+    }
+    SDL_RWclose(stream);
+
+    if(!ok) {
+        /* Don't leave a truncated file behind */
+        remove(path);
+        return;
+    }
+    s_binaries_dirty = false;
+}
+
+static bool shader_load_binary(int idx, uint32_t src_hash, GLint *out)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    const struct binary *bin = &s_binaries[idx];
+    if(!bin->data || bin->src_hash != src_hash)
+        return false;
+
+    GLint success;
+    GLuint prog = glCreateProgram();
+    glProgramBinary(prog, bin->format, bin->data, bin->size);
+    glGetProgramiv(prog, GL_LINK_STATUS, &success);
+
+    if(!success) {
+        /* The driver is free to reject binaries at any time (e.g. after 
+         * an update that didn't change the version string). */
+        glDeleteProgram(prog);
+        return false;
+    }
+
+    *out = prog;
+    return true;
+}
+
+static void shader_store_binary(int idx, uint32_t src_hash, GLint prog)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    GLint size = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+    if(size <= 0 || size > CACHE_MAX_BIN)
+        return;
+
+    void *data = malloc(size);
+    if(!data)
+        return;
+
+    GLenum format;
+    GLsizei written = 0;
+    glGetProgramBinary(prog, size, &written, &format, data);
+    if(written <= 0) {
+        free(data);
+        return;
+    }
+
+    struct binary *bin = &s_binaries[idx];
+    binary_clear(bin);
+    *bin = (struct binary){
+        .src_hash = src_hash,
+        .format = format,
+        .size = written,
+        .data = data
+    };
+    s_binaries_dirty = true;
+}
+
 static const struct shader *shader_for_name(const char *name)
 {
     ASSERT_IN_RENDER_THREAD();
@@ -723,6 +955,7 @@ static void shader_install(const struct shader *shader)
     if(s_curr_prog != shader->prog_id) {
         glUseProgram(shader->prog_id);
         s_curr_prog = shader->prog_id;
+        R_GL_StatsProgBind();
     }
 
     while(curr->name) {
@@ -740,12 +973,32 @@ bool R_GL_Shader_InitAll(const char *base_path)
 {
     ASSERT_IN_RENDER_THREAD();
 
+    const bool cache = binary_cache_supported();
+    if(cache) {
+        s_driver_hash = binary_driver_hash();
+        binary_cache_load(base_path);
+    }
+
     for(int i = 0; i < ARR_SIZE(s_shaders); i++){
 
         char path[512];
         struct shader *res = &s_shaders[i];
         GLuint vertex = 0, geometry = 0, fragment = 0, compute = 0;
 
+        if(res->compute_path && !R_ComputeShaderSupported()) {
+            char buff[512];
+            pf_snprintf(buff, sizeof(buff), "No compute shader support on the current platform. "
+                "Skipping shader '%s'.\n", res->name);
+            PRINT(buff);
+            continue;
+        }
+
+        uint32_t src_hash = 0;
+        bool hashed = cache && shader_source_hash(base_path, res, &src_hash);
+
+        if(hashed && shader_load_binary(i, src_hash, &res->prog_id))
+            goto bind;
+
         if(res->vertex_path) {
             pf_snprintf(path, sizeof(path), "%s/%s", base_path, res->vertex_path);
             if(!shader_load_and_init(path, &vertex, GL_VERTEX_SHADER)) {
@@ -775,14 +1028,6 @@ bool R_GL_Shader_InitAll(const char *base_path)
 
         if(res->compute_path) {
 
-            if(!R_ComputeShaderSupported()) {
-                char buff[512];
-                pf_snprintf(buff, sizeof(buff), "No compute shader support on the current platform. "
-                    "Skipping shader '%s'.\n", res->name);
-                PRINT(buff);
-                continue;
-            }
-
             pf_snprintf(path, sizeof(path), "%s/%s", base_path, res->compute_path);
             if(!shader_load_and_init(path, &compute, GL_COMPUTE_SHADER)) {
                 PRINT("Failed to load and init compute shader.\n");
@@ -791,7 +1036,7 @@ bool R_GL_Shader_InitAll(const char *base_path)
         }
         assert(!res->compute_path || compute > 0);
 
-        if(!shader_make_prog(vertex, geometry, compute, fragment, &res->prog_id)) {
+        if(!shader_make_prog(vertex, geometry, compute, fragment, hashed, &res->prog_id)) {
             char buff[512];
             pf_snprintf(buff, sizeof(buff), "Failed to make shader program %d of %d.\n",
                 i + 1, (int)ARR_SIZE(s_shaders));
@@ -799,10 +1044,20 @@ bool R_GL_Shader_InitAll(const char *base_path)
             goto fail;
         }
 
+        if(hashed) {
+            shader_store_binary(i, src_hash, res->prog_id);
+        }
+
         if(vertex)      glDeleteShader(vertex);
         if(geometry)    glDeleteShader(geometry);
         if(fragment)    glDeleteShader(fragment);
         if(compute)     glDeleteShader(compute);
+
+    bind:;
+        GLuint block = glGetUniformBlockIndex(res->prog_id, GL_GLOBALS_BLOCK);
+        if(block != GL_INVALID_INDEX) {
+            glUniformBlockBinding(res->prog_id, block, GL_GLOBALS_BINDING);
+        }
         continue;
 
     fail:
@@ -810,9 +1065,18 @@ bool R_GL_Shader_InitAll(const char *base_path)
         if(geometry)    glDeleteShader(geometry);
         if(fragment)    glDeleteShader(fragment);
         if(compute)     glDeleteShader(compute);
+        for(int j = 0; j < ARR_SIZE(s_binaries); j++) {
+            binary_clear(&s_binaries[j]);
+        }
         return false;
     }
 
+    if(cache && s_binaries_dirty) {
+        binary_cache_save(base_path);
+    }
+    for(int i = 0; i < ARR_SIZE(s_binaries); i++) {
+        binary_clear(&s_binaries[i]);
+    }
     return true;
 }
 
@@ -47,19 +47,34 @@
 #include "../camera.h"
 #include "../phys/public/collision.h"
 #include "../game/public/game.h"
+#include "../entity.h"
+#include "../lib/public/vec.h"
 
 #include <GL/glew.h>
 #include <assert.h>
+#include <string.h>
 
 
 #define LIGHT_EXTRA_HEIGHT    (300.0f)
 #define LIGHT_VISIBILITY_ZOOM (75.0f)
+/* The shadow map's origin moves in steps of this many OpenGL units, so that the 
+ * cached static casters stay valid while the camera pans within a step. 
+ */
+#define SHADOW_CACHE_SNAP     (16.0f)
 
 struct shadow_gl_state{
     GLint viewport[4];
     GLint fb;
 };
 
+struct static_draw{
+    const void *render_private;
+    mat4x4_t    model;
+};
+
+VEC_TYPE(sdraw, struct static_draw)
+VEC_IMPL(static inline, sdraw, struct static_draw)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
@@ -69,15 +84,94 @@ static GLuint         s_depth_map_tex;
 static bool           s_depth_pass_active = false;
 static struct shadow_gl_state s_saved;
 
+/* The terrain and the static entities are rendered to a separate depth map, 
+ * which is only redrawn when the set of static casters or the light's view 
+ * changes. Every frame, it is copied to the shadow map before the dynamic 
+ * casters are drawn on top of it. Until the static casters are flushed,
+ * calls to 'R_GL_RenderDepthMap' are only recorded, so that they can be 
+ * compared against the cached ones.
+ */
+static GLuint         s_static_FBO;
+static GLuint         s_static_tex;
+static bool           s_static_valid = false;
+static uint64_t       s_static_key;
+static bool           s_static_recording = false;
+static uint64_t       s_frame_key;
+static vec_sdraw_t    s_static_draws;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static uint64_t shadow_hash(const void *data, size_t size, uint64_t hash)
+{
+    /* FNV-1a */
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* The keys of the individual casters are summed, so that the combined key 
+ * does not depend on the order in which they are drawn. */
+static uint64_t shadow_caster_key(const void *render_private, const mat4x4_t *model)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = shadow_hash(&render_private, sizeof(render_private), hash);
+    hash = shadow_hash(model, sizeof(*model), hash);
+    return hash;
+}
+
+static void shadow_draw(const void *render_private, const mat4x4_t *model)
+{
+    R_GL_StateSet(GL_U_MODEL, (struct uval){
+        .type = UTYPE_MAT4,
+        .val.as_mat4 = *model
+    });
+
+    const struct render_private *priv = render_private;
+    R_GL_Shader_InstallProg(priv->shader_prog_dp);
+
+    R_GL_MeshDraw(&priv->mesh);
+}
+
+static void make_depth_target(GLuint *out_tex, GLuint *out_fbo)
+{
+    glGenTextures(1, out_tex);
+    glBindTexture(GL_TEXTURE_2D, *out_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, 
+                 CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_MAP_RES, 
+                 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    /* Don't enable deptph comparisons as we will use a sampler2D and 
+     * manually perform comparison and filtering in the shader.
+     */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(1, out_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, *out_fbo);
+
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, *out_tex, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);  
+}
+
 static void make_light_frustum(vec3_t light_pos, vec3_t cam_pos, vec3_t cam_dir, 
                                struct frustum *out, mat4x4_t *out_view_mat)
 {
     float t = cam_pos.y / cam_dir.y;
-    vec3_t cam_ray_ground_isec = (vec3_t){cam_pos.x - t * cam_dir.x, 0.0f, cam_pos.z - t * cam_dir.z};
+    vec3_t cam_ray_ground_isec = (vec3_t){
+        roundf((cam_pos.x - t * cam_dir.x) / SHADOW_CACHE_SNAP) * SHADOW_CACHE_SNAP, 
+        0.0f, 
+        roundf((cam_pos.z - t * cam_dir.z) / SHADOW_CACHE_SNAP) * SHADOW_CACHE_SNAP
+    };
 
     vec3_t light_dir = light_pos;
     PFM_Vec3_Normal(&light_dir, &light_dir);
@@ -119,28 +213,71 @@ void R_GL_InitShadows(void)
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
 
-    glGenTextures(1, &s_depth_map_tex);
-    glBindTexture(GL_TEXTURE_2D, s_depth_map_tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, 
-                 CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_MAP_RES, 
-                 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    /* Don't enable deptph comparisons as we will use a sampler2D and 
-     * manually perform comparison and filtering in the shader.
-     */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    make_depth_target(&s_depth_map_tex, &s_depth_map_FBO);
+    make_depth_target(&s_static_tex, &s_static_FBO);
 
-    glGenFramebuffers(1, &s_depth_map_FBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, s_depth_map_FBO);
+    vec_sdraw_init(&s_static_draws);
+    s_static_valid = false;
 
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, s_depth_map_tex, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+void R_GL_ShadowsInvalidateStatic(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    s_static_valid = false;
+}
+
+bool R_GL_DepthPassStatic(const struct ent_stat_rstate *ents, size_t nents)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+    assert(s_depth_pass_active);
+    assert(s_static_recording);
+    s_static_recording = false;
+
+    uint64_t key = s_frame_key;
+    for(int i = 0; i < nents; i++) {
+        key += shadow_caster_key(ents[i].render_private, &ents[i].model);
+    }
+    key = shadow_hash(&nents, sizeof(nents), key);
+
+    if(s_static_valid && key == s_static_key)
+        GL_PERF_RETURN(false);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s_static_FBO);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    for(int i = 0; i < vec_size(&s_static_draws); i++) {
+        const struct static_draw *curr = &vec_AT(&s_static_draws, i);
+        shadow_draw(curr->render_private, &curr->model);
+    }
+
+    s_static_key = key;
+    s_static_valid = true;
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN(true);
+}
+
+void R_GL_DepthPassDynamic(void)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+    assert(s_depth_pass_active);
+
+    if(s_static_recording) {
+        R_GL_DepthPassStatic(NULL, 0);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, s_static_FBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, s_depth_map_FBO);
+    glBlitFramebuffer(0, 0, CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_MAP_RES,
+                      0, 0, CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_MAP_RES,
+                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, s_depth_map_FBO);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);  
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
@@ -153,6 +290,8 @@ void R_GL_DepthPassBegin(const vec3_t *light_pos, const vec3_t *cam_pos, const v
 
     assert(!s_depth_pass_active);
     s_depth_pass_active = true;
+    R_GL_StatsPushPass(RENDER_STAT_PASS_SHADOW);
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_SHADOW);
 
     glGetIntegerv(GL_VIEWPORT, s_saved.viewport);
     glGetIntegerv(GL_FRAMEBUFFER_BINDING, &s_saved.fb);
@@ -168,9 +307,13 @@ void R_GL_DepthPassBegin(const vec3_t *light_pos, const vec3_t *cam_pos, const v
     PFM_Mat4x4_Mult4x4(&light_proj, &light_view, &light_space_trans);
     R_GL_SetLightSpaceTrans(&light_space_trans);
 
+    /* The static casters are drawn into their own target once they are flushed
+     * and the shadow map itself is overwritten by the copy of those. */
+    vec_sdraw_reset(&s_static_draws);
+    s_static_recording = true;
+    s_frame_key = shadow_hash(&light_space_trans, sizeof(light_space_trans), 0xcbf29ce484222325ull);
+
     glViewport(0, 0, CONFIG_SHADOW_MAP_RES, CONFIG_SHADOW_MAP_RES);
-    glBindFramebuffer(GL_FRAMEBUFFER, s_depth_map_FBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
     glCullFace(GL_FRONT);
 
     GL_ASSERT_OK();
@@ -183,6 +326,9 @@ void R_GL_DepthPassEnd(void)
     ASSERT_IN_RENDER_THREAD();
 
     assert(s_depth_pass_active);
+    if(s_static_recording) {
+        R_GL_DepthPassDynamic();
+    }
     s_depth_pass_active = false;
 
     R_GL_StateSet(GL_U_SHADOW_MAP, (struct uval){
@@ -193,6 +339,8 @@ void R_GL_DepthPassEnd(void)
     glViewport(s_saved.viewport[0], s_saved.viewport[1], s_saved.viewport[2], s_saved.viewport[3]);
     glBindFramebuffer(GL_FRAMEBUFFER, s_saved.fb);
     glCullFace(GL_BACK);
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_SHADOW);
+    R_GL_StatsPopPass();
 
     GL_PERF_POP_GROUP();
     GL_ASSERT_OK();
@@ -205,17 +353,13 @@ void R_GL_RenderDepthMap(const void *render_private, mat4x4_t *model)
     ASSERT_IN_RENDER_THREAD();
     assert(s_depth_pass_active);
 
-    R_GL_StateSet(GL_U_MODEL, (struct uval){
-        .type = UTYPE_MAT4,
-        .val.as_mat4 = *model
-    });
-
-    const struct render_private *priv = render_private;
-    R_GL_Shader_InstallProg(priv->shader_prog_dp);
-
-    glBindVertexArray(priv->mesh.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+    if(s_static_recording) {
+        vec_sdraw_push(&s_static_draws, (struct static_draw){render_private, *model});
+        s_frame_key += shadow_caster_key(render_private, model);
+        GL_PERF_RETURN_VOID();
+    }
 
+    shadow_draw(render_private, model);
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
@@ -251,6 +395,7 @@ void R_GL_ShadowMapBind(void)
 {
     glActiveTexture(SHADOW_MAP_TUNIT);
     glBindTexture(GL_TEXTURE_2D, s_depth_map_tex);
+    R_GL_StatsTexBind();
 }
 
 void R_LightVisibilityFrustum(const struct camera *cam, struct frustum *out)
@@ -35,6 +35,7 @@
 
 #include "gl_state.h"
 #include "gl_shader.h"
+#include "gl_render.h"
 #include "gl_assert.h"
 #include "../lib/public/khash.h"
 #include "../lib/public/pf_string.h"
@@ -45,6 +46,8 @@
 
 
 #define NINSTALLED_CACHE (32)
+#define ARR_SIZE(a)      (sizeof(a)/sizeof((a)[0]))
+#define GLOBALS_SIZE     (272)
 
 struct buff{
     char raw[16384];
@@ -78,6 +81,13 @@ struct puval{
     GLuint installed_progs[NINSTALLED_CACHE];
 };
 
+/* A member of the globals uniform block, at its' std140 offset */
+struct gmember{
+    const char *name;
+    enum utype  type;
+    GLintptr    offset;
+};
+
 KHASH_MAP_INIT_STR(puval, struct puval)
 
 MPOOL_TYPE(buff, struct buff)
@@ -90,6 +100,21 @@ MPOOL_IMPL(static inline, buff, struct buff)
 static khash_t(puval) *s_state_table;
 static mp_buff_t       s_buff_pool;
 
+/* Must match the 'Globals' block declared in the shaders */
+static const struct gmember s_globals_layout[] = {
+    { GL_U_VIEW,            UTYPE_MAT4,   0 },
+    { GL_U_PROJECTION,      UTYPE_MAT4,  64 },
+    { GL_U_LS_TRANS,        UTYPE_MAT4, 128 },
+    { GL_U_CLIP_PLANE0,     UTYPE_VEC4, 192 },
+    { GL_U_VIEW_POS,        UTYPE_VEC3, 208 },
+    { GL_U_LIGHT_POS,       UTYPE_VEC3, 224 },
+    { GL_U_LIGHT_COLOR,     UTYPE_VEC3, 240 },
+    { GL_U_AMBIENT_COLOR,   UTYPE_VEC3, 256 },
+};
+
+static GLuint          s_globals_ubo;
+static unsigned char   s_globals[GLOBALS_SIZE];
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -272,6 +297,31 @@ static void uval_composite_install(GLuint shader_prog, const char *uname, const
     }
 }
 
+static const struct gmember *globals_member(const char *uname)
+{
+    for(int i = 0; i < ARR_SIZE(s_globals_layout); i++) {
+        if(!strcmp(s_globals_layout[i].name, uname))
+            return &s_globals_layout[i];
+    }
+    return NULL;
+}
+
+static void globals_update(const struct gmember *member, const struct uval *val)
+{
+    assert(member->type == val->type);
+    size_t size = uval_size(member->type);
+    assert(member->offset + size <= GLOBALS_SIZE);
+
+    if(0 == memcmp(s_globals + member->offset, &val->val, size))
+        return;
+    memcpy(s_globals + member->offset, &val->val, size);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, s_globals_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, member->offset, size, &val->val);
+    R_GL_StatsUpload(size);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
 static uint32_t hash_adler32(const void *data, size_t len) 
 {
      const uint8_t *buff = (const uint8_t*)data;
@@ -314,6 +364,13 @@ bool R_GL_StateInit(void)
     mp_buff_init(&s_buff_pool, true);
     if(!mp_buff_reserve(&s_buff_pool, 512))
         goto fail_pool;
+
+    memset(s_globals, 0, sizeof(s_globals));
+    glGenBuffers(1, &s_globals_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_globals_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(s_globals), s_globals, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, GL_GLOBALS_BINDING, s_globals_ubo);
     return true;
 
 fail_pool:
@@ -333,6 +390,7 @@ void R_GL_StateShutdown(void)
     });
     kh_destroy(puval, s_state_table);
     mp_buff_destroy(&s_buff_pool);
+    glDeleteBuffers(1, &s_globals_ubo);
 }
 
 void R_GL_StateSet(const char *uname, struct uval val)
@@ -358,6 +416,11 @@ void R_GL_StateSet(const char *uname, struct uval val)
         .v = val,
         .ninstalled = 0,
     };
+
+    const struct gmember *member = globals_member(uname);
+    if(member) {
+        globals_update(member, &val);
+    }
 }
 
 bool R_GL_StateGet(const char *uname, struct uval *out)
@@ -378,6 +441,9 @@ bool R_GL_StateGet(const char *uname, struct uval *out)
 
 void R_GL_StateInstall(const char *uname, GLuint shader_prog)
 {
+    if(globals_member(uname))
+        return;
+
     khiter_t k = kh_get(puval, s_state_table, uname);
     if (k == kh_end(s_state_table))
         return;
@@ -72,8 +72,6 @@
 #define GL_U_LIGHT_COLOR        "light_color"
 #define GL_U_LS_TRANS           "light_space_transform"
 #define GL_U_SHADOW_MAP         "shadow_map"
-#define GL_U_ENT_TOP_OFFSETS_SS "ent_top_offsets_ss"
-#define GL_U_ENT_HEALTH_PC      "ent_health_pc"
 #define GL_U_CURR_RES           "curr_res"
 #define GL_U_COLOR              "color"
 #define GL_U_CLIP_PLANE0        "clip_plane0"
@@ -91,6 +89,12 @@
 #define GL_U_ATTR_STRIDE        "attr_stride"
 #define GL_U_ATTR_OFFSET        "attr_offset"
 
+/* The frame and pass constant state lives in a single std140 uniform block 
+ * (see 'R_GL_StateSet'), which every program that declares it has bound to 
+ * the same binding point when it is linked. */
+#define GL_GLOBALS_BLOCK        "Globals"
+#define GL_GLOBALS_BINDING      (0)
+
 enum utype{
     UTYPE_FLOAT,
     UTYPE_VEC2,
@@ -138,7 +142,9 @@ void R_GL_StateSetArray(const char *uname, enum utype itemtype, size_t size, voi
 void R_GL_StateSetComposite(const char *uname, const struct mdesc *descs, 
                             size_t itemsize, size_t nitems, void *data);
 
-/* The shader program must have been used before installing the uniforms */
+/* The shader program must have been used before installing the uniforms. 
+ * This is a no-op for members of the globals block, which every program 
+ * already sees through the block binding. */
 void R_GL_StateInstall(const char *uname, GLuint shader_prog);
 
 #endif
@@ -0,0 +1,404 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "gl_render.h"
+#include "public/render_ctrl.h"
+#include "../main.h"
+
+#include <SDL_atomic.h>
+#include <assert.h>
+#include <string.h>
+
+
+#define ARR_SIZE(a)     (sizeof(a)/sizeof((a)[0]))
+#define MAX_PASS_DEPTH  (4)
+/* The timer queries of a frame are read back this many frames later, 
+ * so as not to stall on the GPU */
+#define GPU_FRAMES      (4)
+#define MAX_GPU_TIMERS  (64)
+
+struct gpu_timer{
+    enum render_gpu_pass pass;
+    GLuint               begin;
+    GLuint               end;
+};
+
+struct gpu_frame{
+    uint64_t         frame;
+    bool             pending;
+    size_t           ntimers;
+    struct gpu_timer timers[MAX_GPU_TIMERS];
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char *s_pass_names[RENDER_STAT_PASS_COUNT] = {
+    [RENDER_STAT_PASS_MAIN]         = "main",
+    [RENDER_STAT_PASS_SHADOW]       = "shadow",
+    [RENDER_STAT_PASS_REFRACTION]   = "refraction",
+    [RENDER_STAT_PASS_REFLECTION]   = "reflection",
+    [RENDER_STAT_PASS_MINIMAP]      = "minimap",
+    [RENDER_STAT_PASS_UI]           = "ui",
+};
+
+/* Owned by the render thread */
+static struct render_stats    s_curr;
+static enum render_stat_pass  s_pass_stack[MAX_PASS_DEPTH];
+static int                    s_pass_depth;
+static enum render_stat_pass  s_pass = RENDER_STAT_PASS_MAIN;
+
+static const char *s_gpu_pass_names[RENDER_GPU_PASS_COUNT] = {
+    [RENDER_GPU_PASS_SHADOW]        = "shadow",
+    [RENDER_GPU_PASS_WATER]         = "water",
+    [RENDER_GPU_PASS_BATCH_STAT]    = "batch_stat",
+    [RENDER_GPU_PASS_BATCH_ANIM]    = "batch_anim",
+    [RENDER_GPU_PASS_TERRAIN]       = "terrain",
+    [RENDER_GPU_PASS_UI]            = "ui",
+};
+
+/* Owned by the render thread */
+static bool                   s_gpu_enabled;
+static bool                   s_gpu_init;
+static int                    s_gpu_head;
+static struct gpu_frame       s_gpu_frames[GPU_FRAMES];
+/* The timer of the outermost open instance of every pass, or -1 */
+static int                    s_gpu_open[RENDER_GPU_PASS_COUNT];
+static int                    s_gpu_depth[RENDER_GPU_PASS_COUNT];
+
+/* The last published frame, read by the other threads */
+static SDL_SpinLock           s_published_lock;
+static struct render_stats    s_published;
+static struct render_gpu_times s_published_gpu;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static inline struct render_pass_stats *curr_pass(void)
+{
+    return &s_curr.passes[s_pass];
+}
+
+static uint64_t mode_tris(GLenum mode, size_t count)
+{
+    switch(mode) {
+    case GL_TRIANGLES:
+        return count / 3;
+    case GL_TRIANGLE_STRIP:
+    case GL_TRIANGLE_FAN:
+        return count >= 3 ? count - 2 : 0;
+    default:
+        return 0;
+    }
+}
+
+static void stats_accumulate(struct render_pass_stats *a, const struct render_pass_stats *b)
+{
+    a->ndraws += b->ndraws;
+    a->nindirect += b->nindirect;
+    a->ninstances += b->ninstances;
+    a->ntris += b->ntris;
+    a->nprog_binds += b->nprog_binds;
+    a->ntex_binds += b->ntex_binds;
+    a->upload_bytes += b->upload_bytes;
+}
+
+static void gpu_timers_free(void)
+{
+    if(!s_gpu_init)
+        return;
+
+    for(int i = 0; i < GPU_FRAMES; i++) {
+        struct gpu_frame *gf = &s_gpu_frames[i];
+        for(int j = 0; j < MAX_GPU_TIMERS; j++) {
+            glDeleteQueries(1, &gf->timers[j].begin);
+            glDeleteQueries(1, &gf->timers[j].end);
+        }
+        gf->pending = false;
+        gf->ntimers = 0;
+    }
+    s_gpu_init = false;
+}
+
+static void gpu_timers_alloc(void)
+{
+    if(s_gpu_init)
+        return;
+
+    for(int i = 0; i < GPU_FRAMES; i++) {
+        struct gpu_frame *gf = &s_gpu_frames[i];
+        for(int j = 0; j < MAX_GPU_TIMERS; j++) {
+            glGenQueries(1, &gf->timers[j].begin);
+            glGenQueries(1, &gf->timers[j].end);
+        }
+        gf->pending = false;
+        gf->ntimers = 0;
+    }
+    s_gpu_head = 0;
+    s_gpu_init = true;
+}
+
+/* Frames whose results are not yet available when their 
+ * slot comes up for re-use are dropped */
+static void gpu_frame_poll(struct gpu_frame *gf)
+{
+    if(!gf->pending)
+        return;
+    gf->pending = false;
+
+    for(int i = 0; i < gf->ntimers; i++) {
+        GLint avail = GL_FALSE;
+        glGetQueryObjectiv(gf->timers[i].end, GL_QUERY_RESULT_AVAILABLE, &avail);
+        if(!avail)
+            return;
+    }
+
+    struct render_gpu_times times = (struct render_gpu_times){ .frame = gf->frame };
+    for(int i = 0; i < gf->ntimers; i++) {
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(gf->timers[i].begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(gf->timers[i].end, GL_QUERY_RESULT, &end);
+        if(end > begin) {
+            times.pass_ms[gf->timers[i].pass] += (end - begin) / 1000000.0f;
+        }
+    }
+
+    SDL_AtomicLock(&s_published_lock);
+    s_published_gpu = times;
+    SDL_AtomicUnlock(&s_published_lock);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_StatsBeginFrame(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+
+    uint64_t frame = s_curr.frame;
+    memset(&s_curr, 0, sizeof(s_curr));
+    s_curr.frame = frame + 1;
+
+    s_pass_depth = 0;
+    s_pass = RENDER_STAT_PASS_MAIN;
+
+    if(!s_gpu_enabled)
+        return;
+
+    gpu_timers_alloc();
+    struct gpu_frame *gf = &s_gpu_frames[s_gpu_head];
+    gpu_frame_poll(gf);
+    gf->frame = s_curr.frame;
+    gf->ntimers = 0;
+
+    for(int i = 0; i < RENDER_GPU_PASS_COUNT; i++) {
+        s_gpu_open[i] = -1;
+        s_gpu_depth[i] = 0;
+    }
+}
+
+void R_GL_StatsEndFrame(size_t ncmds, size_t arg_bytes)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(s_pass_depth == 0);
+
+    s_curr.ncmds = ncmds;
+    s_curr.arg_bytes = arg_bytes;
+    for(int i = 0; i < RENDER_STAT_PASS_COUNT; i++) {
+        stats_accumulate(&s_curr.total, &s_curr.passes[i]);
+    }
+
+    SDL_AtomicLock(&s_published_lock);
+    s_published = s_curr;
+    SDL_AtomicUnlock(&s_published_lock);
+
+    if(!s_gpu_init)
+        return;
+
+    struct gpu_frame *gf = &s_gpu_frames[s_gpu_head];
+    for(int i = 0; i < RENDER_GPU_PASS_COUNT; i++) {
+        if(s_gpu_open[i] >= 0) {
+            glQueryCounter(gf->timers[s_gpu_open[i]].end, GL_TIMESTAMP);
+            s_gpu_open[i] = -1;
+        }
+    }
+    gf->pending = (gf->ntimers > 0);
+    s_gpu_head = (s_gpu_head + 1) % GPU_FRAMES;
+
+    if(!s_gpu_enabled) {
+        gpu_timers_free();
+    }
+}
+
+void R_GL_StatsSetPass(enum render_stat_pass pass)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(pass >= 0 && pass < RENDER_STAT_PASS_COUNT);
+
+    if(s_pass_depth == 0) {
+        s_pass = pass;
+    }else{
+        s_pass_stack[0] = pass;
+    }
+}
+
+void R_GL_StatsPushPass(enum render_stat_pass pass)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(pass >= 0 && pass < RENDER_STAT_PASS_COUNT);
+    assert(s_pass_depth < MAX_PASS_DEPTH);
+
+    s_pass_stack[s_pass_depth++] = s_pass;
+    s_pass = pass;
+}
+
+void R_GL_StatsPopPass(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(s_pass_depth > 0);
+
+    s_pass = s_pass_stack[--s_pass_depth];
+}
+
+void R_GL_StatsDraw(GLenum mode, size_t count, size_t ninstances)
+{
+    curr_pass()->ndraws++;
+    curr_pass()->ninstances += ninstances;
+    curr_pass()->ntris += mode_tris(mode, count) * ninstances;
+}
+
+void R_GL_StatsIndirect(GLenum mode, size_t count, size_t ninstances)
+{
+    curr_pass()->nindirect++;
+    curr_pass()->ninstances += ninstances;
+    curr_pass()->ntris += mode_tris(mode, count) * ninstances;
+}
+
+void R_GL_StatsProgBind(void)
+{
+    curr_pass()->nprog_binds++;
+}
+
+void R_GL_StatsTexBind(void)
+{
+    curr_pass()->ntex_binds++;
+}
+
+void R_GL_StatsUpload(size_t bytes)
+{
+    curr_pass()->upload_bytes += bytes;
+}
+
+void R_GL_StatsGPUBegin(enum render_gpu_pass pass)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(pass >= 0 && pass < RENDER_GPU_PASS_COUNT);
+
+    if(!s_gpu_init)
+        return;
+    if(s_gpu_depth[pass]++ > 0)
+        return;
+
+    struct gpu_frame *gf = &s_gpu_frames[s_gpu_head];
+    if(gf->ntimers == MAX_GPU_TIMERS)
+        return;
+
+    struct gpu_timer *timer = &gf->timers[gf->ntimers];
+    timer->pass = pass;
+    glQueryCounter(timer->begin, GL_TIMESTAMP);
+    s_gpu_open[pass] = gf->ntimers++;
+}
+
+void R_GL_StatsGPUEnd(enum render_gpu_pass pass)
+{
+    ASSERT_IN_RENDER_THREAD();
+    assert(pass >= 0 && pass < RENDER_GPU_PASS_COUNT);
+
+    if(!s_gpu_init)
+        return;
+    assert(s_gpu_depth[pass] > 0);
+    if(--s_gpu_depth[pass] > 0)
+        return;
+    if(s_gpu_open[pass] < 0)
+        return;
+
+    struct gpu_frame *gf = &s_gpu_frames[s_gpu_head];
+    glQueryCounter(gf->timers[s_gpu_open[pass]].end, GL_TIMESTAMP);
+    s_gpu_open[pass] = -1;
+}
+
+void R_GL_StatsSetGPUTimers(const bool *on)
+{
+    ASSERT_IN_RENDER_THREAD();
+    s_gpu_enabled = *on;
+}
+
+void R_GL_StatsShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
+    gpu_timers_free();
+}
+
+void R_GetStats(struct render_stats *out)
+{
+    SDL_AtomicLock(&s_published_lock);
+    *out = s_published;
+    SDL_AtomicUnlock(&s_published_lock);
+}
+
+void R_GetGPUTimes(struct render_gpu_times *out)
+{
+    SDL_AtomicLock(&s_published_lock);
+    *out = s_published_gpu;
+    SDL_AtomicUnlock(&s_published_lock);
+}
+
+const char *R_GPUPassName(enum render_gpu_pass pass)
+{
+    assert(pass >= 0 && pass < ARR_SIZE(s_gpu_pass_names));
+    return s_gpu_pass_names[pass];
+}
+
+const char *R_StatPassName(enum render_stat_pass pass)
+{
+    assert(pass >= 0 && pass < ARR_SIZE(s_pass_names));
+    return s_pass_names[pass];
+}
+
@@ -38,6 +38,8 @@
 #include "gl_state.h"
 #include "gl_assert.h"
 #include "gl_perf.h"
+#include "gl_render.h"
+#include "gl_ringbuffer.h"
 #include "../camera.h"
 #include "../pf_math.h"
 #include "../config.h"
@@ -49,45 +51,33 @@
 #include <assert.h>
 
 
-#define ARR_SIZE(a) (sizeof(a)/sizeof((a)[0]))
-#define MIN(a, b)   ((a) < (b) ? (a) : (b))
-#define MAX_HBS     (256)
+#define ARR_SIZE(a)     (sizeof(a)/sizeof((a)[0]))
+#define INST_RING_SZ    (1024 * 1024)
+
+/* Per-instance attributes of a single healthbar */
+struct hb_inst{
+    vec2_t  pos_ss;
+    GLfloat health_pc;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct{
+    GLuint          VAO;
+    GLuint          VBO;
+    struct gl_ring *inst_ring;
+}s_ctx;
 
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
-void R_GL_DrawHealthbars(const size_t *num_ents, GLfloat *ent_health_pc, 
-                         vec3_t *ent_top_pos_ws, int *yoffsets, const struct camera *cam)
+bool R_GL_StatusbarInit(void)
 {
-    GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
 
-    int width, height;
-    Engine_WinDrawableSize(&width, &height);
-
-    /* Convert the worldspace positions to SDL screenspace positions */
-    STALLOC(vec2_t, ent_top_pos_ss, *num_ents); /* Screen-space XY positions of the entity tops. */
-
-    mat4x4_t view, proj;
-    Camera_MakeViewMat(cam, &view); 
-    Camera_MakeProjMat(cam, &proj);
-
-    for(int i = 0; i < *num_ents; i++) {
-    
-        vec4_t ent_top_homo = (vec4_t){ent_top_pos_ws[i].x, ent_top_pos_ws[i].y, ent_top_pos_ws[i].z, 1.0f};
-
-        vec4_t clip, tmp;
-        PFM_Mat4x4_Mult4x1(&view, &ent_top_homo, &tmp);
-        PFM_Mat4x4_Mult4x1(&proj, &tmp, &clip);
-        vec3_t ndc = (vec3_t){clip.x / clip.w, clip.y / clip.w, clip.z / clip.w};
-
-        float screen_x = (ndc.x + 1.0f) * width/2.0f;
-        float screen_y = height - ((ndc.y + 1.0f) * height/2.0f);
-
-        ent_top_pos_ss[i] = (vec2_t){screen_x, screen_y + yoffsets[i]};
-    }
-
     /* Create a buffer of mesh vertices for a healthbar centered at (0, 0).
      * Set uv attribute for each vertex - used in fragment shader to determine relative 
      * texel position within the quad. 
@@ -116,15 +106,16 @@ void R_GL_DrawHealthbars(const size_t *num_ents, GLfloat *ent_health_pc,
         corners[2], corners[3], corners[0],
     };
 
-    /* OpenGL setup */
-    GLuint VAO, VBO;
+    s_ctx.inst_ring = R_GL_RingbufferInit(INST_RING_SZ, RING_FLOAT, RING_GROWABLE | RING_ADAPTIVE);
+    if(!s_ctx.inst_ring)
+        return false;
 
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    glGenVertexArrays(1, &s_ctx.VAO);
+    glBindVertexArray(s_ctx.VAO);
 
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(vbuff) * sizeof(struct textured_vert), vbuff, GL_STATIC_DRAW);
+    glGenBuffers(1, &s_ctx.VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vbuff), vbuff, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct textured_vert), (void*)0);
     glEnableVertexAttribArray(0);
@@ -133,30 +124,101 @@ void R_GL_DrawHealthbars(const size_t *num_ents, GLfloat *ent_health_pc,
         (void*)offsetof(struct textured_vert, uv));
     glEnableVertexAttribArray(1);
 
-    /* set uniforms */
-    int w, h;
-    Engine_WinDrawableSize(&w, &h);
+    /* The per-instance attributes are sourced from the ringbuffer. Their 
+     * pointers are set up at draw time, once the section offset is known. */
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GL_ASSERT_OK();
+    return true;
+}
+
+void R_GL_StatusbarShutdown(void)
+{
+    ASSERT_IN_RENDER_THREAD();
 
+    R_GL_RingbufferDestroy(s_ctx.inst_ring);
+    glDeleteVertexArrays(1, &s_ctx.VAO);
+    glDeleteBuffers(1, &s_ctx.VBO);
+}
+
+void R_GL_DrawHealthbars(const size_t *num_ents, GLfloat *ent_health_pc, 
+                         vec3_t *ent_top_pos_ws, int *yoffsets, const struct camera *cam)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+
+    if(*num_ents == 0)
+        GL_PERF_RETURN_VOID();
+
+    int width, height;
+    Engine_WinDrawableSize(&width, &height);
+
+    /* Convert the worldspace positions to SDL screenspace positions */
+    STALLOC(struct hb_inst, insts, *num_ents);
+
+    mat4x4_t view, proj;
+    Camera_MakeViewMat(cam, &view); 
+    Camera_MakeProjMat(cam, &proj);
+
+    for(int i = 0; i < *num_ents; i++) {
+    
+        vec4_t ent_top_homo = (vec4_t){ent_top_pos_ws[i].x, ent_top_pos_ws[i].y, ent_top_pos_ws[i].z, 1.0f};
+
+        vec4_t clip, tmp;
+        PFM_Mat4x4_Mult4x1(&view, &ent_top_homo, &tmp);
+        PFM_Mat4x4_Mult4x1(&proj, &tmp, &clip);
+        vec3_t ndc = (vec3_t){clip.x / clip.w, clip.y / clip.w, clip.z / clip.w};
+
+        float screen_x = (ndc.x + 1.0f) * width/2.0f;
+        float screen_y = height - ((ndc.y + 1.0f) * height/2.0f);
+
+        insts[i] = (struct hb_inst){
+            .pos_ss = (vec2_t){screen_x, screen_y + yoffsets[i]},
+            .health_pc = ent_health_pc[i]
+        };
+    }
+
+    size_t begin, end;
+    if(!R_GL_RingbufferPushContiguous(s_ctx.inst_ring, insts, 
+        *num_ents * sizeof(struct hb_inst), sizeof(struct hb_inst))) {
+        STFREE(insts);
+        GL_PERF_RETURN_VOID();
+    }
+    R_GL_RingbufferGetLastRange(s_ctx.inst_ring, &begin, &end);
+
+    glBindVertexArray(s_ctx.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, R_GL_RingbufferGetVBO(s_ctx.inst_ring));
+
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(struct hb_inst), 
+        (void*)(begin + offsetof(struct hb_inst, pos_ss)));
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(struct hb_inst), 
+        (void*)(begin + offsetof(struct hb_inst, health_pc)));
+
+    /* set uniforms */
     R_GL_StateSet(GL_U_CURR_RES, (struct uval){
         .type = UTYPE_IVEC2,
-        .val.as_ivec2[0] = w,
-        .val.as_ivec2[1] = h
+        .val.as_ivec2[0] = width,
+        .val.as_ivec2[1] = height
     });
 
-    size_t ndraw = MIN(*num_ents, MAX_HBS);
-    R_GL_StateSetArray(GL_U_ENT_TOP_OFFSETS_SS, UTYPE_VEC2, ndraw, ent_top_pos_ss);
-    R_GL_StateSetArray(GL_U_ENT_HEALTH_PC, UTYPE_FLOAT, ndraw, ent_health_pc);
-
     R_GL_Shader_Install("statusbar");
 
     /* Draw instances */
-    glDrawArraysInstanced(GL_TRIANGLES, 0, ARR_SIZE(vbuff), *num_ents);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, *num_ents);
+    R_GL_StatsDraw(GL_TRIANGLES, 6, *num_ents);
+    R_GL_RingbufferSyncLast(s_ctx.inst_ring);
 
     /* cleanup */
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    STFREE(ent_top_pos_ss);
+    STFREE(insts);
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
@@ -40,14 +40,28 @@
 #include "gl_assert.h"
 #include "gl_state.h"
 #include "gl_perf.h"
+#include "gl_material.h"
 #include "render_private.h"
 #include "../main.h"
 #include "../map/public/tile.h"
 
 #include <assert.h>
 #include <string.h>
+#include <stddef.h>
 
 #define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define CLAMP(a, min, max) (MIN(MAX((a), (min)), (max)))
+
+/* The resolution of the baked page of a single chunk. The full mip chain of 
+ * the page is kept, down to a single texel. */
+#define BAKE_PAGE_RES       (256)
+#define BAKE_PAGE_LEVELS    (9)
+#define BAKE_TUNIT          (GL_TEXTURE2)
+/* Bound the stall of a frame in which many chunks fall into the distance 
+ * at once. The chunks left over are drawn with the full blending. */
+#define MAX_BAKES_PER_FRAME (4)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -58,6 +72,213 @@ static bool                   s_map_ctx_active = false;
 static struct gl_ring        *s_fog_ring;
 static struct map_resolution  s_res;
 
+/* A copy of the latest fog-of-war state. Since the same amount of data is
+ * pushed to the ringbuffer every time, each of the NFOG_SECTIONS sections
+ * always lands on the same part of the buffer. So only the chunks that have
+ * changed since a section was last written need to be written to it again.
+ * A section generation of 0 means it holds no valid fog state.
+ */
+#define NFOG_SECTIONS (3)
+static unsigned char         *s_fog_shadow;
+static uint32_t              *s_fog_chunk_gens;
+static struct ring_range     *s_fog_ranges;
+static uint32_t               s_fog_section_gens[NFOG_SECTIONS];
+static uint32_t               s_fog_gen;
+static int                    s_fog_next_section;
+
+/* The chunks which are further than 's_bake_dist' from the camera are drawn 
+ * with the blended colors of their materials sampled from a page, instead 
+ * of blending up to 26 samples of the map textures per fragment. Each chunk 
+ * has one layer of the page array. The pages are baked on demand, the first 
+ * time the chunk is drawn in the distance after it has been invalidated. A
+ * distance of 0 disables the pages altogether.
+ */
+static struct texture_arr     s_bake_pages;
+static GLuint                 s_bake_fbs[2];
+static bool                  *s_bake_valid;
+static float                  s_bake_dist = 384.0f;
+static vec2_t                 s_map_pos;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void bake_init(size_t nchunks)
+{
+    GLint max_layers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+    s_bake_pages = (struct texture_arr){0, BAKE_TUNIT};
+    s_bake_valid = calloc(nchunks, sizeof(bool));
+    assert(s_bake_valid);
+
+    if(nchunks > max_layers)
+        return;
+
+    glActiveTexture(BAKE_TUNIT);
+    glGenTextures(1, &s_bake_pages.id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, s_bake_pages.id);
+
+    for(int i = 0; i < BAKE_PAGE_LEVELS; i++) {
+        int res = BAKE_PAGE_RES >> i;
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGBA8, res, res, nchunks, 0, 
+            GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, BAKE_PAGE_LEVELS - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenFramebuffers(2, s_bake_fbs);
+    GL_ASSERT_OK();
+}
+
+static void bake_shutdown(void)
+{
+    if(s_bake_pages.id) {
+        R_GL_Texture_ArrayFree(s_bake_pages);
+        glDeleteFramebuffers(2, s_bake_fbs);
+    }
+    s_bake_pages.id = 0;
+    free(s_bake_valid);
+    s_bake_valid = NULL;
+}
+
+/* Returns true if the chunk with the given model matrix is far enough 
+ * from the camera to be drawn from its' page. */
+static bool bake_chunk_far(const mat4x4_t *model, vec3_t view_pos, int *out_layer)
+{
+    if(!s_bake_pages.id || s_bake_dist == 0.0f)
+        return false;
+
+    const float chunk_x_dist = s_res.tile_w * X_COORDS_PER_TILE;
+    const float chunk_z_dist = s_res.tile_h * Z_COORDS_PER_TILE;
+    vec3_t origin = (vec3_t){model->cols[3][0], model->cols[3][1], model->cols[3][2]};
+
+    int r = (origin.z - s_map_pos.raw[1]) / chunk_z_dist + 0.5f;
+    int c = (s_map_pos.raw[0] - origin.x) / chunk_x_dist + 0.5f;
+    if(r < 0 || r >= s_res.chunk_h || c < 0 || c >= s_res.chunk_w)
+        return false;
+
+    /* The chunk spans from its' origin in the -X and +Z directions */
+    vec3_t nearest = (vec3_t){
+        CLAMP(view_pos.x, origin.x - chunk_x_dist, origin.x),
+        origin.y,
+        CLAMP(view_pos.z, origin.z, origin.z + chunk_z_dist),
+    };
+    vec3_t delta;
+    PFM_Vec3_Sub(&view_pos, &nearest, &delta);
+    if(PFM_Vec3_Len(&delta) < s_bake_dist)
+        return false;
+
+    *out_layer = r * s_res.chunk_w + c;
+    return true;
+}
+
+static void bake_page(const struct render_private *priv, int layer)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, s_bake_fbs[0]);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, s_bake_pages.id, 0, layer);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+    glViewport(0, 0, BAKE_PAGE_RES, BAKE_PAGE_RES);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glBindVertexArray(priv->mesh.VAO);
+    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+    R_GL_StatsDraw(GL_TRIANGLES, priv->mesh.num_verts, 1);
+
+    /* Filter down every level of the page from the one above it. Unlike 
+     * glGenerateMipmap, this only touches the layer that was baked. */
+    for(int i = 1; i < BAKE_PAGE_LEVELS; i++) {
+
+        int src_res = BAKE_PAGE_RES >> (i - 1);
+        int dst_res = BAKE_PAGE_RES >> i;
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, s_bake_fbs[0]);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, s_bake_pages.id, i - 1, layer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, s_bake_fbs[1]);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, s_bake_pages.id, i, layer);
+
+        glBlitFramebuffer(0, 0, src_res, src_res, 0, 0, dst_res, dst_res, 
+            GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    }
+    s_bake_valid[layer] = true;
+}
+
+static void bake_stale_pages(void **chunk_rprivates, const mat4x4_t *models, 
+                             size_t nchunks, vec3_t view_pos)
+{
+    GL_PERF_ENTER();
+
+    size_t nstale = 0;
+    int layers[MAX_BAKES_PER_FRAME];
+    const struct render_private *privs[MAX_BAKES_PER_FRAME];
+
+    for(int i = 0; i < nchunks && nstale < MAX_BAKES_PER_FRAME; i++) {
+        int layer;
+        if(!bake_chunk_far(&models[i], view_pos, &layer) || s_bake_valid[layer])
+            continue;
+        layers[nstale] = layer;
+        privs[nstale] = chunk_rprivates[i];
+        nstale++;
+    }
+
+    if(nstale == 0)
+        GL_PERF_RETURN_VOID();
+
+    GLint prev_draw_fb, prev_read_fb, prev_viewport[4];
+    GLfloat prev_clear[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_draw_fb);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_read_fb);
+    glGetIntegerv(GL_VIEWPORT, prev_viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, prev_clear);
+
+    const GLenum caps[] = {GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_CLIP_DISTANCE0, GL_SCISSOR_TEST};
+    GLboolean prev_caps[ARR_SIZE(caps)];
+    for(int i = 0; i < ARR_SIZE(caps); i++) {
+        prev_caps[i] = glIsEnabled(caps[i]);
+        glDisable(caps[i]);
+    }
+
+    GLuint bake_prog = R_GL_Shader_GetProgForName("terrain-bake");
+    assert(bake_prog != -1);
+    R_GL_Shader_InstallProg(bake_prog);
+    R_GL_Texture_BindArray(&s_map_textures, bake_prog);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+    for(int i = 0; i < nstale; i++) {
+        bake_page(privs[i], layers[i]);
+    }
+
+    for(int i = 0; i < ARR_SIZE(caps); i++) {
+        if(prev_caps[i])
+            glEnable(caps[i]);
+    }
+    glClearColor(prev_clear[0], prev_clear[1], prev_clear[2], prev_clear[3]);
+    glViewport(prev_viewport[0], prev_viewport[1], prev_viewport[2], prev_viewport[3]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_draw_fb);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_read_fb);
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+static GLuint baked_prog_for(GLuint prog)
+{
+    static GLuint s_shadowed_prog, s_baked_prog, s_baked_shadowed_prog;
+    if(!s_baked_prog) {
+        s_shadowed_prog = R_GL_Shader_GetProgForName("terrain-shadowed");
+        s_baked_prog = R_GL_Shader_GetProgForName("terrain-baked");
+        s_baked_shadowed_prog = R_GL_Shader_GetProgForName("terrain-baked-shadowed");
+    }
+    return (prog == s_shadowed_prog) ? s_baked_shadowed_prog : s_baked_prog;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -67,12 +288,27 @@ void R_GL_MapInit(const char map_texfiles[][256], const size_t *num_textures,
 {
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
+    R_GL_ShadowsInvalidateStatic();
 
     size_t nchunks = res->chunk_w * res->chunk_h;
-    s_fog_ring = R_GL_RingbufferInit(nchunks * TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT * 3, RING_UBYTE);
+    size_t fog_size = nchunks * TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT;
+    s_fog_ring = R_GL_RingbufferInit(fog_size * NFOG_SECTIONS, RING_UBYTE, 0);
     assert(s_fog_ring);
 
+    s_fog_shadow = calloc(fog_size, 1);
+    s_fog_chunk_gens = malloc(nchunks * sizeof(uint32_t));
+    s_fog_ranges = malloc(nchunks * sizeof(struct ring_range));
+    assert(s_fog_shadow && s_fog_chunk_gens && s_fog_ranges);
+
+    s_fog_gen = 1;
+    s_fog_next_section = 0;
+    memset(s_fog_section_gens, 0, sizeof(s_fog_section_gens));
+    for(int i = 0; i < nchunks; i++) {
+        s_fog_chunk_gens[i] = s_fog_gen;
+    }
+
     R_GL_Texture_ArrayMakeMap(map_texfiles, *num_textures, &s_map_textures, GL_TEXTURE0);
+    bake_init(nchunks);
 
     R_GL_StateSet(GL_U_MAP_RES, (struct uval){
         .type = UTYPE_IVEC4,
@@ -87,10 +323,42 @@ void R_GL_MapInit(const char map_texfiles[][256], const size_t *num_textures,
     GL_PERF_RETURN_VOID();
 }
 
-void R_GL_MapUpdateFog(void *buff, const size_t *size)
+void R_GL_MapUpdateFog(void *buff, void *chunks, const size_t *nchunks)
 {
     GL_PERF_ENTER();
-    R_GL_RingbufferPush(s_fog_ring, buff, *size);
+
+    const size_t chunk_size = s_res.tile_w * s_res.tile_h;
+    const size_t nmapchunks = s_res.chunk_w * s_res.chunk_h;
+    const uint32_t *indices = chunks;
+
+    s_fog_gen++;
+    for(int i = 0; i < *nchunks; i++) {
+        uint32_t idx = indices[i];
+        assert(idx < nmapchunks);
+        memcpy(s_fog_shadow + idx * chunk_size, ((unsigned char*)buff) + i * chunk_size, 
+            chunk_size);
+        s_fog_chunk_gens[idx] = s_fog_gen;
+    }
+
+    /* Merge the chunks that are stale in the next section into ranges */
+    uint32_t section_gen = s_fog_section_gens[s_fog_next_section];
+    size_t nranges = 0;
+    for(int i = 0; i < nmapchunks; i++) {
+        if(section_gen && s_fog_chunk_gens[i] <= section_gen)
+            continue;
+        size_t begin = i * chunk_size;
+        if(nranges > 0 && s_fog_ranges[nranges - 1].end == begin) {
+            s_fog_ranges[nranges - 1].end += chunk_size;
+        }else{
+            s_fog_ranges[nranges++] = (struct ring_range){begin, begin + chunk_size};
+        }
+    }
+
+    R_GL_RingbufferPushRanges(s_fog_ring, s_fog_shadow, nmapchunks * chunk_size, 
+        s_fog_ranges, nranges);
+    s_fog_section_gens[s_fog_next_section] = s_fog_gen;
+    s_fog_next_section = (s_fog_next_section + 1) % NFOG_SECTIONS;
+
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
@@ -99,6 +367,10 @@ void R_GL_MapShutdown(void)
 {
     R_GL_Texture_ArrayFree(s_map_textures);
     R_GL_RingbufferDestroy(s_fog_ring);
+    free(s_fog_shadow);
+    free(s_fog_chunk_gens);
+    free(s_fog_ranges);
+    bake_shutdown();
 }
 
 /* Push a fully 'visible' field into the ringbuffer. Must be followed
@@ -110,6 +382,10 @@ void R_GL_MapUpdateFogClear(void)
     memset(buff, 0x2, size);
     R_GL_RingbufferPush(s_fog_ring, buff, size);
     free(buff);
+
+    /* The section no longer holds the fog state */
+    s_fog_section_gens[s_fog_next_section] = 0;
+    s_fog_next_section = (s_fog_next_section + 1) % NFOG_SECTIONS;
 }
 
 void R_GL_MapBegin(const bool *shadows, const vec2_t *pos)
@@ -118,6 +394,7 @@ void R_GL_MapBegin(const bool *shadows, const vec2_t *pos)
     ASSERT_IN_RENDER_THREAD();
     GL_PERF_PUSH_GROUP(0, "map");
     assert(!s_map_ctx_active);
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_TERRAIN);
 
     GLuint shader_prog;
     if(*shadows) {
@@ -136,10 +413,71 @@ void R_GL_MapBegin(const bool *shadows, const vec2_t *pos)
         .val.as_vec2 = *pos
     });
 
+    s_map_pos = *pos;
     s_map_ctx_active = true;
     GL_PERF_RETURN_VOID();
 }
 
+void R_GL_MapDrawChunks(void **chunk_rprivates, mat4x4_t *models, const size_t *nchunks)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+    assert(s_map_ctx_active);
+
+    /* Chunks have no materials of their own (they are textured from 
+     * the map texture array) so that uniform is set once for all of them */
+    R_GL_StateSetComposite(GL_U_MATERIALS, (struct mdesc[]){
+        { "ambient_intensity",   UTYPE_FLOAT,    offsetof(struct material, ambient_intensity) },
+        { "diffuse_clr",         UTYPE_VEC3,     offsetof(struct material, diffuse_clr)       },
+        { "specular_clr",        UTYPE_VEC3,     offsetof(struct material, specular_clr)      },
+        {0}
+    }, sizeof(struct material), 0, NULL);
+    R_GL_ShadowMapBind();
+
+    struct uval pval;
+    R_GL_StateGet(GL_U_VIEW_POS, &pval);
+    vec3_t view_pos = pval.val.as_vec3;
+
+    bake_stale_pages(chunk_rprivates, models, *nchunks, view_pos);
+    if(s_bake_pages.id) {
+        R_GL_Texture_BindArray(&s_bake_pages, R_GL_Shader_GetProgForName("terrain-baked"));
+    }
+
+    GLuint curr_prog = 0;
+    for(int i = 0; i < *nchunks; i++) {
+
+        const struct render_private *priv = chunk_rprivates[i];
+        assert(priv->num_materials == 0);
+
+        int layer;
+        GLuint prog = priv->shader_prog;
+        if(bake_chunk_far(&models[i], view_pos, &layer) && s_bake_valid[layer]) {
+            prog = baked_prog_for(prog);
+        }
+
+        R_GL_StateSet(GL_U_MODEL, (struct uval){
+            .type = UTYPE_MAT4,
+            .val.as_mat4 = models[i]
+        });
+
+        /* All the chunks normally share the same program, in which case
+         * only the model matrix needs to be uploaded between draws */
+        if(i == 0 || prog != curr_prog) {
+            curr_prog = prog;
+            R_GL_Shader_InstallProg(curr_prog);
+        }else{
+            R_GL_StateInstall(GL_U_MODEL, curr_prog);
+        }
+
+        glBindVertexArray(priv->mesh.VAO);
+        glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+        R_GL_StatsDraw(GL_TRIANGLES, priv->mesh.num_verts, 1);
+    }
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
 void R_GL_MapEnd(void)
 {
     GL_PERF_ENTER();
@@ -147,6 +485,7 @@ void R_GL_MapEnd(void)
 
     assert(s_map_ctx_active);
     s_map_ctx_active = false;
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_TERRAIN);
 
     GL_PERF_POP_GROUP();
     GL_PERF_RETURN_VOID();
@@ -159,6 +498,20 @@ void R_GL_MapInvalidate(void)
     GL_PERF_RETURN_VOID();
 }
 
+void R_GL_MapSetBakeDistance(const float *dist)
+{
+    s_bake_dist = *dist;
+}
+
+void R_GL_MapInvalidateBake(int chunk_r, int chunk_c)
+{
+    if(!s_bake_valid)
+        return;
+    assert(chunk_r >= 0 && chunk_r < s_res.chunk_h);
+    assert(chunk_c >= 0 && chunk_c < s_res.chunk_w);
+    s_bake_valid[chunk_r * s_res.chunk_w + chunk_c] = false;
+}
+
 void R_GL_MapFogBindLast(GLuint tunit, GLuint shader_prog, const char *uname)
 {
     R_GL_RingbufferBindLast(s_fog_ring, tunit, shader_prog, uname);
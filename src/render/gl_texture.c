@@ -35,6 +35,7 @@
 
 #include "gl_texture.h"
 #include "gl_state.h"
+#include "gl_render.h"
 #include "gl_assert.h"
 #include "gl_material.h"
 #include "../lib/public/stb_image.h"
@@ -149,6 +150,100 @@ static size_t texture_arr_num_mip_levels(GLuint tex)
     return MIN(max_lvl + 1, nmips);
 }
 
+/* Find the smallest mip level of the texture that is still no smaller than 
+ * 'res' in both dimensions, or the base level if even that is smaller. Scaling 
+ * it to 'res' never minifies by more than a factor of 2. Levels that were not 
+ * allocated report a size of 0, so textures without mips always give 0. 
+ */
+static int texture_blit_level(GLuint tex, int res, int *out_w, int *out_h)
+{
+    int level = 0, w, h;
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+
+    while(true) {
+        int next_w, next_h;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level + 1, GL_TEXTURE_WIDTH, &next_w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level + 1, GL_TEXTURE_HEIGHT, &next_h);
+        if(next_w < res || next_h < res)
+            break;
+        w = next_w;
+        h = next_h;
+        level++;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    *out_w = w;
+    *out_h = h;
+    return level;
+}
+
+/* Scale a 2D texture into a layer of an array texture, entirely on the GPU. 
+ * Returns false if the framebuffers can't be set up for the copy (e.g. the 
+ * texture is of a format that isn't color-renderable).
+ */
+static bool texture_arr_blit_elem(const GLuint fbos[2], GLuint src, GLuint dst, int dst_idx)
+{
+    int w, h;
+    int level = texture_blit_level(src, CONFIG_ARR_TEX_RES, &w, &h);
+    if(w == 0 || h == 0)
+        return false;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos[0]);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, src, level);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[1]);
+    glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, dst, 0, dst_idx);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+    if(glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE
+    || glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        return false;
+
+    glBlitFramebuffer(0, 0, w, h, 0, 0, CONFIG_ARR_TEX_RES, CONFIG_ARR_TEX_RES, 
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    GL_ASSERT_OK();
+    return true;
+}
+
+/* Fallback path for 'texture_arr_blit_elem': read the texture back and 
+ * resize it on the CPU. This stalls until the GPU has caught up. 
+ */
+static void texture_arr_copy_elem_cpu(GLuint src, GLuint dst, int dst_idx)
+{
+    glBindTexture(GL_TEXTURE_2D, src);
+
+    int w, h;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+
+    GLubyte *orig_data = malloc(w * h * 4);
+    if(!orig_data)
+        goto fail_orig;
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, orig_data);
+
+    GLubyte *resized_data = malloc(CONFIG_ARR_TEX_RES * CONFIG_ARR_TEX_RES * 4);
+    if(!resized_data)
+        goto fail_resized;
+
+    int res = stbir_resize_uint8(orig_data, w, h, 0, resized_data, CONFIG_ARR_TEX_RES, CONFIG_ARR_TEX_RES, 0, 4);
+    if(res != 1)
+        goto fail_resize;
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, dst);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, dst_idx, CONFIG_ARR_TEX_RES, 
+        CONFIG_ARR_TEX_RES, 1, GL_RGBA, GL_UNSIGNED_BYTE, resized_data);
+
+fail_resize:
+    free(resized_data);
+fail_resized:
+    free(orig_data);
+fail_orig:
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 static bool texture_write_ppm(const char* filename, const unsigned char *data, int width, int height)
 {
     FILE* file = fopen(filename, "wb");
@@ -296,6 +391,7 @@ void R_GL_Texture_Bind(const struct texture *text, GLuint shader_prog)
 
     glActiveTexture(text->tunit);
     glBindTexture(GL_TEXTURE_2D, text->id);
+    R_GL_StatsTexBind();
     GLint sampler = text->tunit - GL_TEXTURE0;
 
     const char *uname_table[] = {
@@ -492,40 +588,28 @@ void R_GL_Texture_ArrayMake(const struct material *mats, size_t num_mats,
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
+    GLint prev_read_fbo, prev_draw_fbo;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_read_fbo);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_draw_fbo);
+
+    GLuint fbos[2];
+    glGenFramebuffers(2, fbos);
+
     for(int i = 0; i < num_mats; i++) {
 
         if(mats[i].texture.id == 0)
             continue;
 
-        glBindTexture(GL_TEXTURE_2D, mats[i].texture.id);
-
-        int w, h;
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
-
-        GLubyte *orig_data = malloc(w * h * 4);
-        if(!orig_data) {
-            continue;
-        }
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, orig_data);
+        if(!texture_arr_blit_elem(fbos, mats[i].texture.id, out->id, i))
+            texture_arr_copy_elem_cpu(mats[i].texture.id, out->id, i);
+    }
 
-        GLubyte *resized_data = malloc(CONFIG_ARR_TEX_RES * CONFIG_ARR_TEX_RES * 4);
-        if(!resized_data) {
-            free(orig_data);
-            continue;
-        }
-        int res = stbir_resize_uint8(orig_data, w, h, 0, resized_data, CONFIG_ARR_TEX_RES, CONFIG_ARR_TEX_RES, 0, 4);
-        if(res != 1) {
-            free(orig_data);
-            free(resized_data);
-            continue;
-        }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_read_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_draw_fbo);
+    glDeleteFramebuffers(2, fbos);
 
-        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, CONFIG_ARR_TEX_RES, 
-            CONFIG_ARR_TEX_RES, 1, GL_RGBA, GL_UNSIGNED_BYTE, resized_data);
-        free(orig_data);
-        free(resized_data);
-    }
+    glActiveTexture(tunit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, out->id);
 
     glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -618,6 +702,7 @@ void R_GL_Texture_BindArray(const struct texture_arr *arr, GLuint shader_prog)
 
     glActiveTexture(arr->tunit);
     glBindTexture(GL_TEXTURE_2D_ARRAY, arr->id);
+    R_GL_StatsTexBind();
 
     R_GL_StateSet(unit_name[idx], (struct uval){
         .type = UTYPE_INT,
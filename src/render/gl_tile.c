@@ -57,9 +57,12 @@
 #include <stddef.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
   
 
 #define ARR_SIZE(a)                 (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)                   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)                   ((a) > (b) ? (a) : (b))
 #define MAG(x, y)                   sqrt(pow(x,2) + pow(y,2))
 #define VEC3_EQUAL(a, b)            (0 == memcmp((a).raw, (b).raw, sizeof((a).raw)))
 
@@ -540,103 +543,9 @@ static float tile_min_visible_height(const struct map *map, struct tile_desc til
     return arr_min(heights, ARR_SIZE(heights)) * Y_COORDS_PER_TILE;
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
-
-void R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rprivate, mat4x4_t *model, 
-                           const int *tiles_per_chunk_x, const int *tiles_per_chunk_z)
-{
-    GL_PERF_ENTER();
-    ASSERT_IN_RENDER_THREAD();
-
-    struct terrain_vert vbuff[VERTS_PER_TILE];
-    vec4_t red = (vec4_t){1.0f, 0.0f, 0.0f, 1.0};
-    GLuint VAO, VBO;
-
-    const struct render_private *priv = chunk_rprivate;
-    size_t offset = (in->tile_r * (*tiles_per_chunk_x) + in->tile_c) * VERTS_PER_TILE * sizeof(struct terrain_vert);
-    size_t length = VERTS_PER_TILE * sizeof(struct terrain_vert);
-
-    glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
-    const struct terrain_vert *vert_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_READ_BIT);
-    assert(vert_base);
-    memcpy(vbuff, vert_base, sizeof(vbuff));
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-
-    /* Additionally, scale the tile selection mesh slightly around its' center. This is so that 
-     * it is slightly larger than the actual tile underneath and can be rendered on top of it. */
-    const float SCALE_FACTOR = 1.025f;
-    mat4x4_t final_model;
-    mat4x4_t scale, trans, trans_inv, tmp1, tmp2;
-    PFM_Mat4x4_MakeScale(SCALE_FACTOR, SCALE_FACTOR, SCALE_FACTOR, &scale);
-
-    vec3_t center = (vec3_t){
-        ( 0.0f - (in->tile_c* X_COORDS_PER_TILE) - X_COORDS_PER_TILE/2.0f ), 
-        (-TILE_DEPTH * Y_COORDS_PER_TILE - Y_COORDS_PER_TILE/2.0f), 
-        ( 0.0f + (in->tile_r* Z_COORDS_PER_TILE) + Z_COORDS_PER_TILE/2.0f),
-    };
-    PFM_Mat4x4_MakeTrans(-center.x, -center.y, -center.z, &trans);
-    PFM_Mat4x4_MakeTrans( center.x,  center.y,  center.z, &trans_inv);
-
-    PFM_Mat4x4_Mult4x4(&scale, &trans, &tmp1);
-    PFM_Mat4x4_Mult4x4(&trans_inv, &tmp1, &tmp2);
-    PFM_Mat4x4_Mult4x4(model, &tmp2, &final_model);
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    /* Attribute 0 - position */
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct terrain_vert), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    /* Attribute 1 - texture coordinates */
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct terrain_vert), 
-        (void*)offsetof(struct terrain_vert, uv));
-    glEnableVertexAttribArray(1);
-
-    /* Attribute 2 - normal */
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct terrain_vert), 
-        (void*)offsetof(struct terrain_vert, normal));
-    glEnableVertexAttribArray(2);
-
-    /* Set uniforms */
-    R_GL_StateSet(GL_U_MODEL, (struct uval){
-        .type = UTYPE_MAT4,
-        .val.as_mat4 = final_model
-    });
-
-    R_GL_StateSet(GL_U_COLOR, (struct uval){
-        .type = UTYPE_VEC4,
-        .val.as_vec4 = red
-    });
-
-    R_GL_Shader_Install("mesh.static.tile-outline");
-
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vbuff), vbuff, GL_STATIC_DRAW);
-
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, VERTS_PER_TILE);
-
-    /* cleanup */
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-
-    GL_PERF_RETURN_VOID();
-}
-
-void R_GL_TilePatchVertsBlend(void *chunk_rprivate, const struct map *map, const struct tile_desc *tile)
+static void tile_patch_verts_blend(const struct map *map, const struct tile_desc *tile, 
+                                   struct terrain_vert *tile_verts_base)
 {
-    ASSERT_IN_RENDER_THREAD();
-
-    const struct render_private *priv = chunk_rprivate;
-    GLuint VBO = priv->mesh.VBO;
-
     struct map_resolution res;
     M_GetResolution(map, &res);
 
@@ -790,14 +699,6 @@ void R_GL_TilePatchVertsBlend(void *chunk_rprivate, const struct map *map, const
      * 'tb_indices' and 'lr_indices' hold the materials at the midpoints of the edges of this 
      * tile and 'middle_indices' hold the materials for the center of the tile.
      */
-    size_t offset = VERTS_PER_TILE * (tile->tile_r * TILES_PER_CHUNK_WIDTH + tile->tile_c) * sizeof(struct terrain_vert);
-    size_t length = VERTS_PER_TILE * sizeof(struct terrain_vert);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    struct terrain_vert *tile_verts_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
-    GL_ASSERT_OK();
-    assert(tile_verts_base);
-
     struct terrain_vert *south_provoking[2] = {tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 0*3,
                                                tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 1*3};
     struct terrain_vert *west_provoking[2]  = {tile_verts_base + (4 * VERTS_PER_SIDE_FACE) + 2*3,
@@ -851,26 +752,12 @@ void R_GL_TilePatchVertsBlend(void *chunk_rprivate, const struct map *map, const
         provoking[i]->middle_indices = curr.middle_mask;
         provoking[i]->blend_mode = optimal_blendmode(provoking[i]);
     }
-
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    GL_ASSERT_OK();
 }
 
-void R_GL_TilePatchVertsSmooth(void *chunk_rprivate, const struct map *map, const struct tile_desc *tile)
+static void tile_patch_verts_smooth(const struct map *map, const struct tile_desc *tile, 
+                                    struct terrain_vert *tile_verts_base)
 {
-    ASSERT_IN_RENDER_THREAD();
-
-    const struct render_private *priv = chunk_rprivate;
-    GLuint VBO = priv->mesh.VBO;
-
-    size_t offset = VERTS_PER_TILE * (tile->tile_r * TILES_PER_CHUNK_WIDTH + tile->tile_c) * sizeof(struct terrain_vert);
-    size_t length = VERTS_PER_TILE * sizeof(struct terrain_vert);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    union top_face_vbuff *tfvb = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
-    GL_ASSERT_OK();
-    assert(tfvb);
-    tfvb = (union top_face_vbuff*)(((struct terrain_vert*)tfvb) + (4 * VERTS_PER_SIDE_FACE));
+    union top_face_vbuff *tfvb = (union top_face_vbuff*)(tile_verts_base + (4 * VERTS_PER_SIDE_FACE));
 
     struct map_resolution res;
     M_GetResolution(map, &res);
@@ -964,6 +851,140 @@ void R_GL_TilePatchVertsSmooth(void *chunk_rprivate, const struct map *map, cons
     tfvb->center5.normal = center_norm;
     tfvb->center6.normal = center_norm;
     tfvb->center7.normal = center_norm;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rprivate, mat4x4_t *model, 
+                           const int *tiles_per_chunk_x, const int *tiles_per_chunk_z)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+
+    struct terrain_vert vbuff[VERTS_PER_TILE];
+    vec4_t red = (vec4_t){1.0f, 0.0f, 0.0f, 1.0};
+    GLuint VAO, VBO;
+
+    const struct render_private *priv = chunk_rprivate;
+    size_t offset = (in->tile_r * (*tiles_per_chunk_x) + in->tile_c) * VERTS_PER_TILE * sizeof(struct terrain_vert);
+    size_t length = VERTS_PER_TILE * sizeof(struct terrain_vert);
+
+    glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
+    const struct terrain_vert *vert_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_READ_BIT);
+    assert(vert_base);
+    memcpy(vbuff, vert_base, sizeof(vbuff));
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    /* Additionally, scale the tile selection mesh slightly around its' center. This is so that 
+     * it is slightly larger than the actual tile underneath and can be rendered on top of it. */
+    const float SCALE_FACTOR = 1.025f;
+    mat4x4_t final_model;
+    mat4x4_t scale, trans, trans_inv, tmp1, tmp2;
+    PFM_Mat4x4_MakeScale(SCALE_FACTOR, SCALE_FACTOR, SCALE_FACTOR, &scale);
+
+    vec3_t center = (vec3_t){
+        ( 0.0f - (in->tile_c* X_COORDS_PER_TILE) - X_COORDS_PER_TILE/2.0f ), 
+        (-TILE_DEPTH * Y_COORDS_PER_TILE - Y_COORDS_PER_TILE/2.0f), 
+        ( 0.0f + (in->tile_r* Z_COORDS_PER_TILE) + Z_COORDS_PER_TILE/2.0f),
+    };
+    PFM_Mat4x4_MakeTrans(-center.x, -center.y, -center.z, &trans);
+    PFM_Mat4x4_MakeTrans( center.x,  center.y,  center.z, &trans_inv);
+
+    PFM_Mat4x4_Mult4x4(&scale, &trans, &tmp1);
+    PFM_Mat4x4_Mult4x4(&trans_inv, &tmp1, &tmp2);
+    PFM_Mat4x4_Mult4x4(model, &tmp2, &final_model);
+
+    /* OpenGL setup */
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+
+    glGenBuffers(1, &VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    /* Attribute 0 - position */
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct terrain_vert), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    /* Attribute 1 - texture coordinates */
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct terrain_vert), 
+        (void*)offsetof(struct terrain_vert, uv));
+    glEnableVertexAttribArray(1);
+
+    /* Attribute 2 - normal */
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct terrain_vert), 
+        (void*)offsetof(struct terrain_vert, normal));
+    glEnableVertexAttribArray(2);
+
+    /* Set uniforms */
+    R_GL_StateSet(GL_U_MODEL, (struct uval){
+        .type = UTYPE_MAT4,
+        .val.as_mat4 = final_model
+    });
+
+    R_GL_StateSet(GL_U_COLOR, (struct uval){
+        .type = UTYPE_VEC4,
+        .val.as_vec4 = red
+    });
+
+    R_GL_Shader_Install("mesh.static.tile-outline");
+
+    /* buffer & render */
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vbuff), vbuff, GL_STATIC_DRAW);
+
+    glBindVertexArray(VAO);
+    glDrawArrays(GL_TRIANGLES, 0, VERTS_PER_TILE);
+    R_GL_StatsDraw(GL_TRIANGLES, VERTS_PER_TILE, 1);
+
+    /* cleanup */
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+
+    GL_PERF_RETURN_VOID();
+}
+
+void R_GL_TilePatchVertsBlend(void *chunk_rprivate, const struct map *map, const struct tile_desc *tile)
+{
+    ASSERT_IN_RENDER_THREAD();
+    R_GL_ShadowsInvalidateStatic();
+    R_GL_MapInvalidateBake(tile->chunk_r, tile->chunk_c);
+
+    const struct render_private *priv = chunk_rprivate;
+    GLuint VBO = priv->mesh.VBO;
+
+    size_t offset = VERTS_PER_TILE * (tile->tile_r * TILES_PER_CHUNK_WIDTH + tile->tile_c) * sizeof(struct terrain_vert);
+    size_t length = VERTS_PER_TILE * sizeof(struct terrain_vert);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    struct terrain_vert *tile_verts_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
+    GL_ASSERT_OK();
+    assert(tile_verts_base);
+
+    tile_patch_verts_blend(map, tile, tile_verts_base);
+
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    GL_ASSERT_OK();
+}
+
+void R_GL_TilePatchVertsSmooth(void *chunk_rprivate, const struct map *map, const struct tile_desc *tile)
+{
+    ASSERT_IN_RENDER_THREAD();
+    R_GL_ShadowsInvalidateStatic();
+    R_GL_MapInvalidateBake(tile->chunk_r, tile->chunk_c);
+
+    const struct render_private *priv = chunk_rprivate;
+    GLuint VBO = priv->mesh.VBO;
+
+    size_t offset = VERTS_PER_TILE * (tile->tile_r * TILES_PER_CHUNK_WIDTH + tile->tile_c) * sizeof(struct terrain_vert);
+    size_t length = VERTS_PER_TILE * sizeof(struct terrain_vert);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    struct terrain_vert *tile_verts_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
+    GL_ASSERT_OK();
+    assert(tile_verts_base);
+
+    tile_patch_verts_smooth(map, tile, tile_verts_base);
 
     glUnmapBuffer(GL_ARRAY_BUFFER);
     GL_ASSERT_OK();
@@ -973,6 +994,8 @@ void R_GL_TileUpdate(void *chunk_rprivate, const struct map *map, const struct t
 {
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
+    R_GL_ShadowsInvalidateStatic();
+    R_GL_MapInvalidateBake(desc->chunk_r, desc->chunk_c);
 
     struct render_private *priv = chunk_rprivate;
 
@@ -998,6 +1021,61 @@ void R_GL_TileUpdate(void *chunk_rprivate, const struct map *map, const struct t
     GL_PERF_RETURN_VOID();
 }
 
+void R_GL_TileUpdateBatch(void *chunk_rprivate, const struct map *map, 
+                          const size_t *ntiles, const struct tile_desc *descs)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+    R_GL_ShadowsInvalidateStatic();
+
+    struct render_private *priv = chunk_rprivate;
+    if(*ntiles == 0)
+        GL_PERF_RETURN_VOID();
+
+    /* All the tiles of the batch belong to the same chunk */
+    R_GL_MapInvalidateBake(descs[0].chunk_r, descs[0].chunk_c);
+
+    int min_idx = INT_MAX, max_idx = INT_MIN;
+    for(int i = 0; i < *ntiles; i++) {
+        int idx = descs[i].tile_r * TILES_PER_CHUNK_WIDTH + descs[i].tile_c;
+        min_idx = MIN(min_idx, idx);
+        max_idx = MAX(max_idx, idx);
+    }
+
+    /* Map the range spanning all the tiles. Without the invalidate bit, the 
+     * contents of the range that are not written are left untouched. */
+    size_t offset = min_idx * VERTS_PER_TILE * sizeof(struct terrain_vert);
+    size_t length = (max_idx - min_idx + 1) * VERTS_PER_TILE * sizeof(struct terrain_vert);
+    glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
+    struct terrain_vert *vert_base = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, GL_MAP_WRITE_BIT);
+    assert(vert_base);
+
+    for(int i = 0; i < *ntiles; i++) {
+
+        int idx = descs[i].tile_r * TILES_PER_CHUNK_WIDTH + descs[i].tile_c;
+        struct terrain_vert *verts = vert_base + (idx - min_idx) * VERTS_PER_TILE;
+
+        R_TileGetVertices(map, descs[i], verts);
+        R_TilePatchVertices(map, descs[i], verts);
+    }
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+void R_TilePatchVertices(const struct map *map, struct tile_desc td, struct terrain_vert *inout)
+{
+    struct tile *tile;
+    int ret = M_TileForDesc(map, td, &tile);
+    assert(ret);
+
+    tile_patch_verts_blend(map, &td, inout);
+    if(tile->blend_normals) {
+        tile_patch_verts_smooth(map, &td, inout);
+    }
+}
+
 void R_TileGetVertices(const struct map *map, struct tile_desc td, struct terrain_vert *out)
 {
     PERF_ENTER();
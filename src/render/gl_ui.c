@@ -40,6 +40,7 @@
 #include "gl_shader.h"
 #include "gl_render.h"
 #include "gl_perf.h"
+#include "gl_ringbuffer.h"
 #include "../main.h"
 #include "../lib/public/pf_nuklear.h"
 #include "../lib/public/stb_image.h"
@@ -49,22 +50,29 @@
 
 #include <GL/glew.h>
 
+/* The UI geometry is streamed into ringbuffers which can hold a few frames' 
+ * worth of the maximum vertex and element data produced by the UI module. 
+ */
+#define VERT_RING_SZ    (8 * 1024 * 1024)
+#define ELEM_RING_SZ    (2 * 1024 * 1024)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static struct render_ui_ctx{
-    GLuint font_tex;
-    GLuint VBO;
-    GLuint EBO;
-    GLuint VAO;
+    GLuint          font_tex;
+    GLuint          VAO;
+    struct gl_ring *vert_ring;
+    struct gl_ring *elem_ring;
 }s_ctx;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog)
+static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog,
+                               bool draw, GLint base_vertex, size_t elem_begin)
 {
     GL_PERF_ENTER();
 
@@ -73,7 +81,7 @@ static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog
 
     struct nk_vec2i curr_vres = (struct nk_vec2i){w, h};
     const struct nk_draw_command *cmd;
-    const nk_draw_index *offset = NULL;
+    const nk_draw_index *offset = (const nk_draw_index*)elem_begin;
 
     mat4x4_t ortho;
     PFM_Mat4x4_MakeOrthographic(0.0f, curr_vres.x, curr_vres.y, 0.0f, -1.0f, 1.0f, &ortho);
@@ -119,7 +127,9 @@ static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog
             PF_FREE(ud);
         }
 
-        if(!cmd->elem_count) 
+        /* The commands must still be walked to consume their userdata,
+         * even when the geometry could not be submitted */
+        if(!cmd->elem_count || !draw) 
             continue;
 
         struct texture tex = (struct texture){cmd->texture.id, GL_TEXTURE0};
@@ -129,7 +139,9 @@ static void exec_draw_commands(const struct nk_draw_list *dl, GLuint shader_prog
             h - (GLint)((cmd->clip_rect.y + cmd->clip_rect.h) / (float)curr_vres.y * h),
             (GLint)(cmd->clip_rect.w / (float)curr_vres.x * w),
             (GLint)(cmd->clip_rect.h / (float)curr_vres.y * h));
-        glDrawElements(GL_TRIANGLES, (GLsizei)cmd->elem_count, GL_UNSIGNED_INT, offset);
+        glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)cmd->elem_count, GL_UNSIGNED_INT, 
+            (void*)offset, base_vertex);
+        R_GL_StatsDraw(GL_TRIANGLES, cmd->elem_count, 1);
 
         offset += cmd->elem_count;
     }
@@ -157,13 +169,15 @@ void R_GL_UI_Init(void)
     size_t vt = offsetof(struct ui_vert, uv);
     size_t vc = offsetof(struct ui_vert, color);
 
-    glGenBuffers(1, &s_ctx.VBO);
-    glGenBuffers(1, &s_ctx.EBO);
+    s_ctx.vert_ring = R_GL_RingbufferInit(VERT_RING_SZ, RING_UBYTE, 0);
+    s_ctx.elem_ring = R_GL_RingbufferInit(ELEM_RING_SZ, RING_UBYTE, 0);
+    assert(s_ctx.vert_ring && s_ctx.elem_ring);
+
     glGenVertexArrays(1, &s_ctx.VAO);
 
     glBindVertexArray(s_ctx.VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.VBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_ctx.EBO);
+    glBindBuffer(GL_ARRAY_BUFFER, R_GL_RingbufferGetVBO(s_ctx.vert_ring));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, R_GL_RingbufferGetVBO(s_ctx.elem_ring));
 
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
@@ -175,9 +189,9 @@ void R_GL_UI_Init(void)
 
     /* unbind context */
     glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
 
     GL_ASSERT_OK();
 }
@@ -189,8 +203,8 @@ void R_GL_UI_Shutdown(void)
     if(s_ctx.font_tex) {
         glDeleteTextures(1, &s_ctx.font_tex);
     }
-    glDeleteBuffers(1, &s_ctx.VBO);
-    glDeleteBuffers(1, &s_ctx.EBO);
+    R_GL_RingbufferDestroy(s_ctx.vert_ring);
+    R_GL_RingbufferDestroy(s_ctx.elem_ring);
     glDeleteVertexArrays(1, &s_ctx.VAO);
 
     GL_ASSERT_OK();
@@ -200,6 +214,7 @@ void R_GL_UI_Render(const struct nk_draw_list *dl)
 {
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_UI);
 
     /* setup global state */
     glEnable(GL_BLEND);
@@ -218,24 +233,47 @@ void R_GL_UI_Render(const struct nk_draw_list *dl)
     assert(shader_prog);
     R_GL_Shader_InstallProg(shader_prog);
 
-    /* setup buffers */
-    glBindVertexArray(s_ctx.VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.VBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_ctx.EBO);
+    /* Write the geometry straight into the (persistently mapped, when 
+     * supported) ringbuffers. The vertices are addressed with a base 
+     * vertex, so they must start at a multiple of the vertex size. */
+    size_t vsize = dl->vertices->memory.size;
+    size_t esize = dl->elements->memory.size;
+    size_t vbegin = 0, vend = 0, ebegin = 0, eend = 0;
+
+    bool vpushed = (vsize > 0) && R_GL_RingbufferPushContiguous(s_ctx.vert_ring, 
+        dl->vertices->memory.ptr, vsize, sizeof(struct ui_vert));
+    bool epushed = (esize > 0) && R_GL_RingbufferPushContiguous(s_ctx.elem_ring, 
+        dl->elements->memory.ptr, esize, sizeof(nk_draw_index));
 
-    glBufferData(GL_ARRAY_BUFFER, dl->vertices->memory.size, dl->vertices->memory.ptr, GL_STREAM_DRAW);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, dl->elements->memory.size, dl->elements->memory.ptr, GL_STREAM_DRAW);
+    if(vpushed) {
+        R_GL_RingbufferGetLastRange(s_ctx.vert_ring, &vbegin, &vend);
+    }
+    if(epushed) {
+        R_GL_RingbufferGetLastRange(s_ctx.elem_ring, &ebegin, &eend);
+    }
+
+    glBindVertexArray(s_ctx.VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, R_GL_RingbufferGetVBO(s_ctx.elem_ring));
 
     /* iterate over and execute each draw command */
-    exec_draw_commands(dl, shader_prog);
+    exec_draw_commands(dl, shader_prog, vpushed && epushed, 
+        vbegin / sizeof(struct ui_vert), ebegin);
+
+    if(vpushed) {
+        R_GL_RingbufferSyncLast(s_ctx.vert_ring);
+    }
+    if(epushed) {
+        R_GL_RingbufferSyncLast(s_ctx.elem_ring);
+    }
 
     /* cleanup state */
+    glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
     glDisable(GL_BLEND);
     glDisable(GL_SCISSOR_TEST);
 
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_UI);
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
@@ -245,7 +283,11 @@ void R_GL_UI_UploadFontAtlas(void *image, const int *w, const int *h)
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
 
-    glGenTextures(1, &s_ctx.font_tex);
+    /* The atlas may be re-baked as fonts are loaded. Keep the same texture 
+     * so that the handles baked into the fonts stay valid. */
+    if(!s_ctx.font_tex) {
+        glGenTextures(1, &s_ctx.font_tex);
+    }
     glBindTexture(GL_TEXTURE_2D, s_ctx.font_tex);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -66,6 +66,28 @@ struct anim_vert{
     GLfloat weights[6];
 };
 
+/* The vertices of the PFOBJ meshes are converted to these compact layouts
+ * when loading. The UVs are stored as half floats, the normals as signed 
+ * normalized GL_INT_2_10_10_10_REV and the joint weights as unsigned 
+ * normalized bytes. All of these are expanded back to floats by the vertex 
+ * fetch, so the shaders see the same inputs as with the full-float layouts.
+ */
+#define PACKED_VERTEX_BASE      \
+    vec3_t  pos;                \
+    GLhalf  uv[2];              \
+    GLuint  normal;             \
+    GLint   material_idx;       \
+
+struct packed_vert{
+    PACKED_VERTEX_BASE
+};
+
+struct packed_anim_vert{
+    PACKED_VERTEX_BASE
+    GLubyte joint_indices[6];
+    GLubyte weights[6];
+};
+
 struct terrain_vert{
     VERTEX_BASE
     uint16_t  blend_mode;
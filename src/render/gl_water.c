@@ -57,12 +57,31 @@
 #include <math.h>
 
 
+/* The offscreen buffers are kept around between frames and are only 
+ * re-created when the size they should be rendered at changes.
+ */
+struct water_buffs{
+    int    width, height;
+    GLuint refract_fb;
+    GLuint refract_tex;
+    GLuint refract_depth;
+    GLuint reflect_fb;
+    GLuint reflect_tex;
+    GLuint reflect_depth;
+};
+
 struct render_water_ctx{
-    struct mesh    surface;
-    struct texture dudv;
-    struct texture normal;
-    GLfloat        move_factor;
-    uint32_t       prev_frame_tick;
+    struct mesh        surface;
+    struct texture     dudv;
+    struct texture     normal;
+    GLfloat            move_factor;
+    uint32_t           prev_frame_tick;
+    struct water_buffs buffs;
+    /* The reflection texture holds the result of an earlier frame that
+     * may be re-used, rendered with the 'reflect_on' setting */
+    bool               reflect_valid;
+    bool               reflect_on;
+    int                frames_since_reflect;
 };
 
 struct water_gl_state{
@@ -87,11 +106,16 @@ struct water_gl_state{
 #define REFRACT_DEPTH_TUNIT GL_TEXTURE4
 #define VISBUFF_TUNIT       GL_TEXTURE5
 
+#define DEFAULT_RES_SCALE   (0.4f)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static struct render_water_ctx s_ctx;
+/* Set from the 'pf.video.water_*' settings */
+static float                   s_res_scale = DEFAULT_RES_SCALE;
+static int                     s_reflect_interval = 1;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -135,7 +159,8 @@ static int wbuff_width(void)
 
     int viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
-    return viewport[2] / 2.5f;
+    int ret = viewport[2] * s_res_scale;
+    return (ret > 0) ? ret : 1;
 }
 
 static int wbuff_height(int width)
@@ -145,7 +170,8 @@ static int wbuff_height(int width)
     int viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
     float ar = (float)viewport[2] / viewport[3];
-    return width / ar;
+    int ret = width / ar;
+    return (ret > 0) ? ret : 1;
 }
 
 static GLuint make_new_tex(int width, int height)
@@ -183,31 +209,85 @@ static GLuint make_new_depth_tex(int width, int height)
     GL_PERF_RETURN(ret);
 }
 
-static void render_refraction_tex(GLuint clr_tex, GLuint depth_tex, bool on, struct render_input in)
+static void water_buffs_free(struct water_buffs *buffs)
 {
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
-    GL_PERF_PUSH_GROUP(0, "water::render_refraction_tex");
 
-    GLint texw, texh;
-    glBindTexture(GL_TEXTURE_2D, clr_tex);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &texw);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &texh);
+    if(buffs->width == 0)
+        GL_PERF_RETURN_VOID();
+
+    glDeleteFramebuffers(1, &buffs->refract_fb);
+    glDeleteTextures(1, &buffs->refract_tex);
+    glDeleteTextures(1, &buffs->refract_depth);
+    glDeleteFramebuffers(1, &buffs->reflect_fb);
+    glDeleteTextures(1, &buffs->reflect_tex);
+    glDeleteRenderbuffers(1, &buffs->reflect_depth);
+
+    memset(buffs, 0, sizeof(*buffs));
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+static void water_buffs_update(struct water_buffs *buffs, int width, int height)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
 
-    /* Create framebuffer object */
-    GLuint fb;
-    glGenFramebuffers(1, &fb);
-    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+    if(buffs->width == width && buffs->height == height)
+        GL_PERF_RETURN_VOID();
 
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_tex, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, clr_tex, 0);
+    GLint prev_fb;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fb);
+    water_buffs_free(buffs);
+
+    buffs->width = width;
+    buffs->height = height;
+
+    buffs->refract_tex = make_new_tex(width, height);
+    buffs->refract_depth = make_new_depth_tex(width, height);
+    assert(buffs->refract_tex > 0 && buffs->refract_depth > 0);
+
+    glGenFramebuffers(1, &buffs->refract_fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, buffs->refract_fb);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, buffs->refract_depth, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, buffs->refract_tex, 0);
 
     GLenum draw_buffs[1] = {GL_COLOR_ATTACHMENT0};
     glDrawBuffers(ARR_SIZE(draw_buffs), draw_buffs);
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
 
+    buffs->reflect_tex = make_new_tex(width, height);
+    assert(buffs->reflect_tex > 0);
+
+    glGenFramebuffers(1, &buffs->reflect_fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, buffs->reflect_fb);
+
+    glGenRenderbuffers(1, &buffs->reflect_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, buffs->reflect_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, buffs->reflect_depth);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, buffs->reflect_tex, 0);
+
+    glDrawBuffers(ARR_SIZE(draw_buffs), draw_buffs);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fb);
+    s_ctx.reflect_valid = false;
+
+    GL_ASSERT_OK();
+    GL_PERF_RETURN_VOID();
+}
+
+static void render_refraction_tex(const struct water_buffs *buffs, bool on, struct render_input in)
+{
+    GL_PERF_ENTER();
+    ASSERT_IN_RENDER_THREAD();
+    GL_PERF_PUSH_GROUP(0, "water::render_refraction_tex");
+
     /* Render to the texture */
-    glViewport(0, 0, texw, texh);
+    glBindFramebuffer(GL_FRAMEBUFFER, buffs->refract_fb);
+    glViewport(0, 0, buffs->width, buffs->height);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     if(on) {
@@ -216,8 +296,6 @@ static void render_refraction_tex(GLuint clr_tex, GLuint depth_tex, bool on, str
         GL_PERF_POP_GROUP();
     }
 
-    /* Clean up framebuffer */
-    glDeleteFramebuffers(1, &fb);
     glDisable(GL_CLIP_DISTANCE0);
 
     GL_PERF_POP_GROUP();
@@ -225,42 +303,20 @@ static void render_refraction_tex(GLuint clr_tex, GLuint depth_tex, bool on, str
     GL_PERF_RETURN_VOID();
 }
 
-static void render_reflection_tex(GLuint tex, bool on, struct render_input in)
+static void render_reflection_tex(const struct water_buffs *buffs, bool on, struct render_input in)
 {
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
     GL_PERF_PUSH_GROUP(0, "water::render_reflection_tex");
 
-    GLint texw, texh;
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &texw);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &texh);
-
-    /* Create framebuffer object */
-    GLuint fb;
-    glGenFramebuffers(1, &fb);
-    glBindFramebuffer(GL_FRAMEBUFFER, fb);
-
-    GLuint depth_rb;
-    glGenRenderbuffers(1, &depth_rb);
-    glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, texw, texh);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex, 0);
-
-    GLenum draw_buffs[1] = {GL_COLOR_ATTACHMENT0};
-    glDrawBuffers(ARR_SIZE(draw_buffs), draw_buffs);
-    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-
     /* Clear buffers */
-    glViewport(0, 0, texw, texh);
+    glBindFramebuffer(GL_FRAMEBUFFER, buffs->reflect_fb);
+    glViewport(0, 0, buffs->width, buffs->height);
     glClearColor(SKY_CLR[0], SKY_CLR[1], SKY_CLR[2], SKY_CLR[3]);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     if(!on) {
 
-        glDeleteRenderbuffers(1, &depth_rb);
-        glDeleteFramebuffers(1, &fb);
         GL_PERF_POP_GROUP();
         GL_ASSERT_OK();
         GL_PERF_RETURN_VOID(); 
@@ -292,9 +348,6 @@ static void render_reflection_tex(GLuint tex, bool on, struct render_input in)
     G_RenderMapAndEntities(&in);
     GL_PERF_POP_GROUP();
 
-    /* Clean up framebuffer */
-    glDeleteRenderbuffers(1, &depth_rb);
-    glDeleteFramebuffers(1, &fb);
     glDisable(GL_CLIP_DISTANCE0);
     glEnable(GL_CULL_FACE);
 
@@ -313,6 +366,7 @@ static void setup_texture_uniforms(GLuint shader_prog, GLuint refract_tex,
 	/* refraction texture */
     glActiveTexture(REFRACT_TUNIT);
     glBindTexture(GL_TEXTURE_2D, refract_tex);
+    R_GL_StatsTexBind();
 
     R_GL_StateSet(GL_U_REFRACT_TEX, (struct uval){
         .type = UTYPE_INT,
@@ -323,6 +377,7 @@ static void setup_texture_uniforms(GLuint shader_prog, GLuint refract_tex,
 	/* refraction depth texture */
     glActiveTexture(REFRACT_DEPTH_TUNIT);
     glBindTexture(GL_TEXTURE_2D, refract_depth);
+    R_GL_StatsTexBind();
 
     R_GL_StateSet(GL_U_REFRACT_DEPTH, (struct uval){
         .type = UTYPE_INT,
@@ -333,6 +388,7 @@ static void setup_texture_uniforms(GLuint shader_prog, GLuint refract_tex,
 	/* reflection texture */
     glActiveTexture(REFLECT_TUNIT);
     glBindTexture(GL_TEXTURE_2D, reflect_tex);
+    R_GL_StatsTexBind();
 
     R_GL_StateSet(GL_U_REFLECT_TEX, (struct uval){
         .type = UTYPE_INT,
@@ -376,6 +432,7 @@ static void setup_map_uniforms(GLuint shader_prog)
 	/* DUDV map */
     glActiveTexture(s_ctx.dudv.tunit);
     glBindTexture(GL_TEXTURE_2D, s_ctx.dudv.id);
+    R_GL_StatsTexBind();
 
     R_GL_StateSet(GL_U_DUDV_MAP, (struct uval){
         .type = UTYPE_INT,
@@ -386,6 +443,7 @@ static void setup_map_uniforms(GLuint shader_prog)
 	/* normal map */
     glActiveTexture(s_ctx.normal.tunit);
     glBindTexture(GL_TEXTURE_2D, s_ctx.normal.id);
+    R_GL_StatsTexBind();
 
     R_GL_StateSet(GL_U_NORMAL_MAP, (struct uval){
         .type = UTYPE_INT,
@@ -552,6 +610,7 @@ void R_GL_WaterShutdown(void)
 
     glDeleteVertexArrays(1, &s_ctx.surface.VAO);
     glDeleteBuffers(1, &s_ctx.surface.VBO);
+    water_buffs_free(&s_ctx.buffs);
     memset(&s_ctx, 0, sizeof(s_ctx));
 
     GL_PERF_RETURN_VOID();
@@ -562,24 +621,34 @@ void R_GL_DrawWater(const struct render_input *in, const bool *refraction, const
     GL_PERF_ENTER();
     ASSERT_IN_RENDER_THREAD();
     GL_PERF_PUSH_GROUP(0, "water");
+    R_GL_StatsGPUBegin(RENDER_GPU_PASS_WATER);
 
     struct water_gl_state state;
     save_gl_state(&state);
 
     int w = wbuff_width();
     int h = wbuff_height(w);
-
-    GLuint refract_tex = make_new_tex(w, h);
-    assert(refract_tex > 0);
-
-    GLuint refract_depth = make_new_depth_tex(w, h);
-    assert(refract_depth > 0);
-
-    render_refraction_tex(refract_tex, refract_depth, *refraction, *in);
-
-    GLuint reflect_tex = make_new_tex(w, h);
-    assert(reflect_tex > 0);
-    render_reflection_tex(reflect_tex, *reflection, *in);
+    water_buffs_update(&s_ctx.buffs, w, h);
+
+    R_GL_StatsPushPass(RENDER_STAT_PASS_REFRACTION);
+    render_refraction_tex(&s_ctx.buffs, *refraction, *in);
+    R_GL_StatsPopPass();
+
+    /* The reflection is the most expensive pass, as nothing can be culled 
+     * against the real camera. It may be configured to be refreshed only 
+     * every few frames, re-using the last result in between. */
+    s_ctx.frames_since_reflect++;
+    if(!s_ctx.reflect_valid
+    || (s_ctx.reflect_on != *reflection)
+    || (s_ctx.frames_since_reflect >= s_reflect_interval)) {
+
+        R_GL_StatsPushPass(RENDER_STAT_PASS_REFLECTION);
+        render_reflection_tex(&s_ctx.buffs, *reflection, *in);
+        R_GL_StatsPopPass();
+        s_ctx.reflect_valid = true;
+        s_ctx.reflect_on = *reflection;
+        s_ctx.frames_since_reflect = 0;
+    }
 
     restore_gl_state(&state);
 
@@ -588,7 +657,8 @@ void R_GL_DrawWater(const struct render_input *in, const bool *refraction, const
 
     setup_map_uniforms(shader_prog);
     setup_cam_uniforms(shader_prog);
-    setup_texture_uniforms(shader_prog, refract_tex, refract_depth, reflect_tex);
+    setup_texture_uniforms(shader_prog, s_ctx.buffs.refract_tex, 
+        s_ctx.buffs.refract_depth, s_ctx.buffs.reflect_tex);
     setup_fog_uniforms(shader_prog, in->map);
     setup_model_mat(shader_prog, in->map);
     setup_move_factor(shader_prog);
@@ -600,16 +670,26 @@ void R_GL_DrawWater(const struct render_input *in, const bool *refraction, const
 
     glBindVertexArray(s_ctx.surface.VAO);
     glDrawArrays(GL_TRIANGLES, 0, s_ctx.surface.num_verts);
+    R_GL_StatsDraw(GL_TRIANGLES, s_ctx.surface.num_verts, 1);
 
     glDepthMask(GL_TRUE);
     glDisable(GL_BLEND);
 
-    glDeleteTextures(1, &refract_tex);
-    glDeleteTextures(1, &refract_depth);
-    glDeleteTextures(1, &reflect_tex);
-
+    R_GL_StatsGPUEnd(RENDER_GPU_PASS_WATER);
     GL_PERF_POP_GROUP();
     GL_ASSERT_OK();
     GL_PERF_RETURN_VOID();
 }
 
+void R_GL_WaterSetResolutionScale(const float *scale)
+{
+    ASSERT_IN_RENDER_THREAD();
+    s_res_scale = *scale;
+}
+
+void R_GL_WaterSetReflectInterval(const int *interval)
+{
+    ASSERT_IN_RENDER_THREAD();
+    s_reflect_interval = *interval;
+}
+
@@ -283,6 +283,14 @@ void   R_GL_DrawCombinedHRVO(vec2_t *apexes, vec2_t *left_rays, vec2_t *right_ra
  */
 void   R_GL_TimestampForCookie(uint32_t *cookie, uint64_t *out);
 
+/* ---------------------------------------------------------------------------
+ * Turn the GPU timers of the major passes on or off. The timings can then 
+ * be read with 'R_GetGPUTimes'. Unlike the GPU perf trace, these are also 
+ * available in release builds.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_StatsSetGPUTimers(const bool *on);
+
 /*###########################################################################*/
 /* RENDER TILES                                                              */
 /*###########################################################################*/
@@ -302,6 +310,16 @@ void   R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rpriv
  */
 void   R_GL_TileUpdate(void *chunk_rprivate, const struct map *map, const struct tile_desc *desc);
 
+/* ---------------------------------------------------------------------------
+ * Rebuild the vertex data for a set of tiles, all belonging to the same chunk,
+ * and buffer it using a single mapping of the chunk's vertex buffer. Unlike
+ * 'R_GL_TileUpdate', the surrounding tiles are not touched - they must be 
+ * included in the set by the caller, if necessary.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_TileUpdateBatch(void *chunk_rprivate, const struct map *map, 
+                            const size_t *ntiles, const struct tile_desc *descs);
+
 /*###########################################################################*/
 /* RENDER MINIMAP                                                            */
 /*###########################################################################*/
@@ -333,12 +351,20 @@ void  R_GL_MinimapRender(const struct map *map, const struct camera *cam,
                          vec2_t *center_pos, const int *side_len_px, vec4_t *border_clr);
 
 /* ---------------------------------------------------------------------------
- * Render the specified unit positions in the minimap region.
+ * Replace the set of unit positions and colors that are drawn on the minimap.
+ * The data is kept in GPU buffers until the next update, so this only needs
+ * to be called when the positions are refreshed.
+ * ---------------------------------------------------------------------------
+ */
+void  R_GL_MinimapUpdateUnits(size_t *nunits, vec2_t *posbuff, vec3_t *colorbuff);
+
+/* ---------------------------------------------------------------------------
+ * Render the unit positions set by the last 'R_GL_MinimapUpdateUnits' call
+ * in the minimap region, using a single instanced draw.
  * ---------------------------------------------------------------------------
  */
 void  R_GL_MinimapRenderUnits(const struct map *map, vec2_t *center_pos, 
-                              const int *side_len_px, size_t *nunits, 
-                              vec2_t *posbuff, vec3_t *colorbuff);
+                              const int *side_len_px);
 
 /* ---------------------------------------------------------------------------
  * Free the memory allocated by 'R_GL_MinimapBake'.
@@ -386,6 +412,14 @@ void  R_GL_MapShutdown(void);
  */
 void  R_GL_MapBegin(const bool *shadows, const vec2_t *pos);
 
+/* ---------------------------------------------------------------------------
+ * Draw 'nchunks' map chunks, each with its' own model matrix. The state that
+ * is the same for all the chunks is set up only once. Must be called between
+ * 'R_GL_MapBegin' and 'R_GL_MapEnd'.
+ * ---------------------------------------------------------------------------
+ */
+void  R_GL_MapDrawChunks(void **chunk_rprivates, mat4x4_t *models, const size_t *nchunks);
+
 /* ---------------------------------------------------------------------------
  * Call after finishing rendering all map chunks.
  * ---------------------------------------------------------------------------
@@ -394,9 +428,12 @@ void  R_GL_MapEnd(void);
 
 /* ---------------------------------------------------------------------------
  * Send the current-frame fog-of-war information to the rendering susbsystem.
+ * Only the chunks which have changed since the last update are sent. 'chunks' 
+ * holds 'nchunks' uint32_t chunk indices (in row-major order) and 'buff' holds 
+ * the fog state of every one of these chunks, in the same order.
  * ---------------------------------------------------------------------------
  */
-void  R_GL_MapUpdateFog(void *buff, const size_t *size);
+void  R_GL_MapUpdateFog(void *buff, void *chunks, const size_t *nchunks);
 
 /* ---------------------------------------------------------------------------
  * Must be Called once per frame when we are sure there will be no more draw 
@@ -417,6 +454,15 @@ void  R_GL_MapInvalidate(void);
  */
 void R_GL_DepthPassBegin(const vec3_t *light_pos, const vec3_t *cam_pos, const vec3_t *cam_dir);
 
+/* ---------------------------------------------------------------------------
+ * Separates the static shadow casters from the dynamic ones. The calls to 
+ * 'R_GL_RenderDepthMap' that come before this, for the terrain and the static 
+ * entities, are cached between frames and only redrawn when they change. The
+ * ones that come after are drawn every frame.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_DepthPassDynamic(void);
+
 /* ---------------------------------------------------------------------------
  * Set up the rendering context for normal rendering. This _must_ be called
  * after all calls to 'R_GL_RenderDepthMap' complete.
@@ -589,17 +635,73 @@ void R_GL_MoveUploadData(void *buff, size_t *nents, size_t *buffsize);
 void R_GL_MoveInvalidateData(void);
 
 /* ---------------------------------------------------------------------------
- * Dispatch the compute work for deriving the new velocities of the entities.
+ * Dispatch the compute work for deriving the steering forces of the entities.
+ * This reads the texture produced by R_GL_PositionsUploadData.
  * ---------------------------------------------------------------------------
  */
 void R_GL_MoveDispatchWork(const size_t *nents);
 
 /* ---------------------------------------------------------------------------
  * Read back the results of the previously dispatched compute work. This will
- * block until the work is finished and the results are read back.
+ * block until the work is finished and the results are read back. Afterwards,
+ * 'out_gen' is set to 'gen' to let the simulation know the results are ready.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_MoveReadNewVelocities(void *out, const size_t *nents, const size_t *maxout,
+                                SDL_atomic_t *out_gen, const int *gen);
+
+/*###########################################################################*/
+/* RENDER NAV FIELDS                                                         */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Upload a batch of flow field jobs and dispatch the 'nav_field' compute 
+ * shader to build the directions of all of them in one pass. Each job is 
+ * 'jobsize' bytes and produces 'outsize' bytes of packed directions.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_NavFieldDispatch(void *jobs, const size_t *njobs, const size_t *jobsize, 
+                           const size_t *outsize);
+
+/* ---------------------------------------------------------------------------
+ * Free resources previously allocated by R_GL_NavFieldDispatch.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_NavFieldInvalidateData(void);
+
+/* ---------------------------------------------------------------------------
+ * Read back the directions of the previously dispatched batch and free its'
+ * buffers. Afterwards, 'out_gen' is set to 'gen' to let the simulation know
+ * the results are ready.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_NavFieldReadResults(void *out, const size_t *size, const size_t *maxout,
+                              SDL_atomic_t *out_gen, const int *gen);
+
+/*###########################################################################*/
+/* RENDER PICKING                                                            */
+/*###########################################################################*/
+
+/* The world-space position under a screen pixel, as resolved from the depth 
+ * buffer. Written by the render thread and read by the main thread. 'seq' is
+ * odd while a write is in progress and is incremented once more when it is 
+ * complete, so a reader can detect (and discard) torn reads. */
+struct pick_result{
+    SDL_atomic_t seq;
+    bool         hit;
+    vec3_t       pos;
+};
+
+/* ---------------------------------------------------------------------------
+ * Start an asynchronous readback of the depth value under the (window-space)
+ * pixel (x, y) of the currently bound framebuffer and resolve the readback 
+ * started on the previous call, if it is ready. The resolved depth is 
+ * unprojected with the inverse view-projection matrix that was passed along 
+ * with it and written to 'out'. Hence, results lag by a frame.
  * ---------------------------------------------------------------------------
  */
-void R_GL_MoveReadNewVelocities(void *out, const size_t *nents, const size_t *maxout);
+void R_GL_PickReadDepth(const int *x, const int *y, const mat4x4_t *inv_view_proj,
+                        struct pick_result *out);
 
 
 #endif
@@ -64,15 +64,15 @@ void   R_AL_DumpPrivate(FILE *stream, void *priv_data);
 size_t R_AL_PrivBuffSizeForChunk(size_t tiles_width, size_t tiles_height, size_t num_mats);
 
 /* ---------------------------------------------------------------------------
- * Initialize private render buff for a PFChunk of the map. 
+ * Initialize the private render buffs for all the PFChunks of the map, in 
+ * row-major order. 
  *
- * This function will build the vertices and their vertices from the data
- * already parsed into the 'tiles'.
+ * This function will build the vertices of the chunks from the tiles already 
+ * loaded into the map. The chunk meshes are built in parallel and uploaded 
+ * in batches by the render thread.
  * ---------------------------------------------------------------------------
  */
-bool   R_AL_InitPrivFromTiles(const struct map *map, int chunk_r, int chunk_c,
-                              const struct tile *tiles, size_t width, size_t height,
-                              void *priv_buff, const char *basedir);
+bool   R_AL_InitPrivFromChunks(const struct map *map, size_t nchunks, void *priv_buffs[]);
 
 #endif
 
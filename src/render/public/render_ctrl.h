@@ -41,6 +41,7 @@
 #include "../../pf_math.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <SDL_video.h>
 #include <SDL_mutex.h>
@@ -59,10 +60,62 @@ enum render_info{
     RENDER_INFO_SL_VERSION,
 };
 
+enum render_stat_pass{
+    RENDER_STAT_PASS_MAIN,
+    RENDER_STAT_PASS_SHADOW,
+    RENDER_STAT_PASS_REFRACTION,
+    RENDER_STAT_PASS_REFLECTION,
+    RENDER_STAT_PASS_MINIMAP,
+    RENDER_STAT_PASS_UI,
+    RENDER_STAT_PASS_COUNT
+};
+
+/* The passes which are timed on the GPU when the timers are enabled. 
+ * They overlap - i.e. the batches drawn into the shadow map count 
+ * towards both the 'shadow' and the 'batch' passes. */
+enum render_gpu_pass{
+    RENDER_GPU_PASS_SHADOW,
+    RENDER_GPU_PASS_WATER,
+    RENDER_GPU_PASS_BATCH_STAT,
+    RENDER_GPU_PASS_BATCH_ANIM,
+    RENDER_GPU_PASS_TERRAIN,
+    RENDER_GPU_PASS_UI,
+    RENDER_GPU_PASS_COUNT
+};
+
+struct render_pass_stats{
+    uint32_t ndraws;        /* draw API calls */
+    uint32_t nindirect;     /* draws sourced from indirect command buffers */
+    uint64_t ninstances;
+    uint64_t ntris;
+    uint32_t nprog_binds;
+    uint32_t ntex_binds;
+    uint64_t upload_bytes;  /* buffer data written by the CPU */
+};
+
+/* The counters of the most recent frame completed by the render thread */
+struct render_stats{
+    uint64_t                 frame;
+    uint32_t                 ncmds;
+    uint64_t                 arg_bytes;
+    struct render_pass_stats total;
+    struct render_pass_stats passes[RENDER_STAT_PASS_COUNT];
+};
+
+/* The GPU times of the passes of the most recent frame for which the 
+ * timer queries have been read back. This lags a few frames behind the 
+ * counters, as the queries are not waited on. */
+struct render_gpu_times{
+    uint64_t frame;
+    float    pass_ms[RENDER_GPU_PASS_COUNT];
+};
+
 struct render_init_arg{
     SDL_Window *in_window;
     int         in_width; 
     int         in_height;
+    /* Run without a GL context, discarding all the commands */
+    bool        in_headless;
     bool        out_success;
 };
 
@@ -96,14 +149,30 @@ struct rcmd{
     void *args[MAX_ARGS];
 };
 
-QUEUE_TYPE(rcmd, struct rcmd)
-QUEUE_IMPL(static inline, rcmd, struct rcmd)
+/* The commands are stored back-to-back in a single linear buffer, each 
+ * as a 'struct rcmd_hdr' immediately followed by its' 'nargs' argument 
+ * pointers. Most commands have only a few arguments, so this takes up a 
+ * fraction of the space of an array of 'struct rcmd'. The stream is read 
+ * from the front by the render thread and is reset in one go when the 
+ * workspace is cleared.
+ */
+struct rcmd_hdr{
+    void (*func)();
+    size_t nargs;
+};
+
+struct rcmd_stream{
+    unsigned char *buff;
+    size_t         size;
+    size_t         capacity;
+    size_t         head;
+};
 
 struct render_workspace{
     /* Stack allocator for storing all the data/arguments associated
      * with the commands */
-    struct memstack   args;
-    queue_rcmd_t      commands;
+    struct memstack    args;
+    struct rcmd_stream commands;
 };
 
 
@@ -122,8 +191,14 @@ void        R_PushCmdImmediate(struct rcmd cmd);
 bool        R_InitWS(struct render_workspace *ws);
 void        R_DestroyWS(struct render_workspace *ws);
 void        R_ClearWS(struct render_workspace *ws);
+/* Returns true if all the commands in the workspace have been executed */
+bool        R_WSDone(const struct render_workspace *ws);
 
 const char *R_GetInfo(enum render_info attr);
+void        R_GetStats(struct render_stats *out);
+const char *R_StatPassName(enum render_stat_pass pass);
+void        R_GetGPUTimes(struct render_gpu_times *out);
+const char *R_GPUPassName(enum render_gpu_pass pass);
 
 void        R_LightFrustum(vec3_t light_pos, vec3_t cam_pos, vec3_t cam_dir, struct frustum *out);
 void        R_LightVisibilityFrustum(const struct camera *cam, struct frustum *out);
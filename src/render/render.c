@@ -43,10 +43,13 @@
 #include "gl_batch.h"
 #include "../settings.h"
 #include "../main.h"
+#include "../perf.h"
 #include "../ui.h"
 #include "../game/public/game.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <SDL.h>
@@ -68,6 +71,7 @@ bool g_trace_gpu;
 /*****************************************************************************/
 
 static SDL_GLContext s_context;
+static bool          s_headless = false;
 
 /* write-once strings. Set by render thread at initialization */
 char                 s_info_vendor[128];
@@ -205,6 +209,79 @@ static bool int_val_validate(const struct sval *new_val)
     return (new_val->type == ST_TYPE_INT);
 }
 
+static bool water_res_validate(const struct sval *new_val)
+{
+    if(new_val->type != ST_TYPE_FLOAT)
+        return false;
+    return (new_val->as_float >= 0.1f && new_val->as_float <= 1.0f);
+}
+
+static void water_res_commit(const struct sval *new_val)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_WaterSetResolutionScale,
+        .nargs = 1,
+        .args = { R_PushArg(&new_val->as_float, sizeof(float)) },
+    });
+}
+
+static bool water_interval_validate(const struct sval *new_val)
+{
+    if(new_val->type != ST_TYPE_INT)
+        return false;
+    return (new_val->as_int >= 1 && new_val->as_int <= 60);
+}
+
+static void water_interval_commit(const struct sval *new_val)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_WaterSetReflectInterval,
+        .nargs = 1,
+        .args = { R_PushArg(&new_val->as_int, sizeof(int)) },
+    });
+}
+
+static bool bake_dist_validate(const struct sval *new_val)
+{
+    if(new_val->type != ST_TYPE_FLOAT)
+        return false;
+    return (new_val->as_float >= 0.0f);
+}
+
+static void bake_dist_commit(const struct sval *new_val)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_MapSetBakeDistance,
+        .nargs = 1,
+        .args = { R_PushArg(&new_val->as_float, sizeof(float)) },
+    });
+}
+
+static void dynres_commit(const struct sval *new_val)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_DynresSetEnabled,
+        .nargs = 1,
+        .args = { R_PushArg(&new_val->as_bool, sizeof(bool)) },
+    });
+}
+
+static bool dynres_target_validate(const struct sval *new_val)
+{
+    if(new_val->type != ST_TYPE_FLOAT)
+        return false;
+    return (new_val->as_float >= 2.0f && new_val->as_float <= 100.0f);
+}
+
+static void dynres_target_commit(const struct sval *new_val)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_DynresSetTarget,
+        .nargs = 1,
+        .args = { R_PushArg(&new_val->as_float, sizeof(float)) },
+    });
+}
+
 static void render_set_logmask(int *mask)
 {
     if(!GLEW_KHR_debug)
@@ -355,7 +432,9 @@ static void render_init_ctx(struct render_init_arg *arg)
     if(!R_GL_Shader_InitAll(g_basepath)
     || !R_GL_Texture_Init()
     || !R_GL_StateInit()
-    || !R_GL_Batch_Init()) {
+    || !R_GL_MeshInit()
+    || !R_GL_Batch_Init()
+    || !R_GL_StatusbarInit()) {
 
         arg->out_success = false;
         return;
@@ -373,12 +452,83 @@ static void render_init_ctx(struct render_init_arg *arg)
 
 static void render_destroy_ctx(void)
 {
+    R_GL_StatusbarShutdown();
+    R_GL_PickShutdown();
+    R_GL_DynresShutdown();
+    R_GL_StatsShutdown();
+    R_GL_DecalsShutdown();
     R_GL_Batch_Shutdown();
+    R_GL_MeshShutdown();
     R_GL_StateShutdown();
     R_GL_Texture_Shutdown();
     SDL_GL_DeleteContext(s_context);
 }
 
+static bool rcmd_stream_init(struct rcmd_stream *st, size_t capacity)
+{
+    st->buff = malloc(capacity);
+    if(!st->buff)
+        return false;
+    st->size = 0;
+    st->capacity = capacity;
+    st->head = 0;
+    return true;
+}
+
+static void rcmd_stream_destroy(struct rcmd_stream *st)
+{
+    free(st->buff);
+    memset(st, 0, sizeof(*st));
+}
+
+static void rcmd_stream_clear(struct rcmd_stream *st)
+{
+    st->size = 0;
+    st->head = 0;
+}
+
+static bool rcmd_stream_push(struct rcmd_stream *st, const struct rcmd *cmd)
+{
+    assert(cmd->nargs <= MAX_ARGS);
+    size_t len = sizeof(struct rcmd_hdr) + cmd->nargs * sizeof(void*);
+
+    if(st->size + len > st->capacity) {
+
+        size_t new_cap = st->capacity * 2;
+        while(new_cap < st->size + len)
+            new_cap *= 2;
+
+        unsigned char *new_buff = realloc(st->buff, new_cap);
+        if(!new_buff)
+            return false;
+        st->buff = new_buff;
+        st->capacity = new_cap;
+    }
+
+    struct rcmd_hdr *hdr = (struct rcmd_hdr*)(st->buff + st->size);
+    hdr->func = cmd->func;
+    hdr->nargs = cmd->nargs;
+    memcpy(hdr + 1, cmd->args, cmd->nargs * sizeof(void*));
+
+    st->size += len;
+    return true;
+}
+
+static bool rcmd_stream_pop(struct rcmd_stream *st, struct rcmd *out)
+{
+    if(st->head == st->size)
+        return false;
+
+    const struct rcmd_hdr *hdr = (const struct rcmd_hdr*)(st->buff + st->head);
+    out->func = hdr->func;
+    out->nargs = hdr->nargs;
+    memcpy(out->args, hdr + 1, hdr->nargs * sizeof(void*));
+
+    st->head += sizeof(struct rcmd_hdr) + hdr->nargs * sizeof(void*);
+    assert(st->head <= st->size);
+    return true;
+}
+
 static void render_dispatch_cmd(struct rcmd cmd)
 {
     switch(cmd.nargs) {
@@ -469,15 +619,31 @@ static void render_dispatch_cmd(struct rcmd cmd)
     }
 }
 
-static void render_process_cmds(queue_rcmd_t *cmds)
+static size_t render_process_cmds(struct rcmd_stream *cmds)
 {
-    while(queue_size(*cmds) > 0) {
+    struct rcmd curr;
+    size_t ret = 0;
+    while(rcmd_stream_pop(cmds, &curr)) {
 
-        struct rcmd curr;
-        queue_rcmd_pop(cmds, &curr);
+        if(!R_GL_DecalCmd(curr.func)) {
+            R_GL_DecalsFlush();
+        }
         render_dispatch_cmd(curr);
         GL_ASSERT_OK();
+        ret++;
+    }
+    R_GL_DecalsFlush();
+    return ret;
+}
+
+static size_t render_discard_cmds(struct rcmd_stream *cmds)
+{
+    struct rcmd curr;
+    size_t ret = 0;
+    while(rcmd_stream_pop(cmds, &curr)) {
+        ret++;
     }
+    return ret;
 }
 
 static int render(void *data)
@@ -486,12 +652,18 @@ static int render(void *data)
     SDL_Window *window = rstate->arg->in_window; /* cache window ptr */
 
     Engine_SetRenderThreadID(SDL_ThreadID());
-    SDL_GL_MakeCurrent(window, s_context);
+    if(!s_headless) {
+        SDL_GL_MakeCurrent(window, s_context);
+    }
 
     bool quit = render_wait_cmd(rstate);
     assert(!quit);
-    render_init_ctx(rstate->arg);
-    bool initialized = rstate->arg->out_success;
+    if(s_headless) {
+        rstate->arg->out_success = true;
+    }else{
+        render_init_ctx(rstate->arg);
+    }
+    bool initialized = rstate->arg->out_success && !s_headless;
 
     rstate->arg = NULL; /* arg is stale after signalling main thread */
     render_signal_done(rstate);
@@ -502,9 +674,22 @@ static int render(void *data)
         if(quit)
             break;
 
-        render_process_cmds(&G_GetRenderWS()->commands);
+        uint64_t start = SDL_GetPerformanceCounter();
+        struct render_workspace *ws = G_GetRenderWS();
+
+        if(s_headless) {
+            render_discard_cmds(&ws->commands);
+            render_signal_done(rstate);
+            continue;
+        }
+
+        R_GL_StatsBeginFrame();
+        size_t ncmds = render_process_cmds(&ws->commands);
+        R_GL_StatsEndFrame(ncmds, stalloc_used(&ws->args));
+
         if(rstate->swap_buffers)
             SDL_GL_SwapWindow(window);
+        Perf_RecordSample(PERF_METRIC_RENDER, SDL_GetPerformanceCounter() - start);
 
         render_signal_done(rstate);
     }
@@ -524,8 +709,8 @@ bool R_Init(const char *base_path)
     ss_e status;
     (void)status;
 
-    SDL_DisplayMode dm;
-    SDL_GetDesktopDisplayMode(0, &dm);
+    SDL_DisplayMode dm = {0};
+    Engine_DesktopRes(&dm.w, &dm.h);
 
     status = Settings_Create((struct setting){
         .name = "pf.video.aspect_ratio",
@@ -599,6 +784,18 @@ bool R_Init(const char *base_path)
     });
     assert(status == SS_OKAY);
 
+    status = Settings_Create((struct setting){
+        .name = "pf.video.gpu_picking",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false 
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = NULL,
+    });
+    assert(status == SS_OKAY);
+
     status = Settings_Create((struct setting){
         .name = "pf.video.water_reflection",
         .val = (struct sval) {
@@ -623,6 +820,66 @@ bool R_Init(const char *base_path)
     });
     assert(status == SS_OKAY);
 
+    status = Settings_Create((struct setting){
+        .name = "pf.video.water_resolution_scale",
+        .val = (struct sval) {
+            .type = ST_TYPE_FLOAT,
+            .as_float = 0.4f
+        },
+        .prio = 0,
+        .validate = water_res_validate,
+        .commit = water_res_commit,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.water_reflection_interval",
+        .val = (struct sval) {
+            .type = ST_TYPE_INT,
+            .as_int = 1
+        },
+        .prio = 0,
+        .validate = water_interval_validate,
+        .commit = water_interval_commit,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.terrain_bake_distance",
+        .val = (struct sval) {
+            .type = ST_TYPE_FLOAT,
+            .as_float = 384.0f
+        },
+        .prio = 0,
+        .validate = bake_dist_validate,
+        .commit = bake_dist_commit,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.dynamic_resolution",
+        .val = (struct sval) {
+            .type = ST_TYPE_BOOL,
+            .as_bool = false
+        },
+        .prio = 0,
+        .validate = bool_val_validate,
+        .commit = dynres_commit,
+    });
+    assert(status == SS_OKAY);
+
+    status = Settings_Create((struct setting){
+        .name = "pf.video.dynamic_resolution_target_ms",
+        .val = (struct sval) {
+            .type = ST_TYPE_FLOAT,
+            .as_float = 16.0f
+        },
+        .prio = 0,
+        .validate = dynres_target_validate,
+        .commit = dynres_target_commit,
+    });
+    assert(status == SS_OKAY);
+
     status = Settings_Create((struct setting){
         .name = "pf.debug.render_log_mask",
         .val = (struct sval) {
@@ -654,6 +911,10 @@ SDL_Thread *R_Run(struct render_sync_state *rstate)
 {
     ASSERT_IN_MAIN_THREAD();
 
+    s_headless = rstate->arg->in_headless;
+    if(s_headless)
+        return SDL_CreateThread(render, "render", rstate);
+
     /* Create the GL context in the main thread and then hand it off to the render thread. 
      * Certain drivers crap out when trying to make the context in the render thread directly. 
      */
@@ -681,24 +942,28 @@ void R_PushCmd(struct rcmd cmd)
      * as if it were a function call */
     if(SDL_ThreadID() == g_render_thread_id) {
 
+        R_GL_DecalsFlush();
         render_dispatch_cmd(cmd);
+        R_GL_DecalsFlush();
         return;
     }
 
     struct render_workspace *ws = G_GetSimWS();
-    queue_rcmd_push(&ws->commands, &cmd);
+    rcmd_stream_push(&ws->commands, &cmd);
 }
 
 void R_PushCmdImmediate(struct rcmd cmd)
 {
     if(SDL_ThreadID() == g_render_thread_id) {
 
+        R_GL_DecalsFlush();
         render_dispatch_cmd(cmd);
+        R_GL_DecalsFlush();
         return;
     }
 
     struct render_workspace *ws = G_GetRenderWS();
-    queue_rcmd_push(&ws->commands, &cmd);
+    rcmd_stream_push(&ws->commands, &cmd);
 }
 
 bool R_InitWS(struct render_workspace *ws)
@@ -706,7 +971,7 @@ bool R_InitWS(struct render_workspace *ws)
     if(!stalloc_init(&ws->args)) 
         goto fail_args;
 
-    if(!queue_rcmd_init(&ws->commands, 2048))
+    if(!rcmd_stream_init(&ws->commands, 2048 * sizeof(struct rcmd_hdr)))
         goto fail_queue;
 
     return true;
@@ -719,16 +984,21 @@ fail_args:
 
 void R_DestroyWS(struct render_workspace *ws)
 {
-    queue_rcmd_destroy(&ws->commands);
+    rcmd_stream_destroy(&ws->commands);
     stalloc_destroy(&ws->args);
 }
 
 void R_ClearWS(struct render_workspace *ws)
 {
-    queue_rcmd_clear(&ws->commands);
+    rcmd_stream_clear(&ws->commands);
     stalloc_clear(&ws->args);
 }
 
+bool R_WSDone(const struct render_workspace *ws)
+{
+    return (ws->commands.head == ws->commands.size);
+}
+
 const char *R_GetInfo(enum render_info attr)
 {
     switch(attr) {
@@ -46,18 +46,40 @@
 #include "../perf.h"
 #include "../asset_load.h"
 #include "../map/public/tile.h"
+#include "../map/public/map.h"
 #include "../settings.h"
+#include "../sched.h"
+#include "../task.h"
 #include "../lib/public/pf_string.h"
 
 #include <assert.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
 
 #define STREVAL(a) STR(a)
 #define STR(a) #a
 
 #define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
 
+/* Size of the simulated post-transform vertex cache. This does not need to 
+ * match the hardware exactly; the ordering degrades gracefully. 
+ */
+#define VCACHE_SIZE (32)
+#define NO_INDEX    ((GLuint)-1)
+/* Number of terrain chunks whose meshes are built concurrently during 
+ * map load. Each one holds a client-side copy of its vertices. 
+ */
+#define MESH_BATCH_SIZE (16)
+
+struct mesh_task_arg{
+    const struct map    *map;
+    int                  chunk_r, chunk_c;
+    size_t               width, height;
+    struct terrain_vert *vbuff;
+};
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -181,6 +203,383 @@ fail:
     return false;
 }
 
+static GLhalf al_pack_half(float val)
+{
+    union{ float f; uint32_t u; }in = {.f = val};
+    uint32_t sign = (in.u >> 16) & 0x8000;
+    int32_t exp = (int32_t)((in.u >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = in.u & 0x7fffff;
+
+    if(exp <= 0) {
+        /* Subnormal or flushed to zero */
+        if(exp < -10)
+            return sign;
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t ret = mant >> shift;
+        if((mant >> (shift - 1)) & 0x1)
+            ret++;
+        return sign | ret;
+    }
+    if(exp >= 31)
+        return sign | 0x7c00;
+
+    /* Rounding may carry into the exponent, which is still correct */
+    uint32_t ret = sign | (exp << 10) | (mant >> 13);
+    if(mant & 0x1000)
+        ret++;
+    return ret;
+}
+
+static float al_unpack_half(GLhalf val)
+{
+    uint32_t sign = ((uint32_t)val & 0x8000) << 16;
+    uint32_t exp = (val >> 10) & 0x1f;
+    uint32_t mant = val & 0x3ff;
+
+    if(exp == 0) {
+        float ret = ldexpf((float)mant, -24);
+        return sign ? -ret : ret;
+    }
+
+    union{ float f; uint32_t u; }out;
+    if(exp == 31) {
+        out.u = sign | 0x7f800000 | (mant << 13);
+    }else{
+        out.u = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    }
+    return out.f;
+}
+
+static GLuint al_pack_normal(vec3_t normal)
+{
+    float len = PFM_Vec3_Len(&normal);
+    if(len > 0.0f) {
+        PFM_Vec3_Scale(&normal, 1.0f / len, &normal);
+    }
+
+    GLuint ret = 0;
+    for(int i = 0; i < 3; i++) {
+        float comp = MIN(MAX(normal.raw[i], -1.0f), 1.0f);
+        int32_t snorm = lroundf(comp * 511.0f);
+        ret |= ((GLuint)snorm & 0x3ff) << (i * 10);
+    }
+    return ret;
+}
+
+static vec3_t al_unpack_normal(GLuint normal)
+{
+    vec3_t ret;
+    for(int i = 0; i < 3; i++) {
+        /* Sign-extend the 10-bit component */
+        int32_t snorm = (int32_t)(((normal >> (i * 10)) & 0x3ff) << 22) >> 22;
+        ret.raw[i] = MAX(snorm / 511.0f, -1.0f);
+    }
+    return ret;
+}
+
+static void al_pack_vertex(const struct vertex *in, struct packed_vert *out)
+{
+    out->pos = in->pos;
+    out->uv[0] = al_pack_half(in->uv.x);
+    out->uv[1] = al_pack_half(in->uv.y);
+    out->normal = al_pack_normal(in->normal);
+    out->material_idx = in->material_idx;
+}
+
+static void al_pack_anim_vertex(const struct anim_vert *in, struct packed_anim_vert *out)
+{
+    al_pack_vertex((const struct vertex*)in, (struct packed_vert*)out);
+    memcpy(out->joint_indices, in->joint_indices, sizeof(out->joint_indices));
+
+    int total = 0, max = 0;
+    for(int i = 0; i < 6; i++) {
+        float weight = MIN(MAX(in->weights[i], 0.0f), 1.0f);
+        out->weights[i] = lroundf(weight * 255.0f);
+        total += out->weights[i];
+        if(out->weights[i] > out->weights[max])
+            max = i;
+    }
+
+    /* Push the rounding error onto the dominant joint, so that the 
+     * quantized weights still add up to exactly 1 */
+    if(total > 0) {
+        int fixed = out->weights[max] + (255 - total);
+        out->weights[max] = MIN(MAX(fixed, 0), 255);
+    }
+}
+
+static uint32_t al_vert_hash(const unsigned char *bytes, size_t size)
+{
+    /* 32-bit FNV-1a */
+    uint32_t ret = 2166136261u;
+    for(size_t i = 0; i < size; i++) {
+        ret ^= bytes[i];
+        ret *= 16777619u;
+    }
+    return ret;
+}
+
+/* Merge the bitwise-identical vertices of the triangle soup in 'vbuff' in-place,
+ * writing out the index of the merged vertex for every input vertex. The 
+ * unique vertices are kept in the order of their first occurence. Returns 
+ * the number of unique vertices, or 0 on failure.
+ */
+static size_t al_weld_vertices(void *vbuff, size_t nverts, size_t stride, GLuint *out_indices)
+{
+    size_t cap = 16;
+    while(cap < nverts * 2)
+        cap <<= 1;
+
+    GLuint *table = malloc(cap * sizeof(GLuint));
+    if(!table)
+        return 0;
+    memset(table, 0xff, cap * sizeof(GLuint));
+
+    unsigned char *base = vbuff;
+    size_t nunique = 0;
+
+    for(size_t i = 0; i < nverts; i++) {
+
+        const unsigned char *vert = base + i * stride;
+        size_t slot = al_vert_hash(vert, stride) & (cap - 1);
+
+        while(true) {
+            GLuint entry = table[slot];
+            if(entry == NO_INDEX) {
+                /* 'nunique' never exceeds 'i', so this never overwrites 
+                 * a vertex that hasn't been visited yet */
+                memmove(base + nunique * stride, vert, stride);
+                table[slot] = nunique;
+                out_indices[i] = nunique++;
+                break;
+            }
+            if(!memcmp(base + entry * stride, vert, stride)) {
+                out_indices[i] = entry;
+                break;
+            }
+            slot = (slot + 1) & (cap - 1);
+        }
+    }
+
+    free(table);
+    return nunique;
+}
+
+static float al_vcache_score(int cache_pos, int ntris)
+{
+    /* No remaining triangles - the vertex will never be needed again */
+    if(ntris == 0)
+        return -1.0f;
+
+    float ret = 0.0f;
+    if(cache_pos >= 0) {
+        if(cache_pos < 3) {
+            /* The vertices of the last triangle get a fixed score so that 
+             * the strip-like order doesn't get too greedy */
+            ret = 0.75f;
+        }else{
+            float scale = 1.0f - (float)(cache_pos - 3) / (VCACHE_SIZE - 3);
+            ret = powf(scale, 1.5f);
+        }
+    }
+    /* Boost the vertices with few remaining triangles, to get rid of them
+     * before they leave lone triangles behind */
+    ret += 2.0f * powf((float)ntris, -0.5f);
+    return ret;
+}
+
+static float al_tri_score(const GLuint *tri, const float *vscore)
+{
+    return vscore[tri[0]] + vscore[tri[1]] + vscore[tri[2]];
+}
+
+/* Reorder the triangles to make the best use of the post-transform vertex 
+ * cache, using Tom Forsyth's 'Linear-Speed Vertex Cache Optimisation'. The 
+ * indices are left unchanged on allocation failure.
+ */
+static void al_optimize_vcache(GLuint *indices, size_t nindices, size_t nverts)
+{
+    const size_t ntris = nindices / 3;
+    if(ntris < 2)
+        return;
+
+    int *vtris_count = calloc(nverts, sizeof(int));
+    int *vtris_start = malloc((nverts + 1) * sizeof(int));
+    int *vtris = malloc(ntris * 3 * sizeof(int));
+    int *vcache_pos = malloc(nverts * sizeof(int));
+    float *vscore = malloc(nverts * sizeof(float));
+    float *tscore = malloc(ntris * sizeof(float));
+    GLuint *out = malloc(ntris * 3 * sizeof(GLuint));
+
+    if(!vtris_count || !vtris_start || !vtris || !vcache_pos 
+    || !vscore || !tscore || !out)
+        goto out;
+
+    /* Build the vertex to triangle adjacency */
+    for(size_t i = 0; i < ntris * 3; i++) {
+        vtris_count[indices[i]]++;
+    }
+    vtris_start[0] = 0;
+    for(size_t i = 0; i < nverts; i++) {
+        vtris_start[i + 1] = vtris_start[i] + vtris_count[i];
+        vcache_pos[i] = vtris_start[i];
+    }
+    for(size_t i = 0; i < ntris * 3; i++) {
+        GLuint v = indices[i];
+        vtris[vcache_pos[v]++] = i / 3;
+    }
+
+    for(size_t i = 0; i < nverts; i++) {
+        vcache_pos[i] = -1;
+        vscore[i] = al_vcache_score(-1, vtris_count[i]);
+    }
+    for(size_t i = 0; i < ntris; i++) {
+        tscore[i] = al_tri_score(indices + i * 3, vscore);
+    }
+
+    GLuint cache[VCACHE_SIZE + 3];
+    size_t ncache = 0;
+    size_t nout = 0;
+    size_t scan = 0;
+
+    while(nout < ntris) {
+
+        /* The triangles still to be emitted are kept at the front of each 
+         * vertex's adjacency list, so only those are visited here */
+        int best = -1;
+        float best_score = -1.0f;
+        for(int i = 0; i < ncache; i++) {
+            GLuint v = cache[i];
+            for(int j = 0; j < vtris_count[v]; j++) {
+                int tri = vtris[vtris_start[v] + j];
+                if(tscore[tri] > best_score) {
+                    best_score = tscore[tri];
+                    best = tri;
+                }
+            }
+        }
+
+        /* Nothing left around the cached vertices - continue from the next 
+         * triangle in the original order */
+        if(best < 0) {
+            while(tscore[scan] < 0.0f)
+                scan++;
+            best = scan;
+        }
+
+        const GLuint *tri = indices + best * 3;
+        memcpy(out + nout * 3, tri, 3 * sizeof(GLuint));
+        nout++;
+        tscore[best] = -1.0f;
+
+        for(int i = 0; i < 3; i++) {
+            int *list = vtris + vtris_start[tri[i]];
+            int count = vtris_count[tri[i]];
+            for(int j = 0; j < count; j++) {
+                if(list[j] == best) {
+                    list[j] = list[count - 1];
+                    list[count - 1] = best;
+                    vtris_count[tri[i]]--;
+                    break;
+                }
+            }
+        }
+
+        /* The emitted triangle's vertices move to the front of the cache */
+        GLuint newcache[VCACHE_SIZE + 3];
+        size_t nnew = 0;
+        for(int i = 0; i < 3; i++) {
+            if(nnew > 0 && newcache[0] == tri[i])
+                continue;
+            if(nnew > 1 && newcache[1] == tri[i])
+                continue;
+            newcache[nnew++] = tri[i];
+        }
+        for(int i = 0; i < ncache; i++) {
+            if(cache[i] == tri[0] || cache[i] == tri[1] || cache[i] == tri[2])
+                continue;
+            newcache[nnew++] = cache[i];
+        }
+
+        for(int i = 0; i < nnew; i++) {
+            GLuint v = newcache[i];
+            vcache_pos[v] = (i < VCACHE_SIZE) ? i : -1;
+            vscore[v] = al_vcache_score(vcache_pos[v], vtris_count[v]);
+        }
+        for(int i = 0; i < nnew; i++) {
+            GLuint v = newcache[i];
+            for(int j = 0; j < vtris_count[v]; j++) {
+                int adj = vtris[vtris_start[v] + j];
+                tscore[adj] = al_tri_score(indices + adj * 3, vscore);
+            }
+        }
+
+        ncache = MIN(nnew, VCACHE_SIZE);
+        memcpy(cache, newcache, ncache * sizeof(GLuint));
+    }
+
+    memcpy(indices, out, ntris * 3 * sizeof(GLuint));
+
+out:
+    free(vtris_count);
+    free(vtris_start);
+    free(vtris);
+    free(vcache_pos);
+    free(vscore);
+    free(tscore);
+    free(out);
+}
+
+/* Reorder the vertices in the order that they are first referenced by the 
+ * indices, so that the vertex fetches walk the buffer linearly. 
+ */
+static bool al_reorder_vertices(void *vbuff, size_t nverts, size_t stride, 
+                                GLuint *indices, size_t nindices)
+{
+    GLuint *remap = malloc(nverts * sizeof(GLuint));
+    unsigned char *tmp = malloc(nverts * stride);
+    if(!remap || !tmp) {
+        free(remap);
+        free(tmp);
+        return false;
+    }
+    memset(remap, 0xff, nverts * sizeof(GLuint));
+
+    size_t next = 0;
+    for(size_t i = 0; i < nindices; i++) {
+        GLuint v = indices[i];
+        if(remap[v] == NO_INDEX) {
+            memcpy(tmp + next * stride, ((unsigned char*)vbuff) + v * stride, stride);
+            remap[v] = next++;
+        }
+        indices[i] = remap[v];
+    }
+    memcpy(vbuff, tmp, next * stride);
+
+    free(remap);
+    free(tmp);
+    return true;
+}
+
+static void al_build_chunk_verts(const struct mesh_task_arg *arg)
+{
+    for(int r = 0; r < arg->height; r++) {
+    for(int c = 0; c < arg->width;  c++) {
+
+        struct terrain_vert *vert_base = &arg->vbuff[ (r * arg->width + c) * VERTS_PER_TILE ];
+        struct tile_desc td = (struct tile_desc){arg->chunk_r, arg->chunk_c, r, c};
+        R_TileGetVertices(arg->map, td, vert_base);
+        R_TilePatchVertices(arg->map, td, vert_base);
+    }}
+}
+
+static struct result al_chunk_mesh_task(void *arg)
+{
+    al_build_chunk_verts(arg);
+    return NULL_RESULT;
+}
+
 size_t al_priv_buffsize_from_header(const struct pfobj_hdr *header)
 {
     size_t ret = 0;
@@ -214,14 +613,21 @@ void *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header,
         goto fail_alloc_priv;
 
     bool anim = (header->num_as > 0);
-    priv->vertex_stride = anim ? sizeof(struct anim_vert) : sizeof(struct vertex);
+    priv->vertex_stride = anim ? sizeof(struct packed_anim_vert) : sizeof(struct packed_vert);
 
+    /* Zero-initialize so that padding bytes don't prevent vertices from being welded */
     size_t vbuff_sz = header->num_verts * priv->vertex_stride;
-    void *vbuff = malloc(vbuff_sz);
+    void *vbuff = calloc(header->num_verts, priv->vertex_stride);
     if(!vbuff)
         goto fail_alloc_vbuff;
 
+    size_t ibuff_sz = header->num_verts * sizeof(GLuint);
+    GLuint *ibuff = malloc(ibuff_sz);
+    if(!ibuff)
+        goto fail_alloc_ibuff;
+
     priv->mesh.num_verts = header->num_verts;
+    priv->mesh.num_indices = header->num_verts;
     priv->num_materials = header->num_materials;
     priv->materials = (void*)(priv + 1);
 
@@ -229,14 +635,22 @@ void *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header,
 
         bool status;
         char ignoreline[MAX_LINE_LEN];
+        struct anim_vert vert;
 
         if(anim) {
-            status = al_read_anim_vertex(stream, ((struct anim_vert*)vbuff) + i);
+            status = al_read_anim_vertex(stream, &vert);
         }else{
-            status = al_read_vertex(stream, ((struct vertex*)vbuff) + i, ignoreline);
+            status = al_read_vertex(stream, (struct vertex*)&vert, ignoreline);
         }
         if(!status)
             goto fail_parse;
+
+        void *out = ((unsigned char*)vbuff) + i * priv->vertex_stride;
+        if(anim) {
+            al_pack_anim_vertex(&vert, out);
+        }else{
+            al_pack_vertex((struct vertex*)&vert, out);
+        }
     }
 
     for(int i = 0; i < header->num_materials; i++) {
@@ -249,6 +663,18 @@ void *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header,
         assert(!null);
     }
 
+    /* The PFOBJ vertices are a triangle soup. Weld the shared vertices and 
+     * draw the mesh as indexed, so that every vertex is only shaded once. */
+    size_t nunique = al_weld_vertices(vbuff, header->num_verts, priv->vertex_stride, ibuff);
+    if(nunique == 0)
+        goto fail_parse;
+
+    al_optimize_vcache(ibuff, header->num_verts, nunique);
+    al_reorder_vertices(vbuff, nunique, priv->vertex_stride, ibuff, header->num_verts);
+
+    priv->mesh.num_verts = nunique;
+    vbuff_sz = nunique * priv->vertex_stride;
+
     struct sval sh_setting;
     ss_e status = Settings_Get("pf.video.shadows_enabled", &sh_setting);
     assert(status == SS_OKAY);
@@ -264,18 +690,22 @@ void *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header,
 
     R_PushCmd((struct rcmd){
         .func = R_GL_Init,
-        .nargs = 3,
+        .nargs = 4,
         .args = {
             priv,
             (void*)shader,
             R_PushArg(vbuff, vbuff_sz),
+            R_PushArg(ibuff, ibuff_sz),
         },
     });
 
+    free(ibuff);
     free(vbuff);
     PERF_RETURN(priv);
 
 fail_parse:
+    free(ibuff);
+fail_alloc_ibuff:
     free(vbuff);
 fail_alloc_vbuff:
     free(priv);
@@ -287,25 +717,34 @@ void R_AL_DumpPrivate(FILE *stream, void *priv_data)
 {
     struct render_private *priv = priv_data;
     glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
-    struct vertex *vbuff = glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
+    const unsigned char *vbuff = glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
     assert(vbuff);
 
-    /* Write verticies */
-    for(int i = 0; i < priv->mesh.num_verts; i++) {
+    /* Map the indices through a target that isn't part of the VAO state */
+    glBindBuffer(GL_COPY_READ_BUFFER, priv->mesh.EBO);
+    const GLuint *ibuff = glMapBuffer(GL_COPY_READ_BUFFER, GL_READ_ONLY);
+    assert(ibuff);
+
+    bool anim = (priv->vertex_stride == sizeof(struct packed_anim_vert));
 
-        struct vertex *v = (struct vertex*)(((char*)vbuff) + priv->vertex_stride * i);
+    /* Write verticies - PFOBJ has no notion of indices, so the mesh is 
+     * expanded back into a triangle soup */
+    for(int i = 0; i < priv->mesh.num_indices; i++) {
+
+        const struct packed_vert *v = (void*)(vbuff + priv->vertex_stride * ibuff[i]);
+        vec3_t normal = al_unpack_normal(v->normal);
 
         fprintf(stream, "v %.6f %.6f %.6f\n", v->pos.x, v->pos.y, v->pos.z); 
-        fprintf(stream, "vt %.6f %.6f \n", v->uv.x, v->uv.y); 
-        fprintf(stream, "vn %.6f %.6f %.6f\n", v->normal.x, v->normal.y, v->normal.z);
+        fprintf(stream, "vt %.6f %.6f \n", al_unpack_half(v->uv[0]), al_unpack_half(v->uv[1])); 
+        fprintf(stream, "vn %.6f %.6f %.6f\n", normal.x, normal.y, normal.z);
 
         fprintf(stream, "vw ");
-        if(strstr("animated", R_GL_Shader_GetName(priv->shader_prog))) {
+        if(anim) {
             for(int j = 0; j < 6; j++) {
 
-                struct anim_vert *av = (struct anim_vert*)v;
+                const struct packed_anim_vert *av = (const struct packed_anim_vert*)v;
                 if(av->weights[j]) {
-                    fprintf(stream, "%d/%.6f ", av->joint_indices[j], av->weights[j]);
+                    fprintf(stream, "%d/%.6f ", av->joint_indices[j], av->weights[j] / 255.0f);
                 }
             }
         }
@@ -314,6 +753,7 @@ void R_AL_DumpPrivate(FILE *stream, void *priv_data)
         fprintf(stream, "vm %d\n", v->material_idx); 
     }
 
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
     glUnmapBuffer(GL_ARRAY_BUFFER);
 
     /* Write materials */
@@ -345,52 +785,90 @@ size_t R_AL_PrivBuffSizeForChunk(size_t tiles_width, size_t tiles_height, size_t
     return ret;
 }
 
-bool R_AL_InitPrivFromTiles(const struct map *map, int chunk_r, int chunk_c,
-                            const struct tile *tiles, size_t width, size_t height,
-                            void *priv_buff, const char *basedir)
+bool R_AL_InitPrivFromChunks(const struct map *map, size_t nchunks, void *priv_buffs[])
 {
     PERF_ENTER();
     ASSERT_IN_MAIN_THREAD();
 
-    size_t num_verts = VERTS_PER_TILE * (width * height);
+    struct map_resolution res;
+    M_GetResolution(map, &res);
 
-    struct render_private *priv = priv_buff;
-    char *unused_base = (char*)priv_buff + sizeof(struct render_private);
-    size_t vbuff_sz = num_verts * sizeof(struct terrain_vert);
+    const size_t width = res.tile_w;
+    const size_t height = res.tile_h;
+    const size_t num_verts = VERTS_PER_TILE * (width * height);
+    const size_t vbuff_sz = num_verts * sizeof(struct terrain_vert);
 
-    struct terrain_vert *vbuff = malloc(vbuff_sz);
-    if(!vbuff)
+    struct terrain_vert *vbuffs = malloc(vbuff_sz * MESH_BATCH_SIZE);
+    if(!vbuffs)
         goto fail_alloc;
 
-    priv->vertex_stride = sizeof(struct terrain_vert);
-    priv->mesh.num_verts = num_verts;
-    priv->materials = (void*)unused_base;
-    priv->num_materials = 0;
-
-    for(int r = 0; r < height; r++) {
-    for(int c = 0; c < width;  c++) {
-
-        struct terrain_vert *vert_base = &vbuff[ (r * width + c) * VERTS_PER_TILE ];
-        struct tile_desc td = (struct tile_desc){chunk_r, chunk_c, r, c};
-        R_TileGetVertices(map, td, vert_base);
-    }}
-
     struct sval sh_setting;
     ss_e status = Settings_Get("pf.video.shadows_enabled", &sh_setting);
     assert(status == SS_OKAY);
-
     const char *shader = sh_setting.as_bool ? "terrain-shadowed" : "terrain";
-    R_PushCmd((struct rcmd){
-        .func = R_GL_Init,
-        .nargs = 3,
-        .args = {
-            priv,
-            (void*)shader,
-            R_PushArg(vbuff, vbuff_sz),
-        },
-    });
 
-    free(vbuff);
+    /* The chunks only read the (already loaded) tiles of their own and the 
+     * neighbouring chunks, so their meshes can be built independently. Do 
+     * it in batches to bound the size of the client-side vertex buffers. */
+    for(size_t base = 0; base < nchunks; base += MESH_BATCH_SIZE) {
+
+        size_t nbatch = MIN(MESH_BATCH_SIZE, nchunks - base);
+        struct mesh_task_arg args[MESH_BATCH_SIZE];
+        struct future futures[MESH_BATCH_SIZE];
+        uint32_t tids[MESH_BATCH_SIZE];
+
+        for(int i = 0; i < nbatch; i++) {
+
+            args[i] = (struct mesh_task_arg){
+                .map = map,
+                .chunk_r = (base + i) / res.chunk_w,
+                .chunk_c = (base + i) % res.chunk_w,
+                .width = width,
+                .height = height,
+                .vbuff = (struct terrain_vert*)((char*)vbuffs + i * vbuff_sz)
+            };
+            SDL_AtomicSet(&futures[i].status, FUTURE_INCOMPLETE);
+            tids[i] = Sched_Create(4, al_chunk_mesh_task, &args[i], &futures[i], TASK_BIG_STACK);
+            if(tids[i] == NULL_TID) {
+                al_build_chunk_verts(&args[i]);
+            }
+        }
+
+        for(int i = 0; i < nbatch; i++) {
+            if(tids[i] == NULL_TID)
+                continue;
+            while(!Sched_FutureIsReady(&futures[i])) {
+                Sched_RunSync(tids[i]);
+            }
+        }
+
+        for(int i = 0; i < nbatch; i++) {
+
+            struct render_private *priv = priv_buffs[base + i];
+            char *unused_base = (char*)priv + sizeof(struct render_private);
+
+            priv->vertex_stride = sizeof(struct terrain_vert);
+            priv->mesh.num_verts = num_verts;
+            priv->mesh.num_indices = 0;
+            priv->materials = (void*)unused_base;
+            priv->num_materials = 0;
+
+            /* The tile vertices are patched in-place by their offset in the 
+             * buffer, so the terrain stays non-indexed. */
+            R_PushCmd((struct rcmd){
+                .func = R_GL_Init,
+                .nargs = 4,
+                .args = {
+                    priv,
+                    (void*)shader,
+                    R_PushArg(args[i].vbuff, vbuff_sz),
+                    NULL,
+                },
+            });
+        }
+    }
+
+    free(vbuffs);
     PERF_RETURN(true);
 
 fail_alloc:
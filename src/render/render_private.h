@@ -55,5 +55,9 @@ struct render_private{
 
 /* Tile */
 void R_TileGetVertices(const struct map *map, struct tile_desc td, struct terrain_vert *out);
+/* Same as R_GL_TilePatchVertsBlend and R_GL_TilePatchVertsSmooth, but writing 
+ * to the tile's vertices in client memory. The tiles of all the neighbouring 
+ * chunks must already be loaded. */
+void R_TilePatchVertices(const struct map *map, struct tile_desc td, struct terrain_vert *inout);
 
 #endif
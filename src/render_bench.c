@@ -0,0 +1,520 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "render_bench.h"
+#include "perf.h"
+#include "main.h"
+#include "camera.h"
+#include "game/public/game.h"
+#include "render/public/render.h"
+#include "render/public/render_ctrl.h"
+#include "lib/public/vec.h"
+#include "lib/public/pf_string.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+
+/* Simulation ticks for the scene to settle before it is paused */
+#define WARMUP_FRAMES   (60)
+/* The GPU timings lag behind by a few frames. Keep rendering the last 
+ * pose for long enough to have the timings of all the path's frames. */
+#define DRAIN_FRAMES    (8)
+#define ORBIT_POSES     (16)
+#define ORBIT_RADIUS    (256.0f)
+#define ORBIT_HEIGHT    (175.0f)
+
+struct cam_pose{
+    vec3_t pos;
+    float  pitch;
+    float  yaw;
+};
+
+VEC_TYPE(pose, struct cam_pose)
+VEC_IMPL(static inline, pose, struct cam_pose)
+
+enum phase{
+    PHASE_LOADING,
+    PHASE_WARMUP,
+    PHASE_RUNNING,
+    PHASE_DRAIN,
+};
+
+struct samples{
+    float  *ms;
+    size_t  size;
+    size_t  capacity;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                     s_active = false;
+static enum phase               s_phase;
+static uint32_t                 s_nframes;
+static uint32_t                 s_frame;
+static char                     s_outpath[512];
+static vec_pose_t               s_path;
+
+/* The render frames belonging to the path */
+static uint64_t                 s_first_rframe;
+static uint64_t                 s_last_rframe;
+static uint64_t                 s_seen_rframe;
+static uint64_t                 s_seen_gpu_frame;
+
+static struct samples           s_gpu[RENDER_GPU_PASS_COUNT];
+static uint32_t                 s_counted;
+static struct render_pass_stats s_pass_sums[RENDER_STAT_PASS_COUNT];
+static struct render_pass_stats s_total_sums;
+static uint64_t                 s_start_pc;
+
+static FILE                    *s_record;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool load_path(const char *pathfile)
+{
+    FILE *stream = fopen(pathfile, "r");
+    if(!stream)
+        return false;
+
+    char line[256];
+    while(fgets(line, sizeof(line), stream)) {
+
+        struct cam_pose pose;
+        if(line[0] == '#')
+            continue;
+        if(5 != sscanf(line, "%f %f %f %f %f", &pose.pos.x, &pose.pos.y, &pose.pos.z, 
+            &pose.pitch, &pose.yaw))
+            continue;
+        vec_pose_push(&s_path, pose);
+    }
+    fclose(stream);
+    return (vec_size(&s_path) > 0);
+}
+
+static void make_orbit_path(void)
+{
+    for(int i = 0; i <= ORBIT_POSES; i++) {
+
+        float angle = (2.0f * M_PI * i) / ORBIT_POSES;
+        vec3_t pos = (vec3_t){
+            cos(angle) * ORBIT_RADIUS,
+            ORBIT_HEIGHT,
+            sin(angle) * ORBIT_RADIUS
+        };
+        /* Look towards the center of the map */
+        float yaw = 180.0f - (angle * 180.0f / M_PI);
+        vec_pose_push(&s_path, (struct cam_pose){pos, -65.0f, yaw});
+    }
+}
+
+static struct cam_pose pose_at(uint32_t frame)
+{
+    size_t nposes = vec_size(&s_path);
+    if(nposes == 1 || s_nframes == 1)
+        return vec_AT(&s_path, 0);
+
+    float t = (float)MIN(frame, s_nframes - 1) / (s_nframes - 1) * (nposes - 1);
+    size_t idx = MIN((size_t)t, nposes - 2);
+    float frac = t - idx;
+
+    const struct cam_pose *a = &vec_AT(&s_path, idx);
+    const struct cam_pose *b = &vec_AT(&s_path, idx + 1);
+
+    vec3_t delta;
+    PFM_Vec3_Sub((vec3_t*)&b->pos, (vec3_t*)&a->pos, &delta);
+    PFM_Vec3_Scale(&delta, frac, &delta);
+
+    struct cam_pose ret;
+    PFM_Vec3_Add((vec3_t*)&a->pos, &delta, &ret.pos);
+    ret.pitch = a->pitch + (b->pitch - a->pitch) * frac;
+    ret.yaw = a->yaw + (b->yaw - a->yaw) * frac;
+    return ret;
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static void samples_push(struct samples *s, float ms)
+{
+    if(s->size < s->capacity)
+        s->ms[s->size++] = ms;
+}
+
+static void samples_summarize(struct samples *s, float *out_mean, float *out_p95, float *out_max)
+{
+    *out_mean = *out_p95 = *out_max = 0.0f;
+    if(s->size == 0)
+        return;
+
+    qsort(s->ms, s->size, sizeof(float), compare_floats);
+    double sum = 0.0;
+    for(size_t i = 0; i < s->size; i++)
+        sum += s->ms[i];
+
+    *out_mean = sum / s->size;
+    *out_p95 = s->ms[(s->size - 1) * 95 / 100];
+    *out_max = s->ms[s->size - 1];
+}
+
+static void stats_accumulate(struct render_pass_stats *a, const struct render_pass_stats *b)
+{
+    a->ndraws += b->ndraws;
+    a->nindirect += b->nindirect;
+    a->ninstances += b->ninstances;
+    a->ntris += b->ntris;
+    a->nprog_binds += b->nprog_binds;
+    a->ntex_binds += b->ntex_binds;
+    a->upload_bytes += b->upload_bytes;
+}
+
+static void write_pass_stats(FILE *stream, const char *name, const struct render_pass_stats *sums, 
+                             const char *sep)
+{
+    double n = MAX(s_counted, 1);
+    fprintf(stream, "    \"%s\": {\"draws\": %.1f, \"indirect\": %.1f, \"instances\": %.1f, "
+        "\"tris\": %.1f, \"prog_binds\": %.1f, \"tex_binds\": %.1f, \"upload_bytes\": %.1f}%s\n",
+        name, sums->ndraws / n, sums->nindirect / n, sums->ninstances / n, sums->ntris / n,
+        sums->nprog_binds / n, sums->ntex_binds / n, sums->upload_bytes / n, sep);
+}
+
+static bool write_results(void)
+{
+    FILE *stream = fopen(s_outpath, "w");
+    if(!stream)
+        return false;
+
+    double wall_ms = (SDL_GetPerformanceCounter() - s_start_pc) * 1000.0 
+                   / SDL_GetPerformanceFrequency();
+
+    fprintf(stream, "{\n");
+    fprintf(stream, "  \"frames\": %u,\n", s_nframes);
+    fprintf(stream, "  \"poses\": %u,\n", (unsigned)vec_size(&s_path));
+    fprintf(stream, "  \"renderer\": \"%s\",\n", R_GetInfo(RENDER_INFO_RENDERER));
+    fprintf(stream, "  \"vendor\": \"%s\",\n", R_GetInfo(RENDER_INFO_VENDOR));
+    fprintf(stream, "  \"version\": \"%s\",\n", R_GetInfo(RENDER_INFO_VERSION));
+    fprintf(stream, "  \"wall_ms\": %.4f,\n", wall_ms);
+
+    /* The per-pass GPU times, in milliseconds */
+    fprintf(stream, "  \"gpu\": {\n");
+    for(int i = 0; i < RENDER_GPU_PASS_COUNT; i++) {
+        float mean, p95, max;
+        samples_summarize(&s_gpu[i], &mean, &p95, &max);
+        fprintf(stream, "    \"%s\": {\"samples\": %u, \"mean_ms\": %.4f, \"p95_ms\": %.4f, "
+            "\"max_ms\": %.4f}%s\n", R_GPUPassName(i), (unsigned)s_gpu[i].size, mean, p95, max,
+            (i == RENDER_GPU_PASS_COUNT - 1) ? "" : ",");
+    }
+    fprintf(stream, "  },\n");
+
+    struct perf_percentiles frame, render;
+    Perf_GetPercentiles(PERF_METRIC_FRAME, &frame);
+    Perf_GetPercentiles(PERF_METRIC_RENDER, &render);
+    fprintf(stream, "  \"cpu\": {\n");
+    fprintf(stream, "    \"frame\": {\"samples\": %u, \"mean_ms\": %.4f, \"p95_ms\": %.4f, "
+        "\"max_ms\": %.4f},\n", frame.nsamples, frame.mean_ms, frame.p95_ms, frame.max_ms);
+    fprintf(stream, "    \"render\": {\"samples\": %u, \"mean_ms\": %.4f, \"p95_ms\": %.4f, "
+        "\"max_ms\": %.4f}\n", render.nsamples, render.mean_ms, render.p95_ms, render.max_ms);
+    fprintf(stream, "  },\n");
+
+    /* The mean render counters per frame */
+    fprintf(stream, "  \"counters\": {\n");
+    for(int i = 0; i < RENDER_STAT_PASS_COUNT; i++) {
+        write_pass_stats(stream, R_StatPassName(i), &s_pass_sums[i], ",");
+    }
+    write_pass_stats(stream, "total", &s_total_sums, "");
+    fprintf(stream, "  }\n");
+    fprintf(stream, "}\n");
+
+    bool ret = !ferror(stream);
+    fclose(stream);
+    return ret;
+}
+
+static void print_summary(void)
+{
+    printf("%-12s %10s %10s %10s\n", "pass", "avg ms", "p95 ms", "max ms");
+    for(int i = 0; i < RENDER_GPU_PASS_COUNT; i++) {
+        float mean, p95, max;
+        samples_summarize(&s_gpu[i], &mean, &p95, &max);
+        printf("%-12s %10.3f %10.3f %10.3f\n", R_GPUPassName(i), mean, p95, max);
+    }
+
+    double n = MAX(s_counted, 1);
+    printf("per frame: %.1f draws, %.1f indirect, %.1f instances, %.1f tris, "
+        "%.1f program binds, %.1f texture binds, %.1f upload bytes\n",
+        s_total_sums.ndraws / n, s_total_sums.nindirect / n, s_total_sums.ninstances / n, 
+        s_total_sums.ntris / n, s_total_sums.nprog_binds / n, s_total_sums.ntex_binds / n,
+        s_total_sums.upload_bytes / n);
+}
+
+static void set_gpu_timers(bool on)
+{
+    R_PushCmd((struct rcmd){
+        .func = R_GL_StatsSetGPUTimers,
+        .nargs = 1,
+        .args = { R_PushArg(&on, sizeof(on)) },
+    });
+}
+
+static void sample_frame(void)
+{
+    struct render_stats stats;
+    R_GetStats(&stats);
+
+    if(stats.frame != s_seen_rframe
+    && stats.frame >= s_first_rframe && stats.frame <= s_last_rframe) {
+
+        for(int i = 0; i < RENDER_STAT_PASS_COUNT; i++) {
+            stats_accumulate(&s_pass_sums[i], &stats.passes[i]);
+        }
+        stats_accumulate(&s_total_sums, &stats.total);
+        s_counted++;
+    }
+    s_seen_rframe = stats.frame;
+
+    struct render_gpu_times times;
+    R_GetGPUTimes(&times);
+
+    if(times.frame != s_seen_gpu_frame
+    && times.frame >= s_first_rframe && times.frame <= s_last_rframe) {
+
+        for(int i = 0; i < RENDER_GPU_PASS_COUNT; i++) {
+            samples_push(&s_gpu[i], times.pass_ms[i]);
+        }
+    }
+    s_seen_gpu_frame = times.frame;
+}
+
+static void begin_running(void)
+{
+    G_SetSimState(G_PAUSED_FULL);
+    Perf_ResetPercentiles();
+
+    struct render_stats stats;
+    R_GetStats(&stats);
+
+    /* The render thread may be working on the frame right after 
+     * the last one published, which was queued before the pause. */
+    s_first_rframe = stats.frame + 2;
+    s_last_rframe = UINT64_MAX;
+    s_seen_rframe = stats.frame;
+    s_start_pc = SDL_GetPerformanceCounter();
+    s_frame = 0;
+    s_phase = PHASE_RUNNING;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool RenderBench_Init(uint32_t nframes, const char *pathfile, const char *outpath)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!s_active);
+
+    vec_pose_init(&s_path);
+    if(pathfile && !load_path(pathfile)) {
+        fprintf(stderr, "Failed to load the camera path: %s\n", pathfile);
+        goto fail_path;
+    }
+    if(!pathfile) {
+        make_orbit_path();
+    }
+
+    size_t ninit = 0;
+    for(; ninit < RENDER_GPU_PASS_COUNT; ninit++) {
+        struct samples *s = &s_gpu[ninit];
+        s->ms = malloc((nframes + DRAIN_FRAMES) * sizeof(float));
+        s->size = 0;
+        s->capacity = nframes + DRAIN_FRAMES;
+        if(!s->ms)
+            goto fail_samples;
+    }
+
+    s_nframes = nframes;
+    s_frame = 0;
+    s_counted = 0;
+    s_phase = PHASE_LOADING;
+    memset(s_pass_sums, 0, sizeof(s_pass_sums));
+    memset(&s_total_sums, 0, sizeof(s_total_sums));
+    pf_strlcpy(s_outpath, outpath, sizeof(s_outpath));
+
+    set_gpu_timers(true);
+    s_active = true;
+    return true;
+
+fail_samples:
+    for(size_t i = 0; i < ninit; i++) {
+        free(s_gpu[i].ms);
+    }
+fail_path:
+    vec_pose_destroy(&s_path);
+    return false;
+}
+
+void RenderBench_Shutdown(void)
+{
+    if(!s_active)
+        return;
+
+    for(int i = 0; i < RENDER_GPU_PASS_COUNT; i++) {
+        free(s_gpu[i].ms);
+    }
+    vec_pose_destroy(&s_path);
+    s_active = false;
+}
+
+bool RenderBench_Active(void)
+{
+    return s_active;
+}
+
+void RenderBench_Prepare(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_active);
+
+    if(s_phase != PHASE_RUNNING && s_phase != PHASE_DRAIN)
+        return;
+
+    struct camera *cam = G_GetActiveCamera();
+    struct cam_pose pose = pose_at(s_frame);
+
+    Camera_SetPos(cam, pose.pos);
+    Camera_SetPitchAndYaw(cam, pose.pitch, pose.yaw);
+    Camera_TickFinishPerspective(cam);
+}
+
+bool RenderBench_Step(bool sim_ran)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_active);
+
+    switch(s_phase) {
+    case PHASE_LOADING:
+        if(sim_ran) {
+            s_frame = 0;
+            s_phase = PHASE_WARMUP;
+        }
+        return true;
+
+    case PHASE_WARMUP:
+        if(sim_ran && ++s_frame == WARMUP_FRAMES) {
+            begin_running();
+        }
+        return true;
+
+    case PHASE_RUNNING:
+        sample_frame();
+        if(++s_frame < s_nframes)
+            return true;
+
+        /* The frame rendered next is the last one of the path */
+        struct render_stats stats;
+        R_GetStats(&stats);
+        s_last_rframe = stats.frame + 2;
+        s_frame = 0;
+        s_phase = PHASE_DRAIN;
+        return true;
+
+    case PHASE_DRAIN:
+        sample_frame();
+        if(s_seen_gpu_frame < s_last_rframe && ++s_frame < DRAIN_FRAMES)
+            return true;
+        break;
+
+    default: assert(0);
+    }
+
+    set_gpu_timers(false);
+    print_summary();
+
+    if(!write_results()) {
+        fprintf(stderr, "Failed to write render benchmark results to: %s\n", s_outpath);
+    }else{
+        printf("Wrote render benchmark results (%u frames) to: %s\n", s_nframes, s_outpath);
+    }
+    return false;
+}
+
+bool RenderBench_RecordInit(const char *pathfile)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(!s_record);
+
+    s_record = fopen(pathfile, "w");
+    if(!s_record)
+        return false;
+    fprintf(s_record, "# x y z pitch yaw\n");
+    return true;
+}
+
+void RenderBench_RecordStep(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_record)
+        return;
+
+    const struct camera *cam = G_GetActiveCamera();
+    vec3_t pos = Camera_GetPos(cam);
+    fprintf(s_record, "%f %f %f %f %f\n", pos.x, pos.y, pos.z, 
+        Camera_GetPitch(cam), Camera_GetYaw(cam));
+}
+
+void RenderBench_RecordShutdown(void)
+{
+    if(!s_record)
+        return;
+    fclose(s_record);
+    s_record = NULL;
+}
+
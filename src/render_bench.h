@@ -0,0 +1,73 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef RENDER_BENCH_H
+#define RENDER_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The render benchmark mode flies the active camera along a camera path 
+ * over the scene set up by the script. The simulation is run for a short
+ * while for the scene to settle and is then paused, so that every run 
+ * draws the same entities in the same animation state. Every frame, the 
+ * GPU time of the major passes and the render counters are sampled. The 
+ * summary is printed and written out as JSON once the path is done. 
+ *
+ * A camera path is a text file with one 'x y z pitch yaw' pose per line. 
+ * The poses are spread evenly over the frames of the run. Without a path, 
+ * the camera circles the center of the map. A path can be recorded from a
+ * regular session of the game with 'RenderBench_RecordInit'.
+ */
+
+bool RenderBench_Init(uint32_t nframes, const char *pathfile, const char *outpath);
+void RenderBench_Shutdown(void);
+bool RenderBench_Active(void);
+/* Place the camera for the frame. Must be called after the simulation has 
+ * been updated and before the frame is rendered. */
+void RenderBench_Prepare(void);
+/* Sample the counters of the last frame. Returns false once the path has 
+ * been flown and the results were written out. 
+ */
+bool RenderBench_Step(bool sim_ran);
+
+/* Append the pose of the active camera to the path file every frame */
+bool RenderBench_RecordInit(const char *pathfile);
+void RenderBench_RecordStep(void);
+void RenderBench_RecordShutdown(void);
+
+#endif
+
@@ -0,0 +1,608 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "replay.h"
+#include "main.h"
+#include "settings.h"
+#include "game/public/game.h"
+#include "lib/public/vec.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define REPLAY_MAGIC    (0x50524650) /* 'PFRP' */
+#define REPLAY_VERSION  (1)
+#define MAX_NAME_LEN    (32)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+enum record_tag{
+    TAG_FRAME   = 'F',
+    TAG_COMMAND = 'C',
+    TAG_SCRIPT  = 'S',
+    TAG_HASH    = 'H',
+    TAG_END     = 'E',
+};
+
+enum phase{
+    PHASE_PRE_UPDATE,
+    PHASE_POST_UPDATE,
+};
+
+enum mode{
+    MODE_NONE,
+    MODE_RECORD,
+    MODE_PLAYBACK,
+};
+
+struct stored_cmd{
+    uint8_t  phase;
+    uint8_t  type;
+    bool     attack;
+    uint32_t target;
+    vec3_t   pos;
+    vec2_t   orientation;
+    size_t   first_uid;
+    size_t   nents;
+};
+
+struct frame{
+    int      nticks;
+    size_t   first_cmd;
+    size_t   ncmds;
+};
+
+struct checkpoint{
+    uint32_t frame;
+    uint64_t state_hash;
+    uint64_t script_hash;
+};
+
+VEC_TYPE(cmd, struct stored_cmd)
+VEC_IMPL(static inline, cmd, struct stored_cmd)
+
+VEC_TYPE(frame, struct frame)
+VEC_IMPL(static inline, frame, struct frame)
+
+VEC_TYPE(checkpoint, struct checkpoint)
+VEC_IMPL(static inline, checkpoint, struct checkpoint)
+
+VEC_TYPE(uid, uint32_t)
+VEC_IMPL(static inline, uid, uint32_t)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static enum mode            s_mode = MODE_NONE;
+static enum phase           s_phase;
+static uint32_t             s_frame;
+static uint64_t             s_script_hash;
+
+/* Recording */
+static SDL_RWops           *s_stream;
+static uint32_t             s_hash_interval;
+static bool                 s_write_failed;
+
+/* Playback */
+static vec_frame_t          s_frames;
+static vec_cmd_t            s_cmds;
+static vec_uid_t            s_uids;
+static vec_checkpoint_t     s_checkpoints;
+static size_t               s_next_checkpoint;
+static uint32_t             s_nchecked;
+static uint32_t             s_nmismatched;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    /* FNV-1a */
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static bool write_u8(uint8_t val)
+{
+    return (SDL_WriteU8(s_stream, val) == 1);
+}
+
+static bool write_u32(uint32_t val)
+{
+    return (SDL_WriteLE32(s_stream, val) == 1);
+}
+
+static bool write_u64(uint64_t val)
+{
+    return (SDL_WriteLE64(s_stream, val) == 1);
+}
+
+static bool write_float(float val)
+{
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    return write_u32(bits);
+}
+
+static float read_float(SDL_RWops *stream)
+{
+    uint32_t bits = SDL_ReadLE32(stream);
+    float ret;
+    memcpy(&ret, &bits, sizeof(ret));
+    return ret;
+}
+
+static void check_write(bool result)
+{
+    if(!result && !s_write_failed) {
+        fprintf(stderr, "Failed to write to the replay file. The recording will be incomplete.\n");
+        s_write_failed = true;
+    }
+}
+
+static void write_checkpoint(void)
+{
+    bool ret = write_u8(TAG_HASH)
+            && write_u32(s_frame)
+            && write_u64(G_StateHash())
+            && write_u64(s_script_hash);
+    check_write(ret);
+}
+
+static void dispatch_command(const struct replay_cmd *cmd)
+{
+    /* The selection is copied out of the entity list */
+    uint32_t *ents = (uint32_t*)cmd->ents;
+
+    switch(cmd->type) {
+    case REPLAY_CMD_SELECT:
+        G_Sel_Set(ents, cmd->nents);
+        break;
+    case REPLAY_CMD_MOVE:
+        G_Move_Order(cmd->nents, ents, cmd->attack, cmd->pos, cmd->orientation);
+        break;
+    case REPLAY_CMD_ATTACK:
+        G_Combat_AttackOrder(cmd->nents, ents, cmd->target);
+        break;
+    case REPLAY_CMD_BUILD:
+        G_Builder_BuildOrder(cmd->nents, ents, cmd->target);
+        break;
+    case REPLAY_CMD_GATHER:
+        G_Harvester_GatherOrder(cmd->nents, ents, cmd->target);
+        break;
+    default: assert(0);
+    }
+}
+
+static void apply_commands(enum phase phase)
+{
+    if(s_frame >= vec_size(&s_frames))
+        return;
+
+    const struct frame *frame = &vec_AT(&s_frames, s_frame);
+    for(size_t i = frame->first_cmd; i < frame->first_cmd + frame->ncmds; i++) {
+
+        const struct stored_cmd *cmd = &vec_AT(&s_cmds, i);
+        if(cmd->phase != phase)
+            continue;
+
+        dispatch_command(&(struct replay_cmd){
+            .type = cmd->type,
+            .nents = cmd->nents,
+            .ents = s_uids.array + cmd->first_uid,
+            .target = cmd->target,
+            .attack = cmd->attack,
+            .pos = cmd->pos,
+            .orientation = cmd->orientation
+        });
+    }
+}
+
+static void check_checkpoint(void)
+{
+    if(s_next_checkpoint == vec_size(&s_checkpoints))
+        return;
+
+    const struct checkpoint *cp = &vec_AT(&s_checkpoints, s_next_checkpoint);
+    if(cp->frame != s_frame)
+        return;
+    s_next_checkpoint++;
+    s_nchecked++;
+
+    uint64_t state_hash = G_StateHash();
+    if(state_hash == cp->state_hash && s_script_hash == cp->script_hash)
+        return;
+
+    if(s_nmismatched++ == 0) {
+        fprintf(stderr, "The replay diverged from the recording at frame %u "
+            "[state: %016llx, expected: %016llx] [script: %016llx, expected: %016llx]\n", 
+            s_frame, 
+            (unsigned long long)state_hash, (unsigned long long)cp->state_hash,
+            (unsigned long long)s_script_hash, (unsigned long long)cp->script_hash);
+    }
+}
+
+static bool read_command(SDL_RWops *stream)
+{
+    struct stored_cmd cmd = {0};
+    cmd.phase = SDL_ReadU8(stream);
+    cmd.type = SDL_ReadU8(stream);
+    cmd.attack = SDL_ReadU8(stream);
+    cmd.target = SDL_ReadLE32(stream);
+    cmd.pos.x = read_float(stream);
+    cmd.pos.y = read_float(stream);
+    cmd.pos.z = read_float(stream);
+    cmd.orientation.x = read_float(stream);
+    cmd.orientation.z = read_float(stream);
+    cmd.nents = SDL_ReadLE32(stream);
+    cmd.first_uid = vec_size(&s_uids);
+
+    if(cmd.type >= REPLAY_CMD_SCRIPT || cmd.phase > PHASE_POST_UPDATE)
+        return false;
+    size_t needed = vec_size(&s_uids) + cmd.nents;
+    if(needed > s_uids.capacity && !vec_uid_resize(&s_uids, MAX(needed, s_uids.capacity * 2)))
+        return false;
+
+    for(size_t i = 0; i < cmd.nents; i++) {
+        vec_uid_push(&s_uids, SDL_ReadLE32(stream));
+    }
+
+    /* Commands issued before the first frame are applied along 
+     * with the ones of the first frame */
+    if(vec_size(&s_frames) == 0) {
+        vec_frame_push(&s_frames, (struct frame){1, 0, 0});
+    }
+    vec_AT(&s_frames, vec_size(&s_frames) - 1).ncmds++;
+    return vec_cmd_push(&s_cmds, cmd);
+}
+
+static bool load_replay(SDL_RWops *stream, unsigned *out_seed)
+{
+    if(SDL_ReadLE32(stream) != REPLAY_MAGIC)
+        return false;
+    if(SDL_ReadLE32(stream) != REPLAY_VERSION)
+        return false;
+    *out_seed = SDL_ReadLE32(stream);
+    s_hash_interval = SDL_ReadLE32(stream);
+
+    /* The first frame may be a placeholder for commands 
+     * which were recorded before any frames */
+    bool placeholder = false;
+
+    while(true) {
+
+        uint8_t tag;
+        if(SDL_RWread(stream, &tag, 1, 1) != 1)
+            return false;
+
+        switch(tag) {
+        case TAG_FRAME: {
+            int nticks = SDL_ReadLE32(stream);
+            if(vec_size(&s_frames) == 1 && placeholder) {
+                vec_AT(&s_frames, 0).nticks = nticks;
+                placeholder = false;
+                break;
+            }
+            vec_frame_push(&s_frames, (struct frame){nticks, vec_size(&s_cmds), 0});
+            break;
+        }
+        case TAG_COMMAND:
+            placeholder = placeholder || (vec_size(&s_frames) == 0);
+            if(!read_command(stream))
+                return false;
+            break;
+        case TAG_SCRIPT: {
+            uint8_t len = SDL_ReadU8(stream);
+            /* The name, uid, target and XZ position. They are only informational. */
+            if(SDL_RWseek(stream, len + 4 * sizeof(uint32_t), RW_SEEK_CUR) < 0)
+                return false;
+            break;
+        }
+        case TAG_HASH: {
+            struct checkpoint cp;
+            cp.frame = SDL_ReadLE32(stream);
+            cp.state_hash = SDL_ReadLE64(stream);
+            cp.script_hash = SDL_ReadLE64(stream);
+            vec_checkpoint_push(&s_checkpoints, cp);
+            break;
+        }
+        case TAG_END:
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+static void set_deterministic(void)
+{
+    /* The movement is otherwise allowed to be updated in shards or on the 
+     * GPU, which does not produce the same results from run to run */
+    struct sval on = (struct sval){
+        .type = ST_TYPE_BOOL,
+        .as_bool = true
+    };
+    ss_e status = Settings_SetNoPersist("pf.game.deterministic_movement", &on);
+    assert(status == SS_OKAY);
+    (void)status;
+}
+
+static void reset_state(void)
+{
+    s_frame = 0;
+    s_phase = PHASE_PRE_UPDATE;
+    s_script_hash = 0xcbf29ce484222325ull;
+    s_write_failed = false;
+    s_next_checkpoint = 0;
+    s_nchecked = 0;
+    s_nmismatched = 0;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Replay_InitRecord(const char *path, unsigned seed, uint32_t hash_interval)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_mode == MODE_NONE);
+    assert(hash_interval > 0);
+
+    s_stream = SDL_RWFromFile(path, "wb");
+    if(!s_stream)
+        return false;
+
+    bool ret = write_u32(REPLAY_MAGIC)
+            && write_u32(REPLAY_VERSION)
+            && write_u32(seed)
+            && write_u32(hash_interval);
+    if(!ret) {
+        SDL_RWclose(s_stream);
+        return false;
+    }
+
+    reset_state();
+    s_hash_interval = hash_interval;
+    s_mode = MODE_RECORD;
+
+    srand(seed);
+    set_deterministic();
+    return true;
+}
+
+bool Replay_InitPlayback(const char *path, uint32_t *out_nframes, unsigned *out_seed)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(s_mode == MODE_NONE);
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        return false;
+
+    vec_frame_init(&s_frames);
+    vec_cmd_init(&s_cmds);
+    vec_uid_init(&s_uids);
+    vec_checkpoint_init(&s_checkpoints);
+
+    unsigned seed;
+    bool ret = load_replay(stream, &seed);
+    SDL_RWclose(stream);
+
+    if(!ret || vec_size(&s_frames) == 0) {
+        fprintf(stderr, "Failed to parse the replay file: %s\n", path);
+        vec_frame_destroy(&s_frames);
+        vec_cmd_destroy(&s_cmds);
+        vec_uid_destroy(&s_uids);
+        vec_checkpoint_destroy(&s_checkpoints);
+        return false;
+    }
+
+    reset_state();
+    s_mode = MODE_PLAYBACK;
+    *out_nframes = vec_size(&s_frames);
+    *out_seed = seed;
+
+    srand(seed);
+    set_deterministic();
+    return true;
+}
+
+bool Replay_Shutdown(void)
+{
+    bool ret = true;
+
+    switch(s_mode) {
+    case MODE_RECORD:
+        check_write(write_u8(TAG_END));
+        if(SDL_RWclose(s_stream) != 0) {
+            fprintf(stderr, "Failed to write out the replay file.\n");
+            ret = false;
+        }
+        printf("Recorded %u frames of replay.\n", s_frame);
+        break;
+
+    case MODE_PLAYBACK:
+        printf("Played back %u of %u frames of replay: %u of %u checkpoints matched.\n", 
+            MIN(s_frame, (uint32_t)vec_size(&s_frames)), (unsigned)vec_size(&s_frames),
+            s_nchecked - s_nmismatched, (unsigned)vec_size(&s_checkpoints));
+        ret = (s_nmismatched == 0) && (s_nchecked == vec_size(&s_checkpoints));
+
+        vec_frame_destroy(&s_frames);
+        vec_cmd_destroy(&s_cmds);
+        vec_uid_destroy(&s_uids);
+        vec_checkpoint_destroy(&s_checkpoints);
+        break;
+
+    default:
+        break;
+    }
+
+    s_mode = MODE_NONE;
+    return ret;
+}
+
+bool Replay_Recording(void)
+{
+    return (s_mode == MODE_RECORD);
+}
+
+bool Replay_Playing(void)
+{
+    return (s_mode == MODE_PLAYBACK);
+}
+
+int Replay_FrameTicks(void)
+{
+    assert(s_mode == MODE_PLAYBACK);
+    if(s_frame >= vec_size(&s_frames))
+        return 1;
+    return vec_AT(&s_frames, s_frame).nticks;
+}
+
+void Replay_BeginFrame(int nticks)
+{
+    ASSERT_IN_MAIN_THREAD();
+    s_phase = PHASE_PRE_UPDATE;
+
+    switch(s_mode) {
+    case MODE_RECORD:
+        check_write(write_u8(TAG_FRAME) && write_u32(nticks));
+        break;
+    case MODE_PLAYBACK:
+        apply_commands(PHASE_PRE_UPDATE);
+        break;
+    default:
+        break;
+    }
+}
+
+void Replay_BeginUpdate(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    s_phase = PHASE_POST_UPDATE;
+}
+
+void Replay_EndFrame(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    switch(s_mode) {
+    case MODE_RECORD:
+        if((s_frame + 1) % s_hash_interval == 0) {
+            write_checkpoint();
+        }
+        break;
+    case MODE_PLAYBACK:
+        apply_commands(PHASE_POST_UPDATE);
+        check_checkpoint();
+        break;
+    default:
+        return;
+    }
+    s_frame++;
+    s_phase = PHASE_PRE_UPDATE;
+}
+
+void Replay_RecordCommand(const struct replay_cmd *cmd)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(cmd->type < REPLAY_CMD_SCRIPT);
+
+    if(s_mode != MODE_RECORD)
+        return;
+
+    bool ret = write_u8(TAG_COMMAND)
+            && write_u8(s_phase)
+            && write_u8(cmd->type)
+            && write_u8(cmd->attack)
+            && write_u32(cmd->target)
+            && write_float(cmd->pos.x)
+            && write_float(cmd->pos.y)
+            && write_float(cmd->pos.z)
+            && write_float(cmd->orientation.x)
+            && write_float(cmd->orientation.z)
+            && write_u32(cmd->nents);
+    for(size_t i = 0; ret && i < cmd->nents; i++) {
+        ret = write_u32(cmd->ents[i]);
+    }
+    check_write(ret);
+}
+
+void Replay_ExecuteCommand(const struct replay_cmd *cmd)
+{
+    ASSERT_IN_MAIN_THREAD();
+    assert(cmd->type < REPLAY_CMD_SCRIPT);
+
+    Replay_RecordCommand(cmd);
+    dispatch_command(cmd);
+}
+
+void Replay_RecordScript(const char *name, uint32_t uid, uint32_t target, vec3_t pos)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(s_mode == MODE_NONE)
+        return;
+
+    size_t len = MIN(strlen(name), MAX_NAME_LEN);
+    s_script_hash = hash_bytes(s_script_hash, name, len);
+    s_script_hash = hash_bytes(s_script_hash, &uid, sizeof(uid));
+    s_script_hash = hash_bytes(s_script_hash, &target, sizeof(target));
+    s_script_hash = hash_bytes(s_script_hash, &pos.x, sizeof(pos.x));
+    s_script_hash = hash_bytes(s_script_hash, &pos.z, sizeof(pos.z));
+
+    if(s_mode != MODE_RECORD)
+        return;
+
+    bool ret = write_u8(TAG_SCRIPT)
+            && write_u8(len)
+            && (SDL_RWwrite(s_stream, name, len, 1) == 1)
+            && write_u32(uid)
+            && write_u32(target)
+            && write_float(pos.x)
+            && write_float(pos.z);
+    check_write(ret);
+}
+
@@ -0,0 +1,111 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "pf_math.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* A replay is a recording of the commands issued during a session, keyed by 
+ * the simulation frame they were issued in, along with the number of 60Hz 
+ * ticks that every frame advanced by and the seed of the random number 
+ * generator. Playing it back re-runs the same scene script with the same 
+ * frame/tick schedule, without any input, and injects the commands that the 
+ * player issued on the frames that they were issued in. 
+ *
+ * The commands issued by scripts are recorded too, but they are not injected, 
+ * as the script will issue them again on its' own. Instead, they are folded 
+ * into a hash, which is checked along with a hash of the simulation state 
+ * every few frames to detect the playback diverging from the recording.
+ *
+ * Note that the commands issued by the script handlers of input events (ex. 
+ * hotkeys) are not reproduced by the playback.
+ */
+
+enum replay_cmd_type{
+    REPLAY_CMD_SELECT,
+    REPLAY_CMD_MOVE,
+    REPLAY_CMD_ATTACK,
+    REPLAY_CMD_BUILD,
+    REPLAY_CMD_GATHER,
+    REPLAY_CMD_SCRIPT,
+    REPLAY_CMD_MAX
+};
+
+struct replay_cmd{
+    enum replay_cmd_type type;
+    size_t               nents;
+    const uint32_t      *ents;
+    uint32_t             target;
+    bool                 attack;
+    vec3_t               pos;
+    vec2_t               orientation;
+    /* For script-issued commands, the name of the API call */
+    const char          *name;
+};
+
+bool Replay_InitRecord(const char *path, unsigned seed, uint32_t hash_interval);
+/* Load the replay to be played back. Returns the number of simulation frames 
+ * and the seed of the recorded session. */
+bool Replay_InitPlayback(const char *path, uint32_t *out_nframes, unsigned *out_seed);
+/* Returns false if the playback diverged from the recording */
+bool Replay_Shutdown(void);
+bool Replay_Recording(void);
+bool Replay_Playing(void);
+
+/* The number of 60Hz ticks that the next simulation frame should be advanced 
+ * by during playback. */
+int  Replay_FrameTicks(void);
+/* The main loop brackets every frame of the simulation with these calls. In 
+ * playback, the commands issued before the update of a frame (from input 
+ * handlers) are applied in 'BeginFrame', and the ones issued by the update 
+ * itself (ex. box selection) are applied in 'EndFrame'. */
+void Replay_BeginFrame(int nticks);
+void Replay_BeginUpdate(void);
+void Replay_EndFrame(void);
+
+void Replay_RecordCommand(const struct replay_cmd *cmd);
+/* Record the command and issue the orders for it. Used for applying the 
+ * commands which were deferred (ex. by the network layer). */
+void Replay_ExecuteCommand(const struct replay_cmd *cmd);
+void Replay_RecordScript(const char *name, uint32_t uid, uint32_t target, vec3_t pos);
+
+#endif
+
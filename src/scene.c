@@ -43,112 +43,302 @@
 #include "lib/public/attr.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 #include <assert.h>
 
 
 #define PFSCENE_VERSION (1.0)
 
+#define PARSE_CHUNK_ENTS  (256)
+#define MAX_PARSE_CHUNKS  (1024)
+#define MIN_PARALLEL_ENTS (1024)
+
 #define STR2(val) #val
 #define STR(val) STR2(val)
 #define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
 
 VEC_IMPL(extern, attr, struct attr)
 __KHASH_IMPL(attr, extern, kh_cstr_t, struct attr, 1, kh_str_hash_func, kh_str_hash_equal)
 
+/* An entity as it is read from the scene file */
+struct entity_record{
+    char            name[128];
+    char            path[256];
+    khash_t(attr)  *attrs;
+    vec_attr_t      constructor_args;
+    unsigned        ntags;
+    char          (*tags)[128];
+};
+
+/* A run of whole entity records in the scene file, and what was read from it */
+struct parse_chunk{
+    const char           *begin;
+    size_t                size;
+    size_t                nrecs;
+    size_t                cap;
+    struct entity_record *recs;
+    bool                  ok;
+};
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static bool scene_load_entity(SDL_RWops *stream)
+static void entity_record_destroy(struct entity_record *rec)
+{
+    const char *key;
+    struct attr val;
+    (void)val;
+
+    if(rec->attrs) {
+        kh_foreach(rec->attrs, key, val, { 
+            free((void*)key);
+        });
+        kh_destroy(attr, rec->attrs);
+    }
+    vec_attr_destroy(&rec->constructor_args);
+    free(rec->tags);
+    memset(rec, 0, sizeof(*rec));
+}
+
+/* Only reads the record into memory, without creating anything. Thus, 
+ * this is safe to call from worker threads. */
+static bool scene_parse_entity(SDL_RWops *stream, struct entity_record *out)
 {
     char line[MAX_LINE_LEN];
-    char name[128];
-    char path[256];
-    unsigned num_atts, ntags = 0;
-    char tags[128][MAX_TAGS];
+    unsigned num_atts;
 
-    khash_t(attr) *attr_table = kh_init(attr);
-    if(!attr_table)
-        goto fail_alloc;
+    memset(out, 0, sizeof(*out));
+    vec_attr_init(&out->constructor_args);
 
-    vec_attr_t constructor_args;
-    vec_attr_init(&constructor_args);
+    out->attrs = kh_init(attr);
+    if(!out->attrs)
+        goto fail;
 
-    READ_LINE(stream, line, fail_parse);
-    if(!sscanf(line, " entity %127s %255s %u", name, path, &num_atts))
-        goto fail_parse;
+    READ_LINE(stream, line, fail);
+    if(!sscanf(line, " entity %127s %255s %u", out->name, out->path, &num_atts))
+        goto fail;
 
     for(int i = 0; i < num_atts; i++) {
         struct attr attr;
         if(!Attr_Parse(stream, &attr, true))
-            goto fail_parse;
+            goto fail;
 
         int ret;
-        khiter_t k = kh_put(attr, attr_table, pf_strdup(attr.key), &ret);
-        assert(ret != -1 && ret != 0);
-        kh_value(attr_table, k) = attr;
+        khiter_t k = kh_put(attr, out->attrs, pf_strdup(attr.key), &ret);
+        if(ret == -1 || ret == 0)
+            goto fail;
+        kh_value(out->attrs, k) = attr;
 
         if(!strcmp(attr.key, "constructor_arguments")) {
 
             if(attr.type != TYPE_INT)
-                goto fail_parse;
+                goto fail;
 
             size_t num_args = attr.val.as_int;
             struct attr const_arg;
             
             for(int j = 0; j < num_args; j++) {
-                if(!Attr_Parse(stream, &const_arg, false)) {
-                    vec_attr_destroy(&constructor_args);
-                    goto fail_parse;
-                }
-                vec_attr_push(&constructor_args, const_arg);
+                if(!Attr_Parse(stream, &const_arg, false))
+                    goto fail;
+                vec_attr_push(&out->constructor_args, const_arg);
             }
         }
 
         if(!strcmp(attr.key, "tags")) {
 
-            if(attr.type != TYPE_INT)
-                goto fail_parse;
+            if(attr.type != TYPE_INT || attr.val.as_int < 0 || attr.val.as_int > MAX_TAGS)
+                goto fail;
+
+            out->ntags = attr.val.as_int;
+            out->tags = malloc(out->ntags * sizeof(out->tags[0]));
+            if(out->ntags && !out->tags)
+                goto fail;
 
-            ntags = attr.val.as_int;
-            for(int j = 0; j < ntags; j++) {
+            for(int j = 0; j < out->ntags; j++) {
 
-                READ_LINE(stream, line, fail_parse);
-                if(!sscanf(line, " tag \"%127[^\"]", tags[j]))
-                    goto fail_parse;
+                READ_LINE(stream, line, fail);
+                if(!sscanf(line, " tag \"%127[^\"]", out->tags[j]))
+                    goto fail;
             }
         }
     }
+    return true;
 
+fail:
+    entity_record_destroy(out);
+    return false;
+}
+
+static bool scene_create_entity(const struct entity_record *rec)
+{
     script_opaque_t obj;
-    if(!(obj = S_Entity_ObjFromAtts(path, name, attr_table, &constructor_args)))
-        goto fail_init;
+    if(!(obj = S_Entity_ObjFromAtts(rec->path, rec->name, rec->attrs, &rec->constructor_args)))
+        return false;
 
     uint32_t uid;
     S_Entity_UIDForObj(obj, &uid);
 
-    for(int i = 0; i < ntags; i++) {
-        Entity_AddTag(uid, tags[i]);
+    for(int i = 0; i < rec->ntags; i++) {
+        Entity_AddTag(uid, rec->tags[i]);
     }
-
-    const char *key;
-    struct attr val;
-    kh_foreach(attr_table, key, val, { 
-        (void)val;
-        free((void*)key);
-    });
-    
-    kh_destroy(attr, attr_table);
-    vec_attr_destroy(&constructor_args);
     return true;
+}
 
-fail_init:
-    vec_attr_destroy(&constructor_args);
-fail_parse:
-    kh_destroy(attr, attr_table);
-fail_alloc:
-    return false;
+static bool scene_load_entity(SDL_RWops *stream)
+{
+    struct entity_record rec;
+    if(!scene_parse_entity(stream, &rec))
+        return false;
+
+    bool ret = scene_create_entity(&rec);
+    entity_record_destroy(&rec);
+    return ret;
+}
+
+static void scene_parse_chunk_task(size_t begin, size_t end, void *arg)
+{
+    struct parse_chunk *chunks = arg;
+
+    for(size_t i = begin; i < end; i++) {
+
+        struct parse_chunk *chunk = &chunks[i];
+        SDL_RWops *stream = SDL_RWFromConstMem(chunk->begin, chunk->size);
+        if(!stream)
+            continue;
+
+        while(SDL_RWtell(stream) < chunk->size) {
+
+            if(chunk->nrecs == chunk->cap) {
+                size_t cap = chunk->cap ? chunk->cap * 2 : 64;
+                struct entity_record *recs = realloc(chunk->recs, cap * sizeof(*recs));
+                if(!recs)
+                    goto fail;
+                chunk->recs = recs;
+                chunk->cap = cap;
+            }
+
+            if(!scene_parse_entity(stream, &chunk->recs[chunk->nrecs]))
+                goto fail;
+            chunk->nrecs++;
+        }
+        chunk->ok = true;
+    fail:
+        SDL_RWclose(stream);
+    }
+}
+
+/* Find the start of the next line beginning with 'prefix' at or after 'from' */
+static const char *scene_next_line(const char *buff, const char *from, 
+                                   const char *end, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    const char *curr = from;
+
+    if(curr > buff && curr[-1] != '\n') {
+        curr = memchr(curr, '\n', end - curr);
+        if(!curr)
+            return end;
+        curr++;
+    }
+
+    while(curr < end) {
+        if(end - curr >= len && 0 == memcmp(curr, prefix, len))
+            return curr;
+        curr = memchr(curr, '\n', end - curr);
+        if(!curr)
+            return end;
+        curr++;
+    }
+    return end;
+}
+
+/* The entity records are independent of one another, so the section is split 
+ * at the lines starting new records and the pieces are parsed by the workers. 
+ * Only creating the entities from the records is left to the main thread. 
+ * The split relies on the layout of the text format. Should the pieces not 
+ * parse to exactly the expected records, false is returned with the stream 
+ * left untouched, and the records are to be read one after another instead. 
+ */
+static bool scene_load_entities_parallel(SDL_RWops *stream, unsigned num_ents, bool *out_ok)
+{
+    Sint64 start = SDL_RWtell(stream);
+    Sint64 size = SDL_RWsize(stream);
+    if(start < 0 || size <= start)
+        return false;
+
+    size_t nbytes = size - start;
+    char *buff = malloc(nbytes);
+    if(!buff)
+        return false;
+
+    if(SDL_RWread(stream, buff, 1, nbytes) != nbytes) {
+        SDL_RWseek(stream, start, RW_SEEK_SET);
+        free(buff);
+        return false;
+    }
+
+    const char *end = scene_next_line(buff, buff, buff + nbytes, "section ");
+    size_t nchunks = MIN((num_ents + PARSE_CHUNK_ENTS - 1) / PARSE_CHUNK_ENTS, MAX_PARSE_CHUNKS);
+    struct parse_chunk *chunks = calloc(nchunks, sizeof(struct parse_chunk));
+    bool ret = false;
+    if(!chunks)
+        goto out;
+
+    const char *curr = buff;
+    size_t nsplit = 0;
+    for(int i = 0; i < nchunks && curr < end; i++) {
+
+        const char *next = (i == nchunks - 1) ? end 
+            : scene_next_line(buff, buff + (end - buff) * (i + 1) / nchunks, end, "entity ");
+        if(next <= curr)
+            continue;
+
+        chunks[nsplit++] = (struct parse_chunk){ .begin = curr, .size = next - curr };
+        curr = next;
+    }
+
+    Sched_ParallelFor(0, nsplit, 1, scene_parse_chunk_task, chunks);
+
+    size_t nrecs = 0;
+    bool parsed = true;
+    for(int i = 0; i < nsplit; i++) {
+        parsed = parsed && chunks[i].ok;
+        nrecs += chunks[i].nrecs;
+    }
+
+    if(parsed && nrecs == num_ents) {
+
+        ret = true;
+        *out_ok = true;
+        SDL_RWseek(stream, start + (end - buff), RW_SEEK_SET);
+
+        for(int i = 0; i < nsplit; i++) {
+        for(int j = 0; j < chunks[i].nrecs; j++) {
+            if(*out_ok && !scene_create_entity(&chunks[i].recs[j])) {
+                *out_ok = false;
+            }
+            Sched_TryYield();
+        }}
+    }
+
+    for(int i = 0; i < nsplit; i++) {
+        for(int j = 0; j < chunks[i].nrecs; j++) {
+            entity_record_destroy(&chunks[i].recs[j]);
+        }
+        free(chunks[i].recs);
+    }
+    free(chunks);
+
+out:
+    if(!ret) {
+        SDL_RWseek(stream, start, RW_SEEK_SET);
+    }
+    free(buff);
+    return ret;
 }
 
 static bool scene_load_entities(SDL_RWops *stream)
@@ -160,13 +350,27 @@ static bool scene_load_entities(SDL_RWops *stream)
     if(!sscanf(line, " num_entities %u", &num_ents))
         goto fail_parse;
 
+    /* The blocker, fog and region updates of all the entities are applied 
+     * together once they have all been created */
+    G_BeginEntityBatch(num_ents);
+
+    bool ok;
+    if(num_ents >= MIN_PARALLEL_ENTS && Sched_UsingBigStack()
+    && scene_load_entities_parallel(stream, num_ents, &ok)) {
+        G_EndEntityBatch();
+        return ok;
+    }
+
     for(int i = 0; i < num_ents; i++) {
         if(!scene_load_entity(stream))
-            goto fail_parse;
+            goto fail_entity;
         Sched_TryYield();
     }
+    G_EndEntityBatch();
     return true;
 
+fail_entity:
+    G_EndEntityBatch();
 fail_parse:
     return false;
 }
@@ -313,7 +517,7 @@ bool Scene_Load(const char *path)
     unsigned num_sections;
     float version;
 
-    stream = SDL_RWFromFile(path, "r");
+    stream = AL_StreamFromFile(path);
     if(!stream)
         goto fail_stream;
 
@@ -334,6 +538,7 @@ bool Scene_Load(const char *path)
     }
 
     SDL_RWclose(stream);
+    S_GC_CollectFull();
     return true;
     
 fail_parse:
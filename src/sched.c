@@ -33,6 +33,10 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* sched_getaffinity */
+#endif
+
 #include "sched.h"
 #include "config.h"
 #include "perf.h"
@@ -47,11 +51,20 @@
 #include "lib/public/khash.h"
 #include "lib/public/pf_string.h"
 #include "lib/public/mem.h"
+#include "lib/public/timer_wheel.h"
 
 #include <SDL.h>
 #include <inttypes.h>
-#ifdef _MSC_VER
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
 #endif
 
 
@@ -62,6 +75,10 @@ enum taskstate{
     TASK_STATE_RECV_BLOCKED,
     TASK_STATE_REPLY_BLOCKED,
     TASK_STATE_EVENT_BLOCKED,
+    TASK_STATE_CHAN_BLOCKED,
+    TASK_STATE_IO_BLOCKED,
+    TASK_STATE_SYNC_BLOCKED,
+    TASK_STATE_TIMER_BLOCKED,
     TASK_STATE_ZOMBIE,
 };
 
@@ -135,6 +152,10 @@ enum{
     _SCHED_REQ_RUN_SYNC,
 };
 
+/* Set on tasks created by a continuation, whose future may already 
+ * have continuations chained onto it */
+#define _TASK_CONTINUATION (1 << 15)
+
 #ifdef _MSC_VER
 __pragma(pack(push, 16))
 #endif
@@ -156,7 +177,12 @@ struct task{
     struct task   *prev, *next;
     void          *earg;
     void         (*erelease)(void*);
-    char          __pad[8];
+    uint64_t       ready_ts;
+    uint64_t       block_ts;
+    uint64_t       deadline;
+    uint64_t       run_start;
+    uint32_t       wnext;       /* the next task in the same wait queue */
+    char          __pad[4];
 };
 
 #ifdef _MSC_VER
@@ -164,11 +190,29 @@ __pragma(pack(pop));
 #endif
 
 #define MAX_TASKS               (8192)
-#define MAX_WORKER_THREADS      (64)
+#define MAX_WORKER_THREADS      (SCHED_MAX_WORKERS)
+#define MAIN_THREAD_SLOT        (MAX_WORKER_THREADS)
 #define STACK_SZ                (16 * 1024)
 #define BIG_STACK_SZ            (4 * 1024 * 1024)
+#define STACK_GUARD_SZ          (4096)
+#define MAX_CACHED_BIG_STACKS   (64)
 #define SCHED_TICK_MS           (1.0f / CONFIG_SCHED_TARGET_FPS * 1000.0f)
+#define SCHED_BG_BUDGET_MS      (SCHED_TICK_MS * CONFIG_SCHED_BG_BUDGET)
+#define SCHED_QUANTUM_MS        (2.0)
+#define SCHED_KEY_EMPTY         (INT_MAX)
+#define SCHED_KEY_DEADLINE      (-1)
 #define ALIGNED(val, align)     (((val) + ((align) - 1)) & ~((align) - 1))
+#define FRAME_CHUNK_SZ          (256 * 1024)
+#define FRAME_MAX_RETAINED      (16 * 1024 * 1024)
+#define FRAME_ALIGN             (16)
+#define IO_THREADS              (2)
+#define MAX_CONTINUATIONS       (MAX_TASKS)
+#define MAX_CPUS                (256)
+#define MAX_NODES               (64)
+/* Rough throughput of a hardware thread relative to the first thread of a 
+ * performance core, for when the OS doesn't report the core capacities */
+#define SMT_SIBLING_CAPACITY    (0.25f)
+#define EFFICIENCY_CAPACITY     (0.5f)
 
 PQUEUE_TYPE(task, struct task*)
 PQUEUE_IMPL(static, task, struct task*)
@@ -176,6 +220,17 @@ PQUEUE_IMPL(static, task, struct task*)
 QUEUE_TYPE(tid, uint32_t)
 QUEUE_IMPL(static, tid, uint32_t)
 
+struct io_req{
+    uint32_t   tid;
+    bool       write;
+    SDL_RWops *stream;
+    void      *buff;
+    size_t     size;
+};
+
+QUEUE_TYPE(io, struct io_req)
+QUEUE_IMPL(static, io, struct io_req)
+
 KHASH_MAP_INIT_INT64(tid, uint32_t)
 KHASH_MAP_INIT_INT(tqueue, queue_tid_t)
 
@@ -199,7 +254,24 @@ static struct task     *s_freehead;
 static unsigned         s_nfree = MAX_TASKS;
 
 static struct task      s_tasks[MAX_TASKS];
-static char             s_stacks[MAX_TASKS][STACK_SZ];
+/* The task stacks are mapped on demand (with an inaccessible guard page 
+ * below the lowest address of the stack, to catch overflows) and recycled 
+ * between tasks of the same size class. The pages of the stack are only
+ * committed by the OS when they are first touched. All the stack pool 
+ * state is protected by the request lock.
+ */
+struct stack_pool{
+    size_t                  size;
+    size_t                  max_cached;
+    size_t                  ncached;
+    void                  **cached;
+    struct sched_stack_stats stats;
+};
+
+static struct stack_pool s_stack_pools[SCHED_STACK_CLASS_COUNT] = {
+    [SCHED_STACK_SMALL] = {.size = STACK_SZ,     .max_cached = MAX_TASKS},
+    [SCHED_STACK_BIG]   = {.size = BIG_STACK_SZ, .max_cached = MAX_CACHED_BIG_STACKS},
+};
 static queue_tid_t      s_msg_queues[MAX_TASKS];
 static bool             s_parent_waiting[MAX_TASKS];
 static khash_t(tqueue) *s_event_queues;
@@ -207,26 +279,91 @@ static khash_t(tqueue) *s_event_queues;
 /* Lock used to serialzie the scheduler requests */
 static SDL_mutex       *s_request_lock;
 
-/* The active worker threads wait on the ready cond to be 
- * notified when the ready queue(s) becomes non-empty, so that
- * they can pop a task to execute. At the end of a frame, the 
- * ready condition variable is also used to notify the workers 
- * that the 'quiesce' flags has been set, instructing them to 
- * go back to waiting on a start/quit command. 
- * 
- * We have 2 diff. queues to allow only de-queuing tasks based
- * on the thread. The worker threads will not dequeue from the 
- * 'main' queues.
+/* Sleeping tasks are kept in a timer wheel keyed by their wake time in 
+ * milliseconds since scheduler initialization. At the start of every tick, 
+ * the main thread advances the wheel and makes only the tasks that are due 
+ * ready again. Protected by the request lock.
+ */
+static struct twheel    s_sleepers;
+
+/* The continuations of a future form a singly-linked list threaded through 
+ * the pool, with the head index (plus one) kept in the future itself. The 
+ * list is detached and run by whoever completes the future. A task's future 
+ * is only marked complete when the freeing of the task is serviced, as that 
+ * is the last point where the scheduler may still touch it. Protected by 
+ * the request lock.
+ */
+enum cont_type{
+    CONT_TASK,
+    CONT_JOIN,
+};
+
+struct continuation{
+    enum cont_type type;
+    uint32_t       next;
+    union{
+        struct{
+            int            prio;
+            task_func_t    code;
+            void          *arg;
+            struct future *result;
+            int            flags;
+        }task;
+        struct sched_join *join;
+    };
+};
+
+static struct continuation s_conts[MAX_CONTINUATIONS];
+static uint32_t         s_free_conts;
+static size_t           s_nfree_conts;
+
+/* Every worker thread owns a ready queue. Tasks that are made ready 
+ * on a worker thread are pushed to that worker's own queue, while tasks 
+ * made ready from the main thread are distributed round-robin between 
+ * the queues (unless the task carries an affinity hint). A worker first 
+ * tries to pop from its' own queue and then attempts to steal from the 
+ * other workers' queues. Stealing only ever try-locks the victim queue,
+ * so a thief never stalls the owner of a queue and the workers don't all
+ * end up serialized behind a single lock during a large fan-out.
+ *
+ * The 'main' queue holds the tasks pinned to the main thread. The worker 
+ * threads will never dequeue from it.
  *
- * All the queues are protected by the ready lock.
+ * Tasks created with a deadline are kept in a separate 'edf' queue, keyed 
+ * by the deadline (in milliseconds since scheduler initialization), and are 
+ * always dequeued ahead of the tasks ordered by their priority. The 'top' 
+ * field caches the key of the most urgent task in the queue, so that a 
+ * running task can cheaply check if it should give up its' thread at a 
+ * yield point.
  */
-static pq_task_t        s_ready_queue;
-static pq_task_t        s_ready_queue_main;
+struct ready_queue{
+    SDL_SpinLock lock;
+    SDL_atomic_t size;
+    SDL_atomic_t top;
+    pq_task_t    edf;
+    pq_task_t    tasks;
+    char         __pad[64];
+};
 
+static struct ready_queue s_ready_queues[MAX_WORKER_THREADS];
+static size_t             s_nqueues;
+static struct ready_queue s_ready_queue_main;
+/* The total number of tasks in the per-worker queues */
+static SDL_atomic_t       s_nready;
+static SDL_atomic_t       s_next_queue;
+
+/* The ready lock and condition variable are only used for putting idle
+ * threads to sleep and waking them up. The idle workers wait on the ready 
+ * cond to be notified when the ready queue(s) become non-empty, so that 
+ * they can pop a task to execute. At the end of a frame, the ready condition 
+ * variable is also used to notify the workers that the 'quiesce' flag has 
+ * been set, instructing them to go back to waiting on a start/quit command. 
+ */
 static SDL_mutex       *s_ready_lock;
 static SDL_cond        *s_ready_cond;
-static int              s_nwaiters;     /* protected by ready lock */
-static bool             s_quiesce;      /* protected by ready lock */
+static SDL_atomic_t     s_nwaiters;     /* modified under ready lock */
+static SDL_atomic_t     s_main_waiting; /* modified under ready lock */
+static SDL_atomic_t     s_quiesce;
 static int              s_idle_workers; /* protected by ready lock */
 
 static size_t           s_nworkers;
@@ -243,10 +380,205 @@ static SDL_cond        *s_worker_conds[MAX_WORKER_THREADS];
 
 bool                    s_flushing = false;
 
+/* Blocking reads and writes requested by tasks are carried out by a small 
+ * pool of dedicated I/O threads, so that the workers are never stalled on 
+ * the disk. The requesting task is blocked until its' I/O is complete, at 
+ * which point the I/O thread makes it ready again. The in-flight count is 
+ * the number of requests that have been submitted but not yet completed.
+ */
+static SDL_mutex       *s_io_lock;
+static SDL_cond        *s_io_cond;
+static SDL_cond        *s_io_idle_cond;
+static queue_io_t       s_io_queue;
+static int              s_io_inflight;  /* protected by io lock */
+static bool             s_io_quit;      /* protected by io lock */
+static SDL_Thread      *s_io_threads[IO_THREADS];
+
+/* The telemetry counters are kept per-thread so that they can be updated
+ * without any synchronization. They are only ever written by the owning 
+ * thread and are folded into 's_last_stats' at the end of every tick, at 
+ * which point all the workers are quiesced. The time values are in units 
+ * of the performance counter.
+ */
+struct sched_counters{
+    uint64_t ncreated;
+    uint64_t nswitches;
+    uint64_t nsteals;
+    uint64_t ready_wait;
+    uint64_t ready_wait_max;
+    uint64_t blocked_msg;
+    uint64_t blocked_event;
+    uint64_t busy;
+    uint64_t ndeadline_misses;
+    size_t   max_queue_depth;
+    char     __pad[64];
+};
+
+/* Every thread owns a pair of frame arenas. Allocations are bump-allocated 
+ * from the arena of the current parity, which is reset when it comes around 
+ * again at the start of the tick after next. All the allocations thus stay 
+ * valid until the end of the tick following the one they were made in.
+ */
+struct frame_chunk{
+    struct frame_chunk *next;
+    size_t              size;
+    size_t              used;
+    size_t              __pad;
+    unsigned char       mem[];
+};
+
+struct frame_hdr{
+    size_t size;
+    size_t __pad;
+};
+
+struct frame_arena{
+    struct frame_chunk *head; /* Allocations are made from the head chunk */
+    size_t              total;
+    char                __pad[48];
+};
+
+struct cpu_info{
+    int   id;       /* the OS's number of the hardware thread */
+    int   core;     /* unique within the package */
+    int   package;
+    int   node;
+    int   smt_idx;  /* the index of the hardware thread within its' core */
+    float capacity;
+};
+
+static struct sched_counters s_counters[MAX_WORKER_THREADS + 1];
+static struct frame_arena    s_frame_arenas[MAX_WORKER_THREADS + 1][2];
+static int                   s_frame_parity;
+static struct sched_stats    s_last_stats;
+static uint64_t              s_tick_start;
+static uint64_t              s_sched_epoch;
+
+/* The hardware threads available to the process, in placement order. The 
+ * main thread is expected to run on the first one, and worker 'i' is placed 
+ * on the one after that. */
+static struct cpu_info       s_cpus[MAX_CPUS];
+static int                   s_ncpus;
+static bool                  s_cpus_known;
+static struct sched_topology s_topology;
+static float                 s_capacity[MAX_WORKER_THREADS + 1];
+static float                 s_total_capacity;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static int stack_class(uint32_t flags)
+{
+    return (flags & TASK_BIG_STACK) ? SCHED_STACK_BIG : SCHED_STACK_SMALL;
+}
+
+static void *stack_map(size_t size)
+{
+#ifdef _WIN32
+    char *base = VirtualAlloc(NULL, size + STACK_GUARD_SZ, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if(!base)
+        return NULL;
+    DWORD old;
+    VirtualProtect(base, STACK_GUARD_SZ, PAGE_NOACCESS, &old);
+#else
+    char *base = mmap(NULL, size + STACK_GUARD_SZ, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED)
+        return NULL;
+    mprotect(base, STACK_GUARD_SZ, PROT_NONE);
+#endif
+    pf_mem_account(MEM_TAG_TASK_STACKS, size + STACK_GUARD_SZ);
+    return base + STACK_GUARD_SZ;
+}
+
+static void stack_unmap(void *stack, size_t size)
+{
+    char *base = ((char*)stack) - STACK_GUARD_SZ;
+#ifdef _WIN32
+    VirtualFree(base, 0, MEM_RELEASE);
+#else
+    munmap(base, size + STACK_GUARD_SZ);
+#endif
+    pf_mem_account(MEM_TAG_TASK_STACKS, -(ptrdiff_t)(size + STACK_GUARD_SZ));
+}
+
+static void *stack_alloc(int cls)
+{
+    struct stack_pool *pool = &s_stack_pools[cls];
+    void *ret = NULL;
+
+    if(pool->ncached > 0) {
+        ret = pool->cached[--pool->ncached];
+    }else{
+        ret = stack_map(pool->size);
+        if(!ret)
+            return NULL;
+        pool->stats.nmapped++;
+    }
+
+    pool->stats.nlive++;
+    if(pool->stats.nlive > pool->stats.nlive_hwm)
+        pool->stats.nlive_hwm = pool->stats.nlive;
+    pool->stats.ncached = pool->ncached;
+    return ret;
+}
+
+static void stack_free(int cls, void *stack)
+{
+    struct stack_pool *pool = &s_stack_pools[cls];
+    assert(pool->stats.nlive > 0);
+    pool->stats.nlive--;
+
+    if(pool->ncached < pool->max_cached) {
+        pool->cached[pool->ncached++] = stack;
+    }else{
+        stack_unmap(stack, pool->size);
+        pool->stats.nmapped--;
+    }
+    pool->stats.ncached = pool->ncached;
+}
+
+static void stack_note_depth(const struct task *task)
+{
+    struct stack_pool *pool = &s_stack_pools[stack_class(task->flags)];
+    size_t depth = ((uintptr_t)task->stackmem + pool->size) - task->ctx.rsp;
+    if(depth > pool->stats.depth_hwm)
+        pool->stats.depth_hwm = depth;
+}
+
+static bool stack_pools_init(void)
+{
+    for(int i = 0; i < SCHED_STACK_CLASS_COUNT; i++) {
+        struct stack_pool *pool = &s_stack_pools[i];
+        pool->ncached = 0;
+        pool->cached = malloc(pool->max_cached * sizeof(void*));
+        if(!pool->cached)
+            goto fail;
+        memset(&pool->stats, 0, sizeof(pool->stats));
+        pool->stats.size = pool->size;
+    }
+    return true;
+
+fail:
+    for(int i = 0; i < SCHED_STACK_CLASS_COUNT; i++) {
+        PF_FREE(s_stack_pools[i].cached);
+    }
+    return false;
+}
+
+static void stack_pools_destroy(void)
+{
+    for(int i = 0; i < SCHED_STACK_CLASS_COUNT; i++) {
+        struct stack_pool *pool = &s_stack_pools[i];
+        for(int j = 0; j < pool->ncached; j++) {
+            stack_unmap(pool->cached[j], pool->size);
+        }
+        pool->ncached = 0;
+        PF_FREE(pool->cached);
+    }
+}
+
 static void sched_init_ctx(struct task *task, void *code)
 {
     const size_t stack_size = (task->flags & TASK_BIG_STACK) ? BIG_STACK_SZ : STACK_SZ;
@@ -430,6 +762,161 @@ static uint32_t sched_curr_thread_worker_id(void)
     return kh_val(s_thread_worker_id_map, k);
 }
 
+static struct sched_counters *sched_counters(void)
+{
+    if(SDL_ThreadID() == g_main_thread_id)
+        return &s_counters[MAIN_THREAD_SLOT];
+    return &s_counters[sched_curr_thread_worker_id()];
+}
+
+static struct frame_arena *sched_frame_arena(void)
+{
+    if(SDL_ThreadID() == g_main_thread_id)
+        return &s_frame_arenas[MAIN_THREAD_SLOT][s_frame_parity];
+    return &s_frame_arenas[sched_curr_thread_worker_id()][s_frame_parity];
+}
+
+static void *frame_arena_alloc(struct frame_arena *arena, size_t size)
+{
+    size_t need = sizeof(struct frame_hdr) + ALIGNED(size, FRAME_ALIGN);
+    struct frame_chunk *chunk = arena->head;
+
+    if(!chunk || chunk->used + need > chunk->size) {
+        size_t chunksz = need > FRAME_CHUNK_SZ ? need : FRAME_CHUNK_SZ;
+        chunk = pf_tmalloc(MEM_TAG_FRAME_ARENA, sizeof(struct frame_chunk) + chunksz);
+        if(!chunk)
+            return NULL;
+        chunk->next = arena->head;
+        chunk->size = chunksz;
+        chunk->used = 0;
+        arena->head = chunk;
+        arena->total += chunksz;
+    }
+
+    struct frame_hdr *hdr = (struct frame_hdr*)(chunk->mem + chunk->used);
+    hdr->size = size;
+    chunk->used += need;
+    return hdr + 1;
+}
+
+/* Returns true if 'ptr' is the most recent allocation in the arena. Only 
+ * then can it be grown or released in place. */
+static bool frame_arena_is_top(const struct frame_arena *arena, void *ptr)
+{
+    const struct frame_chunk *chunk = arena->head;
+    if(!chunk)
+        return false;
+
+    unsigned char *uptr = ptr;
+    if(uptr < chunk->mem + sizeof(struct frame_hdr) || uptr > chunk->mem + chunk->used)
+        return false;
+
+    const struct frame_hdr *hdr = ((struct frame_hdr*)ptr) - 1;
+    return (uptr + ALIGNED(hdr->size, FRAME_ALIGN) == chunk->mem + chunk->used);
+}
+
+static void frame_arena_destroy(struct frame_arena *arena)
+{
+    struct frame_chunk *curr = arena->head;
+    while(curr) {
+        struct frame_chunk *next = curr->next;
+        pf_tfree(curr);
+        curr = next;
+    }
+    arena->head = NULL;
+    arena->total = 0;
+}
+
+static void frame_arena_reset(struct frame_arena *arena)
+{
+    if(!arena->head)
+        return;
+
+    if(!arena->head->next) {
+        arena->head->used = 0;
+        return;
+    }
+
+    /* Coalesce the chunks so that the next tick with a similar 
+     * amount of allocations is served from a single chunk. Don't 
+     * hold on to the memory used by exceptional ticks (ex. loading). */
+    size_t total = arena->total;
+    if(total > FRAME_MAX_RETAINED)
+        total = FRAME_CHUNK_SZ;
+    frame_arena_destroy(arena);
+
+    struct frame_chunk *chunk = pf_tmalloc(MEM_TAG_FRAME_ARENA, sizeof(struct frame_chunk) + total);
+    if(!chunk)
+        return;
+    chunk->next = NULL;
+    chunk->size = total;
+    chunk->used = 0;
+    arena->head = chunk;
+    arena->total = total;
+}
+
+static bool state_blocked(enum taskstate state)
+{
+    return (state == TASK_STATE_SEND_BLOCKED)
+        || (state == TASK_STATE_RECV_BLOCKED)
+        || (state == TASK_STATE_REPLY_BLOCKED)
+        || (state == TASK_STATE_EVENT_BLOCKED)
+        || (state == TASK_STATE_CHAN_BLOCKED)
+        || (state == TASK_STATE_IO_BLOCKED)
+        || (state == TASK_STATE_SYNC_BLOCKED)
+        || (state == TASK_STATE_TIMER_BLOCKED);
+}
+
+static void sched_collect_stats(void)
+{
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    uint64_t now = SDL_GetPerformanceCounter();
+    double tick_ms = (now - s_tick_start) * 1000.0 / freq;
+    struct sched_counters sum = {0};
+
+    memset(&s_last_stats, 0, sizeof(s_last_stats));
+    s_last_stats.nworkers = s_nworkers;
+    s_last_stats.tick_ms = tick_ms;
+
+    for(int i = 0; i <= MAX_WORKER_THREADS; i++) {
+
+        struct sched_counters *curr = &s_counters[i];
+        if(i < MAX_WORKER_THREADS && i >= s_nworkers)
+            continue;
+
+        sum.ncreated += curr->ncreated;
+        sum.nswitches += curr->nswitches;
+        sum.nsteals += curr->nsteals;
+        sum.ndeadline_misses += curr->ndeadline_misses;
+        sum.ready_wait += curr->ready_wait;
+        sum.blocked_msg += curr->blocked_msg;
+        sum.blocked_event += curr->blocked_event;
+        if(curr->ready_wait_max > sum.ready_wait_max)
+            sum.ready_wait_max = curr->ready_wait_max;
+        if(curr->max_queue_depth > sum.max_queue_depth)
+            sum.max_queue_depth = curr->max_queue_depth;
+
+        double busy_ms = curr->busy * 1000.0 / freq;
+        if(i == MAIN_THREAD_SLOT) {
+            s_last_stats.main_busy_ms = busy_ms;
+        }else{
+            s_last_stats.worker_busy_ms[i] = busy_ms;
+        }
+        memset(curr, 0, sizeof(*curr));
+    }
+
+    s_last_stats.ntasks_created = sum.ncreated;
+    s_last_stats.nswitches = sum.nswitches;
+    s_last_stats.nsteals = sum.nsteals;
+    s_last_stats.ndeadline_misses = sum.ndeadline_misses;
+    s_last_stats.ready_wait_ms = sum.ready_wait * 1000.0 / freq;
+    s_last_stats.ready_wait_max_ms = sum.ready_wait_max * 1000.0 / freq;
+    s_last_stats.blocked_msg_ms = sum.blocked_msg * 1000.0 / freq;
+    s_last_stats.blocked_event_ms = sum.blocked_event * 1000.0 / freq;
+    s_last_stats.max_queue_depth = sum.max_queue_depth;
+    s_last_stats.ntasks_live = MAX_TASKS - s_nfree;
+}
+
 static struct task *sched_task_alloc(void)
 {
     if(!s_freehead)
@@ -456,19 +943,274 @@ static void sched_task_free(struct task *task)
     s_nfree++;
 }
 
-static void sched_reactivate(struct task *task)
+static void sched_task_cleanup(const struct task *task)
+{
+    if(task->destructor) {
+        task->destructor(task->darg);
+    }
+    if(task->erelease) {
+        task->erelease(task->earg);
+    }
+}
+
+static float sched_edf_key(const struct task *task)
+{
+    /* Milliseconds since scheduler initialization */
+    return (task->deadline - s_sched_epoch) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static int task_urgency(const struct task *task)
+{
+    return task->deadline ? SCHED_KEY_DEADLINE : task->prio;
+}
+
+/* Must be called with the queue lock held */
+static void ready_queue_update_top(struct ready_queue *rq)
+{
+    float prio;
+    if(pq_size(&rq->edf)) {
+        SDL_AtomicSet(&rq->top, SCHED_KEY_DEADLINE);
+    }else if(pq_task_top_prio(&rq->tasks, &prio)) {
+        SDL_AtomicSet(&rq->top, (int)prio);
+    }else{
+        SDL_AtomicSet(&rq->top, SCHED_KEY_EMPTY);
+    }
+}
+
+static void ready_queue_push(struct ready_queue *rq, struct task *task)
+{
+    SDL_AtomicLock(&rq->lock);
+    if(task->deadline) {
+        pq_task_push(&rq->edf, sched_edf_key(task), task);
+    }else{
+        pq_task_push(&rq->tasks, task->prio, task);
+    }
+    SDL_AtomicIncRef(&rq->size);
+    ready_queue_update_top(rq);
+    SDL_AtomicUnlock(&rq->lock);
+}
+
+static bool ready_queue_pop(struct ready_queue *rq, struct task **out, bool steal)
+{
+    if(SDL_AtomicGet(&rq->size) == 0)
+        return false;
+
+    if(steal) {
+        if(!SDL_AtomicTryLock(&rq->lock))
+            return false;
+    }else{
+        SDL_AtomicLock(&rq->lock);
+    }
+
+    bool ret = pq_task_pop(&rq->edf, out) || pq_task_pop(&rq->tasks, out);
+    if(ret) {
+        SDL_AtomicAdd(&rq->size, -1);
+        ready_queue_update_top(rq);
+    }
+    SDL_AtomicUnlock(&rq->lock);
+    return ret;
+}
+
+/* A task with a deadline is always more urgent than a task without one. 
+ * Otherwise, the smaller key is more urgent. 
+ */
+struct sched_key{
+    bool  edf;
+    float key;
+};
+
+static bool sched_key_less(struct sched_key a, struct sched_key b)
+{
+    if(a.edf != b.edf)
+        return a.edf;
+    return (a.key < b.key);
+}
+
+static bool ready_queue_top_key(struct ready_queue *rq, struct sched_key *out, bool (*pred)(void*))
+{
+    if(SDL_AtomicGet(&rq->size) == 0)
+        return false;
+
+    SDL_AtomicLock(&rq->lock);
+    bool ret;
+    if((ret = (pred ? pq_task_top_prio_of(&rq->edf, &out->key, pred)
+                    : pq_task_top_prio(&rq->edf, &out->key)))) {
+        out->edf = true;
+    }else if((ret = (pred ? pq_task_top_prio_of(&rq->tasks, &out->key, pred)
+                          : pq_task_top_prio(&rq->tasks, &out->key)))) {
+        out->edf = false;
+    }
+    SDL_AtomicUnlock(&rq->lock);
+    return ret;
+}
+
+static bool ready_queue_pop_matching(struct ready_queue *rq, struct task **out, bool (*pred)(void*))
+{
+    if(!pred)
+        return ready_queue_pop(rq, out, false);
+
+    if(SDL_AtomicGet(&rq->size) == 0)
+        return false;
+
+    SDL_AtomicLock(&rq->lock);
+    bool ret = pq_task_pop_matching(&rq->edf, out, pred)
+            || pq_task_pop_matching(&rq->tasks, out, pred);
+    if(ret) {
+        SDL_AtomicAdd(&rq->size, -1);
+        ready_queue_update_top(rq);
+    }
+    SDL_AtomicUnlock(&rq->lock);
+    return ret;
+}
+
+static bool ready_queue_init(struct ready_queue *rq)
+{
+    rq->lock = 0;
+    SDL_AtomicSet(&rq->size, 0);
+    SDL_AtomicSet(&rq->top, SCHED_KEY_EMPTY);
+    pq_task_init(&rq->edf);
+    pq_task_init(&rq->tasks);
+
+    if(!pq_task_reserve(&rq->edf, MAX_TASKS))
+        goto fail_edf;
+    if(!pq_task_reserve(&rq->tasks, MAX_TASKS))
+        goto fail_tasks;
+    return true;
+
+fail_tasks:
+    pq_task_destroy(&rq->edf);
+fail_edf:
+    return false;
+}
+
+static void ready_queue_destroy(struct ready_queue *rq)
+{
+    pq_task_destroy(&rq->edf);
+    pq_task_destroy(&rq->tasks);
+}
+
+static int tasks_compare(void *a, void *b)
+{
+    struct task *ta = *(struct task**)a;
+    struct task *tb = *(struct task**)b;
+    return ((uintptr_t)(ta) - (uintptr_t)(tb));
+}
+
+static bool ready_queue_remove(struct ready_queue *rq, struct task *task)
+{
+    if(SDL_AtomicGet(&rq->size) == 0)
+        return false;
+
+    SDL_AtomicLock(&rq->lock);
+    bool ret = pq_task_remove(&rq->edf, tasks_compare, task)
+            || pq_task_remove(&rq->tasks, tasks_compare, task);
+    if(ret) {
+        SDL_AtomicAdd(&rq->size, -1);
+        ready_queue_update_top(rq);
+    }
+    SDL_AtomicUnlock(&rq->lock);
+    return ret;
+}
+
+static void ready_queue_clear(struct ready_queue *rq)
+{
+    SDL_AtomicLock(&rq->lock);
+    struct task *curr = NULL;
+    while(pq_task_pop(&rq->edf, &curr) || pq_task_pop(&rq->tasks, &curr)) {
+        sched_task_cleanup(curr);
+    }
+    SDL_AtomicSet(&rq->size, 0);
+    SDL_AtomicSet(&rq->top, SCHED_KEY_EMPTY);
+    SDL_AtomicUnlock(&rq->lock);
+}
+
+static size_t sched_target_queue(const struct task *task)
+{
+    uint32_t hint = (task->flags & TASK_AFFINITY_MASK) >> TASK_AFFINITY_SHIFT;
+    if(hint)
+        return (hint - 1) % s_nqueues;
+
+    if(s_nworkers && SDL_ThreadID() != g_main_thread_id)
+        return sched_curr_thread_worker_id();
+
+    return ((uint32_t)SDL_AtomicAdd(&s_next_queue, 1)) % s_nqueues;
+}
+
+static void sched_notify_ready(void)
 {
+    /* The waiters publish that they are going to sleep before checking
+     * for work and we publish the work before checking for waiters, so 
+     * at least one of the two sides is guaranteed to see the other.
+     */
+    if(SDL_AtomicGet(&s_nwaiters) == 0 && SDL_AtomicGet(&s_main_waiting) == 0)
+        return;
+
     SDL_LockMutex(s_ready_lock); 
+    SDL_CondSignal(s_ready_cond);
+    SDL_UnlockMutex(s_ready_lock);
+}
+
+static void sched_reactivate(struct task *task)
+{
+    struct sched_counters *counters = sched_counters();
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if(task->state == TASK_STATE_EVENT_BLOCKED
+    || task->state == TASK_STATE_TIMER_BLOCKED) {
+        counters->blocked_event += now - task->block_ts;
+    }else if(state_blocked(task->state)) {
+        counters->blocked_msg += now - task->block_ts;
+    }
+
     task->state = TASK_STATE_READY;
+    task->ready_ts = now;
+
+    size_t depth = SDL_AtomicGet(&s_nready) + SDL_AtomicGet(&s_ready_queue_main.size) + 1;
+    if(depth > counters->max_queue_depth)
+        counters->max_queue_depth = depth;
 
     if(task->flags & TASK_MAIN_THREAD_PINNED) {
-        pq_task_push(&s_ready_queue_main, task->prio, task);
+        ready_queue_push(&s_ready_queue_main, task);
     }else{
-        pq_task_push(&s_ready_queue, task->prio, task);
+        ready_queue_push(&s_ready_queues[sched_target_queue(task)], task);
+        SDL_AtomicIncRef(&s_nready);
     }
+    sched_notify_ready();
+}
 
-    SDL_CondSignal(s_ready_cond);
-    SDL_UnlockMutex(s_ready_lock);
+static bool sched_pop_general(struct task **out, size_t first, bool steal)
+{
+    for(int i = 0; i < s_nqueues; i++) {
+        struct ready_queue *rq = &s_ready_queues[(first + i) % s_nqueues];
+        if(ready_queue_pop(rq, out, steal && (i > 0))) {
+            SDL_AtomicAdd(&s_nready, -1);
+            if(steal && (i > 0)) {
+                sched_counters()->nsteals++;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool sched_pop_any(struct task **out)
+{
+    return ready_queue_pop(&s_ready_queue_main, out, false)
+        || sched_pop_general(out, 0, false);
+}
+
+static bool sched_ready_remove(struct task *task)
+{
+    if(ready_queue_remove(&s_ready_queue_main, task))
+        return true;
+
+    for(int i = 0; i < s_nqueues; i++) {
+        if(ready_queue_remove(&s_ready_queues[i], task)) {
+            SDL_AtomicAdd(&s_nready, -1);
+            return true;
+        }
+    }
+    return false;
 }
 
 #ifndef _MSC_VER
@@ -481,7 +1223,6 @@ void sched_task_exit(struct result ret)
 
     if(task->future) {
         task->future->res = ret;
-        SDL_AtomicSet(&task->future->status, FUTURE_COMPLETE);
     }
 
     if(task->destructor) {
@@ -506,12 +1247,19 @@ void sched_task_exit(struct result ret)
     assert(0);
 }
 
-static void sched_task_init(struct task *task, int prio, uint32_t flags, 
-                            void *code, void *arg, struct future *future, uint32_t parent)
+static bool sched_task_init(struct task *task, int prio, uint32_t flags, void *code, 
+                            void *arg, struct future *future, uint32_t parent, uint64_t deadline)
 {
-    task->prio = prio;
-    task->parent_tid = parent;
-    task->flags = flags;
+    PERF_PUSH("stack alloc");
+    task->stackmem = stack_alloc(stack_class(flags));
+    PERF_POP();
+
+    if(!task->stackmem)
+        return false;
+
+    task->prio = prio;
+    task->parent_tid = parent;
+    task->flags = flags & ~_TASK_CONTINUATION;
     task->retval = 0;
     task->arg = arg;
     task->destructor = NULL;
@@ -519,21 +1267,18 @@ static void sched_task_init(struct task *task, int prio, uint32_t flags,
     task->future = future;
     task->earg = NULL;
     task->erelease = NULL;
+    task->deadline = deadline;
 
     if(task->future) {
         SDL_AtomicSet(&task->future->status, FUTURE_INCOMPLETE);    
+        if(!(flags & _TASK_CONTINUATION)) {
+            task->future->cont = 0;
+        }
     }
 
-    PERF_PUSH("stack alloc");
-    if(flags & TASK_BIG_STACK) {
-        task->stackmem = malloc(BIG_STACK_SZ);
-    }else{
-        task->stackmem = s_stacks[task->tid - 1];
-    }
-    PERF_POP();
-
     sched_init_ctx(task, code);
     sched_reactivate(task);
+    return true;
 }
 
 static void sched_send(struct task *task, uint32_t tid, void *msg, size_t msglen)
@@ -641,16 +1386,6 @@ static uint64_t sched_retain_arg(struct task *task, int event, int event_source,
     return (uint64_t)ret;
 }
 
-static void sched_task_cleanup(const struct task *task)
-{
-    if(task->destructor) {
-        task->destructor(task->darg);
-    }
-    if(task->erelease) {
-        task->erelease(task->earg);
-    }
-}
-
 static void sched_await_event(struct task *task, int event)
 {
     task->state = TASK_STATE_EVENT_BLOCKED;
@@ -667,17 +1402,421 @@ static void sched_await_event(struct task *task, int event)
     queue_tid_push(&kh_val(s_event_queues, k), &task->tid);
 }
 
+static bool chan_empty(struct sched_chan *chan)
+{
+    uint32_t pos = SDL_AtomicGet(&chan->tail);
+    uint32_t seq = SDL_AtomicGet(&chan->seqs[pos & chan->mask]);
+    return ((int32_t)(seq - (pos + 1)) < 0);
+}
+
+static void sched_chan_wait(struct task *task, struct sched_chan *chan)
+{
+    /* Only a single consumer is allowed */
+    assert(SDL_AtomicGet(&chan->waiter) == NULL_TID);
+
+    /* Publish the waiter before checking the channel again. A producer 
+     * which pushed an element in the meantime will either have its' element 
+     * seen here or will see the waiter and wake it. */
+    task->state = TASK_STATE_CHAN_BLOCKED;
+    SDL_AtomicSet(&chan->waiter, task->tid);
+
+    if(!chan_empty(chan)) {
+        SDL_AtomicSet(&chan->waiter, NULL_TID);
+        sched_reactivate(task);
+    }
+}
+
+static void sched_chan_wake(struct sched_chan *chan)
+{
+    SDL_LockMutex(s_request_lock);
+
+    uint32_t tid = SDL_AtomicGet(&chan->waiter);
+    if(tid != NULL_TID && s_tasks[tid - 1].state == TASK_STATE_CHAN_BLOCKED) {
+        SDL_AtomicSet(&chan->waiter, NULL_TID);
+        sched_reactivate(&s_tasks[tid - 1]);
+    }
+    SDL_UnlockMutex(s_request_lock);
+}
+
+static void waitq_push(struct sched_waitq *wq, struct task *task)
+{
+    task->wnext = NULL_TID;
+    if(wq->tail == NULL_TID) {
+        wq->head = task->tid;
+    }else{
+        s_tasks[wq->tail - 1].wnext = task->tid;
+    }
+    wq->tail = task->tid;
+}
+
+static struct task *waitq_pop(struct sched_waitq *wq)
+{
+    if(wq->head == NULL_TID)
+        return NULL;
+
+    struct task *ret = &s_tasks[wq->head - 1];
+    wq->head = ret->wnext;
+    if(wq->head == NULL_TID)
+        wq->tail = NULL_TID;
+    return ret;
+}
+
+static void sched_sync_wait(struct task *task, struct sched_waitq *wq, 
+                            SDL_atomic_t *addr, int expected)
+{
+    task->state = TASK_STATE_SYNC_BLOCKED;
+
+    /* Publish the waiter before checking the value again. A task which 
+     * changed the value in the meantime will either have its' change seen 
+     * here or will see the waiter and wake it. */
+    SDL_AtomicIncRef(&wq->nwaiters);
+    if(SDL_AtomicGet(addr) != expected) {
+        SDL_AtomicAdd(&wq->nwaiters, -1);
+        sched_reactivate(task);
+        return;
+    }
+    waitq_push(wq, task);
+}
+
+static void sched_sync_wake(struct sched_waitq *wq, int nwake)
+{
+    if(SDL_AtomicGet(&wq->nwaiters) == 0)
+        return;
+
+    SDL_LockMutex(s_request_lock);
+    struct task *curr;
+    while(nwake-- != 0 && (curr = waitq_pop(wq))) {
+        assert(curr->state == TASK_STATE_SYNC_BLOCKED);
+        SDL_AtomicAdd(&wq->nwaiters, -1);
+        sched_reactivate(curr);
+    }
+    SDL_UnlockMutex(s_request_lock);
+}
+
+static void sched_waitq_init(struct sched_waitq *wq)
+{
+    SDL_AtomicSet(&wq->nwaiters, 0);
+    wq->head = NULL_TID;
+    wq->tail = NULL_TID;
+}
+
+static uint64_t sched_io_do(const struct io_req *req)
+{
+    if(req->write)
+        return SDL_RWwrite(req->stream, req->buff, 1, req->size);
+    return SDL_RWread(req->stream, req->buff, 1, req->size);
+}
+
+static void sched_io_reactivate(struct task *task)
+{
+    /* The I/O threads have no ready queue or counters of their own, so 
+     * the task is handed out in the same way as from the main thread. */
+    task->state = TASK_STATE_READY;
+    task->ready_ts = SDL_GetPerformanceCounter();
+
+    if(task->flags & TASK_MAIN_THREAD_PINNED) {
+        ready_queue_push(&s_ready_queue_main, task);
+    }else{
+        uint32_t hint = (task->flags & TASK_AFFINITY_MASK) >> TASK_AFFINITY_SHIFT;
+        size_t idx = hint ? (hint - 1) % s_nqueues
+                          : ((uint32_t)SDL_AtomicAdd(&s_next_queue, 1)) % s_nqueues;
+        ready_queue_push(&s_ready_queues[idx], task);
+        SDL_AtomicIncRef(&s_nready);
+    }
+    sched_notify_ready();
+}
+
+static uint64_t sched_now_ms(void)
+{
+    return (SDL_GetPerformanceCounter() - s_sched_epoch) * 1000 / SDL_GetPerformanceFrequency();
+}
+
+static void sched_sleep(struct task *task, uint32_t ms)
+{
+    task->state = TASK_STATE_TIMER_BLOCKED;
+    if(!twheel_add(&s_sleepers, sched_now_ms() + ms, task->tid)) {
+        sched_reactivate(task);
+    }
+}
+
+static void sched_wake_sleeper(uint64_t tid, void *arg)
+{
+    struct task *task = &s_tasks[tid - 1];
+    if(task->state != TASK_STATE_TIMER_BLOCKED)
+        return;
+    sched_reactivate(task);
+}
+
+static void sched_io_submit(struct task *task, bool write, SDL_RWops *stream, 
+                            void *buff, size_t size)
+{
+    struct io_req req = (struct io_req){
+        .tid = task->tid,
+        .write = write,
+        .stream = stream,
+        .buff = buff,
+        .size = size
+    };
+    task->state = TASK_STATE_IO_BLOCKED;
+
+    SDL_LockMutex(s_io_lock);
+    bool queued = queue_io_push(&s_io_queue, &req);
+    if(queued) {
+        s_io_inflight++;
+        SDL_CondSignal(s_io_cond);
+    }
+    SDL_UnlockMutex(s_io_lock);
+
+    /* Fall back to doing the I/O on the current thread */
+    if(!queued) {
+        task->retval = sched_io_do(&req);
+        sched_reactivate(task);
+    }
+}
+
+static void sched_io_drain(void)
+{
+    SDL_LockMutex(s_io_lock);
+    while(s_io_inflight > 0)
+        SDL_CondWait(s_io_idle_cond, s_io_lock);
+    SDL_UnlockMutex(s_io_lock);
+}
+
+static bool sched_io_pending(void)
+{
+    SDL_LockMutex(s_io_lock);
+    bool ret = (s_io_inflight > 0);
+    SDL_UnlockMutex(s_io_lock);
+    return ret;
+}
+
+static int io_threadfn(void *arg)
+{
+    while(true) {
+
+        struct io_req req;
+        SDL_LockMutex(s_io_lock);
+        while(!s_io_quit && queue_size(s_io_queue) == 0)
+            SDL_CondWait(s_io_cond, s_io_lock);
+        bool popped = queue_io_pop(&s_io_queue, &req);
+        SDL_UnlockMutex(s_io_lock);
+
+        /* The queue is only empty here when we're told to quit */
+        if(!popped)
+            break;
+
+        uint64_t ret = sched_io_do(&req);
+
+        SDL_LockMutex(s_request_lock);
+        struct task *task = &s_tasks[req.tid - 1];
+        assert(task->state == TASK_STATE_IO_BLOCKED);
+        task->retval = ret;
+        sched_io_reactivate(task);
+        SDL_UnlockMutex(s_request_lock);
+
+        SDL_LockMutex(s_io_lock);
+        if(--s_io_inflight == 0)
+            SDL_CondBroadcast(s_io_idle_cond);
+        SDL_UnlockMutex(s_io_lock);
+    }
+    return 0;
+}
+
+static bool sched_io_init(void)
+{
+    s_io_quit = false;
+    s_io_inflight = 0;
+
+    if(!queue_io_init(&s_io_queue, 64))
+        goto fail_queue;
+
+    s_io_lock = SDL_CreateMutex();
+    if(!s_io_lock)
+        goto fail_lock;
+
+    s_io_cond = SDL_CreateCond();
+    if(!s_io_cond)
+        goto fail_cond;
+
+    s_io_idle_cond = SDL_CreateCond();
+    if(!s_io_idle_cond)
+        goto fail_idle_cond;
+
+    for(int i = 0; i < IO_THREADS; i++) {
+
+        char threadname[128];
+        pf_snprintf(threadname, sizeof(threadname), "io-%d", i);
+        s_io_threads[i] = SDL_CreateThread(io_threadfn, threadname, NULL);
+        if(!s_io_threads[i])
+            goto fail_threads;
+    }
+    return true;
+
+fail_threads:
+    SDL_LockMutex(s_io_lock);
+    s_io_quit = true;
+    SDL_CondBroadcast(s_io_cond);
+    SDL_UnlockMutex(s_io_lock);
+    for(int i = 0; i < IO_THREADS; i++) {
+        if(s_io_threads[i])
+            SDL_WaitThread(s_io_threads[i], NULL);
+        s_io_threads[i] = NULL;
+    }
+    SDL_DestroyCond(s_io_idle_cond);
+fail_idle_cond:
+    SDL_DestroyCond(s_io_cond);
+fail_cond:
+    SDL_DestroyMutex(s_io_lock);
+fail_lock:
+    queue_io_destroy(&s_io_queue);
+fail_queue:
+    return false;
+}
+
+static void sched_io_shutdown(void)
+{
+    SDL_LockMutex(s_io_lock);
+    s_io_quit = true;
+    SDL_CondBroadcast(s_io_cond);
+    SDL_UnlockMutex(s_io_lock);
+
+    for(int i = 0; i < IO_THREADS; i++) {
+        SDL_WaitThread(s_io_threads[i], NULL);
+        s_io_threads[i] = NULL;
+    }
+    SDL_DestroyCond(s_io_idle_cond);
+    SDL_DestroyCond(s_io_cond);
+    SDL_DestroyMutex(s_io_lock);
+    queue_io_destroy(&s_io_queue);
+}
+
 static uint32_t sched_create(int prio, task_func_t code, void *arg, struct future *result, 
-                             int flags, uint32_t parent)
+                             int flags, uint32_t parent, uint64_t deadline)
 {
     struct task *task = sched_task_alloc();
     if(!task)
         return NULL_TID;
 
-    sched_task_init(task, prio, flags, code, arg, result, parent);
+    if(!sched_task_init(task, prio, flags, code, arg, result, parent, deadline)) {
+        sched_task_free(task);
+        return NULL_TID;
+    }
+    sched_counters()->ncreated++;
     return task->tid;
 }
 
+static void sched_conts_reset(void)
+{
+    for(int i = 0; i < MAX_CONTINUATIONS - 1; i++) {
+        s_conts[i].next = i + 2;
+    }
+    s_conts[MAX_CONTINUATIONS - 1].next = 0;
+    s_free_conts = 1;
+    s_nfree_conts = MAX_CONTINUATIONS;
+}
+
+static uint32_t sched_cont_alloc(void)
+{
+    uint32_t ret = s_free_conts;
+    if(ret) {
+        s_free_conts = s_conts[ret - 1].next;
+        s_conts[ret - 1].next = 0;
+        s_nfree_conts--;
+    }
+    return ret;
+}
+
+static void sched_cont_free(uint32_t id)
+{
+    s_conts[id - 1].next = s_free_conts;
+    s_free_conts = id;
+    s_nfree_conts++;
+}
+
+static void sched_future_complete(struct future *future, struct result res);
+
+static void sched_conts_run(uint32_t head, struct result res)
+{
+    while(head) {
+
+        struct continuation cont = s_conts[head - 1];
+        sched_cont_free(head);
+        head = cont.next;
+
+        switch(cont.type) {
+        case CONT_TASK: {
+            uint32_t tid = sched_create(cont.task.prio, cont.task.code, cont.task.arg, 
+                cont.task.result, cont.task.flags | TASK_DETACHED | _TASK_CONTINUATION, 
+                NULL_TID, 0);
+            /* Don't leave anyone waiting on a task that will never run */
+            if(tid == NULL_TID && cont.task.result) {
+                sched_future_complete(cont.task.result, NULL_RESULT);
+            }
+            break;
+        }
+        case CONT_JOIN:
+            if(--cont.join->remaining == 0) {
+                sched_future_complete(&cont.join->future, res);
+            }
+            break;
+        default: assert(0);
+        }
+    }
+}
+
+static void sched_future_complete(struct future *future, struct result res)
+{
+    uint32_t head = future->cont;
+    future->cont = 0;
+    future->res = res;
+    SDL_AtomicSet(&future->status, FUTURE_COMPLETE);
+    /* The owner is free to re-use the future from here on */
+    sched_conts_run(head, res);
+}
+
+static void sched_cont_attach(struct future *future, uint32_t id)
+{
+    if(SDL_AtomicGet(&future->status) == FUTURE_COMPLETE) {
+        sched_conts_run(id, future->res);
+        return;
+    }
+    s_conts[id - 1].next = future->cont;
+    future->cont = id;
+}
+
+static bool sched_join(struct sched_join *join, struct future *const *futures, 
+                       size_t n, int needed)
+{
+    SDL_LockMutex(s_request_lock);
+
+    join->future.cont = 0;
+    join->remaining = needed;
+    SDL_AtomicSet(&join->future.status, FUTURE_INCOMPLETE);
+
+    if(needed == 0) {
+        sched_future_complete(&join->future, NULL_RESULT);
+        SDL_UnlockMutex(s_request_lock);
+        return true;
+    }
+
+    /* Some of the inputs may complete the join as soon as they're attached, 
+     * so make sure that all of them can be attached up-front */
+    if(s_nfree_conts < n) {
+        SDL_UnlockMutex(s_request_lock);
+        return false;
+    }
+
+    for(int i = 0; i < n; i++) {
+        uint32_t id = sched_cont_alloc();
+        s_conts[id - 1].type = CONT_JOIN;
+        s_conts[id - 1].join = join;
+        sched_cont_attach(futures[i], id);
+    }
+
+    SDL_UnlockMutex(s_request_lock);
+    return true;
+}
+
 static bool sched_wait(struct task *task, uint32_t child_tid)
 {
     if(child_tid > MAX_TASKS)
@@ -710,6 +1849,20 @@ static void sched_task_run(struct task *task)
     pf_snprintf(name, sizeof(name), "Task %03u", task->tid);
     PERF_PUSH(name);
 
+    struct sched_counters *counters = sched_counters();
+    uint64_t start = SDL_GetPerformanceCounter();
+    uint64_t wait = start - task->ready_ts;
+
+    task->run_start = start;
+    counters->nswitches++;
+    counters->ready_wait += wait;
+    if(wait > counters->ready_wait_max)
+        counters->ready_wait_max = wait;
+
+    if(g_perf_trace_enabled) {
+        Perf_TraceSetTask(task->tid);
+    }
+
     if(SDL_ThreadID() == g_main_thread_id) {
         sched_switch_ctx(&s_main_ctx, &task->ctx, task->retval, task->arg);
     }else{
@@ -717,6 +1870,11 @@ static void sched_task_run(struct task *task)
         sched_switch_ctx(&s_worker_contexts[id], &task->ctx, task->retval, task->arg);
     }
 
+    if(g_perf_trace_enabled) {
+        Perf_TraceSetTask(NULL_TID);
+    }
+
+    counters->busy += SDL_GetPerformanceCounter() - start;
     PERF_POP();
     assert(stack_pointer_valid(task));
     sched_set_thread_tid(SDL_ThreadID(), NULL_TID);
@@ -727,6 +1885,10 @@ static void sched_task_service_request(struct task *task)
     assert(sched_curr_thread_tid() == NULL_TID);
     SDL_LockMutex(s_request_lock);
 
+    if(task->stackmem) {
+        stack_note_depth(task);
+    }
+
     switch((int)task->req.type) {
     case SCHED_REQ_CREATE:
         task->retval = sched_create(
@@ -735,7 +1897,8 @@ static void sched_task_service_request(struct task *task)
             (void*)         task->req.argv[2],
             (struct future*)task->req.argv[3],
             (int)           task->req.argv[4],
-            task->tid
+            task->tid,
+            task->deadline
         );
         sched_reactivate(task);
         break;
@@ -789,11 +1952,46 @@ static void sched_task_service_request(struct task *task)
     case SCHED_REQ_WAIT:
         task->retval = sched_wait(task, task->req.argv[0]);
         break;
+    case SCHED_REQ_CHAN_WAIT:
+        sched_chan_wait(
+            task, 
+            (struct sched_chan*)task->req.argv[0]
+        );
+        break;
+    case SCHED_REQ_SYNC_WAIT:
+        sched_sync_wait(
+            task,
+            (struct sched_waitq*)task->req.argv[0],
+            (SDL_atomic_t*)      task->req.argv[1],
+            (int)                task->req.argv[2]
+        );
+        break;
+    case SCHED_REQ_SLEEP:
+        sched_sleep(
+            task,
+            (uint32_t)task->req.argv[0]
+        );
+        break;
+    case SCHED_REQ_READ:
+    case SCHED_REQ_WRITE:
+        sched_io_submit(
+            task,
+            task->req.type == SCHED_REQ_WRITE,
+            (SDL_RWops*)task->req.argv[0],
+            (void*)     task->req.argv[1],
+            (size_t)    task->req.argv[2]
+        );
+        break;
     case _SCHED_REQ_FREE:
 
-        if(task->flags & TASK_BIG_STACK) {
-            PF_FREE(task->stackmem);
+        if(task->future) {
+            sched_future_complete(task->future, task->future->res);
         }
+        if(task->deadline && SDL_GetPerformanceCounter() > task->deadline) {
+            sched_counters()->ndeadline_misses++;
+        }
+        stack_free(stack_class(task->flags), task->stackmem);
+        task->stackmem = NULL;
         if(task->flags & TASK_DETACHED) {
             sched_task_free(task);
         }else if(s_parent_waiting[task->tid - 1]) {
@@ -818,6 +2016,10 @@ static void sched_task_service_request(struct task *task)
     default: assert(0);    
     }
 
+    if(state_blocked(task->state)) {
+        task->block_ts = SDL_GetPerformanceCounter();
+    }
+
     if(task->erelease) {
         task->erelease(task->earg);
         task->erelease = NULL;
@@ -875,7 +2077,7 @@ static void sched_wait_workers_done(void)
     SDL_UnlockMutex(s_ready_lock);
 
     assert(s_idle_workers == s_nworkers);
-    assert(s_nwaiters == 0);
+    assert(SDL_AtomicGet(&s_nwaiters) == 0);
 }
 
 static void sched_quiesce_workers(void)
@@ -884,13 +2086,13 @@ static void sched_quiesce_workers(void)
     PERF_ENTER();
 
     SDL_LockMutex(s_ready_lock);
-    s_quiesce = true;
+    SDL_AtomicSet(&s_quiesce, true);
     SDL_CondBroadcast(s_ready_cond);
     SDL_UnlockMutex(s_ready_lock);
 
     sched_wait_workers_done();
 
-    s_quiesce = false;
+    SDL_AtomicSet(&s_quiesce, false);
     PERF_RETURN_VOID();
 }
 
@@ -911,31 +2113,38 @@ static void worker_notify_done(int id)
     SDL_UnlockMutex(s_ready_lock);
 }
 
-static struct task *worker_wait_task_or_quiesce(void)
+static struct task *worker_wait_task_or_quiesce(int id)
 {
     struct task *task = NULL;
 
-    SDL_LockMutex(s_ready_lock);
-    s_nwaiters++;
+    while(!SDL_AtomicGet(&s_quiesce)) {
 
-    if(s_nwaiters == s_nworkers) {
-        SDL_CondBroadcast(s_ready_cond);
-    }
+        /* Pop from our own queue first, then try to steal */
+        if(sched_pop_general(&task, id, true))
+            return task;
 
-    while(!s_quiesce && !pq_task_pop(&s_ready_queue, &task)) {
-        SDL_CondWait(s_ready_cond, s_ready_lock);
-    }
+        SDL_LockMutex(s_ready_lock);
+        SDL_AtomicIncRef(&s_nwaiters);
 
-    s_nwaiters--;
-    SDL_UnlockMutex(s_ready_lock);
-    return task;
+        if(SDL_AtomicGet(&s_nwaiters) == s_nworkers) {
+            SDL_CondBroadcast(s_ready_cond);
+        }
+
+        while(!SDL_AtomicGet(&s_quiesce) && SDL_AtomicGet(&s_nready) == 0) {
+            SDL_CondWait(s_ready_cond, s_ready_lock);
+        }
+
+        SDL_AtomicAdd(&s_nwaiters, -1);
+        SDL_UnlockMutex(s_ready_lock);
+    }
+    return NULL;
 }
 
 static void worker_do_work(int id)
 {
     while(true) {
 
-        struct task *task = worker_wait_task_or_quiesce();
+        struct task *task = worker_wait_task_or_quiesce(id);
         if(!task)
             return;
 
@@ -945,10 +2154,342 @@ static void worker_do_work(int id)
     }
 }
 
+#if defined(__linux__)
+
+static int sysfs_read_int(const char *path, int fallback)
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+        return fallback;
+
+    int ret;
+    if(fscanf(file, "%d", &ret) != 1)
+        ret = fallback;
+    fclose(file);
+    return ret;
+}
+
+/* Parse a CPU list (ex. '0-3,8,10-11') */
+static bool sysfs_read_cpulist(const char *path, bool out[MAX_CPUS])
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+        return false;
+
+    memset(out, 0, sizeof(bool) * MAX_CPUS);
+    int first, last;
+    while(fscanf(file, "%d", &first) == 1) {
+
+        last = first;
+        int next = fgetc(file);
+        if(next == '-') {
+            if(fscanf(file, "%d", &last) != 1)
+                break;
+            next = fgetc(file);
+        }
+        for(int i = first; i <= last; i++) {
+            if(i >= 0 && i < MAX_CPUS)
+                out[i] = true;
+        }
+        if(next != ',')
+            break;
+    }
+    fclose(file);
+    return true;
+}
+
+static bool sched_detect_cpus(void)
+{
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return false;
+
+    static int s_node_of[MAX_CPUS];
+    memset(s_node_of, 0, sizeof(s_node_of));
+    for(int i = 0; i < MAX_NODES; i++) {
+
+        char path[128];
+        bool cpus[MAX_CPUS];
+        pf_snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+        if(!sysfs_read_cpulist(path, cpus))
+            continue;
+        for(int j = 0; j < MAX_CPUS; j++) {
+            if(cpus[j])
+                s_node_of[j] = i;
+        }
+    }
+
+    /* The kernel reports the capacities on asymmetric ARM systems. On Intel 
+     * hybrid parts, the efficiency cores are listed under a PMU of their own. */
+    bool atom[MAX_CPUS];
+    bool hybrid = sysfs_read_cpulist("/sys/devices/cpu_atom/cpus", atom);
+    int max_capacity = 0;
+
+    s_ncpus = 0;
+    for(int i = 0; i < MAX_CPUS && i < CPU_SETSIZE; i++) {
+
+        if(!CPU_ISSET(i, &allowed))
+            continue;
+
+        char path[128];
+        struct cpu_info *cpu = &s_cpus[s_ncpus++];
+        cpu->id = i;
+        cpu->node = s_node_of[i];
+
+        pf_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+        cpu->core = sysfs_read_int(path, i);
+        pf_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        cpu->package = sysfs_read_int(path, 0);
+        pf_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpu_capacity", i);
+        int capacity = sysfs_read_int(path, 0);
+
+        cpu->capacity = capacity;
+        if(capacity > max_capacity)
+            max_capacity = capacity;
+    }
+
+    for(int i = 0; i < s_ncpus; i++) {
+        struct cpu_info *cpu = &s_cpus[i];
+        if(max_capacity > 0) {
+            cpu->capacity = cpu->capacity > 0 ? cpu->capacity / max_capacity : 1.0f;
+        }else{
+            cpu->capacity = (hybrid && atom[cpu->id]) ? EFFICIENCY_CAPACITY : 1.0f;
+        }
+    }
+    return (s_ncpus > 0);
+}
+
+static void sched_pin_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+#elif defined(_WIN32)
+
+static bool sched_detect_cpus(void)
+{
+    DWORD size = 0;
+    GetLogicalProcessorInformationEx(RelationAll, NULL, &size);
+    if(GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+        return false;
+
+    char *buff = malloc(size);
+    if(!buff)
+        return false;
+    if(!GetLogicalProcessorInformationEx(RelationAll, 
+        (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buff, &size)) {
+        free(buff);
+        return false;
+    }
+
+    /* The cores come first, so that the packages and nodes can be 
+     * assigned to the hardware threads in a second pass */
+    int ncores = 0, npackages = 0;
+    BYTE max_class = 0;
+    s_ncpus = 0;
+
+    for(int pass = 0; pass < 2; pass++) {
+
+        char *curr = buff;
+        while(curr < buff + size) {
+
+            PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (void*)curr;
+            curr += info->Size;
+
+            const GROUP_AFFINITY *masks = NULL;
+            int nmasks = 0;
+            if(info->Relationship == RelationProcessorCore 
+            || info->Relationship == RelationProcessorPackage) {
+                masks = info->Processor.GroupMask;
+                nmasks = info->Processor.GroupCount;
+            }else if(info->Relationship == RelationNumaNode) {
+                masks = &info->NumaNode.GroupMask;
+                nmasks = 1;
+            }
+
+            if(pass == 0 && info->Relationship == RelationProcessorCore) {
+
+                int smt_idx = 0;
+                for(int bit = 0; bit < 64; bit++) {
+                    int id = masks[0].Group * 64 + bit;
+                    if(!(masks[0].Mask & ((KAFFINITY)1 << bit)) || s_ncpus == MAX_CPUS)
+                        continue;
+                    s_cpus[s_ncpus++] = (struct cpu_info){
+                        .id = id,
+                        .core = ncores,
+                        .smt_idx = smt_idx++,
+                        .capacity = info->Processor.EfficiencyClass,
+                    };
+                }
+                if(info->Processor.EfficiencyClass > max_class)
+                    max_class = info->Processor.EfficiencyClass;
+                ncores++;
+                continue;
+            }
+
+            if(pass == 0 || !masks)
+                continue;
+
+            for(int i = 0; i < s_ncpus; i++) {
+
+                struct cpu_info *cpu = &s_cpus[i];
+                bool member = false;
+                for(int j = 0; j < nmasks && !member; j++) {
+                    member = (cpu->id / 64 == masks[j].Group)
+                          && (masks[j].Mask & ((KAFFINITY)1 << (cpu->id % 64)));
+                }
+                if(!member)
+                    continue;
+
+                if(info->Relationship == RelationProcessorPackage)
+                    cpu->package = npackages;
+                else if(info->Relationship == RelationNumaNode)
+                    cpu->node = info->NumaNode.NodeNumber;
+            }
+            if(info->Relationship == RelationProcessorPackage)
+                npackages++;
+        }
+    }
+    free(buff);
+
+    /* A higher efficiency class means a higher performance */
+    for(int i = 0; i < s_ncpus; i++) {
+        s_cpus[i].capacity = (s_cpus[i].capacity < max_class) ? EFFICIENCY_CAPACITY : 1.0f;
+    }
+    return (s_ncpus > 0);
+}
+
+static void sched_pin_thread(int cpu)
+{
+    GROUP_AFFINITY affinity = {0};
+    affinity.Group = cpu / 64;
+    affinity.Mask = (KAFFINITY)1 << (cpu % 64);
+    SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL);
+}
+
+#else
+
+static bool sched_detect_cpus(void)
+{
+    return false;
+}
+
+static void sched_pin_thread(int cpu)
+{
+    (void)cpu;
+}
+
+#endif
+
+static int compare_cpus(const void *a, const void *b)
+{
+    const struct cpu_info *cpua = a, *cpub = b;
+    if(cpua->capacity != cpub->capacity)
+        return (cpua->capacity > cpub->capacity) ? -1 : 1;
+    if(cpua->node != cpub->node)
+        return cpua->node - cpub->node;
+    if(cpua->package != cpub->package)
+        return cpua->package - cpub->package;
+    if(cpua->core != cpub->core)
+        return cpua->core - cpub->core;
+    return cpua->id - cpub->id;
+}
+
+static int count_distinct(int (*key)(const struct cpu_info*), bool (*pred)(const struct cpu_info*))
+{
+    int ret = 0;
+    for(int i = 0; i < s_ncpus; i++) {
+        if(pred && !pred(&s_cpus[i]))
+            continue;
+        bool seen = false;
+        for(int j = 0; j < i && !seen; j++) {
+            seen = (!pred || pred(&s_cpus[j])) && key(&s_cpus[j]) == key(&s_cpus[i]);
+        }
+        ret += !seen;
+    }
+    return ret;
+}
+
+static int cpu_core_key(const struct cpu_info *cpu)    { return cpu->package * MAX_CPUS + cpu->core; }
+static int cpu_package_key(const struct cpu_info *cpu) { return cpu->package; }
+static int cpu_node_key(const struct cpu_info *cpu)    { return cpu->node; }
+static bool cpu_is_efficiency(const struct cpu_info *cpu) 
+{ 
+    return (cpu->smt_idx == 0 && cpu->capacity < 1.0f);
+}
+
+/* Find out the layout of the hardware threads and order them for placing 
+ * the workers. When it can't be detected, every hardware thread is treated 
+ * as a core of its' own. */
+static void sched_init_topology(void)
+{
+    s_cpus_known = sched_detect_cpus();
+    if(!s_cpus_known) {
+        s_ncpus = SDL_GetCPUCount();
+        if(s_ncpus > MAX_CPUS)
+            s_ncpus = MAX_CPUS;
+        for(int i = 0; i < s_ncpus; i++) {
+            s_cpus[i] = (struct cpu_info){ .id = i, .core = i, .capacity = 1.0f };
+        }
+    }
+
+    for(int i = 0; i < s_ncpus; i++) {
+        struct cpu_info *cpu = &s_cpus[i];
+        if(cpu->smt_idx > 0)
+            continue;
+        for(int j = 0; j < s_ncpus; j++) {
+            if(j != i && cpu_core_key(&s_cpus[j]) == cpu_core_key(cpu) && s_cpus[j].id > cpu->id)
+                s_cpus[j].smt_idx++;
+        }
+    }
+    for(int i = 0; i < s_ncpus; i++) {
+        if(s_cpus[i].smt_idx > 0)
+            s_cpus[i].capacity *= SMT_SIBLING_CAPACITY;
+    }
+    qsort(s_cpus, s_ncpus, sizeof(s_cpus[0]), compare_cpus);
+
+    s_topology = (struct sched_topology){
+        .nlogical = s_ncpus,
+        .ncores = count_distinct(cpu_core_key, NULL),
+        .nefficiency = count_distinct(cpu_core_key, cpu_is_efficiency),
+        .npackages = count_distinct(cpu_package_key, NULL),
+        .nnodes = count_distinct(cpu_node_key, NULL),
+        .pinned = s_cpus_known && CONFIG_SCHED_PIN_WORKERS,
+    };
+}
+
+static void sched_init_capacity(void)
+{
+    s_capacity[MAIN_THREAD_SLOT] = s_ncpus > 0 ? s_cpus[0].capacity : 1.0f;
+    s_total_capacity = s_capacity[MAIN_THREAD_SLOT];
+
+    for(int i = 0; i < s_nworkers; i++) {
+        s_capacity[i] = s_cpus[i + 1].capacity;
+        s_total_capacity += s_capacity[i];
+    }
+    s_topology.capacity = s_total_capacity;
+}
+
+static float sched_curr_thread_capacity(void)
+{
+    if(SDL_ThreadID() == g_main_thread_id)
+        return s_capacity[MAIN_THREAD_SLOT];
+    return s_capacity[sched_curr_thread_worker_id()];
+}
+
 static int worker_threadfn(void *arg)
 {
     int id = (uintptr_t)arg;
 
+    /* Pinning the worker also keeps its' frame arenas local to its' 
+     * core (and NUMA node), as they are first touched by the worker */
+    if(s_topology.pinned) {
+        sched_pin_thread(s_cpus[id + 1].id);
+    }
+
     while(true) {
 
         worker_wait_on_cmd(id);
@@ -960,13 +2501,6 @@ static int worker_threadfn(void *arg)
     return 0;
 }
 
-static int tasks_compare(void *a, void *b)
-{
-    struct task *ta = *(struct task**)a;
-    struct task *tb = *(struct task**)b;
-    return ((uintptr_t)(ta) - (uintptr_t)(tb));
-}
-
 static bool do_run_sync(uint32_t tid, bool dequeue)
 {
     SDL_LockMutex(s_request_lock);
@@ -982,10 +2516,7 @@ static bool do_run_sync(uint32_t tid, bool dequeue)
 
     bool found = false;
     if(dequeue) {
-        SDL_LockMutex(s_ready_lock);
-        found = pq_task_remove(&s_ready_queue, tasks_compare, task) 
-             || pq_task_remove(&s_ready_queue_main, tasks_compare, task);
-        SDL_UnlockMutex(s_ready_lock);
+        found = sched_ready_remove(task);
     }
 
     if(dequeue && !found)
@@ -1017,11 +2548,8 @@ out:
 
 static bool work_exists(void)
 {
-    bool ret;
-    SDL_LockMutex(s_ready_lock);
-    ret = pq_size(&s_ready_queue_main) || pq_size(&s_ready_queue);
-    SDL_UnlockMutex(s_ready_lock);
-    return ret;
+    return (SDL_AtomicGet(&s_ready_queue_main.size) > 0) 
+        || (SDL_AtomicGet(&s_nready) > 0);
 }
 
 static bool can_run_during_pause(void *arg)
@@ -1030,49 +2558,106 @@ static bool can_run_during_pause(void *arg)
     return (task->flags & TASK_RUN_DURING_PAUSE);
 }
 
-static struct task *next_main_thread_task(void)
+static bool is_foreground(void *arg)
 {
-    struct task *ret = NULL;
+    struct task *task = *(struct task**)arg;
+    return (task->deadline || task->prio < SCHED_PRIO_BACKGROUND);
+}
+
+static bool is_foreground_during_pause(void *arg)
+{
+    return is_foreground(arg) && can_run_during_pause(arg);
+}
+
+static struct task *next_main_thread_task(bool foreground_only)
+{
+    /* During a pause, only the tasks with the TASK_RUN_DURING_PAUSE
+     * flag can run. Once the background budget is used up, only the 
+     * tasks with a deadline or a foreground priority can run. */
+    bool (*pred)(void*);
     if(G_GetSimState() == G_RUNNING) {
+        pred = foreground_only ? is_foreground : NULL;
+    }else{
+        pred = foreground_only ? is_foreground_during_pause : can_run_during_pause;
+    }
 
-        SDL_LockMutex(s_ready_lock);
-        if(pq_size(&s_ready_queue_main) || pq_size(&s_ready_queue)) {
+    struct task *ret = NULL;
+    if(!work_exists())
+        return NULL;
 
-            float prio_main = -1.0, prio_gen = -1.0;
-            pq_task_top_prio(&s_ready_queue_main, &prio_main);
-            pq_task_top_prio(&s_ready_queue, &prio_gen);
+    struct sched_key key_main, key_gen;
+    bool has_main = ready_queue_top_key(&s_ready_queue_main, &key_main, pred);
 
-            if(prio_gen > prio_main) {
-                pq_task_pop(&s_ready_queue, &ret);
-            }else {
-                pq_task_pop(&s_ready_queue_main, &ret);
-            }
+    int best = -1;
+    for(int i = 0; i < s_nqueues; i++) {
+        struct sched_key key;
+        if(ready_queue_top_key(&s_ready_queues[i], &key, pred)
+        && (best < 0 || sched_key_less(key, key_gen))) {
+            key_gen = key;
+            best = i;
         }
-        SDL_UnlockMutex(s_ready_lock);
+    }
+
+    if(best >= 0 && (!has_main || sched_key_less(key_gen, key_main))) {
+        if(ready_queue_pop_matching(&s_ready_queues[best], &ret, pred)) {
+            SDL_AtomicAdd(&s_nready, -1);
+            return ret;
+        }
+    }
+    if(ready_queue_pop_matching(&s_ready_queue_main, &ret, pred))
         return ret;
 
-    }else{
-        /* During a pause, only the tasks with the TASK_RUN_DURING_PAUSE
-         * flag can run. */
-        SDL_LockMutex(s_ready_lock);
+    /* The queues may have changed underneath us - take anything we're allowed to */
+    for(int i = 0; i < s_nqueues; i++) {
+        if(ready_queue_pop_matching(&s_ready_queues[i], &ret, pred)) {
+            SDL_AtomicAdd(&s_nready, -1);
+            return ret;
+        }
+    }
+    return NULL;
+}
 
-        if(pq_size(&s_ready_queue_main) || pq_size(&s_ready_queue)) {
+static bool sched_group_claim(struct task_group *tg, size_t *out_begin, size_t *out_end)
+{
+    const float share = sched_curr_thread_capacity() / s_total_capacity;
 
-            float prio_main = -1.0, prio_gen = -1.0;
-            pq_task_top_prio_of(&s_ready_queue_main, &prio_main, can_run_during_pause);
-            pq_task_top_prio_of(&s_ready_queue, &prio_gen, can_run_during_pause);
+    while(true) {
 
-            if(prio_gen > prio_main) {
-                pq_task_pop_matching(&s_ready_queue, &ret, can_run_during_pause);
-            }else {
-                pq_task_pop_matching(&s_ready_queue_main, &ret, can_run_during_pause);
-            }
+        size_t curr = (size_t)SDL_AtomicGet(&tg->next);
+        if(curr >= tg->end)
+            return false;
+
+        /* Hand out big chunks first and progressively smaller ones as
+         * we approach the end of the range to even out the tail. The 
+         * chunks are sized by the throughput of the claiming thread, so 
+         * that the slower cores don't end up holding up the tail. */
+        size_t left = tg->end - curr;
+        size_t chunk = left * share / 2.0f;
+        if(chunk < tg->grain)
+            chunk = tg->grain;
+        if(chunk > left)
+            chunk = left;
+
+        if(SDL_AtomicCAS(&tg->next, (int)curr, (int)(curr + chunk))) {
+            *out_begin = curr;
+            *out_end = curr + chunk;
+            return true;
         }
-        SDL_UnlockMutex(s_ready_lock);
-        return ret;
     }
 }
 
+static struct result sched_group_task(void *arg)
+{
+    struct task_group *tg = arg;
+    size_t begin, end;
+
+    while(sched_group_claim(tg, &begin, &end)) {
+        tg->fn(begin, end, tg->arg);
+        Sched_TryYield();
+    }
+    return NULL_RESULT;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -1097,6 +2682,9 @@ bool Sched_Init(void)
     if(!s_event_queues)
         goto fail_event_queue;
 
+    if(!stack_pools_init())
+        goto fail_stack_pools;
+
     s_ready_lock = SDL_CreateMutex();
     if(!s_ready_lock)
         goto fail_ready_lock;
@@ -1105,13 +2693,26 @@ bool Sched_Init(void)
     if(!s_ready_cond)
         goto fail_ready_cond;
 
-    pq_task_init(&s_ready_queue);
-    if(!pq_task_reserve(&s_ready_queue, MAX_TASKS))
-        goto fail_ready_queue;
+    /* On a single-core system, all the tasks will just be run on the main thread */
+    sched_init_topology();
+    s_nworkers = s_ncpus - 1;
+    if(s_nworkers > MAX_WORKER_THREADS)
+        s_nworkers = MAX_WORKER_THREADS;
+    sched_init_capacity();
+    s_nqueues = s_nworkers > 0 ? s_nworkers : 1;
+
+    int nqueues_init = 0;
+    for(; nqueues_init < s_nqueues; nqueues_init++) {
+        if(!ready_queue_init(&s_ready_queues[nqueues_init]))
+            goto fail_ready_queue;
+    }
+    SDL_AtomicSet(&s_nready, 0);
 
-    pq_task_init(&s_ready_queue_main);
-    if(!pq_task_reserve(&s_ready_queue_main, MAX_TASKS))
+    if(!ready_queue_init(&s_ready_queue_main))
         goto fail_ready_queue_main;
+    s_sched_epoch = SDL_GetPerformanceCounter();
+    twheel_init(&s_sleepers, 0);
+    sched_conts_reset();
 
     assert(MAX_TASKS >= 2);
     s_tasks[0].prev = NULL;
@@ -1133,9 +2734,6 @@ bool Sched_Init(void)
             goto fail_msg_queue;
     }
 
-    /* On a single-core system, all the tasks will just be run on the main thread */
-    s_nworkers = SDL_GetCPUCount() - 1;
-
     for(int i = 0; i < s_nworkers; i++) {
 
         s_worker_locks[i] = SDL_CreateMutex();
@@ -1160,11 +2758,15 @@ bool Sched_Init(void)
         Perf_RegisterThread(SDL_GetThreadID(s_worker_threads[i]), threadname);
     }
 
+    if(!sched_io_init())
+        goto fail_io;
+
     sched_init_thread_tid_map();
     sched_init_thread_worker_id_map();
     Task_CreateServices();
     return true;
 
+fail_io:
 fail_workers:
     for(int i = 0; i < s_nworkers; i++) {
         if(!s_worker_threads[i])
@@ -1183,14 +2785,18 @@ fail_msg_queue:
     for(int i = 0; i < MAX_TASKS; i++) {
         queue_tid_destroy(s_msg_queues + i);
     }
-    pq_task_destroy(&s_ready_queue_main);
+    ready_queue_destroy(&s_ready_queue_main);
 fail_ready_queue_main:
-    pq_task_destroy(&s_ready_queue);
 fail_ready_queue:
+    for(int i = 0; i < nqueues_init; i++) {
+        ready_queue_destroy(&s_ready_queues[i]);
+    }
     SDL_DestroyCond(s_ready_cond);
 fail_ready_cond:
     SDL_DestroyMutex(s_ready_lock);
 fail_ready_lock:
+    stack_pools_destroy();
+fail_stack_pools:
     kh_destroy(tqueue, s_event_queues);
 fail_event_queue:
     SDL_DestroyMutex(s_request_lock);
@@ -1215,13 +2821,17 @@ void Sched_Shutdown(void)
     });
     kh_destroy(tqueue, s_event_queues);
 
+    sched_io_shutdown();
+    twheel_destroy(&s_sleepers);
     SDL_DestroyCond(s_ready_cond);
     SDL_DestroyMutex(s_ready_lock);
     kh_destroy(tid, s_thread_tid_map);
     kh_destroy(tid, s_thread_worker_id_map);
     SDL_DestroyMutex(s_request_lock);
-    pq_task_destroy(&s_ready_queue);
-    pq_task_destroy(&s_ready_queue_main);
+    for(int i = 0; i < s_nqueues; i++) {
+        ready_queue_destroy(&s_ready_queues[i]);
+    }
+    ready_queue_destroy(&s_ready_queue_main);
 
     for(int i = 0; i < s_nworkers; i++) {
         sched_signal_worker_quit(i);
@@ -1233,6 +2843,16 @@ void Sched_Shutdown(void)
     }
     for(int i = 0; i < MAX_TASKS; i++) {
         queue_tid_destroy(s_msg_queues + i);
+        if(s_tasks[i].stackmem) {
+            stack_free(stack_class(s_tasks[i].flags), s_tasks[i].stackmem);
+            s_tasks[i].stackmem = NULL;
+        }
+    }
+    stack_pools_destroy();
+
+    for(int i = 0; i < MAX_WORKER_THREADS + 1; i++) {
+        frame_arena_destroy(&s_frame_arenas[i][0]);
+        frame_arena_destroy(&s_frame_arenas[i][1]);
     }
 }
 
@@ -1241,13 +2861,17 @@ void Sched_HandleEvent(int event, void *arg, int event_source, bool immediate)
     ASSERT_IN_MAIN_THREAD();
     SDL_LockMutex(s_request_lock);
 
+    /* This is called for every single event, so don't pay for setting up 
+     * the run queue unless there is actually a task waiting on the event. */
+    khiter_t k = kh_get(tqueue, s_event_queues, event);
+    if(k == kh_end(s_event_queues) || queue_size(kh_val(s_event_queues, k)) == 0) {
+        SDL_UnlockMutex(s_request_lock);
+        return;
+    }
+
     queue_tid_t torun;
     queue_tid_init(&torun, 32);
 
-    khiter_t k = kh_get(tqueue, s_event_queues, event);
-    if(k == kh_end(s_event_queues))
-        goto out;
-
     queue_tid_t *waiters = &kh_val(s_event_queues, k);
     while(queue_size(*waiters) > 0) {
 
@@ -1283,7 +2907,6 @@ void Sched_HandleEvent(int event, void *arg, int event_source, bool immediate)
         do_run_sync(tid, false);
     }
 
-out:
     queue_tid_destroy(&torun);
     SDL_UnlockMutex(s_request_lock);
 }    
@@ -1291,11 +2914,20 @@ out:
 void Sched_StartBackgroundTasks(void)
 {
     ASSERT_IN_MAIN_THREAD();
+    s_tick_start = SDL_GetPerformanceCounter();
 
     SDL_LockMutex(s_ready_lock);
     s_idle_workers = 0;
     SDL_UnlockMutex(s_ready_lock);
 
+    /* The workers are quiesced at this point, so it's safe to 
+     * recycle the arenas used two ticks ago. */
+    s_frame_parity = !s_frame_parity;
+    frame_arena_reset(&s_frame_arenas[MAIN_THREAD_SLOT][s_frame_parity]);
+    for(int i = 0; i < s_nworkers; i++) {
+        frame_arena_reset(&s_frame_arenas[i][s_frame_parity]);
+    }
+
     for(int i = 0; i < s_nworkers; i++) {
     
         SDL_LockMutex(s_worker_locks[i]);
@@ -1310,13 +2942,20 @@ void Sched_Tick(void)
     ASSERT_IN_MAIN_THREAD();
     PERF_ENTER();
 
+    SDL_LockMutex(s_request_lock);
+    twheel_advance(&s_sleepers, sched_now_ms(), sched_wake_sleeper, NULL);
+    SDL_UnlockMutex(s_request_lock);
+
     /* Use a do-while to ensure we're always making at least _some_ forward progress */
     do{
         int nwaiters = 0;
         struct task *curr = NULL;
 
+        SDL_LockMutex(s_ready_lock);
+        SDL_AtomicSet(&s_main_waiting, 1);
+
         while(!work_exists()
-           && ((nwaiters = s_nwaiters) < s_nworkers)
+           && ((nwaiters = SDL_AtomicGet(&s_nwaiters)) < s_nworkers)
            && (s_idle_workers < s_nworkers)
            && !s_flushing) {
 
@@ -1326,19 +2965,33 @@ void Sched_Tick(void)
 
             SDL_CondWaitTimeout(s_ready_cond, s_ready_lock, left);
             if(left == 0) {
-                s_quiesce = true;
+                SDL_AtomicSet(&s_quiesce, true);
                 SDL_CondBroadcast(s_ready_cond); 
             }
         }
 
+        SDL_AtomicSet(&s_main_waiting, 0);
+        SDL_UnlockMutex(s_ready_lock);
+
         /* When the ready queue is empty and all the workers are in a state of waiting, 
          * there is no more work to be done. In that case, let's not waste any more time. 
          */
-        curr = next_main_thread_task();
+        /* Past the background budget, the main thread only picks up tasks which 
+         * are needed for the current frame. The remaining background tasks are 
+         * left to the workers.
+         */
+        bool past_budget = (Perf_CurrFrameMS() >= SCHED_BG_BUDGET_MS);
+        curr = next_main_thread_task(past_budget);
         if(curr == NULL && nwaiters == s_nworkers)
             break;
         if(curr == NULL && s_idle_workers == s_nworkers)
             break;
+        if(curr == NULL && past_budget && work_exists()) {
+            SDL_LockMutex(s_ready_lock);
+            SDL_CondWaitTimeout(s_ready_cond, s_ready_lock, 1);
+            SDL_UnlockMutex(s_ready_lock);
+            continue;
+        }
         if(curr == NULL)
             continue;
 
@@ -1348,13 +3001,26 @@ void Sched_Tick(void)
     }while(Perf_CurrFrameMS() < SCHED_TICK_MS);
 
     sched_quiesce_workers();
+    sched_collect_stats();
     PERF_RETURN_VOID();
 }
 
 uint32_t Sched_Create(int prio, task_func_t code, void *arg, struct future *result, int flags)
 {
+    return Sched_CreateDeadline(prio, code, arg, result, flags, 0);
+}
+
+uint32_t Sched_CreateDeadline(int prio, task_func_t code, void *arg, struct future *result, 
+                              int flags, uint32_t deadline_ms)
+{
+    uint64_t deadline = 0;
+    if(deadline_ms) {
+        deadline = SDL_GetPerformanceCounter() 
+                 + (uint64_t)deadline_ms * SDL_GetPerformanceFrequency() / 1000;
+    }
+
     SDL_LockMutex(s_request_lock);
-    uint32_t ret = sched_create(prio, code, arg, result, flags | TASK_DETACHED, NULL_TID);
+    uint32_t ret = sched_create(prio, code, arg, result, flags | TASK_DETACHED, NULL_TID, deadline);
     SDL_UnlockMutex(s_request_lock);
     struct task *task = &s_tasks[ret - 1];
     return ret;
@@ -1369,22 +3035,15 @@ void Sched_ClearState(void)
 {
     ASSERT_IN_MAIN_THREAD();
 
+    /* The I/O threads must not reactivate any tasks after they're freed */
+    sched_io_drain();
     sched_quiesce_workers();
-    SDL_LockMutex(s_ready_lock);
-
-    while(pq_size(&s_ready_queue)) {
-        struct task *curr = NULL;
-        pq_task_pop(&s_ready_queue, &curr);
-        sched_task_cleanup(curr);
-    }
 
-    while(pq_size(&s_ready_queue_main)) {
-        struct task *curr = NULL;
-        pq_task_pop(&s_ready_queue_main, &curr);
-        sched_task_cleanup(curr);
+    for(int i = 0; i < s_nqueues; i++) {
+        ready_queue_clear(&s_ready_queues[i]);
     }
-
-    SDL_UnlockMutex(s_ready_lock);
+    ready_queue_clear(&s_ready_queue_main);
+    SDL_AtomicSet(&s_nready, 0);
 
     for(khiter_t k = kh_begin(s_event_queues); k != kh_end(s_event_queues); k++) {
         if(!kh_exist(s_event_queues, k))
@@ -1407,13 +3066,24 @@ void Sched_ClearState(void)
         }
         queue_tid_clear(queue);
 
-        if(s_tasks[i].state == TASK_STATE_SEND_BLOCKED) {
+        if(s_tasks[i].state == TASK_STATE_SEND_BLOCKED
+        || s_tasks[i].state == TASK_STATE_CHAN_BLOCKED
+        || s_tasks[i].state == TASK_STATE_SYNC_BLOCKED
+        || s_tasks[i].state == TASK_STATE_TIMER_BLOCKED) {
             struct task *curr = &s_tasks[i];
             sched_task_cleanup(curr);
         }
         s_parent_waiting[i] = false;
         s_tasks[i].state = TASK_STATE_ACTIVE;
+
+        /* Return the stacks of all the discarded tasks to the pool */
+        if(s_tasks[i].stackmem && s_tasks[i].tid != Sched_ActiveTID()) {
+            stack_free(stack_class(s_tasks[i].flags), s_tasks[i].stackmem);
+            s_tasks[i].stackmem = NULL;
+        }
     }
+    twheel_clear(&s_sleepers, sched_now_ms());
+    sched_conts_reset();
 
     /* Reset the free list */
     s_tasks[0].prev = NULL;
@@ -1457,6 +3127,14 @@ uint64_t Sched_Request(struct request req)
     }
 }
 
+void Sched_SleepMs(uint32_t ms)
+{
+    Sched_Request((struct request){
+        .type = SCHED_REQ_SLEEP,
+        .argv[0] = ms
+    });
+}
+
 uint32_t Sched_ActiveTID(void)
 {
     return sched_curr_thread_tid();
@@ -1467,12 +3145,88 @@ bool Sched_FutureIsReady(const struct future *future)
     return (SDL_AtomicGet((SDL_atomic_t*)&future->status) == FUTURE_COMPLETE);
 }
 
+bool Sched_FutureThen(struct future *future, int prio, task_func_t code, void *arg, 
+                      struct future *result, int flags)
+{
+    SDL_LockMutex(s_request_lock);
+
+    uint32_t id = sched_cont_alloc();
+    if(!id) {
+        SDL_UnlockMutex(s_request_lock);
+        return false;
+    }
+
+    s_conts[id - 1].type = CONT_TASK;
+    s_conts[id - 1].task.prio = prio;
+    s_conts[id - 1].task.code = code;
+    s_conts[id - 1].task.arg = arg;
+    s_conts[id - 1].task.result = result;
+    s_conts[id - 1].task.flags = flags;
+
+    if(result) {
+        result->cont = 0;
+        SDL_AtomicSet(&result->status, FUTURE_INCOMPLETE);
+    }
+    sched_cont_attach(future, id);
+
+    SDL_UnlockMutex(s_request_lock);
+    return true;
+}
+
+bool Sched_WhenAll(struct sched_join *join, struct future *const *futures, size_t n)
+{
+    return sched_join(join, futures, n, n);
+}
+
+bool Sched_WhenAny(struct sched_join *join, struct future *const *futures, size_t n)
+{
+    return sched_join(join, futures, n, n > 0 ? 1 : 0);
+}
+
+static bool sched_should_yield(const struct task *task)
+{
+    uint64_t elapsed = SDL_GetPerformanceCounter() - task->run_start;
+    if(elapsed * 1000.0 / SDL_GetPerformanceFrequency() >= SCHED_QUANTUM_MS)
+        return true;
+
+    if(SDL_ThreadID() == g_main_thread_id) {
+        if(Perf_CurrFrameMS() >= SCHED_TICK_MS)
+            return true;
+        if(SDL_AtomicGet(&s_ready_queue_main.top) < task_urgency(task))
+            return true;
+    }else if(SDL_AtomicGet(&s_quiesce)) {
+        return true;
+    }
+
+    for(int i = 0; i < s_nqueues; i++) {
+        if(SDL_AtomicGet(&s_ready_queues[i].top) < task_urgency(task))
+            return true;
+    }
+    return false;
+}
+
+bool Sched_ShouldYield(void)
+{
+    /* A flush must drive every task to its next blocking point */
+    if(s_flushing)
+        return false;
+    uint32_t tid = Sched_ActiveTID();
+    if(tid == NULL_TID)
+        return false;
+    return sched_should_yield(&s_tasks[tid - 1]);
+}
+
 void Sched_TryYield(void)
 {
     uint32_t tid = Sched_ActiveTID();
     if(tid == NULL_TID)
         return;
 
+    /* Only give up the thread when the task has used up its' time 
+     * quantum or when there is more urgent work waiting to run. */
+    if(!sched_should_yield(&s_tasks[tid - 1]))
+        return;
+
     const char *name = NULL;
     if(!Perf_IsRoot()) {
         PERF_POP_NAME(&name);
@@ -1502,9 +3256,7 @@ uint32_t Sched_CreateBlocking(int prio, task_func_t code, void *arg,
 
         if(ret == NULL_TID) {
 
-            SDL_LockMutex(s_ready_lock); 
-            status = pq_task_pop(&s_ready_queue_main, &task) || pq_task_pop(&s_ready_queue, &task);
-            SDL_UnlockMutex(s_ready_lock);
+            status = sched_pop_any(&task);
 
             if(status) {
                 sched_task_run(task);
@@ -1536,12 +3288,17 @@ void Sched_Flush(void)
     sched_quiesce_workers();
     struct task *curr;
 
-    while(pq_task_pop(&s_ready_queue, &curr)) {
-        do_run_sync(curr->tid, false);
-    }
-    while(pq_task_pop(&s_ready_queue_main, &curr)) {
-        do_run_sync(curr->tid, false);
-    }
+    /* Wait out the I/O in flight such that the tasks blocked on it are 
+     * made ready and run to their next blocking point as well */
+    do{
+        sched_io_drain();
+        while(sched_pop_general(&curr, 0, false)) {
+            do_run_sync(curr->tid, false);
+        }
+        while(ready_queue_pop(&s_ready_queue_main, &curr, false)) {
+            do_run_sync(curr->tid, false);
+        }
+    }while(sched_io_pending());
     s_flushing = false;
 }
 
@@ -1549,11 +3306,7 @@ bool Sched_HasBlocked(void)
 {
     ASSERT_IN_MAIN_THREAD();
 
-    SDL_LockMutex(s_ready_lock); 
-    bool ret = (pq_size(&s_ready_queue) > 0)
-            || (pq_size(&s_ready_queue_main) > 0);
-    SDL_UnlockMutex(s_ready_lock);
-    return ret;
+    return work_exists() || sched_io_pending();
 }
 
 bool Sched_IsReady(uint32_t tid)
@@ -1565,3 +3318,332 @@ bool Sched_IsReady(uint32_t tid)
     return ret;
 }
 
+
+bool Sched_ChanInit(struct sched_chan *chan, size_t elemsize, size_t capacity)
+{
+    size_t cap = 1;
+    while(cap < capacity)
+        cap <<= 1;
+    assert(cap <= INT32_MAX);
+
+    chan->slots = malloc(cap * elemsize);
+    if(!chan->slots)
+        goto fail_slots;
+
+    chan->seqs = malloc(cap * sizeof(SDL_atomic_t));
+    if(!chan->seqs)
+        goto fail_seqs;
+
+    for(size_t i = 0; i < cap; i++) {
+        SDL_AtomicSet(&chan->seqs[i], (int)i);
+    }
+    chan->elemsize = elemsize;
+    chan->mask = cap - 1;
+    SDL_AtomicSet(&chan->head, 0);
+    SDL_AtomicSet(&chan->tail, 0);
+    SDL_AtomicSet(&chan->waiter, NULL_TID);
+    return true;
+
+fail_seqs:
+    free(chan->slots);
+fail_slots:
+    return false;
+}
+
+void Sched_ChanDestroy(struct sched_chan *chan)
+{
+    assert(SDL_AtomicGet(&chan->waiter) == NULL_TID);
+    free(chan->seqs);
+    free(chan->slots);
+}
+
+bool Sched_ChanTrySend(struct sched_chan *chan, const void *elem)
+{
+    uint32_t pos = SDL_AtomicGet(&chan->head);
+    while(true) {
+
+        SDL_atomic_t *seq = &chan->seqs[pos & chan->mask];
+        int32_t diff = (int32_t)((uint32_t)SDL_AtomicGet(seq) - pos);
+
+        if(diff == 0) {
+            if(SDL_AtomicCAS(&chan->head, (int)pos, (int)(pos + 1))) {
+                memcpy(chan->slots + (pos & chan->mask) * chan->elemsize, elem, chan->elemsize);
+                SDL_AtomicSet(seq, (int)(pos + 1));
+                break;
+            }
+            pos = SDL_AtomicGet(&chan->head);
+        }else if(diff < 0) {
+            return false; /* full */
+        }else{
+            pos = SDL_AtomicGet(&chan->head);
+        }
+    }
+
+    if(SDL_AtomicGet(&chan->waiter) != NULL_TID) {
+        sched_chan_wake(chan);
+    }
+    return true;
+}
+
+bool Sched_ChanTryRecv(struct sched_chan *chan, void *out)
+{
+    uint32_t pos = SDL_AtomicGet(&chan->tail);
+    SDL_atomic_t *seq = &chan->seqs[pos & chan->mask];
+
+    if((int32_t)((uint32_t)SDL_AtomicGet(seq) - (pos + 1)) < 0)
+        return false; /* empty */
+
+    memcpy(out, chan->slots + (pos & chan->mask) * chan->elemsize, chan->elemsize);
+    SDL_AtomicSet(&chan->tail, (int)(pos + 1));
+    SDL_AtomicSet(seq, (int)(pos + chan->mask + 1));
+    return true;
+}
+
+void Sched_MutexInit(struct sched_mutex *mutex)
+{
+    SDL_AtomicSet(&mutex->state, 0);
+    sched_waitq_init(&mutex->wq);
+}
+
+bool Sched_MutexTryLock(struct sched_mutex *mutex)
+{
+    return SDL_AtomicCAS(&mutex->state, 0, 1);
+}
+
+void Sched_MutexUnlock(struct sched_mutex *mutex)
+{
+    int prev = SDL_AtomicSet(&mutex->state, 0);
+    assert(prev != 0);
+    if(prev == 2) {
+        sched_sync_wake(&mutex->wq, 1);
+    }
+}
+
+void Sched_RWLockInit(struct sched_rwlock *lock)
+{
+    SDL_AtomicSet(&lock->state, 0);
+    sched_waitq_init(&lock->wq);
+}
+
+bool Sched_RWLockTryRead(struct sched_rwlock *lock)
+{
+    int state;
+    while((state = SDL_AtomicGet(&lock->state)) >= 0) {
+        if(SDL_AtomicCAS(&lock->state, state, state + 1))
+            return true;
+    }
+    return false;
+}
+
+bool Sched_RWLockTryWrite(struct sched_rwlock *lock)
+{
+    return SDL_AtomicCAS(&lock->state, 0, -1);
+}
+
+void Sched_RWLockUnlockRead(struct sched_rwlock *lock)
+{
+    int prev = SDL_AtomicAdd(&lock->state, -1);
+    assert(prev > 0);
+    if(prev == 1) {
+        sched_sync_wake(&lock->wq, -1);
+    }
+}
+
+void Sched_RWLockUnlockWrite(struct sched_rwlock *lock)
+{
+    assert(SDL_AtomicGet(&lock->state) == -1);
+    SDL_AtomicSet(&lock->state, 0);
+    sched_sync_wake(&lock->wq, -1);
+}
+
+void Sched_SemInit(struct sched_sem *sem, int count)
+{
+    assert(count >= 0);
+    SDL_AtomicSet(&sem->count, count);
+    sched_waitq_init(&sem->wq);
+}
+
+bool Sched_SemTryWait(struct sched_sem *sem)
+{
+    int count;
+    while((count = SDL_AtomicGet(&sem->count)) > 0) {
+        if(SDL_AtomicCAS(&sem->count, count, count - 1))
+            return true;
+    }
+    return false;
+}
+
+void Sched_SemPost(struct sched_sem *sem)
+{
+    SDL_AtomicIncRef(&sem->count);
+    sched_sync_wake(&sem->wq, 1);
+}
+
+void Sched_WaitGroupInit(struct sched_waitgroup *wg)
+{
+    SDL_AtomicSet(&wg->count, 0);
+    sched_waitq_init(&wg->wq);
+}
+
+void Sched_WaitGroupAdd(struct sched_waitgroup *wg, int count)
+{
+    int prev = SDL_AtomicAdd(&wg->count, count);
+    assert(prev + count >= 0);
+    if(prev + count == 0) {
+        sched_sync_wake(&wg->wq, -1);
+    }
+}
+
+void Sched_WaitGroupDone(struct sched_waitgroup *wg)
+{
+    Sched_WaitGroupAdd(wg, -1);
+}
+
+void *Sched_FrameAlloc(size_t size)
+{
+    return frame_arena_alloc(sched_frame_arena(), size);
+}
+
+void *Sched_FrameRealloc(void *ptr, size_t size)
+{
+    struct frame_arena *arena = sched_frame_arena();
+    if(!ptr)
+        return frame_arena_alloc(arena, size);
+
+    struct frame_hdr *hdr = ((struct frame_hdr*)ptr) - 1;
+    if(frame_arena_is_top(arena, ptr)) {
+
+        struct frame_chunk *chunk = arena->head;
+        size_t base = chunk->used - ALIGNED(hdr->size, FRAME_ALIGN);
+        if(base + ALIGNED(size, FRAME_ALIGN) <= chunk->size) {
+            chunk->used = base + ALIGNED(size, FRAME_ALIGN);
+            hdr->size = size;
+            return ptr;
+        }
+    }
+
+    void *ret = frame_arena_alloc(arena, size);
+    if(!ret)
+        return NULL;
+    memcpy(ret, ptr, hdr->size < size ? hdr->size : size);
+    return ret;
+}
+
+void Sched_FrameFree(void *ptr)
+{
+    if(!ptr)
+        return;
+
+    struct frame_arena *arena = sched_frame_arena();
+    if(!frame_arena_is_top(arena, ptr))
+        return;
+
+    struct frame_hdr *hdr = ((struct frame_hdr*)ptr) - 1;
+    arena->head->used -= sizeof(struct frame_hdr) + ALIGNED(hdr->size, FRAME_ALIGN);
+}
+
+void Sched_TaskGroupInit(struct task_group *tg)
+{
+    tg->ntasks = 0;
+    tg->fn = NULL;
+    tg->arg = NULL;
+    tg->end = 0;
+    tg->deadline_ms = 0;
+    tg->grain = 1;
+    SDL_AtomicSet(&tg->next, 0);
+}
+
+bool Sched_TaskGroupAdd(struct task_group *tg, int prio, task_func_t code, void *arg, int flags)
+{
+    if(tg->ntasks == SCHED_MAX_GROUP_TASKS)
+        return false;
+
+    uint32_t tid = Sched_CreateDeadline(prio, code, arg, &tg->futures[tg->ntasks], 
+                                        flags, tg->deadline_ms);
+    if(tid == NULL_TID)
+        return false;
+
+    tg->tids[tg->ntasks++] = tid;
+    return true;
+}
+
+void Sched_TaskGroupSetDeadline(struct task_group *tg, uint32_t deadline_ms)
+{
+    tg->deadline_ms = deadline_ms;
+}
+
+void Sched_ParallelForAsync(struct task_group *tg, size_t begin, size_t end, size_t grain,
+                            range_func_t fn, void *arg, int prio, int flags)
+{
+    assert(tg->fn == NULL);
+    assert(end - begin < INT32_MAX);
+
+    if(begin >= end)
+        return;
+
+    tg->fn = fn;
+    tg->arg = arg;
+    tg->end = end;
+    tg->grain = grain ? grain : 1;
+    SDL_AtomicSet(&tg->next, (int)begin);
+
+    size_t nchunks = (end - begin + tg->grain - 1) / tg->grain;
+    size_t nhelpers = s_nworkers < nchunks ? s_nworkers : nchunks;
+
+    for(int i = 0; i < nhelpers; i++) {
+        if(!Sched_TaskGroupAdd(tg, prio, sched_group_task, tg, flags | TASK_AFFINITY(i)))
+            break;
+    }
+}
+
+void Sched_TaskGroupJoin(struct task_group *tg)
+{
+    /* Help out with the remaining chunks instead of spinning */
+    if(tg->fn) {
+        size_t begin, end;
+        while(sched_group_claim(tg, &begin, &end)) {
+            tg->fn(begin, end, tg->arg);
+        }
+    }
+
+    for(int i = 0; i < tg->ntasks; i++) {
+        while(!Sched_FutureIsReady(&tg->futures[i])) {
+            Sched_RunSync(tg->tids[i]);
+        }
+    }
+
+    tg->ntasks = 0;
+    tg->fn = NULL;
+    tg->arg = NULL;
+}
+
+void Sched_ParallelFor(size_t begin, size_t end, size_t grain, range_func_t fn, void *arg)
+{
+    /* The task group is too large to live on a small task stack */
+    assert(Sched_UsingBigStack());
+
+    struct task_group tg;
+    Sched_TaskGroupInit(&tg);
+    Sched_ParallelForAsync(&tg, begin, end, grain, fn, arg, 0, 0);
+    Sched_TaskGroupJoin(&tg);
+}
+
+void Sched_GetStackStats(struct sched_stack_stats out[SCHED_STACK_CLASS_COUNT])
+{
+    SDL_LockMutex(s_request_lock);
+    for(int i = 0; i < SCHED_STACK_CLASS_COUNT; i++) {
+        out[i] = s_stack_pools[i].stats;
+    }
+    SDL_UnlockMutex(s_request_lock);
+}
+
+void Sched_GetStats(struct sched_stats *out)
+{
+    ASSERT_IN_MAIN_THREAD();
+    *out = s_last_stats;
+}
+
+void Sched_GetTopology(struct sched_topology *out)
+{
+    *out = s_topology;
+}
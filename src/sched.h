@@ -77,6 +77,18 @@ enum comp_status{
 struct future{
     struct result res;
     SDL_atomic_t  status;
+    uint32_t      cont;     /* Pending continuations, protected by the scheduler */
+};
+
+/* A join is a future that completes once all ('Sched_WhenAll') or any 
+ * ('Sched_WhenAny') of a set of input futures have completed. The result 
+ * is that of the input which completed it. As it is an ordinary future, it 
+ * can be polled or have continuations of its own. The join must stay alive 
+ * until all of its inputs have completed.
+ */
+struct sched_join{
+    struct future future;
+    int           remaining;
 };
 
 enum{
@@ -86,12 +98,203 @@ enum{
     TASK_RUN_DURING_PAUSE   = (1 << 3)
 };
 
+/* An optional worker affinity hint can be OR'd into the task flags 
+ * (ex. 'TASK_BIG_STACK | TASK_AFFINITY(i)'). The task will be placed 
+ * into the ready queue of worker (i % nworkers) instead of being 
+ * distributed round-robin. Note that the task may still be stolen 
+ * by another worker which has run out of work.
+ */
+#define TASK_AFFINITY_SHIFT     (16)
+#define TASK_AFFINITY_MASK      (0xff << TASK_AFFINITY_SHIFT)
+#define TASK_AFFINITY(_worker)  (((((uint32_t)(_worker)) % 0xff) + 1) << TASK_AFFINITY_SHIFT)
+
+enum{
+    SCHED_STACK_SMALL,
+    SCHED_STACK_BIG,
+    SCHED_STACK_CLASS_COUNT
+};
+
+struct sched_stack_stats{
+    size_t size;        /* usable size of a stack of this class */
+    size_t nlive;       /* stacks currently owned by tasks */
+    size_t nlive_hwm;   /* most stacks owned by tasks at the same time */
+    size_t ncached;     /* stacks sitting in the pool, ready for re-use */
+    size_t nmapped;     /* stacks currently mapped (live + cached) */
+    size_t depth_hwm;   /* deepest stack usage seen when switching out of a task */
+};
+
+#define SCHED_MAX_WORKERS       (64)
+
+/* Scheduler telemetry for the last completed tick */
+struct sched_stats{
+    size_t   nworkers;
+    size_t   ntasks_live;
+    uint64_t ntasks_created;
+    uint64_t nswitches;         /* number of times a task was switched to */
+    uint64_t nsteals;           /* number of tasks stolen from another worker's queue */
+    uint64_t ndeadline_misses;  /* number of tasks which completed after their deadline */
+    size_t   max_queue_depth;   /* most tasks sitting in the ready queues at once */
+    double   tick_ms;           /* time between starting and quiescing the workers */
+    double   ready_wait_ms;     /* total time tasks spent in a ready queue before running */
+    double   ready_wait_max_ms; /* longest time a single task spent in a ready queue */
+    double   blocked_msg_ms;    /* total time tasks spent blocked on send/receive/reply */
+    double   blocked_event_ms;  /* total time tasks spent blocked on awaiting an event */
+    double   main_busy_ms;      /* time the main thread spent running tasks */
+    double   worker_busy_ms[SCHED_MAX_WORKERS];
+};
+
+/* The layout of the hardware threads available to the process. The workers 
+ * are placed on the fastest cores first - one per physical core, before the 
+ * efficiency cores and the second hardware threads of the cores. The first 
+ * of them is left for the main thread. The capacity of a hardware thread is 
+ * its' throughput relative to a thread running alone on the fastest core. 
+ */
+struct sched_topology{
+    int   nlogical;
+    int   ncores;       /* physical cores */
+    int   nefficiency;  /* physical cores of a lower performance class */
+    int   npackages;
+    int   nnodes;       /* NUMA nodes */
+    bool  pinned;       /* the workers are pinned to their hardware threads */
+    float capacity;     /* the total capacity of the main thread and the workers */
+};
+
+/* Tasks with a lower 'prio' value are more urgent. Tasks at or above the 
+ * background priority will not be started by the main thread once the 
+ * background budget of the tick (CONFIG_SCHED_BG_BUDGET) is used up. 
+ * A task created with a deadline is scheduled ahead of all tasks without 
+ * one, earliest deadline first, and its' children inherit the deadline.
+ */
+#define SCHED_PRIO_BACKGROUND   (16)
+
 typedef struct result (*task_func_t)(void *);
+typedef void (*range_func_t)(size_t begin, size_t end, void *arg);
+
+#define SCHED_MAX_GROUP_TASKS   (256)
+
+/* A task group tracks a set of tasks that are joined together. The 
+ * futures are owned by the group and are recycled every time the group 
+ * is re-used. A group can either hold a set of independent tasks added
+ * with 'Sched_TaskGroupAdd' or a range of work items that is split up 
+ * between the workers by 'Sched_ParallelForAsync'. For the latter, the 
+ * chunks are claimed dynamically in decreasing sizes (but never smaller 
+ * than 'grain') and whichever thread joins the group will claim chunks 
+ * to execute itself instead of waiting idly for the helpers to finish.
+ */
+struct task_group{
+    size_t        ntasks;
+    uint32_t      tids[SCHED_MAX_GROUP_TASKS];
+    struct future futures[SCHED_MAX_GROUP_TASKS];
+    range_func_t  fn;
+    void         *arg;
+    size_t        end;
+    size_t        grain;
+    SDL_atomic_t  next;
+    uint32_t      deadline_ms;
+};
+
+/* A bounded multi-producer, single-consumer channel of fixed-size elements. 
+ * Elements are pushed and popped without taking the scheduler lock. The 
+ * consumer only enters the scheduler when it needs to block on an empty 
+ * channel (Task_ChanRecv) and a producer only takes the lock when there is 
+ * a blocked consumer to wake up. The capacity is rounded up to a power of 2.
+ */
+struct sched_chan{
+    size_t         elemsize;
+    size_t         mask;
+    unsigned char *slots;
+    SDL_atomic_t  *seqs;
+    SDL_atomic_t   head;    /* next slot to be claimed by a producer */
+    SDL_atomic_t   tail;    /* next slot to be consumed */
+    SDL_atomic_t   waiter;  /* TID of the consumer blocked on the channel */
+};
+
+/* The synchronization primitives below park a task which has to wait in 
+ * the scheduler (rather than blocking or spinning on the worker thread) 
+ * and make it ready again when it is released. The uncontended paths are 
+ * a single atomic operation and only the waiting and the waking of parked 
+ * tasks take the scheduler lock. The waiting calls (Task_MutexLock, etc.) 
+ * may only be made from task context. The primitives must be re-initialized 
+ * after 'Sched_ClearState', as that discards all the parked tasks.
+ */
+struct sched_waitq{
+    SDL_atomic_t   nwaiters;
+    uint32_t       head;
+    uint32_t       tail;
+};
+
+struct sched_mutex{
+    SDL_atomic_t       state;   /* 0: unlocked, 1: locked, 2: locked with waiters */
+    struct sched_waitq wq;
+};
+
+struct sched_rwlock{
+    SDL_atomic_t       state;   /* -1: write-locked, otherwise the number of readers */
+    struct sched_waitq wq;
+};
+
+struct sched_sem{
+    SDL_atomic_t       count;
+    struct sched_waitq wq;
+};
+
+struct sched_waitgroup{
+    SDL_atomic_t       count;
+    struct sched_waitq wq;
+};
 
 /* The following may only be called from any context */
 
 bool     Sched_FutureIsReady(const struct future *future);
+/* Create a detached task running 'code' as soon as 'future' completes, or 
+ * right away if it already has. The optional 'result' future is marked as 
+ * incomplete immediately, so that further continuations can be chained 
+ * onto it before the task even exists. */
+bool     Sched_FutureThen(struct future *future, int prio, task_func_t code, void *arg, 
+                          struct future *result, int flags);
+bool     Sched_WhenAll(struct sched_join *join, struct future *const *futures, size_t n);
+bool     Sched_WhenAny(struct sched_join *join, struct future *const *futures, size_t n);
 void     Sched_TryYield(void);
+/* Returns true when the active task has used up its' time quantum or the
+ * tick budget, or when there is more urgent work waiting. Always returns 
+ * false outside of a task context. */
+bool     Sched_ShouldYield(void);
+
+bool     Sched_ChanInit(struct sched_chan *chan, size_t elemsize, size_t capacity);
+void     Sched_ChanDestroy(struct sched_chan *chan);
+bool     Sched_ChanTrySend(struct sched_chan *chan, const void *elem);
+bool     Sched_ChanTryRecv(struct sched_chan *chan, void *out);
+
+void     Sched_MutexInit(struct sched_mutex *mutex);
+bool     Sched_MutexTryLock(struct sched_mutex *mutex);
+void     Sched_MutexUnlock(struct sched_mutex *mutex);
+
+void     Sched_RWLockInit(struct sched_rwlock *lock);
+bool     Sched_RWLockTryRead(struct sched_rwlock *lock);
+bool     Sched_RWLockTryWrite(struct sched_rwlock *lock);
+void     Sched_RWLockUnlockRead(struct sched_rwlock *lock);
+void     Sched_RWLockUnlockWrite(struct sched_rwlock *lock);
+
+void     Sched_SemInit(struct sched_sem *sem, int count);
+bool     Sched_SemTryWait(struct sched_sem *sem);
+void     Sched_SemPost(struct sched_sem *sem);
+
+void     Sched_WaitGroupInit(struct sched_waitgroup *wg);
+void     Sched_WaitGroupAdd(struct sched_waitgroup *wg, int count);
+void     Sched_WaitGroupDone(struct sched_waitgroup *wg);
+
+/* The frame allocator hands out memory from an arena owned by the calling 
+ * thread, so it must only be called from the main thread or a worker. The 
+ * memory is reclaimed in bulk and stays valid until the end of the tick 
+ * following the one in which it was allocated. It must not be held by a 
+ * task across ticks beyond that. 'Sched_FrameFree' only releases the most 
+ * recent allocation of the thread and is a no-op otherwise. The realloc and 
+ * free functions can be used as the allocator hooks of the containers 
+ * (ex. 'vec_*_init_alloc') for temporary buffers.
+ */
+void    *Sched_FrameAlloc(size_t size);
+void    *Sched_FrameRealloc(void *ptr, size_t size);
+void     Sched_FrameFree(void *ptr);
 
 /* The following may only be called from main thread context */
 
@@ -101,12 +304,25 @@ void     Sched_HandleEvent(int event, void *arg, int event_source, bool immediat
 void     Sched_StartBackgroundTasks(void);
 void     Sched_Tick(void);
 uint32_t Sched_Create(int prio, task_func_t code, void *arg, struct future *result, int flags);
+uint32_t Sched_CreateDeadline(int prio, task_func_t code, void *arg, struct future *result, 
+                              int flags, uint32_t deadline_ms);
 uint32_t Sched_CreateBlocking(int prio, task_func_t code, void *arg, struct future *result, int flags);
 bool     Sched_RunSync(uint32_t tid);
 void     Sched_ClearState(void);
 void     Sched_Flush(void);
 bool     Sched_HasBlocked(void);
 bool     Sched_IsReady(uint32_t tid);
+void     Sched_GetStackStats(struct sched_stack_stats out[SCHED_STACK_CLASS_COUNT]);
+void     Sched_GetStats(struct sched_stats *out);
+void     Sched_GetTopology(struct sched_topology *out);
+
+void     Sched_TaskGroupInit(struct task_group *tg);
+void     Sched_TaskGroupSetDeadline(struct task_group *tg, uint32_t deadline_ms);
+bool     Sched_TaskGroupAdd(struct task_group *tg, int prio, task_func_t code, void *arg, int flags);
+void     Sched_ParallelForAsync(struct task_group *tg, size_t begin, size_t end, size_t grain,
+                                range_func_t fn, void *arg, int prio, int flags);
+void     Sched_TaskGroupJoin(struct task_group *tg);
+void     Sched_ParallelFor(size_t begin, size_t end, size_t grain, range_func_t fn, void *arg);
 
 /* The following may only be called from task context 
  * (i.e. from the body of a task function) */
@@ -122,6 +338,11 @@ enum reqtype{
     SCHED_REQ_AWAIT_EVENT,
     SCHED_REQ_SET_DESTRUCTOR,
     SCHED_REQ_WAIT,
+    SCHED_REQ_CHAN_WAIT,
+    SCHED_REQ_READ,
+    SCHED_REQ_WRITE,
+    SCHED_REQ_SYNC_WAIT,
+    SCHED_REQ_SLEEP,
     _SCHED_REQ_COUNT,
 };
 
@@ -131,6 +352,7 @@ struct request{
 };
 
 uint64_t Sched_Request(struct request req);
+void     Sched_SleepMs(uint32_t ms);
 uint32_t Sched_ActiveTID(void);
 bool     Sched_UsingBigStack(void);
 
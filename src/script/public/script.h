@@ -64,6 +64,11 @@ void            S_ShowLastError(void);
 
 void            S_RunEventHandler(script_opaque_t callable, script_opaque_t user_arg, 
                                   void *event_arg);
+/* Invokes the handler with a list of (receiver, arg) tuples. Receivers 
+ * that are not entities are passed as None. */
+void            S_RunBatchEventHandler(script_opaque_t callable, script_opaque_t user_arg,
+                                       size_t nevents, const uint32_t *receivers,
+                                       script_opaque_t *event_args);
 
 void            S_Retain(script_opaque_t obj);
 /* Decrement reference count for Python objects. 
@@ -79,6 +84,9 @@ bool            S_ObjectsEqual(script_opaque_t a, script_opaque_t b);
 uint64_t        S_ScriptTypeID(uint32_t uid);
 int             S_FormationPriority(uint32_t uid);
 
+void            S_GC_Step(void);
+void            S_GC_CollectFull(void);
+
 void            S_ClearState(void);
 bool            S_SaveState(SDL_RWops *stream);
 bool            S_LoadState(SDL_RWops *stream);
@@ -0,0 +1,385 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018-2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "py_array.h"
+#include "py_pickle.h"
+#include "../lib/public/SDL_vec_rwops.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+#define CHK_TRUE(_pred, _label) do{ if(!(_pred)) goto _label; }while(0)
+
+typedef struct {
+    PyObject_HEAD
+    char       format[2];
+    Py_ssize_t itemsize;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    void      *data;
+}PyArrayObject;
+
+
+static void       PyArray_dealloc(PyArrayObject *self);
+static Py_ssize_t PyArray_length(PyArrayObject *self);
+static PyObject  *PyArray_item(PyArrayObject *self, Py_ssize_t idx);
+
+static int        PyArray_getbuffer(PyArrayObject *self, Py_buffer *view, int flags);
+static Py_ssize_t PyArray_getreadbuf(PyArrayObject *self, Py_ssize_t segment, void **ptr);
+static Py_ssize_t PyArray_getsegcount(PyArrayObject *self, Py_ssize_t *lenp);
+
+static PyObject  *PyArray_get_format(PyArrayObject *self, void *closure);
+static PyObject  *PyArray_get_shape(PyArrayObject *self, void *closure);
+
+static PyObject  *PyArray_pickle(PyArrayObject *self, PyObject *args, PyObject *kwargs);
+static PyObject  *PyArray_unpickle(PyObject *cls, PyObject *args, PyObject *kwargs);
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static PySequenceMethods PyArray_as_sequence = {
+    .sq_length      = (lenfunc)PyArray_length,
+    .sq_item        = (ssizeargfunc)PyArray_item,
+};
+
+static PyBufferProcs PyArray_as_buffer = {
+    .bf_getreadbuffer   = (readbufferproc)PyArray_getreadbuf,
+    .bf_getsegcount     = (segcountproc)PyArray_getsegcount,
+    .bf_getbuffer       = (getbufferproc)PyArray_getbuffer,
+};
+
+static PyGetSetDef PyArray_getset[] = {
+    {"format",
+    (getter)PyArray_get_format, NULL,
+    "The 'struct' module format character of a single element.",
+    NULL},
+    {"shape",
+    (getter)PyArray_get_shape, NULL,
+    "A tuple of the number of rows and the number of elements in each row.",
+    NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyMethodDef PyArray_methods[] = {
+    {"__pickle__", 
+    (PyCFunction)PyArray_pickle, METH_KEYWORDS,
+    "Serialize a Permafrost Engine array to a string."},
+
+    {"__unpickle__", 
+    (PyCFunction)PyArray_unpickle, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+    "Create a new pf.Array instance from a string earlier returned from a __pickle__ method."
+    "Returns a tuple of the new instance and the number of bytes consumed from the stream."},
+
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject PyArray_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name        = "pf.Array",
+    .tp_basicsize   = sizeof(PyArrayObject),
+    .tp_flags       = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+    .tp_doc         = "A read-only array of numeric values returned from bulk engine queries. "
+                      "Supports the buffer protocol, so it can be wrapped with 'memoryview' or "
+                      "'numpy.frombuffer' without copying. Indexing a 2-dimensional array yields "
+                      "a tuple for each row.",
+    .tp_dealloc     = (destructor)PyArray_dealloc,
+    .tp_as_sequence = &PyArray_as_sequence,
+    .tp_as_buffer   = &PyArray_as_buffer,
+    .tp_getset      = PyArray_getset,
+    .tp_methods     = PyArray_methods,
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static Py_ssize_t array_nbytes(const PyArrayObject *self)
+{
+    return self->shape[0] * self->shape[1] * self->itemsize;
+}
+
+static PyObject *array_new(char format, size_t itemsize, size_t nrows, size_t ncols)
+{
+    PyArrayObject *ret = (PyArrayObject*)PyArray_type.tp_alloc(&PyArray_type, 0);
+    if(!ret)
+        return NULL;
+
+    ret->format[0] = format;
+    ret->format[1] = '\0';
+    ret->itemsize = itemsize;
+    ret->shape[0] = nrows;
+    ret->shape[1] = ncols;
+    ret->strides[0] = ncols * itemsize;
+    ret->strides[1] = itemsize;
+
+    /* Always allocate at least 1 byte so that empty arrays still
+     * expose a valid buffer address */
+    ret->data = malloc(array_nbytes(ret) ? array_nbytes(ret) : 1);
+    if(!ret->data) {
+        Py_DECREF(ret);
+        return PyErr_NoMemory();
+    }
+    return (PyObject*)ret;
+}
+
+static PyObject *array_scalar(const PyArrayObject *self, const void *ptr)
+{
+    switch(self->format[0]) {
+    case 'i': return PyInt_FromLong(*(const int32_t*)ptr);
+    case 'I': return PyInt_FromLong(*(const uint32_t*)ptr);
+    case 'f': return PyFloat_FromDouble(*(const float*)ptr);
+    default: assert(0);
+    }
+    PyErr_SetString(PyExc_RuntimeError, "Unsupported array format.");
+    return NULL;
+}
+
+static void PyArray_dealloc(PyArrayObject *self)
+{
+    free(self->data);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static Py_ssize_t PyArray_length(PyArrayObject *self)
+{
+    return self->shape[0];
+}
+
+static PyObject *PyArray_item(PyArrayObject *self, Py_ssize_t idx)
+{
+    if(idx < 0 || idx >= self->shape[0]) {
+        PyErr_SetString(PyExc_IndexError, "Array index out of range.");
+        return NULL;
+    }
+
+    const char *row = (const char*)self->data + idx * self->strides[0];
+    if(self->shape[1] == 1)
+        return array_scalar(self, row);
+
+    PyObject *ret = PyTuple_New(self->shape[1]);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < self->shape[1]; i++) {
+        PyObject *elem = array_scalar(self, row + i * self->strides[1]);
+        if(!elem) {
+            Py_DECREF(ret);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(ret, i, elem);
+    }
+    return ret;
+}
+
+static int PyArray_getbuffer(PyArrayObject *self, Py_buffer *view, int flags)
+{
+    if(flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "pf.Array objects are read-only.");
+        view->obj = NULL;
+        return -1;
+    }
+
+    Py_INCREF(self);
+    view->obj = (PyObject*)self;
+    view->buf = self->data;
+    view->len = array_nbytes(self);
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    /* The data is C-contiguous, so consumers that don't ask for the 
+     * shape get it as a flat array of bytes */
+    if(flags & PyBUF_ND) {
+        view->ndim = (self->shape[1] > 1) ? 2 : 1;
+        view->shape = self->shape;
+        view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) 
+                      ? (self->shape[1] > 1 ? self->strides : self->strides + 1)
+                      : NULL;
+    }else{
+        view->ndim = 1;
+        view->shape = NULL;
+        view->strides = NULL;
+    }
+    return 0;
+}
+
+static Py_ssize_t PyArray_getreadbuf(PyArrayObject *self, Py_ssize_t segment, void **ptr)
+{
+    if(segment != 0) {
+        PyErr_SetString(PyExc_SystemError, "Accessing non-existent array segment.");
+        return -1;
+    }
+    *ptr = self->data;
+    return array_nbytes(self);
+}
+
+static Py_ssize_t PyArray_getsegcount(PyArrayObject *self, Py_ssize_t *lenp)
+{
+    if(lenp) {
+        *lenp = array_nbytes(self);
+    }
+    return 1;
+}
+
+static PyObject *PyArray_get_format(PyArrayObject *self, void *closure)
+{
+    return PyString_FromString(self->format);
+}
+
+static PyObject *PyArray_get_shape(PyArrayObject *self, void *closure)
+{
+    return Py_BuildValue("(nn)", self->shape[0], self->shape[1]);
+}
+
+static PyObject *PyArray_pickle(PyArrayObject *self, PyObject *args, PyObject *kwargs)
+{
+    bool status;
+    PyObject *ret = NULL;
+
+    SDL_RWops *stream = PFSDL_VectorRWOps();
+    CHK_TRUE(stream, fail_alloc);
+
+    PyObject *attrs = Py_BuildValue("(snns#)", 
+        self->format,
+        self->shape[0],
+        self->shape[1],
+        (const char*)self->data, array_nbytes(self)
+    );
+    CHK_TRUE(attrs, fail_pickle);
+
+    status = S_PickleObjgraph(attrs, stream);
+    Py_DECREF(attrs);
+    CHK_TRUE(status, fail_pickle);
+    ret = PyString_FromStringAndSize(PFSDL_VectorRWOpsRaw(stream), SDL_RWsize(stream));
+
+fail_pickle:
+    SDL_RWclose(stream);
+fail_alloc:
+    return ret;
+}
+
+static PyObject *PyArray_unpickle(PyObject *cls, PyObject *args, PyObject *kwargs)
+{
+    PyObject *ret = NULL;
+    const char *str;
+    Py_ssize_t len;
+    char tmp;
+
+    if(!PyArg_ParseTuple(args, "s#", &str, &len)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a single string.");
+        goto fail_args;
+    }
+
+    SDL_RWops *stream = SDL_RWFromConstMem(str, len);
+    CHK_TRUE(stream, fail_args);
+
+    PyObject *attrs = S_UnpickleObjgraph(stream);
+    SDL_RWread(stream, &tmp, 1, 1); /* consume NULL byte */
+    CHK_TRUE(attrs, fail_unpickle);
+
+    const char *format, *data;
+    Py_ssize_t nrows, ncols, ndata;
+
+    if(!PyArg_ParseTuple(attrs, "snns#", &format, &nrows, &ncols, &data, &ndata)) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not unpickle internal state of pf.Array instance.");
+        goto fail_unpickle;
+    }
+
+    size_t itemsize;
+    switch(format[0]) {
+    case 'i': itemsize = sizeof(int32_t);  break;
+    case 'I': itemsize = sizeof(uint32_t); break;
+    case 'f': itemsize = sizeof(float);    break;
+    default:
+        PyErr_SetString(PyExc_RuntimeError, "Unsupported pf.Array format.");
+        goto fail_unpickle;
+    }
+
+    if(nrows < 0 || ncols < 1 || ndata != nrows * ncols * itemsize) {
+        PyErr_SetString(PyExc_RuntimeError, "Inconsistent pf.Array dimensions.");
+        goto fail_unpickle;
+    }
+
+    PyArrayObject *arrobj = (PyArrayObject*)array_new(format[0], itemsize, nrows, ncols);
+    CHK_TRUE(arrobj, fail_unpickle);
+    memcpy(arrobj->data, data, ndata);
+
+    Py_ssize_t nread = SDL_RWseek(stream, 0, RW_SEEK_CUR);
+    ret = Py_BuildValue("(Oi)", arrobj, (int)nread);
+    Py_DECREF(arrobj);
+
+fail_unpickle:
+    Py_XDECREF(attrs);
+    SDL_RWclose(stream);
+fail_args:
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void S_Array_PyRegister(PyObject *module)
+{
+    if(PyType_Ready(&PyArray_type) < 0)
+        return;
+    Py_INCREF(&PyArray_type);
+    PyModule_AddObject(module, "Array", (PyObject*)&PyArray_type);
+}
+
+PyObject *S_Array_New(char format, size_t itemsize, size_t nrows, size_t ncols)
+{
+    assert(ncols > 0);
+    return array_new(format, itemsize, nrows, ncols);
+}
+
+void *S_Array_Data(PyObject *array)
+{
+    assert(Py_TYPE(array) == &PyArray_type);
+    return ((PyArrayObject*)array)->data;
+}
+
+void S_Array_Truncate(PyObject *array, size_t nrows)
+{
+    assert(Py_TYPE(array) == &PyArray_type);
+    PyArrayObject *self = (PyArrayObject*)array;
+    assert(nrows <= self->shape[0]);
+    self->shape[0] = nrows;
+}
+
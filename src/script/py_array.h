@@ -0,0 +1,55 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018-2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PY_ARRAY_H
+#define PY_ARRAY_H
+
+#include <Python.h> /* Must be first */
+#include <stddef.h>
+
+/* A flat, read-only array of fixed-size scalars exposed to Python via the 
+ * buffer protocol. Used to hand bulk query results to scripts without
+ * creating a Python object for every element. 'format' is a struct module 
+ * format character. When 'ncols' is greater than 1, the array is exposed 
+ * as a 2-dimensional (nrows x ncols) buffer. 
+ */
+void      S_Array_PyRegister(PyObject *module);
+PyObject *S_Array_New(char format, size_t itemsize, size_t nrows, size_t ncols);
+void     *S_Array_Data(PyObject *array);
+/* Shrinks the number of rows in a newly-created array */
+void      S_Array_Truncate(PyObject *array, size_t nrows);
+
+#endif
+
@@ -0,0 +1,932 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "py_bundle.h"
+#include "py_pickle.h"
+#include "../lib/public/pf_string.h"
+#include "../lib/public/SDL_vec_rwops.h"
+
+#include <marshal.h>
+#include <SDL.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#endif
+
+
+#define BUNDLE_NAME     "scripts.pfbundle"
+#define BUNDLE_MAGIC    "PFBUNDL2"
+#define ENTRY_PACKAGE   (1 << 0)
+#define MAX_PATH_LEN    (1024)
+
+#define CHK_TRUE(_pred, _label) do{ if(!(_pred)) goto _label; }while(0)
+#define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+/* The archive is laid out as the header, the module keys, the index and 
+ * the marshalled code objects, all in native byte order. The keys are the 
+ * module paths relative to the scripts directory, without the extension 
+ * (or the directory path for packages), and the index is sorted by them. 
+ * Like a .pyc file, each entry records the modification time (and size) 
+ * of the source it was compiled from, and is skipped in favour of the 
+ * loose file when the source no longer matches.
+ */
+struct bundle_header{
+    char     magic[8];
+    uint32_t pymagic;
+    uint32_t nentries;
+    uint32_t index_off;
+};
+
+struct bundle_entry{
+    uint32_t key_off;
+    uint32_t key_len;
+    uint32_t code_off;
+    uint32_t code_len;
+    uint32_t flags;
+    uint32_t src_mtime;
+    uint32_t src_size;
+};
+
+struct bundle{
+    const char                *base;
+    size_t                     size;
+    const struct bundle_entry *index;
+    uint32_t                   nentries;
+#ifdef _WIN32
+    HANDLE                     file;
+    HANDLE                     mapping;
+#endif
+};
+
+struct build_entry{
+    char      key[MAX_PATH_LEN];
+    uint32_t  flags;
+    uint32_t  src_mtime;
+    uint32_t  src_size;
+    PyObject *blob;
+};
+
+struct dir_item{
+    char name[256];
+    bool isdir;
+};
+
+struct build_ctx{
+    size_t              nentries;
+    size_t              capacity;
+    struct build_entry *entries;
+};
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *dir;      /* the path entry, as it appears on sys.path */
+    PyObject *prefix;   /* relative to the scripts directory; NULL if not in the archive */
+}PyBundleImporterObject;
+
+static int       PyBundleImporter_init(PyBundleImporterObject *self, PyObject *args, PyObject *kwds);
+static void      PyBundleImporter_dealloc(PyBundleImporterObject *self);
+static PyObject *PyBundleImporter_find_module(PyBundleImporterObject *self, PyObject *args);
+static PyObject *PyBundleImporter_load_module(PyBundleImporterObject *self, PyObject *args);
+static PyObject *PyBundleImporter_pickle(PyBundleImporterObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *PyBundleImporter_unpickle(PyObject *cls, PyObject *args, PyObject *kwargs);
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static PyMethodDef PyBundleImporter_methods[] = {
+    {"find_module", 
+    (PyCFunction)PyBundleImporter_find_module, METH_VARARGS,
+    "Returns this importer if the specified module is in the script archive, or None."},
+
+    {"load_module", 
+    (PyCFunction)PyBundleImporter_load_module, METH_VARARGS,
+    "Import the specified module from its' precompiled code in the script archive."},
+
+    {"__pickle__", 
+    (PyCFunction)PyBundleImporter_pickle, METH_KEYWORDS,
+    "Serialize a Permafrost Engine script archive importer to a string."},
+
+    {"__unpickle__", 
+    (PyCFunction)PyBundleImporter_unpickle, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+    "Create a new pf.BundleImporter instance from a string earlier returned from a __pickle__ method."
+    "Returns a tuple of the new instance and the number of bytes consumed from the stream."},
+
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject PyBundleImporter_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name        = "pf.BundleImporter",
+    .tp_basicsize   = sizeof(PyBundleImporterObject),
+    .tp_flags       = Py_TPFLAGS_DEFAULT,
+    .tp_doc         = "Import hook for the directories of the precompiled script archive. "
+                      "Constructing it for any other path raises ImportError.",
+    .tp_methods     = PyBundleImporter_methods,
+    .tp_init        = (initproc)PyBundleImporter_init,
+    .tp_new         = PyType_GenericNew,
+    .tp_dealloc     = (destructor)PyBundleImporter_dealloc,
+};
+
+static struct bundle s_bundle;
+/* The absolute path of the scripts directory, with forward slashes */
+static char          s_root[MAX_PATH_LEN];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool abspath(const char *path, char out[static MAX_PATH_LEN])
+{
+#ifdef _WIN32
+    if(!_fullpath(out, path, MAX_PATH_LEN))
+        return false;
+    for(char *c = out; *c; c++) {
+        if(*c == '\\')
+            *c = '/';
+    }
+#else
+    char tmp[PATH_MAX];
+    if(!realpath(path, tmp))
+        return false;
+    if(pf_strlcpy(out, tmp, MAX_PATH_LEN) >= MAX_PATH_LEN)
+        return false;
+#endif
+    size_t len = strlen(out);
+    while(len > 1 && out[len - 1] == '/')
+        out[--len] = '\0';
+    return true;
+}
+
+/* Returns the path relative to the scripts directory, or NULL if it isn't in it */
+static const char *relpath(const char *abs)
+{
+    size_t rootlen = strlen(s_root);
+    if(rootlen == 0 || strncmp(abs, s_root, rootlen))
+        return NULL;
+    if(abs[rootlen] == '\0')
+        return abs + rootlen;
+    if(abs[rootlen] == '/')
+        return abs + rootlen + 1;
+    return NULL;
+}
+
+static int key_cmp(const struct bundle_entry *entry, const char *key, size_t len)
+{
+    size_t minlen = entry->key_len < len ? entry->key_len : len;
+    int ret = memcmp(s_bundle.base + entry->key_off, key, minlen);
+    if(ret)
+        return ret;
+    return (entry->key_len > len) - (entry->key_len < len);
+}
+
+/* Index of the first entry not ordered before the key */
+static size_t bundle_lower_bound(const char *key, size_t len)
+{
+    size_t lo = 0, hi = s_bundle.nentries;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(key_cmp(&s_bundle.index[mid], key, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static const struct bundle_entry *bundle_find(const char *key)
+{
+    size_t len = strlen(key);
+    size_t idx = bundle_lower_bound(key, len);
+    if(idx == s_bundle.nentries || key_cmp(&s_bundle.index[idx], key, len))
+        return NULL;
+    return &s_bundle.index[idx];
+}
+
+static bool bundle_has_dir(const char *prefix)
+{
+    if(!s_bundle.base)
+        return false;
+    if(prefix[0] == '\0')
+        return (s_bundle.nentries > 0);
+
+    char dir[MAX_PATH_LEN];
+    if(pf_snprintf(dir, sizeof(dir), "%s/", prefix) >= sizeof(dir))
+        return false;
+
+    size_t len = strlen(dir);
+    size_t idx = bundle_lower_bound(dir, len);
+    if(idx == s_bundle.nentries)
+        return false;
+
+    const struct bundle_entry *entry = &s_bundle.index[idx];
+    return (entry->key_len >= len) && (0 == memcmp(s_bundle.base + entry->key_off, dir, len));
+}
+
+static bool bundle_validate(void)
+{
+    if(s_bundle.size < sizeof(struct bundle_header))
+        return false;
+
+    const struct bundle_header *header = (const struct bundle_header*)s_bundle.base;
+    if(memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)))
+        return false;
+    /* Bytecode from a different interpreter version is not to be trusted */
+    if(header->pymagic != (uint32_t)PyImport_GetMagicNumber())
+        return false;
+    if(header->index_off % sizeof(uint32_t))
+        return false;
+    if(header->index_off > s_bundle.size
+    || header->nentries > (s_bundle.size - header->index_off) / sizeof(struct bundle_entry))
+        return false;
+
+    const struct bundle_entry *index = (const struct bundle_entry*)(s_bundle.base + header->index_off);
+    for(int i = 0; i < header->nentries; i++) {
+        const struct bundle_entry *entry = &index[i];
+        if(entry->key_off > s_bundle.size || entry->key_len > s_bundle.size - entry->key_off)
+            return false;
+        if(entry->code_off > s_bundle.size || entry->code_len > s_bundle.size - entry->code_off)
+            return false;
+        if(entry->key_len == 0 || entry->key_len >= MAX_PATH_LEN)
+            return false;
+    }
+
+    s_bundle.index = index;
+    s_bundle.nentries = header->nentries;
+    return true;
+}
+
+static void bundle_unmap(void)
+{
+    if(!s_bundle.base)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(s_bundle.base);
+    CloseHandle(s_bundle.mapping);
+    CloseHandle(s_bundle.file);
+#else
+    munmap((void*)s_bundle.base, s_bundle.size);
+#endif
+    memset(&s_bundle, 0, sizeof(s_bundle));
+}
+
+static bool bundle_map(const char *path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, 
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    const char *base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!base) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    s_bundle.file = file;
+    s_bundle.mapping = mapping;
+    s_bundle.size = size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+        return false;
+
+    s_bundle.size = st.st_size;
+#endif
+    s_bundle.base = base;
+
+    if(!bundle_validate()) {
+        fprintf(stderr, "Ignoring stale or corrupt script archive: %s\n", path);
+        bundle_unmap();
+        return false;
+    }
+    return true;
+}
+
+static void importer_bind(PyBundleImporterObject *self, PyObject *path)
+{
+    char abs[MAX_PATH_LEN];
+    const char *rel;
+
+    Py_INCREF(path);
+    Py_XSETREF(self->dir, path);
+    Py_CLEAR(self->prefix);
+
+    if(PyString_Check(path)
+    && abspath(PyString_AS_STRING(path), abs)
+    && (rel = relpath(abs))
+    && bundle_has_dir(rel)) {
+        self->prefix = PyString_FromString(rel);
+    }
+}
+
+/* The absolute path of the source file an entry was compiled from */
+static void entry_src_path(const struct bundle_entry *entry, char out[static MAX_PATH_LEN])
+{
+    pf_snprintf(out, MAX_PATH_LEN, "%s/%.*s%s", s_root, (int)entry->key_len, 
+        s_bundle.base + entry->key_off, (entry->flags & ENTRY_PACKAGE) ? "/__init__.py" : ".py");
+}
+
+static bool entry_current(const struct bundle_entry *entry)
+{
+    char path[MAX_PATH_LEN];
+    entry_src_path(entry, path);
+
+    struct stat st;
+    if(stat(path, &st))
+        return false;
+    return (entry->src_mtime == (uint32_t)st.st_mtime)
+        && (entry->src_size == (uint32_t)st.st_size);
+}
+
+/* The importer is invoked with the full dotted name, but each directory 
+ * only holds the last component. Entries whose source has since changed 
+ * or been removed are not reported, leaving the import to the loose files. 
+ */
+static const struct bundle_entry *importer_lookup(PyBundleImporterObject *self, 
+                                                  const char *fullname, const char **out_sub)
+{
+    if(!self->prefix || !s_bundle.base)
+        return NULL;
+
+    const char *sub = strrchr(fullname, '.');
+    sub = sub ? sub + 1 : fullname;
+    *out_sub = sub;
+
+    const char *prefix = PyString_AS_STRING(self->prefix);
+    char key[MAX_PATH_LEN];
+    if(pf_snprintf(key, sizeof(key), "%s%s%s", prefix, prefix[0] ? "/" : "", sub) >= sizeof(key))
+        return NULL;
+
+    const struct bundle_entry *entry = bundle_find(key);
+    if(!entry || !entry_current(entry))
+        return NULL;
+    return entry;
+}
+
+static int PyBundleImporter_init(PyBundleImporterObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *path;
+    if(!PyArg_ParseTuple(args, "O", &path))
+        return -1;
+
+    importer_bind(self, path);
+    if(!self->prefix) {
+        PyErr_SetString(PyExc_ImportError, "The path is not in the script archive.");
+        return -1;
+    }
+    return 0;
+}
+
+static void PyBundleImporter_dealloc(PyBundleImporterObject *self)
+{
+    Py_CLEAR(self->dir);
+    Py_CLEAR(self->prefix);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject *PyBundleImporter_find_module(PyBundleImporterObject *self, PyObject *args)
+{
+    const char *fullname, *sub;
+    PyObject *path = NULL;
+
+    if(!PyArg_ParseTuple(args, "s|O", &fullname, &path))
+        return NULL;
+
+    if(!importer_lookup(self, fullname, &sub))
+        Py_RETURN_NONE;
+
+    Py_INCREF(self);
+    return (PyObject*)self;
+}
+
+static PyObject *PyBundleImporter_load_module(PyBundleImporterObject *self, PyObject *args)
+{
+    const char *fullname, *sub;
+    if(!PyArg_ParseTuple(args, "s", &fullname))
+        return NULL;
+
+    const struct bundle_entry *entry = importer_lookup(self, fullname, &sub);
+    if(!entry) {
+        PyErr_Format(PyExc_ImportError, "No module named %s in the script archive", fullname);
+        return NULL;
+    }
+
+    /* Report the same paths as the loose files would have */
+    const char *dir = PyString_AS_STRING(self->dir);
+    char file[MAX_PATH_LEN];
+    if(entry->flags & ENTRY_PACKAGE) {
+        pf_snprintf(file, sizeof(file), "%s/%s/__init__.py", dir, sub);
+    }else{
+        pf_snprintf(file, sizeof(file), "%s/%s.py", dir, sub);
+    }
+
+    PyObject *code = PyMarshal_ReadObjectFromString((char*)s_bundle.base + entry->code_off, entry->code_len);
+    if(!code)
+        return NULL;
+
+    if(!PyCode_Check(code)) {
+        Py_DECREF(code);
+        PyErr_Format(PyExc_ImportError, "Bad code object for %s in the script archive", fullname);
+        return NULL;
+    }
+
+    if(entry->flags & ENTRY_PACKAGE) {
+
+        PyObject *mod = PyImport_AddModule(fullname); /* borrowed */
+        if(!mod) {
+            Py_DECREF(code);
+            return NULL;
+        }
+
+        char pkgdir[MAX_PATH_LEN];
+        pf_snprintf(pkgdir, sizeof(pkgdir), "%s/%s", dir, sub);
+        PyObject *pkgpath = Py_BuildValue("[s]", pkgdir);
+        if(!pkgpath || 0 != PyModule_AddObject(mod, "__path__", pkgpath)) {
+            Py_XDECREF(pkgpath);
+            Py_DECREF(code);
+            return NULL;
+        }
+    }
+
+    PyObject *ret = PyImport_ExecCodeModuleEx((char*)fullname, code, file);
+    Py_DECREF(code);
+    return ret;
+}
+
+static PyObject *PyBundleImporter_pickle(PyBundleImporterObject *self, PyObject *args, PyObject *kwargs)
+{
+    bool status;
+    PyObject *ret = NULL;
+
+    SDL_RWops *stream = PFSDL_VectorRWOps();
+    CHK_TRUE(stream, fail_alloc);
+
+    status = S_PickleObjgraph(self->dir ? self->dir : Py_None, stream);
+    CHK_TRUE(status, fail_pickle);
+    ret = PyString_FromStringAndSize(PFSDL_VectorRWOpsRaw(stream), SDL_RWsize(stream));
+
+fail_pickle:
+    SDL_RWclose(stream);
+fail_alloc:
+    return ret;
+}
+
+static PyObject *PyBundleImporter_unpickle(PyObject *cls, PyObject *args, PyObject *kwargs)
+{
+    PyObject *ret = NULL;
+    const char *str;
+    Py_ssize_t len;
+    char tmp;
+
+    if(!PyArg_ParseTuple(args, "s#", &str, &len)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a single string.");
+        goto fail_args;
+    }
+
+    SDL_RWops *stream = SDL_RWFromConstMem(str, len);
+    CHK_TRUE(stream, fail_args);
+
+    PyObject *dir = S_UnpickleObjgraph(stream);
+    SDL_RWread(stream, &tmp, 1, 1); /* consume NULL byte */
+    CHK_TRUE(dir, fail_unpickle);
+
+    /* The archive may since have been rebuilt or removed. The importer then 
+     * finds nothing, leaving the imports to the loose files. */
+    PyObject *empty = PyTuple_New(0);
+    PyBundleImporterObject *importer = (PyBundleImporterObject*)((PyTypeObject*)cls)->tp_new(
+        (PyTypeObject*)cls, empty, NULL);
+    Py_XDECREF(empty);
+    CHK_TRUE(importer, fail_importer);
+    importer_bind(importer, dir);
+
+    Py_ssize_t nread = SDL_RWseek(stream, 0, RW_SEEK_CUR);
+    ret = Py_BuildValue("(Oi)", importer, (int)nread);
+    Py_DECREF(importer);
+
+fail_importer:
+    Py_DECREF(dir);
+fail_unpickle:
+    SDL_RWclose(stream);
+fail_args:
+    return ret;
+}
+
+static bool build_push(struct build_ctx *ctx, const char *key, uint32_t flags, 
+                       const struct stat *src, PyObject *blob)
+{
+    if(ctx->nentries == ctx->capacity) {
+        size_t capacity = ctx->capacity ? ctx->capacity * 2 : 256;
+        struct build_entry *entries = realloc(ctx->entries, capacity * sizeof(*entries));
+        if(!entries)
+            return false;
+        ctx->entries = entries;
+        ctx->capacity = capacity;
+    }
+    struct build_entry *entry = &ctx->entries[ctx->nentries++];
+    pf_strlcpy(entry->key, key, sizeof(entry->key));
+    entry->flags = flags;
+    entry->src_mtime = (uint32_t)src->st_mtime;
+    entry->src_size = (uint32_t)src->st_size;
+    entry->blob = blob;
+    return true;
+}
+
+static void build_clear(struct build_ctx *ctx)
+{
+    for(int i = 0; i < ctx->nentries; i++) {
+        Py_DECREF(ctx->entries[i].blob);
+    }
+    free(ctx->entries);
+}
+
+static int build_compare(const void *a, const void *b)
+{
+    const struct build_entry *ea = a, *eb = b;
+    int ret = strcmp(ea->key, eb->key);
+    if(ret)
+        return ret;
+    /* A package shadows a module of the same name */
+    return (int)(eb->flags & ENTRY_PACKAGE) - (int)(ea->flags & ENTRY_PACKAGE);
+}
+
+static PyObject *build_compile(const char *path)
+{
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream) {
+        PyErr_Format(PyExc_IOError, "Could not open %s", path);
+        return NULL;
+    }
+
+    Sint64 size = SDL_RWsize(stream);
+    char *source = malloc(size + 1);
+    if(!source) {
+        SDL_RWclose(stream);
+        return PyErr_NoMemory();
+    }
+
+    size_t nread = SDL_RWread(stream, source, 1, size);
+    SDL_RWclose(stream);
+
+    /* The compiler only accepts newlines as line terminators */
+    size_t len = 0;
+    for(size_t i = 0; i < nread; i++) {
+        if(source[i] != '\r')
+            source[len++] = source[i];
+    }
+    source[len] = '\0';
+
+    PyObject *code = Py_CompileString(source, path, Py_file_input);
+    free(source);
+    if(!code)
+        return NULL;
+
+    PyObject *ret = PyMarshal_WriteObjectToString(code, Py_MARSHAL_VERSION);
+    Py_DECREF(code);
+    return ret;
+}
+
+static bool build_add_file(struct build_ctx *ctx, const char *dir, const char *rel, const char *name)
+{
+    size_t namelen = strlen(name);
+    if(namelen <= 3 || strcmp(name + namelen - 3, ".py"))
+        return true;
+
+    char path[MAX_PATH_LEN], key[MAX_PATH_LEN];
+    pf_snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    uint32_t flags = 0;
+    if(!strcmp(name, "__init__.py")) {
+        if(rel[0] == '\0')
+            return true;
+        pf_strlcpy(key, rel, sizeof(key));
+        flags |= ENTRY_PACKAGE;
+    }else{
+        pf_snprintf(key, sizeof(key), "%s%s%.*s", rel, rel[0] ? "/" : "", (int)(namelen - 3), name);
+    }
+
+    /* Taken before reading the source, so that an edit made while 
+     * compiling leaves the entry stale rather than current */
+    struct stat st;
+    if(stat(path, &st)) {
+        PyErr_Format(PyExc_IOError, "Could not stat %s", path);
+        return false;
+    }
+
+    PyObject *blob = build_compile(path);
+    if(!blob)
+        return false;
+
+    if(!build_push(ctx, key, flags, &st, blob)) {
+        Py_DECREF(blob);
+        PyErr_NoMemory();
+        return false;
+    }
+    return true;
+}
+
+static bool dir_items_push(struct dir_item **items, size_t *nitems, size_t *capacity, 
+                           const char *name, bool isdir)
+{
+    if(*nitems == *capacity) {
+        size_t newcap = *capacity ? *capacity * 2 : 64;
+        struct dir_item *newitems = realloc(*items, newcap * sizeof(**items));
+        if(!newitems)
+            return false;
+        *items = newitems;
+        *capacity = newcap;
+    }
+    pf_strlcpy((*items)[*nitems].name, name, sizeof((*items)[0].name));
+    (*items)[*nitems].isdir = isdir;
+    (*nitems)++;
+    return true;
+}
+
+static bool build_walk(struct build_ctx *ctx, const char *dir, const char *rel)
+{
+    /* The Blender add-on is not run by the engine */
+    static const char *excluded[] = {"io_scene_pfobj"};
+
+    struct dir_item *items = NULL;
+    size_t nitems = 0, capacity = 0;
+    bool ret = false;
+
+#ifdef _WIN32
+    char pattern[MAX_PATH_LEN];
+    pf_snprintf(pattern, sizeof(pattern), "%s/*", dir);
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if(find == INVALID_HANDLE_VALUE)
+        return true;
+    do{
+        bool isdir = !!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+        CHK_TRUE(dir_items_push(&items, &nitems, &capacity, data.cFileName, isdir), fail_list);
+    }while(FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *dp = opendir(dir);
+    if(!dp)
+        return true;
+    struct dirent *ent;
+    while((ent = readdir(dp))) {
+        char path[MAX_PATH_LEN];
+        struct stat st;
+        pf_snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        if(stat(path, &st))
+            continue;
+        CHK_TRUE(dir_items_push(&items, &nitems, &capacity, ent->d_name, S_ISDIR(st.st_mode)), fail_list);
+    }
+    closedir(dp);
+#endif
+
+    for(int i = 0; i < nitems; i++) {
+
+        const char *name = items[i].name;
+        if(name[0] == '.')
+            continue;
+
+        if(!items[i].isdir) {
+            CHK_TRUE(build_add_file(ctx, dir, rel, name), out);
+            continue;
+        }
+
+        bool skip = false;
+        for(int j = 0; j < ARR_SIZE(excluded); j++) {
+            if(rel[0] == '\0' && !strcmp(name, excluded[j]))
+                skip = true;
+        }
+        if(skip)
+            continue;
+
+        char subdir[MAX_PATH_LEN], subrel[MAX_PATH_LEN];
+        pf_snprintf(subdir, sizeof(subdir), "%s/%s", dir, name);
+        pf_snprintf(subrel, sizeof(subrel), "%s%s%s", rel, rel[0] ? "/" : "", name);
+        CHK_TRUE(build_walk(ctx, subdir, subrel), out);
+    }
+    ret = true;
+
+out:
+    free(items);
+    return ret;
+
+fail_list:
+#ifdef _WIN32
+    FindClose(find);
+#else
+    closedir(dp);
+#endif
+    free(items);
+    PyErr_NoMemory();
+    return false;
+}
+
+static bool build_write(struct build_ctx *ctx, const char *path)
+{
+    size_t keys_size = 0;
+    for(int i = 0; i < ctx->nentries; i++) {
+        keys_size += strlen(ctx->entries[i].key);
+    }
+
+    struct bundle_header header = {
+        .pymagic = (uint32_t)PyImport_GetMagicNumber(),
+        .nentries = ctx->nentries,
+        .index_off = sizeof(struct bundle_header) + keys_size,
+    };
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    size_t pad = (sizeof(uint32_t) - header.index_off % sizeof(uint32_t)) % sizeof(uint32_t);
+    header.index_off += pad;
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "wb");
+    if(!stream)
+        return false;
+
+    bool ret = false;
+    CHK_TRUE(SDL_RWwrite(stream, &header, sizeof(header), 1), out);
+    for(int i = 0; i < ctx->nentries; i++) {
+        const char *key = ctx->entries[i].key;
+        CHK_TRUE(SDL_RWwrite(stream, key, strlen(key), 1), out);
+    }
+    const char zeros[sizeof(uint32_t)] = {0};
+    CHK_TRUE(pad == 0 || SDL_RWwrite(stream, zeros, pad, 1), out);
+
+    uint32_t key_off = sizeof(struct bundle_header);
+    uint32_t code_off = header.index_off + ctx->nentries * sizeof(struct bundle_entry);
+    for(int i = 0; i < ctx->nentries; i++) {
+        struct bundle_entry entry = {
+            .key_off = key_off,
+            .key_len = strlen(ctx->entries[i].key),
+            .code_off = code_off,
+            .code_len = PyString_GET_SIZE(ctx->entries[i].blob),
+            .flags = ctx->entries[i].flags,
+            .src_mtime = ctx->entries[i].src_mtime,
+            .src_size = ctx->entries[i].src_size,
+        };
+        CHK_TRUE(SDL_RWwrite(stream, &entry, sizeof(entry), 1), out);
+        key_off += entry.key_len;
+        code_off += entry.code_len;
+    }
+
+    for(int i = 0; i < ctx->nentries; i++) {
+        PyObject *blob = ctx->entries[i].blob;
+        CHK_TRUE(SDL_RWwrite(stream, PyString_AS_STRING(blob), PyString_GET_SIZE(blob), 1), out);
+    }
+    ret = true;
+
+out:
+    SDL_RWclose(stream);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void S_Bundle_PyRegister(PyObject *module)
+{
+    if(PyType_Ready(&PyBundleImporter_type) < 0)
+        return;
+    Py_INCREF(&PyBundleImporter_type);
+    PyModule_AddObject(module, "BundleImporter", (PyObject*)&PyBundleImporter_type);
+}
+
+bool S_Bundle_Init(const char *scripts_dir)
+{
+    if(!abspath(scripts_dir, s_root)) {
+        s_root[0] = '\0';
+        return true;
+    }
+
+    char path[MAX_PATH_LEN];
+    pf_snprintf(path, sizeof(path), "%s/%s", s_root, BUNDLE_NAME);
+    if(!bundle_map(path))
+        return true;
+
+    /* Ahead of the default file system lookup, so that the directories 
+     * in the archive don't get searched at all */
+    PyObject *hooks = PySys_GetObject("path_hooks"); /* borrowed */
+    PyObject *cache = PySys_GetObject("path_importer_cache"); /* borrowed */
+    if(!hooks || 0 != PyList_Insert(hooks, 0, (PyObject*)&PyBundleImporter_type)) {
+        bundle_unmap();
+        return false;
+    }
+    if(cache) {
+        PyDict_Clear(cache);
+    }
+    return true;
+}
+
+void S_Bundle_Shutdown(void)
+{
+    bundle_unmap();
+}
+
+PyObject *S_Bundle_Build(void)
+{
+    if(s_root[0] == '\0') {
+        PyErr_SetString(PyExc_RuntimeError, "Could not resolve the scripts directory.");
+        return NULL;
+    }
+
+    struct build_ctx ctx = {0};
+    if(!build_walk(&ctx, s_root, "")) {
+        build_clear(&ctx);
+        return NULL;
+    }
+    qsort(ctx.entries, ctx.nentries, sizeof(struct build_entry), build_compare);
+
+    size_t nunique = 0;
+    for(int i = 0; i < ctx.nentries; i++) {
+        if(nunique > 0 && !strcmp(ctx.entries[nunique - 1].key, ctx.entries[i].key)) {
+            Py_DECREF(ctx.entries[i].blob);
+            continue;
+        }
+        ctx.entries[nunique++] = ctx.entries[i];
+    }
+    ctx.nentries = nunique;
+
+    /* The old archive can't be overwritten while it's mapped. From here on, 
+     * the remaining imports are from the loose files. */
+    bundle_unmap();
+
+    char path[MAX_PATH_LEN];
+    pf_snprintf(path, sizeof(path), "%s/%s", s_root, BUNDLE_NAME);
+
+    bool status = build_write(&ctx, path);
+    build_clear(&ctx);
+    if(!status) {
+        PyErr_Format(PyExc_IOError, "Could not write %s", path);
+        return NULL;
+    }
+    return PyInt_FromLong(nunique);
+}
+
@@ -793,6 +793,7 @@ static void s_expose_event_constants(PyObject *module)
     PY_EXPOSE_ENUM(module, EVENT_RALLY_POINT_SET);
     PY_EXPOSE_ENUM(module, EVENT_UNIT_BECAME_IDLE);
     PY_EXPOSE_ENUM(module, EVENT_UNIT_BECAME_ACTIVE);
+    PY_EXPOSE_ENUM(module, EVENT_20HZ_SUBTICK);
     PY_EXPOSE_ENUM(module, EVENT_ENGINE_LAST);
 }
 
@@ -861,6 +862,15 @@ static void s_expose_game_constants(PyObject *module)
     PY_EXPOSE_ENUM(module, FORMATION_COLUMN);
     PY_EXPOSE_ENUM(module, FORMATION_MAX);
 
+    PY_EXPOSE_ENUM(module, INFLUENCE_STRENGTH);
+    PY_EXPOSE_ENUM(module, INFLUENCE_VISION);
+    PY_EXPOSE_ENUM(module, INFLUENCE_RESOURCES);
+
+    PY_EXPOSE_ENUM(module, ORDER_MOVE);
+    PY_EXPOSE_ENUM(module, ORDER_ATTACK);
+    PY_EXPOSE_ENUM(module, ORDER_STOP);
+    PY_EXPOSE_ENUM(module, ORDER_HOLD_POSITION);
+
     PY_EXPOSE_ENUM(module, AIR_UNIT_HEIGHT);
 }
 
@@ -37,6 +37,7 @@
 #include "py_entity.h" 
 #include "py_pickle.h"
 #include "../main.h"
+#include "../replay.h"
 #include "../entity.h"
 #include "../event.h"
 #include "../asset_load.h"
@@ -1300,6 +1301,7 @@ static PyObject *PyEntity_new(PyTypeObject *type, PyObject *args, PyObject *kwds
 
     PyObject *uidobj = NULL;
     uint32_t uid;
+    bool new_uid = false;
 
     if(kwds) {
         uidobj = PyDict_GetItemString(kwds, "__uid__");
@@ -1308,11 +1310,20 @@ static PyObject *PyEntity_new(PyTypeObject *type, PyObject *args, PyObject *kwds
         uid = PyInt_AS_LONG(uidobj);
     }else {
         uid = Entity_NewUID();
+        new_uid = true;
+    }
+
+    if(uid == NULL_UID) {
+        PyErr_SetString(PyExc_RuntimeError, "Ran out of entity UIDs.");
+        return NULL;
     }
 
     uint32_t flags;
     bool success = AL_EntityFromPFObj(dirpath, filename, name, uid, &flags);
     if(!success) {
+        if(new_uid) {
+            Entity_FreeUID(uid);
+        }
         PyErr_SetString(PyExc_RuntimeError, "Unable to load specified pf.Entity PFOBJ model.");
         return NULL;
     }
@@ -1763,6 +1774,7 @@ static PyObject *PyEntity_deselect(PyEntityObject *self)
 static PyObject *PyEntity_stop(PyEntityObject *self)
 {
     assert(self->ent != NULL_UID);
+    Replay_RecordScript("stop", self->ent, NULL_UID, (vec3_t){0.0f, 0.0f, 0.0f});
     G_StopEntity(self->ent, true, true);
     Py_RETURN_NONE;
 }
@@ -2178,6 +2190,7 @@ static PyObject *PyCombatableEntity_hold_position(PyCombatableEntityObject *self
         return NULL;
     }
 
+    Replay_RecordScript("hold_position", self->super.ent, NULL_UID, (vec3_t){0.0f, 0.0f, 0.0f});
     G_StopEntity(self->super.ent, true, true);
 
     assert(G_FlagsGet(self->super.ent) & ENTITY_FLAG_COMBATABLE);
@@ -2204,6 +2217,8 @@ static PyObject *PyCombatableEntity_attack(PyCombatableEntityObject *self, PyObj
     }
 
     assert(G_FlagsGet(self->super.ent) & ENTITY_FLAG_COMBATABLE);
+    Replay_RecordScript("attack", self->super.ent, NULL_UID, 
+        (vec3_t){xz_pos.x, 0.0f, xz_pos.z});
     G_Combat_SetStance(self->super.ent, COMBAT_STANCE_AGGRESSIVE);
 
     if(G_FlagsGet(self->super.ent) & ENTITY_FLAG_MOVABLE) {
@@ -3078,7 +3093,9 @@ static PyObject *PyBuilderEntity_build(PyBuilderEntityObject *self, PyObject *ar
         return NULL;
     }
 
-    G_Builder_Build(self->super.ent, ((PyBuildableEntityObject*)building)->super.ent);
+    uint32_t target = ((PyBuildableEntityObject*)building)->super.ent;
+    Replay_RecordScript("build", self->super.ent, target, (vec3_t){0.0f, 0.0f, 0.0f});
+    G_Builder_Build(self->super.ent, target);
     Py_RETURN_NONE;
 }
 
@@ -3477,6 +3494,7 @@ static PyObject *PyHarvesterEntity_gather(PyHarvesterEntityObject *self, PyObjec
         return NULL;
     }
 
+    Replay_RecordScript("gather", self->super.ent, resource->super.ent, (vec3_t){0.0f, 0.0f, 0.0f});
     G_StopEntity(self->super.ent, true, true);
     if(!G_Harvester_Gather(self->super.ent, resource->super.ent)) {
         PyErr_SetString(PyExc_RuntimeError, "Unable to gather the specified resource.");
@@ -3499,6 +3517,7 @@ static PyObject *PyHarvesterEntity_drop_off(PyHarvesterEntityObject *self, PyObj
         return NULL;
     }
 
+    Replay_RecordScript("drop_off", self->super.ent, storage->super.ent, (vec3_t){0.0f, 0.0f, 0.0f});
     G_StopEntity(self->super.ent, true, true);
     if(!G_Harvester_DropOff(self->super.ent, storage->super.ent)) {
         PyErr_SetString(PyExc_RuntimeError, "Unable to drop off resource at the specified storage site.");
@@ -3521,6 +3540,7 @@ static PyObject *PyHarvesterEntity_transport(PyHarvesterEntityObject *self, PyOb
         return NULL;
     }
 
+    Replay_RecordScript("transport", self->super.ent, storage->super.ent, (vec3_t){0.0f, 0.0f, 0.0f});
     G_StopEntity(self->super.ent, true, true);
     if(!G_Harvester_Transport(self->super.ent, storage->super.ent)) {
         PyErr_SetString(PyExc_RuntimeError, "Unable to transport resources to the specified storage site.");
@@ -4110,6 +4130,7 @@ static PyObject *PyMovableEntity_move(PyMovableEntityObject *self, PyObject *arg
         return NULL;
     }
 
+    Replay_RecordScript("move", self->super.ent, NULL_UID, (vec3_t){xz_pos.x, 0.0f, xz_pos.z});
     G_Move_SetDest(self->super.ent, xz_pos, false);
     Py_RETURN_NONE;
 }
@@ -4176,6 +4197,7 @@ static PyObject *PyGarrisonEntity_garrison(PyGarrisonEntityObject *self, PyObjec
         return NULL;
     }
 
+    Replay_RecordScript("garrison", self->super.ent, garrisonable->super.ent, (vec3_t){0.0f, 0.0f, 0.0f});
     if(!G_Garrison_Enter(self->super.ent, garrisonable->super.ent)) {
         PyErr_SetString(PyExc_TypeError, "Unable to garrison inside specified "
             "pf.GarrisonableEntity instance.");
@@ -40,6 +40,7 @@
 #include "private_types.h"
 #include "../lib/public/pf_string.h"
 #include "../lib/public/mem.h"
+#include "../lib/public/SDL_vec_rwops.h"
 #include "../asset_load.h"
 #include "../sched.h"
 
@@ -217,15 +218,39 @@ typedef void *mod_ty; //symtable.h wants this
 #define PF_OP_METHODCALL '-' /* Push an operator.methodcaller instance from top 3 TOS items */
 #define PF_CUSTOM       '+' /* Push an instance returned by an __unpickle__ static method of a type */
 #define PF_ALLOC        ':' /* Allocate an object (call tp_alloc) using the type on TOS */
+#define PF_CODEBLOB     ';' /* Push code object unpickled from the length-prefixed, self-contained pickle that follows */
 
 #define EXC_START_MAGIC ((void*)0x1234)
 #define EXC_END_MAGIC   ((void*)0x4321)
 
-struct memo_entry{
-    int idx;
-    PyObject *obj;
+#define MEMO_INIT_CAP       (1024)
+#define MEMO_EMPTY          ((uintptr_t)0)
+#define TYPE_CACHE_SIZE     (256)
+#define CODE_CACHE_MIN_SWEEP (256)
+
+/* Open-addressing table (linear probing) mapping an object's address to 
+ * its' index in the memo. Object addresses are never NULL, so a zero key 
+ * marks an empty slot. Nothing is ever deleted from the memo. */
+struct memo_table{
+    uintptr_t *keys;
+    int       *idxs;
+    size_t     capacity; /* power of 2 */
+    size_t     size;
+};
+
+/* Code objects are immutable, so the serialized form of one never changes
+ * for as long as the object is alive. Each one is pickled once into a 
+ * self-contained stream (with its' own memo) and the bytes are re-emitted 
+ * verbatim by every subsequent save. The entry holds a reference to the
+ * code object so that its' address can't be recycled while cached. */
+struct code_blob{
+    PyObject *code;
+    char     *data;
+    size_t    size;
 };
 
+KHASH_MAP_INIT_INT64(blob, struct code_blob)
+
 VEC_IMPL(extern, pobj, PyObject*)
 
 VEC_TYPE(int, int)
@@ -234,10 +259,8 @@ VEC_IMPL(static inline, int, int)
 VEC_TYPE(char, char)
 VEC_IMPL(static inline, char, char)
 
-KHASH_MAP_INIT_INT64(memo, struct memo_entry)
-
 struct pickle_ctx{
-    khash_t(memo) *memo;
+    struct memo_table memo;
     /* Any objects newly created during serialization must 
      * get pushed onto this buffer, to be decref'd during context
      * destruction. We wish to pickle them using the normal flow,
@@ -264,11 +287,20 @@ struct pickle_entry{
     pickle_func_t  picklefunc;
 };
 
+/* Direct-mapped cache of type to pickle function lookups */
+struct type_cache_entry{
+    PyTypeObject  *type;
+    pickle_func_t  picklefunc;
+};
+
 
+static bool pickle_ctx_init(struct pickle_ctx *ctx);
+static void pickle_ctx_destroy(struct pickle_ctx *ctx);
 static bool pickle_obj(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *stream);
 static bool pickle_attrs(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw);
 static void memoize(struct pickle_ctx *ctx, PyObject *obj);
 static bool memo_contains(const struct pickle_ctx *ctx, PyObject *obj);
+static int memo_lookup(const struct pickle_ctx *ctx, PyObject *obj);
 static int memo_idx(const struct pickle_ctx *ctx, PyObject *obj);
 static bool emit_get(const struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw);
 static bool emit_put(const struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw);
@@ -453,12 +485,16 @@ static int op_ext_oper_attrgetter(struct unpickle_ctx *, SDL_RWops *);
 static int op_ext_oper_methodcaller(struct unpickle_ctx *, SDL_RWops *);
 static int op_ext_custom    (struct unpickle_ctx *, SDL_RWops *);
 static int op_ext_alloc     (struct unpickle_ctx *, SDL_RWops *);
+static int op_ext_codeblob  (struct unpickle_ctx *, SDL_RWops *);
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static khash_t(str) *s_id_qualname_map;
+static struct type_cache_entry s_type_cache[TYPE_CACHE_SIZE];
+static khash_t(blob)         *s_code_cache;
+static size_t                 s_code_cache_swept_size;
 
 static struct pickle_entry s_type_dispatch_table[] = {
     /* The Python 2.7 public built-in types. Some of these types may be 
@@ -684,6 +720,8 @@ static struct pickle_entry s_pf_dispatch_table[] = {
     {.type = NULL, /* PyGarrisonEntity_type */            .picklefunc = custom_pickle   },
     {.type = NULL, /* PyGarrisonableEntity_type */        .picklefunc = custom_pickle   },
     {.type = NULL, /* PyRegion_type*/                     .picklefunc = custom_pickle   },
+    {.type = NULL, /* PyArray_type*/                      .picklefunc = custom_pickle   },
+    {.type = NULL, /* PyBundleImporter_type*/             .picklefunc = custom_pickle   },
 };
 
 static unpickle_func_t s_op_dispatch_table[256] = {
@@ -785,6 +823,7 @@ static unpickle_func_t s_ext_op_dispatch_table[256] = {
     [PF_OP_METHODCALL] = op_ext_oper_methodcaller,
     [PF_CUSTOM] = op_ext_custom,
     [PF_ALLOC] = op_ext_alloc,
+    [PF_CODEBLOB] = op_ext_codeblob,
 };
 
 /* Statically-linked builtin modules not imported on initialization which also contain C builtins */
@@ -855,24 +894,43 @@ struct sc_map_entry{
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
  
-static pickle_func_t picklefunc_for_type(PyObject *obj)
+static pickle_func_t picklefunc_for_type_slow(PyTypeObject *type)
 {
     for(int i = 0; i < ARR_SIZE(s_type_dispatch_table); i++) {
     
-        if(obj->ob_type == s_type_dispatch_table[i].type)
+        if(type == s_type_dispatch_table[i].type)
             return s_type_dispatch_table[i].picklefunc;
     }
 
     /* It's not one of the Python builtins - it may be an engine builtin */
     for(int i = 0; i < ARR_SIZE(s_pf_dispatch_table); i++) {
     
-        if(obj->ob_type == s_pf_dispatch_table[i].type)
+        if(type == s_pf_dispatch_table[i].type)
             return s_pf_dispatch_table[i].picklefunc;
     }
 
     return NULL;
 }
 
+static pickle_func_t picklefunc_for_type(PyObject *obj)
+{
+    /* The dispatch tables only hold types that live for as long as the 
+     * interpreter, so a hit can never go stale. A heap type that isn't in 
+     * the tables will never be in them, so it's safe to cache misses as well,
+     * even if the type gets freed and its' address is later re-used. */
+    PyTypeObject *type = obj->ob_type;
+    size_t slot = (((uintptr_t)type) >> 4) & (TYPE_CACHE_SIZE - 1);
+    struct type_cache_entry *entry = &s_type_cache[slot];
+
+    if(entry->type == type)
+        return entry->picklefunc;
+
+    pickle_func_t ret = picklefunc_for_type_slow(type);
+    entry->type = type;
+    entry->picklefunc = ret;
+    return ret;
+}
+
 static bool strarr_contains(const char **arr, size_t len, const char *item)
 {
     for(int i = 0; i < len; i++)
@@ -1354,6 +1412,8 @@ static void load_engine_builtin_types(void)
     s_pf_dispatch_table[idx++].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "GarrisonEntity");
     s_pf_dispatch_table[idx++].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "GarrisonableEntity");
     s_pf_dispatch_table[idx++].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "Region");
+    s_pf_dispatch_table[idx++].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "Array");
+    s_pf_dispatch_table[idx++].type = (PyTypeObject*)PyObject_GetAttrString(pfmod, "BundleImporter");
 
     for(int i = 0; i < ARR_SIZE(s_pf_dispatch_table); i++) {
         assert(s_pf_dispatch_table[i].type);
@@ -2964,9 +3024,8 @@ fail:
     return -1;
 }
 
-static int code_pickle(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
+static int code_fields_pickle(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
 {
-    TRACE_PICKLE(obj);
     assert(PyCode_Check(obj));
     PyCodeObject *co = (PyCodeObject*)obj;
 
@@ -3009,6 +3068,116 @@ fail:
     return -1;
 }
 
+static void code_cache_sweep(void)
+{
+    /* Drop the entries for code objects that nothing but the cache 
+     * references anymore. This is amortized by only sweeping once the 
+     * cache has doubled in size since the last sweep. */
+    size_t size = kh_size(s_code_cache);
+    if(size < CODE_CACHE_MIN_SWEEP || size < s_code_cache_swept_size * 2)
+        return;
+
+    for(khiter_t k = kh_begin(s_code_cache); k != kh_end(s_code_cache); k++) {
+        if(!kh_exist(s_code_cache, k))
+            continue;
+        struct code_blob *blob = &kh_val(s_code_cache, k);
+        if(Py_REFCNT(blob->code) > 1)
+            continue;
+        Py_DECREF(blob->code);
+        PF_FREE(blob->data);
+        kh_del(blob, s_code_cache, k);
+    }
+    s_code_cache_swept_size = kh_size(s_code_cache);
+}
+
+static bool code_cache_put(PyObject *code, char *data, size_t size)
+{
+    int status;
+    khiter_t k = kh_put(blob, s_code_cache, (uintptr_t)code, &status);
+    if(status == -1)
+        return false;
+
+    if(status == 0) {
+        /* Another task cached the same code object while we yielded */
+        PF_FREE(data);
+        return true;
+    }
+
+    Py_INCREF(code);
+    kh_val(s_code_cache, k) = (struct code_blob){code, data, size};
+    code_cache_sweep();
+    return true;
+}
+
+static const struct code_blob *code_cache_get(PyObject *code)
+{
+    khiter_t k = kh_get(blob, s_code_cache, (uintptr_t)code);
+    if(k != kh_end(s_code_cache))
+        return &kh_val(s_code_cache, k);
+
+    struct pickle_ctx blob_ctx;
+    if(!pickle_ctx_init(&blob_ctx))
+        return NULL;
+
+    SDL_RWops *stream = PFSDL_VectorRWOps();
+    if(!stream) {
+        SET_EXC(PyExc_MemoryError, "Code blob stream allocation");
+        goto fail_stream;
+    }
+
+    const char term[] = {STOP};
+    CHK_TRUE(0 == code_fields_pickle(&blob_ctx, code, stream), fail_pickle);
+    CHK_TRUE(stream->write(stream, term, ARR_SIZE(term), 1), fail_pickle);
+
+    size_t size = SDL_RWsize(stream);
+    char *data = malloc(size);
+    if(!data) {
+        SET_EXC(PyExc_MemoryError, "Code blob allocation");
+        goto fail_pickle;
+    }
+    memcpy(data, PFSDL_VectorRWOpsRaw(stream), size);
+
+    if(!code_cache_put(code, data, size)) {
+        SET_EXC(PyExc_MemoryError, "Code cache insertion");
+        PF_FREE(data);
+        goto fail_pickle;
+    }
+
+    SDL_RWclose(stream);
+    pickle_ctx_destroy(&blob_ctx);
+
+    k = kh_get(blob, s_code_cache, (uintptr_t)code);
+    assert(k != kh_end(s_code_cache));
+    return &kh_val(s_code_cache, k);
+
+fail_pickle:
+    DEFAULT_ERR(PyExc_IOError, "Error writing to pickle stream");
+    SDL_RWclose(stream);
+fail_stream:
+    pickle_ctx_destroy(&blob_ctx);
+    return NULL;
+}
+
+static int code_pickle(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
+{
+    TRACE_PICKLE(obj);
+    assert(PyCode_Check(obj));
+
+    const struct code_blob *blob = code_cache_get(obj);
+    if(!blob)
+        return -1;
+
+    const char ops[] = {PF_EXTEND, PF_CODEBLOB};
+    CHK_TRUE(rw->write(rw, ops, ARR_SIZE(ops), 1), fail);
+    CHK_TRUE(SDL_WriteLE32(rw, (Uint32)blob->size), fail);
+    CHK_TRUE(rw->write(rw, blob->data, blob->size, 1), fail);
+    return 0;
+
+fail:
+    DEFAULT_ERR(PyExc_IOError, "Error writing to pickle stream");
+    return -1;
+}
+
 static int traceback_pickle(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
 {
     TRACE_PICKLE(obj);
@@ -7323,6 +7492,49 @@ fail_underflow:
     return ret;
 }
 
+static int op_ext_codeblob(struct unpickle_ctx *ctx, SDL_RWops *rw)
+{
+    TRACE_OP(PF_CODEBLOB, ctx);
+    int ret = -1;
+
+    Uint32 size;
+    CHK_TRUE(rw->read(rw, &size, sizeof(size), 1), fail_read);
+    size = SDL_SwapLE32(size);
+
+    char *data = malloc(size);
+    if(!data) {
+        SET_EXC(PyExc_MemoryError, "Code blob allocation");
+        goto fail_read;
+    }
+    CHK_TRUE(size == 0 || rw->read(rw, data, size, 1), fail_data);
+
+    SDL_RWops *blob = SDL_RWFromConstMem(data, size);
+    CHK_TRUE(blob, fail_data);
+    PyObject *code = S_UnpickleObjgraph(blob);
+    SDL_RWclose(blob);
+    CHK_TRUE(code, fail_data);
+
+    if(!PyCode_Check(code)) {
+        SET_RUNTIME_EXC("PF_CODEBLOB: Blob did not produce a code object");
+        Py_DECREF(code);
+        goto fail_data;
+    }
+
+    /* Seed the cache with the bytes we just loaded so that the next 
+     * save does not need to pickle this code object again. */
+    if(!code_cache_put(code, data, size))
+        PF_FREE(data);
+
+    vec_pobj_push(&ctx->stack, code);
+    return 0;
+
+fail_data:
+    PF_FREE(data);
+fail_read:
+    DEFAULT_ERR(PyExc_IOError, "Error reading from pickle stream");
+    return ret;
+}
+
 static int op_ext_nullimporter(struct unpickle_ctx *ctx, SDL_RWops *rw)
 {
     TRACE_OP(PF_NULLIMPORTER, ctx);
@@ -7336,9 +7548,62 @@ static int op_ext_nullimporter(struct unpickle_ctx *ctx, SDL_RWops *rw)
     return 0;
 }
 
+static size_t memo_slot(const struct memo_table *table, uintptr_t key)
+{
+    /* Objects are at least 8-byte aligned - mix in the high bits */
+    uint64_t hash = ((uint64_t)key >> 3) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(hash >> 32) & (table->capacity - 1);
+}
+
+static bool memo_table_init(struct memo_table *table, size_t capacity)
+{
+    table->keys = calloc(capacity, sizeof(uintptr_t));
+    table->idxs = malloc(capacity * sizeof(int));
+    if(!table->keys || !table->idxs) {
+        free(table->keys);
+        free(table->idxs);
+        return false;
+    }
+    table->capacity = capacity;
+    table->size = 0;
+    return true;
+}
+
+static void memo_table_destroy(struct memo_table *table)
+{
+    free(table->keys);
+    free(table->idxs);
+    memset(table, 0, sizeof(*table));
+}
+
+static bool memo_table_grow(struct memo_table *table)
+{
+    struct memo_table grown;
+    if(!memo_table_init(&grown, table->capacity * 2))
+        return false;
+
+    for(size_t i = 0; i < table->capacity; i++) {
+
+        uintptr_t key = table->keys[i];
+        if(key == MEMO_EMPTY)
+            continue;
+
+        size_t slot = memo_slot(&grown, key);
+        while(grown.keys[slot] != MEMO_EMPTY)
+            slot = (slot + 1) & (grown.capacity - 1);
+        grown.keys[slot] = key;
+        grown.idxs[slot] = table->idxs[i];
+    }
+    grown.size = table->size;
+
+    memo_table_destroy(table);
+    *table = grown;
+    return true;
+}
+
 static bool pickle_ctx_init(struct pickle_ctx *ctx)
 {
-    if(NULL == (ctx->memo = kh_init(memo))) {
+    if(!memo_table_init(&ctx->memo, MEMO_INIT_CAP)) {
         SET_EXC(PyExc_MemoryError, "Memo table allocation");
         goto fail_memo;
     }
@@ -7358,7 +7623,7 @@ static void pickle_ctx_destroy(struct pickle_ctx *ctx)
     }
 
     vec_pobj_destroy(&ctx->to_free);
-    kh_destroy(memo, ctx->memo);
+    memo_table_destroy(&ctx->memo);
 }
 
 static bool unpickle_ctx_init(struct unpickle_ctx *ctx)
@@ -7393,41 +7658,67 @@ static void unpickle_ctx_destroy(struct unpickle_ctx *ctx)
     vec_pobj_destroy(&ctx->stack);
 }
 
+/* Returns the memo index of the object or -1 if it's not memoized */
+static int memo_lookup(const struct pickle_ctx *ctx, PyObject *obj)
+{
+    const struct memo_table *table = &ctx->memo;
+    uintptr_t key = (uintptr_t)obj;
+    size_t slot = memo_slot(table, key);
+
+    while(table->keys[slot] != MEMO_EMPTY) {
+        if(table->keys[slot] == key)
+            return table->idxs[slot];
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return -1;
+}
+
 static bool memo_contains(const struct pickle_ctx *ctx, PyObject *obj)
 {
-    uintptr_t id = (uintptr_t)obj;
-    khiter_t k = kh_get(memo, ctx->memo, id);
-    if(k != kh_end(ctx->memo))
-        return true;
-    return false;
+    return (memo_lookup(ctx, obj) != -1);
 }
 
 static int memo_idx(const struct pickle_ctx *ctx, PyObject *obj)
 {
-    uintptr_t id = (uintptr_t)obj;
-    khiter_t k = kh_get(memo, ctx->memo, id);
-    assert(kh_exist(ctx->memo, k));
-    return kh_value(ctx->memo, k).idx;
+    int ret = memo_lookup(ctx, obj);
+    assert(ret != -1);
+    return ret;
 }
 
 static void memoize(struct pickle_ctx *ctx, PyObject *obj)
 {
-    int ret;
-    int idx = kh_size(ctx->memo);
+    struct memo_table *table = &ctx->memo;
+    assert(!memo_contains(ctx, obj));
 
-    khiter_t k = kh_put(memo, ctx->memo, (uintptr_t)obj, &ret);
-    assert(ret != -1 && ret != 0);
-    kh_value(ctx->memo, k) = (struct memo_entry){idx, obj};
+    /* Keep the load factor at or below 1/2 */
+    if((table->size + 1) * 2 > table->capacity) {
+        bool ret = memo_table_grow(table);
+        assert(ret);
+        (void)ret;
+    }
+
+    uintptr_t key = (uintptr_t)obj;
+    size_t slot = memo_slot(table, key);
+    while(table->keys[slot] != MEMO_EMPTY)
+        slot = (slot + 1) & (table->capacity - 1);
+
+    table->keys[slot] = key;
+    table->idxs[slot] = table->size++;
 }
 
-static bool emit_get(const struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
+static bool emit_get_idx(int idx, SDL_RWops *rw)
 {
     char str[32];
-    pf_snprintf(str, ARR_SIZE(str), "%c%d\n", GET, memo_idx(ctx, obj));
+    pf_snprintf(str, ARR_SIZE(str), "%c%d\n", GET, idx);
     str[ARR_SIZE(str)-1] = '\0';
     return rw->write(rw, str, 1, strlen(str));
 }
 
+static bool emit_get(const struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
+{
+    return emit_get_idx(memo_idx(ctx, obj), rw);
+}
+
 static bool emit_put(const struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *rw)
 {
     char str[32];
@@ -7505,8 +7796,9 @@ static bool pickle_obj(struct pickle_ctx *ctx, PyObject *obj, SDL_RWops *stream)
         goto fail;
     }
 
-    if(memo_contains(ctx, obj)) {
-        CHK_TRUE(emit_get(ctx, obj, stream), fail);
+    int idx = memo_lookup(ctx, obj);
+    if(idx != -1) {
+        CHK_TRUE(emit_get_idx(idx, stream), fail);
         goto out;
     }
 
@@ -7568,6 +7860,11 @@ bool S_Pickle_Init(PyObject *module)
     if(!s_id_qualname_map)
         goto fail_id_qualname;
 
+    s_code_cache = kh_init(blob);
+    if(!s_code_cache)
+        goto fail_code_cache;
+    s_code_cache_swept_size = 0;
+
     Py_INCREF(Py_False);
     PyModule_AddObject(module, "trace_pickling", Py_False);
 
@@ -7583,6 +7880,7 @@ bool S_Pickle_Init(PyObject *module)
     load_builtin_types();
     load_exception_types();
     load_engine_builtin_types();
+    memset(s_type_cache, 0, sizeof(s_type_cache));
     reference_all_types();
     reference_codecs_builtins();
 	load_subclassable_builtin_refs();
@@ -7596,6 +7894,8 @@ bool S_Pickle_Init(PyObject *module)
     return true;
 
 fail_traverse:
+    kh_destroy(blob, s_code_cache);
+fail_code_cache:
     kh_destroy(str, s_id_qualname_map);
 fail_id_qualname:
     return false;
@@ -7609,6 +7909,14 @@ void S_Pickle_Clear(void)
     }
     memset(s_subclassable_builtin_map, 0, sizeof(s_subclassable_builtin_map));
     Py_CLEAR(s_placeholder_type);
+
+    struct code_blob curr;
+    kh_foreach(s_code_cache, (uint64_t){0}, curr, {
+        Py_DECREF(curr.code);
+        PF_FREE(curr.data);
+    });
+    kh_clear(blob, s_code_cache);
+    s_code_cache_swept_size = 0;
 }
 
 void S_Pickle_Shutdown(void)
@@ -7618,6 +7926,7 @@ void S_Pickle_Shutdown(void)
         PF_FREE(curr);
     });
     kh_destroy(str, s_id_qualname_map);
+    kh_destroy(blob, s_code_cache);
 }
 
 PyObject *S_Pickle_PlainHeapSubtype(PyTypeObject *type)
@@ -7678,7 +7987,7 @@ PyObject *S_UnpickleObjgraph(SDL_RWops *stream)
         CHK_TRUE(upf(&ctx, stream) == 0, err);
 
         opcount++;
-        if(opcount % 10)
+        if(opcount % 64 == 0)
             Sched_TryYield();
     }
 
@@ -44,9 +44,12 @@
 #include "py_camera.h"
 #include "py_task.h"
 #include "py_region.h"
+#include "py_array.h"
 #include "py_error.h"
+#include "py_bundle.h"
 #include "public/script.h"
 #include "../entity.h"
+#include "../asset_load.h"
 #include "../game/public/game.h"
 #include "../render/public/render.h"
 #include "../render/public/render_ctrl.h"
@@ -66,6 +69,7 @@
 #include "../main.h"
 #include "../ui.h"
 #include "../session.h"
+#include "../replay.h"
 #include "../perf.h"
 #include "../cursor.h"
 #include "../task.h"
@@ -76,6 +80,38 @@
 
 
 #define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
+#define OVERRUN_REPORT_MS (1000)
+#define ARGS_CACHE_SLOTS  (4)
+#define QUERY_CACHE_SIZE  (64)
+
+enum query_shape{
+    QUERY_CIRCLE,
+    QUERY_RECT,
+};
+
+struct query_filter{
+    int         faction_id; /* negative for any */
+    uint32_t    flags;      /* all must be set */
+    const char *tag;
+    PyObject   *predicate;
+};
+
+struct query_key{
+    enum query_shape shape;
+    vec2_t           a, b;
+    int              faction_id;
+    uint32_t         flags;
+    char             tag[64];
+};
+
+struct query_result{
+    bool             valid;
+    struct query_key key;
+    uint32_t        *uids;
+    size_t           nuids;
+};
 
 struct script_arg{
     const char *path;
@@ -83,8 +119,10 @@ struct script_arg{
     const char **argv;
 };
 
+static PyObject *PyPf_bake_map_nav_data(PyObject *self, PyObject *args, PyObject *kwargs);
 static PyObject *PyPf_load_map(PyObject *self, PyObject *args, PyObject *kwargs);
 static PyObject *PyPf_load_map_string(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *PyPf_preload_models(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_ambient_light_color(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_emit_light_color(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_emit_light_pos(PyObject *self, PyObject *args);
@@ -93,6 +131,8 @@ static PyObject *PyPf_load_scene(PyObject *self, PyObject *args, PyObject *kwarg
 static PyObject *PyPf_register_event_handler(PyObject *self, PyObject *args);
 static PyObject *PyPf_register_ui_event_handler(PyObject *self, PyObject *args);
 static PyObject *PyPf_unregister_event_handler(PyObject *self, PyObject *args);
+static PyObject *PyPf_register_batch_event_handler(PyObject *self, PyObject *args);
+static PyObject *PyPf_unregister_batch_event_handler(PyObject *self, PyObject *args);
 static PyObject *PyPf_global_event(PyObject *self, PyObject *args);
 static PyObject *PyPf_get_ticks(PyObject *self);
 static PyObject *PyPf_ticks_delta(PyObject *self, PyObject *args);
@@ -103,11 +143,21 @@ static PyObject *PyPf_set_active_camera(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_prev_frame_ms(PyObject *self);
 static PyObject *PyPf_prev_frame_perfstats(PyObject *self);
+static PyObject *PyPf_dump_perf_trace(PyObject *self, PyObject *args);
+static PyObject *PyPf_begin_perf_capture(PyObject *self, PyObject *args);
+static PyObject *PyPf_end_perf_capture(PyObject *self);
 static PyObject *PyPf_get_resolution(PyObject *self);
 static PyObject *PyPf_get_native_resolution(PyObject *self);
 static PyObject *PyPf_get_basedir(PyObject *self);
 static PyObject *PyPf_get_render_info(PyObject *self);
 static PyObject *PyPf_get_nav_perfstats(PyObject *self);
+static PyObject *PyPf_get_sched_perfstats(PyObject *self);
+static PyObject *PyPf_get_render_stats(PyObject *self);
+static PyObject *PyPf_get_mem_stats(PyObject *self);
+static PyObject *PyPf_nav_benchmark(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *PyPf_get_frame_percentiles(PyObject *self);
+static PyObject *PyPf_reset_frame_percentiles(PyObject *self);
+static PyObject *PyPf_build_script_bundle(PyObject *self);
 static PyObject *PyPf_get_mouse_pos(PyObject *self);
 static PyObject *PyPf_mouse_over_ui(PyObject *self);
 static PyObject *PyPf_ui_text_edit_has_focus(PyObject *self);
@@ -133,6 +183,7 @@ static PyObject *PyPf_get_idle_units(PyObject *self);
 static PyObject *PyPf_set_unit_selection(PyObject *self, PyObject *args);
 static PyObject *PyPf_get_hovered_unit(PyObject *self);
 static PyObject *PyPf_entities_for_tag(PyObject *self, PyObject *args);
+static PyObject *PyPf_entities_for_tags(PyObject *self, PyObject *args, PyObject *kwargs);
 
 static PyObject *PyPf_hide_healthbars(PyObject *self);
 static PyObject *PyPf_show_healthbars(PyObject *self);
@@ -154,6 +205,7 @@ static PyObject *PyPf_get_diplomacy_state(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_get_tile(PyObject *self, PyObject *args);
 static PyObject *PyPf_update_tile(PyObject *self, PyObject *args);
+static PyObject *PyPf_update_tiles(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_map_highlight_size(PyObject *self, PyObject *args);
 static PyObject *PyPf_get_minimap_position(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_minimap_position(PyObject *self, PyObject *args);
@@ -190,6 +242,8 @@ static PyObject *PyPf_set_transport_on_left_click(PyObject *self);
 static PyObject *PyPf_set_evict_on_left_click(PyObject *self);
 static PyObject *PyPf_set_position_rally_point_on_left_click(PyObject *self);
 static PyObject *PyPf_set_click_move_enabled(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_movement_state_hash(PyObject *self);
+static PyObject *PyPf_get_combat_hits(PyObject *self);
 
 static PyObject *PyPf_settings_get(PyObject *self, PyObject *args);
 static PyObject *PyPf_settings_set(PyObject *self, PyObject *args, PyObject *kwargs);
@@ -221,10 +275,20 @@ static PyObject *PyPf_exec_push(PyObject *self, PyObject *args);
 static PyObject *PyPf_exec_pop(PyObject *self, PyObject *args);
 static PyObject *PyPf_exec_pop_to_root(PyObject *self, PyObject *args);
 static PyObject *PyPf_session_stack_depth(PyObject *self, PyObject *args);
+static PyObject *PyPf_session_profile(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_nearest_ent(PyObject *self, PyObject *args, PyObject *kwargs);
 static PyObject *PyPf_ents_in_circle(PyObject *self, PyObject *args, PyObject *kwargs);
 static PyObject *PyPf_ents_in_rect(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *PyPf_uids_in_circle(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *PyPf_uids_in_rect(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *PyPf_query_snapshot(PyObject *self, PyObject *args);
+static PyObject *PyPf_queue_orders(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *PyPf_get_positions(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_factions(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_flags(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_healths(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_influence_map(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_play_music(PyObject *self, PyObject *args);
 static PyObject *PyPf_curr_music(PyObject *self);
@@ -243,10 +307,20 @@ static PyObject *PyPf_formation_preferred_for_set(PyObject *self, PyObject *args
 
 static PyMethodDef pf_module_methods[] = {
 
+    {"bake_map_nav_data", 
+    (PyCFunction)PyPf_bake_map_nav_data, METH_VARARGS | METH_KEYWORDS,
+    "Appends the precomputed navigation data for the currently loaded map to the "
+    "specified PFMap file, so that it doesn't need to be rebuilt when the file is loaded."},
+
     {"load_map", 
     (PyCFunction)PyPf_load_map, METH_VARARGS | METH_KEYWORDS,
     "Loads the map from the specified file."},
 
+    {"preload_models", 
+    (PyCFunction)PyPf_preload_models, METH_VARARGS,
+    "Loads all the models in the list of (directory, PFOBJ filename) tuples at once, "
+    "so that they are ready for any entities created later."},
+
     {"load_map_string", 
     (PyCFunction)PyPf_load_map_string, METH_VARARGS | METH_KEYWORDS,
     "Loads the map from the specified PFMAP string."},
@@ -283,6 +357,18 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_unregister_event_handler, METH_VARARGS,
     "Removes a script event handler added by 'register_event_handler'."},
 
+    {"register_batch_event_handler", 
+    (PyCFunction)PyPf_register_batch_event_handler, METH_VARARGS,
+    "Adds a script event handler that is called once at the end of every tick in which the "
+    "specified event occurred. The handler is passed the user argument and a list of "
+    "(receiver, arg) tuples for all the occurrences of the event during the tick, where the "
+    "receiver is the entity the event was sent to or None for global events. This avoids the "
+    "per-call overhead of handling high-frequency events one at a time."},
+
+    {"unregister_batch_event_handler", 
+    (PyCFunction)PyPf_unregister_batch_event_handler, METH_VARARGS,
+    "Removes a script event handler added by 'register_batch_event_handler'."},
+
     {"global_event", 
     (PyCFunction)PyPf_global_event, METH_VARARGS,
     "Broadcast a global event so all handlers can get invoked. Any weakref argument is "
@@ -319,6 +405,20 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_prev_frame_perfstats, METH_NOARGS,
     "Get a dictionary of the performance data for the previous frame."},
 
+    {"dump_perf_trace", 
+    (PyCFunction)PyPf_dump_perf_trace, METH_VARARGS,
+    "Write the contents of the performance trace buffers to the specified file as CSV. "
+    "Tracing must be turned on with the 'pf.debug.perf_trace_enabled' setting."},
+
+    {"begin_perf_capture", 
+    (PyCFunction)PyPf_begin_perf_capture, METH_VARARGS,
+    "Start streaming the performance trace of all threads to the specified file in the "
+    "Chrome trace JSON format, for the specified number of seconds."},
+
+    {"end_perf_capture", 
+    (PyCFunction)PyPf_end_perf_capture, METH_NOARGS,
+    "Stop an active performance capture early and finish writing the file."},
+
     {"get_resolution", 
     (PyCFunction)PyPf_get_resolution, METH_NOARGS,
     "Get the currently set resolution of the game window."},
@@ -340,6 +440,45 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_get_nav_perfstats, METH_NOARGS,
     "Returns a dictionary holding various performance couners for the navigation subsystem."},
 
+    {"nav_benchmark", 
+    (PyCFunction)PyPf_nav_benchmark, METH_VARARGS | METH_KEYWORDS,
+    "Time building the navigation data of the current map, followed by a batch of path, "
+    "path attacking, LOS and surround queries against it. Returns a dictionary holding the "
+    "latency distributions of every kind of query, the field cache counters, the number of "
+    "nodes expanded by the searches and the memory used by the navigation subsystem."},
+
+    {"get_sched_perfstats", 
+    (PyCFunction)PyPf_get_sched_perfstats, METH_NOARGS,
+    "Returns a dictionary holding various performance counters for the task scheduler, "
+    "collected over the last tick."},
+
+    {"get_render_stats", 
+    (PyCFunction)PyPf_get_render_stats, METH_NOARGS,
+    "Returns a dictionary holding the counters (draw calls, instances, triangles, program and "
+    "texture binds, uploaded bytes) of the last frame completed by the render thread. The "
+    "'passes' key maps each pass name to a dictionary of its' counters and 'total' holds the "
+    "sums of all passes."},
+
+    {"get_mem_stats", 
+    (PyCFunction)PyPf_get_mem_stats, METH_NOARGS,
+    "Returns a dictionary mapping the name of every memory accounting tag to a dictionary of "
+    "its' counters: 'live_bytes', 'peak_bytes', 'nallocs', 'nfrees' and 'tick_allocs' (the "
+    "number of allocations made during the last tick)."},
+
+    {"get_frame_percentiles", 
+    (PyCFunction)PyPf_get_frame_percentiles, METH_NOARGS,
+    "Returns a dictionary holding the rolling percentiles (p50, p95, p99, max and mean, in "
+    "milliseconds) of the frame time, simulation time and render thread time."},
+
+    {"reset_frame_percentiles", 
+    (PyCFunction)PyPf_reset_frame_percentiles, METH_NOARGS,
+    "Discard all the samples collected for the frame time percentiles."},
+
+    {"build_script_bundle", 
+    (PyCFunction)PyPf_build_script_bundle, METH_NOARGS,
+    "Compile all the scripts under the scripts directory into the archive that is loaded "
+    "in their place on the next startup. Returns the number of modules written."},
+
     {"get_mouse_pos", 
     (PyCFunction)PyPf_get_mouse_pos, METH_NOARGS,
     "Get the (x, y) cursor position on the screen."},
@@ -379,7 +518,8 @@ static PyMethodDef pf_module_methods[] = {
 
     {"set_active_font", 
     (PyCFunction)PyPf_set_active_font, METH_VARARGS,
-    "Set the current active font to that of the specified name."},
+    "Set the current active font to that of the specified name. A font that has not been used "
+    "before is loaded on the next frame, with the previous font remaining in use until then."},
 
     {"show_regions", 
     (PyCFunction)PyPf_show_regions, METH_NOARGS,
@@ -433,6 +573,11 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_entities_for_tag, METH_VARARGS,
     "Get a tuple of entities that have the specific tag."},
 
+    {"entities_for_tags", 
+    (PyCFunction)PyPf_entities_for_tags, METH_VARARGS | METH_KEYWORDS,
+    "Get a tuple of entities that have all of the tags in the 'include' sequence and none of the "
+    "tags in the optional 'exclude' sequence."},
+
     {"hide_healthbars", 
     (PyCFunction)PyPf_hide_healthbars, METH_NOARGS,
     "Disable rendering of healthbars. Overrides the user-configurable dynamic setting."},
@@ -508,6 +653,11 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_update_tile, METH_VARARGS,
     "Update the map tile at the specified coordinates to the new value."},
 
+    {"update_tiles", 
+    (PyCFunction)PyPf_update_tiles, METH_VARARGS,
+    "Update a number of map tiles at once. Takes a list of (chunk coordinates, tile coordinates, "
+    "pf.Tile) tuples. Much faster than repeatedly calling 'update_tile' for bulk edits."},
+
     {"set_map_highlight_size", 
     (PyCFunction)PyPf_set_map_highlight_size, METH_VARARGS,
     "Determines how many tiles around the currently hovered tile are highlighted. (0 = none, "
@@ -626,6 +776,18 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_set_click_move_enabled, METH_VARARGS,
     "Enable or disable issuing move orders by right-clicking."},
 
+    {"get_movement_state_hash",
+    (PyCFunction)PyPf_get_movement_state_hash, METH_NOARGS,
+    "Get a hash of the movement state as of the most recent movement tick. Only computed when the "
+    "'pf.game.deterministic_movement' setting is enabled. Can be compared between peers to detect "
+    "simulations going out of sync."},
+
+    {"get_combat_hits",
+    (PyCFunction)PyPf_get_combat_hits, METH_NOARGS,
+    "Get a list of all the hits landed during the most recent combat tick, as (attacker, target, damage, "
+    "killed) tuples. The attacker or target is None when the entity no longer exists. Allows handling "
+    "all the hits of a tick with a single call."},
+
     {"draw_text",
     (PyCFunction)PyPf_draw_text, METH_VARARGS,
     "Draw a text label with the specified bounds (X, Y, W, H) )and with the specified color (R, G, B, A). "
@@ -771,6 +933,12 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_session_stack_depth, METH_VARARGS,
     "Returns the number of sessions currently on the sessin stack."},
 
+    {"session_profile",
+    (PyCFunction)PyPf_session_profile, METH_VARARGS,
+    "Returns the time taken and the number of bytes written or read by every section of the most "
+    "recent session save (if the argument is True) or load (if the argument is False), or None if "
+    "there hasn't been one."},
+
     {"nearest_ent",
     (PyCFunction)PyPf_nearest_ent, METH_VARARGS | METH_KEYWORDS,
     "Returns the nearest entity to the specified 'position' - (X, Z) point or None. Takes an optional 'predicate' callable "
@@ -778,14 +946,74 @@ static PyMethodDef pf_module_methods[] = {
 
     {"ents_in_circle",
     (PyCFunction)PyPf_ents_in_circle, METH_VARARGS | METH_KEYWORDS,
-    "Returns a list of entities in the specified circle (defined by (X, Z) 'position' and 'radius'). "
-    "Takes an optional 'predicate' callable argument to filter the results."},
+    "Returns a list of entities in the specified circle (defined by (X, Z) 'position' and "
+    "'radius'). Takes an optional 'predicate' callable argument to filter the results. The "
+    "results can also be filtered by 'faction_id', by 'flags' (all of which must be set) and by "
+    "'tag' without calling into Python for every entity. Results of queries without a 'predicate' "
+    "are cached until the end of the tick."},
 
     {"ents_in_rect",
     (PyCFunction)PyPf_ents_in_rect, METH_VARARGS | METH_KEYWORDS,
-    "Returns a list of entities in the specified rectangle (defined by two (X, Z) points - "
-    "the 'minimum' and 'maximum' corners. Takes an optional 'predicate' callable argument to "
-    "filter the results."},
+    "Returns a list of entities in the specified rectangle (defined by two (X, Z) points - the "
+    "'minimum' and 'maximum' corners. Takes an optional 'predicate' callable argument to filter "
+    "the results. The results can also be filtered by 'faction_id', by 'flags' (all of which must "
+    "be set) and by 'tag' without calling into Python for every entity. Results of queries "
+    "without a 'predicate' are cached until the end of the tick."},
+
+    {"uids_in_circle",
+    (PyCFunction)PyPf_uids_in_circle, METH_VARARGS | METH_KEYWORDS,
+    "Returns a pf.Array of the UIDs of all entities in the specified circle (defined by (X, Z) "
+    "'position' and 'radius'). Unlike 'ents_in_circle', no Python object is created per entity. "
+    "Takes the same optional 'faction_id', 'flags' and 'tag' filters as 'ents_in_circle'."},
+
+    {"uids_in_rect",
+    (PyCFunction)PyPf_uids_in_rect, METH_VARARGS | METH_KEYWORDS,
+    "Returns a pf.Array of the UIDs of all entities in the specified rectangle (defined by two "
+    "(X, Z) points - the 'minimum' and 'maximum' corners). Unlike 'ents_in_rect', no Python "
+    "object is created per entity. Takes the same optional 'faction_id', 'flags' and 'tag' "
+    "filters as 'ents_in_rect'."},
+
+    {"query_snapshot",
+    (PyCFunction)PyPf_query_snapshot, METH_VARARGS,
+    "Takes a sequence of queries and returns a list with a pf.Array of UIDs for each. A query "
+    "is a tuple of an (X, Z) 'position' and a 'radius', or of 'minimum' and 'maximum' (X, Z) "
+    "corners, optionally followed by a 'faction_id' (-1 for any) and 'flags' (all of which must "
+    "be set). The whole batch is answered in parallel from a snapshot of the world which is "
+    "taken once per tick, so it does not see changes made since the start of the tick."},
+
+    {"queue_orders",
+    (PyCFunction)PyPf_queue_orders, METH_VARARGS | METH_KEYWORDS,
+    "Queues an 'order' (one of the pf.ORDER_ constants) for every entity in the 'uids' sequence "
+    "(or buffer of UIDs). A 'target' (X, Z) point within the map bounds is required for "
+    "pf.ORDER_MOVE and pf.ORDER_ATTACK. The orders are carried out at the start of the next "
+    "update, after the entities that no longer exist or can't carry them out are skipped."},
+
+    {"get_positions",
+    (PyCFunction)PyPf_get_positions, METH_VARARGS,
+    "Takes a sequence of entity UIDs or pf.Entity instances (or a buffer of UIDs, such as a "
+    "pf.Array) and returns an (N x 3) pf.Array of the (X, Y, Z) float positions of the entities."},
+
+    {"get_factions",
+    (PyCFunction)PyPf_get_factions, METH_VARARGS,
+    "Takes a sequence of entity UIDs or pf.Entity instances (or a buffer of UIDs, such as a "
+    "pf.Array) and returns a pf.Array of the integer faction IDs of the entities."},
+
+    {"get_flags",
+    (PyCFunction)PyPf_get_flags, METH_VARARGS,
+    "Takes a sequence of entity UIDs or pf.Entity instances (or a buffer of UIDs, such as a "
+    "pf.Array) and returns a pf.Array of the integer flags of the entities."},
+
+    {"get_healths",
+    (PyCFunction)PyPf_get_healths, METH_VARARGS,
+    "Takes a sequence of entity UIDs or pf.Entity instances (or a buffer of UIDs, such as a "
+    "pf.Array) and returns a pf.Array of the current integer hitpoints of the entities. Entities "
+    "that are not combatable have 0 hitpoints."},
+
+    {"get_influence_map",
+    (PyCFunction)PyPf_get_influence_map, METH_VARARGS,
+    "Takes a faction ID and an influence layer (one of pf.INFLUENCE_STRENGTH, pf.INFLUENCE_VISION "
+    "and pf.INFLUENCE_RESOURCES) and returns a (rows x columns) pf.Array of floats holding the "
+    "faction's most recently published influence grid for the layer."},
 
     {"play_music",
     (PyCFunction)PyPf_play_music, METH_VARARGS,
@@ -839,6 +1067,20 @@ static PyMethodDef pf_module_methods[] = {
 
 static const char        *s_progname = NULL;
 static struct py_err_ctx  s_err_ctx = {false,};
+static uint32_t           s_last_overrun_report = 0;
+/* Recycled argument tuples for event handler calls, with 2 and 3 items.
+ * A tuple only held by the cache is free for use. Nested handler calls 
+ * each get a different slot. */
+static PyObject          *s_args_cache[2][ARGS_CACHE_SLOTS];
+/* Spatial query results, reused until the end of the tick. AI scripts tend 
+ * to make the same queries from many tasks and handlers. */
+static struct query_result s_query_cache[QUERY_CACHE_SIZE];
+static int                 s_query_cache_next = 0;
+/* The automatic collector is disabled. Collections are run by the engine at 
+ * the end of the tick and while loading, never from inside a handler. */
+static PyObject           *s_gc_module = NULL;
+static double              s_gc_mid_ms = 0.0;
+static int                 s_gc_mid_deferred = 0;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -852,9 +1094,193 @@ static void s_err_clear(void)
     s_err_ctx.occurred = false;
 }
 
+static void s_query_cache_invalidate(void)
+{
+    for(int i = 0; i < ARR_SIZE(s_query_cache); i++) {
+        s_query_cache[i].valid = false;
+    }
+}
+
+static void s_query_cache_free(void)
+{
+    for(int i = 0; i < ARR_SIZE(s_query_cache); i++) {
+        free(s_query_cache[i].uids);
+        s_query_cache[i] = (struct query_result){0};
+    }
+    s_query_cache_next = 0;
+}
+
 static void s_on_update(void *user, void *event)
 {
     S_Error_Update(&s_err_ctx);
+    s_query_cache_invalidate();
+}
+
+static PyObject *s_args_acquire(int nargs)
+{
+    assert(nargs == 2 || nargs == 3);
+    PyObject **slots = s_args_cache[nargs - 2];
+
+    for(int i = 0; i < ARGS_CACHE_SLOTS; i++) {
+        if(!slots[i]) {
+            slots[i] = PyTuple_New(nargs);
+            if(!slots[i])
+                return NULL;
+        }
+        if(Py_REFCNT(slots[i]) == 1) {
+            Py_INCREF(slots[i]);
+            return slots[i];
+        }
+    }
+    return PyTuple_New(nargs);
+}
+
+static void s_args_release(PyObject *args)
+{
+    PyObject **slots = s_args_cache[PyTuple_GET_SIZE(args) - 2];
+
+    for(int i = 0; i < ARGS_CACHE_SLOTS; i++) {
+
+        if(slots[i] != args)
+            continue;
+
+        /* The callee held on to the tuple (i.e. via *args) so it 
+         * can't be recycled anymore. */
+        if(Py_REFCNT(args) > 2) {
+            slots[i] = NULL;
+            Py_DECREF(args);
+            break;
+        }
+
+        /* Clear the items before releasing them - a destructor may 
+         * re-enter and look for a free tuple. */
+        for(int j = 0; j < PyTuple_GET_SIZE(args); j++) {
+            PyObject *item = PyTuple_GET_ITEM(args, j);
+            PyTuple_SET_ITEM(args, j, NULL);
+            Py_XDECREF(item);
+        }
+        break;
+    }
+    Py_DECREF(args);
+}
+
+static void s_args_clear(void)
+{
+    for(int i = 0; i < 2; i++) {
+        for(int j = 0; j < ARGS_CACHE_SLOTS; j++) {
+            Py_CLEAR(s_args_cache[i][j]);
+        }
+    }
+}
+
+static void s_report_overrun(PyObject *callable, double ms)
+{
+    /* Don't flood the console when a handler is slow on every tick */
+    uint32_t now = SDL_GetTicks();
+    if(s_last_overrun_report 
+    && !SDL_TICKS_PASSED(now, s_last_overrun_report + OVERRUN_REPORT_MS))
+        return;
+    s_last_overrun_report = now;
+
+    PyObject *func = callable;
+    if(PyMethod_Check(func))
+        func = PyMethod_GET_FUNCTION(func);
+
+    if(PyFunction_Check(func)) {
+        PyCodeObject *code = (PyCodeObject*)PyFunction_GET_CODE(func);
+        fprintf(stderr, "Script event handler '%s' (%s:%d) took %.2f ms [budget: %.2f ms]\n",
+            PyString_AS_STRING(code->co_name), PyString_AS_STRING(code->co_filename),
+            code->co_firstlineno, ms, CONFIG_SCRIPT_HANDLER_BUDGET_MS);
+    }else{
+        fprintf(stderr, "Script event handler of type '%s' took %.2f ms [budget: %.2f ms]\n",
+            Py_TYPE(callable)->tp_name, ms, CONFIG_SCRIPT_HANDLER_BUDGET_MS);
+    }
+    fflush(stderr);
+}
+
+static double s_gc_collect(int generation)
+{
+    assert(s_gc_module);
+
+    PERF_PUSH("script::gc");
+    uint64_t start = SDL_GetPerformanceCounter();
+    PyObject *ret = PyObject_CallMethod(s_gc_module, "collect", "i", generation);
+    uint64_t delta = SDL_GetPerformanceCounter() - start;
+    PERF_POP();
+
+    if(!ret) {
+        S_ShowLastError();
+    }
+    Py_XDECREF(ret);
+
+    Perf_RecordSample(PERF_METRIC_GC, delta);
+    return delta * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static bool s_gc_counts(long out[3])
+{
+    PyObject *counts = PyObject_CallMethod(s_gc_module, "get_count", NULL);
+    if(!counts || !PyArg_ParseTuple(counts, "lll", &out[0], &out[1], &out[2])) {
+        Py_XDECREF(counts);
+        PyErr_Clear();
+        return false;
+    }
+    Py_DECREF(counts);
+    return true;
+}
+
+static bool s_gc_init(void)
+{
+    s_gc_module = PyImport_ImportModule("gc");
+    if(!s_gc_module)
+        return false;
+
+    PyObject *ret = PyObject_CallMethod(s_gc_module, "disable", NULL);
+    if(!ret)
+        return false;
+    Py_DECREF(ret);
+
+    s_gc_mid_ms = 0.0;
+    s_gc_mid_deferred = 0;
+    return true;
+}
+
+static PyObject *PyPf_bake_map_nav_data(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"pfmap", "absolute", NULL};
+    const char *pfmap;
+    int absolute = false;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist, &pfmap, &absolute)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string (PFMAP filepath).");
+        return NULL;
+    }
+
+    char pfmap_path[512];
+    if(absolute) {
+        pf_strlcpy(pfmap_path, pfmap, sizeof(pfmap_path));
+    }else{
+        pf_snprintf(pfmap_path, sizeof(pfmap_path), "%s/%s", g_basepath, pfmap);
+    }
+
+    /* Not opened in append mode, as the section header is patched 
+     * after the data is written. */
+    SDL_RWops *stream = SDL_RWFromFile(pfmap_path, "r+b");
+    if(!stream) {
+        char errbuff[256];
+        pf_snprintf(errbuff, sizeof(errbuff), "Unable to open PFMap file %s", pfmap_path);
+        PyErr_SetString(PyExc_RuntimeError, errbuff);
+        return NULL;
+    }
+
+    if(SDL_RWseek(stream, 0, RW_SEEK_END) < 0 || !G_WriteMapNavData(stream)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to write the navigation data for the current map.");
+        SDL_RWclose(stream);
+        return NULL;
+    }
+
+    SDL_RWclose(stream);
+    Py_RETURN_NONE;
 }
 
 static PyObject *PyPf_load_map(PyObject *self, PyObject *args, PyObject *kwargs)
@@ -881,7 +1307,7 @@ static PyObject *PyPf_load_map(PyObject *self, PyObject *args, PyObject *kwargs)
     }
     pf_strlcat(pfmap_path, pfmap, sizeof(pfmap_path));
 
-    SDL_RWops *stream = SDL_RWFromFile(pfmap_path, "r");
+    SDL_RWops *stream = AL_StreamFromFile(pfmap_path);
     if(!stream) {
         char errbuff[256];
         pf_snprintf(errbuff, sizeof(errbuff), "Unable to open PFMap file %s", pfmap_path);
@@ -923,6 +1349,51 @@ static PyObject *PyPf_load_map_string(PyObject *self, PyObject *args, PyObject *
     Py_RETURN_NONE;
 }
 
+static PyObject *PyPf_preload_models(PyObject *self, PyObject *args)
+{
+    PyObject *list;
+    if(!PyArg_ParseTuple(args, "O", &list) || !PySequence_Check(list)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a list of (string, string) tuples.");
+        return NULL;
+    }
+
+    PyObject *seq = PySequence_Fast(list, "Argument must be a list of (string, string) tuples.");
+    if(!seq)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    const char **dirs = malloc(count * sizeof(char*));
+    const char **names = malloc(count * sizeof(char*));
+    if(count && (!dirs || !names)) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    for(int i = 0; i < count; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        if(!PyTuple_Check(item) || !PyArg_ParseTuple(item, "ss", &dirs[i], &names[i])) {
+            PyErr_SetString(PyExc_TypeError, "Argument must be a list of (string, string) tuples.");
+            goto fail;
+        }
+    }
+
+    if(!AL_PreloadPFObjs(count, dirs, names)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to load one or more of the specified models.");
+        goto fail;
+    }
+
+    free(dirs);
+    free(names);
+    Py_DECREF(seq);
+    Py_RETURN_NONE;
+
+fail:
+    free(dirs);
+    free(names);
+    Py_DECREF(seq);
+    return NULL;
+}
+
 static PyObject *PyPf_set_ambient_light_color(PyObject *self, PyObject *args)
 {
     vec3_t color;
@@ -1071,6 +1542,50 @@ static PyObject *PyPf_unregister_event_handler(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyPf_register_batch_event_handler(PyObject *self, PyObject *args)
+{
+    enum eventtype event;
+    PyObject *callable, *user_arg;
+
+    if(!PyArg_ParseTuple(args, "iOO", &event, &callable, &user_arg)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and two objects.");
+        return NULL;
+    }
+
+    if(!PyCallable_Check(callable)) {
+        PyErr_SetString(PyExc_TypeError, "Second argument must be callable.");
+        return NULL;
+    }
+
+    Py_INCREF(callable);
+    Py_INCREF(user_arg);
+
+    if(!E_ScriptRegisterBatch(event, callable, user_arg, G_RUNNING)) {
+        Py_DECREF(callable);
+        Py_DECREF(user_arg);
+        PyErr_SetString(PyExc_RuntimeError, "Could not register batch handler for event.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_unregister_batch_event_handler(PyObject *self, PyObject *args)
+{
+    enum eventtype event;
+    PyObject *callable;
+
+    if(!PyArg_ParseTuple(args, "iO", &event, &callable)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and one object.");
+        return NULL;
+    }
+
+    if(!E_ScriptUnregisterBatch(event, callable)) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not unregister the specified batch event handler.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyObject *PyPf_global_event(PyObject *self, PyObject *args)
 {
     enum eventtype event;
@@ -1136,6 +1651,45 @@ static PyObject *PyPf_prev_frame_ms(PyObject *self)
     return Py_BuildValue("i", Perf_LastFrameMS());
 }
 
+static PyObject *PyPf_dump_perf_trace(PyObject *self, PyObject *args)
+{
+    const char *path;
+
+    if(!PyArg_ParseTuple(args, "s", &path)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a string.");
+        return NULL;
+    }
+
+    if(!Perf_TraceDump(path)) {
+        Py_RETURN_FALSE;
+    }else{
+        Py_RETURN_TRUE;
+    }
+}
+
+static PyObject *PyPf_begin_perf_capture(PyObject *self, PyObject *args)
+{
+    const char *path;
+    float seconds;
+
+    if(!PyArg_ParseTuple(args, "sf", &path, &seconds)) {
+        PyErr_SetString(PyExc_TypeError, "Expecting two arguments: a path string and a duration (in seconds).");
+        return NULL;
+    }
+
+    if(!Perf_CaptureBegin(path, seconds)) {
+        Py_RETURN_FALSE;
+    }else{
+        Py_RETURN_TRUE;
+    }
+}
+
+static PyObject *PyPf_end_perf_capture(PyObject *self)
+{
+    Perf_CaptureEnd();
+    Py_RETURN_NONE;
+}
+
 static PyObject *PyPf_prev_frame_perfstats(PyObject *self)
 {
     struct perf_info *infos[16];
@@ -1241,9 +1795,9 @@ static PyObject *PyPf_get_resolution(PyObject *self)
 
 static PyObject *PyPf_get_native_resolution(PyObject *self)
 {
-    SDL_DisplayMode dm;
-    SDL_GetDesktopDisplayMode(0, &dm);
-    return Py_BuildValue("(i, i)", dm.w, dm.h);
+    int w, h;
+    Engine_DesktopRes(&w, &h);
+    return Py_BuildValue("(i, i)", w, h);
 }
 
 static PyObject *PyPf_get_basedir(PyObject *self)
@@ -1269,92 +1823,282 @@ static PyObject *PyPf_get_render_info(PyObject *self)
     return ret;
 }
 
-static PyObject *PyPf_get_nav_perfstats(PyObject *self)
+static PyObject *s_fc_stats_dict(const struct fc_stats *pstats)
 {
     PyObject *ret = PyDict_New();
     if(!ret) {
         return NULL;
     }
 
-    struct fc_stats stats;
-    N_FC_GetStats(&stats);
-
+    const struct fc_stats stats = *pstats;
     int rval = 0;
     rval |= PyDict_SetItemString(ret, "los_used",           Py_BuildValue("i", stats.los_used));
     rval |= PyDict_SetItemString(ret, "los_max",            Py_BuildValue("i", stats.los_max));
     rval |= PyDict_SetItemString(ret, "los_hit_rate",       Py_BuildValue("f", stats.los_hit_rate));
+    rval |= PyDict_SetItemString(ret, "los_evicted",        Py_BuildValue("i", stats.los_evicted));
     rval |= PyDict_SetItemString(ret, "los_invalidated",    Py_BuildValue("i", stats.los_invalidated));
     rval |= PyDict_SetItemString(ret, "flow_used",          Py_BuildValue("i", stats.flow_used));
     rval |= PyDict_SetItemString(ret, "flow_max",           Py_BuildValue("i", stats.flow_max));
     rval |= PyDict_SetItemString(ret, "flow_hit_rate",      Py_BuildValue("f", stats.flow_hit_rate));
+    rval |= PyDict_SetItemString(ret, "flow_evicted",       Py_BuildValue("i", stats.flow_evicted));
     rval |= PyDict_SetItemString(ret, "flow_invalidated",   Py_BuildValue("i", stats.flow_invalidated));
     rval |= PyDict_SetItemString(ret, "ffid_used",          Py_BuildValue("i", stats.ffid_used));
     rval |= PyDict_SetItemString(ret, "ffid_max",           Py_BuildValue("i", stats.ffid_max));
     rval |= PyDict_SetItemString(ret, "ffid_hit_rate",      Py_BuildValue("f", stats.ffid_hit_rate));
+    rval |= PyDict_SetItemString(ret, "ffid_evicted",       Py_BuildValue("i", stats.ffid_evicted));
     rval |= PyDict_SetItemString(ret, "grid_path_used",     Py_BuildValue("i", stats.grid_path_used));
     rval |= PyDict_SetItemString(ret, "grid_path_max",      Py_BuildValue("i", stats.grid_path_max));
+    rval |= PyDict_SetItemString(ret, "grid_path_bytes",    Py_BuildValue("K", (unsigned long long)stats.grid_path_bytes));
+    rval |= PyDict_SetItemString(ret, "grid_path_max_bytes",Py_BuildValue("K", (unsigned long long)stats.grid_path_max_bytes));
     rval |= PyDict_SetItemString(ret, "grid_path_hit_rate", Py_BuildValue("f", stats.grid_path_hit_rate));
+    rval |= PyDict_SetItemString(ret, "grid_path_evicted",  Py_BuildValue("i", stats.grid_path_evicted));
     assert(0 == rval);
 
     return ret;
 }
 
-static PyObject *PyPf_get_mouse_pos(PyObject *self)
+static PyObject *PyPf_get_nav_perfstats(PyObject *self)
 {
-    int mouse_x, mouse_y;
-    SDL_GetMouseState(&mouse_x, &mouse_y);
-    return Py_BuildValue("(i, i)", mouse_x, mouse_y);
+    struct fc_stats stats;
+    N_FC_GetStats(&stats);
+    return s_fc_stats_dict(&stats);
 }
 
-static PyObject *PyPf_mouse_over_ui(PyObject *self)
+static PyObject *PyPf_get_sched_perfstats(PyObject *self)
 {
-    int mouse_x, mouse_y;
-    SDL_GetMouseState(&mouse_x, &mouse_y);
+    struct sched_stats stats;
+    Sched_GetStats(&stats);
 
-    if(S_UI_MouseOverWindow(mouse_x, mouse_y))
-        Py_RETURN_TRUE;
-    else
-        Py_RETURN_NONE;
-}
+    struct sched_stack_stats stack_stats[SCHED_STACK_CLASS_COUNT];
+    Sched_GetStackStats(stack_stats);
 
-static PyObject *PyPf_ui_text_edit_has_focus(PyObject *self)
-{
-    if(S_UI_TextEditHasFocus())
-        Py_RETURN_TRUE;
-    else
-        Py_RETURN_FALSE;
-}
+    PyObject *busy = PyList_New(stats.nworkers);
+    if(!busy)
+        return NULL;
 
-static PyObject *PyPf_get_active_window(PyObject *self)
-{
-    PyObject *ret = S_UI_ActiveWindow();
-    if(ret) {
-        return ret;
-    }else{
-        Py_RETURN_NONE;
+    for(int i = 0; i < stats.nworkers; i++) {
+        PyList_SET_ITEM(busy, i, PyFloat_FromDouble(stats.worker_busy_ms[i]));
     }
-}
-
-static PyObject *PyPf_get_file_size(PyObject *self, PyObject *args)
-{
-    PyObject *file;
 
-    if(!PyArg_ParseTuple(args, "O", &file)
-	|| !PyFile_Check(file)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must a file object.");
+    PyObject *ret = PyDict_New();
+    if(!ret) {
+        Py_DECREF(busy);
         return NULL;
     }
 
-	SDL_RWops *rw = SDL_RWFromFP(((PyFileObject*)file)->f_fp, false);
-	PyObject *ret = PyLong_FromLongLong(SDL_RWsize(rw));
-	SDL_FreeRW(rw);
+    int rval = 0;
+    rval |= PyDict_SetItemString(ret, "nworkers",           Py_BuildValue("i", (int)stats.nworkers));
+    rval |= PyDict_SetItemString(ret, "ntasks_live",        Py_BuildValue("i", (int)stats.ntasks_live));
+    rval |= PyDict_SetItemString(ret, "ntasks_created",     Py_BuildValue("K", (unsigned long long)stats.ntasks_created));
+    rval |= PyDict_SetItemString(ret, "nswitches",          Py_BuildValue("K", (unsigned long long)stats.nswitches));
+    rval |= PyDict_SetItemString(ret, "nsteals",            Py_BuildValue("K", (unsigned long long)stats.nsteals));
+    rval |= PyDict_SetItemString(ret, "ndeadline_misses",   Py_BuildValue("K", (unsigned long long)stats.ndeadline_misses));
+    rval |= PyDict_SetItemString(ret, "max_queue_depth",    Py_BuildValue("i", (int)stats.max_queue_depth));
+    rval |= PyDict_SetItemString(ret, "tick_ms",            Py_BuildValue("f", stats.tick_ms));
+    rval |= PyDict_SetItemString(ret, "ready_wait_ms",      Py_BuildValue("f", stats.ready_wait_ms));
+    rval |= PyDict_SetItemString(ret, "ready_wait_max_ms",  Py_BuildValue("f", stats.ready_wait_max_ms));
+    rval |= PyDict_SetItemString(ret, "blocked_msg_ms",     Py_BuildValue("f", stats.blocked_msg_ms));
+    rval |= PyDict_SetItemString(ret, "blocked_event_ms",   Py_BuildValue("f", stats.blocked_event_ms));
+    rval |= PyDict_SetItemString(ret, "main_busy_ms",       Py_BuildValue("f", stats.main_busy_ms));
+    rval |= PyDict_SetItemString(ret, "worker_busy_ms",     busy);
+    rval |= PyDict_SetItemString(ret, "stacks_live",        Py_BuildValue("i", (int)stack_stats[SCHED_STACK_SMALL].nlive));
+    rval |= PyDict_SetItemString(ret, "stacks_live_hwm",    Py_BuildValue("i", (int)stack_stats[SCHED_STACK_SMALL].nlive_hwm));
+    rval |= PyDict_SetItemString(ret, "stacks_depth_hwm",   Py_BuildValue("i", (int)stack_stats[SCHED_STACK_SMALL].depth_hwm));
+    rval |= PyDict_SetItemString(ret, "big_stacks_live",    Py_BuildValue("i", (int)stack_stats[SCHED_STACK_BIG].nlive));
+    rval |= PyDict_SetItemString(ret, "big_stacks_live_hwm",Py_BuildValue("i", (int)stack_stats[SCHED_STACK_BIG].nlive_hwm));
+    rval |= PyDict_SetItemString(ret, "big_stacks_depth_hwm",Py_BuildValue("i", (int)stack_stats[SCHED_STACK_BIG].depth_hwm));
+    assert(0 == rval);
+    Py_DECREF(busy);
 
-	return ret;
+    return ret;
 }
 
-static PyObject *PyPf_shift_pressed(PyObject *self)
+static PyObject *PyPf_get_mem_stats(PyObject *self)
 {
-    const Uint8 *state = SDL_GetKeyboardState(NULL);
+    struct mem_tag_stats stats[MEM_TAG_COUNT];
+    size_t nstats = pf_mem_get_stats(stats);
+
+    PyObject *ret = PyDict_New();
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < nstats; i++) {
+        PyObject *tag = Py_BuildValue("{s:K, s:K, s:K, s:K, s:K}",
+            "live_bytes",   (unsigned long long)stats[i].live_bytes,
+            "peak_bytes",   (unsigned long long)stats[i].peak_bytes,
+            "nallocs",      (unsigned long long)stats[i].nallocs,
+            "nfrees",       (unsigned long long)stats[i].nfrees,
+            "tick_allocs",  (unsigned long long)stats[i].tick_allocs);
+        if(!tag || 0 != PyDict_SetItemString(ret, stats[i].name, tag)) {
+            Py_XDECREF(tag);
+            Py_DECREF(ret);
+            return NULL;
+        }
+        Py_DECREF(tag);
+    }
+    return ret;
+}
+
+static PyObject *render_pass_stats_dict(const struct render_pass_stats *stats)
+{
+    return Py_BuildValue("{s:I, s:I, s:K, s:K, s:I, s:I, s:K}",
+        "draws",        stats->ndraws,
+        "indirect",     stats->nindirect,
+        "instances",    (unsigned long long)stats->ninstances,
+        "tris",         (unsigned long long)stats->ntris,
+        "prog_binds",   stats->nprog_binds,
+        "tex_binds",    stats->ntex_binds,
+        "upload_bytes", (unsigned long long)stats->upload_bytes);
+}
+
+static PyObject *PyPf_get_render_stats(PyObject *self)
+{
+    struct render_stats stats;
+    R_GetStats(&stats);
+
+    PyObject *passes = PyDict_New();
+    if(!passes)
+        return NULL;
+
+    for(int i = 0; i < RENDER_STAT_PASS_COUNT; i++) {
+
+        PyObject *pass = render_pass_stats_dict(&stats.passes[i]);
+        if(!pass) {
+            Py_DECREF(passes);
+            return NULL;
+        }
+        int rval = PyDict_SetItemString(passes, R_StatPassName(i), pass);
+        Py_DECREF(pass);
+        if(rval) {
+            Py_DECREF(passes);
+            return NULL;
+        }
+    }
+
+    PyObject *total = render_pass_stats_dict(&stats.total);
+    if(!total) {
+        Py_DECREF(passes);
+        return NULL;
+    }
+
+    PyObject *ret = Py_BuildValue("{s:K, s:I, s:K, s:O, s:O}",
+        "frame",        (unsigned long long)stats.frame,
+        "commands",     stats.ncmds,
+        "arg_bytes",    (unsigned long long)stats.arg_bytes,
+        "total",        total,
+        "passes",       passes);
+    Py_DECREF(total);
+    Py_DECREF(passes);
+    return ret;
+}
+
+static PyObject *PyPf_get_frame_percentiles(PyObject *self)
+{
+    const char *names[PERF_METRIC_COUNT] = {
+        [PERF_METRIC_FRAME]  = "frame",
+        [PERF_METRIC_SIM]    = "sim",
+        [PERF_METRIC_RENDER] = "render",
+        [PERF_METRIC_SCRIPT] = "script",
+        [PERF_METRIC_GC]     = "gc",
+    };
+
+    PyObject *ret = PyDict_New();
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < PERF_METRIC_COUNT; i++) {
+
+        struct perf_percentiles pct;
+        Perf_GetPercentiles(i, &pct);
+
+        PyObject *metric = Py_BuildValue("{s:I, s:f, s:f, s:f, s:f, s:f}",
+            "nsamples", pct.nsamples,
+            "p50_ms",   pct.p50_ms,
+            "p95_ms",   pct.p95_ms,
+            "p99_ms",   pct.p99_ms,
+            "max_ms",   pct.max_ms,
+            "mean_ms",  pct.mean_ms);
+        if(!metric) {
+            Py_DECREF(ret);
+            return NULL;
+        }
+        int rval = PyDict_SetItemString(ret, names[i], metric);
+        Py_DECREF(metric);
+        if(0 != rval) {
+            Py_DECREF(ret);
+            return NULL;
+        }
+    }
+    return ret;
+}
+
+static PyObject *PyPf_reset_frame_percentiles(PyObject *self)
+{
+    Perf_ResetPercentiles();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_build_script_bundle(PyObject *self)
+{
+    return S_Bundle_Build();
+}
+
+static PyObject *PyPf_get_mouse_pos(PyObject *self)
+{
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+    return Py_BuildValue("(i, i)", mouse_x, mouse_y);
+}
+
+static PyObject *PyPf_mouse_over_ui(PyObject *self)
+{
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+
+    if(S_UI_MouseOverWindow(mouse_x, mouse_y))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_ui_text_edit_has_focus(PyObject *self)
+{
+    if(S_UI_TextEditHasFocus())
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_get_active_window(PyObject *self)
+{
+    PyObject *ret = S_UI_ActiveWindow();
+    if(ret) {
+        return ret;
+    }else{
+        Py_RETURN_NONE;
+    }
+}
+
+static PyObject *PyPf_get_file_size(PyObject *self, PyObject *args)
+{
+    PyObject *file;
+
+    if(!PyArg_ParseTuple(args, "O", &file)
+	|| !PyFile_Check(file)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a file object.");
+        return NULL;
+    }
+
+	SDL_RWops *rw = SDL_RWFromFP(((PyFileObject*)file)->f_fp, false);
+	PyObject *ret = PyLong_FromLongLong(SDL_RWsize(rw));
+	SDL_FreeRW(rw);
+
+	return ret;
+}
+
+static PyObject *PyPf_shift_pressed(PyObject *self)
+{
+    const Uint8 *state = SDL_GetKeyboardState(NULL);
     if(state[SDL_SCANCODE_LSHIFT] || state[SDL_SCANCODE_RSHIFT]) {
         Py_RETURN_TRUE;
     }else{
@@ -1520,6 +2264,7 @@ static PyObject *PyPf_set_unit_selection(PyObject *self, PyObject *args)
         uint32_t uid;
         S_Entity_UIDForObj(obj, &uid);
         ents[nents++] = uid;
+        Replay_RecordScript("select", uid, NULL_UID, (vec3_t){0.0f, 0.0f, 0.0f});
     }
 
     G_Sel_Set(ents, nents);
@@ -1565,6 +2310,78 @@ static PyObject *PyPf_entities_for_tag(PyObject *self, PyObject *args)
     return ret;
 }
 
+/* Returns a new reference to the sequence holding the tag strings, which 
+ * must be kept alive for as long as the strings are used. */
+static PyObject *s_tag_list(PyObject *obj, size_t maxout, const char *out[], size_t *nout)
+{
+    PyObject *seq = PySequence_Fast(obj, "Tags must be given as a sequence of strings.");
+    if(!seq)
+        return NULL;
+
+    size_t ntags = PySequence_Fast_GET_SIZE(seq);
+    if(ntags > maxout) {
+        PyErr_SetString(PyExc_ValueError, "Too many tags in the query.");
+        goto fail;
+    }
+
+    for(int i = 0; i < ntags; i++) {
+        PyObject *tag = PySequence_Fast_GET_ITEM(seq, i);
+        if(!PyString_Check(tag)) {
+            PyErr_SetString(PyExc_TypeError, "Tags must be given as a sequence of strings.");
+            goto fail;
+        }
+        out[i] = PyString_AS_STRING(tag);
+    }
+    *nout = ntags;
+    return seq;
+
+fail:
+    Py_DECREF(seq);
+    return NULL;
+}
+
+static PyObject *PyPf_entities_for_tags(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    assert(Sched_UsingBigStack());
+
+    static char *kwlist[] = {"include", "exclude", NULL};
+    PyObject *include, *exclude = NULL;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &include, &exclude)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a sequence of tags and an optional "
+            "sequence of tags to exclude.");
+        return NULL;
+    }
+
+    const char *incl[MAX_TAGS], *excl[MAX_TAGS];
+    size_t nincl = 0, nexcl = 0;
+    PyObject *incl_seq = NULL, *excl_seq = NULL;
+
+    if(!(incl_seq = s_tag_list(include, ARR_SIZE(incl), incl, &nincl)))
+        return NULL;
+    if(exclude && !(excl_seq = s_tag_list(exclude, ARR_SIZE(excl), excl, &nexcl))) {
+        Py_DECREF(incl_seq);
+        return NULL;
+    }
+
+    uint32_t uids[16384];
+    size_t nents = Entity_EntsForTags(nincl, incl, nexcl, excl, ARR_SIZE(uids), uids);
+    Py_DECREF(incl_seq);
+    Py_XDECREF(excl_seq);
+
+    PyObject *ret = PyTuple_New(nents);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < nents; i++) {
+        PyObject *ent = S_Entity_ObjForUID(uids[i]);
+        assert(ent);
+        Py_INCREF(ent);
+        PyTuple_SET_ITEM(ret, i, ent);
+    }
+    return ret;
+}
+
 static PyObject *PyPf_hide_healthbars(PyObject *self)
 {
     G_SetHideHealthbars(true);
@@ -1877,6 +2694,80 @@ static PyObject *PyPf_update_tile(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyPf_update_tiles(PyObject *self, PyObject *args)
+{
+    PyObject *list;
+    if(!PyArg_ParseTuple(args, "O", &list) || !PySequence_Check(list)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a list of ((int, int), (int, int), pf.Tile) tuples.");
+        return NULL;
+    }
+
+    PyObject *seq = PySequence_Fast(list, "Argument must be a list of ((int, int), (int, int), pf.Tile) tuples.");
+    if(!seq)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    struct tile_desc *descs = malloc(count * sizeof(struct tile_desc));
+    struct tile *tiles = malloc(count * sizeof(struct tile));
+    if(count && (!descs || !tiles)) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    for(int i = 0; i < count; i++) {
+
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        PyObject *tile_obj;
+        const struct tile *tile;
+
+        if(!PyTuple_Check(item) || !PyArg_ParseTuple(item, "(ii)(ii)O", 
+            &descs[i].chunk_r, &descs[i].chunk_c, &descs[i].tile_r, &descs[i].tile_c, &tile_obj)) {
+            PyErr_SetString(PyExc_TypeError, "Argument must be a list of ((int, int), (int, int), pf.Tile) tuples.");
+            goto fail;
+        }
+        if(NULL == (tile = S_Tile_GetTile(tile_obj))) {
+            PyErr_SetString(PyExc_TypeError, "Last element of every tuple must be of type pf.Tile.");
+            goto fail;
+        }
+        tiles[i] = *tile;
+    }
+
+    if(!G_UpdateTiles(count, descs, tiles)) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not update tiles.");
+        goto fail;
+    }
+
+    /* Only update each affected minimap chunk once */
+    for(int i = 0; i < count; i++) {
+
+        bool seen = false;
+        for(int j = 0; j < i; j++) {
+            if(descs[j].chunk_r == descs[i].chunk_r && descs[j].chunk_c == descs[i].chunk_c) {
+                seen = true;
+                break;
+            }
+        }
+        if(seen)
+            continue;
+
+        if(!G_UpdateMinimapChunk(descs[i].chunk_r, descs[i].chunk_c)) {
+            PyErr_SetString(PyExc_RuntimeError, "Could not update minimap chunk.");
+            goto fail;
+        }
+    }
+
+    free(descs);
+    free(tiles);
+    Py_DECREF(seq);
+    Py_RETURN_NONE;
+
+fail:
+    free(descs);
+    free(tiles);
+    Py_DECREF(seq);
+    return NULL;
+}
+
 static PyObject *PyPf_set_map_highlight_size(PyObject *self, PyObject *args)
 {
     int size;
@@ -2195,6 +3086,39 @@ static PyObject *PyPf_set_click_move_enabled(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyPf_get_movement_state_hash(PyObject *self)
+{
+    return PyLong_FromUnsignedLongLong(G_Move_StateHash());
+}
+
+static PyObject *PyPf_get_combat_hits(PyObject *self)
+{
+    const struct combat_hit *hits;
+    size_t nhits = G_Combat_GetHits(&hits);
+
+    PyObject *ret = PyList_New(nhits);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < nhits; i++) {
+
+        PyObject *attacker = S_Entity_ObjForUID(hits[i].attacker);
+        PyObject *target = S_Entity_ObjForUID(hits[i].target);
+
+        PyObject *tuple = Py_BuildValue("(OOfO)", 
+            attacker ? attacker : Py_None,
+            target ? target : Py_None,
+            hits[i].damage,
+            hits[i].killed ? Py_True : Py_False);
+        if(!tuple) {
+            Py_DECREF(ret);
+            return NULL;
+        }
+        PyList_SET_ITEM(ret, i, tuple);
+    }
+    return ret;
+}
+
 static PyObject *PyPf_draw_text(PyObject *self, PyObject *args)
 {
     const char *text;
@@ -3046,6 +3970,43 @@ static PyObject *PyPf_session_stack_depth(PyObject *self, PyObject *args)
     return PyInt_FromLong(depth);
 }
 
+static PyObject *PyPf_session_profile(PyObject *self, PyObject *args)
+{
+    int save;
+    if(!PyArg_ParseTuple(args, "i", &save)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a boolean (True for saving, False for loading).");
+        return NULL;
+    }
+
+    struct session_profile profile;
+    if(!Session_GetProfile(save, &profile))
+        Py_RETURN_NONE;
+
+    PyObject *sections = PyList_New(profile.nsections);
+    if(!sections)
+        return NULL;
+
+    for(int i = 0; i < profile.nsections; i++) {
+        const struct session_section *curr = &profile.sections[i];
+        PyObject *section = Py_BuildValue("{s:s, s:i, s:d, s:K}",
+            "name",  curr->name,
+            "depth", curr->depth,
+            "ms",    curr->ms,
+            "bytes", (unsigned long long)curr->bytes);
+        if(!section) {
+            Py_DECREF(sections);
+            return NULL;
+        }
+        PyList_SET_ITEM(sections, i, section);
+    }
+
+    return Py_BuildValue("{s:d, s:d, s:K, s:N}",
+        "total_ms",   profile.total_ms,
+        "write_ms",   profile.write_ms,
+        "file_bytes", (unsigned long long)profile.file_bytes,
+        "sections",   sections);
+}
+
 static bool s_pred_callable(uint32_t ent, void *arg)
 {
     PyObject *func = arg;
@@ -3053,7 +4014,14 @@ static bool s_pred_callable(uint32_t ent, void *arg)
     if(!obj)
         return false;
 
+    /* Once the predicate raised, leave the exception set and reject 
+     * everything else */
+    if(PyErr_Occurred())
+        return false;
+
     PyObject *result = PyObject_CallFunctionObjArgs(func, obj, NULL);
+    if(!result)
+        return false;
     bool ret = PyObject_IsTrue(result);
     Py_DECREF(result);
     return ret;
@@ -3089,6 +4057,9 @@ static PyObject *PyPf_nearest_ent(PyObject *self, PyObject *args, PyObject *kwar
         nearest = G_Pos_NearestWithPred(xz_pos, s_pred_any, NULL, max_range);
     }
 
+    if(PyErr_Occurred())
+        return NULL;
+
     if(G_EntityExists(nearest)) {
         PyObject *ret = S_Entity_ObjForUID(nearest);
         if(!ret) {
@@ -3100,107 +4071,735 @@ static PyObject *PyPf_nearest_ent(PyObject *self, PyObject *args, PyObject *kwar
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_ents_in_circle(PyObject *self, PyObject *args, PyObject *kwargs)
+static bool s_pred_filter(uint32_t ent, void *arg)
 {
-    assert(Sched_UsingBigStack());
+    const struct query_filter *filter = arg;
 
-    static char *kwlist[] = {"position", "radius", "predicate", NULL};
-    float radius;
-    vec2_t xz_pos;
-    PyObject *predicate = NULL;
+    if(filter->faction_id >= 0 && G_GetFactionID(ent) != filter->faction_id)
+        return false;
+    if((G_FlagsGet(ent) & filter->flags) != filter->flags)
+        return false;
+    if(filter->tag && !Entity_HasTag(ent, filter->tag))
+        return false;
+    if(filter->predicate)
+        return s_pred_callable(ent, filter->predicate);
+    return true;
+}
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "(ff)f|O", kwlist, &xz_pos.x, &xz_pos.z, &radius, &predicate)) {
-        PyErr_SetString(PyExc_TypeError, "Arguments must be an (X, Z) float tuple, a float and "
-            "an optional callable object.");
-        return NULL;
+static bool s_filter_empty(const struct query_filter *filter)
+{
+    return (filter->faction_id < 0)
+        && (filter->flags == 0)
+        && (filter->tag == NULL)
+        && (filter->predicate == NULL);
+}
+
+static bool s_query_key_init(struct query_key *out, enum query_shape shape, 
+                             vec2_t a, vec2_t b, const struct query_filter *filter)
+{
+    /* The key is compared with memcmp, so make sure the padding is zeroed */
+    memset(out, 0, sizeof(*out));
+    if(filter->predicate)
+        return false;
+    if(filter->tag && strlen(filter->tag) >= sizeof(out->tag))
+        return false;
+
+    out->shape = shape;
+    out->a = a;
+    out->b = b;
+    out->faction_id = filter->faction_id;
+    out->flags = filter->flags;
+    if(filter->tag) {
+        pf_strlcpy(out->tag, filter->tag, sizeof(out->tag));
     }
+    return true;
+}
 
-    if(predicate && !PyCallable_Check(predicate)) {
-        PyErr_SetString(PyExc_TypeError, "'predicate' argument must be callable.");
-        return NULL;
+static struct query_result *s_query_cache_find(const struct query_key *key)
+{
+    for(int i = 0; i < ARR_SIZE(s_query_cache); i++) {
+        struct query_result *curr = &s_query_cache[i];
+        if(curr->valid && 0 == memcmp(&curr->key, key, sizeof(*key)))
+            return curr;
     }
+    return NULL;
+}
 
-    uint32_t inside[16384];
-    size_t ninside;
+static void s_query_cache_store(const struct query_key *key, const uint32_t *uids, size_t nuids)
+{
+    struct query_result *slot = &s_query_cache[s_query_cache_next];
+    s_query_cache_next = (s_query_cache_next + 1) % ARR_SIZE(s_query_cache);
 
-    if(predicate) {
-        ninside = G_Pos_EntsInCircleWithPred(xz_pos, radius, inside, ARR_SIZE(inside),
-            s_pred_callable, predicate);
-    }else{
-        ninside = G_Pos_EntsInCircleWithPred(xz_pos, radius, inside, ARR_SIZE(inside),
-            s_pred_any, NULL);
+    uint32_t *copy = realloc(slot->uids, MAX(nuids, 1) * sizeof(uint32_t));
+    if(!copy) {
+        slot->valid = false;
+        return;
     }
+    memcpy(copy, uids, nuids * sizeof(uint32_t));
+    slot->uids = copy;
+    slot->nuids = nuids;
+    slot->key = *key;
+    slot->valid = true;
+}
+
+/* For circles, 'a' is the center and 'b.x' is the radius. For rectangles, 
+ * 'a' and 'b' are the minimum and maximum corners. Results for queries 
+ * without a Python predicate are reused until the end of the tick. */
+static size_t s_query(enum query_shape shape, vec2_t a, vec2_t b, 
+                      const struct query_filter *filter, uint32_t *out, size_t maxout)
+{
+    struct query_key key;
+    bool cacheable = s_query_key_init(&key, shape, a, b, filter);
 
-    PyObject *list = PyList_New(ninside);
+    if(cacheable) {
+        const struct query_result *hit = s_query_cache_find(&key);
+        if(hit) {
+            size_t ret = MIN(hit->nuids, maxout);
+            memcpy(out, hit->uids, ret * sizeof(uint32_t));
+            return ret;
+        }
+    }
+
+    size_t ret;
+    bool empty = s_filter_empty(filter);
+
+    switch(shape) {
+    case QUERY_CIRCLE:
+        ret = empty ? G_Pos_EntsInCircle(a, b.x, out, maxout)
+                    : G_Pos_EntsInCircleWithPred(a, b.x, out, maxout, s_pred_filter, (void*)filter);
+        break;
+    case QUERY_RECT:
+        ret = empty ? G_Pos_EntsInRect(a, b, out, maxout)
+                    : G_Pos_EntsInRectWithPred(a, b, out, maxout, s_pred_filter, (void*)filter);
+        break;
+    default: assert(0);
+        return 0;
+    }
+
+    if(cacheable) {
+        s_query_cache_store(&key, out, ret);
+    }
+    return ret;
+}
+
+static bool s_query_filter_init(struct query_filter *out, int faction_id, 
+                                unsigned int flags, const char *tag, PyObject *predicate)
+{
+    if(predicate && !PyCallable_Check(predicate)) {
+        PyErr_SetString(PyExc_TypeError, "'predicate' argument must be callable.");
+        return false;
+    }
+    if(faction_id >= MAX_FACTIONS) {
+        PyErr_SetString(PyExc_ValueError, "'faction_id' argument is out of range.");
+        return false;
+    }
+    out->faction_id = faction_id;
+    out->flags = flags;
+    out->tag = tag;
+    out->predicate = predicate;
+    return true;
+}
+
+static PyObject *s_ents_list(const uint32_t *uids, size_t nuids)
+{
+    PyObject *list = PyList_New(nuids);
     if(!list)
         return NULL;
 
     size_t ninserted = 0;
-    for(int i = 0; i < ninside; i++) {
-        PyObject *obj = S_Entity_ObjForUID(inside[i]);
+    for(int i = 0; i < nuids; i++) {
+        PyObject *obj = S_Entity_ObjForUID(uids[i]);
         if(!obj)
             continue;
         Py_INCREF(obj);
         PyList_SET_ITEM(list, ninserted++, obj);
     }
 
-    if(ninserted == ninside || ninserted == 0)
+    if(ninserted == nuids)
         return list;
 
-    PyObject *ret = PyList_GetSlice(list, 0, ninserted-1);
+    PyObject *ret = PyList_GetSlice(list, 0, ninserted);
     Py_DECREF(list);
     return ret;
 }
 
+static PyObject *s_uids_array(const uint32_t *uids, size_t nuids)
+{
+    PyObject *ret = S_Array_New('I', sizeof(uint32_t), nuids, 1);
+    if(!ret)
+        return NULL;
+    memcpy(S_Array_Data(ret), uids, nuids * sizeof(uint32_t));
+    return ret;
+}
+
+static PyObject *PyPf_ents_in_circle(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    assert(Sched_UsingBigStack());
+
+    static char *kwlist[] = {"position", "radius", "predicate", "faction_id", "flags", "tag", NULL};
+    float radius;
+    vec2_t xz_pos;
+    PyObject *predicate = NULL;
+    int faction_id = -1;
+    unsigned int flags = 0;
+    const char *tag = NULL;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "(ff)f|OiIz", kwlist, &xz_pos.x, &xz_pos.z, 
+        &radius, &predicate, &faction_id, &flags, &tag)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an (X, Z) float tuple, a float and "
+            "an optional callable object, faction ID, flags and tag.");
+        return NULL;
+    }
+
+    struct query_filter filter;
+    if(!s_query_filter_init(&filter, faction_id, flags, tag, predicate))
+        return NULL;
+
+    uint32_t inside[16384];
+    size_t ninside = s_query(QUERY_CIRCLE, xz_pos, (vec2_t){radius, 0.0f}, 
+        &filter, inside, ARR_SIZE(inside));
+
+    if(PyErr_Occurred())
+        return NULL;
+    return s_ents_list(inside, ninside);
+}
+
 static PyObject *PyPf_ents_in_rect(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     assert(Sched_UsingBigStack());
 
-    static char *kwlist[] = {"minimum", "maximum", "predicate", NULL};
+    static char *kwlist[] = {"minimum", "maximum", "predicate", "faction_id", "flags", "tag", NULL};
     vec2_t xz_min, xz_max;
     PyObject *predicate = NULL;
+    int faction_id = -1;
+    unsigned int flags = 0;
+    const char *tag = NULL;
 
-    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "(ff)(ff)|O", kwlist, &xz_min.x, &xz_min.z, 
-        &xz_max.x, &xz_max.z, &predicate)) {
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "(ff)(ff)|OiIz", kwlist, &xz_min.x, &xz_min.z, 
+        &xz_max.x, &xz_max.z, &predicate, &faction_id, &flags, &tag)) {
         PyErr_SetString(PyExc_TypeError, "Arguments must be two (X, Z) float tuples, and an "
-            "optional callable object.");
+            "optional callable object, faction ID, flags and tag.");
         return NULL;
     }
 
-    if(predicate && !PyCallable_Check(predicate)) {
-        PyErr_SetString(PyExc_TypeError, "'predicate' argument must be callable.");
+    struct query_filter filter;
+    if(!s_query_filter_init(&filter, faction_id, flags, tag, predicate))
+        return NULL;
+
+    uint32_t inside[16384];
+    size_t ninside = s_query(QUERY_RECT, xz_min, xz_max, &filter, inside, ARR_SIZE(inside));
+
+    if(PyErr_Occurred())
+        return NULL;
+    return s_ents_list(inside, ninside);
+}
+
+static PyObject *PyPf_uids_in_circle(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    assert(Sched_UsingBigStack());
+
+    static char *kwlist[] = {"position", "radius", "faction_id", "flags", "tag", NULL};
+    float radius;
+    vec2_t xz_pos;
+    int faction_id = -1;
+    unsigned int flags = 0;
+    const char *tag = NULL;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "(ff)f|iIz", kwlist, &xz_pos.x, &xz_pos.z, 
+        &radius, &faction_id, &flags, &tag)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an (X, Z) float tuple and a float, "
+            "and an optional faction ID, flags and tag.");
         return NULL;
     }
 
+    struct query_filter filter;
+    if(!s_query_filter_init(&filter, faction_id, flags, tag, NULL))
+        return NULL;
+
     uint32_t inside[16384];
-    size_t ninside;
+    size_t ninside = s_query(QUERY_CIRCLE, xz_pos, (vec2_t){radius, 0.0f}, 
+        &filter, inside, ARR_SIZE(inside));
+    return s_uids_array(inside, ninside);
+}
 
-    if(predicate) {
-        ninside = G_Pos_EntsInRectWithPred(xz_min, xz_max, inside, ARR_SIZE(inside),
-            s_pred_callable, predicate);
+static PyObject *PyPf_uids_in_rect(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    assert(Sched_UsingBigStack());
+
+    static char *kwlist[] = {"minimum", "maximum", "faction_id", "flags", "tag", NULL};
+    vec2_t xz_min, xz_max;
+    int faction_id = -1;
+    unsigned int flags = 0;
+    const char *tag = NULL;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "(ff)(ff)|iIz", kwlist, &xz_min.x, &xz_min.z, 
+        &xz_max.x, &xz_max.z, &faction_id, &flags, &tag)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two (X, Z) float tuples, and an "
+            "optional faction ID, flags and tag.");
+        return NULL;
+    }
+
+    struct query_filter filter;
+    if(!s_query_filter_init(&filter, faction_id, flags, tag, NULL))
+        return NULL;
+
+    uint32_t inside[16384];
+    size_t ninside = s_query(QUERY_RECT, xz_min, xz_max, &filter, inside, ARR_SIZE(inside));
+    return s_uids_array(inside, ninside);
+}
+
+static bool s_snapshot_query_init(PyObject *obj, struct snapshot_query *out)
+{
+    out->faction_id = -1;
+    out->flags = 0;
+
+    vec2_t a;
+    PyObject *b;
+    if(!PyTuple_Check(obj)
+    || !PyArg_ParseTuple(obj, "(ff)O|iI", &a.x, &a.z, &b, &out->faction_id, &out->flags)) {
+        PyErr_SetString(PyExc_TypeError, "Each query must be a tuple of an (X, Z) float tuple, "
+            "a float radius or a second (X, Z) float tuple, and an optional faction ID and flags.");
+        return false;
+    }
+
+    out->a = a;
+    if(PyTuple_Check(b)) {
+        out->shape = SNAPSHOT_QUERY_RECT;
+        if(!PyArg_ParseTuple(b, "ff", &out->b.x, &out->b.z)) {
+            PyErr_SetString(PyExc_TypeError, "The maximum corner must be an (X, Z) float tuple.");
+            return false;
+        }
     }else{
-        ninside = G_Pos_EntsInRectWithPred(xz_min, xz_max, inside, ARR_SIZE(inside),
-            s_pred_any, NULL);
+        out->shape = SNAPSHOT_QUERY_CIRCLE;
+        out->b = (vec2_t){PyFloat_AsDouble(b), 0.0f};
+        if(PyErr_Occurred())
+            return false;
     }
+    return true;
+}
 
-    PyObject *list = PyList_New(ninside);
-    if(!list)
+static PyObject *PyPf_query_snapshot(PyObject *self, PyObject *args)
+{
+    enum{ MAX_RESULTS = 8192 };
+
+    PyObject *obj;
+    if(!PyArg_ParseTuple(args, "O", &obj))
         return NULL;
 
-    size_t ninserted = 0;
-    for(int i = 0; i < ninside; i++) {
-        PyObject *obj = S_Entity_ObjForUID(inside[i]);
-        if(!obj)
-            continue;
-        Py_INCREF(obj);
-        PyList_SET_ITEM(list, ninserted++, obj);
+    PyObject *seq = PySequence_Fast(obj, "Argument must be a sequence of queries.");
+    if(!seq)
+        return NULL;
+
+    PyObject *ret = NULL;
+    size_t nqueries = PySequence_Fast_GET_SIZE(seq);
+    struct snapshot_query *queries = calloc(nqueries ? nqueries : 1, sizeof(struct snapshot_query));
+    uint32_t *results = malloc((nqueries ? nqueries : 1) * MAX_RESULTS * sizeof(uint32_t));
+    if(!queries || !results) {
+        PyErr_NoMemory();
+        goto out;
     }
 
-    if(ninserted == ninside || ninserted == 0)
-        return list;
+    for(int i = 0; i < nqueries; i++) {
+        if(!s_snapshot_query_init(PySequence_Fast_GET_ITEM(seq, i), &queries[i]))
+            goto out;
+        queries[i].out = results + (i * MAX_RESULTS);
+        queries[i].maxout = MAX_RESULTS;
+    }
 
-    PyObject *ret = PyList_GetSlice(list, 0, ninserted-1);
-    Py_DECREF(list);
+    G_Snapshot_QueryBatch(nqueries, queries);
+
+    ret = PyList_New(nqueries);
+    if(!ret)
+        goto out;
+
+    for(int i = 0; i < nqueries; i++) {
+        PyObject *arr = s_uids_array(queries[i].out, queries[i].nout);
+        if(!arr) {
+            Py_CLEAR(ret);
+            goto out;
+        }
+        PyList_SET_ITEM(ret, i, arr);
+    }
+
+out:
+    free(results);
+    free(queries);
+    Py_DECREF(seq);
+    return ret;
+}
+
+struct uid_list{
+    const uint32_t *uids;
+    size_t          nuids;
+    Py_buffer       view;
+    bool            has_view;
+    uint32_t       *alloc;
+};
+
+static bool s_uid_list_init(PyObject *obj, struct uid_list *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    /* Buffers of UIDs (such as the ones returned by the 'uids_in_*' 
+     * queries) are read directly, without any conversion */
+    if(PyObject_CheckBuffer(obj)) {
+
+        if(PyObject_GetBuffer(obj, &out->view, PyBUF_FORMAT | PyBUF_ND) < 0)
+            return false;
+        out->has_view = true;
+
+        const char *format = out->view.format ? out->view.format : "B";
+        if(out->view.itemsize != sizeof(uint32_t) || !strchr("Ii", format[0])) {
+            PyErr_SetString(PyExc_TypeError, "The buffer of UIDs must have a 32-bit integer format.");
+            goto fail;
+        }
+        out->uids = out->view.buf;
+        out->nuids = out->view.len / sizeof(uint32_t);
+        goto validate;
+    }
+
+    PyObject *seq = PySequence_Fast(obj, "Argument must be a sequence of UIDs or pf.Entity instances.");
+    if(!seq)
+        return false;
+
+    size_t nitems = PySequence_Fast_GET_SIZE(seq);
+    out->alloc = malloc(nitems ? nitems * sizeof(uint32_t) : 1);
+    if(!out->alloc) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    for(int i = 0; i < nitems; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        if(PyInt_Check(item)) {
+            out->alloc[i] = PyInt_AS_LONG(item);
+        }else if(!S_Entity_UIDForObj(item, &out->alloc[i])) {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_TypeError, "Argument must be a sequence of UIDs or pf.Entity instances.");
+            goto fail;
+        }
+    }
+    Py_DECREF(seq);
+    out->uids = out->alloc;
+    out->nuids = nitems;
+
+validate:
+    for(int i = 0; i < out->nuids; i++) {
+        if(!G_EntityExists(out->uids[i])) {
+            PyErr_SetString(PyExc_ValueError, "The sequence holds the UID of a non-existent entity.");
+            goto fail;
+        }
+    }
+    return true;
+
+fail:
+    if(out->has_view) {
+        PyBuffer_Release(&out->view);
+    }
+    free(out->alloc);
+    return false;
+}
+
+static void s_uid_list_destroy(struct uid_list *list)
+{
+    if(list->has_view) {
+        PyBuffer_Release(&list->view);
+    }
+    free(list->alloc);
+}
+
+static PyObject *PyPf_queue_orders(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"order", "uids", "target", NULL};
+    int order;
+    PyObject *obj;
+    PyObject *target_obj = NULL;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "iO|O", kwlist, &order, &obj, &target_obj))
+        return NULL;
+
+    if(order < 0 || order >= ORDER_MAX) {
+        PyErr_SetString(PyExc_ValueError, "The order must be one of the pf.ORDER_ constants.");
+        return NULL;
+    }
+
+    vec2_t target = (vec2_t){0.0f, 0.0f};
+    if(target_obj && target_obj != Py_None) {
+        if(!PyTuple_Check(target_obj)
+        || !PyArg_ParseTuple(target_obj, "ff", &target.x, &target.z)) {
+            PyErr_SetString(PyExc_TypeError, "The target must be an (X, Z) float tuple.");
+            return NULL;
+        }
+    }
+
+    if(order == ORDER_MOVE || order == ORDER_ATTACK) {
+        if(!target_obj || target_obj == Py_None) {
+            PyErr_SetString(PyExc_ValueError, "A target is required for the move and attack orders.");
+            return NULL;
+        }
+        if(!G_PointInsideMap(target)) {
+            PyErr_SetString(PyExc_RuntimeError, "The target must be within the map bounds.");
+            return NULL;
+        }
+    }
+
+    struct uid_list list;
+    if(!s_uid_list_init(obj, &list))
+        return NULL;
+
+    for(int i = 0; i < list.nuids; i++) {
+        Replay_RecordScript("queue_order", list.uids[i], order, (vec3_t){target.x, 0.0f, target.z});
+    }
+    G_Orders_Queue(order, list.nuids, list.uids, target);
+    s_uid_list_destroy(&list);
+    Py_RETURN_NONE;
+}
+
+static PyObject *s_nav_latency_dict(const struct nav_bench_latency *lat)
+{
+    return Py_BuildValue("{s:I, s:f, s:f, s:f, s:f, s:f}",
+        "samples",  lat->nsamples,
+        "mean_us",  lat->mean_us,
+        "p50_us",   lat->p50_us,
+        "p95_us",   lat->p95_us,
+        "p99_us",   lat->p99_us,
+        "max_us",   lat->max_us);
+}
+
+static bool s_parse_nav_pairs(PyObject *obj, vec2_t **out, size_t *out_npairs)
+{
+    PyObject *seq = PySequence_Fast(obj, "'pairs' must be a sequence of ((x, z), (x, z)) tuples.");
+    if(!seq)
+        return false;
+
+    size_t npairs = PySequence_Fast_GET_SIZE(seq);
+    vec2_t *pairs = malloc(npairs ? npairs * 2 * sizeof(vec2_t) : 1);
+    if(!pairs) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return false;
+    }
+
+    for(int i = 0; i < npairs; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        vec2_t *src = &pairs[i * 2 + 0], *dest = &pairs[i * 2 + 1];
+        if(!PyArg_ParseTuple(item, "(ff)(ff)", &src->x, &src->z, &dest->x, &dest->z)) {
+            Py_DECREF(seq);
+            free(pairs);
+            PyErr_SetString(PyExc_TypeError, "'pairs' must be a sequence of ((x, z), (x, z)) tuples.");
+            return false;
+        }
+    }
+    Py_DECREF(seq);
+    *out = pairs;
+    *out_npairs = npairs;
+    return true;
+}
+
+static PyObject *PyPf_nav_benchmark(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"npaths", "seed", "radius", "faction_id", "targets", "pairs", NULL};
+    int npaths = 1000;
+    unsigned seed = 0;
+    float radius = 0.0f;
+    int faction_id = 0;
+    PyObject *targets = NULL, *pairs = NULL;
+    PyObject *ret = NULL;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|iIfiOO", kwlist, &npaths, &seed, 
+        &radius, &faction_id, &targets, &pairs)) {
+        return NULL;
+    }
+
+    if(npaths < 0) {
+        PyErr_SetString(PyExc_ValueError, "'npaths' must be non-negative.");
+        return NULL;
+    }
+    if(faction_id < 0 || faction_id >= MAX_FACTIONS) {
+        PyErr_SetString(PyExc_ValueError, "Invalid faction ID.");
+        return NULL;
+    }
+    if(!G_MapLoaded()) {
+        PyErr_SetString(PyExc_RuntimeError, "A map must be loaded to run the navigation benchmark.");
+        return NULL;
+    }
+
+    struct nav_bench_desc desc = (struct nav_bench_desc){
+        .layer = Entity_NavLayerWithRadius(0, radius),
+        .faction_id = faction_id,
+        .seed = seed,
+        .npaths = npaths,
+    };
+
+    struct uid_list list = {0};
+    vec2_t *pair_buff = NULL;
+
+    if(targets && targets != Py_None) {
+        if(!s_uid_list_init(targets, &list))
+            return NULL;
+        desc.targets = list.uids;
+        desc.ntargets = list.nuids;
+    }
+    if(pairs && pairs != Py_None) {
+        if(!s_parse_nav_pairs(pairs, &pair_buff, &desc.npairs))
+            goto out;
+        desc.pairs = pair_buff;
+    }
+
+    struct nav_bench_result result;
+    if(!G_MapNavBenchmark(&desc, &result)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to run the navigation benchmark.");
+        goto out;
+    }
+
+    static const char *query_names[NAV_BENCH_QUERY_COUNT] = {
+        [NAV_BENCH_PATH]            = "path",
+        [NAV_BENCH_PATH_ATTACKING]  = "path_attacking",
+        [NAV_BENCH_DEST_LOS]        = "dest_los",
+        [NAV_BENCH_ENTITY_LOS]      = "entity_los",
+        [NAV_BENCH_SURROUND]        = "surround",
+    };
+
+    PyObject *latency = PyDict_New();
+    if(!latency)
+        goto out;
+
+    for(int i = 0; i < NAV_BENCH_QUERY_COUNT; i++) {
+        PyObject *lat = s_nav_latency_dict(&result.latency[i]);
+        if(!lat || 0 != PyDict_SetItemString(latency, query_names[i], lat)) {
+            Py_XDECREF(lat);
+            Py_DECREF(latency);
+            goto out;
+        }
+        Py_DECREF(lat);
+    }
+
+    PyObject *fc = s_fc_stats_dict(&result.fc);
+    if(!fc) {
+        Py_DECREF(latency);
+        goto out;
+    }
+
+    ret = Py_BuildValue("{s:f, s:I, s:I, s:N, s:N, s:{s:K, s:K, s:K, s:K}, s:{s:K, s:K}}",
+        "build_ms",     result.build_ms,
+        "npaths",       result.npaths,
+        "npaths_found", result.npaths_found,
+        "latency",      latency,
+        "field_cache",  fc,
+        "search",
+            "grid_searches",    (unsigned long long)result.search.grid_searches,
+            "grid_expanded",    (unsigned long long)result.search.grid_expanded,
+            "portal_searches",  (unsigned long long)result.search.portal_searches,
+            "portal_expanded",  (unsigned long long)result.search.portal_expanded,
+        "mem",
+            "nav_bytes",        (unsigned long long)result.nav_bytes,
+            "field_cache_bytes",(unsigned long long)result.field_cache_bytes);
+
+out:
+    free(pair_buff);
+    s_uid_list_destroy(&list);
+    return ret;
+}
+
+static PyObject *s_bulk_query(PyObject *args, char format, size_t itemsize, size_t ncols,
+                              void (*query)(uint32_t, void*))
+{
+    PyObject *obj;
+    if(!PyArg_ParseTuple(args, "O", &obj))
+        return NULL;
+
+    struct uid_list list;
+    if(!s_uid_list_init(obj, &list))
+        return NULL;
+
+    PyObject *ret = S_Array_New(format, itemsize, list.nuids, ncols);
+    if(!ret)
+        goto out;
+
+    char *data = S_Array_Data(ret);
+    for(int i = 0; i < list.nuids; i++) {
+        query(list.uids[i], data + (i * itemsize * ncols));
+    }
+
+out:
+    s_uid_list_destroy(&list);
+    return ret;
+}
+
+static void s_query_position(uint32_t uid, void *out)
+{
+    vec3_t pos = G_Pos_Get(uid);
+    memcpy(out, pos.raw, sizeof(pos.raw));
+}
+
+static void s_query_faction(uint32_t uid, void *out)
+{
+    int32_t faction_id = G_GetFactionID(uid);
+    memcpy(out, &faction_id, sizeof(faction_id));
+}
+
+static void s_query_flags(uint32_t uid, void *out)
+{
+    uint32_t flags = G_FlagsGet(uid);
+    memcpy(out, &flags, sizeof(flags));
+}
+
+static void s_query_health(uint32_t uid, void *out)
+{
+    int32_t hp = (G_FlagsGet(uid) & ENTITY_FLAG_COMBATABLE) ? G_Combat_GetCurrentHP(uid) : 0;
+    memcpy(out, &hp, sizeof(hp));
+}
+
+static PyObject *PyPf_get_positions(PyObject *self, PyObject *args)
+{
+    return s_bulk_query(args, 'f', sizeof(float), 3, s_query_position);
+}
+
+static PyObject *PyPf_get_factions(PyObject *self, PyObject *args)
+{
+    return s_bulk_query(args, 'i', sizeof(int32_t), 1, s_query_faction);
+}
+
+static PyObject *PyPf_get_flags(PyObject *self, PyObject *args)
+{
+    return s_bulk_query(args, 'I', sizeof(uint32_t), 1, s_query_flags);
+}
+
+static PyObject *PyPf_get_healths(PyObject *self, PyObject *args)
+{
+    return s_bulk_query(args, 'i', sizeof(int32_t), 1, s_query_health);
+}
+
+static PyObject *PyPf_get_influence_map(PyObject *self, PyObject *args)
+{
+    int faction_id, layer;
+    if(!PyArg_ParseTuple(args, "ii", &faction_id, &layer)) {
+        PyErr_SetString(PyExc_TypeError, "Expecting two arguments: faction ID (int) and layer (int).");
+        return NULL;
+    }
+
+    if(faction_id < 0 || faction_id >= MAX_FACTIONS) {
+        PyErr_SetString(PyExc_ValueError, "Invalid faction ID.");
+        return NULL;
+    }
+
+    if(layer < 0 || layer >= INFLUENCE_LAYER_MAX) {
+        PyErr_SetString(PyExc_ValueError, "Invalid influence layer.");
+        return NULL;
+    }
+
+    int w, h;
+    const float *grid = G_Influence_Get(faction_id, layer, &w, &h);
+    if(!grid) {
+        PyErr_SetString(PyExc_RuntimeError, "No map is loaded.");
+        return NULL;
+    }
+
+    PyObject *ret = S_Array_New('f', sizeof(float), h, w);
+    if(!ret)
+        return NULL;
+    memcpy(S_Array_Data(ret), grid, w * h * sizeof(float));
     return ret;
 }
 
@@ -3482,6 +5081,8 @@ PyMODINIT_FUNC initpf(void)
     S_Camera_PyRegister(module);
     S_Task_PyRegister(module);
     S_Region_PyRegister(module);
+    S_Array_PyRegister(module);
+    S_Bundle_PyRegister(module);
     S_Constants_Expose(module); 
 }
 
@@ -3497,6 +5098,8 @@ bool S_Init(const char *progname, const char *base_path, struct nk_context *ctx)
     Py_SetPythonHome(script_dir); /* caches passed in pointer */
     Py_InitializeEx(0);
 
+    if(!s_gc_init())
+        return false;
     if(!S_UI_Init(ctx))
         return false;
     if(!S_Entity_Init())
@@ -3515,6 +5118,9 @@ bool S_Init(const char *progname, const char *base_path, struct nk_context *ctx)
 
     initpf();
 
+    pf_snprintf(script_dir, sizeof(script_dir), "%s/%s", g_basepath, "scripts");
+    if(!S_Bundle_Init(script_dir))
+        return false;
     if(!S_Camera_Init())
         return false;
 
@@ -3538,11 +5144,14 @@ void S_Shutdown(void)
     /* Free any globaly retained Python objects before finalizing 
      * the session */
     s_err_clear();
+    s_args_clear();
+    s_query_cache_free();
     S_Pickle_Clear();
     S_Camera_Clear();
     S_Region_Clear();
     S_Task_Clear();
     S_Entity_Clear();
+    Py_CLEAR(s_gc_module);
 
     Py_Finalize();
 
@@ -3554,6 +5163,7 @@ void S_Shutdown(void)
     S_Task_Shutdown();
     S_Entity_Shutdown();
     S_UI_Shutdown();
+    S_Bundle_Shutdown();
 }
 
 bool S_RunFile(const char *path, int argc, char **argv)
@@ -3647,26 +5257,86 @@ void S_RunEventHandler(script_opaque_t callable, script_opaque_t user_arg, scrip
     assert(user_arg);
     assert(event_arg);
 
-    args = PyTuple_New(2);
-    /* PyTuple_SetItem steals references! However, we wish to hold on to the user_arg. The event_arg
+    /* Make sure to retain the callable object - PyObject_Call will not do this for us.
+     * The reason is that the invoked handler may unregister itself, thus removing the last 
+     * living reference to it. */
+    Py_INCREF(callable);
+
+    /* Handlers are most often bound methods. Calling through the method object 
+     * allocates a new argument tuple with 'self' prepended on every call, so 
+     * unpack it here and call the function directly. */
+    PyObject *func = callable;
+    PyObject *self = NULL;
+    if(PyMethod_Check(func) && PyMethod_GET_SELF(func)) {
+        self = PyMethod_GET_SELF(func);
+        func = PyMethod_GET_FUNCTION(func);
+    }
+
+    int nargs = self ? 3 : 2;
+    args = s_args_acquire(nargs);
+    if(!args) {
+        S_ShowLastError();
+        Py_DECREF(callable);
+        return;
+    }
+
+    /* PyTuple_SET_ITEM steals references! However, we wish to hold on to the user_arg. The event_arg
      * is DECREF'd once after all the handlers for the event have been executed. */
+    if(self) {
+        Py_INCREF(self);
+        PyTuple_SET_ITEM(args, 0, self);
+    }
     Py_INCREF(user_arg);
     Py_INCREF(event_arg);
-    PyTuple_SetItem(args, 0, user_arg);
-    PyTuple_SetItem(args, 1, event_arg);
+    PyTuple_SET_ITEM(args, nargs - 2, user_arg);
+    PyTuple_SET_ITEM(args, nargs - 1, event_arg);
 
-    /* Make sure to retain the callable object - PyObject_CallObject will not do this for us.
-     * The reason is that the invoked handler may unregister itself, thus removing the last 
-     * living reference to it. */
-    Py_INCREF(callable);
-    ret = PyObject_CallObject(callable, args);
-    Py_DECREF(callable);
-    Py_DECREF(args);
+    uint64_t start = SDL_GetPerformanceCounter();
+    ret = PyObject_Call(func, args, NULL);
+    uint64_t delta = SDL_GetPerformanceCounter() - start;
+    s_args_release(args);
 
     if(PyErr_Occurred()) {
         S_ShowLastError();
     }
     Py_XDECREF(ret);
+
+    /* Event handlers run to completion on the main thread, so a slow 
+     * one eats into the frame directly. Point out the culprits. */
+    Perf_RecordSample(PERF_METRIC_SCRIPT, delta);
+    double ms = delta * 1000.0 / SDL_GetPerformanceFrequency();
+    if(ms > CONFIG_SCRIPT_HANDLER_BUDGET_MS)
+        s_report_overrun(callable, ms);
+    Py_DECREF(callable);
+}
+
+void S_RunBatchEventHandler(script_opaque_t callable, script_opaque_t user_arg,
+                            size_t nevents, const uint32_t *receivers,
+                            script_opaque_t *event_args)
+{
+    PyObject *events = PyList_New(nevents);
+    if(!events)
+        goto fail;
+
+    for(int i = 0; i < nevents; i++) {
+
+        PyObject *receiver = S_Entity_ObjForUID(receivers[i]);
+        if(!receiver) {
+            receiver = Py_None;
+        }
+        PyObject *event = PyTuple_Pack(2, receiver, (PyObject*)event_args[i]);
+        if(!event)
+            goto fail;
+        PyList_SET_ITEM(events, i, event);
+    }
+
+    S_RunEventHandler(callable, user_arg, events);
+    Py_DECREF(events);
+    return;
+
+fail:
+    Py_XDECREF(events);
+    S_ShowLastError();
 }
 
 void S_Retain(script_opaque_t obj)
@@ -3793,16 +5463,58 @@ bool S_ObjectsEqual(script_opaque_t a, script_opaque_t b)
     return (1 == PyObject_RichCompareBool(a, b, Py_EQ));
 }
 
+void S_GC_Step(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    long counts[3];
+    if(!s_gc_module || !s_gc_counts(counts))
+        return;
+
+    /* The oldest generation is only collected while loading, unless it 
+     * has been put off for so long that the garbage is piling up */
+    if(counts[2] >= CONFIG_SCRIPT_GC_FULL_CAP) {
+        S_GC_CollectFull();
+        return;
+    }
+
+    if(counts[0] < CONFIG_SCRIPT_GC_YOUNG_THRESH)
+        return;
+
+    /* A middle generation collection takes the young one with it, but costs 
+     * more. Put it off while it's expected to blow the budget, though not 
+     * indefinitely. */
+    if(counts[1] >= CONFIG_SCRIPT_GC_MID_THRESH
+    && (s_gc_mid_ms <= CONFIG_SCRIPT_GC_BUDGET_MS 
+        || ++s_gc_mid_deferred > CONFIG_SCRIPT_GC_MAX_DEFERRED)) {
+
+        double ms = s_gc_collect(1);
+        s_gc_mid_ms = (s_gc_mid_ms + ms) / 2.0;
+        s_gc_mid_deferred = 0;
+        return;
+    }
+    s_gc_collect(0);
+}
+
+void S_GC_CollectFull(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    if(!s_gc_module)
+        return;
+    s_gc_collect(2);
+}
+
 void S_ClearState(void)
 {
     S_Shutdown();
     S_Init(s_progname, g_basepath, UI_GetContext());
-    PyGC_Collect(); /* quick sanity check */
+    S_GC_CollectFull(); /* quick sanity check */
 }
 
 bool S_SaveState(SDL_RWops *stream)
 {
-    PyGC_Collect();
+    S_GC_CollectFull();
 
     PyObject *modules_dict = PySys_GetObject("modules"); /* borrowed */
     assert(modules_dict);
@@ -3819,8 +5531,9 @@ bool S_SaveState(SDL_RWops *stream)
         goto fail_tuple;
 
     for(int i = 0; i < nhandlers; i++) {
-        PyObject *val = Py_BuildValue("lllOO", handlers[i].event, handlers[i].id, 
-            handlers[i].simmask, (PyObject*)handlers[i].handler, (PyObject*)handlers[i].arg);
+        PyObject *val = Py_BuildValue("lllOOi", handlers[i].event, handlers[i].id, 
+            handlers[i].simmask, (PyObject*)handlers[i].handler, (PyObject*)handlers[i].arg,
+            handlers[i].batch);
         if(!val)
             goto fail_handlers;
         PyTuple_SET_ITEM(saved_handlers, i, val);
@@ -3899,7 +5612,9 @@ bool S_LoadState(SDL_RWops *stream)
     for(int i = 0; i < PyTuple_GET_SIZE(handlers); i++) {
 
         PyObject *entry = PyTuple_GET_ITEM(handlers, i);
-        if(!PyTuple_Check(entry) || PyTuple_GET_SIZE(entry) != 5)
+        /* Sessions saved before batch handlers existed have no 'batch' flag */
+        if(!PyTuple_Check(entry) 
+        || (PyTuple_GET_SIZE(entry) != 5 && PyTuple_GET_SIZE(entry) != 6))
             goto fail;
 
         PyObject *event = PyTuple_GET_ITEM(entry, 0);
@@ -3917,11 +5632,15 @@ bool S_LoadState(SDL_RWops *stream)
         int ievent = PyInt_AS_LONG(event);
         uint32_t iuid = PyInt_AS_LONG(uid);
         int isimmask = PyInt_AS_LONG(simmask);
+        bool batch = (PyTuple_GET_SIZE(entry) == 6) 
+                  && PyObject_IsTrue(PyTuple_GET_ITEM(entry, 5));
 
         Py_INCREF(handler);
         Py_INCREF(arg);
 
-        if(iuid == ~((uint32_t)0)) {
+        if(batch) {
+            E_ScriptRegisterBatch(ievent, handler, arg, isimmask);
+        }else if(iuid == ~((uint32_t)0)) {
             E_Global_ScriptRegister(ievent, handler, arg, isimmask);
         }else{
             E_Entity_ScriptRegister(ievent, iuid, handler, arg, isimmask);
@@ -3940,6 +5659,8 @@ bool S_LoadState(SDL_RWops *stream)
 
 fail:
     Py_DECREF(state);
+    /* Unpickling leaves a lot of garbage behind. Clear it while still loading. */
+    S_GC_CollectFull();
     return ret;
 } 
 
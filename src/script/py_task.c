@@ -58,6 +58,10 @@
 #define CALL_FLAG_VAR   1
 #define CALL_FLAG_KW    2
 
+/* The number of opcodes a task executes between checks of whether it 
+ * has exhausted its' time quantum. */
+#define PREEMPT_CHECK_OPS (1024)
+
 #define CHK_TRUE(_pred, _label)         \
     do{                                 \
         if(!(_pred))                    \
@@ -95,6 +99,7 @@ typedef struct {
     }state;
     struct pyrequest req;
     size_t stack_depth;
+    uint32_t nops;
     PyThreadState *ts;
     const char *regname;
     uint32_t sleep_elapsed;
@@ -129,6 +134,9 @@ static PyObject *PyTask_who_is(PyTaskObject *self, PyObject *args, PyObject *kwa
 
 static PyObject *PyTask_get_completed(PyTaskObject *self, void *closure);
 
+static void      pytask_push_ctx(PyTaskObject *self);
+static void      pytask_pop_ctx(PyTaskObject *self);
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
@@ -323,6 +331,20 @@ static int pytask_tracefunc(PyTaskObject *self, PyFrameObject *frame, int what,
         assert(frame->f_stacktop);
         size_t stack_depth = (size_t)(frame->f_stacktop - frame->f_valuestack);
         self->stack_depth = stack_depth;
+
+        /* Long-running scripts get preempted at opcode boundaries once 
+         * they exceed the scheduler's time budget so that they cannot 
+         * stall the tick. No request is set - so long as the task is 
+         * preempted, it cannot be saved. Flushing the scheduler before
+         * a save will run it up to its' next blocking request. */
+        if(++self->nops % PREEMPT_CHECK_OPS == 0
+        && Sched_ActiveTID() == self->tid
+        && Sched_ShouldYield()) {
+
+            pytask_pop_ctx(self);
+            Task_Yield();
+            pytask_push_ctx(self);
+        }
     }
     return 0;
 }
@@ -564,6 +586,7 @@ static PyObject *PyTask_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     self->state = PYTASK_STATE_NOT_STARTED;
     self->req = (struct pyrequest){0};
     self->stack_depth = 0;
+    self->nops = 0;
     self->regname = NULL;
     self->sleep_elapsed = 0;
     return (PyObject*)self;
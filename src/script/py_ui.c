@@ -66,6 +66,24 @@
             return false;     \
     }while(0)
 
+/* The draw commands emitted by the last 'update' call of a retained 
+ * window, along with the state that they were recorded under. 
+ */
+struct window_cache{
+    bool                    valid;
+    bool                    hovered;
+    struct nk_rect          bounds;
+    nk_flags                flags;
+    struct nk_style_window  style;
+    float                   at_x, at_y, max_x;
+    struct nk_row_layout    row;
+    nk_size                 begin;
+    nk_size                 last;
+    size_t                  size;
+    size_t                  capacity;
+    void                   *cmds;
+};
+
 typedef struct {
     PyObject_HEAD
     char                    name[128];
@@ -81,6 +99,12 @@ typedef struct {
      * will be transformed according to the resize mask. */
     struct nk_vec2i         virt_res;
     bool                    hide;
+    /* Retained windows don't have their 'update' method invoked while
+     * they are not being interacted with. Instead, the draw commands 
+     * from the last invocation are replayed until the window is 
+     * invalidated, moved or restyled. */
+    bool                    retained;
+    struct window_cache     cache;
 }PyWindowObject;
 
 VEC_TYPE(win, PyWindowObject*)
@@ -125,6 +149,7 @@ static PyObject *PyWindow_text_lines_width(PyWindowObject *self, PyObject *args)
 static PyObject *PyWindow_show(PyWindowObject *self);
 static PyObject *PyWindow_hide(PyWindowObject *self);
 static PyObject *PyWindow_update(PyWindowObject *self);
+static PyObject *PyWindow_invalidate(PyWindowObject *self);
 static PyObject *PyWindow_on_hide(PyWindowObject *self, PyObject *args);
 static PyObject *PyWindow_on_minimize(PyWindowObject *self);
 static PyObject *PyWindow_on_maximize(PyWindowObject *self);
@@ -202,6 +227,8 @@ static int       PyWindow_set_interactive(PyWindowObject *self, PyObject *value,
 static PyObject *PyWindow_get_background(PyWindowObject *self, void *closure);
 static int       PyWindow_set_background(PyWindowObject *self, PyObject *value, void *closure);
 static PyObject *PyWindow_get_fixed_background(PyWindowObject *self, void *closure);
+static PyObject *PyWindow_get_retained(PyWindowObject *self, void *closure);
+static int       PyWindow_set_retained(PyWindowObject *self, PyObject *value, void *closure);
 static int       PyWindow_set_fixed_background(PyWindowObject *self, PyObject *value, void *closure);
 
 NK_API struct nk_window *nk_find_window(struct nk_context *ctx, nk_hash hash, const char *name);
@@ -367,6 +394,11 @@ static PyMethodDef PyWindow_methods[] = {
     "Handles layout and state changes of the window. Default implementation is empty. "
     "This method should be overridden by subclasses to customize the window look and behavior."},
 
+    {"invalidate", 
+    (PyCFunction)PyWindow_invalidate, METH_NOARGS,
+    "Force the 'update' method of a retained window to be invoked on the next frame. Should be "
+    "called whenever the contents of a retained window change."},
+
     {"on_hide", 
     (PyCFunction)PyWindow_on_hide, METH_VARARGS,
     "Callback that gets invoked when the user hides the window with the close button (or via an API call)."},
@@ -557,6 +589,13 @@ static PyGetSetDef PyWindow_getset[] = {
     (setter)PyWindow_set_fixed_background,
     "An image path or an (R, G, B, A) tuple of floats specifying the background style of the window.", 
     NULL},
+    {"retained",
+    (getter)PyWindow_get_retained, 
+    (setter)PyWindow_set_retained,
+    "A read-write bool. When set, the 'update' method is only invoked when the window is being "
+    "interacted with, after it is moved or restyled, or after a call to 'invalidate'. Otherwise, "
+    "the contents from the last 'update' call are redrawn. Useful for static panels.", 
+    NULL},
     {NULL}  /* Sentinel */
 };
 
@@ -1505,6 +1544,12 @@ static PyObject *PyWindow_update(PyWindowObject *self)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyWindow_invalidate(PyWindowObject *self)
+{
+    self->cache.valid = false;
+    Py_RETURN_NONE;
+}
+
 static PyObject *PyWindow_on_hide(PyWindowObject *self, PyObject *args)
 {
     Py_RETURN_NONE;
@@ -1698,6 +1743,7 @@ static PyObject *PyWindow_new(PyTypeObject *type, PyObject *args, PyObject *kwds
     ((PyWindowObject*)self)->resize_mask = ANCHOR_DEFAULT;
     ((PyWindowObject*)self)->suspend_on_pause = false;
     ((PyWindowObject*)self)->hide = false;
+    ((PyWindowObject*)self)->retained = false;
     vec_win_push(&s_active_windows, (PyWindowObject*)self);
     return self;
 }
@@ -1705,6 +1751,7 @@ static PyObject *PyWindow_new(PyTypeObject *type, PyObject *args, PyObject *kwds
 static void PyWindow_dealloc(PyWindowObject *self)
 {
     Py_XDECREF(self->header_style);
+    free(self->cache.cmds);
 
     int idx = vec_win_indexof(&s_active_windows, self, equal);
     vec_win_del(&s_active_windows, idx);
@@ -2325,6 +2372,21 @@ static int PyWindow_set_fixed_background(PyWindowObject *self, PyObject *value,
     return 0;
 }
 
+static PyObject *PyWindow_get_retained(PyWindowObject *self, void *closure)
+{
+    if(self->retained)
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static int PyWindow_set_retained(PyWindowObject *self, PyObject *value, void *closure)
+{
+    self->retained = PyObject_IsTrue(value);
+    self->cache.valid = false;
+    return 0;
+}
+
 static void call_registered(PyObject *obj, char *method_name)
 {
     PyObject *ret = PyObject_CallMethod(obj, method_name, NULL);
@@ -2343,6 +2405,129 @@ static void call_registered_arg(PyObject *obj, char *method_name, PyObject *arg)
     Py_XDECREF(ret);
 }
 
+static bool window_cache_matches(const PyWindowObject *win, const struct nk_window *nkwin)
+{
+    const struct window_cache *cache = &win->cache;
+    if(!cache->valid)
+        return false;
+    if(memcmp(&cache->bounds, &nkwin->bounds, sizeof(struct nk_rect)))
+        return false;
+    if(cache->flags != nkwin->flags)
+        return false;
+    if(memcmp(&cache->style, &s_nk_ctx->style.window, sizeof(struct nk_style_window)))
+        return false;
+    return true;
+}
+
+static void window_cache_record(PyWindowObject *win, struct nk_window *nkwin, nk_size begin)
+{
+    struct window_cache *cache = &win->cache;
+    cache->valid = false;
+
+    /* Only record the commands if they form a single contiguous run in 
+     * the window's buffer. This is not the case when popups are used, 
+     * for example. */
+    const nk_byte *mem = nkwin->buffer.base->memory.ptr;
+    nk_size end = nkwin->buffer.end;
+    nk_size curr = begin;
+    while(curr < end) {
+        const struct nk_command *cmd = (const struct nk_command*)(mem + curr);
+        if(cmd->next <= curr || cmd->next > end)
+            return;
+        curr = cmd->next;
+    }
+    if(curr != end)
+        return;
+
+    size_t size = end - begin;
+    if(size > cache->capacity) {
+        void *cmds = realloc(cache->cmds, size);
+        if(!cmds)
+            return;
+        cache->cmds = cmds;
+        cache->capacity = size;
+    }
+
+    memcpy(cache->cmds, mem + begin, size);
+    cache->size = size;
+    cache->begin = begin;
+    cache->last = nkwin->buffer.last;
+    cache->bounds = nkwin->bounds;
+    cache->flags = nkwin->flags;
+    memcpy(&cache->style, &s_nk_ctx->style.window, sizeof(struct nk_style_window));
+    cache->at_x = nkwin->layout->at_x;
+    cache->at_y = nkwin->layout->at_y;
+    cache->max_x = nkwin->layout->max_x;
+    cache->row = nkwin->layout->row;
+    cache->valid = true;
+}
+
+static void window_cache_replay(PyWindowObject *win, struct nk_window *nkwin)
+{
+    struct window_cache *cache = &win->cache;
+
+    /* Restore the layout state so that the panel is sized and 
+     * scrolled as if the widgets had been laid out again */
+    nkwin->layout->at_x = cache->at_x;
+    nkwin->layout->at_y = cache->at_y;
+    nkwin->layout->max_x = cache->max_x;
+    nkwin->layout->row = cache->row;
+
+    if(cache->size == 0)
+        return;
+
+    struct nk_buffer *base = nkwin->buffer.base;
+    nk_size prev_allocated = base->allocated;
+    nk_buffer_push(base, NK_BUFFER_FRONT, cache->cmds, cache->size, NK_ALIGNOF(struct nk_command));
+    if(base->allocated == prev_allocated)
+        return;
+
+    nk_size begin = base->allocated - cache->size;
+    assert(begin == nkwin->buffer.end);
+
+    /* The command links are absolute offsets into the context's memory */
+    nk_byte *mem = base->memory.ptr;
+    nk_size curr = begin;
+    while(curr < begin + cache->size) {
+        struct nk_command *cmd = (struct nk_command*)(mem + curr);
+        cmd->next = cmd->next - cache->begin + begin;
+        curr = cmd->next;
+    }
+    nkwin->buffer.last = cache->last - cache->begin + begin;
+    nkwin->buffer.end = begin + cache->size;
+}
+
+static void window_update(PyWindowObject *win)
+{
+    struct nk_window *nkwin = s_nk_ctx->current;
+    bool hovered = nk_input_is_mouse_hovering_rect(&s_nk_ctx->input, nkwin->bounds);
+
+    /* A window that is (or has just stopped) being interacted with must 
+     * have its' widgets run to handle the input and hover effects */
+    bool interacting = hovered
+                    || win->cache.hovered
+                    || nkwin->edit.active
+                    || nkwin->popup.active;
+    win->cache.hovered = hovered;
+
+    if(!win->retained || interacting) {
+        win->cache.valid = false;
+        call_registered((PyObject*)win, "update");
+        return;
+    }
+
+    if(window_cache_matches(win, nkwin)) {
+        window_cache_replay(win, nkwin);
+        return;
+    }
+
+    nk_size begin = nkwin->buffer.end;
+    call_registered((PyObject*)win, "update");
+    if(s_nk_ctx->current == nkwin) {
+        window_cache_record(win, nkwin, begin);
+    }
+}
+
 static void active_windows_update(void *user, void *event)
 {
     (void)user;
@@ -2358,6 +2543,17 @@ static void active_windows_update(void *user, void *event)
         if(win->suspend_on_pause && G_GetSimState() != G_RUNNING)
             win->flags |= NK_WINDOW_NOT_INTERACTIVE;
 
+        /* The windows are internally indexed by their name, so it is not possible
+         * to have multiple active windows with the exact same name. This is checked 
+         * before the window's style is swapped in, so that a skipped window doesn't 
+         * leave its' style applied to all the windows drawn after it.
+         */
+		int name_len = (int)nk_strlen(win->name);
+		nk_hash name_hash = nk_murmur_hash(win->name, (int)name_len, NK_WINDOW_TITLE);
+		struct nk_window *nkwin = nk_find_window(s_nk_ctx, name_hash, win->name);
+		if(nkwin && (nkwin->seq == s_nk_ctx->seq))
+			continue;
+
         struct nk_style_window saved_style = s_nk_ctx->style.window;
         s_nk_ctx->style.window = win->style;
         if(win->header_style) {
@@ -2368,20 +2564,11 @@ static void active_windows_update(void *user, void *event)
         struct rect adj_bounds = UI_BoundsForAspectRatio(win->rect, 
             TO_VEC2T(win->virt_res), TO_VEC2T(adj_vres), win->resize_mask);
 
-        /* The windows are internally indexed by their name, so it is not possible
-         * to have multiple active windows with the exact same name. 
-         */
-		int name_len = (int)nk_strlen(win->name);
-		nk_hash name_hash = nk_murmur_hash(win->name, (int)name_len, NK_WINDOW_TITLE);
-		struct nk_window *nkwin = nk_find_window(s_nk_ctx, name_hash, win->name);
-		if(nkwin && (nkwin->seq == s_nk_ctx->seq))
-			continue;
-
         if(nk_begin_with_vres(s_nk_ctx, win->name, 
             nk_rect(adj_bounds.x, adj_bounds.y, adj_bounds.w, adj_bounds.h), 
             win->flags, adj_vres)) {
 
-            call_registered((PyObject*)win, "update");
+            window_update(win);
         }
 
         if(win->hide || (s_nk_ctx->current->flags & NK_WINDOW_HIDDEN 
@@ -38,6 +38,7 @@
 #include "main.h"
 #include "ui.h"
 #include "sched.h"
+#include "task.h"
 #include "cursor.h"
 #include "asset_load.h"
 #include "lib/public/attr.h"
@@ -56,12 +57,28 @@
 #include <assert.h>
 
 
-#define PFSAVE_VERSION  (1.0f)
+#define PFSAVE_VERSION  (1.4f)
+/* The first version to save UIDs holding a slot index and generation. Older 
+ * versions handed out sequential UIDs, which decode to the same slot only 
+ * while they are below ENTITY_UID_MAX_SLOTS. */
+#define PFSAVE_SLOT_UIDS_VERSION (1.4f)
 #define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX_PROFILE_DEPTH (8)
 
 VEC_TYPE(stream, SDL_RWops*)
 VEC_IMPL(static, stream, SDL_RWops*)
 
+/* A session file that has been fully serialized into memory and is being 
+ * written out to disk by a background task. */
+struct save_work{
+    char           path[512];
+    SDL_RWops     *snapshot;
+    uint32_t       tid;
+    struct future  future;
+    bool           pending;
+    double         write_ms;
+};
+
 enum srequest{
     SESH_REQ_NONE,
     SESH_REQ_SAVE,
@@ -90,13 +107,55 @@ static char            s_errbuff[512] = {0};
 static bool            s_pushing = false;
 static uint64_t        s_change_tick = UINT64_MAX;
 
+static struct save_work s_save_work;
+
 static struct arg_desc s_saved_args;
 static char            s_saved_argv[MAX_ARGC + 1][128];
 
+static struct session_profile  s_save_profile;
+static struct session_profile  s_load_profile;
+static bool                    s_has_save_profile = false;
+static bool                    s_has_load_profile = false;
+/* The profile that sections are being recorded into, if any */
+static struct session_profile *s_profile = NULL;
+static int                     s_profile_depth = 0;
+static int                     s_open_sections[MAX_PROFILE_DEPTH];
+static int64_t                 s_open_offsets[MAX_PROFILE_DEPTH];
+static uint64_t                s_open_start[MAX_PROFILE_DEPTH];
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static double elapsed_ms(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void profile_begin(struct session_profile *profile)
+{
+    memset(profile, 0, sizeof(*profile));
+    s_profile_depth = 0;
+}
+
+static int profile_section_idx(const char *name, int depth)
+{
+    for(int i = 0; i < s_profile->nsections; i++) {
+        const struct session_section *curr = &s_profile->sections[i];
+        if(curr->depth == depth && !strcmp(curr->name, name))
+            return i;
+    }
+    if(s_profile->nsections == MAX_SESSION_SECTIONS)
+        return -1;
+
+    struct session_section *new = &s_profile->sections[s_profile->nsections];
+    pf_strlcpy(new->name, name, sizeof(new->name));
+    new->depth = depth;
+    new->ms = 0.0;
+    new->bytes = 0;
+    return s_profile->nsections++;
+}
+
 static void subsession_clear(void)
 {
     Sched_ClearState();
@@ -155,24 +214,30 @@ static bool subsession_save(SDL_RWops *stream)
 {
     subsession_flush();
 
+    Session_ProfileBegin("cursor", stream);
     if(!Cursor_SaveState(stream))
         return false;
+    Session_ProfileEnd(stream);
 
     /* First save the state of the map, lighting, camera, etc. (everything that 
      * isn't entities). Loading this state initalizes the session. */
+    Session_ProfileBegin("globals", stream);
     if(!G_SaveGlobalState(stream))
         return false;
+    Session_ProfileEnd(stream);
 
     /* All live entities have a scripting object associated with them. Loading the
      * scripting state will re-create all the entities. */
+    Session_ProfileBegin("script", stream);
     if(!S_SaveState(stream))
         return false;
+    Session_ProfileEnd(stream);
 
-    /* Roll forward the 'next_uid' so there's no collision with already loaded 
-     * entities (which preserve their UIDs from the old session) */
+    /* Save the UID slot high-water mark so there's no collision with already 
+     * loaded entities (which preserve their UIDs from the old session) */
     struct attr next_uid = (struct attr){
         .type = TYPE_INT,
-        .val.as_int = Entity_NewUID()
+        .val.as_int = Entity_NextUID()
     };
     if(!Attr_Write(stream, &next_uid, "next_uid"))
         return false;
@@ -180,40 +245,61 @@ static bool subsession_save(SDL_RWops *stream)
     /* After the entities are loaded, populate all the auxiliary entity state that
      * isn't visible via the scripting API. (animation context, pricise movement 
      * state, etc) */
+    Session_ProfileBegin("entities", stream);
     if(!G_SaveEntityState(stream))
         return false;
+    Session_ProfileEnd(stream);
 
+    Session_ProfileBegin("audio", stream);
     if(!Audio_SaveState(stream))
         return false;
+    Session_ProfileEnd(stream);
 
+    Session_ProfileBegin("projectiles", stream);
     if(!P_Projectile_SaveState(stream))
         return false;
+    Session_ProfileEnd(stream);
 
     return true;
 }
 
-static bool subsession_load(SDL_RWops *stream, char *errstr, size_t errlen)
+static bool subsession_load(SDL_RWops *stream, float version, char *errstr, size_t errlen)
 {
     struct attr attr;
     subsession_clear();
 
+    Session_ProfileBegin("cursor", stream);
     if(!Cursor_LoadState(stream)) {
         pf_snprintf(errstr, errlen, 
             "Could not de-serialize cursor state from session file");
         goto fail;
     }
+    Session_ProfileEnd(stream);
 
+    Session_ProfileBegin("globals", stream);
     if(!G_LoadGlobalState(stream)) {
         pf_snprintf(errstr, errlen, 
             "Could not de-serialize map and globals state from session file");
         goto fail;
     }
+    Session_ProfileEnd(stream);
 
+    Session_ProfileBegin("script", stream);
     if(!S_LoadState(stream)) {
-        pf_snprintf(errstr, errlen, 
-            "Could not de-serialize script-defined state from session file");
+        uint32_t conflict = Entity_TakeUIDConflict();
+        if(conflict != NULL_UID && version < PFSAVE_SLOT_UIDS_VERSION) {
+            pf_snprintf(errstr, errlen, 
+                "Session file version %.01f holds entity UID %u, which maps to the same slot "
+                "as another entity. Saves older than version %.01f with UIDs of %u or "
+                "greater cannot be loaded", version, conflict, PFSAVE_SLOT_UIDS_VERSION, 
+                ENTITY_UID_MAX_SLOTS);
+        }else{
+            pf_snprintf(errstr, errlen, 
+                "Could not de-serialize script-defined state from session file");
+        }
         goto fail;
     }
+    Session_ProfileEnd(stream);
 
     if(!Attr_Parse(stream, &attr, true) || attr.type != TYPE_INT) {
         pf_snprintf(errstr, errlen, 
@@ -223,23 +309,29 @@ static bool subsession_load(SDL_RWops *stream, char *errstr, size_t errlen)
     Entity_SetNextUID(attr.val.as_int);
     Sched_TryYield();
 
+    Session_ProfileBegin("entities", stream);
     if(!G_LoadEntityState(stream)) {
         pf_snprintf(errstr, errlen, 
             "Could not de-serialize additional entity state from session file");
         goto fail;
     }
+    Session_ProfileEnd(stream);
 
+    Session_ProfileBegin("audio", stream);
     if(!Audio_LoadState(stream)) {
         pf_snprintf(errstr, errlen, 
             "Could not de-serialize audio state from session file");
         goto fail;
     }
+    Session_ProfileEnd(stream);
 
+    Session_ProfileBegin("projectiles", stream);
     if(!P_Projectile_LoadState(stream)) {
         pf_snprintf(errstr, errlen, 
             "Could not de-serialize physics state from session file");
         goto fail;
     }
+    Session_ProfileEnd(stream);
 
     /* We may have loaded some assets during the session loading 
      * process - make sure the appropriate initialization is performed 
@@ -259,9 +351,12 @@ static bool session_load(const char *file, char *errstr, size_t errlen)
 {
     bool ret = false;
     struct attr attr;
+    uint64_t start = SDL_GetPerformanceCounter();
 
     vec_stream_t loaded;
     vec_stream_init(&loaded);
+    profile_begin(&s_load_profile);
+    s_has_load_profile = false;
 
     /* First save the current subsession to memory. If things go sour, we will roll back to it */
     SDL_RWops *current = PFSDL_VectorRWOps();
@@ -271,7 +366,7 @@ static bool session_load(const char *file, char *errstr, size_t errlen)
     assert(result);
     SDL_RWseek(current, 0, RW_SEEK_SET);
 
-    SDL_RWops *stream = SDL_RWFromFile(file, "r");
+    SDL_RWops *stream = SDL_RWFromFile(file, "rb");
     if(!stream) {
         pf_snprintf(errstr, errlen, "Could not open session file: %s", file);
         goto fail_stream;
@@ -282,6 +377,7 @@ static bool session_load(const char *file, char *errstr, size_t errlen)
         goto fail_parse;
     }
 
+    float version = attr.val.as_float;
     if(attr.val.as_float > PFSAVE_VERSION) {
         pf_snprintf(errstr, errlen, 
             "Incompatible save version: %.01f [Expecting %.01f or less]", 
@@ -294,11 +390,17 @@ static bool session_load(const char *file, char *errstr, size_t errlen)
         goto fail_parse;
     }
 
+    s_load_profile.file_bytes = SDL_RWsize(stream);
+
     for(int i = 0; i < attr.val.as_int; i++) {
     
-        if(!subsession_load(stream, errstr, errlen)) {
+        s_profile = &s_load_profile;
+        bool loaded_sub = subsession_load(stream, version, errstr, errlen);
+        s_profile = NULL;
+
+        if(!loaded_sub) {
 
-            bool result = subsession_load(current, errstr, errlen);
+            bool result = subsession_load(current, PFSAVE_VERSION, errstr, errlen);
             assert(result);
             goto fail_parse;
         }
@@ -322,6 +424,9 @@ static bool session_load(const char *file, char *errstr, size_t errlen)
     vec_stream_copy(&s_subsession_stack, &loaded);
     ret = true;
 
+    s_load_profile.total_ms = elapsed_ms(start);
+    s_has_load_profile = true;
+
 fail_parse:
     SDL_RWclose(stream);
 fail_stream:
@@ -341,7 +446,7 @@ static bool session_pop_subsession(char *errstr, size_t errlen)
     subsession_clear();
 
     SDL_RWops *stream = vec_stream_pop(&s_subsession_stack);
-    bool result = subsession_load(stream, errstr, errlen);
+    bool result = subsession_load(stream, PFSAVE_VERSION, errstr, errlen);
     assert(result);
 
     E_Global_Notify(EVENT_SESSION_POPPED, &s_saved_args, ES_ENGINE);
@@ -360,7 +465,7 @@ static bool session_pop_subsession_to_root(char *errstr, size_t errlen)
     subsession_save_args();
 
     SDL_RWops *stream = vec_AT(&s_subsession_stack, 0);
-    bool result = subsession_load(stream, errstr, errlen);
+    bool result = subsession_load(stream, PFSAVE_VERSION, errstr, errlen);
     assert(result);
 
     while(vec_size(&s_subsession_stack) > 0) {
@@ -393,7 +498,7 @@ static bool session_push_subsession(const char *script, char *errstr, size_t err
         argv[i] = s_argv[i];
 
     if(!S_RunFile(script, s_argc, argv)) {
-        result = subsession_load(stream, errstr, errlen);
+        result = subsession_load(stream, PFSAVE_VERSION, errstr, errlen);
         assert(result);
         SDL_RWclose(stream);
         goto out;
@@ -418,27 +523,89 @@ static bool session_exec_subsession(const char *script, char *errstr, size_t err
     return true;
 }
 
+static struct result session_write_task(void *arg)
+{
+    struct save_work *work = arg;
+    bool ret = false;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    SDL_RWops *stream = SDL_RWFromFile(work->path, "wb");
+    if(stream) {
+        const char *data = PFSDL_VectorRWOpsRaw(work->snapshot);
+        size_t size = SDL_RWsize(work->snapshot);
+        ret = (Task_Write(stream, data, size) == size);
+        ret = (SDL_RWclose(stream) == 0) && ret;
+    }
+    work->write_ms = elapsed_ms(start);
+
+    return (struct result) {
+        .type = RESULT_BOOL,
+        .val.as_bool = ret
+    };
+}
+
+static void session_finish_save(void)
+{
+    ASSERT_IN_MAIN_THREAD();
+    if(!s_save_work.pending)
+        return;
+
+    while(!Sched_FutureIsReady(&s_save_work.future)) {
+        Sched_RunSync(s_save_work.tid);
+    }
+
+    if(s_save_work.future.res.val.as_bool) {
+        s_save_profile.write_ms = s_save_work.write_ms;
+        s_has_save_profile = true;
+        E_Global_Notify(EVENT_SESSION_SAVED, NULL, ES_ENGINE);
+    }else{
+        pf_snprintf(s_errbuff, sizeof(s_errbuff), 
+            "Could not write session file: %s", s_save_work.path);
+        E_Global_Notify(EVENT_SESSION_FAIL_SAVE, s_errbuff, ES_ENGINE);
+    }
+
+    SDL_RWclose(s_save_work.snapshot);
+    s_save_work.snapshot = NULL;
+    s_save_work.pending = false;
+}
+
+/* The session is captured into memory at a tick boundary, which is all that 
+ * needs to happen synchronously. The file is written out by a background 
+ * task while the game keeps running, and the 'saved' event is only sent 
+ * once it has been fully written. */
 static bool session_save(const char *file, char* errstr, size_t errlen)
 {
-    SDL_RWops *stream = SDL_RWFromFile(file, "w");
+    session_finish_save();
+    uint64_t start = SDL_GetPerformanceCounter();
+    profile_begin(&s_save_profile);
+    s_has_save_profile = false;
+
+    SDL_RWops *stream = PFSDL_VectorRWOps();
     if(!stream) {
-        pf_snprintf(errstr, errlen, "Could not open session file: %s", file);
+        pf_snprintf(errstr, errlen, "Could not allocate session snapshot");
         goto fail_stream;
     }
 
+    /* Size the buffer for the (typically similar) previous save */
+    size_t hint = 0;
+    for(int i = 0; i < vec_size(&s_subsession_stack); i++) {
+        hint += SDL_RWsize(vec_AT(&s_subsession_stack, i));
+    }
+    PFSDL_VectorRWOpsReserve(stream, hint * 2);
+
     struct attr version = (struct attr){
         .type = TYPE_FLOAT,
         .val.as_float = PFSAVE_VERSION
     };
     if(!Attr_Write(stream, &version, "version"))
-        return false;
+        goto fail_save;
 
     struct attr num_subsessions = (struct attr){
         .type = TYPE_INT,
         .val.as_int = 1 + vec_size(&s_subsession_stack)
     };
     if(!Attr_Write(stream, &num_subsessions, "num_subsessions"))
-        return false;
+        goto fail_save;
 
     for(int i = 0; i < vec_size(&s_subsession_stack); i++) {
 
@@ -450,10 +617,29 @@ static bool session_save(const char *file, char* errstr, size_t errlen)
 
     Sched_TryYield();
 
-    if(!subsession_save(stream))
+    s_profile = &s_save_profile;
+    bool saved = subsession_save(stream);
+    s_profile = NULL;
+
+    if(!saved) {
+        pf_snprintf(errstr, errlen, "Could not serialize session state");
         goto fail_save;
+    }
 
-    SDL_RWclose(stream);
+    s_save_profile.file_bytes = SDL_RWsize(stream);
+    s_save_profile.total_ms = elapsed_ms(start);
+
+    pf_strlcpy(s_save_work.path, file, sizeof(s_save_work.path));
+    s_save_work.snapshot = stream;
+    s_save_work.pending = true;
+    s_save_work.tid = Sched_Create(SCHED_PRIO_BACKGROUND, session_write_task, 
+        &s_save_work, &s_save_work.future, 0);
+
+    if(s_save_work.tid == NULL_TID) {
+        /* Fall back to writing the file ourselves */
+        s_save_work.future.res = session_write_task(&s_save_work);
+        SDL_AtomicSet(&s_save_work.future.status, FUTURE_COMPLETE);
+    }
     return true;
 
 fail_save:
@@ -467,6 +653,11 @@ static struct result session_task(void* arg)
     ASSERT_IN_MAIN_THREAD();
     bool result = false;
 
+    /* A prior save may still be getting written. Make sure it is complete 
+     * before we could possibly be reading it back or clearing the state 
+     * of the scheduler. */
+    session_finish_save();
+
     switch(s_current) {
     case SESH_REQ_SAVE:
         result = session_save(s_req_path, s_errbuff, sizeof(s_errbuff));
@@ -496,9 +687,10 @@ static struct result session_task(void* arg)
     int failure_event = (s_current == SESH_REQ_SAVE) ? EVENT_SESSION_FAIL_SAVE 
                                                      : EVENT_SESSION_FAIL_LOAD;
 
-    if(result) {
+    /* The 'saved' event is sent once the file has been written */
+    if(result && s_current != SESH_REQ_SAVE) {
         E_Global_Notify(success_event, NULL, ES_ENGINE);
-    }else {
+    }else if(!result) {
         E_Global_Notify(failure_event, s_errbuff, ES_ENGINE);
     }
 
@@ -570,6 +762,10 @@ void Session_RequestPopToRoot(int argc, char **argv)
 
 bool Session_ServiceRequests(struct future *result)
 {
+    if(s_save_work.pending && Sched_FutureIsReady(&s_save_work.future)) {
+        session_finish_save();
+    }
+
     if(s_request == SESH_REQ_NONE)
         return false;
 
@@ -595,6 +791,48 @@ uint64_t Session_ChangeTick(void)
     return s_change_tick;
 }
 
+void Session_ProfileBegin(const char *name, SDL_RWops *stream)
+{
+    ASSERT_IN_MAIN_THREAD();
+    if(!s_profile)
+        return;
+
+    int depth = s_profile_depth++;
+    if(depth >= MAX_PROFILE_DEPTH)
+        return;
+
+    s_open_sections[depth] = profile_section_idx(name, depth);
+    s_open_offsets[depth] = SDL_RWtell(stream);
+    s_open_start[depth] = SDL_GetPerformanceCounter();
+}
+
+void Session_ProfileEnd(SDL_RWops *stream)
+{
+    ASSERT_IN_MAIN_THREAD();
+    if(!s_profile)
+        return;
+
+    assert(s_profile_depth > 0);
+    int depth = --s_profile_depth;
+    if(depth >= MAX_PROFILE_DEPTH || s_open_sections[depth] < 0)
+        return;
+
+    struct session_section *section = &s_profile->sections[s_open_sections[depth]];
+    section->ms += elapsed_ms(s_open_start[depth]);
+    section->bytes += SDL_RWtell(stream) - s_open_offsets[depth];
+}
+
+bool Session_GetProfile(bool save, struct session_profile *out)
+{
+    if(save && !s_has_save_profile)
+        return false;
+    if(!save && !s_has_load_profile)
+        return false;
+
+    *out = save ? s_save_profile : s_load_profile;
+    return true;
+}
+
 bool Session_Init(void)
 {
     vec_stream_init(&s_subsession_stack);
@@ -605,6 +843,14 @@ bool Session_Init(void)
 
 void Session_Shutdown(void)
 {
+    if(s_save_work.pending) {
+        while(!Sched_FutureIsReady(&s_save_work.future)) {
+            Sched_RunSync(s_save_work.tid);
+        }
+        SDL_RWclose(s_save_work.snapshot);
+        s_save_work.pending = false;
+    }
+
     while(vec_size(&s_subsession_stack) > 0) {
         SDL_RWops *stream = vec_stream_pop(&s_subsession_stack);
         SDL_RWclose(stream);
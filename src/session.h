@@ -40,6 +40,7 @@
 #include <stdint.h>
 
 #define MAX_ARGC (32)
+#define MAX_SESSION_SECTIONS (32)
 
 
 struct SDL_RWops;
@@ -50,6 +51,26 @@ struct arg_desc{
     char *argv[MAX_ARGC + 1];
 };
 
+/* A part of the serialized session state. Sections can be nested, in which 
+ * case the time and bytes of the child are included in those of the parent. */
+struct session_section{
+    char     name[32];
+    int      depth;
+    double   ms;
+    uint64_t bytes;
+};
+
+/* The breakdown of the most recent save or load. The times are wall-clock, 
+ * and so include any time spent running other work when the session task 
+ * yields. For loads with multiple subsessions, the sections are summed. */
+struct session_profile{
+    double                 total_ms;    /* serializing or de-serializing the session */
+    double                 write_ms;    /* writing the file out in the background (saves only) */
+    uint64_t               file_bytes;
+    int                    nsections;
+    struct session_section sections[MAX_SESSION_SECTIONS];
+};
+
 bool     Session_Init(void);
 void     Session_Shutdown(void);
 bool     Session_ServiceRequests(struct future *result);
@@ -64,5 +85,12 @@ void     Session_RequestExec(const char *script, int argc, char **argv);
 int      Session_StackDepth(void);
 uint64_t Session_ChangeTick(void);
 
+/* Mark the parts of the state written to or read from the stream, so that 
+ * they are broken out in the profile. This is a no-op outside of a session 
+ * save or load. */
+void     Session_ProfileBegin(const char *name, struct SDL_RWops *stream);
+void     Session_ProfileEnd(struct SDL_RWops *stream);
+bool     Session_GetProfile(bool save, struct session_profile *out);
+
 #endif
 
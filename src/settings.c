@@ -60,8 +60,10 @@ struct named_val{
 /* Additional private metadata associated 
  * with every setting */
 struct setting_priv{
-    uint32_t    flags;
-    struct sval prev;
+    uint32_t     flags;
+    struct sval  prev;
+    int          nbinds;
+    struct sval *binds[SETT_MAX_BINDS];
 };
 
 KHASH_MAP_INIT_STR(setting, struct setting)
@@ -177,6 +179,16 @@ static struct setting_priv sett_get_priv(const char *name)
     return kh_value(s_priv_table, k);
 }
 
+static void sett_update_binds(const char *name, const struct sval *val)
+{
+    khiter_t k = kh_get(settpriv, s_priv_table, name);
+    assert(k != kh_end(s_priv_table));
+    struct setting_priv *priv = &kh_value(s_priv_table, k);
+    for(int i = 0; i < priv->nbinds; i++) {
+        *priv->binds[i] = *val;
+    }
+}
+
 static int compare_strings(const void* a, const void* b)
 {
     const char *stra = *(const char **)a;
@@ -257,6 +269,7 @@ ss_e Settings_Create(struct setting sett)
         sett.commit(&sett.val);
 
     sett_priv_clear(sett.name);;
+    sett_update_binds(sett.name, &sett.val);
     return SS_OKAY;
 }
 
@@ -268,6 +281,12 @@ ss_e Settings_Delete(const char *name)
     if(k == kh_end(s_settings_table))
         return SS_NO_SETTING;
 
+    /* The private entry shares the key string */
+    khiter_t pk = kh_get(settpriv, s_priv_table, name);
+    if(pk != kh_end(s_priv_table)) {
+        kh_del(settpriv, s_priv_table, pk);
+    }
+
     free((char*)kh_key(s_settings_table, k));
     kh_del(setting, s_settings_table, k);
     return SS_OKAY; 
@@ -285,6 +304,47 @@ ss_e Settings_Get(const char *name, struct sval *out)
     return SS_OKAY;
 }
 
+ss_e Settings_Bind(const char *name, struct sval *out)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    khiter_t k = kh_get(setting, s_settings_table, name);
+    if(k == kh_end(s_settings_table))
+        return SS_NO_SETTING;
+
+    khiter_t pk = kh_get(settpriv, s_priv_table, name);
+    assert(pk != kh_end(s_priv_table));
+    struct setting_priv *priv = &kh_value(s_priv_table, pk);
+
+    *out = kh_value(s_settings_table, k).val;
+    for(int i = 0; i < priv->nbinds; i++) {
+        if(priv->binds[i] == out)
+            return SS_OKAY;
+    }
+    if(priv->nbinds == SETT_MAX_BINDS)
+        return SS_BADALLOC;
+
+    priv->binds[priv->nbinds++] = out;
+    return SS_OKAY;
+}
+
+void Settings_Unbind(const char *name, struct sval *out)
+{
+    ASSERT_IN_MAIN_THREAD();
+
+    khiter_t pk = kh_get(settpriv, s_priv_table, name);
+    if(pk == kh_end(s_priv_table))
+        return;
+
+    struct setting_priv *priv = &kh_value(s_priv_table, pk);
+    for(int i = 0; i < priv->nbinds; i++) {
+        if(priv->binds[i] != out)
+            continue;
+        priv->binds[i] = priv->binds[--priv->nbinds];
+        return;
+    }
+}
+
 ss_e Settings_Set(const char *name, const struct sval *new_val)
 {
     ASSERT_IN_MAIN_THREAD();
@@ -303,6 +363,7 @@ ss_e Settings_Set(const char *name, const struct sval *new_val)
         sett->commit(new_val);
         
     sett_priv_clear(sett->name);
+    sett_update_binds(sett->name, new_val);
     return SS_OKAY;
 }
 
@@ -321,6 +382,7 @@ ss_e Settings_SetNoValidate(const char *name, const struct sval *new_val)
         sett->commit(new_val);
         
     sett_priv_clear(sett->name);
+    sett_update_binds(sett->name, new_val);
     return SS_OKAY;
 }
 
@@ -345,10 +407,10 @@ ss_e Settings_SetNoPersist(const char *name, const struct sval *new_val)
     khiter_t k = kh_get(setting, s_settings_table, name);
     struct setting *sett = &kh_value(s_settings_table, k);
 
-    sett_set_priv(sett->name, (struct setting_priv){
-        .flags = SETT_FLAGS_NOPERSIST,
-        .prev = prev
-    });
+    priv = sett_get_priv(sett->name);
+    priv.flags = SETT_FLAGS_NOPERSIST;
+    priv.prev = prev;
+    sett_set_priv(sett->name, priv);
     return ret;
 }
 
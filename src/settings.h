@@ -41,8 +41,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#define SETT_NAME_LEN 128
-#define SETT_MAX_PRIO 2
+#define SETT_NAME_LEN   128
+#define SETT_MAX_PRIO   2
+#define SETT_MAX_BINDS  4
 
 struct sval{
     enum{
@@ -96,6 +97,12 @@ ss_e Settings_Create(struct setting sett);
 ss_e Settings_Delete(const char *name);
 
 ss_e Settings_Get(const char *name, struct sval *out);
+/* Keep '*out' in sync with the value of the setting, so that hot paths can 
+ * read the cached value directly instead of looking the setting up by name. 
+ * The value is copied right away and on every subsequent update. 'out' must 
+ * remain valid until it is unbound or the setting is deleted. */
+ss_e Settings_Bind(const char *name, struct sval *out);
+void Settings_Unbind(const char *name, struct sval *out);
 ss_e Settings_Set(const char *name, const struct sval *new_val);
 ss_e Settings_SetNoValidate(const char *name, const struct sval *new_val);
 /* The new value is not written to the settings file. Until it is overwritten 
@@ -38,7 +38,6 @@
 #include "event.h"
 #include "main.h"
 #include "lib/public/pf_string.h"
-#include "lib/public/pqueue.h"
 #include "lib/public/queue.h"
 #include "lib/public/khash.h"
 
@@ -49,19 +48,6 @@
 #include <windows.h>
 #endif
 
-struct delay_desc{
-    uint32_t tid;
-    uint32_t wake_tick;
-};
-
-struct ts_req{
-    enum{
-        TS_REQ_NOTIFY, 
-        TS_REQ_DELAY,
-    }type;
-    uint32_t ticks;
-};
-
 struct ns_req{
     enum{
         NS_REQ_REGISTER,
@@ -75,9 +61,6 @@ struct ns_req{
 QUEUE_TYPE(tid, uint32_t)
 QUEUE_IMPL(static, tid, uint32_t)
 
-PQUEUE_TYPE(delay, struct delay_desc)
-PQUEUE_IMPL(static, delay, struct delay_desc)
-
 KHASH_MAP_INIT_STR(tid, uint32_t)
 KHASH_MAP_INIT_STR(tidq, queue_tid_t)
 
@@ -91,79 +74,11 @@ struct ns_state{
 /*****************************************************************************/
 
 static uint32_t s_ns_tid; /* write-once */
-static uint32_t s_ts_tid; /* write-once */
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static struct result tick_notifier(void *arg)
-{
-    uint32_t ts_tid = Task_ParentTid();
-    struct ts_req request = (struct ts_req){ .type = TS_REQ_NOTIFY };
-    int resp, source;
-
-    while(1) {
-        Task_AwaitEvent(EVENT_60HZ_TICK, &source);
-        Task_Send(ts_tid, &request, sizeof(request), &resp, sizeof(resp));
-    }
-    return NULL_RESULT;
-}
-
-static void timeserver_exit(void *arg)
-{
-    pq_delay_t *pq = (pq_delay_t*)arg;
-    pq_delay_destroy(pq);
-}
-
-static struct result timeserver_task(void *arg)
-{
-    pq_delay_t descs;
-    pq_delay_init(&descs);
-    Task_SetDestructor(timeserver_exit, &descs);
-
-    struct future res;
-    uint32_t notifier = Task_Create(0, tick_notifier, NULL, &res, 0);
-
-    while(1) {
-        struct ts_req request;
-        uint32_t tid;
-        int reply = 0;
-
-        Task_Receive(&tid, &request, sizeof(request));
-        uint32_t curr_tick = SDL_GetTicks();
-
-        switch(request.type) {
-        case TS_REQ_NOTIFY:
-            Task_Reply(tid, &reply, sizeof(reply));
-            break;
-        case TS_REQ_DELAY: {
-            struct delay_desc dd = (struct delay_desc){
-                .tid = tid,
-                .wake_tick = curr_tick + request.ticks
-            };
-            pq_delay_push(&descs, dd.wake_tick, dd);
-            break;
-        }
-        default: assert(0);
-        }
-
-        /* Check if any tasks need waking */
-        struct delay_desc curr;
-        do{
-            if(!pq_delay_pop(&descs, &curr))
-                break;
-            if(curr.wake_tick > curr_tick) {
-                pq_delay_push(&descs, curr.wake_tick, curr);
-            }else{
-                Task_Reply(curr.tid, &reply, sizeof(reply));
-            }
-        }while(curr.wake_tick <= curr_tick);
-    }
-
-    return NULL_RESULT;
-}
-
 static void nameserver_exit(void *arg)
 {
     struct ns_state *state = (struct ns_state*)arg;
@@ -376,12 +291,7 @@ bool Task_Wait(uint32_t tid)
 
 void Task_Sleep(int ms)
 {
-    struct ts_req tr = (struct ts_req){
-        .type = TS_REQ_DELAY,
-        .ticks = ms
-    };
-    int resp;
-    Task_Send(s_ts_tid, &tr, sizeof(tr), &resp, sizeof(resp));
+    Sched_SleepMs(ms > 0 ? ms : 0);
 }
 
 void Task_Register(const char *name)
@@ -403,6 +313,105 @@ void Task_Unregister(void)
     Task_Send(s_ns_tid, &nr, sizeof(nr), &resp, sizeof(resp));
 }
 
+void Task_ChanSend(struct sched_chan *chan, const void *elem)
+{
+    /* There is no wait list for producers - a full channel is expected to be 
+     * drained shortly by the consumer, so just give up the thread and retry. */
+    while(!Sched_ChanTrySend(chan, elem)) {
+        Task_Yield();
+    }
+}
+
+void Task_ChanRecv(struct sched_chan *chan, void *out)
+{
+    while(!Sched_ChanTryRecv(chan, out)) {
+        Sched_Request((struct request){
+            .type = SCHED_REQ_CHAN_WAIT,
+            .argv[0] = (uint64_t)chan,
+        });
+    }
+}
+
+static void task_sync_wait(struct sched_waitq *wq, SDL_atomic_t *addr, int expected)
+{
+    Sched_Request((struct request){
+        .type = SCHED_REQ_SYNC_WAIT,
+        .argv[0] = (uint64_t)wq,
+        .argv[1] = (uint64_t)addr,
+        .argv[2] = (uint64_t)expected,
+    });
+}
+
+void Task_MutexLock(struct sched_mutex *mutex)
+{
+    if(SDL_AtomicCAS(&mutex->state, 0, 1))
+        return;
+
+    /* Mark the mutex as contended, such that the owner will wake us 
+     * up when it releases it */
+    while(SDL_AtomicSet(&mutex->state, 2) != 0) {
+        task_sync_wait(&mutex->wq, &mutex->state, 2);
+    }
+}
+
+void Task_RWLockRead(struct sched_rwlock *lock)
+{
+    while(!Sched_RWLockTryRead(lock)) {
+        task_sync_wait(&lock->wq, &lock->state, -1);
+    }
+}
+
+void Task_RWLockWrite(struct sched_rwlock *lock)
+{
+    while(!Sched_RWLockTryWrite(lock)) {
+        int state = SDL_AtomicGet(&lock->state);
+        if(state == 0)
+            continue;
+        task_sync_wait(&lock->wq, &lock->state, state);
+    }
+}
+
+void Task_SemWait(struct sched_sem *sem)
+{
+    while(!Sched_SemTryWait(sem)) {
+        task_sync_wait(&sem->wq, &sem->count, 0);
+    }
+}
+
+void Task_WaitGroupWait(struct sched_waitgroup *wg)
+{
+    int count;
+    while((count = SDL_AtomicGet(&wg->count)) > 0) {
+        task_sync_wait(&wg->wq, &wg->count, count);
+    }
+}
+
+size_t Task_Read(SDL_RWops *stream, void *buff, size_t size)
+{
+    if(Sched_ActiveTID() == NULL_TID)
+        return SDL_RWread(stream, buff, 1, size);
+
+    return Sched_Request((struct request){
+        .type = SCHED_REQ_READ,
+        .argv[0] = (uint64_t)stream,
+        .argv[1] = (uint64_t)buff,
+        .argv[2] = (uint64_t)size,
+    });
+}
+
+size_t Task_Write(SDL_RWops *stream, const void *buff, size_t size)
+{
+    if(Sched_ActiveTID() == NULL_TID)
+        return SDL_RWwrite(stream, buff, 1, size);
+
+    return Sched_Request((struct request){
+        .type = SCHED_REQ_WRITE,
+        .argv[0] = (uint64_t)stream,
+        .argv[1] = (uint64_t)buff,
+        .argv[2] = (uint64_t)size,
+    });
+}
+
 uint32_t Task_WhoIs(const char *name, bool blocking)
 {
     struct ns_req nr = (struct ns_req){
@@ -419,6 +428,5 @@ void Task_CreateServices(void)
 {
     ASSERT_IN_MAIN_THREAD();
     s_ns_tid = Sched_Create(0, nameserver_task, NULL, NULL, 0);
-    s_ts_tid = Sched_Create(0, timeserver_task, NULL, NULL, 0);
 }
 
@@ -42,6 +42,12 @@
 
 struct taskret;
 struct future;
+struct sched_chan;
+struct sched_mutex;
+struct sched_rwlock;
+struct sched_sem;
+struct sched_waitgroup;
+struct SDL_RWops;
 
 typedef struct result (*task_t)(void *);
 
@@ -62,6 +68,55 @@ void     Task_Sleep(int ms);
 void     Task_Register(const char *name);
 void     Task_Unregister(void);
 uint32_t Task_WhoIs(const char *name, bool blocking);
+void     Task_ChanSend(struct sched_chan *chan, const void *elem);
+void     Task_ChanRecv(struct sched_chan *chan, void *out);
+void     Task_MutexLock(struct sched_mutex *mutex);
+void     Task_RWLockRead(struct sched_rwlock *lock);
+void     Task_RWLockWrite(struct sched_rwlock *lock);
+void     Task_SemWait(struct sched_sem *sem);
+void     Task_WaitGroupWait(struct sched_waitgroup *wg);
+/* The I/O is carried out by the scheduler's I/O threads while the task 
+ * is blocked, so that the worker is free to run other tasks. Outside of 
+ * task context, the I/O is done synchronously on the calling thread. 
+ * Return the number of bytes transferred. */
+size_t   Task_Read(struct SDL_RWops *stream, void *buff, size_t size);
+size_t   Task_Write(struct SDL_RWops *stream, const void *buff, size_t size);
+
+/* Defines a type-safe wrapper around a channel of 'type' elements. 
+ * The blocking send and receive may only be called from task context, 
+ * the rest may be called from any context.
+ */
+#define CHAN_TYPE(name, type)                                                               \
+    typedef struct chan_##name##_s{                                                         \
+        struct sched_chan chan;                                                             \
+    }chan_##name##_t;                                                                       \
+                                                                                            \
+    static inline bool chan_##name##_init(chan_##name##_t *ch, size_t capacity)             \
+    {                                                                                       \
+        return Sched_ChanInit(&ch->chan, sizeof(type), capacity);                           \
+    }                                                                                       \
+    static inline void chan_##name##_destroy(chan_##name##_t *ch)                           \
+    {                                                                                       \
+        Sched_ChanDestroy(&ch->chan);                                                       \
+    }                                                                                       \
+    static inline bool chan_##name##_try_send(chan_##name##_t *ch, type elem)               \
+    {                                                                                       \
+        return Sched_ChanTrySend(&ch->chan, &elem);                                         \
+    }                                                                                       \
+    static inline bool chan_##name##_try_recv(chan_##name##_t *ch, type *out)               \
+    {                                                                                       \
+        return Sched_ChanTryRecv(&ch->chan, out);                                           \
+    }                                                                                       \
+    static inline void chan_##name##_send(chan_##name##_t *ch, type elem)                   \
+    {                                                                                       \
+        Task_ChanSend(&ch->chan, &elem);                                                    \
+    }                                                                                       \
+    static inline type chan_##name##_recv(chan_##name##_t *ch)                              \
+    {                                                                                       \
+        type ret;                                                                           \
+        Task_ChanRecv(&ch->chan, &ret);                                                     \
+        return ret;                                                                         \
+    }
 
 /* The following may only be called from the main thread */
 
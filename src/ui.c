@@ -64,7 +64,14 @@ struct text_desc{
 VEC_TYPE(td, struct text_desc)
 VEC_IMPL(static inline, td, struct text_desc)
 
-KHASH_MAP_INIT_STR(font, struct nk_font*)
+/* The fonts in the fonts directory are only baked into the atlas once 
+ * they are first made active. */
+struct font_entry{
+    struct nk_font *font;
+    bool            wanted;
+};
+
+KHASH_MAP_INIT_STR(font, struct font_entry)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -76,6 +83,11 @@ static struct nk_draw_null_texture  s_null;
 static vec_td_t                     s_curr_frame_labels;
 static khash_t(font)               *s_fontmap;
 static const char                  *s_active_font = NULL;
+/* Set when a font that is not yet in the atlas is made active. It is 
+ * applied once the atlas is re-baked at the start of the next frame, 
+ * since the current frame's commands still reference the old atlas. */
+static const char                  *s_pending_font = NULL;
+static bool                         s_atlas_dirty = false;
 static SDL_mutex                   *s_lock;
 static vec2_t                       s_vres = {1920, 1080};
 
@@ -233,83 +245,96 @@ static void *push_draw_list(const struct nk_draw_list *dl)
 {
     struct nk_draw_list *st_dl = R_PushArg(dl, sizeof(struct nk_draw_list));
 
+    /* The draw commands are allocated from the back of the buffer */
     void *st_cmdbuff = R_PushArg(dl->buffer->memory.ptr, dl->buffer->memory.size);
-    void *st_vbuff = R_PushArg(dl->vertices->memory.ptr, dl->vertices->memory.size);
-    void *st_ebuff = R_PushArg(dl->elements->memory.ptr, dl->elements->memory.size);
-
     st_dl->buffer = R_PushArg(dl->buffer, sizeof(struct nk_buffer));
     st_dl->buffer->memory.ptr = st_cmdbuff;
+
+    /* The vertex and element buffers are already allocated from the 
+     * simulation workspace which gets handed off to the render thread,
+     * so they don't need to be copied. Trim them to the used portion 
+     * so that only the converted geometry is uploaded. */
     st_dl->vertices = R_PushArg(dl->vertices, sizeof(struct nk_buffer));
-    st_dl->vertices->memory.ptr = st_vbuff;
+    st_dl->vertices->memory.size = dl->vertices->allocated;
     st_dl->elements = R_PushArg(dl->elements, sizeof(struct nk_buffer));
-    st_dl->elements->memory.ptr = st_ebuff;
+    st_dl->elements->memory.size = dl->elements->allocated;
 
     return st_dl;
 }
 
-static void ui_init_font_stash(struct nk_context *ctx)
+static void ui_font_dir(char *out, size_t size)
 {
-    const void *image; 
-    int w, h;
+    pf_snprintf(out, size, "%s/%s", g_basepath, "assets/fonts");
+}
 
+static struct nk_font *ui_load_font(const char *name)
+{
     char fontdir[NK_MAX_PATH_LEN];
-    pf_snprintf(fontdir, sizeof(fontdir), "%s/%s", g_basepath, "assets/fonts");
+    ui_font_dir(fontdir, sizeof(fontdir));
+
+    char path[NK_MAX_PATH_LEN];
+    pf_snprintf(path, sizeof(path), "%s/%s", fontdir, name);
+
+    static const nk_rune glyph_ranges[] = {
+        /* English */
+        0x0020, 0x00FF,
+        /* Chinese */
+        0x3000, 0x30FF,
+        0x31F0, 0x31FF,
+        0xFF00, 0xFFEF,
+        0x4e00, 0x9FAF,
+        /* Cyrillic */
+        0x0400, 0x052F,
+        0x2DE0, 0x2DFF,
+        0xA640, 0xA69F,
+        /* Terminator */
+        0
+    };
+    struct nk_font_config config = nk_font_config(16);
+    config.oversample_h = 1;
+    config.oversample_v = 1;
+    config.range = glyph_ranges;
 
+    return nk_font_atlas_add_from_file(&s_atlas, path, 16, &config);
+}
+
+/* (Re-)build the atlas from the default font and all the fonts that have 
+ * been made active so far. All the previous font pointers are invalidated.
+ */
+static void ui_bake_atlas(bool initial)
+{
+    const void *image; 
+    int w, h;
+
+    if(!initial) {
+        nk_font_atlas_clear(&s_atlas);
+    }
     nk_font_atlas_init_default(&s_atlas);
     nk_font_atlas_begin(&s_atlas);
 
     s_atlas.default_font = nk_font_atlas_add_default(&s_atlas, 16, NULL);
 
-    int result;
-    khiter_t k = kh_put(font, s_fontmap, pf_strdup("__default__"), &result);
-    assert(result != -1 && result != 0);
-    kh_value(s_fontmap, k) = s_atlas.default_font;
-    s_active_font = kh_key(s_fontmap, k);
-
-    size_t nfiles = 0;
-    struct file *files = nk_file_list(fontdir, &nfiles);
-
-    for(int i = 0; i < nfiles; i++) {
+    for(khiter_t k = kh_begin(s_fontmap); k != kh_end(s_fontmap); k++) {
 
-        if(files[i].is_dir)
-            continue;
-        if(!pf_endswith(files[i].name, ".ttf"))
+        if(!kh_exist(s_fontmap, k))
             continue;
 
-        char path[NK_MAX_PATH_LEN];
-        pf_snprintf(path, sizeof(path), "%s/%s", fontdir, files[i].name);
-
-        static const nk_rune glyph_ranges[] = {
-            /* English */
-            0x0020, 0x00FF,
-            /* Chinese */
-            0x3000, 0x30FF,
-            0x31F0, 0x31FF,
-            0xFF00, 0xFFEF,
-            0x4e00, 0x9FAF,
-            /* Cyrillic */
-            0x0400, 0x052F,
-            0x2DE0, 0x2DFF,
-            0xA640, 0xA69F,
-            /* Terminator */
-            0
-        };
-        struct nk_font_config config = nk_font_config(16);
-        config.oversample_h = 1;
-        config.oversample_v = 1;
-        config.range = glyph_ranges;
+        const char *name = kh_key(s_fontmap, k);
+        struct font_entry *entry = &kh_value(s_fontmap, k);
 
-        struct nk_font *font = nk_font_atlas_add_from_file(&s_atlas, path, 16, &config);
-        if(!font)
+        if(!strcmp(name, "__default__")) {
+            entry->font = s_atlas.default_font;
+            continue;
+        }
+        entry->font = NULL;
+        if(!entry->wanted)
             continue;
 
-        int result;
-        khiter_t k = kh_put(font, s_fontmap, pf_strdup(files[i].name), &result);
-        assert(result != -1 && result != 0);
-        kh_value(s_fontmap, k) = font;
+        /* Fonts that fail to load are no longer requested */
+        entry->font = ui_load_font(name);
+        entry->wanted = (entry->font != NULL);
     }
 
-    PF_FREE(files);
     image = nk_font_atlas_bake(&s_atlas, &w, &h, NK_FONT_ATLAS_RGBA32);
 
     R_PushCmd((struct rcmd){
@@ -322,10 +347,65 @@ static void ui_init_font_stash(struct nk_context *ctx)
         },
     });
 
-    Engine_FlushRenderWorkQueue();
+    /* The texture is only created on the first upload and is re-used 
+     * afterwards, so only the initial bake needs to wait for its' ID. */
+    if(initial) {
+        Engine_FlushRenderWorkQueue();
+    }
 
     nk_font_atlas_end(&s_atlas, nk_handle_id(R_UI_GetFontTexID()), &s_null);
-    nk_style_set_font(ctx, &s_atlas.default_font->handle);
+    s_atlas_dirty = false;
+}
+
+static void ui_apply_active_font(struct nk_context *ctx)
+{
+    if(s_pending_font) {
+        khiter_t k = kh_get(font, s_fontmap, s_pending_font);
+        assert(k != kh_end(s_fontmap));
+        if(kh_value(s_fontmap, k).font) {
+            s_active_font = s_pending_font;
+        }
+        s_pending_font = NULL;
+    }
+
+    khiter_t k = kh_get(font, s_fontmap, s_active_font);
+    assert(k != kh_end(s_fontmap));
+    assert(kh_value(s_fontmap, k).font);
+    nk_style_set_font(ctx, &kh_value(s_fontmap, k).font->handle);
+}
+
+static void ui_init_font_stash(struct nk_context *ctx)
+{
+    char fontdir[NK_MAX_PATH_LEN];
+    ui_font_dir(fontdir, sizeof(fontdir));
+
+    int result;
+    khiter_t k = kh_put(font, s_fontmap, pf_strdup("__default__"), &result);
+    assert(result != -1 && result != 0);
+    kh_value(s_fontmap, k) = (struct font_entry){NULL, true};
+    s_active_font = kh_key(s_fontmap, k);
+
+    /* Only the names of the installed fonts are recorded up-front. The 
+     * fonts are loaded the first time they are made active. */
+    size_t nfiles = 0;
+    struct file *files = nk_file_list(fontdir, &nfiles);
+
+    for(int i = 0; i < nfiles; i++) {
+
+        if(files[i].is_dir)
+            continue;
+        if(!pf_endswith(files[i].name, ".ttf"))
+            continue;
+
+        int result;
+        khiter_t k = kh_put(font, s_fontmap, pf_strdup(files[i].name), &result);
+        assert(result != -1 && result != 0);
+        kh_value(s_fontmap, k) = (struct font_entry){NULL, false};
+    }
+    PF_FREE(files);
+
+    ui_bake_atlas(true);
+    ui_apply_active_font(ctx);
 }
 
 static void ui_clipboard_paste(nk_handle usr, struct nk_text_edit *edit)
@@ -358,9 +438,9 @@ static struct nk_vec2i ui_get_drawable_size(void)
 
 static struct nk_vec2i ui_get_screen_size(void)
 {
-    SDL_DisplayMode dm;
-    SDL_GetDesktopDisplayMode(0, &dm);
-    return (struct nk_vec2i){dm.w, dm.h};
+    int w, h;
+    Engine_DesktopRes(&w, &h);
+    return (struct nk_vec2i){w, h};
 }
 
 static void ui_render(void *user, void *event)
@@ -457,7 +537,7 @@ void UI_Shutdown(void)
     SDL_DestroyMutex(s_lock);
 
     const char *key;
-    struct nk_font *curr;
+    struct font_entry curr;
     (void)curr;
 
     kh_foreach(s_fontmap, key, curr, { free((void*)key); });
@@ -468,6 +548,11 @@ void UI_Shutdown(void)
 
 void UI_InputBegin(void)
 {
+    /* None of the previous frame's commands are alive at this point */
+    if(s_atlas_dirty) {
+        ui_bake_atlas(false);
+        ui_apply_active_font(&s_ctx);
+    }
     nk_input_begin(&s_ctx);
 }
 
@@ -636,6 +721,8 @@ struct nk_context *UI_GetContext(void)
 const char *UI_GetActiveFont(void)
 {
     assert(s_active_font);
+    if(s_pending_font)
+        return s_pending_font;
     return s_active_font;
 }
 
@@ -645,10 +732,18 @@ bool UI_SetActiveFont(const char *name)
     if(k == kh_end(s_fontmap))
         return false;
 
-    struct nk_user_font *uf = &kh_value(s_fontmap, k)->handle;
-    nk_style_set_font(&s_ctx, uf);
+    struct font_entry *entry = &kh_value(s_fontmap, k);
+    if(!entry->font) {
+        /* Keep drawing with the current font until the atlas is re-baked */
+        entry->wanted = true;
+        s_pending_font = kh_key(s_fontmap, k);
+        s_atlas_dirty = true;
+        return true;
+    }
 
+    nk_style_set_font(&s_ctx, &entry->font->handle);
     s_active_font = kh_key(s_fontmap, k);
+    s_pending_font = NULL;
     return true;
 }
 